@@ -0,0 +1,353 @@
+/*
+ * Raw CAN frame and ISO-TP response capture
+ *
+ * Records frames and reassembled responses with timestamps into a PSRAM ring that may be
+ * written from an ISR.  A writer only reserves its entries while holding the lock and
+ * fills them after releasing it so the lock is held for a few instructions regardless of
+ * the record length.  New records overwrite the oldest.
+ *
+ * The ring is served by an HTTP server at CAN_CAPTURE_URI in candump log format:
+ *   (sec.usec) can0 7E8#0322F19000000000    Received or transmitted frame
+ *   (sec.usec) isotp 7E8#62F190...          Reassembled response (not a CAN frame)
+ * Timestamps are esp_timer time since boot.  Capture is paused while the ring is being
+ * downloaded so the file is a consistent snapshot.  WiFi is started if the interface in
+ * use doesn't already need it (the configured station or AP mode is used).
+ *
+ * A log PUT to CAN_CAPTURE_UPLOAD_URI is stored for the replay driver.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "can_capture.h"
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "wifi_utilities.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+//
+// Local constants
+//
+
+// Entry types beyond the public record types
+#define ENTRY_CONT    0xFF
+
+// Download buffer (sent as one HTTP chunk when full)
+#define DUMP_BUF_LEN  1024
+
+// Longest line prefix: "(" + 20 + "." + 6 + ") isotp " + 8 + "#"
+#define DUMP_HDR_MAX  48
+
+
+
+//
+// Local data structures
+//
+typedef struct {
+	int64_t ts_usec;
+	uint32_t id;
+	uint16_t len;                // Record data length (first entry only)
+	uint8_t type;                // Record type or ENTRY_CONT
+	uint8_t rsvd;
+	uint8_t data[CAN_CAPTURE_ENTRY_DATA];
+} can_capture_entry_t;
+
+
+
+//
+// Global variables
+//
+static const char* TAG = "can_capture";
+
+volatile bool can_capture_active = false;
+
+static bool capture_enabled = false;  // Set by the user (active unless paused for download)
+
+static can_capture_entry_t* ringP = NULL;
+static uint32_t write_count = 0;
+static portMUX_TYPE capture_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool uris_registered = false;
+
+static char dump_buf[DUMP_BUF_LEN];
+static int dump_len;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static esp_err_t _can_capture_dump_handler(httpd_req_t* req);
+static esp_err_t _can_capture_upload_handler(httpd_req_t* req);
+static void _can_capture_pause(bool pause);
+static esp_err_t _can_capture_dump_append(httpd_req_t* req, const char* s, int len);
+static esp_err_t _can_capture_dump_hex(httpd_req_t* req, const uint8_t* data, int len);
+
+
+
+//
+// API
+//
+bool can_capture_init()
+{
+	const httpd_uri_t dump_uri = {
+		.uri = CAN_CAPTURE_URI,
+		.method = HTTP_GET,
+		.handler = _can_capture_dump_handler,
+		.user_ctx = NULL
+	};
+	const httpd_uri_t upload_uri = {
+		.uri = CAN_CAPTURE_UPLOAD_URI,
+		.method = HTTP_PUT,
+		.handler = _can_capture_upload_handler,
+		.user_ctx = NULL
+	};
+	httpd_handle_t server;
+	
+	if (ringP == NULL) {
+		ringP = heap_caps_malloc(CAN_CAPTURE_ENTRIES * sizeof(can_capture_entry_t), MALLOC_CAP_SPIRAM);
+		if (ringP == NULL) {
+			ESP_LOGE(TAG, "Could not allocate capture ring");
+			return false;
+		}
+	}
+	
+	if (!uris_registered) {
+		if (!wifi_is_enabled() && !wifi_init()) {
+			ESP_LOGE(TAG, "Could not start WiFi for capture download");
+		} else if ((server = wifi_get_http_server()) != NULL) {
+			httpd_register_uri_handler(server, &dump_uri);
+			httpd_register_uri_handler(server, &upload_uri);
+			uris_registered = true;
+		}
+	}
+	
+	can_capture_clear();
+	can_capture_enable(true);
+	ESP_LOGI(TAG, "Capturing %d entries", CAN_CAPTURE_ENTRIES);
+	
+	return true;
+}
+
+
+void can_capture_enable(bool en)
+{
+	capture_enabled = en && (ringP != NULL);
+	can_capture_active = capture_enabled;
+}
+
+
+void can_capture_clear()
+{
+	portENTER_CRITICAL_SAFE(&capture_mux);
+	write_count = 0;
+	portEXIT_CRITICAL_SAFE(&capture_mux);
+}
+
+
+void can_capture_record(int type, uint32_t id, int len, const uint8_t* data)
+{
+	can_capture_entry_t* eP;
+	uint32_t idx;
+	int n;
+	int64_t ts_usec;
+	
+	if (!can_capture_active) return;
+	
+	ts_usec = esp_timer_get_time();
+	n = (len <= CAN_CAPTURE_ENTRY_DATA) ? 1 : ((len + CAN_CAPTURE_ENTRY_DATA - 1) / CAN_CAPTURE_ENTRY_DATA);
+	if (n > CAN_CAPTURE_ENTRIES) return;
+	
+	// Reserve our entries
+	portENTER_CRITICAL_SAFE(&capture_mux);
+	idx = write_count;
+	write_count += n;
+	portEXIT_CRITICAL_SAFE(&capture_mux);
+	
+	for (int i=0; i<n; i++) {
+		eP = &ringP[(idx + i) % CAN_CAPTURE_ENTRIES];
+		eP->ts_usec = ts_usec;
+		eP->id = id;
+		eP->len = (uint16_t) len;
+		eP->type = (i == 0) ? (uint8_t) type : ENTRY_CONT;
+		memcpy(eP->data, &data[i * CAN_CAPTURE_ENTRY_DATA], (len < CAN_CAPTURE_ENTRY_DATA) ? len : CAN_CAPTURE_ENTRY_DATA);
+		len -= CAN_CAPTURE_ENTRY_DATA;
+	}
+}
+
+
+
+//
+// Internal functions
+//
+static esp_err_t _can_capture_dump_handler(httpd_req_t* req)
+{
+	can_capture_entry_t* eP;
+	uint32_t start, end, i;
+	int remaining;
+	int n;
+	char hdr[DUMP_HDR_MAX];
+	char query[16];
+	bool clear = false;
+	esp_err_t ret = ESP_OK;
+	
+	if (ringP == NULL) {
+		httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Capture not enabled");
+		return ESP_FAIL;
+	}
+	
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+		clear = (strstr(query, "clear=1") != NULL);
+	}
+	
+	_can_capture_pause(true);
+	end = write_count;
+	start = (end > CAN_CAPTURE_ENTRIES) ? (end - CAN_CAPTURE_ENTRIES) : 0;
+	
+	httpd_resp_set_type(req, "text/plain");
+	httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"candump.log\"");
+	dump_len = 0;
+	
+	i = start;
+	while ((i < end) && (ret == ESP_OK)) {
+		eP = &ringP[i % CAN_CAPTURE_ENTRIES];
+		if (eP->type == ENTRY_CONT) {
+			// Remainder of a record that was partly overwritten
+			i++;
+			continue;
+		}
+		
+		n = sprintf(hdr, "(%lld.%06lld) %s %0*lX#", eP->ts_usec / 1000000, eP->ts_usec % 1000000,
+		            (eP->type == CAN_CAPTURE_RSP) ? "isotp" : "can0",
+		            (eP->id > 0x7FF) ? 8 : 3, eP->id);
+		ret = _can_capture_dump_append(req, hdr, n);
+		
+		// Record data spans this and any following continuation entries
+		remaining = eP->len;
+		do {
+			n = (remaining < CAN_CAPTURE_ENTRY_DATA) ? remaining : CAN_CAPTURE_ENTRY_DATA;
+			if (ret == ESP_OK) {
+				ret = _can_capture_dump_hex(req, ringP[i % CAN_CAPTURE_ENTRIES].data, n);
+			}
+			remaining -= n;
+			i++;
+		} while ((remaining > 0) && (i < end) && (ringP[i % CAN_CAPTURE_ENTRIES].type == ENTRY_CONT));
+		
+		if (ret == ESP_OK) {
+			ret = _can_capture_dump_append(req, "\n", 1);
+		}
+	}
+	
+	if ((ret == ESP_OK) && (dump_len != 0)) {
+		ret = httpd_resp_send_chunk(req, dump_buf, dump_len);
+	}
+	if (ret == ESP_OK) {
+		ret = httpd_resp_send_chunk(req, NULL, 0);
+	}
+	
+	if ((ret == ESP_OK) && clear) {
+		can_capture_clear();
+	}
+	_can_capture_pause(false);
+	
+	ESP_LOGI(TAG, "Sent %lu entries", end - start);
+	return ret;
+}
+
+
+// Store an uploaded log for replay (dump_buf is shared since the server runs one handler
+// at a time)
+static esp_err_t _can_capture_upload_handler(httpd_req_t* req)
+{
+	FILE* fp;
+	int remaining = req->content_len;
+	int n;
+	
+	fp = fopen(CAN_CAPTURE_UPLOAD_FILE, "w");
+	if (fp == NULL) {
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Could not create file");
+		return ESP_FAIL;
+	}
+	
+	while (remaining > 0) {
+		n = httpd_req_recv(req, dump_buf, (remaining < DUMP_BUF_LEN) ? remaining : DUMP_BUF_LEN);
+		if (n == HTTPD_SOCK_ERR_TIMEOUT) {
+			continue;
+		}
+		if ((n <= 0) || (fwrite(dump_buf, 1, n, fp) != n)) {
+			fclose(fp);
+			unlink(CAN_CAPTURE_UPLOAD_FILE);
+			httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Upload failed");
+			return ESP_FAIL;
+		}
+		remaining -= n;
+	}
+	fclose(fp);
+	
+	ESP_LOGI(TAG, "Stored %d byte replay log", (int) req->content_len);
+	httpd_resp_sendstr(req, "OK\n");
+	return ESP_OK;
+}
+
+
+static void _can_capture_pause(bool pause)
+{
+	if (pause) {
+		can_capture_active = false;
+		
+		// Let a writer that has already reserved its entries finish filling them
+		vTaskDelay(pdMS_TO_TICKS(10));
+	} else {
+		can_capture_active = capture_enabled;
+	}
+}
+
+
+static esp_err_t _can_capture_dump_append(httpd_req_t* req, const char* s, int len)
+{
+	esp_err_t ret = ESP_OK;
+	
+	if ((dump_len + len) > DUMP_BUF_LEN) {
+		ret = httpd_resp_send_chunk(req, dump_buf, dump_len);
+		dump_len = 0;
+	}
+	memcpy(&dump_buf[dump_len], s, len);
+	dump_len += len;
+	
+	return ret;
+}
+
+
+static esp_err_t _can_capture_dump_hex(httpd_req_t* req, const uint8_t* data, int len)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char s[2 * CAN_CAPTURE_ENTRY_DATA];
+	
+	for (int i=0; i<len; i++) {
+		s[2*i]     = hex[data[i] >> 4];
+		s[2*i + 1] = hex[data[i] & 0x0F];
+	}
+	
+	return _can_capture_dump_append(req, s, 2 * len);
+}
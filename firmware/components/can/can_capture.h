@@ -0,0 +1,72 @@
+/*
+ * Raw CAN frame and ISO-TP response capture
+ *
+ * Records frames and reassembled responses with timestamps into a PSRAM ring that may be
+ * written from an ISR.  The ring is downloaded over WiFi in candump log format.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef CAN_CAPTURE_H
+#define CAN_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// Constants
+//
+
+// Ring entries (each CAN_CAPTURE_ENTRY_DATA bytes of payload, records longer than that
+// use additional entries)
+#define CAN_CAPTURE_ENTRIES    16384
+#define CAN_CAPTURE_ENTRY_DATA 16
+
+// Record types
+#define CAN_CAPTURE_RX         0
+#define CAN_CAPTURE_TX         1
+#define CAN_CAPTURE_RSP        2
+
+// Download URI.  "?clear=1" empties the ring after the download.
+#define CAN_CAPTURE_URI        "/candump.log"
+
+// Upload (PUT) URI for a log to be played back by the replay driver and where it is stored
+// (e.g. curl -T candump.log http://<ip>/replay.log)
+#define CAN_CAPTURE_UPLOAD_URI  "/replay.log"
+#define CAN_CAPTURE_UPLOAD_FILE "/log/REPLAY.LOG"
+
+
+
+//
+// Externally accessible variables
+//
+
+// Checked by the capture points before calling can_capture_record() so capture costs a
+// single load when it is off
+extern volatile bool can_capture_active;
+
+
+
+//
+// API
+//
+bool can_capture_init();
+void can_capture_enable(bool en);
+void can_capture_clear();
+void can_capture_record(int type, uint32_t id, int len, const uint8_t* data);  // May be called from within an ISR
+
+#endif /* CAN_CAPTURE_H */
\ No newline at end of file
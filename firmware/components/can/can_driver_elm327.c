@@ -21,12 +21,19 @@
  *
  */
 #include "can_driver_elm327.h"
+#include "can_timer.h"
 #include "elm327_interface_ble.h"
+#include "elm327_interface_usb.h"
 #include "elm327_interface_wifi.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "event_utilities.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "ps_utilities.h"
+#include "tune_utilities.h"
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -41,6 +48,12 @@
 // Uncomment to debug initialization
 //#define DEBUG_SHOW_INIT
 
+// Uncomment to have the adapter do ISO-TP (ATCAF1).  It adds the PCI byte to requests and
+// returns a response as one line (single frame) or a length line followed by numbered
+// "n:" lines so fewer characters cross the link.  Responses go to the CAN manager as
+// complete payloads (they are not streamed while they arrive).
+//#define ENABLE_ADAPTER_ISOTP
+
 // Operational state
 #define OP_ST_DISCONNECTED  0
 #define OP_ST_INIT_ELM327   1
@@ -52,40 +65,293 @@
 #define TX_ST_REQ_PKT       2
 #define TX_ST_TIMEOUT       3
 #define TX_ST_ERROR         4
+#define TX_ST_MONITOR       5
+#define TX_ST_MON_STOP      6
 
 // Previous packet size (to update ELM327 protocol on header size differences)
 #define HEADER_SIZE_UNDEF   0
 #define HEADER_SIZE_11      1
 #define HEADER_SIZE_29      2
 
-// RX circular data buffer
-#define RX_BUFF_LEN         1024
+// Longest adapter-formatted response (12-bit ISO-TP length)
+#define ISOTP_MAX_RSP_LEN   4095
+
+// Response timeout (ATST) classes in 4 mSec units.  The ATST value for a request is the
+// smallest class covering its timeout so it is only re-issued when a request to an ECU
+// with different latency follows.  ST_DEFAULT must match the init command.
+#define ST_DEFAULT          0x7D
+static const uint8_t st_class[] = {0x10, 0x20, 0x40, ST_DEFAULT};
+#define NUM_ST_CLASSES      (sizeof(st_class)/sizeof(st_class[0]))
+
+// Hex character decode table.  Entries hold the nibble value + 1 so 0 marks non-hex characters.
+static const uint8_t hex_char_val[256] = {
+	['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,  ['5'] = 6,  ['6'] = 7,  ['7'] = 8,
+	['8'] = 9,  ['9'] = 10, ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+};
+
+// STN (OBDLink) fast path.  STPX sends a request with its header in one command and the
+// adapter generates flow control for registered STCFCPA ID pairs so ATSH/ATCP/ATFCSH aren't
+// needed when the request ID changes.  The longest STPX command (29-bit header, 8 data
+// bytes, response count) must fit in one interface write.
+#define STN_MAX_STPX_LEN    40
+#define STN_MAX_FC_PAIRS    8
+
+// Prepared requests.  The header (ATCP/ATSH/ATFCSH) and response header (ATCRA) commands
+// and payload hex of the vehicle's scheduled requests are formatted once into the arena
+// (commands shared between requests to the same IDs) so sending one only queues strings.
+#define PREP_ARENA_LEN      1536
 
 // Maximum length of ELM327 version string (numeric component - e.g. "2.4"")
 // Room for "MM.mm" + Null
 #define MAX_ELM327_VER_LEN  6
 
+// Maximum length of a captured identification response line (ATI, AT@1, STI)
+#define MAX_RSP_TEXT_LEN    24
+
+// Characterization.  Latency and rate are measured over a burst of harmless commands and
+// the longest pipelined write by sending increasing numbers of them in one write.
+#define CHAR_NUM_CMDS       16
+#define CHAR_CMD            "ATS0"
+#define CHAR_CMD_LEN        5         // Including the CR separator
+
+// Maximum time for the driver task to finish an init command and exit during deinit
+#define STOP_MSEC           3000
+
+
+
+//
+// Local data structures
+//
+
+// One adapter.  Every instance has its own interface, task, state machine and parsers so
+// with CAN_MANAGER_EN_ELM327_PAIR two adapters run requests at the same time.
+typedef struct {
+	// Local initialization task
+	TaskHandle_t task_handle_elm327_driver;
+	const char* task_name;
+	volatile bool stop_req;                // Task exits (deinit)
+	
+	// Selected interface driver
+	const elm327_if_driver_t* driverP;
+	
+	// Task waiting for the current transmission to complete
+	TaskHandle_t tx_wait_task;
+	
+	// Asynchronous request packets.  tx_packet returns once a request is written and the
+	// parser, response completion, interface TX failure or request timer finishes it.  The
+	// first of them to see req_async clears it and reports the result to the CAN manager.
+	volatile bool req_async;
+	portMUX_TYPE req_mux;
+	can_timer_t req_timer;
+	uint32_t req_rsp_id;                   // Response ID of the request (0 while initializing)
+	
+	// Result of the last asynchronous request for the next one to act on
+	volatile bool req_failed;              // Settings must be resent
+	volatile bool req_fail_unknown;        // Adapter didn't understand the request ("?")
+	bool req_used_rsp_count;
+	bool req_used_stn;
+	
+	// State
+	int if_index;
+	bool can_500k;
+	int timeout_msec;
+	int req_timeout_msec;                  // Timeout for the current request packet (<= timeout_msec)
+	int op_state;
+	int tx_state;
+	int prev_header_size;
+	uint32_t prev_req_id;
+	uint32_t prev_rsp_id;
+	uint8_t fc_block_size;                 // Must match ATFCSD init command
+	uint8_t fc_sep_time;
+	bool fc_changed;
+	uint8_t prev_st_val;
+	bool no_data;                          // Request saw a "NO DATA" response
+	bool unknown_cmd;                      // Request saw a "?" response
+	
+	// Response count suffix.  Appending a single hex digit with the number of expected response
+	// frames to a request lets the ELM327 return as soon as they arrive instead of waiting for
+	// its ATST timeout.  Supported by v1.3 and later except for the v1.5 clones.
+	bool rsp_count_en;
+	int expected_frames;                   // For the next request, 0 = unknown
+	
+	// STN adapter support
+	bool stn_seen;                         // STI returned an STN identification
+	bool stn_en;
+	int stn_num_fc_pairs;
+	uint32_t stn_fc_pair[STN_MAX_FC_PAIRS][2];
+	
+	// Monitor mode (ATMA) - the adapter streams filtered bus frames with headers between requests
+	int mon_header_size;
+	
+	// Command pipeline.  AT commands preceding a request are queued and sent in the same
+	// write as the request (separated by CR) on adapters that buffer input while executing
+	// a command.  The prompts are then matched in order.
+	bool pipeline_en;
+	int pipe_max_len;                      // Longest write the adapter accepted
+	char pipe_buf[CAN_DRIVER_MAX_ELM327_STR_LEN+1];
+	int pipe_len;
+	int pipe_num_cmds;
+	volatile int pipe_pending_cmds;        // AT command prompts before the final command's
+	volatile int pipe_final_state;         // State for the final command
+	
+	// Streaming RX parsers.  Characters are consumed directly from the interface driver's
+	// buffer and the parse state carries across calls so frames are emitted as lines complete.
+	struct {
+		bool first_char;
+		bool high_nibble;
+		bool has_version;
+		bool saw_data;
+		bool success;
+		bool in_rsp;                       // Response characters seen since the last prompt
+		bool complete;                     // All frames delivered, waiting for the prompt
+		int n;
+		uint8_t data[8];
+	} rsp_p;
+	
+	struct {
+		bool valid;
+		int id_chars;                      // Header characters seen
+		int n;
+		uint32_t id;
+		uint8_t data[8];
+	} mon_p;
+	
+#ifdef ENABLE_ADAPTER_ISOTP
+	struct {
+		bool first_char;
+		bool numbered;                     // Line started with a "n:" frame index
+		bool line_bad;                     // Line is a status message
+		int nibbles;                       // Hex characters in the line (after any index)
+		uint16_t line_val;                 // Value of the line's first 3 hex characters
+		int total_len;                     // Payload length from the length line (-1 = unknown)
+		int n;                             // Payload bytes
+		int line_start;                    // Payload index of the line's first byte
+		int data_len;                      // Longest payload data holds
+		uint8_t* data;                     // min_data or the planned buffer (see can_driver_elm327_set_rsp_bufs)
+		uint8_t min_data[CAN_MANAGER_MIN_RSP_LEN];
+	} isotp_p;
+#endif
+	
+	// Prepared requests (see PREP_ARENA_LEN).  The arena is built on the first request after
+	// the list changes or the adapter version (v1.5 workarounds) is learned.
+	const can_tx_desc_t* volatile prep_descP;
+	volatile int prep_num_desc;
+	volatile bool prep_changed;
+	bool prep_built_v15;
+	int prep_num;
+	struct {
+		const uint8_t* data;
+		uint32_t req_id;
+		uint32_t rsp_id;
+		int len;
+		uint16_t hdr_offset;               // First of hdr_num consecutive header commands
+		uint8_t hdr_num;
+		uint8_t pay_len;                   // Payload hex characters (a response count digit may follow)
+		uint16_t cra_offset;
+		uint16_t pay_offset;
+	} prep_list[CAN_MANAGER_MAX_PREP_REQ];
+	char prep_arena[PREP_ARENA_LEN];
+	
+	// ELM325 adapter information for hacks around crappy and buggy implementations
+	char elm327_version_string[MAX_ELM327_VER_LEN];
+	bool elm327_is_v15;
+	int ver_parse_state;                   // 0: looking for 'v', 1: Major number, 2: Minor number
+	int ver_index;
+	
+	// Set once the adapter has been fully initialized so a reconnect can check if it is still
+	// configured (its settings, version and detected features are kept here) instead of resetting it
+	bool elm327_configured;
+	bool echo_seen;                        // Command echo seen (adapter was reset, ATE0 lost)
+	
+	// Identification response capture (first line of the response)
+	volatile bool rsp_text_en;
+	int rsp_text_len;
+	char rsp_text[MAX_RSP_TEXT_LEN+1];
+	
+	// Tuning profile of the connected adapter (in the persistent storage local copy).  Adapters
+	// without a profile are characterized on first connect, or again on request.
+	elm327_profile_t* profileP;
+	volatile bool characterize_req;
+	volatile bool characterize_active;
+} elm327_dev_t;
+
 
 
 // Functions for CAN manager
-static bool _can_driver_elm327_init(int if_type, int req_timeout, bool can_is_500k);
-static bool _can_driver_elm327_connected();
-static bool _can_driver_elm327_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data);
+static bool _can_driver_elm327_init(elm327_dev_t* d, int if_type, int req_timeout, bool can_is_500k);
+static bool _can_driver_elm327_deinit(elm327_dev_t* d);
+static void _can_driver_elm327_prepare_tx(elm327_dev_t* d, int num_req, const can_tx_desc_t* reqs);
+static bool _can_driver_elm327_connected(elm327_dev_t* d);
+static bool _can_driver_elm327_tx_packet(elm327_dev_t* d, uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout);
 static bool _can_driver_elm327_tx_fc_packet(uint32_t req_id, int len, uint8_t* data);
 static void _can_driver_elm327_en_rsp_filter(bool en);
-static void _can_driver_elm327_response_complete();
+static void _can_driver_elm327_set_rx_id_list(int num_ids, const uint32_t* ids);
+static void _can_driver_elm327_set_flow_control(elm327_dev_t* d, uint8_t block_size, uint8_t sep_time);
+static void _can_driver_elm327_set_expected_frames(elm327_dev_t* d, int num_frames);
+static bool _can_driver_elm327_start_monitor(elm327_dev_t* d, int num_ids, const uint32_t* ids);
+static void _can_driver_elm327_response_complete(elm327_dev_t* d);
+
+// Driver entry points of each instance
+static bool _can_driver_elm327_init_0(int if_type, int req_timeout, bool can_is_500k);
+static bool _can_driver_elm327_connected_0();
+static bool _can_driver_elm327_tx_packet_0(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout);
+static void _can_driver_elm327_set_flow_control_0(uint8_t block_size, uint8_t sep_time);
+static void _can_driver_elm327_set_expected_frames_0(int num_frames);
+static bool _can_driver_elm327_start_monitor_0(int num_ids, const uint32_t* ids);
+static void _can_driver_elm327_response_complete_0();
+static bool _can_driver_elm327_deinit_0();
+static void _can_driver_elm327_prepare_tx_0(int num_req, const can_tx_desc_t* reqs);
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+static bool _can_driver_elm327_init_1(int if_type, int req_timeout, bool can_is_500k);
+static bool _can_driver_elm327_connected_1();
+static bool _can_driver_elm327_tx_packet_1(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout);
+static void _can_driver_elm327_set_flow_control_1(uint8_t block_size, uint8_t sep_time);
+static void _can_driver_elm327_set_expected_frames_1(int num_frames);
+static bool _can_driver_elm327_start_monitor_1(int num_ids, const uint32_t* ids);
+static void _can_driver_elm327_response_complete_1();
+static bool _can_driver_elm327_deinit_1();
+static void _can_driver_elm327_prepare_tx_1(int num_req, const can_tx_desc_t* reqs);
+#endif
 
 
 //
 //  Forward declarations
 //
-static void _can_driver_elm327_task();
-static void _can_driver_elm327_process_rx_buf();
-static bool _can_driver_elm327_tx_string(int pkt_state, char* s);
+static void _can_driver_elm327_task(void* arg);
+static bool _can_driver_elm327_quick_probe(elm327_dev_t* d);
+static void _can_driver_elm327_setup_features(elm327_dev_t* d);
+static void _can_driver_elm327_get_identity(elm327_dev_t* d, char* id);
+static bool _can_driver_elm327_query(elm327_dev_t* d, char* cmd, char* txt);
+static void _can_driver_elm327_characterize(elm327_dev_t* d, elm327_profile_t* pP);
+static void _can_driver_elm327_apply_profile(elm327_dev_t* d, elm327_profile_t* pP);
+static void _can_driver_elm327_clear_profile_flag(elm327_dev_t* d, uint8_t flag);
+static void _can_driver_elm327_rx_rsp_char(elm327_dev_t* d, char c);
+static void _can_driver_elm327_rx_prompt(elm327_dev_t* d);
+static void _can_driver_elm327_reset_parser(elm327_dev_t* d);
+static bool _can_driver_elm327_tx_string(elm327_dev_t* d, int pkt_state, char* s);
+static void _can_driver_elm327_wake_tx(elm327_dev_t* d);
+static bool _can_driver_elm327_wait_req(elm327_dev_t* d);
+static void _can_driver_elm327_finish_req(elm327_dev_t* d, int result);
+static void _can_driver_elm327_req_timer_cb(void* arg);
+static bool _can_driver_elm327_queue_cmd(elm327_dev_t* d, char* s);
+static void _can_driver_elm327_build_prep(elm327_dev_t* d);
+static int _can_driver_elm327_find_prep(elm327_dev_t* d, uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data);
+static int _can_driver_elm327_header_cmds(elm327_dev_t* d, uint32_t req_id, char* s, int max_len, int* num_cmdsP);
+static void _can_driver_elm327_trim_payload(elm327_dev_t* d, int* lenP, uint8_t** dataP);
+static int _can_driver_elm327_payload_2_ascii(int len, const uint8_t* data, char* s);
+static bool _can_driver_elm327_stn_tx_packet(elm327_dev_t* d, uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout);
+static bool _can_driver_elm327_stn_fc_pair(elm327_dev_t* d, uint32_t req_id, uint32_t rsp_id);
+static bool _can_driver_elm327_queue_protocol(elm327_dev_t* d, int header_size);
+static bool _can_driver_elm327_stop_monitor(elm327_dev_t* d);
+static void _can_driver_elm327_rx_monitor_char(elm327_dev_t* d, char c);
+#ifdef ENABLE_ADAPTER_ISOTP
+static void _can_driver_elm327_rx_isotp_char(elm327_dev_t* d, char c);
+#endif
+static bool _can_driver_elm327_tx_pipeline(elm327_dev_t* d, int pkt_state, char* s);
+static bool _can_driver_elm327_tx_lines(elm327_dev_t* d, int num_prev_cmds, int pkt_state, char* s);
 static char _can_driver_elm327_nibble_2_ascii(uint8_t nibble);
-static uint8_t _can_driver_elm327_ascii_to_nibble(char c);
-static bool _can_driver_elm327_is_hex_char(char c);
-static void _can_driver_elm327_proc_version_info(char c, bool init);
+static void _can_driver_elm327_proc_version_info(elm327_dev_t* d, char c, bool init);
 
 
 //
@@ -94,13 +360,49 @@ static void _can_driver_elm327_proc_version_info(char c, bool init);
 const can_if_driver_t can_driver_elm327 =
 {
 	"CAN ELM327 Driver",
-	_can_driver_elm327_init,
-	_can_driver_elm327_connected,
-	_can_driver_elm327_tx_packet,
+	1,                             // ELM327 can only process one request at a time
+	30,                            // Changing IDs requires AT commands
+	8,                             // Raw (CAF0) requests are sent as a single frame
+	_can_driver_elm327_init_0,
+	_can_driver_elm327_connected_0,
+	_can_driver_elm327_tx_packet_0,
+	_can_driver_elm327_tx_fc_packet,
+	_can_driver_elm327_en_rsp_filter,
+	_can_driver_elm327_set_rx_id_list,
+	_can_driver_elm327_set_flow_control_0,
+	_can_driver_elm327_set_expected_frames_0,
+	_can_driver_elm327_start_monitor_0,
+	_can_driver_elm327_response_complete_0,
+	NULL,                          // The adapter returns to its prompt after the pending response
+	NULL,                          // Only sees responses to its own requests
+	_can_driver_elm327_deinit_0,
+	_can_driver_elm327_prepare_tx_0
+};
+
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+// Second adapter sharing the requests
+const can_if_driver_t can_driver_elm327_pair =
+{
+	"CAN ELM327 Pair Driver",
+	1,                             // ELM327 can only process one request at a time
+	30,                            // Changing IDs requires AT commands
+	8,                             // Raw (CAF0) requests are sent as a single frame
+	_can_driver_elm327_init_1,
+	_can_driver_elm327_connected_1,
+	_can_driver_elm327_tx_packet_1,
 	_can_driver_elm327_tx_fc_packet,
 	_can_driver_elm327_en_rsp_filter,
-	_can_driver_elm327_response_complete
+	_can_driver_elm327_set_rx_id_list,
+	_can_driver_elm327_set_flow_control_1,
+	_can_driver_elm327_set_expected_frames_1,
+	_can_driver_elm327_start_monitor_1,
+	_can_driver_elm327_response_complete_1,
+	NULL,                          // The adapter returns to its prompt after the pending response
+	NULL,                          // Only sees responses to its own requests
+	_can_driver_elm327_deinit_1,
+	_can_driver_elm327_prepare_tx_1
 };
+#endif
 
 
 //
@@ -108,116 +410,290 @@ const can_if_driver_t can_driver_elm327 =
 //
 static const char* TAG = "can_driver_elm327";
 
-// Local initialization task
-static TaskHandle_t task_handle_elm327_driver;
-
 // Supported interface drivers
 static const elm327_if_driver_t* interface_listP[] = {
 	&elm327_interface_driver_wifi,
-	&elm327_interface_driver_ble
+	&elm327_interface_driver_ble,
+	&elm327_interface_driver_usb
 };
 
-// Selected interface driver
-static const elm327_if_driver_t* driverP = NULL;
-
-// State
-static bool can_500k;
-static int timeout_msec;
-static int op_state = OP_ST_DISCONNECTED;
-static int tx_state = TX_ST_IDLE;
-static int prev_header_size = HEADER_SIZE_UNDEF;
-static uint32_t prev_req_id = 0;
-static uint32_t prev_rsp_id = 0;
-
-// RX Buffer
-static char *rx_buf;
-static int rx_buf_push_index = 0;
-static int rx_buf_pop_index = 0;
-
-// ELM325 adapter information for hacks around crappy and buggy implementations
-static char elm327_version_string[MAX_ELM327_VER_LEN];
-static bool elm327_is_v15 = false;
+// Adapter instances (the second shares requests with the first, see can_manager.c)
+static elm327_dev_t elm327_dev[CAN_DRIVER_ELM327_NUM_DEV] = {
+	{
+		.task_name = "can_driver_elm327_task",
+		.req_mux = portMUX_INITIALIZER_UNLOCKED,
+		.op_state = OP_ST_DISCONNECTED,
+		.tx_state = TX_ST_IDLE,
+		.prev_header_size = HEADER_SIZE_UNDEF,
+		.prev_st_val = ST_DEFAULT,
+		.rsp_p = {true, true, false, false, false, false, false, 0, {0}}
+	},
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	{
+		.task_name = "can_driver_elm327_task2",
+		.req_mux = portMUX_INITIALIZER_UNLOCKED,
+		.op_state = OP_ST_DISCONNECTED,
+		.tx_state = TX_ST_IDLE,
+		.prev_header_size = HEADER_SIZE_UNDEF,
+		.prev_st_val = ST_DEFAULT,
+		.rsp_p = {true, true, false, false, false, false, false, 0, {0}}
+	},
+#endif
+};
 
+// Instance running each interface (NULL when the interface isn't in use)
+static elm327_dev_t* volatile if_devP[CAN_DRIVER_ELM327_NUM_IF];
+	
 
 // ELM327 IF Initialization sequence
 static char* elm327_init_cmd[] =
 {
 	"ATZ",			// Reset the ELM327 controller
 	"ATE0",			// Disable echoing sent data bytes (and commands)
+#ifdef ENABLE_ADAPTER_ISOTP
+	"ATCAF1",		// Turn on auto formatting so the adapter handles ISO-TP framing
+#else
 	"ATCAF0",		// Turn off auto formatting so we specify and receive all the data bytes
+#endif
 	"ATCFC1",		// Turn on flow control (for optimization, we'll ignore can_manager's FC packets)
 	"ATM0",			// Disable saving protocol changes to memory
 	"ATL0",			// Disable sending <LF> after <CR>
 	"ATH0",			// Disable header ID in responses
-	"ATS1",			// Enable spaces between data bytes (necessary for our parser)
-	"ATST7D",		// Set 500 mSec timeout
+	"ATS0",			// Disable spaces between data bytes (fewer characters to transfer and parse)
+	"ATST7D",		// Set 500 mSec timeout (maximum for adaptive timing)
+	"ATAT1",		// Enable adaptive timing so the adapter stops waiting when the ECU is done
 	"ATFCSH710",	// Set a dummy flow control message for now (so subsequent ATFCSM1 command will succeed)
 	"ATFCSD300000",	// Set flow control response bytes
 	"ATFCSM1",		// Enable custom flow control response
 };
-#define NUM_ELM327_INIT_CMDS 12
+#define NUM_ELM327_INIT_CMDS 13
+
+
+
+//
+// Driver entry points
+//
+static bool _can_driver_elm327_init_0(int if_type, int req_timeout, bool can_is_500k)
+{
+	return _can_driver_elm327_init(&elm327_dev[0], if_type, req_timeout, can_is_500k);
+}
+
+
+static bool _can_driver_elm327_connected_0()
+{
+	return _can_driver_elm327_connected(&elm327_dev[0]);
+}
+
+
+static bool _can_driver_elm327_tx_packet_0(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout)
+{
+	return _can_driver_elm327_tx_packet(&elm327_dev[0], req_id, rsp_id, len, data, req_timeout);
+}
+
+
+static void _can_driver_elm327_set_flow_control_0(uint8_t block_size, uint8_t sep_time)
+{
+	_can_driver_elm327_set_flow_control(&elm327_dev[0], block_size, sep_time);
+}
+
+
+static void _can_driver_elm327_set_expected_frames_0(int num_frames)
+{
+	_can_driver_elm327_set_expected_frames(&elm327_dev[0], num_frames);
+}
+
+
+static bool _can_driver_elm327_start_monitor_0(int num_ids, const uint32_t* ids)
+{
+	return _can_driver_elm327_start_monitor(&elm327_dev[0], num_ids, ids);
+}
+
+
+static void _can_driver_elm327_response_complete_0()
+{
+	_can_driver_elm327_response_complete(&elm327_dev[0]);
+}
+
+
+static bool _can_driver_elm327_deinit_0()
+{
+	return _can_driver_elm327_deinit(&elm327_dev[0]);
+}
+
+
+static void _can_driver_elm327_prepare_tx_0(int num_req, const can_tx_desc_t* reqs)
+{
+	_can_driver_elm327_prepare_tx(&elm327_dev[0], num_req, reqs);
+}
+
+
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+static bool _can_driver_elm327_init_1(int if_type, int req_timeout, bool can_is_500k)
+{
+	return _can_driver_elm327_init(&elm327_dev[1], if_type, req_timeout, can_is_500k);
+}
+
+
+static bool _can_driver_elm327_connected_1()
+{
+	return _can_driver_elm327_connected(&elm327_dev[1]);
+}
+
+
+static bool _can_driver_elm327_tx_packet_1(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout)
+{
+	return _can_driver_elm327_tx_packet(&elm327_dev[1], req_id, rsp_id, len, data, req_timeout);
+}
+
+
+static void _can_driver_elm327_set_flow_control_1(uint8_t block_size, uint8_t sep_time)
+{
+	_can_driver_elm327_set_flow_control(&elm327_dev[1], block_size, sep_time);
+}
+
+
+static void _can_driver_elm327_set_expected_frames_1(int num_frames)
+{
+	_can_driver_elm327_set_expected_frames(&elm327_dev[1], num_frames);
+}
+
+
+static bool _can_driver_elm327_start_monitor_1(int num_ids, const uint32_t* ids)
+{
+	return _can_driver_elm327_start_monitor(&elm327_dev[1], num_ids, ids);
+}
+
+
+static void _can_driver_elm327_response_complete_1()
+{
+	_can_driver_elm327_response_complete(&elm327_dev[1]);
+}
+
+
+static bool _can_driver_elm327_deinit_1()
+{
+	return _can_driver_elm327_deinit(&elm327_dev[1]);
+}
+
+
+static void _can_driver_elm327_prepare_tx_1(int num_req, const can_tx_desc_t* reqs)
+{
+	_can_driver_elm327_prepare_tx(&elm327_dev[1], num_req, reqs);
+}
+#endif
 
 
 
 //
 // CAN manager functions
 //
-static bool _can_driver_elm327_init(int if_type, int req_timeout, bool can_is_500k)
+static bool _can_driver_elm327_init(elm327_dev_t* d, int if_type, int req_timeout, bool can_is_500k)
 {
 	bool success = true;
 	
-	timeout_msec = req_timeout * 10;   // Accomodate latency in connection + ELM327 controller
-	can_500k = can_is_500k;
-	
-	// Initialize the interface
-	switch (if_type) {
-		case CAN_DRIVER_ELM327_WIFI:
-			driverP = interface_listP[CAN_DRIVER_ELM327_WIFI];
-			success = driverP->fcn_init();
-			break;
-		
-		case CAN_DRIVER_ELM327_BLE:
-			driverP = interface_listP[CAN_DRIVER_ELM327_BLE];
-			success = driverP->fcn_init();
-			break;
-		
-		default:
-			success = false;
+	d->timeout_msec = req_timeout * 10;   // Accomodate latency in connection + ELM327 controller
+	d->if_index = if_type;
+	d->can_500k = can_is_500k;
+#ifdef ENABLE_ADAPTER_ISOTP
+	if (d->isotp_p.data == NULL) {
+		d->isotp_p.data = d->isotp_p.min_data;
+		d->isotp_p.data_len = CAN_MANAGER_MIN_RSP_LEN;
 	}
+#endif
 	
-	// Create our receive circular buffer
-	rx_buf = malloc(RX_BUFF_LEN);
-	if (rx_buf == NULL) {
-		ESP_LOGE(TAG, "Could not malloc rx_buf");
-		success = false;
+	// Initialize the interface.  Its callbacks are routed to this instance so each interface
+	// can only be used by one of them.
+	if ((if_type < 0) || (if_type >= CAN_DRIVER_ELM327_NUM_IF) ||
+	    ((if_devP[if_type] != NULL) && (if_devP[if_type] != d))) {
+		return false;
 	}
+	d->driverP = interface_listP[if_type];
+	if_devP[if_type] = d;
+	success = d->driverP->fcn_init();
+	
+	_can_driver_elm327_reset_parser(d);
 	
-	// Start our task on the protocol CPU
+	// Setup the timer to time out asynchronous requests
+	can_timer_setup(&d->req_timer, &_can_driver_elm327_req_timer_cb, d);
+	
+	// Start our task (normally on the protocol CPU)
+	d->stop_req = false;
 	if (success) {
-		xTaskCreatePinnedToCore(&_can_driver_elm327_task, "can_driver_elm327_task", 3072, NULL, 3, &task_handle_elm327_driver, 0);
+		xTaskCreatePinnedToCore(&_can_driver_elm327_task, d->task_name, CAN_DRIVER_ELM327_TASK_STACK, d, CAN_DRIVER_ELM327_TASK_PRIORITY, &d->task_handle_elm327_driver, CAN_DRIVER_ELM327_TASK_CORE);
 	}
 	
 	return success;
 }
 
 
-static bool _can_driver_elm327_connected()
+// Stop the driver task and the interface so another interface can be initialized.  Returns
+// false, without changing anything, if the interface can only be stopped by a restart.
+static bool _can_driver_elm327_deinit(elm327_dev_t* d)
+{
+	int n = 0;
+	
+	if ((d->driverP == NULL) || (d->driverP->fcn_deinit == NULL)) {
+		return false;
+	}
+	
+	// Let the task finish the command it is sending and exit
+	d->stop_req = true;
+	d->op_state = OP_ST_DISCONNECTED;
+	while ((d->task_handle_elm327_driver != NULL) && (n++ < (STOP_MSEC / 10))) {
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	if (d->task_handle_elm327_driver != NULL) {
+		ESP_LOGE(TAG, "Task did not stop");
+		return false;
+	}
+	
+	// Abandon any request in flight
+	portENTER_CRITICAL(&d->req_mux);
+	d->req_async = false;
+	d->tx_state = TX_ST_IDLE;
+	portEXIT_CRITICAL(&d->req_mux);
+	can_timer_stop(&d->req_timer);
+	
+	if (!d->driverP->fcn_deinit()) {
+		ESP_LOGE(TAG, "%s deinit failed", d->driverP->name);
+		return false;
+	}
+	
+	// The next adapter may be a different one
+	if_devP[d->if_index] = NULL;
+	d->driverP = NULL;
+	d->elm327_configured = false;
+	d->profileP = NULL;
+	d->stn_seen = false;
+	d->stn_num_fc_pairs = 0;
+	d->characterize_req = false;
+	
+	return true;
+}
+
+
+static bool _can_driver_elm327_connected(elm327_dev_t* d)
 {
-	return (op_state == OP_ST_CONNECTED);
+	return (d->op_state == OP_ST_CONNECTED);
 }
 
 
-// This function is blocking and depends on asynchronous tasks running in the interface
-// driver to return status for the various commands it sends to the ELM327 controller.
-static bool _can_driver_elm327_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data)
+// Any AT commands needed before the request are sent and waited for (when they can't be
+// pipelined) but the request itself returns once written.  The response, "NO DATA", error
+// or timeout is reported through the CAN manager as it is seen by the receive path.
+static bool _can_driver_elm327_tx_packet(elm327_dev_t* d, uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout)
 {
 	char tx_str[32];  // Large enough for AT command "ATFCSHnnnnnnnn" or 8-bytes of data - "00 00 00 00 00 00 00 00"
+	char hdr_str[40]; // Large enough for "ATCPnn", "ATSHnnnnnn" and "ATFCSHnnnnnnnn"
+	char* sendP;
 	char* txP;
 	int cur_header_size;
-	uint8_t* dP;
+	int n;
+	int prep_i = -1;
+	uint8_t st_val;
 	
 	// Safety...
-	if ((driverP == NULL) || (op_state != OP_ST_CONNECTED)) {
+	if ((d->driverP == NULL) || (d->op_state != OP_ST_CONNECTED)) {
 		return false;
 	}
 	
@@ -225,142 +701,665 @@ static bool _can_driver_elm327_tx_packet(uint32_t req_id, uint32_t rsp_id, int l
 	ESP_LOGI(TAG, "TX req 0x%lx, rsp 0x%lx", req_id, rsp_id);
 #endif
 	
+	// The adapter handles one request at a time
+	if (!_can_driver_elm327_wait_req(d)) return false;
+	d->req_rsp_id = rsp_id;
+	
+	// Any header changes are queued and sent with the request
+	d->pipe_len = 0;
+	d->pipe_num_cmds = 0;
+	
+	if (d->req_failed) {
+		d->req_failed = false;
+		
+		// Force all settings to be resent since we don't know which succeeded
+		d->prev_header_size = HEADER_SIZE_UNDEF;
+		d->prev_req_id = 0;
+		d->prev_rsp_id = 0;
+		d->prev_st_val = 0;
+		d->fc_changed = true;
+		
+		if (d->req_fail_unknown && d->req_used_stn) {
+			// Not a capable STN adapter after all so return to the standard path
+			ESP_LOGI(TAG, "STPX not supported - disabling STN fast path");
+			d->stn_en = false;
+			_can_driver_elm327_clear_profile_flag(d, PS_ELM327_FLAG_STN);
+			if (!_can_driver_elm327_queue_cmd(d, "ATFCSM1")) return false;
+		} else if (d->req_fail_unknown && d->req_used_rsp_count) {
+			// Adapter doesn't support the response count after all
+			ESP_LOGI(TAG, "Response count not supported - disabling");
+			d->rsp_count_en = false;
+			_can_driver_elm327_clear_profile_flag(d, PS_ELM327_FLAG_RSP_COUNT);
+		}
+	}
+	
+	// Use the caller's timeout if it is shorter than our configured maximum
+	if ((req_timeout <= 0) || (req_timeout > d->timeout_msec)) {
+		d->req_timeout_msec = d->timeout_msec;
+	} else {
+		d->req_timeout_msec = req_timeout;
+	}
+	
+	// Leave monitor mode
+	if (!_can_driver_elm327_stop_monitor(d)) return false;
+	
 	// Set the appropriate protocol if necessary (previous packet had a different size id)
 	cur_header_size = (req_id > 0x7FF) ? HEADER_SIZE_29 : HEADER_SIZE_11;
-	if ((prev_header_size == HEADER_SIZE_UNDEF) || (prev_header_size != cur_header_size)) {
-		prev_header_size = cur_header_size;
-		
-		if (cur_header_size == HEADER_SIZE_11) {
-			if (can_500k) {
-				if (!_can_driver_elm327_tx_string(TX_ST_AT_CMD, "ATTP6")) return false;
-			} else {
-				if (!_can_driver_elm327_tx_string(TX_ST_AT_CMD, "ATTP8")) return false;
+	if (!_can_driver_elm327_queue_protocol(d, cur_header_size)) return false;
+	
+	if (d->stn_en) {
+		// Register the flow control ID pair the first time we see it
+		if (!_can_driver_elm327_stn_fc_pair(d, req_id, rsp_id)) return false;
+	} else {
+		// Use the prepared commands if this is one of the scheduled requests
+		if (d->prep_changed || (d->prep_built_v15 != d->elm327_is_v15)) {
+			_can_driver_elm327_build_prep(d);
+		}
+		prep_i = _can_driver_elm327_find_prep(d, req_id, rsp_id, len, data);
+	}
+	
+	if (!d->stn_en && (req_id != d->prev_req_id)) {
+		// Set the request header and the custom flow control header to be the same
+		if (prep_i >= 0) {
+			txP = &d->prep_arena[d->prep_list[prep_i].hdr_offset];
+			for (int i=0; i<d->prep_list[prep_i].hdr_num; i++) {
+				if (!_can_driver_elm327_queue_cmd(d, txP)) return false;
+				txP += strlen(txP) + 1;
 			}
 		} else {
-			if (can_500k) {
-				if (!_can_driver_elm327_tx_string(TX_ST_AT_CMD, "ATTP7")) return false;
-			} else {
-				if (!_can_driver_elm327_tx_string(TX_ST_AT_CMD, "ATTP9")) return false;
+			txP = hdr_str;
+			(void) _can_driver_elm327_header_cmds(d, req_id, hdr_str, sizeof(hdr_str), &n);
+			for (int i=0; i<n; i++) {
+				if (!_can_driver_elm327_queue_cmd(d, txP)) return false;
+				txP += strlen(txP) + 1;
 			}
 		}
+		
+		d->prev_req_id = req_id;
+	}
+	
+	if (d->fc_changed && d->stn_en) {
+		ESP_LOGW(TAG, "STN automatic flow control ignores custom parameters");
+		d->fc_changed = false;
+	} else if (d->fc_changed) {
+		// Set the custom flow control response bytes
+		sprintf(tx_str, "ATFCSD30%02X%02X", d->fc_block_size, d->fc_sep_time);
+		if (!_can_driver_elm327_queue_cmd(d, tx_str)) return false;
+		
+		d->fc_changed = false;
 	}
 	
-	if (req_id != prev_req_id) {
-		// Set the request header
-		if (elm327_is_v15) {
-			// Work around a bug where we can only send 24-bits to ATSH so we also use ATCP
-			// for the upper 8-bits
-			if (cur_header_size == HEADER_SIZE_29) {
-				sprintf(tx_str, "ATCP%lx", (req_id >> 24));
-				if (!_can_driver_elm327_tx_string(TX_ST_AT_CMD, tx_str)) return false;
+	// Set the adapter's response timeout for this request's timeout class (or the tuned
+	// fixed value)
+	st_val = ST_DEFAULT;
+	if (tune_get(TUNE_ELM327_ST) != 0) {
+		st_val = (uint8_t) tune_get(TUNE_ELM327_ST);
+	} else if (req_timeout > 0) {
+		for (int i=0; i<NUM_ST_CLASSES; i++) {
+			if ((st_class[i] * 4) >= req_timeout) {
+				st_val = st_class[i];
+				break;
 			}
-			sprintf(tx_str, "ATSH%lx", req_id & 0xFFFFFF);
-			if (!_can_driver_elm327_tx_string(TX_ST_AT_CMD, tx_str)) return false;
-		} else {
-			sprintf(tx_str, "ATSH%lx", req_id);
-			if (!_can_driver_elm327_tx_string(TX_ST_AT_CMD, tx_str)) return false;
 		}
+	}
+	if (st_val != d->prev_st_val) {
+		sprintf(tx_str, "ATST%02X", st_val);
+		if (!_can_driver_elm327_queue_cmd(d, tx_str)) return false;
 		
-		// Set the custom flow control header to be the same as the request header
-		sprintf(tx_str, "ATFCSH%lx", req_id);
-		if (!_can_driver_elm327_tx_string(TX_ST_AT_CMD, tx_str)) return false;
-		
-		prev_req_id = req_id;
+		d->prev_st_val = st_val;
 	}
 	
-	if (rsp_id != prev_rsp_id) {
+	if (rsp_id != d->prev_rsp_id) {
 		// Set the expected response header	
-		sprintf(tx_str, "ATCRA%lx", rsp_id);
-		if (!_can_driver_elm327_tx_string(TX_ST_AT_CMD, tx_str)) return false;
+		if (prep_i >= 0) {
+			if (!_can_driver_elm327_queue_cmd(d, &d->prep_arena[d->prep_list[prep_i].cra_offset])) return false;
+		} else {
+			sprintf(tx_str, "ATCRA%lx", rsp_id);
+			if (!_can_driver_elm327_queue_cmd(d, tx_str)) return false;
+		}
 		
-		prev_rsp_id = rsp_id;
+		d->prev_rsp_id = rsp_id;
 	}
 	
-	if (elm327_is_v15) {
-		// Get rid of trailing zeros (because some cheap Chinese OBD clones fail with them)
-		for (cur_header_size=len-1; cur_header_size>= 0; cur_header_size--) {
-			if (data[cur_header_size] != 0) break;
-		}
-		len = cur_header_size + 1;
+	if (d->stn_en) {
+		_can_driver_elm327_trim_payload(d, &len, &data);
+		return _can_driver_elm327_stn_tx_packet(d, req_id, rsp_id, len, data, req_timeout);
 	}
 	
 	// Send the data as a string
-	txP = tx_str;
-	dP = data;
-	while (len--) {
-		*txP++ = _can_driver_elm327_nibble_2_ascii(*dP >> 4);
-		*txP++ = _can_driver_elm327_nibble_2_ascii(*dP++ & 0x0F);
+	if (prep_i >= 0) {
+		sendP = &d->prep_arena[d->prep_list[prep_i].pay_offset];
+		txP = sendP + d->prep_list[prep_i].pay_len;
+	} else {
+		_can_driver_elm327_trim_payload(d, &len, &data);
+		sendP = tx_str;
+		txP = tx_str + _can_driver_elm327_payload_2_ascii(len, data, tx_str);
+	}
+	d->req_used_rsp_count = false;
+	d->req_used_stn = false;
+	if (d->rsp_count_en && (d->expected_frames > 0) && (d->expected_frames <= 0xF)) {
+		*txP++ = _can_driver_elm327_nibble_2_ascii(d->expected_frames);
+		d->req_used_rsp_count = true;
 	}
 	*txP = 0;
-	if (!_can_driver_elm327_tx_string(TX_ST_REQ_PKT, tx_str)) return false;
+	if (!_can_driver_elm327_tx_pipeline(d, TX_ST_REQ_PKT, sendP)) {
+		// Force all settings to be resent since we don't know which succeeded
+		d->prev_header_size = HEADER_SIZE_UNDEF;
+		d->prev_req_id = 0;
+		d->prev_rsp_id = 0;
+		d->prev_st_val = 0;
+		d->fc_changed = true;
+		return false;
+	}
 	
 	return true;
 }
 
 
-static bool _can_driver_elm327_tx_fc_packet(uint32_t req_id, int len, uint8_t* data)
+// Queue a protocol change if the header size differs from the previous packet's
+static bool _can_driver_elm327_queue_protocol(elm327_dev_t* d, int header_size)
 {
-	// This driver skips flow control packets since it configures the ELM327 interface to
-	// deal with those
+	if ((d->prev_header_size == HEADER_SIZE_UNDEF) || (d->prev_header_size != header_size)) {
+		d->prev_header_size = header_size;
+		
+		if (header_size == HEADER_SIZE_11) {
+			if (d->can_500k) {
+				if (!_can_driver_elm327_queue_cmd(d, "ATTP6")) return false;
+			} else {
+				if (!_can_driver_elm327_queue_cmd(d, "ATTP8")) return false;
+			}
+		} else {
+			if (d->can_500k) {
+				if (!_can_driver_elm327_queue_cmd(d, "ATTP7")) return false;
+			} else {
+				if (!_can_driver_elm327_queue_cmd(d, "ATTP9")) return false;
+			}
+		}
+	}
+	
 	return true;
 }
 
 
-static void _can_driver_elm327_en_rsp_filter(bool en)
+// Stop monitor mode (any character interrupts it) and restore headers-off responses
+static bool _can_driver_elm327_stop_monitor(elm327_dev_t* d)
 {
-	// This driver ignores filtering since it always configures the ELM327 interface
-	// with the specific response it is looking for
+	if (d->tx_state != TX_ST_MONITOR) {
+		return true;
+	}
+	
+	if (!_can_driver_elm327_tx_string(d, TX_ST_MON_STOP, "")) return false;
+	
+#ifdef ENABLE_ADAPTER_ISOTP
+	if (!_can_driver_elm327_queue_cmd(d, "ATCAF1")) return false;
+#endif
+	return _can_driver_elm327_queue_cmd(d, "ATH0");
 }
 
 
-static void _can_driver_elm327_response_complete()
+// Format the commands and payload of the prepared requests into the arena.  Requests that
+// don't fit are sent by formatting them each time.
+static void _can_driver_elm327_build_prep(elm327_dev_t* d)
 {
-	// This frees us up for the next request
-	tx_state = TX_ST_IDLE;
+	const can_tx_desc_t* descP;
+	uint8_t* dP;
+	int num_desc;
+	int arena_len = 0;
+	int len, n, j;
+	
+	portENTER_CRITICAL(&d->req_mux);
+	descP = d->prep_descP;
+	num_desc = d->prep_num_desc;
+	d->prep_changed = false;
+	portEXIT_CRITICAL(&d->req_mux);
+	
+	d->prep_built_v15 = d->elm327_is_v15;
+	d->prep_num = 0;
+	for (int i=0; i<num_desc; i++, descP++) {
+		if ((descP->len > 8) || (descP->data == NULL)) continue;
+		
+		d->prep_list[d->prep_num].data = descP->data;
+		d->prep_list[d->prep_num].req_id = descP->req_id;
+		d->prep_list[d->prep_num].rsp_id = descP->rsp_id;
+		d->prep_list[d->prep_num].len = descP->len;
+		
+		// Share the header commands of an earlier request to the same IDs
+		for (j=0; j<d->prep_num; j++) {
+			if (d->prep_list[j].req_id == descP->req_id) break;
+		}
+		if (j < d->prep_num) {
+			d->prep_list[d->prep_num].hdr_offset = d->prep_list[j].hdr_offset;
+			d->prep_list[d->prep_num].hdr_num = d->prep_list[j].hdr_num;
+		} else {
+			len = _can_driver_elm327_header_cmds(d, descP->req_id, &d->prep_arena[arena_len], PREP_ARENA_LEN - arena_len, &n);
+			if (len == 0) break;
+			d->prep_list[d->prep_num].hdr_offset = arena_len;
+			d->prep_list[d->prep_num].hdr_num = n;
+			arena_len += len;
+		}
+		
+		for (j=0; j<d->prep_num; j++) {
+			if (d->prep_list[j].rsp_id == descP->rsp_id) break;
+		}
+		if (j < d->prep_num) {
+			d->prep_list[d->prep_num].cra_offset = d->prep_list[j].cra_offset;
+		} else {
+			len = snprintf(&d->prep_arena[arena_len], PREP_ARENA_LEN - arena_len, "ATCRA%lx", descP->rsp_id) + 1;
+			if ((arena_len + len) > PREP_ARENA_LEN) break;
+			d->prep_list[d->prep_num].cra_offset = arena_len;
+			arena_len += len;
+		}
+		
+		// Payload with room for a response count digit and the terminator
+		len = descP->len;
+		dP = (uint8_t*) descP->data;
+		_can_driver_elm327_trim_payload(d, &len, &dP);
+		if ((arena_len + 2*len + 2) > PREP_ARENA_LEN) break;
+		d->prep_list[d->prep_num].pay_offset = arena_len;
+		d->prep_list[d->prep_num].pay_len = _can_driver_elm327_payload_2_ascii(len, dP, &d->prep_arena[arena_len]);
+		d->prep_arena[arena_len + d->prep_list[d->prep_num].pay_len] = 0;
+		arena_len += d->prep_list[d->prep_num].pay_len + 2;
+		
+		d->prep_num += 1;
+	}
+	
+	if (d->prep_num < num_desc) {
+		ESP_LOGW(TAG, "Prepared %d of %d requests (%d arena bytes)", d->prep_num, num_desc, arena_len);
+	} else {
+		ESP_LOGI(TAG, "Prepared %d requests (%d arena bytes)", d->prep_num, arena_len);
+	}
 }
 
 
+// Index of a prepared request (-1 if the request wasn't prepared)
+static int _can_driver_elm327_find_prep(elm327_dev_t* d, uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data)
+{
+	for (int i=0; i<d->prep_num; i++) {
+		if ((d->prep_list[i].data == data) && (d->prep_list[i].req_id == req_id) &&
+		    (d->prep_list[i].rsp_id == rsp_id) && (d->prep_list[i].len == len)) {
+			return i;
+		}
+	}
+	
+	return -1;
+}
 
-//
-// API
-//
-void can_driver_elm327_set_connected(bool connected)
-{	
-	if (connected) {
-		// Trigger ELM327 controller initialization if we're idle, otherwise do nothing
-		// as we're already initializing or in the connected state.
-		if (op_state == OP_ST_DISCONNECTED) {
-			op_state = OP_ST_INIT_ELM327;
-#ifdef DEBUG_SHOW_INIT
-			ESP_LOGI(TAG, "OP_ST_INIT_ELM327");
-#endif
+
+// Format the commands setting the request header into s as consecutive null-terminated
+// strings.  Returns the length including the terminators (0 if they don't fit).
+static int _can_driver_elm327_header_cmds(elm327_dev_t* d, uint32_t req_id, char* s, int max_len, int* num_cmdsP)
+{
+	int len = 0;
+	
+	*num_cmdsP = 0;
+	if (d->elm327_is_v15) {
+		// Work around a bug where we can only send 24-bits to ATSH so we also use ATCP
+		// for the upper 8-bits
+		if (req_id > 0x7FF) {
+			len += snprintf(&s[len], max_len - len, "ATCP%lx", (req_id >> 24)) + 1;
+			if (len > max_len) return 0;
+			*num_cmdsP += 1;
 		}
+		len += snprintf(&s[len], max_len - len, "ATSH%lx", req_id & 0xFFFFFF) + 1;
 	} else {
-		op_state = OP_ST_DISCONNECTED;
-#ifdef DEBUG_SHOW_INIT
-			ESP_LOGI(TAG, "OP_ST_DISCONNECTED");
-#endif
+		len += snprintf(&s[len], max_len - len, "ATSH%lx", req_id) + 1;
 	}
+	if (len > max_len) return 0;
+	*num_cmdsP += 1;
+	
+	// Set the custom flow control header to be the same as the request header
+	len += snprintf(&s[len], max_len - len, "ATFCSH%lx", req_id) + 1;
+	if (len > max_len) return 0;
+	*num_cmdsP += 1;
+	
+	return len;
 }
 
 
-void can_driver_elm327_tx_failed()
+// Adjust a request's payload for the adapter
+static void _can_driver_elm327_trim_payload(elm327_dev_t* d, int* lenP, uint8_t** dataP)
 {
-	// Only note error while executing the TX
-	if ((tx_state == TX_ST_AT_CMD) || (tx_state == TX_ST_REQ_PKT)) {
-		tx_state = TX_ST_ERROR;
+	int i;
+	
+#ifdef ENABLE_ADAPTER_ISOTP
+	// Send the single frame payload, the adapter adds the PCI byte and padding
+	i = (*dataP)[0] & 0x0F;
+	*lenP = (i > 7) ? 7 : i;
+	*dataP += 1;
+#else
+	if (d->elm327_is_v15) {
+		// Get rid of trailing zeros (because some cheap Chinese OBD clones fail with them)
+		for (i=*lenP-1; i>=0; i--) {
+			if ((*dataP)[i] != 0) break;
+		}
+		*lenP = i + 1;
 	}
+#endif
 }
 
 
-// Note this is called asynchronously by an interface driver
-void can_driver_elm327_rx_data(char* s)
+// Hex encode a payload into s (not terminated), returning the number of characters
+static int _can_driver_elm327_payload_2_ascii(int len, const uint8_t* data, char* s)
 {
-	char c;
-	int len;
+	for (int i=0; i<len; i++) {
+		*s++ = _can_driver_elm327_nibble_2_ascii(data[i] >> 4);
+		*s++ = _can_driver_elm327_nibble_2_ascii(data[i] & 0x0F);
+	}
+	
+	return 2*len;
+}
+
+
+// Send a request with STPX after any queued commands
+static bool _can_driver_elm327_stn_tx_packet(elm327_dev_t* d, uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout)
+{
+	char stn_str[STN_MAX_STPX_LEN+1];
+	char* txP;
+	
+	txP = stn_str + sprintf(stn_str, "STPX H:%lx,D:", req_id);
+	for (int i=0; i<len; i++) {
+		*txP++ = _can_driver_elm327_nibble_2_ascii(data[i] >> 4);
+		*txP++ = _can_driver_elm327_nibble_2_ascii(data[i] & 0x0F);
+	}
+	*txP = 0;
+	if ((d->expected_frames > 0) && (d->expected_frames <= 0xF)) {
+		sprintf(txP, ",R:%d", d->expected_frames);
+	}
+	
+	d->req_used_rsp_count = false;
+	d->req_used_stn = true;
+	if (!_can_driver_elm327_tx_pipeline(d, TX_ST_REQ_PKT, stn_str)) {
+		d->prev_header_size = HEADER_SIZE_UNDEF;
+		d->prev_rsp_id = 0;
+		d->prev_st_val = 0;
+		return false;
+	}
+	
+	return true;
+}
+
+
+// Queue STCFCPA for an ID pair the adapter hasn't been told about yet
+static bool _can_driver_elm327_stn_fc_pair(elm327_dev_t* d, uint32_t req_id, uint32_t rsp_id)
+{
+	char tx_str[32];
+	
+	for (int i=0; i<d->stn_num_fc_pairs; i++) {
+		if ((d->stn_fc_pair[i][0] == req_id) && (d->stn_fc_pair[i][1] == rsp_id)) {
+			return true;
+		}
+	}
+	
+	if (d->stn_num_fc_pairs == STN_MAX_FC_PAIRS) {
+		// Start over
+		if (!_can_driver_elm327_queue_cmd(d, "STCFCPC")) return false;
+		d->stn_num_fc_pairs = 0;
+	}
+	
+	sprintf(tx_str, "STCFCPA%lx,%lx", req_id, rsp_id);
+	if (!_can_driver_elm327_queue_cmd(d, tx_str)) return false;
+	
+	d->stn_fc_pair[d->stn_num_fc_pairs][0] = req_id;
+	d->stn_fc_pair[d->stn_num_fc_pairs][1] = rsp_id;
+	d->stn_num_fc_pairs += 1;
+	
+	return true;
+}
+
+
+// Put the adapter into filtered monitor mode to receive broadcast frames until the next
+// request.  The receive filter passes the bits common to all IDs (of the first ID's size).
+static bool _can_driver_elm327_start_monitor(elm327_dev_t* d, int num_ids, const uint32_t* ids)
+{
+	char tx_str[32];
+	int header_size;
+	uint32_t all_ones;
+	uint32_t all_zeros;
+	uint32_t mask;
+	
+	if ((d->driverP == NULL) || (d->op_state != OP_ST_CONNECTED) || (num_ids == 0)) {
+		return false;
+	}
+	
+	if (!_can_driver_elm327_wait_req(d)) return false;
+	
+	if (d->tx_state == TX_ST_MONITOR) {
+		return true;
+	}
+	
+	d->req_rsp_id = 0;
+	d->pipe_len = 0;
+	d->pipe_num_cmds = 0;
+	
+	header_size = (ids[0] > 0x7FF) ? HEADER_SIZE_29 : HEADER_SIZE_11;
+	all_ones = 0xFFFFFFFF;
+	all_zeros = 0xFFFFFFFF;
+	for (int i=0; i<num_ids; i++) {
+		if (((ids[i] > 0x7FF) ? HEADER_SIZE_29 : HEADER_SIZE_11) == header_size) {
+			all_ones &= ids[i];
+			all_zeros &= ~ids[i];
+		}
+	}
+	mask = (all_ones | all_zeros) & ((header_size == HEADER_SIZE_29) ? 0x1FFFFFFF : 0x7FF);
+	
+	if (!_can_driver_elm327_queue_protocol(d, header_size)) return false;
+#ifdef ENABLE_ADAPTER_ISOTP
+	// Broadcast frames are monitored raw
+	if (!_can_driver_elm327_queue_cmd(d, "ATCAF0")) return false;
+#endif
+	if (!_can_driver_elm327_queue_cmd(d, "ATH1")) return false;
+	sprintf(tx_str, "ATCF%lx", all_ones & mask);
+	if (!_can_driver_elm327_queue_cmd(d, tx_str)) return false;
+	sprintf(tx_str, "ATCM%lx", mask);
+	if (!_can_driver_elm327_queue_cmd(d, tx_str)) return false;
+	
+	// The receive filter is replaced so ATCRA must be resent for the next request
+	d->prev_rsp_id = 0;
+	d->mon_header_size = header_size;
+	
+	return _can_driver_elm327_tx_pipeline(d, TX_ST_MONITOR, "ATMA");
+}
+
+
+static bool _can_driver_elm327_tx_fc_packet(uint32_t req_id, int len, uint8_t* data)
+{
+	// This driver skips flow control packets since it configures the ELM327 interface to
+	// deal with those
+	return true;
+}
+
+
+static void _can_driver_elm327_en_rsp_filter(bool en)
+{
+	// This driver ignores filtering since it always configures the ELM327 interface
+	// with the specific response it is looking for
+}
+
+
+static void _can_driver_elm327_set_rx_id_list(int num_ids, const uint32_t* ids)
+{
+	// This driver ignores the receive list for the same reason (ATCRA is set per request)
+}
+
+
+static void _can_driver_elm327_set_flow_control(elm327_dev_t* d, uint8_t block_size, uint8_t sep_time)
+{
+	if ((block_size != d->fc_block_size) || (sep_time != d->fc_sep_time)) {
+		d->fc_block_size = block_size;
+		d->fc_sep_time = sep_time;
+		d->fc_changed = true;   // Sent with the next request
+	}
+}
+
+
+static void _can_driver_elm327_set_expected_frames(elm327_dev_t* d, int num_frames)
+{
+	d->expected_frames = num_frames;
+}
+
+
+static void _can_driver_elm327_response_complete(elm327_dev_t* d)
+{
+	if (d->rsp_p.in_rsp) {
+		// Frames are delivered as their lines complete so the prompt may still be coming.
+		// Finish when it arrives so the next request isn't sent while the adapter is busy.
+		d->rsp_p.complete = true;
+	} else if (d->req_async) {
+		// This frees us up for the next request
+		_can_driver_elm327_finish_req(d, TX_ST_IDLE);
+	} else {
+		d->tx_state = TX_ST_IDLE;
+		_can_driver_elm327_wake_tx(d);
+	}
+}
+
+
+// Note the requests to prepare.  The arena is built by the next tx_packet since it may be
+// in the middle of using it.
+static void _can_driver_elm327_prepare_tx(elm327_dev_t* d, int num_req, const can_tx_desc_t* reqs)
+{
+	portENTER_CRITICAL(&d->req_mux);
+	d->prep_descP = reqs;
+	d->prep_num_desc = (reqs == NULL) ? 0 : num_req;
+	d->prep_changed = true;
+	portEXIT_CRITICAL(&d->req_mux);
+}
+
+
+
+//
+// API
+//
+
+// True if the interface can be stopped without a restart
+bool can_driver_elm327_if_supports_deinit(int if_type)
+{
+	if ((if_type < 0) || (if_type >= CAN_DRIVER_ELM327_NUM_IF)) return false;
+	
+	return (interface_listP[if_type]->fcn_deinit != NULL);
+}
+
+
+// Re-initialize and characterize the adapters in use, replacing their stored profiles
+void can_driver_elm327_characterize()
+{
+	elm327_dev_t* d;
+	
+	for (int i=0; i<CAN_DRIVER_ELM327_NUM_DEV; i++) {
+		d = &elm327_dev[i];
+		if (d->driverP == NULL) continue;
+		
+		d->characterize_req = true;
+		d->elm327_configured = false;
+		if (d->op_state == OP_ST_CONNECTED) {
+			d->op_state = OP_ST_INIT_ELM327;
+		}
+	}
+}
+
+
+bool can_driver_elm327_characterizing()
+{
+	for (int i=0; i<CAN_DRIVER_ELM327_NUM_DEV; i++) {
+		if (elm327_dev[i].characterize_req || elm327_dev[i].characterize_active) {
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+
+// Bytes of adapter ISO-TP payload buffers for responses up to max_rsp_len bytes (0 when
+// the minimum length buffers are enough)
+int can_driver_elm327_get_rsp_buf_size(int max_rsp_len)
+{
+#ifdef ENABLE_ADAPTER_ISOTP
+	if (max_rsp_len > CAN_MANAGER_MIN_RSP_LEN) {
+		return CAN_DRIVER_ELM327_NUM_DEV * max_rsp_len;
+	}
+#endif
+	return 0;
+}
+
+
+// Use bufP (can_driver_elm327_get_rsp_buf_size bytes) for adapter ISO-TP payloads, or the
+// minimum length buffers when NULL.  Called while no requests are outstanding.
+void can_driver_elm327_set_rsp_bufs(uint8_t* bufP, int max_rsp_len)
+{
+#ifdef ENABLE_ADAPTER_ISOTP
+	if (max_rsp_len > ISOTP_MAX_RSP_LEN) {
+		max_rsp_len = ISOTP_MAX_RSP_LEN;
+	}
+	for (int i=0; i<CAN_DRIVER_ELM327_NUM_DEV; i++) {
+		if ((bufP != NULL) && (max_rsp_len > CAN_MANAGER_MIN_RSP_LEN)) {
+			elm327_dev[i].isotp_p.data = &bufP[i * max_rsp_len];
+			elm327_dev[i].isotp_p.data_len = max_rsp_len;
+		} else {
+			elm327_dev[i].isotp_p.data = elm327_dev[i].isotp_p.min_data;
+			elm327_dev[i].isotp_p.data_len = CAN_MANAGER_MIN_RSP_LEN;
+		}
+	}
+#endif
+}
+
+
+// The interface functions are called with their CAN_DRIVER_ELM327_xxx ID and go to the
+// instance running it
+void can_driver_elm327_set_connected(int if_type, bool connected)
+{
+	elm327_dev_t* d = if_devP[if_type];
+	
+	if (d == NULL) return;
+	
+	if (connected) {
+		// Trigger ELM327 controller initialization if we're idle, otherwise do nothing
+		// as we're already initializing or in the connected state.
+		if (d->op_state == OP_ST_DISCONNECTED) {
+			d->op_state = OP_ST_INIT_ELM327;
+			event_publish(EVENT_LINK_UP);
+#ifdef DEBUG_SHOW_INIT
+			ESP_LOGI(TAG, "OP_ST_INIT_ELM327");
+#endif
+		}
+	} else {
+		d->op_state = OP_ST_DISCONNECTED;
+		if ((d->tx_state == TX_ST_MONITOR) || (d->tx_state == TX_ST_MON_STOP)) {
+			// Adapter is still monitoring with headers on so it must be fully re-initialized
+			d->elm327_configured = false;
+			d->tx_state = TX_ST_IDLE;
+		}
+#ifdef DEBUG_SHOW_INIT
+			ESP_LOGI(TAG, "OP_ST_DISCONNECTED");
+#endif
+	}
+}
+
+
+void can_driver_elm327_tx_failed(int if_type)
+{
+	elm327_dev_t* d = if_devP[if_type];
+	
+	if (d == NULL) return;
+	
+	// Only note error while executing the TX
+	if (d->req_async) {
+		_can_driver_elm327_finish_req(d, TX_ST_ERROR);
+	} else if ((d->tx_state == TX_ST_AT_CMD) || (d->tx_state == TX_ST_REQ_PKT)) {
+		d->tx_state = TX_ST_ERROR;
+		_can_driver_elm327_wake_tx(d);
+	}
+}
+
+
+// Note this is called asynchronously by an interface driver with a span of its receive
+// buffer (not NUL terminated).  The data is parsed in place.
+void can_driver_elm327_rx_data(int if_type, const char* s, int len)
+{
+	elm327_dev_t* d = if_devP[if_type];
+	char c;
 	
-	// Push data into rx_buf, looking for the terminator '>'
-	len = strlen(s);
+	if (d == NULL) return;
 	
 #ifdef DEBUG_SHOW_DATA
 	printf("%s RX: ", TAG);
@@ -382,11 +1381,17 @@ void can_driver_elm327_rx_data(char* s)
 	}
 #endif
 
-		rx_buf[rx_buf_push_index++] = c;
-		if (rx_buf_push_index >= RX_BUFF_LEN) rx_buf_push_index = 0;
-		
 		if (c == '>') {
-			_can_driver_elm327_process_rx_buf();
+			_can_driver_elm327_rx_prompt(d);
+		} else if (d->tx_state == TX_ST_MONITOR) {
+			// Monitor mode frames are processed a line at a time
+			_can_driver_elm327_rx_monitor_char(d, c);
+#ifdef ENABLE_ADAPTER_ISOTP
+		} else if (d->tx_state == TX_ST_REQ_PKT) {
+			_can_driver_elm327_rx_isotp_char(d, c);
+#endif
+		} else {
+			_can_driver_elm327_rx_rsp_char(d, c);
 		}
 	}
 }
@@ -396,25 +1401,47 @@ void can_driver_elm327_rx_data(char* s)
 //
 // Internal functions
 //
-static void _can_driver_elm327_task()
+static void _can_driver_elm327_task(void* arg)
 {
+	elm327_dev_t* d = (elm327_dev_t*) arg;
 	char* s;
 	int i;
 	
 	ESP_LOGI(TAG, "Start task");
 	
-	while (1) {
-		while (op_state == OP_ST_INIT_ELM327) {
+	while (!d->stop_req) {
+		while ((d->op_state == OP_ST_INIT_ELM327) && !d->stop_req) {
+			// Let a request in flight finish (re-initializing while connected)
+			(void) _can_driver_elm327_wait_req(d);
+			
+			// Discard anything left from before the connection dropped
+			d->req_rsp_id = 0;
+			_can_driver_elm327_reset_parser(d);
+			d->pipe_len = 0;
+			d->pipe_num_cmds = 0;
+			
+			// Skip initialization if the adapter kept running while the link was down
+			if (d->elm327_configured) {
+				if (_can_driver_elm327_quick_probe(d)) {
+					ESP_LOGI(TAG, "ELM327 v%s still configured", d->elm327_version_string);
+					d->op_state = OP_ST_CONNECTED;
+					break;
+				}
+				
+				ESP_LOGI(TAG, "ELM327 needs re-initialization");
+				d->elm327_configured = false;
+			}
+			
 			// version string starts out empty
-			elm327_version_string[0] = 0;
+			d->elm327_version_string[0] = 0;
 			
 			// Send initialization commands
-			for (i=0; i<NUM_ELM327_INIT_CMDS; i++) {
+			for (i=0; (i<NUM_ELM327_INIT_CMDS) && !d->stop_req; i++) {
 				s = elm327_init_cmd[i];
 #ifdef DEBUG_SHOW_INIT
 				ESP_LOGI(TAG, "Init: %s", s);
 #endif
-				if (!_can_driver_elm327_tx_string(TX_ST_AT_CMD, s)) {
+				if (!_can_driver_elm327_tx_string(d, TX_ST_AT_CMD, s)) {
 					ESP_LOGE(TAG, "ELM327 init command failed - %s", s);
 					vTaskDelay(pdMS_TO_TICKS(1000));  // Just not to overwhelm the log file
 					break;  // Force a restart of initialization
@@ -422,141 +1449,612 @@ static void _can_driver_elm327_task()
 			}
 			
 			if (i == NUM_ELM327_INIT_CMDS) {
-				// Successfully completed initialization
-				op_state = OP_ST_CONNECTED;
+				// Successfully completed initialization.  The adapter was reset so all
+				// settings must be sent with the next request.
+				d->prev_header_size = HEADER_SIZE_UNDEF;
+				d->prev_req_id = 0;
+				d->prev_rsp_id = 0;
+				d->prev_st_val = ST_DEFAULT;
+				d->fc_changed = (d->fc_block_size != 0) || (d->fc_sep_time != 0);
+				
+				// Version handling
+				ESP_LOGI(TAG, "Found ELM327 v%s", d->elm327_version_string);
+				d->elm327_is_v15 = (strcmp(d->elm327_version_string, "1.5") == 0);
+				
+				// Select the features to use from the adapter's profile
+				_can_driver_elm327_setup_features(d);
+				
+				// Unless the connection dropped while we were setting up
+				if (d->op_state == OP_ST_INIT_ELM327) {
+				d->op_state = OP_ST_CONNECTED;
 #ifdef DEBUG_SHOW_INIT
 				ESP_LOGI(TAG, "OP_ST_CONNECTED");
 #endif
-
-				// Version handling
-				ESP_LOGI(TAG, "Found ELM327 v%s", elm327_version_string);
-				elm327_is_v15 = (strcmp(elm327_version_string, "1.5") == 0);
+					}
+				
+				d->elm327_configured = (d->op_state == OP_ST_CONNECTED);
 			}
 		}
 		
 		// Idle while not initializing
 		vTaskDelay(pdMS_TO_TICKS(50));
 	}
+	
+	ESP_LOGI(TAG, "Stop task");
+	d->task_handle_elm327_driver = NULL;
+	vTaskDelete(NULL);
 }
 
 
-static void _can_driver_elm327_process_rx_buf()
+// Check that a previously initialized adapter is still configured.  ATI returns the version
+// which must match and, since ATE0 isn't saved, any echo means the adapter was reset.  The
+// cached protocol, header and feature state remain valid on success.
+static bool _can_driver_elm327_quick_probe(elm327_dev_t* d)
 {
-	bool first_char = true;
-	bool high_nibble = true;
-	bool has_version = false;
-	bool saw_data = false;
-	bool success = false;
-	char c;
-	int n = 0;
-	uint8_t data[8];
+	char cached_ver[MAX_ELM327_VER_LEN];
+	bool success;
+	
+	strcpy(cached_ver, d->elm327_version_string);
+	d->elm327_version_string[0] = 0;
+	d->echo_seen = false;
+	
+	success = _can_driver_elm327_tx_string(d, TX_ST_AT_CMD, "ATI");
+	success = success && !d->echo_seen && (strcmp(cached_ver, d->elm327_version_string) == 0);
+	
+	if (!success) {
+		// Protocol and header settings have to be resent too
+		d->prev_header_size = HEADER_SIZE_UNDEF;
+		d->prev_req_id = 0;
+		d->prev_rsp_id = 0;
+	}
+	
+	return success;
+}
+
+
+// Use the stored profile for the adapter, characterizing it first if it has none (or a
+// new characterization was requested)
+static void _can_driver_elm327_setup_features(elm327_dev_t* d)
+{
+	char id[PS_ELM327_ID_LEN+1];
+	elm327_profiles_t* profilesP;
+	elm327_profile_t* pP = NULL;
+	
+	// Basic features until a profile is applied
+	d->rsp_count_en = false;
+	d->pipeline_en = false;
+	d->stn_en = false;
+	
+	_can_driver_elm327_get_identity(d, id);
+	
+	// Find the adapter's profile or the least recently used one to replace
+	d->profileP = NULL;
+	if (ps_get_config(PS_CONFIG_TYPE_ELM327, (void**) &profilesP)) {
+		for (int i=0; i<PS_ELM327_NUM_PROFILES; i++) {
+			if (profilesP->profile[i].valid && (strcmp(profilesP->profile[i].id, id) == 0)) {
+				d->profileP = &profilesP->profile[i];
+				break;
+			}
+			if ((pP == NULL) || (!profilesP->profile[i].valid && pP->valid) ||
+			    ((profilesP->profile[i].valid == pP->valid) && (profilesP->profile[i].use_seq < pP->use_seq))) {
+				pP = &profilesP->profile[i];
+			}
+		}
+	}
+	
+	if ((d->profileP == NULL) || d->characterize_req) {
+		d->characterize_active = true;
+		d->characterize_req = false;
+		event_publish(EVENT_ADAPTER_TESTING);
+		if (d->profileP == NULL) {
+			d->profileP = pP;
+		}
+		
+		if (d->profileP != NULL) {
+			memset(d->profileP, 0, sizeof(elm327_profile_t));
+			strcpy(d->profileP->id, id);
+			_can_driver_elm327_characterize(d, d->profileP);
+			d->profileP->valid = (d->op_state == OP_ST_INIT_ELM327);
+			profilesP->seq += 1;
+			d->profileP->use_seq = profilesP->seq;
+			(void) ps_save_config(PS_CONFIG_TYPE_ELM327);
+		}
+		d->characterize_active = false;
+		event_publish(EVENT_ADAPTER_TESTING);
+	} else {
+		ESP_LOGI(TAG, "Using stored profile for %s", id);
+		if (d->profileP->use_seq != profilesP->seq) {
+			// Note it as the most recently used
+			profilesP->seq += 1;
+			d->profileP->use_seq = profilesP->seq;
+			(void) ps_save_config(PS_CONFIG_TYPE_ELM327);
+		}
+	}
+	
+	if (d->profileP != NULL) {
+		_can_driver_elm327_apply_profile(d, d->profileP);
+	}
+}
+
+
+// Build the adapter identity from the interface and its ATI, AT@1 and STI responses
+// (clones often answer "?" to the last two)
+static void _can_driver_elm327_get_identity(elm327_dev_t* d, char* id)
+{
+	static char* id_cmd[] = {"ATI", "AT@1", "STI"};
+	char txt[MAX_RSP_TEXT_LEN+1];
+	int n;
 	
-	// Parse all lines in this data
-	while ((c = rx_buf[rx_buf_pop_index]) != '>') {
-		rx_buf_pop_index += 1;
-		if (rx_buf_pop_index >= RX_BUFF_LEN) rx_buf_pop_index = 0;
+	n = sprintf(id, "%s", (d->if_index == CAN_DRIVER_ELM327_BLE) ? "BLE" : ((d->if_index == CAN_DRIVER_ELM327_USB) ? "USB" : "WIFI"));
+	d->stn_seen = false;
+	for (int i=0; i<3; i++) {
+		if (!_can_driver_elm327_query(d, id_cmd[i], txt)) {
+			txt[0] = 0;
+		}
+		n += snprintf(&id[n], PS_ELM327_ID_LEN + 1 - n, "|%s", txt);
+		if (n >= PS_ELM327_ID_LEN) break;
+	}
+}
+
+
+// Send a command and return the first line of its response in txt
+static bool _can_driver_elm327_query(elm327_dev_t* d, char* cmd, char* txt)
+{
+	bool success;
+	
+	d->rsp_text_len = 0;
+	d->rsp_text[0] = 0;
+	d->rsp_text_en = true;
+	success = _can_driver_elm327_tx_string(d, TX_ST_AT_CMD, cmd);
+	d->rsp_text_en = false;
+	strcpy(txt, d->rsp_text);
+	
+	return success;
+}
+
+
+static void _can_driver_elm327_characterize(elm327_dev_t* d, elm327_profile_t* pP)
+{
+	char buf[CAN_DRIVER_MAX_ELM327_STR_LEN+1];
+	int64_t start_usec;
+	int64_t t1;
+	int64_t t2;
+	int max_n;
+	int n;
+	
+	ESP_LOGI(TAG, "Characterizing %s", pP->id);
+	
+	// Per-command latency and sustained rate over a burst of commands
+	start_usec = esp_timer_get_time();
+	t2 = start_usec;
+	for (n=0; n<CHAR_NUM_CMDS; n++) {
+		t1 = t2;
+		if (!_can_driver_elm327_tx_string(d, TX_ST_AT_CMD, CHAR_CMD)) break;
+		t2 = esp_timer_get_time();
+		if ((t2 - t1) > pP->cmd_lat_max_usec) {
+			pP->cmd_lat_max_usec = (uint32_t) (t2 - t1);
+		}
+	}
+	if ((n != 0) && (t2 > start_usec)) {
+		pP->cmd_lat_usec = (uint32_t) ((t2 - start_usec) / n);
+		pP->cmd_rate = (uint16_t) ((n * 1000000LL) / (t2 - start_usec));
+	}
+	
+	// The response count suffix is supported by v1.3 and later except for the v1.5 clones.
+	// There is no harmless request to test it with so it is cleared if a request is rejected.
+	if (!d->elm327_is_v15 && (atof(d->elm327_version_string) >= 1.3)) {
+		pP->flags |= PS_ELM327_FLAG_RSP_COUNT;
+	}
+	
+	// Longest pipelined write the adapter accepts, doubling the number of commands in one
+	// write up to what the interface can send
+	max_n = d->driverP->fcn_max_tx_len();
+	if (max_n > CAN_DRIVER_MAX_ELM327_STR_LEN) {
+		max_n = CAN_DRIVER_MAX_ELM327_STR_LEN;
+	}
+	max_n = max_n / CHAR_CMD_LEN;
+	n = 2;
+	while (n <= max_n) {
+		buf[0] = 0;
+		for (int i=0; i<n; i++) {
+			strcat(buf, (i == 0) ? CHAR_CMD : "\r" CHAR_CMD);
+		}
+		if (!_can_driver_elm327_tx_lines(d, n - 1, TX_ST_AT_CMD, buf)) {
+			// Resynchronize with the adapter
+			vTaskDelay(pdMS_TO_TICKS(100));
+			(void) _can_driver_elm327_tx_string(d, TX_ST_AT_CMD, CHAR_CMD);
+			break;
+		}
+		pP->max_line_len = (uint8_t) (n * CHAR_CMD_LEN);
+		if (n == max_n) break;
+		n = ((2 * n) > max_n) ? max_n : (2 * n);
+	}
+	
+	// STN adapters (clones respond to STI with "?") can use the single-command transmit
+	// path with the adapter's automatic flow control (checked when the profile is applied)
+	if (d->stn_seen && (d->driverP->fcn_max_tx_len() >= STN_MAX_STPX_LEN)) {
+		pP->flags |= PS_ELM327_FLAG_STN;
+	}
+	
+	ESP_LOGI(TAG, "  Command latency %lu uSec (max %lu uSec), %u commands/sec", pP->cmd_lat_usec, pP->cmd_lat_max_usec, pP->cmd_rate);
+	ESP_LOGI(TAG, "  Longest pipelined write %u", pP->max_line_len);
+}
+
+
+static void _can_driver_elm327_apply_profile(elm327_dev_t* d, elm327_profile_t* pP)
+{
+	d->rsp_count_en = (pP->flags & PS_ELM327_FLAG_RSP_COUNT) != 0;
+	ESP_LOGI(TAG, "Response count %s", d->rsp_count_en ? "enabled" : "disabled");
+	
+	d->pipe_max_len = pP->max_line_len;
+	if (d->pipe_max_len > d->driverP->fcn_max_tx_len()) {
+		d->pipe_max_len = d->driverP->fcn_max_tx_len();
+	}
+	d->pipeline_en = (d->pipe_max_len >= (2 * CHAR_CMD_LEN));
+	ESP_LOGI(TAG, "Command pipelining %s", d->pipeline_en ? "enabled" : "disabled");
+	
+	// The STN path uses the adapter's automatic flow control
+	d->stn_en = false;
+	d->stn_num_fc_pairs = 0;
+	if ((pP->flags & PS_ELM327_FLAG_STN) != 0) {
+		d->stn_en = _can_driver_elm327_tx_string(d, TX_ST_AT_CMD, "ATFCSM0");
+		if (!d->stn_en) {
+			_can_driver_elm327_clear_profile_flag(d, PS_ELM327_FLAG_STN);
+		}
+	}
+	ESP_LOGI(TAG, "STN fast path %s", d->stn_en ? "enabled" : "disabled");
+}
+
+
+// Remember a feature the adapter turned out not to support
+static void _can_driver_elm327_clear_profile_flag(elm327_dev_t* d, uint8_t flag)
+{
+	if ((d->profileP != NULL) && ((d->profileP->flags & flag) != 0)) {
+		d->profileP->flags &= ~flag;
+		(void) ps_save_config(PS_CONFIG_TYPE_ELM327);
+	}
+}
+
+
+// Parse one response character.  Data lines are passed to the CAN manager as soon as the
+// terminating CR arrives.
+static void _can_driver_elm327_rx_rsp_char(elm327_dev_t* d, char c)
+{
+	uint8_t nibble;
+	
+	d->rsp_p.in_rsp = true;
+	
+	if ((c == 0x0D) || (c == 0x0A)) {
+		// CR (or NL) terminate a valid data line
+		if (d->rsp_p.saw_data) {
+			d->rsp_p.saw_data = false;
+			d->rsp_p.success = true;
+			can_rx_packet(d->prev_rsp_id, d->rsp_p.n, d->rsp_p.data, esp_timer_get_time());
+		}
 		
-		if ((c == 0x0D) || (c == 0x0A)) {
-			// CR (or NL) terminate a valid data line
-			if (saw_data) {
-				saw_data = false;
-				can_rx_packet(prev_rsp_id, n, data);
+		// Identification text is only the first line
+		if (d->rsp_text_len != 0) {
+			d->rsp_text_en = false;
+		}
+		
+		// CR (or NL) always set first_char for subsequent data
+		d->rsp_p.first_char = true;
+		d->rsp_p.has_version = false;
+		d->rsp_p.high_nibble = true;
+		d->rsp_p.n = 0;
+		return;
+	}
+	
+	if (d->tx_state == TX_ST_AT_CMD) {
+		if (d->rsp_text_en && (d->rsp_text_len < MAX_RSP_TEXT_LEN) && (c >= ' ') && (c != '|')) {
+			d->rsp_text[d->rsp_text_len++] = c;
+			d->rsp_text[d->rsp_text_len] = 0;
+		}
+		
+		if (d->rsp_p.first_char) {
+			if ((c == 'O') || (c == 'E')) {
+				// "OK" (or "ELM327" from ATZ)
+				d->rsp_p.success = true;
+				
+				if (c == 'E') {
+					// Start processing of string for version
+					d->rsp_p.has_version = true;
+					_can_driver_elm327_proc_version_info(d, c, true);
+				}
+			} else if (c == 'S') {
+				// "STNxxxx" from STI
+				d->rsp_p.success = true;
+				d->stn_seen = true;
+			} else if (c == 'A') {
+				// Echo of our AT command
+				d->echo_seen = true;
+			} else if (c == '?') {
+				ESP_LOGE(TAG, "Unknown TX command");
+				d->rsp_p.success = false;
+			} else if (d->rsp_text_en) {
+				// Any identification text
+				d->rsp_p.success = true;
+			}
+		} else if (d->rsp_p.has_version) {
+			// Collect and process characters until has_version is false (next CR)
+			_can_driver_elm327_proc_version_info(d, c, false);
+		}
+	} else if (d->tx_state == TX_ST_REQ_PKT) {
+		nibble = hex_char_val[(uint8_t) c];
+		if (nibble != 0) {
+			if (d->rsp_p.first_char) {
+				// Saw data
+				d->rsp_p.saw_data = true;
 			}
 			
-			// CR (or NL) always set first_char for subsequent data
-			first_char = true;
-			has_version = false;
-			high_nibble = true;
-			n = 0;
-		} else {
-			if (tx_state == TX_ST_AT_CMD) {
-				if (first_char) {
-					if ((c == 'O') || (c == 'E')) {
-						// "OK" (or "ELM327" from ATZ)
-						success = true;
-						
-						if (c == 'E') {
-							// Start processing of string for version
-							has_version = true;
-							_can_driver_elm327_proc_version_info(c, true);
-						}
-					} else if (c == '?') {
-						ESP_LOGE(TAG, "Unknown TX command");
-						success = false;
-					}
-				} else if (has_version) {
-					// Collect and process characters until has_version is false (next CR)
-					_can_driver_elm327_proc_version_info(c, false);
-				}
-			} else if (tx_state == TX_ST_REQ_PKT) {
-				if (_can_driver_elm327_is_hex_char(c)) {
-					if (first_char) {
-						// Saw data
-						saw_data = true;
-						success = true;
-					}
-					
-					// Store data in our array (expect 2 hex-characters per byte)
-					if (n < 8) {
-						if (high_nibble) {
-							data[n] = _can_driver_elm327_ascii_to_nibble(c);
-							high_nibble = false;
-						} else {
-							data[n] = (data[n] << 4) | _can_driver_elm327_ascii_to_nibble(c);
-							n += 1;
-							high_nibble = true;
-						}
-					}
-				} else if (c == ' ') {
-					// Handle case where only 1 character was sent as a hex number (should not occur)
-					if (!high_nibble) {
-						n += 1;
-						high_nibble = true;
-					}
-				} else if (first_char) {
-					if (c == 'N') {
-					// "NO DATA"
-						ESP_LOGE(TAG, "No data for request");
-					} else if (c == '?') {
-						// Shouldn't see this but 
-						ESP_LOGE(TAG, "Request received ? response");
-					}
-					success = false;
+			// Store data in our array (expect 2 hex-characters per byte)
+			if (d->rsp_p.n < 8) {
+				if (d->rsp_p.high_nibble) {
+					d->rsp_p.data[d->rsp_p.n] = nibble - 1;
+					d->rsp_p.high_nibble = false;
+				} else {
+					d->rsp_p.data[d->rsp_p.n] = (d->rsp_p.data[d->rsp_p.n] << 4) | (nibble - 1);
+					d->rsp_p.n += 1;
+					d->rsp_p.high_nibble = true;
 				}
 			}
-			
-			// Clear flag after consuming it
-			first_char = false;
+		} else if (c == ' ') {
+			// Handle case where only 1 character was sent as a hex number (should not occur)
+			if (!d->rsp_p.high_nibble) {
+				d->rsp_p.n += 1;
+				d->rsp_p.high_nibble = true;
+			}
+		} else if (d->rsp_p.first_char) {
+			if (c == 'N') {
+				// "NO DATA" - the ECU didn't respond so this is reported like a timeout
+				d->no_data = true;
+			} else if (c == '?') {
+				// Shouldn't see this unless the adapter doesn't understand the request format
+				ESP_LOGE(TAG, "Request received ? response");
+				d->unknown_cmd = true;
+			}
+			d->rsp_p.success = false;
+		} else {
+			// Status message starting with a hex character (e.g. "CAN ERROR", "BUFFER FULL")
+			d->rsp_p.saw_data = false;
 		}
-		
 	}
 	
-	// Skip past the '>' character in preparation for the next response
-	rx_buf_pop_index += 1;
-	if (rx_buf_pop_index >= RX_BUFF_LEN) rx_buf_pop_index = 0;
-	
+	// Clear flag after consuming it
+	d->rsp_p.first_char = false;
+}
+
+
+// Handle the '>' prompt ending a response
+static void _can_driver_elm327_rx_prompt(elm327_dev_t* d)
+{
 	// Note if response was successful
-	if (tx_state == TX_ST_AT_CMD) {
-		tx_state = success ? TX_ST_IDLE : TX_ST_ERROR;
-	} else if (tx_state == TX_ST_REQ_PKT) {
+	if (d->tx_state == TX_ST_MON_STOP) {
+		// Adapter responds "STOPPED" (or with a final frame) when leaving monitor mode
+		d->tx_state = TX_ST_IDLE;
+	} else if (d->tx_state == TX_ST_AT_CMD) {
+		if (!d->rsp_p.success) {
+			d->tx_state = TX_ST_ERROR;
+		} else if (d->pipe_pending_cmds > 0) {
+			// Pipelined AT command complete, move on to the next
+			d->pipe_pending_cmds -= 1;
+			if (d->pipe_pending_cmds == 0) {
+				d->tx_state = d->pipe_final_state;
+			}
+		} else {
+			d->tx_state = TX_ST_IDLE;
+		}
+	} else if (d->tx_state == TX_ST_REQ_PKT) {
 		// Success is indicated when we get all the data and _can_driver_elm327_response_complete is called.
 		// That way we handle the case I saw where the ELM327 controller didn't return all the data for
 		// a multi-packet response before sending '>'
-		if (!success) {
-			tx_state = TX_ST_ERROR;
+		if (d->rsp_p.complete) {
+			d->tx_state = TX_ST_IDLE;
+		} else if (!d->rsp_p.success) {
+			d->tx_state = TX_ST_ERROR;
+		}
+	}
+	
+	// Report the result of an asynchronous request (including a failed pipelined command
+	// in front of it)
+	if (d->req_async && (d->tx_state != TX_ST_AT_CMD) && (d->tx_state != TX_ST_REQ_PKT)) {
+		_can_driver_elm327_finish_req(d, d->tx_state);
+	}
+	
+	// Ready for the next response
+	_can_driver_elm327_reset_parser(d);
+	
+	_can_driver_elm327_wake_tx(d);
+}
+
+
+static void _can_driver_elm327_reset_parser(elm327_dev_t* d)
+{
+	d->rsp_p.first_char = true;
+	d->rsp_p.high_nibble = true;
+	d->rsp_p.has_version = false;
+	d->rsp_p.saw_data = false;
+	d->rsp_p.success = false;
+	d->rsp_p.in_rsp = false;
+	d->rsp_p.complete = false;
+	d->rsp_p.n = 0;
+	
+	d->mon_p.valid = true;
+	d->mon_p.id_chars = 0;
+	d->mon_p.n = 0;
+	d->mon_p.id = 0;
+	
+#ifdef ENABLE_ADAPTER_ISOTP
+	d->isotp_p.first_char = true;
+	d->isotp_p.numbered = false;
+	d->isotp_p.line_bad = false;
+	d->isotp_p.nibbles = 0;
+	d->isotp_p.line_val = 0;
+	d->isotp_p.total_len = -1;
+	d->isotp_p.n = 0;
+	d->isotp_p.line_start = 0;
+#endif
+}
+
+
+static void _can_driver_elm327_wake_tx(elm327_dev_t* d)
+{
+	if (d->tx_wait_task != NULL) {
+		xTaskNotifyGive(d->tx_wait_task);
+	}
+}
+
+
+// Wait for an outstanding asynchronous request to finish.  The request timer normally
+// ends it, this is just a backstop.
+static bool _can_driver_elm327_wait_req(elm327_dev_t* d)
+{
+	TickType_t start_ticks = xTaskGetTickCount();
+	TickType_t to_ticks = pdMS_TO_TICKS(d->timeout_msec);
+	TickType_t elapsed;
+	
+	d->tx_wait_task = xTaskGetCurrentTaskHandle();
+	while (d->req_async) {
+		elapsed = xTaskGetTickCount() - start_ticks;
+		if (elapsed >= to_ticks) {
+			ESP_LOGE(TAG, "Request did not finish");
+			_can_driver_elm327_finish_req(d, TX_ST_TIMEOUT);
+			return false;
 		}
+		(void) ulTaskNotifyTake(pdTRUE, to_ticks - elapsed);
+	}
+	
+	return true;
+}
+
+
+// Called from the receive path, interface or timer task to end the asynchronous request
+// with the result state.  Only the first call for a request reports it.
+static void _can_driver_elm327_finish_req(elm327_dev_t* d, int result)
+{
+	bool finished;
+	bool saw_no_data;
+	bool saw_unknown;
+	uint32_t rsp_id;
+	
+	// Take the response flags before the waiting task can start another transmission
+	portENTER_CRITICAL_SAFE(&d->req_mux);
+	finished = d->req_async;
+	saw_no_data = d->no_data;
+	saw_unknown = d->unknown_cmd;
+	rsp_id = d->req_rsp_id;
+	if (finished) {
+		d->req_async = false;
+		d->tx_state = TX_ST_IDLE;
+	}
+	portEXIT_CRITICAL_SAFE(&d->req_mux);
+	
+	if (!finished) return;
+	
+	can_timer_stop(&d->req_timer);
+	
+	if (result == TX_ST_TIMEOUT) {
+#ifdef DEBUG_SHOW_DATA
+		ESP_LOGI(TAG, "TX Timeout");
+#endif
+		can_rsp_error(rsp_id, CAN_ERRNO_TIMEOUT);
+	} else if ((result == TX_ST_ERROR) && saw_no_data) {
+#ifdef DEBUG_SHOW_DATA
+		ESP_LOGI(TAG, "TX No Data");
+#endif
+		can_rsp_error(rsp_id, CAN_ERRNO_NO_DATA);
+	} else if (result == TX_ST_ERROR) {
+#ifdef DEBUG_SHOW_DATA
+		ESP_LOGE(TAG, "TX Error");
+#endif
+		d->req_fail_unknown = saw_unknown;
+		d->req_failed = true;
+		can_rsp_error(rsp_id, CAN_ERRNO_IF_ERROR);
 	}
+	
+	_can_driver_elm327_wake_tx(d);
+}
+
+
+static void _can_driver_elm327_req_timer_cb(void* arg)
+{
+	_can_driver_elm327_finish_req((elm327_dev_t*) arg, TX_ST_TIMEOUT);
+}
+
+
+static bool _can_driver_elm327_tx_string(elm327_dev_t* d, int pkt_state, char* s)
+{
+	return _can_driver_elm327_tx_lines(d, 0, pkt_state, s);
+}
+
+
+// Queue an AT command to be sent with the following request (or send it immediately
+// if the adapter doesn't support pipelining)
+static bool _can_driver_elm327_queue_cmd(elm327_dev_t* d, char* s)
+{
+	int len = strlen(s);
+	
+	if (!d->pipeline_en) {
+		return _can_driver_elm327_tx_string(d, TX_ST_AT_CMD, s);
+	}
+	
+	// Send the queued commands first if this one won't fit (room for CR separator)
+	if ((d->pipe_len + len + 1) > d->pipe_max_len) {
+		if (d->pipe_num_cmds != 0) {
+			d->pipe_buf[d->pipe_len - 1] = 0;   // Interface appends the final CR
+			if (!_can_driver_elm327_tx_lines(d, d->pipe_num_cmds - 1, TX_ST_AT_CMD, d->pipe_buf)) return false;
+			d->pipe_len = 0;
+			d->pipe_num_cmds = 0;
+		}
+	}
+	
+	strcpy(&d->pipe_buf[d->pipe_len], s);
+	d->pipe_len += len;
+	d->pipe_buf[d->pipe_len++] = 0x0D;
+	d->pipe_buf[d->pipe_len] = 0;
+	d->pipe_num_cmds += 1;
+	
+	return true;
+}
+
+
+// Send s with any queued commands in front of it
+static bool _can_driver_elm327_tx_pipeline(elm327_dev_t* d, int pkt_state, char* s)
+{
+	int len = strlen(s);
+	int n = d->pipe_num_cmds;
+	
+	d->pipe_num_cmds = 0;
+	if (n == 0) {
+		return _can_driver_elm327_tx_string(d, pkt_state, s);
+	}
+	
+	if ((d->pipe_len + len + 1) > d->pipe_max_len) {
+		// Send the queued commands by themselves
+		d->pipe_buf[d->pipe_len - 1] = 0;   // Interface appends the final CR
+		if (!_can_driver_elm327_tx_lines(d, n - 1, TX_ST_AT_CMD, d->pipe_buf)) return false;
+		return _can_driver_elm327_tx_string(d, pkt_state, s);
+	}
+	
+	strcpy(&d->pipe_buf[d->pipe_len], s);
+	d->pipe_len = 0;
+	return _can_driver_elm327_tx_lines(d, n, pkt_state, d->pipe_buf);
 }
 
 
-static bool _can_driver_elm327_tx_string(int pkt_state, char* s)
+// Send a string containing num_prev_cmds CR-terminated AT commands followed by a final
+// command of type pkt_state and wait for all of them to complete.  A final request packet
+// is not waited for (see _can_driver_elm327_finish_req).
+static bool _can_driver_elm327_tx_lines(elm327_dev_t* d, int num_prev_cmds, int pkt_state, char* s)
 {
 	bool success;
-	int to_count = timeout_msec;
+	TickType_t start_ticks;
+	TickType_t to_ticks = pdMS_TO_TICKS(d->timeout_msec);
+	TickType_t elapsed;
 	
-	if (driverP == NULL) {
+	if (d->driverP == NULL) {
 		ESP_LOGE(TAG, "Send tx string without driver");
-		tx_state = TX_ST_IDLE;
+		d->tx_state = TX_ST_IDLE;
 		return false;
 	}
 	
@@ -564,33 +2062,58 @@ static bool _can_driver_elm327_tx_string(int pkt_state, char* s)
 	ESP_LOGI(TAG, "TX: %s", s);
 #endif
 	
+	// Set the type of command this is before sending since the interface may receive the
+	// response before fcn_tx_line returns
+	d->no_data = false;
+	d->unknown_cmd = false;
+	d->pipe_final_state = pkt_state;
+	d->pipe_pending_cmds = num_prev_cmds;
+	d->tx_wait_task = xTaskGetCurrentTaskHandle();
+	(void) ulTaskNotifyTake(pdTRUE, 0);
+	d->tx_state = (num_prev_cmds != 0) ? TX_ST_AT_CMD : pkt_state;
+	start_ticks = xTaskGetTickCount();
+	
+	if (pkt_state == TX_ST_REQ_PKT) {
+		// Timed from the write (including any pipelined commands) like the wait below
+		d->req_async = true;
+		can_timer_start(&d->req_timer, d->req_timeout_msec);
+	}
+	
 	// Send the string to the interface for transmission
-	if (!driverP->fcn_tx_line(s)) {
+	if (!d->driverP->fcn_tx_line(s)) {
 		ESP_LOGE(TAG, "Interface failed to send %s", s);
-		tx_state = TX_ST_IDLE;
+		if (pkt_state == TX_ST_REQ_PKT) {
+			portENTER_CRITICAL(&d->req_mux);
+			d->req_async = false;
+			portEXIT_CRITICAL(&d->req_mux);
+			can_timer_stop(&d->req_timer);
+		}
+		d->tx_state = TX_ST_IDLE;
 		return false;
 	}
 	
-	// Set the type of command this is
-	tx_state = pkt_state;
+	if (pkt_state == TX_ST_REQ_PKT) {
+		return true;
+	}
 	
-	// Spin waiting for the transmission to succeed or error/timeout
-	while (tx_state == pkt_state) {
-		vTaskDelay(pdMS_TO_TICKS(10));
-		
-		to_count -= 10;
-		if (to_count <= 0) {
-			tx_state = TX_ST_TIMEOUT;
+	// Wait for the transmission to succeed or error/timeout (monitor mode continues after
+	// this returns).  The receive path notifies us when the state changes.
+	while ((d->tx_state == TX_ST_AT_CMD) || (d->tx_state == TX_ST_MON_STOP)) {
+		elapsed = xTaskGetTickCount() - start_ticks;
+		if (elapsed >= to_ticks) {
+			d->tx_state = TX_ST_TIMEOUT;
+			break;
 		}
+		(void) ulTaskNotifyTake(pdTRUE, to_ticks - elapsed);
 	}
 	
-	if (tx_state == TX_ST_TIMEOUT) {
+	if (d->tx_state == TX_ST_TIMEOUT) {
 #ifdef DEBUG_SHOW_DATA
 		ESP_LOGI(TAG, "TX Timeout");
 #endif
-		can_if_error(CAN_ERRNO_TIMEOUT);
+		can_rsp_error(d->req_rsp_id, CAN_ERRNO_TIMEOUT);
 		success = true;
-	} else if (tx_state == TX_ST_ERROR) {
+	} else if (d->tx_state == TX_ST_ERROR) {
 #ifdef DEBUG_SHOW_DATA
 		ESP_LOGE(TAG, "TX Error");
 #endif
@@ -602,79 +2125,182 @@ static bool _can_driver_elm327_tx_string(int pkt_state, char* s)
 		success = true;
 	}
 	
-	tx_state = TX_ST_IDLE;
+	if (d->tx_state != TX_ST_MONITOR) {
+		d->tx_state = TX_ST_IDLE;
+	}
 	return success;	
 }
 
 
-static char _can_driver_elm327_nibble_2_ascii(uint8_t nibble)
+// Parse one monitor mode character.  Each "<header><data>" line is passed to the CAN manager
+// when its CR arrives.
+static void _can_driver_elm327_rx_monitor_char(elm327_dev_t* d, char c)
 {
-	nibble = nibble & 0x0F;
+	int id_len;
+	uint8_t nibble;
 	
-	if (nibble <= 9) {
-		return '0' + nibble;
-	} else {
-		return 'A' + (nibble - 10);
+	id_len = (d->mon_header_size == HEADER_SIZE_29) ? 8 : 3;
+	
+	if (c == 0x0D) {
+		if (d->mon_p.valid && (d->mon_p.id_chars == id_len) && (d->mon_p.n >= 2)) {
+			can_rx_packet(d->mon_p.id, d->mon_p.n/2, d->mon_p.data, esp_timer_get_time());
+		}
+		
+		d->mon_p.valid = true;
+		d->mon_p.id_chars = 0;
+		d->mon_p.n = 0;
+		d->mon_p.id = 0;
+		return;
+	}
+	
+	nibble = hex_char_val[(uint8_t) c];
+	if (nibble == 0) {
+		// Not a frame (e.g. "BUFFER FULL")
+		d->mon_p.valid = false;
+	} else if (d->mon_p.id_chars < id_len) {
+		d->mon_p.id = (d->mon_p.id << 4) | (nibble - 1);
+		d->mon_p.id_chars += 1;
+	} else if (d->mon_p.n < 16) {
+		if ((d->mon_p.n & 1) == 0) {
+			d->mon_p.data[d->mon_p.n/2] = nibble - 1;
+		} else {
+			d->mon_p.data[d->mon_p.n/2] = (d->mon_p.data[d->mon_p.n/2] << 4) | (nibble - 1);
+		}
+		d->mon_p.n += 1;
 	}
 }
 
 
-static uint8_t _can_driver_elm327_ascii_to_nibble(char c)
+#ifdef ENABLE_ADAPTER_ISOTP
+// Parse one character of an adapter-formatted response.  A single frame is one line of
+// payload bytes.  A multi-frame response starts with a line holding the payload length
+// (3 hex characters) followed by "n:" lines of payload bytes.  The payload is passed to
+// the CAN manager when complete.
+static void _can_driver_elm327_rx_isotp_char(elm327_dev_t* d, char c)
 {
-	if ((c >= '0') && (c <= '9')) {
-		return c - '0';
-	} else if ((c >= 'a') && (c <= 'f')) {
-		return 10 + (c - 'a');
-	} else if ((c >= 'A') && (c <= 'F')) {
-		return 10 + (c - 'A');
-	} else {
-		return 0;
+	uint8_t nibble;
+	
+	d->rsp_p.in_rsp = true;
+	
+	if ((c == 0x0D) || (c == 0x0A)) {
+		if ((d->isotp_p.nibbles != 0) && !d->isotp_p.line_bad) {
+			if (!d->isotp_p.numbered && (d->isotp_p.total_len < 0) && (d->isotp_p.nibbles == 3)) {
+				// Length line
+				d->isotp_p.total_len = d->isotp_p.line_val;
+				d->isotp_p.n = d->isotp_p.line_start;
+				if (d->isotp_p.total_len > d->isotp_p.data_len) {
+					ESP_LOGE(TAG, "Response too long - %d bytes", d->isotp_p.total_len);
+					d->isotp_p.total_len = 0;
+				}
+			} else if (!d->isotp_p.numbered && (d->isotp_p.total_len < 0)) {
+				// Single frame
+				d->isotp_p.total_len = d->isotp_p.n;
+			}
+			
+			if ((d->isotp_p.total_len > 0) && (d->isotp_p.n >= d->isotp_p.total_len)) {
+				d->rsp_p.success = true;
+				can_rx_message(d->prev_rsp_id, d->isotp_p.total_len, d->isotp_p.data, esp_timer_get_time());
+				d->isotp_p.total_len = 0;    // Ignore anything else until the prompt
+			}
+		}
+		
+		d->isotp_p.first_char = true;
+		d->isotp_p.numbered = false;
+		d->isotp_p.line_bad = false;
+		d->isotp_p.nibbles = 0;
+		d->isotp_p.line_val = 0;
+		d->isotp_p.line_start = d->isotp_p.n;
+		return;
 	}
+	
+	if (d->isotp_p.line_bad) return;
+	
+	nibble = hex_char_val[(uint8_t) c];
+	if (c == ':') {
+		// Discard the frame index
+		d->isotp_p.numbered = true;
+		d->isotp_p.nibbles = 0;
+		d->isotp_p.line_val = 0;
+		d->isotp_p.n = d->isotp_p.line_start;
+	} else if (nibble != 0) {
+		// Lines are stored as payload until a 3 character length line is identified at its end
+		if (d->isotp_p.nibbles < 3) {
+			d->isotp_p.line_val = (d->isotp_p.line_val << 4) | (nibble - 1);
+		}
+		if ((d->isotp_p.total_len != 0) && (d->isotp_p.n < d->isotp_p.data_len)) {
+			if ((d->isotp_p.nibbles & 1) == 0) {
+				d->isotp_p.data[d->isotp_p.n] = nibble - 1;
+			} else {
+				d->isotp_p.data[d->isotp_p.n] = (d->isotp_p.data[d->isotp_p.n] << 4) | (nibble - 1);
+				d->isotp_p.n += 1;
+			}
+		}
+		d->isotp_p.nibbles += 1;
+	} else if ((c != ' ') && d->isotp_p.first_char) {
+		if (c == 'N') {
+			// "NO DATA" - the ECU didn't respond so this is reported like a timeout
+			d->no_data = true;
+		} else if (c == '?') {
+			ESP_LOGE(TAG, "Request received ? response");
+			d->unknown_cmd = true;
+		}
+		d->rsp_p.success = false;
+	} else if (c != ' ') {
+		// Status message starting with a hex character (e.g. "CAN ERROR", "BUFFER FULL")
+		d->isotp_p.line_bad = true;
+		d->isotp_p.n = d->isotp_p.line_start;
+	}
+	
+	d->isotp_p.first_char = false;
 }
+#endif
 
 
-static bool _can_driver_elm327_is_hex_char(char c)
+static char _can_driver_elm327_nibble_2_ascii(uint8_t nibble)
 {
-	return (((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'f')) || ((c >= 'A') && (c <= 'F')));
+	nibble = nibble & 0x0F;
+	
+	if (nibble <= 9) {
+		return '0' + nibble;
+	} else {
+		return 'A' + (nibble - 10);
+	}
 }
 
 
-static void _can_driver_elm327_proc_version_info(char c, bool init)
+static void _can_driver_elm327_proc_version_info(elm327_dev_t* d, char c, bool init)
 {
-	static int parse_state = 0;              // 0: looking for 'v', 1: Major number, 2: Minor number
-	static int ver_index = 0;
-	
 	if (init) {
-		parse_state = 0;
-		ver_index = 0;
+		d->ver_parse_state = 0;
+		d->ver_index = 0;
 	} else {
-		switch (parse_state) {
+		switch (d->ver_parse_state) {
 			case 0:
 				if (c == 'v') {
-					parse_state = 1;
+					d->ver_parse_state = 1;
 				}
 				break;
 			case 1:
 				if ((c >= '0') && (c <= '9')) {
-					if (ver_index < MAX_ELM327_VER_LEN-1) {
-						elm327_version_string[ver_index++] = c;
+					if (d->ver_index < MAX_ELM327_VER_LEN-1) {
+						d->elm327_version_string[d->ver_index++] = c;
 					}
 				} else if (c == '.') {
-					if (ver_index < MAX_ELM327_VER_LEN-1) {
-						elm327_version_string[ver_index++] = c;
+					if (d->ver_index < MAX_ELM327_VER_LEN-1) {
+						d->elm327_version_string[d->ver_index++] = c;
 					}
-					parse_state = 2;
+					d->ver_parse_state = 2;
 				}
 				break;
 			case 2:
 				if ((c >= '0') && (c <= '9')) {
-					if (ver_index < MAX_ELM327_VER_LEN-1) {
-						elm327_version_string[ver_index++] = c;
+					if (d->ver_index < MAX_ELM327_VER_LEN-1) {
+						d->elm327_version_string[d->ver_index++] = c;
 					}
 				}
 		}
 		
 		// Always terminate the string in case this is the last character
-		elm327_version_string[ver_index] = 0;
+		d->elm327_version_string[d->ver_index] = 0;
 	}
 }
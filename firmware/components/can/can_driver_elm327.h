@@ -35,19 +35,43 @@
 // List of all implemented interfaces
 #define CAN_DRIVER_ELM327_WIFI     0
 #define CAN_DRIVER_ELM327_BLE      1
+#define CAN_DRIVER_ELM327_USB      2
 
-#define CAN_DRIVER_ELM327_NUM_IF   2
+#define CAN_DRIVER_ELM327_NUM_IF   3
+
+// Adapter instances (see CAN_MANAGER_EN_ELM327_PAIR)
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+#define CAN_DRIVER_ELM327_NUM_DEV  2
+#else
+#define CAN_DRIVER_ELM327_NUM_DEV  1
+#endif
 
 // Max ELM327 controller command or response string length
 #define CAN_DRIVER_MAX_ELM327_STR_LEN  80
 
+// Uncomment to run ELM327 response parsing on core 1 with the GUI so it isn't preempted by
+// the BLE/WiFi stacks and the interface tasks on core 0 (see "Core layout" in the README)
+//#define CAN_ELM327_PARSE_ON_APP_CORE
+
+// Driver task (ASCII response parsing).  Its priority is above gui_task's so a response
+// never waits for a render pass when it shares core 1.
+#define CAN_DRIVER_ELM327_TASK_STACK    3072
+#define CAN_DRIVER_ELM327_TASK_PRIORITY 3
+#ifdef CAN_ELM327_PARSE_ON_APP_CORE
+#define CAN_DRIVER_ELM327_TASK_CORE     1
+#else
+#define CAN_DRIVER_ELM327_TASK_CORE     0
+#endif
+
 
 
 //
 // Interface driver functions
 //
 typedef bool (*elm327_if_init)();
+typedef int (*elm327_if_max_tx_len)();     // Longest string (including CR) sent in one write
 typedef bool (*elm327_if_tx_line)(char* s);
+typedef bool (*elm327_if_deinit)();
 
 
 
@@ -56,8 +80,10 @@ typedef bool (*elm327_if_tx_line)(char* s);
 //
 typedef struct {
 	char* name;
+	elm327_if_max_tx_len fcn_max_tx_len;
 	elm327_if_init fcn_init;
 	elm327_if_tx_line fcn_tx_line;
+	elm327_if_deinit fcn_deinit;       // NULL if the interface can only be stopped by a restart
 } elm327_if_driver_t;
 
 
@@ -65,15 +91,25 @@ typedef struct {
 // Externs for driver definition
 //
 extern const can_if_driver_t can_driver_elm327;
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+extern const can_if_driver_t can_driver_elm327_pair;
+#endif
 
 
 //
 // API
 //
 
-// For ELM327 interface driver
-void can_driver_elm327_set_connected(bool connected);
-void can_driver_elm327_tx_failed();
-void can_driver_elm327_rx_data(char* s);
+// For CAN manager
+bool can_driver_elm327_if_supports_deinit(int if_type);
+void can_driver_elm327_characterize();
+bool can_driver_elm327_characterizing();
+int can_driver_elm327_get_rsp_buf_size(int max_rsp_len);
+void can_driver_elm327_set_rsp_bufs(uint8_t* bufP, int max_rsp_len);
+
+// For ELM327 interface driver (if_type is the interface's CAN_DRIVER_ELM327_xxx ID)
+void can_driver_elm327_set_connected(int if_type, bool connected);
+void can_driver_elm327_tx_failed(int if_type);
+void can_driver_elm327_rx_data(int if_type, const char* s, int len);
 
 #endif /* CAN_DRIVER_ELM327_H */
@@ -0,0 +1,505 @@
+/*
+ * Emulated ECU CAN driver
+ *
+ * Answer requests locally as a set of emulated ECUs with configurable latency and drop
+ * rate for closed-loop benchmarking of the vehicle polling without a car.  Designed to be
+ * used by can_manager.  Only included when CAN_MANAGER_EN_EMULATOR is defined.
+ *
+ * Each request is answered with a positive response (request SID + 0x40) echoing the
+ * request's parameter bytes (DID or PID) followed by changing filler data.  The response is
+ * sized to fill the number of frames the vehicle expects (can_set_expected_frames) so
+ * multi-frame responses exercise the ISO-TP reassembly and flow control paths.  Frames are
+ * delivered from esp_timer callbacks, like responses from the TWAI receive task.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "can_manager.h"
+
+#ifdef CAN_MANAGER_EN_EMULATOR
+
+#include "can_driver_emulator.h"
+#include "can_timer.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+
+
+//
+// Local constants
+//
+
+// Largest emulated response
+#define EMU_MAX_RSP_LEN    256
+
+// Emulated response state
+#define EMU_ST_IDLE        0
+#define EMU_ST_WAIT_RSP    1
+#define EMU_ST_WAIT_FC     2
+#define EMU_ST_SEND_CF     3
+
+// Minimum time between consecutive frames (STmin 0)
+#define EMU_MIN_CF_USEC    200
+
+
+
+//
+// Local data structures
+//
+typedef struct {
+	uint32_t rsp_id;
+	int latency_msec;
+	int drop_percent;
+} emu_ecu_t;
+
+typedef struct {
+	volatile int state;
+	uint32_t rsp_id;
+	int rsp_len;
+	int index;
+	uint8_t seq_num;
+	uint8_t sep_time;
+	esp_timer_handle_t timer;
+	uint8_t rsp_buf[EMU_MAX_RSP_LEN];
+} emu_response_t;
+
+
+
+//
+//  Forward declarations
+//
+
+// Functions for CAN manager
+static bool _can_driver_emu_init(int if_type, int req_timeout, bool can_is_500k);
+static bool _can_driver_emu_connected();
+static bool _can_driver_emu_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout);
+static bool _can_driver_emu_tx_fc_packet(uint32_t req_id, int len, uint8_t* data);
+static void _can_driver_emu_en_rsp_filter(bool en);
+static void _can_driver_emu_set_rx_id_list(int num_ids, const uint32_t* ids);
+static void _can_driver_emu_set_flow_control(uint8_t block_size, uint8_t sep_time);
+static void _can_driver_emu_set_expected_frames(int num_frames);
+static bool _can_driver_emu_start_monitor(int num_ids, const uint32_t* ids);
+static void _can_driver_emu_response_complete();
+
+// Internal functions
+static void _can_driver_emu_rsp_callback(void* arg);
+static void _can_driver_emu_to_callback(void* arg);
+static void _can_driver_emu_stats_callback(void* arg);
+static emu_ecu_t* _can_driver_emu_find_ecu(uint32_t rsp_id);
+static emu_response_t* _can_driver_emu_alloc_response(uint32_t rsp_id);
+static void _can_driver_emu_build_response(emu_response_t* rP, int len, uint8_t* data);
+static int _can_driver_emu_sep_time_usec(uint8_t sep_time);
+
+
+
+//
+// Driver definition
+//
+const can_if_driver_t can_driver_emulator =
+{
+	"CAN ECU Emulator",
+	CAN_MANAGER_MAX_SESSIONS,
+	0,                             // IDs are part of each frame
+	8,                             // Emulated ECUs don't send flow control for requests
+	_can_driver_emu_init,
+	_can_driver_emu_connected,
+	_can_driver_emu_tx_packet,
+	_can_driver_emu_tx_fc_packet,
+	_can_driver_emu_en_rsp_filter,
+	_can_driver_emu_set_rx_id_list,
+	_can_driver_emu_set_flow_control,
+	_can_driver_emu_set_expected_frames,
+	_can_driver_emu_start_monitor,
+	_can_driver_emu_response_complete,
+	NULL,                          // Emulated ECUs always answer immediately
+	NULL,                          // No bus
+	NULL,                          // Bench use only, switched by a restart
+	NULL                           // Requests are matched directly
+};
+
+
+
+//
+// Global variables
+//
+static const char* TAG = "can_driver_emulator";
+
+// State
+static bool connected = false;
+static int timeout_msec;
+static int expected_frames = 0;
+static uint8_t filler = 0;
+
+// Emulated ECUs
+static emu_ecu_t ecu_list[CAN_EMU_MAX_ECUS];
+static int num_ecus = 0;
+
+// Responses in progress (one per emulated ECU answering)
+static emu_response_t response[CAN_MANAGER_MAX_SESSIONS];
+static portMUX_TYPE response_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Statistics
+static volatile uint32_t stat_num_req = 0;
+static volatile uint32_t stat_num_rsp = 0;
+static volatile uint32_t stat_num_drop = 0;
+static volatile uint32_t stat_num_timeout = 0;
+
+// Request timeout
+static can_timer_t req_timer;
+
+// ESP Timers
+static esp_timer_handle_t stats_timer;
+static const esp_timer_create_args_t stats_timer_args = {
+	.callback = &_can_driver_emu_stats_callback,
+	.arg = NULL,
+	.name = "CAN emu stats timer"
+};
+
+
+
+//
+// API
+//
+
+/**
+ * Set the response latency and drop rate for the ECU with the specified response ID.
+ * ECUs not set use CAN_EMU_DEFAULT_LATENCY_MSEC and CAN_EMU_DEFAULT_DROP_PERCENT.
+ */
+bool can_driver_emulator_set_ecu(uint32_t rsp_id, int latency_msec, int drop_percent)
+{
+	emu_ecu_t* eP;
+	
+	if ((eP = _can_driver_emu_find_ecu(rsp_id)) == NULL) {
+		if (num_ecus >= CAN_EMU_MAX_ECUS) {
+			ESP_LOGE(TAG, "Too many emulated ECUs");
+			return false;
+		}
+		eP = &ecu_list[num_ecus++];
+		eP->rsp_id = rsp_id;
+	}
+	
+	eP->latency_msec = latency_msec;
+	eP->drop_percent = drop_percent;
+	
+	return true;
+}
+
+
+
+//
+// CAN manager functions
+//
+static bool _can_driver_emu_init(int if_type, int req_timeout, bool can_is_500k)
+{
+	esp_err_t ret;
+	esp_timer_create_args_t rsp_timer_args = {
+		.callback = &_can_driver_emu_rsp_callback,
+		.name = "CAN emu response timer"
+	};
+	
+	timeout_msec = req_timeout;
+	
+	// Create a timer for each response in progress
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		response[i].state = EMU_ST_IDLE;
+		rsp_timer_args.arg = (void*) &response[i];
+		if ((ret = esp_timer_create(&rsp_timer_args, &response[i].timer)) != ESP_OK) {
+			ESP_LOGE(TAG, "Could not create response timer - %d", ret);
+			return false;
+		}
+	}
+	
+	can_timer_setup(&req_timer, &_can_driver_emu_to_callback, NULL);
+	
+	if ((ret = esp_timer_create(&stats_timer_args, &stats_timer)) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not create stats timer - %d", ret);
+		return false;
+	}
+	(void) esp_timer_start_periodic(stats_timer, CAN_EMU_STATS_MSEC * 1000);
+	
+	ESP_LOGI(TAG, "Emulating ECUs, %d configured", num_ecus);
+	connected = true;
+	
+	return true;
+}
+
+
+static bool _can_driver_emu_connected()
+{
+	return connected;
+}
+
+
+static bool _can_driver_emu_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout)
+{
+	emu_ecu_t* eP;
+	emu_response_t* rP;
+	int latency_msec = CAN_EMU_DEFAULT_LATENCY_MSEC;
+	int drop_percent = CAN_EMU_DEFAULT_DROP_PERCENT;
+	
+	// Use the caller's timeout if it is shorter than our configured maximum
+	if ((req_timeout <= 0) || (req_timeout > timeout_msec)) {
+		req_timeout = timeout_msec;
+	}
+	
+	if ((eP = _can_driver_emu_find_ecu(rsp_id)) != NULL) {
+		latency_msec = eP->latency_msec;
+		drop_percent = eP->drop_percent;
+	}
+	
+	stat_num_req += 1;
+	
+	// Drop the request to simulate a missing response
+	if ((drop_percent > 0) && ((int) (esp_random() % 100) < drop_percent)) {
+		stat_num_drop += 1;
+	} else {
+		if ((rP = _can_driver_emu_alloc_response(rsp_id)) == NULL) {
+			ESP_LOGE(TAG, "No free response for 0x%lx", rsp_id);
+			return false;
+		}
+		_can_driver_emu_build_response(rP, len, data);
+		rP->state = EMU_ST_WAIT_RSP;
+		(void) esp_timer_start_once(rP->timer, (latency_msec * 1000) + EMU_MIN_CF_USEC);
+	}
+	
+	// Start timeout timer
+	can_timer_start(&req_timer, req_timeout);
+	
+	return true;
+}
+
+
+// Flow control from the CAN manager starts the consecutive frames of the response
+static bool _can_driver_emu_tx_fc_packet(uint32_t req_id, int len, uint8_t* data)
+{
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (response[i].state == EMU_ST_WAIT_FC) {
+			// Block size is ignored since the CAN manager only sends one flow control frame
+			response[i].sep_time = (len > 2) ? data[2] : 0;
+			response[i].state = EMU_ST_SEND_CF;
+			(void) esp_timer_start_once(response[i].timer, _can_driver_emu_sep_time_usec(response[i].sep_time));
+			return true;
+		}
+	}
+	
+	return true;
+}
+
+
+static void _can_driver_emu_en_rsp_filter(bool en)
+{
+	// Nothing to do since only responses are generated
+}
+
+
+static void _can_driver_emu_set_rx_id_list(int num_ids, const uint32_t* ids)
+{
+	// Nothing to do since only responses are generated
+}
+
+
+static void _can_driver_emu_set_flow_control(uint8_t block_size, uint8_t sep_time)
+{
+	// Nothing to do since the CAN manager builds the flow control packets we receive
+}
+
+
+static void _can_driver_emu_set_expected_frames(int num_frames)
+{
+	expected_frames = num_frames;
+}
+
+
+static bool _can_driver_emu_start_monitor(int num_ids, const uint32_t* ids)
+{
+	// Broadcast frames are not emulated
+	return true;
+}
+
+
+static void _can_driver_emu_response_complete()
+{
+	can_timer_stop(&req_timer);
+}
+
+
+
+//
+// Internal functions
+//
+
+// Send the next frame of a response (called from the esp_timer task)
+static void _can_driver_emu_rsp_callback(void* arg)
+{
+	emu_response_t* rP = (emu_response_t*) arg;
+	uint8_t frame[8] = {0};
+	int n = 0;
+	
+	if (rP->state == EMU_ST_WAIT_RSP) {
+		if (rP->rsp_len <= 7) {
+			// Single frame
+			frame[n++] = rP->rsp_len;
+			while (rP->index < rP->rsp_len) {
+				frame[n++] = rP->rsp_buf[rP->index++];
+			}
+			rP->state = EMU_ST_IDLE;
+			stat_num_rsp += 1;
+		} else {
+			// First frame (flow control from the CAN manager starts the consecutive frames)
+			frame[n++] = 0x10 | ((rP->rsp_len >> 8) & 0x0F);
+			frame[n++] = rP->rsp_len & 0xFF;
+			while (n < 8) {
+				frame[n++] = rP->rsp_buf[rP->index++];
+			}
+			rP->seq_num = 1;
+			rP->state = EMU_ST_WAIT_FC;
+		}
+	} else if (rP->state == EMU_ST_SEND_CF) {
+		frame[n++] = 0x20 | rP->seq_num;
+		rP->seq_num = (rP->seq_num + 1) & 0x0F;
+		while ((n < 8) && (rP->index < rP->rsp_len)) {
+			frame[n++] = rP->rsp_buf[rP->index++];
+		}
+		if (rP->index < rP->rsp_len) {
+			(void) esp_timer_start_once(rP->timer, _can_driver_emu_sep_time_usec(rP->sep_time));
+		} else {
+			rP->state = EMU_ST_IDLE;
+			stat_num_rsp += 1;
+		}
+	} else {
+		return;
+	}
+	
+	// Frames are padded to 8 bytes like most ECUs
+	can_rx_packet(rP->rsp_id, 8, frame, esp_timer_get_time());
+}
+
+
+static void _can_driver_emu_to_callback(void* arg)
+{
+	stat_num_timeout += 1;
+	can_if_error(CAN_ERRNO_TIMEOUT);
+}
+
+
+static void _can_driver_emu_stats_callback(void* arg)
+{
+	static int64_t prev_usec = 0;
+	static uint32_t prev_req = 0;
+	static uint32_t prev_rsp = 0;
+	int64_t cur_usec = esp_timer_get_time();
+	int32_t dt_msec;
+	uint32_t num_req = stat_num_req;
+	uint32_t num_rsp = stat_num_rsp;
+	
+	if (prev_usec != 0) {
+		dt_msec = (int32_t) ((cur_usec - prev_usec) / 1000);
+		if (dt_msec > 0) {
+			ESP_LOGI(TAG, "%lu req/s, %lu rsp/s (%lu dropped, %lu timeouts total)",
+			         (num_req - prev_req) * 1000 / dt_msec, (num_rsp - prev_rsp) * 1000 / dt_msec,
+			         stat_num_drop, stat_num_timeout);
+		}
+	}
+	
+	prev_usec = cur_usec;
+	prev_req = num_req;
+	prev_rsp = num_rsp;
+}
+
+
+static emu_ecu_t* _can_driver_emu_find_ecu(uint32_t rsp_id)
+{
+	for (int i=0; i<num_ecus; i++) {
+		if (ecu_list[i].rsp_id == rsp_id) {
+			return &ecu_list[i];
+		}
+	}
+	
+	return NULL;
+}
+
+
+// Get a response slot for an ECU, replacing any response it was still sending
+static emu_response_t* _can_driver_emu_alloc_response(uint32_t rsp_id)
+{
+	emu_response_t* rP = NULL;
+	
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if ((response[i].state != EMU_ST_IDLE) && (response[i].rsp_id == rsp_id)) {
+			(void) esp_timer_stop(response[i].timer);
+			response[i].state = EMU_ST_IDLE;
+		}
+	}
+	
+	portENTER_CRITICAL(&response_mux);
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (response[i].state == EMU_ST_IDLE) {
+			rP = &response[i];
+			rP->rsp_id = rsp_id;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&response_mux);
+	
+	return rP;
+}
+
+
+// Build a positive response echoing the request parameters sized for the expected frames
+static void _can_driver_emu_build_response(emu_response_t* rP, int len, uint8_t* data)
+{
+	int req_len;
+	int i;
+	int n = 0;
+	
+	// Request is a single frame with its length in the first byte
+	req_len = ((len > 0) && (data[0] <= 7)) ? data[0] : 0;
+	
+	if (expected_frames <= 1) {
+		rP->rsp_len = 7;
+	} else {
+		rP->rsp_len = 6 + 7 * (expected_frames - 1);
+		if (rP->rsp_len > EMU_MAX_RSP_LEN) rP->rsp_len = EMU_MAX_RSP_LEN;
+	}
+	
+	if (req_len > 0) {
+		rP->rsp_buf[n++] = data[1] + 0x40;
+		for (i=2; (i<=req_len) && (n<rP->rsp_len); i++) {
+			rP->rsp_buf[n++] = data[i];
+		}
+	}
+	while (n < rP->rsp_len) {
+		rP->rsp_buf[n++] = filler++;
+	}
+	
+	rP->index = 0;
+}
+
+
+static int _can_driver_emu_sep_time_usec(uint8_t sep_time)
+{
+	if ((sep_time > 0) && (sep_time <= 0x7F)) {
+		return sep_time * 1000;
+	}
+	
+	// 0 and 0xF1-0xF9 (100-900 uSec) are run at our minimum
+	return EMU_MIN_CF_USEC;
+}
+
+#endif /* CAN_MANAGER_EN_EMULATOR */
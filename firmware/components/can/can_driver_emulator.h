@@ -0,0 +1,57 @@
+/*
+ * Emulated ECU CAN driver
+ *
+ * Answer requests locally as a set of emulated ECUs with configurable latency and drop
+ * rate for closed-loop benchmarking of the vehicle polling without a car.  Designed to be
+ * used by can_manager.  Only included when CAN_MANAGER_EN_EMULATOR is defined.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef CAN_DRIVER_EMULATOR_H
+#define CAN_DRIVER_EMULATOR_H
+
+#include <can_manager.h>
+
+
+//
+// Global constants
+//
+
+// Maximum number of ECUs with their own latency/drop settings
+#define CAN_EMU_MAX_ECUS             16
+
+// Defaults for ECUs without their own settings
+#define CAN_EMU_DEFAULT_LATENCY_MSEC 5
+#define CAN_EMU_DEFAULT_DROP_PERCENT 0
+
+// Period between throughput statistics log messages
+#define CAN_EMU_STATS_MSEC           10000
+
+
+
+//
+// Externs for driver definition
+//
+extern const can_if_driver_t can_driver_emulator;
+
+
+//
+// API
+//
+bool can_driver_emulator_set_ecu(uint32_t rsp_id, int latency_msec, int drop_percent);
+
+#endif /* CAN_DRIVER_EMULATOR_H */
@@ -0,0 +1,334 @@
+/*
+ * ESP-NOW remote display CAN driver
+ *
+ * Feed the data broker of a secondary display from the broker updates another unit (the
+ * one connected to the vehicle) broadcasts over ESP-NOW (see espnow_task), so any number
+ * of displays share one vehicle connection without a second adapter loading the bus or a
+ * WiFi association.  Designed to be used by can_manager in place of a vehicle interface.
+ * Only included when CAN_MANAGER_EN_REMOTE is defined.
+ *
+ * The driver sends no requests (it reports no sessions so the vehicle manager's scheduler
+ * stays idle).  Each frame's records are published directly to the data broker as one
+ * batch from the WiFi task's receive callback, with their acquisition times moved to our
+ * clock.  The configured vehicle should be the publisher's so its items and tiles match.
+ * The first publisher heard is followed until its frames stop.  While nothing is heard,
+ * and the radio isn't held on an AP's channel, the channels are searched for it.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "can_manager.h"
+
+#ifdef CAN_MANAGER_EN_REMOTE
+
+#include "can_driver_remote.h"
+#include "data_broker.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "vehicle_manager.h"
+#include "wifi_utilities.h"
+#include <string.h>
+
+
+
+//
+//  Forward declarations
+//
+
+// Functions for CAN manager
+static bool _can_driver_remote_init(int if_type, int req_timeout, bool can_is_500k);
+static bool _can_driver_remote_connected();
+static bool _can_driver_remote_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout);
+static bool _can_driver_remote_tx_fc_packet(uint32_t req_id, int len, uint8_t* data);
+static void _can_driver_remote_en_rsp_filter(bool en);
+static void _can_driver_remote_set_rx_id_list(int num_ids, const uint32_t* ids);
+static void _can_driver_remote_set_flow_control(uint8_t block_size, uint8_t sep_time);
+static void _can_driver_remote_set_expected_frames(int num_frames);
+static bool _can_driver_remote_start_monitor(int num_ids, const uint32_t* ids);
+static void _can_driver_remote_response_complete();
+static bool _can_driver_remote_deinit();
+
+// Internal functions
+static void _can_driver_remote_rx_cb(const esp_now_recv_info_t* infoP, const uint8_t* data, int len);
+static void _can_driver_remote_search_cb(void* arg);
+
+
+
+//
+// Driver definition
+//
+const can_if_driver_t can_driver_remote =
+{
+	"ESP-NOW Remote",
+	0,                             // Receive only, no requests are sent
+	0,                             // No IDs
+	8,
+	_can_driver_remote_init,
+	_can_driver_remote_connected,
+	_can_driver_remote_tx_packet,
+	_can_driver_remote_tx_fc_packet,
+	_can_driver_remote_en_rsp_filter,
+	_can_driver_remote_set_rx_id_list,
+	_can_driver_remote_set_flow_control,
+	_can_driver_remote_set_expected_frames,
+	_can_driver_remote_start_monitor,
+	_can_driver_remote_response_complete,
+	NULL,                          // No requests
+	NULL,                          // No bus
+	_can_driver_remote_deinit,
+	NULL                           // No requests
+};
+
+
+
+//
+// Global variables
+//
+static const char* TAG = "can_driver_remote";
+
+// State
+static bool espnow_init = false;
+static volatile int64_t last_rx_usec = 0;
+
+// Publisher being followed (only accessed from the WiFi task)
+static uint8_t src_mac[6];
+static bool have_src = false;
+static uint16_t next_seq;
+static uint32_t num_rx_frames = 0;
+static uint32_t num_lost_frames = 0;
+static bool warned_items = false;
+
+// Only accessed from the WiFi task
+static db_batch_t rx_batch;
+
+// Channel search
+static uint8_t search_channel = CAN_REMOTE_MIN_CHANNEL;
+static bool link_up = false;
+static esp_timer_handle_t search_timer = NULL;
+static const esp_timer_create_args_t search_timer_args = {
+	.callback = &_can_driver_remote_search_cb,
+	.arg = NULL,
+	.name = "CAN remote search timer"
+};
+
+
+
+//
+// CAN manager functions
+//
+static bool _can_driver_remote_init(int if_type, int req_timeout, bool can_is_500k)
+{
+	esp_err_t ret;
+	
+	// ESP-NOW runs on whichever WiFi mode is configured
+	if (!wifi_is_enabled() && !wifi_init()) {
+		ESP_LOGE(TAG, "Could not start WiFi");
+		return false;
+	}
+	
+	if ((ret = esp_now_init()) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not init ESP-NOW - %d", ret);
+		return false;
+	}
+	espnow_init = true;
+	
+	have_src = false;
+	last_rx_usec = 0;
+	link_up = false;
+	if ((ret = esp_now_register_recv_cb(_can_driver_remote_rx_cb)) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not register receive callback - %d", ret);
+		(void) _can_driver_remote_deinit();
+		return false;
+	}
+	
+	if ((ret = esp_timer_create(&search_timer_args, &search_timer)) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not create search timer - %d", ret);
+		search_timer = NULL;
+	} else {
+		(void) esp_timer_start_periodic(search_timer, CAN_REMOTE_SEARCH_MSEC * 1000);
+	}
+	
+	ESP_LOGI(TAG, "Listening for a publisher");
+	
+	return true;
+}
+
+
+static bool _can_driver_remote_connected()
+{
+	int64_t t = last_rx_usec;
+	
+	return (t != 0) && ((esp_timer_get_time() - t) < (CAN_REMOTE_LINK_TIMEOUT_MSEC * 1000));
+}
+
+
+static bool _can_driver_remote_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout)
+{
+	// The publisher's unit makes all requests
+	return false;
+}
+
+
+static bool _can_driver_remote_tx_fc_packet(uint32_t req_id, int len, uint8_t* data)
+{
+	return false;
+}
+
+
+static void _can_driver_remote_en_rsp_filter(bool en)
+{
+	// Nothing to do since there are no responses
+}
+
+
+static void _can_driver_remote_set_rx_id_list(int num_ids, const uint32_t* ids)
+{
+	// Nothing to do since there are no responses
+}
+
+
+static void _can_driver_remote_set_flow_control(uint8_t block_size, uint8_t sep_time)
+{
+	// Nothing to do since there are no responses
+}
+
+
+static void _can_driver_remote_set_expected_frames(int num_frames)
+{
+	// Nothing to do since there are no responses
+}
+
+
+static bool _can_driver_remote_start_monitor(int num_ids, const uint32_t* ids)
+{
+	// Broadcast items arrive decoded from the publisher
+	return true;
+}
+
+
+static void _can_driver_remote_response_complete()
+{
+	// Nothing to do since there are no responses
+}
+
+
+static bool _can_driver_remote_deinit()
+{
+	if (search_timer != NULL) {
+		(void) esp_timer_stop(search_timer);
+		(void) esp_timer_delete(search_timer);
+		search_timer = NULL;
+	}
+	
+	if (espnow_init) {
+		(void) esp_now_unregister_recv_cb();
+		(void) esp_now_deinit();
+		espnow_init = false;
+	}
+	last_rx_usec = 0;
+	
+	return true;
+}
+
+
+
+//
+// Internal functions
+//
+
+// Runs in the WiFi task
+static void _can_driver_remote_rx_cb(const esp_now_recv_info_t* infoP, const uint8_t* data, int len)
+{
+	can_remote_hdr_t hdr;
+	can_remote_record_t rec;
+	int64_t rx_usec = esp_timer_get_time();
+	uint16_t lost;
+	
+	if (len < sizeof(can_remote_hdr_t)) {
+		return;
+	}
+	memcpy(&hdr, data, sizeof(hdr));
+	if ((hdr.magic != CAN_REMOTE_MAGIC) || (hdr.version != CAN_REMOTE_VERSION) ||
+	    (len != (sizeof(can_remote_hdr_t) + hdr.count * sizeof(can_remote_record_t)))) {
+		return;
+	}
+	
+	// Follow one publisher (another is only taken once it has been quiet for a while)
+	if (!have_src || !_can_driver_remote_connected()) {
+		if (!have_src || (memcmp(src_mac, infoP->src_addr, 6) != 0)) {
+			ESP_LOGI(TAG, "Publisher " MACSTR, MAC2STR(infoP->src_addr));
+		}
+		memcpy(src_mac, infoP->src_addr, 6);
+		have_src = true;
+		next_seq = hdr.seq;
+	} else if (memcmp(src_mac, infoP->src_addr, 6) != 0) {
+		return;
+	}
+	
+	lost = hdr.seq - next_seq;
+	if (lost < 0x8000) {
+		num_lost_frames += lost;
+	}
+	next_seq = hdr.seq + 1;
+	num_rx_frames += 1;
+	last_rx_usec = rx_usec;
+	
+	if (!warned_items && ((hdr.items & ~vm_get_supported_item_mask()) != 0)) {
+		ESP_LOGW(TAG, "Publisher sends items this vehicle doesn't have - select the publisher's vehicle");
+		warned_items = true;
+	}
+	
+	// Records may be unaligned in the frame
+	db_batch_begin(&rx_batch);
+	data += sizeof(can_remote_hdr_t);
+	for (int i=0; i<hdr.count; i++) {
+		memcpy(&rec, data, sizeof(rec));
+		data += sizeof(rec);
+		if (rec.item < DB_NUM_ITEMS) {
+			db_batch_add(&rx_batch, rec.item, rec.val, rx_usec + 1000 * (int64_t) rec.dt_msec);
+		}
+	}
+	db_batch_commit(&rx_batch);
+}
+
+
+static void _can_driver_remote_search_cb(void* arg)
+{
+	wifi_mode_t mode;
+	
+	if (_can_driver_remote_connected() != link_up) {
+		link_up = !link_up;
+		if (!link_up) {
+			ESP_LOGW(TAG, "Publisher lost (%lu frames received, %lu lost)", num_rx_frames, num_lost_frames);
+		}
+	}
+	
+	// An AP (ours or the one we're connected to) sets the channel
+	if (_can_driver_remote_connected() || wifi_is_connected() ||
+	    (esp_wifi_get_mode(&mode) != ESP_OK) || (mode != WIFI_MODE_STA)) {
+		return;
+	}
+	
+	if (++search_channel > CAN_REMOTE_MAX_CHANNEL) {
+		search_channel = CAN_REMOTE_MIN_CHANNEL;
+	}
+	(void) esp_wifi_set_channel(search_channel, WIFI_SECOND_CHAN_NONE);
+}
+
+#endif /* CAN_MANAGER_EN_REMOTE */
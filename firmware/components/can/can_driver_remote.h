@@ -0,0 +1,75 @@
+/*
+ * ESP-NOW remote display CAN driver
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef CAN_DRIVER_REMOTE_H
+#define CAN_DRIVER_REMOTE_H
+
+#include <can_manager.h>
+#include "data_broker.h"
+
+
+
+//
+// Global constants
+//
+
+// Frame format (little endian, one ESP-NOW broadcast of at most CAN_REMOTE_MAX_FRAME_LEN)
+//   Header: can_remote_hdr_t
+//   count records: can_remote_record_t (item times relative to when the frame was sent)
+#define CAN_REMOTE_MAGIC             0xE5D1
+#define CAN_REMOTE_VERSION           1
+#define CAN_REMOTE_MAX_FRAME_LEN     250     // ESP_NOW_MAX_DATA_LEN
+#define CAN_REMOTE_MAX_RECORDS       ((CAN_REMOTE_MAX_FRAME_LEN - sizeof(can_remote_hdr_t)) / sizeof(can_remote_record_t))
+
+// The link is down when no frame has been received for this long
+#define CAN_REMOTE_LINK_TIMEOUT_MSEC 1000
+
+// While the link is down (and WiFi isn't holding the radio on an AP's channel) the channels
+// are searched for the publisher, listening this long on each
+#define CAN_REMOTE_SEARCH_MSEC       300
+#define CAN_REMOTE_MIN_CHANNEL       1
+#define CAN_REMOTE_MAX_CHANNEL       13
+
+
+
+//
+// Global typedefs
+//
+typedef struct {
+	uint16_t magic;
+	uint8_t version;
+	uint8_t count;
+	uint16_t seq;
+	db_mask_t items;                     // Items the publisher sends
+} __attribute__((packed)) can_remote_hdr_t;
+
+typedef struct {
+	uint8_t item;
+	int16_t dt_msec;                     // Acquisition time - send time (<= 0)
+	float val;
+} __attribute__((packed)) can_remote_record_t;
+
+
+
+//
+// Externs for driver definition
+//
+extern const can_if_driver_t can_driver_remote;
+
+#endif /* CAN_DRIVER_REMOTE_H */
@@ -0,0 +1,605 @@
+/*
+ * Captured frame log replay CAN driver
+ *
+ * Play back a candump format log (e.g. downloaded from can_capture) in place of a live
+ * interface for deterministic benchmarking of the decoders and GUI, reproducing field
+ * problems and bench demonstrations.  Designed to be used by can_manager.  Only included
+ * when CAN_MANAGER_EN_REPLAY is defined.
+ *
+ * The log is loaded into PSRAM at init.  Each request is matched to the next recorded
+ * occurrence of the same request (ID and data) after the one last used for it, so every
+ * request steps through its own recorded responses in order, independent of the order
+ * the vehicle polls in.  The frames from the response ID that followed the recorded
+ * request are delivered with their recorded timing divided by the playback speed (0 for
+ * as fast as possible).  A request that never appears in the log times out like an ECU
+ * that isn't answering.  In monitor mode subscribed broadcast frames are played in log
+ * order.  The log wraps at its end.  Frames are delivered from esp_timer callbacks, like
+ * responses from the TWAI receive callback.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "can_manager.h"
+
+#ifdef CAN_MANAGER_EN_REPLAY
+
+#include "can_driver_replay.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+//
+// Local constants
+//
+
+// Longest log line we parse (longer lines, such as reassembled responses, are skipped)
+#define REPLAY_LINE_LEN    80
+
+
+
+//
+// Local data structures
+//
+typedef struct {
+	int64_t ts_usec;
+	uint32_t id;
+	uint8_t len;
+	uint8_t data[8];
+} replay_frame_t;
+
+// Position in the log of each distinct request
+typedef struct {
+	uint32_t req_id;
+	int len;
+	uint8_t data[8];
+	int next_index;
+} replay_req_t;
+
+// Frames being played (one per session, plus broadcasts)
+typedef struct {
+	volatile bool active;
+	uint32_t req_id;
+	uint32_t rsp_id;             // 0 for broadcast monitor
+	int index;                   // Next frame to deliver
+	int64_t log_base_usec;       // Log time corresponding to start_usec
+	int64_t start_usec;
+	esp_timer_handle_t timer;
+} replay_player_t;
+
+
+
+//
+//  Forward declarations
+//
+
+// Functions for CAN manager
+static bool _can_driver_replay_init(int if_type, int req_timeout, bool can_is_500k);
+static bool _can_driver_replay_connected();
+static bool _can_driver_replay_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout);
+static bool _can_driver_replay_tx_fc_packet(uint32_t req_id, int len, uint8_t* data);
+static void _can_driver_replay_en_rsp_filter(bool en);
+static void _can_driver_replay_set_rx_id_list(int num_ids, const uint32_t* ids);
+static void _can_driver_replay_set_flow_control(uint8_t block_size, uint8_t sep_time);
+static void _can_driver_replay_set_expected_frames(int num_frames);
+static bool _can_driver_replay_start_monitor(int num_ids, const uint32_t* ids);
+static void _can_driver_replay_response_complete();
+
+// Internal functions
+static bool _can_driver_replay_load();
+static bool _can_driver_replay_read_line(FILE* fp, char* buf, int len);
+static bool _can_driver_replay_parse_line(const char* buf, replay_frame_t* fP);
+static int _can_driver_replay_find_request(uint32_t req_id, int len, const uint8_t* data);
+static replay_player_t* _can_driver_replay_alloc_player(uint32_t rsp_id);
+static bool _can_driver_replay_next_frame(replay_player_t* pP);
+static void _can_driver_replay_schedule(replay_player_t* pP);
+static void _can_driver_replay_player_callback(void* arg);
+static void _can_driver_replay_to_callback(void* arg);
+
+
+
+//
+// Driver definition
+//
+const can_if_driver_t can_driver_replay =
+{
+	"CAN Log Replay",
+	CAN_MANAGER_MAX_SESSIONS,
+	0,                             // IDs are part of each frame
+	8,                             // Replayed responses are to single frame requests
+	_can_driver_replay_init,
+	_can_driver_replay_connected,
+	_can_driver_replay_tx_packet,
+	_can_driver_replay_tx_fc_packet,
+	_can_driver_replay_en_rsp_filter,
+	_can_driver_replay_set_rx_id_list,
+	_can_driver_replay_set_flow_control,
+	_can_driver_replay_set_expected_frames,
+	_can_driver_replay_start_monitor,
+	_can_driver_replay_response_complete,
+	NULL,                          // Responses are replayed as captured
+	NULL,                          // No bus
+	NULL,                          // Bench use only, switched by a restart
+	NULL                           // Requests are matched directly
+};
+
+
+
+//
+// Global variables
+//
+static const char* TAG = "can_driver_replay";
+
+// State
+static bool connected = false;
+static int timeout_msec;
+static volatile int speed = CAN_REPLAY_DEFAULT_SPEED;
+
+// Log
+static replay_frame_t* frameP = NULL;
+static int num_frames = 0;
+
+// Requests seen
+static replay_req_t req_list[CAN_REPLAY_MAX_REQS];
+static int num_reqs = 0;
+
+// Players
+static replay_player_t player[CAN_MANAGER_MAX_SESSIONS];
+static replay_player_t monitor;
+static uint32_t monitor_id[CAN_MANAGER_MAX_BCAST];
+static int num_monitor_ids = 0;
+static int monitor_index = 0;
+static portMUX_TYPE player_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// ESP Timers
+static esp_timer_handle_t req_timer;
+static const esp_timer_create_args_t req_timer_args = {
+	.callback = &_can_driver_replay_to_callback,
+	.arg = NULL,
+	.name = "CAN replay request timer"
+};
+
+
+
+//
+// API
+//
+
+/**
+ * Set the playback speed multiplier (1 = recorded timing, N = N times faster, 0 = as fast
+ * as possible)
+ */
+void can_driver_replay_set_speed(int mult)
+{
+	speed = (mult < 0) ? 0 : mult;
+}
+
+
+
+//
+// CAN manager functions
+//
+static bool _can_driver_replay_init(int if_type, int req_timeout, bool can_is_500k)
+{
+	esp_err_t ret;
+	esp_timer_create_args_t player_timer_args = {
+		.callback = &_can_driver_replay_player_callback,
+		.name = "CAN replay frame timer"
+	};
+	
+	timeout_msec = req_timeout;
+	
+	if ((frameP == NULL) && !_can_driver_replay_load()) {
+		return false;
+	}
+	
+	// Create a timer for each player
+	for (int i=0; i<=CAN_MANAGER_MAX_SESSIONS; i++) {
+		replay_player_t* pP = (i < CAN_MANAGER_MAX_SESSIONS) ? &player[i] : &monitor;
+		
+		pP->active = false;
+		player_timer_args.arg = (void*) pP;
+		if ((ret = esp_timer_create(&player_timer_args, &pP->timer)) != ESP_OK) {
+			ESP_LOGE(TAG, "Could not create frame timer - %d", ret);
+			return false;
+		}
+	}
+	
+	if ((ret = esp_timer_create(&req_timer_args, &req_timer)) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not create timeout timer - %d", ret);
+		return false;
+	}
+	
+	ESP_LOGI(TAG, "Replaying %d frames at %dx", num_frames, speed);
+	connected = true;
+	
+	return true;
+}
+
+
+static bool _can_driver_replay_connected()
+{
+	return connected;
+}
+
+
+static bool _can_driver_replay_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout)
+{
+	replay_player_t* pP;
+	int n;
+	
+	// Use the caller's timeout if it is shorter than our configured maximum
+	if ((req_timeout <= 0) || (req_timeout > timeout_msec)) {
+		req_timeout = timeout_msec;
+	}
+	
+	// A request ends monitoring
+	if (monitor.active) {
+		(void) esp_timer_stop(monitor.timer);
+		monitor.active = false;
+		monitor_index = monitor.index;
+	}
+	
+	if ((n = _can_driver_replay_find_request(req_id, len, data)) >= 0) {
+		if ((pP = _can_driver_replay_alloc_player(rsp_id)) == NULL) {
+			ESP_LOGE(TAG, "No free player for 0x%lx", rsp_id);
+			return false;
+		}
+		pP->req_id = req_id;
+		pP->index = n + 1;
+		pP->log_base_usec = frameP[n].ts_usec;
+		pP->start_usec = esp_timer_get_time();
+		if (_can_driver_replay_next_frame(pP)) {
+			_can_driver_replay_schedule(pP);
+		} else {
+			pP->active = false;
+		}
+	}
+	
+	// Start timeout timer
+	if (esp_timer_is_active(req_timer)) {
+		(void) esp_timer_stop(req_timer);
+	}
+	(void) esp_timer_start_once(req_timer, req_timeout * 1000);
+	
+	return true;
+}
+
+
+static bool _can_driver_replay_tx_fc_packet(uint32_t req_id, int len, uint8_t* data)
+{
+	// Recorded consecutive frame timing already reflects the flow control that was sent
+	return true;
+}
+
+
+static void _can_driver_replay_en_rsp_filter(bool en)
+{
+	// Nothing to do since only frames for outstanding requests or monitored IDs are played
+}
+
+
+static void _can_driver_replay_set_rx_id_list(int num_ids, const uint32_t* ids)
+{
+	// Nothing to do since only frames for outstanding requests or monitored IDs are played
+}
+
+
+static void _can_driver_replay_set_flow_control(uint8_t block_size, uint8_t sep_time)
+{
+	// Nothing to do since the recorded frames are replayed as they were received
+}
+
+
+static void _can_driver_replay_set_expected_frames(int num_frames)
+{
+	// Nothing to do since the recorded frames are replayed as they were received
+}
+
+
+static bool _can_driver_replay_start_monitor(int num_ids, const uint32_t* ids)
+{
+	if (monitor.active || (num_frames == 0)) {
+		return true;
+	}
+	
+	num_monitor_ids = (num_ids > CAN_MANAGER_MAX_BCAST) ? CAN_MANAGER_MAX_BCAST : num_ids;
+	memcpy(monitor_id, ids, num_monitor_ids * sizeof(uint32_t));
+	
+	monitor.rsp_id = 0;
+	monitor.index = (monitor_index < num_frames) ? monitor_index : 0;
+	monitor.log_base_usec = frameP[monitor.index].ts_usec;
+	monitor.start_usec = esp_timer_get_time();
+	monitor.active = true;
+	if (_can_driver_replay_next_frame(&monitor)) {
+		_can_driver_replay_schedule(&monitor);
+	} else {
+		monitor.active = false;
+	}
+	
+	return true;
+}
+
+
+static void _can_driver_replay_response_complete()
+{
+	if (esp_timer_is_active(req_timer)) {
+		(void) esp_timer_stop(req_timer);
+	}
+}
+
+
+
+//
+// Internal functions
+//
+static bool _can_driver_replay_load()
+{
+	FILE* fp = NULL;
+	char buf[REPLAY_LINE_LEN];
+	int lines = 0;
+	int wait_msec = 0;
+	
+	// The file system is mounted by another task at startup
+	while ((fp = fopen(CAN_REPLAY_FILE, "r")) == NULL) {
+		if (wait_msec >= CAN_REPLAY_OPEN_WAIT_MSEC) {
+			ESP_LOGE(TAG, "Could not open %s", CAN_REPLAY_FILE);
+			return false;
+		}
+		vTaskDelay(pdMS_TO_TICKS(100));
+		wait_msec += 100;
+	}
+	
+	// Size the frame list from the number of lines
+	while (_can_driver_replay_read_line(fp, buf, sizeof(buf))) {
+		lines++;
+	}
+	if (lines == 0) {
+		ESP_LOGE(TAG, "%s is empty", CAN_REPLAY_FILE);
+		fclose(fp);
+		return false;
+	}
+	
+	frameP = heap_caps_malloc(lines * sizeof(replay_frame_t), MALLOC_CAP_SPIRAM);
+	if (frameP == NULL) {
+		ESP_LOGE(TAG, "Could not allocate %d frames", lines);
+		fclose(fp);
+		return false;
+	}
+	
+	rewind(fp);
+	num_frames = 0;
+	while ((num_frames < lines) && _can_driver_replay_read_line(fp, buf, sizeof(buf))) {
+		if (_can_driver_replay_parse_line(buf, &frameP[num_frames])) {
+			num_frames++;
+		}
+	}
+	fclose(fp);
+	
+	return true;
+}
+
+
+// Read a line, discarding any part that doesn't fit in buf.  Returns false at end of file.
+static bool _can_driver_replay_read_line(FILE* fp, char* buf, int len)
+{
+	char discard[REPLAY_LINE_LEN];
+	
+	if (fgets(buf, len, fp) == NULL) {
+		return false;
+	}
+	
+	if (strchr(buf, '\n') == NULL) {
+		while ((fgets(discard, sizeof(discard), fp) != NULL) && (strchr(discard, '\n') == NULL)) {}
+	}
+	
+	return true;
+}
+
+
+// Parse "(sec.usec) iface ID#HEXDATA".  Reassembled responses (iface "isotp") are skipped
+// since the frames they were built from are replayed.
+static bool _can_driver_replay_parse_line(const char* buf, replay_frame_t* fP)
+{
+	char iface[16];
+	char hex[20];
+	long long sec, usec;
+	unsigned long id;
+	unsigned int b;
+	int n;
+	
+	if (sscanf(buf, "(%lld.%lld) %15s %lx#%19s", &sec, &usec, iface, &id, hex) != 5) {
+		return false;
+	}
+	if (strcmp(iface, "isotp") == 0) {
+		return false;
+	}
+	
+	n = strlen(hex) / 2;
+	if (n > 8) {
+		return false;
+	}
+	for (int i=0; i<n; i++) {
+		if (sscanf(&hex[2*i], "%2x", &b) != 1) {
+			return false;
+		}
+		fP->data[i] = (uint8_t) b;
+	}
+	
+	fP->ts_usec = sec * 1000000 + usec;
+	fP->id = (uint32_t) id;
+	fP->len = (uint8_t) n;
+	
+	return true;
+}
+
+
+// Find the recorded request following the last one used for this request.  Returns the
+// frame index or -1 if the request isn't in the log.
+static int _can_driver_replay_find_request(uint32_t req_id, int len, const uint8_t* data)
+{
+	replay_req_t* rP = NULL;
+	int n;
+	
+	if (len > 8) len = 8;
+	
+	for (int i=0; i<num_reqs; i++) {
+		if ((req_list[i].req_id == req_id) && (req_list[i].len == len) && (memcmp(req_list[i].data, data, len) == 0)) {
+			rP = &req_list[i];
+			break;
+		}
+	}
+	if (rP == NULL) {
+		// Start a new request at the beginning of the log (replace the oldest if full)
+		rP = &req_list[(num_reqs < CAN_REPLAY_MAX_REQS) ? num_reqs++ : 0];
+		rP->req_id = req_id;
+		rP->len = len;
+		memcpy(rP->data, data, len);
+		rP->next_index = 0;
+	}
+	
+	for (int i=0; i<num_frames; i++) {
+		n = (rP->next_index + i) % num_frames;
+		if ((frameP[n].id == req_id) && (frameP[n].len == len) && (memcmp(frameP[n].data, data, len) == 0)) {
+			rP->next_index = n + 1;
+			return n;
+		}
+	}
+	
+	return -1;
+}
+
+
+// Get a player for a response, replacing any response still playing for the ECU
+static replay_player_t* _can_driver_replay_alloc_player(uint32_t rsp_id)
+{
+	replay_player_t* pP = NULL;
+	
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (player[i].active && (player[i].rsp_id == rsp_id)) {
+			(void) esp_timer_stop(player[i].timer);
+			player[i].active = false;
+		}
+	}
+	
+	portENTER_CRITICAL(&player_mux);
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (!player[i].active) {
+			pP = &player[i];
+			pP->rsp_id = rsp_id;
+			pP->active = true;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&player_mux);
+	
+	return pP;
+}
+
+
+// Advance a player's index to its next frame.  Returns false if there are no more.
+static bool _can_driver_replay_next_frame(replay_player_t* pP)
+{
+	const replay_frame_t* fP;
+	
+	if (pP->rsp_id == 0) {
+		// Broadcasts: next monitored ID in log order, wrapping once
+		for (int i=0; i<num_frames; i++) {
+			if (pP->index >= num_frames) {
+				pP->index = 0;
+				pP->log_base_usec = frameP[0].ts_usec;
+				pP->start_usec = esp_timer_get_time();
+			}
+			fP = &frameP[pP->index];
+			for (int j=0; j<num_monitor_ids; j++) {
+				if (fP->id == monitor_id[j]) {
+					return true;
+				}
+			}
+			pP->index++;
+		}
+		return false;
+	}
+	
+	// Responses: frames from the ECU until its next request or the end of the window
+	while (pP->index < num_frames) {
+		fP = &frameP[pP->index];
+		if ((fP->ts_usec - pP->log_base_usec) > ((int64_t) CAN_REPLAY_RSP_WINDOW_MSEC * 1000)) {
+			return false;
+		}
+		if (fP->id == pP->rsp_id) {
+			return true;
+		}
+		if ((fP->id == pP->req_id) && ((fP->len == 0) || ((fP->data[0] & 0xF0) != 0x30))) {
+			// Next request (flow control frames are ours to send)
+			return false;
+		}
+		pP->index++;
+	}
+	
+	return false;
+}
+
+
+static void _can_driver_replay_schedule(replay_player_t* pP)
+{
+	int64_t delay_usec = CAN_REPLAY_MIN_FRAME_USEC;
+	int mult = speed;
+	
+	if (mult > 0) {
+		delay_usec = pP->start_usec + (frameP[pP->index].ts_usec - pP->log_base_usec) / mult - esp_timer_get_time();
+		if (delay_usec < CAN_REPLAY_MIN_FRAME_USEC) {
+			delay_usec = CAN_REPLAY_MIN_FRAME_USEC;
+		}
+	}
+	
+	(void) esp_timer_start_once(pP->timer, (uint64_t) delay_usec);
+}
+
+
+// Deliver a player's next frame (called from the esp_timer task)
+static void _can_driver_replay_player_callback(void* arg)
+{
+	replay_player_t* pP = (replay_player_t*) arg;
+	const replay_frame_t* fP;
+	
+	if (!pP->active) {
+		return;
+	}
+	
+	fP = &frameP[pP->index++];
+	can_rx_packet(fP->id, fP->len, (uint8_t*) fP->data, esp_timer_get_time());
+	
+	if (pP->active && _can_driver_replay_next_frame(pP)) {
+		_can_driver_replay_schedule(pP);
+	} else {
+		pP->active = false;
+	}
+}
+
+
+static void _can_driver_replay_to_callback(void* arg)
+{
+	can_if_error(CAN_ERRNO_TIMEOUT);
+}
+
+#endif /* CAN_MANAGER_EN_REPLAY */
@@ -0,0 +1,62 @@
+/*
+ * Captured frame log replay CAN driver
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef CAN_DRIVER_REPLAY_H
+#define CAN_DRIVER_REPLAY_H
+
+#include <can_manager.h>
+#include "can_capture.h"
+
+
+//
+// Global constants
+//
+
+// candump format log to replay (on the flash FAT partition, uploaded through can_capture)
+#define CAN_REPLAY_FILE              CAN_CAPTURE_UPLOAD_FILE
+
+// Time to wait at startup for the file system holding the log to be mounted
+#define CAN_REPLAY_OPEN_WAIT_MSEC    3000
+
+// Maximum number of distinct requests followed through the log
+#define CAN_REPLAY_MAX_REQS          64
+
+// Responses are taken from frames up to this long after the recorded request
+#define CAN_REPLAY_RSP_WINDOW_MSEC   1000
+
+// Playback speed multiplier (1 = recorded timing, 0 = as fast as possible)
+#define CAN_REPLAY_DEFAULT_SPEED     1
+
+// Minimum time between replayed frames (also the as-fast-as-possible frame period)
+#define CAN_REPLAY_MIN_FRAME_USEC    200
+
+
+
+//
+// Externs for driver definition
+//
+extern const can_if_driver_t can_driver_replay;
+
+
+//
+// API
+//
+void can_driver_replay_set_speed(int mult);
+
+#endif /* CAN_DRIVER_REPLAY_H */
\ No newline at end of file
@@ -2,7 +2,8 @@
  * TWAI CAN driver
  *
  * Provide a simple interface to the Espressif IDF TWAI peripheral driver.
- * Designed to be used by can_manager.
+ * Designed to be used by can_manager.  The receive ISR only timestamps and queues frames;
+ * a receive task hands them to can_manager for ISO-TP reassembly.
  *
  * Copyright 2025 Dan Julio
  *
@@ -21,11 +22,80 @@
  *
  */
 #include "can_driver_twai.h"
+#include "can_timer.h"
+#include "dlog_utilities.h"
+#include "esp_cpu.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_pm.h"
 #include "esp_timer.h"
 #include "esp_twai.h"
 #include "esp_twai_onchip.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ps_utilities.h"
+#include "soc/soc_caps.h"
+#include <string.h>
+
+
+
+//
+// Local constants
+//
+
+// Uncomment to log receive timing every RX_TIMING_LOG_MSEC: the receive callback's duration
+// in CPU cycles (cache misses show up here), the time from the callback to the receive task
+// handing the frame to the CAN manager and the time the CAN manager takes with it.  Used to
+// compare builds with and without CONFIG_CAN_RX_PATH_IN_IRAM under the same load.
+//#define ENABLE_RX_TIMING
+
+#define RX_TIMING_LOG_MSEC 10000
+
+// Number of hardware mask filters available
+#ifdef SOC_TWAI_MASK_FILTER_NUM
+#define NUM_HW_FILTERS SOC_TWAI_MASK_FILTER_NUM
+#else
+#define NUM_HW_FILTERS 1
+#endif
+
+#define STD_ID_MASK    0x7FF
+#define EXT_ID_MASK    0x1FFFFFFF
+
+// Received frame ring between the ISR and the receive task (power of 2)
+#define RX_RING_LEN    32
+#define RX_RING_MASK   (RX_RING_LEN - 1)
+
+// Maximum 10 mSec waits for the receive task to empty the ring during deinit
+#define DEINIT_DRAIN_TRIES 10
+
+// Transmit queue depth.  The driver doesn't copy queued frames so each is sent from a
+// slot in our transmit ring, which must be longer than the queue plus the frame being sent
+// (power of 2).
+#define TX_QUEUE_DEPTH 8
+#define TX_RING_LEN    16
+#define TX_RING_MASK   (TX_RING_LEN - 1)
+
+// Bitrate probe results
+#define PROBE_SILENT   0
+#define PROBE_FRAMES   1
+#define PROBE_ERRORS   2
+
+
+
+//
+// Local data structures
+//
+typedef struct {
+	uint32_t id;
+	int64_t rx_usec;
+	uint8_t len;
+	uint8_t data[8];
+} rx_frame_t;
+
+typedef struct {
+	twai_frame_t frame;
+	uint8_t data[8];
+} tx_slot_t;
 
 
 //
@@ -34,16 +104,36 @@
 
 // Functions for CAN manager
 static bool _can_driver_twai_init(int if_type, int req_timeout, bool can_is_500k);
+static bool _can_driver_twai_deinit();
 static bool _can_driver_twai_connected();
-static bool _can_driver_twai_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data);
+static bool _can_driver_twai_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout);
 static bool _can_driver_twai_tx_fc_packet(uint32_t req_id, int len, uint8_t* data);
 static void _can_driver_twai_en_rsp_filter(bool en);
+static void _can_driver_twai_set_rx_id_list(int num_ids, const uint32_t* ids);
+static void _can_driver_twai_set_flow_control(uint8_t block_size, uint8_t sep_time);
+static void _can_driver_twai_set_expected_frames(int num_frames);
+static bool _can_driver_twai_start_monitor(int num_ids, const uint32_t* ids);
 static void _can_driver_twai_response_complete();
+static void _can_driver_twai_extend_timeout(int timeout_msec);
+static bool _can_driver_twai_get_bus_stats(can_bus_stats_t* statsP);
 
 // Internal functions
 static bool _can_driver_rx_callback(twai_node_handle_t handle, const twai_rx_done_event_data_t *edata, void *user_ctx);
 static bool _can_driver_state_change_callback(twai_node_handle_t handle, const twai_state_change_event_data_t *edata, void *user_ctx);
+static bool _can_driver_error_callback(twai_node_handle_t handle, const twai_error_event_data_t *edata, void *user_ctx);
+static void _can_driver_twai_count_frame(volatile uint32_t* countP, bool is_ext, int len);
 static void _can_driver_to_callback(void* arg);
+static void _can_driver_twai_rx_task(void* args);
+static esp_err_t _can_driver_twai_transmit(uint32_t id, int len, uint8_t* data);
+static void _can_driver_twai_apply_filters();
+static bool _can_driver_twai_build_filter(bool is_ext, twai_mask_filter_config_t* cfgP);
+static bool _can_driver_twai_sw_accept(uint32_t id);
+#ifdef CAN_DRIVER_TWAI_PROBE_BITRATE
+static uint32_t _can_driver_twai_probe_bitrate(uint32_t cfg_bitrate);
+static int _can_driver_twai_probe_one(uint32_t rate, uint32_t* id_flagsP);
+static bool _can_driver_probe_rx_callback(twai_node_handle_t handle, const twai_rx_done_event_data_t *edata, void *user_ctx);
+static bool _can_driver_probe_error_callback(twai_node_handle_t handle, const twai_error_event_data_t *edata, void *user_ctx);
+#endif
 
 
 
@@ -53,12 +143,23 @@ static void _can_driver_to_callback(void* arg);
 const can_if_driver_t can_driver_twai =
 {
 	"CAN TWAI Driver",
+	CAN_MANAGER_MAX_SESSIONS,
+	0,                             // IDs are part of each frame
+	CAN_MANAGER_MAX_REQ_LEN,       // can_manager segments long requests
 	_can_driver_twai_init,
 	_can_driver_twai_connected,
 	_can_driver_twai_tx_packet,
 	_can_driver_twai_tx_fc_packet,
 	_can_driver_twai_en_rsp_filter,
-	_can_driver_twai_response_complete
+	_can_driver_twai_set_rx_id_list,
+	_can_driver_twai_set_flow_control,
+	_can_driver_twai_set_expected_frames,
+	_can_driver_twai_start_monitor,
+	_can_driver_twai_response_complete,
+	_can_driver_twai_extend_timeout,
+	_can_driver_twai_get_bus_stats,
+	_can_driver_twai_deinit,
+	NULL                           // Frames are built directly from the request
 };
 
 
@@ -73,20 +174,69 @@ static twai_node_handle_t node_hdl = NULL;
 static const twai_event_callbacks_t user_cbs = {
     .on_rx_done = _can_driver_rx_callback,
     .on_state_change = _can_driver_state_change_callback,
+    .on_error = _can_driver_error_callback,
 };
 
+#ifdef CAN_DRIVER_TWAI_PROBE_BITRATE
+// Bitrate probe (once per boot)
+static const twai_event_callbacks_t probe_cbs = {
+    .on_rx_done = _can_driver_probe_rx_callback,
+    .on_error = _can_driver_probe_error_callback,
+};
+static const uint32_t probe_bitrates[] = {500000, 250000, 125000};
+static uint32_t probed_bitrate = 0;
+static volatile uint32_t probe_std_frames;
+static volatile uint32_t probe_ext_frames;
+static volatile uint32_t probe_errors;
+#endif
+
 // State
 static bool connected = false;
 static bool filter_en = false;
+static bool listen_only = false;       // Broadcast-only interface alongside a request interface
 static int timeout_msec;
-
-// ESP Timer
-static esp_timer_handle_t req_timer;
-static const esp_timer_create_args_t oneshot_timer_args = {
-	.callback = &_can_driver_to_callback,
-	.arg = NULL,
-	.name = "CAN request timer"
-};
+static uint32_t bitrate;
+
+// Bus statistics.  The hardware filters only pass the IDs we're interested in so the
+// received frames (and bus load) are our own traffic rather than everything on the bus.
+// Counters are updated from the ISR and the receive, timer and CAN tasks so are only
+// changed atomically.
+static volatile uint32_t stat_rx_frames = 0;
+static volatile uint32_t stat_tx_frames = 0;
+static volatile uint32_t stat_bits = 0;
+static volatile uint32_t stat_bus_errors = 0;
+static volatile uint32_t stat_err_passive = 0;
+static volatile uint32_t stat_bus_off = 0;
+
+// Received frames - single-producer (ISR) single-consumer (receive task).  Frames are
+// processed at the maximum CPU frequency.
+static TaskHandle_t task_handle_twai_rx = NULL;
+static esp_pm_lock_handle_t rx_pm_lock = NULL;
+static rx_frame_t rx_ring[RX_RING_LEN];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+static volatile uint32_t rx_drop_count = 0;
+
+#ifdef ENABLE_RX_TIMING
+// Receive callback cycles (sum and count only increase, the task takes the maximum)
+static volatile uint32_t rx_isr_cycles = 0;
+static volatile uint32_t rx_isr_count = 0;
+static volatile uint32_t rx_isr_max_cycles = 0;
+#endif
+
+// Transmitted frames (sent from several contexts so slots are claimed atomically)
+static tx_slot_t tx_ring[TX_RING_LEN];
+static uint32_t tx_ring_index = 0;
+
+// Receive ID list for the filter bank.  The hardware filters are programmed to pass the
+// union of this list (a mask covering several IDs passes some extra IDs too) and the
+// software filter drops anything else when the hardware filters aren't exact.
+static uint32_t rx_id_list[CAN_MANAGER_MAX_RX_IDS];
+static volatile int num_rx_ids = 0;
+static volatile bool sw_filter_en = false;
+
+// Request timeout
+static can_timer_t req_timer;
 
 
 
@@ -105,12 +255,25 @@ static bool _can_driver_twai_init(int if_type, int req_timeout, bool can_is_500k
 		.io_cfg.quanta_clk_out = -1,
 		.io_cfg.bus_off_indicator = -1,
 		.bit_timing.bitrate = 250000,
-		.tx_queue_depth = 2,
+		.tx_queue_depth = TX_QUEUE_DEPTH,
 	};
 	
 	if (can_is_500k) {
 		node_config.bit_timing.bitrate = 500000;
 	}
+#ifdef CAN_DRIVER_TWAI_PROBE_BITRATE
+	// Use the bitrate actually on the bus
+	if (probed_bitrate == 0) {
+		probed_bitrate = _can_driver_twai_probe_bitrate(node_config.bit_timing.bitrate);
+	}
+	node_config.bit_timing.bitrate = probed_bitrate;
+#endif
+	bitrate = node_config.bit_timing.bitrate;
+	
+	listen_only = (if_type == CAN_DRIVER_TWAI_LISTEN_ONLY);
+	if (listen_only) {
+		node_config.flags.enable_listen_only = true;
+	}
 	
 	// Create a new TWAI controller driver
 	if ((ret = twai_new_node_onchip(&node_config, &node_hdl)) != ESP_OK) {
@@ -134,17 +297,27 @@ static bool _can_driver_twai_init(int if_type, int req_timeout, bool can_is_500k
 		return false;
 	}
 	
+	// Start the receive task (once, the driver is initialized again when the vehicle changes)
+	if (task_handle_twai_rx == NULL) {
+		if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "can_twai_rx", &rx_pm_lock) != ESP_OK) {
+			rx_pm_lock = NULL;
+		}
+		if (xTaskCreatePinnedToCore(&_can_driver_twai_rx_task, "can_driver_twai_task", CAN_DRIVER_TWAI_TASK_STACK, NULL,
+		                            CAN_DRIVER_TWAI_TASK_PRIORITY, &task_handle_twai_rx, CAN_DRIVER_TWAI_TASK_CORE) != pdPASS) {
+			ESP_LOGE(TAG, "Could not start receive task");
+			task_handle_twai_rx = NULL;
+			return false;
+		}
+	}
+	
 	// Start the driver
 	if ((ret = twai_node_enable(node_hdl)) != ESP_OK) {
 		ESP_LOGE(TAG, "Driver start failed - %d", ret);
 		return false;
 	}
 	
-	// Create a timer to use with transmitted packets
-	if ((ret = esp_timer_create(&oneshot_timer_args, &req_timer)) != ESP_OK) {
-		ESP_LOGE(TAG, "Could not create timeout timer - %d", ret);
-		return false;
-	}
+	// Setup the timer to use with transmitted packets
+	can_timer_setup(&req_timer, &_can_driver_to_callback, NULL);
 	
 	// Connected if we've made it to here
 	connected = true;
@@ -153,57 +326,63 @@ static bool _can_driver_twai_init(int if_type, int req_timeout, bool can_is_500k
 }
 
 
+// Release the controller so it can be initialized again (as the request interface or the
+// listen-only broadcast interface).  The receive task is kept for the next init.
+static bool _can_driver_twai_deinit()
+{
+	esp_err_t ret;
+	int n = 0;
+	
+	connected = false;
+	
+	can_timer_stop(&req_timer);
+	
+	if (node_hdl != NULL) {
+		(void) twai_node_disable(node_hdl);
+		if ((ret = twai_node_delete(node_hdl)) != ESP_OK) {
+			ESP_LOGE(TAG, "Driver delete failed - %d", ret);
+			return false;
+		}
+		node_hdl = NULL;
+	}
+	
+	// Let the receive task finish with frames already queued
+	while ((__atomic_load_n(&rx_tail, __ATOMIC_ACQUIRE) != rx_head) && (n++ < DEINIT_DRAIN_TRIES)) {
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	
+	num_rx_ids = 0;
+	filter_en = false;
+	sw_filter_en = false;
+	listen_only = false;
+	
+	return true;
+}
+
+
 static bool _can_driver_twai_connected()
 {
 	return connected;
 }
 
 
-static bool _can_driver_twai_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data)
+static bool _can_driver_twai_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int req_timeout)
 {
-	bool rsp_extended_id;
 	esp_err_t ret;
 	
-	rsp_extended_id = (rsp_id > 0x7FF);
-	
-	// Enable a filter for only the response packet if requested
-	if (filter_en) {
-		twai_mask_filter_config_t mfilter_cfg = {
-			.id = rsp_id,
-			.mask = (rsp_extended_id) ? 0x1FFFFFFF : 0x7FF,
-			.is_ext = rsp_extended_id,
-		};
-		
-		twai_node_disable(node_hdl);
-		
-		if ((ret = twai_node_config_mask_filter(node_hdl, 0, &mfilter_cfg)) != ESP_OK) {
-			ESP_LOGE(TAG, "Failed to set mask 0x%x - %d", rsp_id, ret);
-			return false;
-		}
-		
-		twai_node_enable(node_hdl);
+	// Use the caller's timeout if it is shorter than our configured maximum
+	if ((req_timeout <= 0) || (req_timeout > timeout_msec)) {
+		req_timeout = timeout_msec;
 	}
-
+	
 	// Send the packet
-	twai_frame_t tx_msg = {
-		.header.id = req_id,
-		.header.dlc = len,
-		.header.ide = (req_id > 0x7FF),
-		.buffer = data,
-		.buffer_len = len
-	};
-	if ((ret = twai_node_transmit(node_hdl, &tx_msg, 0)) != ESP_OK) {
-		ESP_LOGE(TAG, "Failed to send packet 0x%x - %d", req_id, ret);
+	if ((ret = _can_driver_twai_transmit(req_id, len, data)) != ESP_OK) {
+		DLOGE(TAG, "Failed to send packet 0x%x - %d", req_id, ret);
 		return false;
 	}
 	
 	// Start timeout timer
-	if (esp_timer_is_active(req_timer)) {
-		(void) esp_timer_stop(req_timer);
-	}
-	if ((ret = esp_timer_start_once(req_timer, timeout_msec * 1000)) != ESP_OK) {
-		ESP_LOGE(TAG, "Failed to start request timer - %d", ret);
-	}
+	can_timer_start(&req_timer, req_timeout);
 	
 	return true;
 }
@@ -213,48 +392,77 @@ static bool _can_driver_twai_tx_packet(uint32_t req_id, uint32_t rsp_id, int len
 static bool _can_driver_twai_tx_fc_packet(uint32_t req_id, int len, uint8_t* data)
 {
 	// Send the packet
-	twai_frame_t tx_msg = {
-		.header.id = req_id,
-		.header.dlc = len,
-		.header.ide = (req_id > 0x7FF),
-		.buffer = data,
-		.buffer_len = len
-	};
-	if (twai_node_transmit(node_hdl, &tx_msg, 0) != ESP_OK) {
-		return false;
-	}
-	
-	return true;
+	return (_can_driver_twai_transmit(req_id, len, data) == ESP_OK);
 }
 
 
 static void _can_driver_twai_en_rsp_filter(bool en)
 {
 	filter_en = en;
+	_can_driver_twai_apply_filters();
+}
+
+
+static void _can_driver_twai_set_rx_id_list(int num_ids, const uint32_t* ids)
+{
+	// Prevent the ISR from using the list while it changes
+	sw_filter_en = false;
 	
-	if (!en) {
-		// Disable filter
-		twai_mask_filter_config_t mfilter_cfg = {
-			.id = 0,
-			.mask = 0,
-			.is_ext = true
-		};
-		twai_node_disable(node_hdl);
-		if (twai_node_config_mask_filter(node_hdl, 0, &mfilter_cfg) != ESP_OK) {
-			ESP_LOGE(TAG, "Disable filter failed");
-		}
-		twai_node_enable(node_hdl);
+	for (int i=0; i<num_ids; i++) {
+		rx_id_list[i] = ids[i];
 	}
-	// No else necessary as filter is configured in tx_packet
+	num_rx_ids = num_ids;
+	
+	_can_driver_twai_apply_filters();
+}
+
+
+static void _can_driver_twai_set_flow_control(uint8_t block_size, uint8_t sep_time)
+{
+	// Nothing to do since the CAN manager builds the flow control packets we send
+}
+
+
+static void _can_driver_twai_set_expected_frames(int num_frames)
+{
+	// Nothing to do since we see each frame as it arrives
+}
+
+
+static bool _can_driver_twai_start_monitor(int num_ids, const uint32_t* ids)
+{
+	// Broadcast frames are always received (when included in the receive ID list)
+	return true;
 }
 
 
 static void _can_driver_twai_response_complete()
 {
 	// Stop the timer
-    if (esp_timer_is_active(req_timer)) {
-		(void) esp_timer_stop(req_timer);
-	}
+	can_timer_stop(&req_timer);
+}
+
+
+// A pending response may take longer than our configured maximum
+static void _can_driver_twai_extend_timeout(int timeout_msec)
+{
+	can_timer_start(&req_timer, timeout_msec);
+}
+
+
+static bool _can_driver_twai_get_bus_stats(can_bus_stats_t* statsP)
+{
+	if (!connected) return false;
+	
+	statsP->bitrate = bitrate;
+	statsP->num_rx_frames = stat_rx_frames;
+	statsP->num_tx_frames = stat_tx_frames;
+	statsP->num_bits = stat_bits;
+	statsP->num_bus_errors = stat_bus_errors;
+	statsP->num_err_passive = stat_err_passive;
+	statsP->num_bus_off = stat_bus_off;
+	
+	return true;
 }
 
 
@@ -269,13 +477,45 @@ static bool _can_driver_rx_callback(twai_node_handle_t handle, const twai_rx_don
         .buffer = recv_buff,
         .buffer_len = sizeof(recv_buff),
     };
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    rx_frame_t* fP;
+    uint32_t h;
+    int len;
+#ifdef ENABLE_RX_TIMING
+    uint32_t start_cycles = esp_cpu_get_cycle_count();
+#endif
     
-    // Push the response to the CAN manager (this is within an ISR context)
+    // Queue the timestamped frame for the receive task (this is within an ISR context)
     if (twai_node_receive_from_isr(handle, &rx_frame) == ESP_OK) {
-    	can_rx_packet(rx_frame.header.id, (int) twaifd_dlc2len(rx_frame.header.dlc), rx_frame.buffer);
+    	len = (int) twaifd_dlc2len(rx_frame.header.dlc);
+    	if (len > sizeof(recv_buff)) len = sizeof(recv_buff);
+    	_can_driver_twai_count_frame(&stat_rx_frames, rx_frame.header.ide, len);
+    	if (sw_filter_en && !_can_driver_twai_sw_accept(rx_frame.header.id)) {
+    		return false;
+    	}
+    	
+    	h = rx_head;
+    	if ((h - __atomic_load_n(&rx_tail, __ATOMIC_ACQUIRE)) >= RX_RING_LEN) {
+    		rx_drop_count += 1;
+    		return false;
+    	}
+    	fP = &rx_ring[h & RX_RING_MASK];
+    	fP->id = rx_frame.header.id;
+    	fP->rx_usec = esp_timer_get_time();
+    	fP->len = (uint8_t) len;
+    	memcpy(fP->data, recv_buff, len);
+    	__atomic_store_n(&rx_head, h + 1, __ATOMIC_RELEASE);
+    	
+    	vTaskNotifyGiveFromISR(task_handle_twai_rx, &higher_priority_task_woken);
     }
     
-    return false;
+#ifdef ENABLE_RX_TIMING
+    h = esp_cpu_get_cycle_count() - start_cycles;
+    rx_isr_cycles += h;
+    rx_isr_count += 1;
+    if (h > rx_isr_max_cycles) rx_isr_max_cycles = h;
+#endif
+    return (higher_priority_task_woken == pdTRUE);
 }
 
 
@@ -283,14 +523,414 @@ static bool _can_driver_state_change_callback(twai_node_handle_t handle, const t
 {
 	if (edata->new_sta == TWAI_ERROR_BUS_OFF) {
 		// Initiate recovery
+		__atomic_fetch_add(&stat_bus_off, 1, __ATOMIC_RELAXED);
 		(void) twai_node_recover(handle);
+	} else if (edata->new_sta == TWAI_ERROR_PASSIVE) {
+		__atomic_fetch_add(&stat_err_passive, 1, __ATOMIC_RELAXED);
 	}
 	
 	return false;
 }
 
 
+static bool _can_driver_error_callback(twai_node_handle_t handle, const twai_error_event_data_t *edata, void *user_ctx)
+{
+	__atomic_fetch_add(&stat_bus_errors, 1, __ATOMIC_RELAXED);
+	
+	return false;
+}
+
+
+// Count a frame and its worst case (maximum bit stuffing) length on the bus including
+// the interframe space
+static void _can_driver_twai_count_frame(volatile uint32_t* countP, bool is_ext, int len)
+{
+	int n = 8 * len;
+	uint32_t bits;
+	
+	if (is_ext) {
+		bits = 64 + n + (54 + n - 1) / 4 + 3;
+	} else {
+		bits = 44 + n + (34 + n - 1) / 4 + 3;
+	}
+	
+	__atomic_fetch_add(countP, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stat_bits, bits, __ATOMIC_RELAXED);
+}
+
+
 static void _can_driver_to_callback(void* arg)
 {
 	can_if_error(CAN_ERRNO_TIMEOUT);
 }
+
+
+// Hand received frames to the CAN manager outside of the ISR
+static void _can_driver_twai_rx_task(void* args)
+{
+	rx_frame_t* fP;
+	uint32_t t;
+	uint32_t prev_drop_count = 0;
+#ifdef ENABLE_RX_TIMING
+	int64_t t_usec;
+	int64_t log_usec = 0;
+	uint32_t prev_isr_cycles = 0;
+	uint32_t prev_isr_count = 0;
+	uint32_t n, isr_max;
+	uint32_t num_frames = 0;
+	uint32_t wake_usec, wake_sum = 0, wake_max = 0;
+	uint32_t proc_usec, proc_sum = 0, proc_max = 0;
+#endif
+	
+	while (1) {
+		(void) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		
+		if (rx_pm_lock != NULL) {
+			(void) esp_pm_lock_acquire(rx_pm_lock);
+		}
+		t = rx_tail;
+		while (t != __atomic_load_n(&rx_head, __ATOMIC_ACQUIRE)) {
+			fP = &rx_ring[t & RX_RING_MASK];
+#ifdef ENABLE_RX_TIMING
+			t_usec = esp_timer_get_time();
+			wake_usec = (uint32_t) (t_usec - fP->rx_usec);
+#endif
+			if (listen_only) {
+				can_rx_bcast_packet(fP->id, fP->len, fP->data, fP->rx_usec);
+			} else {
+				can_rx_packet(fP->id, fP->len, fP->data, fP->rx_usec);
+			}
+#ifdef ENABLE_RX_TIMING
+			proc_usec = (uint32_t) (esp_timer_get_time() - t_usec);
+			num_frames += 1;
+			wake_sum += wake_usec;
+			if (wake_usec > wake_max) wake_max = wake_usec;
+			proc_sum += proc_usec;
+			if (proc_usec > proc_max) proc_max = proc_usec;
+#endif
+			t += 1;
+			__atomic_store_n(&rx_tail, t, __ATOMIC_RELEASE);
+		}
+		if (rx_pm_lock != NULL) {
+			(void) esp_pm_lock_release(rx_pm_lock);
+		}
+		
+		if (rx_drop_count != prev_drop_count) {
+			ESP_LOGW(TAG, "Receive ring overflow - %lu frames dropped", rx_drop_count - prev_drop_count);
+			prev_drop_count = rx_drop_count;
+		}
+		
+#ifdef ENABLE_RX_TIMING
+		t_usec = esp_timer_get_time();
+		if ((num_frames != 0) && ((t_usec - log_usec) >= (RX_TIMING_LOG_MSEC * 1000))) {
+			n = rx_isr_count - prev_isr_count;
+			isr_max = __atomic_exchange_n(&rx_isr_max_cycles, 0, __ATOMIC_RELAXED);
+			ESP_LOGI(TAG, "RX timing (%s): %lu frames  isr avg %lu max %lu cycles  wake avg %lu max %lu  proc avg %lu max %lu uSec",
+#ifdef CONFIG_CAN_RX_PATH_IN_IRAM
+				"IRAM",
+#else
+				"flash",
+#endif
+				num_frames, (n == 0) ? 0 : (rx_isr_cycles - prev_isr_cycles) / n, isr_max,
+				wake_sum / num_frames, wake_max, proc_sum / num_frames, proc_max);
+			prev_isr_cycles = rx_isr_cycles;
+			prev_isr_count = rx_isr_count;
+			num_frames = 0;
+			wake_sum = 0;
+			wake_max = 0;
+			proc_sum = 0;
+			proc_max = 0;
+			log_usec = t_usec;
+		}
+#endif
+	}
+}
+
+
+// Queue a frame from the next transmit slot.  May be called from within an ISR context.
+static esp_err_t _can_driver_twai_transmit(uint32_t id, int len, uint8_t* data)
+{
+	tx_slot_t* sP;
+	esp_err_t ret;
+	
+	if (len > sizeof(sP->data)) len = sizeof(sP->data);
+	
+	sP = &tx_ring[__atomic_fetch_add(&tx_ring_index, 1, __ATOMIC_RELAXED) & TX_RING_MASK];
+	memcpy(sP->data, data, len);
+	memset(&sP->frame, 0, sizeof(sP->frame));
+	sP->frame.header.id = id;
+	sP->frame.header.dlc = len;
+	sP->frame.header.ide = (id > STD_ID_MASK);
+	sP->frame.buffer = sP->data;
+	sP->frame.buffer_len = len;
+	
+	if ((ret = twai_node_transmit(node_hdl, &sP->frame, 0)) == ESP_OK) {
+		_can_driver_twai_count_frame(&stat_tx_frames, sP->frame.header.ide, len);
+	}
+	
+	return ret;
+}
+
+
+// Program the hardware filters once for the current receive ID list (instead of
+// reprogramming them for each request).  Standard and extended IDs each need their own
+// filter.  Falls back to passing everything through hardware and filtering in software
+// when there aren't enough hardware filters.
+static void _can_driver_twai_apply_filters()
+{
+	int n = 0;
+	bool exact = true;
+	bool have_std = false;
+	bool have_ext = false;
+	twai_mask_filter_config_t mfilter_cfg[2] = {0};
+	
+	if (node_hdl == NULL) {
+		return;
+	}
+	
+	sw_filter_en = false;
+	
+	if (filter_en && (num_rx_ids > 0)) {
+		for (int i=0; i<num_rx_ids; i++) {
+			if (rx_id_list[i] > STD_ID_MASK) {
+				have_ext = true;
+			} else {
+				have_std = true;
+			}
+		}
+		
+		if ((have_std ? 1 : 0) + (have_ext ? 1 : 0) <= NUM_HW_FILTERS) {
+			if (have_std) {
+				exact &= _can_driver_twai_build_filter(false, &mfilter_cfg[n++]);
+			}
+			if (have_ext) {
+				exact &= _can_driver_twai_build_filter(true, &mfilter_cfg[n++]);
+			}
+		} else {
+			exact = false;
+		}
+	}
+	
+	if (n == 0) {
+		// Pass everything
+		mfilter_cfg[0].id = 0;
+		mfilter_cfg[0].mask = 0;
+		mfilter_cfg[0].is_ext = true;
+		n = 1;
+	}
+	
+	twai_node_disable(node_hdl);
+	for (int i=0; i<NUM_HW_FILTERS; i++) {
+		// Unused filters duplicate the first
+		if (twai_node_config_mask_filter(node_hdl, i, &mfilter_cfg[(i < n) ? i : 0]) != ESP_OK) {
+			ESP_LOGE(TAG, "Failed to set filter %d", i);
+		}
+	}
+	twai_node_enable(node_hdl);
+	
+	sw_filter_en = filter_en && (num_rx_ids > 0) && !exact;
+	
+	ESP_LOGI(TAG, "Filters: %d IDs, %d HW, SW %s", num_rx_ids, n, sw_filter_en ? "on" : "off");
+}
+
+
+// Build a mask filter passing all IDs of one type in the list.  Returns true if the
+// filter passes exactly those IDs.
+static bool _can_driver_twai_build_filter(bool is_ext, twai_mask_filter_config_t* cfgP)
+{
+	bool first = true;
+	int num_ids = 0;
+	int num_dont_care = 0;
+	uint32_t and_ids = 0;
+	uint32_t or_ids = 0;
+	uint32_t id_mask = is_ext ? EXT_ID_MASK : STD_ID_MASK;
+	uint32_t dont_care;
+	
+	for (int i=0; i<num_rx_ids; i++) {
+		if ((rx_id_list[i] > STD_ID_MASK) == is_ext) {
+			if (first) {
+				first = false;
+				and_ids = rx_id_list[i];
+				or_ids = rx_id_list[i];
+			} else {
+				and_ids &= rx_id_list[i];
+				or_ids |= rx_id_list[i];
+			}
+			num_ids += 1;
+		}
+	}
+	
+	// Bits that differ between IDs are don't-care
+	dont_care = (and_ids ^ or_ids) & id_mask;
+	cfgP->mask = ~dont_care & id_mask;
+	cfgP->id = and_ids & cfgP->mask;
+	cfgP->is_ext = is_ext;
+	
+	for (uint32_t d=dont_care; d!=0; d&=(d-1)) {
+		num_dont_care += 1;
+	}
+	
+	// Exact when the number of IDs the mask passes matches the number in the list
+	return ((num_dont_care < 6) && ((1 << num_dont_care) == num_ids));
+}
+
+
+// Called from the ISR
+static bool _can_driver_twai_sw_accept(uint32_t id)
+{
+	for (int i=0; i<num_rx_ids; i++) {
+		if (rx_id_list[i] == id) {
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+
+#ifdef CAN_DRIVER_TWAI_PROBE_BITRATE
+// Find the bitrate of the bus by listening at each candidate.  The bitrate found on the
+// last boot is checked first and kept unless it sees errors.  A silent bus (e.g. behind a
+// gateway that only forwards diagnostic traffic) uses the vehicle's bitrate.
+static uint32_t _can_driver_twai_probe_bitrate(uint32_t cfg_bitrate)
+{
+	can_bus_cache_t* cacheP;
+	uint32_t id_flags;
+	uint32_t rate;
+	int64_t start_usec = esp_timer_get_time();
+	int result;
+	
+	if (!ps_get_config(PS_CONFIG_TYPE_CAN, (void**) &cacheP)) {
+		ESP_LOGE(TAG, "Get CAN bus cache failed");
+		cacheP = NULL;
+	}
+	
+	if ((cacheP != NULL) && cacheP->valid) {
+		if (_can_driver_twai_probe_one(cacheP->bitrate, &id_flags) != PROBE_ERRORS) {
+			ESP_LOGI(TAG, "Using cached bitrate %lu", cacheP->bitrate);
+			return cacheP->bitrate;
+		}
+		ESP_LOGI(TAG, "Errors at cached bitrate %lu - probing", cacheP->bitrate);
+		cacheP->valid = false;
+		(void) ps_save_config(PS_CONFIG_TYPE_CAN);
+	}
+	
+	// The vehicle's bitrate first, then the others
+	for (int i=-1; i<(int) (sizeof(probe_bitrates)/sizeof(probe_bitrates[0])); i++) {
+		rate = (i < 0) ? cfg_bitrate : probe_bitrates[i];
+		if ((i >= 0) && (rate == cfg_bitrate)) continue;
+		
+		result = _can_driver_twai_probe_one(rate, &id_flags);
+		if (result == PROBE_FRAMES) {
+			ESP_LOGI(TAG, "Found bitrate %lu (%s IDs) in %d mSec", rate,
+			         (id_flags == (PS_CAN_FLAG_STD_IDS | PS_CAN_FLAG_EXT_IDS)) ? "11 and 29-bit" : ((id_flags == PS_CAN_FLAG_EXT_IDS) ? "29-bit" : "11-bit"),
+			         (int) ((esp_timer_get_time() - start_usec) / 1000));
+			if (cacheP != NULL) {
+				cacheP->valid = true;
+				cacheP->bitrate = rate;
+				cacheP->id_flags = id_flags;
+				(void) ps_save_config(PS_CONFIG_TYPE_CAN);
+			}
+			return rate;
+		}
+	}
+	
+	ESP_LOGI(TAG, "No bus traffic - using bitrate %lu", cfg_bitrate);
+	return cfg_bitrate;
+}
+
+
+// Listen to the bus at one bitrate.  Returns PROBE_FRAMES if enough frames arrived
+// without any errors.
+static int _can_driver_twai_probe_one(uint32_t rate, uint32_t* id_flagsP)
+{
+	twai_node_handle_t hdl;
+	twai_node_status_t status;
+	int64_t start_usec;
+	int result;
+	
+	twai_onchip_node_config_t node_config = {
+		.io_cfg.tx = TWAI_PIN_TX,
+		.io_cfg.rx = TWAI_PIN_RX,
+		.io_cfg.quanta_clk_out = -1,
+		.io_cfg.bus_off_indicator = -1,
+		.bit_timing.bitrate = rate,
+		.tx_queue_depth = 1,
+		.flags.enable_listen_only = true,
+	};
+	twai_mask_filter_config_t mfilter_cfg = {
+		.id = 0,
+		.mask = 0,
+		.is_ext = true,
+	};
+	
+	if (twai_new_node_onchip(&node_config, &hdl) != ESP_OK) {
+		return PROBE_SILENT;
+	}
+	
+	probe_std_frames = 0;
+	probe_ext_frames = 0;
+	probe_errors = 0;
+	if ((twai_node_register_event_callbacks(hdl, &probe_cbs, NULL) != ESP_OK) ||
+	    (twai_node_config_mask_filter(hdl, 0, &mfilter_cfg) != ESP_OK) ||
+	    (twai_node_enable(hdl) != ESP_OK)) {
+		(void) twai_node_delete(hdl);
+		return PROBE_SILENT;
+	}
+	
+	start_usec = esp_timer_get_time();
+	while (((esp_timer_get_time() - start_usec) < (CAN_DRIVER_TWAI_PROBE_MSEC * 1000)) &&
+	       ((probe_std_frames + probe_ext_frames) < CAN_DRIVER_TWAI_PROBE_MIN_FRAMES) && (probe_errors == 0)) {
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	
+	// A wrong bitrate shows up as errors (counted by the controller even when listening)
+	if ((twai_node_get_info(hdl, &status, NULL) == ESP_OK) && (status.rx_error_count != 0)) {
+		probe_errors += 1;
+	}
+	(void) twai_node_disable(hdl);
+	(void) twai_node_delete(hdl);
+	
+	if (probe_errors != 0) {
+		result = PROBE_ERRORS;
+	} else if ((probe_std_frames + probe_ext_frames) >= CAN_DRIVER_TWAI_PROBE_MIN_FRAMES) {
+		result = PROBE_FRAMES;
+	} else {
+		result = PROBE_SILENT;
+	}
+	
+	*id_flagsP = ((probe_std_frames != 0) ? PS_CAN_FLAG_STD_IDS : 0) | ((probe_ext_frames != 0) ? PS_CAN_FLAG_EXT_IDS : 0);
+	ESP_LOGI(TAG, "Probe %lu: %lu std, %lu ext frames, %lu errors", rate, probe_std_frames, probe_ext_frames, probe_errors);
+	
+	return result;
+}
+
+
+static bool _can_driver_probe_rx_callback(twai_node_handle_t handle, const twai_rx_done_event_data_t *edata, void *user_ctx)
+{
+	uint8_t recv_buff[8];
+	twai_frame_t rx_frame = {
+		.buffer = recv_buff,
+		.buffer_len = sizeof(recv_buff),
+	};
+	
+	// Only count frames while probing (this is within an ISR context)
+	if (twai_node_receive_from_isr(handle, &rx_frame) == ESP_OK) {
+		if (rx_frame.header.ide) {
+			probe_ext_frames += 1;
+		} else {
+			probe_std_frames += 1;
+		}
+	}
+	
+	return false;
+}
+
+
+static bool _can_driver_probe_error_callback(twai_node_handle_t handle, const twai_error_event_data_t *edata, void *user_ctx)
+{
+	probe_errors += 1;
+	
+	return false;
+}
+#endif
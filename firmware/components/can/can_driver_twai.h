@@ -32,6 +32,24 @@
 #define TWAI_PIN_TX 43
 #define TWAI_PIN_RX 44
 
+// Interface types passed to init
+#define CAN_DRIVER_TWAI_NORMAL      0
+#define CAN_DRIVER_TWAI_LISTEN_ONLY 1      // Broadcast sniffing only (never transmits or ACKs)
+
+// Comment out to use the vehicle's bitrate without probing the bus
+#define CAN_DRIVER_TWAI_PROBE_BITRATE
+
+// Bitrate probe.  Each candidate bitrate is listened to (never ACKing or transmitting)
+// until enough frames arrive, an error is seen or the window ends.
+#define CAN_DRIVER_TWAI_PROBE_MSEC       250
+#define CAN_DRIVER_TWAI_PROBE_MIN_FRAMES 8
+
+// Receive task (ISO-TP reassembly of the frames queued by the receive ISR) - runs above the
+// application tasks so flow control frames go out promptly
+#define CAN_DRIVER_TWAI_TASK_STACK    3072
+#define CAN_DRIVER_TWAI_TASK_PRIORITY 5
+#define CAN_DRIVER_TWAI_TASK_CORE     0
+
 
 
 //
@@ -6,7 +6,49 @@
  * and receive complete responses.  Exists between the Vehicle Manager and
  * OBD2 interface.  Implements basic [simplified] ISO-TP data management.
  *
- * Note: Only supports one request at a time
+ * Supports up to CAN_MANAGER_MAX_SESSIONS outstanding requests at a time as long as
+ * each is to a different ECU (unique response ID).  Each has its own reassembly state.
+ * Interface drivers report how many sessions they can support (ELM327 only supports one).
+ *
+ * A functional request (CAN_MANAGER_RSP_FUNCTIONAL) holds one session as its response
+ * window.  Each ECU that answers within the window gets a reassembly session of its own,
+ * with flow control sent to its physical address, and the window is closed by the
+ * interface's timeout.  Nothing else is sent while the window is open.  Only interfaces
+ * that see individual frames (TWAI) support them.
+ *
+ * Keeps a running response latency estimate for each ECU (mean + 4 * mean deviation, like
+ * TCP's retransmission timeout) and uses it as the request timeout so an ECU that isn't
+ * answering (e.g. asleep) costs a timeout close to the real latency of ECUs that are.
+ * Drivers clamp this to their configured maximum.
+ *
+ * Also passes subscribed broadcast frames (periodic frames sent by ECUs without a request)
+ * directly to the Vehicle Manager.  These are only seen by interfaces that receive all
+ * bus traffic (TWAI with the response filter disabled) or ELM327 adapters in monitor mode.
+ *
+ * With CAN_MANAGER_EN_DUAL_IF defined and an ELM327 interface selected, a second listen-only
+ * TWAI interface is started and traffic is routed by type: requests and their responses use
+ * the ELM327 while broadcast subscriptions are received by the TWAI (filtered to only the
+ * subscribed IDs so it never sees responses).  The ELM327 is never put into monitor mode.
+ *
+ * With CAN_MANAGER_EN_ELM327_PAIR defined the ELM327 pair interface runs a WiFi and a BLE
+ * adapter on two instances of the ELM327 driver.  Each ECU (response ID) is assigned to one
+ * adapter, balancing the number of prepared requests, so both carry a request at once and
+ * each only switches headers between its own ECUs.  An ECU's requests go to the other
+ * adapter while its own isn't connected and an error only abandons the failed adapter's
+ * request.  Only the WiFi adapter is put into monitor mode.  The two driver tasks receive
+ * concurrently so the receive path and the Vehicle Manager response queue both have more
+ * than one producer.
+ *
+ * With CAN_MANAGER_IF_AUTO selected each available interface (TWAI, the cached BLE adapter
+ * and the configured WiFi adapter) is brought up in turn and timed over a few OBD2 requests
+ * and the one with the highest estimated request rate is used.
+ *
+ * Request timeouts of the drivers and the N_Cr/N_Bs deadlines of each session are timers
+ * in one can_timer wheel so any number of them cost the same to start and stop.  A session
+ * deadline that expires abandons the outstanding requests like a request timeout.
+ *
+ * With CAN_MANAGER_EN_CAPTURE defined every frame passing through (requests, flow control,
+ * received frames) and every reassembled response is recorded by can_capture.
  *
  * Copyright 2025 Dan Julio
  *
@@ -25,11 +67,29 @@
  *
  */
 #include "can_manager.h"
+#include "can_capture.h"
+#include "can_timer.h"
 #include "can_driver_twai.h"
 #include "can_driver_elm327.h"
+#ifdef CAN_MANAGER_EN_EMULATOR
+#include "can_driver_emulator.h"
+#endif
+#ifdef CAN_MANAGER_EN_REPLAY
+#include "can_driver_replay.h"
+#endif
+#ifdef CAN_MANAGER_EN_REMOTE
+#include "can_driver_remote.h"
+#endif
+#include "dlog_utilities.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ps_utilities.h"
+#include "tune_utilities.h"
 #include "vehicle_manager.h"
+#include <string.h>
 
 
 
@@ -40,28 +100,201 @@
 // List of all implemented interfaces
 #define DRIVER_TWAI   0
 #define DRIVER_ELM327 1
+#define DRIVER_EMU    2
+#ifdef CAN_MANAGER_EN_EMULATOR
+#define DRIVER_REPLAY 3
+#else
+#define DRIVER_REPLAY 2
+#endif
+#ifdef CAN_MANAGER_EN_REPLAY
+#define DRIVER_REMOTE (DRIVER_REPLAY + 1)
+#else
+#define DRIVER_REMOTE DRIVER_REPLAY
+#endif
 
-#define NUM_DRIVERS   2
+// Adaptive request timeout = mean + TUNE_LAT_DEV_MULT * mean deviation, at least
+// TUNE_LAT_MIN_TIMEOUT_MSEC
+#define LAT_MIN_SAMPLES       4      // Use the driver's maximum timeout until we have this many samples
+#define LAT_MAX_BACKOFF       4      // Maximum number of timeout doublings after missed responses
+
+// Segmented requests
+#define TX_CF_MIN_GAP_USEC    600    // Consecutive frame spacing when the ECU allows back-to-back frames (one frame time at 250k)
+#define TX_NUM_FRAME_BUFS     4      // Frames are sent from buffers that stay valid until transmitted
+
+// Interface auto selection.  Candidates are timed with OBD2 Mode 01 PID 00 (supported PIDs)
+// requests, which any OBD2 ECU answers, to the engine/powertrain ECU.
+#define AUTO_CONNECT_MSEC     8000   // Connection wait (BLE scan or WiFi association, then ELM327 init)
+#define AUTO_RSP_MSEC         1000   // Response wait for each request
+#define AUTO_NUM_REQ          4
+#define AUTO_REQ_ID           0x7E0
+#define AUTO_RSP_ID           0x7E8
+
+// ELM327 pair adapters
+#define NUM_SHARDS            2
 
 static const can_if_driver_t* interface_listP[] = {
 	&can_driver_twai,
-	&can_driver_elm327
+	&can_driver_elm327,
+#ifdef CAN_MANAGER_EN_EMULATOR
+	&can_driver_emulator,
+#endif
+#ifdef CAN_MANAGER_EN_REPLAY
+	&can_driver_replay,
+#endif
+#ifdef CAN_MANAGER_EN_REMOTE
+	&can_driver_remote,
+#endif
 };
 
 
 
+//
+// Local data structures
+//
+typedef struct {
+	bool in_use;
+	bool rx_busy;                // can_rx_packet is using it (a free only marks it freed)
+	bool freed;                  // Freed while busy (not found, released when can_rx_packet is done)
+	uint32_t req_id;
+	uint32_t rsp_id;
+	int num_rx_bytes;
+	int data_index;
+	uint8_t seq_num;
+	uint8_t fc_block_size;
+	uint8_t fc_sep_time;
+	can_timer_t cf_timer;        // Running while the next consecutive frame (N_Cr) or flow control (N_Bs) is due
+	int64_t tx_usec;             // Time request was sent
+	int lat_index;               // Latency estimate entry (-1 for none)
+	bool keep_window;            // Functional responder: its first frame extended the window
+	int shard;                   // ELM327 pair adapter carrying the request
+	uint8_t* data_buf;           // Response buffer (see can_set_rsp_bufs)
+} isotp_session_t;
+
+typedef struct {
+	uint32_t req_id;
+	uint32_t rsp_id;
+	int num_samples;
+	int backoff;                 // Timeout doublings since the last response
+	int32_t mean_usec;           // Smoothed latency
+	int32_t dev_usec;            // Smoothed mean deviation
+} latency_est_t;
+
+
+
 //
 // Global variables
 //
 static const char* TAG = "can_manager";
 
 static can_if_driver_t* driverP = NULL;
-static uint32_t cur_req_id = 0;
-static uint32_t cur_rsp_id = 0;
-static uint8_t data_buf[4096];
+static int cur_if_type = -1;
+
+// Response buffers.  Sessions use the minimum length buffers until the vehicle manager
+// hands over buffers for the vehicle's longest response.
+static uint8_t session_min_buf[CAN_MANAGER_MAX_SESSIONS][CAN_MANAGER_MIN_RSP_LEN];
+static uint8_t* rsp_bufP = NULL;
+static int rsp_buf_len = CAN_MANAGER_MIN_RSP_LEN;
+
+// Requests per second estimated by interface auto selection (0 = not measured)
+static int link_rate = 0;
+
+// Auto selection response timing (responses and errors aren't passed to the vehicle manager
+// while active)
+static volatile bool auto_active = false;
+static volatile int64_t auto_rx_usec;
+static volatile bool auto_failed;
+static const uint8_t auto_req[8] = {0x02, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+// Interface receiving broadcast frames when it isn't the request interface (NULL = driverP)
+static can_if_driver_t* bcast_driverP = NULL;
+static bool bcast_if_init = false;
+
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+// ELM327 pair request interfaces (shard_driverP[1] is NULL unless the pair is running) and
+// the adapter each ECU is assigned to
+static can_if_driver_t* shard_driverP[NUM_SHARDS] = {NULL, NULL};
+static uint32_t shard_rsp_id[CAN_MANAGER_MAX_SHARD_IDS];
+static uint8_t shard_of_id[CAN_MANAGER_MAX_SHARD_IDS];
+static int num_shard_ids = 0;
+static int shard_expected_frames = 0;    // Given to the adapter the next request is routed to
+#endif
+
+// ISO-TP reassembly table, one entry per outstanding response ID
+static isotp_session_t session[CAN_MANAGER_MAX_SESSIONS];
+static int num_sessions = 0;
+static int max_sessions = 1;
+static portMUX_TYPE session_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Open functional request response window (NULL = none) and the number of complete
+// responses received in it
+static isotp_session_t* volatile func_sessionP = NULL;
+static uint32_t func_req_id;
+static volatile int func_num_rsp;
+
+// Response latency estimates
+static latency_est_t latency[CAN_MANAGER_MAX_LATENCY_IDS];
+static int num_latency = 0;
+
+// Subscribed broadcast frame IDs
+static uint32_t bcast_id[CAN_MANAGER_MAX_BCAST];
+static volatile int num_bcast = 0;
+
+// Flow-control parameters for subsequent requests (block size 0, STmin 0 = send all
+// consecutive frames as fast as possible)
+static uint8_t cur_fc_block_size = 0;
+static uint8_t cur_fc_sep_time = 0;
+
+// Requests the interface was told about in advance (passed again after an interface change)
+static const can_tx_desc_t* cur_prep_reqs = NULL;
+static int cur_prep_num_req = 0;
+
+// Segmented request being sent (one at a time).  The first frame is sent from the
+// requesting task, flow control is received in the interface's receive context and
+// consecutive frames are sent from the pacing timer's callback.
+static isotp_session_t* volatile tx_sessionP = NULL;
+static uint8_t tx_buf[CAN_MANAGER_MAX_REQ_LEN];
+static int tx_len;                // Payload bytes
+static int tx_index;              // Next payload byte to send
+static uint8_t tx_seq_num;
+static int tx_block_left;         // Consecutive frames before the next flow control (-1 = no limit)
+static int tx_gap_usec;
+static volatile bool tx_wait_fc;
+static uint8_t tx_frame[TX_NUM_FRAME_BUFS][8];
+static int tx_frame_index = 0;
+static esp_timer_handle_t tx_cf_timer = NULL;
+
+static bool session_timers_init = false;
+
+
 
-// Data for flow-control message
-static const uint8_t flow_control_data[] = {0x30, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+//
+// Forward declarations for internal functions
+//
+static isotp_session_t* _can_find_session(uint32_t rsp_id);
+static isotp_session_t* _can_alloc_session(uint32_t req_id, uint32_t rsp_id);
+static void _can_free_session(isotp_session_t* sP);
+static void _can_release_session(isotp_session_t* sP);
+static void _can_free_all_sessions();
+static void _can_release_all_sessions();
+static void _can_session_timer_cb(void* arg);
+static isotp_session_t* _can_alloc_responder(uint32_t rsp_id);
+static int _can_get_latency_index(uint32_t req_id, uint32_t rsp_id);
+static int _can_get_timeout_msec(int lat_index);
+static void _can_update_latency(isotp_session_t* sP, int64_t rx_usec);
+static void _can_init_bcast_interface(int if_type, int req_timeout, bool can_is_500k);
+static bool _can_if_stoppable(int if_type);
+static bool _can_auto_init(int req_timeout, bool can_is_500k);
+static int _can_auto_measure(int if_type);
+static bool _can_tx_first_frame(isotp_session_t* sP, int len, uint8_t* data, int timeout_msec);
+static void _can_tx_rx_flow_control(isotp_session_t* sP, int len, uint8_t* data);
+static void _can_tx_cf_timer_cb(void* arg);
+static uint8_t* _can_tx_next_frame_buf();
+static void _can_response_complete(int shard);
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+static void _can_shard_assign(int num_req, const can_tx_desc_t* reqs);
+static int _can_shard_route(uint32_t rsp_id);
+static bool _can_shard_busy(int shard);
+#endif
 
 
 
@@ -86,6 +319,32 @@ const char* can_get_interface_name(int n)
 		case CAN_MANAGER_IF_BLE:
 			return "ELM327 BLE";
 			break;
+		case CAN_MANAGER_IF_USB:
+			return "ELM327 USB";
+			break;
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+		case CAN_MANAGER_IF_ELM327_PAIR:
+			return "ELM327 PAIR";
+			break;
+#endif
+		case CAN_MANAGER_IF_AUTO:
+			return "AUTO";
+			break;
+#ifdef CAN_MANAGER_EN_EMULATOR
+		case CAN_MANAGER_IF_EMU:
+			return "ECU EMULATOR";
+			break;
+#endif
+#ifdef CAN_MANAGER_EN_REPLAY
+		case CAN_MANAGER_IF_REPLAY:
+			return "LOG REPLAY";
+			break;
+#endif
+#ifdef CAN_MANAGER_EN_REMOTE
+		case CAN_MANAGER_IF_REMOTE:
+			return "ESP-NOW REMOTE";
+			break;
+#endif
 		default:
 			return NULL;
 	}
@@ -96,6 +355,23 @@ bool can_init(int if_type, int req_timeout, bool can_is_500k)
 {
 	bool ret;
 	
+	// Deadline timers (once)
+	if (!session_timers_init && can_timer_wheel_init()) {
+		for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+			can_timer_setup(&session[i].cf_timer, &_can_session_timer_cb, &session[i]);
+		}
+		session_timers_init = true;
+	}
+	
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	shard_driverP[1] = NULL;
+#endif
+	
+	if (if_type == CAN_MANAGER_IF_AUTO) {
+		return _can_auto_init(req_timeout, can_is_500k);
+	}
+	link_rate = 0;
+	
 	switch (if_type) {
 		case CAN_MANAGER_IF_TWAI:
 			driverP = (can_if_driver_t*) interface_listP[DRIVER_TWAI];
@@ -112,16 +388,151 @@ bool can_init(int if_type, int req_timeout, bool can_is_500k)
 			ret = driverP->fcn_init(CAN_DRIVER_ELM327_BLE, req_timeout, can_is_500k);
 			break;
 		
+		case CAN_MANAGER_IF_USB:
+			driverP = (can_if_driver_t*) interface_listP[DRIVER_ELM327];
+			ret = driverP->fcn_init(CAN_DRIVER_ELM327_USB, req_timeout, can_is_500k);
+			break;
+		
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+		case CAN_MANAGER_IF_ELM327_PAIR:
+			// WiFi adapter on the first instance of the ELM327 driver, BLE on the second
+			driverP = (can_if_driver_t*) interface_listP[DRIVER_ELM327];
+			ret = driverP->fcn_init(CAN_DRIVER_ELM327_WIFI, req_timeout, can_is_500k);
+			if (ret) {
+				ret = can_driver_elm327_pair.fcn_init(CAN_DRIVER_ELM327_BLE, req_timeout, can_is_500k);
+			}
+			if (ret) {
+				shard_driverP[0] = driverP;
+				shard_driverP[1] = (can_if_driver_t*) &can_driver_elm327_pair;
+			}
+			break;
+#endif
+		
+#ifdef CAN_MANAGER_EN_EMULATOR
+		case CAN_MANAGER_IF_EMU:
+			driverP = (can_if_driver_t*) interface_listP[DRIVER_EMU];
+			ret = driverP->fcn_init(0, req_timeout, can_is_500k);
+			break;
+#endif
+		
+#ifdef CAN_MANAGER_EN_REPLAY
+		case CAN_MANAGER_IF_REPLAY:
+			driverP = (can_if_driver_t*) interface_listP[DRIVER_REPLAY];
+			ret = driverP->fcn_init(0, req_timeout, can_is_500k);
+			break;
+#endif
+		
+#ifdef CAN_MANAGER_EN_REMOTE
+		case CAN_MANAGER_IF_REMOTE:
+			driverP = (can_if_driver_t*) interface_listP[DRIVER_REMOTE];
+			ret = driverP->fcn_init(0, req_timeout, can_is_500k);
+			break;
+#endif
+		
 		default:
 			ret = false;
 	}
 	
+	_can_free_all_sessions();
+	num_latency = 0;
+	if (tx_cf_timer == NULL) {
+		const esp_timer_create_args_t tx_cf_timer_args = {
+			.callback = &_can_tx_cf_timer_cb,
+			.name = "can_tx_cf"
+		};
+		if (esp_timer_create(&tx_cf_timer_args, &tx_cf_timer) != ESP_OK) {
+			ESP_LOGE(TAG, "Could not create consecutive frame timer");
+			tx_cf_timer = NULL;
+		}
+	}
+	if (ret) {
+		cur_if_type = if_type;
+		_can_init_bcast_interface(if_type, req_timeout, can_is_500k);
+#ifdef CAN_MANAGER_EN_CAPTURE
+		(void) can_capture_init();
+#endif
+		driverP->fcn_set_flow_control(cur_fc_block_size, cur_fc_sep_time);
+		if (driverP->fcn_prepare_tx != NULL) {
+			driverP->fcn_prepare_tx(cur_prep_num_req, cur_prep_reqs);
+		}
+		// A receive only interface has no sessions so nothing is ever scheduled
+		max_sessions = driverP->max_sessions;
+		if (max_sessions > CAN_MANAGER_MAX_SESSIONS) {
+			max_sessions = CAN_MANAGER_MAX_SESSIONS;
+		} else if (max_sessions < 0) {
+			max_sessions = 0;
+		}
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+		if (shard_driverP[1] != NULL) {
+			// One request on each adapter
+			shard_driverP[1]->fcn_set_flow_control(cur_fc_block_size, cur_fc_sep_time);
+			shard_driverP[1]->fcn_prepare_tx(cur_prep_num_req, cur_prep_reqs);
+			_can_shard_assign(cur_prep_num_req, cur_prep_reqs);
+			max_sessions = NUM_SHARDS;
+		}
+#endif
+	}
+	
 	return ret;
 }
 
 
+// Stop the interface (and any broadcast interface) so can_init may start another.  Returns
+// false, leaving the interface running, if it can only be stopped by a restart.
+bool can_deinit()
+{
+	if (driverP == NULL) {
+		return true;
+	}
+	if (!_can_if_stoppable(cur_if_type)) {
+		return false;
+	}
+	
+	// Abandon outstanding requests and any segmented request being sent
+	if (tx_cf_timer != NULL) {
+		(void) esp_timer_stop(tx_cf_timer);
+	}
+	_can_free_all_sessions();
+	
+	if (!driverP->fcn_deinit()) {
+		ESP_LOGE(TAG, "%s deinit failed", driverP->name);
+		return false;
+	}
+	driverP = NULL;
+	cur_if_type = -1;
+	
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	if (shard_driverP[1] != NULL) {
+		if (!shard_driverP[1]->fcn_deinit()) {
+			ESP_LOGE(TAG, "%s deinit failed", shard_driverP[1]->name);
+			return false;
+		}
+		shard_driverP[1] = NULL;
+	}
+#endif
+	
+	if (bcast_if_init) {
+		bcast_driverP = NULL;
+		if (!interface_listP[DRIVER_TWAI]->fcn_deinit()) {
+			ESP_LOGE(TAG, "Broadcast interface deinit failed");
+			return false;
+		}
+		bcast_if_init = false;
+	}
+	
+	return true;
+}
+
+
 bool can_connected()
 {
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	// Requests are sent by whichever adapter is connected
+	if (shard_driverP[1] != NULL) {
+		return shard_driverP[0]->fcn_is_connected() || shard_driverP[1]->fcn_is_connected();
+	}
+#endif
+	
 	if (driverP != NULL) {
 		return driverP->fcn_is_connected();
 	}
@@ -130,98 +541,1378 @@ bool can_connected()
 }
 
 
-bool can_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data)
+// True when broadcast frames are received at full rate by a separate interface
+bool can_has_bcast_interface()
+{
+	return (bcast_driverP != NULL);
+}
+
+
+int can_get_max_sessions()
+{
+	return max_sessions;
+}
+
+
+// Returns the approximate time cost for the interface to change each of the request ID,
+// the response ID or the protocol (11/29-bit) between requests
+int can_get_id_switch_msec()
 {
 	if (driverP != NULL) {
-		// Store the request ID and response ID for later comparison with received data
-		cur_req_id = req_id;
-		cur_rsp_id = rsp_id;
-		
-		// Attempt to send the packet
-		return driverP->fcn_tx_packet(req_id, rsp_id, len, data);
+		return driverP->id_switch_msec;
+	}
+	
+	return 0;
+}
+
+
+// Returns the longest request (payload length byte and payload) the interface can send
+int can_get_max_req_len()
+{
+	if ((driverP != NULL) && (tx_cf_timer != NULL)) {
+		return (driverP->max_req_len < CAN_MANAGER_MAX_REQ_LEN) ? driverP->max_req_len : CAN_MANAGER_MAX_REQ_LEN;
+	}
+	
+	return 8;
+}
+
+
+bool can_session_available(uint32_t rsp_id)
+{
+	if (rsp_id == CAN_MANAGER_RSP_FUNCTIONAL) {
+		return (num_sessions == 0) && can_functional_supported();
+	}
+	
+	if ((func_sessionP != NULL) || (_can_find_session(rsp_id) != NULL) || (num_sessions >= max_sessions)) {
+		return false;
+	}
+	
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	// Each adapter of the pair carries one request at a time
+	if ((shard_driverP[1] != NULL) && _can_shard_busy(_can_shard_route(rsp_id))) {
+		return false;
+	}
+#endif
+	
+	return true;
+}
+
+
+// Returns true if a responsePending negative response keeps the request's session open for
+// the real response (otherwise the interface ends the request when it arrives)
+bool can_rsp_pending_supported()
+{
+	return ((driverP != NULL) && (driverP->fcn_extend_timeout != NULL));
+}
+
+
+// Returns true if the interface can gather the responses of several ECUs to a functional
+// request (it must see each frame to reassemble them separately)
+bool can_functional_supported()
+{
+	return ((driverP != NULL) && (driverP == interface_listP[DRIVER_TWAI]));
+}
+
+
+// Returns true if rsp_id is an ECU's physical response ID answering the functional
+// request ID req_id.  May be called from within an ISR.
+bool can_is_functional_rsp(uint32_t req_id, uint32_t rsp_id)
+{
+	if (req_id == CAN_MANAGER_FUNC_REQ_ID) {
+		return ((rsp_id >= 0x7E8) && (rsp_id <= 0x7EF));
+	} else if (req_id == CAN_MANAGER_FUNC_REQ_EXT_ID) {
+		return ((rsp_id & 0xFFFFFF00) == 0x18DAF100);
 	}
 	
 	return false;
 }
 
 
-void can_en_rsp_filter(bool en)
+// Get the statistics of the bus the interface is on.  Returns false if the interface
+// can't see bus traffic (e.g. ELM327).
+bool can_get_bus_stats(can_bus_stats_t* statsP)
 {
-	if (driverP != NULL) {
-		driverP->fcn_en_rsp_filter(en);
+	if ((driverP != NULL) && (driverP->fcn_get_bus_stats != NULL)) {
+		return driverP->fcn_get_bus_stats(statsP);
 	}
+	
+	return false;
 }
 
 
-// Note this may be called from within an ISR which means the Vehicle Manager vm_rx_data()
-// will also be called from within an ISR
-void can_rx_packet(uint32_t rsp_id, int len, uint8_t* data)
+// Measure the interface's capabilities again (ELM327 adapters).  Returns false if the
+// interface has nothing to characterize.
+bool can_characterize_interface()
 {
-	bool is_singleframe = false;
-	bool is_firstframe = false;
-	bool is_consecutiveframe = false;
-	int rx_data_index;
-	static int num_rx_bytes;
-	static int data_index;
-	static uint8_t seq_num;
+	if (driverP == interface_listP[DRIVER_ELM327]) {
+		can_driver_elm327_characterize();
+		return true;
+	}
 	
-	if (rsp_id == cur_rsp_id) {
-		if (len > 0) {
-			switch (data[0] & 0xF0) {
-				case 0x00:
-					// Single frame
-					is_singleframe = true;
-					num_rx_bytes = data[0] & 0x0F;
-					rx_data_index = 1;               // Index of first data byte
-					data_index = 0;                  // Start collecting data
-					seq_num = 0xFF;                  // Should see no subsequent frame packets so ignore any we see
-					break;
-				case 0x10:
-					// First frame of a multiframe response
-					if (len > 1) {
-						is_firstframe = true;
-						num_rx_bytes = ((data[0] & 0x0F) << 8) | data[1];
-						rx_data_index = 2;
-						data_index = 0;
-						seq_num = 0;
-					} else {
-						// Invalid packet so set an invalid sequence number for force ignoring subsequent data
-						seq_num = 0xFF;
-					}
-					break;
-				case 0x20:
-					// Subsequent frame of a multiframe response
-					is_consecutiveframe = true;
-					rx_data_index = 1;
-					break;
-			}
+	return false;
+}
+
+
+// True if the current interface can be stopped and if_type started in its place without
+// a restart
+bool can_interface_hot_swappable(int if_type)
+{
+	return _can_if_stoppable(cur_if_type) && _can_if_stoppable(if_type);
+}
+
+
+// Returns the interface in use (the one auto selection picked) or -1 if none
+int can_get_active_interface()
+{
+	return cur_if_type;
+}
+
+
+// Returns the request rate (requests per second) measured by auto selection for the
+// interface in use, or 0 if it wasn't measured
+int can_get_link_rate()
+{
+	return link_rate;
+}
+
+
+bool can_interface_characterizing()
+{
+	if (driverP == interface_listP[DRIVER_ELM327]) {
+		return can_driver_elm327_characterizing();
+	}
+	
+	return false;
+}
+
+
+void can_end_session(uint32_t rsp_id)
+{
+	isotp_session_t* sP;
+	
+	portENTER_CRITICAL_SAFE(&session_mux);
+	if ((sP = _can_find_session(rsp_id)) != NULL) {
+		_can_release_session(sP);
+	}
+	portEXIT_CRITICAL_SAFE(&session_mux);
+}
+
+
+// Set the ISO-TP flow control block size and separation time (STmin) sent for
+// subsequent requests
+void can_set_flow_control(uint8_t block_size, uint8_t sep_time)
+{
+	if ((block_size != cur_fc_block_size) || (sep_time != cur_fc_sep_time)) {
+		cur_fc_block_size = block_size;
+		cur_fc_sep_time = sep_time;
+		if (driverP != NULL) {
+			driverP->fcn_set_flow_control(block_size, sep_time);
 		}
-		
-		// Copy data to our local buffer
-		if (is_singleframe || is_firstframe || (is_consecutiveframe && ((data[0] & 0x0F) == seq_num))) {
-			while ((rx_data_index < len) && (data_index < num_rx_bytes)) {
-				data_buf[data_index++] = data[rx_data_index++];
-			}
-			seq_num = (seq_num + 1) & 0x0F;
-			
-			if (data_index == num_rx_bytes) {
-				// Received a complete response, stop the driver's timeout timer
-				driverP->fcn_response_complete();
-				
-				// And send it to the vehicle
-				vm_rx_data(rsp_id, num_rx_bytes, data_buf);
-			}
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+		if (shard_driverP[1] != NULL) {
+			shard_driverP[1]->fcn_set_flow_control(block_size, sep_time);
 		}
-		
-		// Send flow control packet if necessary
-		if (is_firstframe && (cur_req_id != 0)) {
-			(void) driverP->fcn_tx_fc_packet(cur_req_id, 8, (uint8_t*) flow_control_data);
+#endif
+	}
+}
+
+
+// Describe the requests that will be sent repeatedly so the interface can do any per-request
+// work (e.g. formatting) once instead of for each transmission.  reqs must persist until the
+// next call.  Requests that weren't described are still sent normally.
+void can_prepare_requests(int num_req, const can_tx_desc_t* reqs)
+{
+	if (num_req > CAN_MANAGER_MAX_PREP_REQ) {
+		num_req = CAN_MANAGER_MAX_PREP_REQ;
+	}
+	cur_prep_reqs = reqs;
+	cur_prep_num_req = num_req;
+	if ((driverP != NULL) && (driverP->fcn_prepare_tx != NULL)) {
+		driverP->fcn_prepare_tx(num_req, reqs);
+	}
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	if (shard_driverP[1] != NULL) {
+		// Both adapters prepare every request so either can send one while the other is
+		// disconnected
+		shard_driverP[1]->fcn_prepare_tx(num_req, reqs);
+		_can_shard_assign(num_req, reqs);
+	}
+#endif
+}
+
+
+// Set the number of CAN frames expected in the response to the next request (0 if unknown)
+// so interfaces that wait for more frames (ELM327) can stop as soon as they arrive
+void can_set_expected_frames(int num_frames)
+{
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	if (shard_driverP[1] != NULL) {
+		shard_expected_frames = num_frames;
+		return;
+	}
+#endif
+	
+	if (driverP != NULL) {
+		driverP->fcn_set_expected_frames(num_frames);
+	}
+}
+
+
+// Set the list of all IDs the vehicle expects to receive (responses and broadcasts)
+// for interfaces that can filter received traffic
+void can_set_rx_id_list(int num_ids, const uint32_t* ids)
+{
+	if (driverP != NULL) {
+		if (num_ids > CAN_MANAGER_MAX_RX_IDS) {
+			num_ids = CAN_MANAGER_MAX_RX_IDS;
+		}
+		driverP->fcn_set_rx_id_list(num_ids, ids);
+	}
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	if (shard_driverP[1] != NULL) {
+		shard_driverP[1]->fcn_set_rx_id_list(num_ids, ids);
+	}
+#endif
+}
+
+
+bool can_subscribe_broadcast(uint32_t id)
+{
+	for (int i=0; i<num_bcast; i++) {
+		if (bcast_id[i] == id) {
+			return true;
 		}
 	}
+	
+	if (num_bcast >= CAN_MANAGER_MAX_BCAST) {
+		ESP_LOGE(TAG, "Too many broadcast subscriptions");
+		return false;
+	}
+	
+	// Entry is written before the count is increased for readers in the ISR
+	bcast_id[num_bcast] = id;
+	__atomic_store_n(&num_bcast, num_bcast + 1, __ATOMIC_RELEASE);
+	
+	if (bcast_driverP != NULL) {
+		bcast_driverP->fcn_set_rx_id_list(num_bcast, bcast_id);
+	}
+	
+	return true;
 }
 
 
-void can_if_error(int errno)
+void can_clear_broadcasts()
+{
+	num_bcast = 0;
+	
+	if (bcast_driverP != NULL) {
+		bcast_driverP->fcn_set_rx_id_list(0, bcast_id);
+	}
+}
+
+
+// Called when there are no requests to send for a while so interfaces that can only
+// receive broadcast frames in a special mode (ELM327 monitor mode) may enter it.  Not
+// necessary when a separate interface receives them.
+void can_start_monitor()
+{
+	if ((driverP != NULL) && (bcast_driverP == NULL) && (num_bcast != 0)) {
+		(void) driverP->fcn_start_monitor(num_bcast, bcast_id);
+	}
+}
+
+
+// Bytes of response buffers needed by the CAN manager and the interface drivers for
+// responses up to max_rsp_len bytes (0 when the minimum length buffers are enough)
+int can_get_rsp_buf_size(int max_rsp_len)
 {
-	vm_note_error(errno);
+	int len = 0;
+	
+	if (max_rsp_len > CAN_MANAGER_MIN_RSP_LEN) {
+		len = CAN_MANAGER_MAX_SESSIONS * max_rsp_len;
+	}
+	
+	return len + can_driver_elm327_get_rsp_buf_size(max_rsp_len);
+}
+
+
+// Use bufP (can_get_rsp_buf_size bytes) for responses up to max_rsp_len bytes.  A NULL
+// bufP returns to the minimum length buffers.  Called by the vehicle manager while no
+// requests are outstanding.
+void can_set_rsp_bufs(uint8_t* bufP, int max_rsp_len)
+{
+	int len = 0;
+	
+	portENTER_CRITICAL(&session_mux);
+	if ((bufP != NULL) && (max_rsp_len > CAN_MANAGER_MIN_RSP_LEN)) {
+		rsp_bufP = bufP;
+		rsp_buf_len = max_rsp_len;
+		len = CAN_MANAGER_MAX_SESSIONS * max_rsp_len;
+	} else {
+		rsp_bufP = NULL;
+		rsp_buf_len = CAN_MANAGER_MIN_RSP_LEN;
+	}
+	portEXIT_CRITICAL(&session_mux);
+	
+	can_driver_elm327_set_rsp_bufs((bufP != NULL) ? &bufP[len] : NULL, max_rsp_len);
+}
+
+
+bool can_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data)
+{
+	bool ret;
+	int shard = 0;
+	can_if_driver_t* drvP = driverP;
+	isotp_session_t* sP;
+	
+	if (driverP != NULL) {
+		// Requests that don't fit in a single frame need an interface that can segment them
+		// and we only send one at a time
+		if (len > 8) {
+			if ((len > can_get_max_req_len()) || (data[0] != (len - 1))) {
+				ESP_LOGE(TAG, "Can't send %d byte request to 0x%lx", len, req_id);
+				return false;
+			}
+			if (tx_sessionP != NULL) {
+				return false;
+			}
+		}
+		
+		// A functional request is sent on its own and holds the bus until its window closes
+		if (rsp_id == CAN_MANAGER_RSP_FUNCTIONAL) {
+			if ((num_sessions != 0) || (len > 8) || !can_functional_supported() ||
+			    ((req_id != CAN_MANAGER_FUNC_REQ_ID) && (req_id != CAN_MANAGER_FUNC_REQ_EXT_ID))) {
+				return false;
+			}
+		} else if (func_sessionP != NULL) {
+			return false;
+		}
+		
+		// Setup a reassembly slot for the response (reuse any existing slot for this ECU
+		// since it can only be answering one request at a time)
+		portENTER_CRITICAL_SAFE(&session_mux);
+		if ((sP = _can_find_session(rsp_id)) != NULL) {
+			_can_release_session(sP);
+		}
+		portEXIT_CRITICAL_SAFE(&session_mux);
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+		if (shard_driverP[1] != NULL) {
+			// Send on the ECU's adapter once its previous request has finished
+			shard = _can_shard_route(rsp_id);
+			if (_can_shard_busy(shard)) {
+				return false;
+			}
+			drvP = shard_driverP[shard];
+			drvP->fcn_set_expected_frames(shard_expected_frames);
+		}
+#endif
+		if ((sP = _can_alloc_session(req_id, rsp_id)) == NULL) {
+			DLOGE(TAG, "No free session for 0x%lx", rsp_id);
+			return false;
+		}
+		sP->shard = shard;
+		
+		// Attempt to send the packet
+		sP->tx_usec = esp_timer_get_time();
+		if (rsp_id == CAN_MANAGER_RSP_FUNCTIONAL) {
+			// The window is the same for every functional request
+			sP->lat_index = -1;
+			func_req_id = req_id;
+			func_num_rsp = 0;
+			func_sessionP = sP;
+			if (can_capture_active) {
+				can_capture_record(CAN_CAPTURE_TX, req_id, len, data);
+			}
+			ret = driverP->fcn_tx_packet(req_id, rsp_id, len, data, CAN_MANAGER_FUNC_WINDOW_MSEC);
+		} else if (len > 8) {
+			sP->lat_index = _can_get_latency_index(req_id, rsp_id);
+			ret = _can_tx_first_frame(sP, len, data, _can_get_timeout_msec(sP->lat_index));
+		} else {
+			sP->lat_index = _can_get_latency_index(req_id, rsp_id);
+			if (can_capture_active) {
+				can_capture_record(CAN_CAPTURE_TX, req_id, len, data);
+			}
+			ret = drvP->fcn_tx_packet(req_id, rsp_id, len, data, _can_get_timeout_msec(sP->lat_index));
+		}
+		if (!ret) {
+			_can_free_session(sP);
+			return false;
+		}
+		
+		return true;
+	}
+	
+	return false;
+}
+
+
+void can_en_rsp_filter(bool en)
+{
+	if (driverP != NULL) {
+		driverP->fcn_en_rsp_filter(en);
+	}
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	if (shard_driverP[1] != NULL) {
+		shard_driverP[1]->fcn_en_rsp_filter(en);
+	}
+#endif
+}
+
+
+// Note this may be called from within an ISR which means the Vehicle Manager vm_rx_data()
+// will also be called from within an ISR.  rx_usec is the time the driver received the frame.
+//
+// With CAN_MANAGER_EN_ELM327_PAIR frames arrive from two contexts at once, each adapter's
+// driver task delivering its own ECUs' responses.  The session table and the latency
+// estimates, functional window count and auto selection time updated with it are only read
+// and changed under session_mux.  A session's reassembly state is only used by the context
+// receiving its ECU's frames, which holds it busy while processing a frame so an error or
+// timer freeing it meanwhile leaves it for this function to release.
+void can_rx_packet(uint32_t rsp_id, int len, uint8_t* data, int64_t rx_usec)
+{
+	bool is_singleframe = false;
+	bool is_firstframe = false;
+	bool is_consecutiveframe = false;
+	bool rx_done = false;
+	int rx_data_index;
+	int rsp_len;
+	int shard;
+	int start_index;
+	isotp_session_t* sP;
+	uint8_t fc_data[8] = {0x30, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+	
+	if (can_capture_active) {
+		can_capture_record(CAN_CAPTURE_RX, rsp_id, len, data);
+	}
+	
+	portENTER_CRITICAL_SAFE(&session_mux);
+	sP = _can_find_session(rsp_id);
+	if (sP != NULL) {
+		sP->rx_busy = true;
+	}
+	portEXIT_CRITICAL_SAFE(&session_mux);
+	
+	// The first frame from each ECU answering an open functional request starts its session
+	if ((sP == NULL) && (func_sessionP != NULL) && (len > 0) &&
+	    (((data[0] & 0xF0) == 0x00) || ((data[0] & 0xF0) == 0x10)) &&
+	    can_is_functional_rsp(func_req_id, rsp_id)) {
+		sP = _can_alloc_responder(rsp_id);
+	}
+	
+	if (sP != NULL) {
+		if (len > 0) {
+			switch (data[0] & 0xF0) {
+				case 0x00:
+					// Single frame
+					is_singleframe = true;
+					sP->num_rx_bytes = data[0] & 0x0F;
+					rx_data_index = 1;               // Index of first data byte
+					sP->data_index = 0;              // Start collecting data
+					sP->seq_num = 0xFF;              // Should see no subsequent frame packets so ignore any we see
+					break;
+				case 0x10:
+					// First frame of a multiframe response
+					if ((len > 1) && ((((data[0] & 0x0F) << 8) | data[1]) > rsp_buf_len)) {
+						// Longer than the vehicle's responses were planned for so let
+						// the request time out
+						DLOGE(TAG, "%d byte response from 0x%lx too long", ((data[0] & 0x0F) << 8) | data[1], rsp_id);
+						sP->seq_num = 0xFF;
+					} else if (len > 1) {
+						is_firstframe = true;
+						sP->num_rx_bytes = ((data[0] & 0x0F) << 8) | data[1];
+						rx_data_index = 2;
+						sP->data_index = 0;
+						sP->seq_num = 0;
+						if ((func_sessionP != NULL) && !sP->keep_window && (driverP->fcn_extend_timeout != NULL)) {
+							// Keep the window open for the rest of this ECU's response
+							sP->keep_window = true;
+							driverP->fcn_extend_timeout(tune_get(TUNE_N_CR_MSEC));
+						}
+					} else {
+						// Invalid packet so set an invalid sequence number for force ignoring subsequent data
+						sP->seq_num = 0xFF;
+					}
+					break;
+				case 0x20:
+					// Subsequent frame of a multiframe response
+					is_consecutiveframe = true;
+					rx_data_index = 1;
+					break;
+				case 0x30:
+					// Flow control for the segmented request we're sending to this ECU
+					if ((sP == tx_sessionP) && tx_wait_fc) {
+						_can_tx_rx_flow_control(sP, len, data);
+					}
+					break;
+			}
+		}
+		
+		// Copy data to the session buffer
+		if (is_singleframe || is_firstframe || (is_consecutiveframe && ((data[0] & 0x0F) == sP->seq_num))) {
+			start_index = sP->data_index;
+			while ((rx_data_index < len) && (sP->data_index < sP->num_rx_bytes)) {
+				sP->data_buf[sP->data_index++] = data[rx_data_index++];
+			}
+			sP->seq_num = (sP->seq_num + 1) & 0x0F;
+			
+			if (!is_singleframe && (sP->data_index < sP->num_rx_bytes)) {
+				// Start the N_Cr timer for the next consecutive frame
+				can_timer_start(&sP->cf_timer, tune_get(TUNE_N_CR_MSEC));
+				
+				// Let the vehicle manager decode what has arrived so far (if it streams this response)
+				vm_rx_partial(rsp_id, start_index, sP->num_rx_bytes, sP->data_index - start_index, &sP->data_buf[start_index], rx_usec);
+			}
+			
+			if ((sP->data_index == sP->num_rx_bytes) && (sP->num_rx_bytes == 3) && (sP->data_buf[0] == CAN_UDS_NEG_RSP) &&
+			    (sP->data_buf[2] == CAN_NRC_RESPONSE_PENDING) && (driverP->fcn_extend_timeout != NULL)) {
+				// The ECU needs more time.  Keep the session for the real response, give it
+				// P2* and let the vehicle manager know so it doesn't abandon the request.
+				sP->data_index = 0;
+				sP->num_rx_bytes = 0;
+				driverP->fcn_extend_timeout(CAN_MANAGER_P2X_MSEC);
+				vm_rx_data(rsp_id, 3, sP->data_buf, rx_usec);
+			} else if (sP->data_index == sP->num_rx_bytes) {
+				// Received a complete response.  Release the session before handing the data
+				// to the vehicle so it may immediately issue another request to this ECU (the
+				// buffer is only written by subsequent frames from this ECU which are processed
+				// in this same context).  A response to a request that has already been
+				// abandoned (e.g. it timed out as the last frame arrived) is dropped.
+				rsp_len = sP->num_rx_bytes;
+				shard = sP->shard;
+				rx_done = true;
+				portENTER_CRITICAL_SAFE(&session_mux);
+				sP->rx_busy = false;
+				if (sP->freed) {
+					_can_release_session(sP);
+					portEXIT_CRITICAL_SAFE(&session_mux);
+					return;
+				}
+				_can_update_latency(sP, rx_usec);
+				_can_release_session(sP);
+				portEXIT_CRITICAL_SAFE(&session_mux);
+				_can_response_complete(shard);
+				portENTER_CRITICAL_SAFE(&session_mux);
+				if (func_sessionP != NULL) {
+					func_num_rsp += 1;
+				}
+				if (auto_active) {
+					auto_rx_usec = rx_usec;
+				}
+				portEXIT_CRITICAL_SAFE(&session_mux);
+				
+				// And send it to the vehicle
+				if (can_capture_active) {
+					can_capture_record(CAN_CAPTURE_RSP, rsp_id, rsp_len, sP->data_buf);
+				}
+				if (!auto_active) {
+					vm_rx_data(rsp_id, rsp_len, sP->data_buf, rx_usec);
+				}
+			}
+		}
+		
+		if (rx_done) {
+			return;
+		}
+		
+		// Send flow control packet if necessary
+		if (is_firstframe && (sP->req_id != 0)) {
+			fc_data[1] = sP->fc_block_size;
+			fc_data[2] = sP->fc_sep_time;
+			if (can_capture_active) {
+				can_capture_record(CAN_CAPTURE_TX, sP->req_id, 8, fc_data);
+			}
+			(void) driverP->fcn_tx_fc_packet(sP->req_id, 8, fc_data);
+		}
+		
+		// Done with the session (releasing it if it was freed meanwhile)
+		portENTER_CRITICAL_SAFE(&session_mux);
+		sP->rx_busy = false;
+		if (sP->freed) {
+			_can_release_session(sP);
+		}
+		portEXIT_CRITICAL_SAFE(&session_mux);
+	} else {
+		// Not a response, look for a subscribed broadcast frame
+		can_rx_bcast_packet(rsp_id, len, data, rx_usec);
+	}
+}
+
+
+// Complete response payload from an interface that does ISO-TP itself.  It skips frame
+// reassembly but is otherwise handled like a response completed by can_rx_packet (and
+// may also be called from more than one context at once).
+void can_rx_message(uint32_t rsp_id, int len, uint8_t* data, int64_t rx_usec)
+{
+	int shard;
+	isotp_session_t* sP;
+	
+	portENTER_CRITICAL_SAFE(&session_mux);
+	sP = _can_find_session(rsp_id);
+	if (sP != NULL) {
+		shard = sP->shard;
+		_can_update_latency(sP, rx_usec);
+		_can_release_session(sP);
+		if (auto_active) {
+			auto_rx_usec = rx_usec;
+		}
+	}
+	portEXIT_CRITICAL_SAFE(&session_mux);
+	
+	if (sP == NULL) {
+		return;
+	}
+	
+	_can_response_complete(shard);
+	
+	if (can_capture_active) {
+		can_capture_record(CAN_CAPTURE_RSP, rsp_id, len, data);
+	}
+	if (!auto_active) {
+		vm_rx_data(rsp_id, len, data, rx_usec);
+	}
+}
+
+
+// Frames from an interface that only receives broadcasts skip response reassembly.  May be
+// called from within an ISR.
+void can_rx_bcast_packet(uint32_t id, int len, uint8_t* data, int64_t rx_usec)
+{
+	int n;
+	
+	n = __atomic_load_n(&num_bcast, __ATOMIC_ACQUIRE);
+	for (int i=0; i<n; i++) {
+		if (bcast_id[i] == id) {
+			vm_rx_broadcast(id, len, data, rx_usec);
+			break;
+		}
+	}
+}
+
+
+void can_if_error(int errno)
+{
+	bool func_answered;
+	
+	// Lengthen the timeout for ECUs that didn't respond in time
+	portENTER_CRITICAL_SAFE(&session_mux);
+	if (errno == CAN_ERRNO_TIMEOUT) {
+		for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+			if (session[i].in_use && !session[i].freed && (session[i].lat_index >= 0)) {
+				if (latency[session[i].lat_index].backoff < LAT_MAX_BACKOFF) {
+					latency[session[i].lat_index].backoff += 1;
+				}
+			}
+		}
+	}
+	
+	// The timeout closing a functional window that was answered is its normal end
+	func_answered = (func_sessionP != NULL) && (errno == CAN_ERRNO_TIMEOUT) && (func_num_rsp != 0);
+	
+	// Interface errors (e.g. timeout) abandon all outstanding requests
+	_can_release_all_sessions();
+	portEXIT_CRITICAL_SAFE(&session_mux);
+	
+	if (auto_active) {
+		auto_failed = true;
+	} else if (func_answered) {
+		vm_rx_functional_done();
+	} else {
+		vm_note_error(errno);
+	}
+}
+
+
+// The interface's request to rsp_id failed.  Only that request is abandoned when the
+// ELM327 pair is running (the other adapter's request is still outstanding), otherwise
+// it is handled like can_if_error.
+void can_rsp_error(uint32_t rsp_id, int errno)
+{
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	isotp_session_t* sP;
+	
+	if (shard_driverP[1] != NULL) {
+		// Nothing to abandon for errors outside a request (e.g. adapter initialization)
+		portENTER_CRITICAL_SAFE(&session_mux);
+		if ((sP = _can_find_session(rsp_id)) == NULL) {
+			portEXIT_CRITICAL_SAFE(&session_mux);
+			return;
+		}
+		
+		if ((errno == CAN_ERRNO_TIMEOUT) && (sP->lat_index >= 0)) {
+			if (latency[sP->lat_index].backoff < LAT_MAX_BACKOFF) {
+				latency[sP->lat_index].backoff += 1;
+			}
+		}
+		_can_release_session(sP);
+		portEXIT_CRITICAL_SAFE(&session_mux);
+		
+		if (auto_active) {
+			auto_failed = true;
+		} else {
+			vm_note_rsp_error(rsp_id, errno);
+		}
+		return;
+	}
+#endif
+	
+	can_if_error(errno);
+}
+
+
+
+//
+// Internal functions
+//
+
+// Called with session_mux held except where only the calling context changes the table
+static isotp_session_t* _can_find_session(uint32_t rsp_id)
+{
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (session[i].in_use && !session[i].freed && (session[i].rsp_id == rsp_id)) {
+			return &session[i];
+		}
+	}
+	
+	return NULL;
+}
+
+
+static isotp_session_t* _can_alloc_session(uint32_t req_id, uint32_t rsp_id)
+{
+	isotp_session_t* sP = NULL;
+	
+	portENTER_CRITICAL_SAFE(&session_mux);
+	if (num_sessions < max_sessions) {
+		for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+			if (!session[i].in_use) {
+				sP = &session[i];
+				sP->req_id = req_id;
+				sP->rsp_id = rsp_id;
+				sP->num_rx_bytes = 0;
+				sP->data_index = 0;
+				sP->seq_num = 0xFF;      // Ignore consecutive frames until we see a first frame
+				sP->fc_block_size = cur_fc_block_size;
+				sP->fc_sep_time = cur_fc_sep_time;
+				sP->keep_window = false;
+				sP->shard = 0;
+				sP->data_buf = (rsp_bufP != NULL) ? &rsp_bufP[i * rsp_buf_len] : session_min_buf[i];
+				sP->in_use = true;
+				num_sessions += 1;
+				break;
+			}
+		}
+	}
+	portEXIT_CRITICAL_SAFE(&session_mux);
+	
+	return sP;
+}
+
+
+// May be called from within an ISR
+static void _can_free_session(isotp_session_t* sP)
+{
+	portENTER_CRITICAL_SAFE(&session_mux);
+	_can_release_session(sP);
+	portEXIT_CRITICAL_SAFE(&session_mux);
+}
+
+
+// Called with session_mux held.  A session can_rx_packet is using is only marked freed so
+// it can't be found or allocated again until can_rx_packet is done with it.
+static void _can_release_session(isotp_session_t* sP)
+{
+	if (sP->in_use && !sP->freed) {
+		num_sessions -= 1;
+	}
+	if (sP->in_use && sP->rx_busy) {
+		sP->freed = true;
+	} else {
+		sP->in_use = false;
+		sP->freed = false;
+	}
+	can_timer_stop(&sP->cf_timer);
+	if (sP == tx_sessionP) {
+		// Stops any remaining consecutive frames
+		tx_sessionP = NULL;
+	}
+	if (sP == func_sessionP) {
+		func_sessionP = NULL;
+	}
+}
+
+
+// May be called from within an ISR
+static void _can_free_all_sessions()
+{
+	portENTER_CRITICAL_SAFE(&session_mux);
+	_can_release_all_sessions();
+	portEXIT_CRITICAL_SAFE(&session_mux);
+}
+
+
+// Called with session_mux held
+static void _can_release_all_sessions()
+{
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		_can_release_session(&session[i]);
+	}
+	num_sessions = 0;
+	tx_sessionP = NULL;
+	func_sessionP = NULL;
+}
+
+
+// A session's next frame (consecutive frame or flow control) didn't arrive in time (e.g.
+// a lost frame).  Called from the esp_timer task.
+static void _can_session_timer_cb(void* arg)
+{
+	isotp_session_t* sP = (isotp_session_t*) arg;
+	
+	// May have just been released
+	if (!sP->in_use || sP->freed) return;
+	
+	// Stop the driver's request timeout so it doesn't fire later against another request
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	if (shard_driverP[1] != NULL) {
+		shard_driverP[sP->shard]->fcn_response_complete();
+		can_rsp_error(sP->rsp_id, CAN_ERRNO_FRAME_TIMEOUT);
+		return;
+	}
+#endif
+	if (driverP != NULL) {
+		driverP->fcn_response_complete();
+	}
+	can_if_error(CAN_ERRNO_FRAME_TIMEOUT);
+}
+
+
+// Stop the request timeout of the interface that received a complete response when
+// nothing else is outstanding on it (an open functional window holds a session until
+// the timer closes it).  May be called from within an ISR.
+static void _can_response_complete(int shard)
+{
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	if (shard_driverP[1] != NULL) {
+		shard_driverP[shard]->fcn_response_complete();
+		return;
+	}
+#endif
+	if (num_sessions == 0) {
+		driverP->fcn_response_complete();
+	}
+}
+
+
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+// Assign the ECUs of the prepared requests to the pair's adapters, those with the most
+// requests first, each to the adapter with fewer requests so far
+static void _can_shard_assign(int num_req, const can_tx_desc_t* reqs)
+{
+	bool assigned[CAN_MANAGER_MAX_SHARD_IDS];
+	int count[CAN_MANAGER_MAX_SHARD_IDS];
+	int load[NUM_SHARDS] = {0, 0};
+	int best;
+	int i, j, s;
+	
+	num_shard_ids = 0;
+	for (i=0; i<num_req; i++) {
+		for (j=0; j<num_shard_ids; j++) {
+			if (shard_rsp_id[j] == reqs[i].rsp_id) break;
+		}
+		if (j == num_shard_ids) {
+			if (num_shard_ids == CAN_MANAGER_MAX_SHARD_IDS) continue;
+			shard_rsp_id[j] = reqs[i].rsp_id;
+			assigned[j] = false;
+			count[j] = 0;
+			num_shard_ids += 1;
+		}
+		count[j] += 1;
+	}
+	
+	for (i=0; i<num_shard_ids; i++) {
+		best = -1;
+		for (j=0; j<num_shard_ids; j++) {
+			if (!assigned[j] && ((best < 0) || (count[j] > count[best]))) {
+				best = j;
+			}
+		}
+		s = (load[1] < load[0]) ? 1 : 0;
+		shard_of_id[best] = s;
+		load[s] += count[best];
+		assigned[best] = true;
+	}
+	
+	ESP_LOGI(TAG, "%d ECUs split %d/%d requests", num_shard_ids, load[0], load[1]);
+}
+
+
+// Adapter for a request to rsp_id.  ECUs without a prepared request are assigned to the
+// adapter with fewer ECUs when first seen.  Uses the other adapter while the assigned
+// one isn't connected.
+static int _can_shard_route(uint32_t rsp_id)
+{
+	int n[NUM_SHARDS] = {0, 0};
+	int s = -1;
+	
+	for (int i=0; i<num_shard_ids; i++) {
+		if (shard_rsp_id[i] == rsp_id) {
+			s = shard_of_id[i];
+			break;
+		}
+		n[shard_of_id[i]] += 1;
+	}
+	
+	if (s < 0) {
+		s = (n[1] < n[0]) ? 1 : 0;
+		if (num_shard_ids < CAN_MANAGER_MAX_SHARD_IDS) {
+			shard_rsp_id[num_shard_ids] = rsp_id;
+			shard_of_id[num_shard_ids] = s;
+			num_shard_ids += 1;
+		}
+	}
+	
+	if (!shard_driverP[s]->fcn_is_connected() && shard_driverP[s ^ 1]->fcn_is_connected()) {
+		s ^= 1;
+	}
+	
+	return s;
+}
+
+
+static bool _can_shard_busy(int shard)
+{
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (session[i].in_use && !session[i].freed && (session[i].shard == shard)) {
+			return true;
+		}
+	}
+	
+	return false;
+}
+#endif
+
+
+// Session for an ECU answering the open functional request.  Responders may use the whole
+// table since nothing else is outstanding.  Flow control goes to the ECU's physical
+// request address (11-bit response ID - 8, 29-bit source and target swapped).  Called
+// from the interface's receive context by can_rx_packet (the session is returned busy).
+static isotp_session_t* _can_alloc_responder(uint32_t rsp_id)
+{
+	isotp_session_t* sP = NULL;
+	isotp_session_t* wP;
+	
+	portENTER_CRITICAL_SAFE(&session_mux);
+	wP = func_sessionP;               // May have just closed
+	for (int i=0; (wP != NULL) && (i<CAN_MANAGER_MAX_SESSIONS); i++) {
+		if (!session[i].in_use) {
+			sP = &session[i];
+			sP->req_id = (rsp_id > 0x7FF) ? (0x18DA00F1 | ((rsp_id & 0xFF) << 8)) : (rsp_id - 8);
+			sP->rsp_id = rsp_id;
+			sP->num_rx_bytes = 0;
+			sP->data_index = 0;
+			sP->seq_num = 0xFF;
+			sP->fc_block_size = wP->fc_block_size;
+			sP->fc_sep_time = wP->fc_sep_time;
+			sP->tx_usec = wP->tx_usec;
+			sP->lat_index = -1;
+			sP->keep_window = false;
+			sP->data_buf = (rsp_bufP != NULL) ? &rsp_bufP[i * rsp_buf_len] : session_min_buf[i];
+			sP->rx_busy = true;
+			sP->in_use = true;
+			num_sessions += 1;
+			break;
+		}
+	}
+	portEXIT_CRITICAL_SAFE(&session_mux);
+	
+	return sP;
+}
+
+
+// Called from task context when a request is sent
+static int _can_get_latency_index(uint32_t req_id, uint32_t rsp_id)
+{
+	latency_est_t* lP;
+	
+	for (int i=0; i<num_latency; i++) {
+		if ((latency[i].req_id == req_id) && (latency[i].rsp_id == rsp_id)) {
+			return i;
+		}
+	}
+	
+	if (num_latency < CAN_MANAGER_MAX_LATENCY_IDS) {
+		lP = &latency[num_latency];
+		lP->req_id = req_id;
+		lP->rsp_id = rsp_id;
+		lP->num_samples = 0;
+		lP->backoff = 0;
+		lP->mean_usec = 0;
+		lP->dev_usec = 0;
+		return num_latency++;
+	}
+	
+	return -1;
+}
+
+
+static int _can_get_timeout_msec(int lat_index)
+{
+	latency_est_t* lP;
+	int to_msec;
+	
+	if (lat_index < 0) return 0;
+	
+	lP = &latency[lat_index];
+	if (lP->num_samples < LAT_MIN_SAMPLES) return 0;
+	
+	to_msec = (lP->mean_usec + tune_get(TUNE_LAT_DEV_MULT) * lP->dev_usec) / 1000;
+	if (to_msec < tune_get(TUNE_LAT_MIN_TIMEOUT_MSEC)) {
+		to_msec = tune_get(TUNE_LAT_MIN_TIMEOUT_MSEC);
+	}
+	
+	// The driver clamps this to its maximum
+	return to_msec << lP->backoff;
+}
+
+
+// Start the listen-only TWAI broadcast interface alongside an ELM327 request interface
+static void _can_init_bcast_interface(int if_type, int req_timeout, bool can_is_500k)
+{
+	bcast_driverP = NULL;
+	
+#ifdef CAN_MANAGER_EN_DUAL_IF
+	if ((if_type == CAN_MANAGER_IF_WIFI) || (if_type == CAN_MANAGER_IF_BLE) || (if_type == CAN_MANAGER_IF_USB)) {
+		if (!bcast_if_init) {
+			bcast_if_init = interface_listP[DRIVER_TWAI]->fcn_init(CAN_DRIVER_TWAI_LISTEN_ONLY, req_timeout, can_is_500k);
+			if (!bcast_if_init) {
+				ESP_LOGE(TAG, "Broadcast interface init failed");
+				return;
+			}
+		}
+		
+		// Only the subscribed IDs are passed so responses only ever come from the ELM327
+		bcast_driverP = (can_if_driver_t*) interface_listP[DRIVER_TWAI];
+		bcast_driverP->fcn_set_rx_id_list(num_bcast, bcast_id);
+		bcast_driverP->fcn_en_rsp_filter(true);
+		ESP_LOGI(TAG, "Broadcasts routed to %s", bcast_driverP->name);
+	}
+#endif
+}
+
+
+static bool _can_if_stoppable(int if_type)
+{
+	switch (if_type) {
+		case CAN_MANAGER_IF_TWAI:
+			return (interface_listP[DRIVER_TWAI]->fcn_deinit != NULL);
+		case CAN_MANAGER_IF_WIFI:
+			return can_driver_elm327_if_supports_deinit(CAN_DRIVER_ELM327_WIFI);
+		case CAN_MANAGER_IF_BLE:
+			return can_driver_elm327_if_supports_deinit(CAN_DRIVER_ELM327_BLE);
+		case CAN_MANAGER_IF_USB:
+			return can_driver_elm327_if_supports_deinit(CAN_DRIVER_ELM327_USB);
+		case CAN_MANAGER_IF_AUTO:
+			// Auto selection stops the candidates it doesn't pick
+			return _can_if_stoppable(CAN_MANAGER_IF_TWAI) && _can_if_stoppable(CAN_MANAGER_IF_WIFI) &&
+			       _can_if_stoppable(CAN_MANAGER_IF_BLE);
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+		case CAN_MANAGER_IF_ELM327_PAIR:
+			return _can_if_stoppable(CAN_MANAGER_IF_WIFI) && _can_if_stoppable(CAN_MANAGER_IF_BLE);
+#endif
+#ifdef CAN_MANAGER_EN_REMOTE
+		case CAN_MANAGER_IF_REMOTE:
+			return true;
+#endif
+		default:
+			// The emulator and replay drivers
+			return false;
+	}
+}
+
+
+// Bring up each available candidate in turn and keep the one with the highest estimated
+// request rate: sessions in parallel over the mean round trip plus the interface's cost of
+// changing IDs between requests.  A direct TWAI connection that answers is used immediately
+// as an adapter can't be faster.  When no ECU answers (e.g. vehicle off) the first candidate
+// that connected (or saw bus traffic) is used.  The ELM327 driver runs a single adapter so
+// candidates are probed one at a time rather than in parallel.
+static bool _can_auto_init(int req_timeout, bool can_is_500k)
+{
+	const int candidate[] = {CAN_MANAGER_IF_TWAI, CAN_MANAGER_IF_WIFI, CAN_MANAGER_IF_BLE};
+	ble_config_t* ble_configP;
+	net_config_t* net_configP;
+	int best_if = -1;
+	int best_rate = 0;
+	int if_type;
+	int rate;
+	int rtt_usec;
+	
+	for (int i=0; i<(sizeof(candidate)/sizeof(candidate[0])); i++) {
+		if_type = candidate[i];
+		
+		// Only adapters we have connected to (BLE) or been configured for (WiFi station)
+		if ((if_type == CAN_MANAGER_IF_BLE) &&
+		    (!ps_get_config(PS_CONFIG_TYPE_BLE, (void**) &ble_configP) || !ble_configP->peer_valid)) {
+			continue;
+		}
+		if ((if_type == CAN_MANAGER_IF_WIFI) &&
+		    (!ps_get_config(PS_CONFIG_TYPE_NET, (void**) &net_configP) || !net_configP->sta_mode ||
+		     (net_configP->sta_ssid[0] == 0))) {
+			continue;
+		}
+		
+		if (can_init(if_type, req_timeout, can_is_500k)) {
+			rtt_usec = _can_auto_measure(if_type);
+			if (rtt_usec > 0) {
+				rate = (1000000 * max_sessions) / (rtt_usec + 1000 * driverP->id_switch_msec);
+				ESP_LOGI(TAG, "Auto: %s %d uSec round trip, %d req/sec", can_get_interface_name(if_type), rtt_usec, rate);
+				if ((rate > best_rate) || (best_rate == 0)) {
+					best_if = if_type;
+					best_rate = rate;
+				}
+			} else if (rtt_usec == 0) {
+				ESP_LOGI(TAG, "Auto: %s connected, no response", can_get_interface_name(if_type));
+				if (best_if < 0) {
+					best_if = if_type;
+				}
+			} else {
+				ESP_LOGI(TAG, "Auto: %s not available", can_get_interface_name(if_type));
+			}
+		}
+		
+		if ((if_type == CAN_MANAGER_IF_TWAI) && (best_rate != 0)) {
+			// Keep it running
+			break;
+		}
+		if ((i == ((sizeof(candidate)/sizeof(candidate[0])) - 1)) && (if_type == best_if)) {
+			// Last one probed is already running
+			break;
+		}
+		if (!can_deinit()) {
+			ESP_LOGE(TAG, "Auto: could not stop %s", can_get_interface_name(if_type));
+			return false;
+		}
+	}
+	
+	if (best_if < 0) {
+		ESP_LOGE(TAG, "Auto: no interface found");
+		return false;
+	}
+	
+	ESP_LOGI(TAG, "Auto: using %s", can_get_interface_name(best_if));
+	if ((cur_if_type != best_if) && !can_init(best_if, req_timeout, can_is_500k)) {
+		return false;
+	}
+	link_rate = best_rate;
+	
+	return true;
+}
+
+
+// Returns the mean round trip (uSec) of the timing requests on the interface just started,
+// 0 if it connected but nothing answered or -1 if it isn't available
+static int _can_auto_measure(int if_type)
+{
+	can_bus_stats_t stats;
+	int64_t start_usec;
+	int64_t tx_usec;
+	int64_t sum_usec = 0;
+	int n = 0;
+	
+	start_usec = esp_timer_get_time();
+	while (!can_connected()) {
+		if ((esp_timer_get_time() - start_usec) > ((int64_t) AUTO_CONNECT_MSEC * 1000)) {
+			return -1;
+		}
+		vTaskDelay(pdMS_TO_TICKS(20));
+	}
+	
+	auto_active = true;
+	for (int i=0; i<AUTO_NUM_REQ; i++) {
+		auto_rx_usec = 0;
+		auto_failed = false;
+		tx_usec = esp_timer_get_time();
+		if (!can_tx_packet(AUTO_REQ_ID, AUTO_RSP_ID, 8, (uint8_t*) auto_req)) {
+			break;
+		}
+		
+		while ((auto_rx_usec == 0) && !auto_failed && ((esp_timer_get_time() - tx_usec) < ((int64_t) AUTO_RSP_MSEC * 1000))) {
+			vTaskDelay(1);
+		}
+		if (auto_rx_usec != 0) {
+			sum_usec += auto_rx_usec - tx_usec;
+			n += 1;
+		} else {
+			can_end_session(AUTO_RSP_ID);
+			if (!auto_failed) {
+				// Stop the interface's timer so it doesn't fire against the next request
+				driverP->fcn_response_complete();
+			}
+			if (n == 0) {
+				// Nothing answering so the rest would only take longer
+				break;
+			}
+		}
+	}
+	auto_active = false;
+	
+	if (n != 0) {
+		return (int) (sum_usec / n);
+	}
+	
+	// A direct connection is only available if there is traffic on the bus
+	if ((if_type == CAN_MANAGER_IF_TWAI) && (!can_get_bus_stats(&stats) || (stats.num_rx_frames == 0))) {
+		return -1;
+	}
+	
+	return 0;
+}
+
+
+// May be called from within an ISR.  Integer version of the RFC 6298 estimator.
+static void _can_update_latency(isotp_session_t* sP, int64_t rx_usec)
+{
+	latency_est_t* lP;
+	int32_t sample;
+	int32_t err;
+	
+	if (sP->lat_index < 0) return;
+	
+	lP = &latency[sP->lat_index];
+	sample = (int32_t) (rx_usec - sP->tx_usec);
+	if (lP->num_samples == 0) {
+		lP->mean_usec = sample;
+		lP->dev_usec = sample / 2;
+	} else {
+		err = sample - lP->mean_usec;
+		lP->mean_usec += err / 8;
+		if (err < 0) err = -err;
+		lP->dev_usec += (err - lP->dev_usec) / 4;
+	}
+	if (lP->num_samples < LAT_MIN_SAMPLES) {
+		lP->num_samples += 1;
+	}
+	lP->backoff = 0;
+}
+
+
+// Called from task context.  Saves the payload for the consecutive frames and sends the
+// first frame (which starts the interface's request timeout).
+static bool _can_tx_first_frame(isotp_session_t* sP, int len, uint8_t* data, int timeout_msec)
+{
+	uint8_t* fP;
+	
+	tx_len = len - 1;
+	memcpy(tx_buf, &data[1], tx_len);
+	tx_index = 6;
+	tx_seq_num = 1;
+	tx_wait_fc = true;
+	
+	// The ECU's flow control must arrive within N_Bs
+	can_timer_start(&sP->cf_timer, CAN_MANAGER_N_BS_MSEC);
+	tx_sessionP = sP;
+	
+	fP = _can_tx_next_frame_buf();
+	fP[0] = 0x10 | ((tx_len >> 8) & 0x0F);
+	fP[1] = tx_len & 0xFF;
+	memcpy(&fP[2], tx_buf, 6);
+	if (can_capture_active) {
+		can_capture_record(CAN_CAPTURE_TX, sP->req_id, 8, fP);
+	}
+	if (!driverP->fcn_tx_packet(sP->req_id, sP->rsp_id, 8, fP, timeout_msec)) {
+		tx_sessionP = NULL;
+		return false;
+	}
+	
+	return true;
+}
+
+
+// May be called from within an ISR
+static void _can_tx_rx_flow_control(isotp_session_t* sP, int len, uint8_t* data)
+{
+	uint8_t st;
+	
+	if (len < 3) return;
+	
+	switch (data[0] & 0x0F) {
+		case 0:
+			// Continue to send: block size and STmin (0x00-0x7F mSec, 0xF1-0xF9 100-900 uSec)
+			tx_block_left = (data[1] == 0) ? -1 : data[1];
+			st = data[2];
+			if (st <= 0x7F) {
+				tx_gap_usec = st * 1000;
+			} else if ((st >= 0xF1) && (st <= 0xF9)) {
+				tx_gap_usec = (st - 0xF0) * 100;
+			} else {
+				tx_gap_usec = 0x7F * 1000;
+			}
+			if (tx_gap_usec < TX_CF_MIN_GAP_USEC) {
+				tx_gap_usec = TX_CF_MIN_GAP_USEC;
+			}
+			can_timer_stop(&sP->cf_timer);
+			tx_wait_fc = false;
+			(void) esp_timer_start_once(tx_cf_timer, tx_gap_usec);
+			break;
+		
+		case 1:
+			// Wait: another flow control frame follows within N_Bs
+			can_timer_start(&sP->cf_timer, CAN_MANAGER_N_BS_MSEC);
+			break;
+		
+		default:
+			// Overflow (request too long for the ECU) or invalid - abandon the request at the
+			// next tick of the deadline timers
+			tx_sessionP = NULL;
+			can_timer_start(&sP->cf_timer, 0);
+	}
+}
+
+
+// Sends the next consecutive frame of the segmented request
+static void _can_tx_cf_timer_cb(void* arg)
+{
+	int n;
+	isotp_session_t* sP;
+	uint8_t* fP;
+	
+	if ((sP = tx_sessionP) == NULL) return;
+	
+	n = tx_len - tx_index;
+	if (n > 7) n = 7;
+	fP = _can_tx_next_frame_buf();
+	memset(fP, 0, 8);
+	fP[0] = 0x20 | tx_seq_num;
+	memcpy(&fP[1], &tx_buf[tx_index], n);
+	if (!driverP->fcn_tx_fc_packet(sP->req_id, 8, fP)) {
+		// Transmit queue full, try again after another gap
+		(void) esp_timer_start_once(tx_cf_timer, tx_gap_usec);
+		return;
+	}
+	if (can_capture_active) {
+		can_capture_record(CAN_CAPTURE_TX, sP->req_id, 8, fP);
+	}
+	tx_index += n;
+	tx_seq_num = (tx_seq_num + 1) & 0x0F;
+	
+	if (tx_index >= tx_len) {
+		// Request sent, the response is received as usual
+		tx_sessionP = NULL;
+	} else if ((tx_block_left > 0) && (--tx_block_left == 0)) {
+		// Wait for the ECU's next flow control
+		can_timer_start(&sP->cf_timer, CAN_MANAGER_N_BS_MSEC);
+		tx_wait_fc = true;
+	} else {
+		(void) esp_timer_start_once(tx_cf_timer, tx_gap_usec);
+	}
+}
+
+
+// Frame buffers are used in turn so a frame's data stays valid while it is queued
+static uint8_t* _can_tx_next_frame_buf()
+{
+	uint8_t* fP = tx_frame[tx_frame_index];
+	
+	tx_frame_index = (tx_frame_index + 1) % TX_NUM_FRAME_BUFS;
+	return fP;
 }
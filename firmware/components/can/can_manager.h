@@ -6,7 +6,7 @@
  * and receive complete responses.  Exists between the Vehicle Manager and
  * OBD2 interface.  Implements basic [simplified] ISO-TP data management.
  *
- * Note: Only supports one request at a time
+ * Supports up to CAN_MANAGER_MAX_SESSIONS outstanding requests at a time (one per ECU).
  *
  * Copyright 2025 Dan Julio
  *
@@ -35,41 +35,199 @@
 // Constants
 //
 
+// Uncomment to add the ECU emulator interface (for benchmarking without a vehicle)
+//#define CAN_MANAGER_EN_EMULATOR
+
+// Uncomment to add the captured log replay interface (see can_driver_replay.h)
+//#define CAN_MANAGER_EN_REPLAY
+
+// Uncomment to add the ESP-NOW remote interface for a secondary display fed by another
+// unit's broadcast broker updates (see can_driver_remote.c and espnow_task.h)
+//#define CAN_MANAGER_EN_REMOTE
+
+// Uncomment to capture raw frames and reassembled responses for download over WiFi (see
+// can_capture.h) - much lighter on the paths being observed than DEBUG_DATA logging
+//#define CAN_MANAGER_EN_CAPTURE
+
+// Uncomment to receive subscribed broadcast frames through the TWAI interface (a direct,
+// listen-only CAN tap, e.g. behind the gateway) while requests use the selected ELM327
+// interface.  Broadcasts then arrive at full rate without ELM327 monitor mode.
+//#define CAN_MANAGER_EN_DUAL_IF
+
+// Uncomment to add the ELM327 pair interface: a WiFi and a BLE adapter (e.g. on a splitter)
+// run requests at the same time with each ECU's requests sent by one of them (and both
+// deliver responses concurrently)
+//#define CAN_MANAGER_EN_ELM327_PAIR
+
 // CAN Interface type
 #define CAN_MANAGER_IF_TWAI 0
 #define CAN_MANAGER_IF_WIFI 1
 #define CAN_MANAGER_IF_BLE  2
+#define CAN_MANAGER_IF_USB  3
+#define CAN_MANAGER_IF_EMU  4
+
+#ifdef CAN_MANAGER_EN_EMULATOR
+#define CAN_MANAGER_NUM_BASE_IF  5
+#else
+#define CAN_MANAGER_NUM_BASE_IF  4
+#endif
+
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+#define CAN_MANAGER_IF_ELM327_PAIR CAN_MANAGER_NUM_BASE_IF
+#define CAN_MANAGER_NUM_PAIR_IF  (CAN_MANAGER_NUM_BASE_IF + 1)
+#else
+#define CAN_MANAGER_NUM_PAIR_IF  CAN_MANAGER_NUM_BASE_IF
+#endif
+
+#ifdef CAN_MANAGER_EN_REPLAY
+#define CAN_MANAGER_IF_REPLAY    CAN_MANAGER_NUM_PAIR_IF
+#define CAN_MANAGER_NUM_LOCAL_IF (CAN_MANAGER_NUM_PAIR_IF + 1)
+#else
+#define CAN_MANAGER_NUM_LOCAL_IF CAN_MANAGER_NUM_PAIR_IF
+#endif
+
+#ifdef CAN_MANAGER_EN_REMOTE
+#define CAN_MANAGER_IF_REMOTE    CAN_MANAGER_NUM_LOCAL_IF
+#define CAN_MANAGER_IF_AUTO      (CAN_MANAGER_NUM_LOCAL_IF + 1)
+#else
+#define CAN_MANAGER_IF_AUTO      CAN_MANAGER_NUM_LOCAL_IF
+#endif
+
+// Auto selects the fastest of the available TWAI, WiFi and BLE interfaces at init
+#define CAN_MANAGER_NUM_IF       (CAN_MANAGER_IF_AUTO + 1)
+
+// Maximum simultaneous outstanding requests (each to a unique response ID)
+#define CAN_MANAGER_MAX_SESSIONS 4
+
+// Maximum number of response IDs (ECUs) assigned to one of the ELM327 pair's adapters
+#define CAN_MANAGER_MAX_SHARD_IDS 16
+
+// Maximum number of subscribed broadcast (unsolicited) frame IDs
+#define CAN_MANAGER_MAX_BCAST    8
 
-#define CAN_MANAGER_NUM_IF  3
+// Maximum number of IDs in the receive filter list (responses + broadcasts)
+#define CAN_MANAGER_MAX_RX_IDS   40
+
+// Maximum number of (request ID, response ID) pairs with a response latency estimate
+#define CAN_MANAGER_MAX_LATENCY_IDS 16
+
+// ISO-TP N_Cr timeout - maximum time between frames of a multi-frame response before
+// it is abandoned (much shorter than the request timeout so lost frames are retried quickly)
+// is TUNE_N_CR_MSEC
+
+// ISO-TP N_Bs timeout - maximum time to wait for the ECU's flow control frame after
+// sending the first frame (or a block) of a segmented request
+#define CAN_MANAGER_N_BS_MSEC    1000
+
+// Longest response (12-bit ISO-TP length) and the response buffer length before the vehicle
+// manager plans buffers for the vehicle's responses (single frames and the probes of
+// interface auto selection)
+#define CAN_MANAGER_MAX_RSP_LEN  4096
+#define CAN_MANAGER_MIN_RSP_LEN  64
+
+// Longest request: a payload length byte followed by up to 255 payload bytes.  Requests of
+// up to 8 bytes are sent as a single frame (the length byte is the single frame PCI), longer
+// requests as first and consecutive frames by interfaces whose max_req_len allows it.
+#define CAN_MANAGER_MAX_REQ_LEN  256
+
+// Maximum number of requests an interface is told about in advance (can_prepare_requests)
+#define CAN_MANAGER_MAX_PREP_REQ 32
+
+// ISO 14229 P2*server_max - time an ECU has to send the real response after a
+// responsePending negative response
+#define CAN_MANAGER_P2X_MSEC     5000
+
+// Functional (broadcast) request addresses.  A request sent to one of these with a response
+// ID of CAN_MANAGER_RSP_FUNCTIONAL collects the answer of every ECU that responds within
+// CAN_MANAGER_FUNC_WINDOW_MSEC (11-bit 0x7E8 - 0x7EF, 29-bit 0x18DAF1xx).  Each is passed to
+// the vehicle manager with its own response ID.
+#define CAN_MANAGER_FUNC_REQ_ID     0x7DF
+#define CAN_MANAGER_FUNC_REQ_EXT_ID 0x18DB33F1
+#define CAN_MANAGER_RSP_FUNCTIONAL  0xFFFFFFFF
+#define CAN_MANAGER_FUNC_WINDOW_MSEC 100     // SAE J1979 P2 (50 mSec) plus gateway delay
 
 // CAN RX Error codes
-#define CAN_ERRNO_NONE      0
-#define CAN_ERRNO_TIMEOUT   1
+#define CAN_ERRNO_NONE          0
+#define CAN_ERRNO_TIMEOUT       1
+#define CAN_ERRNO_FRAME_TIMEOUT 2
+#define CAN_ERRNO_NO_DATA       3
+#define CAN_ERRNO_IF_ERROR      4       // Interface couldn't complete a request it accepted
+
+// UDS negative responses (0x7F, SID, NRC)
+#define CAN_UDS_NEG_RSP               0x7F
+#define CAN_NRC_SERVICE_NOT_SUPPORTED 0x11
+#define CAN_NRC_SUBFUNC_NOT_SUPPORTED 0x12
+#define CAN_NRC_BUSY_REPEAT_REQUEST   0x21
+#define CAN_NRC_REQUEST_OUT_OF_RANGE  0x31
+#define CAN_NRC_RESPONSE_PENDING      0x78
+#define CAN_NRC_NOT_SUPP_IN_SESSION   0x7F
 
 
 //
 // Interface driver functions
 //
+typedef struct can_bus_stats_t can_bus_stats_t;
+typedef struct can_tx_desc_t can_tx_desc_t;
+
 typedef bool (*can_if_init)(int if_type, int req_timeout, bool can_is_500k);
 typedef bool (*can_if_connected)();
-typedef bool (*can_if_tx_packet)(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data);
+typedef bool (*can_if_tx_packet)(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data, int timeout_msec);  // timeout_msec = 0 for driver maximum
 typedef bool (*can_if_tx_fc_packet)(uint32_t req_id, int len, uint8_t* data);  // May be called from within an ISR
 typedef void (*can_if_en_rsp_filter)(bool en);
+typedef void (*can_if_set_rx_id_list)(int num_ids, const uint32_t* ids);
+typedef void (*can_if_set_flow_control)(uint8_t block_size, uint8_t sep_time);
+typedef void (*can_if_set_expected_frames)(int num_frames);
+typedef bool (*can_if_start_monitor)(int num_ids, const uint32_t* ids);
 typedef void (*can_if_response_complete)();
+typedef void (*can_if_extend_timeout)(int timeout_msec);  // Restart the request timeout
+typedef bool (*can_if_get_bus_stats)(can_bus_stats_t* statsP);
+typedef bool (*can_if_deinit)();
+typedef void (*can_if_prepare_tx)(int num_req, const can_tx_desc_t* reqs);  // reqs persists until the next call
 
 
 
 //
 // Global Data structures
 //
+
+// Bus statistics, counted since the interface started, from interfaces directly on the bus
+struct can_bus_stats_t {
+	uint32_t bitrate;
+	uint32_t num_rx_frames;
+	uint32_t num_tx_frames;
+	uint32_t num_bits;                            // Estimated bus bits (worst case stuffing) of those frames
+	uint32_t num_bus_errors;
+	uint32_t num_err_passive;                     // Transitions to error passive
+	uint32_t num_bus_off;
+};
+
+// A request that will be sent repeatedly (data is compared by address when it is sent)
+struct can_tx_desc_t {
+	uint32_t req_id;
+	uint32_t rsp_id;
+	int len;
+	const uint8_t* data;
+};
+
 typedef struct {
 	char* name;
+	int max_sessions;                             // Number of simultaneous requests supported (0 = receive only)
+	int id_switch_msec;                           // Approximate cost of changing request/response ID or protocol
+	int max_req_len;                              // Longest request sent (8 = single frame requests only)
 	can_if_init fcn_init;
 	can_if_connected fcn_is_connected;
 	can_if_tx_packet fcn_tx_packet;
 	can_if_tx_fc_packet fcn_tx_fc_packet;
 	can_if_en_rsp_filter fcn_en_rsp_filter;
+	can_if_set_rx_id_list fcn_set_rx_id_list;
+	can_if_set_flow_control fcn_set_flow_control;
+	can_if_set_expected_frames fcn_set_expected_frames;
+	can_if_start_monitor fcn_start_monitor;       // Receive broadcasts until the next request
 	can_if_response_complete fcn_response_complete;
+	can_if_extend_timeout fcn_extend_timeout;     // NULL if the interface can't wait for a pending response
+	can_if_get_bus_stats fcn_get_bus_stats;       // NULL if the interface can't see bus traffic
+	can_if_deinit fcn_deinit;                     // NULL if the interface can only be stopped by a restart
+	can_if_prepare_tx fcn_prepare_tx;             // NULL if sending a request needs no preparation
 } can_if_driver_t;
 
 
@@ -80,14 +238,42 @@ typedef struct {
 // For GUI use
 int can_get_num_interfaces();
 const char* can_get_interface_name(int n);
+bool can_characterize_interface();
+bool can_interface_characterizing();
+bool can_interface_hot_swappable(int if_type);
+int can_get_active_interface();
+int can_get_link_rate();
 
 // For vehicle implementations
 bool can_init(int if_type, int req_timeout, bool can_is_500k);
+bool can_deinit();
 bool can_connected();
+bool can_has_bcast_interface();
+int can_get_max_sessions();
+int can_get_id_switch_msec();
+int can_get_max_req_len();
+bool can_session_available(uint32_t rsp_id);
+bool can_rsp_pending_supported();
+bool can_functional_supported();
+bool can_is_functional_rsp(uint32_t req_id, uint32_t rsp_id);
+bool can_get_bus_stats(can_bus_stats_t* statsP);
+void can_end_session(uint32_t rsp_id);
 bool can_tx_packet(uint32_t req_id, uint32_t rsp_id, int len, uint8_t* data);
 void can_en_rsp_filter(bool en);
+void can_set_rx_id_list(int num_ids, const uint32_t* ids);
+void can_set_flow_control(uint8_t block_size, uint8_t sep_time);
+void can_set_expected_frames(int num_frames);
+void can_prepare_requests(int num_req, const can_tx_desc_t* reqs);
+bool can_subscribe_broadcast(uint32_t id);
+void can_clear_broadcasts();
+void can_start_monitor();
+int can_get_rsp_buf_size(int max_rsp_len);
+void can_set_rsp_bufs(uint8_t* bufP, int max_rsp_len);
 
 // For OBD2 CAN interface drivers
-void can_rx_packet(uint32_t rsp_id, int len, uint8_t* data);
+void can_rx_packet(uint32_t rsp_id, int len, uint8_t* data, int64_t rx_usec);
+void can_rx_bcast_packet(uint32_t id, int len, uint8_t* data, int64_t rx_usec);
+void can_rx_message(uint32_t rsp_id, int len, uint8_t* data, int64_t rx_usec);
 void can_if_error(int errno);
+void can_rsp_error(uint32_t rsp_id, int errno);
 #endif /* CAN_MANAGER_H */
@@ -0,0 +1,282 @@
+/*
+ * CAN deadline timers
+ *
+ * Hashed timer wheel holding the request timeouts of the interface drivers and the
+ * ISO-TP session deadlines (N_Cr, N_Bs) of the CAN manager.  A running timer is linked
+ * into the slot of the tick it expires in (modulo the wheel size) so starting or stopping
+ * one is a few pointer updates under a spinlock.  One periodic esp_timer advances the
+ * wheel, visiting the slots of the ticks that have passed and calling the functions of
+ * the timers that expired in them (those due in a later turn stay linked).  The tick
+ * only runs while a timer is pending so an idle interface costs nothing.
+ *
+ * A timer's function is called with the lock released so it may start or stop any timer
+ * (including its own).  Whether the tick should start or stop is decided with the lock
+ * held but the esp_timer itself is started and stopped after releasing it.  Timers are
+ * started and stopped from task context (the interface tasks and esp_timer callbacks),
+ * never from an ISR.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "can_timer.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <stddef.h>
+
+
+
+//
+// Local constants
+//
+#define TICK_USEC    (CAN_TIMER_TICK_MSEC * 1000)
+#define SLOT_MASK    (CAN_TIMER_SLOTS - 1)
+
+
+
+//
+// Global variables
+//
+static const char* TAG = "can_timer";
+
+static can_timer_t* slot_list[CAN_TIMER_SLOTS];
+static int num_pending = 0;
+
+// Last tick whose slot has been visited
+static uint32_t cur_tick;
+
+static bool tick_running = false;
+static bool tick_stopping = false;    // Tick callback is stopping the esp_timer
+static esp_timer_handle_t tick_timer = NULL;
+
+static portMUX_TYPE wheel_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _can_timer_tick_cb(void* arg);
+static void _can_timer_start_tick();
+static void _can_timer_unlink(can_timer_t* tP);
+static bool _can_timer_pop_expired(uint32_t tick, uint32_t now_tick, can_timer_t** tPP);
+
+
+
+//
+// API
+//
+
+// Create the tick (once, before any timer is started)
+bool can_timer_wheel_init()
+{
+	const esp_timer_create_args_t tick_timer_args = {
+		.callback = &_can_timer_tick_cb,
+		.arg = NULL,
+		.name = "can_timer"
+	};
+	
+	if (tick_timer == NULL) {
+		if (esp_timer_create(&tick_timer_args, &tick_timer) != ESP_OK) {
+			ESP_LOGE(TAG, "Could not create wheel timer");
+			tick_timer = NULL;
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+
+// tP must be zeroed (e.g. static) or have been setup before.  A running timer is stopped
+// (e.g. an interface initialized again).
+void can_timer_setup(can_timer_t* tP, can_timer_fcn fcn, void* arg)
+{
+	can_timer_stop(tP);
+	tP->fcn = fcn;
+	tP->arg = arg;
+}
+
+
+// Not ISR safe (it may start the esp_timer)
+void can_timer_start(can_timer_t* tP, int msec)
+{
+	bool start_tick = false;
+	can_timer_t** headP;
+	uint32_t now_tick;
+	int ticks;
+	
+	if (tick_timer == NULL) return;
+	
+	// At least one full tick away so it can't expire early
+	ticks = (msec + CAN_TIMER_TICK_MSEC - 1) / CAN_TIMER_TICK_MSEC + 1;
+	now_tick = (uint32_t) (esp_timer_get_time() / TICK_USEC);
+	
+	portENTER_CRITICAL_SAFE(&wheel_mux);
+	if (tP->active) {
+		_can_timer_unlink(tP);
+	}
+	
+	tP->expiry_tick = now_tick + ticks;
+	headP = &slot_list[tP->expiry_tick & SLOT_MASK];
+	tP->prev = NULL;
+	tP->next = *headP;
+	if (*headP != NULL) {
+		(*headP)->prev = tP;
+	}
+	*headP = tP;
+	tP->active = true;
+	num_pending += 1;
+	
+	// A tick being stopped is restarted by its callback once stopped
+	if (!tick_running && !tick_stopping) {
+		cur_tick = now_tick;
+		tick_running = true;
+		start_tick = true;
+	}
+	portEXIT_CRITICAL_SAFE(&wheel_mux);
+	
+	if (start_tick) {
+		_can_timer_start_tick();
+	}
+}
+
+
+// Safe to call for a timer that isn't running.  The tick stops itself when nothing is
+// pending.
+void can_timer_stop(can_timer_t* tP)
+{
+	portENTER_CRITICAL_SAFE(&wheel_mux);
+	if (tP->active) {
+		_can_timer_unlink(tP);
+	}
+	portEXIT_CRITICAL_SAFE(&wheel_mux);
+}
+
+
+bool can_timer_is_active(can_timer_t* tP)
+{
+	return tP->active;
+}
+
+
+
+//
+// Internal functions
+//
+static void _can_timer_tick_cb(void* arg)
+{
+	bool stop_tick;
+	bool restart_tick;
+	can_timer_t* tP;
+	uint32_t now_tick;
+	uint32_t last_tick;
+	uint32_t n;
+	
+	now_tick = (uint32_t) (esp_timer_get_time() / TICK_USEC);
+	
+	portENTER_CRITICAL(&wheel_mux);
+	last_tick = cur_tick;
+	cur_tick = now_tick;
+	portEXIT_CRITICAL(&wheel_mux);
+	
+	// Visit each tick since the last visit (every slot once if we fell a turn behind)
+	n = now_tick - last_tick;
+	if (n > CAN_TIMER_SLOTS) n = CAN_TIMER_SLOTS;
+	for (uint32_t t=now_tick-n+1; t!=now_tick+1; t++) {
+		while (_can_timer_pop_expired(t, now_tick, &tP)) {
+			tP->fcn(tP->arg);
+		}
+	}
+	
+	// Stop ticking when nothing is pending.  A timer started while the esp_timer is being
+	// stopped leaves the tick to us so restart it for that timer afterwards.
+	portENTER_CRITICAL(&wheel_mux);
+	stop_tick = (num_pending == 0);
+	if (stop_tick) {
+		tick_running = false;
+		tick_stopping = true;
+	}
+	portEXIT_CRITICAL(&wheel_mux);
+	
+	if (stop_tick) {
+		(void) esp_timer_stop(tick_timer);
+		
+		now_tick = (uint32_t) (esp_timer_get_time() / TICK_USEC);
+		portENTER_CRITICAL(&wheel_mux);
+		tick_stopping = false;
+		restart_tick = (num_pending != 0) && !tick_running;
+		if (restart_tick) {
+			cur_tick = now_tick;
+			tick_running = true;
+		}
+		portEXIT_CRITICAL(&wheel_mux);
+		
+		if (restart_tick) {
+			_can_timer_start_tick();
+		}
+	}
+}
+
+
+// Called with the lock released after deciding to start the tick
+static void _can_timer_start_tick()
+{
+	if (esp_timer_start_periodic(tick_timer, TICK_USEC) != ESP_OK) {
+		// The next timer started tries again
+		portENTER_CRITICAL_SAFE(&wheel_mux);
+		tick_running = false;
+		portEXIT_CRITICAL_SAFE(&wheel_mux);
+	}
+}
+
+
+// Called with the lock held
+static void _can_timer_unlink(can_timer_t* tP)
+{
+	if (tP->prev != NULL) {
+		tP->prev->next = tP->next;
+	} else {
+		slot_list[tP->expiry_tick & SLOT_MASK] = tP->next;
+	}
+	if (tP->next != NULL) {
+		tP->next->prev = tP->prev;
+	}
+	tP->next = NULL;
+	tP->prev = NULL;
+	tP->active = false;
+	num_pending -= 1;
+}
+
+
+// Remove one expired timer from tick's slot.  Returns false when there are no more.
+static bool _can_timer_pop_expired(uint32_t tick, uint32_t now_tick, can_timer_t** tPP)
+{
+	can_timer_t* tP;
+	
+	portENTER_CRITICAL(&wheel_mux);
+	for (tP=slot_list[tick & SLOT_MASK]; tP!=NULL; tP=tP->next) {
+		if ((int32_t) (now_tick - tP->expiry_tick) >= 0) {
+			_can_timer_unlink(tP);
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&wheel_mux);
+	
+	*tPP = tP;
+	return (tP != NULL);
+}
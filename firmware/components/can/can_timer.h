@@ -0,0 +1,72 @@
+/*
+ * CAN deadline timers
+ *
+ * Hashed timer wheel holding the request timeouts of the interface drivers and the
+ * ISO-TP session deadlines (N_Cr, N_Bs) of the CAN manager.  Starting and stopping a
+ * timer is constant time regardless of how many are pending and may be done from any
+ * context.  Expired timers call their function from the esp_timer task.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef CAN_TIMER_H
+#define CAN_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//
+// Constants
+//
+
+// Wheel resolution.  A timer expires up to two ticks after its time.
+#define CAN_TIMER_TICK_MSEC  4
+
+// Wheel slots (power of 2).  Timers longer than one turn (CAN_TIMER_SLOTS *
+// CAN_TIMER_TICK_MSEC) stay in their slot until the turn they expire in.
+#define CAN_TIMER_SLOTS      128
+
+
+
+//
+// Typedefs
+//
+typedef void (*can_timer_fcn)(void* arg);
+
+// Owned by the caller (static or within a longer lived structure), linked into the wheel
+// while it is running
+typedef struct can_timer_t {
+	struct can_timer_t* next;
+	struct can_timer_t* prev;
+	uint32_t expiry_tick;
+	volatile bool active;
+	can_timer_fcn fcn;
+	void* arg;
+} can_timer_t;
+
+
+
+//
+// API
+//
+bool can_timer_wheel_init();
+void can_timer_setup(can_timer_t* tP, can_timer_fcn fcn, void* arg);
+void can_timer_start(can_timer_t* tP, int msec);   // Restarts a running timer
+void can_timer_stop(can_timer_t* tP);
+bool can_timer_is_active(can_timer_t* tP);
+
+#endif /* CAN_TIMER_H */
@@ -23,10 +23,12 @@
 #include "ble_utilities.h"
 #include "can_driver_elm327.h"
 #include "elm327_interface_ble.h"
+#include "dlog_utilities.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
 #include "freertos/task.h"
 #include <string.h>
 
@@ -44,19 +46,30 @@
 #define DRIVER_STATE_BLE_SCAN_DONE 2
 #define DRIVER_STATE_CONNECTED     3
 
+// RX stream buffer between the NimBLE host task and our task
+#define RX_STREAM_LEN              1024
+#define RX_STREAM_WAIT_MSEC        50
+
+// Maximum time for the task to exit during deinit
+#define STOP_MSEC                  500
+
 
 //
 // Functions for can_driver_elm327
 //
+static int elm327_interface_ble_max_tx_len();
 static bool elm327_interface_ble_init(int debug);
 static bool elm327_interface_ble_tx_line(char* s);
+static bool elm327_interface_ble_deinit();
 
 
 const elm327_if_driver_t elm327_interface_driver_ble =
 {
 	"ELM327 Interface BLE",
+	&elm327_interface_ble_max_tx_len,
 	&elm327_interface_ble_init,
-	&elm327_interface_ble_tx_line
+	&elm327_interface_ble_tx_line,
+	&elm327_interface_ble_deinit
 };
 
 
@@ -65,18 +78,19 @@ const elm327_if_driver_t elm327_interface_driver_ble =
 //
 static const char* TAG = "elm327_interface_ble";
 
-static TaskHandle_t task_handle_elm327_interface_ble;
+static TaskHandle_t task_handle_elm327_interface_ble = NULL;
+static volatile bool stop_req = false;      // Task exits (deinit)
 
 // State
 static int driver_state = DRIVER_STATE_NO_BLE;
 
-// TX Buffer
-static bool tx_buffer_valid = false;
+// TX Buffer - strings are written directly from the caller's context
 static char tx_buffer[CAN_DRIVER_MAX_ELM327_STR_LEN+2];  // Room for carriage return and null
 static SemaphoreHandle_t tx_mutex;
 
-// RX Buffer
-static char rx_buffer[CAN_DRIVER_MAX_ELM327_STR_LEN+1];
+// RX notification data is passed to our task for parsing so the host task isn't held up
+static StreamBufferHandle_t rx_stream;
+static char rx_buffer[CAN_DRIVER_MAX_ELM327_STR_LEN];
 
 
 
@@ -91,8 +105,23 @@ static void _elm327_interface_ble_rx_cb(int len, uint8_t* data);
 //
 // CAN driver functions
 //
+static int elm327_interface_ble_max_tx_len()
+{
+	int len = ble_get_max_tx_len();
+	
+	return (len > CAN_DRIVER_MAX_ELM327_STR_LEN) ? CAN_DRIVER_MAX_ELM327_STR_LEN : len;
+}
+
+
 static bool elm327_interface_ble_init()
 {
+	// Create the rx stream buffer (any amount of data unblocks the reader)
+	rx_stream = xStreamBufferCreate(RX_STREAM_LEN, 1);
+	if (rx_stream == NULL) {
+		ESP_LOGE(TAG, "Could not create rx_stream");
+		return false;
+	}
+	
 	if (!ble_init(&_elm327_interface_ble_scan_complete, &_elm327_interface_ble_rx_cb)) {
 		ESP_LOGE(TAG, "Could not initialize BLE");
 		return false;
@@ -106,7 +135,39 @@ static bool elm327_interface_ble_init()
 	}
 	
 	// Start our task on the protocol CPU
-	xTaskCreatePinnedToCore(&_elm327_interface_ble_task, "elm327_interface_ble_task", 4096, NULL, 2, &task_handle_elm327_interface_ble, 0);
+	stop_req = false;
+	driver_state = DRIVER_STATE_NO_BLE;
+	xTaskCreatePinnedToCore(&_elm327_interface_ble_task, "elm327_interface_ble_task", ELM327_INTERFACE_BLE_TASK_STACK, NULL, ELM327_INTERFACE_BLE_TASK_PRIORITY, &task_handle_elm327_interface_ble, ELM327_INTERFACE_BLE_TASK_CORE);
+	
+	return true;
+}
+
+
+// Stop the task and shut the BLE stack down (disconnecting the adapter)
+static bool elm327_interface_ble_deinit()
+{
+	int n = 0;
+	
+	// Every state waits at most RX_STREAM_WAIT_MSEC before checking for the request
+	stop_req = true;
+	while ((task_handle_elm327_interface_ble != NULL) && (n++ < (STOP_MSEC / 10))) {
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	if (task_handle_elm327_interface_ble != NULL) {
+		ESP_LOGE(TAG, "Task did not stop");
+		return false;
+	}
+	
+	if (!ble_deinit()) {
+		return false;
+	}
+	
+	// The host task, which fed the stream, is gone
+	vStreamBufferDelete(rx_stream);
+	rx_stream = NULL;
+	vSemaphoreDelete(tx_mutex);
+	tx_mutex = NULL;
+	driver_state = DRIVER_STATE_NO_BLE;
 	
 	return true;
 }
@@ -124,8 +185,13 @@ static bool elm327_interface_ble_tx_line(char* s)
 		i = strlen(tx_buffer);
 		tx_buffer[i++] = 0x0D;  // Add Carriage Return
 		tx_buffer[i] = 0;       // Null terminate
-		tx_buffer_valid = true;
-		ret = true;
+#ifdef DEBUG_SHOW_DATA
+		ESP_LOGI(TAG, "TX: %s", tx_buffer);
+#endif
+		ret = ble_tx_data(i, tx_buffer);
+		if (!ret) {
+			DLOGE(TAG, "BLE TX failed");
+		}
 	}
 	
 	xSemaphoreGive(tx_mutex);
@@ -140,9 +206,11 @@ static bool elm327_interface_ble_tx_line(char* s)
 //
 static void _elm327_interface_ble_task()
 {
+	size_t len;
+	
 	ESP_LOGI(TAG, "Start task");
 	
-	while (1) {
+	while (!stop_req) {
 		switch (driver_state) {
 			case DRIVER_STATE_NO_BLE:
 				// Idle waiting for BLE stack initialization
@@ -165,8 +233,9 @@ static void _elm327_interface_ble_task()
 			
 			case DRIVER_STATE_BLE_SCAN_DONE:
 				if (ble_is_connected()) {
+					(void) xStreamBufferReset(rx_stream);
 					driver_state = DRIVER_STATE_CONNECTED;
-					can_driver_elm327_set_connected(true);
+					can_driver_elm327_set_connected(CAN_DRIVER_ELM327_BLE, true);
 				} else {
 					// Start another scan
 					driver_state = DRIVER_STATE_NO_BLE;
@@ -174,32 +243,28 @@ static void _elm327_interface_ble_task()
 				break;
 			
 			case DRIVER_STATE_CONNECTED:
-			// Look for strings to send
-				xSemaphoreTake(tx_mutex, portMAX_DELAY);
-				if (tx_buffer_valid) {
-					tx_buffer_valid = false;
-#ifdef DEBUG_SHOW_DATA
-					ESP_LOGI(TAG, "TX: %s", tx_buffer);
-#endif
-					if (!ble_tx_data(strlen(tx_buffer), tx_buffer)) {
-						ESP_LOGE(TAG, "BLE TX failed");
-						can_driver_elm327_tx_failed();
-					}
+				// Block waiting for received data to hand to the ELM327 driver
+				len = xStreamBufferReceive(rx_stream, rx_buffer, CAN_DRIVER_MAX_ELM327_STR_LEN, pdMS_TO_TICKS(RX_STREAM_WAIT_MSEC));
+				if (len > 0) {
+					can_driver_elm327_rx_data(CAN_DRIVER_ELM327_BLE, rx_buffer, len);
 				}
-				xSemaphoreGive(tx_mutex);
 				
 				if (!ble_is_connected()) {
+					xSemaphoreTake(tx_mutex, portMAX_DELAY);
 					driver_state = DRIVER_STATE_NO_BLE;
-					can_driver_elm327_set_connected(false);
+					xSemaphoreGive(tx_mutex);
+					can_driver_elm327_set_connected(CAN_DRIVER_ELM327_BLE, false);
 				}
-				
-				vTaskDelay(pdMS_TO_TICKS(10));
 				break;
 			
 			default:
 				break;
 		}
 	}
+	
+	ESP_LOGI(TAG, "Stop task");
+	task_handle_elm327_interface_ble = NULL;
+	vTaskDelete(NULL);
 }
 
 
@@ -210,10 +275,9 @@ static void _elm327_interface_ble_scan_complete(int debug)
 }
 
 
+// Called from the NimBLE host task
 static void _elm327_interface_ble_rx_cb(int len, uint8_t* data)
 {
-	size_t rx_len;
-	
 #ifdef DEBUG_SHOW_DATA
 	printf("%s RX: ", TAG);
 	for (int i=0; i<len; i++) {
@@ -222,8 +286,7 @@ static void _elm327_interface_ble_rx_cb(int len, uint8_t* data)
 	printf("\n");
 #endif
 	
-	rx_len = (len > CAN_DRIVER_MAX_ELM327_STR_LEN) ? CAN_DRIVER_MAX_ELM327_STR_LEN : len;
-	strncpy(rx_buffer, (const char*) data, rx_len);
-	rx_buffer[rx_len] = 0;
-	can_driver_elm327_rx_data(rx_buffer);
+	if (xStreamBufferSend(rx_stream, data, len, 0) != len) {
+		ESP_LOGE(TAG, "RX stream full");
+	}
 }
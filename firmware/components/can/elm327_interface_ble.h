@@ -24,11 +24,23 @@
 #define ELM327_INTERFACE_BLE_H
 
 #include <can_driver_elm327.h>
+#include "sdkconfig.h"
 #include <stdbool.h>
 #include <stdint.h>
 
 
 
+//
+// Constants
+//
+
+// Interface task - kept on the same core as the NimBLE host (CONFIG_BT_NIMBLE_PINNED_TO_CORE)
+#define ELM327_INTERFACE_BLE_TASK_STACK    4096
+#define ELM327_INTERFACE_BLE_TASK_PRIORITY 2
+#define ELM327_INTERFACE_BLE_TASK_CORE     CONFIG_BT_NIMBLE_PINNED_TO_CORE
+
+
+
 //
 // Externs for interface defined in this module
 //
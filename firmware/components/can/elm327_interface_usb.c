@@ -0,0 +1,659 @@
+/*
+ * ELM327 driver USB interface
+ *
+ * Implement the stream interface for the ELM327 driver over a wired USB serial adapter
+ * on the OTG port.  Runs the USB host library, opens the first attached device with a
+ * bulk IN/OUT interface, configures its serial bridge (CDC-ACM, FTDI, CP210x or CH34x)
+ * and streams data through bulk transfers.  Designed to be used by can_driver_elm327.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "can_driver_elm327.h"
+#include "elm327_interface_usb.h"
+#include "esp_intr_alloc.h"
+#include "dlog_utilities.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "usb/usb_host.h"
+#include <string.h>
+
+
+
+//
+// Local constants
+//
+
+// Uncomment to debug TX/RX data
+//#define DEBUG_SHOW_DATA
+
+// Connection state
+#define DRIVER_STATE_NO_DEV     0
+#define DRIVER_STATE_NEW_DEV    1
+#define DRIVER_STATE_CONNECTED  2
+#define DRIVER_STATE_DEV_GONE   3
+
+// Serial bridge types (selected by vendor ID, otherwise CDC-ACM)
+#define BRIDGE_CDC_ACM          0
+#define BRIDGE_FTDI             1
+#define BRIDGE_CP210X           2
+#define BRIDGE_CH34X            3
+
+#define USB_VID_FTDI            0x0403
+#define USB_VID_CP210X          0x10C4
+#define USB_VID_CH34X           0x1A86
+
+// Interface classes
+#define USB_CLASS_CDC_COMM      0x02
+#define USB_CLASS_CDC_DATA      0x0A
+
+// Bulk IN transfers kept queued so the adapter never waits on us to read (each a multiple
+// of the largest bulk packet size)
+#define NUM_RX_XFERS            2
+#define RX_XFER_LEN             512
+
+// FTDI bridges prefix each bulk IN packet with two modem/line status bytes
+#define FTDI_STATUS_LEN         2
+
+// Control transfers (setup packet plus a small data stage)
+#define CTRL_XFER_LEN           (sizeof(usb_setup_packet_t) + 16)
+#define CTRL_TIMEOUT_MSEC       500
+
+// Maximum time a TX waits for its bulk OUT transfer to complete
+#define TX_TIMEOUT_MSEC         500
+
+// Maximum time the client task blocks handling events before checking device state
+#define EVENT_TIMEOUT_MSEC      100
+
+
+
+//
+// Functions for can_driver_elm327
+//
+static int elm327_interface_usb_max_tx_len();
+static bool elm327_interface_usb_init();
+static bool elm327_interface_usb_tx_line(char* s);
+
+
+const elm327_if_driver_t elm327_interface_driver_usb =
+{
+	"ELM327 Interface USB",
+	&elm327_interface_usb_max_tx_len,
+	&elm327_interface_usb_init,
+	&elm327_interface_usb_tx_line,
+	NULL                           // The USB host stack is only started once
+};
+
+
+
+//
+// Global variables
+//
+static const char* TAG = "elm327_interface_usb";
+
+// Local tasks
+static TaskHandle_t task_handle_elm327_interface_usb;
+static TaskHandle_t task_handle_elm327_interface_usb_lib;
+
+// State
+static int driver_state = DRIVER_STATE_NO_DEV;
+static uint8_t dev_addr;
+
+// USB host client and open device
+static usb_host_client_handle_t client_hdl;
+static usb_device_handle_t dev_hdl = NULL;
+static int bridge_type;
+static int data_intf;
+static int comm_intf;                      // CDC-ACM control interface (-1 if none)
+static int in_mps;
+
+// Transfers
+static usb_transfer_t* ctrl_xferP = NULL;
+static usb_transfer_t* tx_xferP = NULL;
+static usb_transfer_t* rx_xferP[NUM_RX_XFERS];
+static volatile int rx_xfers_active;
+static volatile bool ctrl_done;
+static SemaphoreHandle_t tx_done_sem;
+
+// TX - strings are sent from the caller's context, completion is signaled by the client task
+static SemaphoreHandle_t tx_mutex;
+
+
+
+//
+//  Forward declarations for internal functions
+//
+static void _elm327_interface_usb_lib_task();
+static void _elm327_interface_usb_task();
+static void _elm327_interface_usb_client_cb(const usb_host_client_event_msg_t* event_msg, void* arg);
+static void _elm327_interface_usb_ctrl_cb(usb_transfer_t* xferP);
+static void _elm327_interface_usb_tx_cb(usb_transfer_t* xferP);
+static void _elm327_interface_usb_rx_cb(usb_transfer_t* xferP);
+static bool _elm327_interface_usb_open_dev();
+static void _elm327_interface_usb_close_dev();
+static bool _elm327_interface_usb_find_intf(const usb_config_desc_t* config_descP, uint8_t* in_ep, uint8_t* out_ep);
+static bool _elm327_interface_usb_setup_bridge();
+static bool _elm327_interface_usb_ctrl(uint8_t req_type, uint8_t req, uint16_t value, uint16_t index, const uint8_t* data, uint16_t len);
+
+
+
+//
+// CAN driver functions
+//
+static int elm327_interface_usb_max_tx_len()
+{
+	return CAN_DRIVER_MAX_ELM327_STR_LEN;
+}
+
+
+static bool elm327_interface_usb_init()
+{
+	const usb_host_config_t host_config = {
+		.skip_phy_setup = false,
+		.intr_flags = ESP_INTR_FLAG_LEVEL1,
+	};
+	esp_err_t ret;
+	
+	// Create the tx mutex and completion semaphore
+	tx_mutex = xSemaphoreCreateMutex();
+	if (tx_mutex == NULL) {
+		ESP_LOGE(TAG, "Could not create tx_mutex");
+		return false;
+	}
+	tx_done_sem = xSemaphoreCreateBinary();
+	if (tx_done_sem == NULL) {
+		ESP_LOGE(TAG, "Could not create tx_done_sem");
+		return false;
+	}
+	
+	// Install the USB host library (this takes the PHY from the USB Serial/JTAG console)
+	ret = usb_host_install(&host_config);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Could not install USB host - %d", ret);
+		return false;
+	}
+	
+	driver_state = DRIVER_STATE_NO_DEV;
+	
+	// Start the library task and our client task on the protocol CPU
+	xTaskCreatePinnedToCore(&_elm327_interface_usb_lib_task, "elm327_interface_usb_lib", ELM327_INTERFACE_USB_LIB_STACK, NULL, ELM327_INTERFACE_USB_LIB_PRIORITY, &task_handle_elm327_interface_usb_lib, ELM327_INTERFACE_USB_TASK_CORE);
+	xTaskCreatePinnedToCore(&_elm327_interface_usb_task, "elm327_interface_usb_task", ELM327_INTERFACE_USB_TASK_STACK, NULL, ELM327_INTERFACE_USB_TASK_PRIORITY, &task_handle_elm327_interface_usb, ELM327_INTERFACE_USB_TASK_CORE);
+	
+	return true;
+}
+
+
+static bool elm327_interface_usb_tx_line(char* s)
+{
+	bool ret = false;
+	int i;
+	
+	xSemaphoreTake(tx_mutex, portMAX_DELAY);
+	
+	if (driver_state == DRIVER_STATE_CONNECTED) {
+		strncpy((char*) tx_xferP->data_buffer, s, CAN_DRIVER_MAX_ELM327_STR_LEN);
+		i = strlen((char*) tx_xferP->data_buffer);
+		tx_xferP->data_buffer[i++] = 0x0D;  // Add Carriage Return
+		tx_xferP->data_buffer[i] = 0;       // Null terminate
+#ifdef DEBUG_SHOW_DATA
+		ESP_LOGI(TAG, "TX: %s", (char*) tx_xferP->data_buffer);
+#endif
+		tx_xferP->num_bytes = i;
+	
+		// The buffer is reused so wait for the transfer to complete before returning
+		(void) xSemaphoreTake(tx_done_sem, 0);
+		if (usb_host_transfer_submit(tx_xferP) == ESP_OK) {
+			if (xSemaphoreTake(tx_done_sem, pdMS_TO_TICKS(TX_TIMEOUT_MSEC)) == pdTRUE) {
+				ret = (tx_xferP->status == USB_TRANSFER_STATUS_COMPLETED);
+			}
+		}
+	
+		if (!ret) {
+			DLOGI(TAG, "bulk out failed");
+			can_driver_elm327_tx_failed(CAN_DRIVER_ELM327_USB);
+		}
+	}
+	
+	xSemaphoreGive(tx_mutex);
+	
+	return ret;
+}
+
+
+
+//
+// Internal functions
+//
+
+// USB host library event handling
+static void _elm327_interface_usb_lib_task()
+{
+	uint32_t event_flags;
+	
+	while (1) {
+		(void) usb_host_lib_handle_events(portMAX_DELAY, &event_flags);
+		if (event_flags & USB_HOST_LIB_EVENT_FLAGS_NO_CLIENTS) {
+			(void) usb_host_device_free_all();
+		}
+	}
+}
+
+
+// USB host client - opens, configures and services the serial adapter.  Transfer callbacks
+// (including RX parsing) run in this task from usb_host_client_handle_events.
+static void _elm327_interface_usb_task()
+{
+	const usb_host_client_config_t client_config = {
+		.is_synchronous = false,
+		.max_num_event_msg = 5,
+		.async = {
+			.client_event_callback = _elm327_interface_usb_client_cb,
+			.callback_arg = NULL,
+		},
+	};
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	if (usb_host_client_register(&client_config, &client_hdl) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not register USB host client");
+		vTaskDelete(NULL);
+	}
+	
+	if (usb_host_transfer_alloc(CTRL_XFER_LEN, 0, &ctrl_xferP) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not allocate control transfer");
+		vTaskDelete(NULL);
+	}
+	
+	while (1) {
+		(void) usb_host_client_handle_events(client_hdl, pdMS_TO_TICKS(EVENT_TIMEOUT_MSEC));
+	
+		if (driver_state == DRIVER_STATE_NEW_DEV) {
+			if (_elm327_interface_usb_open_dev()) {
+				ESP_LOGI(TAG, "Adapter connected");
+				xSemaphoreTake(tx_mutex, portMAX_DELAY);
+				driver_state = DRIVER_STATE_CONNECTED;
+				xSemaphoreGive(tx_mutex);
+				can_driver_elm327_set_connected(CAN_DRIVER_ELM327_USB, true);
+			} else {
+				_elm327_interface_usb_close_dev();
+				driver_state = DRIVER_STATE_NO_DEV;
+			}
+		} else if (driver_state == DRIVER_STATE_DEV_GONE) {
+			ESP_LOGI(TAG, "Adapter disconnected");
+			can_driver_elm327_set_connected(CAN_DRIVER_ELM327_USB, false);
+			xSemaphoreTake(tx_mutex, portMAX_DELAY);
+			_elm327_interface_usb_close_dev();
+			driver_state = DRIVER_STATE_NO_DEV;
+			xSemaphoreGive(tx_mutex);
+		}
+	}
+}
+
+
+static void _elm327_interface_usb_client_cb(const usb_host_client_event_msg_t* event_msg, void* arg)
+{
+	switch (event_msg->event) {
+		case USB_HOST_CLIENT_EVENT_NEW_DEV:
+			// Only one adapter is used at a time
+			if (driver_state == DRIVER_STATE_NO_DEV) {
+				dev_addr = event_msg->new_dev.address;
+				driver_state = DRIVER_STATE_NEW_DEV;
+			}
+			break;
+	
+		case USB_HOST_CLIENT_EVENT_DEV_GONE:
+			if ((dev_hdl != NULL) && (event_msg->dev_gone.dev_hdl == dev_hdl)) {
+				driver_state = DRIVER_STATE_DEV_GONE;
+			}
+			break;
+	
+		default:
+			break;
+	}
+}
+
+
+static void _elm327_interface_usb_ctrl_cb(usb_transfer_t* xferP)
+{
+	ctrl_done = true;
+}
+
+
+static void _elm327_interface_usb_tx_cb(usb_transfer_t* xferP)
+{
+	xSemaphoreGive(tx_done_sem);
+}
+
+
+static void _elm327_interface_usb_rx_cb(usb_transfer_t* xferP)
+{
+	int i;
+	int len;
+	
+	if (xferP->status == USB_TRANSFER_STATUS_COMPLETED) {
+#ifdef DEBUG_SHOW_DATA
+		printf("%s RX: ", TAG);
+		for (i=0; i<xferP->actual_num_bytes; i++) {
+			printf("0x%2x ", xferP->data_buffer[i]);
+		}
+		printf("\n");
+#endif
+		if (bridge_type == BRIDGE_FTDI) {
+			// Skip the status bytes at the start of each packet
+			for (i=0; i<xferP->actual_num_bytes; i += in_mps) {
+				len = xferP->actual_num_bytes - i;
+				if (len > in_mps) len = in_mps;
+				if (len > FTDI_STATUS_LEN) {
+					can_driver_elm327_rx_data(CAN_DRIVER_ELM327_USB, (char*) &xferP->data_buffer[i + FTDI_STATUS_LEN], len - FTDI_STATUS_LEN);
+				}
+			}
+		} else if (xferP->actual_num_bytes > 0) {
+			can_driver_elm327_rx_data(CAN_DRIVER_ELM327_USB, (char*) xferP->data_buffer, xferP->actual_num_bytes);
+		}
+	}
+	
+	// Requeue unless the device is going away
+	if ((xferP->status == USB_TRANSFER_STATUS_COMPLETED) || (xferP->status == USB_TRANSFER_STATUS_TIMED_OUT)) {
+		if ((driver_state != DRIVER_STATE_DEV_GONE) && (usb_host_transfer_submit(xferP) == ESP_OK)) {
+			return;
+		}
+	}
+	rx_xfers_active--;
+}
+
+
+static bool _elm327_interface_usb_open_dev()
+{
+	const usb_device_desc_t* dev_descP;
+	const usb_config_desc_t* config_descP;
+	uint8_t in_ep;
+	uint8_t out_ep;
+	int i;
+	
+	if (usb_host_device_open(client_hdl, dev_addr, &dev_hdl) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not open device %d", dev_addr);
+		dev_hdl = NULL;
+		return false;
+	}
+	
+	if ((usb_host_get_device_descriptor(dev_hdl, &dev_descP) != ESP_OK) ||
+	    (usb_host_get_active_config_descriptor(dev_hdl, &config_descP) != ESP_OK)) {
+		ESP_LOGE(TAG, "Could not read device descriptors");
+		return false;
+	}
+	
+	switch (dev_descP->idVendor) {
+		case USB_VID_FTDI:
+			bridge_type = BRIDGE_FTDI;
+			break;
+		case USB_VID_CP210X:
+			bridge_type = BRIDGE_CP210X;
+			break;
+		case USB_VID_CH34X:
+			bridge_type = BRIDGE_CH34X;
+			break;
+		default:
+			bridge_type = BRIDGE_CDC_ACM;
+	}
+	ESP_LOGI(TAG, "Device %04x:%04x bridge type %d", dev_descP->idVendor, dev_descP->idProduct, bridge_type);
+	
+	if (!_elm327_interface_usb_find_intf(config_descP, &in_ep, &out_ep)) {
+		ESP_LOGE(TAG, "No bulk serial interface found");
+		return false;
+	}
+	
+	if (usb_host_interface_claim(client_hdl, dev_hdl, data_intf, 0) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not claim interface %d", data_intf);
+		data_intf = -1;
+		return false;
+	}
+	
+	if (!_elm327_interface_usb_setup_bridge()) {
+		ESP_LOGE(TAG, "Serial bridge setup failed");
+		return false;
+	}
+	
+	// Allocate the bulk transfers
+	if (usb_host_transfer_alloc(CAN_DRIVER_MAX_ELM327_STR_LEN+2, 0, &tx_xferP) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not allocate tx transfer");
+		return false;
+	}
+	tx_xferP->device_handle = dev_hdl;
+	tx_xferP->bEndpointAddress = out_ep;
+	tx_xferP->callback = _elm327_interface_usb_tx_cb;
+	tx_xferP->timeout_ms = TX_TIMEOUT_MSEC;
+	
+	for (i=0; i<NUM_RX_XFERS; i++) {
+		if (usb_host_transfer_alloc(RX_XFER_LEN, 0, &rx_xferP[i]) != ESP_OK) {
+			ESP_LOGE(TAG, "Could not allocate rx transfer");
+			return false;
+		}
+		rx_xferP[i]->device_handle = dev_hdl;
+		rx_xferP[i]->bEndpointAddress = in_ep;
+		rx_xferP[i]->num_bytes = RX_XFER_LEN;
+		rx_xferP[i]->callback = _elm327_interface_usb_rx_cb;
+		if (usb_host_transfer_submit(rx_xferP[i]) != ESP_OK) {
+			ESP_LOGE(TAG, "Could not submit rx transfer");
+			return false;
+		}
+		rx_xfers_active++;
+	}
+	
+	return true;
+}
+
+
+// Release everything _elm327_interface_usb_open_dev acquired
+static void _elm327_interface_usb_close_dev()
+{
+	int i;
+	
+	if (dev_hdl == NULL) return;
+	
+	// Wait for queued bulk IN transfers to be returned (they fail once the device is gone)
+	if (rx_xfers_active > 0 && data_intf >= 0) {
+		(void) usb_host_endpoint_halt(dev_hdl, rx_xferP[0]->bEndpointAddress);
+		(void) usb_host_endpoint_flush(dev_hdl, rx_xferP[0]->bEndpointAddress);
+	}
+	while (rx_xfers_active > 0) {
+		(void) usb_host_client_handle_events(client_hdl, pdMS_TO_TICKS(EVENT_TIMEOUT_MSEC));
+	}
+	
+	for (i=0; i<NUM_RX_XFERS; i++) {
+		if (rx_xferP[i] != NULL) {
+			(void) usb_host_transfer_free(rx_xferP[i]);
+			rx_xferP[i] = NULL;
+		}
+	}
+	if (tx_xferP != NULL) {
+		(void) usb_host_transfer_free(tx_xferP);
+		tx_xferP = NULL;
+	}
+	
+	if (data_intf >= 0) {
+		(void) usb_host_interface_release(client_hdl, dev_hdl, data_intf);
+		data_intf = -1;
+	}
+	(void) usb_host_device_close(client_hdl, dev_hdl);
+	dev_hdl = NULL;
+}
+
+
+// Find the first interface with a bulk IN and OUT endpoint (the CDC data interface or the
+// vendor interface of a serial bridge) and the CDC control interface if there is one
+static bool _elm327_interface_usb_find_intf(const usb_config_desc_t* config_descP, uint8_t* in_ep, uint8_t* out_ep)
+{
+	const usb_intf_desc_t* intfP;
+	const usb_ep_desc_t* epP;
+	int i, j;
+	int intf_offset;
+	int ep_offset;
+	
+	data_intf = -1;
+	comm_intf = -1;
+	
+	for (i=0; i<config_descP->bNumInterfaces; i++) {
+		intf_offset = 0;
+		intfP = usb_parse_interface_descriptor(config_descP, i, 0, &intf_offset);
+		if (intfP == NULL) continue;
+	
+		if ((intfP->bInterfaceClass == USB_CLASS_CDC_COMM) && (comm_intf < 0)) {
+			comm_intf = i;
+		}
+	
+		if (data_intf >= 0) continue;
+		*in_ep = 0;
+		*out_ep = 0;
+		for (j=0; j<intfP->bNumEndpoints; j++) {
+			ep_offset = intf_offset;
+			epP = usb_parse_endpoint_descriptor_by_index(intfP, j, config_descP->wTotalLength, &ep_offset);
+			if ((epP == NULL) || (USB_EP_DESC_GET_XFERTYPE(epP) != USB_BM_ATTRIBUTES_XFER_BULK)) continue;
+	
+			if (USB_EP_DESC_GET_EP_DIR(epP)) {
+				*in_ep = epP->bEndpointAddress;
+				in_mps = USB_EP_DESC_GET_MPS(epP);
+			} else {
+				*out_ep = epP->bEndpointAddress;
+			}
+		}
+		if ((*in_ep != 0) && (*out_ep != 0)) {
+			data_intf = i;
+		}
+	}
+	
+	return (data_intf >= 0);
+}
+
+
+// Configure the serial bridge for ELM327_INTERFACE_USB_BAUD, 8N1, no flow control with
+// DTR and RTS asserted
+static bool _elm327_interface_usb_setup_bridge()
+{
+	static const uint8_t ftdi_frac_code[8] = {0, 3, 2, 4, 1, 5, 6, 7};
+	uint8_t buf[7];
+	uint32_t div8;
+	uint32_t factor;
+	uint16_t divisor;
+	bool success = true;
+	
+	switch (bridge_type) {
+		case BRIDGE_FTDI:
+			// Reset, 8N1, no flow control, DTR/RTS, baud from the 3 MHz clock with 1/8th
+			// fractional divisor and the shortest latency timer so replies are not held
+			div8 = ((3000000 * 8) + (ELM327_INTERFACE_USB_BAUD / 2)) / ELM327_INTERFACE_USB_BAUD;
+			factor = (div8 >> 3) | ((uint32_t) ftdi_frac_code[div8 & 0x7] << 14);
+			success &= _elm327_interface_usb_ctrl(0x40, 0x00, 0x0000, 0, NULL, 0);
+			success &= _elm327_interface_usb_ctrl(0x40, 0x03, factor & 0xFFFF, factor >> 16, NULL, 0);
+			success &= _elm327_interface_usb_ctrl(0x40, 0x04, 0x0008, 0, NULL, 0);
+			success &= _elm327_interface_usb_ctrl(0x40, 0x02, 0x0000, 0, NULL, 0);
+			success &= _elm327_interface_usb_ctrl(0x40, 0x01, 0x0303, 0, NULL, 0);
+			success &= _elm327_interface_usb_ctrl(0x40, 0x09, 1, 0, NULL, 0);
+			break;
+	
+		case BRIDGE_CP210X:
+			// Enable the UART, set baud (32-bit little endian), 8N1 and DTR/RTS
+			buf[0] = ELM327_INTERFACE_USB_BAUD & 0xFF;
+			buf[1] = (ELM327_INTERFACE_USB_BAUD >> 8) & 0xFF;
+			buf[2] = (ELM327_INTERFACE_USB_BAUD >> 16) & 0xFF;
+			buf[3] = (ELM327_INTERFACE_USB_BAUD >> 24) & 0xFF;
+			success &= _elm327_interface_usb_ctrl(0x41, 0x00, 0x0001, data_intf, NULL, 0);
+			success &= _elm327_interface_usb_ctrl(0x41, 0x1E, 0x0000, data_intf, buf, 4);
+			success &= _elm327_interface_usb_ctrl(0x41, 0x03, 0x0800, data_intf, NULL, 0);
+			success &= _elm327_interface_usb_ctrl(0x41, 0x07, 0x0303, data_intf, NULL, 0);
+			break;
+	
+		case BRIDGE_CH34X:
+			// Initialize, baud prescaler/divisor (registers 0x12, 0x13), enable RX/TX with
+			// 8 data bits (LCR registers 0x18, 0x25) and assert DTR/RTS (active low)
+			factor = 1532620800 / ELM327_INTERFACE_USB_BAUD;
+			divisor = 3;
+			while ((factor > 0xFFF0) && (divisor > 0)) {
+				factor >>= 3;
+				divisor--;
+			}
+			factor = 0x10000 - factor;
+			divisor = (factor & 0xFF00) | divisor | 0x80;
+			success &= _elm327_interface_usb_ctrl(0x40, 0xA1, 0x0000, 0, NULL, 0);
+			success &= _elm327_interface_usb_ctrl(0x40, 0x9A, 0x1312, divisor, NULL, 0);
+			success &= _elm327_interface_usb_ctrl(0x40, 0x9A, 0x2518, 0x00C3, NULL, 0);
+			success &= _elm327_interface_usb_ctrl(0x40, 0xA4, (uint16_t) ~(0x20 | 0x40), 0, NULL, 0);
+			break;
+	
+		default:
+			// CDC-ACM SET_LINE_CODING and SET_CONTROL_LINE_STATE (devices without a control
+			// interface are assumed to be preconfigured)
+			if (comm_intf >= 0) {
+				buf[0] = ELM327_INTERFACE_USB_BAUD & 0xFF;
+				buf[1] = (ELM327_INTERFACE_USB_BAUD >> 8) & 0xFF;
+				buf[2] = (ELM327_INTERFACE_USB_BAUD >> 16) & 0xFF;
+				buf[3] = (ELM327_INTERFACE_USB_BAUD >> 24) & 0xFF;
+				buf[4] = 0;   // 1 stop bit
+				buf[5] = 0;   // No parity
+				buf[6] = 8;   // Data bits
+				success &= _elm327_interface_usb_ctrl(0x21, 0x20, 0x0000, comm_intf, buf, 7);
+				success &= _elm327_interface_usb_ctrl(0x21, 0x22, 0x0003, comm_intf, NULL, 0);
+			}
+	}
+	
+	return success;
+}
+
+
+// Synchronous host-to-device control transfer, handling client events until it completes
+static bool _elm327_interface_usb_ctrl(uint8_t req_type, uint8_t req, uint16_t value, uint16_t index, const uint8_t* data, uint16_t len)
+{
+	usb_setup_packet_t* setupP = (usb_setup_packet_t*) ctrl_xferP->data_buffer;
+	TickType_t start_tick;
+	
+	setupP->bmRequestType = req_type;
+	setupP->bRequest = req;
+	setupP->wValue = value;
+	setupP->wIndex = index;
+	setupP->wLength = len;
+	if (len > 0) {
+		memcpy(ctrl_xferP->data_buffer + sizeof(usb_setup_packet_t), data, len);
+	}
+	ctrl_xferP->num_bytes = sizeof(usb_setup_packet_t) + len;
+	ctrl_xferP->device_handle = dev_hdl;
+	ctrl_xferP->bEndpointAddress = 0;
+	ctrl_xferP->callback = _elm327_interface_usb_ctrl_cb;
+	ctrl_xferP->timeout_ms = CTRL_TIMEOUT_MSEC;
+	
+	ctrl_done = false;
+	if (usb_host_transfer_submit_control(client_hdl, ctrl_xferP) != ESP_OK) {
+		ESP_LOGE(TAG, "Control request 0x%02x submit failed", req);
+		return false;
+	}
+	
+	start_tick = xTaskGetTickCount();
+	while (!ctrl_done) {
+		(void) usb_host_client_handle_events(client_hdl, pdMS_TO_TICKS(10));
+		if ((xTaskGetTickCount() - start_tick) > pdMS_TO_TICKS(2 * CTRL_TIMEOUT_MSEC)) {
+			ESP_LOGE(TAG, "Control request 0x%02x timed out", req);
+			return false;
+		}
+	}
+	
+	if (ctrl_xferP->status != USB_TRANSFER_STATUS_COMPLETED) {
+		ESP_LOGE(TAG, "Control request 0x%02x failed - %d", req, ctrl_xferP->status);
+		return false;
+	}
+	
+	return true;
+}
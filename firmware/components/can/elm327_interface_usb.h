@@ -0,0 +1,58 @@
+/*
+ * ELM327 driver USB interface
+ *
+ * Implement the stream interface for the ELM327 driver over a wired USB serial adapter
+ * connected to the ESP32-S3 OTG port (USB host).  Supports CDC-ACM, FTDI, CP210x and
+ * CH34x serial bridges.  Designed to be used by can_driver_elm327.
+ *
+ * Note: The OTG port shares the USB PHY with the USB Serial/JTAG console, which stops
+ * working once this interface starts.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef ELM327_INTERFACE_USB_H
+#define ELM327_INTERFACE_USB_H
+
+#include <can_driver_elm327.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Serial bridge baud rate (ELM327 default - STN adapters may need 115200)
+#define ELM327_INTERFACE_USB_BAUD          38400
+
+// Interface task (USB host client and device handling) and USB host library task
+#define ELM327_INTERFACE_USB_TASK_STACK    4096
+#define ELM327_INTERFACE_USB_TASK_PRIORITY 2
+#define ELM327_INTERFACE_USB_TASK_CORE     0
+
+#define ELM327_INTERFACE_USB_LIB_STACK     2048
+#define ELM327_INTERFACE_USB_LIB_PRIORITY  3
+
+
+
+//
+// Externs for interface defined in this module
+//
+extern const elm327_if_driver_t elm327_interface_driver_usb;
+
+#endif /* ELM327_INTERFACE_USB_H */
@@ -22,6 +22,7 @@
  */
 #include "can_driver_elm327.h"
 #include "elm327_interface_wifi.h"
+#include "dlog_utilities.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_netif.h"
@@ -33,6 +34,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netdb.h>            // struct addrinfo
+#include <netinet/tcp.h>      // TCP_NODELAY, keepalive options
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -51,20 +53,35 @@
 #define DRIVER_STATE_WIFI       1
 #define DRIVER_STATE_CONNECTED  2
 
+// Maximum time the receive loop blocks waiting for data before checking connection state
+#define RX_SELECT_TIMEOUT_MSEC  100
+
+// TCP keepalive so a dead adapter connection is detected while idle
+#define KEEPALIVE_IDLE_SEC      5
+#define KEEPALIVE_INTERVAL_SEC  2
+#define KEEPALIVE_COUNT         3
+
+// Maximum time for the task to close its socket and exit during deinit
+#define STOP_MSEC               2000
+
 
 
 //
 // Functions for can_driver_elm327
 //
+static int elm327_interface_wifi_max_tx_len();
 static bool elm327_interface_wifi_init();
 static bool elm327_interface_wifi_tx_line(char* s);
+static bool elm327_interface_wifi_deinit();
 
 
 const elm327_if_driver_t elm327_interface_driver_wifi =
 {
 	"ELM327 Interface Wifi",
+	&elm327_interface_wifi_max_tx_len,
 	&elm327_interface_wifi_init,
-	&elm327_interface_wifi_tx_line
+	&elm327_interface_wifi_tx_line,
+	&elm327_interface_wifi_deinit
 };
 
 
@@ -75,7 +92,8 @@ const elm327_if_driver_t elm327_interface_driver_wifi =
 static const char* TAG = "elm327_interface_wifi";
 
 // Local initialization task
-static TaskHandle_t task_handle_elm327_interface_wifi;
+static TaskHandle_t task_handle_elm327_interface_wifi = NULL;
+static volatile bool stop_req = false;      // Task exits (deinit)
 
 // Wifi configuration
 static net_config_t* configP;
@@ -83,10 +101,10 @@ static net_config_t* configP;
 // State
 static int driver_state = DRIVER_STATE_NO_WIFI;
 
-// TX Buffer
-static bool tx_buffer_valid = false;
+// TX Buffer - strings are sent directly from the caller's context on the connected socket
 static char tx_buffer[CAN_DRIVER_MAX_ELM327_STR_LEN+2];  // Room for carriage return and null
 static SemaphoreHandle_t tx_mutex;
+static int tx_sock = -1;
 
 
 
@@ -94,16 +112,23 @@ static SemaphoreHandle_t tx_mutex;
 //  Forward declarations for internal functions
 //
 static void _elm327_interface_wifi_task();
+static void _elm327_interface_wifi_config_socket(int sock);
 
 
 
 //
 // CAN driver functions
 //
+static int elm327_interface_wifi_max_tx_len()
+{
+	return CAN_DRIVER_MAX_ELM327_STR_LEN;
+}
+
+
 static bool elm327_interface_wifi_init()
 {
-	// Attempt to initialize Wifi
-	if (!wifi_init()) {
+	// Attempt to initialize Wifi (it may already be running for another feature or interface)
+	if (!wifi_is_enabled() && !wifi_init()) {
 		ESP_LOGE(TAG, "Could not initialize Wifi");
 		return false;
 	}
@@ -122,7 +147,8 @@ static bool elm327_interface_wifi_init()
 	}
 	
 	// Start our task on the protocol CPU
-	xTaskCreatePinnedToCore(&_elm327_interface_wifi_task, "elm327_interface_wifi_task", 4096, NULL, 2, &task_handle_elm327_interface_wifi, 0);
+	stop_req = false;
+	xTaskCreatePinnedToCore(&_elm327_interface_wifi_task, "elm327_interface_wifi_task", ELM327_INTERFACE_WIFI_TASK_STACK, NULL, ELM327_INTERFACE_WIFI_TASK_PRIORITY, &task_handle_elm327_interface_wifi, ELM327_INTERFACE_WIFI_TASK_CORE);
 	
 	driver_state = DRIVER_STATE_NO_WIFI;
 	
@@ -130,6 +156,29 @@ static bool elm327_interface_wifi_init()
 }
 
 
+// Close the adapter connection and stop the task.  WiFi itself is left running as other
+// features (uploads, telemetry, diagnostics) may be using it.
+static bool elm327_interface_wifi_deinit()
+{
+	int n = 0;
+	
+	// The receive loop checks for the request at least every RX_SELECT_TIMEOUT_MSEC
+	stop_req = true;
+	while ((task_handle_elm327_interface_wifi != NULL) && (n++ < (STOP_MSEC / 10))) {
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	if (task_handle_elm327_interface_wifi != NULL) {
+		ESP_LOGE(TAG, "Task did not stop");
+		return false;
+	}
+	
+	vSemaphoreDelete(tx_mutex);
+	tx_mutex = NULL;
+	driver_state = DRIVER_STATE_NO_WIFI;
+	
+	return true;
+}
+
 
 static bool elm327_interface_wifi_tx_line(char* s)
 {
@@ -138,13 +187,21 @@ static bool elm327_interface_wifi_tx_line(char* s)
 	
 	xSemaphoreTake(tx_mutex, portMAX_DELAY);
 	
-	if (driver_state == DRIVER_STATE_CONNECTED) {
+	if ((driver_state == DRIVER_STATE_CONNECTED) && (tx_sock >= 0)) {
 		strncpy(tx_buffer, s, CAN_DRIVER_MAX_ELM327_STR_LEN);
 		i = strlen(tx_buffer);
 		tx_buffer[i++] = 0x0D;  // Add Carriage Return
 		tx_buffer[i] = 0;       // Null terminate
-		tx_buffer_valid = true;
-		ret = true;
+#ifdef DEBUG_SHOW_DATA
+		ESP_LOGI(TAG, "TX: %s", tx_buffer);
+#endif
+		// Send immediately (the receive task is blocked in select)
+		if (send(tx_sock, tx_buffer, i, 0) == i) {
+			ret = true;
+		} else {
+			DLOGI(TAG, "send failed: errno: %d", errno);
+			can_driver_elm327_tx_failed(CAN_DRIVER_ELM327_WIFI);
+		}
 	}
 	
 	xSemaphoreGive(tx_mutex);
@@ -160,18 +217,20 @@ static bool elm327_interface_wifi_tx_line(char* s)
 static void _elm327_interface_wifi_task()
 {
 	char err_buf[80];
-	char rx_buffer[CAN_DRIVER_MAX_ELM327_STR_LEN+1];
+	char rx_buffer[CAN_DRIVER_MAX_ELM327_STR_LEN];
 	char host_ip[32];
 	int addr_family = 0;
 	int err;
 	int ip_protocol = 0;
 	int len;
 	int sock;
+	fd_set rx_fds;
 	struct sockaddr_in dest_addr;
+	struct timeval select_tv;
 	
 	ESP_LOGI(TAG, "Start task");
 	
-	while (1) {
+	while (!stop_req) {
 		if (driver_state == DRIVER_STATE_NO_WIFI) {
 			// Just idle waiting for a Wifi connection
 			vTaskDelay(pdMS_TO_TICKS(50));
@@ -204,40 +263,44 @@ static void _elm327_interface_wifi_task()
 				err = connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
 				if (err != 0) {
 					ESP_LOGE(TAG, "Socket unable to connect: errno %d - %s", errno, esp_err_to_name_r(errno, err_buf, sizeof(err_buf)));
+					close(sock);
 					vTaskDelay(pdMS_TO_TICKS(500));
 				} else {
 					ESP_LOGI(TAG, "Socket connected");
+					_elm327_interface_wifi_config_socket(sock);
+					xSemaphoreTake(tx_mutex, portMAX_DELAY);
+					tx_sock = sock;
 					driver_state = DRIVER_STATE_CONNECTED;
-					can_driver_elm327_set_connected(true);
+					xSemaphoreGive(tx_mutex);
+					can_driver_elm327_set_connected(CAN_DRIVER_ELM327_WIFI, true);
 					
-					while (1) {
-						// Look for strings to send
-						xSemaphoreTake(tx_mutex, portMAX_DELAY);
-						if (tx_buffer_valid) {
-							tx_buffer_valid = false;
-#ifdef DEBUG_SHOW_DATA
-							ESP_LOGI(TAG, "TX: %s", tx_buffer);
-#endif
-							err = send(sock, tx_buffer, strlen(tx_buffer), 0);
-							if (err < 0) {
-								can_driver_elm327_tx_failed();
-								ESP_LOGI(TAG, "send failed: errno: %d - %s - Socket disconnected", errno, esp_err_to_name_r(errno, err_buf, sizeof(err_buf)));
+					// Every request is a round trip to the dongle
+					wifi_set_latency_mode(true);
+					
+					while (!stop_req) {
+						// Block until data arrives (transmission happens in elm327_interface_wifi_tx_line)
+						FD_ZERO(&rx_fds);
+						FD_SET(sock, &rx_fds);
+						select_tv.tv_sec = 0;
+						select_tv.tv_usec = RX_SELECT_TIMEOUT_MSEC * 1000;
+						err = select(sock + 1, &rx_fds, NULL, NULL, &select_tv);
+						if (err < 0) {
+							ESP_LOGI(TAG, "select failed: errno: %d - %s - Socket disconnected", errno, esp_err_to_name_r(errno, err_buf, sizeof(err_buf)));
+							break;
+						} else if (err == 0) {
+							// Timeout - make sure we're still connected
+							if (!wifi_is_connected()) {
+								ESP_LOGI(TAG, "Wifi disconnected");
 								break;
 							}
+							continue;
 						}
-						xSemaphoreGive(tx_mutex);
 						
-						// Look for incoming strings
-						len = recv(sock, rx_buffer, sizeof(rx_buffer) - 1, MSG_DONTWAIT);
-						if (len < 0) {
-							if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-								// Nothing there to receive, so just wait before calling recv again
-								vTaskDelay(pdMS_TO_TICKS(10));
-							} else {
-								ESP_LOGI(TAG, "recv failed: errno: %d - %s - Socket disconnected", errno, esp_err_to_name_r(errno, err_buf, sizeof(err_buf)));
-								break;
-							}
-						} else if (len > 0) {
+						len = recv(sock, rx_buffer, sizeof(rx_buffer), 0);
+						if (len <= 0) {
+							ESP_LOGI(TAG, "recv failed: errno: %d - %s - Socket disconnected", errno, esp_err_to_name_r(errno, err_buf, sizeof(err_buf)));
+							break;
+						} else {
 #ifdef DEBUG_SHOW_DATA
 							printf("%s RX: ", TAG);
 							for (int i=0; i<len; i++) {
@@ -245,20 +308,23 @@ static void _elm327_interface_wifi_task()
 							}
 							printf("\n");
 #endif
-							// Process received data
-							rx_buffer[len] = 0;  // Null-terminate string
-							can_driver_elm327_rx_data(rx_buffer);
+							// Parse the received data in place
+							can_driver_elm327_rx_data(CAN_DRIVER_ELM327_WIFI, rx_buffer, len);
 						}
 					}
 					
 					// Clean up
+					xSemaphoreTake(tx_mutex, portMAX_DELAY);
+					tx_sock = -1;
+					xSemaphoreGive(tx_mutex);
 					if (wifi_is_connected()) {
 	        			driver_state = DRIVER_STATE_WIFI;
 					} else {
 						driver_state = DRIVER_STATE_NO_WIFI;
 					}
 					
-					can_driver_elm327_set_connected(false);
+					can_driver_elm327_set_connected(CAN_DRIVER_ELM327_WIFI, false);
+					wifi_set_latency_mode(false);
 				
 					if (sock != -1) {
 						ESP_LOGE(TAG, "Shutting down socket and restarting...");
@@ -266,9 +332,32 @@ static void _elm327_interface_wifi_task()
 						close(sock);
 					}
 					
+					if (!stop_req) {
 					vTaskDelay(pdMS_TO_TICKS(500));
 				}
 			}
 		}
 	}
+	}
+	
+	ESP_LOGI(TAG, "Stop task");
+	task_handle_elm327_interface_wifi = NULL;
+	vTaskDelete(NULL);
+}
+
+
+// Send data without Nagle delay and detect a dead connection while idle
+static void _elm327_interface_wifi_config_socket(int sock)
+{
+	int opt;
+	
+	opt = 1;
+	(void) setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+	(void) setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt));
+	opt = KEEPALIVE_IDLE_SEC;
+	(void) setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &opt, sizeof(opt));
+	opt = KEEPALIVE_INTERVAL_SEC;
+	(void) setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &opt, sizeof(opt));
+	opt = KEEPALIVE_COUNT;
+	(void) setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &opt, sizeof(opt));
 }
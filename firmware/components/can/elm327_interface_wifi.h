@@ -24,11 +24,27 @@
 #define ELM327_INTERFACE_WIFI_H
 
 #include <can_driver_elm327.h>
+#include "sdkconfig.h"
 #include <stdbool.h>
 #include <stdint.h>
 
 
 
+//
+// Constants
+//
+
+// Interface task - kept on the same core as the WiFi task (CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_x)
+#define ELM327_INTERFACE_WIFI_TASK_STACK    4096
+#define ELM327_INTERFACE_WIFI_TASK_PRIORITY 2
+#ifdef CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_1
+#define ELM327_INTERFACE_WIFI_TASK_CORE     1
+#else
+#define ELM327_INTERFACE_WIFI_TASK_CORE     0
+#endif
+
+
+
 //
 // Externs for interface defined in this module
 //
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+#
+# Report where the receive hot path listed in linker fragment files was placed.
+#
+# Usage: iram_report.py <ev_info_display.map> <linker.lf> [<linker.lf> ...]
+#
+# Each object:symbol entry of the fragments is looked up in the linker map and
+# its code and read-only data sections listed with their size and the memory
+# they ended up in (IRAM, DRAM or flash/PSRAM through the cache).  Symbols the
+# compiler inlined into their callers have no sections of their own and are
+# shown as such.  The static data of the objects involved is summarized by
+# output section to confirm it is in internal DRAM.  Run by the iram_report
+# build target.  Only the Python standard library is used.
+#
+# Copyright 2025 Dan Julio
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# It is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software.  If not, see <https://www.gnu.org/licenses/>.
+#
+import re
+import sys
+
+# Output section name prefixes and the memory they are in
+REGIONS = [
+    ('.iram0', 'IRAM'),
+    ('.dram0', 'DRAM'),
+    ('.flash.text', 'flash'),
+    ('.flash.rodata', 'flash'),
+    ('.flash.appdesc', 'flash'),
+    ('.ext_ram', 'PSRAM'),
+    ('.rtc', 'RTC'),
+]
+
+OUT_SECT_RE = re.compile(r'^(\.\S+)(?:\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+))?')
+IN_SECT_RE = re.compile(r'^ (\.\S+)(?:\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*))?$')
+IN_CONT_RE = re.compile(r'^\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*)$')
+OBJ_RE = re.compile(r'lib([^/\\]+)\.a\(([^)]+?)\.c(?:pp)?\.obj\)$')
+ENTRY_RE = re.compile(r'^\s*([\w]+):([\w]+)\s*\((\w+)\)')
+
+
+def region(out_sect):
+    for prefix, name in REGIONS:
+        if out_sect.startswith(prefix):
+            return name
+    return out_sect
+
+
+def read_fragments(paths):
+    """Returns a list of (archive, object, symbol) from the fragment files"""
+    entries = []
+    for path in paths:
+        archive = None
+        with open(path) as f:
+            for line in f:
+                line = line.split('#')[0]
+                m = re.match(r'^\s*archive:\s*lib(\w+)\.a', line)
+                if m:
+                    archive = m.group(1)
+                    continue
+                m = ENTRY_RE.match(line)
+                if m and archive is not None:
+                    entries.append((archive, m.group(1), m.group(2)))
+    return entries
+
+
+def read_map(path):
+    """Returns a list of (output section, input section, size, archive, object)"""
+    sections = []
+    out_sect = None
+    pending = None
+    with open(path, errors='replace') as f:
+        for line in f:
+            line = line.rstrip('\n')
+            if pending is not None:
+                m = IN_CONT_RE.match(line)
+                if m:
+                    sections.append((out_sect, pending, int(m.group(2), 16), m.group(3)))
+                pending = None
+                continue
+            if line.startswith('.'):
+                m = OUT_SECT_RE.match(line)
+                out_sect = m.group(1)
+                continue
+            m = IN_SECT_RE.match(line)
+            if m and out_sect is not None:
+                if m.group(2) is None:
+                    pending = m.group(1)       # Address, size and object on the next line
+                else:
+                    sections.append((out_sect, m.group(1), int(m.group(3), 16), m.group(4)))
+
+    result = []
+    for out_sect, in_sect, size, obj in sections:
+        m = OBJ_RE.search(obj)
+        if m and (size != 0):
+            result.append((out_sect, in_sect, size, m.group(1), m.group(2)))
+    return result
+
+
+def main():
+    if len(sys.argv) < 3:
+        print('Usage: %s <map file> <linker.lf> [<linker.lf> ...]' % sys.argv[0])
+        sys.exit(1)
+
+    entries = read_fragments(sys.argv[2:])
+    sections = read_map(sys.argv[1])
+    totals = {}
+    num_inlined = 0
+
+    print('%-40s %-18s %6s  %s' % ('Symbol', 'Object', 'Bytes', 'Placed'))
+    for archive, obj, sym in entries:
+        found = False
+        for out_sect, in_sect, size, s_archive, s_obj in sections:
+            if (s_archive == archive) and (s_obj == obj) and in_sect.endswith('.' + sym):
+                kind = in_sect[1:].split('.')[0]
+                where = region(out_sect)
+                print('%-40s %-18s %6d  %s (%s)' % (sym, obj, size, where, kind))
+                totals[where] = totals.get(where, 0) + size
+                found = True
+        if not found:
+            print('%-40s %-18s %6s  inlined or not built' % (sym, obj, '-'))
+            num_inlined += 1
+
+    print()
+    print('Placed: ' + ', '.join('%s %d bytes' % (k, v) for k, v in sorted(totals.items())) +
+          ' (%d symbols inlined or not built)' % num_inlined)
+
+    # Static data of the objects on the hot path
+    objects = sorted(set((a, o) for a, o, s in entries))
+    data = {}
+    for out_sect, in_sect, size, s_archive, s_obj in sections:
+        if ((s_archive, s_obj) in objects) and in_sect.startswith(('.bss', '.data', '.sbss', '.sdata')):
+            data[out_sect] = data.get(out_sect, 0) + size
+    print('Static data of ' + ', '.join(o for a, o in objects) + ':')
+    for out_sect, size in sorted(data.items()):
+        print('  %-20s %6d bytes  %s' % (out_sect, size, region(out_sect)))
+
+
+if __name__ == '__main__':
+    main()
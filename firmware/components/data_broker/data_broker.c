@@ -24,26 +24,261 @@
  *
  */
 #include "data_broker.h"
+#include "esp_heap_caps.h"
+#ifdef DB_LOCK_STATS
+#include "esp_cpu.h"
+#endif
+#include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "tune_utilities.h"
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// Local constants
+//
+
+// Updated-item bitset is kept in 32-bit words so it can be updated with native atomics
+#define DB_UPDATED_WORDS    (DB_MAX_ITEMS / 32)
+
+// Derived item types
+#define DERIVED_PRODUCT     0         // out = gain * in_a * in_b, computed when in_b updates
+#define DERIVED_INTEGRAL    1         // out += gain * in_a * dt(sec), computed when in_a updates
+#define DERIVED_FUSION      2         // out += gain * (in_a - bias) * dt(sec) when in_a updates,
+                                      // complementary correction toward in_b when in_b updates
+#define DERIVED_ACCUM       3         // out += max(gain * in_a, 0) * dt(sec) when in_a updates, only
+                                      // while in_b (if set) is current and positive
+#define DERIVED_TRIP_RATIO  4         // out = gain * ratio of trip accumulators when in_a or in_b updates
+#define DERIVED_WINDOW      5         // out = net Wh/km over the last gain km when in_a (trip distance)
+                                      // updates (in_b only makes it depend on the traction energy)
+#define DERIVED_RANGE       6         // out = gain (usable kWh) * in_a (SoC) / long window (or trip)
+                                      // Wh/km when in_a updates (in_b only marks the dependency)
+#define DERIVED_SPLIT       7         // out = gain * |in_a| / (|in_a| + |in_b|), aligned like a product
+#define DERIVED_SLOPE       8         // out = gain * windowed regression slope of in_a over the trip
+                                      // distance in_b (or over time for DB_ITEM_NONE) when in_a updates
+
+// Integration restarts after a gap in its input longer than this
+#define DERIVED_MAX_GAP_USEC (5 * 1000 * 1000)
+
+// Slope fits use exact fixed-point sums: elevation in dm against distance in dm or time in
+// mSec.  Positions are rebased to the oldest sample before the sums could overflow.
+#define SLOPE_Y_PER_M       10
+#define SLOPE_X_PER_KM      10000.0
+#define SLOPE_X_PER_USEC    0.001
+#define SLOPE_MAX_X         (1 << 24)
+#define SLOPE_MAX_ELEV_M    10000.0   // Larger elevations are taken as corrupt
+
+
+
+//
+// Local typedefs
+//
+typedef struct {
+	db_item_handler fcn;                   // NULL for the GUI subscriber (uses the GUI handler lists)
+	uint32_t interest_bits[DB_UPDATED_WORDS];
+	uint32_t pending_bits[DB_UPDATED_WORDS];   // Set by producer, claimed by subscriber (atomic)
+	float snap_value_list[DB_MAX_ITEMS];       // Subscriber-side copies so handlers run with nothing held
+	float snap_filtered_list[DB_MAX_ITEMS];
+	int64_t snap_timestamp[DB_MAX_ITEMS];
+	float deadband[DB_MAX_ITEMS];              // Minimum change from the last delivered value (0 = any)
+	uint32_t min_interval_msec[DB_MAX_ITEMS];  // Minimum time between deliveries (0 = none)
+	float last_val[DB_MAX_ITEMS];              // Last delivered value
+	int64_t last_usec[DB_MAX_ITEMS];           // Time of last delivery (0 = never delivered)
+} db_subscriber_t;
+
+typedef struct {
+	int type;                              // DB_FILTER_*
+	float alpha;                           // EMA weight
+	int taps;                              // Boxcar length
+	int count;                             // Samples seen since the filter was configured
+	int64_t sum;                           // Boxcar sum of fixed-point history values
+} db_item_filter_t;
+
+typedef struct {
+	db_hist_sample_t* bufP;                // NULL if history not enabled for the item
+	int len;
+	volatile uint32_t write_count;         // Total samples written (next write index = write_count % len)
+} db_hist_ring_t;
+
+typedef struct {
+	int out;
+	int type;                              // DERIVED_*
+	int in_a;
+	int in_b;                              // DB_ITEM_NONE for integrals
+	float gain;                            // 0 = item unavailable
+	int align;                             // DB_ALIGN_* for products
+	int64_t window_usec;                   // Pairing window for DB_ALIGN_PAIR
+	int64_t out_usec;                      // Sample time of the last product
+	int64_t used_a_usec;                   // Input sample times already paired
+	int64_t used_b_usec;
+	double acc;                            // Integral state
+	float prev_val;
+	int64_t prev_usec;                     // 0 = integral (re)starting
+	float bias;                            // Fusion: estimated in_a offset
+} db_derived_t;
+
+typedef struct {
+	int32_t x[DB_SLOPE_WINDOW];            // Positions relative to the origin
+	int32_t y[DB_SLOPE_WINDOW];            // Filtered elevations
+	int count;
+	int next;                              // Next write (the oldest sample once full)
+	int64_t sx, sy, sxx, sxy;              // Sums over the window
+	double origin;                         // Trip km or uSec at x = 0
+	int32_t med[3];                        // Last raw elevations for the median
+	int med_count;
+	int reject_run;                        // Consecutive samples rejected by the residual gate
+} db_slope_t;
+
 
 
 //
 // Module variables
 //
-static bool gui_item_fast_average = false;
-static gui_item_value_handler gui_handler_list[DB_MAX_ITEMS];
-static float gui_item_value_list[2][DB_MAX_ITEMS];
-static uint32_t gui_item_updated_mask;
+static const char* TAG = "data_broker";
+
+static gui_item_value_handler gui_handler_list[DB_MAX_ITEMS][DB_MAX_GUI_HANDLERS];
+static gui_item_update_handler gui_item_handler_list[DB_MAX_ITEMS];   // Table-driven tiles
+static gui_batch_handler gui_batch_fcn = NULL;         // Tile handler for a set of items per evaluation
+static db_mask_t gui_batch_mask = 0;
+static float gui_item_value_list[2][DB_MAX_ITEMS];     // Current and previous raw values
+static float item_filtered_list[DB_MAX_ITEMS];
+static db_item_filter_t item_filter[DB_MAX_ITEMS];
+static uint32_t item_update_count[DB_MAX_ITEMS];   // Free-running, for poll-rate statistics
+static int64_t item_timestamp[DB_MAX_ITEMS];       // esp_timer uSec when the current value was acquired (0 = never)
+static int64_t item_prev_timestamp[DB_MAX_ITEMS];  // When the previous value was acquired
+static db_hist_ring_t item_history[DB_MAX_ITEMS];
+
+// Item quality.  Changes are flagged in quality_changed_bits for the GUI.
+static volatile uint8_t item_quality[DB_MAX_ITEMS];
+static uint32_t item_stale_msec[DB_MAX_ITEMS];     // 0 = never stale
+static uint32_t quality_changed_bits[DB_UPDATED_WORDS];
+static gui_item_quality_handler gui_quality_handler = NULL;
+static esp_timer_handle_t quality_timer;
+
+// Sequence lock protecting the value and timestamp lists.  Writers serialize on writer_mux
+// (held only while storing a value) and make the sequence odd while updating.  Readers never
+// block writers; they retry their copy if the sequence changed underneath them.
+static volatile uint32_t update_seq = 0;
+static portMUX_TYPE writer_mux = portMUX_INITIALIZER_UNLOCKED;
+#ifdef DB_LOCK_STATS
+static db_lock_stats_t lock_stats;          // Writer counts under writer_mux, reader counts atomic
+#endif
+
+// Serializes fusion state updates from its two producers
+static portMUX_TYPE fusion_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Serializes trip accumulator updates from their producers and the application
+static portMUX_TYPE trip_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Subscribers
+static db_subscriber_t subscriber_list[DB_MAX_SUBSCRIBERS];
+
+// Battery cell arrays (protected by the value sequence lock)
+static db_cell_array_t cell_array[DB_NUM_CELL_ARRAYS];
+
+// Acquisition time given to restored values (older than anything acquired)
+#define RESTORED_TS_USEC    1
+
+// Filter results
+#define FILTER_DELIVER      0
+#define FILTER_DROP         1
+#define FILTER_DEFER        2
+static int num_subscribers = 0;
+
+// Items published by on-board sensors
+static db_mask_t local_item_mask = 0;
+
+// GUI task wakeup on new data
+static TaskHandle_t gui_notify_task = NULL;
+static uint32_t gui_notify_bits;
+
+// Derived items, evaluated in the producer's context when their inputs are set.  Motor
+// power gains depend on the drivetrain and are set by the vehicle.  Products interpolate by
+// default since their inputs are usually acquired by different requests.
+static db_derived_t derived_list[] = {
+	{DB_ITEM_HV_POWER_KW,   DERIVED_PRODUCT,  DB_ITEM_HV_BATT_V,   DB_ITEM_HV_BATT_I,    0.001,      DB_ALIGN_INTERP, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_HV_ENERGY_KWH, DERIVED_INTEGRAL, DB_ITEM_HV_POWER_KW, DB_ITEM_NONE,         1.0/3600.0, DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_FRONT_MECH_KW, DERIVED_PRODUCT,  DB_ITEM_SPEED,       DB_ITEM_FRONT_TORQUE, 0,          DB_ALIGN_INTERP, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_REAR_MECH_KW,  DERIVED_PRODUCT,  DB_ITEM_SPEED,       DB_ITEM_REAR_TORQUE,  0,          DB_ALIGN_INTERP, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_FUSED_SPEED,   DERIVED_FUSION,   DB_ITEM_LONG_ACCEL,  DB_ITEM_SPEED,        9.80665*3.6, DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_TRIP_TRACTION_KWH, DERIVED_ACCUM, DB_ITEM_HV_POWER_KW, DB_ITEM_NONE,      -1.0/3600.0, DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_TRIP_REGEN_KWH,    DERIVED_ACCUM, DB_ITEM_HV_POWER_KW, DB_ITEM_SPEED,     1.0/3600.0,  DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_TRIP_AUX_KWH,      DERIVED_ACCUM, DB_ITEM_AUX_KW,      DB_ITEM_NONE,      1.0/3600.0,  DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_TRIP_DIST_KM,      DERIVED_ACCUM, DB_ITEM_SPEED,       DB_ITEM_NONE,      1.0/3600.0,  DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_TRIP_WH_PER_KM,    DERIVED_TRIP_RATIO, DB_ITEM_TRIP_TRACTION_KWH, DB_ITEM_TRIP_DIST_KM,     1000.0, DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_TRIP_REGEN_PCT,    DERIVED_TRIP_RATIO, DB_ITEM_TRIP_REGEN_KWH,    DB_ITEM_TRIP_TRACTION_KWH, 100.0, DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_TRIP_AUX_PCT,      DERIVED_TRIP_RATIO, DB_ITEM_TRIP_AUX_KWH,      DB_ITEM_TRIP_TRACTION_KWH, 100.0, DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_WH_PER_KM_SHORT,   DERIVED_WINDOW, DB_ITEM_TRIP_DIST_KM, DB_ITEM_TRIP_TRACTION_KWH, DB_EFF_SHORT_KM, DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_WH_PER_KM_LONG,    DERIVED_WINDOW, DB_ITEM_TRIP_DIST_KM, DB_ITEM_TRIP_TRACTION_KWH, DB_EFF_LONG_KM,  DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_RANGE_KM,          DERIVED_RANGE,  DB_ITEM_HV_SOC,       DB_ITEM_TRIP_WH_PER_KM,    0,              DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_FRONT_SPLIT_PCT,   DERIVED_SPLIT,  DB_ITEM_FRONT_TORQUE, DB_ITEM_REAR_TORQUE,       100.0,          DB_ALIGN_PAIR,   DB_SPLIT_PAIR_MSEC * 1000, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_ROAD_GRADE_PCT,    DERIVED_SLOPE,  DB_ITEM_GPS_ELEVATION, DB_ITEM_TRIP_DIST_KM,     100.0,          DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0},
+	{DB_ITEM_CLIMB_RATE,        DERIVED_SLOPE,  DB_ITEM_GPS_ELEVATION, DB_ITEM_NONE,             1.0,            DB_ALIGN_LATEST, 0, 0, 0, 0, 0, 0, 0, 0}
+};
+
+#define NUM_DERIVED (sizeof(derived_list) / sizeof(derived_list[0]))
+
+// Trip accumulators in derived_list, indexed by TRIP_ACC_*
+#define TRIP_ACC_TRACTION   0
+#define TRIP_ACC_REGEN      1
+#define TRIP_ACC_AUX        2
+#define TRIP_ACC_DIST       3
+#define TRIP_NUM_ACC        4
+static db_derived_t* trip_acc_list[TRIP_NUM_ACC];
 
-static SemaphoreHandle_t update_mutex;
+// Sliding efficiency windows: net trip energy (kWh) when the trip distance reached each
+// 1/DB_EFF_BUCKETS_PER_KM km boundary, indexed by boundary number modulo EFF_RING_LEN.  Boundaries
+// eff_first_bucket up to (but not including) eff_next_bucket are valid.  Under trip_mux.
+#define EFF_LONG_BUCKETS    (DB_EFF_LONG_KM * DB_EFF_BUCKETS_PER_KM)
+#define EFF_RING_LEN        (EFF_LONG_BUCKETS + 1)
+static double eff_ring_kwh[EFF_RING_LEN];
+static uint32_t eff_first_bucket = 0;
+static uint32_t eff_next_bucket = 0;
+
+// Grade and climb rate fits, indexed by SLOPE_*.  Only the elevation's producer uses them.
+#define SLOPE_GRADE         0
+#define SLOPE_CLIMB         1
+static db_slope_t slope_list[2];
 
 
 //
 // Forward declarations
 //
-static int _db_mask_to_index(uint32_t mask);
+static int _db_item_to_index(int item);
+static void _db_gui_add_interest(int n);
+static void _db_history_push(db_hist_ring_t* hP, float val, int64_t ts_usec);
+static void _db_write_begin();
+static void _db_write_end();
+static uint32_t _db_read_begin();
+static bool _db_read_retry(uint32_t seq);
+static void _db_bits_from_mask(db_mask_t mask, uint32_t* bits);
+static bool _db_claim_updates(db_subscriber_t* sP, uint32_t* bits);
+static int _db_filter(db_subscriber_t* sP, int i, float val, int64_t cur_usec);
+static void _db_reset_filters(db_subscriber_t* sP);
+static float _db_item_filter(int n, float val);
+static void _db_store_value(int n, float val, int64_t ts_usec);
+static void _db_flag_updates(const uint32_t* bits);
+static void _db_eval_derived(int n, float val, int64_t ts_usec);
+static void _db_eval_fusion(db_derived_t* dP, int n, float val, int64_t ts_usec);
+static void _db_eval_accum(db_derived_t* dP, int n, float val, int64_t ts_usec);
+static void _db_eval_trip_ratio(db_derived_t* dP, int64_t ts_usec);
+static void _db_eval_window(db_derived_t* dP, int64_t ts_usec);
+static void _db_eval_range(db_derived_t* dP, float soc, int64_t ts_usec);
+static void _db_eff_reset(double dist);
+static void _db_eff_update();
+static bool _db_eff_window(int num_buckets, float* wh_per_km);
+static void _db_eval_slope(db_derived_t* dP, float val, int64_t ts_usec);
+static void _db_slope_reset(db_slope_t* sP, double origin);
+static void _db_slope_rebase(db_slope_t* sP, double scale);
+static db_derived_t* _db_find_derived(int item);
+static void _db_set_quality(int n, int quality);
+static void _db_quality_timer_cb(void* arg);
+static void _db_eval_product(db_derived_t* dP, int n);
 
 
 
@@ -52,90 +287,1789 @@ static int _db_mask_to_index(uint32_t mask);
 //
 esp_err_t db_init()
 {
+	esp_err_t ret;
+	
 	for (int i=0; i<DB_MAX_ITEMS; i++) {
-		gui_handler_list[i] = NULL;
+		for (int j=0; j<DB_MAX_GUI_HANDLERS; j++) {
+			gui_handler_list[i][j] = NULL;
+		}
+		gui_item_handler_list[i] = NULL;
 		gui_item_value_list[0][i] = 0;
+		item_filtered_list[i] = 0;
+		item_filter[i].type = DB_FILTER_NONE;
+		item_update_count[i] = 0;
+		item_timestamp[i] = 0;
+		item_history[i].bufP = NULL;
+		item_history[i].len = 0;
+		item_history[i].write_count = 0;
+		item_quality[i] = DB_QUALITY_NONE;
+		item_stale_msec[i] = DB_STALE_DEFAULT_MSEC;
+	}
+	memset(quality_changed_bits, 0, sizeof(quality_changed_bits));
+	memset(cell_array, 0, sizeof(cell_array));
+	db_catalog_reset_ranges();
+	db_alert_init();
+	
+	trip_acc_list[TRIP_ACC_TRACTION] = _db_find_derived(DB_ITEM_TRIP_TRACTION_KWH);
+	trip_acc_list[TRIP_ACC_REGEN] = _db_find_derived(DB_ITEM_TRIP_REGEN_KWH);
+	trip_acc_list[TRIP_ACC_AUX] = _db_find_derived(DB_ITEM_TRIP_AUX_KWH);
+	trip_acc_list[TRIP_ACC_DIST] = _db_find_derived(DB_ITEM_TRIP_DIST_KM);
+	
+	// The GUI subscriber's interest is the set of items with registered handlers
+	memset(subscriber_list, 0, sizeof(subscriber_list));
+	num_subscribers = 1;
+	
+	// One timer ages all items
+	const esp_timer_create_args_t quality_timer_args = {
+		.callback = &_db_quality_timer_cb,
+		.arg = NULL,
+		.name = "db quality timer"
+	};
+	ret = esp_timer_create(&quality_timer_args, &quality_timer);
+	if (ret == ESP_OK) {
+		ret = esp_timer_start_periodic(quality_timer, DB_QUALITY_CHECK_MSEC * 1000);
+	}
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Could not start quality timer - %d", ret);
+	}
+	
+	return ret;
+}
+
+
+// Configure the smoothing filter for an item.  Boxcar filters require (and enable if
+// necessary) a history ring at least param samples long.
+bool db_set_item_filter(int item, int type, float param)
+{
+	db_item_filter_t f = {type, 1.0, 1, 0, 0};
+	int n;
+	
+	n = _db_item_to_index(item);
+	if (n < 0) {
+		return false;
 	}
 	
-	update_mutex = xSemaphoreCreateMutex();
-	return (update_mutex == NULL) ? ESP_FAIL : ESP_OK;
+	switch (type) {
+		case DB_FILTER_NONE:
+		case DB_FILTER_MEDIAN3:
+			break;
+		case DB_FILTER_EMA:
+			if ((param <= 0) || (param > 1)) return false;
+			f.alpha = param;
+			break;
+		case DB_FILTER_BOXCAR:
+			f.taps = (int) param;
+			if (f.taps < 1) return false;
+			if (!db_enable_history(item, f.taps) && (item_history[n].len < f.taps)) {
+				return false;
+			}
+			break;
+		default:
+			return false;
+	}
+	
+	_db_write_begin();
+	item_filter[n] = f;
+	item_filtered_list[n] = gui_item_value_list[0][n];
+	_db_write_end();
+	
+	return true;
 }
 
 
-void db_enable_fast_average(bool en)
+// Apply the default GUI smoothing to a set of items: each item's catalog filter for fast
+// interfaces, none for slow ones where averaging would only add lag.  A tuned EMA weight
+// replaces the catalog weight of EMA filtered items.
+void db_set_filter_profile(db_mask_t items, bool fast_interface)
 {
-	gui_item_fast_average = true;
+	const db_signal_t* sigP;
+	float param;
+	
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		if ((items & DB_MASK(i)) != 0) {
+			if (fast_interface) {
+				sigP = db_catalog_get(i);
+				param = sigP->filter_param;
+				if ((sigP->filter_type == DB_FILTER_EMA) && (tune_get(TUNE_EMA_ALPHA_PCT) != 0)) {
+					param = tune_get(TUNE_EMA_ALPHA_PCT) / 100.0f;
+				}
+				(void) db_set_item_filter(i, sigP->filter_type, param);
+			} else {
+				(void) db_set_item_filter(i, DB_FILTER_NONE, 0);
+			}
+		}
+	}
 }
 
 
 void db_gui_eval()
 {
-	xSemaphoreTake(update_mutex, portMAX_DELAY);
-	for (int i=0; i<DB_MAX_ITEMS; i++) {
-		if ((gui_item_updated_mask & (1 << i)) != 0) {
-			if (gui_handler_list[i] != NULL) {
-				if (gui_item_fast_average) {
-					gui_handler_list[i]((gui_item_value_list[0][i] + gui_item_value_list[1][i])/2.0);
-				} else {
-					gui_handler_list[i](gui_item_value_list[0][i]);
+	db_subscriber_t* sP = &subscriber_list[DB_SUBSCRIBER_GUI];
+	float val;
+	int i;
+	int64_t cur_usec;
+	db_mask_t delivered = 0;
+	uint32_t updated_bits[DB_UPDATED_WORDS];
+	uint32_t quality_bits;
+	
+	// Pass quality changes of displayed items first so a handler sees the quality of its value
+	for (int w=0; w<DB_UPDATED_WORDS; w++) {
+		quality_bits = __atomic_exchange_n(&quality_changed_bits[w], 0, __ATOMIC_ACQ_REL);
+		quality_bits &= __atomic_load_n(&sP->interest_bits[w], __ATOMIC_ACQUIRE);
+		while ((quality_bits != 0) && (gui_quality_handler != NULL)) {
+			i = __builtin_ctz(quality_bits);
+			quality_bits &= quality_bits - 1;
+			i += w * 32;
+			gui_quality_handler(i, item_quality[i]);
+		}
+	}
+	
+	if (!_db_claim_updates(sP, updated_bits)) {
+		return;
+	}
+	cur_usec = esp_timer_get_time();
+	
+	// Run the GUI handlers without holding anything the producer needs
+	for (int w=0; w<DB_UPDATED_WORDS; w++) {
+		while (updated_bits[w] != 0) {
+			// Visit only the set bits
+			i = __builtin_ctz(updated_bits[w]);
+			updated_bits[w] &= updated_bits[w] - 1;
+			i += w * 32;
+			
+			val = sP->snap_filtered_list[i];
+			if (_db_filter(sP, i, val, cur_usec) != FILTER_DELIVER) {
+				continue;
+			}
+			delivered |= DB_MASK(i);
+#ifdef DB_LATENCY_TRACE
+			if (sP->snap_timestamp[i] > RESTORED_TS_USEC) {
+				db_lat_note(DB_LAT_STAGE_GUI, sP->snap_timestamp[i]);
+			}
+#endif
+			for (int j=0; j<DB_MAX_GUI_HANDLERS; j++) {
+				if (gui_handler_list[i][j] != NULL) {
+					gui_handler_list[i][j](val);
 				}
 			}
+			if (gui_item_handler_list[i] != NULL) {
+				gui_item_handler_list[i](i, val);
+			}
 		}
 	}
-	gui_item_updated_mask = 0;
-	xSemaphoreGive(update_mutex);
+	
+	// Then the batch handler once with everything of its set delivered this evaluation
+	if ((gui_batch_fcn != NULL) && ((delivered & gui_batch_mask) != 0)) {
+		gui_batch_fcn(delivered & gui_batch_mask, sP->snap_filtered_list);
+	}
+}
+
+
+// Returns the number of times the item has been set since boot
+uint32_t db_get_item_update_count(int item)
+{
+	int n;
+	
+	n = _db_item_to_index(item);
+	
+	return (n >= 0) ? item_update_count[n] : 0;
 }
 
 
-void db_register_gui_callback(uint32_t mask, gui_item_value_handler fcn)
+// Get the most recent value and the time it was acquired.  Either pointer may be NULL.
+// Returns false if the item has never been set.
+bool db_get_data_item(int item, float* val, int64_t* ts_usec)
 {
+	float v = 0;
 	int n;
+	int64_t ts = 0;
+	uint32_t seq;
 	
-	n = _db_mask_to_index(mask);
+	n = _db_item_to_index(item);
 	
 	if (n >= 0) {
-		gui_handler_list[n] = fcn;
-		gui_item_updated_mask &= ~(1 << n);
-		gui_item_value_list[0][n] = 0;
+		do {
+			seq = _db_read_begin();
+			v = gui_item_value_list[0][n];
+			ts = item_timestamp[n];
+		} while (_db_read_retry(seq));
+	}
+	
+	if (val != NULL) *val = v;
+	if (ts_usec != NULL) *ts_usec = ts;
+	
+	return ts != 0;
+}
+
+
+// Returns uSec since the item was acquired, -1 if it has never been set
+int64_t db_get_data_item_age(int item)
+{
+	int64_t ts;
+	
+	if (!db_get_data_item(item, NULL, &ts)) {
+		return -1;
+	}
+	
+	return esp_timer_get_time() - ts;
+}
+
+
+// Returns the item's DB_QUALITY_*
+int db_get_item_quality(int item)
+{
+	int n;
+	
+	n = _db_item_to_index(item);
+	
+	return (n >= 0) ? item_quality[n] : DB_QUALITY_NONE;
+}
+
+
+// Returns the items that have been set but are currently stale or in error
+db_mask_t db_get_unfresh_mask(db_mask_t items)
+{
+	db_mask_t mask = 0;
+	uint8_t q;
+	
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		if ((items & DB_MASK(i)) != 0) {
+			q = item_quality[i];
+			if ((q == DB_QUALITY_STALE) || (q == DB_QUALITY_ERROR)) {
+				mask |= DB_MASK(i);
+			}
+		}
 	}
+	
+	return mask;
 }
 
 
-void db_set_data_item_value(uint32_t mask, float val)
+// Set how long an item may go without being set before it is stale (0 = never stale).
+// Typically a few times the item's polling period.
+void db_set_item_stale_msec(int item, uint32_t stale_msec)
 {
 	int n;
 	
-	n = _db_mask_to_index(mask);
+	n = _db_item_to_index(item);
+	if (n >= 0) {
+		item_stale_msec[n] = stale_msec;
+	}
+}
+
+
+// Called by producers when the item's source failed (e.g. negative response).  The item is
+// marked fresh again when it is next set.  Integrals of the item restart with its next value
+// so the failed interval isn't bridged.
+void db_set_item_error(int item)
+{
+	int n;
 	
-	xSemaphoreTake(update_mutex, portMAX_DELAY);
+	n = _db_item_to_index(item);
 	if (n >= 0) {
-		gui_item_updated_mask |= (1 << n);
-		gui_item_value_list[1][n] = gui_item_value_list[0][n];
-		gui_item_value_list[0][n] = val;
+		_db_set_quality(n, DB_QUALITY_ERROR);
+		
+		for (int i=0; i<NUM_DERIVED; i++) {
+			if ((derived_list[i].in_a == n) && ((derived_list[i].type == DERIVED_INTEGRAL) || (derived_list[i].type == DERIVED_ACCUM))) {
+				taskENTER_CRITICAL(&trip_mux);
+				derived_list[i].prev_usec = 0;
+				taskEXIT_CRITICAL(&trip_mux);
+			}
+		}
+	}
+}
+
+
+// Set the gain of a derived item, e.g. the factor converting motor torque (N-m) times vehicle
+// speed (km/h) to mechanical kW for a particular drivetrain.  A gain of 0 disables the item.
+void db_set_derived_gain(int item, float gain)
+{
+	for (int i=0; i<NUM_DERIVED; i++) {
+		if (derived_list[i].out == item) {
+			derived_list[i].gain = gain;
+			derived_list[i].prev_usec = 0;
+		}
 	}
-	xSemaphoreGive(update_mutex);
 }
 
 
+// Set how the inputs of a derived product are aligned in time.  window_msec is the maximum
+// time between paired samples for DB_ALIGN_PAIR.
+void db_set_derived_align(int item, int align, uint32_t window_msec)
+{
+	for (int i=0; i<NUM_DERIVED; i++) {
+		if ((derived_list[i].out == item) && ((derived_list[i].type == DERIVED_PRODUCT) || (derived_list[i].type == DERIVED_SPLIT))) {
+			derived_list[i].align = align;
+			derived_list[i].window_usec = (int64_t) window_msec * 1000;
+		}
+	}
+}
+
 
-//
-// Internal functions
-//
+// Returns the derived items that can be computed from the available items
+db_mask_t db_get_derived_outputs(db_mask_t available)
+{
+	db_mask_t outputs = 0;
+	db_mask_t inputs;
+	
+	// Repeat so items derived from other derived items are included
+	for (int pass=0; pass<2; pass++) {
+		for (int i=0; i<NUM_DERIVED; i++) {
+			if (derived_list[i].gain == 0) continue;
+			inputs = DB_MASK(derived_list[i].in_a);
+			if (derived_list[i].in_b != DB_ITEM_NONE) {
+				inputs |= DB_MASK(derived_list[i].in_b);
+			}
+			if (((available | outputs) & inputs) == inputs) {
+				outputs |= DB_MASK(derived_list[i].out);
+			}
+		}
+	}
+	
+	return outputs;
+}
+
+
+// Called by on-board sensor producers once they are running
+void db_set_local_items(db_mask_t items)
+{
+	__atomic_fetch_or(&local_item_mask, items, __ATOMIC_RELEASE);
+}
+
+
+db_mask_t db_get_local_items()
+{
+	return __atomic_load_n(&local_item_mask, __ATOMIC_ACQUIRE);
+}
+
+
+// Returns items with the inputs of any derived items they include added
+db_mask_t db_get_derived_inputs(db_mask_t items)
+{
+	for (int pass=0; pass<2; pass++) {
+		for (int i=0; i<NUM_DERIVED; i++) {
+			if ((items & DB_MASK(derived_list[i].out)) != 0) {
+				items |= DB_MASK(derived_list[i].in_a);
+				if (derived_list[i].in_b != DB_ITEM_NONE) {
+					items |= DB_MASK(derived_list[i].in_b);
+				}
+			}
+		}
+	}
+	
+	return items;
+}
+
+
+// Returns the current trip accumulator values
+void db_get_trip_totals(db_trip_totals_t* tP)
+{
+	taskENTER_CRITICAL(&trip_mux);
+	tP->traction_kwh = (float) trip_acc_list[TRIP_ACC_TRACTION]->acc;
+	tP->regen_kwh = (float) trip_acc_list[TRIP_ACC_REGEN]->acc;
+	tP->aux_kwh = (float) trip_acc_list[TRIP_ACC_AUX]->acc;
+	tP->dist_km = (float) trip_acc_list[TRIP_ACC_DIST]->acc;
+	taskEXIT_CRITICAL(&trip_mux);
+}
+
+
+// Load the trip accumulators (e.g. from persistent storage).  NULL resets the trip.  The
+// items are published with their next input sample.
+void db_set_trip_totals(const db_trip_totals_t* tP)
+{
+	taskENTER_CRITICAL(&trip_mux);
+	trip_acc_list[TRIP_ACC_TRACTION]->acc = (tP == NULL) ? 0 : tP->traction_kwh;
+	trip_acc_list[TRIP_ACC_REGEN]->acc = (tP == NULL) ? 0 : tP->regen_kwh;
+	trip_acc_list[TRIP_ACC_AUX]->acc = (tP == NULL) ? 0 : tP->aux_kwh;
+	trip_acc_list[TRIP_ACC_DIST]->acc = (tP == NULL) ? 0 : tP->dist_km;
+	_db_eff_reset(trip_acc_list[TRIP_ACC_DIST]->acc);
+	taskEXIT_CRITICAL(&trip_mux);
+}
+
+
+// Allocate a history ring holding the most recent num_samples values of the item.  Should be
+// called once per item during initialization, before the item starts being updated.
+bool db_enable_history(int item, int num_samples)
+{
+	db_hist_sample_t* bufP;
+	int n;
+	
+	n = _db_item_to_index(item);
+	if ((n < 0) || (num_samples <= 0)) {
+		return false;
+	}
+	
+	if (item_history[n].bufP != NULL) {
+		// Already enabled
+		return item_history[n].len == num_samples;
+	}
+	
+	bufP = (db_hist_sample_t*) heap_caps_malloc(num_samples * sizeof(db_hist_sample_t), MALLOC_CAP_SPIRAM);
+	if (bufP == NULL) {
+		ESP_LOGE(TAG, "Could not allocate %d history samples for item %d", num_samples, n);
+		return false;
+	}
+	
+	// Publish the buffer pointer last so the producer only sees a fully set up ring
+	taskENTER_CRITICAL(&writer_mux);
+	item_history[n].len = num_samples;
+	item_history[n].write_count = 0;
+	__atomic_store_n(&item_history[n].bufP, bufP, __ATOMIC_RELEASE);
+	taskEXIT_CRITICAL(&writer_mux);
+	
+	return true;
+}
+
+
+// Get a view of the item's stored history without copying.  Returns false if history
+// is not enabled for the item.
+bool db_get_history_view(int item, db_hist_view_t* viewP)
+{
+	db_hist_ring_t* hP;
+	int count;
+	int start;
+	int n;
+	uint32_t wc;
+	
+	n = _db_item_to_index(item);
+	if ((n < 0) || (item_history[n].bufP == NULL)) {
+		return false;
+	}
+	hP = &item_history[n];
+	
+	wc = __atomic_load_n(&hP->write_count, __ATOMIC_ACQUIRE);
+	count = (wc < (uint32_t) hP->len) ? (int) wc : hP->len;
+	start = (int) ((wc - count) % hP->len);
+	
+	viewP->item = item;
+	viewP->write_count = wc;
+	viewP->seg1P = &hP->bufP[start];
+	if ((start + count) > hP->len) {
+		viewP->seg1_len = hP->len - start;
+		viewP->seg2P = hP->bufP;
+		viewP->seg2_len = count - viewP->seg1_len;
+	} else {
+		viewP->seg1_len = count;
+		viewP->seg2P = NULL;
+		viewP->seg2_len = 0;
+	}
+	
+	return true;
+}
+
+
+// Returns the number of samples at the start of the view that have been overwritten since
+// the view was taken (these should be skipped)
+int db_get_history_overrun(const db_hist_view_t* viewP)
+{
+	int n;
+	int count;
+	uint32_t written;
+	
+	n = _db_item_to_index(viewP->item);
+	if ((n < 0) || (item_history[n].bufP == NULL)) {
+		return 0;
+	}
+	
+	count = viewP->seg1_len + viewP->seg2_len;
+	written = __atomic_load_n(&item_history[n].write_count, __ATOMIC_ACQUIRE) - viewP->write_count;
+	written += count;                      // Slots used at view time plus those written since
+	if (written <= (uint32_t) item_history[n].len) {
+		return 0;
+	}
+	written -= item_history[n].len;
+	
+	return (written > count) ? count : (int) written;
+}
 
-// Returns -1 if no valid bit found, otherwise returns the first bit found from LSb
-static int _db_mask_to_index(uint32_t mask)
+
+// Compute the minimum, maximum and average of the newest num_samples history values (or all
+// stored values if fewer).  Any of the result pointers may be NULL.  Returns false if there
+// is no history.
+bool db_get_history_stats(int item, int num_samples, float* min, float* max, float* avg)
+{
+	const db_hist_sample_t* sP;
+	db_hist_view_t view;
+	int count;
+	int skip;
+	int32_t v;
+	int32_t v_min = INT32_MAX;
+	int32_t v_max = INT32_MIN;
+	int64_t sum = 0;
+	
+	if (!db_get_history_view(item, &view)) {
+		return false;
+	}
+	
+	count = view.seg1_len + view.seg2_len;
+	if (num_samples < count) {
+		count = num_samples;
+	}
+	if (count <= 0) {
+		return false;
+	}
+	skip = view.seg1_len + view.seg2_len - count;
+	
+	for (int i=skip; i<(skip + count); i++) {
+		sP = (i < view.seg1_len) ? &view.seg1P[i] : &view.seg2P[i - view.seg1_len];
+		v = sP->val;
+		if (v < v_min) v_min = v;
+		if (v > v_max) v_max = v;
+		sum += v;
+	}
+	
+	if (min != NULL) *min = (float) v_min / DB_HIST_SCALE;
+	if (max != NULL) *max = (float) v_max / DB_HIST_SCALE;
+	if (avg != NULL) *avg = (float) sum / count / DB_HIST_SCALE;
+	
+	return true;
+}
+
+
+// Store a complete acquisition of a cell array.  The voltage array also publishes the
+// lowest and highest cell voltage items.
+void db_set_cell_array(int array, int num, const int16_t* vals, int64_t ts_usec)
+{
+	int16_t v_min = INT16_MAX;
+	int16_t v_max = INT16_MIN;
+	
+	if ((array < 0) || (array >= DB_NUM_CELL_ARRAYS) || (num <= 0)) return;
+	if (num > DB_CELL_MAX) num = DB_CELL_MAX;
+	
+	_db_write_begin();
+	memcpy(cell_array[array].val, vals, num * sizeof(int16_t));
+	cell_array[array].num = num;
+	cell_array[array].ts_usec = ts_usec;
+	cell_array[array].update_count += 1;
+	_db_write_end();
+	
+	if (array == DB_CELL_ARRAY_V) {
+		for (int i=0; i<num; i++) {
+			if (vals[i] < v_min) v_min = vals[i];
+			if (vals[i] > v_max) v_max = vals[i];
+		}
+		db_set_data_item_value_ts(DB_ITEM_CELL_MIN_V, (float) v_min / 1000.0f, ts_usec);
+		db_set_data_item_value_ts(DB_ITEM_CELL_MAX_V, (float) v_max / 1000.0f, ts_usec);
+	}
+}
+
+
+// Copy a consistent snapshot of a cell array.  Returns false if it has never been set.
+bool db_get_cell_array(int array, db_cell_array_t* arrayP)
+{
+	uint32_t seq;
+	
+	if ((array < 0) || (array >= DB_NUM_CELL_ARRAYS)) return false;
+	
+	do {
+		seq = _db_read_begin();
+		memcpy(arrayP, &cell_array[array], sizeof(db_cell_array_t));
+	} while (_db_read_retry(seq));
+	
+	return arrayP->update_count != 0;
+}
+
+
+// Returns the array's update count so a consumer can cheaply check for a new acquisition
+uint32_t db_get_cell_array_count(int array)
+{
+	if ((array < 0) || (array >= DB_NUM_CELL_ARRAYS)) return 0;
+	
+	return __atomic_load_n(&cell_array[array].update_count, __ATOMIC_ACQUIRE);
+}
+
+
+// Add a subscriber that will be passed updates to the specified items each time it calls
+// db_subscriber_eval() from its own task.  Returns the subscriber ID or -1 if there is no room.
+int db_add_subscriber(db_mask_t items, db_item_handler fcn)
+{
+	int sub;
+	
+	if ((fcn == NULL) || (num_subscribers >= DB_MAX_SUBSCRIBERS)) {
+		return -1;
+	}
+	
+	sub = num_subscribers;
+	subscriber_list[sub].fcn = fcn;
+	_db_bits_from_mask(items, subscriber_list[sub].interest_bits);
+	
+	// Make the subscriber visible to the producer only once it is set up
+	__atomic_store_n(&num_subscribers, sub + 1, __ATOMIC_RELEASE);
+	
+	return sub;
+}
+
+
+// Change the set of items a subscriber receives
+void db_set_subscriber_items(int sub, db_mask_t items)
+{
+	uint32_t bits[DB_UPDATED_WORDS];
+	
+	if ((sub <= DB_SUBSCRIBER_GUI) || (sub >= num_subscribers)) {
+		return;
+	}
+	
+	_db_bits_from_mask(items, bits);
+	for (int w=0; w<DB_UPDATED_WORDS; w++) {
+		__atomic_store_n(&subscriber_list[sub].interest_bits[w], bits[w], __ATOMIC_RELEASE);
+		__atomic_and_fetch(&subscriber_list[sub].pending_bits[w], bits[w], __ATOMIC_ACQ_REL);
+	}
+}
+
+
+bool db_subscriber_has_updates(int sub)
 {
-	int n = 0;
-	uint32_t shift_mask = 0x00000001;
+	if ((sub < 0) || (sub >= num_subscribers)) {
+		return false;
+	}
 	
-	// Return first set bit position
-	while (n<DB_MAX_ITEMS) {
-		if ((mask & shift_mask) != 0) {
-			return n;
+	for (int w=0; w<DB_UPDATED_WORDS; w++) {
+		if (__atomic_load_n(&subscriber_list[sub].pending_bits[w], __ATOMIC_ACQUIRE) != 0) {
+			return true;
 		}
-		n += 1;
-		shift_mask <<= 1;
 	}
 	
-	return -1;
+	return false;
+}
+
+
+// Pass all updates since the last call to the subscriber's handler
+void db_subscriber_eval(int sub)
+{
+	db_subscriber_t* sP;
+	int i;
+	int64_t cur_usec;
+	uint32_t updated_bits[DB_UPDATED_WORDS];
+	
+	if ((sub <= DB_SUBSCRIBER_GUI) || (sub >= num_subscribers)) {
+		return;
+	}
+	sP = &subscriber_list[sub];
+	
+	if (!_db_claim_updates(sP, updated_bits)) {
+		return;
+	}
+	cur_usec = esp_timer_get_time();
+	
+	for (int w=0; w<DB_UPDATED_WORDS; w++) {
+		while (updated_bits[w] != 0) {
+			i = __builtin_ctz(updated_bits[w]);
+			updated_bits[w] &= updated_bits[w] - 1;
+			i += w * 32;
+			
+			if (_db_filter(sP, i, sP->snap_value_list[i], cur_usec) == FILTER_DELIVER) {
+				sP->fcn(i, sP->snap_value_list[i], sP->snap_timestamp[i]);
+			}
+		}
+	}
+}
+
+
+// Only notify the subscriber of an item when it has changed by at least deadband from the
+// last value delivered, and no more often than min_interval_msec.  Updates held back by the
+// interval are delivered once it expires so the final value is never lost.
+void db_set_subscriber_filter(int sub, int item, float deadband, uint32_t min_interval_msec)
+{
+	int n;
+	
+	n = _db_item_to_index(item);
+	if ((n < 0) || (sub < 0) || (sub >= num_subscribers)) {
+		return;
+	}
+	
+	subscriber_list[sub].deadband[n] = (deadband < 0) ? -deadband : deadband;
+	subscriber_list[sub].min_interval_msec[n] = min_interval_msec;
+	subscriber_list[sub].last_usec[n] = 0;
+}
+
+
+// Add a GUI handler for an item.  Several handlers (e.g. from different tiles) may be
+// registered for the same item.  The item's last-known value (if it has been set) is passed
+// to the handler on the next db_gui_eval() so a newly displayed tile starts from current data.
+void db_register_gui_callback(int item, gui_item_value_handler fcn)
+{
+	int j;
+	int n;
+	
+	n = _db_item_to_index(item);
+	
+	if (n >= 0) {
+		for (j=0; j<DB_MAX_GUI_HANDLERS; j++) {
+			if ((gui_handler_list[n][j] == fcn) || (gui_handler_list[n][j] == NULL)) {
+				gui_handler_list[n][j] = fcn;
+				break;
+			}
+		}
+		if (j == DB_MAX_GUI_HANDLERS) {
+			ESP_LOGE(TAG, "No room for GUI handler for item %d", n);
+			return;
+		}
+		
+		_db_gui_add_interest(n);
+	}
+}
+
+
+// Add a GUI handler that is passed the item along with its value so one handler can serve
+// items chosen at run time (e.g. a table-driven gauge tile).  One per item.
+void db_register_gui_item_callback(int item, gui_item_update_handler fcn)
+{
+	int n;
+	
+	n = _db_item_to_index(item);
+	
+	if (n >= 0) {
+		gui_item_handler_list[n] = fcn;
+		_db_gui_add_interest(n);
+	}
+}
+
+
+// Set a handler called at most once per db_gui_eval() with the items of a set delivered by
+// that evaluation (so a tile can update a display computed from several items at once).
+// vals is indexed by item and only valid for the items in updated.  A tile has one batch
+// handler and may also register per-item handlers for other items.
+void db_register_gui_batch_callback(db_mask_t items, gui_batch_handler fcn)
+{
+	items &= DB_MASK_ALL;
+	gui_batch_mask = items;
+	gui_batch_fcn = fcn;
+	
+	for (int i=1; i<DB_MAX_ITEMS; i++) {
+		if ((items & DB_MASK(i)) != 0) {
+			_db_gui_add_interest(i);
+		}
+	}
+}
+
+
+// Set the handler called from db_gui_eval() when the quality of an item with a registered
+// GUI handler changes
+void db_register_gui_quality_callback(gui_item_quality_handler fcn)
+{
+	gui_quality_handler = fcn;
+}
+
+
+// The task is notified with notify_bits when a GUI-registered item is updated while
+// nothing else was pending for the GUI
+void db_set_gui_notify(TaskHandle_t task, uint32_t notify_bits)
+{
+	gui_notify_bits = notify_bits;
+	__atomic_store_n(&gui_notify_task, task, __ATOMIC_RELEASE);
+}
+
+
+// Remove all GUI handlers and filters (called by the GUI when the displayed tile changes)
+void db_clear_gui_callbacks()
+{
+	for (int i=0; i<DB_MAX_ITEMS; i++) {
+		for (int j=0; j<DB_MAX_GUI_HANDLERS; j++) {
+			gui_handler_list[i][j] = NULL;
+		}
+		gui_item_handler_list[i] = NULL;
+	}
+	for (int w=0; w<DB_UPDATED_WORDS; w++) {
+		__atomic_store_n(&subscriber_list[DB_SUBSCRIBER_GUI].interest_bits[w], 0, __ATOMIC_RELEASE);
+	}
+	gui_quality_handler = NULL;
+	gui_batch_fcn = NULL;
+	gui_batch_mask = 0;
+	_db_reset_filters(&subscriber_list[DB_SUBSCRIBER_GUI]);
+}
+
+
+// Seed an item that has not been set yet with a value saved from a previous power cycle.
+// The value is marked stale and is not passed to subscribers, the history or derived items,
+// but a GUI handler registered for the item is passed it.
+void db_restore_data_item(int item, float val)
+{
+	int n;
+	
+	n = _db_item_to_index(item);
+	
+	if ((n >= 0) && (item_timestamp[n] == 0)) {
+		_db_write_begin();
+		gui_item_value_list[0][n] = val;
+		gui_item_value_list[1][n] = val;
+		item_filtered_list[n] = val;
+		item_timestamp[n] = RESTORED_TS_USEC;
+		_db_write_end();
+		
+		_db_set_quality(n, DB_QUALITY_STALE);
+	}
+}
+
+
+void db_set_data_item_value(int item, float val)
+{
+	db_set_data_item_value_ts(item, val, esp_timer_get_time());
+}
+
+
+// Set an item value with the time (esp_timer uSec) the underlying data was received
+void db_set_data_item_value_ts(int item, float val, int64_t ts_usec)
+{
+	int n;
+	uint32_t bits[DB_UPDATED_WORDS] = {0};
+	
+	n = _db_item_to_index(item);
+	
+	if (n >= 0) {
+		_db_write_begin();
+		_db_store_value(n, val, ts_usec);
+		_db_write_end();
+		
+		if (item_quality[n] != DB_QUALITY_FRESH) {
+			_db_set_quality(n, DB_QUALITY_FRESH);
+		}
+		
+		bits[n / 32] = 1UL << (n % 32);
+		_db_flag_updates(bits);
+		db_alert_eval(n, val);
+		
+		// Update any items derived from this one
+		_db_eval_derived(n, val, ts_usec);
+	}
+}
+
+
+// Start staging item values to be published together
+void db_batch_begin(db_batch_t* bP)
+{
+	bP->num = 0;
+}
+
+
+// Stage an item value with the time (esp_timer uSec) the underlying data was received
+void db_batch_add(db_batch_t* bP, int item, float val, int64_t ts_usec)
+{
+	if (_db_item_to_index(item) < 0) {
+		return;
+	}
+	
+	if (bP->num >= DB_BATCH_MAX_ITEMS) {
+		db_batch_commit(bP);
+	}
+	bP->item[bP->num] = (uint8_t) item;
+	bP->val[bP->num] = val;
+	bP->ts_usec[bP->num] = ts_usec;
+	bP->num += 1;
+}
+
+
+// Publish the staged values.  They are stored under a single writer lock and flagged to
+// the subscribers together so readers never see only some of them updated.  Derived items
+// are then updated in the order the values were staged.
+void db_batch_commit(db_batch_t* bP)
+{
+	int n;
+	uint32_t bits[DB_UPDATED_WORDS] = {0};
+	
+	if (bP->num == 0) {
+		return;
+	}
+	
+	_db_write_begin();
+	for (int i=0; i<bP->num; i++) {
+		n = bP->item[i];
+		_db_store_value(n, bP->val[i], bP->ts_usec[i]);
+		bits[n / 32] |= 1UL << (n % 32);
+	}
+	_db_write_end();
+#ifdef DB_LATENCY_TRACE
+	db_lat_note(DB_LAT_STAGE_PUBLISH, bP->ts_usec[0]);
+#endif
+	
+	for (int i=0; i<bP->num; i++) {
+		n = bP->item[i];
+		if (item_quality[n] != DB_QUALITY_FRESH) {
+			_db_set_quality(n, DB_QUALITY_FRESH);
+		}
+	}
+	
+	_db_flag_updates(bits);
+	
+	for (int i=0; i<bP->num; i++) {
+		db_alert_eval(bP->item[i], bP->val[i]);
+	}
+	
+	for (int i=0; i<bP->num; i++) {
+		_db_eval_derived(bP->item[i], bP->val[i], bP->ts_usec[i]);
+	}
+	bP->num = 0;
+}
+
+
+#ifdef DB_LOCK_STATS
+void db_get_lock_stats(db_lock_stats_t* sP, bool reset)
+{
+	taskENTER_CRITICAL(&writer_mux);
+	*sP = lock_stats;
+	if (reset) {
+		memset(&lock_stats, 0, sizeof(lock_stats));
+	}
+	taskEXIT_CRITICAL(&writer_mux);
+}
+#endif
+
+
+
+//
+// Internal functions
+//
+static void _db_bits_from_mask(db_mask_t mask, uint32_t* bits)
+{
+	for (int w=0; w<DB_UPDATED_WORDS; w++) {
+		bits[w] = (uint32_t) (mask >> (w * 32));
+	}
+}
+
+
+// Claim a subscriber's pending updates and copy the claimed items' values.  An item updated
+// after the claim is copied with its newer value and delivered again on the next claim.
+// Returns false if there was nothing pending.
+static bool _db_claim_updates(db_subscriber_t* sP, uint32_t* bits)
+{
+	bool any_updated = false;
+	int i;
+	uint32_t b;
+	uint32_t seq;
+	
+	for (int w=0; w<DB_UPDATED_WORDS; w++) {
+		bits[w] = __atomic_exchange_n(&sP->pending_bits[w], 0, __ATOMIC_ACQ_REL);
+		any_updated |= (bits[w] != 0);
+	}
+	if (!any_updated) {
+		return false;
+	}
+	
+	do {
+		seq = _db_read_begin();
+		for (int w=0; w<DB_UPDATED_WORDS; w++) {
+			b = bits[w];
+			while (b != 0) {
+				i = __builtin_ctz(b) + w * 32;
+				b &= b - 1;
+				sP->snap_value_list[i] = gui_item_value_list[0][i];
+				sP->snap_filtered_list[i] = item_filtered_list[i];
+				sP->snap_timestamp[i] = item_timestamp[i];
+			}
+		}
+	} while (_db_read_retry(seq));
+	
+	return true;
+}
+
+
+static int _db_filter(db_subscriber_t* sP, int i, float val, int64_t cur_usec)
+{
+	float delta;
+	
+	if (sP->last_usec[i] != 0) {
+		if ((cur_usec - sP->last_usec[i]) < ((int64_t) sP->min_interval_msec[i] * 1000)) {
+			// Too soon: leave it pending for a later evaluation
+			__atomic_or_fetch(&sP->pending_bits[i / 32], 1UL << (i % 32), __ATOMIC_RELEASE);
+			return FILTER_DEFER;
+		}
+		
+		delta = val - sP->last_val[i];
+		if (delta < 0) delta = -delta;
+		if ((sP->deadband[i] > 0) && (delta < sP->deadband[i])) {
+			return FILTER_DROP;
+		}
+	}
+	
+	sP->last_val[i] = val;
+	sP->last_usec[i] = cur_usec;
+	
+	return FILTER_DELIVER;
+}
+
+
+// Compute the new filtered value for item n.  Called with the writer lock held, before
+// val is stored as the current value and pushed into the history ring.
+static float _db_item_filter(int n, float val)
+{
+	db_item_filter_t* fP = &item_filter[n];
+	db_hist_ring_t* hP = &item_history[n];
+	float a, b, t;
+	
+	switch (fP->type) {
+		case DB_FILTER_EMA:
+			if (fP->count++ == 0) {
+				return val;
+			}
+			return item_filtered_list[n] + fP->alpha * (val - item_filtered_list[n]);
+		
+		case DB_FILTER_BOXCAR:
+			// Running sum of the fixed-point values: add the new sample, remove the one
+			// falling out of the window (still in the ring since len >= taps)
+			fP->sum += (int64_t) (val * DB_HIST_SCALE);
+			if (fP->count < fP->taps) {
+				fP->count++;
+			} else {
+				fP->sum -= hP->bufP[(hP->write_count - fP->taps) % hP->len].val;
+			}
+			return (float) fP->sum / fP->count / DB_HIST_SCALE;
+		
+		case DB_FILTER_MEDIAN3:
+			if (fP->count < 2) {
+				fP->count++;
+				return val;
+			}
+			a = gui_item_value_list[0][n];
+			b = gui_item_value_list[1][n];
+			if (a > b) {
+				t = a;
+				a = b;
+				b = t;
+			}
+			return (val < a) ? a : ((val > b) ? b : val);
+		
+		default:
+			return val;
+	}
+}
+
+
+// Store a new value for item n.  Called with the writer lock held.
+static void _db_store_value(int n, float val, int64_t ts_usec)
+{
+	item_filtered_list[n] = _db_item_filter(n, val);
+	gui_item_value_list[1][n] = gui_item_value_list[0][n];
+	gui_item_value_list[0][n] = val;
+	item_update_count[n] += 1;
+	item_prev_timestamp[n] = item_timestamp[n];
+	item_timestamp[n] = ts_usec;
+	if (item_history[n].bufP != NULL) {
+		_db_history_push(&item_history[n], val, ts_usec);
+	}
+}
+
+
+// Flag updated items (bit per item) to interested subscribers after their values are
+// visible
+static void _db_flag_updates(const uint32_t* bits)
+{
+	bool wake_gui = false;
+	uint32_t b;
+	uint32_t prev_bits;
+	TaskHandle_t task;
+	
+	for (int i=0; i<__atomic_load_n(&num_subscribers, __ATOMIC_ACQUIRE); i++) {
+		for (int w=0; w<DB_UPDATED_WORDS; w++) {
+			b = bits[w] & __atomic_load_n(&subscriber_list[i].interest_bits[w], __ATOMIC_ACQUIRE);
+			if (b != 0) {
+				prev_bits = __atomic_fetch_or(&subscriber_list[i].pending_bits[w], b, __ATOMIC_RELEASE);
+				if ((i == DB_SUBSCRIBER_GUI) && (prev_bits == 0)) {
+					wake_gui = true;
+				}
+			}
+		}
+	}
+	
+	// Wake the GUI only for items it displays, and once per batch of updates
+	task = __atomic_load_n(&gui_notify_task, __ATOMIC_ACQUIRE);
+	if (wake_gui && (task != NULL)) {
+		xTaskNotify(task, gui_notify_bits, eSetBits);
+	}
+}
+
+
+// Change an item's quality, waking the GUI if it displays the item
+static void _db_set_quality(int n, int quality)
+{
+	TaskHandle_t task;
+	
+	if (item_quality[n] == quality) {
+		return;
+	}
+	item_quality[n] = quality;
+	
+	// An alert can't stand on a value that is no longer current
+	if (quality == DB_QUALITY_STALE) {
+		db_alert_clear_item(n);
+	}
+	
+	// Quality changes are rare so the GUI is always woken for displayed items
+	__atomic_fetch_or(&quality_changed_bits[n / 32], 1UL << (n % 32), __ATOMIC_RELEASE);
+	task = __atomic_load_n(&gui_notify_task, __ATOMIC_ACQUIRE);
+	if ((task != NULL) &&
+	    ((__atomic_load_n(&subscriber_list[DB_SUBSCRIBER_GUI].interest_bits[n / 32], __ATOMIC_ACQUIRE) & (1UL << (n % 32))) != 0)) {
+		xTaskNotify(task, gui_notify_bits, eSetBits);
+	}
+}
+
+
+// Runs every DB_QUALITY_CHECK_MSEC to mark items that have not been set recently as stale
+static void _db_quality_timer_cb(void* arg)
+{
+	int64_t cur_usec;
+	int64_t ts;
+	
+	cur_usec = esp_timer_get_time();
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		if ((item_quality[i] != DB_QUALITY_FRESH) || (item_stale_msec[i] == 0)) continue;
+		
+		ts = __atomic_load_n(&item_timestamp[i], __ATOMIC_RELAXED);
+		if ((cur_usec - ts) > ((int64_t) item_stale_msec[i] * 1000)) {
+			_db_set_quality(i, DB_QUALITY_STALE);
+		}
+	}
+}
+
+
+// Recompute the derived items triggered by an update of item n
+static void _db_eval_derived(int n, float val, int64_t ts_usec)
+{
+	db_derived_t* dP;
+	int64_t dt;
+	
+	for (int i=0; i<NUM_DERIVED; i++) {
+		dP = &derived_list[i];
+		if (dP->gain == 0) continue;
+		
+		if (((dP->type == DERIVED_PRODUCT) || (dP->type == DERIVED_SPLIT)) && ((dP->in_a == n) || (dP->in_b == n))) {
+			_db_eval_product(dP, n);
+		} else if ((dP->type == DERIVED_INTEGRAL) && (dP->in_a == n)) {
+			// Trapezoidal integration over the sample timestamps
+			dt = ts_usec - dP->prev_usec;
+			if ((dP->prev_usec != 0) && (dt > 0) && (dt < DERIVED_MAX_GAP_USEC)) {
+				dP->acc += (double) dP->gain * (double) (dP->prev_val + val) / 2.0 * ((double) dt / 1000000.0);
+				db_set_data_item_value_ts(dP->out, (float) dP->acc, ts_usec);
+			}
+			dP->prev_val = val;
+			dP->prev_usec = ts_usec;
+		} else if ((dP->type == DERIVED_FUSION) && ((dP->in_a == n) || (dP->in_b == n))) {
+			_db_eval_fusion(dP, n, val, ts_usec);
+		} else if ((dP->type == DERIVED_ACCUM) && (dP->in_a == n)) {
+			_db_eval_accum(dP, n, val, ts_usec);
+		} else if ((dP->type == DERIVED_TRIP_RATIO) && ((dP->in_a == n) || (dP->in_b == n))) {
+			_db_eval_trip_ratio(dP, ts_usec);
+		} else if ((dP->type == DERIVED_WINDOW) && (dP->in_a == n)) {
+			_db_eval_window(dP, ts_usec);
+		} else if ((dP->type == DERIVED_RANGE) && (dP->in_a == n)) {
+			_db_eval_range(dP, val, ts_usec);
+		} else if ((dP->type == DERIVED_SLOPE) && (dP->in_a == n)) {
+			_db_eval_slope(dP, val, ts_usec);
+		}
+	}
+}
+
+
+// Complementary filter: integrate the high-rate input (e.g. acceleration) between samples of
+// the low-rate reference (e.g. OBD speed) and pull the estimate toward each reference sample.
+// The estimate is only published while the reference is current so it can't drift unchecked.
+// The inputs come from different producers so the state is updated under fusion_mux.
+static void _db_eval_fusion(db_derived_t* dP, int n, float val, int64_t ts_usec)
+{
+	bool publish = false;
+	int64_t dt;
+	double est_at_ref;
+	double err;
+	double k;
+	float out;
+	
+	taskENTER_CRITICAL(&fusion_mux);
+	if (n == dP->in_a) {
+		dt = ts_usec - dP->prev_usec;
+		if ((dP->prev_usec != 0) && (dt > 0) && (dt < DERIVED_MAX_GAP_USEC)) {
+			dP->acc += (double) dP->gain * (double) ((dP->prev_val + val) / 2.0 - dP->bias) * ((double) dt / 1000000.0);
+			if (dP->acc < 0) dP->acc = 0;
+			publish = (dP->used_b_usec != 0) && ((ts_usec - dP->used_b_usec) < DERIVED_MAX_GAP_USEC);
+		}
+		dP->prev_val = val;
+		dP->prev_usec = ts_usec;
+	} else {
+		if ((dP->used_b_usec == 0) || ((ts_usec - dP->used_b_usec) >= DERIVED_MAX_GAP_USEC) || (dP->prev_usec == 0)) {
+			// (Re)starting - take the reference as is
+			dP->acc = val;
+			dP->bias = 0;
+		} else if ((val == 0) && (dP->acc < DB_FUSION_ZERO_KPH)) {
+			// At rest
+			dP->acc = 0;
+		} else {
+			// Compare against the estimate at the time the reference was acquired (it usually
+			// lags the integrated input) and correct both the estimate and the input offset
+			est_at_ref = dP->acc;
+			if (dP->prev_usec > ts_usec) {
+				est_at_ref -= (double) dP->gain * (double) (dP->prev_val - dP->bias) * ((double) (dP->prev_usec - ts_usec) / 1000000.0);
+			}
+			err = (double) val - est_at_ref;
+			dt = ts_usec - dP->used_b_usec;
+			k = ((double) dt / 1000000.0) / (DB_FUSION_TAU_SEC + ((double) dt / 1000000.0));
+			dP->acc += k * err;
+			if (dP->acc < 0) dP->acc = 0;
+			dP->bias -= (float) (k * err / ((double) dP->gain * DB_FUSION_TAU_SEC * 4.0));
+		}
+		dP->used_b_usec = ts_usec;
+	}
+	out = (float) dP->acc;
+	taskEXIT_CRITICAL(&fusion_mux);
+	
+	if (publish) {
+		db_set_data_item_value_ts(dP->out, out, ts_usec);
+	}
+}
+
+
+// One-sided trapezoidal integration for trip accounting.  Each sample is O(1).  The
+// integral restarts (rather than bridging) a gap longer than the input's stale time so an
+// ECU that stopped answering doesn't add a step of energy or distance.  A gating input
+// (e.g. speed for regen) must be current and positive for the interval to count.
+static void _db_eval_accum(db_derived_t* dP, int n, float val, int64_t ts_usec)
+{
+	bool gate;
+	int64_t dt;
+	int64_t max_gap;
+	int64_t gate_age;
+	float a, b;
+	float out;
+	
+	max_gap = (int64_t) item_stale_msec[n] * 1000;
+	if ((max_gap == 0) || (max_gap > DERIVED_MAX_GAP_USEC)) {
+		max_gap = DERIVED_MAX_GAP_USEC;
+	}
+	
+	if (dP->in_b == DB_ITEM_NONE) {
+		gate = true;
+	} else {
+		gate_age = ts_usec - item_timestamp[dP->in_b];
+		if (gate_age < 0) gate_age = -gate_age;
+		gate = (item_timestamp[dP->in_b] != 0) && (gate_age < max_gap) && (gui_item_value_list[0][dP->in_b] > 0);
+	}
+	
+	taskENTER_CRITICAL(&trip_mux);
+	dt = ts_usec - dP->prev_usec;
+	if (gate && (dP->prev_usec != 0) && (dt > 0) && (dt < max_gap)) {
+		a = dP->gain * dP->prev_val;
+		b = dP->gain * val;
+		if (a < 0) a = 0;
+		if (b < 0) b = 0;
+		dP->acc += (double) (a + b) / 2.0 * ((double) dt / 1000000.0);
+	}
+	dP->prev_val = val;
+	dP->prev_usec = ts_usec;
+	out = (float) dP->acc;
+	taskEXIT_CRITICAL(&trip_mux);
+	
+	db_set_data_item_value_ts(dP->out, out, ts_usec);
+}
+
+
+// Trip efficiency figures, computed from the accumulators when one of their inputs updates.
+// Nothing is published until the figure is meaningful (e.g. some distance has been covered).
+static void _db_eval_trip_ratio(db_derived_t* dP, int64_t ts_usec)
+{
+	bool publish = false;
+	double traction, regen, aux, dist, net;
+	float out = 0;
+	
+	taskENTER_CRITICAL(&trip_mux);
+	traction = trip_acc_list[TRIP_ACC_TRACTION]->acc;
+	regen = trip_acc_list[TRIP_ACC_REGEN]->acc;
+	aux = trip_acc_list[TRIP_ACC_AUX]->acc;
+	dist = trip_acc_list[TRIP_ACC_DIST]->acc;
+	taskEXIT_CRITICAL(&trip_mux);
+	net = traction - regen;
+	
+	switch (dP->out) {
+		case DB_ITEM_TRIP_WH_PER_KM:
+			if (dist >= DB_TRIP_MIN_DIST_KM) {
+				out = (float) ((double) dP->gain * net / dist);
+				publish = true;
+			}
+			break;
+		
+		case DB_ITEM_TRIP_REGEN_PCT:
+			if (traction > 0) {
+				out = (float) ((double) dP->gain * regen / traction);
+				publish = true;
+			}
+			break;
+		
+		case DB_ITEM_TRIP_AUX_PCT:
+			if (net > 0) {
+				out = (float) ((double) dP->gain * aux / net);
+				publish = true;
+			}
+			break;
+	}
+	
+	if (publish) {
+		db_set_data_item_value_ts(dP->out, out, ts_usec);
+	}
+}
+
+
+// Efficiency over the last gain km, from the distance ring (updated here as the trip
+// distance passes each bucket boundary).  Each sample is O(1).
+static void _db_eval_window(db_derived_t* dP, int64_t ts_usec)
+{
+	bool publish;
+	float out;
+	
+	taskENTER_CRITICAL(&trip_mux);
+	_db_eff_update();
+	publish = _db_eff_window((int) (dP->gain * DB_EFF_BUCKETS_PER_KM + 0.5), &out);
+	taskEXIT_CRITICAL(&trip_mux);
+	
+	if (publish) {
+		db_set_data_item_value_ts(dP->out, out, ts_usec);
+	}
+}
+
+
+// Remaining range from the usable capacity (reduced by the SoH when it's known), the SoC
+// and the long window's efficiency, or the trip's while the trip is shorter than the window
+static void _db_eval_range(db_derived_t* dP, float soc, int64_t ts_usec)
+{
+	bool valid;
+	double dist, net;
+	float wh_per_km;
+	float kwh;
+	
+	taskENTER_CRITICAL(&trip_mux);
+	valid = _db_eff_window(EFF_LONG_BUCKETS, &wh_per_km);
+	if (!valid) {
+		dist = trip_acc_list[TRIP_ACC_DIST]->acc;
+		net = trip_acc_list[TRIP_ACC_TRACTION]->acc - trip_acc_list[TRIP_ACC_REGEN]->acc;
+		if (dist >= DB_TRIP_MIN_DIST_KM) {
+			wh_per_km = (float) (1000.0 * net / dist);
+			valid = true;
+		}
+	}
+	taskEXIT_CRITICAL(&trip_mux);
+	
+	if (!valid) return;
+	
+	if (wh_per_km < DB_EFF_MIN_WH_PER_KM) {
+		wh_per_km = DB_EFF_MIN_WH_PER_KM;
+	}
+	kwh = dP->gain * soc / 100.0;
+	if ((item_timestamp[DB_ITEM_HV_SOH] != 0) && (gui_item_value_list[0][DB_ITEM_HV_SOH] > 0)) {
+		kwh = kwh * gui_item_value_list[0][DB_ITEM_HV_SOH] / 100.0;
+	}
+	
+	db_set_data_item_value_ts(dP->out, kwh * 1000.0 / wh_per_km, ts_usec);
+}
+
+
+// Restart the efficiency windows at trip distance dist.  Called under trip_mux.
+static void _db_eff_reset(double dist)
+{
+	eff_next_bucket = (uint32_t) ceil(dist * DB_EFF_BUCKETS_PER_KM);
+	eff_first_bucket = eff_next_bucket;
+}
+
+
+// Record the net energy at each bucket boundary the trip distance has reached.  Called
+// under trip_mux.
+static void _db_eff_update()
+{
+	double dist = trip_acc_list[TRIP_ACC_DIST]->acc;
+	double net = trip_acc_list[TRIP_ACC_TRACTION]->acc - trip_acc_list[TRIP_ACC_REGEN]->acc;
+	uint32_t reached = (uint32_t) (dist * DB_EFF_BUCKETS_PER_KM);
+	
+	// Longer jumps than the ring (e.g. the distance was changed) restart the windows
+	if ((reached >= eff_next_bucket) && ((reached - eff_next_bucket) >= EFF_RING_LEN)) {
+		_db_eff_reset(dist);
+	}
+	while (eff_next_bucket <= reached) {
+		eff_ring_kwh[eff_next_bucket % EFF_RING_LEN] = net;
+		eff_next_bucket++;
+	}
+}
+
+
+// Net Wh/km since the boundary num_buckets before the last one reached.  Returns false until
+// that boundary has been recorded.  Called under trip_mux.
+static bool _db_eff_window(int num_buckets, float* wh_per_km)
+{
+	uint32_t start;
+	double dist, net;
+	
+	if ((num_buckets <= 0) || (num_buckets > EFF_LONG_BUCKETS) || (eff_next_bucket < (uint32_t) (num_buckets + 1))) {
+		return false;
+	}
+	start = eff_next_bucket - 1 - num_buckets;
+	if (start < eff_first_bucket) {
+		return false;
+	}
+	
+	dist = trip_acc_list[TRIP_ACC_DIST]->acc - (double) start / DB_EFF_BUCKETS_PER_KM;
+	net = trip_acc_list[TRIP_ACC_TRACTION]->acc - trip_acc_list[TRIP_ACC_REGEN]->acc - eff_ring_kwh[start % EFF_RING_LEN];
+	if (dist <= 0) {
+		return false;
+	}
+	*wh_per_km = (float) (1000.0 * net / dist);
+	
+	return true;
+}
+
+
+// Slope of the elevation over trip distance (grade) or time (climb rate) by a least-squares
+// fit to the window, kept as running sums so each sample is O(1).  The fit restarts after a
+// gap in the elevation, when the trip distance goes backwards (trip reset) or when the gain
+// is set.
+static void _db_eval_slope(db_derived_t* dP, float val, int64_t ts_usec)
+{
+	db_slope_t* sP;
+	bool grade;
+	double pos;
+	double scale;
+	double fit;
+	double num, den;
+	int32_t a, b, c;
+	int32_t x, y;
+	int64_t n;
+	float out;
+	
+	grade = (dP->in_b != DB_ITEM_NONE);
+	sP = &slope_list[grade ? SLOPE_GRADE : SLOPE_CLIMB];
+	if (fabsf(val) > SLOPE_MAX_ELEV_M) return;
+	
+	if (grade) {
+		taskENTER_CRITICAL(&trip_mux);
+		pos = trip_acc_list[TRIP_ACC_DIST]->acc;
+		taskEXIT_CRITICAL(&trip_mux);
+		scale = SLOPE_X_PER_KM;
+	} else {
+		pos = (double) ts_usec;
+		scale = SLOPE_X_PER_USEC;
+	}
+	
+	if ((dP->prev_usec == 0) || ((ts_usec - dP->prev_usec) >= DERIVED_MAX_GAP_USEC) || (pos < sP->origin)) {
+		_db_slope_reset(sP, pos);
+		sP->med_count = 0;
+	}
+	dP->prev_usec = ts_usec;
+	
+	// Median of the last three raw samples removes single-sample spikes
+	sP->med[sP->med_count % 3] = (int32_t) lroundf(val * SLOPE_Y_PER_M);
+	sP->med_count += 1;
+	if (sP->med_count < 3) return;
+	if (sP->med_count >= 6) sP->med_count -= 3;
+	a = sP->med[0];
+	b = sP->med[1];
+	c = sP->med[2];
+	y = (a > b) ? ((b > c) ? b : ((a > c) ? c : a)) : ((a > c) ? a : ((b > c) ? c : b));
+	
+	x = (int32_t) ((pos - sP->origin) * scale);
+	if (x > SLOPE_MAX_X) {
+		_db_slope_rebase(sP, scale);
+		x = (int32_t) ((pos - sP->origin) * scale);
+	}
+	
+	if (grade && (sP->count > 0)) {
+		if ((x - sP->x[(sP->next + DB_SLOPE_WINDOW - 1) % DB_SLOPE_WINDOW]) < (int32_t) (DB_GRADE_STEP_M * SLOPE_X_PER_KM / 1000.0)) {
+			return;
+		}
+	}
+	
+	// Reject samples far from the current fit
+	n = sP->count;
+	if (n >= DB_SLOPE_MIN_SAMPLES) {
+		den = (double) (n * sP->sxx - sP->sx * sP->sx);
+		num = (double) (n * sP->sxy - sP->sx * sP->sy);
+		fit = (den > 0) ? ((double) sP->sy + num / den * ((double) (n * x) - (double) sP->sx)) / (double) n : (double) sP->sy / (double) n;
+		if (fabs((double) y - fit) > (DB_SLOPE_GATE_M * SLOPE_Y_PER_M)) {
+			sP->reject_run += 1;
+			if (sP->reject_run < DB_SLOPE_MAX_REJECT) return;
+			
+			// The elevation really stepped so fit from here
+			_db_slope_reset(sP, pos);
+			x = 0;
+		}
+	}
+	sP->reject_run = 0;
+	
+	// Replace the oldest sample once the window is full
+	if (sP->count == DB_SLOPE_WINDOW) {
+		sP->sx -= sP->x[sP->next];
+		sP->sy -= sP->y[sP->next];
+		sP->sxx -= (int64_t) sP->x[sP->next] * sP->x[sP->next];
+		sP->sxy -= (int64_t) sP->x[sP->next] * sP->y[sP->next];
+	} else {
+		sP->count += 1;
+	}
+	sP->x[sP->next] = x;
+	sP->y[sP->next] = y;
+	sP->sx += x;
+	sP->sy += y;
+	sP->sxx += (int64_t) x * x;
+	sP->sxy += (int64_t) x * y;
+	sP->next = (sP->next + 1) % DB_SLOPE_WINDOW;
+	
+	// Publish once the window covers enough distance or time
+	n = sP->count;
+	if (n < DB_SLOPE_MIN_SAMPLES) return;
+	if (grade) {
+		if ((x - sP->x[(sP->next + DB_SLOPE_WINDOW - n) % DB_SLOPE_WINDOW]) < (int32_t) (DB_GRADE_MIN_SPAN_M * SLOPE_X_PER_KM / 1000.0)) return;
+	} else {
+		if ((x - sP->x[(sP->next + DB_SLOPE_WINDOW - n) % DB_SLOPE_WINDOW]) < (int32_t) (DB_CLIMB_MIN_SPAN_SEC * 1000)) return;
+	}
+	den = (double) (n * sP->sxx - sP->sx * sP->sx);
+	if (den <= 0) return;
+	num = (double) (n * sP->sxy - sP->sx * sP->sy);
+	
+	// Grade positions are dm like the elevation, climb positions mSec
+	out = (float) ((double) dP->gain * num / den);
+	if (!grade) {
+		out = out * 1000.0 / SLOPE_Y_PER_M;
+	}
+	
+	db_set_data_item_value_ts(dP->out, out, ts_usec);
+}
+
+
+// Empty the fit's window (not its median) with positions starting at origin
+static void _db_slope_reset(db_slope_t* sP, double origin)
+{
+	sP->count = 0;
+	sP->next = 0;
+	sP->sx = 0;
+	sP->sy = 0;
+	sP->sxx = 0;
+	sP->sxy = 0;
+	sP->origin = origin;
+	sP->reject_run = 0;
+}
+
+
+// Move the origin to the oldest sample in the window.  Infrequent so the sums are recomputed.
+static void _db_slope_rebase(db_slope_t* sP, double scale)
+{
+	int32_t d;
+	int i;
+	
+	if (sP->count == 0) {
+		return;
+	}
+	d = sP->x[(sP->next + DB_SLOPE_WINDOW - sP->count) % DB_SLOPE_WINDOW];
+	sP->origin += (double) d / scale;
+	sP->sx = 0;
+	sP->sxx = 0;
+	sP->sxy = 0;
+	for (int j=0; j<sP->count; j++) {
+		i = (sP->next + DB_SLOPE_WINDOW - sP->count + j) % DB_SLOPE_WINDOW;
+		sP->x[i] -= d;
+		sP->sx += sP->x[i];
+		sP->sxx += (int64_t) sP->x[i] * sP->x[i];
+		sP->sxy += (int64_t) sP->x[i] * sP->y[i];
+	}
+}
+
+
+static db_derived_t* _db_find_derived(int item)
+{
+	for (int i=0; i<NUM_DERIVED; i++) {
+		if (derived_list[i].out == item) {
+			return &derived_list[i];
+		}
+	}
+	
+	return NULL;
+}
+
+
+// Compute a derived product after input n was updated.  Inputs are only written by their
+// producer so they are read here without the sequence lock.
+static void _db_eval_product(db_derived_t* dP, int n)
+{
+	int o;
+	float a, b;
+	float v, v_prev;
+	int64_t t, t_prev, t_o;
+	
+	o = (n == dP->in_a) ? dP->in_b : dP->in_a;
+	t = item_timestamp[n];
+	t_o = item_timestamp[o];
+	if (t_o == 0) {
+		// Other input not yet acquired
+		return;
+	}
+	
+	switch (dP->align) {
+		case DB_ALIGN_PAIR:
+			// Pair samples close together in time, using each sample only once
+			if ((llabs(t - t_o) > dP->window_usec) || (t_o == ((o == dP->in_a) ? dP->used_a_usec : dP->used_b_usec))) {
+				return;
+			}
+			a = gui_item_value_list[0][dP->in_a];
+			b = gui_item_value_list[0][dP->in_b];
+			dP->used_a_usec = item_timestamp[dP->in_a];
+			dP->used_b_usec = item_timestamp[dP->in_b];
+			t = (t > t_o) ? t : t_o;
+			break;
+		
+		case DB_ALIGN_INTERP:
+			// Interpolate the just-updated input back to the other input's sample time
+			v = gui_item_value_list[0][n];
+			if (t_o < t) {
+				t_prev = item_prev_timestamp[n];
+				if ((t_prev == 0) || (t_o < t_prev)) {
+					// Other input older than our previous sample (not being updated)
+					return;
+				}
+				v_prev = gui_item_value_list[1][n];
+				v = v_prev + (v - v_prev) * (float) (t_o - t_prev) / (float) (t - t_prev);
+				t = t_o;
+			}
+			if (t <= dP->out_usec) {
+				// Already computed for this time
+				return;
+			}
+			a = (n == dP->in_a) ? v : gui_item_value_list[0][dP->in_a];
+			b = (n == dP->in_b) ? v : gui_item_value_list[0][dP->in_b];
+			break;
+		
+		default:
+			// Latest values when the second input updates
+			if (n != dP->in_b) {
+				return;
+			}
+			a = gui_item_value_list[0][dP->in_a];
+			b = gui_item_value_list[0][dP->in_b];
+	}
+	
+	if (dP->type == DERIVED_SPLIT) {
+		a = fabsf(a);
+		b = fabsf(b);
+		if ((a + b) < DB_SPLIT_MIN_NM) {
+			return;
+		}
+		dP->out_usec = t;
+		db_set_data_item_value_ts(dP->out, dP->gain * a / (a + b), t);
+	} else {
+	dP->out_usec = t;
+	db_set_data_item_value_ts(dP->out, dP->gain * a * b, t);
+	}
+}
+
+
+static void _db_reset_filters(db_subscriber_t* sP)
+{
+	for (int i=0; i<DB_MAX_ITEMS; i++) {
+		sP->deadband[i] = 0;
+		sP->min_interval_msec[i] = 0;
+		sP->last_usec[i] = 0;
+	}
+}
+
+
+static void _db_write_begin()
+{
+#ifdef DB_LOCK_STATS
+	uint32_t t0 = esp_cpu_get_cycle_count();
+	uint32_t dt;
+#endif
+	
+	taskENTER_CRITICAL(&writer_mux);
+#ifdef DB_LOCK_STATS
+	dt = esp_cpu_get_cycle_count() - t0;
+	lock_stats.writes += 1;
+	lock_stats.write_wait_cycles += dt;
+	if (dt > lock_stats.write_wait_max) lock_stats.write_wait_max = dt;
+#endif
+	__atomic_store_n(&update_seq, update_seq + 1, __ATOMIC_RELAXED);   // Odd: update in progress
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static void _db_write_end()
+{
+	__atomic_store_n(&update_seq, update_seq + 1, __ATOMIC_RELEASE);   // Even: stable
+	taskEXIT_CRITICAL(&writer_mux);
+}
+
+
+// Returns a stable (even) sequence number to start a read
+static uint32_t _db_read_begin()
+{
+	uint32_t seq;
+	
+#ifdef DB_LOCK_STATS
+	__atomic_fetch_add(&lock_stats.reads, 1, __ATOMIC_RELAXED);
+#endif
+	while (((seq = __atomic_load_n(&update_seq, __ATOMIC_ACQUIRE)) & 0x1) != 0) {
+		// Writer is mid-update on the other core and only holds it for a few stores
+#ifdef DB_LOCK_STATS
+		__atomic_fetch_add(&lock_stats.read_spins, 1, __ATOMIC_RELAXED);
+#endif
+	}
+	
+	return seq;
+}
+
+
+// Returns true if a write happened during the read and it must be repeated
+static bool _db_read_retry(uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+#ifdef DB_LOCK_STATS
+	if (__atomic_load_n(&update_seq, __ATOMIC_RELAXED) != seq) {
+		__atomic_fetch_add(&lock_stats.read_retries, 1, __ATOMIC_RELAXED);
+		return true;
+	}
+	return false;
+#else
+	return __atomic_load_n(&update_seq, __ATOMIC_RELAXED) != seq;
+#endif
+}
+
+
+static void _db_history_push(db_hist_ring_t* hP, float val, int64_t ts_usec)
+{
+	db_hist_sample_t* sP;
+	float f;
+	
+	sP = &hP->bufP[hP->write_count % hP->len];
+	sP->ts_msec = (uint32_t) (ts_usec / 1000);
+	
+	// Saturate to the fixed-point range
+	f = val * DB_HIST_SCALE;
+	if (f > (float) INT32_MAX) {
+		sP->val = INT32_MAX;
+	} else if (f < (float) INT32_MIN) {
+		sP->val = INT32_MIN;
+	} else {
+		sP->val = (int32_t) f;
+	}
+	
+	__atomic_store_n(&hP->write_count, hP->write_count + 1, __ATOMIC_RELEASE);
+}
+
+
+
+// Returns -1 for an invalid item ID, otherwise the table index
+static int _db_item_to_index(int item)
+{
+	if ((item <= DB_ITEM_NONE) || (item >= DB_MAX_ITEMS)) {
+		return -1;
+	}
+	
+	return item;
+}
+
+// Mark a GUI-handled item as wanted and have its last-known value passed on the next
+// db_gui_eval()
+static void _db_gui_add_interest(int n)
+{
+	__atomic_or_fetch(&subscriber_list[DB_SUBSCRIBER_GUI].interest_bits[n / 32], 1UL << (n % 32), __ATOMIC_RELEASE);
+	subscriber_list[DB_SUBSCRIBER_GUI].last_usec[n] = 0;
+	
+	// Restart the item's filter from its last-known value
+	_db_write_begin();
+	item_filtered_list[n] = gui_item_value_list[0][n];
+	item_filter[n].count = 0;
+	item_filter[n].sum = 0;
+	_db_write_end();
+	
+	if (item_timestamp[n] != 0) {
+		__atomic_or_fetch(&subscriber_list[DB_SUBSCRIBER_GUI].pending_bits[n / 32], 1UL << (n % 32), __ATOMIC_RELEASE);
+	} else {
+		__atomic_and_fetch(&subscriber_list[DB_SUBSCRIBER_GUI].pending_bits[n / 32], ~(1UL << (n % 32)), __ATOMIC_ACQ_REL);
+	}
 }
\ No newline at end of file
@@ -27,6 +27,8 @@
 #define DATA_BROKER_H
 
 #include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -36,47 +38,445 @@
 // Global constants
 //
 
-// Data Item Masks
+// Data Item IDs
 //  - All units metric (e.g. °C)
 //  - Battery voltage in volts
 //  - Battery current negative for discharge, positive for charge
 //  - Torque in N-m
-//  - Elevation in meters
-#define DB_ITEM_HV_BATT_V         0x00000001
-#define DB_ITEM_HV_BATT_I         0x00000002
-#define DB_ITEM_HV_BATT_MIN_T     0x00000004
-#define DB_ITEM_HV_BATT_MAX_T     0x00000008
-#define DB_ITEM_LV_BATT_V         0x00000010
-#define DB_ITEM_LV_BATT_I         0x00000020
-#define DB_ITEM_LV_BATT_T         0x00000040
-#define DB_ITEM_AUX_KW            0x00000100
-#define DB_ITEM_FRONT_TORQUE      0x00001000
-#define DB_ITEM_REAR_TORQUE       0x00002000
-#define DB_ITEM_SPEED             0x00010000
-#define DB_ITEM_GPS_ELEVATION     0x00100000
+//  - Elevation in meters, latitude/longitude in degrees (north/east positive), heading in
+//    degrees clockwise from north
+//  - State of charge and health in percent
+//  - Power in kW (HV power follows the battery current sign: negative for discharge)
+//  - Energy in kWh accumulated since boot (negative for net discharge)
+//  - Trip energy in kWh and distance in km accumulated over the trip (always positive)
+//  - Efficiency in Wh/km (converted for display by the GUI), range in km
+//  - Acceleration in g (longitudinal positive accelerating, lateral positive to the right)
+//  - Road grade in percent and climb rate in m/s (both positive uphill)
+//  - ID 0 is reserved to mean "no item"
+#define DB_ITEM_NONE              0
+#define DB_ITEM_HV_BATT_V         1
+#define DB_ITEM_HV_BATT_I         2
+#define DB_ITEM_HV_BATT_MIN_T     3
+#define DB_ITEM_HV_BATT_MAX_T     4
+#define DB_ITEM_LV_BATT_V         5
+#define DB_ITEM_LV_BATT_I         6
+#define DB_ITEM_LV_BATT_T         7
+#define DB_ITEM_AUX_KW            8
+#define DB_ITEM_FRONT_TORQUE      9
+#define DB_ITEM_REAR_TORQUE       10
+#define DB_ITEM_SPEED             11
+#define DB_ITEM_GPS_ELEVATION     12
 
-// DB_MASK_ITEMS is a power-of-2 indicating size of mask variable
-#define DB_MAX_ITEMS              32
+// Derived items (computed by the broker from the items above)
+#define DB_ITEM_HV_POWER_KW       13
+#define DB_ITEM_HV_ENERGY_KWH     14
+#define DB_ITEM_FRONT_MECH_KW     15
+#define DB_ITEM_REAR_MECH_KW      16
+
+// Items from on-board sensors (available independent of the vehicle)
+#define DB_ITEM_LONG_ACCEL        17
+#define DB_ITEM_LAT_ACCEL         18
+
+// Speed estimated at the IMU rate from longitudinal acceleration, corrected toward DB_ITEM_SPEED
+#define DB_ITEM_FUSED_SPEED       19
+
+// Trip energy accounting (derived).  Traction is energy out of the HV battery, regen is
+// energy into it while moving, aux is the energy consumed by the auxiliary loads.  Efficiency
+// is net (traction - regen) energy per distance, regen is a percent of traction energy and
+// aux is a percent of net energy.
+#define DB_ITEM_TRIP_TRACTION_KWH 20
+#define DB_ITEM_TRIP_REGEN_KWH    21
+#define DB_ITEM_TRIP_AUX_KWH      22
+#define DB_ITEM_TRIP_DIST_KM      23
+#define DB_ITEM_TRIP_WH_PER_KM    24
+#define DB_ITEM_TRIP_REGEN_PCT    25
+#define DB_ITEM_TRIP_AUX_PCT      26
+
+// Lowest and highest HV battery cell voltage (published by the broker from the cell voltage array)
+#define DB_ITEM_CELL_MIN_V        27
+#define DB_ITEM_CELL_MAX_V        28
+
+// HV battery state and GPS position (carried by responses also read for other items)
+#define DB_ITEM_HV_SOC            29
+#define DB_ITEM_HV_SOH            30
+#define DB_ITEM_GPS_LAT           31
+#define DB_ITEM_GPS_LON           32
+#define DB_ITEM_GPS_HEADING       33
+
+// Efficiency over the last DB_EFF_SHORT_KM and DB_EFF_LONG_KM driven (derived, published
+// once that far has been driven in the trip) and the range the remaining charge gives at
+// the long window's efficiency (the trip's until then).  Range needs the vehicle to set its
+// usable battery capacity (kWh) as the derived gain of DB_ITEM_RANGE_KM.
+#define DB_ITEM_WH_PER_KM_SHORT   34
+#define DB_ITEM_WH_PER_KM_LONG    35
+#define DB_ITEM_RANGE_KM          36
+
+// Front motor share of the total (absolute) motor torque in percent (derived from front
+// and rear torque samples acquired together, published while the total is at least
+// DB_SPLIT_MIN_NM)
+#define DB_ITEM_FRONT_SPLIT_PCT   37
+
+// Road grade and climb rate (derived from the GPS elevation against the trip distance and
+// against time, published once the fit covers DB_GRADE_MIN_SPAN_M or DB_CLIMB_MIN_SPAN_SEC)
+#define DB_ITEM_ROAD_GRADE_PCT    38
+#define DB_ITEM_CLIMB_RATE        39
+
+// Number of defined item IDs (including DB_ITEM_NONE)
+#define DB_NUM_ITEMS              40
+
+// DB_MAX_ITEMS is the size of the item tables and of db_mask_t
+#define DB_MAX_ITEMS              64
+
+// Sets of items (e.g. a vehicle's supported items or a tile's requested items)
+typedef uint64_t db_mask_t;
+#define DB_MASK(item)             (((db_mask_t) 1) << (item))
+#define DB_MASK_ALL               (~((db_mask_t) 0) & ~DB_MASK(DB_ITEM_NONE))
+
+// Subscribers.  The GUI is always subscriber 0.  Each subscriber receives every update to
+// the items it is interested in, independent of the others.
+#define DB_MAX_SUBSCRIBERS        4
+#define DB_SUBSCRIBER_GUI         0
+
+// Maximum GUI handlers per item
+#define DB_MAX_GUI_HANDLERS       2
+
+// Item smoothing filters (computed when an item is set, delivered to the GUI)
+//  - EMA: param is the weight of the new sample (0 < param <= 1)
+//  - BOXCAR: param is the number of taps, averaged over the item's history ring
+//  - MEDIAN3: median of the last three samples for spike rejection (param unused)
+#define DB_FILTER_NONE            0
+#define DB_FILTER_EMA             1
+#define DB_FILTER_BOXCAR          2
+#define DB_FILTER_MEDIAN3         3
+
+// Input alignment for derived products of separately acquired items
+//  - LATEST: latest values whenever the second input updates
+//  - PAIR: only samples acquired within a window of each other, each sample used once
+//  - INTERP: the newer input is linearly interpolated to the older input's sample time
+#define DB_ALIGN_LATEST           0
+#define DB_ALIGN_PAIR             1
+#define DB_ALIGN_INTERP           2
+
+// Item data quality
+//  - NONE: never set
+//  - FRESH: set within the item's stale time
+//  - STALE: not set within the item's stale time (e.g. ECU stopped answering)
+//  - ERROR: producer reported a failure (e.g. negative response) since the last value
+#define DB_QUALITY_NONE           0
+#define DB_QUALITY_FRESH          1
+#define DB_QUALITY_STALE          2
+#define DB_QUALITY_ERROR          3
+
+// Items not set for this long become stale unless given their own stale time
+#define DB_STALE_DEFAULT_MSEC     3000
+
+// Period of the broker timer that checks for stale items
+#define DB_QUALITY_CHECK_MSEC     250
+
+// EMA weight used for GUI items when the interface is fast enough to smooth
+#define DB_FAST_IF_EMA_ALPHA      0.5
+
+// History sample values are stored as fixed-point with this many counts per unit
+#define DB_HIST_SCALE             1000
+
+// Speed fusion: time constant (sec) over which the estimate is pulled toward the reference
+// speed, and the estimate below which a reference of 0 snaps it to rest
+#define DB_FUSION_TAU_SEC         0.5
+#define DB_FUSION_ZERO_KPH        2.0
+
+// Trip efficiency is only published once the trip is at least this long (km)
+#define DB_TRIP_MIN_DIST_KM       0.1
+
+// Sliding efficiency windows (whole km).  Net energy is recorded DB_EFF_BUCKETS_PER_KM times
+// per km of trip distance into a ring covering the long window so each window is one
+// subtraction.
+#define DB_EFF_SHORT_KM           1
+#define DB_EFF_LONG_KM            10
+#define DB_EFF_BUCKETS_PER_KM     10
+
+// Efficiency floor (Wh/km) used for range so a downhill stretch doesn't give a huge range
+#define DB_EFF_MIN_WH_PER_KM      50.0
+
+// Total torque (N-m) below which the front/rear split isn't meaningful (coasting)
+#define DB_SPLIT_MIN_NM           10.0
+
+// Front/rear split: longest time (mSec) between the torque samples that are paired
+#define DB_SPLIT_PAIR_MSEC        50
+
+// Grade and climb rate are the least-squares slopes of the last DB_SLOPE_WINDOW accepted
+// elevation samples.  The GPS elevation is coarse so it is median-of-3 filtered and samples
+// more than DB_SLOPE_GATE_M from the fit are rejected; DB_SLOPE_MAX_REJECT in a row restart
+// the fit (the elevation really stepped, e.g. a new fix).  Grade samples closer than
+// DB_GRADE_STEP_M of distance to the previous one are skipped so a stopped vehicle doesn't
+// collapse the fit.
+#define DB_SLOPE_WINDOW           16
+#define DB_SLOPE_MIN_SAMPLES      6
+#define DB_SLOPE_GATE_M           4.0
+#define DB_SLOPE_MAX_REJECT       3
+#define DB_GRADE_STEP_M           5.0
+#define DB_GRADE_MIN_SPAN_M       50.0
+#define DB_CLIMB_MIN_SPAN_SEC     5.0
+
+// Battery cell arrays.  Per-cell values are kept as packed fixed-point arrays rather than
+// as items, each written all at once by the vehicle after a complete acquisition.
+//  - V: cell voltages in mV
+//  - T: cell (or module sensor) temperatures in 0.1 °C
+#define DB_CELL_ARRAY_V           0
+#define DB_CELL_ARRAY_T           1
+#define DB_NUM_CELL_ARRAYS        2
+
+#define DB_CELL_MAX               108
+
+// Uncomment to trace the latency from the CAN driver receiving a response to its values
+// being displayed (percentiles per stage are logged every DB_LAT_LOG_MSEC)
+//#define DB_LATENCY_TRACE
+
+// Uncomment to count the CPU cycles writers spend acquiring the value lock and the spins and
+// retries of its readers (read with db_get_lock_stats by the broker benchmark)
+//#define DB_LOCK_STATS
+
+// Latency trace stages (measured from the reception of the frame completing a response)
+//  - VM: response taken from the queue by the vehicle manager
+//  - PUBLISH: values decoded from it published to the broker
+//  - GUI: a value delivered to a GUI handler
+//  - FRAME: end of the render pass following the delivery
+#define DB_LAT_STAGE_VM           0
+#define DB_LAT_STAGE_PUBLISH      1
+#define DB_LAT_STAGE_GUI          2
+#define DB_LAT_STAGE_FRAME        3
+#define DB_LAT_NUM_STAGES         4
+
+// Latency histogram bins (last bin holds everything longer) and log interval
+#define DB_LAT_BIN_USEC           1000
+#define DB_LAT_NUM_BINS           200
+#define DB_LAT_LOG_MSEC           30000
+
+// Maximum number of item values staged in a batch (a full batch is committed when another
+// value is added)
+#define DB_BATCH_MAX_ITEMS        16
+
+// Alerts.  Threshold rules checked in the producer's context whenever their item is set.
+// A rule becomes active once its item is beyond the threshold for the rule's number of
+// consecutive samples and clears once it is back past the threshold by the hysteresis for
+// as many (or immediately when the item goes stale).  Lower alert numbers take precedence
+// when several are active.
+#define DB_MAX_ALERTS             16
+
+// Alert rule types
+#define DB_ALERT_BELOW            0
+#define DB_ALERT_ABOVE            1
+
+// Default rules (set up by db_init, vehicles may change their thresholds)
+//  - REGEN_COLD / REGEN_FULL: conditions under which the vehicle limits regen
+#define DB_ALERT_LV_LOW           0
+#define DB_ALERT_HV_HOT           1
+#define DB_ALERT_REGEN_COLD       2
+#define DB_ALERT_REGEN_FULL       3
+#define DB_NUM_DEFAULT_ALERTS     4
 
 
 
 //
-// Callback handler definition
+// Callback handler definitions
 //
 typedef void (*gui_item_value_handler)(float val);
+typedef void (*gui_item_update_handler)(int item, float val);
+typedef void (*db_item_handler)(int item, float val, int64_t ts_usec);
+typedef void (*gui_item_quality_handler)(int item, int quality);
+typedef void (*gui_batch_handler)(db_mask_t updated, const float* vals);
+typedef void (*db_alert_handler)(int alert, bool active, float val);
+
+
+
+//
+// History typedefs
+//
+
+// Compact history sample
+typedef struct {
+	uint32_t ts_msec;                    // esp_timer mSec (low 32 bits) of acquisition
+	int32_t val;                         // Value * DB_HIST_SCALE
+} db_hist_sample_t;
+
+// Zero-copy view of an item's history ring.  Samples are oldest to newest in seg1
+// followed by seg2 (seg2_len is 0 if the view does not wrap).  The producer keeps
+// writing while the view is held so the oldest samples may be overwritten; see
+// db_get_history_overrun().
+typedef struct {
+	const db_hist_sample_t* seg1P;
+	int seg1_len;
+	const db_hist_sample_t* seg2P;
+	int seg2_len;
+	int item;
+	uint32_t write_count;                // Ring write count when the view was taken
+} db_hist_view_t;
+
+#define DB_HIST_SAMPLE_VAL(sP) ((float) (sP)->val / DB_HIST_SCALE)
+
+
+
+//
+// Cell array typedefs
+//
+typedef struct {
+	uint32_t update_count;               // Incremented each time the array is set (0 = never set)
+	int64_t ts_usec;                     // esp_timer uSec when the acquisition completed
+	int num;                             // Number of valid entries
+	int16_t val[DB_CELL_MAX];
+} db_cell_array_t;
+
+
+
+//
+// Batch typedefs
+//
+
+// Item values staged by a producer (e.g. all the values decoded from one response) and
+// published together by db_batch_commit()
+typedef struct {
+	int num;
+	uint8_t item[DB_BATCH_MAX_ITEMS];
+	float val[DB_BATCH_MAX_ITEMS];
+	int64_t ts_usec[DB_BATCH_MAX_ITEMS];
+} db_batch_t;
+
+
+
+//
+// Signal catalog typedefs
+//
+
+// Per-item metadata, indexed by item ID (see db_catalog_get()).  Ranges are display
+// ranges (e.g. gauge scales) with defaults suitable for a typical EV; vehicles override
+// those that depend on the drivetrain.
+typedef struct {
+	const char* name;                    // Short display name (NULL for DB_ITEM_NONE)
+	const char* unit;                    // Metric unit
+	float min;
+	float max;
+	uint8_t precision;                   // Decimal places shown
+	uint8_t filter_type;                 // DB_FILTER_* applied for the GUI on fast interfaces
+	float filter_param;
+	int period_msec;                     // Default request period (0 = as fast as possible)
+	float persist_deadband;              // Last-known value saved when it moves this far (0 = not saved)
+} db_signal_t;
+
+
+
+//
+// Trip typedefs
+//
+
+// Trip accumulator state (saved and restored by the application across power cycles)
+typedef struct {
+	float traction_kwh;
+	float regen_kwh;
+	float aux_kwh;
+	float dist_km;
+} db_trip_totals_t;
+
+
+//
+// Lock statistics typedefs (DB_LOCK_STATS)
+//
+typedef struct {
+	uint32_t writes;                       // Value lock acquisitions
+	uint64_t write_wait_cycles;            // Total cycles taken to acquire it
+	uint32_t write_wait_max;               // Longest acquisition
+	uint32_t reads;                        // Sequence lock reads started
+	uint32_t read_spins;                   // Polls of the sequence while a write was in progress
+	uint32_t read_retries;                 // Reads repeated because a write overlapped them
+} db_lock_stats_t;
 
 
 //
 // API
 //
 esp_err_t db_init();
-void db_enable_fast_average(bool en);
+bool db_set_item_filter(int item, int type, float param);
+void db_set_filter_profile(db_mask_t items, bool fast_interface);
 void db_gui_eval();
+uint32_t db_get_item_update_count(int item);
+bool db_get_data_item(int item, float* val, int64_t* ts_usec);
+int64_t db_get_data_item_age(int item);
+
+// Quality API
+int db_get_item_quality(int item);
+db_mask_t db_get_unfresh_mask(db_mask_t items);
+void db_set_item_stale_msec(int item, uint32_t stale_msec);
+void db_set_item_error(int item);
+
+// Derived item API
+void db_set_derived_gain(int item, float gain);
+void db_set_derived_align(int item, int align, uint32_t window_msec);
+db_mask_t db_get_derived_outputs(db_mask_t available);
+db_mask_t db_get_derived_inputs(db_mask_t items);
+
+// Signal catalog API
+const db_signal_t* db_catalog_get(int item);
+void db_catalog_set_range(int item, float min, float max);
+void db_catalog_reset_ranges();
+
+// Latency trace API (DB_LATENCY_TRACE)
+void db_lat_note(int stage, int64_t rx_usec);
+void db_lat_note_frame();
+
+// Lock statistics API (DB_LOCK_STATS)
+void db_get_lock_stats(db_lock_stats_t* sP, bool reset);
+
+// Alert API
+void db_alert_init();
+void db_alert_eval(int item, float val);
+void db_alert_clear_item(int item);
+int db_add_alert(int item, int type, float threshold, float hysteresis, int samples, const char* text);
+void db_set_alert_threshold(int alert, float threshold, float hysteresis);
+uint32_t db_get_active_alerts();
+const char* db_get_alert_text(int alert);
+uint32_t db_get_alert_count(int alert);
+void db_register_alert_callback(db_alert_handler fcn);
+
+// Trip API
+void db_get_trip_totals(db_trip_totals_t* tP);
+void db_set_trip_totals(const db_trip_totals_t* tP);
+
+// On-board sensor API
+void db_set_local_items(db_mask_t items);
+db_mask_t db_get_local_items();
+
+// History API
+bool db_enable_history(int item, int num_samples);
+bool db_get_history_view(int item, db_hist_view_t* viewP);
+int db_get_history_overrun(const db_hist_view_t* viewP);
+bool db_get_history_stats(int item, int num_samples, float* min, float* max, float* avg);
+
+// Cell array API
+void db_set_cell_array(int array, int num, const int16_t* vals, int64_t ts_usec);
+bool db_get_cell_array(int array, db_cell_array_t* arrayP);
+uint32_t db_get_cell_array_count(int array);
+
+// Subscriber API
+int db_add_subscriber(db_mask_t items, db_item_handler fcn);
+void db_set_subscriber_items(int sub, db_mask_t items);
+bool db_subscriber_has_updates(int sub);
+void db_subscriber_eval(int sub);
+void db_set_subscriber_filter(int sub, int item, float deadband, uint32_t min_interval_msec);
 
 // GUI API
-void db_register_gui_callback(uint32_t mask, gui_item_value_handler fcn);
+void db_register_gui_callback(int item, gui_item_value_handler fcn);
+void db_register_gui_item_callback(int item, gui_item_update_handler fcn);
+void db_register_gui_quality_callback(gui_item_quality_handler fcn);
+void db_register_gui_batch_callback(db_mask_t items, gui_batch_handler fcn);
+void db_clear_gui_callbacks();
+void db_set_gui_notify(TaskHandle_t task, uint32_t notify_bits);
 
 // Vehicle Manager API
-void db_set_data_item_value(uint32_t mask, float val);
+void db_set_data_item_value(int item, float val);
+void db_set_data_item_value_ts(int item, float val, int64_t ts_usec);
+void db_batch_begin(db_batch_t* bP);
+void db_batch_add(db_batch_t* bP, int item, float val, int64_t ts_usec);
+void db_batch_commit(db_batch_t* bP);
+
+// Application API
+void db_restore_data_item(int item, float val);
 
 #endif /* DATA_BROKER_H */
\ No newline at end of file
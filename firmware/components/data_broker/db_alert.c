@@ -0,0 +1,231 @@
+/*
+ * Data Broker Alerts
+ *
+ * Threshold rules checked in the producer's context each time their item is set so an
+ * alert fires within one sample of its item crossing the threshold, whatever the GUI is
+ * showing.  Rules are compiled into a chain per item: an update of an item without rules
+ * costs one table lookup and one with rules a comparison per rule.  Changes of state are
+ * passed to a registered handler (which must be quick as it runs on the producer's task).
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "data_broker.h"
+#include "esp_log.h"
+#include <string.h>
+
+
+
+//
+// Local typedefs
+//
+typedef struct {
+	int item;
+	int type;                              // DB_ALERT_*
+	float set_val;                         // Beyond this to become active
+	float clear_val;                       // Back past this to clear
+	int samples;                           // Consecutive samples needed for either change
+	int count;                             // Consecutive samples seen toward a change
+	uint32_t fire_count;                   // Times the alert became active
+	const char* text;
+	int next;                              // Next rule on the same item (-1 = last)
+} db_alert_rule_t;
+
+
+
+//
+// Local variables
+//
+static const char* TAG = "db_alert";
+
+static db_alert_rule_t rule_list[DB_MAX_ALERTS];
+static int num_rules = 0;
+
+// First rule of each item's chain (-1 = none)
+static int8_t item_first_rule[DB_MAX_ITEMS];
+
+// Active rules (bit per alert number)
+static uint32_t active_mask = 0;
+
+static db_alert_handler alert_fcn = NULL;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _db_alert_change(int alert, bool active, float val);
+
+
+
+//
+// API
+//
+
+// Set up the default rules (called by db_init)
+void db_alert_init()
+{
+	memset(item_first_rule, -1, sizeof(item_first_rule));
+	num_rules = 0;
+	active_mask = 0;
+	
+	// In DB_ALERT_* order
+	(void) db_add_alert(DB_ITEM_LV_BATT_V,     DB_ALERT_BELOW, 11.8, 0.3, 3, "12V battery low");
+	(void) db_add_alert(DB_ITEM_HV_BATT_MAX_T, DB_ALERT_ABOVE, 50.0, 3.0, 2, "HV battery hot");
+	(void) db_add_alert(DB_ITEM_HV_BATT_MIN_T, DB_ALERT_BELOW, 5.0,  2.0, 2, "Regen limited - cold battery");
+	(void) db_add_alert(DB_ITEM_HV_SOC,        DB_ALERT_ABOVE, 95.0, 2.0, 2, "Regen limited - battery full");
+}
+
+
+// Check the rules of an item for a new value (called by the broker after storing it)
+void db_alert_eval(int item, float val)
+{
+	db_alert_rule_t* rP;
+	bool active;
+	bool toward;
+	
+	for (int r=item_first_rule[item]; r>=0; r=rP->next) {
+		rP = &rule_list[r];
+		active = (__atomic_load_n(&active_mask, __ATOMIC_RELAXED) & (1UL << r)) != 0;
+		if (rP->type == DB_ALERT_BELOW) {
+			toward = active ? (val > rP->clear_val) : (val < rP->set_val);
+		} else {
+			toward = active ? (val < rP->clear_val) : (val > rP->set_val);
+		}
+	
+		if (!toward) {
+			rP->count = 0;
+		} else if (++rP->count >= rP->samples) {
+			rP->count = 0;
+			_db_alert_change(r, !active, val);
+		}
+	}
+}
+
+
+// Clear any active alerts of an item (its value is no longer current)
+void db_alert_clear_item(int item)
+{
+	for (int r=item_first_rule[item]; r>=0; r=rule_list[r].next) {
+		rule_list[r].count = 0;
+		if ((__atomic_load_n(&active_mask, __ATOMIC_RELAXED) & (1UL << r)) != 0) {
+			_db_alert_change(r, false, 0);
+		}
+	}
+}
+
+
+// Add a rule, returning its alert number (-1 if there is no room).  Rules should be added
+// before the item starts being published.  text must be persistent.
+int db_add_alert(int item, int type, float threshold, float hysteresis, int samples, const char* text)
+{
+	db_alert_rule_t* rP;
+	int r, last;
+	
+	if ((item <= DB_ITEM_NONE) || (item >= DB_NUM_ITEMS) || (num_rules >= DB_MAX_ALERTS)) {
+		ESP_LOGE(TAG, "Cannot add alert for item %d", item);
+		return -1;
+	}
+	
+	r = num_rules;
+	rP = &rule_list[r];
+	rP->item = item;
+	rP->type = type;
+	rP->samples = (samples < 1) ? 1 : samples;
+	rP->count = 0;
+	rP->fire_count = 0;
+	rP->text = text;
+	db_set_alert_threshold(r, threshold, hysteresis);
+	
+	// Append to the item's chain so earlier (higher precedence) rules are checked first
+	rP->next = -1;
+	if (item_first_rule[item] < 0) {
+		item_first_rule[item] = r;
+	} else {
+		last = item_first_rule[item];
+		while (rule_list[last].next >= 0) last = rule_list[last].next;
+		rule_list[last].next = r;
+	}
+	num_rules += 1;
+	
+	return r;
+}
+
+
+// Change the threshold of a rule (e.g. the pack temperature limit of a vehicle)
+void db_set_alert_threshold(int alert, float threshold, float hysteresis)
+{
+	db_alert_rule_t* rP;
+	
+	if ((alert < 0) || (alert >= DB_MAX_ALERTS)) return;
+	
+	rP = &rule_list[alert];
+	if (hysteresis < 0) hysteresis = -hysteresis;
+	rP->set_val = threshold;
+	rP->clear_val = (rP->type == DB_ALERT_BELOW) ? (threshold + hysteresis) : (threshold - hysteresis);
+}
+
+
+uint32_t db_get_active_alerts()
+{
+	return __atomic_load_n(&active_mask, __ATOMIC_ACQUIRE);
+}
+
+
+const char* db_get_alert_text(int alert)
+{
+	if ((alert < 0) || (alert >= num_rules)) return "";
+	
+	return rule_list[alert].text;
+}
+
+
+// Times an alert has become active since boot
+uint32_t db_get_alert_count(int alert)
+{
+	if ((alert < 0) || (alert >= num_rules)) return 0;
+	
+	return rule_list[alert].fire_count;
+}
+
+
+void db_register_alert_callback(db_alert_handler fcn)
+{
+	__atomic_store_n(&alert_fcn, fcn, __ATOMIC_RELEASE);
+}
+
+
+
+//
+// Internal functions
+//
+static void _db_alert_change(int alert, bool active, float val)
+{
+	db_alert_handler fcn;
+	
+	if (active) {
+		rule_list[alert].fire_count += 1;
+		__atomic_fetch_or(&active_mask, 1UL << alert, __ATOMIC_RELEASE);
+		ESP_LOGI(TAG, "%s (%s = %.2f)", rule_list[alert].text, db_catalog_get(rule_list[alert].item)->name, val);
+	} else {
+		__atomic_fetch_and(&active_mask, ~(1UL << alert), __ATOMIC_RELEASE);
+	}
+	
+	fcn = __atomic_load_n(&alert_fcn, __ATOMIC_ACQUIRE);
+	if (fcn != NULL) {
+		fcn(alert, active, val);
+	}
+}
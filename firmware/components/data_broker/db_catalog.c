@@ -0,0 +1,126 @@
+/*
+ * Data Broker Signal Catalog
+ *
+ * Item ID indexed table of per-item metadata: display name and unit, display range and
+ * precision, the GUI smoothing filter used on fast interfaces, the default request
+ * period and the deadband for persisting the last-known value.  Everything that needs to
+ * know something about an item (broker, scheduler, tiles, snapshot logger) looks it up
+ * here with one array index instead of keeping its own table.
+ *
+ * The display ranges start at the defaults below and are overridden by the vehicle
+ * manager for the selected vehicle before the GUI builds its tiles.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "data_broker.h"
+#include <string.h>
+
+
+
+//
+// Local constants
+//
+
+// Shorthand for the catalog table
+#define EMA      DB_FILTER_EMA
+#define NONE     DB_FILTER_NONE
+#define EMA_FAST DB_FAST_IF_EMA_ALPHA
+
+
+
+//
+// Local variables
+//
+
+// Columns: name, unit, min, max, precision, filter, filter param, request period (mSec),
+// persist deadband
+static const db_signal_t catalog_default[DB_NUM_ITEMS] = {
+	[DB_ITEM_NONE]              = {NULL,        "",     0.0,    0.0,    0, NONE, 0,        0,     0.0},
+	[DB_ITEM_HV_BATT_V]         = {"HV V",      "V",    0.0,    500.0,  1, EMA,  EMA_FAST, 500,   2.0},
+	[DB_ITEM_HV_BATT_I]         = {"HV I",      "A",    -150.0, 450.0,  0, EMA,  EMA_FAST, 0,     0.0},
+	[DB_ITEM_HV_BATT_MIN_T]     = {"HV Tmin",   "C",    -20.0,  60.0,   0, EMA,  EMA_FAST, 5000,  1.0},
+	[DB_ITEM_HV_BATT_MAX_T]     = {"HV Tmax",   "C",    -20.0,  60.0,   0, EMA,  EMA_FAST, 5000,  1.0},
+	[DB_ITEM_LV_BATT_V]         = {"LV V",      "V",    10.0,   16.0,   1, EMA,  EMA_FAST, 1000,  0.1},
+	[DB_ITEM_LV_BATT_I]         = {"LV I",      "A",    -50.0,  50.0,   1, EMA,  EMA_FAST, 1000,  0.0},
+	[DB_ITEM_LV_BATT_T]         = {"LV T",      "C",    -20.0,  60.0,   0, EMA,  EMA_FAST, 5000,  1.0},
+	[DB_ITEM_AUX_KW]            = {"Aux kW",    "kW",   0.0,    8.0,    1, EMA,  EMA_FAST, 250,   0.0},
+	[DB_ITEM_FRONT_TORQUE]      = {"F Trq",     "Nm",   -100.0, 250.0,  0, EMA,  EMA_FAST, 0,     0.0},
+	[DB_ITEM_REAR_TORQUE]       = {"R Trq",     "Nm",   -100.0, 250.0,  0, EMA,  EMA_FAST, 0,     0.0},
+	[DB_ITEM_SPEED]             = {"Speed",     "km/h", 0.0,    200.0,  0, EMA,  EMA_FAST, 0,     0.0},
+	[DB_ITEM_GPS_ELEVATION]     = {"Elev",      "m",    -100.0, 3000.0, 0, EMA,  EMA_FAST, 1000,  0.0},
+	[DB_ITEM_HV_POWER_KW]       = {"HV kW",     "kW",   -40.0,  160.0,  0, EMA,  EMA_FAST, 0,     0.0},
+	[DB_ITEM_HV_ENERGY_KWH]     = {"HV kWh",    "kWh",  -100.0, 100.0,  2, NONE, 0,        0,     0.0},
+	[DB_ITEM_FRONT_MECH_KW]     = {"F kW",      "kW",   -40.0,  160.0,  0, EMA,  EMA_FAST, 0,     0.0},
+	[DB_ITEM_REAR_MECH_KW]      = {"R kW",      "kW",   -40.0,  160.0,  0, EMA,  EMA_FAST, 0,     0.0},
+	[DB_ITEM_LONG_ACCEL]        = {"Long g",    "g",    -1.0,   1.0,    2, EMA,  EMA_FAST, 0,     0.0},
+	[DB_ITEM_LAT_ACCEL]         = {"Lat g",     "g",    -1.0,   1.0,    2, EMA,  EMA_FAST, 0,     0.0},
+	[DB_ITEM_FUSED_SPEED]       = {"Fused spd", "km/h", 0.0,    200.0,  0, EMA,  EMA_FAST, 0,     0.0},
+	[DB_ITEM_TRIP_TRACTION_KWH] = {"Trip kWh",  "kWh",  0.0,    100.0,  2, NONE, 0,        0,     0.0},
+	[DB_ITEM_TRIP_REGEN_KWH]    = {"Regen kWh", "kWh",  0.0,    100.0,  2, NONE, 0,        0,     0.0},
+	[DB_ITEM_TRIP_AUX_KWH]      = {"Aux kWh",   "kWh",  0.0,    100.0,  2, NONE, 0,        0,     0.0},
+	[DB_ITEM_TRIP_DIST_KM]      = {"Trip km",   "km",   0.0,    1000.0, 1, NONE, 0,        0,     0.0},
+	[DB_ITEM_TRIP_WH_PER_KM]    = {"Wh/km",     "Wh/km", 0.0,   400.0,  0, NONE, 0,        0,     0.0},
+	[DB_ITEM_TRIP_REGEN_PCT]    = {"Regen %",   "%",    0.0,    100.0,  0, NONE, 0,        0,     0.0},
+	[DB_ITEM_TRIP_AUX_PCT]      = {"Aux %",     "%",    0.0,    100.0,  0, NONE, 0,        0,     0.0},
+	[DB_ITEM_CELL_MIN_V]        = {"Cell min",  "V",    2.5,    4.3,    3, NONE, 0,        2000,  0.01},
+	[DB_ITEM_CELL_MAX_V]        = {"Cell max",  "V",    2.5,    4.3,    3, NONE, 0,        2000,  0.01},
+	[DB_ITEM_HV_SOC]            = {"SoC",       "%",    0.0,    100.0,  1, NONE, 0,        5000,  0.5},
+	[DB_ITEM_HV_SOH]            = {"SoH",       "%",    0.0,    100.0,  1, NONE, 0,        10000, 0.0},
+	[DB_ITEM_GPS_LAT]           = {"Lat",       "deg",  -90.0,  90.0,   5, NONE, 0,        1000,  0.0},
+	[DB_ITEM_GPS_LON]           = {"Lon",       "deg",  -180.0, 180.0,  5, NONE, 0,        1000,  0.0},
+	[DB_ITEM_GPS_HEADING]       = {"Heading",   "deg",  0.0,    360.0,  0, NONE, 0,        1000,  0.0},
+	[DB_ITEM_WH_PER_KM_SHORT]   = {"Wh/km 1k",  "Wh/km", 0.0,   400.0,  0, NONE, 0,        0,     0.0},
+	[DB_ITEM_WH_PER_KM_LONG]    = {"Wh/km 10k", "Wh/km", 0.0,   400.0,  0, NONE, 0,        0,     0.0},
+	[DB_ITEM_RANGE_KM]          = {"Range",     "km",   0.0,    600.0,  0, NONE, 0,        0,     0.0},
+	[DB_ITEM_FRONT_SPLIT_PCT]   = {"F split",   "%",    0.0,    100.0,  0, NONE, 0,        0,     0.0},
+	[DB_ITEM_ROAD_GRADE_PCT]    = {"Grade",     "%",    -15.0,  15.0,   1, NONE, 0,        0,     0.0},
+	[DB_ITEM_CLIMB_RATE]        = {"Climb",     "m/s",  -3.0,   3.0,    1, NONE, 0,        0,     0.0}
+};
+
+// Working copy with the selected vehicle's ranges
+static db_signal_t catalog[DB_NUM_ITEMS];
+
+
+
+//
+// API
+//
+
+// Returns the DB_ITEM_NONE entry for unknown items so the result can always be used
+const db_signal_t* db_catalog_get(int item)
+{
+	if ((item < 0) || (item >= DB_NUM_ITEMS)) {
+		item = DB_ITEM_NONE;
+	}
+	
+	return &catalog[item];
+}
+
+
+void db_catalog_set_range(int item, float min, float max)
+{
+	if ((item > DB_ITEM_NONE) && (item < DB_NUM_ITEMS) && (min < max)) {
+		catalog[item].min = min;
+		catalog[item].max = max;
+	}
+}
+
+
+void db_catalog_reset_ranges()
+{
+	memcpy(catalog, catalog_default, sizeof(catalog));
+}
@@ -0,0 +1,156 @@
+/*
+ * Data Broker Latency Trace
+ *
+ * Optional (DB_LATENCY_TRACE) histograms of the time from the CAN driver receiving the
+ * frame that completed a response to each later stage: the vehicle manager taking the
+ * response, its values being published, their delivery to a GUI handler and the end of
+ * the render pass that follows.  Percentiles of each stage are logged periodically so
+ * changes can be judged on the complete reception to display latency.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "data_broker.h"
+
+#ifdef DB_LATENCY_TRACE
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <string.h>
+
+
+
+//
+// Local variables
+//
+static const char* TAG = "db_latency";
+
+static const char* stage_names[DB_LAT_NUM_STAGES] = {"VM", "Publish", "GUI", "Frame"};
+
+// Histograms, each stage written by one task (counts lost while they are cleared by the
+// logger don't matter)
+static uint32_t lat_hist[DB_LAT_NUM_STAGES][DB_LAT_NUM_BINS];
+static uint32_t lat_max_usec[DB_LAT_NUM_STAGES];
+
+// Oldest reception time of the values delivered to the GUI since the last render pass
+static int64_t frame_rx_usec = 0;
+
+static int64_t last_log_usec = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static int _db_lat_percentile_msec(int stage, uint32_t total, int pct);
+static void _db_lat_log();
+
+
+
+//
+// API
+//
+
+// Record the latency of a stage for data received by the driver at rx_usec
+void db_lat_note(int stage, int64_t rx_usec)
+{
+	int64_t dt_usec;
+	int bin;
+	
+	if ((stage < 0) || (stage >= DB_LAT_NUM_STAGES) || (rx_usec <= 0)) {
+		return;
+	}
+	
+	dt_usec = esp_timer_get_time() - rx_usec;
+	if (dt_usec < 0) {
+		dt_usec = 0;
+	}
+	
+	bin = dt_usec / DB_LAT_BIN_USEC;
+	if (bin >= DB_LAT_NUM_BINS) bin = DB_LAT_NUM_BINS - 1;
+	lat_hist[stage][bin] += 1;
+	if (dt_usec > lat_max_usec[stage]) lat_max_usec[stage] = (uint32_t) dt_usec;
+	
+	if ((stage == DB_LAT_STAGE_GUI) && ((frame_rx_usec == 0) || (rx_usec < frame_rx_usec))) {
+		frame_rx_usec = rx_usec;
+	}
+}
+
+
+// Called by the GUI task after each render pass.  Values delivered before it are shown
+// by it.  Also logs the percentiles every DB_LAT_LOG_MSEC.
+void db_lat_note_frame()
+{
+	int64_t cur_usec;
+	
+	if (frame_rx_usec != 0) {
+		db_lat_note(DB_LAT_STAGE_FRAME, frame_rx_usec);
+		frame_rx_usec = 0;
+	}
+	
+	cur_usec = esp_timer_get_time();
+	if ((cur_usec - last_log_usec) >= ((int64_t) DB_LAT_LOG_MSEC * 1000)) {
+		last_log_usec = cur_usec;
+		_db_lat_log();
+	}
+}
+
+
+
+//
+// Internal functions
+//
+
+// Returns the upper edge of the bin holding the percentile
+static int _db_lat_percentile_msec(int stage, uint32_t total, int pct)
+{
+	uint32_t count = 0;
+	uint32_t target;
+	
+	target = (uint32_t) (((uint64_t) total * pct + 99) / 100);
+	for (int i=0; i<DB_LAT_NUM_BINS; i++) {
+		count += lat_hist[stage][i];
+		if (count >= target) {
+			return ((i + 1) * DB_LAT_BIN_USEC) / 1000;
+		}
+	}
+	
+	return (DB_LAT_NUM_BINS * DB_LAT_BIN_USEC) / 1000;
+}
+
+
+static void _db_lat_log()
+{
+	uint32_t total;
+	
+	ESP_LOGI(TAG, "Latency from CAN RX (mSec): p50 p90 p99 max (samples)");
+	for (int s=0; s<DB_LAT_NUM_STAGES; s++) {
+		total = 0;
+		for (int i=0; i<DB_LAT_NUM_BINS; i++) {
+			total += lat_hist[s][i];
+		}
+		if (total != 0) {
+			ESP_LOGI(TAG, "  %-8s %3d %3d %3d %3lu (%lu)", stage_names[s],
+				_db_lat_percentile_msec(s, total, 50), _db_lat_percentile_msec(s, total, 90),
+				_db_lat_percentile_msec(s, total, 99), lat_max_usec[s] / 1000, total);
+		}
+	}
+	
+	memset(lat_hist, 0, sizeof(lat_hist));
+	memset(lat_max_usec, 0, sizeof(lat_max_usec));
+}
+
+#endif /* DB_LATENCY_TRACE */
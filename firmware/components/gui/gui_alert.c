@@ -0,0 +1,146 @@
+/*
+ * GUI alert banner - shows the data broker's active alerts on the top layer so they are
+ * visible over any screen or tile, and sounds the buzzer when one becomes active.
+ *
+ * Alerts are evaluated by the broker on the producer's task.  Its callback only starts
+ * the buzzer and notifies the GUI task, which updates the banner on its next pass.
+ * Touching the banner hides the alerts showing until another becomes active.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "Buzzer.h"
+#include "data_broker.h"
+#include "gui_alert.h"
+#include "gui_task.h"
+#include <stdio.h>
+
+
+
+//
+// Variables
+//
+static lv_obj_t* alert_lbl;
+static char alert_buf[GUI_ALERT_TEXT_LEN];
+
+// Alerts showing and those dismissed by the user
+static uint32_t shown_mask = 0;
+static uint32_t ack_mask = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _gui_alert_db_cb(int alert, bool active, float val);
+static void _gui_alert_click_cb(lv_event_t* e);
+
+
+
+//
+// API
+//
+void gui_alert_init()
+{
+	alert_lbl = lv_label_create(lv_layer_top());
+	lv_obj_set_width(alert_lbl, lv_pct(90));
+	lv_obj_set_style_text_font(alert_lbl, &lv_font_montserrat_18, LV_PART_MAIN);
+	lv_obj_set_style_text_color(alert_lbl, lv_color_white(), LV_PART_MAIN);
+	lv_obj_set_style_text_align(alert_lbl, LV_TEXT_ALIGN_CENTER, LV_PART_MAIN);
+	lv_obj_set_style_bg_color(alert_lbl, lv_palette_main(LV_PALETTE_RED), LV_PART_MAIN);
+	lv_obj_set_style_bg_opa(alert_lbl, LV_OPA_COVER, LV_PART_MAIN);
+	lv_obj_set_style_radius(alert_lbl, 6, LV_PART_MAIN);
+	lv_obj_set_style_pad_all(alert_lbl, 6, LV_PART_MAIN);
+	lv_obj_align(alert_lbl, LV_ALIGN_BOTTOM_MID, 0, -8);
+	lv_label_set_text_static(alert_lbl, alert_buf);
+	lv_obj_add_flag(alert_lbl, LV_OBJ_FLAG_HIDDEN);
+	
+	// The top layer only passes touches to objects that ask for them
+	lv_obj_add_flag(alert_lbl, LV_OBJ_FLAG_CLICKABLE);
+	lv_obj_add_event_cb(alert_lbl, _gui_alert_click_cb, LV_EVENT_CLICKED, NULL);
+	
+	db_register_alert_callback(_gui_alert_db_cb);
+	
+	// Show any that fired before we were ready
+	gui_alert_update();
+}
+
+
+// Called by the GUI task on GUI_NOTIFY_ALERT
+void gui_alert_update()
+{
+	uint32_t active;
+	uint32_t show;
+	int first = -1;
+	int others = 0;
+	
+	active = db_get_active_alerts();
+	
+	// Cleared alerts may be shown again if they return
+	ack_mask &= active;
+	show = active & ~ack_mask;
+	if (show == shown_mask) return;
+	
+	// Bring the display up for a new alert
+	if ((show & ~shown_mask) != 0) {
+		lv_disp_trig_activity(NULL);
+	}
+	shown_mask = show;
+	
+	for (int i=0; i<DB_MAX_ALERTS; i++) {
+		if ((show & (1UL << i)) != 0) {
+			if (first < 0) {
+				first = i;
+			} else {
+				others++;
+			}
+		}
+	}
+	
+	if (first < 0) {
+		lv_obj_add_flag(alert_lbl, LV_OBJ_FLAG_HIDDEN);
+	} else {
+		if (others == 0) {
+			snprintf(alert_buf, GUI_ALERT_TEXT_LEN, "%s", db_get_alert_text(first));
+		} else {
+			snprintf(alert_buf, GUI_ALERT_TEXT_LEN, "%s (+%d)", db_get_alert_text(first), others);
+		}
+		lv_label_set_text_static(alert_lbl, alert_buf);
+		lv_obj_clear_flag(alert_lbl, LV_OBJ_FLAG_HIDDEN);
+	}
+}
+
+
+
+//
+// Internal functions
+//
+
+// Runs on the producer's task
+static void _gui_alert_db_cb(int alert, bool active, float val)
+{
+	if (active) {
+		Buzzer_Play(BUZZER_SEQ_ALERT);
+	}
+	xTaskNotify(task_handle_gui, GUI_NOTIFY_ALERT, eSetBits);
+}
+
+
+static void _gui_alert_click_cb(lv_event_t* e)
+{
+	ack_mask |= shown_mask;
+	gui_alert_update();
+}
@@ -0,0 +1,45 @@
+/*
+ * GUI alert banner - shows the data broker's active alerts on the top layer so they are
+ * visible over any screen or tile, and sounds the buzzer when one becomes active.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef GUI_ALERT_H
+#define GUI_ALERT_H
+
+#include "lvgl.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Banner text buffer (alert text plus a count of the others active)
+#define GUI_ALERT_TEXT_LEN      48
+
+
+
+//
+// API
+//
+void gui_alert_init();
+void gui_alert_update();
+
+#endif /* GUI_ALERT_H */
@@ -0,0 +1,372 @@
+/*
+ * GUI benchmark - drive the data broker with synthetic waveforms (ramps, steps and noise
+ * over each item's display range) while cycling through the main screen tiles, measuring
+ * the frame rate and frame time percentiles, core loads and LVGL memory on each tile, and
+ * log a report so firmware builds and LVGL settings can be compared without a vehicle.
+ * A final pass replays recorded or scripted swipes under the same load to time the tile
+ * transitions.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "can_task.h"
+#include "data_broker.h"
+#include "disp_driver.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "gui_bench.h"
+#include "gui_screen_main.h"
+#include "gui_touch_rec.h"
+#include "gui_utilities.h"
+#include "mon_task.h"
+#include "vehicle_manager.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+
+
+//
+// Private constants
+//
+// Waveform assigned to each item (by item ID modulo the number of waveforms)
+#define WAVE_RAMP  0
+#define WAVE_STEP  1
+#define WAVE_NOISE 2
+#define NUM_WAVES  3
+
+
+
+//
+// Variables
+//
+static const char* TAG = "gui_bench";
+
+static bool running = false;
+
+static lv_disp_t* bench_disp;
+static lv_timer_cb_t prev_refr_cb;
+static void (*prev_monitor_cb)(lv_disp_drv_t* disp_drv, uint32_t time, uint32_t px);
+
+static lv_timer_t* data_timer;
+static lv_timer_t* tile_timer;
+
+// Items driven with synthetic values
+static db_mask_t bench_items;
+
+static int64_t start_usec;
+
+// Tile being measured and the tile displayed before the benchmark started
+static int bench_tile;
+static int orig_tile;
+static int64_t measure_start_usec;     // Frames before this (while the tile settles) aren't counted
+static int64_t replay_start_usec;
+
+// Set by the monitor callback when LVGL actually redrew something
+static bool saw_frame;
+
+// Current tile's frame statistics (frames only counted after the tile has settled)
+static uint32_t frames;
+static uint32_t max_usec;
+static uint32_t hist[GUI_BENCH_HIST_BINS];
+
+static uint64_t render_usec;
+static uint64_t flush_usec;
+
+static int16_t cell_v[GUI_BENCH_NUM_CELLS];
+
+static gui_bench_result_handler result_handler = NULL;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _gui_bench_refr_timer_cb(lv_timer_t* timer);
+static void _gui_bench_monitor_cb(lv_disp_drv_t* disp_drv, uint32_t time, uint32_t px);
+static void _gui_bench_data_timer_cb(lv_timer_t* timer);
+static void _gui_bench_tile_timer_cb(lv_timer_t* timer);
+static void _gui_bench_replay_timer_cb(lv_timer_t* timer);
+static void _gui_bench_start_tile(int n);
+static void _gui_bench_start_replay();
+static void _gui_bench_reset_stats();
+static void _gui_bench_log(const char* name, uint32_t msec);
+static void _gui_bench_stop();
+static uint32_t _gui_bench_percentile(int pct);
+
+
+
+//
+// API
+//
+void gui_bench_start(lv_disp_t* disp)
+{
+	db_mask_t supported;
+	
+	if (running || (gui_screen_main_get_num_tiles() == 0)) {
+		return;
+	}
+	
+	// Stop vehicle data from competing with the synthetic values
+	can_task_set_bench_mode(true);
+	
+	// Drive everything the vehicle supplies except what the data broker derives and the
+	// on-board sensors
+	supported = vm_get_supported_item_mask();
+	bench_items = supported & ~db_get_derived_outputs(supported) & ~db_get_local_items();
+	
+	// Wrap LVGL's refresh timer so each frame can be timed end-to-end
+	bench_disp = disp;
+	prev_refr_cb = disp->refr_timer->timer_cb;
+	prev_monitor_cb = disp->driver->monitor_cb;
+	lv_timer_set_cb(disp->refr_timer, _gui_bench_refr_timer_cb);
+	disp->driver->monitor_cb = _gui_bench_monitor_cb;
+	
+	ESP_LOGI(TAG, "Start: %d tiles, %d mSec each, data at %d Hz", gui_screen_main_get_num_tiles(), GUI_BENCH_TILE_MSEC, GUI_BENCH_UPDATE_HZ);
+	running = true;
+	start_usec = esp_timer_get_time();
+	orig_tile = gui_screen_main_get_tile();
+	_gui_bench_start_tile(0);
+	
+	data_timer = lv_timer_create(_gui_bench_data_timer_cb, 1000 / GUI_BENCH_UPDATE_HZ, NULL);
+	tile_timer = lv_timer_create(_gui_bench_tile_timer_cb, GUI_BENCH_TILE_MSEC, NULL);
+}
+
+
+bool gui_bench_running()
+{
+	return running;
+}
+
+
+void gui_bench_set_result_handler(gui_bench_result_handler handler)
+{
+	result_handler = handler;
+}
+
+
+
+//
+// Internal functions
+//
+static void _gui_bench_refr_timer_cb(lv_timer_t* timer)
+{
+	int64_t t;
+	uint32_t frame_usec;
+	uint32_t frame_flush_usec;
+	int bin;
+	
+	saw_frame = false;
+	(void) disp_driver_get_flush_usec();
+	t = esp_timer_get_time();
+	_lv_disp_refr_timer(timer);
+	frame_usec = (uint32_t) (esp_timer_get_time() - t);
+	
+	if (saw_frame && (t >= measure_start_usec)) {
+		frame_flush_usec = disp_driver_get_flush_usec();
+		if (frame_flush_usec > frame_usec) frame_flush_usec = frame_usec;
+		
+		frames += 1;
+		render_usec += frame_usec - frame_flush_usec;
+		flush_usec += frame_flush_usec;
+		if (frame_usec > max_usec) max_usec = frame_usec;
+		
+		bin = frame_usec / GUI_BENCH_HIST_BIN_USEC;
+		if (bin >= GUI_BENCH_HIST_BINS) bin = GUI_BENCH_HIST_BINS - 1;
+		hist[bin] += 1;
+	}
+}
+
+
+static void _gui_bench_monitor_cb(lv_disp_drv_t* disp_drv, uint32_t time, uint32_t px)
+{
+	saw_frame = true;
+}
+
+
+static void _gui_bench_data_timer_cb(lv_timer_t* timer)
+{
+	const db_signal_t* sigP;
+	float t;
+	float f;
+	
+	t = (float) (esp_timer_get_time() - start_usec) / 1000000.0;
+	
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		if ((bench_items & DB_MASK(i)) == 0) continue;
+		
+		// Fraction of the item's display range
+		switch (i % NUM_WAVES) {
+			case WAVE_RAMP:
+				f = fmodf(t, GUI_BENCH_RAMP_SEC) / GUI_BENCH_RAMP_SEC;
+				break;
+			case WAVE_STEP:
+				f = (fmodf(t, 2 * GUI_BENCH_STEP_SEC) < GUI_BENCH_STEP_SEC) ? 0.25 : 0.75;
+				break;
+			default:
+				f = 0.5 + GUI_BENCH_NOISE_FRAC * (((float) (esp_random() % 2001) / 1000.0) - 1.0);
+				break;
+		}
+		
+		sigP = db_catalog_get(i);
+		db_set_data_item_value(i, sigP->min + f * (sigP->max - sigP->min));
+	}
+	
+	// Cell voltages ripple across the pack
+	for (int i=0; i<GUI_BENCH_NUM_CELLS; i++) {
+		f = 0.5 + 0.5 * sinf(2 * M_PI * (t / GUI_BENCH_RAMP_SEC + (float) i / GUI_BENCH_NUM_CELLS));
+		cell_v[i] = GUI_BENCH_CELL_MIN_MV + (int16_t) (f * (GUI_BENCH_CELL_MAX_MV - GUI_BENCH_CELL_MIN_MV));
+	}
+	db_set_cell_array(DB_CELL_ARRAY_V, GUI_BENCH_NUM_CELLS, cell_v, esp_timer_get_time());
+}
+
+
+static void _gui_bench_tile_timer_cb(lv_timer_t* timer)
+{
+	char name[12];
+	
+	sprintf(name, "Tile %d", bench_tile);
+	_gui_bench_log(name, GUI_BENCH_TILE_MSEC - GUI_BENCH_SETTLE_MSEC);
+	
+	if ((bench_tile + 1) < gui_screen_main_get_num_tiles()) {
+		_gui_bench_start_tile(bench_tile + 1);
+	} else {
+#ifdef GUI_BENCH_EN_REPLAY
+		_gui_bench_start_replay();
+#else
+		_gui_bench_stop();
+#endif
+	}
+}
+
+
+static void _gui_bench_replay_timer_cb(lv_timer_t* timer)
+{
+	if (!gui_touch_replay_running()) {
+		_gui_bench_log("Replay", (uint32_t) ((esp_timer_get_time() - replay_start_usec) / 1000));
+		_gui_bench_stop();
+	}
+}
+
+
+static void _gui_bench_start_tile(int n)
+{
+	bench_tile = n;
+	_gui_bench_reset_stats();
+	
+	gui_screen_main_show_tile(n);
+	measure_start_usec = esp_timer_get_time() + GUI_BENCH_SETTLE_MSEC * 1000;
+}
+
+
+// Replay gestures from the first tile, measuring every frame (the transitions are the point)
+static void _gui_bench_start_replay()
+{
+	_gui_bench_reset_stats();
+	gui_screen_main_show_tile(0);
+	
+	if (!gui_touch_replay_start_file() && !gui_touch_replay_start_swipes(gui_screen_main_get_num_tiles() - 1)) {
+		_gui_bench_stop();
+		return;
+	}
+	replay_start_usec = esp_timer_get_time();
+	measure_start_usec = replay_start_usec;
+	
+	lv_timer_set_cb(tile_timer, _gui_bench_replay_timer_cb);
+	lv_timer_set_period(tile_timer, GUI_BENCH_REPLAY_POLL_MSEC);
+}
+
+
+static void _gui_bench_reset_stats()
+{
+	frames = 0;
+	max_usec = 0;
+	render_usec = 0;
+	flush_usec = 0;
+	memset(hist, 0, sizeof(hist));
+}
+
+
+static void _gui_bench_log(const char* name, uint32_t msec)
+{
+	gui_bench_result_t r;
+	
+	if (msec == 0) msec = 1;
+	
+	r.frames = frames;
+	r.msec = msec;
+	r.p50_usec = _gui_bench_percentile(50);
+	r.p90_usec = _gui_bench_percentile(90);
+	r.p99_usec = _gui_bench_percentile(99);
+	r.max_usec = max_usec;
+	r.render_avg_usec = (frames == 0) ? 0 : (uint32_t) (render_usec / frames);
+	r.flush_avg_usec = (frames == 0) ? 0 : (uint32_t) (flush_usec / frames);
+	
+	ESP_LOGI(TAG, "%s: %lu.%lu fps  p50 %lu  p90 %lu  p99 %lu  max %lu.%lu  render %lu.%lu  flush %lu.%lu mSec  load %d/%d %%",
+		name,
+		frames * 1000 / msec, (frames * 10000 / msec) % 10,
+		r.p50_usec / 1000,
+		r.p90_usec / 1000,
+		r.p99_usec / 1000,
+		max_usec / 1000, (max_usec % 1000) / 100,
+		r.render_avg_usec / 1000, (r.render_avg_usec % 1000) / 100,
+		r.flush_avg_usec / 1000, (r.flush_avg_usec % 1000) / 100,
+		mon_get_core_load(0), mon_get_core_load(1));
+	
+	if (result_handler != NULL) {
+		result_handler(name, &r);
+	}
+}
+
+
+static void _gui_bench_stop()
+{
+	lv_timer_del(data_timer);
+	lv_timer_del(tile_timer);
+	gui_touch_replay_stop();
+	
+	lv_timer_set_cb(bench_disp->refr_timer, prev_refr_cb);
+	bench_disp->driver->monitor_cb = prev_monitor_cb;
+	
+	gui_dump_mem_info();
+	ESP_LOGI(TAG, "Done");
+	
+	gui_screen_main_show_tile(orig_tile);
+	can_task_set_bench_mode(false);
+	running = false;
+}
+
+
+// Upper edge (uSec) of the histogram bin holding the given percentile of frames
+static uint32_t _gui_bench_percentile(int pct)
+{
+	uint32_t n = 0;
+	uint32_t target = (frames * pct + 99) / 100;
+	
+	if (frames == 0) {
+		return 0;
+	}
+	
+	for (int i=0; i<GUI_BENCH_HIST_BINS; i++) {
+		n += hist[i];
+		if (n >= target) {
+			return (i + 1) * GUI_BENCH_HIST_BIN_USEC;
+		}
+	}
+	
+	return GUI_BENCH_HIST_BINS * GUI_BENCH_HIST_BIN_USEC;
+}
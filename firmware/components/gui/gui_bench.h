@@ -0,0 +1,101 @@
+/*
+ * GUI benchmark - drive the data broker with synthetic waveforms (ramps, steps and noise
+ * over each item's display range) while cycling through the main screen tiles, measuring
+ * the frame rate and frame time percentiles, core loads and LVGL memory on each tile, and
+ * log a report so firmware builds and LVGL settings can be compared without a vehicle.
+ * Frame times are split into rendering and the display driver's flush so a tile's own
+ * drawing cost can be followed separately from the panel.  A final pass replays recorded
+ * or scripted swipes under the same load to time the tile transitions.  The desktop
+ * simulator (sim/gui_sim.c) runs the same benchmark on the host.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef GUI_BENCH_H
+#define GUI_BENCH_H
+
+#include "lvgl.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Synthetic item update rate
+#define GUI_BENCH_UPDATE_HZ     20
+
+// Time spent on each tile, the first part of it (while the tile is built and its
+// animations start) not measured
+#define GUI_BENCH_TILE_MSEC     10000
+#define GUI_BENCH_SETTLE_MSEC   1000
+
+// Comment out to skip the gesture pass after the tiles.  It replays the touch recording
+// (GUI_TOUCH_REC_FILE) if there is one, otherwise swipes through every tile, through the
+// touch input device and measures all of its frames.  gui_task must install
+// gui_touch_rec_read_cb as the touch read callback.
+#define GUI_BENCH_EN_REPLAY
+
+// Interval to check if the gesture replay has finished
+#define GUI_BENCH_REPLAY_POLL_MSEC 100
+
+// Waveforms: ramp period, step period and noise amplitude (fraction of the item's range)
+#define GUI_BENCH_RAMP_SEC      8.0
+#define GUI_BENCH_STEP_SEC      2.0
+#define GUI_BENCH_NOISE_FRAC    0.1
+
+// Frame time histogram bins (last bin holds everything longer)
+#define GUI_BENCH_HIST_BIN_USEC 1000
+#define GUI_BENCH_HIST_BINS     100
+
+// Synthetic cell voltage array
+#define GUI_BENCH_NUM_CELLS     96
+#define GUI_BENCH_CELL_MIN_MV   3600
+#define GUI_BENCH_CELL_MAX_MV   4100
+
+
+
+//
+// Typedefs
+//
+
+// Measurements of one tile (or the replay pass)
+typedef struct {
+	uint32_t frames;
+	uint32_t msec;                       // Measured time
+	uint32_t p50_usec;                   // Frame time percentiles (histogram bin upper edges)
+	uint32_t p90_usec;
+	uint32_t p99_usec;
+	uint32_t max_usec;
+	uint32_t render_avg_usec;            // Average frame time outside the driver's flush
+	uint32_t flush_avg_usec;             // Average time in the driver's flush per frame
+} gui_bench_result_t;
+
+// Called with each result as it is logged ("Tile n" or "Replay")
+typedef void (*gui_bench_result_handler)(const char* name, const gui_bench_result_t* resultP);
+
+
+
+//
+// API
+//
+void gui_bench_start(lv_disp_t* disp);
+bool gui_bench_running();
+void gui_bench_set_result_handler(gui_bench_result_handler handler);
+
+#endif /* GUI_BENCH_H */
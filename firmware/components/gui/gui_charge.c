@@ -0,0 +1,415 @@
+/*
+ * Charging session detection - switch the vehicle manager to its low-rate charging request
+ * profile while the parked vehicle is charging and record a compact charge curve (average
+ * power and highest pack temperature at each percent of state of charge) to the log
+ * partition.
+ *
+ * HV power is only watched (as a background request) once the vehicle has been parked for
+ * a while so nothing extra is polled while driving.  The curve is accumulated in RAM and
+ * written by a short-lived low priority task so the GUI never waits on the flash.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "data_broker.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "gui_charge.h"
+#include "vehicle_manager.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+//
+// Private constants
+//
+
+// Session states
+#define CHG_STATE_IDLE    0
+#define CHG_STATE_PARKED  1
+#define CHG_STATE_ACTIVE  2
+
+// Age (mSec) after which speed is no longer current (vehicle stopped responding)
+#define SPEED_STALE_MSEC  5000
+
+// Longest interval integrated for energy (longer gaps are missing data)
+#define MAX_SAMPLE_MSEC   (6 * VM_CHARGE_PERIOD_MSEC)
+
+// One bin per percent SoC
+#define NUM_SOC_BINS      101
+
+
+
+//
+// Private typedefs
+//
+typedef struct {
+	float kw_sum;
+	uint16_t count;
+	int8_t max_temp_c;
+} soc_bin_t;
+
+
+
+//
+// Variables
+//
+static const char* TAG = "gui_charge";
+
+static bool has_charge;              // Vehicle reports HV power (and speed if it has it)
+static bool has_soc;
+static bool has_temp;
+static bool has_speed;
+
+static int chg_state = CHG_STATE_IDLE;
+static int64_t parked_usec;          // When the vehicle was first seen parked (0 = not)
+static int64_t high_usec;            // Start of charging level power while parked (0 = not)
+static int64_t low_usec;             // Start of low power while charging (0 = not)
+static int64_t last_kw_usec;         // Timestamp of the last HV power sample used
+
+// Current session
+static int64_t session_start_usec;
+static float session_kwh;
+static int session_start_soc;
+static int session_end_soc;
+static int session_saved_soc;
+static soc_bin_t soc_bin[NUM_SOC_BINS];
+
+// File image being written and its session sequence number (assigned by the first save)
+static uint8_t save_buf[sizeof(gui_chg_hdr_t) + NUM_SOC_BINS * sizeof(gui_chg_point_t)];
+static int save_len;
+static volatile bool save_busy = false;
+static volatile bool seq_assigned;
+static uint32_t session_seq;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _gui_charge_set_watch(bool parked);
+static void _gui_charge_start(int64_t cur_usec);
+static void _gui_charge_sample(float kw, int64_t ts_usec);
+static void _gui_charge_end(int64_t cur_usec);
+static void _gui_charge_save(int64_t cur_usec);
+static void _gui_charge_save_task(void* arg);
+static uint32_t _gui_charge_find_seq();
+
+
+
+//
+// API
+//
+void gui_charge_init()
+{
+	db_mask_t mask = vm_get_supported_item_mask();
+	
+	has_charge = (db_get_derived_inputs(DB_MASK(DB_ITEM_HV_POWER_KW)) & ~mask) == 0;
+	has_soc = (mask & DB_MASK(DB_ITEM_HV_SOC)) != 0;
+	has_temp = (mask & DB_MASK(DB_ITEM_HV_BATT_MAX_T)) != 0;
+	has_speed = (mask & DB_MASK(DB_ITEM_SPEED)) != 0;
+	
+	chg_state = CHG_STATE_IDLE;
+	parked_usec = 0;
+	if (has_charge) {
+		_gui_charge_set_watch(false);
+	}
+}
+
+
+// Called each pass of the GUI task after the data broker has been evaluated
+void gui_charge_eval()
+{
+	int64_t cur_usec;
+	int64_t kw_usec;
+	float speed;
+	float kw;
+	bool parked;
+	bool moving;
+	bool kw_valid;
+	
+	if (!has_charge) return;
+	
+	cur_usec = esp_timer_get_time();
+	kw_usec = 0;
+	
+	// Vehicles without a speed are always considered parked
+	if (has_speed) {
+		parked = db_get_data_item(DB_ITEM_SPEED, &speed, NULL) &&
+		         (db_get_data_item_age(DB_ITEM_SPEED) >= 0) &&
+		         (db_get_data_item_age(DB_ITEM_SPEED) < (SPEED_STALE_MSEC * 1000));
+		moving = parked && (speed > GUI_CHG_PARKED_KPH);
+		parked = parked && !moving;
+	} else {
+		parked = true;
+		moving = false;
+	}
+	
+	kw_valid = db_get_data_item(DB_ITEM_HV_POWER_KW, &kw, &kw_usec) && (kw_usec != last_kw_usec);
+	
+	switch (chg_state) {
+		case CHG_STATE_IDLE:
+			if (!parked) {
+				parked_usec = 0;
+			} else if (parked_usec == 0) {
+				parked_usec = cur_usec;
+			} else if ((cur_usec - parked_usec) >= (GUI_CHG_PARKED_MSEC * 1000)) {
+				// Start watching HV power
+				_gui_charge_set_watch(true);
+				high_usec = 0;
+				last_kw_usec = kw_usec;
+				chg_state = CHG_STATE_PARKED;
+			}
+			break;
+		
+		case CHG_STATE_PARKED:
+			if (moving) {
+				_gui_charge_set_watch(false);
+				parked_usec = 0;
+				chg_state = CHG_STATE_IDLE;
+			} else if (kw_valid) {
+				last_kw_usec = kw_usec;
+				if (kw < GUI_CHG_START_KW) {
+					high_usec = 0;
+				} else if (high_usec == 0) {
+					high_usec = kw_usec;
+				} else if ((kw_usec - high_usec) >= (GUI_CHG_START_MSEC * 1000)) {
+					_gui_charge_start(cur_usec);
+					chg_state = CHG_STATE_ACTIVE;
+				}
+			}
+			break;
+		
+		case CHG_STATE_ACTIVE:
+			if (kw_valid) {
+				_gui_charge_sample(kw, kw_usec);
+				if (kw >= GUI_CHG_END_KW) {
+					low_usec = 0;
+				} else if (low_usec == 0) {
+					low_usec = kw_usec;
+				}
+			}
+			
+			// Unplugged, finished or driving away (power that stops updating also ends it)
+			if (moving || ((low_usec != 0) && ((cur_usec - low_usec) >= (GUI_CHG_END_MSEC * 1000))) ||
+			    ((cur_usec - last_kw_usec) >= (GUI_CHG_END_MSEC * 1000))) {
+				_gui_charge_end(cur_usec);
+				high_usec = 0;
+				if (moving) {
+					_gui_charge_set_watch(false);
+					parked_usec = 0;
+					chg_state = CHG_STATE_IDLE;
+				} else {
+					chg_state = CHG_STATE_PARKED;
+				}
+			}
+			break;
+	}
+}
+
+
+bool gui_charge_active()
+{
+	return chg_state == CHG_STATE_ACTIVE;
+}
+
+
+
+//
+// Internal functions
+//
+
+// Request speed (to see the vehicle park) and, once parked, HV power in the background
+static void _gui_charge_set_watch(bool parked)
+{
+	db_mask_t mask = (has_speed) ? DB_MASK(DB_ITEM_SPEED) : 0;
+	
+	if (parked) {
+		mask |= DB_MASK(DB_ITEM_HV_POWER_KW);
+	}
+	vm_set_request_background_mask(mask);
+}
+
+
+static void _gui_charge_start(int64_t cur_usec)
+{
+	float soc;
+	
+	vm_set_request_profile(VM_PROFILE_CHARGING);
+	
+	memset(soc_bin, 0, sizeof(soc_bin));
+	session_start_usec = cur_usec;
+	session_kwh = 0;
+	session_start_soc = -1;
+	session_end_soc = -1;
+	if (has_soc && db_get_data_item(DB_ITEM_HV_SOC, &soc, NULL)) {
+		session_start_soc = (int) soc;
+	}
+	session_saved_soc = session_start_soc;
+	low_usec = 0;
+	seq_assigned = false;
+	
+	ESP_LOGI(TAG, "Charging started (soc %d)", session_start_soc);
+}
+
+
+static void _gui_charge_sample(float kw, int64_t ts_usec)
+{
+	soc_bin_t* bP;
+	float soc;
+	float temp;
+	int64_t dt_usec;
+	int n;
+	
+	dt_usec = ts_usec - last_kw_usec;
+	if ((dt_usec > 0) && (dt_usec < ((int64_t) MAX_SAMPLE_MSEC * 1000)) && (kw > 0)) {
+		session_kwh += kw * ((float) dt_usec / 3600000000.0);
+	}
+	last_kw_usec = ts_usec;
+	
+	if (!has_soc || !db_get_data_item(DB_ITEM_HV_SOC, &soc, NULL)) return;
+	
+	n = (int) soc;
+	if (n < 0) n = 0;
+	if (n >= NUM_SOC_BINS) n = NUM_SOC_BINS - 1;
+	if (session_start_soc < 0) {
+		session_start_soc = n;
+		session_saved_soc = n;
+	}
+	session_end_soc = n;
+	
+	bP = &soc_bin[n];
+	bP->kw_sum += kw;
+	if (has_temp && db_get_data_item(DB_ITEM_HV_BATT_MAX_T, &temp, NULL)) {
+		if (temp > 127) temp = 127;
+		if (temp < -128) temp = -128;
+		if ((bP->count == 0) || ((int8_t) temp > bP->max_temp_c)) {
+			bP->max_temp_c = (int8_t) temp;
+		}
+	}
+	if (bP->count < UINT16_MAX) {
+		bP->count++;
+	}
+	
+	// Keep most of a curve from a session that ends with a power loss
+	if ((n - session_saved_soc) >= GUI_CHG_SAVE_PCT) {
+		session_saved_soc = n;
+		_gui_charge_save(ts_usec);
+	}
+}
+
+
+static void _gui_charge_end(int64_t cur_usec)
+{
+	vm_set_request_profile(VM_PROFILE_NORMAL);
+	_gui_charge_save(cur_usec);
+	
+	ESP_LOGI(TAG, "Charging ended (soc %d -> %d, %.1f kWh, %d min)", session_start_soc, session_end_soc,
+	         session_kwh, (int) ((cur_usec - session_start_usec) / 60000000));
+}
+
+
+// Build the file image of the current session and start writing it.  A save still in
+// progress is skipped (it is caught up by the next).
+static void _gui_charge_save(int64_t cur_usec)
+{
+	gui_chg_hdr_t* hP = (gui_chg_hdr_t*) save_buf;
+	gui_chg_point_t* pP = (gui_chg_point_t*) &save_buf[sizeof(gui_chg_hdr_t)];
+	float kwh10;
+	
+	if (save_busy || (session_start_soc < 0)) return;
+	
+	memset(hP, 0, sizeof(gui_chg_hdr_t));
+	hP->magic = GUI_CHG_MAGIC;
+	hP->duration_sec = (uint32_t) ((cur_usec - session_start_usec) / 1000000);
+	kwh10 = session_kwh * 100;
+	hP->energy_wh10 = (uint16_t) ((kwh10 > UINT16_MAX) ? UINT16_MAX : kwh10);
+	hP->start_soc = (uint8_t) session_start_soc;
+	hP->end_soc = (uint8_t) session_end_soc;
+	for (int i=0; i<NUM_SOC_BINS; i++) {
+		if (soc_bin[i].count != 0) {
+			pP->soc = (uint8_t) i;
+			pP->max_temp_c = soc_bin[i].max_temp_c;
+			pP->kw10 = (int16_t) (soc_bin[i].kw_sum * 10 / soc_bin[i].count);
+			pP++;
+			hP->num_points++;
+		}
+	}
+	save_len = sizeof(gui_chg_hdr_t) + hP->num_points * sizeof(gui_chg_point_t);
+	
+	save_busy = true;
+	if (xTaskCreate(&_gui_charge_save_task, "chg_save", GUI_CHG_SAVE_STACK, NULL,
+	                GUI_CHG_SAVE_PRIORITY, NULL) != pdPASS) {
+		ESP_LOGE(TAG, "Could not start save task");
+		save_busy = false;
+	}
+}
+
+
+static void _gui_charge_save_task(void* arg)
+{
+	gui_chg_hdr_t* hP = (gui_chg_hdr_t*) save_buf;
+	char name[24];
+	FILE* fp;
+	
+	// Each save of a session rewrites the same file
+	if (!seq_assigned) {
+		session_seq = _gui_charge_find_seq();
+		seq_assigned = true;
+	}
+	hP->seq = session_seq;
+	
+	sprintf(name, GUI_CHG_FILE_FMT, (int) (session_seq % GUI_CHG_NUM_SAVED));
+	fp = fopen(name, "wb");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Could not create %s", name);
+	} else {
+		if (fwrite(save_buf, 1, save_len, fp) != save_len) {
+			ESP_LOGE(TAG, "Write %s failed", name);
+		}
+		fclose(fp);
+	}
+	
+	save_busy = false;
+	vTaskDelete(NULL);
+}
+
+
+// Returns the sequence number following the newest saved session
+static uint32_t _gui_charge_find_seq()
+{
+	gui_chg_hdr_t hdr;
+	char name[24];
+	FILE* fp;
+	uint32_t next_seq = 0;
+	
+	for (int i=0; i<GUI_CHG_NUM_SAVED; i++) {
+		sprintf(name, GUI_CHG_FILE_FMT, i);
+		fp = fopen(name, "rb");
+		if (fp != NULL) {
+			if ((fread(&hdr, sizeof(gui_chg_hdr_t), 1, fp) == 1) && (hdr.magic == GUI_CHG_MAGIC) &&
+			    (hdr.seq >= next_seq)) {
+				next_seq = hdr.seq + 1;
+			}
+			fclose(fp);
+		}
+	}
+	
+	return next_seq;
+}
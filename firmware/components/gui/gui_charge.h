@@ -0,0 +1,92 @@
+/*
+ * Charging session detection - switch the vehicle manager to its low-rate charging request
+ * profile while the parked vehicle is charging and record a compact charge curve (average
+ * power and highest pack temperature at each percent of state of charge) to the log
+ * partition.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef GUI_CHARGE_H
+#define GUI_CHARGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Charging starts after GUI_CHG_START_MSEC of at least GUI_CHG_START_KW into the HV battery
+// while parked and ends after GUI_CHG_END_MSEC below GUI_CHG_END_KW (or without power data),
+// or as soon as the vehicle moves
+#define GUI_CHG_START_KW        1.0
+#define GUI_CHG_START_MSEC      (20 * 1000)
+#define GUI_CHG_END_KW          0.5
+#define GUI_CHG_END_MSEC        (60 * 1000)
+
+// Speed (kph) below which the vehicle is parked and how long before HV power is watched
+#define GUI_CHG_PARKED_KPH      1.0
+#define GUI_CHG_PARKED_MSEC     (10 * 1000)
+
+// Sessions kept on the log partition (files are numbered by session modulo this)
+#define GUI_CHG_NUM_SAVED       5
+#define GUI_CHG_FILE_FMT        "/log/CHG%d.BIN"
+
+// Curve is saved each time SoC has risen this many percent and when the session ends
+#define GUI_CHG_SAVE_PCT        5
+
+// Background save task
+#define GUI_CHG_SAVE_STACK      3072
+#define GUI_CHG_SAVE_PRIORITY   1
+
+// File header magic
+#define GUI_CHG_MAGIC           0x31474843   /* "CHG1" */
+
+
+
+//
+// Typedefs (little-endian on disk)
+//   File: gui_chg_hdr_t followed by num_points gui_chg_point_t in increasing SoC order
+typedef struct {
+	uint32_t magic;
+	uint32_t seq;                   // Session sequence number
+	uint32_t duration_sec;
+	uint16_t energy_wh10;           // Energy into the battery (Wh / 10)
+	uint8_t start_soc;              // Percent
+	uint8_t end_soc;
+	uint8_t num_points;
+	uint8_t rsvd[3];
+} gui_chg_hdr_t;
+
+typedef struct {
+	uint8_t soc;                    // Percent
+	int8_t max_temp_c;              // Highest pack temperature seen at this SoC
+	int16_t kw10;                   // Average power (kW * 10)
+} gui_chg_point_t;
+
+
+
+//
+// API
+//
+void gui_charge_init();
+void gui_charge_eval();
+bool gui_charge_active();
+
+#endif /* GUI_CHARGE_H */
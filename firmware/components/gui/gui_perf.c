@@ -0,0 +1,204 @@
+/*
+ * GUI rendering instrumentation - per-frame render/flush timing, invalidated area and
+ * frame rate displayed in a small overlay and accumulated into per-tile histograms
+ * that are periodically logged.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "disp_driver.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "gui_perf.h"
+#include "gui_screen_main.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+//
+// Private constants
+//
+#define OVERLAY_LBL_LEN 64
+
+
+
+//
+// Variables
+//
+static const char* TAG = "gui_perf";
+
+static lv_obj_t* overlay_lbl;
+static char overlay_buf[OVERLAY_LBL_LEN];
+
+// Set by the monitor callback when LVGL actually redrew something
+static bool saw_frame;
+static uint32_t frame_px;
+
+// Tile whose frames are being accumulated
+static int cur_tile;
+
+// Current overlay interval
+static uint32_t int_frames;
+static uint32_t int_render_usec;
+static uint32_t int_flush_usec;
+static uint32_t int_max_usec;
+static uint32_t int_px;
+
+// Frame time (render + flush) histograms by tile
+static uint32_t hist[GUI_SCREEN_MAIN_NUM_TILES][GUI_PERF_HIST_BINS];
+
+static const char* tile_names[GUI_SCREEN_MAIN_NUM_TILES] = {
+	"Torque", "Power", "Electrical", "Cells", "Timed", "Settings", "Diag", "Gauge 1", "Gauge 2"
+};
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _gui_perf_refr_timer_cb(lv_timer_t* timer);
+static void _gui_perf_monitor_cb(lv_disp_drv_t* disp_drv, uint32_t time, uint32_t px);
+static void _gui_perf_overlay_timer_cb(lv_timer_t* timer);
+static void _gui_perf_log_timer_cb(lv_timer_t* timer);
+
+
+
+//
+// API
+//
+void gui_perf_init(lv_disp_t* disp)
+{
+	// Wrap LVGL's refresh timer so each frame can be timed end-to-end
+	lv_timer_set_cb(disp->refr_timer, _gui_perf_refr_timer_cb);
+	disp->driver->monitor_cb = _gui_perf_monitor_cb;
+	
+	// Overlay on the top layer so it stays visible across screens and tiles
+	overlay_lbl = lv_label_create(lv_disp_get_layer_top(disp));
+	lv_obj_set_style_text_font(overlay_lbl, &lv_font_montserrat_14, LV_PART_MAIN);
+	lv_obj_set_style_text_color(overlay_lbl, lv_color_white(), LV_PART_MAIN);
+	lv_obj_set_style_bg_color(overlay_lbl, lv_color_black(), LV_PART_MAIN);
+	lv_obj_set_style_bg_opa(overlay_lbl, LV_OPA_60, LV_PART_MAIN);
+	lv_obj_set_style_pad_all(overlay_lbl, 2, LV_PART_MAIN);
+	lv_obj_align(overlay_lbl, LV_ALIGN_TOP_MID, 0, 4);
+	lv_label_set_text_static(overlay_lbl, "");
+	
+	lv_timer_create(_gui_perf_overlay_timer_cb, GUI_PERF_OVERLAY_MSEC, NULL);
+	lv_timer_create(_gui_perf_log_timer_cb, GUI_PERF_LOG_MSEC, NULL);
+}
+
+
+void gui_perf_set_tile(int n)
+{
+	if ((n >= 0) && (n < GUI_SCREEN_MAIN_NUM_TILES)) {
+		cur_tile = n;
+	}
+}
+
+
+void gui_perf_log_histograms()
+{
+	char buf[GUI_PERF_HIST_BINS * 7 + 1];
+	int i, j, n;
+	uint32_t tot;
+	
+	ESP_LOGI(TAG, "Frame time histograms (%d mSec bins)", GUI_PERF_HIST_BIN_MSEC);
+	for (i=0; i<GUI_SCREEN_MAIN_NUM_TILES; i++) {
+		tot = 0;
+		n = 0;
+		for (j=0; j<GUI_PERF_HIST_BINS; j++) {
+			tot += hist[i][j];
+			n += sprintf(buf + n, " %6lu", hist[i][j]);
+		}
+		if (tot != 0) {
+			ESP_LOGI(TAG, "  %-10s%s", tile_names[i], buf);
+		}
+	}
+}
+
+
+
+//
+// Internal functions
+//
+static void _gui_perf_refr_timer_cb(lv_timer_t* timer)
+{
+	int64_t t;
+	uint32_t frame_usec;
+	uint32_t flush_usec;
+	int bin;
+	
+	saw_frame = false;
+	(void) disp_driver_get_flush_usec();
+	
+	t = esp_timer_get_time();
+	_lv_disp_refr_timer(timer);
+	frame_usec = (uint32_t) (esp_timer_get_time() - t);
+	
+	if (saw_frame) {
+		flush_usec = disp_driver_get_flush_usec();
+		if (flush_usec > frame_usec) flush_usec = frame_usec;
+		
+		int_frames += 1;
+		int_render_usec += frame_usec - flush_usec;
+		int_flush_usec += flush_usec;
+		int_px += frame_px;
+		if (frame_usec > int_max_usec) int_max_usec = frame_usec;
+		
+		bin = frame_usec / (GUI_PERF_HIST_BIN_MSEC * 1000);
+		if (bin >= GUI_PERF_HIST_BINS) bin = GUI_PERF_HIST_BINS - 1;
+		hist[cur_tile][bin] += 1;
+	}
+}
+
+
+static void _gui_perf_monitor_cb(lv_disp_drv_t* disp_drv, uint32_t time, uint32_t px)
+{
+	saw_frame = true;
+	frame_px = px;
+}
+
+
+static void _gui_perf_overlay_timer_cb(lv_timer_t* timer)
+{
+	uint32_t render_usec = 0;
+	uint32_t flush_usec = 0;
+	
+	// Average render and flush time per frame over the interval, frames per second
+	if (int_frames != 0) {
+		render_usec = int_render_usec / int_frames;
+		flush_usec = int_flush_usec / int_frames;
+	}
+	sprintf(overlay_buf, "%lu fps  R %lu.%lu  F %lu.%lu  max %lu ms  %lu kpx",
+		int_frames * 1000 / GUI_PERF_OVERLAY_MSEC,
+		render_usec / 1000, (render_usec % 1000) / 100,
+		flush_usec / 1000, (flush_usec % 1000) / 100,
+		int_max_usec / 1000,
+		int_px / 1000);
+	lv_label_set_text_static(overlay_lbl, overlay_buf);
+	
+	int_frames = 0;
+	int_render_usec = 0;
+	int_flush_usec = 0;
+	int_max_usec = 0;
+	int_px = 0;
+}
+
+
+static void _gui_perf_log_timer_cb(lv_timer_t* timer)
+{
+	gui_perf_log_histograms();
+}
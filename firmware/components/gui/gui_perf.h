@@ -0,0 +1,52 @@
+/*
+ * GUI rendering instrumentation - per-frame render/flush timing, invalidated area and
+ * frame rate displayed in a small overlay and accumulated into per-tile histograms
+ * that are periodically logged.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef GUI_PERF_H
+#define GUI_PERF_H
+
+#include "lvgl.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Frame time histogram bins (last bin holds everything longer)
+#define GUI_PERF_HIST_BIN_MSEC  5
+#define GUI_PERF_HIST_BINS      12
+
+// Overlay update and histogram log intervals
+#define GUI_PERF_OVERLAY_MSEC   1000
+#define GUI_PERF_LOG_MSEC       30000
+
+
+
+//
+// API
+//
+void gui_perf_init(lv_disp_t* disp);
+void gui_perf_set_tile(int n);
+void gui_perf_log_histograms();
+
+#endif /* GUI_PERF_H */
\ No newline at end of file
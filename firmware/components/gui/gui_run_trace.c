@@ -0,0 +1,455 @@
+/*
+ * Timed run trace capture - record every timing item sample of a speed run (with the
+ * longitudinal acceleration when the IMU is present) into preallocated PSRAM buffers,
+ * save the last RUN_TRACE_NUM_SAVED runs to the log partition and serve them over WiFi
+ * as CSV or binary.
+ *
+ * Two capture buffers are allocated at startup.  A run is captured into one while the
+ * previous run is written from the other by a short-lived low priority task, so neither
+ * the run evaluation nor the GUI waits on the flash.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "gui_run_trace.h"
+#include "wifi_utilities.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+//
+// Private constants
+//
+
+// Capture buffers
+#define NUM_BUFS      2
+
+// Samples read from a file at a time while serving it
+#define READ_SAMPLES  64
+
+// Download buffer (sent as one HTTP chunk when full)
+#define DUMP_BUF_LEN  1024
+
+// Longest CSV line
+#define DUMP_LINE_MAX 96
+
+
+
+//
+// Private typedefs
+//
+typedef struct {
+	run_trace_hdr_t hdr;
+	int64_t first_usec;
+	run_trace_sample_t sample[RUN_TRACE_MAX_SAMPLES];
+} run_trace_buf_t;
+
+
+
+//
+// Variables
+//
+static const char* TAG = "gui_run_trace";
+
+static run_trace_buf_t* bufP[NUM_BUFS] = {NULL, NULL};
+
+// Capture state (run evaluation)
+static int cap_index = 0;
+static bool capturing = false;
+static bool dropped_logged;
+
+// Finished run waiting to be saved or being saved (-1 = none)
+static volatile int save_index = -1;
+static volatile bool save_busy = false;
+
+// Next run sequence number (found from the saved files before the first save)
+static bool seq_known = false;
+static uint32_t next_seq;
+
+static bool uris_registered = false;
+
+// Used by the HTTP handlers (the server runs one handler at a time)
+static run_trace_sample_t read_buf[READ_SAMPLES];
+static char dump_buf[DUMP_BUF_LEN];
+static int dump_len;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _gui_run_trace_save_task(void* arg);
+static void _gui_run_trace_find_seq();
+static void _gui_run_trace_register_uris();
+static int _gui_run_trace_sort_files(int* file_list);
+static FILE* _gui_run_trace_open(int file, run_trace_hdr_t* hdrP);
+static esp_err_t _gui_run_trace_csv_handler(httpd_req_t* req);
+static esp_err_t _gui_run_trace_bin_handler(httpd_req_t* req);
+static esp_err_t _gui_run_trace_dump_append(httpd_req_t* req, const char* s, int len);
+
+
+
+//
+// API
+//
+bool gui_run_trace_init()
+{
+	for (int i=0; i<NUM_BUFS; i++) {
+		if (bufP[i] == NULL) {
+			bufP[i] = heap_caps_malloc(sizeof(run_trace_buf_t), MALLOC_CAP_SPIRAM);
+			if (bufP[i] == NULL) {
+				ESP_LOGE(TAG, "Could not allocate trace buffers");
+				return false;
+			}
+		}
+	}
+	
+	_gui_run_trace_register_uris();
+	
+	return true;
+}
+
+
+void gui_run_trace_start(int mode, bool has_accel)
+{
+	run_trace_buf_t* tP;
+	
+	capturing = false;
+	if (bufP[cap_index] == NULL) return;
+	
+	// Only possible if runs end faster than they can be saved
+	if (save_busy && (save_index == cap_index)) {
+		ESP_LOGW(TAG, "Previous run still saving - not captured");
+		return;
+	}
+	
+	tP = bufP[cap_index];
+	memset(&tP->hdr, 0, sizeof(run_trace_hdr_t));
+	tP->hdr.magic = RUN_TRACE_MAGIC;
+	tP->hdr.mode = (uint8_t) mode;
+	tP->hdr.has_accel = has_accel ? 1 : 0;
+	tP->hdr.launch_usec = -1;
+	dropped_logged = false;
+	capturing = true;
+}
+
+
+void gui_run_trace_sample(float kph, float long_g, int64_t ts_usec)
+{
+	run_trace_buf_t* tP = bufP[cap_index];
+	run_trace_sample_t* sP;
+	
+	if (!capturing) return;
+	
+	if (tP->hdr.num_samples >= RUN_TRACE_MAX_SAMPLES) {
+		if (!dropped_logged) {
+			ESP_LOGW(TAG, "Trace full");
+			dropped_logged = true;
+		}
+		return;
+	}
+	
+	if (tP->hdr.num_samples == 0) {
+		tP->first_usec = ts_usec;
+	}
+	sP = &tP->sample[tP->hdr.num_samples++];
+	sP->t_usec = (uint32_t) (ts_usec - tP->first_usec);
+	sP->kph100 = (int16_t) ((kph < 0) ? 0 : ((kph > 327) ? 32700 : (kph * 100)));
+	sP->accel_mg = (int16_t) ((long_g < -32) ? -32000 : ((long_g > 32) ? 32000 : (long_g * 1000)));
+}
+
+
+void gui_run_trace_end(bool valid, uint32_t time_msec, int64_t launch_ts_usec)
+{
+	run_trace_buf_t* tP = bufP[cap_index];
+	
+	if (!capturing) return;
+	capturing = false;
+	
+	if (tP->hdr.num_samples == 0) return;
+	
+	tP->hdr.valid = valid ? 1 : 0;
+	tP->hdr.time_msec = time_msec;
+	if ((launch_ts_usec != 0) && (launch_ts_usec >= tP->first_usec)) {
+		tP->hdr.launch_usec = (int32_t) (launch_ts_usec - tP->first_usec);
+	}
+	
+	// Hand it to the GUI to save and capture the next run into the other buffer
+	save_index = cap_index;
+	cap_index = (cap_index + 1) % NUM_BUFS;
+}
+
+
+void gui_run_trace_save()
+{
+	if ((save_index < 0) || save_busy) return;
+	
+	save_busy = true;
+	if (xTaskCreate(&_gui_run_trace_save_task, "run_trace", RUN_TRACE_SAVE_STACK, NULL,
+	                RUN_TRACE_SAVE_PRIORITY, NULL) != pdPASS) {
+		ESP_LOGE(TAG, "Could not start save task");
+		save_index = -1;
+		save_busy = false;
+	}
+}
+
+
+
+//
+// Internal functions
+//
+static void _gui_run_trace_save_task(void* arg)
+{
+	int index = save_index;
+	run_trace_buf_t* tP = bufP[index];
+	char name[24];
+	FILE* fp;
+	size_t len;
+	
+	if (!seq_known) {
+		_gui_run_trace_find_seq();
+	}
+	tP->hdr.seq = next_seq++;
+	
+	sprintf(name, RUN_TRACE_FILE_FMT, (int) (tP->hdr.seq % RUN_TRACE_NUM_SAVED));
+	len = tP->hdr.num_samples * sizeof(run_trace_sample_t);
+	fp = fopen(name, "wb");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Could not create %s", name);
+	} else {
+		if ((fwrite(&tP->hdr, sizeof(run_trace_hdr_t), 1, fp) != 1) ||
+		    (fwrite(tP->sample, 1, len, fp) != len)) {
+			ESP_LOGE(TAG, "Write %s failed", name);
+		} else {
+			ESP_LOGI(TAG, "Saved run %lu (%lu samples) to %s", tP->hdr.seq, tP->hdr.num_samples, name);
+		}
+		fclose(fp);
+	}
+	
+	// WiFi may have been enabled since startup
+	_gui_run_trace_register_uris();
+	
+	// Another run may have ended while saving this one
+	if (save_index == index) {
+		save_index = -1;
+	}
+	save_busy = false;
+	vTaskDelete(NULL);
+}
+
+
+static void _gui_run_trace_find_seq()
+{
+	run_trace_hdr_t hdr;
+	FILE* fp;
+	
+	next_seq = 0;
+	for (int i=0; i<RUN_TRACE_NUM_SAVED; i++) {
+		fp = _gui_run_trace_open(i, &hdr);
+		if (fp != NULL) {
+			if (hdr.seq >= next_seq) {
+				next_seq = hdr.seq + 1;
+			}
+			fclose(fp);
+		}
+	}
+	seq_known = true;
+}
+
+
+static void _gui_run_trace_register_uris()
+{
+	httpd_handle_t server;
+	const httpd_uri_t csv_uri = {
+		.uri = RUN_TRACE_CSV_URI,
+		.method = HTTP_GET,
+		.handler = _gui_run_trace_csv_handler,
+		.user_ctx = NULL
+	};
+	const httpd_uri_t bin_uri = {
+		.uri = RUN_TRACE_BIN_URI,
+		.method = HTTP_GET,
+		.handler = _gui_run_trace_bin_handler,
+		.user_ctx = NULL
+	};
+	
+	// Runs are only served when WiFi is in use for something else
+	if (!uris_registered && wifi_is_enabled() && ((server = wifi_get_http_server()) != NULL)) {
+		httpd_register_uri_handler(server, &csv_uri);
+		httpd_register_uri_handler(server, &bin_uri);
+		uris_registered = true;
+	}
+}
+
+
+// Fill file_list with the saved run files oldest first.  Returns the number of files.
+static int _gui_run_trace_sort_files(int* file_list)
+{
+	run_trace_hdr_t hdr;
+	uint32_t seq[RUN_TRACE_NUM_SAVED];
+	FILE* fp;
+	int n = 0;
+	int j;
+	
+	for (int i=0; i<RUN_TRACE_NUM_SAVED; i++) {
+		fp = _gui_run_trace_open(i, &hdr);
+		if (fp != NULL) {
+			fclose(fp);
+			
+			// Insertion sort by sequence number
+			for (j=n; (j > 0) && (seq[j-1] > hdr.seq); j--) {
+				seq[j] = seq[j-1];
+				file_list[j] = file_list[j-1];
+			}
+			seq[j] = hdr.seq;
+			file_list[j] = i;
+			n++;
+		}
+	}
+	
+	return n;
+}
+
+
+// Open a saved run file and read its header.  Returns NULL if it doesn't exist or isn't valid.
+static FILE* _gui_run_trace_open(int file, run_trace_hdr_t* hdrP)
+{
+	char name[24];
+	FILE* fp;
+	
+	sprintf(name, RUN_TRACE_FILE_FMT, file);
+	fp = fopen(name, "rb");
+	if (fp != NULL) {
+		if ((fread(hdrP, sizeof(run_trace_hdr_t), 1, fp) != 1) || (hdrP->magic != RUN_TRACE_MAGIC) ||
+		    (hdrP->num_samples > RUN_TRACE_MAX_SAMPLES)) {
+			fclose(fp);
+			fp = NULL;
+		}
+	}
+	
+	return fp;
+}
+
+
+static esp_err_t _gui_run_trace_csv_handler(httpd_req_t* req)
+{
+	int file_list[RUN_TRACE_NUM_SAVED];
+	run_trace_hdr_t hdr;
+	FILE* fp;
+	char line[DUMP_LINE_MAX];
+	char accel[12];
+	int num_files;
+	int remaining;
+	int len;
+	int n;
+	esp_err_t ret = ESP_OK;
+	
+	httpd_resp_set_type(req, "text/csv");
+	httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"runs.csv\"");
+	dump_len = 0;
+	
+	len = sprintf(line, "run,mode,valid,time_sec,launch_sec,t_sec,speed_kph,long_g\n");
+	ret = _gui_run_trace_dump_append(req, line, len);
+	
+	num_files = _gui_run_trace_sort_files(file_list);
+	for (int f=0; (f<num_files) && (ret == ESP_OK); f++) {
+		fp = _gui_run_trace_open(file_list[f], &hdr);
+		if (fp == NULL) continue;
+		
+		remaining = (int) hdr.num_samples;
+		while ((remaining > 0) && (ret == ESP_OK)) {
+			n = fread(read_buf, sizeof(run_trace_sample_t), (remaining < READ_SAMPLES) ? remaining : READ_SAMPLES, fp);
+			if (n <= 0) break;
+			remaining -= n;
+			
+			for (int i=0; (i<n) && (ret == ESP_OK); i++) {
+				// Empty acceleration column without the IMU
+				if (hdr.has_accel) {
+					sprintf(accel, "%.3f", read_buf[i].accel_mg / 1000.0);
+				} else {
+					accel[0] = 0;
+				}
+				len = sprintf(line, "%lu,%u,%u,%.3f,%.6f,%.6f,%.2f,%s\n", hdr.seq, hdr.mode, hdr.valid,
+				              hdr.time_msec / 1000.0, (hdr.launch_usec < 0) ? -1.0 : (hdr.launch_usec / 1000000.0),
+				              read_buf[i].t_usec / 1000000.0, read_buf[i].kph100 / 100.0, accel);
+				ret = _gui_run_trace_dump_append(req, line, len);
+			}
+		}
+		fclose(fp);
+	}
+	
+	if ((ret == ESP_OK) && (dump_len != 0)) {
+		ret = httpd_resp_send_chunk(req, dump_buf, dump_len);
+	}
+	if (ret == ESP_OK) {
+		ret = httpd_resp_send_chunk(req, NULL, 0);
+	}
+	
+	return ret;
+}
+
+
+static esp_err_t _gui_run_trace_bin_handler(httpd_req_t* req)
+{
+	int file_list[RUN_TRACE_NUM_SAVED];
+	run_trace_hdr_t hdr;
+	FILE* fp;
+	int num_files;
+	int n;
+	esp_err_t ret = ESP_OK;
+	
+	httpd_resp_set_type(req, "application/octet-stream");
+	httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"runs.bin\"");
+	
+	num_files = _gui_run_trace_sort_files(file_list);
+	for (int f=0; (f<num_files) && (ret == ESP_OK); f++) {
+		fp = _gui_run_trace_open(file_list[f], &hdr);
+		if (fp == NULL) continue;
+		
+		ret = httpd_resp_send_chunk(req, (const char*) &hdr, sizeof(run_trace_hdr_t));
+		while ((ret == ESP_OK) && ((n = fread(dump_buf, 1, DUMP_BUF_LEN, fp)) > 0)) {
+			ret = httpd_resp_send_chunk(req, dump_buf, n);
+		}
+		fclose(fp);
+	}
+	
+	if (ret == ESP_OK) {
+		ret = httpd_resp_send_chunk(req, NULL, 0);
+	}
+	
+	return ret;
+}
+
+
+static esp_err_t _gui_run_trace_dump_append(httpd_req_t* req, const char* s, int len)
+{
+	esp_err_t ret = ESP_OK;
+	
+	if ((dump_len + len) > DUMP_BUF_LEN) {
+		ret = httpd_resp_send_chunk(req, dump_buf, dump_len);
+		dump_len = 0;
+	}
+	memcpy(&dump_buf[dump_len], s, len);
+	dump_len += len;
+	
+	return ret;
+}
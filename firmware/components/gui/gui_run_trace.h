@@ -0,0 +1,91 @@
+/*
+ * Timed run trace capture - record every timing item sample of a speed run (with the
+ * longitudinal acceleration when the IMU is present) into preallocated PSRAM buffers,
+ * save the last RUN_TRACE_NUM_SAVED runs to the log partition and serve them over WiFi
+ * as CSV or binary.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef GUI_RUN_TRACE_H
+#define GUI_RUN_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Samples per run (the longest run timeout plus the countdown at the IMU fused speed rate)
+#define RUN_TRACE_MAX_SAMPLES   4096
+
+// Runs kept on the log partition (files are numbered by run sequence modulo this)
+#define RUN_TRACE_NUM_SAVED     5
+#define RUN_TRACE_FILE_FMT      "/log/RUN%d.BIN"
+
+// Download URIs.  The binary form is each saved file (header then samples) oldest first.
+#define RUN_TRACE_CSV_URI       "/runs.csv"
+#define RUN_TRACE_BIN_URI       "/runs.bin"
+
+// Background save task (runs once per saved run)
+#define RUN_TRACE_SAVE_STACK    3072
+#define RUN_TRACE_SAVE_PRIORITY 1
+
+// File header magic
+#define RUN_TRACE_MAGIC         0x31545252   /* "RRT1" */
+
+
+
+//
+// Typedefs (little-endian on disk and in the binary download)
+//
+typedef struct {
+	uint32_t magic;
+	uint32_t seq;                   // Run sequence number
+	uint8_t mode;                   // Timed tile run mode
+	uint8_t valid;                  // Completed without a false start or timeout
+	uint8_t has_accel;
+	uint8_t rsvd;
+	uint32_t time_msec;             // Result (0 if not completed)
+	int32_t launch_usec;            // Start crossing from the first sample (-1 = none)
+	uint32_t num_samples;
+} run_trace_hdr_t;
+
+typedef struct {
+	uint32_t t_usec;                // From the first sample
+	int16_t kph100;                 // Speed (kph * 100)
+	int16_t accel_mg;               // Longitudinal acceleration (milli-g, 0 without IMU)
+} run_trace_sample_t;
+
+
+
+//
+// API
+//
+bool gui_run_trace_init();
+
+// Called by the run evaluation (never allocates)
+void gui_run_trace_start(int mode, bool has_accel);
+void gui_run_trace_sample(float kph, float long_g, int64_t ts_usec);
+void gui_run_trace_end(bool valid, uint32_t time_msec, int64_t launch_ts_usec);
+
+// Called by the GUI once a run is over to save it in the background
+void gui_run_trace_save();
+
+#endif /* GUI_RUN_TRACE_H */
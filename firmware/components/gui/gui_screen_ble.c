@@ -386,8 +386,10 @@ static void _gui_screen_ble_btn_cb(lv_event_t* e)
 				}
 			}
 			
-			// Save to persistent storage if necessary
+			// Save to persistent storage if necessary (forgetting any cached peer since
+			// it may no longer match)
 			if (changed) {
+				configP->peer_valid = false;
 				if (ps_save_config(PS_CONFIG_TYPE_BLE)) {
 					ESP_LOGI(TAG, "Updated persistent storage");
 				} else {
@@ -22,6 +22,7 @@
 #include "freertos/task.h"
 #include "gui_screen_intro.h"
 #include "gui_task.h"
+#include "gui_utilities.h"
 
 
 
@@ -37,9 +38,12 @@ static lv_obj_t* img;
 
 static lv_timer_t* timer = NULL;
 
-
-// External image definition
-LV_IMG_DECLARE(gui_intro_screen);
+// Intro image, drawn in place from the assets partition (or if it was packed compressed,
+// expanded only while the screen is displayed)
+static lv_img_dsc_t intro_img_dsc;
+static gui_rle_img_t intro_rle;
+static bool intro_img_valid = false;
+static bool intro_img_expanded = false;
 
 
 
@@ -69,7 +73,6 @@ lv_obj_t* gui_screen_intro_init()
 	img = lv_img_create(page);
 	lv_obj_set_size(img, w, h);
 	lv_obj_set_pos(img, 0, 0);
-	lv_img_set_src(img, &gui_intro_screen);
 	
 	return page;
 }
@@ -79,6 +82,19 @@ void gui_screen_intro_set_active(bool is_active)
 {
 	if (is_active) {
 //		lv_obj_clear_flag(page, LV_OBJ_FLAG_HIDDEN);
+		
+		// Get the image
+		if (!intro_img_valid) {
+			if (gui_assets_get_img(GUI_ASSET_INTRO, &intro_img_dsc)) {
+				intro_img_valid = true;
+			} else if (gui_assets_get_rle_img(GUI_ASSET_INTRO, &intro_rle)) {
+				intro_img_valid = gui_utility_decode_rle_img(&intro_rle, &intro_img_dsc);
+				intro_img_expanded = intro_img_valid;
+			}
+			if (intro_img_valid) {
+				lv_img_set_src(img, &intro_img_dsc);
+			}
+		}
 	
 		// Start timer
 		if (timer == NULL) {
@@ -88,6 +104,12 @@ void gui_screen_intro_set_active(bool is_active)
 			// Restart existing timer
 			lv_timer_set_period(timer, GUI_SCREEN_INTRO_TO_MSEC);
 		}
+	} else if (intro_img_expanded) {
+		// Release the PSRAM holding the expanded image
+		lv_img_set_src(img, NULL);
+		gui_utility_free_rle_img(&intro_img_dsc);
+		intro_img_valid = false;
+		intro_img_expanded = false;
 	}
 }
 
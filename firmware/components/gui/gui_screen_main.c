@@ -19,14 +19,23 @@
  * along with this software.  If not, see <https://www.gnu.org/licenses/>.
  *
  */
+#include "data_broker.h"
 #include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
 #include "gui_screen_main.h"
 #include "gui_task.h"
+#include "gui_tile_cells.h"
+#include "gui_tile_diag.h"
 #include "gui_tile_electrical.h"
+#include "gui_tile_gauge.h"
 #include "gui_tile_power.h"
+#include "gui_tile_review.h"
 #include "gui_tile_settings.h"
 #include "gui_tile_timed.h"
 #include "gui_tile_torque.h"
+#include "vehicle_manager.h"
+#include <stdlib.h>
 
 
 
@@ -34,6 +43,15 @@
 // Local constants
 //
 
+// Uncomment to draw swipes between tiles from PSRAM snapshots of the displayed tile and the
+// neighbour being scrolled toward (taken when the scroll starts) instead of rendering both
+// tiles' live widgets every frame
+//#define SNAPSHOT_TILE_TRANSITIONS
+
+// Snapshot slots
+#define SNAP_SLOT_CUR  0
+#define SNAP_SLOT_NEXT 1
+#define SNAP_NUM_SLOTS 2
 
 
 //
@@ -54,12 +72,47 @@ static lv_obj_t* tile_list[GUI_SCREEN_MAIN_NUM_TILES];
 // Array of tile object enable functions
 static tile_activation_handler tile_activation_fcn_list[GUI_SCREEN_MAIN_NUM_TILES];
 
+// Array of tile content build/teardown functions and content state
+static tile_content_handler tile_content_fcn_list[GUI_SCREEN_MAIN_NUM_TILES];
+static bool tile_built[GUI_SCREEN_MAIN_NUM_TILES];
+
+// Array of items each tile requests and the neighbour whose items are being requested while
+// a scroll is in progress (-1 = none)
+static db_mask_t tile_item_mask[GUI_SCREEN_MAIN_NUM_TILES];
+static int scroll_tile_index = -1;
+
+// True from the start of a tileview scroll until it settles
+static bool scrolling = false;
+
+static lv_timer_t* prefetch_timer = NULL;
+
+#ifdef SNAPSHOT_TILE_TRANSITIONS
+static const char* TAG = "gui_screen_main";
+
+// Images covering the snapshotted tiles during a scroll (buffers are kept between scrolls)
+static lv_obj_t* snap_img[SNAP_NUM_SLOTS];
+static int snap_tile_index[SNAP_NUM_SLOTS];
+static lv_img_dsc_t snap_dsc[SNAP_NUM_SLOTS];
+static uint8_t* snap_buf[SNAP_NUM_SLOTS];
+static uint32_t snap_buf_len[SNAP_NUM_SLOTS];
+#endif
+
 
 
 //
 // Forward declarations for internal functions
 //
 static void _gui_screen_main_tileview_changed_cb(lv_event_t * event);
+static void _gui_screen_main_tileview_scroll_cb(lv_event_t * event);
+static void _gui_screen_main_change_tile(int n);
+static void _gui_screen_main_set_tile_content(int n, bool build);
+static void _gui_screen_main_start_prefetch();
+static void _gui_screen_main_prefetch_timer_cb(lv_timer_t* timer);
+#ifdef SNAPSHOT_TILE_TRANSITIONS
+static void _gui_screen_main_snap_tile(int slot, int n);
+static void _gui_screen_main_release_snap(int slot);
+static void _gui_screen_main_snap_delete_cb(lv_event_t* e);
+#endif
 
 
 
@@ -83,20 +136,39 @@ lv_obj_t* gui_screen_main_init()
 	lv_obj_set_size(tileview, w, h);
 	lv_obj_set_scrollbar_mode(tileview, LV_SCROLLBAR_MODE_OFF);
 	lv_obj_add_event_cb(tileview, _gui_screen_main_tileview_changed_cb, LV_EVENT_VALUE_CHANGED, NULL);
+	lv_obj_add_event_cb(tileview, _gui_screen_main_tileview_scroll_cb, LV_EVENT_SCROLL_BEGIN, NULL);
+	lv_obj_add_event_cb(tileview, _gui_screen_main_tileview_scroll_cb, LV_EVENT_SCROLL, NULL);
+	lv_obj_add_event_cb(tileview, _gui_screen_main_tileview_scroll_cb, LV_EVENT_SCROLL_END, NULL);
 	
 	// Initialize the tile object arrays
 	for (int i=0; i<GUI_SCREEN_MAIN_NUM_TILES; i++) {
 		tile_list[i] = NULL;
 		tile_activation_fcn_list[i] = NULL;
+		tile_content_fcn_list[i] = NULL;
+		tile_built[i] = false;
+		tile_item_mask[i] = 0;
+	}
+	
+#ifdef SNAPSHOT_TILE_TRANSITIONS
+	for (int i=0; i<SNAP_NUM_SLOTS; i++) {
+		snap_img[i] = NULL;
+		snap_tile_index[i] = -1;
 	}
+#endif
 	
 	// Add tiles to the tileview object.
 	// They will register themselves with us if they can be displayed based on the vehicle capabilities.
+	// Tiles with a content handler don't create their display objects until they are near the
+	// displayed tile.
 	gui_tile_torque_init(tileview, &cur_tile_index);
 	gui_tile_power_init(tileview, &cur_tile_index);
 	gui_tile_electrical_init(tileview, &cur_tile_index);
+	gui_tile_cells_init(tileview, &cur_tile_index);
 	gui_tile_timed_init(tileview, &cur_tile_index);
 	gui_tile_settings_init(tileview, &cur_tile_index);
+	gui_tile_diag_init(tileview, &cur_tile_index);
+	gui_tile_review_init(tileview, &cur_tile_index);
+	gui_tile_gauge_init(tileview, &cur_tile_index);
 	
 	// Set displayed tile
 	cur_tile_index = gui_get_init_tile_index();
@@ -107,6 +179,10 @@ lv_obj_t* gui_screen_main_init()
 	}
 	
 	if (cur_tile_index >= 0) {
+		// Build only the displayed tile now, its neighbours shortly after
+		_gui_screen_main_set_tile_content(cur_tile_index, true);
+		_gui_screen_main_start_prefetch();
+		
 		lv_obj_set_tile_id(tileview, (uint32_t) cur_tile_index, 0, LV_ANIM_OFF);
 	}
 	
@@ -121,16 +197,48 @@ void gui_screen_main_set_active(bool is_active)
 }
 
 
-void gui_screen_main_register_tile(lv_obj_t* tile, tile_activation_handler activate_func)
+bool gui_screen_main_is_scrolling()
+{
+	return scrolling;
+}
+
+
+void gui_screen_main_register_tile(lv_obj_t* tile, tile_activation_handler activate_func, tile_content_handler content_func, db_mask_t item_mask)
 {
 	if (num_tiles < GUI_SCREEN_MAIN_NUM_TILES) {
 		tile_list[num_tiles] = tile;
 		tile_activation_fcn_list[num_tiles] = activate_func;
+		tile_content_fcn_list[num_tiles] = content_func;
+		tile_built[num_tiles] = (content_func == NULL);
+		tile_item_mask[num_tiles] = item_mask;
 		num_tiles += 1;
 	}
 }
 
 
+int gui_screen_main_get_num_tiles()
+{
+	return num_tiles;
+}
+
+
+int gui_screen_main_get_tile()
+{
+	return cur_tile_index;
+}
+
+
+// Display a tile without animation (setting the tile programmatically does not generate
+// the tileview's VALUE_CHANGED event)
+void gui_screen_main_show_tile(int n)
+{
+	if ((n >= 0) && (n < num_tiles)) {
+		lv_obj_set_tile(tileview, tile_list[n], LV_ANIM_OFF);
+		_gui_screen_main_change_tile(n);
+	}
+}
+
+
 
 //
 // Internal functions
@@ -151,16 +259,196 @@ static void _gui_screen_main_tileview_changed_cb(lv_event_t * event)
 			}
 		}
 		
-		if ((n >= 0) && (n != cur_tile_index)) {
-			// Disable previous tile
-			tile_activation_fcn_list[cur_tile_index](false);
-			
-			// Enable new tile
-			cur_tile_index = n;
-			tile_activation_fcn_list[cur_tile_index](true);
-			
-			// Let gui_task know to update persistent storage
-			gui_set_init_tile_index(cur_tile_index);
+		_gui_screen_main_change_tile(n);
+	}
+}
+
+
+// Request the items of the neighbour being scrolled toward along with those of the displayed
+// tile so both have current data whichever one the scroll settles on
+static void _gui_screen_main_tileview_scroll_cb(lv_event_t * event)
+{
+	int n = -1;
+	lv_coord_t dx;
+	
+	if (lv_event_get_code(event) == LV_EVENT_SCROLL_BEGIN) {
+		scrolling = true;
+#ifdef SNAPSHOT_TILE_TRANSITIONS
+		if (num_tiles > 0) {
+			_gui_screen_main_snap_tile(SNAP_SLOT_CUR, cur_tile_index);
+		}
+#endif
+	} else if ((lv_event_get_code(event) == LV_EVENT_SCROLL) && (num_tiles > 0)) {
+		dx = lv_obj_get_scroll_x(tileview) - lv_obj_get_x(tile_list[cur_tile_index]);
+		if ((dx > 0) && (cur_tile_index < (num_tiles - 1))) {
+			n = cur_tile_index + 1;
+		} else if ((dx < 0) && (cur_tile_index > 0)) {
+			n = cur_tile_index - 1;
+		}
+		
+		if ((n >= 0) && (n != scroll_tile_index)) {
+			scroll_tile_index = n;
+			vm_set_request_prefetch_mask(tile_item_mask[n]);
+#ifdef SNAPSHOT_TILE_TRANSITIONS
+			_gui_screen_main_snap_tile(SNAP_SLOT_NEXT, n);
+#endif
+		}
+	} else if (lv_event_get_code(event) == LV_EVENT_SCROLL_END) {
+		scrolling = false;
+		
+		// The displayed tile (changed or not) has set its own items by now
+		if (scroll_tile_index >= 0) {
+			scroll_tile_index = -1;
+			vm_set_request_prefetch_mask(0);
+		}
+		
+#ifdef SNAPSHOT_TILE_TRANSITIONS
+		// The pointer's scroll ends as the snap animation to the tile boundary starts so
+		// only go back to the live widgets when that has finished too
+		if (lv_anim_get(tileview, NULL) == NULL) {
+			for (int i=0; i<SNAP_NUM_SLOTS; i++) {
+				_gui_screen_main_release_snap(i);
+			}
+		}
+#endif
+	}
+}
+
+
+static void _gui_screen_main_change_tile(int n)
+{
+	if ((n >= 0) && (n != cur_tile_index)) {
+		// Disable previous tile and drop its data handlers
+		tile_activation_fcn_list[cur_tile_index](false);
+		db_clear_gui_callbacks();
+		
+		// Enable new tile (normally already built as a neighbour of the previous tile)
+		cur_tile_index = n;
+		_gui_screen_main_set_tile_content(cur_tile_index, true);
+		tile_activation_fcn_list[cur_tile_index](true);
+		
+		// Update which tiles are resident once the scroll has settled
+		_gui_screen_main_start_prefetch();
+		
+		// Let gui_task know to update persistent storage
+		gui_set_init_tile_index(cur_tile_index);
+	}
+}
+
+
+static void _gui_screen_main_set_tile_content(int n, bool build)
+{
+	if ((tile_content_fcn_list[n] != NULL) && (tile_built[n] != build)) {
+		tile_content_fcn_list[n](build);
+		tile_built[n] = build;
+	}
+}
+
+
+static void _gui_screen_main_start_prefetch()
+{
+	if (prefetch_timer == NULL) {
+		prefetch_timer = lv_timer_create(_gui_screen_main_prefetch_timer_cb, GUI_SCREEN_MAIN_PREFETCH_MSEC, NULL);
+		lv_timer_set_repeat_count(prefetch_timer, 1);
+	} else {
+		lv_timer_reset(prefetch_timer);
+	}
+}
+
+
+static void _gui_screen_main_prefetch_timer_cb(lv_timer_t* timer)
+{
+	// Tear down distant tiles first to make room for the ones being built
+	for (int i=0; i<num_tiles; i++) {
+		if (abs(i - cur_tile_index) > GUI_SCREEN_MAIN_RESIDENT_DIST) {
+			_gui_screen_main_set_tile_content(i, false);
+		}
+	}
+	for (int i=0; i<num_tiles; i++) {
+		if (abs(i - cur_tile_index) <= GUI_SCREEN_MAIN_RESIDENT_DIST) {
+			_gui_screen_main_set_tile_content(i, true);
 		}
 	}
-}
\ No newline at end of file
+	
+	// Note single-shot timer has been deleted
+	prefetch_timer = NULL;
+}
+
+
+#ifdef SNAPSHOT_TILE_TRANSITIONS
+// Render tile n into the slot's PSRAM buffer and cover the tile with an opaque image of it
+// so LVGL only blits the image while the tile's widgets are hidden beneath it
+static void _gui_screen_main_snap_tile(int slot, int n)
+{
+	lv_obj_t* tile;
+	lv_obj_t* img;
+	lv_res_t res;
+	uint32_t len;
+	lv_coord_t ext;
+	
+	if (snap_tile_index[slot] == n) {
+		return;
+	}
+	_gui_screen_main_release_snap(slot);
+	
+	tile = tile_list[n];
+	_gui_screen_main_set_tile_content(n, true);
+	lv_obj_update_layout(tile);
+	
+	len = lv_snapshot_buf_size_needed(tile, LV_IMG_CF_TRUE_COLOR);
+	if (len > snap_buf_len[slot]) {
+		free(snap_buf[slot]);
+		snap_buf[slot] = heap_caps_malloc(len, MALLOC_CAP_SPIRAM);
+		if (snap_buf[slot] == NULL) {
+			ESP_LOGE(TAG, "Could not allocate %lu bytes for tile snapshot", len);
+			snap_buf_len[slot] = 0;
+			return;
+		}
+		snap_buf_len[slot] = len;
+	}
+	
+	// Tiles are transparent over the tileview so give the snapshot the tileview's background
+	lv_obj_set_style_bg_color(tile, lv_obj_get_style_bg_color(tileview, LV_PART_MAIN), LV_PART_MAIN);
+	lv_obj_set_style_bg_opa(tile, LV_OPA_COVER, LV_PART_MAIN);
+	res = lv_snapshot_take_to_buf(tile, LV_IMG_CF_TRUE_COLOR, &snap_dsc[slot], snap_buf[slot], snap_buf_len[slot]);
+	lv_obj_remove_local_style_prop(tile, LV_STYLE_BG_OPA, LV_PART_MAIN);
+	lv_obj_remove_local_style_prop(tile, LV_STYLE_BG_COLOR, LV_PART_MAIN);
+	if (res != LV_RES_OK) {
+		ESP_LOGE(TAG, "Tile %d snapshot failed", n);
+		return;
+	}
+	
+	// Place the image over the tile's (extended) area whatever the tile's own scroll position
+	ext = _lv_obj_get_ext_draw_size(tile);
+	img = lv_img_create(tile);
+	lv_obj_add_flag(img, LV_OBJ_FLAG_FLOATING);
+	lv_obj_clear_flag(img, LV_OBJ_FLAG_CLICKABLE);
+	lv_img_set_src(img, &snap_dsc[slot]);
+	lv_obj_update_layout(img);
+	lv_obj_set_pos(img, tile->coords.x1 - ext - img->coords.x1, tile->coords.y1 - ext - img->coords.y1);
+	lv_obj_add_event_cb(img, _gui_screen_main_snap_delete_cb, LV_EVENT_DELETE, (void*) slot);
+	
+	snap_img[slot] = img;
+	snap_tile_index[slot] = n;
+}
+
+
+static void _gui_screen_main_release_snap(int slot)
+{
+	if (snap_img[slot] != NULL) {
+		// The delete callback clears the slot
+		lv_obj_del(snap_img[slot]);
+	}
+}
+
+
+// Also catches the image being deleted along with its tile's content
+static void _gui_screen_main_snap_delete_cb(lv_event_t* e)
+{
+	int slot = (int) lv_event_get_user_data(e);
+	
+	snap_img[slot] = NULL;
+	snap_tile_index[slot] = -1;
+	lv_img_cache_invalidate_src(&snap_dsc[slot]);
+}
+#endif
\ No newline at end of file
@@ -22,6 +22,7 @@
 #ifndef GUI_SCREEN_MAIN_H
 #define GUI_SCREEN_MAIN_H
 
+#include "data_broker.h"
 #include "lvgl.h"
 #include <stdbool.h>
 #include <stdint.h>
@@ -36,10 +37,21 @@
 #define GUI_SCREEN_MAIN_TILE_TORQUE     0
 #define GUI_SCREEN_MAIN_TILE_POWER      1
 #define GUI_SCREEN_MAIN_TILE_ELECTRICAL 2
-#define GUI_SCREEN_MAIN_TILE_TIMED      3
-#define GUI_SCREEN_MAIN_TILE_SETTINGS   4
+#define GUI_SCREEN_MAIN_TILE_CELLS      3
+#define GUI_SCREEN_MAIN_TILE_TIMED      4
+#define GUI_SCREEN_MAIN_TILE_SETTINGS   5
+#define GUI_SCREEN_MAIN_TILE_DIAG       6
+#define GUI_SCREEN_MAIN_TILE_REVIEW     7
+#define GUI_SCREEN_MAIN_TILE_GAUGE      8    // First of GUI_GAUGE_TILE_MAX table-driven tiles
 
-#define GUI_SCREEN_MAIN_NUM_TILES       5
+#define GUI_SCREEN_MAIN_NUM_TILES       10
+
+// Tiles within this many positions of the displayed tile have their contents built;
+// tiles further away are torn down
+#define GUI_SCREEN_MAIN_RESIDENT_DIST   1
+
+// Delay after a tile change before neighbouring tiles are built and distant ones torn down
+#define GUI_SCREEN_MAIN_PREFETCH_MSEC   100
 
 
 
@@ -48,6 +60,9 @@
 //
 typedef void (*tile_activation_handler)(bool en);
 
+// Build (true) or tear down (false) a tile's display objects
+typedef void (*tile_content_handler)(bool build);
+
 
 
 //
@@ -55,8 +70,14 @@ typedef void (*tile_activation_handler)(bool en);
 //
 lv_obj_t* gui_screen_main_init();
 void gui_screen_main_set_active(bool is_active);
+bool gui_screen_main_is_scrolling();
+int gui_screen_main_get_num_tiles();
+int gui_screen_main_get_tile();
+void gui_screen_main_show_tile(int n);
 
-// From tile pages
-void gui_screen_main_register_tile(lv_obj_t* tile, tile_activation_handler activate_func);
+// From tile pages (content_func may be NULL for a tile whose contents are always resident).
+// item_mask is the set of items the tile requests while displayed (prefetched while the
+// user swipes toward it).
+void gui_screen_main_register_tile(lv_obj_t* tile, tile_activation_handler activate_func, tile_content_handler content_func, db_mask_t item_mask);
 
 #endif /* GUI_SCREEN_MAIN_H */
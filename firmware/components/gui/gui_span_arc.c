@@ -0,0 +1,313 @@
+/*
+ * Span arc - an lv_arc whose track and indicator are filled as horizontal row spans from
+ * per-geometry radius tables instead of LVGL's masked anti-aliased arc drawing.  Edges get
+ * a single anti-aliased pixel against the circles and the ends are square.  All the lv_arc
+ * setters (and gui_utility_set_arc_value()) work on it.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "gui_span_arc.h"
+#include "src/draw/sw/lv_draw_sw.h"
+#include <math.h>
+
+
+
+//
+// Private constants
+//
+// Row table entry (half-widths from the center column) marking a row above or below the
+// inner circle (a single span)
+#define NO_INNER  -1
+
+
+
+//
+// Private typedefs
+//
+
+// Per-row extents of an annulus for rows 0 to r above or below its center: pixels out to
+// outer (and from inner) are solid, with one pixel beyond each edge at the given coverage
+typedef struct {
+	int16_t outer;
+	int16_t inner;                   // NO_INNER if the row misses the inner circle
+	uint8_t outer_aa;
+	uint8_t inner_aa;
+} span_row_t;
+
+typedef struct {
+	lv_coord_t r;
+	lv_coord_t w;
+	span_row_t* rows;                // r + 1 entries
+} span_geom_t;
+
+
+
+//
+// Variables
+//
+static const char* TAG = "gui_span_arc";
+
+static span_geom_t geoms[GUI_SPAN_ARC_MAX_GEOM];
+static int num_geoms = 0;
+
+static void _gui_span_arc_event(const lv_obj_class_t* class_p, lv_event_t* e);
+
+// Subclass of lv_arc that only replaces its drawing
+static const lv_obj_class_t gui_span_arc_class = {
+	.event_cb = _gui_span_arc_event,
+	.instance_size = sizeof(lv_arc_t),
+	.editable = LV_OBJ_CLASS_EDITABLE_TRUE,
+	.base_class = &lv_arc_class
+};
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _gui_span_arc_draw(lv_event_t* e);
+static void _gui_span_arc_draw_part(lv_obj_t* obj, lv_draw_ctx_t* draw_ctx, lv_part_t part, const lv_point_t* c, lv_coord_t r, int32_t start, int32_t end);
+static void _gui_span_arc_draw_piece(lv_draw_ctx_t* draw_ctx, const span_geom_t* gP, const lv_point_t* c, int32_t a0, int32_t a1, lv_color_t color, lv_opa_t opa);
+static void _gui_span_arc_fill(lv_draw_ctx_t* draw_ctx, const lv_point_t* c, int32_t x1, int32_t x2, int32_t y, int32_t lo, int32_t hi, lv_color_t color, lv_opa_t opa);
+static const span_geom_t* _gui_span_arc_get_geom(lv_coord_t r, lv_coord_t w);
+
+
+
+//
+// API
+//
+lv_obj_t* gui_span_arc_create(lv_obj_t* parent)
+{
+	lv_obj_t* obj;
+	
+	// Created as an lv_arc so the theme styles it as one, then switched to the subclass
+	obj = lv_arc_create(parent);
+	obj->class_p = &gui_span_arc_class;
+	
+	return obj;
+}
+
+
+
+//
+// Internal functions
+//
+static void _gui_span_arc_event(const lv_obj_class_t* class_p, lv_event_t* e)
+{
+	lv_res_t res;
+	
+	if (lv_event_get_code(e) == LV_EVENT_DRAW_MAIN) {
+		// The object's own (background) drawing, skipping lv_arc's
+		res = lv_obj_event_base(&lv_arc_class, e);
+		if (res == LV_RES_OK) {
+			_gui_span_arc_draw(e);
+		}
+	} else {
+		(void) lv_obj_event_base(&gui_span_arc_class, e);
+	}
+}
+
+
+// Same geometry as lv_arc: track at the largest circle fitting inside the padding and the
+// indicator inside it by the indicator's padding (the knob is not drawn)
+static void _gui_span_arc_draw(lv_event_t* e)
+{
+	lv_obj_t* obj = lv_event_get_target(e);
+	lv_arc_t* arc = (lv_arc_t*) obj;
+	lv_draw_ctx_t* draw_ctx = lv_event_get_draw_ctx(e);
+	lv_coord_t pad_l, pad_t;
+	lv_coord_t r;
+	lv_point_t c;
+	
+	pad_l = lv_obj_get_style_pad_left(obj, LV_PART_MAIN);
+	pad_t = lv_obj_get_style_pad_top(obj, LV_PART_MAIN);
+	r = LV_MIN(lv_obj_get_width(obj) - pad_l - lv_obj_get_style_pad_right(obj, LV_PART_MAIN),
+	           lv_obj_get_height(obj) - pad_t - lv_obj_get_style_pad_bottom(obj, LV_PART_MAIN)) / 2;
+	c.x = obj->coords.x1 + r + pad_l;
+	c.y = obj->coords.y1 + r + pad_t;
+	
+	_gui_span_arc_draw_part(obj, draw_ctx, LV_PART_MAIN, &c, r, arc->bg_angle_start, arc->bg_angle_end);
+	
+	r -= LV_MAX4(lv_obj_get_style_pad_left(obj, LV_PART_INDICATOR), lv_obj_get_style_pad_right(obj, LV_PART_INDICATOR),
+	             lv_obj_get_style_pad_top(obj, LV_PART_INDICATOR), lv_obj_get_style_pad_bottom(obj, LV_PART_INDICATOR));
+	_gui_span_arc_draw_part(obj, draw_ctx, LV_PART_INDICATOR, &c, r, arc->indic_angle_start, arc->indic_angle_end);
+}
+
+
+static void _gui_span_arc_draw_part(lv_obj_t* obj, lv_draw_ctx_t* draw_ctx, lv_part_t part, const lv_point_t* c, lv_coord_t r, int32_t start, int32_t end)
+{
+	lv_arc_t* arc = (lv_arc_t*) obj;
+	lv_draw_arc_dsc_t arc_dsc;
+	const span_geom_t* gP;
+	int32_t piece_end;
+	
+	if ((r <= 0) || (start == end)) return;
+	
+	// Color, width and opacity (including the object's) as lv_arc would draw them
+	lv_draw_arc_dsc_init(&arc_dsc);
+	lv_obj_init_draw_arc_dsc(obj, part, &arc_dsc);
+	if ((arc_dsc.width <= 0) || (arc_dsc.opa <= LV_OPA_MIN)) return;
+	if (arc_dsc.width > r) arc_dsc.width = r;
+	
+	gP = _gui_span_arc_get_geom(r, arc_dsc.width);
+	if (gP == NULL) return;
+	
+	// Screen angles (0 = right, clockwise) increasing from start to end
+	if (end < start) end += 360;
+	start += arc->rotation;
+	end += arc->rotation;
+	
+	while (start < end) {
+		piece_end = start + GUI_SPAN_ARC_PIECE_DEG;
+		if (piece_end > end) piece_end = end;
+		_gui_span_arc_draw_piece(draw_ctx, gP, c, start, piece_end, arc_dsc.color, arc_dsc.opa);
+		start = piece_end;
+	}
+}
+
+
+// Fill the sector between two rays (at most 90 degrees apart) one row at a time.  Each
+// boundary ray bounds the row on one side: a pixel is in the sector when it is on or
+// clockwise of the first ray and strictly anti-clockwise of the second, so adjacent pieces
+// never fill the same pixel.
+static void _gui_span_arc_draw_piece(lv_draw_ctx_t* draw_ctx, const span_geom_t* gP, const lv_point_t* c, int32_t a0, int32_t a1, lv_color_t color, lv_opa_t opa)
+{
+	const span_row_t* rowP;
+	int32_t c0 = lv_trigo_cos(a0);
+	int32_t s0 = lv_trigo_sin(a0);
+	int32_t c1 = lv_trigo_cos(a1);
+	int32_t s1 = lv_trigo_sin(a1);
+	int32_t lo, hi;
+	int32_t y1, y2;
+	int32_t dy;
+	
+	// Rows of the annulus inside the area being drawn
+	y1 = LV_MAX(c->y - gP->r, draw_ctx->clip_area->y1);
+	y2 = LV_MIN(c->y + gP->r, draw_ctx->clip_area->y2);
+	
+	for (int32_t y=y1; y<=y2; y++) {
+		dy = y - c->y;
+		rowP = &gP->rows[LV_ABS(dy)];
+		
+		// Columns (relative to the center) between the rays, from
+		//   c0 * dy - s0 * dx >= 0  and  c1 * dy - s1 * dx < 0
+		lo = -gP->r - 1;
+		hi = gP->r + 1;
+		if (s0 > 0) {
+			hi = LV_MIN(hi, (int32_t) floorf((float) (c0 * dy) / s0));
+		} else if (s0 < 0) {
+			lo = LV_MAX(lo, (int32_t) ceilf((float) (c0 * dy) / s0));
+		} else if (c0 * dy < 0) {
+			continue;
+		}
+		if (s1 > 0) {
+			lo = LV_MAX(lo, (int32_t) floorf((float) (c1 * dy) / s1) + 1);
+		} else if (s1 < 0) {
+			hi = LV_MIN(hi, (int32_t) ceilf((float) (c1 * dy) / s1) - 1);
+		} else if (c1 * dy >= 0) {
+			continue;
+		}
+		if (lo > hi) continue;
+		
+		if (rowP->inner == NO_INNER) {
+			_gui_span_arc_fill(draw_ctx, c, -rowP->outer, rowP->outer, y, lo, hi, color, opa);
+		} else {
+			_gui_span_arc_fill(draw_ctx, c, -rowP->outer, -rowP->inner, y, lo, hi, color, opa);
+			_gui_span_arc_fill(draw_ctx, c, rowP->inner, rowP->outer, y, lo, hi, color, opa);
+			
+			// Inner edge pixels (a single one at the center column)
+			_gui_span_arc_fill(draw_ctx, c, rowP->inner - 1, rowP->inner - 1, y, lo, hi, color, (opa * rowP->inner_aa) >> 8);
+			if (rowP->inner > 1) {
+				_gui_span_arc_fill(draw_ctx, c, 1 - rowP->inner, 1 - rowP->inner, y, lo, hi, color, (opa * rowP->inner_aa) >> 8);
+			}
+		}
+		_gui_span_arc_fill(draw_ctx, c, -rowP->outer - 1, -rowP->outer - 1, y, lo, hi, color, (opa * rowP->outer_aa) >> 8);
+		_gui_span_arc_fill(draw_ctx, c, rowP->outer + 1, rowP->outer + 1, y, lo, hi, color, (opa * rowP->outer_aa) >> 8);
+	}
+}
+
+
+// Blend columns x1 to x2 (relative to the center) of a row limited to lo to hi
+static void _gui_span_arc_fill(lv_draw_ctx_t* draw_ctx, const lv_point_t* c, int32_t x1, int32_t x2, int32_t y, int32_t lo, int32_t hi, lv_color_t color, lv_opa_t opa)
+{
+	lv_draw_sw_blend_dsc_t dsc;
+	lv_area_t a;
+	
+	if (x1 < lo) x1 = lo;
+	if (x2 > hi) x2 = hi;
+	if ((x1 > x2) || (opa <= LV_OPA_MIN)) return;
+	
+	a.x1 = c->x + x1;
+	a.x2 = c->x + x2;
+	if ((a.x2 < draw_ctx->clip_area->x1) || (a.x1 > draw_ctx->clip_area->x2)) return;
+	a.y1 = y;
+	a.y2 = y;
+	
+	lv_memset_00(&dsc, sizeof(dsc));
+	dsc.blend_area = &a;
+	dsc.color = color;
+	dsc.opa = opa;
+	dsc.mask_res = LV_DRAW_MASK_RES_FULL_COVER;
+	dsc.blend_mode = LV_BLEND_MODE_NORMAL;
+	lv_draw_sw_blend(draw_ctx, &dsc);
+}
+
+
+// Find or build the row table for a geometry
+static const span_geom_t* _gui_span_arc_get_geom(lv_coord_t r, lv_coord_t w)
+{
+	span_geom_t* gP;
+	float r_in = r - w;
+	float xo, xi;
+	
+	for (int i=0; i<num_geoms; i++) {
+		if ((geoms[i].r == r) && (geoms[i].w == w)) return &geoms[i];
+	}
+	
+	if (num_geoms == GUI_SPAN_ARC_MAX_GEOM) {
+		ESP_LOGE(TAG, "Too many arc geometries");
+		return NULL;
+	}
+	gP = &geoms[num_geoms];
+	gP->rows = heap_caps_malloc((r + 1) * sizeof(span_row_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	if (gP->rows == NULL) {
+		ESP_LOGE(TAG, "Could not allocate arc table for r = %d", r);
+		return NULL;
+	}
+	gP->r = r;
+	gP->w = w;
+	num_geoms += 1;
+	
+	// Circle crossings through pixel centers
+	for (int dy=0; dy<=r; dy++) {
+		xo = sqrtf((float) (r * r - dy * dy));
+		gP->rows[dy].outer = (int16_t) xo;
+		gP->rows[dy].outer_aa = (uint8_t) ((xo - floorf(xo)) * 255.0f);
+		if (dy < r_in) {
+			xi = sqrtf(r_in * r_in - (float) (dy * dy));
+			gP->rows[dy].inner = (int16_t) ceilf(xi);
+			gP->rows[dy].inner_aa = (uint8_t) ((ceilf(xi) - xi) * 255.0f);
+		} else {
+			gP->rows[dy].inner = NO_INNER;
+			gP->rows[dy].inner_aa = 0;
+		}
+	}
+	
+	return gP;
+}
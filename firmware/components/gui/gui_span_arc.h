@@ -0,0 +1,50 @@
+/*
+ * Span arc - an lv_arc whose track and indicator are filled as horizontal row spans from
+ * per-geometry radius tables instead of LVGL's masked anti-aliased arc drawing.  Edges get
+ * a single anti-aliased pixel against the circles and the ends are square.  All the lv_arc
+ * setters (and gui_utility_set_arc_value()) work on it.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef GUI_SPAN_ARC_H
+#define GUI_SPAN_ARC_H
+
+#include "lvgl.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Maximum number of distinct (radius, width) geometries.  Tables are built the first
+// time a geometry is drawn and shared by all arcs with it.
+#define GUI_SPAN_ARC_MAX_GEOM  8
+
+// Sectors are filled in pieces of at most this many degrees (must be <= 90)
+#define GUI_SPAN_ARC_PIECE_DEG 90
+
+
+
+//
+// API
+//
+lv_obj_t* gui_span_arc_create(lv_obj_t* parent);
+
+#endif /* GUI_SPAN_ARC_H */
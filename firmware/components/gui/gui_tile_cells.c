@@ -0,0 +1,306 @@
+/*
+ * Battery cell display tile.  Display a histogram of HV battery cell voltages along with
+ * their spread and the range of cell temperatures.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "data_broker.h"
+#include "esp_system.h"
+#include "gui_task.h"
+#include "gui_screen_main.h"
+#include "gui_tile_cells.h"
+#include "gui_utilities.h"
+#include "vehicle_manager.h"
+#include <stdio.h>
+
+
+
+//
+// Local Constants
+//
+
+// Histogram bins spread over the range of cell voltages, each at least this wide (mV)
+#define NUM_BINS               16
+#define MIN_BIN_MV             2
+
+// Interval to check for a new acquisition (cells are polled every few seconds)
+#define TIMER_EVAL_MSEC        500
+
+// Pack temperature trend range (°C)
+#define TEMP_TREND_MIN         -20.0
+#define TEMP_TREND_MAX         60.0
+
+
+
+//
+// Local Variables
+//
+static lv_obj_t* tile;
+
+static lv_obj_t* cell_chart = NULL;
+static lv_chart_series_t* cell_ser;
+static lv_obj_t* spread_lbl;
+static lv_obj_t* range_lbl;
+static lv_obj_t* temp_lbl;
+
+static gui_trend_t temp_trend;             // Highest pack temperature over the last minute
+
+static lv_timer_t* cells_eval_timer = NULL;
+
+// Vehicle capability flags
+static bool has_cells;
+static bool has_temps;
+
+// State
+static bool units_metric;
+static uint16_t tile_w;
+static uint16_t tile_h;
+static uint32_t prev_v_count;
+static uint32_t prev_t_count;
+static db_cell_array_t cells;
+static lv_coord_t bin_counts[NUM_BINS];
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _gui_tile_cells_set_active(bool en);
+static void _gui_tile_cells_set_content(bool build);
+static void _gui_tile_cells_timer_cb(lv_timer_t* timer);
+static void _gui_tile_cells_update_voltages();
+static void _gui_tile_cells_update_temps();
+static void _gui_tile_cells_quality_cb(int item, int quality);
+static void _gui_tile_cells_null_cb(float val);
+
+
+
+//
+// API
+//
+void gui_tile_cells_init(lv_obj_t* parent_tileview, int* tile_index)
+{
+	db_mask_t capability_mask;
+	
+	// Create our object
+	tile = lv_tileview_add_tile(parent_tileview, *tile_index, 0, LV_DIR_LEFT | LV_DIR_RIGHT);
+	*tile_index += 1;
+	
+	gui_get_screen_size(&tile_w, &tile_h);
+	
+	// Determine our capabilities
+	capability_mask = vm_get_supported_item_mask();
+	has_cells = (capability_mask & DB_MASK(DB_ITEM_CELL_MIN_V)) != 0;
+	has_temps = (capability_mask & (DB_MASK(DB_ITEM_HV_BATT_MIN_T) | DB_MASK(DB_ITEM_HV_BATT_MAX_T))) != 0;
+	
+	// Register ourselves with our parent if we're capable of displaying something
+	// (it has us create our display objects when we're about to be displayed)
+	if (has_cells) {
+		gui_screen_main_register_tile(tile, _gui_tile_cells_set_active, _gui_tile_cells_set_content,
+		                              DB_MASK(DB_ITEM_CELL_MIN_V) | DB_MASK(DB_ITEM_CELL_MAX_V) |
+		                              (has_temps ? (DB_MASK(DB_ITEM_HV_BATT_MIN_T) | DB_MASK(DB_ITEM_HV_BATT_MAX_T)) : 0));
+		
+		// Create our evaluation timer
+		cells_eval_timer = lv_timer_create(_gui_tile_cells_timer_cb, TIMER_EVAL_MSEC, NULL);
+		lv_timer_set_repeat_count(cells_eval_timer, -1);
+		lv_timer_pause(cells_eval_timer);
+	}
+	
+	// Get our display units
+	units_metric = gui_is_metric();
+}
+
+
+
+//
+// Internal functions
+//
+static void _gui_tile_cells_set_active(bool en)
+{
+	db_mask_t req_mask;
+	
+	if (en) {
+		// Requesting the cell items starts the (slow) cell acquisition.  The display is
+		// drawn from the broker's cell arrays, the handlers only let us track quality.
+		req_mask = DB_MASK(DB_ITEM_CELL_MIN_V) | DB_MASK(DB_ITEM_CELL_MAX_V);
+		db_register_gui_callback(DB_ITEM_CELL_MIN_V, _gui_tile_cells_null_cb);
+		db_register_gui_callback(DB_ITEM_CELL_MAX_V, _gui_tile_cells_null_cb);
+		if (has_temps) {
+			req_mask |= DB_MASK(DB_ITEM_HV_BATT_MIN_T) | DB_MASK(DB_ITEM_HV_BATT_MAX_T);
+		}
+		vm_set_request_item_mask(req_mask);
+		
+		db_register_gui_quality_callback(_gui_tile_cells_quality_cb);
+		_gui_tile_cells_quality_cb(DB_ITEM_CELL_MAX_V, db_get_item_quality(DB_ITEM_CELL_MAX_V));
+		
+		// Display whatever was last acquired
+		prev_v_count = 0;
+		prev_t_count = 0;
+		_gui_tile_cells_timer_cb(cells_eval_timer);
+		lv_timer_resume(cells_eval_timer);
+	} else {
+		lv_timer_pause(cells_eval_timer);
+	}
+	
+	gui_utility_set_trend_active(&temp_trend, en && has_temps);
+}
+
+
+static void _gui_tile_cells_set_content(bool build)
+{
+	if (build) {
+		// Histogram of cell voltages
+		cell_chart = lv_chart_create(tile);
+		lv_obj_set_size(cell_chart, (tile_w * 5) / 8, (tile_h * 3) / 8);
+		lv_obj_align(cell_chart, LV_ALIGN_CENTER, 0, -tile_h / 16);
+		lv_chart_set_type(cell_chart, LV_CHART_TYPE_BAR);
+		lv_chart_set_point_count(cell_chart, NUM_BINS);
+		lv_chart_set_div_line_count(cell_chart, 0, 0);
+		lv_obj_set_style_pad_column(cell_chart, 2, LV_PART_MAIN);
+		lv_obj_set_style_bg_opa(cell_chart, LV_OPA_TRANSP, LV_PART_MAIN);
+		lv_obj_set_style_border_color(cell_chart, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_MAIN);
+		cell_ser = lv_chart_add_series(cell_chart, lv_palette_main(LV_PALETTE_GREEN), LV_CHART_AXIS_PRIMARY_Y);
+		lv_chart_set_ext_y_array(cell_chart, cell_ser, bin_counts);
+		
+		// Cell voltage spread
+		spread_lbl = lv_label_create(tile);
+		lv_obj_add_style(spread_lbl, gui_utility_get_style(GUI_STYLE_READOUT), LV_PART_MAIN);
+		lv_obj_align(spread_lbl, LV_ALIGN_CENTER, 0, -(tile_h * 5) / 16);
+		lv_label_set_text_static(spread_lbl, "-- mV");
+		
+		// Lowest and highest cell voltage
+		range_lbl = lv_label_create(tile);
+		lv_obj_set_style_text_font(range_lbl, &lv_font_montserrat_18, LV_PART_MAIN);
+		lv_obj_align(range_lbl, LV_ALIGN_CENTER, 0, (tile_h * 3) / 16);
+		lv_label_set_text_static(range_lbl, "");
+		
+		// Cell temperature range
+		temp_lbl = lv_label_create(tile);
+		lv_obj_set_style_text_font(temp_lbl, &lv_font_montserrat_18, LV_PART_MAIN);
+		lv_obj_align(temp_lbl, LV_ALIGN_CENTER, 0, (tile_h * 5) / 16);
+		lv_label_set_text_static(temp_lbl, "");
+		
+		// Highest temperature trend strip
+		if (has_temps && (gui_utility_create_trend(&temp_trend, tile, DB_ITEM_HV_BATT_MAX_T, tile_w / 3, tile_h / 20,
+		                                           TEMP_TREND_MIN, TEMP_TREND_MAX, lv_palette_main(LV_PALETTE_ORANGE)) != NULL)) {
+			lv_obj_align(temp_trend.canvas, LV_ALIGN_CENTER, 0, (tile_h * 3) / 8);
+		}
+		
+		// Redraw from the last acquisition
+		prev_v_count = 0;
+		prev_t_count = 0;
+	} else {
+		lv_obj_clean(tile);
+		cell_chart = NULL;
+	}
+}
+
+
+static void _gui_tile_cells_timer_cb(lv_timer_t* timer)
+{
+	if ((timer != cells_eval_timer) || (cell_chart == NULL)) return;
+	
+	// Only redraw after a new acquisition
+	if (db_get_cell_array_count(DB_CELL_ARRAY_V) != prev_v_count) {
+		_gui_tile_cells_update_voltages();
+	}
+	if (has_temps && (db_get_cell_array_count(DB_CELL_ARRAY_T) != prev_t_count)) {
+		_gui_tile_cells_update_temps();
+	}
+}
+
+
+// Bin the cell voltages between the lowest and highest cell and redraw the histogram
+static void _gui_tile_cells_update_voltages()
+{
+	char buf[32];
+	int bin;
+	int bin_mv;
+	int16_t v_min = INT16_MAX;
+	int16_t v_max = INT16_MIN;
+	lv_coord_t max_count = 1;
+	
+	if (!db_get_cell_array(DB_CELL_ARRAY_V, &cells)) return;
+	prev_v_count = cells.update_count;
+	
+	for (int i=0; i<cells.num; i++) {
+		if (cells.val[i] < v_min) v_min = cells.val[i];
+		if (cells.val[i] > v_max) v_max = cells.val[i];
+	}
+	
+	bin_mv = (v_max - v_min + NUM_BINS) / NUM_BINS;
+	if (bin_mv < MIN_BIN_MV) bin_mv = MIN_BIN_MV;
+	
+	for (int i=0; i<NUM_BINS; i++) {
+		bin_counts[i] = 0;
+	}
+	for (int i=0; i<cells.num; i++) {
+		bin = (cells.val[i] - v_min) / bin_mv;
+		if (bin >= NUM_BINS) bin = NUM_BINS - 1;
+		bin_counts[bin] += 1;
+		if (bin_counts[bin] > max_count) max_count = bin_counts[bin];
+	}
+	
+	lv_chart_set_range(cell_chart, LV_CHART_AXIS_PRIMARY_Y, 0, max_count);
+	lv_chart_refresh(cell_chart);
+	
+	sprintf(buf, "%d mV", v_max - v_min);
+	lv_label_set_text(spread_lbl, buf);
+	sprintf(buf, "%d.%03d - %d.%03d V", v_min / 1000, v_min % 1000, v_max / 1000, v_max % 1000);
+	lv_label_set_text(range_lbl, buf);
+}
+
+
+static void _gui_tile_cells_update_temps()
+{
+	char buf[32];
+	float t;
+	float t_min = 1000;
+	float t_max = -1000;
+	
+	if (!db_get_cell_array(DB_CELL_ARRAY_T, &cells)) return;
+	prev_t_count = cells.update_count;
+	
+	for (int i=0; i<cells.num; i++) {
+		t = (float) cells.val[i] / 10.0f;
+		if (!units_metric) t = gui_util_c_to_f(t);
+		if (t < t_min) t_min = t;
+		if (t > t_max) t_max = t;
+	}
+	
+	sprintf(buf, "%.1f - %.1f °%c", t_min, t_max, units_metric ? 'C' : 'F');
+	lv_label_set_text(temp_lbl, buf);
+}
+
+
+// Only called for items with registered handlers (whose display objects exist)
+static void _gui_tile_cells_quality_cb(int item, int quality)
+{
+	bool stale = (quality == DB_QUALITY_STALE) || (quality == DB_QUALITY_ERROR);
+	
+	if ((item == DB_ITEM_CELL_MAX_V) && (cell_chart != NULL)) {
+		gui_utility_set_stale(cell_chart, stale);
+		gui_utility_set_stale(spread_lbl, stale);
+		gui_utility_set_stale(range_lbl, stale);
+	}
+}
+
+
+static void _gui_tile_cells_null_cb(float val)
+{
+	// The cell arrays are checked by our timer
+}
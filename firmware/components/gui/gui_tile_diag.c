@@ -0,0 +1,225 @@
+/*
+ * Diagnostics tile.  Display per-request polling statistics (response rate, latency
+ * percentiles and error counts) and the effective update rate of each data item.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "data_broker.h"
+#include "deadline_utilities.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "gui_task.h"
+#include "gui_screen_main.h"
+#include "gui_tile_diag.h"
+#include "mon_task.h"
+#include "vehicle_manager.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+//
+// Local Constants
+//
+
+// Statistics update interval
+#define TIMER_EVAL_MSEC       1000
+
+// Maximum number of requests and items displayed
+#define MAX_DISP_REQ          8
+#define MAX_DISP_ITEMS        12
+
+// Display text buffer length
+#define DIAG_BUF_LEN          1024
+
+
+
+//
+// Local Variables
+//
+
+// LVGL objects
+static lv_obj_t* tile;
+static lv_obj_t* diag_lbl;
+
+static lv_timer_t* diag_eval_timer = NULL;
+
+// State
+static uint16_t tile_w;
+static uint16_t tile_h;
+static int64_t prev_eval_msec;
+static uint32_t prev_rsp_count[MAX_DISP_REQ];
+static uint32_t prev_item_count[DB_NUM_ITEMS];
+static char diag_buf[DIAG_BUF_LEN];
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _gui_tile_diag_set_active(bool en);
+static void _gui_tile_diag_timer_cb(lv_timer_t* timer);
+static void _gui_tile_diag_snapshot();
+static void _gui_tile_diag_update();
+
+
+
+//
+// API
+//
+void gui_tile_diag_init(lv_obj_t* parent_tileview, int* tile_index)
+{
+	// Create our object
+	tile = lv_tileview_add_tile(parent_tileview, *tile_index, 0, LV_DIR_LEFT | LV_DIR_RIGHT);
+	*tile_index += 1;
+	
+	gui_get_screen_size(&tile_w, &tile_h);
+	
+	// Statistics label, inset to fit on a circular display
+	diag_lbl = lv_label_create(tile);
+	lv_label_set_long_mode(diag_lbl, LV_LABEL_LONG_CLIP);
+	lv_obj_set_style_text_align(diag_lbl, LV_TEXT_ALIGN_CENTER, 0);
+	lv_obj_set_style_text_font(diag_lbl, &lv_font_montserrat_14, LV_PART_MAIN);
+	lv_obj_set_size(diag_lbl, (tile_w * 3) / 4, (tile_h * 7) / 8);
+	lv_obj_set_pos(diag_lbl, tile_w / 8, tile_h / 16);
+	lv_label_set_text_static(diag_lbl, "");
+	
+	// Register ourselves
+	gui_screen_main_register_tile(tile, _gui_tile_diag_set_active, NULL, vm_get_supported_item_mask());
+	
+	// Create our evaluation timer
+	diag_eval_timer = lv_timer_create(_gui_tile_diag_timer_cb, TIMER_EVAL_MSEC, NULL);
+	lv_timer_set_repeat_count(diag_eval_timer, -1);
+	lv_timer_pause(diag_eval_timer);
+}
+
+
+
+//
+// Internal functions
+//
+static void _gui_tile_diag_set_active(bool en)
+{
+	if (en) {
+		// Poll everything the vehicle supports so the statistics reflect a fully loaded schedule
+		vm_set_request_item_mask(vm_get_supported_item_mask());
+		
+		_gui_tile_diag_snapshot();
+		lv_label_set_text_static(diag_lbl, "");
+		lv_timer_resume(diag_eval_timer);
+	} else {
+		lv_timer_pause(diag_eval_timer);
+	}
+}
+
+
+static void _gui_tile_diag_timer_cb(lv_timer_t* timer)
+{
+	if (timer == diag_eval_timer) {
+		_gui_tile_diag_update();
+	}
+}
+
+
+// Record counts as the starting point for the next rate computation
+static void _gui_tile_diag_snapshot()
+{
+	vm_req_stats_t stats;
+	
+	prev_eval_msec = esp_timer_get_time() / 1000;
+	
+	for (int i=0; i<MAX_DISP_REQ; i++) {
+		prev_rsp_count[i] = vm_get_request_stats(i, &stats) ? stats.num_rsp : 0;
+	}
+	
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		prev_item_count[i] = db_get_item_update_count(i);
+	}
+}
+
+
+// Display the core loads, heap free/minimum-ever-free, the task closest to overflowing
+// its stack and the CAN and GUI loop last/maximum iteration times with their budget
+// overrun counts and the phase that took longest in the last overrun, then one line per
+// request: response rate, p50/p90 latency (mSec) and counts of Timeouts, No data, lost
+// Frames and negative Responses.  Then item update rates.
+static void _gui_tile_diag_update()
+{
+	char* cp = diag_buf;
+	char* endP = diag_buf + DIAG_BUF_LEN;
+	float dt;
+	int64_t cur_msec;
+	uint32_t count;
+	db_mask_t item_mask;
+	vm_req_stats_t stats;
+	mon_heap_info_t heap;
+	deadline_stats_t dl_stats;
+	char task_name[MON_TASK_NAME_LEN];
+	uint32_t stack_hwm;
+	
+	cur_msec = esp_timer_get_time() / 1000;
+	dt = (float) (cur_msec - prev_eval_msec) / 1000.0;
+	if (dt <= 0) return;
+	prev_eval_msec = cur_msec;
+	
+	if (mon_get_core_load(0) >= 0) {
+		cp += snprintf(cp, endP - cp, "CPU0 %d%%   CPU1 %d%%\n", mon_get_core_load(0), mon_get_core_load(1));
+	}
+	if (mon_get_freq_residency(240) >= 0) {
+		cp += snprintf(cp, endP - cp, "240M %d%%  160M %d%%  80M %d%%\n", mon_get_freq_residency(240),
+		               mon_get_freq_residency(160), mon_get_freq_residency(80));
+	}
+	if (mon_get_heap_info(&heap)) {
+		cp += snprintf(cp, endP - cp, "SRAM %luK/%luK   PSRAM %luK/%luK\n",
+		               heap.int_free / 1024, heap.int_min_free / 1024,
+		               heap.psram_free / 1024, heap.psram_min_free / 1024);
+	}
+	if (mon_get_min_stack(task_name, &stack_hwm)) {
+		cp += snprintf(cp, endP - cp, "Min stack %s %lu\n", task_name, stack_hwm);
+	}
+	for (int i=0; i<DEADLINE_NUM_LOOPS; i++) {
+		if (deadline_get_stats(i, &dl_stats)) {
+			cp += snprintf(cp, endP - cp, "%s %.1f/%.1fmS  %lu over %s\n", (i == DEADLINE_LOOP_CAN) ? "CAN" : "GUI",
+			               (float) dl_stats.last_usec / 1000.0, (float) dl_stats.max_usec / 1000.0,
+			               dl_stats.overruns, deadline_get_phase_name(dl_stats.overrun_phase));
+		}
+	}
+	
+	for (int i=0; i<MAX_DISP_REQ; i++) {
+		if (!vm_get_request_stats(i, &stats)) break;
+		
+		cp += snprintf(cp, endP - cp, "%03lX %.1fHz %lu/%lumS T%lu N%lu F%lu R%lu\n",
+		               stats.rsp_id, (float) (stats.num_rsp - prev_rsp_count[i]) / dt,
+		               vm_get_latency_percentile(&stats, 50), vm_get_latency_percentile(&stats, 90),
+		               stats.num_timeout, stats.num_no_data, stats.num_frame_timeout, stats.num_neg_rsp);
+		prev_rsp_count[i] = stats.num_rsp;
+		if (cp >= endP) break;
+	}
+	
+	item_mask = vm_get_supported_item_mask();
+	for (int i=1, n=0; (i<DB_NUM_ITEMS) && (n<MAX_DISP_ITEMS) && (cp < endP); i++) {
+		if (((item_mask & DB_MASK(i)) != 0) && (db_catalog_get(i)->name != NULL)) {
+			count = db_get_item_update_count(i);
+			cp += snprintf(cp, endP - cp, "%s %.1f%s", db_catalog_get(i)->name, (float) (count - prev_item_count[i]) / dt,
+			               ((n % 2) == 1) ? "\n" : "   ");
+			prev_item_count[i] = count;
+			n++;
+		}
+	}
+	
+	lv_label_set_text(diag_lbl, diag_buf);
+}
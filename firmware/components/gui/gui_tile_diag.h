@@ -0,0 +1,35 @@
+/*
+ * Diagnostics tile.  Display per-request polling statistics (response rate, latency
+ * percentiles and error counts) and the effective update rate of each data item.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef GUI_TILE_DIAG_H
+#define GUI_TILE_DIAG_H
+
+#include "lvgl.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// API
+//
+void gui_tile_diag_init(lv_obj_t* parent_tileview, int* tile_index);
+
+#endif /* GUI_TILE_DIAG_H */
\ No newline at end of file
@@ -29,6 +29,29 @@
 #include <stdio.h>
 
 
+//
+// Local Constants
+//
+
+// Data broker notification filters (changes smaller than the display resolution, slowly
+// changing temperatures)
+#define HV_V_DEADBAND          0.5
+#define TEMP_DEADBAND          0.25
+#define TEMP_MIN_INTERVAL_MSEC 1000
+
+// Freshness goals (mSec) of the displayed items
+static const vm_goal_t tile_goals[] = {
+	{DB_ITEM_HV_BATT_V, 500},
+	{DB_ITEM_HV_BATT_I, 200},
+	{DB_ITEM_HV_BATT_MIN_T, 5000},
+	{DB_ITEM_HV_BATT_MAX_T, 5000},
+	{DB_ITEM_LV_BATT_V, 1000},
+	{DB_ITEM_LV_BATT_I, 1000},
+	{DB_ITEM_LV_BATT_T, 5000}
+};
+static const vm_goal_list_t tile_goal_list = VM_GOAL_LIST(tile_goals);
+
+
 //
 // Local Variables
 //
@@ -49,7 +72,15 @@ static lv_obj_t* lv_v_val_lbl;
 static lv_obj_t* lv_i_val_lbl;
 static lv_obj_t* lv_t_val_lbl;
 
-static lv_anim_t hv_i_animation;   // Animator for smooth meter movement between values
+static gui_num_label_t hv_i_val_nl;
+static gui_num_label_t hv_v_val_nl;
+static gui_num_label_t lv_v_val_nl;
+static gui_num_label_t lv_i_val_nl;
+static gui_num_label_t lv_t_val_nl;
+
+static gui_gauge_anim_t hv_i_animation;   // Animator for smooth meter movement between values
+
+static gui_trend_t hv_i_trend;            // HV current over the last minute
 
 
 // Vehicle capability flags
@@ -79,13 +110,21 @@ static float lv_v = 0;
 static float lv_i = 0;
 static int32_t lv_t = 0;
 
+// Currently displayed HV temperature label
+static char hv_t_lbl[40];            // "-XX / -XX °C"
+static bool hv_t_lbl_valid = false;
+static int32_t hv_t_lbl_min;
+static int32_t hv_t_lbl_max;
+
 
 
 //
 // Forward declarations for internal functions
 //
 static void _gui_tile_electrical_set_active(bool en);
+static void _gui_tile_electrical_set_content(bool build);
 static void _gui_tile_electrical_setup_vehicle();
+static db_mask_t _gui_tile_electrical_item_mask();
 static void _gui_tile_electrical_setup_hv_i_meter();
 static void _gui_tile_electrical_setup_hv_v_display();
 static void _gui_tile_electrical_setup_hv_t_display();
@@ -101,11 +140,11 @@ static void _gui_tile_electrical_update_lv_i_display(float val);
 static void _gui_tile_electrical_update_lv_t_display(int32_t val);
 static void _gui_tile_electrical_hv_v_cb(float val);
 static void _gui_tile_electrical_hv_i_cb(float val);
-static void _gui_tile_electrical_hv_min_t_cb(float val);
-static void _gui_tile_electrical_hv_max_t_cb(float val);
+static void _gui_tile_electrical_hv_t_cb(db_mask_t updated, const float* vals);
 static void _gui_tile_electrical_lv_v_cb(float val);
 static void _gui_tile_electrical_lv_i_cb(float val);
 static void _gui_tile_electrical_lv_t_cb(float val);
+static void _gui_tile_electrical_quality_cb(int item, int quality);
 
 
 
@@ -123,36 +162,10 @@ void gui_tile_electrical_init(lv_obj_t* parent_tileview, int* tile_index)
 	// Determine our capabilities
 	_gui_tile_electrical_setup_vehicle();
 	
-	// Create display objects
-	if (has_hv_i) {
-		// Only display HV objects if we can draw the meter (no doubt we'll always have this)
-		_gui_tile_electrical_setup_hv_i_meter();
-		
-		if (has_hv_v) {
-			_gui_tile_electrical_setup_hv_v_display();
-		}
-		
-		if (has_hv_min_t || has_hv_max_t) {
-			_gui_tile_electrical_setup_hv_t_display();
-		}
-	}
-	
-	if (has_lv_v) {
-		// Only display LV objects if we can draw the meter
-		_gui_tile_electrical_setup_lv_v_meter();
-		
-		if (has_lv_i) {
-			_gui_tile_electrical_setup_lv_i_display();
-		}
-		
-		if (has_lv_t) {
-			_gui_tile_electrical_setup_lv_t_display();
-		}
-	}
-	
 	// Register ourselves with our parent if we're capable of displaying something
+	// (it has us create our display objects when we're about to be displayed)
 	if (has_hv_i || has_lv_v) {
-		gui_screen_main_register_tile(tile, _gui_tile_electrical_set_active);
+		gui_screen_main_register_tile(tile, _gui_tile_electrical_set_active, _gui_tile_electrical_set_content, _gui_tile_electrical_item_mask());
 	}
 	
 	// Get our display units
@@ -168,55 +181,59 @@ void gui_tile_electrical_init(lv_obj_t* parent_tileview, int* tile_index)
 //
 static void _gui_tile_electrical_set_active(bool en)
 {
-	uint32_t req_mask = 0;
+	db_mask_t req_mask = 0;
 	
 	if (en) {
 		// Setup to receive data we require
 		if (has_hv_i) {
 			db_register_gui_callback(DB_ITEM_HV_BATT_I, _gui_tile_electrical_hv_i_cb);
-			req_mask |= DB_ITEM_HV_BATT_I;
+			req_mask |= DB_MASK(DB_ITEM_HV_BATT_I);
 			hv_v = 0;
 			_gui_tile_electrical_update_hv_i_meter(0, true);
 			
 			if (has_hv_v) {
 				db_register_gui_callback(DB_ITEM_HV_BATT_V, _gui_tile_electrical_hv_v_cb);
-				req_mask |= DB_ITEM_HV_BATT_V;
+				db_set_subscriber_filter(DB_SUBSCRIBER_GUI, DB_ITEM_HV_BATT_V, HV_V_DEADBAND, 0);
+				req_mask |= DB_MASK(DB_ITEM_HV_BATT_V);
 				hv_i = 0;
 				_gui_tile_electrical_update_hv_v_display(0);
 			}
 			
+			// Both temperatures share a label so they are delivered together
 			if (has_hv_min_t) {
-				db_register_gui_callback(DB_ITEM_HV_BATT_MIN_T, _gui_tile_electrical_hv_min_t_cb);
-				req_mask |= DB_ITEM_HV_BATT_MIN_T;
+				db_set_subscriber_filter(DB_SUBSCRIBER_GUI, DB_ITEM_HV_BATT_MIN_T, TEMP_DEADBAND, TEMP_MIN_INTERVAL_MSEC);
+				req_mask |= DB_MASK(DB_ITEM_HV_BATT_MIN_T);
 				hv_t_min = 0;
 			}
 			
 			if (has_hv_max_t) {
-				db_register_gui_callback(DB_ITEM_HV_BATT_MAX_T, _gui_tile_electrical_hv_max_t_cb);
-				req_mask |= DB_ITEM_HV_BATT_MAX_T;
+				db_set_subscriber_filter(DB_SUBSCRIBER_GUI, DB_ITEM_HV_BATT_MAX_T, TEMP_DEADBAND, TEMP_MIN_INTERVAL_MSEC);
+				req_mask |= DB_MASK(DB_ITEM_HV_BATT_MAX_T);
 				hv_t_max = 0;
 			}
 			
 			if (has_hv_min_t || has_hv_max_t) {
+				db_register_gui_batch_callback(req_mask & (DB_MASK(DB_ITEM_HV_BATT_MIN_T) | DB_MASK(DB_ITEM_HV_BATT_MAX_T)), _gui_tile_electrical_hv_t_cb);
 				_gui_tile_electrical_update_hv_t_display(has_hv_min_t, 0, has_hv_max_t, 0);
 			}
 		}
 		if (has_lv_v) {
 			db_register_gui_callback(DB_ITEM_LV_BATT_V, _gui_tile_electrical_lv_v_cb);
-			req_mask |= DB_ITEM_LV_BATT_V;
+			req_mask |= DB_MASK(DB_ITEM_LV_BATT_V);
 			lv_v = 0;
 			_gui_tile_electrical_update_lv_v_meter(0);
 			
 			if (has_lv_i) {
 				db_register_gui_callback(DB_ITEM_LV_BATT_I, _gui_tile_electrical_lv_i_cb);
-				req_mask |= DB_ITEM_LV_BATT_I;
+				req_mask |= DB_MASK(DB_ITEM_LV_BATT_I);
 				lv_i = 0;
 				_gui_tile_electrical_update_lv_i_display(0);
 			}
 			
 			if (has_lv_t) {
 				db_register_gui_callback(DB_ITEM_LV_BATT_T, _gui_tile_electrical_lv_t_cb);
-				req_mask |= DB_ITEM_LV_BATT_T;
+				db_set_subscriber_filter(DB_SUBSCRIBER_GUI, DB_ITEM_LV_BATT_T, TEMP_DEADBAND, TEMP_MIN_INTERVAL_MSEC);
+				req_mask |= DB_MASK(DB_ITEM_LV_BATT_T);
 				lv_t = 0;
 				_gui_tile_electrical_update_lv_t_display(0);
 			}
@@ -224,38 +241,108 @@ static void _gui_tile_electrical_set_active(bool en)
 		if (has_hv_i || has_lv_v) {
 			// Start data flow
 			vm_set_request_item_mask(req_mask);
+			vm_set_request_goals(&tile_goal_list);
+			
+			// Grey out displays whose data stops arriving
+			db_register_gui_quality_callback(_gui_tile_electrical_quality_cb);
+			for (int i=1; i<DB_NUM_ITEMS; i++) {
+				if ((req_mask & DB_MASK(i)) != 0) {
+					_gui_tile_electrical_quality_cb(i, db_get_item_quality(i));
+				}
+			}
 		}
 		
-		// Enable averaging for incoming data if we have a fast enough interface
-		db_enable_fast_average(gui_has_fast_interface());
+		// Enable smoothing for incoming data if we have a fast enough interface
+		db_set_filter_profile(req_mask, gui_has_fast_interface());
 		
 		// Initialize the update interval timer for meter animations (this will change
 		// to reflect real system timing)
-		gui_utility_init_update_time(100);
+		gui_utility_init_update_time(100, req_mask);
+	}
+	
+	gui_utility_set_trend_active(&hv_i_trend, en && has_hv_i);
+}
+
+
+static void _gui_tile_electrical_set_content(bool build)
+{
+	if (build) {
+		if (has_hv_i) {
+			// Only display HV objects if we can draw the meter (no doubt we'll always have this)
+			_gui_tile_electrical_setup_hv_i_meter();
+			
+			if (has_hv_v) {
+				_gui_tile_electrical_setup_hv_v_display();
+			}
+			
+			if (has_hv_min_t || has_hv_max_t) {
+				hv_t_lbl_valid = false;
+				_gui_tile_electrical_setup_hv_t_display();
+			}
+		}
+		
+		if (has_lv_v) {
+			// Only display LV objects if we can draw the meter
+			_gui_tile_electrical_setup_lv_v_meter();
+			
+			if (has_lv_i) {
+				_gui_tile_electrical_setup_lv_i_display();
+			}
+			
+			if (has_lv_t) {
+				_gui_tile_electrical_setup_lv_t_display();
+			}
+		}
+	} else {
+		gui_utility_stop_gauge_anim(&hv_i_animation);
+		lv_obj_clean(tile);
+	}
+}
+
+
+// Items requested while displayed (see _gui_tile_electrical_set_active)
+static db_mask_t _gui_tile_electrical_item_mask()
+{
+	db_mask_t mask = 0;
+	
+	if (has_hv_i) {
+		mask |= DB_MASK(DB_ITEM_HV_BATT_I);
+		if (has_hv_v) mask |= DB_MASK(DB_ITEM_HV_BATT_V);
+		if (has_hv_min_t) mask |= DB_MASK(DB_ITEM_HV_BATT_MIN_T);
+		if (has_hv_max_t) mask |= DB_MASK(DB_ITEM_HV_BATT_MAX_T);
+	}
+	if (has_lv_v) {
+		mask |= DB_MASK(DB_ITEM_LV_BATT_V);
+		if (has_lv_i) mask |= DB_MASK(DB_ITEM_LV_BATT_I);
+		if (has_lv_t) mask |= DB_MASK(DB_ITEM_LV_BATT_T);
 	}
+	
+	return mask;
 }
 
 
 static void _gui_tile_electrical_setup_vehicle()
 {
-	uint32_t capability_mask;
+	db_mask_t capability_mask;
 	
 	capability_mask = vm_get_supported_item_mask();
 	
-	has_hv_v     = (capability_mask & DB_ITEM_HV_BATT_V) != 0;
-	has_hv_i     = (capability_mask & DB_ITEM_HV_BATT_I) != 0;
-	has_hv_min_t = (capability_mask & DB_ITEM_HV_BATT_MIN_T) != 0;
-	has_hv_max_t = (capability_mask & DB_ITEM_HV_BATT_MAX_T) != 0;
-	has_lv_v     = (capability_mask & DB_ITEM_LV_BATT_V) != 0;
-	has_lv_i     = (capability_mask & DB_ITEM_LV_BATT_I) != 0;
-	has_lv_t     = (capability_mask & DB_ITEM_LV_BATT_T) != 0;
+	has_hv_v     = (capability_mask & DB_MASK(DB_ITEM_HV_BATT_V)) != 0;
+	has_hv_i     = (capability_mask & DB_MASK(DB_ITEM_HV_BATT_I)) != 0;
+	has_hv_min_t = (capability_mask & DB_MASK(DB_ITEM_HV_BATT_MIN_T)) != 0;
+	has_hv_max_t = (capability_mask & DB_MASK(DB_ITEM_HV_BATT_MAX_T)) != 0;
+	has_lv_v     = (capability_mask & DB_MASK(DB_ITEM_LV_BATT_V)) != 0;
+	has_lv_i     = (capability_mask & DB_MASK(DB_ITEM_LV_BATT_I)) != 0;
+	has_lv_t     = (capability_mask & DB_MASK(DB_ITEM_LV_BATT_T)) != 0;
 	
 	if (has_hv_i) {
-		vm_get_range(VM_RANGE_HV_BATTI, &hv_i_min, &hv_i_max);
+		hv_i_min = db_catalog_get(DB_ITEM_HV_BATT_I)->min;
+		hv_i_max = db_catalog_get(DB_ITEM_HV_BATT_I)->max;
 	}
 	
 	if (has_lv_v) {
-		vm_get_range(VM_RANGE_LV_BATTV, &lv_v_min, &lv_v_max);
+		lv_v_min = db_catalog_get(DB_ITEM_LV_BATT_V)->min;
+		lv_v_max = db_catalog_get(DB_ITEM_LV_BATT_V)->max;
 	}
 }
 
@@ -293,41 +380,51 @@ static void _gui_tile_electrical_setup_hv_i_meter()
     lv_meter_set_indicator_end_value(meter_hv_i, indic, 0);
 
 	// Create a green arc that will act as the positive meter indicator (traction current)
-	hv_i_pos_arc = lv_arc_create(tile);
+	hv_i_pos_arc = gui_utility_create_gauge_arc(tile);
 	lv_obj_center(hv_i_pos_arc);
 	lv_obj_set_size(hv_i_pos_arc, tile_w-10, tile_h-10);
 	lv_arc_set_rotation(hv_i_pos_arc, 135 + (270 * (-meter_min) / (meter_max - meter_min)));
 	lv_arc_set_bg_angles(hv_i_pos_arc, 0, 270 - (270 * (-meter_min) / (meter_max - meter_min)));
 	lv_arc_set_range(hv_i_pos_arc, 0, meter_max);
 	lv_arc_set_value(hv_i_pos_arc, 0);
-	lv_obj_set_style_bg_color(hv_i_pos_arc, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_INDICATOR);
+	lv_obj_add_style(hv_i_pos_arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
 	lv_obj_remove_style(hv_i_pos_arc, NULL, LV_PART_KNOB);
 	lv_obj_clear_flag(hv_i_pos_arc, LV_OBJ_FLAG_CLICKABLE);
 	lv_obj_set_style_arc_color(hv_i_pos_arc, lv_palette_main(LV_PALETTE_GREEN), LV_PART_INDICATOR);
 	
 	// Create a blue arc that will act as the negative meter indicator (regen current)
-	hv_i_neg_arc = lv_arc_create(tile);
+	hv_i_neg_arc = gui_utility_create_gauge_arc(tile);
 	lv_obj_center(hv_i_neg_arc);
 	lv_obj_set_size(hv_i_neg_arc, tile_w-10, tile_h-10);
 	lv_arc_set_rotation(hv_i_neg_arc, 135);
 	lv_arc_set_bg_angles(hv_i_neg_arc, 0, 270 * (-meter_min) / (meter_max - meter_min));
 	lv_arc_set_range(hv_i_neg_arc, 0, -meter_min);
 	lv_arc_set_value(hv_i_neg_arc, 0);
-	lv_obj_set_style_bg_color(hv_i_neg_arc, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_INDICATOR);
+	lv_obj_add_style(hv_i_neg_arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
 	lv_obj_remove_style(hv_i_neg_arc, NULL, LV_PART_KNOB);
 	lv_obj_clear_flag(hv_i_neg_arc, LV_OBJ_FLAG_CLICKABLE);
 	lv_arc_set_mode(hv_i_neg_arc, LV_ARC_MODE_REVERSE);
 	
 	// Add the label object for the current value
 	hv_i_val_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&hv_i_val_nl, hv_i_val_lbl);
 	lv_label_set_long_mode(hv_i_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(hv_i_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(hv_i_val_lbl, &lv_font_montserrat_30, LV_PART_MAIN);
+	lv_obj_add_style(hv_i_val_lbl, gui_utility_get_style(GUI_STYLE_READOUT), LV_PART_MAIN);
 	lv_obj_align(hv_i_val_lbl, LV_ALIGN_CENTER, 0, -(tile_h/4) + 10);
 	
 	// Initialize the meter to 0
 	hv_i = -1.0;  // Force update
+	gui_utility_init_gauge_anim(&hv_i_animation, NULL, _gui_tile_electrical_set_hv_i_meter_cb, 0);
 	_gui_tile_electrical_update_hv_i_meter(0, true);
+	
+	// HV current trend strip between the temperature and the LV meter
+	if (gui_utility_create_trend(&hv_i_trend, tile, DB_ITEM_HV_BATT_I, (tile_w * 7) / 16, tile_h / 16,
+	                             hv_i_min, hv_i_max, lv_palette_main(LV_PALETTE_GREEN)) != NULL) {
+		lv_obj_align(hv_i_trend.canvas, LV_ALIGN_CENTER, 0, tile_h / 20);
+	}
+	
+	// Scale and range arcs are static so draw them from a cached image
+	meter_hv_i = gui_utility_cache_meter(meter_hv_i);
 }
 
 
@@ -335,9 +432,9 @@ static void _gui_tile_electrical_setup_hv_v_display()
 {
 	// Create the label object for the current voltage value
 	hv_v_val_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&hv_v_val_nl, hv_v_val_lbl);
 	lv_label_set_long_mode(hv_v_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(hv_v_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(hv_v_val_lbl, &lv_font_montserrat_48, LV_PART_MAIN);
+	lv_obj_add_style(hv_v_val_lbl, gui_utility_get_style(GUI_STYLE_READOUT_LARGE), LV_PART_MAIN);
 	lv_obj_align(hv_v_val_lbl, LV_ALIGN_CENTER, 0, -(tile_h/4) + 60);
 	lv_label_set_text_static(hv_v_val_lbl, "");  // Blank initially
 }
@@ -348,8 +445,7 @@ static void _gui_tile_electrical_setup_hv_t_display()
 	// Create the label object for the current temperature value
 	hv_t_val_lbl = lv_label_create(tile);
 	lv_label_set_long_mode(hv_t_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(hv_t_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(hv_t_val_lbl, &lv_font_montserrat_30, LV_PART_MAIN);
+	lv_obj_add_style(hv_t_val_lbl, gui_utility_get_style(GUI_STYLE_READOUT), LV_PART_MAIN);
 	lv_obj_align(hv_t_val_lbl, LV_ALIGN_CENTER, 0, -(tile_h/4) + 105);
 	lv_label_set_text_static(hv_t_val_lbl, "");  // Blank initially
 }
@@ -383,20 +479,23 @@ static void _gui_tile_electrical_setup_lv_v_meter()
     lv_arc_set_rotation(lv_v_arc, 180);
 	lv_arc_set_bg_angles(lv_v_arc, 0, 180);
 	lv_arc_set_range(lv_v_arc, meter_min * 10, meter_max * 10);
-	lv_obj_set_style_bg_color(lv_v_arc, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_INDICATOR);
+	lv_obj_add_style(lv_v_arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
 	lv_obj_remove_style(lv_v_arc, NULL, LV_PART_KNOB);
 	lv_obj_clear_flag(lv_v_arc, LV_OBJ_FLAG_CLICKABLE);
 	lv_obj_set_style_arc_color(lv_v_arc, lv_palette_main(LV_PALETTE_GREEN), LV_PART_INDICATOR);
 	
 	// Value label
 	lv_v_val_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&lv_v_val_nl, lv_v_val_lbl);
 	lv_label_set_long_mode(lv_v_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(lv_v_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(lv_v_val_lbl, &lv_font_montserrat_24, LV_PART_MAIN);
+	lv_obj_add_style(lv_v_val_lbl, gui_utility_get_style(GUI_STYLE_VALUE), LV_PART_MAIN);
 	lv_obj_align(lv_v_val_lbl, LV_ALIGN_BOTTOM_MID, 0, -h/2 - 20);
 	
 	// Initialize meter to 0
 	_gui_tile_electrical_update_lv_v_meter(0);
+	
+	// Scale and range arcs are static so draw them from a cached image
+	meter_lv_v = gui_utility_cache_meter(meter_lv_v);
 }
 
 
@@ -406,9 +505,9 @@ static void _gui_tile_electrical_setup_lv_i_display()
 	
 	// Create the label object for the current voltage value
 	lv_i_val_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&lv_i_val_nl, lv_i_val_lbl);
 	lv_label_set_long_mode(lv_i_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(lv_i_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(lv_i_val_lbl, &lv_font_montserrat_24, LV_PART_MAIN);
+	lv_obj_add_style(lv_i_val_lbl, gui_utility_get_style(GUI_STYLE_VALUE), LV_PART_MAIN);
 	lv_obj_align(lv_i_val_lbl, LV_ALIGN_BOTTOM_MID, 0, -h/2 + 10);
 	lv_label_set_text_static(lv_i_val_lbl, "");  // Blank initially
 }
@@ -420,9 +519,9 @@ static void _gui_tile_electrical_setup_lv_t_display()
 	
 	// Create the label object for the current temperature value
 	lv_t_val_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&lv_t_val_nl, lv_t_val_lbl);
 	lv_label_set_long_mode(lv_t_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(lv_t_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(lv_t_val_lbl, &lv_font_montserrat_24, LV_PART_MAIN);
+	lv_obj_add_style(lv_t_val_lbl, gui_utility_get_style(GUI_STYLE_VALUE), LV_PART_MAIN);
 	lv_obj_align(lv_t_val_lbl, LV_ALIGN_BOTTOM_MID, 0, -h/2 + 40);
 	lv_label_set_text_static(lv_t_val_lbl, "");  // Blank initially
 }
@@ -430,116 +529,83 @@ static void _gui_tile_electrical_setup_lv_t_display()
 
 static void _gui_tile_electrical_update_hv_i_meter(int32_t val, bool immediate)
 {
-	static char hv_i_lbl[16];             // "-XXXX A"
-	uint32_t anim_time;
-	
 	// Update the label immediately
-	sprintf(hv_i_lbl, "%ld A", val);
-	lv_label_set_text_static(hv_i_val_lbl, hv_i_lbl);
+	gui_utility_set_num_label(&hv_i_val_nl, val, 0, " A");
 	
-	if (immediate) {
-		_gui_tile_electrical_set_hv_i_meter_cb(NULL, val);
-	} else {
-		// Stop any previous animations
-		lv_anim_del(meter_hv_i, _gui_tile_electrical_set_hv_i_meter_cb);
-		
-		// Start an animation to the new value for the meter indicator
-		anim_time = gui_utility_get_update_period() - 20;   // Just slightly faster than the average update interval
-		lv_anim_init(&hv_i_animation);
-		lv_anim_set_exec_cb(&hv_i_animation, _gui_tile_electrical_set_hv_i_meter_cb);
-		lv_anim_set_var(&hv_i_animation, meter_hv_i); // Unused since we will update the arcs
-		lv_anim_set_time(&hv_i_animation, anim_time);
-		lv_anim_set_values(&hv_i_animation, hv_i, val);
-		lv_anim_start(&hv_i_animation);
-	}
+	// Move the meter indicator to the new value (smoothly unless immediate)
+	gui_utility_set_gauge_anim(&hv_i_animation, val, immediate);
 }
 
 
 static void _gui_tile_electrical_set_hv_i_meter_cb(void* indic, int32_t val)
 {
 	if (val < 0) {
-		lv_arc_set_value(hv_i_pos_arc, 0);
-		lv_arc_set_value(hv_i_neg_arc, ((int32_t) round(-hv_i_min)) + val);
+		gui_utility_set_arc_value(hv_i_pos_arc, 0);
+		gui_utility_set_arc_value(hv_i_neg_arc, ((int32_t) lroundf(-hv_i_min)) + val);
 	} else {
-		lv_arc_set_value(hv_i_neg_arc, (int32_t) round(-hv_i_min));
-		lv_arc_set_value(hv_i_pos_arc, val);
+		gui_utility_set_arc_value(hv_i_neg_arc, (int32_t) lroundf(-hv_i_min));
+		gui_utility_set_arc_value(hv_i_pos_arc, val);
 	}
 }
 
 
 static void _gui_tile_electrical_update_hv_v_display(int32_t val)
 {
-	static char hv_v_lbl[16];             // "XXX V"
-	
-	sprintf(hv_v_lbl, "%ld V",  val);
-	lv_label_set_text_static(hv_v_val_lbl, hv_v_lbl);
+	gui_utility_set_num_label(&hv_v_val_nl, val, 0, " V");
 }
 
 
 static void _gui_tile_electrical_update_hv_t_display(bool has_min, int32_t min, bool has_max, int32_t max)
 {
-	static char hv_t_lbl[32];            // "-XX °C / -XX °C"
-	int len;
+	int len = 0;
 	
-	hv_t_lbl[0] = 0;
+	// Only redraw when the displayed values change
+	if (hv_t_lbl_valid && (min == hv_t_lbl_min) && (max == hv_t_lbl_max)) {
+		return;
+	}
 	
 	if (has_min) {
-		sprintf(hv_t_lbl, "%ld", min);
+		len += gui_utility_format_fixed(&hv_t_lbl[len], min, 0);
 	}
 	
 	if (has_min && has_max) {
-		len = strlen(hv_t_lbl);
-		sprintf(&hv_t_lbl[len], " / ");
+		strcpy(&hv_t_lbl[len], " / ");
+		len += 3;
 	}
 	
 	if (has_max) {
-		len = strlen(hv_t_lbl);
-		sprintf(&hv_t_lbl[len], "%ld", max);
+		len += gui_utility_format_fixed(&hv_t_lbl[len], max, 0);
 	}
 	
-	len = strlen(hv_t_lbl);
-	if (units_metric) {
-		sprintf(&hv_t_lbl[len], " °C");
-	} else {
-		sprintf(&hv_t_lbl[len], " °F");
-	}
+	strcpy(&hv_t_lbl[len], units_metric ? " °C" : " °F");
 	
 	lv_label_set_text_static(hv_t_val_lbl, hv_t_lbl);
+	hv_t_lbl_valid = true;
+	hv_t_lbl_min = min;
+	hv_t_lbl_max = max;
 }
 
 
 static void _gui_tile_electrical_update_lv_v_meter(float val)
 {
-	static char lv_v_lbl[16];             // "XXX V"
 	int32_t arc_val;
 	
-	arc_val = (int32_t) round(val * 10.0);
-	lv_arc_set_value(lv_v_arc, arc_val);
+	arc_val = (int32_t) lroundf(val * 10.0f);
+	gui_utility_set_arc_value(lv_v_arc, arc_val);
 	
-	sprintf(lv_v_lbl, "%1.1f V", val);
-	lv_label_set_text_static(lv_v_val_lbl, lv_v_lbl);
+	gui_utility_set_num_label(&lv_v_val_nl, arc_val, 1, " V");
 }
 
 
 static void _gui_tile_electrical_update_lv_i_display(float val)
 {
-	static char lv_i_lbl[16];             // "XXX.X A"
-	
-	sprintf(lv_i_lbl, "%1.1f A",  val);
-	lv_label_set_text_static(lv_i_val_lbl, lv_i_lbl);
+	gui_utility_set_num_label_f(&lv_i_val_nl, val, 1, " A");
 }
 
 
 static void _gui_tile_electrical_update_lv_t_display(int32_t val)
 {
-	static char lv_t_lbl[16];             // "-XX °C"
-	
-	if (units_metric) {
-		sprintf(lv_t_lbl, "%ld °C",  val);
-	} else {
-		sprintf(lv_t_lbl, "%ld °F",  val);
-	}
-	lv_label_set_text_static(lv_t_val_lbl, lv_t_lbl);
+	gui_utility_set_num_label(&lv_t_val_nl, val, 0, units_metric ? " °C" : " °F");
 }
 
 
@@ -547,7 +613,7 @@ static void _gui_tile_electrical_hv_v_cb(float val)
 {
 	int32_t v;
 	
-	v = round(val);
+	v = lroundf(val);
 	
 	if (v != hv_v) {
 		_gui_tile_electrical_update_hv_v_display(v);
@@ -568,7 +634,7 @@ static void _gui_tile_electrical_hv_i_cb(float val)
 	
 	// Negate current since we want to display a positive number for traction
 	// and a negative number for regeneration (battery current is negative for traction)
-	i = round(-val);
+	i = lroundf(-val);
 	
 	if (i != hv_i) {
 		_gui_tile_electrical_update_hv_i_meter(i, false);
@@ -577,28 +643,24 @@ static void _gui_tile_electrical_hv_i_cb(float val)
 }
 
 
-static void _gui_tile_electrical_hv_min_t_cb(float val)
+// Called once per GUI evaluation with whichever temperatures arrived so the label is
+// redrawn once
+static void _gui_tile_electrical_hv_t_cb(db_mask_t updated, const float* vals)
 {
-	int32_t t;
-	
-	t = round((units_metric) ? val : gui_util_c_to_f(val));
+	int32_t t_min = hv_t_min;
+	int32_t t_max = hv_t_max;
 	
-	if (t != hv_t_min) {
-		_gui_tile_electrical_update_hv_t_display(has_hv_min_t, t, has_hv_max_t, hv_t_max);
-		hv_t_min = t;
+	if ((updated & DB_MASK(DB_ITEM_HV_BATT_MIN_T)) != 0) {
+		t_min = lroundf((units_metric) ? vals[DB_ITEM_HV_BATT_MIN_T] : gui_util_c_to_f(vals[DB_ITEM_HV_BATT_MIN_T]));
 	}
+	if ((updated & DB_MASK(DB_ITEM_HV_BATT_MAX_T)) != 0) {
+		t_max = lroundf((units_metric) ? vals[DB_ITEM_HV_BATT_MAX_T] : gui_util_c_to_f(vals[DB_ITEM_HV_BATT_MAX_T]));
 }
 
-
-static void _gui_tile_electrical_hv_max_t_cb(float val)
-{
-	int32_t t;
-	
-	t = round((units_metric) ? val : gui_util_c_to_f(val));
-	
-	if (t != hv_t_max) {
-		_gui_tile_electrical_update_hv_t_display(has_hv_min_t, hv_t_min, has_hv_max_t, t);
-		hv_t_max = t;
+	if ((t_min != hv_t_min) || (t_max != hv_t_max)) {
+		_gui_tile_electrical_update_hv_t_display(has_hv_min_t, t_min, has_hv_max_t, t_max);
+		hv_t_min = t_min;
+		hv_t_max = t_max;
 	}
 }
 
@@ -625,10 +687,42 @@ static void _gui_tile_electrical_lv_t_cb(float val)
 {
 	int32_t t;
 	
-	t = round((units_metric) ? val : gui_util_c_to_f(val));
+	t = lroundf((units_metric) ? val : gui_util_c_to_f(val));
 	
 	if (t != lv_t) {
 		_gui_tile_electrical_update_lv_t_display(t);
 		lv_t = t;
 	}
 }
+
+
+// Only called for items with registered handlers (whose display objects exist)
+static void _gui_tile_electrical_quality_cb(int item, int quality)
+{
+	bool stale = (quality == DB_QUALITY_STALE) || (quality == DB_QUALITY_ERROR);
+	
+	switch (item) {
+		case DB_ITEM_HV_BATT_I:
+			gui_utility_set_stale(hv_i_pos_arc, stale);
+			gui_utility_set_stale(hv_i_neg_arc, stale);
+			gui_utility_set_stale(hv_i_val_lbl, stale);
+			break;
+		case DB_ITEM_HV_BATT_V:
+			gui_utility_set_stale(hv_v_val_lbl, stale);
+			break;
+		case DB_ITEM_HV_BATT_MIN_T:
+		case DB_ITEM_HV_BATT_MAX_T:
+			gui_utility_set_stale(hv_t_val_lbl, stale);
+			break;
+		case DB_ITEM_LV_BATT_V:
+			gui_utility_set_stale(lv_v_arc, stale);
+			gui_utility_set_stale(lv_v_val_lbl, stale);
+			break;
+		case DB_ITEM_LV_BATT_I:
+			gui_utility_set_stale(lv_i_val_lbl, stale);
+			break;
+		case DB_ITEM_LV_BATT_T:
+			gui_utility_set_stale(lv_t_val_lbl, stale);
+			break;
+	}
+}
@@ -0,0 +1,575 @@
+/*
+ * Table-driven gauge tiles.  Each tile is a list of gauge definitions (item, layout,
+ * position) instantiated by one builder that takes ranges, units and precision from the
+ * signal catalog, uses the shared styles and drives every indicator from the
+ * shared gauge animator.  New tiles are added to the tile table below without any new
+ * rendering code.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "data_broker.h"
+#include "esp_system.h"
+#include "gui_task.h"
+#include "gui_screen_main.h"
+#include "gui_tile_gauge.h"
+#include "gui_utilities.h"
+#include "vehicle_manager.h"
+#include <math.h>
+#include <stdio.h>
+
+
+
+//
+// Local Constants
+//
+
+// Formatted unit suffix length (" " + unit)
+#define GAUGE_UNIT_LEN  12
+
+
+
+//
+// Local Data structures
+//
+
+// Gauge instance.  Values are fixed-point with decimals digits after the point (LVGL arc
+// ranges are 16 bits so the range times 10^decimals must fit).
+typedef struct {
+	const gui_gauge_def_t* defP;
+	bool supported;
+	float scale;
+	float fp_mult;                  // Fixed-point counts per display unit
+	int decimals;
+	int32_t fp_min;
+	int32_t fp_zero;                // Where the positive indicator starts (0 clamped to the range)
+	int32_t fp_max;
+	int meter_min;                  // Scale range (display units)
+	int meter_max;
+	const char* name;
+	char unit[GAUGE_UNIT_LEN];
+	float item_val;
+	float ref_val;
+	int32_t val;
+	lv_obj_t* meter;
+	lv_obj_t* pos_arc;
+	lv_obj_t* neg_arc;              // NULL unless the range is below zero
+	lv_obj_t* val_lbl;
+	lv_obj_t* name_lbl;
+	gui_num_label_t val_nl;
+	gui_gauge_anim_t animation;
+} gauge_t;
+
+typedef struct {
+	const gui_gauge_tile_def_t* defP;
+	lv_obj_t* tile;
+	db_mask_t item_mask;
+	int num_gauges;
+	gauge_t gauge[GUI_GAUGE_TILE_MAX_GAUGES];
+} gauge_tile_t;
+
+
+
+//
+// Tile table
+//
+//   Columns: layout, item, ref_item, scale, min, max (display units, both 0 for the catalog
+//   range), decimals (-1 for the catalog precision), unit, name (NULL for the catalog's),
+//   indicator color, x, y, size (1/16ths of the tile)
+//
+// A tile is displayed when the vehicle supports all of the items of at least one gauge.
+// Each tile also declares how old (mSec) its items' values may get (see vm_set_request_goals()).
+//
+static const gui_gauge_def_t gforce_gauges[] = {
+	{GUI_GAUGE_SMALL_270, DB_ITEM_LONG_ACCEL, DB_ITEM_NONE, 1.0, 0, 0, -1, NULL, NULL, LV_PALETTE_GREEN, -4, 0, 7},
+	{GUI_GAUGE_SMALL_270, DB_ITEM_LAT_ACCEL, DB_ITEM_NONE, 1.0, 0, 0, -1, NULL, NULL, LV_PALETTE_ORANGE, 4, 0, 7}
+};
+
+static const vm_goal_t gforce_goals[] = {
+	{DB_ITEM_LONG_ACCEL, 100},
+	{DB_ITEM_LAT_ACCEL, 100}
+};
+
+static const gui_gauge_def_t cell_spread_gauges[] = {
+	{GUI_GAUGE_LARGE_270, DB_ITEM_CELL_MAX_V, DB_ITEM_CELL_MIN_V, 1000.0, 0, 100, 0, "mV", "Cell delta", LV_PALETTE_GREEN, 0, 0, 16},
+	{GUI_GAUGE_SMALL_180, DB_ITEM_CELL_MIN_V, DB_ITEM_NONE, 1.0, 2, 5, 2, NULL, NULL, LV_PALETTE_GREEN, 0, 4, 6}
+};
+
+static const gui_gauge_tile_def_t gauge_tile_defs[] = {
+	GUI_GAUGE_TILE("G-Force", gforce_gauges, VM_GOAL_LIST(gforce_goals)),
+	GUI_GAUGE_TILE("Cell Spread", cell_spread_gauges, VM_GOAL_NONE)
+};
+
+#define NUM_GAUGE_TILE_DEFS (sizeof(gauge_tile_defs)/sizeof(gauge_tile_defs[0]))
+
+
+
+//
+// Local Variables
+//
+static gauge_tile_t gauge_tiles[GUI_GAUGE_TILE_MAX];
+static int num_gauge_tiles = 0;
+
+// Tile whose data handlers are registered
+static gauge_tile_t* active_tileP = NULL;
+
+// State
+static uint16_t tile_w;
+static uint16_t tile_h;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _gui_tile_gauge_set_active(gauge_tile_t* tP, bool en);
+static void _gui_tile_gauge_set_content(gauge_tile_t* tP, bool build);
+static void _gui_tile_gauge_set_active_0(bool en);
+static void _gui_tile_gauge_set_active_1(bool en);
+static void _gui_tile_gauge_set_content_0(bool build);
+static void _gui_tile_gauge_set_content_1(bool build);
+static bool _gui_tile_gauge_setup_vehicle(gauge_tile_t* tP, const gui_gauge_tile_def_t* defP);
+static void _gui_tile_gauge_setup_gauge(gauge_tile_t* tP, gauge_t* gP);
+static lv_obj_t* _gui_tile_gauge_add_arc(lv_obj_t* parent, gauge_t* gP, lv_coord_t w, lv_coord_t h, int rotation, int sweep);
+static lv_obj_t* _gui_tile_gauge_add_label(lv_obj_t* parent, int style, lv_coord_t x, lv_coord_t y);
+static void _gui_tile_gauge_update(gauge_t* gP, bool immediate);
+static void _gui_tile_gauge_set_indicator_cb(void* var, int32_t val);
+static void _gui_tile_gauge_item_cb(int item, float val);
+static void _gui_tile_gauge_quality_cb(int item, int quality);
+
+
+
+//
+// Tile handlers (one set per gauge tile since the handlers do not identify the tile)
+//
+static const tile_activation_handler tile_activation_fcns[GUI_GAUGE_TILE_MAX] = {
+	_gui_tile_gauge_set_active_0,
+	_gui_tile_gauge_set_active_1
+};
+
+static const tile_content_handler tile_content_fcns[GUI_GAUGE_TILE_MAX] = {
+	_gui_tile_gauge_set_content_0,
+	_gui_tile_gauge_set_content_1
+};
+
+
+
+//
+// API
+//
+void gui_tile_gauge_init(lv_obj_t* parent_tileview, int* tile_index)
+{
+	gauge_tile_t* tP;
+	
+	gui_get_screen_size(&tile_w, &tile_h);
+	
+	for (int i=0; i<NUM_GAUGE_TILE_DEFS; i++) {
+		if (num_gauge_tiles == GUI_GAUGE_TILE_MAX) break;
+	
+		// Only create tiles the vehicle can display something on
+		tP = &gauge_tiles[num_gauge_tiles];
+		if (_gui_tile_gauge_setup_vehicle(tP, &gauge_tile_defs[i])) {
+			tP->tile = lv_tileview_add_tile(parent_tileview, *tile_index, 0, LV_DIR_LEFT | LV_DIR_RIGHT);
+			*tile_index += 1;
+	
+			gui_screen_main_register_tile(tP->tile, tile_activation_fcns[num_gauge_tiles], tile_content_fcns[num_gauge_tiles], tP->item_mask);
+			num_gauge_tiles += 1;
+		}
+	}
+}
+
+
+
+//
+// Internal functions
+//
+static void _gui_tile_gauge_set_active(gauge_tile_t* tP, bool en)
+{
+	gauge_t* gP;
+	
+	if (en) {
+		active_tileP = tP;
+	
+		// Setup to receive data we require
+		for (int i=1; i<DB_NUM_ITEMS; i++) {
+			if ((tP->item_mask & DB_MASK(i)) != 0) {
+				db_register_gui_item_callback(i, _gui_tile_gauge_item_cb);
+			}
+		}
+		for (int i=0; i<tP->num_gauges; i++) {
+			gP = &tP->gauge[i];
+			if (gP->supported) {
+				gP->item_val = 0;
+				gP->ref_val = 0;
+				_gui_tile_gauge_update(gP, true);
+			}
+		}
+	
+		// Start data flow
+		vm_set_request_item_mask(tP->item_mask);
+		vm_set_request_goals(&tP->defP->goals);
+	
+		// Grey out gauges whose data stops arriving
+		db_register_gui_quality_callback(_gui_tile_gauge_quality_cb);
+		for (int i=1; i<DB_NUM_ITEMS; i++) {
+			if ((tP->item_mask & DB_MASK(i)) != 0) {
+				_gui_tile_gauge_quality_cb(i, db_get_item_quality(i));
+			}
+		}
+	
+		// Enable smoothing for incoming data if we have a fast enough interface
+		db_set_filter_profile(tP->item_mask, gui_has_fast_interface());
+	
+		// Initialize the update interval timer for meter animations
+		gui_utility_init_update_time(100, tP->item_mask);
+	} else if (active_tileP == tP) {
+		active_tileP = NULL;
+	}
+}
+
+
+static void _gui_tile_gauge_set_content(gauge_tile_t* tP, bool build)
+{
+	gauge_t* gP;
+	
+	if (build) {
+		for (int i=0; i<tP->num_gauges; i++) {
+			if (tP->gauge[i].supported) {
+				_gui_tile_gauge_setup_gauge(tP, &tP->gauge[i]);
+			}
+		}
+	} else {
+		for (int i=0; i<tP->num_gauges; i++) {
+			gP = &tP->gauge[i];
+			if (gP->supported) {
+				gui_utility_stop_gauge_anim(&gP->animation);
+			}
+			gP->meter = NULL;
+			gP->pos_arc = NULL;
+			gP->neg_arc = NULL;
+			gP->val_lbl = NULL;
+			gP->name_lbl = NULL;
+		}
+		lv_obj_clean(tP->tile);
+	}
+}
+
+
+static void _gui_tile_gauge_set_active_0(bool en)
+{
+	_gui_tile_gauge_set_active(&gauge_tiles[0], en);
+}
+
+
+static void _gui_tile_gauge_set_active_1(bool en)
+{
+	_gui_tile_gauge_set_active(&gauge_tiles[1], en);
+}
+
+
+static void _gui_tile_gauge_set_content_0(bool build)
+{
+	_gui_tile_gauge_set_content(&gauge_tiles[0], build);
+}
+
+
+static void _gui_tile_gauge_set_content_1(bool build)
+{
+	_gui_tile_gauge_set_content(&gauge_tiles[1], build);
+}
+
+
+// Resolve each gauge's range, precision and labels from the catalog (which holds the
+// selected vehicle's ranges by now).  Returns true if any gauge is supported.
+static bool _gui_tile_gauge_setup_vehicle(gauge_tile_t* tP, const gui_gauge_tile_def_t* defP)
+{
+	const gui_gauge_def_t* gdP;
+	const db_signal_t* sigP;
+	db_mask_t capability_mask;
+	db_mask_t gauge_mask;
+	float min, max, t;
+	gauge_t* gP;
+	
+	capability_mask = vm_get_supported_item_mask();
+	
+	tP->defP = defP;
+	tP->tile = NULL;
+	tP->item_mask = 0;
+	tP->num_gauges = (defP->num_gauges < GUI_GAUGE_TILE_MAX_GAUGES) ? defP->num_gauges : GUI_GAUGE_TILE_MAX_GAUGES;
+	
+	for (int i=0; i<tP->num_gauges; i++) {
+		gdP = &defP->gaugeP[i];
+		gP = &tP->gauge[i];
+		gP->defP = gdP;
+		gP->supported = false;
+		gP->meter = NULL;
+		gP->pos_arc = NULL;
+		gP->neg_arc = NULL;
+		gP->val_lbl = NULL;
+		gP->name_lbl = NULL;
+	
+		gauge_mask = DB_MASK(gdP->item) | ((gdP->ref_item != DB_ITEM_NONE) ? DB_MASK(gdP->ref_item) : 0);
+		if ((capability_mask & gauge_mask) != gauge_mask) continue;
+	
+		sigP = db_catalog_get(gdP->item);
+		gP->scale = gdP->scale;
+		if (gdP->min < gdP->max) {
+			min = gdP->min;
+			max = gdP->max;
+		} else {
+			min = sigP->min * gdP->scale;
+			max = sigP->max * gdP->scale;
+			if (min > max) {
+				t = min;
+				min = max;
+				max = t;
+			}
+		}
+		if (min >= max) continue;
+	
+		gP->decimals = (gdP->decimals < 0) ? sigP->precision : gdP->decimals;
+		gP->fp_mult = 1.0;
+		for (int j=0; j<gP->decimals; j++) {
+			gP->fp_mult *= 10.0f;
+		}
+		gP->meter_min = (int) lroundf(min);
+		gP->meter_max = (int) lroundf(max);
+		gP->fp_min = (int32_t) lroundf(min * gP->fp_mult);
+		gP->fp_max = (int32_t) lroundf(max * gP->fp_mult);
+		gP->fp_zero = (gP->fp_min > 0) ? gP->fp_min : ((gP->fp_max < 0) ? gP->fp_max : 0);
+		gP->name = (gdP->name != NULL) ? gdP->name : sigP->name;
+		snprintf(gP->unit, GAUGE_UNIT_LEN, " %s", (gdP->unit != NULL) ? gdP->unit : sigP->unit);
+	
+		gP->supported = true;
+		tP->item_mask |= gauge_mask;
+	}
+	
+	return (tP->item_mask != 0);
+}
+
+
+static void _gui_tile_gauge_setup_gauge(gauge_tile_t* tP, gauge_t* gP)
+{
+	const gui_gauge_def_t* gdP = gP->defP;
+	bool large = (gdP->layout == GUI_GAUGE_LARGE_270);
+	int rotation = (gdP->layout == GUI_GAUGE_SMALL_180) ? 180 : 135;
+	int sweep = (gdP->layout == GUI_GAUGE_SMALL_180) ? 180 : 270;
+	int zero_angle;
+	lv_coord_t x = gdP->x * tile_w / 16;
+	lv_coord_t y = gdP->y * tile_h / 16;
+	lv_coord_t w = gdP->size * tile_w / 16;
+	lv_coord_t h = gdP->size * tile_h / 16;
+	lv_meter_indicator_t* indic;
+	lv_meter_scale_t* scale;
+	uint16_t meter_ticks;
+	
+	if (large) {
+		meter_ticks = gui_utility_setup_large_270_meter_ticks(gP->meter_min, gP->meter_max);
+	} else if (gdP->layout == GUI_GAUGE_SMALL_270) {
+		meter_ticks = gui_utility_setup_small_270_meter_ticks(gP->meter_min, gP->meter_max);
+	} else {
+		meter_ticks = gui_utility_setup_small_180_meter_ticks(gP->meter_min, gP->meter_max);
+	}
+	
+	// Meter
+	gP->meter = lv_meter_create(tP->tile);
+	lv_obj_align(gP->meter, LV_ALIGN_CENTER, x, y);
+	lv_obj_set_size(gP->meter, w, h);
+	lv_obj_remove_style(gP->meter, NULL, LV_PART_INDICATOR);
+	
+	scale = lv_meter_add_scale(gP->meter);
+	if (large) {
+		lv_meter_set_scale_ticks(gP->meter, scale, meter_ticks, 2, 20, lv_palette_main(LV_PALETTE_GREY));
+		lv_meter_set_scale_major_ticks(gP->meter, scale, 2, 3, 30, lv_color_hex3(0xeee), 20);
+		lv_obj_set_style_text_font(gP->meter, &lv_font_montserrat_18, LV_PART_MAIN);
+	} else {
+		lv_obj_set_style_border_color(gP->meter, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_MAIN);
+		lv_meter_set_scale_ticks(gP->meter, scale, meter_ticks, 3, 6, lv_palette_main(LV_PALETTE_GREY));
+		lv_meter_set_scale_major_ticks(gP->meter, scale, 2, 3, 10, lv_color_hex3(0xeee), 10);
+	}
+	lv_meter_set_scale_range(gP->meter, scale, gP->meter_min, gP->meter_max, sweep, rotation);
+	
+	if (gP->fp_min < gP->fp_zero) {
+		// Blue arc and tick lines for the part of the scale below zero
+		indic = lv_meter_add_arc(gP->meter, scale, large ? 5 : 3, lv_palette_main(LV_PALETTE_BLUE), 0);
+		lv_meter_set_indicator_start_value(gP->meter, indic, gP->meter_min);
+		lv_meter_set_indicator_end_value(gP->meter, indic, 0);
+	
+		indic = lv_meter_add_scale_lines(gP->meter, scale, lv_palette_main(LV_PALETTE_BLUE), lv_palette_main(LV_PALETTE_BLUE), false, 0);
+		lv_meter_set_indicator_start_value(gP->meter, indic, gP->meter_min);
+		lv_meter_set_indicator_end_value(gP->meter, indic, 0);
+	}
+	
+	// Indicator arcs: positive from zero (or the range start) and, below zero, a reversed
+	// arc that ends at zero
+	zero_angle = sweep * (gP->fp_zero - gP->fp_min) / (gP->fp_max - gP->fp_min);
+	gP->pos_arc = _gui_tile_gauge_add_arc(tP->tile, gP, w, h, rotation + zero_angle, sweep - zero_angle);
+	lv_arc_set_range(gP->pos_arc, gP->fp_zero, gP->fp_max);
+	lv_obj_set_style_arc_color(gP->pos_arc, lv_palette_main(gdP->color), LV_PART_INDICATOR);
+	
+	if (gP->fp_min < gP->fp_zero) {
+		gP->neg_arc = _gui_tile_gauge_add_arc(tP->tile, gP, w, h, rotation, zero_angle);
+		lv_arc_set_range(gP->neg_arc, 0, gP->fp_zero - gP->fp_min);
+		lv_arc_set_mode(gP->neg_arc, LV_ARC_MODE_REVERSE);
+		lv_obj_add_style(gP->neg_arc, gui_utility_get_style(GUI_STYLE_NEG_ARC), LV_PART_INDICATOR);
+	}
+	
+	// Value and name labels
+	if (large) {
+		gP->val_lbl = _gui_tile_gauge_add_label(tP->tile, GUI_STYLE_READOUT_LARGE, x, y - h/12);
+		gP->name_lbl = _gui_tile_gauge_add_label(tP->tile, GUI_STYLE_LABEL, x, y - h/5);
+	} else if (gdP->layout == GUI_GAUGE_SMALL_270) {
+		gP->val_lbl = _gui_tile_gauge_add_label(tP->tile, GUI_STYLE_VALUE, x, y);
+		gP->name_lbl = _gui_tile_gauge_add_label(tP->tile, GUI_STYLE_LABEL, x, y + h/2 - 20);
+	} else {
+		gP->val_lbl = _gui_tile_gauge_add_label(tP->tile, GUI_STYLE_VALUE, x, y - h/6);
+		gP->name_lbl = _gui_tile_gauge_add_label(tP->tile, GUI_STYLE_LABEL, x, y + h/8);
+	}
+	gui_utility_init_num_label(&gP->val_nl, gP->val_lbl);
+	lv_label_set_text_static(gP->name_lbl, (gP->name != NULL) ? gP->name : "");
+	
+	// Initialize the gauge to its current value
+	gui_utility_init_gauge_anim(&gP->animation, gP, _gui_tile_gauge_set_indicator_cb, gP->fp_zero);
+	_gui_tile_gauge_update(gP, true);
+	
+	// Scale and range arcs are static so draw them from a cached image
+	gP->meter = gui_utility_cache_meter(gP->meter);
+}
+
+
+static lv_obj_t* _gui_tile_gauge_add_arc(lv_obj_t* parent, gauge_t* gP, lv_coord_t w, lv_coord_t h, int rotation, int sweep)
+{
+	lv_obj_t* arc;
+	
+	arc = gui_utility_create_gauge_arc(parent);
+	lv_obj_align(arc, LV_ALIGN_CENTER, gP->defP->x * tile_w / 16, gP->defP->y * tile_h / 16);
+	lv_obj_set_size(arc, w - 10, h - 10);
+	lv_arc_set_rotation(arc, rotation);
+	lv_arc_set_bg_angles(arc, 0, sweep);
+	lv_obj_add_style(arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
+	lv_obj_remove_style(arc, NULL, LV_PART_KNOB);
+	lv_obj_clear_flag(arc, LV_OBJ_FLAG_CLICKABLE);
+	
+	return arc;
+}
+
+
+static lv_obj_t* _gui_tile_gauge_add_label(lv_obj_t* parent, int style, lv_coord_t x, lv_coord_t y)
+{
+	lv_obj_t* lbl;
+	
+	lbl = lv_label_create(parent);
+	lv_label_set_long_mode(lbl, LV_LABEL_LONG_WRAP);
+	lv_obj_add_style(lbl, gui_utility_get_style(style), LV_PART_MAIN);
+	lv_obj_align(lbl, LV_ALIGN_CENTER, x, y);
+	
+	return lbl;
+}
+
+
+static void _gui_tile_gauge_update(gauge_t* gP, bool immediate)
+{
+	int32_t v;
+	
+	v = (int32_t) lroundf((gP->item_val - gP->ref_val) * gP->scale * gP->fp_mult);
+	if (!immediate && (v == gP->val)) return;
+	gP->val = v;
+	if (gP->val_lbl == NULL) return;
+	
+	// Update the label immediately
+	gui_utility_set_num_label(&gP->val_nl, v, gP->decimals, (gP->defP->layout == GUI_GAUGE_LARGE_270) ? gP->unit : NULL);
+	
+	// Move the indicator to the new value (smoothly unless immediate)
+	if (v < gP->fp_min) v = gP->fp_min;
+	if (v > gP->fp_max) v = gP->fp_max;
+	gui_utility_set_gauge_anim(&gP->animation, v, immediate);
+}
+
+
+static void _gui_tile_gauge_set_indicator_cb(void* var, int32_t val)
+{
+	gauge_t* gP = (gauge_t*) var;
+	
+	if ((gP->neg_arc != NULL) && (val < gP->fp_zero)) {
+		gui_utility_set_arc_value(gP->pos_arc, gP->fp_zero);
+		gui_utility_set_arc_value(gP->neg_arc, val - gP->fp_min);
+	} else {
+		if (gP->neg_arc != NULL) {
+			gui_utility_set_arc_value(gP->neg_arc, gP->fp_zero - gP->fp_min);
+		}
+		gui_utility_set_arc_value(gP->pos_arc, val);
+	}
+}
+
+
+static void _gui_tile_gauge_item_cb(int item, float val)
+{
+	const gui_gauge_def_t* gdP;
+	gauge_t* gP;
+	
+	if (active_tileP == NULL) return;
+	
+	// Use the first gauge's updates to mark the intervals for the update timer
+	if (item == active_tileP->defP->gaugeP[0].item) {
+		gui_utility_note_update();
+	}
+	
+	for (int i=0; i<active_tileP->num_gauges; i++) {
+		gP = &active_tileP->gauge[i];
+		gdP = gP->defP;
+		if (!gP->supported) continue;
+	
+		if ((item == gdP->item) || (item == gdP->ref_item)) {
+			if (item == gdP->item) {
+				gP->item_val = val;
+			} else {
+				gP->ref_val = val;
+			}
+			_gui_tile_gauge_update(gP, false);
+		}
+	}
+}
+
+
+static void _gui_tile_gauge_quality_cb(int item, int quality)
+{
+	const gui_gauge_def_t* gdP;
+	bool stale;
+	gauge_t* gP;
+	int q;
+	
+	if (active_tileP == NULL) return;
+	
+	for (int i=0; i<active_tileP->num_gauges; i++) {
+		gP = &active_tileP->gauge[i];
+		gdP = gP->defP;
+		if (!gP->supported || (gP->val_lbl == NULL)) continue;
+	
+		if ((item == gdP->item) || (item == gdP->ref_item)) {
+			// A gauge is stale if any item it displays is
+			stale = (quality == DB_QUALITY_STALE) || (quality == DB_QUALITY_ERROR);
+			if (gdP->ref_item != DB_ITEM_NONE) {
+				q = db_get_item_quality((item == gdP->item) ? gdP->ref_item : gdP->item);
+				stale |= (q == DB_QUALITY_STALE) || (q == DB_QUALITY_ERROR);
+			}
+			gui_utility_set_stale(gP->pos_arc, stale);
+			if (gP->neg_arc != NULL) {
+				gui_utility_set_stale(gP->neg_arc, stale);
+			}
+			gui_utility_set_stale(gP->val_lbl, stale);
+		}
+	}
+}
@@ -0,0 +1,88 @@
+/*
+ * Table-driven gauge tiles.  Each tile is a list of gauge definitions (item, layout,
+ * position) instantiated by one builder that takes ranges, units and precision from the
+ * signal catalog, uses the shared styles and drives every indicator from the
+ * shared gauge animator.  New tiles are added to the tile table in gui_tile_gauge.c without
+ * any new rendering code.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef GUI_TILE_GAUGE_H
+#define GUI_TILE_GAUGE_H
+
+#include "lvgl.h"
+#include "vehicle_manager.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Gauge layouts
+//  - LARGE_270: 270 degree scale with a large value and name in the middle
+//  - SMALL_270: 270 degree scale with a small value in the middle and name in the opening
+//  - SMALL_180: 180 degree scale with a small value above and name below the centre
+#define GUI_GAUGE_LARGE_270       0
+#define GUI_GAUGE_SMALL_270       1
+#define GUI_GAUGE_SMALL_180       2
+
+// Maximum number of gauge tiles and gauges on one tile
+#define GUI_GAUGE_TILE_MAX        2
+#define GUI_GAUGE_TILE_MAX_GAUGES 3
+
+
+
+//
+// Gauge definition.  The displayed value is (item - ref_item) * scale.  Ranges should be
+// even, whole numbers in display units (the scale labels are integers).
+//
+typedef struct {
+	int layout;                 // GUI_GAUGE_*
+	int item;
+	int ref_item;               // Subtracted from item (DB_ITEM_NONE for item alone)
+	float scale;                // Display units per item unit
+	float min;                  // Display range (min == max for the catalog range * scale)
+	float max;
+	int decimals;               // Displayed precision (-1 for the catalog's)
+	const char* unit;           // NULL for the catalog's unit
+	const char* name;           // NULL for the catalog's name
+	lv_palette_t color;         // Indicator color for positive values (negative are blue)
+	int8_t x;                   // Centre offset from the tile centre (1/16ths of the tile)
+	int8_t y;
+	uint8_t size;               // Diameter (1/16ths of the tile)
+} gui_gauge_def_t;
+
+typedef struct {
+	const char* name;
+	int num_gauges;
+	const gui_gauge_def_t* gaugeP;
+	vm_goal_list_t goals;       // Freshness goals of the tile's items
+} gui_gauge_tile_def_t;
+
+#define GUI_GAUGE_TILE(name, gauges, goals) {name, sizeof(gauges)/sizeof(gauges[0]), gauges, goals}
+
+
+
+//
+// API
+//
+void gui_tile_gauge_init(lv_obj_t* parent_tileview, int* tile_index);
+
+#endif /* GUI_TILE_GAUGE_H */
@@ -30,6 +30,22 @@
 
 
 
+//
+// Local Constants
+//
+
+// Data broker notification filter for the aux meter (kW)
+#define AUX_KW_DEADBAND       0.05
+
+// Freshness goals (mSec) of the displayed items
+static const vm_goal_t tile_goals[] = {
+	{DB_ITEM_HV_POWER_KW, 100},
+	{DB_ITEM_AUX_KW, 1000}
+};
+static const vm_goal_list_t tile_goal_list = VM_GOAL_LIST(tile_goals);
+
+
+
 //
 // Local Variables
 //
@@ -45,7 +61,12 @@ static lv_obj_t* aux_arc;
 static lv_obj_t* aux_val_lbl;
 static lv_obj_t* aux_lbl;
 
-static lv_anim_t power_animation;   // Animator for smooth meter movement between values
+static gui_num_label_t power_val_nl;
+static gui_num_label_t aux_val_nl;
+
+static gui_gauge_anim_t power_animation;   // Animator for smooth meter movement between values
+
+static gui_trend_t power_trend;            // Power over the last minute
 
 // Vehicle capability flags
 static bool has_power;
@@ -60,7 +81,6 @@ static float aux_max;
 // State
 static uint16_t tile_w;
 static uint16_t tile_h;
-static float hv_v = 0;
 static int32_t power_kw = 0;
 static float aux_kw = 0;
 
@@ -69,15 +89,16 @@ static float aux_kw = 0;
 // Forward declarations for internal functions
 //
 static void _gui_tile_power_set_active(bool en);
+static void _gui_tile_power_set_content(bool build);
 static void _gui_tile_power_setup_vehicle();
 static void _gui_tile_power_setup_power_meter();
 static void _gui_tile_power_setup_aux_meter();
 static void _gui_tile_power_update_power_meter(int32_t val, bool immediate);
 static void _gui_tile_power_set_power_meter_cb(void* indic, int32_t val);
 static void _gui_tile_power_update_aux_meter(float val);
-static void _gui_tile_power_hv_v_cb(float val);
-static void _gui_tile_power_hv_i_cb(float val);
+static void _gui_tile_power_hv_power_cb(float val);
 static void _gui_tile_power_aux_cb(float val);
+static void _gui_tile_power_quality_cb(int item, int quality);
 
 
 //
@@ -94,18 +115,11 @@ void gui_tile_power_init(lv_obj_t* parent_tileview, int* tile_index)
 	// Determine our capabilities
 	_gui_tile_power_setup_vehicle();
 	
-	// Create display objects
-	if (has_power) {
-		_gui_tile_power_setup_power_meter();
-	}
-	
-	if (has_aux) {
-		_gui_tile_power_setup_aux_meter();
-	}
-	
 	// Register ourselves with our parent if we're capable of displaying something
+	// (it has us create our display objects when we're about to be displayed)
 	if (has_power || has_aux) {
-		gui_screen_main_register_tile(tile, _gui_tile_power_set_active);
+		gui_screen_main_register_tile(tile, _gui_tile_power_set_active, _gui_tile_power_set_content,
+		                              (has_power ? DB_MASK(DB_ITEM_HV_POWER_KW) : 0) | (has_aux ? DB_MASK(DB_ITEM_AUX_KW) : 0));
 	}
 }
 
@@ -116,53 +130,79 @@ void gui_tile_power_init(lv_obj_t* parent_tileview, int* tile_index)
 //
 static void _gui_tile_power_set_active(bool en)
 {
-	uint32_t req_mask = 0;
+	db_mask_t req_mask = 0;
 	
 	if (en) {
 		// Setup to receive data we require
 		if (has_power) {
-			db_register_gui_callback(DB_ITEM_HV_BATT_V, _gui_tile_power_hv_v_cb);
-			db_register_gui_callback(DB_ITEM_HV_BATT_I, _gui_tile_power_hv_i_cb);
-			req_mask |= DB_ITEM_HV_BATT_V | DB_ITEM_HV_BATT_I;
-			hv_v = 0;
+			db_register_gui_callback(DB_ITEM_HV_POWER_KW, _gui_tile_power_hv_power_cb);
+			req_mask |= DB_MASK(DB_ITEM_HV_POWER_KW);
 			power_kw = 0;
 			_gui_tile_power_update_power_meter(0, true);
 		}
 		if (has_aux) {
 			db_register_gui_callback(DB_ITEM_AUX_KW, _gui_tile_power_aux_cb);
-			req_mask |= DB_ITEM_AUX_KW;
+			db_set_subscriber_filter(DB_SUBSCRIBER_GUI, DB_ITEM_AUX_KW, AUX_KW_DEADBAND, 0);
+			req_mask |= DB_MASK(DB_ITEM_AUX_KW);
 			aux_kw = 0;
 			_gui_tile_power_update_aux_meter(0);
 		}
 		if (has_power || has_aux) {
 			// Start data flow
 			vm_set_request_item_mask(req_mask);
+			vm_set_request_goals(&tile_goal_list);
+			
+			// Grey out meters whose data stops arriving
+			db_register_gui_quality_callback(_gui_tile_power_quality_cb);
+			_gui_tile_power_quality_cb(DB_ITEM_HV_POWER_KW, db_get_item_quality(DB_ITEM_HV_POWER_KW));
+			_gui_tile_power_quality_cb(DB_ITEM_AUX_KW, db_get_item_quality(DB_ITEM_AUX_KW));
 		}
 		
-		// Enable averaging for incoming data if we have a fast enough interface
-		db_enable_fast_average(gui_has_fast_interface());
+		// Enable smoothing for incoming data if we have a fast enough interface
+		db_set_filter_profile(req_mask, gui_has_fast_interface());
 		
 		// Initialize the update interval timer for meter animations (this will change
 		// to reflect real system timing)
-		gui_utility_init_update_time(100);
+		gui_utility_init_update_time(100, req_mask);
+	}
+	
+	gui_utility_set_trend_active(&power_trend, en && has_power);
+}
+
+
+static void _gui_tile_power_set_content(bool build)
+{
+	if (build) {
+		if (has_power) {
+			_gui_tile_power_setup_power_meter();
+		}
+		
+		if (has_aux) {
+			_gui_tile_power_setup_aux_meter();
+		}
+	} else {
+		gui_utility_stop_gauge_anim(&power_animation);
+		lv_obj_clean(tile);
 	}
 }
 
 
 static void _gui_tile_power_setup_vehicle()
 {
-	uint32_t capability_mask;
+	db_mask_t capability_mask;
 	
 	capability_mask = vm_get_supported_item_mask();
-	has_power = ((capability_mask & DB_ITEM_HV_BATT_V) != 0) && ((capability_mask & DB_ITEM_HV_BATT_I) != 0);
-	has_aux = (capability_mask & DB_ITEM_AUX_KW) != 0;
+	has_power = (capability_mask & DB_MASK(DB_ITEM_HV_POWER_KW)) != 0;
+	has_aux = (capability_mask & DB_MASK(DB_ITEM_AUX_KW)) != 0;
 	
 	if (has_power) {
-		vm_get_range(VM_RANGE_POWER, &power_min, &power_max);
+		power_min = db_catalog_get(DB_ITEM_HV_POWER_KW)->min;
+		power_max = db_catalog_get(DB_ITEM_HV_POWER_KW)->max;
 	}
 	
 	if (has_aux) {
-		vm_get_range(VM_RANGE_AUX, &aux_min, &aux_max);
+		aux_min = db_catalog_get(DB_ITEM_AUX_KW)->min;
+		aux_max = db_catalog_get(DB_ITEM_AUX_KW)->max;
 	}
 }
 
@@ -223,41 +263,51 @@ static void _gui_tile_power_setup_power_meter()
 
 
 	// Create a green arc that will act as the positive meter indicator (traction power)
-	power_pos_arc = lv_arc_create(tile);
+	power_pos_arc = gui_utility_create_gauge_arc(tile);
 	lv_obj_center(power_pos_arc);
 	lv_obj_set_size(power_pos_arc, tile_w-10, tile_h-10);
 	lv_arc_set_rotation(power_pos_arc, 135 + (270 * (-meter_min) / (meter_max - meter_min)));
 	lv_arc_set_bg_angles(power_pos_arc, 0, 270 - (270 * (-meter_min) / (meter_max - meter_min)));
 	lv_arc_set_range(power_pos_arc, 0, meter_max);
 	lv_arc_set_value(power_pos_arc, 0);
-	lv_obj_set_style_bg_color(power_pos_arc, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_INDICATOR);
+	lv_obj_add_style(power_pos_arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
 	lv_obj_remove_style(power_pos_arc, NULL, LV_PART_KNOB);
 	lv_obj_clear_flag(power_pos_arc, LV_OBJ_FLAG_CLICKABLE);
 	lv_obj_set_style_arc_color(power_pos_arc, lv_palette_main(LV_PALETTE_GREEN), LV_PART_INDICATOR);
 	
 	// Create a blue arc that will act as the negative meter indicator (regen power)
-	power_neg_arc = lv_arc_create(tile);
+	power_neg_arc = gui_utility_create_gauge_arc(tile);
 	lv_obj_center(power_neg_arc);
 	lv_obj_set_size(power_neg_arc, tile_w-10, tile_h-10);
 	lv_arc_set_rotation(power_neg_arc, 135);
 	lv_arc_set_bg_angles(power_neg_arc, 0, 270 * (-meter_min) / (meter_max - meter_min));
 	lv_arc_set_range(power_neg_arc, 0, -meter_min);
 	lv_arc_set_value(power_neg_arc, 0);
-	lv_obj_set_style_bg_color(power_neg_arc, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_INDICATOR);
+	lv_obj_add_style(power_neg_arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
 	lv_obj_remove_style(power_neg_arc, NULL, LV_PART_KNOB);
 	lv_obj_clear_flag(power_neg_arc, LV_OBJ_FLAG_CLICKABLE);
 	lv_arc_set_mode(power_neg_arc, LV_ARC_MODE_REVERSE);
 	
 	// Add the label object for the current power value
 	power_val_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&power_val_nl, power_val_lbl);
 	lv_label_set_long_mode(power_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(power_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(power_val_lbl, &lv_font_montserrat_48, LV_PART_MAIN);
+	lv_obj_add_style(power_val_lbl, gui_utility_get_style(GUI_STYLE_READOUT_LARGE), LV_PART_MAIN);
 	lv_obj_align(power_val_lbl, LV_ALIGN_CENTER, 0, -40);
 	
 	// Initialize the meter to 0
 	power_kw = -1.0;  // Force update
+	gui_utility_init_gauge_anim(&power_animation, NULL, _gui_tile_power_set_power_meter_cb, 0);
 	_gui_tile_power_update_power_meter(0, true);
+	
+	// Power trend strip between the value and the aux meter
+	if (gui_utility_create_trend(&power_trend, tile, DB_ITEM_HV_POWER_KW, (tile_w * 7) / 16, tile_h / 12,
+	                             power_min, power_max, lv_palette_main(LV_PALETTE_GREEN)) != NULL) {
+		lv_obj_align(power_trend.canvas, LV_ALIGN_CENTER, 0, tile_h / 24);
+	}
+	
+	// Scale and range arcs are static so draw them from a cached image
+	meter_power = gui_utility_cache_meter(meter_power);
 }
 
 
@@ -289,102 +339,76 @@ static void _gui_tile_power_setup_aux_meter()
     lv_arc_set_rotation(aux_arc, 135);
 	lv_arc_set_bg_angles(aux_arc, 0, 270);
 	lv_arc_set_range(aux_arc, meter_min * 10, meter_max * 10);
-	lv_obj_set_style_bg_color(aux_arc, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_INDICATOR);
+	lv_obj_add_style(aux_arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
 	lv_obj_remove_style(aux_arc, NULL, LV_PART_KNOB);
 	lv_obj_clear_flag(aux_arc, LV_OBJ_FLAG_CLICKABLE);
 	lv_obj_set_style_arc_color(aux_arc, lv_palette_main(LV_PALETTE_GREEN), LV_PART_INDICATOR);
 	
 	// Value label
 	aux_val_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&aux_val_nl, aux_val_lbl);
 	lv_label_set_long_mode(aux_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(aux_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(aux_val_lbl, &lv_font_montserrat_24, LV_PART_MAIN);
+	lv_obj_add_style(aux_val_lbl, gui_utility_get_style(GUI_STYLE_VALUE), LV_PART_MAIN);
 	lv_obj_align(aux_val_lbl, LV_ALIGN_BOTTOM_MID, 0, -h/2 - 10);
     
     // AUX label
     aux_lbl = lv_label_create(tile);
 	lv_label_set_long_mode(aux_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(aux_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(aux_lbl, &lv_font_montserrat_18, LV_PART_MAIN);
+	lv_obj_add_style(aux_lbl, gui_utility_get_style(GUI_STYLE_LABEL), LV_PART_MAIN);
 	lv_obj_align(aux_lbl, LV_ALIGN_BOTTOM_MID, 0, -30);
 	lv_label_set_text_static(aux_lbl, "AUX");
 	
 	// Initialize meter to 0
 	_gui_tile_power_update_aux_meter(0);
+	
+	// Scale and range arcs are static so draw them from a cached image
+	meter_aux = gui_utility_cache_meter(meter_aux);
 }
 
 
 static void _gui_tile_power_update_power_meter(int32_t val, bool immediate)
 {
-	static char kw_lbl[16];                  // "-XXX kW"
-	uint32_t anim_time;
-	
 	// Update the label immediately
-	sprintf(kw_lbl, "%ld kW", val);
-	lv_label_set_text_static(power_val_lbl, kw_lbl);
+	gui_utility_set_num_label(&power_val_nl, val, 0, " kW");
 	
-	if (immediate) {
-		_gui_tile_power_set_power_meter_cb(NULL, val);
-	} else {
-		// Stop any previous animations
-		lv_anim_del(meter_power, _gui_tile_power_set_power_meter_cb);
-		
-		// Start an animation to the new value for the meter indicator
-		anim_time = gui_utility_get_update_period() - 20;   // Just slightly faster than the average update interval
-		lv_anim_init(&power_animation);
-		lv_anim_set_exec_cb(&power_animation, _gui_tile_power_set_power_meter_cb);
-		lv_anim_set_var(&power_animation, meter_power); // Unused since we will update the arcs
-		lv_anim_set_time(&power_animation, anim_time);
-		lv_anim_set_values(&power_animation, power_kw, val);
-		lv_anim_start(&power_animation);
-	}
+	// Move the meter indicator to the new value (smoothly unless immediate)
+	gui_utility_set_gauge_anim(&power_animation, val, immediate);
 }
 
 
 static void _gui_tile_power_set_power_meter_cb(void* indic, int32_t val)
 {
 	if (val < 0) {
-		lv_arc_set_value(power_pos_arc, 0);
-		lv_arc_set_value(power_neg_arc, ((int32_t) round(-power_min)) + val);
+		gui_utility_set_arc_value(power_pos_arc, 0);
+		gui_utility_set_arc_value(power_neg_arc, ((int32_t) lroundf(-power_min)) + val);
 	} else {
-		lv_arc_set_value(power_neg_arc, (int32_t) round(-power_min));
-		lv_arc_set_value(power_pos_arc, val);
+		gui_utility_set_arc_value(power_neg_arc, (int32_t) lroundf(-power_min));
+		gui_utility_set_arc_value(power_pos_arc, val);
 	}
 }
 
 
 static void _gui_tile_power_update_aux_meter(float val)
 {
-	static char kw_lbl[12];                 // "XX.X"
 	int32_t arc_val;
 	
-	arc_val = (int32_t) round(val * 10.0);
-	lv_arc_set_value(aux_arc, arc_val);
+	arc_val = (int32_t) lroundf(val * 10.0f);
+	gui_utility_set_arc_value(aux_arc, arc_val);
 	
-	sprintf(kw_lbl, "%1.1f", val);
-	lv_label_set_text_static(aux_val_lbl, kw_lbl);
-}
-
-
-static void _gui_tile_power_hv_v_cb(float val)
-{
-	hv_v = val;
-	// Power updated when we get the current value
+	gui_utility_set_num_label(&aux_val_nl, arc_val, 1, NULL);
 }
 
 
-static void _gui_tile_power_hv_i_cb(float val)
+static void _gui_tile_power_hv_power_cb(float val)
 {
 	int32_t p;
 	
 	// Use this update to mark the intervals for the update timer
 	gui_utility_note_update();
 	
-	// Update meter on receiving current (2nd after voltage)
-	//  Negate current since we want to display positive kW for traction
-	//  and negative kW for regeneration (battery current is negative for traction)
-	val = -val;
-	p = round((hv_v * val) / 1000.0);
+	// Negate power since we want to display positive kW for traction and negative kW
+	// for regeneration (battery current, and so the broker's HV power, is negative for traction)
+	p = lroundf(-val);
 	if (p != power_kw) {
 		_gui_tile_power_update_power_meter(p, false);
 		power_kw = p;
@@ -399,3 +423,18 @@ static void _gui_tile_power_aux_cb(float val)
 		aux_kw = val;
 	}
 }
+
+
+static void _gui_tile_power_quality_cb(int item, int quality)
+{
+	bool stale = (quality == DB_QUALITY_STALE) || (quality == DB_QUALITY_ERROR);
+	
+	if ((item == DB_ITEM_HV_POWER_KW) && has_power) {
+		gui_utility_set_stale(power_pos_arc, stale);
+		gui_utility_set_stale(power_neg_arc, stale);
+		gui_utility_set_stale(power_val_lbl, stale);
+	} else if ((item == DB_ITEM_AUX_KW) && has_aux) {
+		gui_utility_set_stale(aux_arc, stale);
+		gui_utility_set_stale(aux_val_lbl, stale);
+	}
+}
@@ -0,0 +1,296 @@
+/*
+ * Trip review tile.  Graph the power, speed and battery temperature envelopes (min/max)
+ * of the current or last trip from the logger's summary pyramids.  Touching the tile
+ * steps through the zoom levels, each showing the newest part of the trip.  The graphs
+ * are redrawn periodically so an open trip scrolls along.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "data_broker.h"
+#include "esp_system.h"
+#include "gui_task.h"
+#include "gui_screen_main.h"
+#include "gui_tile_review.h"
+#include "gui_utilities.h"
+#include "log_summary.h"
+#include "vehicle_manager.h"
+#include <stdio.h>
+
+
+
+//
+// Local Constants
+//
+
+// Points across each graph
+#define NUM_POINTS             96
+
+// Redraw interval
+#define TIMER_EVAL_MSEC        2000
+
+// Zoom levels - graph span in seconds (0 = the whole trip)
+#define NUM_ZOOMS              4
+static const uint32_t zoom_span_sec[NUM_ZOOMS] = {0, 30 * 60, 10 * 60, 2 * 60};
+
+// Graph values are kept in tenths
+#define GRAPH_SCALE            10.0f
+
+
+
+//
+// Local Variables
+//
+static lv_obj_t* tile;
+
+static lv_obj_t* title_lbl = NULL;
+static lv_obj_t* graph_chart[LOG_SUM_NUM_SERIES];
+static lv_obj_t* graph_lbl[LOG_SUM_NUM_SERIES];
+static lv_chart_series_t* graph_max_ser[LOG_SUM_NUM_SERIES];
+static lv_chart_series_t* graph_min_ser[LOG_SUM_NUM_SERIES];
+
+static lv_timer_t* review_eval_timer = NULL;
+
+static const char* series_name[LOG_SUM_NUM_SERIES] = {"Power", "Speed", "Batt"};
+static const lv_palette_t series_color[LOG_SUM_NUM_SERIES] = {LV_PALETTE_GREEN, LV_PALETTE_BLUE, LV_PALETTE_ORANGE};
+
+// State
+static bool units_metric;
+static uint16_t tile_w;
+static uint16_t tile_h;
+static int zoom_index = 0;
+static log_sum_point_t points[NUM_POINTS];
+static lv_coord_t max_vals[LOG_SUM_NUM_SERIES][NUM_POINTS];
+static lv_coord_t min_vals[LOG_SUM_NUM_SERIES][NUM_POINTS];
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _gui_tile_review_set_active(bool en);
+static void _gui_tile_review_set_content(bool build);
+static void _gui_tile_review_timer_cb(lv_timer_t* timer);
+static void _gui_tile_review_click_cb(lv_event_t* e);
+static void _gui_tile_review_update();
+static void _gui_tile_review_update_series(int series, uint32_t start_sec, uint32_t span_sec);
+static float _gui_tile_review_convert(int series, float v);
+
+
+
+//
+// API
+//
+void gui_tile_review_init(lv_obj_t* parent_tileview, int* tile_index)
+{
+	db_mask_t req_mask;
+	
+	// Create our object
+	tile = lv_tileview_add_tile(parent_tileview, *tile_index, 0, LV_DIR_LEFT | LV_DIR_RIGHT);
+	*tile_index += 1;
+	
+	gui_get_screen_size(&tile_w, &tile_h);
+	
+	// Keep the summarized items updating while we're displayed
+	req_mask = vm_get_supported_item_mask() & (DB_MASK(DB_ITEM_HV_BATT_V) | DB_MASK(DB_ITEM_HV_BATT_I) |
+	                                          DB_MASK(DB_ITEM_SPEED) | DB_MASK(DB_ITEM_HV_BATT_MAX_T));
+	
+	// Register ourselves with our parent if there is something to summarize
+	if (req_mask != 0) {
+		gui_screen_main_register_tile(tile, _gui_tile_review_set_active, _gui_tile_review_set_content, req_mask);
+	
+		// Create our evaluation timer
+		review_eval_timer = lv_timer_create(_gui_tile_review_timer_cb, TIMER_EVAL_MSEC, NULL);
+		lv_timer_set_repeat_count(review_eval_timer, -1);
+		lv_timer_pause(review_eval_timer);
+	}
+	
+	// Get our display units
+	units_metric = gui_is_metric();
+}
+
+
+
+//
+// Internal functions
+//
+static void _gui_tile_review_set_active(bool en)
+{
+	if (en) {
+		vm_set_request_item_mask(vm_get_supported_item_mask() & (DB_MASK(DB_ITEM_HV_BATT_V) | DB_MASK(DB_ITEM_HV_BATT_I) |
+		                                                         DB_MASK(DB_ITEM_SPEED) | DB_MASK(DB_ITEM_HV_BATT_MAX_T)));
+		_gui_tile_review_update();
+		lv_timer_resume(review_eval_timer);
+	} else {
+		lv_timer_pause(review_eval_timer);
+	}
+}
+
+
+static void _gui_tile_review_set_content(bool build)
+{
+	if (build) {
+		// Trip and span
+		title_lbl = lv_label_create(tile);
+		lv_obj_set_style_text_font(title_lbl, &lv_font_montserrat_18, LV_PART_MAIN);
+		lv_obj_align(title_lbl, LV_ALIGN_TOP_MID, 0, tile_h / 12);
+		lv_label_set_text_static(title_lbl, "");
+	
+		// One graph per series, max and min lines forming an envelope
+		for (int i=0; i<LOG_SUM_NUM_SERIES; i++) {
+			graph_chart[i] = lv_chart_create(tile);
+			lv_obj_set_size(graph_chart[i], (tile_w * 5) / 8, tile_h / 7);
+			lv_obj_align(graph_chart[i], LV_ALIGN_CENTER, 0, ((i - 1) * tile_h * 7) / 30 + tile_h / 16);
+			lv_chart_set_type(graph_chart[i], LV_CHART_TYPE_LINE);
+			lv_chart_set_point_count(graph_chart[i], NUM_POINTS);
+			lv_chart_set_div_line_count(graph_chart[i], 0, 0);
+			lv_obj_set_style_size(graph_chart[i], 0, LV_PART_INDICATOR);
+			lv_obj_set_style_bg_opa(graph_chart[i], LV_OPA_TRANSP, LV_PART_MAIN);
+			lv_obj_set_style_border_color(graph_chart[i], lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_MAIN);
+			lv_obj_clear_flag(graph_chart[i], LV_OBJ_FLAG_CLICKABLE);
+			graph_max_ser[i] = lv_chart_add_series(graph_chart[i], lv_palette_main(series_color[i]), LV_CHART_AXIS_PRIMARY_Y);
+			graph_min_ser[i] = lv_chart_add_series(graph_chart[i], lv_palette_darken(series_color[i], 3), LV_CHART_AXIS_PRIMARY_Y);
+			lv_chart_set_ext_y_array(graph_chart[i], graph_max_ser[i], max_vals[i]);
+			lv_chart_set_ext_y_array(graph_chart[i], graph_min_ser[i], min_vals[i]);
+	
+			// Series name and its range over the span
+			graph_lbl[i] = lv_label_create(tile);
+			lv_obj_set_style_text_font(graph_lbl[i], &lv_font_montserrat_14, LV_PART_MAIN);
+			lv_label_set_text_static(graph_lbl[i], series_name[i]);
+			lv_obj_align_to(graph_lbl[i], graph_chart[i], LV_ALIGN_OUT_TOP_MID, 0, 0);
+		}
+	
+		// Touch anywhere to zoom
+		lv_obj_add_flag(tile, LV_OBJ_FLAG_CLICKABLE);
+		lv_obj_add_event_cb(tile, _gui_tile_review_click_cb, LV_EVENT_SHORT_CLICKED, NULL);
+	} else {
+		lv_obj_remove_event_cb(tile, _gui_tile_review_click_cb);
+		lv_obj_clean(tile);
+		title_lbl = NULL;
+	}
+}
+
+
+static void _gui_tile_review_timer_cb(lv_timer_t* timer)
+{
+	if (timer == review_eval_timer) {
+		_gui_tile_review_update();
+	}
+}
+
+
+static void _gui_tile_review_click_cb(lv_event_t* e)
+{
+	if (lv_event_get_code(e) == LV_EVENT_SHORT_CLICKED) {
+		zoom_index = (zoom_index + 1) % NUM_ZOOMS;
+		_gui_tile_review_update();
+	}
+}
+
+
+// Redraw all graphs for the current zoom level
+static void _gui_tile_review_update()
+{
+	char buf[48];
+	int trip;
+	uint32_t duration, span, start;
+	
+	if (title_lbl == NULL) return;
+	
+	trip = log_summary_get_trip();
+	if (trip < 0) {
+		lv_label_set_text_static(title_lbl, "No trip");
+		return;
+	}
+	
+	// Each zoom shows the newest part of the trip (the whole trip if it's shorter)
+	duration = log_summary_get_duration() + 1;
+	span = zoom_span_sec[zoom_index];
+	if ((span == 0) || (span > duration)) span = duration;
+	if (span < NUM_POINTS) span = NUM_POINTS;
+	start = (duration > span) ? (duration - span) : 0;
+	
+	sprintf(buf, "Trip %d  %lu:%02lu / %lu:%02lu", trip, span / 60, span % 60, duration / 60, duration % 60);
+	lv_label_set_text(title_lbl, buf);
+	
+	for (int i=0; i<LOG_SUM_NUM_SERIES; i++) {
+		_gui_tile_review_update_series(i, start, span);
+	}
+}
+
+
+static void _gui_tile_review_update_series(int series, uint32_t start_sec, uint32_t span_sec)
+{
+	char buf[48];
+	bool any = false;
+	float v_min = 0;
+	float v_max = 0;
+	float v;
+	lv_coord_t range_min, range_max;
+	
+	if (!log_summary_get(series, start_sec, span_sec, NUM_POINTS, points)) return;
+	
+	for (int i=0; i<NUM_POINTS; i++) {
+		if (points[i].valid) {
+			v = _gui_tile_review_convert(series, points[i].max);
+			max_vals[series][i] = (lv_coord_t) (v * GRAPH_SCALE);
+			if (!any || (v > v_max)) v_max = v;
+			v = _gui_tile_review_convert(series, points[i].min);
+			min_vals[series][i] = (lv_coord_t) (v * GRAPH_SCALE);
+			if (!any || (v < v_min)) v_min = v;
+			any = true;
+		} else {
+			max_vals[series][i] = LV_CHART_POINT_NONE;
+			min_vals[series][i] = LV_CHART_POINT_NONE;
+		}
+	}
+	
+	if (any) {
+		range_min = (lv_coord_t) (v_min * GRAPH_SCALE);
+		range_max = (lv_coord_t) (v_max * GRAPH_SCALE);
+		if (range_max <= range_min) range_max = range_min + 1;
+		lv_chart_set_range(graph_chart[series], LV_CHART_AXIS_PRIMARY_Y, range_min, range_max);
+	
+		switch (series) {
+			case LOG_SUM_POWER:
+				sprintf(buf, "%s %.0f - %.0f kW", series_name[series], v_min, v_max);
+				break;
+			case LOG_SUM_SPEED:
+				sprintf(buf, "%s %.0f - %.0f %s", series_name[series], v_min, v_max, units_metric ? "kph" : "mph");
+				break;
+			default:
+				sprintf(buf, "%s %.1f - %.1f °%c", series_name[series], v_min, v_max, units_metric ? 'C' : 'F');
+				break;
+		}
+		lv_label_set_text(graph_lbl[series], buf);
+	} else {
+		lv_label_set_text_static(graph_lbl[series], series_name[series]);
+	}
+	lv_obj_align_to(graph_lbl[series], graph_chart[series], LV_ALIGN_OUT_TOP_MID, 0, 0);
+	
+	lv_chart_refresh(graph_chart[series]);
+}
+
+
+static float _gui_tile_review_convert(int series, float v)
+{
+	if (!units_metric) {
+		if (series == LOG_SUM_SPEED) return gui_util_kph_to_mph(v);
+		if (series == LOG_SUM_TEMP) return gui_util_c_to_f(v);
+	}
+	
+	return v;
+}
@@ -19,10 +19,12 @@
  *
  */
 #include "can_manager.h"
+#include "can_task.h"
 #include "disp_driver.h"
 #include "esp_system.h"
 #include "esp_app_desc.h"
 #include "esp_log.h"
+#include "event_utilities.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "gui_task.h"
@@ -30,20 +32,12 @@
 #include "gui_tile_settings.h"
 #include "ps_utilities.h"
 #include "vehicle_manager.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 
 
-//
-// Local Constants
-//
-
-// Connection status update timer evaluation interval
-#define TIMER_EVAL_MSEC       500
-
-
-
 //
 // Local Variables
 //
@@ -72,10 +66,11 @@ static lv_obj_t* save_btn_info_lbl;
 
 static lv_obj_t* version_info_lbl;
 
-static lv_timer_t* connection_status_eval_timer = NULL;
-
 // State
 static bool is_connected;
+static bool is_characterizing;
+static int num_backoff_req;
+static char connection_status_buf[32];
 static bool prev_screen_settings;   // Used to restore a selection after returning from a settings screen
 static char* canbus_list;
 static char* vehicle_list;
@@ -114,7 +109,8 @@ static void _gui_tile_settings_dd_cb(lv_event_t* e);
 static void _gui_tile_settings_sl_cb(lv_event_t* e);
 static void _gui_tile_settings_sw_cb(lv_event_t* e);
 static void _gui_tile_settings_btn_cb(lv_event_t* e);
-static void _gui_tile_settings_connection_status_timer_cb(lv_timer_t* timer);
+static void _gui_tile_settings_event_cb(uint32_t events);
+static void _gui_tile_settings_update_connection_status();
 
 
 
@@ -141,15 +137,14 @@ void gui_tile_settings_init(lv_obj_t* parent_tileview, int* tile_index)
 	_gui_tile_settings_setup_version();
 	
 	// Register ourselves
-	gui_screen_main_register_tile(tile, _gui_tile_settings_set_active);
+	gui_screen_main_register_tile(tile, _gui_tile_settings_set_active, NULL, 0);
 	
 	// Get a pointer to the persistent storage main configuration
 	(void) ps_get_config(PS_CONFIG_TYPE_MAIN, (void**) &configP);
 	
-	// Create our evaluation timer
-	connection_status_eval_timer = lv_timer_create(_gui_tile_settings_connection_status_timer_cb, TIMER_EVAL_MSEC, NULL);
-	lv_timer_set_repeat_count(connection_status_eval_timer, -1);
-	lv_timer_pause(connection_status_eval_timer);
+	// Update the connection status when the interface or request health changes
+	(void) event_subscribe(EVENT_LINK_UP | EVENT_LINK_DOWN | EVENT_ADAPTER_TESTING | EVENT_ADAPTER_READY | EVENT_REQ_HEALTH,
+	                       _gui_tile_settings_event_cb);
 	
 	// Will come to this tile from another tile the first time
 	prev_screen_settings = false;
@@ -162,6 +157,8 @@ void gui_tile_settings_init(lv_obj_t* parent_tileview, int* tile_index)
 //
 static void _gui_tile_settings_set_active(bool en)
 {
+	int n;
+	
 	if (en) {
 		if (!prev_screen_settings) {
 			// Coming from another main screen tile
@@ -173,12 +170,9 @@ static void _gui_tile_settings_set_active(bool en)
 			//
 			// Connection status
 			is_connected = can_connected();
-			if (is_connected) {
-				lv_label_set_text_static(connection_status_lbl, LV_SYMBOL_REFRESH);				
-			} else {
-				lv_label_set_text_static(connection_status_lbl, "");
-			}
-			lv_timer_resume(connection_status_eval_timer);
+			is_characterizing = can_interface_characterizing();
+			vm_get_request_health(&n, &num_backoff_req);
+			_gui_tile_settings_update_connection_status();
 			
 			// Vehicle drop-down
 			strncpy(cur_vehicle_name, configP->vehicle_name, PS_VEHICLE_NAME_MAX_LEN);
@@ -211,8 +205,6 @@ static void _gui_tile_settings_set_active(bool en)
 			// Leave controls as they were when we displayed a setting screen
 			prev_screen_settings = false;
 		}
-	} else {
-		lv_timer_pause(connection_status_eval_timer);
 	}
 }
 
@@ -226,6 +218,10 @@ static void _gui_tile_settings_setup_connection_status()
 	lv_obj_set_width(connection_status_lbl, tile_w);
 	lv_obj_set_pos(connection_status_lbl, 0, row_y + 20);
 	
+	// Long press to characterize the interface (ELM327 adapters)
+	lv_obj_add_flag(connection_status_lbl, LV_OBJ_FLAG_CLICKABLE);
+	lv_obj_add_event_cb(connection_status_lbl, _gui_tile_settings_btn_cb, LV_EVENT_LONG_PRESSED, NULL);
+	
 	row_y += vertical_spacing;
 }
 
@@ -471,16 +467,31 @@ static void _gui_tile_settings_sw_cb(lv_event_t* e)
 static void _gui_tile_settings_btn_cb(lv_event_t* e)
 {
 	bool changed = false;
+	bool needs_restart = false;
 	
 	lv_event_code_t code = lv_event_get_code(e);
 	lv_obj_t* obj = lv_event_get_target(e);
 	
-	if (code == LV_EVENT_CLICKED) {
+	if (code == LV_EVENT_LONG_PRESSED) {
+		if ((obj == connection_status_lbl) && !is_characterizing) {
+			if (can_characterize_interface()) {
+				ESP_LOGI(TAG, "Characterizing interface");
+				is_characterizing = true;
+				_gui_tile_settings_update_connection_status();
+			}
+		}
+	} else if (code == LV_EVENT_CLICKED) {
 		if (obj == save_btn) {
 			// Look for configuration changes 
 			if (strcmp(cur_vehicle_name, new_vehicle_name) != 0) {
 				strncpy(configP->vehicle_name, new_vehicle_name, PS_VEHICLE_NAME_MAX_LEN);
+				
+				// Selecting auto-detect again identifies the vehicle again
+				vm_forget_identified_vehicle();
 				changed = true;
+				
+				// The tiles are built for the vehicle's items
+				needs_restart = true;
 			}
 			
 			if (cur_if_index != new_if_index) {
@@ -503,6 +514,19 @@ static void _gui_tile_settings_btn_cb(lv_event_t* e)
 					configP->config_flags &= ~PS_MAIN_FLAG_METRIC;
 				}
 				changed = true;
+				needs_restart = true;
+			}
+			
+			// Only the interface changed (brightness is already applied) so switch to it
+			// without a restart if both interfaces can be stopped
+			if ((cur_if_index != new_if_index) && !needs_restart && can_interface_hot_swappable(new_if_index)) {
+				if (!ps_save_config(PS_CONFIG_TYPE_MAIN) || !ps_flush()) {
+					ESP_LOGE(TAG, "Could not update persistent storage");
+				}
+				ESP_LOGI(TAG, "Switching to %s", can_get_interface_name(new_if_index));
+				cur_if_index = new_if_index;
+				can_task_reconfigure();
+				return;
 			}
 			
 			// Save changes if necessary
@@ -517,26 +541,50 @@ static void _gui_tile_settings_btn_cb(lv_event_t* e)
 				ESP_LOGI(TAG, "No changes detected on Save press");
 			}
 			
-			// Finally reboot
+			// Finally reboot once all pending saves (including other pages') are written
+			if (!ps_flush()) {
+				ESP_LOGE(TAG, "Could not update persistent storage");
+			}
 			esp_restart();
 		}
 	}
 }
 
 
-static void _gui_tile_settings_connection_status_timer_cb(lv_timer_t* timer)
+// Events only say something changed so the state is read back
+static void _gui_tile_settings_event_cb(uint32_t events)
 {
 	bool new_is_connected;
-	
-	if (timer == connection_status_eval_timer) {
-		new_is_connected = can_connected();
-		if (is_connected != new_is_connected) {
-			is_connected = new_is_connected;
-			if (is_connected) {
-				lv_label_set_text_static(connection_status_lbl, LV_SYMBOL_REFRESH);				
-			} else {
-				lv_label_set_text_static(connection_status_lbl, "");
-			}
+	bool new_is_characterizing;
+	int n;
+	int new_num_backoff;
+	
+	new_is_connected = can_connected();
+	new_is_characterizing = can_interface_characterizing();
+	vm_get_request_health(&n, &new_num_backoff);
+	if ((is_connected != new_is_connected) || (is_characterizing != new_is_characterizing) || (num_backoff_req != new_num_backoff)) {
+		is_connected = new_is_connected;
+		is_characterizing = new_is_characterizing;
+		num_backoff_req = new_num_backoff;
+		_gui_tile_settings_update_connection_status();
+	}
+}
+
+
+// Connection indicator followed by the number of requests the vehicle manager has backed
+// off because they are not being answered
+static void _gui_tile_settings_update_connection_status()
+{
+	if (is_characterizing) {
+		lv_label_set_text_static(connection_status_lbl, "Testing Adapter");
+	} else if (is_connected) {
+		if (num_backoff_req != 0) {
+			sprintf(connection_status_buf, "%s  %d Not Responding", LV_SYMBOL_REFRESH, num_backoff_req);
+			lv_label_set_text(connection_status_lbl, connection_status_buf);
+		} else {
+			lv_label_set_text_static(connection_status_lbl, LV_SYMBOL_REFRESH);
 		}
+	} else {
+		lv_label_set_text_static(connection_status_lbl, "");
 	}
 }
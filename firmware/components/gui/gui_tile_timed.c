@@ -1,6 +1,7 @@
 /*
- * Timed 0-60MPH/0-100KPH display tile.  Display speed and implement a race-timer like
- * function for timed speed runs.
+ * Timed run display tile.  Display speed and implement a race-timer like function for
+ * timed speed runs: 0-60 MPH/0-100 KPH, 1/4 mile, 60-0 braking and rolling 50-70 MPH.
+ * The best results for each mode are kept in persistent storage with a speed trace.
  *
  * Copyright 2025 Dan Julio
  *
@@ -22,13 +23,19 @@
 #include "data_broker.h"
 #include "esp_system.h"
 #include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "gui_task.h"
+#include "gui_run_trace.h"
 #include "gui_screen_main.h"
 #include "gui_tile_timed.h"
 #include "gui_utilities.h"
+#include "ps_utilities.h"
 #include "vehicle_manager.h"
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 
 
 
@@ -42,20 +49,47 @@
 // Final "Christmas tree" status display time
 #define COUNTDOWN_DONE_MSEC   2000
 
-// Beep intervals
+// Beep lengths (must match the BUZZER_SEQ_COUNTDOWN and BUZZER_SEQ_GO sequences)
 #define COUNTDOWN_BEEP_MSEC   150
 #define TEST_GO_BEEP_MSEC     500
-#define TEST_END_BEEP_MSEC    500
 
-// Timer state evaluation interval (LVGL system must evaluate timers at this rate or faster)
+// Run state evaluation interval (esp_timer) and run display update interval (LVGL timer)
 #define TIMER_EVAL_MSEC       10
+#define TIMER_DISP_MSEC       30
 
-// Maximum timer value (speed test ends after this period without reaching 60 MPH)
-#define TEST_TIMEOUT_MSEC     (15 * 1000)
+// Freshness goals (mSec) of the displayed items
+static const vm_goal_t tile_goals[] = {
+	{DB_ITEM_SPEED, 80},
+	{DB_ITEM_FUSED_SPEED, 80}
+};
+static const vm_goal_list_t tile_goal_list = VM_GOAL_LIST(tile_goals);
 
-// Speed goal
-#define TEST_END_MPH          60
-#define TEST_END_KPH          100
+// Run requests from the GUI
+#define RUN_REQ_NONE          0
+#define RUN_REQ_TRIGGER       1
+#define RUN_REQ_STARTERR      2
+
+// State changes that may be posted to the GUI between display updates
+#define RUN_EVT_QUEUE_LEN     8
+
+// Time allowed for a rolling or braking run to begin after it is armed
+#define ARM_TIMEOUT_MSEC      (60 * 1000)
+
+// Run modes (must match PS_RUN_NUM_MODES)
+#define RUN_MODE_ACCEL        0
+#define RUN_MODE_QUARTER      1
+#define RUN_MODE_BRAKING      2
+#define RUN_MODE_ROLLING      3
+#define RUN_NUM_MODES         4
+
+// Quarter mile
+#define QUARTER_MILE_M        402.336
+
+// Speed (kph) above which the vehicle is considered to have launched
+#define RUN_LAUNCH_KPH        1.0
+
+// Speed history scanned for crossings (must cover several evaluation intervals)
+#define RUN_HIST_SAMPLES      128
 
 // Speedometer range based on units
 #define METER_RANGE_MPH       100
@@ -74,6 +108,7 @@
 #define TIMER_STATE_RUNNING2  9
 #define TIMER_STATE_DONE      10
 #define TIMER_STATE_ERROR     11
+#define TIMER_STATE_ARMED     12
 
 // "Christmas tree" LED brightnesses
 #define XMAS_LED_BRIGHT       255
@@ -88,9 +123,45 @@
 
 
 
+//
+// Local typedefs
+//
+
+// Run mode definition.  Speeds are in the units the mode is named in.  A run starts when
+// speed crosses start_speed in the start direction and ends when it crosses end_speed in
+// the end direction, or when dist_m has been covered (if non-zero).
+typedef struct {
+	const char* name_imperial;
+	const char* name_metric;
+	float start_mph, start_kph;          // 0 = launch from rest
+	bool start_up;
+	float end_mph, end_kph;
+	bool end_up;
+	float dist_m;
+	bool countdown;                      // Start from rest with the "Christmas tree"
+	bool best_by_dist;                   // Best run is shortest distance instead of time
+	uint32_t timeout_msec;               // From start of run
+	uint16_t trace_msec;
+} run_mode_t;
+
+// State change posted from the run evaluation to the GUI
+typedef struct {
+	int state;
+	uint32_t time_msec;                  // Run time to display for DONE and ERROR
+} run_evt_t;
+
+
+
 //
 // Local Variables
 //
+static const run_mode_t run_modes[RUN_NUM_MODES] = {
+	{"0-60",   "0-100",  0,  0,   true,  60, 100, true,  0,             true,  false, 15000, 200},
+	{"1/4 mi", "402 m",  0,  0,   true,  0,  0,   true,  QUARTER_MILE_M, true,  false, 30000, 400},
+	{"60-0",   "100-0",  60, 100, false, 0,  0,   false, 0,             false, true,  15000, 100},
+	{"50-70",  "80-120", 50, 80,  true,  70, 120, true,  0,             false, false, 15000, 150}
+};
+
 static lv_obj_t* tile;
 
 static lv_obj_t* meter_speed;
@@ -100,6 +171,8 @@ static lv_obj_t* speed_val_lbl;
 static lv_obj_t* timer_lbl;           // Format SEC.HUNDREDS - 4.2
 static lv_obj_t* start_btn;
 static lv_obj_t* start_btn_lbl;
+static lv_obj_t* mode_btn;
+static lv_obj_t* mode_btn_lbl = NULL;
 
 static lv_obj_t* led_a1;
 static lv_obj_t* led_a2;
@@ -107,37 +180,70 @@ static lv_obj_t* led_a3;
 static lv_obj_t* led_g;
 static lv_obj_t* led_r;
 
-static lv_anim_t speed_animation;   // Animator for smooth meter movement between values
+static gui_num_label_t speed_val_nl;
+static gui_num_label_t timer_nl;
+
+static gui_gauge_anim_t speed_animation;   // Animator for smooth meter movement between values
 
-static lv_timer_t* beep_timer = NULL;
-static lv_timer_t* run_eval_timer = NULL;
+// Run evaluation (esp_timer task) and display (GUI) share the run state under run_mutex.
+// The evaluation only tries the mutex so it never blocks the esp_timer task.
+static esp_timer_handle_t run_eval_timer = NULL;
+static lv_timer_t* run_disp_timer = NULL;
+static SemaphoreHandle_t run_mutex;
+static QueueHandle_t run_evt_queue;
+static volatile int run_request = RUN_REQ_NONE;
 
 // Vehicle capability flags
 static bool has_speed;
+static bool has_fused;               // IMU fused speed available (checked when activated)
+static bool has_history;             // Timing item history available for crossing detection
+static bool has_accel;               // IMU longitudinal acceleration recorded in run traces
 
 // Meter upper range
 static int16_t meter_range;
 
-// Speed test goal in selected units
-static int32_t speed_goal;
+// Run history
+static run_history_t* run_historyP;
 
 // State
 static bool units_metric;
 static bool false_start;
 static int timer_state;
-static int timer_countdown;
+static int64_t state_deadline_usec;  // When the current state ends
+static uint32_t run_time_msec;       // Final (or error) run time
 static uint16_t tile_w;
 static uint16_t tile_h;
 static int32_t speed;                // KPH or MPH
 static uint32_t elapsed_deciseconds;
 static int64_t start_timestamp;      // ESP32 system uSec since start
 
+// Current run mode and its thresholds in kph
+static int run_mode = RUN_MODE_ACCEL;
+static float run_start_kph;
+static float run_end_kph;
+
+// Crossing detection from the timing item's (fused or OBD speed) samples
+static int run_item;
+static bool run_scanning;            // Samples are being evaluated for the current run
+static uint32_t run_write_count;     // History samples already scanned
+static bool run_prev_valid;          // Previous sample (for interpolating a crossing)
+static float run_prev_kph;
+static int64_t run_prev_usec;
+static int64_t run_launch_timestamp; // Interpolated crossing times (0 = not yet)
+static int64_t run_goal_timestamp;
+static double run_dist_m;            // Distance since the start crossing
+static float run_end_speed_kph;
+static int64_t run_sample_usec;      // Timestamp of the last sample evaluated without history
+static run_result_t run_result;      // Result and trace being built for the current run
+static int64_t run_next_trace_usec;
+
 
 
 //
 // Forward declarations for internal functions
 //
 static void _gui_tile_timed_set_active(bool en);
+static void _gui_tile_timed_set_content(bool build);
 static void _gui_tile_timed_setup_vehicle();
 static void _gui_tile_timed_setup_speed_meter();
 static void _gui_tile_timed_setup_timer_display();
@@ -147,12 +253,20 @@ static void _gui_tile_timed_update_speed_meter(int32_t val, bool immediate);
 static void _gui_tile_timed_set_speed_meter_cb(void* indic, int32_t val);
 static void _gui_tile_timed_update_timer_display(uint32_t msec);
 static void _gui_tile_timed_update_xmas_tree(int state);
-static void _gui_tile_timed_start_beep(uint32_t period);
 static void _gui_tile_timed_btn_cb(lv_event_t* e);
-static void _gui_tile_timed_beep_timer_cb(lv_timer_t* timer);
-static void _gui_tile_timed_run_timer_cb(lv_timer_t* timer);
-static void _gui_tile_timed_set_timer_state(int state);
+static void _gui_tile_timed_run_timer_cb(void* arg);
+static void _gui_tile_timed_set_timer_state(int state, int64_t base_usec);
+static void _gui_tile_timed_run_disp_timer_cb(lv_timer_t* timer);
+static void _gui_tile_timed_show_timer_state(const run_evt_t* evtP);
 static void _gui_tile_timed_speed_cb(float val);
+static void _gui_tile_timed_set_mode(int mode);
+static void _gui_tile_timed_update_mode_label();
+static void _gui_tile_timed_scan_run(bool reset);
+static void _gui_tile_timed_run_sample(float v, int64_t ts_usec);
+static void _gui_tile_timed_trace_sample(float v, int64_t ts_usec);
+static int64_t _gui_tile_timed_crossing(float thresh, float v0, int64_t t0, float v1, int64_t t1);
+static bool _gui_tile_timed_crossed(float thresh, bool up, float v0, float v1);
+static void _gui_tile_timed_record_result(uint32_t time_msec);
 
 
 
@@ -175,24 +289,38 @@ void gui_tile_timed_init(lv_obj_t* parent_tileview, int* tile_index)
 	
 	// Then set units-specific items before we create meters
 	meter_range = (units_metric) ? METER_RANGE_KPH : METER_RANGE_MPH;
-	speed_goal = (units_metric) ? TEST_END_KPH : TEST_END_MPH;
 	
-	// Create display objects
+	// Best runs so far
+	if (!ps_get_config(PS_CONFIG_TYPE_RUNS, (void**) &run_historyP)) {
+		run_historyP = NULL;
+	}
+	_gui_tile_timed_set_mode(RUN_MODE_ACCEL);
+	
 	if (has_speed) {
-		_gui_tile_timed_setup_speed_meter();
-		_gui_tile_timed_setup_timer_display();
-		_gui_tile_timed_setup_start_btn();
-		_gui_tile_timed_setup_xmas_tree();
-		
-		// Create our evaluation timer
-		run_eval_timer = lv_timer_create(_gui_tile_timed_run_timer_cb, TIMER_EVAL_MSEC, NULL);
-		lv_timer_set_repeat_count(run_eval_timer, -1);
-		lv_timer_pause(run_eval_timer);
+		// Create our evaluation and display timers (runs can't be timed without them)
+		const esp_timer_create_args_t run_timer_args = {
+			.callback = &_gui_tile_timed_run_timer_cb,
+			.name = "run_eval"
+		};
+		run_mutex = xSemaphoreCreateMutex();
+		run_evt_queue = xQueueCreate(RUN_EVT_QUEUE_LEN, sizeof(run_evt_t));
+		if ((run_mutex == NULL) || (run_evt_queue == NULL) ||
+		    (esp_timer_create(&run_timer_args, &run_eval_timer) != ESP_OK)) {
+			has_speed = false;
+		} else {
+			run_disp_timer = lv_timer_create(_gui_tile_timed_run_disp_timer_cb, TIMER_DISP_MSEC, NULL);
+			lv_timer_set_repeat_count(run_disp_timer, -1);
+			lv_timer_pause(run_disp_timer);
+			
+			// Runs are still timed if their traces can't be captured
+			(void) gui_run_trace_init();
+		}
 	}
 	
 	// Register ourselves with our parent if we're capable of displaying something
+	// (it has us create our display objects when we're about to be displayed)
 	if (has_speed) {
-		gui_screen_main_register_tile(tile, _gui_tile_timed_set_active);
+		gui_screen_main_register_tile(tile, _gui_tile_timed_set_active, _gui_tile_timed_set_content, DB_MASK(DB_ITEM_SPEED));
 	}
 }
 
@@ -203,48 +331,90 @@ void gui_tile_timed_init(lv_obj_t* parent_tileview, int* tile_index)
 //
 static void _gui_tile_timed_set_active(bool en)
 {
-	uint32_t req_mask = 0;
+	db_mask_t req_mask = 0;
 	
 	if (en) {		
 		// Setup to receive data we require
 		if (has_speed) {
 			db_register_gui_callback(DB_ITEM_SPEED, _gui_tile_timed_speed_cb);
-			req_mask |= DB_ITEM_SPEED;
+			req_mask |= DB_MASK(DB_ITEM_SPEED);
+			
+			// Time runs from IMU fused speed when it's available (on-board items appear after
+			// the IMU has calibrated so this is checked each time we're displayed)
+			has_fused = ((vm_get_supported_item_mask() & DB_MASK(DB_ITEM_FUSED_SPEED)) != 0) &&
+			            db_enable_history(DB_ITEM_FUSED_SPEED, RUN_HIST_SAMPLES);
+			if (has_fused) {
+				req_mask |= DB_MASK(DB_ITEM_FUSED_SPEED);
+			}
+			run_item = (has_fused) ? DB_ITEM_FUSED_SPEED : DB_ITEM_SPEED;
+			has_history = db_enable_history(run_item, RUN_HIST_SAMPLES);
+			has_accel = (vm_get_supported_item_mask() & DB_MASK(DB_ITEM_LONG_ACCEL)) != 0;
+			if (has_accel) {
+				req_mask |= DB_MASK(DB_ITEM_LONG_ACCEL);
+			}
 
 			// Start data flow
 			vm_set_request_item_mask(req_mask);
-			
-			// Start our evaluation timer
-			lv_timer_resume(run_eval_timer);
+			vm_set_request_goals(&tile_goal_list);
 			
 			// Set initial state
 			speed = 0;
 			timer_state = TIMER_STATE_IDLE;
+			run_request = RUN_REQ_NONE;
+			run_scanning = false;
+			xQueueReset(run_evt_queue);
 			_gui_tile_timed_update_speed_meter(0, true);
 			_gui_tile_timed_update_timer_display(0);
 			_gui_tile_timed_update_xmas_tree(XMAS_STATE_OFF);
+			
+			// Start our evaluation and display timers
+			lv_timer_resume(run_disp_timer);
+			(void) esp_timer_start_periodic(run_eval_timer, TIMER_EVAL_MSEC * 1000);
 		}
 		
 		// Never enable averaging for this tile because we want fastest speed update possible
-		db_enable_fast_average(false);	
+		db_set_filter_profile(req_mask, false);
 		
 		// Initialize the update interval timer for meter animations (this will change
 		// to reflect real system timing)
-		gui_utility_init_update_time(100);
+		gui_utility_init_update_time(100, req_mask);
+	} else {
+		// Stop our evaluation and display timers (waiting out an evaluation in progress)
+		(void) esp_timer_stop(run_eval_timer);
+		lv_timer_pause(run_disp_timer);
+		xSemaphoreTake(run_mutex, portMAX_DELAY);
+		xSemaphoreGive(run_mutex);
+		
+		// Abandon any run in progress
+		vm_set_request_profile(VM_PROFILE_NORMAL);
+	}
+}
+
+
+static void _gui_tile_timed_set_content(bool build)
+{
+	if (build) {
+		_gui_tile_timed_setup_speed_meter();
+		_gui_tile_timed_setup_timer_display();
+		_gui_tile_timed_setup_start_btn();
+		_gui_tile_timed_setup_xmas_tree();
+		_gui_tile_timed_update_mode_label();
 	} else {
-		// Pause our evaluation timer
-		lv_timer_pause(run_eval_timer);
+		// Only torn down while not displayed so the evaluation timer is already paused
+		gui_utility_stop_gauge_anim(&speed_animation);
+		lv_obj_clean(tile);
+		mode_btn_lbl = NULL;
 	}
 }
 
 
 static void _gui_tile_timed_setup_vehicle()
 {
-	uint32_t capability_mask;
+	db_mask_t capability_mask;
 	
 	capability_mask = vm_get_supported_item_mask();
 	
-	has_speed = (capability_mask & DB_ITEM_SPEED) != 0;
+	has_speed = (capability_mask & DB_MASK(DB_ITEM_SPEED)) != 0;
 }
 
 
@@ -274,31 +444,35 @@ static void _gui_tile_timed_setup_speed_meter()
     lv_arc_set_rotation(speed_arc, 135);
 	lv_arc_set_bg_angles(speed_arc, 0, 270);
 	lv_arc_set_range(speed_arc, 0, meter_range);
-	lv_obj_set_style_bg_color(speed_arc, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_INDICATOR);
+	lv_obj_add_style(speed_arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
 	lv_obj_remove_style(speed_arc, NULL, LV_PART_KNOB);
 	lv_obj_clear_flag(speed_arc, LV_OBJ_FLAG_CLICKABLE);
 	lv_obj_set_style_arc_color(speed_arc, lv_palette_main(LV_PALETTE_GREEN), LV_PART_INDICATOR);
 	
 	// Label the meter with its units
 	speed_val_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&speed_val_nl, speed_val_lbl);
 	lv_label_set_long_mode(speed_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(speed_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(speed_val_lbl, &lv_font_montserrat_30, LV_PART_MAIN);
+	lv_obj_add_style(speed_val_lbl, gui_utility_get_style(GUI_STYLE_READOUT), LV_PART_MAIN);
 //	lv_obj_align(speed_val_lbl, LV_ALIGN_BOTTOM_MID, 0, -20);
 	lv_obj_align(speed_val_lbl, LV_ALIGN_CENTER, 0, -(tile_h/4) + 10);
 	
 	// Initialize the meter to 0
 	speed = -1.0;   // Force update
+	gui_utility_init_gauge_anim(&speed_animation, speed_arc, _gui_tile_timed_set_speed_meter_cb, 0);
 	_gui_tile_timed_update_speed_meter(0, true);
+	
+	// Scale and range arcs are static so draw them from a cached image
+	meter_speed = gui_utility_cache_meter(meter_speed);
 }
 
 
 static void _gui_tile_timed_setup_timer_display()
 {
 	timer_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&timer_nl, timer_lbl);
 	lv_label_set_long_mode(timer_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(timer_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(timer_lbl, &lv_font_montserrat_48, LV_PART_MAIN);
+	lv_obj_add_style(timer_lbl, gui_utility_get_style(GUI_STYLE_READOUT_LARGE), LV_PART_MAIN);
 //	lv_obj_align(timer_lbl, LV_ALIGN_CENTER, 0, -(tile_h/4) + 60);
 	lv_obj_align(timer_lbl, LV_ALIGN_CENTER, 0, -40);
 	
@@ -322,6 +496,18 @@ static void _gui_tile_timed_setup_start_btn()
 	lv_obj_set_style_text_font(start_btn_lbl, &lv_font_montserrat_30, LV_PART_MAIN);
 	lv_label_set_text(start_btn_lbl, "Start");
 	lv_obj_center(start_btn_lbl);
+	
+	// Transparent button between the LEDs and start button selects the run mode
+	mode_btn = lv_btn_create(tile);
+	lv_obj_set_size(mode_btn, tile_w / 2, btn_h * 3 / 4);
+	lv_obj_set_style_bg_opa(mode_btn, LV_OPA_TRANSP, LV_PART_MAIN);
+	lv_obj_set_style_shadow_width(mode_btn, 0, LV_PART_MAIN);
+	lv_obj_add_event_cb(mode_btn, _gui_tile_timed_btn_cb, LV_EVENT_ALL, NULL);
+	lv_obj_align(mode_btn, LV_ALIGN_CENTER, 0, 75);
+	
+	mode_btn_lbl = lv_label_create(mode_btn);
+	lv_obj_set_style_text_font(mode_btn_lbl, &lv_font_montserrat_18, LV_PART_MAIN);
+	lv_obj_center(mode_btn_lbl);
 }
 
 
@@ -362,46 +548,22 @@ static void _gui_tile_timed_setup_xmas_tree()
 
 static void _gui_tile_timed_update_speed_meter(int32_t val, bool immediate)
 {
-	static char speed_str[16];
-	uint32_t anim_time;
-	
 	// Update the label immediately
-	if (units_metric) {
-		sprintf(speed_str, "%ld kph", val);
-	} else {	
-		sprintf(speed_str, "%ld mph", val);
-	}
-	lv_label_set_text_static(speed_val_lbl, speed_str);
+	gui_utility_set_num_label(&speed_val_nl, val, 0, units_metric ? " kph" : " mph");
 	
-	if (immediate) {
-		_gui_tile_timed_set_speed_meter_cb(speed_arc, val);
-	} else {
-		// Stop any previous animations
-		lv_anim_del(speed_arc, _gui_tile_timed_set_speed_meter_cb);
-		
-		// Start an animation to the new value for the meter indicator
-		anim_time = gui_utility_get_update_period() - 20;   // Just slightly faster than the average update interval
-		lv_anim_init(&speed_animation);
-		lv_anim_set_exec_cb(&speed_animation, _gui_tile_timed_set_speed_meter_cb);
-		lv_anim_set_var(&speed_animation, speed_arc);
-		lv_anim_set_time(&speed_animation, anim_time);
-		lv_anim_set_values(&speed_animation, speed, val);
-		lv_anim_start(&speed_animation);
-	}
+	// Move the meter indicator to the new value (smoothly unless immediate)
+	gui_utility_set_gauge_anim(&speed_animation, val, immediate);
 }
 
 
 static void _gui_tile_timed_set_speed_meter_cb(void* indic, int32_t val)
 {
-	lv_arc_set_value(speed_arc, (int16_t) val);
+	gui_utility_set_arc_value(speed_arc, (int16_t) val);
 }
 
 
 static void _gui_tile_timed_update_timer_display(uint32_t msec)
 {
-	static char buf[32];  // Room for 2 32-bit integers (keep compiler happy) but we expect "XX.X sec"
-	uint32_t sec;
-	uint32_t msec_100;
 	uint32_t decisecond;
 	
 	// Displayed time operates in 100 mSec increments
@@ -413,10 +575,7 @@ static void _gui_tile_timed_update_timer_display(uint32_t msec)
 	
 	if (decisecond != elapsed_deciseconds) {
 		// Update displayed value
-		sec = decisecond / 10;
-		msec_100 = decisecond % 10;
-		sprintf(buf, "%lu.%lu sec", sec, msec_100);
-		lv_label_set_text_static(timer_lbl, buf);
+		gui_utility_set_num_label(&timer_nl, (int32_t) decisecond, 1, " sec");
 		elapsed_deciseconds = decisecond;
 	}
 }
@@ -471,59 +630,75 @@ static void _gui_tile_timed_update_xmas_tree(int state)
 }
 
 
-static void _gui_tile_timed_start_beep(uint32_t period)
-{
-	
-	beep_timer = lv_timer_create(_gui_tile_timed_beep_timer_cb, period, NULL);
-	lv_timer_set_repeat_count(beep_timer, 1);
-	Buzzer_On();
-}
-
-
 static void _gui_tile_timed_btn_cb(lv_event_t* e)
 {
 	lv_event_code_t code = lv_event_get_code(e);
+	lv_obj_t* obj = lv_event_get_target(e);
 	
 	if (code == LV_EVENT_CLICKED) {
 		if (timer_state == TIMER_STATE_IDLE) {
-			if (speed == 0) {
-				// Start timed speed run
-				_gui_tile_timed_set_timer_state(TIMER_STATE_TRIGGERED);
+			if (obj == mode_btn) {
+				xSemaphoreTake(run_mutex, portMAX_DELAY);
+				_gui_tile_timed_set_mode((run_mode + 1) % RUN_NUM_MODES);
+				xSemaphoreGive(run_mutex);
+			} else if ((speed == 0) || !run_modes[run_mode].countdown) {
+				// Start timed speed run (standing starts must be from rest)
+				run_request = RUN_REQ_TRIGGER;
 			} else {
 				// Note start error
-				_gui_tile_timed_set_timer_state(TIMER_STATE_STARTERR1);
+				run_request = RUN_REQ_STARTERR;
 			}
 		}
 	}
 }
 
 
-static void _gui_tile_timed_beep_timer_cb(lv_timer_t* timer)
+// Runs in the esp_timer task every TIMER_EVAL_MSEC so run timing doesn't depend on the
+// rendering load.  States end at deadlines (chained from the previous deadline) so a late
+// evaluation doesn't stretch the countdown.
+static void _gui_tile_timed_run_timer_cb(void* arg)
 {
-	Buzzer_Off();
-}
-
-
-static void _gui_tile_timed_run_timer_cb(lv_timer_t* timer)
-{
-	int64_t cur_timestamp;
-	uint32_t delta_t;
+	int64_t cur_usec;
+	int64_t ts_usec;
+	float v;
 	
-	// Evaluate start-of-run_eval_timer
-	if ((timer_state != TIMER_STATE_IDLE) && (start_timestamp == 0) && (speed > 0)) {
-		start_timestamp = esp_timer_get_time();  // uSec
+	// The GUI is using the run state so evaluate on the next interval
+	if (xSemaphoreTake(run_mutex, 0) != pdTRUE) {
+		return;
 	}
+	cur_usec = esp_timer_get_time();
 	
-	// Evaluate false start
-	if ((timer_state != TIMER_STATE_IDLE) && (timer_state < TIMER_STATE_A3) && (speed > 0)) {
-		false_start = true;
+	// Start requests from the GUI
+	if (run_request != RUN_REQ_NONE) {
+		if (timer_state == TIMER_STATE_IDLE) {
+			_gui_tile_timed_set_timer_state((run_request == RUN_REQ_TRIGGER) ? TIMER_STATE_TRIGGERED : TIMER_STATE_STARTERR1, cur_usec);
+		}
+		run_request = RUN_REQ_NONE;
 	}
 	
-	// Evaluate timer display update
-	if ((timer_state >= TIMER_STATE_TRIGGERED) && (timer_state <= TIMER_STATE_RUNNING2) && (start_timestamp > 0)) {
-		cur_timestamp = esp_timer_get_time();
-		delta_t = (cur_timestamp - start_timestamp) / 1000;
-		_gui_tile_timed_update_timer_display(delta_t);
+	// Evaluate samples acquired since the last evaluation for the start and end of the run.
+	// Crossing times are interpolated between the samples either side of each threshold so
+	// they are much finer than the sample interval (fused speed is also sampled at the IMU
+	// rate).  Without history the newest sample is evaluated when its timestamp changes.
+	if (has_history) {
+		_gui_tile_timed_scan_run(false);
+	} else if (run_scanning && db_get_data_item(run_item, &v, &ts_usec) && (ts_usec != run_sample_usec)) {
+		run_sample_usec = ts_usec;
+		_gui_tile_timed_run_sample(v, ts_usec);
+	}
+	
+	// Evaluate start-of-run
+	if ((timer_state != TIMER_STATE_IDLE) && (start_timestamp == 0) && (run_launch_timestamp != 0)) {
+		// uSec when the vehicle crossed the start speed
+		start_timestamp = run_launch_timestamp;
+		if (timer_state == TIMER_STATE_ARMED) {
+			_gui_tile_timed_set_timer_state(TIMER_STATE_RUNNING2, start_timestamp);
+		}
+	}
+	
+	// Evaluate false start
+	if (run_modes[run_mode].countdown && (timer_state != TIMER_STATE_IDLE) && (timer_state < TIMER_STATE_A3) && (run_launch_timestamp != 0)) {
+		false_start = true;
 	}
 	
 	// Evaluate state
@@ -532,136 +707,220 @@ static void _gui_tile_timed_run_timer_cb(lv_timer_t* timer)
 			// Wait here to be triggered
 			break;
 		case TIMER_STATE_STARTERR1:
-			if (--timer_countdown == 0) {
-				_gui_tile_timed_set_timer_state(TIMER_STATE_STARTERR2);
+			if (cur_usec >= state_deadline_usec) {
+				_gui_tile_timed_set_timer_state(TIMER_STATE_STARTERR2, state_deadline_usec);
 			}
 			break;
 		case TIMER_STATE_STARTERR2:
-			if (--timer_countdown == 0) {
-				_gui_tile_timed_set_timer_state(TIMER_STATE_STARTERR3);
+			if (cur_usec >= state_deadline_usec) {
+				_gui_tile_timed_set_timer_state(TIMER_STATE_STARTERR3, state_deadline_usec);
 			}
 			break;
 		case TIMER_STATE_STARTERR3:
-			if (--timer_countdown == 0) {
-				_gui_tile_timed_set_timer_state(TIMER_STATE_IDLE);
+			if (cur_usec >= state_deadline_usec) {
+				_gui_tile_timed_set_timer_state(TIMER_STATE_IDLE, state_deadline_usec);
 			}
 			break;
 		case TIMER_STATE_TRIGGERED:
-			if (--timer_countdown == 0) {
-				_gui_tile_timed_set_timer_state(TIMER_STATE_A1);
+			if (cur_usec >= state_deadline_usec) {
+				if (run_modes[run_mode].countdown) {
+					_gui_tile_timed_set_timer_state(TIMER_STATE_A1, state_deadline_usec);
+				} else {
+					_gui_tile_timed_set_timer_state(TIMER_STATE_ARMED, state_deadline_usec);
+				}
 			}
 			break;
 		case TIMER_STATE_A1:
-			if (--timer_countdown == 0) {
-				_gui_tile_timed_set_timer_state(TIMER_STATE_A2);
+			if (cur_usec >= state_deadline_usec) {
+				_gui_tile_timed_set_timer_state(TIMER_STATE_A2, state_deadline_usec);
 			}
 			break;
 		case TIMER_STATE_A2:
-			if (--timer_countdown == 0) {
-				_gui_tile_timed_set_timer_state(TIMER_STATE_A3);
+			if (cur_usec >= state_deadline_usec) {
+				_gui_tile_timed_set_timer_state(TIMER_STATE_A3, state_deadline_usec);
 			}
 			break;
 		case TIMER_STATE_A3:
-			if (--timer_countdown == 0) {
-				_gui_tile_timed_set_timer_state(TIMER_STATE_RUNNING1);
+			if (cur_usec >= state_deadline_usec) {
+				_gui_tile_timed_set_timer_state(TIMER_STATE_RUNNING1, state_deadline_usec);
 			}
 			break;
 		case TIMER_STATE_RUNNING1:
-			if (--timer_countdown == 0) {
-				_gui_tile_timed_set_timer_state(TIMER_STATE_RUNNING2);
+			if (cur_usec >= state_deadline_usec) {
+				_gui_tile_timed_set_timer_state(TIMER_STATE_RUNNING2, state_deadline_usec);
 			}
 			break;
 		case TIMER_STATE_RUNNING2:
-			if (speed >= speed_goal) {
+			if ((run_goal_timestamp != 0) && (start_timestamp != 0)) {
+				// Final time from when the goal was crossed, not when we noticed it
+				run_time_msec = (uint32_t) ((run_goal_timestamp - start_timestamp) / 1000);
 				if (false_start) {
-					_gui_tile_timed_set_timer_state(TIMER_STATE_ERROR);
+					_gui_tile_timed_set_timer_state(TIMER_STATE_ERROR, cur_usec);
 				} else {
-					_gui_tile_timed_set_timer_state(TIMER_STATE_DONE);
+					_gui_tile_timed_set_timer_state(TIMER_STATE_DONE, cur_usec);
 				}
-			} else if (--timer_countdown == 0) {
+			} else if (cur_usec >= state_deadline_usec) {
 				// Reset the timer display to 0 to let them know this isn't a valid run if they are just too slow
-				_gui_tile_timed_update_timer_display(0);
-				_gui_tile_timed_set_timer_state(TIMER_STATE_ERROR);
+				run_time_msec = 0;
+				_gui_tile_timed_set_timer_state(TIMER_STATE_ERROR, cur_usec);
+			}
+			break;
+		case TIMER_STATE_ARMED:
+			if (cur_usec >= state_deadline_usec) {
+				_gui_tile_timed_set_timer_state(TIMER_STATE_ERROR, cur_usec);
 			}
 			break;
 		case TIMER_STATE_DONE:
 		case TIMER_STATE_ERROR:
-			if (--timer_countdown == 0) {
-				_gui_tile_timed_set_timer_state(TIMER_STATE_IDLE);
+			if (cur_usec >= state_deadline_usec) {
+				_gui_tile_timed_set_timer_state(TIMER_STATE_IDLE, state_deadline_usec);
 			}
 			break;
 		default:
-			_gui_tile_timed_update_timer_display(0);
-			_gui_tile_timed_set_timer_state(TIMER_STATE_IDLE);
+			run_time_msec = 0;
+			_gui_tile_timed_set_timer_state(TIMER_STATE_IDLE, cur_usec);
 	}
+	
+	xSemaphoreGive(run_mutex);
 }
 
 
-static void _gui_tile_timed_set_timer_state(int state)
+// Enter a new state timed from base_usec (the previous state's deadline or the event that
+// caused the change) and post it to the GUI.  Runs in the esp_timer task.
+static void _gui_tile_timed_set_timer_state(int state, int64_t base_usec)
 {
+	run_evt_t evt;
+	
 	switch (state) {
 		case TIMER_STATE_IDLE:
-			_gui_tile_timed_update_xmas_tree(XMAS_STATE_OFF);
+			vm_set_request_profile(VM_PROFILE_NORMAL);
+			run_scanning = false;
 			break;
 		case TIMER_STATE_STARTERR1:
-			// Start dual short-beep to indicate they can't start
-			timer_countdown = COUNTDOWN_BEEP_MSEC / TIMER_EVAL_MSEC;
-			_gui_tile_timed_start_beep(COUNTDOWN_BEEP_MSEC);
+			// Dual short-beep to indicate they can't start (the STARTERR states span it)
+			state_deadline_usec = base_usec + COUNTDOWN_BEEP_MSEC * 1000;
+			Buzzer_Play(BUZZER_SEQ_FALSE_START);
 			break;
 		case TIMER_STATE_STARTERR2:
-			timer_countdown = COUNTDOWN_BEEP_MSEC / TIMER_EVAL_MSEC;
-			break;
 		case TIMER_STATE_STARTERR3:
-			timer_countdown = COUNTDOWN_BEEP_MSEC / TIMER_EVAL_MSEC;
-			_gui_tile_timed_start_beep(COUNTDOWN_BEEP_MSEC);
+			state_deadline_usec = base_usec + COUNTDOWN_BEEP_MSEC * 1000;
 			break;
 		case TIMER_STATE_TRIGGERED:
 			false_start = false;
-			timer_countdown = TEST_GO_BEEP_MSEC / TIMER_EVAL_MSEC;
+			state_deadline_usec = base_usec + TEST_GO_BEEP_MSEC * 1000;
 			start_timestamp = 0;   // Set to a non-zero number when first speed detected
-			_gui_tile_timed_update_timer_display(0);
-			_gui_tile_timed_update_xmas_tree(XMAS_STATE_OFF);
-			_gui_tile_timed_start_beep(TEST_GO_BEEP_MSEC);
+			run_time_msec = 0;
+			
+			// Poll nothing but speed, as fast as possible, until the run is over
+			vm_set_request_profile(VM_PROFILE_PERF_RUN);
+			if (run_modes[run_mode].countdown) {
+				_gui_tile_timed_scan_run(true);
+			}
+			Buzzer_Play(BUZZER_SEQ_GO);
+			break;
+		case TIMER_STATE_ARMED:
+			// Rolling and braking runs begin when the vehicle crosses the start speed
+			state_deadline_usec = base_usec + (int64_t) ARM_TIMEOUT_MSEC * 1000;
+			_gui_tile_timed_scan_run(true);
 			break;
 		case TIMER_STATE_A1:
 			// No beep for A1 since we've just ended a long "start" beep
-			timer_countdown = COUNTDOWN_STEP_MSEC / TIMER_EVAL_MSEC;
-			_gui_tile_timed_update_xmas_tree(XMAS_STATE_A1);
+			state_deadline_usec = base_usec + COUNTDOWN_STEP_MSEC * 1000;
 			break;
 		case TIMER_STATE_A2:
-			timer_countdown = COUNTDOWN_STEP_MSEC / TIMER_EVAL_MSEC;
-			_gui_tile_timed_update_xmas_tree(XMAS_STATE_A2);
-			_gui_tile_timed_start_beep(COUNTDOWN_BEEP_MSEC);
-			break;
 		case TIMER_STATE_A3:
-			timer_countdown = COUNTDOWN_STEP_MSEC / TIMER_EVAL_MSEC;
-			_gui_tile_timed_update_xmas_tree(XMAS_STATE_A3);
-			_gui_tile_timed_start_beep(COUNTDOWN_BEEP_MSEC);
+			state_deadline_usec = base_usec + COUNTDOWN_STEP_MSEC * 1000;
+			Buzzer_Play(BUZZER_SEQ_COUNTDOWN);
 			break;
 		case TIMER_STATE_RUNNING1:
 			// Green LED on
-			timer_countdown = COUNTDOWN_STEP_MSEC / TIMER_EVAL_MSEC;
-			_gui_tile_timed_update_xmas_tree(XMAS_STATE_G);
-			_gui_tile_timed_start_beep(TEST_GO_BEEP_MSEC);
+			state_deadline_usec = base_usec + COUNTDOWN_STEP_MSEC * 1000;
+			Buzzer_Play(BUZZER_SEQ_GO);
 			break;
 		case TIMER_STATE_RUNNING2:
-			// Green LED off
-			timer_countdown = (TEST_TIMEOUT_MSEC - COUNTDOWN_STEP_MSEC) / TIMER_EVAL_MSEC;
+			// Green LED off (timeout from the green light or from the start crossing)
+			if (run_modes[run_mode].countdown) {
+				state_deadline_usec = base_usec + (int64_t) (run_modes[run_mode].timeout_msec - COUNTDOWN_STEP_MSEC) * 1000;
+			} else {
+				state_deadline_usec = base_usec + (int64_t) run_modes[run_mode].timeout_msec * 1000;
+			}
+			break;
+		case TIMER_STATE_DONE:
+		case TIMER_STATE_ERROR:
+			vm_set_request_profile(VM_PROFILE_NORMAL);
+			run_scanning = false;
+			gui_run_trace_end(state == TIMER_STATE_DONE, run_time_msec, run_launch_timestamp);
+			state_deadline_usec = base_usec + COUNTDOWN_DONE_MSEC * 1000;
+			Buzzer_Play(BUZZER_SEQ_GO);
+			break;
+	}
+	
+	timer_state = state;
+	
+	evt.state = state;
+	evt.time_msec = run_time_msec;
+	(void) xQueueSend(run_evt_queue, &evt, 0);
+}
+
+
+// Display state changes posted by the run evaluation and the running time
+static void _gui_tile_timed_run_disp_timer_cb(lv_timer_t* timer)
+{
+	run_evt_t evt;
+	int64_t cur_timestamp;
+	
+	xSemaphoreTake(run_mutex, portMAX_DELAY);
+	
+	while (xQueueReceive(run_evt_queue, &evt, 0) == pdTRUE) {
+		_gui_tile_timed_show_timer_state(&evt);
+	}
+	
+	if ((timer_state >= TIMER_STATE_TRIGGERED) && (timer_state <= TIMER_STATE_RUNNING2) && (start_timestamp > 0)) {
+		cur_timestamp = esp_timer_get_time();
+		_gui_tile_timed_update_timer_display((uint32_t) ((cur_timestamp - start_timestamp) / 1000));
+	}
+	
+	xSemaphoreGive(run_mutex);
+}
+
+
+static void _gui_tile_timed_show_timer_state(const run_evt_t* evtP)
+{
+	switch (evtP->state) {
+		case TIMER_STATE_IDLE:
+		case TIMER_STATE_RUNNING2:
 			_gui_tile_timed_update_xmas_tree(XMAS_STATE_OFF);
 			break;
+		case TIMER_STATE_TRIGGERED:
+			_gui_tile_timed_update_timer_display(0);
+			_gui_tile_timed_update_xmas_tree(XMAS_STATE_OFF);
+			break;
+		case TIMER_STATE_ARMED:
+		case TIMER_STATE_A3:
+			_gui_tile_timed_update_xmas_tree(XMAS_STATE_A3);
+			break;
+		case TIMER_STATE_A1:
+			_gui_tile_timed_update_xmas_tree(XMAS_STATE_A1);
+			break;
+		case TIMER_STATE_A2:
+			_gui_tile_timed_update_xmas_tree(XMAS_STATE_A2);
+			break;
+		case TIMER_STATE_RUNNING1:
+			_gui_tile_timed_update_xmas_tree(XMAS_STATE_G);
+			break;
 		case TIMER_STATE_DONE:
-			timer_countdown = COUNTDOWN_DONE_MSEC / TIMER_EVAL_MSEC;
+			_gui_tile_timed_update_timer_display(evtP->time_msec);
+			_gui_tile_timed_record_result(evtP->time_msec);
+			_gui_tile_timed_update_mode_label();
 			_gui_tile_timed_update_xmas_tree(XMAS_STATE_G);
-			_gui_tile_timed_start_beep(TEST_GO_BEEP_MSEC);
+			gui_run_trace_save();
 			break;
 		case TIMER_STATE_ERROR:
-			timer_countdown = COUNTDOWN_DONE_MSEC / TIMER_EVAL_MSEC;
+			_gui_tile_timed_update_timer_display(evtP->time_msec);
 			_gui_tile_timed_update_xmas_tree(XMAS_STATE_R);
-			_gui_tile_timed_start_beep(TEST_GO_BEEP_MSEC);
+			gui_run_trace_save();
 			break;
 	}
-	
-	timer_state = state;
 }
 
 
@@ -672,10 +931,235 @@ static void _gui_tile_timed_speed_cb(float val)
 	// Use this update to mark the intervals for the meter update timer
 	gui_utility_note_update();
 	
-	s = round((units_metric) ? val : gui_util_kph_to_mph(val));
+	s = lroundf((units_metric) ? val : gui_util_kph_to_mph(val));
 	
 	if (s != speed) {
 		_gui_tile_timed_update_speed_meter(s, false);
 		speed = s;
 	}
 }
+
+
+static void _gui_tile_timed_set_mode(int mode)
+{
+	run_mode = mode;
+	run_start_kph = run_modes[mode].start_kph;
+	run_end_kph = run_modes[mode].end_kph;
+	if (!units_metric) {
+		run_start_kph = run_modes[mode].start_mph * 1.609344;
+		run_end_kph = run_modes[mode].end_mph * 1.609344;
+	}
+	
+	// Launches from rest are detected once the vehicle is moving
+	if (run_start_kph == 0) {
+		run_start_kph = RUN_LAUNCH_KPH;
+	}
+	if (run_end_kph == 0) {
+		run_end_kph = RUN_LAUNCH_KPH;
+	}
+	
+	if (mode_btn_lbl != NULL) {
+		_gui_tile_timed_update_mode_label();
+	}
+}
+
+
+// Mode name and its best result
+static void _gui_tile_timed_update_mode_label()
+{
+	char buf[32];
+	const run_mode_t* mP = &run_modes[run_mode];
+	const run_result_t* bP = (run_historyP != NULL) ? &run_historyP->best[run_mode][0] : NULL;
+	const char* name = (units_metric) ? mP->name_metric : mP->name_imperial;
+	
+	if ((bP == NULL) || !bP->valid) {
+		sprintf(buf, "%s", name);
+	} else if (mP->best_by_dist) {
+		if (units_metric) {
+			sprintf(buf, "%s  best %.1f m", name, bP->dist_cm / 100.0);
+		} else {
+			sprintf(buf, "%s  best %.0f ft", name, bP->dist_cm / 30.48);
+		}
+	} else {
+		sprintf(buf, "%s  best %.2f s", name, bP->time_msec / 1000.0);
+	}
+	lv_label_set_text(mode_btn_lbl, buf);
+}
+
+
+// Look through timing item samples acquired since the last scan for the start and end
+// of the run.  reset starts a new run ignoring any samples already stored.
+static void _gui_tile_timed_scan_run(bool reset)
+{
+	db_hist_view_t view;
+	const db_hist_sample_t* sP;
+	int skip;
+	int new_count;
+	int len;
+	int64_t cur_usec;
+	uint32_t cur_msec;
+	
+	if (reset) {
+		run_scanning = true;
+		run_prev_valid = false;
+		run_launch_timestamp = 0;
+		run_goal_timestamp = 0;
+		run_dist_m = 0;
+		run_end_speed_kph = 0;
+		memset(&run_result, 0, sizeof(run_result_t));
+		run_result.trace_msec = run_modes[run_mode].trace_msec;
+		gui_run_trace_start(run_mode, has_accel);
+		
+		// Without history only samples after this one are evaluated
+		if (!has_history && !db_get_data_item(run_item, NULL, &run_sample_usec)) {
+			run_sample_usec = 0;
+		}
+	}
+	
+	if (!has_history || !db_get_history_view(run_item, &view)) {
+		return;
+	}
+	
+	if (reset) {
+		run_write_count = view.write_count;
+		return;
+	}
+	
+	// Only the newest samples are of interest
+	new_count = (int) (view.write_count - run_write_count);
+	run_write_count = view.write_count;
+	if (!run_scanning) {
+		return;
+	}
+	len = view.seg1_len + view.seg2_len;
+	if (new_count > len) new_count = len;
+	skip = len - new_count;
+	if (db_get_history_overrun(&view) > skip) {
+		skip = db_get_history_overrun(&view);
+	}
+	
+	// History timestamps are the low 32 bits of esp_timer mSec
+	cur_usec = esp_timer_get_time();
+	cur_msec = (uint32_t) (cur_usec / 1000);
+	for (int i=skip; i<len; i++) {
+		sP = (i < view.seg1_len) ? &view.seg1P[i] : &view.seg2P[i - view.seg1_len];
+		_gui_tile_timed_run_sample(DB_HIST_SAMPLE_VAL(sP), cur_usec - (int64_t) (cur_msec - sP->ts_msec) * 1000);
+	}
+}
+
+
+// Evaluate one speed sample (kph) against the current run
+static void _gui_tile_timed_run_sample(float v, int64_t ts_usec)
+{
+	const run_mode_t* mP = &run_modes[run_mode];
+	double seg_m;
+	float long_g;
+	
+	if (run_goal_timestamp != 0) {
+		// Run over
+		return;
+	}
+	
+	// Every sample goes into the downloadable trace with the latest acceleration
+	if (!has_accel || !db_get_data_item(DB_ITEM_LONG_ACCEL, &long_g, NULL)) {
+		long_g = 0;
+	}
+	gui_run_trace_sample(v, long_g, ts_usec);
+	
+	if (run_launch_timestamp == 0) {
+		if (_gui_tile_timed_crossed(run_start_kph, mP->start_up, run_prev_kph, v)) {
+			run_launch_timestamp = _gui_tile_timed_crossing(run_start_kph, run_prev_kph, run_prev_usec, v, ts_usec);
+			
+			// Distance from the crossing to this sample (trapezoid from the start speed)
+			run_dist_m = (double) (run_start_kph + v) / 2.0 / 3.6 * ((double) (ts_usec - run_launch_timestamp) / 1000000.0);
+			run_next_trace_usec = run_launch_timestamp;
+		}
+	} else if (run_prev_valid && (ts_usec > run_prev_usec)) {
+		// Integrate distance over the sample timestamps
+		seg_m = (double) (run_prev_kph + v) / 2.0 / 3.6 * ((double) (ts_usec - run_prev_usec) / 1000000.0);
+		
+		if ((mP->dist_m != 0) && ((run_dist_m + seg_m) >= mP->dist_m)) {
+			// Distance-based run ends part way through this interval
+			run_goal_timestamp = run_prev_usec + (int64_t) ((double) (ts_usec - run_prev_usec) * (mP->dist_m - run_dist_m) / seg_m);
+			run_dist_m = mP->dist_m;
+			run_end_speed_kph = v;
+		} else {
+			run_dist_m += seg_m;
+			if ((mP->dist_m == 0) && _gui_tile_timed_crossed(run_end_kph, mP->end_up, run_prev_kph, v)) {
+				run_goal_timestamp = _gui_tile_timed_crossing(run_end_kph, run_prev_kph, run_prev_usec, v, ts_usec);
+				run_end_speed_kph = v;
+			}
+		}
+	}
+	
+	if (run_launch_timestamp != 0) {
+		_gui_tile_timed_trace_sample(v, ts_usec);
+	}
+	
+	run_prev_valid = true;
+	run_prev_kph = v;
+	run_prev_usec = ts_usec;
+}
+
+
+// Store the speed at each trace interval since the start of the run
+static void _gui_tile_timed_trace_sample(float v, int64_t ts_usec)
+{
+	while ((ts_usec >= run_next_trace_usec) && (run_result.trace_len < PS_RUN_TRACE_LEN)) {
+		run_result.trace_kph10[run_result.trace_len++] = (uint16_t) ((v < 0) ? 0 : (v * 10));
+		run_next_trace_usec += (int64_t) run_result.trace_msec * 1000;
+	}
+}
+
+
+// True if the speed went from v0 to v1 across thresh in the given direction
+static bool _gui_tile_timed_crossed(float thresh, bool up, float v0, float v1)
+{
+	if (up) {
+		// Launches are from rest (checked when started), otherwise must have been below first
+		return (v1 >= thresh) && ((thresh == RUN_LAUNCH_KPH) || (run_prev_valid && (v0 < thresh)));
+	} else {
+		// Must have been seen above the threshold first
+		return run_prev_valid && (v0 > thresh) && (v1 <= thresh);
+	}
+}
+
+
+// Linearly interpolate the time speed crossed thresh between the last sample on one side
+// of it (v0 at t0) and the first on the other (v1 at t1).  Uses t1 if there is no usable
+// earlier sample.
+static int64_t _gui_tile_timed_crossing(float thresh, float v0, int64_t t0, float v1, int64_t t1)
+{
+	if (!run_prev_valid || (v1 == v0) || (t1 <= t0) ||
+	    ((v1 > v0) && (v0 >= thresh)) || ((v1 < v0) && (v0 <= thresh))) {
+		return t1;
+	}
+	
+	return t0 + (int64_t) ((double) (t1 - t0) * (double) (thresh - v0) / (double) (v1 - v0));
+}
+
+
+// Insert a completed run into the mode's best list if it qualifies and save it
+static void _gui_tile_timed_record_result(uint32_t time_msec)
+{
+	run_result_t* listP;
+	int i;
+	
+	if (run_historyP == NULL) return;
+	
+	run_result.valid = true;
+	run_result.time_msec = time_msec;
+	run_result.dist_cm = (uint32_t) (run_dist_m * 100.0);
+	run_result.end_kph10 = (uint16_t) ((run_end_speed_kph < 0) ? 0 : (run_end_speed_kph * 10));
+	
+	listP = run_historyP->best[run_mode];
+	for (i=0; i<PS_RUN_HISTORY_LEN; i++) {
+		if (!listP[i].valid) break;
+		if (run_modes[run_mode].best_by_dist ? (run_result.dist_cm < listP[i].dist_cm) : (run_result.time_msec < listP[i].time_msec)) break;
+	}
+	if (i == PS_RUN_HISTORY_LEN) return;
+	
+	memmove(&listP[i+1], &listP[i], (PS_RUN_HISTORY_LEN - 1 - i) * sizeof(run_result_t));
+	listP[i] = run_result;
+	(void) ps_save_config(PS_CONFIG_TYPE_RUNS);
+}
@@ -36,6 +36,15 @@
 #define FRONT_TORQUE 0
 #define REAR_TORQUE  1
 
+// Freshness goals (mSec) of the displayed items
+static const vm_goal_t tile_goals[] = {
+	{DB_ITEM_FRONT_TORQUE, 100},
+	{DB_ITEM_REAR_TORQUE, 100},
+	{DB_ITEM_SPEED, 250},
+	{DB_ITEM_GPS_ELEVATION, 5000}
+};
+static const vm_goal_list_t tile_goal_list = VM_GOAL_LIST(tile_goals);
+
 
 
 //
@@ -54,7 +63,11 @@ static lv_obj_t* speed_val_lbl;
 
 static lv_obj_t* elevation_val_lbl;
 
-static lv_anim_t torque_animation[2];
+static gui_num_label_t torque_val_nl;
+static gui_num_label_t speed_val_nl;
+static gui_num_label_t elevation_val_nl;
+
+static gui_gauge_anim_t torque_animation[2];
 
 // Vehicle capability flags
 static bool has_torque[2];
@@ -70,6 +83,7 @@ static bool units_metric;
 static uint16_t tile_w;
 static uint16_t tile_h;
 static int32_t torque[2];            // N-m
+static int32_t torque_total;         // N-m displayed
 static int32_t speed;                // KPH or MPH
 static int32_t elevation;            // Meters or Feet
 
@@ -79,6 +93,7 @@ static int32_t elevation;            // Meters or Feet
 // Forward declarations for internal functions
 //
 static void _gui_tile_torque_set_active(bool en);
+static void _gui_tile_torque_set_content(bool build);
 static void _gui_tile_torque_setup_vehicle();
 static void _gui_tile_torque_setup_torque_meter();
 static void _gui_tile_torque_setup_speed_display();
@@ -104,22 +119,14 @@ void gui_tile_torque_init(lv_obj_t* parent_tileview, int* tile_index)
 	// Determine our capabilities
 	_gui_tile_torque_setup_vehicle();
 	
-	// Create display objects
-	if (has_torque[FRONT_TORQUE] || has_torque[REAR_TORQUE]) {
-		_gui_tile_torque_setup_torque_meter();
-	}
-	
-	if (has_speed) {
-		_gui_tile_torque_setup_speed_display();
-	}
-	
-	if (has_elevation) {
-		_gui_tile_torque_setup_elevation_display();
-	}
-	
 	// Register ourselves with our parent if we're capable of displaying something
+	// (it has us create our display objects when we're about to be displayed)
 	if (has_torque[FRONT_TORQUE] || has_torque[REAR_TORQUE]) {
-		gui_screen_main_register_tile(tile, _gui_tile_torque_set_active);
+		gui_screen_main_register_tile(tile, _gui_tile_torque_set_active, _gui_tile_torque_set_content,
+		                              (has_torque[FRONT_TORQUE] ? DB_MASK(DB_ITEM_FRONT_TORQUE) : 0) |
+		                              (has_torque[REAR_TORQUE] ? DB_MASK(DB_ITEM_REAR_TORQUE) : 0) |
+		                              (has_speed ? DB_MASK(DB_ITEM_SPEED) : 0) |
+		                              (has_elevation ? DB_MASK(DB_ITEM_GPS_ELEVATION) : 0));
 	}
 	
 	// Get our display units
@@ -133,33 +140,33 @@ void gui_tile_torque_init(lv_obj_t* parent_tileview, int* tile_index)
 //
 static void _gui_tile_torque_set_active(bool en)
 {
-	uint32_t req_mask = 0;
+	db_mask_t req_mask = 0;
 	
 	if (en) {
 		if (has_torque[FRONT_TORQUE]) {
 			db_register_gui_callback(DB_ITEM_FRONT_TORQUE, _gui_tile_torque_front_cb);
-			req_mask |= DB_ITEM_FRONT_TORQUE;
+			req_mask |= DB_MASK(DB_ITEM_FRONT_TORQUE);
 			torque[FRONT_TORQUE] = 0;
 			_gui_tile_torque_update_torque_meter(0, FRONT_TORQUE, true);
 		}
 		
 		if (has_torque[REAR_TORQUE]) {
 			db_register_gui_callback(DB_ITEM_REAR_TORQUE, _gui_tile_torque_rear_cb);
-			req_mask |= DB_ITEM_REAR_TORQUE;
+			req_mask |= DB_MASK(DB_ITEM_REAR_TORQUE);
 			torque[REAR_TORQUE] = 0;
 			_gui_tile_torque_update_torque_meter(0, REAR_TORQUE, true);
 		}
 		
 		if (has_speed) {
 			db_register_gui_callback(DB_ITEM_SPEED, _gui_tile_torque_speed_cb);
-			req_mask |= DB_ITEM_SPEED;
+			req_mask |= DB_MASK(DB_ITEM_SPEED);
 			speed = 0;
 			_gui_tile_torque_update_speed_display(0);
 		}
 		
 		if (has_elevation) {
 			db_register_gui_callback(DB_ITEM_GPS_ELEVATION, _gui_tile_torque_elevation_cb);
-			req_mask |= DB_ITEM_GPS_ELEVATION;
+			req_mask |= DB_MASK(DB_ITEM_GPS_ELEVATION);
 			elevation = 0;
 			_gui_tile_torque_update_elevation_display(0);
 		}
@@ -167,31 +174,57 @@ static void _gui_tile_torque_set_active(bool en)
 		if (has_torque[FRONT_TORQUE] || has_torque[REAR_TORQUE] || has_speed || has_elevation) {
 			// Start data flow
 			vm_set_request_item_mask(req_mask);
+			vm_set_request_goals(&tile_goal_list);
 		}
 		
-		// Enable averaging for incoming data if we have a fast enough interface
-		db_enable_fast_average(gui_has_fast_interface());
+		// Enable smoothing for incoming data if we have a fast enough interface
+		db_set_filter_profile(req_mask, gui_has_fast_interface());
 		
 		// Initialize the update interval timer for meter animations (this will change
 		// to reflect real system timing)
-		gui_utility_init_update_time(100);
+		gui_utility_init_update_time(100, req_mask);
+	}
+}
+
+
+static void _gui_tile_torque_set_content(bool build)
+{
+	if (build) {
+		if (has_torque[FRONT_TORQUE] || has_torque[REAR_TORQUE]) {
+			torque_total = -1;   // Force the label to be set on the first meter update
+			_gui_tile_torque_setup_torque_meter();
+		}
+		
+		if (has_speed) {
+			_gui_tile_torque_setup_speed_display();
+		}
+		
+		if (has_elevation) {
+			_gui_tile_torque_setup_elevation_display();
+		}
+	} else {
+		gui_utility_stop_gauge_anim(&torque_animation[FRONT_TORQUE]);
+		gui_utility_stop_gauge_anim(&torque_animation[REAR_TORQUE]);
+		lv_obj_clean(tile);
 	}
 }
 
 
 static void _gui_tile_torque_setup_vehicle()
 {
-	uint32_t capability_mask;
+	db_mask_t capability_mask;
 	
 	capability_mask = vm_get_supported_item_mask();
 	
-	has_torque[FRONT_TORQUE] = (capability_mask & DB_ITEM_FRONT_TORQUE) != 0;
-	has_torque[REAR_TORQUE]  = (capability_mask & DB_ITEM_REAR_TORQUE) != 0;
-	has_speed                = (capability_mask & DB_ITEM_SPEED) != 0;
-	has_elevation            = (capability_mask & DB_ITEM_GPS_ELEVATION) != 0;
+	has_torque[FRONT_TORQUE] = (capability_mask & DB_MASK(DB_ITEM_FRONT_TORQUE)) != 0;
+	has_torque[REAR_TORQUE]  = (capability_mask & DB_MASK(DB_ITEM_REAR_TORQUE)) != 0;
+	has_speed                = (capability_mask & DB_MASK(DB_ITEM_SPEED)) != 0;
+	has_elevation            = (capability_mask & DB_MASK(DB_ITEM_GPS_ELEVATION)) != 0;
 	
 	if (has_torque[FRONT_TORQUE] || has_torque[REAR_TORQUE]) {
-		vm_get_range(VM_RANGE_TORQUE, &torque_min, &torque_max);
+		// Front and rear share the scale
+		torque_min = db_catalog_get(has_torque[FRONT_TORQUE] ? DB_ITEM_FRONT_TORQUE : DB_ITEM_REAR_TORQUE)->min;
+		torque_max = db_catalog_get(has_torque[FRONT_TORQUE] ? DB_ITEM_FRONT_TORQUE : DB_ITEM_REAR_TORQUE)->max;
 	}
 }
 
@@ -238,27 +271,27 @@ static void _gui_tile_torque_setup_torque_meter()
 	// Rear torque is outside if both present
 	if (has_torque[REAR_TORQUE]) {
 		// Create a green arc that will act as the positive meter indicator (traction torque)
-		r_torque_pos_arc = lv_arc_create(tile);
+		r_torque_pos_arc = gui_utility_create_gauge_arc(tile);
 		lv_obj_center(r_torque_pos_arc);
 		lv_obj_set_size(r_torque_pos_arc, tile_w-arc_inset, tile_h-arc_inset);
 		lv_arc_set_rotation(r_torque_pos_arc, 135 + (270 * (-meter_min) / (meter_max - meter_min)));
 		lv_arc_set_bg_angles(r_torque_pos_arc, 0, 270 - (270 * (-meter_min) / (meter_max - meter_min)));
 		lv_arc_set_range(r_torque_pos_arc, 0, meter_max);
 		lv_arc_set_value(r_torque_pos_arc, 0);
-		lv_obj_set_style_bg_color(r_torque_pos_arc, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_INDICATOR);
+		lv_obj_add_style(r_torque_pos_arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
 		lv_obj_remove_style(r_torque_pos_arc, NULL, LV_PART_KNOB);
 		lv_obj_clear_flag(r_torque_pos_arc, LV_OBJ_FLAG_CLICKABLE);
 		lv_obj_set_style_arc_color(r_torque_pos_arc, lv_palette_main(LV_PALETTE_GREEN), LV_PART_INDICATOR);
 		
 		// Create a blue arc that will act as the negative meter indicator (regen torque)
-		r_torque_neg_arc = lv_arc_create(tile);
+		r_torque_neg_arc = gui_utility_create_gauge_arc(tile);
 		lv_obj_center(r_torque_neg_arc);
 		lv_obj_set_size(r_torque_neg_arc, tile_w-arc_inset, tile_h-arc_inset);
 		lv_arc_set_rotation(r_torque_neg_arc, 135);
 		lv_arc_set_bg_angles(r_torque_neg_arc, 0, 270 * (-meter_min) / (meter_max - meter_min));
 		lv_arc_set_range(r_torque_neg_arc, 0, -meter_min);
 		lv_arc_set_value(r_torque_neg_arc, 0);
-		lv_obj_set_style_bg_color(r_torque_neg_arc, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_INDICATOR);
+		lv_obj_add_style(r_torque_neg_arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
 		lv_obj_remove_style(r_torque_neg_arc, NULL, LV_PART_KNOB);
 		lv_obj_clear_flag(r_torque_neg_arc, LV_OBJ_FLAG_CLICKABLE);
 		lv_arc_set_mode(r_torque_neg_arc, LV_ARC_MODE_REVERSE);
@@ -268,27 +301,27 @@ static void _gui_tile_torque_setup_torque_meter()
 	
 	if (has_torque[FRONT_TORQUE]) {
 		// Create a teal arc that will act as the positive meter indicator (traction torque)
-		f_torque_pos_arc = lv_arc_create(tile);
+		f_torque_pos_arc = gui_utility_create_gauge_arc(tile);
 		lv_obj_center(f_torque_pos_arc);
 		lv_obj_set_size(f_torque_pos_arc, tile_w-arc_inset, tile_h-arc_inset);
 		lv_arc_set_rotation(f_torque_pos_arc, 135 + (270 * (-meter_min) / (meter_max - meter_min)));
 		lv_arc_set_bg_angles(f_torque_pos_arc, 0, 270 - (270 * (-meter_min) / (meter_max - meter_min)));
 		lv_arc_set_range(f_torque_pos_arc, 0, meter_max);
 		lv_arc_set_value(f_torque_pos_arc, 0);
-		lv_obj_set_style_bg_color(f_torque_pos_arc, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_INDICATOR);
+		lv_obj_add_style(f_torque_pos_arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
 		lv_obj_remove_style(f_torque_pos_arc, NULL, LV_PART_KNOB);
 		lv_obj_clear_flag(f_torque_pos_arc, LV_OBJ_FLAG_CLICKABLE);
 		lv_obj_set_style_arc_color(f_torque_pos_arc, lv_palette_main(LV_PALETTE_TEAL), LV_PART_INDICATOR);
 		
 		// Create a light blue arc that will act as the negative meter indicator (regen torque)
-		f_torque_neg_arc = lv_arc_create(tile);
+		f_torque_neg_arc = gui_utility_create_gauge_arc(tile);
 		lv_obj_center(f_torque_neg_arc);
 		lv_obj_set_size(f_torque_neg_arc, tile_w-arc_inset, tile_h-arc_inset);
 		lv_arc_set_rotation(f_torque_neg_arc, 135);
 		lv_arc_set_bg_angles(f_torque_neg_arc, 0, 270 * (-meter_min) / (meter_max - meter_min));
 		lv_arc_set_range(f_torque_neg_arc, 0, -meter_min);
 		lv_arc_set_value(f_torque_neg_arc, 0);
-		lv_obj_set_style_bg_color(f_torque_neg_arc, lv_palette_main(LV_PALETTE_BLUE_GREY), LV_PART_INDICATOR);
+		lv_obj_add_style(f_torque_neg_arc, gui_utility_get_style(GUI_STYLE_METER_ARC), LV_PART_INDICATOR);
 		lv_obj_remove_style(f_torque_neg_arc, NULL, LV_PART_KNOB);
 		lv_obj_clear_flag(f_torque_neg_arc, LV_OBJ_FLAG_CLICKABLE);
 		lv_arc_set_mode(f_torque_neg_arc, LV_ARC_MODE_REVERSE);
@@ -297,18 +330,22 @@ static void _gui_tile_torque_setup_torque_meter()
 	
 	// Add the label object for the current value
 	torque_val_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&torque_val_nl, torque_val_lbl);
 	lv_label_set_long_mode(torque_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(torque_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(torque_val_lbl, &lv_font_montserrat_30, LV_PART_MAIN);
+	lv_obj_add_style(torque_val_lbl, gui_utility_get_style(GUI_STYLE_READOUT), LV_PART_MAIN);
 	lv_obj_align(torque_val_lbl, LV_ALIGN_CENTER, 0, -(tile_h/4) + 10);
 	
 	// Initialize the meter to 0
 	for (int i=0; i<2; i++) {
 		torque[i] = 0;
 		if (has_torque[i]) {
+			gui_utility_init_gauge_anim(&torque_animation[i], (i == FRONT_TORQUE) ? f_torque_pos_arc : r_torque_pos_arc, _gui_tile_torque_set_torque_meter_cb, 0);
 			_gui_tile_torque_update_torque_meter(0, i, true);
 		}
 	}
+	
+	// Scale and range arcs are static so draw them from a cached image
+	meter_torque = gui_utility_cache_meter(meter_torque);
 }
 
 
@@ -316,9 +353,9 @@ static void _gui_tile_torque_setup_speed_display()
 {
 	// Create the label object for the current voltage value
 	speed_val_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&speed_val_nl, speed_val_lbl);
 	lv_label_set_long_mode(speed_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(speed_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(speed_val_lbl, &lv_font_montserrat_48, LV_PART_MAIN);
+	lv_obj_add_style(speed_val_lbl, gui_utility_get_style(GUI_STYLE_READOUT_LARGE), LV_PART_MAIN);
 	lv_obj_align(speed_val_lbl, LV_ALIGN_CENTER, 0, -40);
 	lv_label_set_text_static(speed_val_lbl, "");  // Blank initially
 }
@@ -328,9 +365,9 @@ static void _gui_tile_torque_setup_elevation_display()
 {
 	// Create the label object for the current temperature value
 	elevation_val_lbl = lv_label_create(tile);
+	gui_utility_init_num_label(&elevation_val_nl, elevation_val_lbl);
 	lv_label_set_long_mode(elevation_val_lbl, LV_LABEL_LONG_WRAP);
-	lv_obj_set_style_text_align(elevation_val_lbl, LV_TEXT_ALIGN_CENTER, 0);
-	lv_obj_set_style_text_font(elevation_val_lbl, &lv_font_montserrat_24, LV_PART_MAIN);
+	lv_obj_add_style(elevation_val_lbl, gui_utility_get_style(GUI_STYLE_VALUE), LV_PART_MAIN);
 	lv_obj_align(elevation_val_lbl, LV_ALIGN_BOTTOM_MID, 0, -60);
 	lv_label_set_text_static(elevation_val_lbl, "");  // Blank initially
 }
@@ -338,10 +375,7 @@ static void _gui_tile_torque_setup_elevation_display()
 
 static void _gui_tile_torque_update_torque_meter(int32_t val, int index, bool immediate)
 {
-	static char torque_lbl[16];             // "-XXX N-m"
-	static int32_t torque_total = -1;       // Force update on first call when creating the meter
 	int32_t new_total = 0;
-	uint32_t anim_time;
 	
 	// Calculate the new total torque
 	for (int i=0; i<2; i++) {
@@ -358,26 +392,12 @@ static void _gui_tile_torque_update_torque_meter(int32_t val, int index, bool im
 	
 	if (new_total != torque_total) {
 		// Update the label immediately
-		sprintf(torque_lbl, "%ld N-m", new_total);
-		lv_label_set_text_static(torque_val_lbl, torque_lbl);
+		gui_utility_set_num_label(&torque_val_nl, new_total, 0, " N-m");
 		torque_total = new_total;
 	}
 	
-	if (immediate) {
-		_gui_tile_torque_set_torque_meter_cb((index == FRONT_TORQUE) ? f_torque_pos_arc : r_torque_pos_arc, val);
-	} else {
-		// Stop any previous animations
-		lv_anim_del((index == FRONT_TORQUE) ? f_torque_pos_arc : r_torque_pos_arc, _gui_tile_torque_set_torque_meter_cb);
-		
-		// Start an animation to the new value for the meter indicator
-		anim_time = gui_utility_get_update_period() - 20;   // Just slightly faster than the average update interval
-		lv_anim_init(&torque_animation[index]);
-		lv_anim_set_exec_cb(&torque_animation[index], _gui_tile_torque_set_torque_meter_cb);
-		lv_anim_set_var(&torque_animation[index], (index == FRONT_TORQUE) ? f_torque_pos_arc : r_torque_pos_arc);
-		lv_anim_set_time(&torque_animation[index], anim_time);
-		lv_anim_set_values(&torque_animation[index], torque[index], val);
-		lv_anim_start(&torque_animation[index]);
-	}
+	// Move the meter indicator to the new value (smoothly unless immediate)
+	gui_utility_set_gauge_anim(&torque_animation[index], val, immediate);
 }
 
 
@@ -388,38 +408,24 @@ static void _gui_tile_torque_set_torque_meter_cb(void* indic, int32_t val)
 	lv_obj_t* neg_arc = (indic == f_torque_pos_arc) ? f_torque_neg_arc : r_torque_neg_arc;
 	
 	if (val < 0) {
-		lv_arc_set_value(pos_arc, 0);
-		lv_arc_set_value(neg_arc, ((int32_t) round(-torque_min)) + val);
+		gui_utility_set_arc_value(pos_arc, 0);
+		gui_utility_set_arc_value(neg_arc, ((int32_t) lroundf(-torque_min)) + val);
 	} else {
-		lv_arc_set_value(neg_arc, (int32_t) round(-torque_min));
-		lv_arc_set_value(pos_arc, val);
+		gui_utility_set_arc_value(neg_arc, (int32_t) lroundf(-torque_min));
+		gui_utility_set_arc_value(pos_arc, val);
 	}
 }
 
 
 static void _gui_tile_torque_update_speed_display(int32_t val)
 {
-	static char speed_lbl[16];             // "XXX km/h"
-	
-	if (units_metric) {
-		sprintf(speed_lbl, "%ld km/h",  val);
-	} else {
-		sprintf(speed_lbl, "%ld mph",  val);
-	}
-	lv_label_set_text_static(speed_val_lbl, speed_lbl);
+	gui_utility_set_num_label(&speed_val_nl, val, 0, units_metric ? " km/h" : " mph");
 }
 
 
 static void _gui_tile_torque_update_elevation_display(int32_t val)
 {
-	static char elevation_lbl[16];             // "XXXXX m" or "XXXXX'"
-	
-	if (units_metric) {
-		sprintf(elevation_lbl, "%ld m",  val);
-	} else {
-		sprintf(elevation_lbl, "%ld'",  val);
-	}
-	lv_label_set_text_static(elevation_val_lbl, elevation_lbl);
+	gui_utility_set_num_label(&elevation_val_nl, val, 0, units_metric ? " m" : "'");
 }
 
 
@@ -432,7 +438,7 @@ static void _gui_tile_torque_front_cb(float val)
 		gui_utility_note_update();
 	}
 	
-	t = round(val);
+	t = lroundf(val);
 	
 	if (t != torque[FRONT_TORQUE]) {
 		_gui_tile_torque_update_torque_meter(t, FRONT_TORQUE, false);
@@ -448,7 +454,7 @@ static void _gui_tile_torque_rear_cb(float val)
 	// Use this update to mark the intervals for the update timer when we have rear torque
 	gui_utility_note_update();
 	
-	t = round(val);
+	t = lroundf(val);
 	
 	if (t != torque[REAR_TORQUE]) {
 		_gui_tile_torque_update_torque_meter(t, REAR_TORQUE, false);
@@ -461,7 +467,7 @@ static void _gui_tile_torque_speed_cb(float val)
 {
 	int32_t s;
 	
-	s = round((units_metric) ? val : gui_util_kph_to_mph(val));
+	s = lroundf((units_metric) ? val : gui_util_kph_to_mph(val));
 	
 	if (s != speed) {
 		_gui_tile_torque_update_speed_display(s);
@@ -474,7 +480,7 @@ static void _gui_tile_torque_elevation_cb(float val)
 {
 	int32_t e;
 	
-	e = round((units_metric) ? val : gui_util_m_to_feet(val));
+	e = lroundf((units_metric) ? val : gui_util_m_to_feet(val));
 	
 	if (e != elevation) {
 		_gui_tile_torque_update_elevation_display(e);
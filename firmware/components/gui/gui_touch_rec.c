@@ -0,0 +1,329 @@
+/*
+ * GUI touch recorder - capture the touch controller's readings with their times to a file
+ * and feed a recording (or a generated swipe script) back through the touch input device
+ * in place of the controller so UI performance can be measured with repeatable gestures.
+ *
+ * The recorder sits between LVGL's pointer input device and the touch driver so gestures
+ * are replayed through the same input device (and gesture, scroll and tile snapping code)
+ * as real touches.  Replay reports the latest event due at each input device read.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "gui_task.h"
+#include "gui_touch_rec.h"
+#include "gui_utilities.h"
+#include "touch_driver.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+//
+// Variables
+//
+static const char* TAG = "gui_touch_rec";
+
+static bool recording = false;
+static bool replaying = false;
+
+// Event buffer (allocated in PSRAM on first use)
+static gui_touch_event_t* eventP = NULL;
+static int num_events;
+
+// Start of the recording or replay
+static int64_t start_usec;
+
+// Ends a timed recording
+static lv_timer_t* rec_timer = NULL;
+
+// Next event to replay
+static int replay_i;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _gui_touch_rec_timer_cb(lv_timer_t* timer);
+static void _gui_touch_rec_add(lv_indev_data_t* data);
+static void _gui_touch_rec_save();
+static bool _gui_touch_rec_load();
+static bool _gui_touch_rec_alloc();
+
+
+
+//
+// API
+//
+
+// Input device read callback used in place of touch_driver_read
+void gui_touch_rec_read_cb(lv_indev_drv_t* drv, lv_indev_data_t* data)
+{
+	gui_touch_event_t* eP;
+	uint32_t t_msec;
+	
+	if (replaying) {
+		t_msec = (uint32_t) ((esp_timer_get_time() - start_usec) / 1000);
+		while ((replay_i < num_events) && (eventP[replay_i].t_msec <= t_msec)) {
+			replay_i += 1;
+		}
+	
+		// Released at the first point until the first event is due
+		eP = &eventP[(replay_i == 0) ? 0 : (replay_i - 1)];
+		data->point.x = eP->x;
+		data->point.y = eP->y;
+		data->state = ((replay_i != 0) && eP->pressed) ? LV_INDEV_STATE_PRESSED : LV_INDEV_STATE_RELEASED;
+		data->continue_reading = false;
+	
+		if ((replay_i == num_events) && (data->state == LV_INDEV_STATE_RELEASED)) {
+			ESP_LOGI(TAG, "Replay done");
+			replaying = false;
+		}
+		return;
+	}
+	
+	touch_driver_read(drv, data);
+	if (recording) {
+		_gui_touch_rec_add(data);
+	}
+}
+
+
+// Record touches until gui_touch_rec_stop is called, the buffer fills or msec have
+// passed (if msec > 0).  The recording is saved to GUI_TOUCH_REC_FILE.
+bool gui_touch_rec_start(int msec)
+{
+	if (recording || replaying || !_gui_touch_rec_alloc()) {
+		return false;
+	}
+	
+	if (msec > 0) {
+		rec_timer = lv_timer_create(_gui_touch_rec_timer_cb, msec, NULL);
+		lv_timer_set_repeat_count(rec_timer, 1);
+	}
+	
+	ESP_LOGI(TAG, "Recording touches");
+	num_events = 0;
+	start_usec = esp_timer_get_time();
+	recording = true;
+	
+	return true;
+}
+
+
+void gui_touch_rec_stop()
+{
+	if (!recording) {
+		return;
+	}
+	
+	recording = false;
+	if (rec_timer != NULL) {
+		lv_timer_del(rec_timer);
+		rec_timer = NULL;
+	}
+	
+	_gui_touch_rec_save();
+}
+
+
+// Replay the saved recording.  Returns false if there isn't one.
+bool gui_touch_replay_start_file()
+{
+	if (recording || replaying || !_gui_touch_rec_alloc()) {
+		return false;
+	}
+	
+	if (!_gui_touch_rec_load()) {
+		return false;
+	}
+	
+	ESP_LOGI(TAG, "Replay %s: %d events, %lu mSec", GUI_TOUCH_REC_FILE, num_events, eventP[num_events-1].t_msec);
+	replay_i = 0;
+	start_usec = esp_timer_get_time();
+	replaying = true;
+	
+	return true;
+}
+
+
+// Replay a script of right-to-left swipes (each advancing the main screen one tile)
+bool gui_touch_replay_start_swipes(int num_swipes)
+{
+	gui_touch_event_t* eP;
+	uint16_t w, h;
+	uint32_t t_msec = 0;
+	int steps = GUI_TOUCH_SWIPE_MSEC / GUI_TOUCH_SWIPE_STEP_MSEC;
+	
+	if (recording || replaying || (num_swipes < 1) || !_gui_touch_rec_alloc()) {
+		return false;
+	}
+	
+	// Each swipe is the drag points and the release, then one more event ends the script
+	if ((num_swipes * (steps + 2) + 1) > GUI_TOUCH_REC_MAX_EVENTS) {
+		num_swipes = (GUI_TOUCH_REC_MAX_EVENTS - 1) / (steps + 2);
+	}
+	
+	gui_get_screen_size(&w, &h);
+	eP = eventP;
+	for (int i=0; i<num_swipes; i++) {
+		for (int j=0; j<=steps; j++) {
+			eP->t_msec = t_msec;
+			eP->x = (3 * w / 4) - (w / 2) * j / steps;
+			eP->y = h / 2;
+			eP->pressed = 1;
+			eP++;
+			t_msec += GUI_TOUCH_SWIPE_STEP_MSEC;
+		}
+		*eP = *(eP - 1);
+		eP->t_msec = t_msec;
+		eP->pressed = 0;
+		eP++;
+		t_msec += GUI_TOUCH_SWIPE_GAP_MSEC;
+	}
+	
+	// Keep the replay going until the last tile has settled
+	*eP = *(eP - 1);
+	eP->t_msec = t_msec;
+	eP++;
+	num_events = eP - eventP;
+	
+	ESP_LOGI(TAG, "Replay %d swipes: %d events, %lu mSec", num_swipes, num_events, t_msec);
+	replay_i = 0;
+	start_usec = esp_timer_get_time();
+	replaying = true;
+	
+	return true;
+}
+
+
+void gui_touch_replay_stop()
+{
+	replaying = false;
+}
+
+
+bool gui_touch_replay_running()
+{
+	return replaying;
+}
+
+
+
+//
+// Internal functions
+//
+static void _gui_touch_rec_timer_cb(lv_timer_t* timer)
+{
+	// Note single-shot timer is deleted by LVGL
+	rec_timer = NULL;
+	gui_touch_rec_stop();
+}
+
+
+// Record a reading if it differs from the previous one
+static void _gui_touch_rec_add(lv_indev_data_t* data)
+{
+	gui_touch_event_t* eP;
+	uint8_t pressed = (data->state == LV_INDEV_STATE_PRESSED) ? 1 : 0;
+	
+	if (num_events != 0) {
+		eP = &eventP[num_events-1];
+		if ((eP->pressed == pressed) && (!pressed || ((eP->x == data->point.x) && (eP->y == data->point.y)))) {
+			return;
+		}
+	}
+	
+	eP = &eventP[num_events++];
+	eP->t_msec = (uint32_t) ((esp_timer_get_time() - start_usec) / 1000);
+	eP->x = data->point.x;
+	eP->y = data->point.y;
+	eP->pressed = pressed;
+	memset(eP->rsvd, 0, sizeof(eP->rsvd));
+	
+	if (num_events == GUI_TOUCH_REC_MAX_EVENTS) {
+		ESP_LOGW(TAG, "Recording full");
+		gui_touch_rec_stop();
+	}
+}
+
+
+// The recording is written from the GUI task since it only happens at the end of a test
+// session
+static void _gui_touch_rec_save()
+{
+	gui_touch_rec_hdr_t hdr;
+	FILE* fp;
+	
+	fp = fopen(GUI_TOUCH_REC_FILE, "wb");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Could not create %s", GUI_TOUCH_REC_FILE);
+		return;
+	}
+	
+	hdr.magic = GUI_TOUCH_REC_MAGIC;
+	hdr.num_events = num_events;
+	if ((fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
+	    (fwrite(eventP, sizeof(gui_touch_event_t), num_events, fp) != num_events)) {
+		ESP_LOGE(TAG, "Write %s failed", GUI_TOUCH_REC_FILE);
+	} else {
+		ESP_LOGI(TAG, "Saved %d events to %s", num_events, GUI_TOUCH_REC_FILE);
+	}
+	fclose(fp);
+}
+
+
+static bool _gui_touch_rec_load()
+{
+	gui_touch_rec_hdr_t hdr;
+	FILE* fp;
+	bool success = false;
+	
+	fp = fopen(GUI_TOUCH_REC_FILE, "rb");
+	if (fp == NULL) {
+		return false;
+	}
+	
+	if ((fread(&hdr, sizeof(hdr), 1, fp) == 1) && (hdr.magic == GUI_TOUCH_REC_MAGIC) &&
+	    (hdr.num_events != 0) && (hdr.num_events <= GUI_TOUCH_REC_MAX_EVENTS) &&
+	    (fread(eventP, sizeof(gui_touch_event_t), hdr.num_events, fp) == hdr.num_events)) {
+		num_events = hdr.num_events;
+		success = true;
+	} else {
+		ESP_LOGE(TAG, "Bad recording %s", GUI_TOUCH_REC_FILE);
+	}
+	fclose(fp);
+	
+	return success;
+}
+
+
+static bool _gui_touch_rec_alloc()
+{
+	if (eventP == NULL) {
+		eventP = heap_caps_malloc(GUI_TOUCH_REC_MAX_EVENTS * sizeof(gui_touch_event_t), MALLOC_CAP_SPIRAM);
+		if (eventP == NULL) {
+			ESP_LOGE(TAG, "Could not allocate event buffer");
+			return false;
+		}
+	}
+	
+	return true;
+}
@@ -0,0 +1,83 @@
+/*
+ * GUI touch recorder - capture the touch controller's readings with their times to a file
+ * and feed a recording (or a generated swipe script) back through the touch input device
+ * in place of the controller so UI performance can be measured with repeatable gestures.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef GUI_TOUCH_REC_H
+#define GUI_TOUCH_REC_H
+
+#include "lvgl.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Recording on the log partition
+#define GUI_TOUCH_REC_FILE        "/log/TOUCH.BIN"
+
+// Maximum number of events recorded or replayed (a reading is only recorded when it differs
+// from the previous one)
+#define GUI_TOUCH_REC_MAX_EVENTS  2048
+
+// Generated swipe script: each swipe drags across the middle half of the screen in
+// GUI_TOUCH_SWIPE_MSEC with a point every GUI_TOUCH_SWIPE_STEP_MSEC, then waits
+// GUI_TOUCH_SWIPE_GAP_MSEC for the tile to settle before the next
+#define GUI_TOUCH_SWIPE_MSEC      250
+#define GUI_TOUCH_SWIPE_STEP_MSEC 10
+#define GUI_TOUCH_SWIPE_GAP_MSEC  2000
+
+// File header magic
+#define GUI_TOUCH_REC_MAGIC       0x31484354   /* "TCH1" */
+
+
+
+//
+// Typedefs (little-endian on disk)
+//   File: gui_touch_rec_hdr_t followed by num_events gui_touch_event_t in time order
+typedef struct {
+	uint32_t magic;
+	uint32_t num_events;
+} gui_touch_rec_hdr_t;
+
+typedef struct {
+	uint32_t t_msec;                // Since the start of the recording
+	int16_t x;
+	int16_t y;
+	uint8_t pressed;
+	uint8_t rsvd[3];
+} gui_touch_event_t;
+
+
+
+//
+// API
+//
+void gui_touch_rec_read_cb(lv_indev_drv_t* drv, lv_indev_data_t* data);
+bool gui_touch_rec_start(int msec);
+void gui_touch_rec_stop();
+bool gui_touch_replay_start_file();
+bool gui_touch_replay_start_swipes(int num_swipes);
+void gui_touch_replay_stop();
+bool gui_touch_replay_running();
+
+#endif /* GUI_TOUCH_REC_H */
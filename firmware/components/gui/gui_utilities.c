@@ -18,9 +18,17 @@
  *
  */
 #include "esp_system.h"
+#include "esp_heap_caps.h"
 #include "esp_timer.h"
 #include "esp_log.h"
+#include "gui_span_arc.h"
 #include "gui_utilities.h"
+#include "vehicle_manager.h"
+#if LV_MEM_CUSTOM != 0
+#include "lvgl_mem.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
 
 
 
@@ -29,6 +37,30 @@
 //
 #define NUM_UPDATE_PERIODS          2
 
+// Comment out to draw meter scales (ticks, labels and range arcs) every time they are
+// invalidated instead of blitting an image rendered once at setup
+#define CACHE_METER_IMAGES
+
+// Uncomment to draw the indicators of the high-rate gauges as span arcs (table-driven row
+// fills with square ends) instead of LVGL's anti-aliased arcs with rounded ends
+//#define FAST_RENDER_ARCS
+
+// Opacity of objects displaying stale data
+#define STALE_OPA                   LV_OPA_40
+
+// Gauge animation
+//   Animations finish just before the next expected update and are stepped once per
+//   display refresh.  Progress and easing are 10-bit fixed point.
+#define GAUGE_ANIM_EARLY_MSEC       20
+#define GAUGE_ANIM_STEP_MSEC        CONFIG_LV_DISP_DEF_REFR_PERIOD
+#define GAUGE_ANIM_FRAC_BITS        10
+#define GAUGE_ANIM_ONE              (1 << GAUGE_ANIM_FRAC_BITS)
+
+// Trend strip update interval and colors
+#define TREND_EVAL_MSEC             100
+#define TREND_BG_COLOR              lv_color_black()
+#define TREND_ZERO_COLOR            lv_palette_darken(LV_PALETTE_BLUE_GREY, 3)
+
 // Keypad pop-up related
 //
 // Keypad pop-up types
@@ -46,6 +78,22 @@ static bool wait_first_timestamp;
 static int timestamp_delta_index;
 static int64_t prev_timestamp;
 static int32_t timestamp_deltas[NUM_UPDATE_PERIODS];
+static db_mask_t update_item_mask;
+
+// Gauge animators
+static gui_gauge_anim_t* gauge_anims[GUI_GAUGE_ANIM_MAX];
+static int num_gauge_anims = 0;
+static lv_timer_t* gauge_anim_timer = NULL;
+static bool gauge_anims_held = false;
+
+// Shared styles
+static bool styles_initialized = false;
+static lv_style_t styles[GUI_NUM_STYLES];
+
+// Trend strips
+static gui_trend_t* trends[GUI_TREND_MAX];
+static int num_trends = 0;
+static lv_timer_t* trend_timer = NULL;
 
 // Keypad pop-up
 static lv_obj_t* kp_popup = NULL;
@@ -96,6 +144,15 @@ uint16_t _gui_util_setup_meter_ticks(float major_tick_value, float major_tick_in
 float _gui_util_div_frac(float dividend, float divisor);
 void _gui_util_display_keypad(lv_obj_t* parent, char* title, char* val, int val_len);
 void _gui_util_keypad_cb(lv_event_t* e);
+static void _gui_util_init_styles();
+static void _gui_util_gauge_anim_timer_cb(lv_timer_t* timer);
+static void _gui_util_cached_meter_delete_cb(lv_event_t* e);
+static void _gui_util_trend_timer_cb(lv_timer_t* timer);
+static void _gui_util_trend_update(gui_trend_t* tP);
+static void _gui_util_trend_push_column(gui_trend_t* tP, bool valid, int32_t v_min, int32_t v_max);
+static lv_coord_t _gui_util_trend_val_to_y(gui_trend_t* tP, int32_t val);
+static void _gui_util_trend_delete_cb(lv_event_t* e);
+static void _gui_util_inv_arc_span(lv_obj_t* arc, int32_t start, int32_t end);
 
 
 
@@ -104,19 +161,19 @@ void _gui_util_keypad_cb(lv_event_t* e);
 //
 float gui_util_c_to_f(float c)
 {
-	return ((9 * c / 5) + 32);
+	return ((9.0f * c / 5.0f) + 32.0f);
 }
 
 
 float gui_util_m_to_feet(float m)
 {
-	return (m * 3.28084);
+	return (m * 3.28084f);
 }
 
 
 float gui_util_kph_to_mph(float kph)
 {
-	return (kph / 1.60934);
+	return (kph / 1.60934f);
 }
 
 
@@ -138,8 +195,143 @@ uint16_t gui_utility_setup_small_270_meter_ticks(float min, float max)
 }
 
 
-void gui_utility_init_update_time(uint32_t init_delay)
+lv_style_t* gui_utility_get_style(int style)
+{
+	if (!styles_initialized) {
+		_gui_util_init_styles();
+	}
+	
+	if ((style < 0) || (style >= GUI_NUM_STYLES)) {
+		style = GUI_STYLE_LABEL;
+	}
+	
+	return &styles[style];
+}
+
+
+// Render a fully configured meter (whose scales and indicators will not change) into an
+// image in PSRAM and replace the meter with it so overlapping arc animations only cost a
+// blit.  Returns the object now displaying the meter (the meter itself if it could not
+// be cached).  Must be called after any objects drawn above the meter are created.
+lv_obj_t* gui_utility_cache_meter(lv_obj_t* meter)
+{
+#ifdef CACHE_METER_IMAGES
+	lv_obj_t* img;
+	lv_img_dsc_t* dscP;
+	uint8_t* bufP;
+	uint32_t len;
+	lv_coord_t ext;
+	
+	lv_obj_update_layout(meter);
+	len = lv_snapshot_buf_size_needed(meter, LV_IMG_CF_TRUE_COLOR_ALPHA);
+	dscP = heap_caps_malloc(sizeof(lv_img_dsc_t), MALLOC_CAP_SPIRAM);
+	bufP = heap_caps_malloc(len, MALLOC_CAP_SPIRAM);
+	if ((dscP == NULL) || (bufP == NULL)) {
+		ESP_LOGE(TAG, "Could not allocate %lu bytes for meter image", len);
+		free(dscP);
+		free(bufP);
+		return meter;
+	}
+	
+	if (lv_snapshot_take_to_buf(meter, LV_IMG_CF_TRUE_COLOR_ALPHA, dscP, bufP, len) != LV_RES_OK) {
+		ESP_LOGE(TAG, "Meter snapshot failed");
+		free(dscP);
+		free(bufP);
+		return meter;
+	}
+	
+	// The snapshot includes the meter's extended draw area
+	ext = _lv_obj_get_ext_draw_size(meter);
+	img = lv_img_create(lv_obj_get_parent(meter));
+	lv_img_set_src(img, dscP);
+	lv_obj_set_pos(img, lv_obj_get_x(meter) - ext, lv_obj_get_y(meter) - ext);
+	lv_obj_clear_flag(img, LV_OBJ_FLAG_CLICKABLE);
+	lv_obj_move_to_index(img, lv_obj_get_index(meter));
+	lv_obj_add_event_cb(img, _gui_util_cached_meter_delete_cb, LV_EVENT_DELETE, dscP);
+	lv_obj_del(meter);
+	
+	return img;
+#else
+	return meter;
+#endif
+}
+
+
+bool gui_utility_decode_rle_img(const gui_rle_img_t* rleP, lv_img_dsc_t* dscP)
+{
+	const uint8_t* sP = rleP->data;
+	const uint8_t* eP = rleP->data + rleP->len;
+	uint16_t* buf;
+	uint16_t* dP;
+	uint16_t* dEndP;
+	uint16_t pixel;
+	int n;
+	
+	buf = heap_caps_malloc(rleP->w * rleP->h * sizeof(uint16_t), MALLOC_CAP_SPIRAM);
+	if (buf == NULL) {
+		ESP_LOGE(TAG, "Could not allocate %d x %d image", rleP->w, rleP->h);
+		return false;
+	}
+	
+	dP = buf;
+	dEndP = buf + rleP->w * rleP->h;
+	while ((sP < eP) && (dP < dEndP)) {
+		if (*sP < 0x80) {
+			// Literal pixels
+			n = *sP++ + 1;
+			while ((n-- > 0) && (dP < dEndP) && ((sP + 1) < eP)) {
+				pixel = sP[0] | (sP[1] << 8);
+				sP += 2;
+#if LV_COLOR_16_SWAP != 0
+				pixel = (pixel >> 8) | (pixel << 8);
+#endif
+				*dP++ = pixel;
+			}
+		} else {
+			// Repeated pixel
+			n = *sP++ - 0x80 + 2;
+			if ((sP + 1) >= eP) break;
+			pixel = sP[0] | (sP[1] << 8);
+			sP += 2;
+#if LV_COLOR_16_SWAP != 0
+			pixel = (pixel >> 8) | (pixel << 8);
+#endif
+			while ((n-- > 0) && (dP < dEndP)) {
+				*dP++ = pixel;
+			}
+		}
+	}
+	
+	if (dP != dEndP) {
+		ESP_LOGE(TAG, "Image data ended early");
+		free(buf);
+		return false;
+	}
+	
+	memset(dscP, 0, sizeof(lv_img_dsc_t));
+	dscP->header.cf = LV_IMG_CF_TRUE_COLOR;
+	dscP->header.w = rleP->w;
+	dscP->header.h = rleP->h;
+	dscP->data_size = rleP->w * rleP->h * sizeof(uint16_t);
+	dscP->data = (const uint8_t*) buf;
+	
+	return true;
+}
+
+
+void gui_utility_free_rle_img(lv_img_dsc_t* dscP)
 {
+	if (dscP->data != NULL) {
+		free((void*) dscP->data);
+		dscP->data = NULL;
+	}
+}
+
+
+void gui_utility_init_update_time(uint32_t init_delay, db_mask_t item_mask)
+{
+	update_item_mask = item_mask;
+	
 	// Initialize our delta array with this value
 	for (int i=0; i<NUM_UPDATE_PERIODS; i++) {
 		timestamp_deltas[i] = init_delay;
@@ -173,6 +365,13 @@ void gui_utility_note_update()
 uint32_t gui_utility_get_update_period()
 {
 	uint32_t sum = 0;
+	int cadence_msec;
+	
+	// Samples arrive on a fixed grid so the measured jitter can be ignored
+	cadence_msec = vm_get_cadence_msec(update_item_mask);
+	if (cadence_msec != 0) {
+		return (uint32_t) cadence_msec;
+	}
 	
 	// Compute an average
 	for (int i=0; i<NUM_UPDATE_PERIODS; i++) {
@@ -183,6 +382,300 @@ uint32_t gui_utility_get_update_period()
 }
 
 
+void gui_utility_init_gauge_anim(gui_gauge_anim_t* gaP, void* var, gui_gauge_anim_exec_cb exec_cb, int32_t val)
+{
+	gaP->var = var;
+	gaP->exec_cb = exec_cb;
+	gaP->running = false;
+	gaP->start_val = val;
+	gaP->end_val = val;
+	gaP->cur_val = val;
+	
+	// Register with the shared timer (it only runs while an animation is running)
+	for (int i=0; i<num_gauge_anims; i++) {
+		if (gauge_anims[i] == gaP) return;
+	}
+	if (num_gauge_anims < GUI_GAUGE_ANIM_MAX) {
+		gauge_anims[num_gauge_anims++] = gaP;
+	} else {
+		ESP_LOGE(TAG, "Too many gauge animators");
+	}
+	if (gauge_anim_timer == NULL) {
+		gauge_anim_timer = lv_timer_create(_gui_util_gauge_anim_timer_cb, GAUGE_ANIM_STEP_MSEC, NULL);
+		lv_timer_pause(gauge_anim_timer);
+	}
+}
+
+
+void gui_utility_set_gauge_anim(gui_gauge_anim_t* gaP, int32_t val, bool immediate)
+{
+	uint32_t dur;
+	
+	if (immediate) {
+		gaP->running = false;
+		gaP->start_val = val;
+		gaP->end_val = val;
+		gaP->cur_val = val;
+		gaP->exec_cb(gaP->var, val);
+		return;
+	}
+	
+	if (gaP->running && (val == gaP->end_val)) return;
+	
+	// Retarget from where the indicator is now.  Samples arriving faster than the display
+	// refreshes just move the target; the indicator is only redrawn at the refresh rate.
+	dur = gui_utility_get_update_period();
+	dur = (dur > (GAUGE_ANIM_EARLY_MSEC + GAUGE_ANIM_STEP_MSEC)) ? dur - GAUGE_ANIM_EARLY_MSEC : GAUGE_ANIM_STEP_MSEC;
+	gaP->start_val = gaP->cur_val;
+	gaP->end_val = val;
+	gaP->start_msec = lv_tick_get();
+	gaP->dur_msec = dur;
+	gaP->running = true;
+	
+	if (!gauge_anims_held) {
+		lv_timer_resume(gauge_anim_timer);
+	}
+}
+
+
+// Must be called before the object the animator updates is deleted
+void gui_utility_stop_gauge_anim(gui_gauge_anim_t* gaP)
+{
+	gaP->running = false;
+}
+
+
+// Stop stepping all gauge animations (e.g. while the tileview scrolls).  Animations still
+// running when released finish at their target on the next step.
+void gui_utility_hold_gauge_anims(bool hold)
+{
+	gauge_anims_held = hold;
+	if (gauge_anim_timer == NULL) return;
+	
+	if (hold) {
+		lv_timer_pause(gauge_anim_timer);
+	} else {
+		for (int i=0; i<num_gauge_anims; i++) {
+			if (gauge_anims[i]->running) {
+				lv_timer_resume(gauge_anim_timer);
+				break;
+			}
+		}
+	}
+}
+
+
+// Create a trend strip for an item (which must be requested by the caller).  The strip
+// fills from the item's history ring so it is shown from the start when it is activated.
+// Returns the canvas for positioning (NULL on failure).  The strip is released when the
+// canvas is deleted.
+lv_obj_t* gui_utility_create_trend(gui_trend_t* tP, lv_obj_t* parent, int item, lv_coord_t w, lv_coord_t h, float min, float max, lv_color_t color)
+{
+	db_hist_view_t view;
+	
+	tP->canvas = NULL;
+	tP->active = false;
+	
+	// History may already be enabled by another user (with a different length)
+	if (!db_enable_history(item, GUI_TREND_HIST_SAMPLES) && !db_get_history_view(item, &view)) {
+		return NULL;
+	}
+	
+	if ((w < 2) || (h < 2) || (max <= min)) return NULL;
+	tP->bufP = heap_caps_malloc(w * h * sizeof(lv_color_t), MALLOC_CAP_SPIRAM);
+	if (tP->bufP == NULL) {
+		ESP_LOGE(TAG, "Could not allocate %d x %d trend", w, h);
+		return NULL;
+	}
+	
+	tP->w = w;
+	tP->h = h;
+	tP->item = item;
+	tP->min = min;
+	tP->max = max;
+	tP->color = color;
+	tP->col_msec = GUI_TREND_SPAN_MSEC / w;
+	tP->zero_y = ((min < 0) && (max > 0)) ? _gui_util_trend_val_to_y(tP, 0) : -1;
+	tP->started = false;
+	
+	tP->canvas = lv_canvas_create(parent);
+	lv_canvas_set_buffer(tP->canvas, tP->bufP, w, h, LV_IMG_CF_TRUE_COLOR);
+	lv_canvas_fill_bg(tP->canvas, TREND_BG_COLOR, LV_OPA_COVER);
+	lv_obj_clear_flag(tP->canvas, LV_OBJ_FLAG_CLICKABLE);
+	lv_obj_add_event_cb(tP->canvas, _gui_util_trend_delete_cb, LV_EVENT_DELETE, tP);
+	
+	// Register with the shared timer (it only runs while a strip is active)
+	for (int i=0; i<num_trends; i++) {
+		if (trends[i] == tP) return tP->canvas;
+	}
+	if (num_trends < GUI_TREND_MAX) {
+		trends[num_trends++] = tP;
+	} else {
+		ESP_LOGE(TAG, "Too many trend strips");
+	}
+	if (trend_timer == NULL) {
+		trend_timer = lv_timer_create(_gui_util_trend_timer_cb, TREND_EVAL_MSEC, NULL);
+		lv_timer_pause(trend_timer);
+	}
+	
+	return tP->canvas;
+}
+
+
+// Strips only update while active (their tile is displayed).  Activating a strip redraws
+// it from the item's history.
+void gui_utility_set_trend_active(gui_trend_t* tP, bool en)
+{
+	bool any_active = false;
+	
+	if (tP->canvas == NULL) return;
+	
+	tP->active = en;
+	if (en) {
+		tP->started = false;
+		_gui_util_trend_update(tP);
+	}
+	
+	for (int i=0; i<num_trends; i++) {
+		if (trends[i]->active) any_active = true;
+	}
+	if (trend_timer != NULL) {
+		if (any_active) {
+			lv_timer_resume(trend_timer);
+		} else {
+			lv_timer_pause(trend_timer);
+		}
+	}
+}
+
+
+lv_obj_t* gui_utility_create_gauge_arc(lv_obj_t* parent)
+{
+#ifdef FAST_RENDER_ARCS
+	return gui_span_arc_create(parent);
+#else
+	return lv_arc_create(parent);
+#endif
+}
+
+
+// Mirrors lv_arc_set_value() for the normal and reverse modes (the others use it directly)
+void gui_utility_set_arc_value(lv_obj_t* arc, int16_t value)
+{
+	lv_arc_t* arcP = (lv_arc_t*) arc;
+	int32_t bg_end;
+	int32_t angle;
+	
+	if ((arcP->type != LV_ARC_MODE_NORMAL) && (arcP->type != LV_ARC_MODE_REVERSE)) {
+		lv_arc_set_value(arc, value);
+		return;
+	}
+	
+	if (value > arcP->max_value) value = arcP->max_value;
+	if (value < arcP->min_value) value = arcP->min_value;
+	if (value == arcP->value) return;
+	arcP->value = value;
+	
+	bg_end = arcP->bg_angle_end;
+	if (arcP->bg_angle_end < arcP->bg_angle_start) bg_end += 360;
+	angle = lv_map(value, arcP->min_value, arcP->max_value, arcP->bg_angle_start, bg_end);
+	
+	if (arcP->type == LV_ARC_MODE_NORMAL) {
+		_gui_util_inv_arc_span(arc, arcP->indic_angle_end, angle);
+		arcP->indic_angle_start = arcP->bg_angle_start;
+		arcP->indic_angle_end = (angle > 360) ? angle - 360 : angle;
+	} else {
+		_gui_util_inv_arc_span(arc, arcP->indic_angle_start, angle);
+		arcP->indic_angle_start = (angle > 360) ? angle - 360 : angle;
+		arcP->indic_angle_end = arcP->bg_angle_end;
+	}
+	arcP->last_angle = angle;
+}
+
+
+void gui_utility_init_num_label(gui_num_label_t* nlP, lv_obj_t* lbl)
+{
+	nlP->lbl = lbl;
+	nlP->valid = false;
+	nlP->buf[0] = 0;
+}
+
+
+// Display val (fixed-point with the specified number of decimal digits) followed by the
+// suffix.  Nothing is done if the label already shows this.
+void gui_utility_set_num_label(gui_num_label_t* nlP, int32_t val, int decimals, const char* suffix)
+{
+	int len;
+	
+	if (nlP->valid && (val == nlP->val) && (decimals == nlP->decimals) && (suffix == nlP->suffix)) {
+		return;
+	}
+	
+	len = gui_utility_format_fixed(nlP->buf, val, decimals);
+	if (suffix != NULL) {
+		strncpy(&nlP->buf[len], suffix, GUI_NUM_LABEL_LEN - len - 1);
+		nlP->buf[GUI_NUM_LABEL_LEN - 1] = 0;
+	}
+	lv_label_set_text_static(nlP->lbl, nlP->buf);
+	
+	nlP->valid = true;
+	nlP->val = val;
+	nlP->decimals = decimals;
+	nlP->suffix = suffix;
+}
+
+
+// Display val rounded to the specified number of decimal digits
+void gui_utility_set_num_label_f(gui_num_label_t* nlP, float val, int decimals, const char* suffix)
+{
+	for (int i=0; i<decimals; i++) {
+		val *= 10.0f;
+	}
+	
+	gui_utility_set_num_label(nlP, (int32_t) ((val >= 0) ? (val + 0.5f) : (val - 0.5f)), decimals, suffix);
+}
+
+
+// Format a fixed-point value with integer math.  buf must hold at least 13 + decimals
+// characters.  Returns the formatted length.
+int gui_utility_format_fixed(char* buf, int32_t val, int decimals)
+{
+	char digits[12];
+	int len = 0;
+	int n = 0;
+	uint32_t u;
+	
+	if (val < 0) {
+		buf[len++] = '-';
+		u = (uint32_t) -(int64_t) val;
+	} else {
+		u = (uint32_t) val;
+	}
+	
+	// Generate digits least significant first, with at least one before the point
+	do {
+		digits[n++] = '0' + (u % 10);
+		u /= 10;
+	} while ((u != 0) || (n <= decimals));
+	
+	while (n > 0) {
+		if (n == decimals) {
+			buf[len++] = '.';
+		}
+		buf[len++] = digits[--n];
+	}
+	buf[len] = 0;
+	
+	return len;
+}
+
+
+void gui_utility_set_stale(lv_obj_t* obj, bool stale)
+{
+	lv_obj_set_style_opa(obj, stale ? STALE_OPA : LV_OPA_COVER, 0);
+}
+
+
 void gui_utility_display_alpha_kbd(lv_obj_t* parent, char* title, int index, char* val, int val_len, gui_utility_kbd_update_textfield cb_fcn)
 {
 	if (kp_popup == NULL) {
@@ -220,7 +713,25 @@ void gui_utility_display_hex_kbd(lv_obj_t* parent, char* title, int index, char*
 
 void gui_dump_mem_info()
 {
-
+#if LV_MEM_CUSTOM != 0
+	lvgl_mem_stats_t stats;
+	multi_heap_info_t heap_info;
+	
+	// LVGL's share of the internal and PSRAM heaps
+	lvgl_mem_get_stats(&stats);
+	ESP_LOGI(TAG, "LVGL Memory Statistics:");
+	ESP_LOGI(TAG, "  Internal Used: %lu   Max Used: %lu", stats.int_used, stats.int_max_used);
+	ESP_LOGI(TAG, "  PSRAM Used: %lu   Max Used: %lu", stats.ext_used, stats.ext_max_used);
+	ESP_LOGI(TAG, "  Allocations: %lu   Failures: %lu", stats.alloc_cnt, stats.fail_cnt);
+	
+	// Fragmentation of the heaps LVGL allocates from
+	heap_caps_get_info(&heap_info, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	ESP_LOGI(TAG, "  Internal Free: %u   Largest: %u   Frag Percent: %u", heap_info.total_free_bytes, heap_info.largest_free_block,
+		(heap_info.total_free_bytes == 0) ? 0 : 100 - (100 * heap_info.largest_free_block / heap_info.total_free_bytes));
+	heap_caps_get_info(&heap_info, MALLOC_CAP_SPIRAM);
+	ESP_LOGI(TAG, "  PSRAM Free: %u   Largest: %u   Frag Percent: %u", heap_info.total_free_bytes, heap_info.largest_free_block,
+		(heap_info.total_free_bytes == 0) ? 0 : 100 - (100 * heap_info.largest_free_block / heap_info.total_free_bytes));
+#else
 	lv_mem_monitor_t mem_info;
 	
 	// Get LVGL's current private heap info
@@ -231,6 +742,7 @@ void gui_dump_mem_info()
 	ESP_LOGI(TAG, "  Free Count: %lu   Free Size: %lu   Free Biggest Size: %lu", mem_info.free_cnt, mem_info.free_size, mem_info.free_biggest_size);
 	ESP_LOGI(TAG, "  Used Count: %lu   Max Used: %lu  Used Percent: %u", mem_info.used_cnt, mem_info.max_used, mem_info.used_pct);
 	ESP_LOGI(TAG, "  Frag Percent: %u", mem_info.frag_pct);
+#endif
 }
 
 
@@ -244,6 +756,77 @@ void gui_dump_mem_info()
 // major_tick_inc - Increment to add to major_tick_value if it results in too many ticks (more than max_ticks)
 // min_ticks, max_ticks - Minimum and maximum number of ticks to generate (major + minor ticks)
 // min_val, max_val - Range of meter
+// Release the PSRAM image when a cached meter is deleted (its tile is torn down)
+static void _gui_util_init_styles()
+{
+	for (int i=0; i<GUI_NUM_STYLES; i++) {
+		lv_style_init(&styles[i]);
+	}
+	
+	lv_style_set_text_align(&styles[GUI_STYLE_READOUT_LARGE], LV_TEXT_ALIGN_CENTER);
+	lv_style_set_text_font(&styles[GUI_STYLE_READOUT_LARGE], &gui_font_readout_48);
+	
+	lv_style_set_text_align(&styles[GUI_STYLE_READOUT], LV_TEXT_ALIGN_CENTER);
+	lv_style_set_text_font(&styles[GUI_STYLE_READOUT], &gui_font_readout_30);
+	
+	lv_style_set_text_align(&styles[GUI_STYLE_VALUE], LV_TEXT_ALIGN_CENTER);
+	lv_style_set_text_font(&styles[GUI_STYLE_VALUE], &lv_font_montserrat_24);
+	
+	lv_style_set_text_align(&styles[GUI_STYLE_LABEL], LV_TEXT_ALIGN_CENTER);
+	lv_style_set_text_font(&styles[GUI_STYLE_LABEL], &lv_font_montserrat_18);
+	
+	lv_style_set_bg_color(&styles[GUI_STYLE_METER_ARC], lv_palette_main(LV_PALETTE_BLUE_GREY));
+	
+	lv_style_set_arc_color(&styles[GUI_STYLE_NEG_ARC], lv_palette_main(LV_PALETTE_BLUE));
+	
+	styles_initialized = true;
+}
+
+
+static void _gui_util_cached_meter_delete_cb(lv_event_t* e)
+{
+	lv_img_dsc_t* dscP = (lv_img_dsc_t*) lv_event_get_user_data(e);
+	
+	free((void*) dscP->data);
+	free(dscP);
+}
+
+
+static void _gui_util_gauge_anim_timer_cb(lv_timer_t* timer)
+{
+	bool any_running = false;
+	gui_gauge_anim_t* gaP;
+	int32_t p, val;
+	uint32_t t;
+	
+	for (int i=0; i<num_gauge_anims; i++) {
+		gaP = gauge_anims[i];
+		if (!gaP->running) continue;
+		
+		t = lv_tick_elaps(gaP->start_msec);
+		if (t >= gaP->dur_msec) {
+			val = gaP->end_val;
+			gaP->running = false;
+		} else {
+			// Quadratic ease-out: p' = p * (2 - p)
+			p = (int32_t) ((t << GAUGE_ANIM_FRAC_BITS) / gaP->dur_msec);
+			p = (p * (2 * GAUGE_ANIM_ONE - p)) >> GAUGE_ANIM_FRAC_BITS;
+			val = gaP->start_val + (int32_t) (((int64_t) (gaP->end_val - gaP->start_val) * p) >> GAUGE_ANIM_FRAC_BITS);
+			any_running = true;
+		}
+		
+		if (val != gaP->cur_val) {
+			gaP->cur_val = val;
+			gaP->exec_cb(gaP->var, val);
+		}
+	}
+	
+	if (!any_running) {
+		lv_timer_pause(timer);
+	}
+}
+
+
 uint16_t _gui_util_setup_meter_ticks(float major_tick_value, float major_tick_inc, int min_ticks, int max_ticks, float min_val, float max_val)
 {
 	bool done = false;
@@ -374,3 +957,216 @@ void _gui_util_keypad_cb(lv_event_t* e)
 		}
 	}
 }
+
+static void _gui_util_trend_timer_cb(lv_timer_t* timer)
+{
+	for (int i=0; i<num_trends; i++) {
+		if (trends[i]->active) {
+			_gui_util_trend_update(trends[i]);
+		}
+	}
+}
+
+
+// Consume new history samples into the column being accumulated and scroll in columns as
+// time passes (sample times are the low 32 bits of esp_timer mSec)
+static void _gui_util_trend_update(gui_trend_t* tP)
+{
+	bool pushed = false;
+	const db_hist_sample_t* sP;
+	db_hist_view_t view;
+	int len;
+	int skip;
+	int new_count;
+	int num_cols = 0;
+	uint32_t cur_msec;
+	
+	if ((tP->canvas == NULL) || !db_get_history_view(tP->item, &view)) return;
+	
+	cur_msec = (uint32_t) (esp_timer_get_time() / 1000);
+	len = view.seg1_len + view.seg2_len;
+	
+	if (!tP->started) {
+		// (Re)start with an empty strip ending now and backfill from all stored history
+		lv_canvas_fill_bg(tP->canvas, TREND_BG_COLOR, LV_OPA_COVER);
+		tP->started = true;
+		tP->col_valid = false;
+		tP->last_valid = false;
+		tP->col_end_msec = cur_msec - GUI_TREND_SPAN_MSEC + tP->col_msec;
+		new_count = len;
+		pushed = true;
+	} else {
+		new_count = (int) (view.write_count - tP->write_count);
+		if (new_count > len) new_count = len;
+	}
+	tP->write_count = view.write_count;
+	
+	skip = len - new_count;
+	if (db_get_history_overrun(&view) > skip) {
+		skip = db_get_history_overrun(&view);
+	}
+	
+	for (int i=skip; i<len; i++) {
+		sP = (i < view.seg1_len) ? &view.seg1P[i] : &view.seg2P[i - view.seg1_len];
+		
+		// Samples older than the strip are dropped (only possible while backfilling)
+		if ((int32_t) (sP->ts_msec - (tP->col_end_msec - tP->col_msec)) < 0) continue;
+		
+		// Close the columns this sample is past
+		while (((int32_t) (sP->ts_msec - tP->col_end_msec) >= 0) && (num_cols++ < tP->w)) {
+			_gui_util_trend_push_column(tP, tP->col_valid, tP->col_min, tP->col_max);
+			tP->col_end_msec += tP->col_msec;
+			tP->col_valid = false;
+			pushed = true;
+		}
+		
+		// Min/max decimation of the samples falling within a column
+		if (!tP->col_valid) {
+			tP->col_min = sP->val;
+			tP->col_max = sP->val;
+			tP->col_valid = true;
+		} else {
+			if (sP->val < tP->col_min) tP->col_min = sP->val;
+			if (sP->val > tP->col_max) tP->col_max = sP->val;
+		}
+		tP->last_valid = true;
+		tP->last_val = sP->val;
+		tP->last_msec = sP->ts_msec;
+	}
+	
+	// Scroll in the columns whose time has passed
+	while (((int32_t) (cur_msec - tP->col_end_msec) >= 0) && (num_cols++ < tP->w)) {
+		_gui_util_trend_push_column(tP, tP->col_valid, tP->col_min, tP->col_max);
+		tP->col_end_msec += tP->col_msec;
+		tP->col_valid = false;
+		pushed = true;
+	}
+	if ((int32_t) (cur_msec - tP->col_end_msec) >= 0) {
+		// More than a strip's worth of time passed (e.g. the GUI was blocked)
+		tP->col_end_msec = cur_msec + tP->col_msec;
+	}
+	
+	if (pushed) {
+		lv_obj_invalidate(tP->canvas);
+	}
+}
+
+
+// Scroll the strip left by one column and draw the new column at the right edge.  A
+// column without samples continues the previous value for a short time.
+static void _gui_util_trend_push_column(gui_trend_t* tP, bool valid, int32_t v_min, int32_t v_max)
+{
+	lv_color_t* rowP;
+	lv_coord_t y_top;
+	lv_coord_t y_bot;
+	
+	if (!valid && tP->last_valid && ((tP->col_end_msec - tP->last_msec) < GUI_TREND_HOLD_MSEC)) {
+		valid = true;
+		v_min = tP->last_val;
+		v_max = tP->last_val;
+	}
+	
+	if (valid) {
+		y_top = _gui_util_trend_val_to_y(tP, v_max);
+		y_bot = _gui_util_trend_val_to_y(tP, v_min);
+	} else {
+		y_top = tP->h;
+		y_bot = -1;
+	}
+	
+	for (lv_coord_t y=0; y<tP->h; y++) {
+		rowP = &tP->bufP[y * tP->w];
+		memmove(rowP, rowP + 1, (tP->w - 1) * sizeof(lv_color_t));
+		if ((y >= y_top) && (y <= y_bot)) {
+			rowP[tP->w - 1] = tP->color;
+		} else if (y == tP->zero_y) {
+			rowP[tP->w - 1] = TREND_ZERO_COLOR;
+		} else {
+			rowP[tP->w - 1] = TREND_BG_COLOR;
+		}
+	}
+}
+
+
+static lv_coord_t _gui_util_trend_val_to_y(gui_trend_t* tP, int32_t val)
+{
+	float f;
+	
+	f = ((float) val / DB_HIST_SCALE - tP->min) / (tP->max - tP->min);
+	if (f < 0) f = 0;
+	if (f > 1) f = 1;
+	
+	return (lv_coord_t) ((1.0 - f) * (tP->h - 1) + 0.5);
+}
+
+
+static void _gui_util_trend_delete_cb(lv_event_t* e)
+{
+	gui_trend_t* tP = (gui_trend_t*) lv_event_get_user_data(e);
+	
+	tP->active = false;
+	tP->canvas = NULL;
+	free(tP->bufP);
+	tP->bufP = NULL;
+}
+
+
+// Invalidate the indicator between two angles (arc coordinates, either order, possibly
+// past 360) as sectors that each lie within one quadrant so their bounding boxes are the
+// boxes around their corner points
+static void _gui_util_inv_arc_span(lv_obj_t* arc, int32_t start, int32_t end)
+{
+	lv_arc_t* arcP = (lv_arc_t*) arc;
+	lv_area_t a;
+	lv_coord_t pad_l, pad_t;
+	lv_coord_t r_out, r_in, w, extra;
+	lv_coord_t cx, cy;
+	int32_t step, t, seg_end;
+	int32_t x[4], y[4];
+	
+	if (start == end) return;
+	if (!lv_obj_is_visible(arc)) return;
+	if (start > end) {
+		t = start;
+		start = end;
+		end = t;
+	}
+	
+	// Screen angles
+	start += arcP->rotation;
+	end += arcP->rotation;
+	step = ((end - start) <= (GUI_ARC_INV_SEG_DEG * GUI_ARC_INV_MAX_SEGS)) ? GUI_ARC_INV_SEG_DEG : 90;
+	
+	// Geometry as lv_arc computes it (with a pixel of margin for anti-aliasing)
+	pad_l = lv_obj_get_style_pad_left(arc, LV_PART_MAIN);
+	pad_t = lv_obj_get_style_pad_top(arc, LV_PART_MAIN);
+	r_out = LV_MIN(lv_obj_get_width(arc) - pad_l - lv_obj_get_style_pad_right(arc, LV_PART_MAIN),
+	               lv_obj_get_height(arc) - pad_t - lv_obj_get_style_pad_bottom(arc, LV_PART_MAIN)) / 2;
+	cx = arc->coords.x1 + r_out + pad_l;
+	cy = arc->coords.y1 + r_out + pad_t;
+	w = lv_obj_get_style_arc_width(arc, LV_PART_INDICATOR);
+	r_in = (w < r_out) ? r_out - w : 0;
+	extra = (lv_obj_get_style_arc_rounded(arc, LV_PART_INDICATOR) ? w / 2 : 0) + 1;
+	
+	while (start < end) {
+		seg_end = (start / step + 1) * step;
+		if (seg_end > end) seg_end = end;
+		
+		x[0] = cx + ((lv_trigo_cos(start) * r_out) >> LV_TRIGO_SHIFT);
+		y[0] = cy + ((lv_trigo_sin(start) * r_out) >> LV_TRIGO_SHIFT);
+		x[1] = cx + ((lv_trigo_cos(start) * r_in) >> LV_TRIGO_SHIFT);
+		y[1] = cy + ((lv_trigo_sin(start) * r_in) >> LV_TRIGO_SHIFT);
+		x[2] = cx + ((lv_trigo_cos(seg_end) * r_out) >> LV_TRIGO_SHIFT);
+		y[2] = cy + ((lv_trigo_sin(seg_end) * r_out) >> LV_TRIGO_SHIFT);
+		x[3] = cx + ((lv_trigo_cos(seg_end) * r_in) >> LV_TRIGO_SHIFT);
+		y[3] = cy + ((lv_trigo_sin(seg_end) * r_in) >> LV_TRIGO_SHIFT);
+		
+		a.x1 = LV_MIN(LV_MIN(x[0], x[1]), LV_MIN(x[2], x[3])) - extra;
+		a.y1 = LV_MIN(LV_MIN(y[0], y[1]), LV_MIN(y[2], y[3])) - extra;
+		a.x2 = LV_MAX(LV_MAX(x[0], x[1]), LV_MAX(x[2], x[3])) + extra;
+		a.y2 = LV_MAX(LV_MAX(y[0], y[1]), LV_MAX(y[2], y[3])) + extra;
+		lv_obj_invalidate_area(arc, &a);
+		
+		start = seg_end;
+	}
+}
@@ -20,11 +20,112 @@
 #ifndef GUI_UTILITIES_H
 #define GUI_UTILITIES_H
 
+#include "data_broker.h"
+#include "gui_assets.h"
 #include "lvgl.h"
 #include <stdbool.h>
 #include <stdint.h>
 
 
+//
+// Constants
+//
+
+// Maximum formatted length of a numeric label (including suffix)
+#define GUI_NUM_LABEL_LEN 24
+
+// Shared styles (gui_utility_get_style()).  Readout styles use the numeric font subsets.
+#define GUI_STYLE_READOUT_LARGE  0      // Centred 48 px readout
+#define GUI_STYLE_READOUT        1      // Centred 30 px readout
+#define GUI_STYLE_VALUE          2      // Centred 24 px text
+#define GUI_STYLE_LABEL          3      // Centred 18 px text
+#define GUI_STYLE_METER_ARC      4      // Meter indicator arc (LV_PART_INDICATOR)
+#define GUI_STYLE_NEG_ARC        5      // Negative value indicator color (LV_PART_INDICATOR)
+#define GUI_NUM_STYLES           6
+
+// Arc indicator invalidation (gui_utility_set_arc_value()): changed spans up to
+// GUI_ARC_INV_SEG_DEG * GUI_ARC_INV_MAX_SEGS degrees are invalidated as sectors of at most
+// GUI_ARC_INV_SEG_DEG, longer ones by quadrant (bounds the number of invalidated areas)
+#define GUI_ARC_INV_SEG_DEG      30     // Must divide 90
+#define GUI_ARC_INV_MAX_SEGS     4
+
+// Maximum number of gauge animators
+#define GUI_GAUGE_ANIM_MAX 12
+
+// Trend strips: maximum number, time spanned by the strip width, history ring length for
+// their items and how long the last sample is held across columns without samples
+#define GUI_TREND_MAX            4
+#define GUI_TREND_SPAN_MSEC      60000
+#define GUI_TREND_HIST_SAMPLES   256
+#define GUI_TREND_HOLD_MSEC      5000
+
+
+
+//
+// Numeric label cache - holds the last displayed value so the label is only
+// reformatted and invalidated when what it shows changes
+//
+typedef struct {
+	lv_obj_t* lbl;
+	bool valid;
+	int32_t val;                // Fixed-point value with decimals digits after the point
+	int decimals;
+	const char* suffix;
+	char buf[GUI_NUM_LABEL_LEN];
+} gui_num_label_t;
+
+
+
+//
+// Gauge animator - moves a gauge indicator toward its latest target from a single shared
+// timer running at the display refresh rate.  A new target retargets the running animation
+// in place from the currently displayed value.
+//
+typedef void (*gui_gauge_anim_exec_cb)(void* var, int32_t val);
+
+typedef struct {
+	void* var;
+	gui_gauge_anim_exec_cb exec_cb;
+	bool running;
+	int32_t start_val;
+	int32_t end_val;
+	int32_t cur_val;
+	uint32_t start_msec;
+	uint32_t dur_msec;
+} gui_gauge_anim_t;
+
+
+
+//
+// Trend strip - a canvas that scrolls one column to the left each time a column's worth of
+// time has passed, drawing only the new column from the min/max of the item's history
+// samples that fell within it
+//
+typedef struct {
+	lv_obj_t* canvas;                // NULL when not created
+	lv_color_t* bufP;
+	lv_coord_t w;
+	lv_coord_t h;
+	int item;
+	float min;
+	float max;
+	lv_coord_t zero_y;               // Row of the zero line (-1 if not in range)
+	lv_color_t color;
+	bool active;
+	bool started;
+	uint32_t col_msec;               // Time spanned by one column
+	uint32_t col_end_msec;           // End of the column being accumulated (history time base)
+	uint32_t write_count;            // History samples consumed
+	bool col_valid;
+	int32_t col_min;                 // History fixed-point values
+	int32_t col_max;
+	bool last_valid;
+	int32_t last_val;
+	uint32_t last_msec;
+} gui_trend_t;
+
+
+
 //
 // Popup Keyboard update function
 //
@@ -44,11 +145,49 @@ uint16_t gui_utility_setup_large_270_meter_ticks(float min, float max);
 uint16_t gui_utility_setup_small_180_meter_ticks(float min, float max);
 uint16_t gui_utility_setup_small_270_meter_ticks(float min, float max);
 
+// Styles shared by all screens (a style added to many objects costs no per-object memory)
+lv_style_t* gui_utility_get_style(int style);
+
+// Replace a meter that never changes after setup with a cached image of it
+lv_obj_t* gui_utility_cache_meter(lv_obj_t* meter);
+
+// Expand a compressed image asset into a PSRAM image (and release it)
+bool gui_utility_decode_rle_img(const gui_rle_img_t* rleP, lv_img_dsc_t* dscP);
+void gui_utility_free_rle_img(lv_img_dsc_t* dscP);
+
 // Functions used to detect average interval between updates for meter animation purposes
-void gui_utility_init_update_time(uint32_t init_delay);
+// (the vehicle's sampling period is used instead when the tile's items are sampled at a
+// constant cadence)
+void gui_utility_init_update_time(uint32_t init_delay, db_mask_t item_mask);
 void gui_utility_note_update();
 uint32_t gui_utility_get_update_period();
 
+// Gauge animation
+void gui_utility_init_gauge_anim(gui_gauge_anim_t* gaP, void* var, gui_gauge_anim_exec_cb exec_cb, int32_t val);
+void gui_utility_set_gauge_anim(gui_gauge_anim_t* gaP, int32_t val, bool immediate);
+void gui_utility_stop_gauge_anim(gui_gauge_anim_t* gaP);
+void gui_utility_hold_gauge_anims(bool hold);
+
+// Arc for a gauge updated at a high rate (a span arc when fast rendering is configured)
+lv_obj_t* gui_utility_create_gauge_arc(lv_obj_t* parent);
+
+// Set a (knobless) arc's value invalidating only the bounding boxes of the indicator
+// sectors that changed instead of the single box LVGL uses for the whole span
+void gui_utility_set_arc_value(lv_obj_t* arc, int16_t value);
+
+// Numeric labels
+void gui_utility_init_num_label(gui_num_label_t* nlP, lv_obj_t* lbl);
+void gui_utility_set_num_label(gui_num_label_t* nlP, int32_t val, int decimals, const char* suffix);
+void gui_utility_set_num_label_f(gui_num_label_t* nlP, float val, int decimals, const char* suffix);
+int gui_utility_format_fixed(char* buf, int32_t val, int decimals);
+
+// Trend strips
+lv_obj_t* gui_utility_create_trend(gui_trend_t* tP, lv_obj_t* parent, int item, lv_coord_t w, lv_coord_t h, float min, float max, lv_color_t color);
+void gui_utility_set_trend_active(gui_trend_t* tP, bool en);
+
+// Grey out an object displaying data that is stale or in error
+void gui_utility_set_stale(lv_obj_t* obj, bool stale);
+
 // Pop-up keyboards for configuration updating
 void gui_utility_display_alpha_kbd(lv_obj_t* parent, char* title, int index, char* val, int val_len, gui_utility_kbd_update_textfield cb_fcn);
 void gui_utility_display_numeric_kbd(lv_obj_t* parent, char* title, int index, char* val, int val_len, gui_utility_kbd_update_textfield cb_fcn);
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+#
+# Pack PNG images into the GUI asset bundle written to the "assets" partition.
+#
+# Usage: asset_pack.py <output.bin> [--swap] <name>=<input.png>[:rle] ...
+#
+# Images are stored as raw RGB565 (little-endian, or byte swapped with --swap
+# to match LV_COLOR_16_SWAP) that LVGL draws in place from the memory-mapped
+# partition, or with ":rle" run-length encoded as described in img_rle.py
+# (expanded into PSRAM when used).  Only the Python standard library is used
+# so this runs as part of the IDF build.
+#
+# Bundle layout (little-endian, see gui_assets.h):
+#   gui_asset_hdr_t                     at offset 0
+#   gui_asset_entry_t[num_assets]       immediately following the header
+#   asset data                          at the offsets given in each entry
+#
+# Copyright 2025 Dan Julio
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# It is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software.  If not, see <https://www.gnu.org/licenses/>.
+#
+import struct
+import sys
+
+from img_rle import read_png, rle_encode, to_rgb565
+
+MAGIC = 0x53415645          # "EVAS"
+VERSION = 1
+NAME_LEN = 16
+
+TYPE_RGB565 = 0
+TYPE_RGB565_SWAP = 1
+TYPE_RLE565 = 2
+
+HDR_FMT = '<IHHI'
+ENTRY_FMT = '<%dsBBHHHII' % NAME_LEN
+
+# Data is aligned so raw images can be used in place
+DATA_ALIGN = 4
+
+
+def main():
+    args = sys.argv[1:]
+    swap = '--swap' in args
+    args = [a for a in args if a != '--swap']
+    if len(args) < 2:
+        print('usage: asset_pack.py <output.bin> [--swap] <name>=<input.png>[:rle] ...')
+        return 1
+
+    entries = []
+    for spec in args[1:]:
+        name, path = spec.split('=', 1)
+        rle = path.endswith(':rle')
+        if rle:
+            path = path[:-4]
+        if len(name) >= NAME_LEN:
+            raise ValueError('asset name %s too long' % name)
+
+        w, h, rows = read_png(path)
+        pixels = [to_rgb565(*p) for row in rows for p in row]
+        if rle:
+            atype = TYPE_RLE565
+            data = bytes(rle_encode(pixels))
+        else:
+            atype = TYPE_RGB565_SWAP if swap else TYPE_RGB565
+            fmt = '>%dH' if swap else '<%dH'
+            data = struct.pack(fmt % len(pixels), *pixels)
+        entries.append((name, atype, w, h, data))
+
+    offset = struct.calcsize(HDR_FMT) + len(entries) * struct.calcsize(ENTRY_FMT)
+    table = b''
+    body = b''
+    for name, atype, w, h, data in entries:
+        pad = (-(offset + len(body))) % DATA_ALIGN
+        body += b'\0' * pad
+        table += struct.pack(ENTRY_FMT, name.encode(), atype, 0, w, h, 0, offset + len(body), len(data))
+        body += data
+
+    image_len = offset + len(body)
+    with open(args[0], 'wb') as f:
+        f.write(struct.pack(HDR_FMT, MAGIC, VERSION, len(entries), image_len))
+        f.write(table)
+        f.write(body)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+#
+# Extract a subset of the glyphs of an LVGL built-in (lv_font_fmt_txt) font into a new
+# C font for the GUI's numeric readouts.
+#
+# Usage: font_subset.py <lv_font_xxx.c> <output.c> <symbol> <chars> [--dram] [--fallback=<font>]
+#
+# Only the glyphs for <chars> (UTF-8) are kept, mapped by a single directly indexed
+# cmap so a glyph lookup is one table read.  Bitmaps stay uncompressed and kerning
+# classes are carried over.  With --dram the bitmaps and glyph descriptions are placed in
+# internal RAM so drawing a readout never waits on the flash cache.  Glyphs outside the
+# subset are drawn from the --fallback font when one is given.  Only the Python
+# standard library is used so this runs as part of the IDF build.
+#
+# Copyright 2025 Dan Julio
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# It is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software.  If not, see <https://www.gnu.org/licenses/>.
+#
+import os
+import re
+import sys
+
+GLYPH_RE = re.compile(r'\{\.bitmap_index = (\d+), \.adv_w = (\d+), \.box_w = (\d+), \.box_h = (\d+), '
+                      r'\.ofs_x = (-?\d+), \.ofs_y = (-?\d+)\}')
+CMAP_RE = re.compile(r'\.range_start = (\d+), \.range_length = (\d+), \.glyph_id_start = (\d+),\s*'
+                     r'\.unicode_list = (\w+), \.glyph_id_ofs_list = (\w+), \.list_length = (\d+), \.type = (\w+)')
+
+
+def array_body(src, name):
+    """Return the text between the braces of the named array definition"""
+    m = re.search(r'\b%s\[\] = \{(.*?)\n\};' % name, src, re.S)
+    if m is None:
+        raise ValueError('array %s not found' % name)
+    return re.sub(r'/\*.*?\*/', '', m.group(1), flags=re.S)
+
+
+def int_list(body):
+    return [int(v, 0) for v in re.findall(r'-?0x[0-9a-fA-F]+|-?\d+', body)]
+
+
+def field(src, name):
+    m = re.search(r'\.%s\s*=\s*(-?\d+)' % name, src)
+    if m is None:
+        raise ValueError('field %s not found' % name)
+    return int(m.group(1))
+
+
+def read_font(path):
+    with open(path) as f:
+        src = f.read()
+
+    font = {}
+    font['bitmap'] = int_list(array_body(src, 'glyph_bitmap'))
+    font['glyphs'] = [tuple(int(v) for v in g) for g in GLYPH_RE.findall(array_body(src, 'glyph_dsc'))]
+
+    # Code point -> glyph id
+    font['cmap'] = {}
+    for start, length, gid, ulist, ofs_list, list_len, ctype in CMAP_RE.findall(src):
+        start, length, gid = int(start), int(length), int(gid)
+        if ofs_list != 'NULL':
+            raise ValueError('full cmaps are not supported')
+        if ctype == 'LV_FONT_FMT_TXT_CMAP_FORMAT0_TINY':
+            for i in range(length):
+                font['cmap'][start + i] = gid + i
+        elif ctype == 'LV_FONT_FMT_TXT_CMAP_SPARSE_TINY':
+            for i, ofs in enumerate(int_list(array_body(src, ulist))):
+                font['cmap'][start + ofs] = gid + i
+        else:
+            raise ValueError('cmap type %s is not supported' % ctype)
+
+    if field(src, 'kern_classes') != 1:
+        raise ValueError('only class based kerning is supported')
+    font['kern_left'] = int_list(array_body(src, 'kern_left_class_mapping'))
+    font['kern_right'] = int_list(array_body(src, 'kern_right_class_mapping'))
+    font['kern_values'] = int_list(array_body(src, 'kern_class_values'))
+    for name in ('left_class_cnt', 'right_class_cnt', 'kern_scale', 'bpp', 'bitmap_format',
+                 'line_height', 'base_line', 'underline_position', 'underline_thickness'):
+        font[name] = field(src, name)
+    if font['bitmap_format'] != 0:
+        raise ValueError('compressed fonts are not supported')
+    return font
+
+
+def glyph_bytes(font, gid):
+    """Return the bitmap bytes of a glyph (each glyph starts on a byte boundary)"""
+    g = font['glyphs'][gid]
+    return font['bitmap'][g[0]:g[0] + (g[2] * g[3] * font['bpp'] + 7) // 8]
+
+
+def write_array(f, ctype, name, vals, attr):
+    f.write('static %sconst %s %s[] = {\n' % (attr, ctype, name))
+    for i in range(0, len(vals), 16):
+        f.write('\t' + ', '.join(str(v) if ctype != 'uint8_t' else '0x%02x' % v for v in vals[i:i + 16]) + ',\n')
+    f.write('};\n\n')
+
+
+def main():
+    args = [a for a in sys.argv[1:] if not a.startswith('--')]
+    dram = '--dram' in sys.argv[1:]
+    fallback = None
+    for a in sys.argv[1:]:
+        if a.startswith('--fallback='):
+            fallback = a[len('--fallback='):]
+    if len(args) != 4:
+        print('usage: font_subset.py <lv_font_xxx.c> <output.c> <symbol> <chars> [--dram] [--fallback=<font>]')
+        return 1
+
+    font = read_font(args[0])
+    sym = args[2]
+    cps = sorted(set(ord(c) for c in args[3]))
+    missing = [chr(cp) for cp in cps if cp not in font['cmap']]
+    if missing:
+        raise ValueError('font has no glyph for %s' % ''.join(missing))
+
+    # New glyph ids in code point order (id 0 is reserved)
+    bitmap = []
+    glyphs = [(0, 0, 0, 0, 0, 0)]
+    kern_left = [0]
+    kern_right = [0]
+    for cp in cps:
+        gid = font['cmap'][cp]
+        g = font['glyphs'][gid]
+        glyphs.append((len(bitmap),) + g[1:])
+        bitmap.extend(glyph_bytes(font, gid))
+        kern_left.append(font['kern_left'][gid])
+        kern_right.append(font['kern_right'][gid])
+
+    # Glyph id for each code point from the first to the last (0 = no glyph).  LVGL reads
+    # one entry past the range for the code point just after it so that entry is padding.
+    if len(cps) > 255:
+        raise ValueError('too many glyphs for an 8-bit cmap')
+    range_len = cps[-1] - cps[0] + 1
+    ofs_list = [0] * (range_len + 1)
+    for i, cp in enumerate(cps):
+        ofs_list[cp - cps[0]] = i + 1
+    attr = 'DRAM_ATTR ' if dram else ''
+
+    with open(args[1], 'w', encoding='utf-8') as f:
+        f.write('// Generated by font_subset.py from %s - do not edit\n' % os.path.basename(args[0]))
+        f.write('//   %d glyphs "%s", %d bitmap bytes%s\n' % (len(cps), args[3], len(bitmap),
+                ' in internal RAM' if dram else ''))
+        if dram:
+            f.write('#include "esp_attr.h"\n')
+        f.write('#include "lvgl.h"\n\n')
+        if fallback:
+            f.write('LV_FONT_DECLARE(%s)\n\n' % fallback)
+        write_array(f, 'uint8_t', 'glyph_bitmap', bitmap, attr)
+        f.write('static %sconst lv_font_fmt_txt_glyph_dsc_t glyph_dsc[] = {\n' % attr)
+        for g in glyphs:
+            f.write('\t{.bitmap_index = %d, .adv_w = %d, .box_w = %d, .box_h = %d, .ofs_x = %d, .ofs_y = %d},\n' % g)
+        f.write('};\n\n')
+        write_array(f, 'uint8_t', 'glyph_id_ofs_list', ofs_list, attr)
+        f.write('static const lv_font_fmt_txt_cmap_t cmaps[] = {\n')
+        f.write('\t{.range_start = %d, .range_length = %d, .glyph_id_start = 0, .unicode_list = NULL, '
+                '.glyph_id_ofs_list = glyph_id_ofs_list, .list_length = %d, .type = LV_FONT_FMT_TXT_CMAP_FORMAT0_FULL}\n'
+                % (cps[0], range_len, range_len))
+        f.write('};\n\n')
+        write_array(f, 'uint8_t', 'kern_left_class_mapping', kern_left, attr)
+        write_array(f, 'uint8_t', 'kern_right_class_mapping', kern_right, attr)
+        write_array(f, 'int8_t', 'kern_class_values', font['kern_values'], '')
+        f.write('static const lv_font_fmt_txt_kern_classes_t kern_classes = {\n')
+        f.write('\t.class_pair_values = kern_class_values,\n')
+        f.write('\t.left_class_mapping = kern_left_class_mapping,\n')
+        f.write('\t.right_class_mapping = kern_right_class_mapping,\n')
+        f.write('\t.left_class_cnt = %d,\n\t.right_class_cnt = %d,\n};\n\n' % (font['left_class_cnt'], font['right_class_cnt']))
+        f.write('static lv_font_fmt_txt_glyph_cache_t cache;\n')
+        f.write('static const lv_font_fmt_txt_dsc_t font_dsc = {\n')
+        f.write('\t.glyph_bitmap = glyph_bitmap,\n\t.glyph_dsc = glyph_dsc,\n\t.cmaps = cmaps,\n')
+        f.write('\t.kern_dsc = &kern_classes,\n\t.kern_scale = %d,\n\t.cmap_num = 1,\n\t.bpp = %d,\n'
+                % (font['kern_scale'], font['bpp']))
+        f.write('\t.kern_classes = 1,\n\t.bitmap_format = 0,\n\t.cache = &cache\n};\n\n')
+        f.write('const lv_font_t %s = {\n' % sym)
+        f.write('\t.get_glyph_dsc = lv_font_get_glyph_dsc_fmt_txt,\n')
+        f.write('\t.get_glyph_bitmap = lv_font_get_bitmap_fmt_txt,\n')
+        f.write('\t.line_height = %d,\n\t.base_line = %d,\n\t.subpx = LV_FONT_SUBPX_NONE,\n'
+                % (font['line_height'], font['base_line']))
+        f.write('\t.underline_position = %d,\n\t.underline_thickness = %d,\n'
+                % (font['underline_position'], font['underline_thickness']))
+        if fallback:
+            f.write('\t.fallback = &%s,\n' % fallback)
+        f.write('\t.dsc = &font_dsc\n};\n')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
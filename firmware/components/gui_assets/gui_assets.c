@@ -0,0 +1,156 @@
+/*
+ * GUI assets - access to the asset bundle in the "assets" flash data partition
+ *
+ * The partition is mapped into the data address space the first time an asset is
+ * requested and stays mapped so descriptors handed out remain valid.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "gui_assets.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include <string.h>
+
+
+
+//
+// Variables
+//
+static const char* TAG = "gui_assets";
+
+// Mapped bundle
+static bool map_tried = false;
+static esp_partition_mmap_handle_t map_handle;
+static const uint8_t* bundleP = NULL;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static bool _gui_assets_map();
+static const gui_asset_entry_t* _gui_assets_find(const char* name);
+
+
+
+//
+// API
+//
+
+// Fill an LVGL descriptor for a raw image that points into the mapped partition
+bool gui_assets_get_img(const char* name, lv_img_dsc_t* dscP)
+{
+	const gui_asset_entry_t* eP = _gui_assets_find(name);
+	
+	// Raw images must match the LVGL color byte order to be drawn in place
+	if ((eP == NULL) || (eP->type != ((LV_COLOR_16_SWAP != 0) ? GUI_ASSET_TYPE_RGB565_SWAP : GUI_ASSET_TYPE_RGB565)) ||
+	    (eP->len != (eP->w * eP->h * sizeof(uint16_t)))) {
+		return false;
+	}
+	
+	memset(dscP, 0, sizeof(lv_img_dsc_t));
+	dscP->header.cf = LV_IMG_CF_TRUE_COLOR;
+	dscP->header.w = eP->w;
+	dscP->header.h = eP->h;
+	dscP->data_size = eP->len;
+	dscP->data = bundleP + eP->offset;
+	
+	return true;
+}
+
+
+// Fill a run-length encoded image pointing into the mapped partition (expanded with
+// gui_utility_decode_rle_img())
+bool gui_assets_get_rle_img(const char* name, gui_rle_img_t* rleP)
+{
+	const gui_asset_entry_t* eP = _gui_assets_find(name);
+	
+	if ((eP == NULL) || (eP->type != GUI_ASSET_TYPE_RLE565)) {
+		return false;
+	}
+	
+	rleP->w = eP->w;
+	rleP->h = eP->h;
+	rleP->len = eP->len;
+	rleP->data = bundleP + eP->offset;
+	
+	return true;
+}
+
+
+
+//
+// Internal functions
+//
+static bool _gui_assets_map()
+{
+	const esp_partition_t* partP;
+	const gui_asset_hdr_t* hP;
+	const void* mapP;
+	esp_err_t ret;
+	
+	if (map_tried) {
+		return (bundleP != NULL);
+	}
+	map_tried = true;
+	
+	partP = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, GUI_ASSETS_PARTITION_SUBTYPE, GUI_ASSETS_PARTITION_NAME);
+	if (partP == NULL) {
+		ESP_LOGE(TAG, "No assets partition");
+		return false;
+	}
+	
+	ret = esp_partition_mmap(partP, 0, partP->size, ESP_PARTITION_MMAP_DATA, &mapP, &map_handle);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Map assets partition failed - %d", ret);
+		return false;
+	}
+	
+	// An erased partition has no bundle
+	hP = (const gui_asset_hdr_t*) mapP;
+	if ((hP->magic != GUI_ASSETS_MAGIC) || (hP->version != GUI_ASSETS_VERSION) || (hP->image_len > partP->size) ||
+	    ((sizeof(gui_asset_hdr_t) + hP->num_assets * sizeof(gui_asset_entry_t)) > hP->image_len)) {
+		ESP_LOGE(TAG, "No valid asset bundle");
+		esp_partition_munmap(map_handle);
+		return false;
+	}
+	bundleP = (const uint8_t*) mapP;
+	
+	return true;
+}
+
+
+static const gui_asset_entry_t* _gui_assets_find(const char* name)
+{
+	const gui_asset_hdr_t* hP;
+	const gui_asset_entry_t* eP;
+	
+	if (!_gui_assets_map()) {
+		return NULL;
+	}
+	
+	hP = (const gui_asset_hdr_t*) bundleP;
+	eP = (const gui_asset_entry_t*) (bundleP + sizeof(gui_asset_hdr_t));
+	for (int i=0; i<hP->num_assets; i++, eP++) {
+		if ((strncmp(eP->name, name, GUI_ASSET_NAME_LEN) == 0) && ((eP->offset + eP->len) <= hP->image_len)) {
+			return eP;
+		}
+	}
+	
+	ESP_LOGE(TAG, "No asset %s", name);
+	return NULL;
+}
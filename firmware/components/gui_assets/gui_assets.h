@@ -0,0 +1,105 @@
+/*
+ * GUI assets - images packed at build time by asset_pack.py into a bundle written to the
+ * "assets" flash data partition (so they are not part of the app image and are not
+ * rewritten by firmware updates) and font subsets generated by font_subset.py.  The
+ * partition is memory-mapped on first use and raw images are drawn by LVGL in place.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef GUI_ASSETS_H
+#define GUI_ASSETS_H
+
+#include "lvgl.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Partition
+#define GUI_ASSETS_PARTITION_NAME    "assets"
+#define GUI_ASSETS_PARTITION_SUBTYPE 0x41
+
+// Bundle identification
+#define GUI_ASSETS_MAGIC             0x53415645     /* "EVAS" */
+#define GUI_ASSETS_VERSION           1
+
+// Asset types
+#define GUI_ASSET_TYPE_RGB565        0              // Raw little-endian RGB565
+#define GUI_ASSET_TYPE_RGB565_SWAP   1              // Raw byte-swapped RGB565 (LV_COLOR_16_SWAP)
+#define GUI_ASSET_TYPE_RLE565        2              // Run-length encoded RGB565 (see img_rle.py)
+
+#define GUI_ASSET_NAME_LEN           16
+
+// Asset names (see CMakeLists.txt)
+#define GUI_ASSET_INTRO              "intro"
+
+
+
+//
+// Typedefs
+//
+
+// Bundle layout described in asset_pack.py
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t num_assets;
+	uint32_t image_len;
+} gui_asset_hdr_t;
+
+typedef struct {
+	char name[GUI_ASSET_NAME_LEN];
+	uint8_t type;
+	uint8_t rsvd1;
+	uint16_t w;
+	uint16_t h;
+	uint16_t rsvd2;
+	uint32_t offset;                 // From the start of the bundle
+	uint32_t len;
+} gui_asset_entry_t;
+
+// Run-length encoded RGB565 image (encoding described in img_rle.py)
+typedef struct {
+	uint16_t w;
+	uint16_t h;
+	uint32_t len;               // Bytes of encoded data
+	const uint8_t* data;
+} gui_rle_img_t;
+
+
+
+//
+// Assets
+//
+
+// Numeric readout font subsets (see font_subset.py and CMakeLists.txt for the glyphs)
+LV_FONT_DECLARE(gui_font_readout_48)
+LV_FONT_DECLARE(gui_font_readout_30)
+
+
+
+//
+// API
+//
+bool gui_assets_get_img(const char* name, lv_img_dsc_t* dscP);
+bool gui_assets_get_rle_img(const char* name, gui_rle_img_t* rleP);
+
+#endif /* GUI_ASSETS_H */
\ No newline at end of file
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+#
+# Convert a PNG image into a run-length encoded RGB565 C asset for the GUI.
+#
+# Usage: img_rle.py <input.png> <output.c> <symbol>
+#
+# The output holds a gui_rle_img_t (see gui_assets.h) named <symbol> that
+# gui_utility_decode_rle_img() expands into a PSRAM image at runtime.  Only
+# the Python standard library is used so this runs as part of the IDF build.
+#
+# Encoding: a stream of packets, each starting with a control byte c
+#   c < 0x80  : c + 1 literal pixels follow
+#   c >= 0x80 : the single pixel that follows is repeated (c - 0x80) + 2 times
+# Pixels are 16-bit RGB565, little-endian.
+#
+# Copyright 2025 Dan Julio
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# It is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software.  If not, see <https://www.gnu.org/licenses/>.
+#
+import os
+import struct
+import sys
+import zlib
+
+MAX_LITERAL = 128
+MAX_RUN = 129
+
+
+def read_png(path):
+    """Return (w, h, rows) for an 8-bit, non-interlaced RGB or RGBA PNG; rows hold RGB tuples"""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data[:8] != b'\x89PNG\r\n\x1a\n':
+        raise ValueError('not a PNG file')
+
+    pos = 8
+    idat = b''
+    while pos < len(data):
+        length, ctype = struct.unpack('>I4s', data[pos:pos + 8])
+        body = data[pos + 8:pos + 8 + length]
+        if ctype == b'IHDR':
+            w, h, depth, color, _, _, interlace = struct.unpack('>IIBBBBB', body)
+        elif ctype == b'IDAT':
+            idat += body
+        elif ctype == b'IEND':
+            break
+        pos += length + 12
+
+    if depth != 8 or color not in (2, 6) or interlace != 0:
+        raise ValueError('only 8-bit non-interlaced RGB/RGBA PNG files are supported')
+    bpp = 3 if color == 2 else 4
+
+    raw = zlib.decompress(idat)
+    stride = w * bpp
+    prev = bytearray(stride)
+    rows = []
+    pos = 0
+    for _ in range(h):
+        ftype = raw[pos]
+        line = bytearray(raw[pos + 1:pos + 1 + stride])
+        pos += stride + 1
+        for i in range(stride):
+            a = line[i - bpp] if i >= bpp else 0
+            b = prev[i]
+            c = prev[i - bpp] if i >= bpp else 0
+            if ftype == 1:
+                line[i] = (line[i] + a) & 0xFF
+            elif ftype == 2:
+                line[i] = (line[i] + b) & 0xFF
+            elif ftype == 3:
+                line[i] = (line[i] + ((a + b) >> 1)) & 0xFF
+            elif ftype == 4:
+                p = a + b - c
+                pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+                pred = a if (pa <= pb and pa <= pc) else (b if pb <= pc else c)
+                line[i] = (line[i] + pred) & 0xFF
+        rows.append([tuple(line[i:i + 3]) for i in range(0, stride, bpp)])
+        prev = line
+    return w, h, rows
+
+
+def to_rgb565(r, g, b):
+    return (((r * 31 + 127) // 255) << 11) | (((g * 63 + 127) // 255) << 5) | ((b * 31 + 127) // 255)
+
+
+def rle_encode(pixels):
+    out = bytearray()
+    literal = []
+
+    def flush_literal():
+        while literal:
+            n = min(len(literal), MAX_LITERAL)
+            out.append(n - 1)
+            for p in literal[:n]:
+                out.extend(struct.pack('<H', p))
+            del literal[:n]
+
+    i = 0
+    while i < len(pixels):
+        run = 1
+        while (i + run < len(pixels)) and (pixels[i + run] == pixels[i]) and (run < MAX_RUN):
+            run += 1
+        if run >= 2:
+            flush_literal()
+            out.append(0x80 + run - 2)
+            out.extend(struct.pack('<H', pixels[i]))
+        else:
+            literal.append(pixels[i])
+        i += run
+    flush_literal()
+    return out
+
+
+def main():
+    if len(sys.argv) != 4:
+        print('usage: img_rle.py <input.png> <output.c> <symbol>')
+        return 1
+
+    w, h, rows = read_png(sys.argv[1])
+    pixels = [to_rgb565(*p) for row in rows for p in row]
+    rle = rle_encode(pixels)
+    sym = sys.argv[3]
+
+    with open(sys.argv[2], 'w') as f:
+        f.write('// Generated by img_rle.py from %s - do not edit\n' % os.path.basename(sys.argv[1]))
+        f.write('//   %d x %d RGB565, %d bytes encoded (%d raw)\n' % (w, h, len(rle), w * h * 2))
+        f.write('#include "gui_assets.h"\n\n')
+        f.write('static const uint8_t %s_data[] = {\n' % sym)
+        for i in range(0, len(rle), 16):
+            f.write('\t' + ', '.join('0x%02x' % b for b in rle[i:i + 16]) + ',\n')
+        f.write('};\n\n')
+        f.write('const gui_rle_img_t %s = {\n' % sym)
+        f.write('\t.w = %d,\n\t.h = %d,\n\t.len = %d,\n\t.data = %s_data,\n};\n' % (w, h, len(rle), sym))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,4 +1,10 @@
 #include "ST7701S.h"
+#include <string.h>
+#if CONFIG_USE_DMA_FLUSH
+#include "esp_async_memcpy.h"
+#include "esp_cache.h"
+#include "esp_heap_caps.h"
+#endif
 
 #define SPI_WriteComm(cmd) ST7701S_WriteCommand(St7701S_handle, cmd)
 #define SPI_WriteData(data) ST7701S_WriteData(St7701S_handle, data)
@@ -407,18 +413,48 @@ esp_err_t ST7701S_CS_Dis(void)
     return ret;
 }
 
-#if CONFIG_AVOID_TEAR_EFFECT_WITH_SEM
+#if CONFIG_AVOID_TEAR_EFFECT_WITH_SEM || CONFIG_USE_DIRECT_MODE
 SemaphoreHandle_t sem_vsync_end;
 SemaphoreHandle_t sem_gui_ready;
 #endif
 
+#if CONFIG_USE_ASYNC_FLUSH
+// Stripe handed to the flush task (LVGL won't start another flush until this one is ready)
+static TaskHandle_t flush_task_handle;
+static lv_disp_drv_t *flush_drv;
+static lv_area_t flush_area;
+static lv_color_t *flush_color_map;
+
+static void lvgl_flush_task(void *arg);
+#endif
+
+#if CONFIG_USE_DMA_FLUSH
+// Stripe being copied by the async memcpy engine (one transfer per row unless full width).
+// The completion callback of the last outstanding row wakes the flush task.
+static async_memcpy_handle_t flush_mcp;
+static TaskHandle_t flush_task_handle;
+static lv_disp_drv_t *flush_drv;
+static lv_area_t flush_area;
+static lv_color_t *flush_fb;
+static size_t flush_cache_align;
+static int flush_rows_pending;
+static portMUX_TYPE flush_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool lvgl_dma_flush(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t *color_map);
+static bool lvgl_dma_done_cb(async_memcpy_handle_t mcp, async_memcpy_event_t *event, void *cb_args);
+static void lvgl_flush_task(void *arg);
+#endif
+
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static bool IRAM_ATTR on_vsync_event(esp_lcd_panel_handle_t panel, const esp_lcd_rgb_panel_event_data_t *event_data, void *user_data)
 {
     BaseType_t high_task_awoken = pdFALSE;
-#if CONFIG_AVOID_TEAR_EFFECT_WITH_SEM
+#if CONFIG_USE_DIRECT_MODE
+    // Signal every vsync - the flush waits for the one after it switched buffers
+    xSemaphoreGiveFromISR(sem_vsync_end, &high_task_awoken);
+#elif CONFIG_AVOID_TEAR_EFFECT_WITH_SEM
     if (xSemaphoreTakeFromISR(sem_gui_ready, &high_task_awoken) == pdTRUE) {
         xSemaphoreGiveFromISR(sem_vsync_end, &high_task_awoken);
     }
@@ -438,7 +474,7 @@ void LCD_Init(lv_disp_drv_t* disp_drv)
     ESP_ERROR_CHECK(ST7701S_CS_EN());
     ST7701S_screen_init(st7701s, 1);
     
-#if CONFIG_AVOID_TEAR_EFFECT_WITH_SEM
+#if CONFIG_AVOID_TEAR_EFFECT_WITH_SEM || CONFIG_USE_DIRECT_MODE
     ESP_LOGI(TAG, "Create tear effect semaphores");
     sem_vsync_end = xSemaphoreCreateBinary();
     assert(sem_vsync_end);
@@ -505,12 +541,82 @@ void LCD_Init(lv_disp_drv_t* disp_drv)
     ESP_ERROR_CHECK(esp_lcd_panel_init(panel_handle));
     ESP_ERROR_CHECK(ST7701S_CS_Dis());
     Backlight_Init();
+
+#if CONFIG_USE_ASYNC_FLUSH
+    // Runs on the core opposite gui_task so stripe copies overlap rendering
+    ESP_LOGI(TAG, "Start flush task");
+    xTaskCreatePinnedToCore(&lvgl_flush_task, "lcd_flush", 2048, NULL, 3, &flush_task_handle, 0);
+#endif
+
+#if CONFIG_USE_DMA_FLUSH
+    // One queued transfer per row of a stripe
+    ESP_LOGI(TAG, "Install async memcpy for flushes");
+    async_memcpy_config_t mcp_config = ASYNC_MEMCPY_DEFAULT_CONFIG();
+    mcp_config.backlog = LCD_PARTIAL_BUF_LINES;
+    ESP_ERROR_CHECK(esp_async_memcpy_install(&mcp_config, &flush_mcp));
+    ESP_ERROR_CHECK(esp_lcd_rgb_panel_get_frame_buffer(panel_handle, 1, (void**) &flush_fb));
+    ESP_ERROR_CHECK(esp_cache_get_alignment(MALLOC_CAP_SPIRAM, &flush_cache_align));
+    if (flush_cache_align == 0) flush_cache_align = 4;
+    xTaskCreatePinnedToCore(&lvgl_flush_task, "lcd_flush", 2048, NULL, 3, &flush_task_handle, 0);
+#endif
+}
+
+
+#if CONFIG_USE_DIRECT_MODE
+void LCD_Get_Frame_Buffers(void** fb1, void** fb2)
+{
+    ESP_ERROR_CHECK(esp_lcd_rgb_panel_get_frame_buffer(panel_handle, 2, fb1, fb2));
 }
 
 
+// Copy the areas redrawn this frame from the buffer now being displayed into the other
+// buffer so LVGL's next (partial) frame in it starts from the current screen contents
+static void lvgl_sync_other_fb(lv_disp_drv_t *drv, lv_color_t *displayed_fb)
+{
+    lv_disp_t *disp = _lv_refr_get_disp_refreshing();
+    lv_color_t *other_fb;
+    lv_area_t *a;
+    int w;
+    
+    other_fb = (drv->draw_buf->buf1 == displayed_fb) ? drv->draw_buf->buf2 : drv->draw_buf->buf1;
+    for (int i = 0; i < disp->inv_p; i++) {
+        if (disp->inv_area_joined[i]) continue;
+        
+        a = &disp->inv_areas[i];
+        w = lv_area_get_width(a);
+        for (int y = a->y1; y <= a->y2; y++) {
+            memcpy(&other_fb[y * LCD_H_RES + a->x1], &displayed_fb[y * LCD_H_RES + a->x1], w * sizeof(lv_color_t));
+        }
+    }
+}
+#endif
+
+
 void lvgl_flush_cb(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t *color_map)
 {
     esp_lcd_panel_handle_t panel_handle = (esp_lcd_panel_handle_t) drv->user_data;
+#if CONFIG_USE_DIRECT_MODE
+    // color_map is a whole panel frame buffer.  Once every area of the frame has been drawn,
+    // switch the panel to it (no copy) and wait until the switch has happened at vsync.
+    if (lv_disp_flush_is_last(drv)) {
+        xSemaphoreTake(sem_vsync_end, 0);
+        esp_lcd_panel_draw_bitmap(panel_handle, 0, 0, LCD_H_RES, LCD_V_RES, color_map);
+        xSemaphoreTake(sem_vsync_end, portMAX_DELAY);
+        lvgl_sync_other_fb(drv, color_map);
+    }
+    lv_disp_flush_ready(drv);
+    return;
+#endif
+
+#if CONFIG_USE_ASYNC_FLUSH
+    // Hand the stripe off - lvgl_flush_task signals ready when it has been copied
+    flush_drv = drv;
+    flush_area = *area;
+    flush_color_map = color_map;
+    xTaskNotifyGive(flush_task_handle);
+    return;
+#endif
+
     int offsetx1 = area->x1;
     int offsetx2 = area->x2;
     int offsety1 = area->y1;
@@ -520,12 +626,141 @@ void lvgl_flush_cb(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t *color_
     xSemaphoreTake(sem_vsync_end, portMAX_DELAY);
 #endif
 	
+#if CONFIG_USE_DMA_FLUSH
+    // The completion signals ready (falls back to the CPU copy if no row could be queued)
+    if (lvgl_dma_flush(drv, area, color_map)) {
+        return;
+    }
+#endif
+	
     // pass the draw buffer to the driver
     esp_lcd_panel_draw_bitmap(panel_handle, offsetx1, offsety1, offsetx2 + 1, offsety2 + 1, color_map);
     lv_disp_flush_ready(drv);
 }
 
 
+#if CONFIG_USE_ASYNC_FLUSH
+static void lvgl_flush_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#if CONFIG_AVOID_TEAR_EFFECT_WITH_SEM
+        xSemaphoreGive(sem_gui_ready);
+        xSemaphoreTake(sem_vsync_end, portMAX_DELAY);
+#endif
+        esp_lcd_panel_draw_bitmap((esp_lcd_panel_handle_t) flush_drv->user_data, flush_area.x1, flush_area.y1,
+                                  flush_area.x2 + 1, flush_area.y2 + 1, flush_color_map);
+        lv_disp_flush_ready(flush_drv);
+    }
+}
+#endif
+
+
+#if CONFIG_USE_DMA_FLUSH
+// Widen areas to whole LCD_DMA_FLUSH_ALIGN_PX column groups so every row transfer (and the
+// matching draw buffer rows) start and end on 32-byte boundaries
+void lvgl_rounder_cb(lv_disp_drv_t *drv, lv_area_t *area)
+{
+    area->x1 = area->x1 & ~(LCD_DMA_FLUSH_ALIGN_PX - 1);
+    area->x2 = (area->x2 | (LCD_DMA_FLUSH_ALIGN_PX - 1));
+    if (area->x2 >= LCD_H_RES) area->x2 = LCD_H_RES - 1;
+}
+
+
+// Queue the stripe's rows (a single transfer when it spans the full width).  Rows that
+// can't be queued are copied by the CPU and written back from the cache.  Returns false
+// if nothing was queued (the caller copies the whole stripe).
+static bool lvgl_dma_flush(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t *color_map)
+{
+    int w = lv_area_get_width(area);
+    int h = lv_area_get_height(area);
+    int rows = (w == LCD_H_RES) ? 1 : h;
+    size_t len = (w == LCD_H_RES) ? (size_t) w * h * sizeof(lv_color_t) : (size_t) w * sizeof(lv_color_t);
+    lv_color_t *dst;
+    lv_color_t *src;
+    bool done;
+    int n;
+    
+    flush_drv = drv;
+    flush_area = *area;
+    
+    // Held at one until every row is queued so completions can't finish the flush early
+    flush_rows_pending = 1;
+    for (n = 0; n < rows; n++) {
+        dst = &flush_fb[(area->y1 + n) * LCD_H_RES + area->x1];
+        src = &color_map[n * w];
+        portENTER_CRITICAL(&flush_mux);
+        flush_rows_pending += 1;
+        portEXIT_CRITICAL(&flush_mux);
+        if (esp_async_memcpy(flush_mcp, dst, src, len, lvgl_dma_done_cb, NULL) != ESP_OK) {
+            portENTER_CRITICAL(&flush_mux);
+            flush_rows_pending -= 1;
+            portEXIT_CRITICAL(&flush_mux);
+            break;
+        }
+    }
+    
+    if (n == 0) {
+        return false;
+    }
+    
+    for (; n < rows; n++) {
+        dst = &flush_fb[(area->y1 + n) * LCD_H_RES + area->x1];
+        memcpy(dst, &color_map[n * w], len);
+        esp_cache_msync(dst, len, ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_UNALIGNED);
+    }
+    
+    portENTER_CRITICAL(&flush_mux);
+    flush_rows_pending -= 1;
+    done = (flush_rows_pending == 0);
+    portEXIT_CRITICAL(&flush_mux);
+    if (done) {
+        xTaskNotifyGive(flush_task_handle);
+    }
+    
+    return true;
+}
+
+
+static bool IRAM_ATTR lvgl_dma_done_cb(async_memcpy_handle_t mcp, async_memcpy_event_t *event, void *cb_args)
+{
+    BaseType_t high_task_awoken = pdFALSE;
+    bool done;
+    
+    portENTER_CRITICAL_ISR(&flush_mux);
+    flush_rows_pending -= 1;
+    done = (flush_rows_pending == 0);
+    portEXIT_CRITICAL_ISR(&flush_mux);
+    
+    if (done) {
+        vTaskNotifyGiveFromISR(flush_task_handle, &high_task_awoken);
+    }
+    return high_task_awoken == pdTRUE;
+}
+
+
+// The panel's bounce buffers are filled from the frame buffer through the cache so drop
+// any cached copy of the rows the DMA wrote before telling LVGL the buffer is free
+static void lvgl_flush_task(void *arg)
+{
+    uintptr_t start;
+    uintptr_t end;
+    
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        
+        start = (uintptr_t) &flush_fb[flush_area.y1 * LCD_H_RES + flush_area.x1];
+        end = (uintptr_t) &flush_fb[flush_area.y2 * LCD_H_RES + flush_area.x2 + 1];
+        start &= ~(flush_cache_align - 1);
+        end = (end + flush_cache_align - 1) & ~(flush_cache_align - 1);
+        (void) esp_cache_msync((void *) start, end - start, ESP_CACHE_MSYNC_FLAG_DIR_M2C);
+        
+        lv_disp_flush_ready(flush_drv);
+    }
+}
+#endif
+
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Backlight program
 
@@ -567,23 +802,40 @@ void Backlight_Init(void)
     Set_Backlight(100);      //0~100
 }
 
-void Set_Backlight(uint8_t Light)
-{   
+static uint16_t Backlight_Duty(uint8_t Light)
+{
     if (Light > Backlight_MAX) {
     	backlight_level = Backlight_MAX;
     } else {
     	backlight_level = Light;
     }
     
-    uint16_t Duty = LEDC_MAX_Duty-(81*(Backlight_MAX-backlight_level));
     if (backlight_level == 0) {
-        Duty = 0;
+        return 0;
     }
+    return LEDC_MAX_Duty-(81*(Backlight_MAX-backlight_level));
+}
+
+void Set_Backlight(uint8_t Light)
+{   
+    uint16_t Duty = Backlight_Duty(Light);
+    
     ESP_LOGI(TAG, "Set Backlight to %u (%u)", Duty, backlight_level);
+    (void) ledc_fade_stop(ledc_channel.speed_mode, ledc_channel.channel);
     ledc_set_duty(ledc_channel.speed_mode, ledc_channel.channel, Duty);
     ledc_update_duty(ledc_channel.speed_mode, ledc_channel.channel);
 }
 
+// The LEDC hardware runs the fade so this returns immediately
+void Fade_Backlight(uint8_t Light, int Fade_ms)
+{
+    uint16_t Duty = Backlight_Duty(Light);
+    
+    ESP_LOGI(TAG, "Fade Backlight to %u (%u) over %d mSec", Duty, backlight_level, Fade_ms);
+    (void) ledc_fade_stop(ledc_channel.speed_mode, ledc_channel.channel);
+    ledc_set_fade_time_and_start(ledc_channel.speed_mode, ledc_channel.channel, Duty, Fade_ms, LEDC_FADE_NO_WAIT);
+}
+
 uint8_t Get_Backlight()
 {
 	return backlight_level;
@@ -29,6 +29,12 @@
 
 #define LCD_PIXEL_CLOCK_HZ     (18 * 1000 * 1000)
 
+// Lines in each internal RAM partial draw buffer (1/10 screen)
+#define LCD_PARTIAL_BUF_LINES  48
+
+// DMA flush: areas are rounded out to this many pixel columns (32-byte aligned rows)
+#define LCD_DMA_FLUSH_ALIGN_PX 16
+
 #define PIN_NUM_BK_LIGHT       6
 #define PIN_NUM_HSYNC          38
 #define PIN_NUM_VSYNC          39
@@ -52,7 +58,7 @@
 #define PIN_NUM_DATA15         17 // R4
 #define PIN_NUM_DISP_EN        -1
 
-#if CONFIG_DOUBLE_FB
+#if CONFIG_DOUBLE_FB || CONFIG_USE_DIRECT_MODE
 #define LCD_NUM_FB             2
 #else
 #define LCD_NUM_FB             1
@@ -70,7 +76,7 @@
 #define Backlight_MAX          100      
 
 
-#if CONFIG_AVOID_TEAR_EFFECT_WITH_SEM
+#if CONFIG_AVOID_TEAR_EFFECT_WITH_SEM || CONFIG_USE_DIRECT_MODE
 extern SemaphoreHandle_t sem_vsync_end;
 extern SemaphoreHandle_t sem_gui_ready;
 #endif
@@ -101,10 +107,17 @@ esp_err_t ST7701S_reset(void);// LCD Reset
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void LCD_Init(lv_disp_drv_t* disp_drv);
 void lvgl_flush_cb(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t *color_map);
+#if CONFIG_USE_DIRECT_MODE
+void LCD_Get_Frame_Buffers(void** fb1, void** fb2);
+#endif
+#if CONFIG_USE_DMA_FLUSH
+void lvgl_rounder_cb(lv_disp_drv_t *drv, lv_area_t *area);
+#endif
 
 /********************* BackLight *********************/
 void Backlight_Init(void);
 void Set_Backlight(uint8_t Light);
+void Fade_Backlight(uint8_t Light, int Fade_ms);
 uint8_t Get_Backlight();
 
 #endif /* ST7701S_H_ */
\ No newline at end of file
@@ -0,0 +1,310 @@
+/*
+ * RGB565 blend kernels for LVGL's software renderer - installed as the draw context's
+ * blend function, they handle normal-mode fills and image copies (with opacity and masks)
+ * keeping each pixel's channels spread in one 32-bit word so a blend takes two multiplies
+ * instead of three per-channel mixes, and pass everything else to LVGL's routine.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <esp_log.h>
+#include "esp_heap_caps.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "disp_blend.h"
+#include "src/draw/sw/lv_draw_sw.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+// Comment out to use LVGL's blend routines
+#define DISP_FAST_BLEND
+
+// RGB565 pixel with its green, red and blue fields spread apart (G in bits 21-26, R in
+// 11-15, B in 0-4) leaving room for each to be multiplied by a 5-bit weight in place
+#define SPREAD_MASK         0x07E0F81F
+#define SPREAD(c)           ((((uint32_t) (c)) | (((uint32_t) (c)) << 16)) & SPREAD_MASK)
+#define PACK(s)             ((uint16_t) ((s) | ((s) >> 16)))
+
+// LVGL 8-bit opacity to a 0 - 32 weight
+#define WEIGHT(opa)         ((((uint32_t) (opa)) + 4) >> 3)
+
+
+// Variables
+static const char* TAG = "disp_blend";
+
+
+// Forward declarations for internal functions
+static void _disp_blend_init_ctx(lv_disp_drv_t* disp_drv, lv_draw_ctx_t* draw_ctx);
+static void _disp_blend(lv_draw_ctx_t* draw_ctx, const lv_draw_sw_blend_dsc_t* dsc);
+static void _disp_blend_fill(uint16_t* dest, lv_coord_t dest_stride, int32_t w, int32_t h, uint16_t color, lv_opa_t opa, const lv_opa_t* mask, lv_coord_t mask_stride);
+static void _disp_blend_map(uint16_t* dest, lv_coord_t dest_stride, int32_t w, int32_t h, const uint16_t* src, lv_coord_t src_stride, lv_opa_t opa, const lv_opa_t* mask, lv_coord_t mask_stride);
+static uint32_t _disp_blend_time(lv_draw_sw_ctx_t* ctxP, const lv_draw_sw_blend_dsc_t* dsc);
+
+
+
+// API
+void disp_blend_init(lv_disp_drv_t* disp_drv)
+{
+#ifdef DISP_FAST_BLEND
+	disp_drv->draw_ctx_init = _disp_blend_init_ctx;
+	disp_drv->draw_ctx_size = sizeof(lv_draw_sw_ctx_t);
+#endif
+}
+
+
+// Time LVGL's blend and ours for opaque and translucent fills and copies, and masked fills
+// (anti-aliased edges), over a partial draw buffer sized area
+void disp_blend_bench()
+{
+	static const char* names[] = {"fill", "fill 50%", "fill mask", "copy", "copy 50%"};
+	lv_disp_t* disp = lv_disp_get_default();
+	lv_disp_t* prev_disp = _lv_refr_get_disp_refreshing();
+	lv_draw_sw_ctx_t ctx;
+	lv_draw_sw_blend_dsc_t dsc;
+	lv_area_t area = {0, 0, DISP_BLEND_BENCH_W - 1, DISP_BLEND_BENCH_H - 1};
+	lv_color_t* dest;
+	lv_color_t* src;
+	lv_opa_t* mask;
+	uint32_t t_lvgl, t_fast;
+	int n = DISP_BLEND_BENCH_W * DISP_BLEND_BENCH_H;
+	
+	dest = heap_caps_malloc(n * sizeof(lv_color_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	src = heap_caps_malloc(n * sizeof(lv_color_t), MALLOC_CAP_SPIRAM);
+	mask = heap_caps_malloc(n, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	if ((dest == NULL) || (src == NULL) || (mask == NULL)) {
+		ESP_LOGE(TAG, "Could not allocate benchmark buffers");
+		free(dest);
+		free(src);
+		free(mask);
+		return;
+	}
+	
+	// Mostly transparent or opaque mask with partial coverage at its edges like a glyph
+	for (int i=0; i<n; i++) {
+		src[i].full = (uint16_t) esp_random();
+		dest[i].full = (uint16_t) esp_random();
+		switch (i % 16) {
+			case 0: case 1: case 2: case 3: case 4: case 5:
+				mask[i] = LV_OPA_TRANSP;
+				break;
+			case 6: case 15:
+				mask[i] = (lv_opa_t) (esp_random() & 0xFF);
+				break;
+			default:
+				mask[i] = LV_OPA_COVER;
+		}
+	}
+	
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.base_draw.buf = dest;
+	ctx.base_draw.buf_area = &area;
+	ctx.base_draw.clip_area = &area;
+	_lv_refr_set_disp_refreshing(disp);
+	
+	ESP_LOGI(TAG, "Blend benchmark %dx%d (uSec per pass: LVGL, fast)", DISP_BLEND_BENCH_W, DISP_BLEND_BENCH_H);
+	for (int k=0; k<5; k++) {
+		memset(&dsc, 0, sizeof(dsc));
+		dsc.blend_area = &area;
+		dsc.color = lv_color_make(0x20, 0xC0, 0x60);
+		dsc.opa = ((k == 1) || (k == 4)) ? LV_OPA_50 : LV_OPA_COVER;
+		dsc.src_buf = (k >= 3) ? src : NULL;
+		dsc.mask_buf = (k == 2) ? mask : NULL;
+		dsc.mask_area = &area;
+		dsc.mask_res = (k == 2) ? LV_DRAW_MASK_RES_CHANGED : LV_DRAW_MASK_RES_FULL_COVER;
+		dsc.blend_mode = LV_BLEND_MODE_NORMAL;
+		
+		ctx.blend = lv_draw_sw_blend_basic;
+		t_lvgl = _disp_blend_time(&ctx, &dsc);
+		ctx.blend = _disp_blend;
+		t_fast = _disp_blend_time(&ctx, &dsc);
+		ESP_LOGI(TAG, "  %-10s %6lu %6lu", names[k], t_lvgl, t_fast);
+	}
+	
+	_lv_refr_set_disp_refreshing(prev_disp);
+	
+	free(dest);
+	free(src);
+	free(mask);
+}
+
+
+
+// Internal functions
+static void _disp_blend_init_ctx(lv_disp_drv_t* disp_drv, lv_draw_ctx_t* draw_ctx)
+{
+	lv_draw_sw_init_ctx(disp_drv, draw_ctx);
+	((lv_draw_sw_ctx_t*) draw_ctx)->blend = _disp_blend;
+}
+
+
+// Same area and mask arithmetic as lv_draw_sw_blend_basic()
+static LV_ATTRIBUTE_FAST_MEM void _disp_blend(lv_draw_ctx_t* draw_ctx, const lv_draw_sw_blend_dsc_t* dsc)
+{
+	lv_disp_t* disp = _lv_refr_get_disp_refreshing();
+	const lv_opa_t* mask;
+	const lv_color_t* src;
+	lv_color_t* dest;
+	lv_coord_t dest_stride;
+	lv_coord_t src_stride = 0;
+	lv_coord_t mask_stride = 0;
+	lv_area_t a;
+	
+	if ((dsc->blend_mode != LV_BLEND_MODE_NORMAL) || (disp->driver->set_px_cb != NULL)) {
+		lv_draw_sw_blend_basic(draw_ctx, dsc);
+		return;
+	}
+	
+	if ((dsc->mask_buf == NULL) || (dsc->mask_res == LV_DRAW_MASK_RES_FULL_COVER)) {
+		mask = NULL;
+	} else if (dsc->mask_res == LV_DRAW_MASK_RES_TRANSP) {
+		return;
+	} else {
+		mask = dsc->mask_buf;
+	}
+	
+	if (!_lv_area_intersect(&a, dsc->blend_area, draw_ctx->clip_area)) return;
+	
+	dest_stride = lv_area_get_width(draw_ctx->buf_area);
+	dest = (lv_color_t*) draw_ctx->buf + dest_stride * (a.y1 - draw_ctx->buf_area->y1) + (a.x1 - draw_ctx->buf_area->x1);
+	
+	src = dsc->src_buf;
+	if (src != NULL) {
+		src_stride = lv_area_get_width(dsc->blend_area);
+		src += src_stride * (a.y1 - dsc->blend_area->y1) + (a.x1 - dsc->blend_area->x1);
+	}
+	
+	if (mask != NULL) {
+		mask_stride = lv_area_get_width(dsc->mask_area);
+		mask += mask_stride * (a.y1 - dsc->mask_area->y1) + (a.x1 - dsc->mask_area->x1);
+	}
+	
+	if (src == NULL) {
+		_disp_blend_fill((uint16_t*) dest, dest_stride, lv_area_get_width(&a), lv_area_get_height(&a), dsc->color.full, dsc->opa, mask, mask_stride);
+	} else {
+		_disp_blend_map((uint16_t*) dest, dest_stride, lv_area_get_width(&a), lv_area_get_height(&a), (const uint16_t*) src, src_stride, dsc->opa, mask, mask_stride);
+	}
+}
+
+
+static LV_ATTRIBUTE_FAST_MEM void _disp_blend_fill(uint16_t* dest, lv_coord_t dest_stride, int32_t w, int32_t h, uint16_t color, lv_opa_t opa, const lv_opa_t* mask, lv_coord_t mask_stride)
+{
+	lv_color_t c = {.full = color};
+	uint32_t fg = SPREAD(color);
+	uint32_t fg_w;
+	uint32_t bg_w;
+	uint32_t a;
+	int32_t x;
+	
+	if (mask == NULL) {
+		if (opa >= LV_OPA_MAX) {
+			for (int32_t y=0; y<h; y++) {
+				lv_color_fill((lv_color_t*) dest, c, w);
+				dest += dest_stride;
+			}
+		} else {
+			// Foreground term is the same for every pixel
+			a = WEIGHT(opa);
+			fg_w = fg * a;
+			bg_w = 32 - a;
+			for (int32_t y=0; y<h; y++) {
+				for (x=0; x<w; x++) {
+					dest[x] = PACK(((fg_w + SPREAD(dest[x]) * bg_w) >> 5) & SPREAD_MASK);
+				}
+				dest += dest_stride;
+			}
+		}
+		return;
+	}
+	
+	for (int32_t y=0; y<h; y++) {
+		x = 0;
+		while (x < w) {
+			// Skip or fill runs of 4 fully transparent or opaque mask bytes at once
+			if ((((uintptr_t) &mask[x] & 0x3) == 0) && ((x + 4) <= w)) {
+				uint32_t m32 = *((const uint32_t*) &mask[x]);
+				if (m32 == 0) {
+					x += 4;
+					continue;
+				}
+				if ((m32 == 0xFFFFFFFF) && (opa >= LV_OPA_MAX)) {
+					dest[x] = color;
+					dest[x+1] = color;
+					dest[x+2] = color;
+					dest[x+3] = color;
+					x += 4;
+					continue;
+				}
+			}
+			
+			a = (opa >= LV_OPA_MAX) ? mask[x] : ((uint32_t) opa * mask[x]) >> 8;
+			if (a >= LV_OPA_MAX) {
+				dest[x] = color;
+			} else if (a > LV_OPA_MIN) {
+				a = WEIGHT(a);
+				dest[x] = PACK(((fg * a + SPREAD(dest[x]) * (32 - a)) >> 5) & SPREAD_MASK);
+			}
+			x++;
+		}
+		dest += dest_stride;
+		mask += mask_stride;
+	}
+}
+
+
+static LV_ATTRIBUTE_FAST_MEM void _disp_blend_map(uint16_t* dest, lv_coord_t dest_stride, int32_t w, int32_t h, const uint16_t* src, lv_coord_t src_stride, lv_opa_t opa, const lv_opa_t* mask, lv_coord_t mask_stride)
+{
+	uint32_t a;
+	
+	for (int32_t y=0; y<h; y++) {
+		if ((mask == NULL) && (opa >= LV_OPA_MAX)) {
+			memcpy(dest, src, w * sizeof(uint16_t));
+		} else {
+			for (int32_t x=0; x<w; x++) {
+				if (mask == NULL) {
+					a = opa;
+				} else if (opa >= LV_OPA_MAX) {
+					a = mask[x];
+				} else {
+					a = ((uint32_t) opa * mask[x]) >> 8;
+				}
+				
+				if (a >= LV_OPA_MAX) {
+					dest[x] = src[x];
+				} else if (a > LV_OPA_MIN) {
+					a = WEIGHT(a);
+					dest[x] = PACK(((SPREAD(src[x]) * a + SPREAD(dest[x]) * (32 - a)) >> 5) & SPREAD_MASK);
+				}
+			}
+			if (mask != NULL) mask += mask_stride;
+		}
+		dest += dest_stride;
+		src += src_stride;
+	}
+}
+
+
+// Average uSec per pass
+static uint32_t _disp_blend_time(lv_draw_sw_ctx_t* ctxP, const lv_draw_sw_blend_dsc_t* dsc)
+{
+	int64_t t = esp_timer_get_time();
+	
+	for (int i=0; i<DISP_BLEND_BENCH_PASSES; i++) {
+		ctxP->blend(&ctxP->base_draw, dsc);
+	}
+	
+	return (uint32_t) ((esp_timer_get_time() - t) / DISP_BLEND_BENCH_PASSES);
+}
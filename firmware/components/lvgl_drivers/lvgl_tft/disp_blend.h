@@ -0,0 +1,38 @@
+/*
+ * RGB565 blend kernels for LVGL's software renderer - installed as the draw context's
+ * blend function, they handle normal-mode fills and image copies (with opacity and masks)
+ * keeping each pixel's channels spread in one 32-bit word so a blend takes two multiplies
+ * instead of three per-channel mixes, and pass everything else to LVGL's routine.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef DISP_BLEND_H_
+#define DISP_BLEND_H_
+#include "lvgl.h"
+
+
+// Micro-benchmark area (a partial draw buffer's worth) and passes per kernel
+#define DISP_BLEND_BENCH_W      480
+#define DISP_BLEND_BENCH_H      40
+#define DISP_BLEND_BENCH_PASSES 20
+
+
+// API
+void disp_blend_init(lv_disp_drv_t* disp_drv);         // Before lv_disp_drv_register()
+void disp_blend_bench();                               // After lv_disp_drv_register()
+
+
+#endif // DISP_BLEND_H_
@@ -4,33 +4,61 @@
 #include "disp_driver.h"
 #include "ST7701S.h"
 #include "mem_fb.h"
+#include "esp_timer.h"
 
 
 static bool enable_dump;
 
+// Time spent in flush_cb calls since the last disp_driver_get_flush_usec()
+static uint32_t flush_usec;
+
 
 
 void disp_driver_init(lv_disp_drv_t* disp_drv)
 {
 	LCD_Init(disp_drv);
-	mem_fb_init();
 	enable_dump = false;
 }
 
 
 void disp_driver_flush(lv_disp_drv_t * drv, const lv_area_t * area, lv_color_t * color_map)
 {
+	int64_t t = esp_timer_get_time();
+	
 	if (enable_dump) {
 		mem_fb_flush(drv, area, color_map);
+#if CONFIG_USE_DIRECT_MODE
+		// The frame was drawn into a panel buffer that still has to be shown
+		lvgl_flush_cb(drv, area, color_map);
+#endif
 	} else {
 		lvgl_flush_cb(drv, area, color_map);
 	}
+	
+	flush_usec += (uint32_t) (esp_timer_get_time() - t);
+}
+
+
+uint32_t disp_driver_get_flush_usec()
+{
+	uint32_t t = flush_usec;
+	
+	flush_usec = 0;
+	return t;
 }
 
 
-void disp_driver_en_dump(bool en_dump)
+// The dump frame buffer is only allocated the first time a dump is enabled.  Returns
+// false if it couldn't be.
+bool disp_driver_en_dump(bool en_dump)
 {
+	if (en_dump && !mem_fb_init()) {
+		enable_dump = false;
+		return false;
+	}
+	
 	enable_dump = en_dump;
+	return true;
 }
 
 
@@ -40,6 +68,12 @@ void disp_driver_set_bl(uint8_t brightness)
 }
 
 
+void disp_driver_fade_bl(uint8_t brightness, int fade_msec)
+{
+	Fade_Backlight(brightness, fade_msec);
+}
+
+
 uint8_t disp_driver_get_bl()
 {
 	return Get_Backlight();
@@ -31,8 +31,10 @@ extern "C" {
  **********************/
 void disp_driver_init(lv_disp_drv_t* disp_drv);
 void disp_driver_flush(lv_disp_drv_t * drv, const lv_area_t * area, lv_color_t * color_map);
-void disp_driver_en_dump(bool en_dump);
+bool disp_driver_en_dump(bool en_dump);
+uint32_t disp_driver_get_flush_usec();
 void disp_driver_set_bl(uint8_t brightness);
+void disp_driver_fade_bl(uint8_t brightness, int fade_msec);
 uint8_t disp_driver_get_bl();
 
 
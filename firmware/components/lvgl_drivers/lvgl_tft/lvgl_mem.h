@@ -0,0 +1,48 @@
+/*
+ * LVGL heap backend statistics.  The backend itself (lvgl_mem_impl.h) is compiled into
+ * LVGL's lv_mem.c when CONFIG_LV_MEM_CUSTOM is set with
+ * CONFIG_LV_MEM_CUSTOM_INCLUDE="lvgl_drivers/lvgl_tft/lvgl_mem_impl.h".
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef LVGL_MEM_H_
+#define LVGL_MEM_H_
+#include <stdint.h>
+
+
+// Allocations up to this size come from internal RAM (object headers, styles, event
+// descriptors, small strings) as long as the internal budget allows; everything else
+// comes from PSRAM.  Both are served by the IDF TLSF heaps.
+#define LVGL_MEM_INTERNAL_MAX_SIZE  128
+#define LVGL_MEM_INTERNAL_BUDGET    (32 * 1024)
+
+
+// Statistics
+typedef struct {
+	uint32_t int_used;        // Bytes currently allocated from internal RAM
+	uint32_t int_max_used;
+	uint32_t ext_used;        // Bytes currently allocated from PSRAM
+	uint32_t ext_max_used;
+	uint32_t alloc_cnt;       // Outstanding allocations
+	uint32_t fail_cnt;        // Allocations that could not be satisfied from either heap
+} lvgl_mem_stats_t;
+
+
+// API
+void lvgl_mem_get_stats(lvgl_mem_stats_t* statsP);
+
+
+#endif // LVGL_MEM_H_
\ No newline at end of file
@@ -0,0 +1,137 @@
+/*
+ * LVGL heap backend - splits LVGL's allocations between internal RAM and PSRAM.
+ *
+ * Included only by LVGL's lv_mem.c (through LV_MEM_CUSTOM_INCLUDE) so it defines
+ * functions and redirects LVGL's custom allocator macros to them.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef LVGL_MEM_IMPL_H_
+#define LVGL_MEM_IMPL_H_
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "lvgl_mem.h"
+
+
+#undef LV_MEM_CUSTOM_ALLOC
+#undef LV_MEM_CUSTOM_FREE
+#undef LV_MEM_CUSTOM_REALLOC
+#define LV_MEM_CUSTOM_ALLOC   lvgl_mem_alloc
+#define LV_MEM_CUSTOM_FREE    lvgl_mem_free
+#define LV_MEM_CUSTOM_REALLOC lvgl_mem_realloc
+
+#define LVGL_MEM_INT_CAPS     (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#define LVGL_MEM_EXT_CAPS     (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+
+
+static lvgl_mem_stats_t lvgl_mem_stats;
+
+
+static void lvgl_mem_note(void* p, bool add)
+{
+	uint32_t len = heap_caps_get_allocated_size(p);
+	
+	if (esp_ptr_external_ram(p)) {
+		if (add) {
+			lvgl_mem_stats.ext_used += len;
+			if (lvgl_mem_stats.ext_used > lvgl_mem_stats.ext_max_used) lvgl_mem_stats.ext_max_used = lvgl_mem_stats.ext_used;
+		} else {
+			lvgl_mem_stats.ext_used -= len;
+		}
+	} else {
+		if (add) {
+			lvgl_mem_stats.int_used += len;
+			if (lvgl_mem_stats.int_used > lvgl_mem_stats.int_max_used) lvgl_mem_stats.int_max_used = lvgl_mem_stats.int_used;
+		} else {
+			lvgl_mem_stats.int_used -= len;
+		}
+	}
+	
+	if (add) {
+		lvgl_mem_stats.alloc_cnt += 1;
+	} else {
+		lvgl_mem_stats.alloc_cnt -= 1;
+	}
+}
+
+
+static uint32_t lvgl_mem_get_caps(size_t size)
+{
+	if ((size <= LVGL_MEM_INTERNAL_MAX_SIZE) && ((lvgl_mem_stats.int_used + size) <= LVGL_MEM_INTERNAL_BUDGET)) {
+		return LVGL_MEM_INT_CAPS;
+	} else {
+		return LVGL_MEM_EXT_CAPS;
+	}
+}
+
+
+void* lvgl_mem_alloc(size_t size)
+{
+	uint32_t caps = lvgl_mem_get_caps(size);
+	void* p;
+	
+	// Fall back to the other heap if the preferred one can't satisfy the request
+	p = heap_caps_malloc(size, caps);
+	if (p == NULL) {
+		p = heap_caps_malloc(size, (caps == LVGL_MEM_INT_CAPS) ? LVGL_MEM_EXT_CAPS : LVGL_MEM_INT_CAPS);
+	}
+	
+	if (p != NULL) {
+		lvgl_mem_note(p, true);
+	} else {
+		lvgl_mem_stats.fail_cnt += 1;
+	}
+	
+	return p;
+}
+
+
+void lvgl_mem_free(void* p)
+{
+	lvgl_mem_note(p, false);
+	heap_caps_free(p);
+}
+
+
+void* lvgl_mem_realloc(void* p, size_t size)
+{
+	void* new_p;
+	
+	if (p == NULL) return lvgl_mem_alloc(size);
+	
+	lvgl_mem_note(p, false);
+	new_p = heap_caps_realloc(p, size, lvgl_mem_get_caps(size));
+	if (new_p == NULL) {
+		// Original block is untouched
+		lvgl_mem_stats.fail_cnt += 1;
+		lvgl_mem_note(p, true);
+		return NULL;
+	}
+	lvgl_mem_note(new_p, true);
+	
+	return new_p;
+}
+
+
+void lvgl_mem_get_stats(lvgl_mem_stats_t* statsP)
+{
+	*statsP = lvgl_mem_stats;
+}
+
+
+#endif // LVGL_MEM_IMPL_H_
\ No newline at end of file
@@ -1,5 +1,5 @@
 /*
- * Memory frame buffer for LVGL - allocated in PSRAM
+ * Memory frame buffer for LVGL - allocated in PSRAM when the first screen dump is made
  *
  * Copyright 2022 Dan Julio
  *
@@ -23,15 +23,21 @@
 
 // Variables
 static const char* TAG = "mem_fb";
-static lv_color_t* fb;
+static lv_color_t* fb = NULL;
 
 
 
 // API
-void mem_fb_init()
+
+// Allocate the buffer if it doesn't already exist.  Returns false if it couldn't be allocated.
+bool mem_fb_init()
 {
 	int mult;
 	
+	if (fb != NULL) {
+		return true;
+	}
+	
 #if MEM_FB_BPP == 8
 	mult = 1;
 #else
@@ -46,7 +52,10 @@ void mem_fb_init()
 	fb = (lv_color_t*) heap_caps_malloc((MEM_FB_W*MEM_FB_H)*mult, MALLOC_CAP_SPIRAM);
 	if (fb == NULL) {
 		ESP_LOGE(TAG, "malloc %d mem_fb bytes failed", (MEM_FB_W*MEM_FB_H)*mult);
+		return false;
 	}
+	
+	return true;
 }
 
 
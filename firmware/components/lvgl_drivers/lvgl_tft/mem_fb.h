@@ -1,5 +1,5 @@
 /*
- * Memory frame buffer for LVGL - allocated in PSRAM
+ * Memory frame buffer for LVGL - allocated in PSRAM when the first screen dump is made
  *
  * Copyright 2022 Dan Julio
  *
@@ -30,7 +30,7 @@
 
 
 // API
-void mem_fb_init();
+bool mem_fb_init();
 void mem_fb_flush(lv_disp_drv_t * drv, const lv_area_t * area, lv_color_t * color_map);
 uint8_t* mem_fb_get_buffer();
 
@@ -19,6 +19,8 @@
 */
 
 #include <esp_log.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #ifdef LV_LVGL_H_INCLUDE_SIMPLE
 #include <lvgl.h>
 #else
@@ -30,9 +32,32 @@
 
 #define TAG "GT911"
 
+// Re-read the point record if a touch is held this long without a report
+#define GT911_REPORT_TIMEOUT_MSEC 100
+
 gt911_status_t gt911_status;
 
-//TODO: handle multibyte read and refactor to just one read transaction
+// Point record filled asynchronously by the I2C bus task
+static uint8_t rec_buf[GT911_PT1_RECORD_LEN];
+static volatile bool rec_busy = false;
+static TickType_t rec_tick;
+
+// Points decoded by the I2C bus task (producer) for gt911_read (consumer).  Reports keep
+// being read at the controller's rate however long LVGL takes to render a frame, and
+// LVGL is handed every point in order when it next reads.
+static gt911_point_t pt_buf[GT911_POINT_BUF_LEN];
+static uint32_t pt_head = 0;     // Written by the I2C bus task
+static uint32_t pt_tail = 0;     // Written by gt911_read
+static int16_t pt_last_x = 0;
+static int16_t pt_last_y = 0;
+
+static const uint8_t status_clear = 0x00;
+
+static void _gt911_request_record(bool from_isr);
+static void _gt911_record_done(i2c_txn_t* txn, esp_err_t ret);
+static void _gt911_submit_write(uint16_t register_addr, const uint8_t* data);
+static void _gt911_push_point(bool pressed);
+
 esp_err_t gt911_i2c_read(uint8_t slave_addr, uint16_t register_addr, uint8_t *data_buf, uint8_t len) {
     return I2C_ReadReg16(slave_addr, register_addr, data_buf, len);
 }
@@ -59,85 +84,183 @@ void gt911_init(uint8_t dev_addr) {
             return;
         }
 
-        // Read 4 bytes for Product ID in ASCII
+        // Product ID (4 ASCII bytes) through Vendor ID in one transaction
+        uint8_t info_buf[GT911_VENDOR_ID - GT911_PRODUCT_ID1 + 1];
+        if (gt911_i2c_read(dev_addr, GT911_PRODUCT_ID1, info_buf, sizeof(info_buf)) != ESP_OK) {
+            ESP_LOGE(TAG, "Error reading product info");
+            return;
+        }
         for (int i = 0; i < GT911_PRODUCT_ID_LEN; i++) {
-            gt911_i2c_read(dev_addr, (GT911_PRODUCT_ID1 + i), (uint8_t *)&(gt911_status.product_id[i]), 1);
+            gt911_status.product_id[i] = (char) info_buf[i];
         }
-        ESP_LOGI(TAG, "\tProduct ID: %s", gt911_status.product_id);
+        ESP_LOGI(TAG, "\tProduct ID: %.4s", gt911_status.product_id);
+        ESP_LOGI(TAG, "\tVendor ID: 0x%02x", info_buf[GT911_VENDOR_ID - GT911_PRODUCT_ID1]);
 
-        gt911_i2c_read(dev_addr, GT911_VENDOR_ID, &data_buf, 1);
-        ESP_LOGI(TAG, "\tVendor ID: 0x%02x", data_buf);
-
-        gt911_i2c_read(dev_addr, GT911_X_COORD_RES_L, &data_buf, 1);
-        gt911_status.max_x_coord = data_buf;
-        gt911_i2c_read(dev_addr, GT911_X_COORD_RES_H, &data_buf, 1);
-        gt911_status.max_x_coord |= ((uint16_t)data_buf << 8);
+        gt911_status.max_x_coord = info_buf[GT911_X_COORD_RES_L - GT911_PRODUCT_ID1] |
+                                   ((uint16_t)info_buf[GT911_X_COORD_RES_H - GT911_PRODUCT_ID1] << 8);
         ESP_LOGI(TAG, "\tX Resolution: %d", gt911_status.max_x_coord);
 
-        gt911_i2c_read(dev_addr, GT911_Y_COORD_RES_L, &data_buf, 1);
-        gt911_status.max_y_coord = data_buf;
-        gt911_i2c_read(dev_addr, GT911_Y_COORD_RES_H, &data_buf, 1);
-        gt911_status.max_y_coord |= ((uint16_t)data_buf << 8);
+        gt911_status.max_y_coord = info_buf[GT911_Y_COORD_RES_L - GT911_PRODUCT_ID1] |
+                                   ((uint16_t)info_buf[GT911_Y_COORD_RES_H - GT911_PRODUCT_ID1] << 8);
         ESP_LOGI(TAG, "\tY Resolution: %d", gt911_status.max_y_coord);
+        gt911_status.touched = false;
+        I2C_SetDevicePriority(dev_addr, I2C_PRIO_TOUCH);
         gt911_status.inited = true;
     }
 }
 
 /**
-  * @brief  Get the touch screen X and Y positions values. Ignores multi touch
+  * @brief  Get the oldest buffered touch point. Ignores multi touch
   * @param  drv:
   * @param  data: Store data here
-  * @retval Always false
+  * @retval True if more points are waiting
   */
 bool gt911_read(lv_indev_drv_t *drv, lv_indev_data_t *data) {
-    uint8_t touch_pnt_cnt;        // Number of detected touch points
     static int16_t last_x = 0;  // 12bit pixel value
     static int16_t last_y = 0;  // 12bit pixel value
-    uint8_t data_buf;
-    uint8_t status_reg;
+    uint32_t head = __atomic_load_n(&pt_head, __ATOMIC_ACQUIRE);
+    gt911_point_t* ptP;
 
-    gt911_i2c_read(gt911_status.i2c_dev_addr, GT911_STATUS_REG, &status_reg, 1);
-//    ESP_LOGI(TAG, "\tstatus: 0x%02x", status_reg);
-    touch_pnt_cnt = status_reg & 0x0F;
-    if ((status_reg & 0x80) || (touch_pnt_cnt < 6)) {
-        //Reset Status Reg Value
-        gt911_i2c_write8(gt911_status.i2c_dev_addr, GT911_STATUS_REG, 0x00);
-    }
-    if (touch_pnt_cnt != 1) {    // ignore no touch & multi touch
+    if (head == pt_tail) {
+        // Nothing new from the controller.  Hold the last state, but if a touch appears
+        // to be held for too long without a report, go look in case a release was missed.
+        if (gt911_status.touched &&
+            ((xTaskGetTickCount() - rec_tick) > pdMS_TO_TICKS(GT911_REPORT_TIMEOUT_MSEC))) {
+            rec_tick = xTaskGetTickCount();
+            _gt911_request_record(false);
+        }
         data->point.x = last_x;
         data->point.y = last_y;
-        data->state = LV_INDEV_STATE_REL;
+        data->state = gt911_status.touched ? LV_INDEV_STATE_PR : LV_INDEV_STATE_REL;
         return false;
     }
 
-//    gt911_i2c_read(gt911_status.i2c_dev_addr, GT911_TRACK_ID1, &data_buf, 1);
-//    ESP_LOGI(TAG, "\ttrack_id: %d", data_buf);
+    ptP = &pt_buf[pt_tail & (GT911_POINT_BUF_LEN - 1)];
+    last_x = ptP->x;
+    last_y = ptP->y;
+    gt911_status.touched = ptP->pressed;
+    rec_tick = ptP->tick;
+    __atomic_store_n(&pt_tail, pt_tail + 1, __ATOMIC_RELEASE);
+
+    data->point.x = last_x;
+    data->point.y = last_y;
+    data->state = gt911_status.touched ? LV_INDEV_STATE_PR : LV_INDEV_STATE_REL;
+    ESP_LOGV(TAG, "X=%u Y=%u", data->point.x, data->point.y);
+    return (head != pt_tail);
+}
 
-    gt911_i2c_read(gt911_status.i2c_dev_addr, GT911_PT1_X_COORD_L, &data_buf, 1);
-    last_x = data_buf;
-    gt911_i2c_read(gt911_status.i2c_dev_addr, GT911_PT1_X_COORD_H, &data_buf, 1);
-    last_x |= ((uint16_t)data_buf << 8);
+/**
+  * @brief  Start an asynchronous read of the point record.  Called from the TP_INT ISR.
+  * @retval None
+  */
+void gt911_request_read_from_isr(void) {
+    _gt911_request_record(true);
+}
 
-    gt911_i2c_read(gt911_status.i2c_dev_addr, GT911_PT1_Y_COORD_L, &data_buf, 1);
-    last_y = data_buf;
-    gt911_i2c_read(gt911_status.i2c_dev_addr, GT911_PT1_Y_COORD_H, &data_buf, 1);
-    last_y |= ((uint16_t)data_buf << 8);
+static void _gt911_request_record(bool from_isr) {
+    i2c_txn_t txn = {
+        .addr = gt911_status.i2c_dev_addr,
+        .prio = I2C_PRIO_TOUCH,
+        .read = true,
+        .reg_len = 2,
+        .reg = GT911_STATUS_REG,
+        .data = rec_buf,
+        .len = sizeof(rec_buf),
+        .cb = _gt911_record_done,
+        .cb_arg = NULL
+    };
+    esp_err_t ret;
+
+    // A read in flight holds off the next one (the controller won't load a new report
+    // until the status register is cleared anyway)
+    if (!gt911_status.inited || rec_busy) return;
+    rec_busy = true;
+    if (from_isr) {
+        ret = I2C_SubmitFromISR(&txn);
+    } else {
+        ret = I2C_Submit(&txn);
+    }
+    if (ret != ESP_OK) {
+        rec_busy = false;
+    }
+}
+
+// Runs in the I2C bus task.  Decodes the record into the point buffer and frees the
+// controller to load its next report without waiting for LVGL.
+static void _gt911_record_done(i2c_txn_t* txn, esp_err_t ret) {
+    uint8_t status_reg;
+    uint8_t touch_pnt_cnt;        // Number of detected touch points
+
+    if (ret != ESP_OK) {
+        rec_busy = false;
+        _gt911_push_point(false);
+        return;
+    }
+    status_reg = rec_buf[0];
+//    ESP_LOGI(TAG, "\tstatus: 0x%02x", status_reg);
+    touch_pnt_cnt = status_reg & GT911_STATUS_REG_PT_MASK;
+    if (status_reg & GT911_STATUS_REG_BUF) {
+        //Reset Status Reg Value so the controller can load the next report
+        _gt911_submit_write(GT911_STATUS_REG, &status_clear);
+    }
+    if (touch_pnt_cnt != 1) {    // ignore no touch & multi touch
+        rec_busy = false;
+        _gt911_push_point(false);
+        return;
+    }
+
+//    ESP_LOGI(TAG, "\ttrack_id: %d", rec_buf[GT911_TRACK_ID1 - GT911_STATUS_REG]);
+
+    pt_last_x = rec_buf[GT911_PT1_X_COORD_L - GT911_STATUS_REG] |
+                ((uint16_t)rec_buf[GT911_PT1_X_COORD_H - GT911_STATUS_REG] << 8);
+    pt_last_y = rec_buf[GT911_PT1_Y_COORD_L - GT911_STATUS_REG] |
+                ((uint16_t)rec_buf[GT911_PT1_Y_COORD_H - GT911_STATUS_REG] << 8);
+    rec_busy = false;
 
 #if CONFIG_LV_GT911_INVERT_X
-    last_x = gt911_status.max_x_coord - last_x;
+    pt_last_x = gt911_status.max_x_coord - pt_last_x;
 #endif
 #if CONFIG_LV_GT911_INVERT_Y
-    last_y = gt911_status.max_y_coord - last_y;
+    pt_last_y = gt911_status.max_y_coord - pt_last_y;
 #endif
 #if CONFIG_LV_GT911_SWAPXY
-    int16_t swap_buf = last_x;
-    last_x = last_y;
-    last_y = swap_buf;
+    int16_t swap_buf = pt_last_x;
+    pt_last_x = pt_last_y;
+    pt_last_y = swap_buf;
 #endif
-    data->point.x = last_x;
-    data->point.y = last_y;
-    data->state = LV_INDEV_STATE_PR;
-    ESP_LOGV(TAG, "X=%u Y=%u", data->point.x, data->point.y);
-    ESP_LOGV(TAG, "X=%u Y=%u", data->point.x, data->point.y);
-    return false;
+    _gt911_push_point(true);
+}
+
+// Runs in the I2C bus task.  A release keeps the last pressed coordinates.
+static void _gt911_push_point(bool pressed) {
+    uint32_t tail = __atomic_load_n(&pt_tail, __ATOMIC_ACQUIRE);
+    gt911_point_t* ptP;
+
+    if ((pt_head - tail) >= GT911_POINT_BUF_LEN) {
+        // LVGL fell behind.  A lost release is recovered by the report timeout in gt911_read.
+        gt911_status.num_dropped++;
+        return;
+    }
+    ptP = &pt_buf[pt_head & (GT911_POINT_BUF_LEN - 1)];
+    ptP->x = pt_last_x;
+    ptP->y = pt_last_y;
+    ptP->pressed = pressed;
+    ptP->tick = xTaskGetTickCount();
+    __atomic_store_n(&pt_head, pt_head + 1, __ATOMIC_RELEASE);
+}
+
+static void _gt911_submit_write(uint16_t register_addr, const uint8_t* data) {
+    i2c_txn_t txn = {
+        .addr = gt911_status.i2c_dev_addr,
+        .prio = I2C_PRIO_TOUCH,
+        .read = false,
+        .reg_len = 2,
+        .reg = register_addr,
+        .data = (uint8_t*) data,
+        .len = 1,
+        .cb = NULL,
+        .cb_arg = NULL
+    };
+
+    (void) I2C_Submit(&txn);
 }
@@ -23,6 +23,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "freertos/FreeRTOS.h"
 #ifdef LV_LVGL_H_INCLUDE_SIMPLE
 #include "lvgl.h"
 #else
@@ -38,6 +39,9 @@ extern "C" {
 
 #define GT911_PRODUCT_ID_LEN   4
 
+// Touch points buffered between the I2C bus task and LVGL (power of 2)
+#define GT911_POINT_BUF_LEN    16
+
 /* Register Map of GT911 */
 #define GT911_PRODUCT_ID1             0x8140
 #define GT911_PRODUCT_ID2             0x8141
@@ -66,14 +70,28 @@ extern "C" {
 #define GT911_PT1_X_SIZE_L            0x8154
 #define GT911_PT1_X_SIZE_H            0x8155
 
+// Status register through the first point's Y coordinate, read as one burst
+#define GT911_PT1_RECORD_LEN          (GT911_PT1_Y_COORD_H - GT911_STATUS_REG + 1)
+
 typedef struct {
     bool inited;
     char product_id[GT911_PRODUCT_ID_LEN];
     uint16_t max_x_coord;
     uint16_t max_y_coord;
     uint8_t i2c_dev_addr;
+    bool touched;              // Last read reported a press
+    uint32_t num_dropped;      // Points lost because LVGL fell behind
 } gt911_status_t;
 
+typedef struct {
+    int16_t x;
+    int16_t y;
+    bool pressed;
+    TickType_t tick;           // When the point record was read
+} gt911_point_t;
+
+extern gt911_status_t gt911_status;
+
 /**
   * @brief  Initialize for GT911 communication via I2C
   * @param  dev_addr: Device address on communication Bus (I2C slave address of GT911).
@@ -82,13 +100,20 @@ typedef struct {
 void gt911_init(uint8_t dev_addr);
 
 /**
-  * @brief  Get the touch screen X and Y positions values. Ignores multi touch
+  * @brief  Get the oldest touch point buffered by the I2C bus task (or the last state
+  *         if none are waiting). Ignores multi touch
   * @param  drv:
   * @param  data: Store data here
-  * @retval Always false
+  * @retval True if more points are waiting (LVGL should read again)
   */
 bool gt911_read(lv_indev_drv_t *drv, lv_indev_data_t *data);
 
+/**
+  * @brief  Start an asynchronous read of the point record.  Called from the TP_INT ISR.
+  * @retval None
+  */
+void gt911_request_read_from_isr(void);
+
 #ifdef __cplusplus
 }
 #endif
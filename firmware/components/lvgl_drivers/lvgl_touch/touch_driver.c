@@ -9,6 +9,16 @@
 #include "TCA9554PWR.h"
 
 
+// GT911 pulses TP_INT each time it loads a new report.  The ISR queues an asynchronous
+// read of the point record on the (shared) I2C bus and the bus task buffers the decoded
+// point, so reports are sampled at the controller's rate even while a long frame renders
+// and the GUI task never blocks on the bus.  Each LVGL read drains every buffered point.
+static void _touch_int_isr(void* arg)
+{
+	gt911_request_read_from_isr();
+}
+
+
 void touch_driver_init(void)
 {
 	esp_err_t ret;
@@ -32,6 +42,14 @@ void touch_driver_init(void)
 	if (ret == ESP_OK) {
     	gt911_init(GT911_I2C_SLAVE_ADDR);
     }
+    
+    // After reset the GT911 drives TP_INT so we can use it to signal new reports
+    gpio_set_pull_mode(TP_INT, GPIO_FLOATING);
+    gpio_set_intr_type(TP_INT, GPIO_INTR_ANYEDGE);
+    ret = gpio_install_isr_service(0);
+    if ((ret == ESP_OK) || (ret == ESP_ERR_INVALID_STATE)) {
+    	gpio_isr_handler_add(TP_INT, _touch_int_isr, NULL);
+    }
 }
 
 #if LVGL_VERSION_MAJOR >= 8
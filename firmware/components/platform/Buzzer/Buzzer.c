@@ -1,12 +1,258 @@
+/*
+ * Buzzer
+ *
+ * Tone sequences are a list of on/off steps.  Each step boundary is scheduled on an
+ * esp_timer relative to the start of the sequence (so write latency doesn't accumulate)
+ * and the timer wakes the buzzer task to write the expander.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
 #include "Buzzer.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
 #include "TCA9554PWR.h"
 
+
+
+//
+// Buzzer constants
+//
+
+// Task events
+#define BUZZER_EVT_PLAY      0
+#define BUZZER_EVT_STOP      1
+#define BUZZER_EVT_TIMER     2
+
+typedef struct {
+	uint8_t type;
+	uint8_t seq;
+	uint32_t gen;               // Sequence generation that started the timer (BUZZER_EVT_TIMER)
+} buzzer_evt_t;
+
+// A step turns the buzzer on for on_msec then off for off_msec (0 after the last beep)
+typedef struct {
+	uint16_t on_msec;
+	uint16_t off_msec;
+} buzzer_step_t;
+
+typedef struct {
+	int num_steps;
+	buzzer_step_t step[BUZZER_MAX_STEPS];
+} buzzer_seq_def_t;
+
+static const buzzer_seq_def_t seq_list[BUZZER_NUM_SEQ] = {
+	{1, {{100, 0}}},                         // BUZZER_SEQ_CHIRP
+	{1, {{150, 0}}},                         // BUZZER_SEQ_COUNTDOWN
+	{1, {{500, 0}}},                         // BUZZER_SEQ_GO
+	{2, {{150, 150}, {150, 0}}},             // BUZZER_SEQ_FALSE_START
+	{3, {{80, 80}, {80, 80}, {80, 0}}}       // BUZZER_SEQ_ALERT
+};
+
+
+
+//
+// Buzzer variables
+//
+static const char* TAG = "Buzzer";
+
+static QueueHandle_t buzzer_queue = NULL;
+static esp_timer_handle_t step_timer;
+
+// Sequence state (owned by the buzzer task except seq_gen which the timer callback reads)
+static int cur_seq = -1;
+static int cur_step;
+static bool cur_on;
+static int64_t step_end_usec;
+static volatile uint32_t seq_gen = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _buzzer_task(void* arg);
+static void _buzzer_start_phase();
+static void _buzzer_next_phase();
+static void _buzzer_timer_cb(void* arg);
+static void _buzzer_send(uint8_t type, uint8_t seq);
+
+
+
+//
+// API
+//
+esp_err_t Buzzer_Init(void)
+{
+	esp_err_t ret;
+	const esp_timer_create_args_t timer_args = {
+		.callback = &_buzzer_timer_cb,
+		.name = "buzzer"
+	};
+	
+	buzzer_queue = xQueueCreate(BUZZER_QUEUE_LEN, sizeof(buzzer_evt_t));
+	if (buzzer_queue == NULL) {
+		ESP_LOGE(TAG, "Could not create queue");
+		return ESP_ERR_NO_MEM;
+	}
+	
+	if ((ret = esp_timer_create(&timer_args, &step_timer)) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not create timer - %d", ret);
+		return ret;
+	}
+	
+	if (xTaskCreatePinnedToCore(&_buzzer_task, "buzzer", BUZZER_TASK_STACK, NULL,
+	                            BUZZER_TASK_PRIORITY, NULL, BUZZER_TASK_CORE) != pdPASS) {
+		ESP_LOGE(TAG, "Could not start task");
+		return ESP_ERR_NO_MEM;
+	}
+	
+	return ESP_OK;
+}
+
+
+void Buzzer_Play(buzzer_seq_t seq)
+{
+	if (seq < BUZZER_NUM_SEQ) {
+		_buzzer_send(BUZZER_EVT_PLAY, (uint8_t) seq);
+	}
+}
+
+
+void Buzzer_Stop(void)
+{
+	_buzzer_send(BUZZER_EVT_STOP, 0);
+}
+
+
 void Buzzer_On(void)
 {
-    (void) Set_EXIO(TCA9554_EXIO8, true);
+	(void) Set_EXIO(TCA9554_EXIO8, true);
 }
 
+
 void Buzzer_Off(void)
 {
-    (void) Set_EXIO(TCA9554_EXIO8, false);
-}
\ No newline at end of file
+	(void) Set_EXIO(TCA9554_EXIO8, false);
+}
+
+
+
+//
+// Internal functions
+//
+static void _buzzer_task(void* arg)
+{
+	buzzer_evt_t evt;
+	
+	while (1) {
+		if (xQueueReceive(buzzer_queue, &evt, portMAX_DELAY) == pdTRUE) {
+			switch (evt.type) {
+				case BUZZER_EVT_PLAY:
+					// Restart timing from now
+					(void) esp_timer_stop(step_timer);
+					seq_gen += 1;
+					cur_seq = evt.seq;
+					cur_step = 0;
+					cur_on = true;
+					step_end_usec = esp_timer_get_time();
+					_buzzer_start_phase();
+					break;
+				
+				case BUZZER_EVT_STOP:
+					(void) esp_timer_stop(step_timer);
+					seq_gen += 1;
+					if (cur_seq >= 0) {
+						cur_seq = -1;
+						Buzzer_Off();
+					}
+					break;
+				
+				case BUZZER_EVT_TIMER:
+					// Ignore a timer that fired just before its sequence was replaced
+					if ((evt.gen == seq_gen) && (cur_seq >= 0)) {
+						_buzzer_next_phase();
+					}
+					break;
+			}
+		}
+	}
+}
+
+
+// Schedule the end of the current phase then set the buzzer for it
+static void _buzzer_start_phase()
+{
+	const buzzer_step_t* stepP = &seq_list[cur_seq].step[cur_step];
+	int64_t delay_usec;
+	
+	step_end_usec += (int64_t) (cur_on ? stepP->on_msec : stepP->off_msec) * 1000;
+	delay_usec = step_end_usec - esp_timer_get_time();
+	if (delay_usec < 1) delay_usec = 1;
+	(void) esp_timer_start_once(step_timer, (uint64_t) delay_usec);
+	
+	if (cur_on) {
+		Buzzer_On();
+	} else {
+		Buzzer_Off();
+	}
+}
+
+
+static void _buzzer_next_phase()
+{
+	if (cur_on && (seq_list[cur_seq].step[cur_step].off_msec != 0)) {
+		cur_on = false;
+		_buzzer_start_phase();
+	} else if (!cur_on && (++cur_step < seq_list[cur_seq].num_steps)) {
+		cur_on = true;
+		_buzzer_start_phase();
+	} else {
+		// Sequence done
+		cur_seq = -1;
+		Buzzer_Off();
+	}
+}
+
+
+// Runs in the esp_timer task so only wakes the buzzer task
+static void _buzzer_timer_cb(void* arg)
+{
+	buzzer_evt_t evt;
+	
+	evt.type = BUZZER_EVT_TIMER;
+	evt.seq = 0;
+	evt.gen = seq_gen;
+	(void) xQueueSend(buzzer_queue, &evt, 0);
+}
+
+
+static void _buzzer_send(uint8_t type, uint8_t seq)
+{
+	buzzer_evt_t evt;
+	
+	if (buzzer_queue == NULL) return;
+	
+	evt.type = type;
+	evt.seq = seq;
+	evt.gen = 0;
+	if (xQueueSend(buzzer_queue, &evt, 0) != pdTRUE) {
+		ESP_LOGW(TAG, "Request dropped");
+	}
+}
@@ -1,10 +1,77 @@
+/*
+ * Buzzer
+ *
+ * The buzzer is driven through TCA9554 EXIO8 so it can't be timed by a LEDC or RMT
+ * channel.  Preloaded tone sequences are timed by an esp_timer and the expander is
+ * written by a dedicated high priority task so beeps start and end on time regardless
+ * of what the caller is doing and callers never block on the I2C bus.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
 #ifndef BUZZER_H_
 #define BUZZER_H_
 
+#include "esp_system.h"
 #include <stdbool.h>
 
 
+
+//
+// Configuration
+//
+
+// Sequence task (must run above the I2C bus task so it is ready when the bus is)
+#define BUZZER_TASK_STACK    2048
+#define BUZZER_TASK_PRIORITY 5
+#define BUZZER_TASK_CORE     0
+
+// Pending sequence requests
+#define BUZZER_QUEUE_LEN     4
+
+// Maximum number of on/off steps in a sequence
+#define BUZZER_MAX_STEPS     4
+
+
+
+//
+// Preloaded sequences
+//
+typedef enum {
+	BUZZER_SEQ_CHIRP = 0,       // Power-on (100 mSec)
+	BUZZER_SEQ_COUNTDOWN,       // Christmas tree amber (150 mSec)
+	BUZZER_SEQ_GO,              // Christmas tree green, run start and end (500 mSec)
+	BUZZER_SEQ_FALSE_START,     // Two 150 mSec beeps 150 mSec apart
+	BUZZER_SEQ_ALERT,           // Three 80 mSec beeps 80 mSec apart
+	BUZZER_NUM_SEQ
+} buzzer_seq_t;
+
+
+
+//
+// API
+//
+esp_err_t Buzzer_Init(void);
+
+// Start a sequence immediately (replacing one still playing) or stop the buzzer
+void Buzzer_Play(buzzer_seq_t seq);
+void Buzzer_Stop(void);
+
+// Direct (blocking) control
 void Buzzer_On(void);
 void Buzzer_Off(void);
 
-#endif /* BUZZER_H_ */
\ No newline at end of file
+#endif /* BUZZER_H_ */
@@ -1,8 +1,10 @@
 /*
  * I2C Driver with locking
  *
- * Completely re-written Waveshare demo API but changed to use new I2C driver and
- * provide locking.
+ * Completely re-written Waveshare demo API.  All transactions are executed by a bus
+ * task that owns the port.  Transactions are queued by priority (touch > IMU > EXIO)
+ * and back-to-back queued transactions are run as a single command link with repeated
+ * starts.  Callers either block (the original API) or get a completion callback.
  *
  * Copyright 2025 Dan Julio
  *
@@ -20,11 +22,12 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  *
  */
-//#include "driver/i2c_master.h"
 #include "driver/i2c.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "I2C_Driver.h"
 #include <string.h>
 
@@ -32,29 +35,52 @@
 //
 // I2C constants
 //
-#define MAX_I2C_DATA_LEN 8
-
 #define I2C_MASTER_TX_BUF_DISABLE   0         /*!< I2C master doesn't need buffer */
 #define I2C_MASTER_RX_BUF_DISABLE   0         /*!< I2C master doesn't need buffer */
 
+// Maximum number of devices that can be assigned a priority
+#define I2C_MAX_DEV_PRIO            8
+
+// Completion context for a blocking call
+typedef struct {
+	SemaphoreHandle_t done_sem;
+	esp_err_t ret;
+} i2c_blocking_ctx_t;
+
+// Command link storage for a batch (each transaction uses at most 7 commands)
+#define I2C_CMD_LINK_BUF_LEN        (I2C_LINK_RECOMMENDED_SIZE(7 * I2C_BATCH_MAX))
+
 
 //
 // I2C variables
 //
 static const char* TAG = "I2C";
 
-//static i2c_master_bus_handle_t bus_handle;
-static SemaphoreHandle_t i2c_mutex;
+static QueueHandle_t i2c_queue[I2C_NUM_PRIO];
+static SemaphoreHandle_t i2c_pending_sem;      // Counts queued transactions across all queues
+
+static uint8_t dev_prio_cnt = 0;
+static uint8_t dev_prio_addr[I2C_MAX_DEV_PRIO];
+static i2c_prio_t dev_prio_val[I2C_MAX_DEV_PRIO];
+
+static uint8_t cmd_link_buf[I2C_CMD_LINK_BUF_LEN];
+
+// Statistics
+static uint32_t stat_txn_cnt = 0;
+static uint32_t stat_batch_cnt = 0;
+static uint32_t stat_err_cnt = 0;
 
 
 
 //
 // Forward declarations for internal functions
 //
-void _i2c_lock();
-void _i2c_unlock();
-//esp_err_t _i2c_read_slave(uint8_t addr7, uint8_t *data_rd, size_t size);
-//esp_err_t _i2c_write_slave(uint8_t addr7, uint8_t *data_wr, size_t size);
+static void _i2c_task(void* arg);
+static int _i2c_get_batch(i2c_txn_t* batch);
+static esp_err_t _i2c_run(i2c_txn_t* txn, int n);
+static esp_err_t _i2c_blocking(i2c_txn_t* txn);
+static void _i2c_blocking_done(i2c_txn_t* txn, esp_err_t ret);
+static i2c_prio_t _i2c_addr_prio(uint8_t addr);
 
 
 
@@ -63,28 +89,8 @@ void _i2c_unlock();
 //
 esp_err_t I2C_Init(void)
 {
-/*
-	i2c_master_bus_config_t i2c_mst_config;
-	
-	ESP_LOGI(TAG, "Init I2C Master");
-
-	// Create a mutex for thread safety
-    i2c_mutex = xSemaphoreCreateMutex();
-    
-    // Configure the I2C bus
-    i2c_mst_config.clk_source = I2C_CLK_SRC_DEFAULT;
-    i2c_mst_config.i2c_port = I2C_MASTER_NUM;
-    i2c_mst_config.scl_io_num = I2C_SCL_IO;
-    i2c_mst_config.sda_io_num = I2C_SDA_IO;
-    i2c_mst_config.glitch_ignore_cnt = 7;
-    i2c_mst_config.intr_priority = 0;
-    i2c_mst_config.trans_queue_depth = 0;
-    i2c_mst_config.flags.enable_internal_pullup = true;
-    i2c_mst_config.flags.allow_pd = 0;
-    
-	return i2c_new_master_bus(&i2c_mst_config, &bus_handle);
-*/
 	int i2c_master_port = I2C_MASTER_NUM;
+	esp_err_t ret;
 
     i2c_config_t conf = {
         .mode = I2C_MODE_MASTER,
@@ -97,155 +103,164 @@ esp_err_t I2C_Init(void)
     
     ESP_LOGI(TAG, "Init I2C Master");
 
-	// Create a mutex for thread safety
-//    i2c_mutex = xSemaphoreCreateMutex();
-
     i2c_param_config(i2c_master_port, &conf);
 
-    return i2c_driver_install(i2c_master_port, conf.mode, I2C_MASTER_RX_BUF_DISABLE, I2C_MASTER_TX_BUF_DISABLE, 0);
-
-}
-
-/*
-// Reg addr is 8 bit
-esp_err_t I2C_Write(uint8_t Driver_addr, uint8_t Reg_addr, const uint8_t *Reg_data, uint32_t Length)
-{
-	esp_err_t ret;
-    uint8_t buf[MAX_I2C_DATA_LEN+1];
-    
-    if (Length > MAX_I2C_DATA_LEN) {
-    	return ESP_ERR_INVALID_SIZE;
+    ret = i2c_driver_install(i2c_master_port, conf.mode, I2C_MASTER_RX_BUF_DISABLE, I2C_MASTER_TX_BUF_DISABLE, 0);
+    if (ret != ESP_OK) {
+    	return ret;
     }
     
-    // Copy Reg_data to buf starting at buf[1]
-    buf[0] = Reg_addr;
-    memcpy(&buf[1], Reg_data, Length);
-    
-    _i2c_lock();
-    
-    ret = _i2c_write_slave(Driver_addr, buf, Length + 1);
+    // Transaction queues and the task that executes them
+    for (int i=0; i<I2C_NUM_PRIO; i++) {
+    	i2c_queue[i] = xQueueCreate(I2C_QUEUE_LEN, sizeof(i2c_txn_t));
+    	if (i2c_queue[i] == NULL) {
+    		ESP_LOGE(TAG, "Could not create queue %d", i);
+    		return ESP_ERR_NO_MEM;
+    	}
+    }
+    i2c_pending_sem = xSemaphoreCreateCounting(I2C_NUM_PRIO * I2C_QUEUE_LEN, 0);
+    if (i2c_pending_sem == NULL) {
+    	ESP_LOGE(TAG, "Could not create pending semaphore");
+    	return ESP_ERR_NO_MEM;
+    }
     
-    _i2c_unlock();
+    if (xTaskCreatePinnedToCore(&_i2c_task, "i2c_task", I2C_TASK_STACK, NULL, I2C_TASK_PRIORITY, NULL, I2C_TASK_CORE) != pdPASS) {
+    	ESP_LOGE(TAG, "Could not start i2c_task");
+    	return ESP_ERR_NO_MEM;
+    }
     
-    return ret;
+    return ESP_OK;
 }
 
 
-
-esp_err_t I2C_WriteReg16(uint8_t Driver_addr, uint16_t Reg_addr, const uint8_t *Reg_data, uint32_t Length)
+void I2C_SetDevicePriority(uint8_t Driver_addr, i2c_prio_t prio)
 {
-	esp_err_t ret;
-    uint8_t buf[MAX_I2C_DATA_LEN+2];
-    
-    if (Length > MAX_I2C_DATA_LEN) {
-    	return ESP_ERR_INVALID_SIZE;
-    }
-    
-    // Copy Reg_data to buf starting at buf[1]
-    buf[0] = Reg_addr >> 8;
-    buf[1] = Reg_addr & 0xFF;
-    memcpy(&buf[2], Reg_data, Length);
-    
-    _i2c_lock();
-    
-    ret = _i2c_write_slave(Driver_addr, buf, Length + 2);
-    
-    _i2c_unlock();
-    
-    return ret;
+	for (int i=0; i<dev_prio_cnt; i++) {
+		if (dev_prio_addr[i] == Driver_addr) {
+			dev_prio_val[i] = prio;
+			return;
+		}
+	}
+	
+	if (dev_prio_cnt < I2C_MAX_DEV_PRIO) {
+		dev_prio_addr[dev_prio_cnt] = Driver_addr;
+		dev_prio_val[dev_prio_cnt] = prio;
+		dev_prio_cnt++;
+	} else {
+		ESP_LOGE(TAG, "Too many device priorities");
+	}
 }
 
 
-esp_err_t I2C_Read(uint8_t Driver_addr, uint8_t Reg_addr, uint8_t *Reg_data, uint32_t Length)
+esp_err_t I2C_Submit(i2c_txn_t* txn)
 {
-	esp_err_t ret;
+	i2c_prio_t prio = txn->prio;
 	
-	_i2c_lock();
-	
-	// Write address
-	ret = _i2c_write_slave(Driver_addr, &Reg_addr, 1);
+	if ((prio >= I2C_NUM_PRIO) || (txn->reg_len > 2) || ((txn->len != 0) && (txn->data == NULL))) {
+		return ESP_ERR_INVALID_ARG;
+	}
 	
-	// Read data
-	if (ret == ESP_OK) {
-		ret = _i2c_read_slave(Driver_addr, Reg_data, Length);
+	if (xQueueSendToBack(i2c_queue[prio], txn, pdMS_TO_TICKS(I2C_MASTER_TIMEOUT_MS)) != pdTRUE) {
+		ESP_LOGE(TAG, "Queue %d full", prio);
+		return ESP_ERR_TIMEOUT;
 	}
+	xSemaphoreGive(i2c_pending_sem);
 	
-	_i2c_unlock();
-    
-    return ret;
+	return ESP_OK;
 }
 
 
-esp_err_t I2C_ReadReg16(uint8_t Driver_addr, uint16_t Reg_addr, uint8_t *Reg_data, uint32_t Length)
+esp_err_t I2C_SubmitFromISR(i2c_txn_t* txn)
 {
-	esp_err_t ret;
-	uint8_t buf[2];
+	BaseType_t woken = pdFALSE;
+	i2c_prio_t prio = txn->prio;
 	
-	_i2c_lock();
-	
-	// Write address
-	buf[0] = Reg_addr >> 8;
-    buf[1] = Reg_addr & 0xFF;
-	ret = _i2c_write_slave(Driver_addr, buf, 2);
+	if ((prio >= I2C_NUM_PRIO) || (txn->reg_len > 2) || ((txn->len != 0) && (txn->data == NULL))) {
+		return ESP_ERR_INVALID_ARG;
+	}
 	
-	// Read data
-	if (ret == ESP_OK) {
-		ret = _i2c_read_slave(Driver_addr, Reg_data, Length);
+	if (xQueueSendToBackFromISR(i2c_queue[prio], txn, &woken) != pdTRUE) {
+		return ESP_ERR_TIMEOUT;
+	}
+	xSemaphoreGiveFromISR(i2c_pending_sem, &woken);
+	if (woken == pdTRUE) {
+		portYIELD_FROM_ISR();
 	}
 	
-	_i2c_unlock();
-    
-    return ret;
+	return ESP_OK;
 }
-*/
+
+
 // Reg addr is 8 bit
 esp_err_t I2C_Write(uint8_t Driver_addr, uint8_t Reg_addr, const uint8_t *Reg_data, uint32_t Length)
 {
-    uint8_t buf[MAX_I2C_DATA_LEN+1];
-    
-    if (Length > MAX_I2C_DATA_LEN) {
-    	return ESP_ERR_INVALID_SIZE;
-    }
-    
-    buf[0] = Reg_addr;
-    // Copy Reg_data to buf starting at buf[1]
-    memcpy(&buf[1], Reg_data, Length);
-    return i2c_master_write_to_device(I2C_MASTER_NUM, Driver_addr, buf, Length+1, I2C_MASTER_TIMEOUT_MS / portTICK_PERIOD_MS);
+	i2c_txn_t txn = {
+		.addr = Driver_addr,
+		.prio = _i2c_addr_prio(Driver_addr),
+		.read = false,
+		.reg_len = 1,
+		.reg = Reg_addr,
+		.data = (uint8_t*) Reg_data,
+		.len = Length
+	};
+	
+	return _i2c_blocking(&txn);
 }
 
 
 esp_err_t I2C_WriteReg16(uint8_t Driver_addr, uint16_t Reg_addr, const uint8_t *Reg_data, uint32_t Length)
 {
-	uint8_t buf[MAX_I2C_DATA_LEN+2];
+	i2c_txn_t txn = {
+		.addr = Driver_addr,
+		.prio = _i2c_addr_prio(Driver_addr),
+		.read = false,
+		.reg_len = 2,
+		.reg = Reg_addr,
+		.data = (uint8_t*) Reg_data,
+		.len = Length
+	};
 	
-	if (Length > MAX_I2C_DATA_LEN) {
-    	return ESP_ERR_INVALID_SIZE;
-    }
-    
-    // Copy Reg_data to buf starting at buf[1]
-    buf[0] = Reg_addr >> 8;
-    buf[1] = Reg_addr & 0xFF;
-    memcpy(&buf[2], Reg_data, Length);
-    
-    return i2c_master_write_to_device(I2C_MASTER_NUM, Driver_addr, buf, Length+2, I2C_MASTER_TIMEOUT_MS / portTICK_PERIOD_MS);
+	return _i2c_blocking(&txn);
 }
 
 
 esp_err_t I2C_Read(uint8_t Driver_addr, uint8_t Reg_addr, uint8_t *Reg_data, uint32_t Length)
 {
-    return i2c_master_write_read_device(I2C_MASTER_NUM, Driver_addr, &Reg_addr, 1, Reg_data, Length, I2C_MASTER_TIMEOUT_MS / portTICK_PERIOD_MS);
+	i2c_txn_t txn = {
+		.addr = Driver_addr,
+		.prio = _i2c_addr_prio(Driver_addr),
+		.read = true,
+		.reg_len = 1,
+		.reg = Reg_addr,
+		.data = Reg_data,
+		.len = Length
+	};
+	
+	return _i2c_blocking(&txn);
 }
 
 
 esp_err_t I2C_ReadReg16(uint8_t Driver_addr, uint16_t Reg_addr, uint8_t *Reg_data, uint32_t Length)
 {
-	uint8_t buf[2];
+	i2c_txn_t txn = {
+		.addr = Driver_addr,
+		.prio = _i2c_addr_prio(Driver_addr),
+		.read = true,
+		.reg_len = 2,
+		.reg = Reg_addr,
+		.data = Reg_data,
+		.len = Length
+	};
 	
-	// Write address
-	buf[0] = Reg_addr >> 8;
-    buf[1] = Reg_addr & 0xFF;
-    
-    return i2c_master_write_read_device(I2C_MASTER_NUM, Driver_addr, (const uint8_t*) &buf, 2, Reg_data, Length, I2C_MASTER_TIMEOUT_MS / portTICK_PERIOD_MS);
+	return _i2c_blocking(&txn);
+}
+
+
+void I2C_GetStats(uint32_t* txn_cnt, uint32_t* batch_cnt, uint32_t* err_cnt)
+{
+	*txn_cnt = stat_txn_cnt;
+	*batch_cnt = stat_batch_cnt;
+	*err_cnt = stat_err_cnt;
 }
 
 
@@ -253,88 +268,163 @@ esp_err_t I2C_ReadReg16(uint8_t Driver_addr, uint16_t Reg_addr, uint8_t *Reg_dat
 //
 // Internal functions
 //
+static void _i2c_task(void* arg)
+{
+	esp_err_t ret;
+	int n;
+	i2c_txn_t batch[I2C_BATCH_MAX];
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	while (1) {
+		xSemaphoreTake(i2c_pending_sem, portMAX_DELAY);
+		
+		n = _i2c_get_batch(batch);
+		if (n == 0) continue;
+		
+		// Run the batch as one command link.  If it fails we can't tell which
+		// transaction caused it so re-run each by itself to get individual status.
+		ret = _i2c_run(batch, n);
+		if (n > 1) {
+			stat_batch_cnt++;
+			if (ret != ESP_OK) {
+				for (int i=0; i<n; i++) {
+					batch[i].ret = _i2c_run(&batch[i], 1);
+				}
+			}
+		}
+		
+		for (int i=0; i<n; i++) {
+			if ((n == 1) || (ret == ESP_OK)) {
+				batch[i].ret = ret;
+			}
+			if (batch[i].ret != ESP_OK) {
+				stat_err_cnt++;
+			}
+			stat_txn_cnt++;
+			if (batch[i].cb != NULL) {
+				batch[i].cb(&batch[i], batch[i].ret);
+			}
+		}
+	}
+}
 
-/**
- * i2c master lock
- */
-void _i2c_lock()
+
+// Collect the highest priority pending transaction and any others already waiting behind
+// it in the same queue.  Called holding one count of i2c_pending_sem.
+static int _i2c_get_batch(i2c_txn_t* batch)
 {
-	xSemaphoreTake(i2c_mutex, portMAX_DELAY);
+	int n = 0;
+	
+	for (int p=0; p<I2C_NUM_PRIO; p++) {
+		if (xQueueReceive(i2c_queue[p], &batch[0], 0) == pdTRUE) {
+			n = 1;
+			while (n < I2C_BATCH_MAX) {
+				if (xSemaphoreTake(i2c_pending_sem, 0) != pdTRUE) break;
+				if (xQueueReceive(i2c_queue[p], &batch[n], 0) != pdTRUE) {
+					// Pending count belongs to another queue
+					xSemaphoreGive(i2c_pending_sem);
+					break;
+				}
+				n++;
+			}
+			break;
+		}
+	}
+	
+	return n;
 }
 
 
-/**
- * i2c master unlock
- */
-void _i2c_unlock()
+// Execute n transactions in a single command link (repeated start between them)
+static esp_err_t _i2c_run(i2c_txn_t* txn, int n)
 {
-	xSemaphoreGive(i2c_mutex);
+	esp_err_t ret;
+	i2c_cmd_handle_t cmd;
+	uint8_t reg_buf[I2C_BATCH_MAX][2];
+	
+	cmd = i2c_cmd_link_create_static(cmd_link_buf, sizeof(cmd_link_buf));
+	
+	for (int i=0; i<n; i++) {
+		i2c_master_start(cmd);
+		if (txn[i].reg_len != 0) {
+			// Register address, MSB first
+			if (txn[i].reg_len == 2) {
+				reg_buf[i][0] = txn[i].reg >> 8;
+				reg_buf[i][1] = txn[i].reg & 0xFF;
+			} else {
+				reg_buf[i][0] = txn[i].reg & 0xFF;
+			}
+			i2c_master_write_byte(cmd, (txn[i].addr << 1) | I2C_MASTER_WRITE, true);
+			i2c_master_write(cmd, reg_buf[i], txn[i].reg_len, true);
+			if (txn[i].read) {
+				i2c_master_start(cmd);
+			}
+		}
+		if (txn[i].read) {
+			i2c_master_write_byte(cmd, (txn[i].addr << 1) | I2C_MASTER_READ, true);
+			if (txn[i].len != 0) {
+				i2c_master_read(cmd, txn[i].data, txn[i].len, I2C_MASTER_LAST_NACK);
+			}
+		} else {
+			if (txn[i].reg_len == 0) {
+				i2c_master_write_byte(cmd, (txn[i].addr << 1) | I2C_MASTER_WRITE, true);
+			}
+			if (txn[i].len != 0) {
+				i2c_master_write(cmd, txn[i].data, txn[i].len, true);
+			}
+		}
+	}
+	i2c_master_stop(cmd);
+	
+	ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, pdMS_TO_TICKS(I2C_MASTER_TIMEOUT_MS));
+	i2c_cmd_link_delete_static(cmd);
+	
+	return ret;
 }
 
 
-/**
- * Read esp-i2c-slave
- *
- * _______________________________________________________________________________________
- * | start | slave_addr + rd_bit +ack | read n-1 bytes + ack | read 1 byte + nack | stop |
- * --------|--------------------------|----------------------|--------------------|------|
- *
- */
-/*
-esp_err_t _i2c_read_slave(uint8_t addr7, uint8_t *data_rd, size_t size)
+// Submit a transaction and wait for it to complete.  Must not be called from a
+// transaction callback since those run in the bus task.
+static esp_err_t _i2c_blocking(i2c_txn_t* txn)
 {
-	i2c_device_config_t dev_cfg;
-	i2c_master_dev_handle_t dev_handle;
+	esp_err_t ret;
+	StaticSemaphore_t done_buf;
+	i2c_blocking_ctx_t ctx;
 	
-    if (size == 0) {
-        return ESP_OK;
-    }
-    
-    dev_cfg.dev_addr_length = I2C_ADDR_BIT_LEN_7;
-    dev_cfg.device_address = (uint16_t) addr7;
-    dev_cfg.scl_speed_hz = I2C_MASTER_FREQ_HZ;
-    
-    esp_err_t ret = i2c_master_bus_add_device(bus_handle, &dev_cfg, &dev_handle);
-    if (ret != ESP_OK) {
-    	return ret;
-    }
-    
-    ret = i2c_master_receive(dev_handle, data_rd, size, I2C_MASTER_TIMEOUT_MS);
-    
-    i2c_master_bus_rm_device(dev_handle);
-    
-    return ret;
+	ctx.done_sem = xSemaphoreCreateBinaryStatic(&done_buf);
+	ctx.ret = ESP_FAIL;
+	txn->cb = _i2c_blocking_done;
+	txn->cb_arg = (void*) &ctx;
+	
+	ret = I2C_Submit(txn);
+	if (ret == ESP_OK) {
+		xSemaphoreTake(ctx.done_sem, portMAX_DELAY);
+		ret = ctx.ret;
+	}
+	vSemaphoreDelete(ctx.done_sem);
+	
+	return ret;
 }
-*/
 
 
-/**
- * Write esp-i2c-slave
- *
- * ___________________________________________________________________
- * | start | slave_addr + wr_bit + ack | write n bytes + ack  | stop |
- * --------|---------------------------|----------------------|------|
- *
- */
-/*
-esp_err_t _i2c_write_slave(uint8_t addr7, uint8_t *data_wr, size_t size)
+// Runs in the bus task with its own copy of the transaction
+static void _i2c_blocking_done(i2c_txn_t* txn, esp_err_t ret)
 {
-    i2c_device_config_t dev_cfg;
-	i2c_master_dev_handle_t dev_handle;
+	i2c_blocking_ctx_t* ctxP = (i2c_blocking_ctx_t*) txn->cb_arg;
 	
-	dev_cfg.dev_addr_length = I2C_ADDR_BIT_LEN_7;
-    dev_cfg.device_address = (uint16_t) addr7;
-    dev_cfg.scl_speed_hz = I2C_MASTER_FREQ_HZ;
-    
-    esp_err_t ret = i2c_master_bus_add_device(bus_handle, &dev_cfg, &dev_handle);
-    if (ret != ESP_OK) {
-    	return ret;
-    }
-    
-    ret = i2c_master_transmit(dev_handle, data_wr, size, I2C_MASTER_TIMEOUT_MS);
-    
-    i2c_master_bus_rm_device(dev_handle);
-    
-    return ret;
+	ctxP->ret = ret;
+	xSemaphoreGive(ctxP->done_sem);
+}
+
+
+static i2c_prio_t _i2c_addr_prio(uint8_t addr)
+{
+	for (int i=0; i<dev_prio_cnt; i++) {
+		if (dev_prio_addr[i] == addr) {
+			return dev_prio_val[i];
+		}
+	}
+	
+	return I2C_PRIO_LOW;
 }
-*/
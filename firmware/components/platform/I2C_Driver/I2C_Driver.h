@@ -1,8 +1,8 @@
 /*
  * I2C Driver with locking
  *
- * Completely re-written Waveshare demo API but changed to use new I2C driver and
- * provide locking.
+ * Completely re-written Waveshare demo API.  Transactions are queued by priority
+ * and executed by a bus task.
  *
  * Copyright 2025 Dan Julio
  *
@@ -24,6 +24,7 @@
 #define I2C_DRIVER_H
 
 #include "esp_system.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 
@@ -37,14 +38,71 @@
 #define I2C_MASTER_FREQ_HZ          100000    /*!< I2C master clock frequency */
 #define I2C_MASTER_TIMEOUT_MS       1000
 
+// Bus task
+#define I2C_TASK_STACK              2560
+#define I2C_TASK_PRIORITY           4
+#define I2C_TASK_CORE               0
+
+// Per-priority transaction queue depth
+#define I2C_QUEUE_LEN               8
+
+// Maximum number of queued transactions run back-to-back in a single command link
+#define I2C_BATCH_MAX               4
+
+
+
+//
+// Transaction priority (lower value is serviced first)
+//
+typedef enum {
+	I2C_PRIO_TOUCH = 0,
+	I2C_PRIO_IMU,
+	I2C_PRIO_LOW,               // EXIO and anything not assigned a priority
+	I2C_NUM_PRIO
+} i2c_prio_t;
+
+
+
+//
+// Transaction
+//   Register address (0-2 bytes, MSB first) is written first.  A read then does a
+//   repeated start and reads len bytes into data.  A write sends data immediately after
+//   the register address.  data must remain valid until the callback is made.  The
+//   callback runs in the bus task and must be short and not issue blocking I2C calls.
+//
+struct i2c_txn_t;
+typedef void (*i2c_txn_cb)(struct i2c_txn_t* txn, esp_err_t ret);
+
+typedef struct i2c_txn_t {
+	uint8_t addr;
+	i2c_prio_t prio;
+	bool read;
+	uint8_t reg_len;
+	uint16_t reg;
+	uint8_t* data;
+	uint32_t len;
+	i2c_txn_cb cb;              // May be NULL
+	void* cb_arg;
+	esp_err_t ret;              // Set by the bus task
+} i2c_txn_t;
+
 
 //
 // I2C API
 //
 esp_err_t I2C_Init(void);
+void I2C_SetDevicePriority(uint8_t Driver_addr, i2c_prio_t prio);
+
+// Asynchronous access - the transaction is copied so it may be on the caller's stack
+esp_err_t I2C_Submit(i2c_txn_t* txn);
+esp_err_t I2C_SubmitFromISR(i2c_txn_t* txn);
+
+// Blocking access
 esp_err_t I2C_Write(uint8_t Driver_addr, uint8_t Reg_addr, const uint8_t *Reg_data, uint32_t Length);
 esp_err_t I2C_WriteReg16(uint8_t Driver_addr, uint16_t Reg_addr, const uint8_t *Reg_data, uint32_t Length);
 esp_err_t I2C_Read(uint8_t Driver_addr, uint8_t Reg_addr, uint8_t *Reg_data, uint32_t Length);
 esp_err_t I2C_ReadReg16(uint8_t Driver_addr, uint16_t Reg_addr, uint8_t *Reg_data, uint32_t Length);
 
+void I2C_GetStats(uint32_t* txn_cnt, uint32_t* batch_cnt, uint32_t* err_cnt);
+
 #endif /* I2C_DRIVER_H */
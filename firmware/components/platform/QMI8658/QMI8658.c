@@ -23,6 +23,7 @@ void QMI8658_Init(void)
 {
     uint8_t buf[1];
     Device_addr = QMI8658_L_SLAVE_ADDRESS;     
+    I2C_SetDevicePriority(Device_addr, I2C_PRIO_IMU);
     I2C_Read(Device_addr, QMI8658_REVISION_ID, buf, 1);
     printf("QMI8658 Device ID: %x\r\n",buf[0]);    // Get chip id
     setState(sensor_running);             
@@ -58,6 +59,84 @@ void QMI8658_Init(void)
         case GYR_RANGE_1024DPS: gyroScales = 1024.0 / 32768.0; break;
     }
 }
+/**
+ * Check the device answers with the expected identity.
+ * @return true if a QMI8658 is present
+ */
+bool QMI8658_Present(void)
+{
+    uint8_t id;
+
+    Device_addr = QMI8658_L_SLAVE_ADDRESS;
+    if (I2C_Read(Device_addr, QMI8658_WHO_AM_I, &id, 1) != ESP_OK) {
+        return false;
+    }
+    return (id == QMI8658_WHO_AM_I_VAL);
+}
+
+/**
+ * Select which sensors run (e.g. accelerometer only to allow its own ODR).
+ * @param ctrl7_en QMI8658_CTRL7_ACC_EN and/or QMI8658_CTRL7_GYR_EN
+ */
+void QMI8658_EnableSensors(uint8_t ctrl7_en)
+{
+    // keep the high speed internal clock enabled
+    QMI8658_transmit(QMI8658_CTRL7, 0x40 | ctrl7_en);
+}
+
+/**
+ * Reset the FIFO and put it in stream mode.
+ * @param size QMI8658_FIFO_SIZE_x
+ * @param wtm_samples watermark level in samples
+ */
+void QMI8658_ConfigFifo(uint8_t size, uint8_t wtm_samples)
+{
+    QMI8658_transmit(QMI8658_FIFO_WTM_TH, wtm_samples);
+    QMI8658_transmit(QMI8658_FIFO_CTRL, size | QMI8658_FIFO_MODE_STREAM);
+    QMI8658_CTRL9_Write(QMI8658_CTRL_CMD_RST_FIFO);
+}
+
+/**
+ * Get the number of bytes waiting in the FIFO.
+ * @param status returns the FIFO status flags (may be NULL)
+ * @return number of bytes or -1 on a bus error
+ */
+int QMI8658_GetFifoBytes(uint8_t* status)
+{
+    uint8_t buf[2];
+
+    // FIFO_SMPL_CNT and FIFO_STATUS in one read
+    if (I2C_Read(Device_addr, QMI8658_FIFO_SMPL_CNT, buf, 2) != ESP_OK) {
+        return -1;
+    }
+    if (status != NULL) {
+        *status = buf[1];
+    }
+    return 2 * (((buf[1] & QMI8658_FIFO_STATUS_CNT_MSB_MASK) << 8) | buf[0]);
+}
+
+/**
+ * Drain len bytes from the FIFO in one burst.
+ * @param buf destination
+ * @param len number of bytes (from QMI8658_GetFifoBytes)
+ * @return number of bytes read or -1 on a bus error
+ */
+int QMI8658_ReadFifo(uint8_t* buf, int len)
+{
+    esp_err_t ret;
+    uint8_t ctrl;
+
+    if (len <= 0) return 0;
+
+    // Enter FIFO read mode, read, then return to stream mode
+    QMI8658_CTRL9_Write(QMI8658_CTRL_CMD_REQ_FIFO);
+    ret = I2C_Read(Device_addr, QMI8658_FIFO_DATA, buf, len);
+    ctrl = QMI8658_receive(QMI8658_FIFO_CTRL);
+    QMI8658_transmit(QMI8658_FIFO_CTRL, ctrl & ~QMI8658_FIFO_RD_MODE);
+
+    return (ret == ESP_OK) ? len : -1;
+}
+
 void QMI8658_Loop(void)
 {
   getAccelerometer();
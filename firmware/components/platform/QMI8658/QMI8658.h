@@ -1,4 +1,5 @@
 #pragma once
+#include <stdbool.h>
 
 #include "I2C_Driver.h"
 
@@ -26,6 +27,10 @@
 #define QMI8658_CAL3_H  0x10  // calibration 3 register, higher bits
 #define QMI8658_CAL4_L  0x11  // calibration 4 register, lower bits
 #define QMI8658_CAL4_H  0x12  // calibration 4 register, higher bits
+#define QMI8658_FIFO_WTM_TH 0x13 // FIFO watermark level, in samples
+#define QMI8658_FIFO_CTRL 0x14 // FIFO control
+#define QMI8658_FIFO_SMPL_CNT 0x15 // FIFO sample count, lower bits
+#define QMI8658_FIFO_STATUS 0x16 // FIFO status + sample count upper bits
 
 #define QMI8658_TEMP_L 0x33 // lower bits of temperature data
 #define QMI8658_TEMP_H 0x34 // upper bits of temperature data
@@ -44,6 +49,7 @@
 #define QMI8658_GY_H 0x3E
 #define QMI8658_GZ_L 0x3F
 #define QMI8658_GZ_H 0x40
+#define QMI8658_FIFO_DATA 0x49 // FIFO data output
 
 #define QMI8658_AODR_MASK 0x0F // bits in acc data rate are 1, rest are 0 (CTRL2)
 #define QMI8658_GODR_MASK 0x0F // bits in gyro data rate are 1, rest are 0 (CTRL3)
@@ -66,6 +72,32 @@
 
 // control clock gating (necessary to use data locking)
 #define QMI8658_CTRL_CMD_AHB_CLOCK_GATING 0x12
+// FIFO commands
+#define QMI8658_CTRL_CMD_RST_FIFO 0x04
+#define QMI8658_CTRL_CMD_REQ_FIFO 0x05
+
+// CTRL7 sensor enables
+#define QMI8658_CTRL7_ACC_EN 0x01
+#define QMI8658_CTRL7_GYR_EN 0x02
+
+// FIFO_CTRL fields
+#define QMI8658_FIFO_RD_MODE 0x80
+#define QMI8658_FIFO_SIZE_16 0x00
+#define QMI8658_FIFO_SIZE_32 0x04
+#define QMI8658_FIFO_SIZE_64 0x08
+#define QMI8658_FIFO_SIZE_128 0x0C
+#define QMI8658_FIFO_MODE_BYPASS 0x00
+#define QMI8658_FIFO_MODE_FIFO 0x01
+#define QMI8658_FIFO_MODE_STREAM 0x02
+
+// FIFO_STATUS flags
+#define QMI8658_FIFO_STATUS_FULL 0x80
+#define QMI8658_FIFO_STATUS_WTM 0x40
+#define QMI8658_FIFO_STATUS_OVFLOW 0x20
+#define QMI8658_FIFO_STATUS_CNT_MSB_MASK 0x03
+
+// Expected WHO_AM_I value
+#define QMI8658_WHO_AM_I_VAL 0x05
 
 
 typedef enum {
@@ -137,6 +169,11 @@ extern IMUdata Accel;
 extern IMUdata Gyro;
 
 void QMI8658_Init(void);
+bool QMI8658_Present(void);
+void QMI8658_EnableSensors(uint8_t ctrl7_en);
+void QMI8658_ConfigFifo(uint8_t size, uint8_t wtm_samples);
+int QMI8658_GetFifoBytes(uint8_t* status);
+int QMI8658_ReadFifo(uint8_t* buf, int len);
 void QMI8658_Loop(void);
 void QMI8658_transmit(uint8_t addr, uint8_t data);
 uint8_t QMI8658_receive(uint8_t addr);
@@ -3,6 +3,13 @@
  *
  * Contains functions to initialize, configure and query the BLE interface.
  *
+ * With BLE_EN_PERIPHERAL defined a peripheral role runs alongside the central connection
+ * to the adapter: the stack is started by whichever of ble_init or ble_periph_init is
+ * called first (the GATT service is always registered before the host starts) and is
+ * left running when the central side is stopped.  The phone's connection asks for a
+ * longer connection interval than the adapter's so the controller keeps giving the
+ * adapter link the connection events its request rate needs.
+ *
  * Code design inspired by https://gitlab.com/janoskut/esp32-obd2-meter
  *
  * Copyright 2025 Dan Julio
@@ -23,6 +30,8 @@
  */
 #include "ble_utilities.h"
 #include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 //#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
 #include "esp_log.h"
 #include "nimble/nimble_port.h"
@@ -30,6 +39,10 @@
 #include "host/ble_hs.h"
 #include "host/util/util.h"
 #include "services/gap/ble_svc_gap.h"
+#ifdef BLE_EN_PERIPHERAL
+#include "services/gatt/ble_svc_gatt.h"
+#include "sdkconfig.h"
+#endif
 #include "nvs_flash.h"
 #include "ps_utilities.h"
 #include <string.h>
@@ -60,9 +73,40 @@ typedef struct {
 
 #define BLE_DISCOVERY_TIMEOUT_MS (5000U)
 #define BLE_CONNECT_TIMEOUT_MS   (10000U)
+#define BLE_FAST_CONNECT_TIMEOUT_MS (2000U)
+
+// Default ATT MTU and the ATT write header size
+#define BLE_DEFAULT_MTU          23
+#define BLE_ATT_WRITE_HDR_LEN    3
+
+// Write-without-response retries when the host is out of buffers
+#define BLE_TX_NO_RSP_RETRIES    10
+
+// ATT notification header size
+#define BLE_ATT_NOTIFY_HDR_LEN   3
+
+#ifdef BLE_EN_PERIPHERAL
+#if CONFIG_BT_NIMBLE_MAX_CONNECTIONS < 2
+#error "BLE_EN_PERIPHERAL needs CONFIG_BT_NIMBLE_MAX_CONNECTIONS of 2 (adapter and phone)"
+#endif
+
+// Phone connection interval (30 - 50 mSec, twice or more the adapter's) - notifications
+// are batched to it so nothing is lost by the longer interval
+#define BLE_PERIPH_ITVL_MIN      0x0018
+#define BLE_PERIPH_ITVL_MAX      0x0028
+#define BLE_PERIPH_SUP_TIMEOUT   0x0190    // 4 Sec
+
+// Advertising interval (100 - 150 mSec)
+#define BLE_PERIPH_ADV_ITVL_MIN  0x00A0
+#define BLE_PERIPH_ADV_ITVL_MAX  0x00F0
+
+// Longest control characteristic read or write
+#define BLE_PERIPH_CTRL_MAX_LEN  64
+#endif
 
+// Active scan so service UUIDs and names carried in scan responses are seen too
 static const struct ble_gap_disc_params disc_params = {
-    .passive           = 1,
+    .passive           = 0,
     .itvl              = 0x0010,
     .window            = 0x0010,
     .filter_duplicates = 1,
@@ -71,8 +115,8 @@ static const struct ble_gap_disc_params disc_params = {
 static const struct ble_gap_conn_params conn_params = {
     .scan_itvl           = 0x0010,
     .scan_window         = 0x0010,
-    .itvl_min            = 0x0010,
-    .itvl_max            = 0x0020,
+    .itvl_min            = 0x0006,   // 7.5 mSec
+    .itvl_max            = 0x000C,   // 15 mSec
     .latency             = 0,
     .supervision_timeout = 0x0100,
     .min_ce_len          = 0x0010,
@@ -81,6 +125,62 @@ static const struct ble_gap_conn_params conn_params = {
 
 static const uint8_t cccd_notify_enable_cfg[] = {0x01, 0x00};
 
+#ifdef BLE_EN_PERIPHERAL
+static const struct ble_gap_upd_params periph_conn_params = {
+    .itvl_min            = BLE_PERIPH_ITVL_MIN,
+    .itvl_max            = BLE_PERIPH_ITVL_MAX,
+    .latency             = 0,
+    .supervision_timeout = BLE_PERIPH_SUP_TIMEOUT,
+    .min_ce_len          = 0,
+    .max_ce_len          = 0,
+};
+
+static const struct ble_gap_adv_params periph_adv_params = {
+    .conn_mode           = BLE_GAP_CONN_MODE_UND,
+    .disc_mode           = BLE_GAP_DISC_MODE_GEN,
+    .itvl_min            = BLE_PERIPH_ADV_ITVL_MIN,
+    .itvl_max            = BLE_PERIPH_ADV_ITVL_MAX,
+};
+
+// e5d1000x-8a3c-4f1e-9b2d-3c5a7e9f0b1d (NimBLE byte order is reversed)
+static const ble_uuid128_t periph_svc_uuid =
+	BLE_UUID128_INIT(0x1d, 0x0b, 0x9f, 0x7e, 0x5a, 0x3c, 0x2d, 0x9b, 0x1e, 0x4f, 0x3c, 0x8a, 0x01, 0x00, 0xd1, 0xe5);
+static const ble_uuid128_t periph_data_uuid =
+	BLE_UUID128_INIT(0x1d, 0x0b, 0x9f, 0x7e, 0x5a, 0x3c, 0x2d, 0x9b, 0x1e, 0x4f, 0x3c, 0x8a, 0x02, 0x00, 0xd1, 0xe5);
+static const ble_uuid128_t periph_ctrl_uuid =
+	BLE_UUID128_INIT(0x1d, 0x0b, 0x9f, 0x7e, 0x5a, 0x3c, 0x2d, 0x9b, 0x1e, 0x4f, 0x3c, 0x8a, 0x03, 0x00, 0xd1, 0xe5);
+
+static uint16_t periph_data_handle;
+
+static int _ble_periph_access_cb(uint16_t handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+static const struct ble_gatt_svc_def periph_svcs[] = {
+	{
+		.type = BLE_GATT_SVC_TYPE_PRIMARY,
+		.uuid = &periph_svc_uuid.u,
+		.characteristics = (struct ble_gatt_chr_def[]) {
+			{
+				.uuid = &periph_data_uuid.u,
+				.access_cb = _ble_periph_access_cb,
+				.flags = BLE_GATT_CHR_F_NOTIFY,
+				.val_handle = &periph_data_handle,
+			},
+			{
+				.uuid = &periph_ctrl_uuid.u,
+				.access_cb = _ble_periph_access_cb,
+				.flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP,
+			},
+			{
+				0                      // No more characteristics
+			}
+		},
+	},
+	{
+		0                              // No more services
+	}
+};
+#endif
+
 // Note: Device UUIDs must be lower-case
 #define NUM_KNOWN_BLE_DEVICES  2
 static const remote_ble_device_desc_t known_ble_devices[NUM_KNOWN_BLE_DEVICES] = {
@@ -96,28 +196,51 @@ static const remote_ble_device_desc_t known_ble_devices[NUM_KNOWN_BLE_DEVICES] =
 static const char* TAG = "ble_utilities";
 
 // API state
+static bool is_initialized = false;         // NimBLE port running (from the first ble_init or ble_periph_init to ble_deinit)
 static bool is_enabled = false;
 static bool is_connected = false;
+static bool central_conn = false;           // Link to the adapter is up (before discovery completes too)
 
 // Internal state
 static bool svc_disc_completed = false;
 static bool chr_disc_completed = false;
 static bool chr_disc_started = false;
+static bool fast_connect = false;           // Connecting to the cached peer without discovery
+static bool try_cached_peer = true;         // Alternate cached peer connects with full scans
 static int num_searchable_ble_devices;
 static int cur_searchable_ble_device_index;
 static uint16_t conn_handle;
 static uint16_t tx_handle;
 static uint16_t rx_handle;
+static uint16_t cccd_handle;
+static bool tx_no_rsp;
+static volatile uint16_t att_mtu = BLE_DEFAULT_MTU;
 static char temp_name_str[BLE_NAME_STR_LEN+1];
 
 // System configuration
 static ble_config_t* configP;
 
+#ifdef BLE_EN_PERIPHERAL
+// Peripheral state
+static bool periph_en = false;
+static volatile bool periph_connected = false;
+static volatile bool periph_subscribed = false;
+static uint16_t periph_conn_handle;
+static volatile uint16_t periph_mtu = BLE_DEFAULT_MTU;
+static char periph_name[BLE_NAME_STR_LEN+1];
+
+// Peripheral callbacks
+static ble_periph_state_fcn periph_state_cb_fcn = NULL;
+static ble_periph_write_fcn periph_write_cb_fcn = NULL;
+static ble_periph_read_fcn periph_read_cb_fcn = NULL;
+#endif
+
 
 
 //
 // Forward declarations for internal functions
 //
+static bool _ble_port_start();
 static void _ble_client_on_reset(int reason);
 static void _ble_client_on_sync(void);
 static void _ble_client_host_task(void *param);
@@ -129,11 +252,22 @@ static const char* _ble_get_service_uuid(int index);
 static const char* _ble_get_tx_char_uuid(int index);
 static const char* _ble_get_rx_char_uuid(int index);
 static int _ble_adv_contains_service(const struct ble_hs_adv_fields *adv_fields);
+static int _ble_adv_has_known_name(const struct ble_hs_adv_fields *adv_fields);
+static bool _ble_is_cached_peer(const ble_addr_t *addr);
 static void _ble_gap_connected_cb(uint16_t handle);
+static int _ble_gatt_mtu_cb(uint16_t handle, const struct ble_gatt_error *error, uint16_t mtu, void *arg);
+static void _ble_gatt_start_discovery(uint16_t handle);
+static bool _ble_fast_connect();
+static int _ble_gatt_cccd_written_cb(uint16_t handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg);
+static void _ble_save_peer();
 static int _ble_gatt_svc_discovered_cb(uint16_t handle, const struct ble_gatt_error *error, const struct ble_gatt_svc *service, void *arg);
 static int _ble_gatt_chr_discovered_cb(uint16_t handle, const struct ble_gatt_error *error, const struct ble_gatt_chr *chr,void *arg);
 static void ble_gatt_svc_chr_disc_completed_check();
 static char* _ble_get_device_name(int len, const char* s);
+#ifdef BLE_EN_PERIPHERAL
+static void _ble_periph_advertise();
+static int _ble_periph_gap_event_cb(struct ble_gap_event *event, void *arg);
+#endif
 
 // Necessary template for compilation
 void ble_store_config_init(void);
@@ -154,8 +288,6 @@ static ble_rx_data_fcn rx_data_cb_fcn;
  */
 bool ble_init(ble_scan_complete_fcn scan_fcn, ble_rx_data_fcn rx_fcn)
 {
-	esp_err_t ret;
-	
 //	esp_log_level_set(TAG, ESP_LOG_DEBUG);
 	
 	// Save the calling code's callbacks
@@ -166,23 +298,64 @@ bool ble_init(ble_scan_complete_fcn scan_fcn, ble_rx_data_fcn rx_fcn)
 	(void) ps_get_config(PS_CONFIG_TYPE_BLE, (void**) &configP);
 	num_searchable_ble_devices = configP->use_custom_uuid ? NUM_KNOWN_BLE_DEVICES+1 : NUM_KNOWN_BLE_DEVICES;
 	
-	ret = nimble_port_init();
+	// The peripheral may have started the stack already
+	if (is_initialized) {
+		return true;
+	}
+	
+	return _ble_port_start();
+}
+
+
+/**
+ * Stop the host (which disconnects any peer and ends the host task) and release the
+ * controller so ble_init may be called again.  Returns false if the stack would not stop.
+ */
+bool ble_deinit()
+{
+	esp_err_t ret;
+	
+	if (!is_initialized) {
+		return true;
+	}
+	
+	// End a procedure in progress (the host terminates established connections itself)
+	if (ble_gap_disc_active()) {
+		(void) ble_gap_disc_cancel();
+	}
+	if (ble_gap_conn_active()) {
+		(void) ble_gap_conn_cancel();
+	}
+	
+#ifdef BLE_EN_PERIPHERAL
+	// Only the central side stops, the stack keeps running for the peripheral
+	if (periph_en) {
+		if (central_conn) {
+			(void) ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+		}
+		is_connected = false;
+		try_cached_peer = true;
+		return true;
+	}
+#endif
+	
+	is_enabled = false;
+	is_connected = false;
+	
+	ret = nimble_port_stop();
 	if (ret != ESP_OK) {
-		ESP_LOGE(TAG, "Failed to init nimble %d", ret);
+		ESP_LOGE(TAG, "Failed to stop nimble %d", ret);
 		return false;
 	}
 	
-	// Configure the host
-	ble_hs_cfg.reset_cb = _ble_client_on_reset;
-    ble_hs_cfg.sync_cb = _ble_client_on_sync;
-    ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
-    ble_hs_cfg.sm_io_cap = BLE_HS_IO_NO_INPUT_OUTPUT;
-    
-    // Need to have template for store (see above)
-    ble_store_config_init();
-    
-    // Start
-    nimble_port_freertos_init(_ble_client_host_task);
+	ret = nimble_port_deinit();
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to deinit nimble %d", ret);
+		return false;
+	}
+	
+	is_initialized = false;
+	try_cached_peer = true;
     
     return true;
 }
@@ -203,9 +376,22 @@ bool ble_start_scan()
 	conn_handle = 0;
 	tx_handle = 0;
 	rx_handle = 0;
+	cccd_handle = 0;
+	tx_no_rsp = false;
+	att_mtu = BLE_DEFAULT_MTU;
 	svc_disc_completed = false;
 	chr_disc_completed = false;
 	chr_disc_started   = false;
+	fast_connect       = false;
+	
+	// Try a direct connect to the last good peer using its cached handles first
+	if (configP->peer_valid && try_cached_peer && (configP->peer_device_index < num_searchable_ble_devices)) {
+		try_cached_peer = false;
+		if (_ble_fast_connect()) {
+			return true;
+		}
+	}
+	try_cached_peer = true;
 	
 	// Start scanning
 	rc = ble_gap_disc(0, BLE_DISCOVERY_TIMEOUT_MS, &disc_params, _ble_gap_event_cb, NULL);
@@ -236,9 +422,18 @@ bool ble_tx_data(int len, char* data)
 {
 	bool success = false;
 	int rc;
+	int retries = BLE_TX_NO_RSP_RETRIES;
 	
 	if (is_connected) {
- 		rc = ble_gattc_write_flat(conn_handle, tx_handle, data, len, NULL, NULL);
+		if (tx_no_rsp) {
+			// Write without response if the characteristic supports it.  The host
+			// may briefly run out of buffers when writes are back-to-back.
+			while (((rc = ble_gattc_write_no_rsp_flat(conn_handle, tx_handle, data, len)) == BLE_HS_ENOMEM) && (retries-- > 0)) {
+				vTaskDelay(1);
+			}
+		} else {
+ 			rc = ble_gattc_write_flat(conn_handle, tx_handle, data, len, NULL, NULL);
+ 		}
  		if (rc == 0) {
  			success = true;
  		} else {
@@ -253,20 +448,155 @@ bool ble_tx_data(int len, char* data)
 }
 
 
+/**
+ * Return the longest write supported by the negotiated ATT MTU
+ */
+int ble_get_max_tx_len()
+{
+	return att_mtu - BLE_ATT_WRITE_HDR_LEN;
+}
+
+
+/**
+ * Start the peripheral role advertising as name (starting the stack if the central side
+ * hasn't).  The callbacks are called from the NimBLE host task.  Returns false if the
+ * stack could not be started or the peripheral isn't included.
+ */
+bool ble_periph_init(const char* name, ble_periph_state_fcn state_fcn, ble_periph_write_fcn write_fcn, ble_periph_read_fcn read_fcn)
+{
+#ifdef BLE_EN_PERIPHERAL
+	strncpy(periph_name, name, BLE_NAME_STR_LEN);
+	periph_name[BLE_NAME_STR_LEN] = 0;
+	periph_state_cb_fcn = state_fcn;
+	periph_write_cb_fcn = write_fcn;
+	periph_read_cb_fcn = read_fcn;
+	periph_en = true;
+	
+	if (!is_initialized) {
+		return _ble_port_start();
+	}
+	
+	// Already synced (advertising starts at sync otherwise)
+	if (is_enabled) {
+		_ble_periph_advertise();
+	}
+	
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+bool ble_periph_is_subscribed()
+{
+#ifdef BLE_EN_PERIPHERAL
+	return periph_subscribed;
+#else
+	return false;
+#endif
+}
+
+
+/**
+ * Return the longest notification supported by the phone's negotiated ATT MTU
+ */
+int ble_periph_get_max_notify_len()
+{
+#ifdef BLE_EN_PERIPHERAL
+	return periph_mtu - BLE_ATT_NOTIFY_HDR_LEN;
+#else
+	return 0;
+#endif
+}
+
+
+/**
+ * Notify the subscribed phone.  Returns false if it isn't subscribed or the host is out
+ * of buffers (the caller should send less).
+ */
+bool ble_periph_notify(int len, const uint8_t* data)
+{
+#ifdef BLE_EN_PERIPHERAL
+	struct os_mbuf* om;
+	
+	if (!periph_subscribed) {
+		return false;
+	}
+	
+	om = ble_hs_mbuf_from_flat(data, len);
+	if (om == NULL) {
+		return false;
+	}
+	
+	// The mbuf is consumed whether or not the notification is queued
+	return (ble_gatts_notify_custom(periph_conn_handle, periph_data_handle, om) == 0);
+#else
+	return false;
+#endif
+}
+
+
 
 //
 // Internal functions
 //
+static bool _ble_port_start()
+{
+	esp_err_t ret;
+	
+	ret = nimble_port_init();
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to init nimble %d", ret);
+		return false;
+	}
+	
+	// Configure the host
+	ble_hs_cfg.reset_cb = _ble_client_on_reset;
+    ble_hs_cfg.sync_cb = _ble_client_on_sync;
+    ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
+    ble_hs_cfg.sm_io_cap = BLE_HS_IO_NO_INPUT_OUTPUT;
+    
+#ifdef BLE_EN_PERIPHERAL
+    // The service is registered whichever role starts the stack as it can't be added later
+    ble_svc_gap_init();
+    ble_svc_gatt_init();
+    if ((ble_gatts_count_cfg(periph_svcs) != 0) || (ble_gatts_add_svcs(periph_svcs) != 0)) {
+    	ESP_LOGE(TAG, "Failed to add peripheral service");
+    }
+#endif
+    
+    // Need to have template for store (see above)
+    ble_store_config_init();
+    
+    // Start
+    nimble_port_freertos_init(_ble_client_host_task);
+    is_initialized = true;
+    
+    return true;
+}
+
+
 static void _ble_client_on_reset(int reason)
 {
     ESP_LOGE(TAG, "NimBLE stack reset - reason = %d", reason);
     is_connected = false;
+    central_conn = false;
+#ifdef BLE_EN_PERIPHERAL
+    periph_connected = false;
+    periph_subscribed = false;
+#endif
 }
 
 
 static void _ble_client_on_sync(void)
 {
     is_enabled = true;
+#ifdef BLE_EN_PERIPHERAL
+    if (periph_en) {
+    	_ble_periph_advertise();
+    }
+#endif
 }
 
 
@@ -304,7 +634,23 @@ static int _ble_gap_event_cb(struct ble_gap_event *event, void *arg)
         			ESP_LOGD(TAG, "Device name: %s",  _ble_get_device_name(adv_fields.name_len, (const char*) adv_fields.name));
         		}
 				
+        		// The last good peer is connected to with its cached handles as soon as it
+        		// is seen
+        		if (_ble_is_cached_peer(&event->disc.addr)) {
+        			ESP_LOGI(TAG, "Found cached peer %s", addr_str);
+        			ble_gap_disc_cancel();
+        			if (!_ble_fast_connect()) {
+        				scan_complete_cb_fcn(1);
+        			}
+        			break;
+        		}
+				
+				// Otherwise the first known adapter (by service or, for adapters that don't
+				// advertise their service, name)
 				cur_searchable_ble_device_index = _ble_adv_contains_service(&adv_fields);
+				if (cur_searchable_ble_device_index < 0) {
+					cur_searchable_ble_device_index = _ble_adv_has_known_name(&adv_fields);
+				}
         		
         		if (cur_searchable_ble_device_index >= 0) {
         			// Try to connect to a matching device
@@ -341,6 +687,7 @@ static int _ble_gap_event_cb(struct ble_gap_event *event, void *arg)
     	case BLE_GAP_EVENT_CONNECT:
     		if (event->connect.status == 0) {
     			ESP_LOGI(TAG, "Connected to device. Handle: 0x%04x", event->connect.conn_handle);
+    			central_conn = true;
     			_ble_gap_connected_cb(event->connect.conn_handle);
     		} else {
     			ESP_LOGE(TAG, "Connection to %s failed: %d", addr_str, event->connect.status);
@@ -351,6 +698,7 @@ static int _ble_gap_event_cb(struct ble_gap_event *event, void *arg)
     	
     	case BLE_GAP_EVENT_DISCONNECT:
     		is_connected = false;
+    		central_conn = false;
     		ESP_LOGI(TAG, "Device disconnected - reason %d", event->disconnect.reason);
     		break;
     	
@@ -364,6 +712,7 @@ static int _ble_gap_event_cb(struct ble_gap_event *event, void *arg)
     	
     	case BLE_GAP_EVENT_MTU:
     		ESP_LOGD(TAG, "MTU exchange complete. MTU size: %d", event->mtu.value);
+    		att_mtu = event->mtu.value;
     		break;
     	
     	case BLE_GAP_EVENT_LINK_ESTAB:
@@ -517,7 +866,7 @@ static int _ble_adv_contains_service(const struct ble_hs_adv_fields *adv_fields)
 		// 16-bit UUIDs
 		for (j = 0; j < adv_fields->num_uuids16; j++) {
 			ble_uuid_to_str(&adv_fields->uuids16[j].u, uuid_str);
-			ESP_LOGI(TAG, "Checking %s %s", uuid_str, target_uuid);
+			ESP_LOGD(TAG, "Checking %s %s", uuid_str, target_uuid);
 			if (strncmp(uuid_str, target_uuid, BLE_UUID_STR_LEN) == 0) {
 				return i;
 			}
@@ -545,12 +894,82 @@ static int _ble_adv_contains_service(const struct ble_hs_adv_fields *adv_fields)
 }
 
 
+// Returns the known device advertising its BLE name or -1 if there is none
+static int _ble_adv_has_known_name(const struct ble_hs_adv_fields *adv_fields)
+{
+	const char* name;
+	
+	if (adv_fields->name_len == 0) {
+		return -1;
+	}
+	
+	for (int i=0; i<NUM_KNOWN_BLE_DEVICES; i++) {
+		name = _ble_get_ble_device_ble_name(i);
+		if ((strlen(name) == adv_fields->name_len) && (memcmp(name, adv_fields->name, adv_fields->name_len) == 0)) {
+			return i;
+		}
+	}
+	
+	return -1;
+}
+
+
+static bool _ble_is_cached_peer(const ble_addr_t *addr)
+{
+	return (configP->peer_valid && (configP->peer_device_index < num_searchable_ble_devices) &&
+	        (addr->type == configP->peer_addr_type) && (memcmp(addr->val, configP->peer_addr, PS_BLE_ADDR_LEN) == 0));
+}
+
+
 static void _ble_gap_connected_cb(uint16_t handle)
 {
 	int rc;
 	
 	conn_handle = handle;
 	
+	// Negotiate the largest MTU (CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU) before discovery
+	// so it is known when the ELM327 driver starts
+	rc = ble_gattc_exchange_mtu(handle, _ble_gatt_mtu_cb, NULL);
+	if (rc != 0) {
+		ESP_LOGW(TAG, "Failed to start MTU exchange - %d", rc);
+		_ble_gatt_start_discovery(handle);
+	}
+}
+
+
+static int _ble_gatt_mtu_cb(uint16_t handle, const struct ble_gatt_error *error, uint16_t mtu, void *arg)
+{
+	if (error->status == 0) {
+		ESP_LOGI(TAG, "MTU %u", mtu);
+		att_mtu = mtu;
+	} else {
+		ESP_LOGW(TAG, "MTU exchange failed - %d", error->status);
+	}
+	
+	_ble_gatt_start_discovery(handle);
+	
+	return 0;
+}
+
+
+// Start service discovery or, when connected to the cached peer, just subscribe to
+// notifications using its cached handles
+static void _ble_gatt_start_discovery(uint16_t handle)
+{
+	int rc;
+	
+	if (fast_connect) {
+		rc = ble_gattc_write_flat(handle, configP->peer_cccd_handle, cccd_notify_enable_cfg, sizeof(cccd_notify_enable_cfg), _ble_gatt_cccd_written_cb, NULL);
+		if (rc != 0) {
+			ESP_LOGE(TAG, "Failed to subscribe with cached handles - %d", rc);
+			configP->peer_valid = false;
+			(void) ps_save_config(PS_CONFIG_TYPE_BLE);
+			(void) ble_gap_terminate(handle, BLE_ERR_REM_USER_CONN_TERM);
+			scan_complete_cb_fcn(6);
+		}
+		return;
+	}
+	
 	// Start service discovery
 	rc = ble_gattc_disc_all_svcs(handle, _ble_gatt_svc_discovered_cb, NULL);
 	if (rc == 0) {
@@ -619,6 +1038,7 @@ static int _ble_gatt_chr_discovered_cb(uint16_t handle, const struct ble_gatt_er
     		if (strcmp(uuid_str, char_uuid) == 0) {
     			ESP_LOGD(TAG, "  TX characteristic found");
     			tx_handle = chr->val_handle;
+    			tx_no_rsp = (chr->properties & BLE_GATT_CHR_PROP_WRITE_NO_RSP) != 0;
     		}
     		
     		// Look for RX characteristic
@@ -631,6 +1051,7 @@ static int _ble_gatt_chr_discovered_cb(uint16_t handle, const struct ble_gatt_er
                                          cccd_notify_enable_cfg, sizeof(cccd_notify_enable_cfg), NULL, NULL);
             	if (rc == 0) {
             		rx_handle = chr->val_handle;
+            		cccd_handle = chr->val_handle + 1;
             	} else {
             		ESP_LOGE(TAG, "Failed to subscribe to RX notifications - %d", rc);
             	}
@@ -659,6 +1080,7 @@ static void ble_gatt_svc_chr_disc_completed_check()
 		// Done with characteristic discovery, check to see if we found matches
 		if ((tx_handle != 0) && (rx_handle != 0)) {
 			is_connected = true;
+			_ble_save_peer();
 		} else {
 			// Disconnect from device
 			disconnect = true;
@@ -687,6 +1109,88 @@ static void ble_gatt_svc_chr_disc_completed_check()
 }
 
 
+// Start a direct connection to the cached peer.  Returns false if it cannot be started.
+static bool _ble_fast_connect()
+{
+	ble_addr_t addr;
+	int rc;
+	
+	addr.type = configP->peer_addr_type;
+	memcpy(addr.val, configP->peer_addr, PS_BLE_ADDR_LEN);
+	
+	cur_searchable_ble_device_index = configP->peer_device_index;
+	tx_handle = configP->peer_tx_handle;
+	tx_no_rsp = configP->peer_tx_no_rsp;
+	fast_connect = true;
+	
+	rc = ble_gap_connect(BLE_OWN_ADDR_PUBLIC, &addr, BLE_FAST_CONNECT_TIMEOUT_MS, &conn_params, _ble_gap_event_cb, NULL);
+	if (rc != 0) {
+		ESP_LOGW(TAG, "Cached peer connect failed - %d", rc);
+		fast_connect = false;
+		return false;
+	}
+	
+	ESP_LOGI(TAG, "Connecting to cached peer %s...", _ble_get_ble_device_name(cur_searchable_ble_device_index));
+	return true;
+}
+
+
+static int _ble_gatt_cccd_written_cb(uint16_t handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg)
+{
+	if (error->status == 0) {
+		ESP_LOGI(TAG, "Connected using cached handles");
+		rx_handle = configP->peer_rx_handle;
+		try_cached_peer = true;
+		is_connected = true;
+		scan_complete_cb_fcn(0);
+	} else {
+		// Handles may have changed, forget them and fall back to discovery
+		ESP_LOGE(TAG, "Cached handle subscribe failed - %d", error->status);
+		configP->peer_valid = false;
+		(void) ps_save_config(PS_CONFIG_TYPE_BLE);
+		(void) ble_gap_terminate(handle, BLE_ERR_REM_USER_CONN_TERM);
+		scan_complete_cb_fcn(7);
+	}
+	
+	return 0;
+}
+
+
+// Persist the connected peer's address and handles if they changed
+static void _ble_save_peer()
+{
+	struct ble_gap_conn_desc desc;
+	
+	try_cached_peer = true;
+	
+	if (ble_gap_conn_find(conn_handle, &desc) != 0) {
+		return;
+	}
+	
+	if (!configP->peer_valid ||
+	    (configP->peer_addr_type != desc.peer_ota_addr.type) ||
+	    (memcmp(configP->peer_addr, desc.peer_ota_addr.val, PS_BLE_ADDR_LEN) != 0) ||
+	    (configP->peer_device_index != cur_searchable_ble_device_index) ||
+	    (configP->peer_tx_handle != tx_handle) ||
+	    (configP->peer_rx_handle != rx_handle) ||
+	    (configP->peer_cccd_handle != cccd_handle) ||
+	    (configP->peer_tx_no_rsp != tx_no_rsp)) {
+	    
+		configP->peer_valid = true;
+		configP->peer_addr_type = desc.peer_ota_addr.type;
+		memcpy(configP->peer_addr, desc.peer_ota_addr.val, PS_BLE_ADDR_LEN);
+		configP->peer_device_index = cur_searchable_ble_device_index;
+		configP->peer_tx_handle = tx_handle;
+		configP->peer_rx_handle = rx_handle;
+		configP->peer_cccd_handle = cccd_handle;
+		configP->peer_tx_no_rsp = tx_no_rsp;
+		if (!ps_save_config(PS_CONFIG_TYPE_BLE)) {
+			ESP_LOGE(TAG, "Could not save peer information");
+		}
+	}
+}
+
+
 static char* _ble_get_device_name(int len, const char* s)
 {
 	// Must null terminate the string
@@ -696,3 +1200,137 @@ static char* _ble_get_device_name(int len, const char* s)
 	
 	return temp_name_str;
 }
+
+
+#ifdef BLE_EN_PERIPHERAL
+// Advertise the service (name in the scan response) until a phone connects
+static void _ble_periph_advertise()
+{
+	struct ble_hs_adv_fields fields;
+	struct ble_hs_adv_fields rsp_fields;
+	int rc;
+	
+	if (periph_connected || ble_gap_adv_active()) {
+		return;
+	}
+	
+	(void) ble_svc_gap_device_name_set(periph_name);
+	
+	memset(&fields, 0, sizeof(fields));
+	fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+	fields.uuids128 = &periph_svc_uuid;
+	fields.num_uuids128 = 1;
+	fields.uuids128_is_complete = 1;
+	rc = ble_gap_adv_set_fields(&fields);
+	if (rc != 0) {
+		ESP_LOGE(TAG, "Failed to set advertisement data - %d", rc);
+		return;
+	}
+	
+	memset(&rsp_fields, 0, sizeof(rsp_fields));
+	rsp_fields.name = (uint8_t*) periph_name;
+	rsp_fields.name_len = strlen(periph_name);
+	rsp_fields.name_is_complete = 1;
+	rc = ble_gap_adv_rsp_set_fields(&rsp_fields);
+	if (rc != 0) {
+		ESP_LOGE(TAG, "Failed to set scan response data - %d", rc);
+		return;
+	}
+	
+	rc = ble_gap_adv_start(BLE_OWN_ADDR_PUBLIC, NULL, BLE_HS_FOREVER, &periph_adv_params, _ble_periph_gap_event_cb, NULL);
+	if (rc != 0) {
+		ESP_LOGE(TAG, "Failed to start advertising - %d", rc);
+	} else {
+		ESP_LOGI(TAG, "Advertising as %s", periph_name);
+	}
+}
+
+
+// Events for the phone's connection
+static int _ble_periph_gap_event_cb(struct ble_gap_event *event, void *arg)
+{
+	int rc;
+	
+	switch (event->type) {
+		case BLE_GAP_EVENT_CONNECT:
+			if (event->connect.status == 0) {
+				ESP_LOGI(TAG, "Phone connected. Handle: 0x%04x", event->connect.conn_handle);
+				periph_conn_handle = event->connect.conn_handle;
+				periph_mtu = BLE_DEFAULT_MTU;
+				periph_connected = true;
+				
+				// Leave the connection events the adapter link needs
+				rc = ble_gap_update_params(periph_conn_handle, &periph_conn_params);
+				if (rc != 0) {
+					ESP_LOGW(TAG, "Failed to request phone connection parameters - %d", rc);
+				}
+			} else {
+				_ble_periph_advertise();
+			}
+			break;
+		
+		case BLE_GAP_EVENT_DISCONNECT:
+			ESP_LOGI(TAG, "Phone disconnected - reason %d", event->disconnect.reason);
+			periph_connected = false;
+			if (periph_subscribed) {
+				periph_subscribed = false;
+				if (periph_state_cb_fcn != NULL) {
+					periph_state_cb_fcn(false);
+				}
+			}
+			_ble_periph_advertise();
+			break;
+		
+		case BLE_GAP_EVENT_ADV_COMPLETE:
+			_ble_periph_advertise();
+			break;
+		
+		case BLE_GAP_EVENT_SUBSCRIBE:
+			if (event->subscribe.attr_handle == periph_data_handle) {
+				periph_subscribed = (event->subscribe.cur_notify != 0);
+				ESP_LOGI(TAG, "Phone %s", periph_subscribed ? "subscribed" : "unsubscribed");
+				if (periph_state_cb_fcn != NULL) {
+					periph_state_cb_fcn(periph_subscribed);
+				}
+			}
+			break;
+		
+		case BLE_GAP_EVENT_MTU:
+			ESP_LOGI(TAG, "Phone MTU %u", event->mtu.value);
+			periph_mtu = event->mtu.value;
+			break;
+		
+		default:
+			ESP_LOGD(TAG, "Phone event type: %d", event->type);
+	}
+	
+	return 0;
+}
+
+
+static int _ble_periph_access_cb(uint16_t handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+	uint8_t buf[BLE_PERIPH_CTRL_MAX_LEN];
+	uint16_t len;
+	int n;
+	
+	switch (ctxt->op) {
+		case BLE_GATT_ACCESS_OP_READ_CHR:
+			n = (periph_read_cb_fcn != NULL) ? periph_read_cb_fcn(sizeof(buf), buf) : 0;
+			return (os_mbuf_append(ctxt->om, buf, n) == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+		
+		case BLE_GATT_ACCESS_OP_WRITE_CHR:
+			if (ble_hs_mbuf_to_flat(ctxt->om, buf, sizeof(buf), &len) != 0) {
+				return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+			}
+			if (periph_write_cb_fcn != NULL) {
+				periph_write_cb_fcn(len, buf);
+			}
+			return 0;
+		
+		default:
+			// The notify characteristic has no value of its own
+			return BLE_ATT_ERR_UNLIKELY;
+	}
+}
+#endif
@@ -29,21 +29,47 @@
 
 
 
+//
+// BLE Utilities Constants
+//
+
+// Uncomment to add a peripheral role, running alongside the central connection to a BLE
+// ELM327 adapter, with one service (UUID e5d10001-8a3c-4f1e-9b2d-3c5a7e9f0b1d) holding a
+// notify characteristic for streamed data (e5d10002-...) and a read/write control
+// characteristic (e5d10003-...).  Used by ble_stream_task.  Needs
+// CONFIG_BT_NIMBLE_MAX_CONNECTIONS set to 2 in menuconfig.
+//#define BLE_EN_PERIPHERAL
+
+
+
 //
 // Typedef for RX callback
 //
 typedef void (*ble_scan_complete_fcn)(int debug);          // Scan done callback (returns internal diag info)
 typedef void (*ble_rx_data_fcn)(int len, uint8_t* data);   // Receive data callback
 
+// Peripheral callbacks (called from the NimBLE host task)
+typedef void (*ble_periph_state_fcn)(bool subscribed);                // Notifications enabled or disabled
+typedef void (*ble_periph_write_fcn)(int len, const uint8_t* data);  // Control characteristic written
+typedef int (*ble_periph_read_fcn)(int max_len, uint8_t* data);      // Control characteristic read (returns length)
+
 
 
 //
 // BLE Utilities API
 //
 bool ble_init(ble_scan_complete_fcn scan_fcn, ble_rx_data_fcn rx_fcn);
+bool ble_deinit();
 bool ble_start_scan();
 bool ble_is_enabled();
 bool ble_is_connected();
 bool ble_tx_data(int len, char* data);
+int ble_get_max_tx_len();
+
+// Peripheral API (BLE_EN_PERIPHERAL)
+bool ble_periph_init(const char* name, ble_periph_state_fcn state_fcn, ble_periph_write_fcn write_fcn, ble_periph_read_fcn read_fcn);
+bool ble_periph_is_subscribed();
+int ble_periph_get_max_notify_len();
+bool ble_periph_notify(int len, const uint8_t* data);
 
 #endif /* BLE_UTILITIES_H */
@@ -0,0 +1,153 @@
+/*
+ * Deadline Utilities
+ *
+ * Each loop's timing is only written by the task running it.  Readers copy the
+ * statistics under a spinlock.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "deadline_utilities.h"
+#include "dlog_utilities.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <string.h>
+
+
+
+//
+// Deadline Utilities typedefs
+//
+typedef struct {
+	bool enabled;
+	int64_t start_usec;
+	int64_t phase_start_usec;
+	int phase;
+	uint32_t phase_usec[DEADLINE_NUM_PHASES];     // This iteration
+	deadline_stats_t stats;
+} deadline_loop_t;
+
+
+
+//
+// Deadline Utilities variables
+//
+static const char* TAG = "deadline";
+
+static const char* loop_names[DEADLINE_NUM_LOOPS] = {"can_task", "gui_task"};
+static const char* phase_names[DEADLINE_NUM_PHASES] = {"decode", "sched", "save", "render", "broker", "other"};
+
+static portMUX_TYPE deadline_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static deadline_loop_t loops[DEADLINE_NUM_LOOPS];
+
+
+
+//
+// Deadline Utilities API
+//
+void deadline_init(int loop, uint32_t budget_usec)
+{
+	if ((loop < 0) || (loop >= DEADLINE_NUM_LOOPS)) return;
+	
+	memset(&loops[loop], 0, sizeof(deadline_loop_t));
+	loops[loop].stats.budget_usec = budget_usec;
+	loops[loop].stats.max_phase = DEADLINE_PHASE_OTHER;
+	loops[loop].stats.overrun_phase = -1;
+	loops[loop].enabled = true;
+}
+
+
+// Start an iteration in phase
+void deadline_begin(int loop, int phase)
+{
+	deadline_loop_t* lP = &loops[loop];
+	
+	if (!lP->enabled) return;
+	
+	memset(lP->phase_usec, 0, sizeof(lP->phase_usec));
+	lP->start_usec = esp_timer_get_time();
+	lP->phase_start_usec = lP->start_usec;
+	lP->phase = phase;
+}
+
+
+// Move to another phase (may be called by the functions a loop calls whether or not
+// the loop is monitored)
+void deadline_phase(int loop, int phase)
+{
+	deadline_loop_t* lP = &loops[loop];
+	int64_t t;
+	
+	if (!lP->enabled || (lP->start_usec == 0)) return;
+	
+	t = esp_timer_get_time();
+	lP->phase_usec[lP->phase] += (uint32_t) (t - lP->phase_start_usec);
+	lP->phase_start_usec = t;
+	lP->phase = phase;
+}
+
+
+void deadline_end(int loop)
+{
+	deadline_loop_t* lP = &loops[loop];
+	uint32_t dur;
+	int longest = 0;
+	
+	if (!lP->enabled || (lP->start_usec == 0)) return;
+	
+	deadline_phase(loop, lP->phase);
+	dur = (uint32_t) (lP->phase_start_usec - lP->start_usec);
+	lP->start_usec = 0;
+	for (int i=1; i<DEADLINE_NUM_PHASES; i++) {
+		if (lP->phase_usec[i] > lP->phase_usec[longest]) longest = i;
+	}
+	
+	portENTER_CRITICAL(&deadline_mux);
+	lP->stats.iterations++;
+	lP->stats.last_usec = dur;
+	if (dur > lP->stats.max_usec) {
+		lP->stats.max_usec = dur;
+		lP->stats.max_phase = longest;
+	}
+	if (dur > lP->stats.budget_usec) {
+		lP->stats.overruns++;
+		lP->stats.overrun_phase = longest;
+	}
+	portEXIT_CRITICAL(&deadline_mux);
+	
+	if (dur > (DEADLINE_LOG_FACTOR * lP->stats.budget_usec)) {
+		DLOGW(TAG, "%s took %lu uSec (mostly %s)", loop_names[loop], dur, phase_names[longest]);
+	}
+}
+
+
+bool deadline_get_stats(int loop, deadline_stats_t* statsP)
+{
+	if ((loop < 0) || (loop >= DEADLINE_NUM_LOOPS) || !loops[loop].enabled) return false;
+	
+	portENTER_CRITICAL(&deadline_mux);
+	*statsP = loops[loop].stats;
+	portEXIT_CRITICAL(&deadline_mux);
+	
+	return true;
+}
+
+
+const char* deadline_get_phase_name(int phase)
+{
+	return ((phase >= 0) && (phase < DEADLINE_NUM_PHASES)) ? phase_names[phase] : "-";
+}
@@ -0,0 +1,82 @@
+/*
+ * Deadline Utilities
+ *
+ * Lightweight monitor of the time taken by each iteration of the periodic task loops.
+ * A loop marks the start of each iteration, the phases it passes through and the end.
+ * Iterations longer than the loop's budget are counted along with the phase that took
+ * longest in them, and those more than DEADLINE_LOG_FACTOR times the budget are logged
+ * (rate limited).  Statistics are read by the diagnostics displays.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef DEADLINE_UTILITIES_H
+#define DEADLINE_UTILITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Deadline Utilities Constants
+//
+
+// Monitored loops
+#define DEADLINE_LOOP_CAN      0         // can_task (vehicle manager evaluation)
+#define DEADLINE_LOOP_GUI      1         // gui_task (one LVGL frame)
+#define DEADLINE_NUM_LOOPS     2
+
+// Loop phases
+#define DEADLINE_PHASE_DECODE  0         // Vehicle manager response decoding
+#define DEADLINE_PHASE_SCHED   1         // Vehicle manager request scheduling
+#define DEADLINE_PHASE_SAVE    2         // Trip and snapshot persistence
+#define DEADLINE_PHASE_RENDER  3         // LVGL timers, rendering and display flush
+#define DEADLINE_PHASE_BROKER  4         // Data broker GUI callbacks
+#define DEADLINE_PHASE_OTHER   5
+#define DEADLINE_NUM_PHASES    6
+
+// Iterations over this multiple of the budget are logged
+#define DEADLINE_LOG_FACTOR    2
+
+
+
+//
+// Deadline Utilities typedefs
+//
+typedef struct {
+	uint32_t budget_usec;
+	uint32_t iterations;
+	uint32_t overruns;
+	uint32_t last_usec;                  // Duration of the last iteration
+	uint32_t max_usec;                   // Longest iteration
+	int max_phase;                       // Longest phase of the longest iteration
+	int overrun_phase;                   // Longest phase of the last overrun (-1 if none yet)
+} deadline_stats_t;
+
+
+
+//
+// Deadline Utilities API
+//
+void deadline_init(int loop, uint32_t budget_usec);
+void deadline_begin(int loop, int phase);
+void deadline_phase(int loop, int phase);
+void deadline_end(int loop);
+bool deadline_get_stats(int loop, deadline_stats_t* statsP);
+const char* deadline_get_phase_name(int phase);
+
+#endif /* DEADLINE_UTILITIES_H */
@@ -0,0 +1,135 @@
+/*
+ * Deferred Log Utilities
+ *
+ * Records are written under a spinlock so any task may log.  Writers never wait: when
+ * the ring is full the record is dropped and counted.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "dlog_utilities.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+
+
+//
+// Deferred Log Utilities typedefs
+//
+typedef struct {
+	const dlog_site_t* siteP;
+	const char* tag;
+	uint32_t ts_msec;
+	uint32_t suppressed;                 // Records the site skipped before this one
+	uint32_t args[DLOG_MAX_ARGS];
+} dlog_record_t;
+
+
+
+//
+// Deferred Log Utilities variables
+//
+static const char* TAG = "dlog";
+
+static portMUX_TYPE dlog_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static dlog_record_t ring[DLOG_RING_LEN];
+static uint32_t write_count = 0;
+static uint32_t read_count = 0;
+static uint32_t drop_count = 0;
+
+
+
+//
+// Deferred Log Utilities API
+//
+
+// Called by the DLOG macros
+void dlog_write(dlog_site_t* siteP, const char* tag, int num_args, ...)
+{
+	uint32_t args[DLOG_MAX_ARGS] = {0};
+	uint32_t now_msec = (uint32_t) (esp_timer_get_time() / 1000);
+	dlog_record_t* rP;
+	va_list ap;
+	
+	if (esp_log_level_get(tag) < siteP->level) return;
+	
+	va_start(ap, num_args);
+	for (int i=0; (i<num_args) && (i<DLOG_MAX_ARGS); i++) {
+		args[i] = va_arg(ap, uint32_t);
+	}
+	va_end(ap);
+	
+	portENTER_CRITICAL_SAFE(&dlog_mux);
+	if ((int32_t) (now_msec - siteP->next_msec) < 0) {
+		siteP->suppressed++;
+	} else {
+		siteP->next_msec = now_msec + DLOG_SITE_MIN_MSEC;
+		if ((write_count - read_count) >= DLOG_RING_LEN) {
+			drop_count++;
+		} else {
+			rP = &ring[write_count++ % DLOG_RING_LEN];
+			rP->siteP = siteP;
+			rP->tag = tag;
+			rP->ts_msec = now_msec;
+			rP->suppressed = siteP->suppressed;
+			for (int i=0; i<DLOG_MAX_ARGS; i++) {
+				rP->args[i] = args[i];
+			}
+			siteP->suppressed = 0;
+		}
+	}
+	portEXIT_CRITICAL_SAFE(&dlog_mux);
+}
+
+
+// Format the pending records to the log.  Returns the number written.
+int dlog_flush()
+{
+	char msg[DLOG_MAX_MSG_LEN];
+	dlog_record_t r;
+	uint32_t dropped;
+	int n = 0;
+	
+	while (1) {
+		portENTER_CRITICAL(&dlog_mux);
+		if (read_count == write_count) {
+			dropped = drop_count;
+			drop_count = 0;
+			portEXIT_CRITICAL(&dlog_mux);
+			break;
+		}
+		r = ring[read_count++ % DLOG_RING_LEN];
+		portEXIT_CRITICAL(&dlog_mux);
+	
+		// Formats only consume the arguments they refer to
+		snprintf(msg, sizeof(msg), r.siteP->fmt, r.args[0], r.args[1], r.args[2]);
+		if (r.suppressed != 0) {
+			ESP_LOG_LEVEL(r.siteP->level, r.tag, "%s (at %lu mSec, %lu more suppressed)", msg, r.ts_msec, r.suppressed);
+		} else {
+			ESP_LOG_LEVEL(r.siteP->level, r.tag, "%s (at %lu mSec)", msg, r.ts_msec);
+		}
+		n++;
+	}
+	
+	if (dropped != 0) {
+		ESP_LOGW(TAG, "%lu records dropped", dropped);
+	}
+	
+	return n;
+}
@@ -0,0 +1,96 @@
+/*
+ * Deferred Log Utilities
+ *
+ * Cheap logging for hot paths such as request errors that may repeat many times a second
+ * while an ECU is asleep.  A call site stores a small binary record (its site and up to
+ * DLOG_MAX_ARGS integer arguments) in a ring instead of formatting and writing to the
+ * console where it occurs and each site is limited to one record per DLOG_SITE_MIN_MSEC
+ * (the records it skips are counted).  A low priority task formats the records to the
+ * normal log with dlog_flush().
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef DLOG_UTILITIES_H
+#define DLOG_UTILITIES_H
+
+#include "esp_log.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Deferred Log Utilities Constants
+//
+
+// Arguments per record (32-bit integers or pointers to constant strings)
+#define DLOG_MAX_ARGS         3
+
+// Records held until they are flushed
+#define DLOG_RING_LEN         64
+
+// Shortest time between records from one call site
+#define DLOG_SITE_MIN_MSEC    1000
+
+// Longest formatted message
+#define DLOG_MAX_MSG_LEN      80
+
+
+
+//
+// Deferred Log Utilities typedefs
+//
+
+// Call site (one static instance per DLOG macro use)
+typedef struct {
+	const char* fmt;
+	esp_log_level_t level;
+	uint32_t next_msec;                  // Earliest time of the site's next record
+	uint32_t suppressed;                 // Records skipped since the site's last record
+} dlog_site_t;
+
+
+
+//
+// Deferred Log Utilities macros
+//
+
+// Log like ESP_LOGx with integer or constant string arguments only.  tag and format must
+// remain valid (e.g. a module's TAG and a literal) since they are used when the record is
+// flushed.
+#define DLOG_LEVEL(level, tag, format, ...) do { \
+		static dlog_site_t _dlog_site = {(format), (level), 0, 0}; \
+		dlog_write(&_dlog_site, (tag), _DLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__); \
+	} while (0)
+
+#define DLOGE(tag, format, ...) DLOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define DLOGW(tag, format, ...) DLOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define DLOGI(tag, format, ...) DLOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+
+// Argument count (0 - DLOG_MAX_ARGS)
+#define _DLOG_NARGS(...) _DLOG_NARGS_N(0, ##__VA_ARGS__, 3, 2, 1, 0)
+#define _DLOG_NARGS_N(_0, _1, _2, _3, n, ...) n
+
+
+
+//
+// Deferred Log Utilities API
+//
+void dlog_write(dlog_site_t* siteP, const char* tag, int num_args, ...);
+int dlog_flush();
+
+#endif /* DLOG_UTILITIES_H */
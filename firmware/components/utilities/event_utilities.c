@@ -0,0 +1,116 @@
+/*
+ * Event Utilities
+ *
+ * Published events are accumulated in a pending mask and the subscribing task is notified.
+ * Its dispatch takes the whole mask at once so an event published several times before
+ * the dispatch is delivered once.  Handlers read the current state (e.g. can_connected())
+ * instead of counting events.  Events published before the task is set up are delivered
+ * when it is.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "event_utilities.h"
+#include "esp_log.h"
+
+
+
+//
+// Event Utilities typedefs
+//
+typedef struct {
+	uint32_t events;
+	event_handler fcn;
+} event_sub_t;
+
+
+
+//
+// Event Utilities variables
+//
+static const char* TAG = "event";
+
+static uint32_t pending_events = 0;
+static TaskHandle_t notify_task = NULL;
+static uint32_t notify_bits = 0;
+
+// Only changed by the notified task
+static event_sub_t sub_list[EVENT_MAX_SUBS];
+static int num_subs = 0;
+
+
+
+//
+// Event Utilities API
+//
+
+// Set the task that runs the handlers and the notification bits it dispatches on
+void event_set_notify(TaskHandle_t task, uint32_t bits)
+{
+	notify_bits = bits;
+	__atomic_store_n(&notify_task, task, __ATOMIC_RELEASE);
+	
+	if (__atomic_load_n(&pending_events, __ATOMIC_ACQUIRE) != 0) {
+		xTaskNotify(task, bits, eSetBits);
+	}
+}
+
+
+// Called by the notified task (or before it starts dispatching)
+bool event_subscribe(uint32_t events, event_handler fcn)
+{
+	if (num_subs == EVENT_MAX_SUBS) {
+		ESP_LOGE(TAG, "Too many subscribers");
+		return false;
+	}
+	
+	sub_list[num_subs].events = events;
+	sub_list[num_subs].fcn = fcn;
+	num_subs += 1;
+	
+	return true;
+}
+
+
+// May be called from any task (not from an ISR)
+void event_publish(uint32_t events)
+{
+	TaskHandle_t task;
+	
+	(void) __atomic_fetch_or(&pending_events, events, __ATOMIC_ACQ_REL);
+	
+	task = __atomic_load_n(&notify_task, __ATOMIC_ACQUIRE);
+	if (task != NULL) {
+		xTaskNotify(task, notify_bits, eSetBits);
+	}
+}
+
+
+// Run the handlers of the events published since the last dispatch (called by the
+// notified task on its notification)
+void event_dispatch()
+{
+	uint32_t events;
+	
+	events = __atomic_exchange_n(&pending_events, 0, __ATOMIC_ACQ_REL);
+	if (events == 0) return;
+	
+	for (int i=0; i<num_subs; i++) {
+		if ((sub_list[i].events & events) != 0) {
+			sub_list[i].fcn(sub_list[i].events & events);
+		}
+	}
+}
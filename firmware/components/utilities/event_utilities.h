@@ -0,0 +1,71 @@
+/*
+ * Event Utilities
+ *
+ * Small publish/subscribe bus for changes of the interface, adapter and vehicle state.
+ * Any task may publish an event.  Subscribers' handlers are run by the task that set
+ * itself up to be notified (the GUI), so a display can react as soon as the state
+ * changes instead of polling for it.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef EVENT_UTILITIES_H
+#define EVENT_UTILITIES_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Event Utilities Constants
+//
+
+// Events (bit mask)
+#define EVENT_LINK_UP              0x00000001  // Link to an ELM327 adapter established (initialization starts)
+#define EVENT_LINK_DOWN            0x00000002  // Interface can no longer reach the vehicle
+#define EVENT_ADAPTER_TESTING      0x00000004  // Adapter characterization started or finished
+#define EVENT_ADAPTER_READY        0x00000008  // Interface ready to send requests
+#define EVENT_VEHICLE_IDENTIFIED   0x00000010  // Vehicle manager running for the selected (or identified) vehicle
+#define EVENT_ECU_ASLEEP           0x00000020  // Vehicle off (its ECUs stopped answering)
+#define EVENT_ECU_AWAKE            0x00000040  // Vehicle answering again
+#define EVENT_REQ_HEALTH           0x00000080  // A request was backed off or started responding again
+
+// Maximum number of subscribers
+#define EVENT_MAX_SUBS             8
+
+
+
+//
+// Event Utilities typedefs
+//
+
+// Called with the subscribed events that occurred since the last dispatch
+typedef void (*event_handler)(uint32_t events);
+
+
+
+//
+// Event Utilities API
+//
+void event_set_notify(TaskHandle_t task, uint32_t bits);
+bool event_subscribe(uint32_t events, event_handler fcn);
+void event_publish(uint32_t events);
+void event_dispatch();
+
+#endif /* EVENT_UTILITIES_H */
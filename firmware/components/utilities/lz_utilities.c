@@ -0,0 +1,295 @@
+/*
+ * LZ Utilities
+ *
+ * Small-window streaming LZSS compressor and matching decoder for log data.  The encoder
+ * is greedy with a single hash candidate per position so it costs a few operations per
+ * byte.  Encoding of each position waits until LZ_MAX_MATCH bytes of lookahead are
+ * available (or the stream is flushed).
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "lz_utilities.h"
+#include <string.h>
+
+
+//
+// LZ Utilities internal constants
+//
+
+// Ring index mask
+#define LZ_RING_MASK     (LZ_RING_LEN - 1)
+
+// Match word fields
+#define LZ_DIST_MASK     0x03FF
+#define LZ_LEN_SHIFT     10
+
+
+
+//
+// LZ Utilities Forward Declarations for internal functions
+//
+static void _lz_encode_one(lz_enc_t* eP);
+static void _lz_put_item(lz_enc_t* eP, bool match, uint16_t v);
+static uint32_t _lz_hash(const lz_enc_t* eP, uint32_t pos);
+
+
+
+//
+// LZ Utilities API
+//
+
+// Start a stream into the buffer outP
+void lz_enc_begin(lz_enc_t* eP, uint8_t* outP, int out_max)
+{
+	memset(eP->head, 0, sizeof(eP->head));
+	eP->in_pos = 0;
+	eP->enc_pos = 0;
+	eP->outP = outP;
+	eP->out_len = 0;
+	eP->out_max = out_max;
+	eP->flag_count = 8;
+}
+
+
+// Returns true if len more bytes can be written without overrunning the output buffer
+bool lz_enc_fits(const lz_enc_t* eP, int len)
+{
+	int pending = (int) (eP->in_pos - eP->enc_pos) + len;
+	
+	return ((eP->out_len + LZ_MAX_ENCODED_LEN(pending)) <= eP->out_max);
+}
+
+
+// Caller must have checked there is room with lz_enc_fits()
+void lz_enc_write(lz_enc_t* eP, const uint8_t* data, int len)
+{
+	while (len-- > 0) {
+		eP->ring[eP->in_pos++ & LZ_RING_MASK] = *data++;
+		if ((eP->in_pos - eP->enc_pos) >= LZ_MAX_MATCH) {
+			_lz_encode_one(eP);
+		}
+	}
+}
+
+
+// Encode the lookahead so the output holds everything written so far.  The stream may be
+// continued afterwards.  Returns the encoded length.
+int lz_enc_flush(lz_enc_t* eP)
+{
+	while (eP->enc_pos != eP->in_pos) {
+		_lz_encode_one(eP);
+	}
+	
+	return eP->out_len;
+}
+
+
+// Returns the number of bytes written to the stream
+uint32_t lz_enc_raw_len(const lz_enc_t* eP)
+{
+	return eP->in_pos;
+}
+
+
+// Decode a complete (or flushed) stream.  Returns the decoded length or -1 if the stream
+// is corrupt or out is too small.
+int lz_decode(const uint8_t* in, int in_len, uint8_t* out, int out_max)
+{
+	int ip = 0;
+	int op = 0;
+	int dist, len;
+	uint16_t w;
+	uint8_t flags;
+	
+	while (ip < in_len) {
+		flags = in[ip++];
+		for (int n=0; (n<8) && (ip<in_len); n++) {
+			if ((flags & (1 << n)) != 0) {
+				if ((ip + 2) > in_len) return -1;
+				w = in[ip] | (in[ip+1] << 8);
+				ip += 2;
+				dist = (w & LZ_DIST_MASK) + 1;
+				len = (w >> LZ_LEN_SHIFT) + LZ_MIN_MATCH;
+				if ((dist > op) || ((op + len) > out_max)) return -1;
+	
+				// Byte at a time since a match may overlap its own output
+				while (len-- > 0) {
+					out[op] = out[op - dist];
+					op++;
+				}
+			} else {
+				if (op >= out_max) return -1;
+				out[op++] = in[ip++];
+			}
+		}
+	}
+	
+	return op;
+}
+
+
+// Start decoding a stream
+void lz_dec_begin(lz_dec_t* dP)
+{
+	dP->out_pos = 0;
+	dP->flag_count = 8;
+	dP->have_lo = false;
+	dP->match_len = 0;
+}
+
+
+// Decode from in until it is used up or out_max bytes have been output.  Items may be
+// split across calls.  Sets *in_usedP to the input consumed and returns the output length
+// or -1 if the stream refers back before its start.
+int lz_dec_run(lz_dec_t* dP, const uint8_t* in, int in_len, int* in_usedP, uint8_t* out, int out_max)
+{
+	int ip = 0;
+	int op = 0;
+	uint16_t w;
+	uint8_t c;
+	
+	while (op < out_max) {
+		if (dP->match_len != 0) {
+			// Continue a match (byte at a time since it may overlap its own output)
+			c = dP->ring[(dP->out_pos - dP->match_dist) & (LZ_WINDOW_LEN - 1)];
+			dP->ring[dP->out_pos++ & (LZ_WINDOW_LEN - 1)] = c;
+			out[op++] = c;
+			dP->match_len--;
+			continue;
+		}
+		
+		if (ip >= in_len) break;
+		
+		if (dP->flag_count == 8) {
+			dP->flags = in[ip++];
+			dP->flag_count = 0;
+		} else if ((dP->flags & (1 << dP->flag_count)) == 0) {
+			c = in[ip++];
+			dP->ring[dP->out_pos++ & (LZ_WINDOW_LEN - 1)] = c;
+			out[op++] = c;
+			dP->flag_count++;
+		} else if (!dP->have_lo) {
+			dP->lo = in[ip++];
+			dP->have_lo = true;
+		} else {
+			w = dP->lo | (in[ip++] << 8);
+			dP->have_lo = false;
+			dP->flag_count++;
+			dP->match_dist = (w & LZ_DIST_MASK) + 1;
+			dP->match_len = (w >> LZ_LEN_SHIFT) + LZ_MIN_MATCH;
+			if (dP->match_dist > dP->out_pos) {
+				*in_usedP = ip;
+				return -1;
+			}
+		}
+	}
+	
+	*in_usedP = ip;
+	return op;
+}
+
+
+// Returns the number of bytes decoded
+uint32_t lz_dec_raw_len(const lz_dec_t* dP)
+{
+	return dP->out_pos;
+}
+
+
+// Returns true if the stream so far ended on an item boundary (a complete stream must)
+bool lz_dec_idle(const lz_dec_t* dP)
+{
+	return !dP->have_lo && (dP->match_len == 0);
+}
+
+
+
+//
+// LZ Utilities internal functions
+//
+
+// Encode one item at enc_pos using the available lookahead
+static void _lz_encode_one(lz_enc_t* eP)
+{
+	uint32_t pos = eP->enc_pos;
+	uint32_t avail = eP->in_pos - pos;
+	uint32_t cand, dist;
+	int max_len, len;
+	
+	max_len = (avail < LZ_MAX_MATCH) ? avail : LZ_MAX_MATCH;
+	len = 0;
+	dist = 0;
+	if (max_len >= LZ_MIN_MATCH) {
+		cand = eP->head[_lz_hash(eP, pos)];
+		if (cand != 0) {
+			cand--;
+			dist = pos - cand;
+			if (dist <= LZ_WINDOW_LEN) {
+				while ((len < max_len) && (eP->ring[(cand + len) & LZ_RING_MASK] == eP->ring[(pos + len) & LZ_RING_MASK])) {
+					len++;
+				}
+			}
+		}
+	}
+	
+	if (len >= LZ_MIN_MATCH) {
+		_lz_put_item(eP, true, (uint16_t) ((dist - 1) | ((len - LZ_MIN_MATCH) << LZ_LEN_SHIFT)));
+	} else {
+		len = 1;
+		_lz_put_item(eP, false, eP->ring[pos & LZ_RING_MASK]);
+	}
+	
+	// Positions inside the match are candidates for later matches too
+	for (int i=0; i<len; i++) {
+		if ((pos + LZ_MIN_MATCH) <= eP->in_pos) {
+			eP->head[_lz_hash(eP, pos)] = pos + 1;
+		}
+		pos++;
+	}
+	eP->enc_pos = pos;
+}
+
+
+static void _lz_put_item(lz_enc_t* eP, bool match, uint16_t v)
+{
+	if (eP->flag_count == 8) {
+		eP->flag_index = eP->out_len;
+		eP->outP[eP->out_len++] = 0;
+		eP->flag_count = 0;
+	}
+	
+	if (match) {
+		eP->outP[eP->flag_index] |= 1 << eP->flag_count;
+		eP->outP[eP->out_len++] = (uint8_t) v;
+		eP->outP[eP->out_len++] = (uint8_t) (v >> 8);
+	} else {
+		eP->outP[eP->out_len++] = (uint8_t) v;
+	}
+	eP->flag_count++;
+}
+
+
+static uint32_t _lz_hash(const lz_enc_t* eP, uint32_t pos)
+{
+	uint32_t v;
+	
+	v = eP->ring[pos & LZ_RING_MASK] |
+	    (eP->ring[(pos + 1) & LZ_RING_MASK] << 8) |
+	    (eP->ring[(pos + 2) & LZ_RING_MASK] << 16);
+	
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
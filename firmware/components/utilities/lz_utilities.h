@@ -0,0 +1,110 @@
+/*
+ * LZ Utilities
+ *
+ * Small-window streaming LZSS compressor and matching decoders for log data and firmware
+ * images.  The encoder state fits in a few KB of internal RAM, bytes are fed in as they
+ * are produced and it writes into a caller-supplied buffer that the caller checks for
+ * room before each write so a stream can be closed exactly at a flash block boundary.  A
+ * stream may be flushed at any point (making everything written so far decodable) and
+ * then continued.
+ *
+ * Stream format: groups of a flag byte followed by up to 8 items.  Bit n (LSB first) of
+ * the flag byte describes item n:
+ *   0 : one literal byte
+ *   1 : 16-bit little-endian match word - bits 9:0 distance back - 1, bits 15:10 length - 3
+ * The stream ends with the input (there is no end marker).
+ *
+ * The incremental decoder takes a stream in arbitrary pieces (e.g. as it arrives over the
+ * network) and produces output into fixed size buffers, keeping only the window of
+ * history matches refer back to.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LZ_UTILITIES_H
+#define LZ_UTILITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// LZ Utilities Constants
+//
+
+// Match limits (set by the match word format)
+#define LZ_WINDOW_LEN    1024
+#define LZ_MIN_MATCH     3
+#define LZ_MAX_MATCH     66
+
+// History ring (power of 2, holds the window plus the lookahead)
+#define LZ_RING_LEN      2048
+
+// Match finder hash table (one candidate per hash)
+#define LZ_HASH_BITS     9
+#define LZ_HASH_LEN      (1 << LZ_HASH_BITS)
+
+// Worst case encoded length of n bytes (all literals)
+#define LZ_MAX_ENCODED_LEN(n) ((n) + (((n) + 7) / 8))
+
+
+
+//
+// LZ Utilities typedefs
+//
+typedef struct {
+	uint8_t ring[LZ_RING_LEN];
+	uint32_t head[LZ_HASH_LEN];          // Last stream position + 1 with each hash (0 = none)
+	uint32_t in_pos;                     // Bytes written to the stream
+	uint32_t enc_pos;                    // Bytes encoded (the rest are lookahead)
+	uint8_t* outP;
+	int out_len;
+	int out_max;
+	int flag_index;                      // outP index of the current group's flag byte
+	int flag_count;                      // Items in the current group
+} lz_enc_t;
+
+typedef struct {
+	uint8_t ring[LZ_WINDOW_LEN];         // Last LZ_WINDOW_LEN decoded bytes
+	uint32_t out_pos;                    // Bytes decoded
+	uint8_t flags;                       // Current group's flag byte
+	uint8_t flag_count;                  // Items of the current group decoded
+	bool have_lo;                        // Set when the low byte of a match word was consumed
+	uint8_t lo;
+	uint16_t match_dist;
+	uint16_t match_len;                  // Bytes of the current match still to be output
+} lz_dec_t;
+
+
+
+//
+// LZ Utilities API
+//
+void lz_enc_begin(lz_enc_t* eP, uint8_t* outP, int out_max);
+bool lz_enc_fits(const lz_enc_t* eP, int len);
+void lz_enc_write(lz_enc_t* eP, const uint8_t* data, int len);
+int lz_enc_flush(lz_enc_t* eP);
+uint32_t lz_enc_raw_len(const lz_enc_t* eP);
+
+int lz_decode(const uint8_t* in, int in_len, uint8_t* out, int out_max);
+
+void lz_dec_begin(lz_dec_t* dP);
+int lz_dec_run(lz_dec_t* dP, const uint8_t* in, int in_len, int* in_usedP, uint8_t* out, int out_max);
+uint32_t lz_dec_raw_len(const lz_dec_t* dP);
+bool lz_dec_idle(const lz_dec_t* dP);
+
+#endif /* LZ_UTILITIES_H */
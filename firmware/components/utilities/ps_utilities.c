@@ -24,6 +24,9 @@
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_mac.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "ps_utilities.h"
@@ -53,12 +56,28 @@ static const char* TAG = "ps_utilities";
 static nvs_handle_t ps_handle;
 
 // NVS Keys
-static const char* config_keys[PS_NUM_CONFIGS] = {"main_key", "net_key", "ble_key"};
+static const char* config_keys[PS_NUM_CONFIGS] = {"main_key", "net_key", "ble_key", "runs_key", "trip_key", "snap_key", "elm_key", "obd_key", "vin_key", "can_key", "tune_key"};
+
+// Layout version of each config, stored with it under the version key.  Configs stored
+// before versions were kept are version 1.  Fields appended to the end of a config don't
+// need a new version (they get their default values when an older, shorter config is
+// loaded).  Any other layout change must bump the version and add a conversion from the
+// previous layout to _ps_migrate_config().
+#define PS_LEGACY_VERSION 1
+static const char* version_keys[PS_NUM_CONFIGS] = {"main_ver", "net_ver", "ble_ver", "runs_ver", "trip_ver", "snap_ver", "elm_ver", "obd_ver", "vin_ver", "can_ver", "tune_ver"};
+static const uint8_t config_version[PS_NUM_CONFIGS] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
 
 // Local copies
-static const size_t config_data_len[PS_NUM_CONFIGS] = {sizeof(main_config_t), sizeof(net_config_t), sizeof(ble_config_t)};
+static const size_t config_data_len[PS_NUM_CONFIGS] = {sizeof(main_config_t), sizeof(net_config_t), sizeof(ble_config_t), sizeof(run_history_t), sizeof(trip_totals_t), sizeof(item_snapshot_t), sizeof(elm327_profiles_t), sizeof(obd2_pid_cache_t), sizeof(vin_cache_t), sizeof(can_bus_cache_t), sizeof(tune_config_t)};
 static uint8_t* config_data[PS_NUM_CONFIGS];
 
+// Write-back state.  Local copies may be changed by their users while being committed so
+// each is copied to the staging buffer (under commit_mutex) before it is written.
+static volatile uint32_t dirty_mask = 0;
+static uint8_t* staging_bufP;
+static SemaphoreHandle_t commit_mutex;
+static TaskHandle_t task_handle_ps_commit;
+
 
 
 //
@@ -67,7 +86,12 @@ static uint8_t* config_data[PS_NUM_CONFIGS];
 static bool _ps_malloc_local_memory();
 static bool _ps_read_config_info(int index, void* cfg);
 static bool _ps_write_config_info(int index, void* cfg);
+static bool _ps_write_config_version(int index);
 static void _ps_init_config_memory(int index);
+static bool _ps_load_config(int index, size_t stored_len);
+static bool _ps_migrate_config(int index, uint8_t version, const uint8_t* data, size_t len);
+static bool _ps_commit_dirty();
+static void _ps_commit_task(void* arg);
 
 
 
@@ -132,25 +156,32 @@ bool ps_init()
 			ESP_LOGE(TAG, "NVS get_blob lep size failed with err %d", err);
 			return false;
 		}
-		if ((required_size == 0) || (required_size != config_data_len[i])) {
-			if (required_size == 0) {
-				ESP_LOGI(TAG, "Initializing %s", config_keys[i]);
-			} else {
-				ESP_LOGI(TAG, "Re-initializing %s", config_keys[i]);
-			}
+		if ((err == ESP_ERR_NVS_NOT_FOUND) || (required_size == 0)) {
+			ESP_LOGI(TAG, "Initializing %s", config_keys[i]);
 			_ps_init_config_memory(i);
-			if (!_ps_write_config_info(i, config_data[i])) {
+			if (!_ps_write_config_version(i) || !_ps_write_config_info(i, config_data[i])) {
 				ESP_LOGE(TAG, "Write %s data failed", config_keys[i]);
 				return false;
 			}
 		} else {
-			if (!_ps_read_config_info(i, config_data[i])) {
+			if (!_ps_load_config(i, required_size)) {
 				ESP_LOGE(TAG, "Read %s data failed", config_keys[i]);
 				return false;
 			}
 		}
 	}
 	
+	// Start the write-back task
+	commit_mutex = xSemaphoreCreateMutex();
+	if (commit_mutex == NULL) {
+		ESP_LOGE(TAG, "Create commit mutex failed");
+		return false;
+	}
+	if (xTaskCreatePinnedToCore(&_ps_commit_task, "ps_commit_task", PS_COMMIT_TASK_STACK, NULL, PS_COMMIT_TASK_PRIORITY, &task_handle_ps_commit, PS_COMMIT_TASK_CORE) != pdPASS) {
+		ESP_LOGE(TAG, "Create commit task failed");
+		return false;
+	}
+	
 	return true;
 }
 
@@ -168,14 +199,13 @@ bool ps_get_config(int index, void** cfg)
 }
 
 
+// Schedule the local copy of a config to be written to NVS.  Returns immediately; the
+// write happens in the background (use ps_flush() when it must complete, e.g. before a reboot).
 bool ps_save_config(int index)
 {
 	if ((index >=0) && (index < PS_NUM_CONFIGS)) {
-		// Update NVS
-		if (!_ps_write_config_info(index, config_data[index])) {
-			ESP_LOGE(TAG, "Failed to save %s config to NVS storage", config_keys[index]);
-			return false;
-		}
+		__atomic_or_fetch(&dirty_mask, 1UL << index, __ATOMIC_RELEASE);
+		xTaskNotifyGive(task_handle_ps_commit);
 		
 		return true;
 	} else {
@@ -192,24 +222,39 @@ bool ps_reinit_all()
 	ret &= ps_reinit_config(PS_CONFIG_TYPE_MAIN);
 	ret &= ps_reinit_config(PS_CONFIG_TYPE_NET);
 	ret &= ps_reinit_config(PS_CONFIG_TYPE_BLE);
+	ret &= ps_reinit_config(PS_CONFIG_TYPE_RUNS);
+	ret &= ps_reinit_config(PS_CONFIG_TYPE_TRIP);
+	ret &= ps_reinit_config(PS_CONFIG_TYPE_SNAP);
+	ret &= ps_reinit_config(PS_CONFIG_TYPE_ELM327);
+	ret &= ps_reinit_config(PS_CONFIG_TYPE_OBD2);
+	ret &= ps_reinit_config(PS_CONFIG_TYPE_VIN);
+	ret &= ps_reinit_config(PS_CONFIG_TYPE_CAN);
+	ret &= ps_reinit_config(PS_CONFIG_TYPE_TUNE);
 	
 	return ret;
 }
 
 
+// Write any configs with pending saves to NVS now.  Returns false if a write failed.
+bool ps_flush()
+{
+	bool success;
+	
+	xSemaphoreTake(commit_mutex, portMAX_DELAY);
+	success = _ps_commit_dirty();
+	xSemaphoreGive(commit_mutex);
+	
+	return success;
+}
+
+
 bool ps_reinit_config(int index)
 {
 	if ((index >=0) && (index < PS_NUM_CONFIGS)) {
-		// Reset default values to our local copy
+		// Reset default values to our local copy and schedule the NVS update
 		_ps_init_config_memory(index);
 		
-		// Update NVS
-		if (!_ps_write_config_info(index, config_data[index])) {
-			ESP_LOGE(TAG, "Failed to reset %s config to default values in NVS storage", config_keys[index]);
-			return false;
-		}
-		
-		return true;
+		return ps_save_config(index);
 	} else {
 		ESP_LOGE(TAG, "Requested reinit of illegal config index %d", index);
 		return false;
@@ -248,12 +293,23 @@ static bool _ps_malloc_local_memory()
 {
 	bool success = true;
 	
+	size_t max_len = 0;
+	
 	// Allocate and zero memory for each config item
 	for (int i=0; i<PS_NUM_CONFIGS; i++) {
 		if ((config_data[i] = calloc(config_data_len[i], sizeof(uint8_t))) == NULL) {
 			ESP_LOGE(TAG, "Failed to allocate %d bytes for %s config item", config_data_len[i], config_keys[i]);
 			success = false;
 		}
+		if (config_data_len[i] > max_len) {
+			max_len = config_data_len[i];
+		}
+	}
+	
+	// Staging buffer for the write-back task
+	if ((staging_bufP = malloc(max_len)) == NULL) {
+		ESP_LOGE(TAG, "Failed to allocate %d bytes for staging buffer", max_len);
+		success = false;
 	}
 	
 	return success;
@@ -357,6 +413,10 @@ static void _ps_init_config_memory(int index)
 			net_configP->sta_netmask[2] = 255;
 			net_configP->sta_netmask[1] = 255;
 			net_configP->sta_netmask[0] = 0;
+			
+			// No AP connected to yet
+			memset(net_configP->sta_bssid, 0, PS_BSSID_LEN);
+			net_configP->sta_channel = 0;
 			break;
 			
 		case PS_CONFIG_TYPE_BLE:
@@ -368,6 +428,157 @@ static void _ps_init_config_memory(int index)
 			strcpy(ble_configP->tx_char_uuid, "0000");
 			strcpy(ble_configP->rx_char_uuid, "0000");
 			strcpy(ble_configP->pairing_key, "1234");
+			ble_configP->peer_valid = false;
 			break;
+		
+		case PS_CONFIG_TYPE_RUNS:
+			memset(config_data[PS_CONFIG_TYPE_RUNS], 0, sizeof(run_history_t));
+			break;
+		
+		case PS_CONFIG_TYPE_TRIP:
+			memset(config_data[PS_CONFIG_TYPE_TRIP], 0, sizeof(trip_totals_t));
+			break;
+		
+		case PS_CONFIG_TYPE_SNAP:
+			memset(config_data[PS_CONFIG_TYPE_SNAP], 0, sizeof(item_snapshot_t));
+			break;
+		
+		case PS_CONFIG_TYPE_ELM327:
+			memset(config_data[PS_CONFIG_TYPE_ELM327], 0, sizeof(elm327_profiles_t));
+			break;
+		
+		case PS_CONFIG_TYPE_OBD2:
+			memset(config_data[PS_CONFIG_TYPE_OBD2], 0, sizeof(obd2_pid_cache_t));
+			break;
+		
+		case PS_CONFIG_TYPE_VIN:
+			memset(config_data[PS_CONFIG_TYPE_VIN], 0, sizeof(vin_cache_t));
+			break;
+		
+		case PS_CONFIG_TYPE_CAN:
+			memset(config_data[PS_CONFIG_TYPE_CAN], 0, sizeof(can_bus_cache_t));
+			break;
+		
+		case PS_CONFIG_TYPE_TUNE:
+			memset(config_data[PS_CONFIG_TYPE_TUNE], 0, sizeof(tune_config_t));
+			break;
+	}
+}
+
+
+// Load a stored config, converting it if it has an older version or length.  A config
+// that can't be converted is reset to defaults.  Assumes the index is valid.
+static bool _ps_load_config(int index, size_t stored_len)
+{
+	bool converted;
+	esp_err_t ret;
+	uint8_t version;
+	uint8_t* bufP;
+	
+	ret = nvs_get_u8(ps_handle, version_keys[index], &version);
+	if (ret == ESP_ERR_NVS_NOT_FOUND) {
+		version = PS_LEGACY_VERSION;
+	} else if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Get config version %s failed with %d", version_keys[index], ret);
+		return false;
+	}
+	
+	if ((version == config_version[index]) && (stored_len == config_data_len[index])) {
+		return _ps_read_config_info(index, config_data[index]);
+	}
+	
+	// Read the stored layout and convert it
+	if ((bufP = malloc(stored_len)) == NULL) {
+		ESP_LOGE(TAG, "Failed to allocate %d bytes to convert %s", stored_len, config_keys[index]);
+		return false;
+	}
+	ret = nvs_get_blob(ps_handle, config_keys[index], bufP, &stored_len);
+	if (ret == ESP_OK) {
+		converted = _ps_migrate_config(index, version, bufP, stored_len);
+	} else {
+		converted = false;
+	}
+	free(bufP);
+	
+	if (converted) {
+		ESP_LOGI(TAG, "Converted %s from version %d (%d bytes)", config_keys[index], version, stored_len);
+	} else {
+		ESP_LOGI(TAG, "Re-initializing %s", config_keys[index]);
+		_ps_init_config_memory(index);
+	}
+	
+	return _ps_write_config_version(index) && _ps_write_config_info(index, config_data[index]);
+}
+
+
+// Record the layout version of a config (committed with the next config write).  Assumes
+// the index is valid.
+static bool _ps_write_config_version(int index)
+{
+	esp_err_t ret;
+	
+	ret = nvs_set_u8(ps_handle, version_keys[index], config_version[index]);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Set config version %s failed with %d", version_keys[index], ret);
+		return false;
+	}
+	
+	return true;
+}
+
+
+// Convert stored config data with the specified version to the current layout in the
+// local copy.  Returns false if there is no conversion.  Assumes the index is valid.
+static bool _ps_migrate_config(int index, uint8_t version, const uint8_t* data, size_t len)
+{
+	if (version == config_version[index]) {
+		// Same layout with fields appended or removed at the end: keep the common part
+		_ps_init_config_memory(index);
+		memcpy(config_data[index], data, (len < config_data_len[index]) ? len : config_data_len[index]);
+		return true;
+	}
+	
+	// Conversions from earlier versions go here as layouts change (none yet)
+	switch (index) {
+		default:
+			return false;
+	}
+}
+
+
+// Write all configs with pending saves.  Must be called with commit_mutex held.
+static bool _ps_commit_dirty()
+{
+	bool success = true;
+	uint32_t mask;
+	
+	mask = __atomic_exchange_n(&dirty_mask, 0, __ATOMIC_ACQ_REL);
+	for (int i=0; i<PS_NUM_CONFIGS; i++) {
+		if ((mask & (1UL << i)) == 0) continue;
+		
+		// A change made while we copy is saved again by the save call that follows it
+		memcpy(staging_bufP, config_data[i], config_data_len[i]);
+		if (!_ps_write_config_info(i, staging_bufP)) {
+			ESP_LOGE(TAG, "Failed to save %s config to NVS storage", config_keys[i]);
+			success = false;
+		}
+	}
+	
+	return success;
+}
+
+
+static void _ps_commit_task(void* arg)
+{
+	ESP_LOGI(TAG, "Start task");
+	
+	while (1) {
+		// Wait for a save then for saves to stop arriving
+		(void) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		while (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(PS_COMMIT_DELAY_MSEC)) != 0) {}
+		
+		xSemaphoreTake(commit_mutex, portMAX_DELAY);
+		(void) _ps_commit_dirty();
+		xSemaphoreGive(commit_mutex);
 	}
 }
@@ -34,11 +34,19 @@
 
 //
 // Configuration types
-#define PS_NUM_CONFIGS           3
+#define PS_NUM_CONFIGS           11
 
 #define PS_CONFIG_TYPE_MAIN      0
 #define PS_CONFIG_TYPE_NET       1
 #define PS_CONFIG_TYPE_BLE       2
+#define PS_CONFIG_TYPE_RUNS      3
+#define PS_CONFIG_TYPE_TRIP      4
+#define PS_CONFIG_TYPE_SNAP      5
+#define PS_CONFIG_TYPE_ELM327    6
+#define PS_CONFIG_TYPE_OBD2      7
+#define PS_CONFIG_TYPE_VIN       8
+#define PS_CONFIG_TYPE_CAN       9
+#define PS_CONFIG_TYPE_TUNE      10
 
 // Main configuration flags
 #define PS_MAIN_FLAG_METRIC      0x00000001
@@ -49,6 +57,45 @@
 #define PS_PW_MAX_LEN            63
 #define PS_BLE_UUID_STR_LEN      37
 #define PS_BLE_PAIRING_KEY_LEN   16
+#define PS_BLE_ADDR_LEN          6
+#define PS_BSSID_LEN             6
+
+// Timed run history - best results kept per run mode, each with a speed trace
+#define PS_RUN_NUM_MODES         4
+#define PS_RUN_HISTORY_LEN       5
+#define PS_RUN_TRACE_LEN         64
+
+// Last-known item value snapshot
+#define PS_SNAP_MAX_ITEMS        8
+
+// ELM327 adapter tuning profiles - the least recently used is replaced by a new adapter
+#define PS_ELM327_NUM_PROFILES   4
+#define PS_ELM327_ID_LEN         63
+
+// ELM327 profile feature flags
+#define PS_ELM327_FLAG_RSP_COUNT 0x01               // Response count suffix
+#define PS_ELM327_FLAG_STN       0x02               // STPX with adapter flow control
+
+// Cached OBD-II supported PID bitmaps (Mode 01 PIDs 0x00, 0x20, ... 0xE0)
+#define PS_OBD2_NUM_PID_MAPS     8
+
+// Vehicle identification number length
+#define PS_VIN_LEN               17
+
+// CAN bus ID formats seen while probing the bitrate
+#define PS_CAN_FLAG_STD_IDS      0x01
+#define PS_CAN_FLAG_EXT_IDS      0x02
+
+// Saved runtime parameters (tune_utilities.h)
+#define PS_TUNE_MAX_PARAMS       32
+
+// Deferred write-back.  Saved configs are committed to NVS by a background task once no
+// further save has been requested for PS_COMMIT_DELAY_MSEC so consecutive changes cost
+// one flash write.
+#define PS_COMMIT_DELAY_MSEC     500
+#define PS_COMMIT_TASK_STACK     3072
+#define PS_COMMIT_TASK_PRIORITY  1
+#define PS_COMMIT_TASK_CORE      0
 
 // Base part of the default SSID/Device name - the last 4 nibbles of the ESP32's
 // mac address are appended as ASCII characters
@@ -78,6 +125,8 @@ typedef struct {
 	uint8_t ap_ip_addr[4];
 	uint8_t sta_ip_addr[4];
 	uint8_t sta_netmask[4];
+	uint8_t sta_bssid[PS_BSSID_LEN];              // AP last connected to in station mode
+	uint8_t sta_channel;                          //   and its channel (0: none, full scan)
 } net_config_t;
 
 typedef struct {
@@ -87,8 +136,81 @@ typedef struct {
 	char tx_char_uuid[PS_BLE_UUID_STR_LEN];      // Transmit (W) characteristic UUID
 	char rx_char_uuid[PS_BLE_UUID_STR_LEN];      // Receive (R) notification characteristic UUID
 	char pairing_key[PS_BLE_PAIRING_KEY_LEN+1];  // Optional pairing key to send
+	bool peer_valid;                             // Set when the cached peer information below is valid
+	bool peer_tx_no_rsp;                         // Peer TX characteristic supports write-without-response
+	uint8_t peer_addr_type;                      // Last connected peer address (ble_addr_t)
+	uint8_t peer_addr[PS_BLE_ADDR_LEN];
+	int8_t peer_device_index;                    // Known device (or custom) index of the peer
+	uint16_t peer_tx_handle;                     // Cached GATT handles
+	uint16_t peer_rx_handle;
+	uint16_t peer_cccd_handle;
 } ble_config_t;
 
+typedef struct {
+	bool valid;
+	uint32_t time_msec;                          // Run time
+	uint32_t dist_cm;                            // Distance covered during the run
+	uint16_t end_kph10;                          // Speed at the end of the run (kph * 10)
+	uint16_t trace_msec;                         // Interval between trace samples
+	uint16_t trace_len;
+	uint16_t trace_kph10[PS_RUN_TRACE_LEN];      // Speed (kph * 10) from the start of the run
+} run_result_t;
+
+typedef struct {
+	run_result_t best[PS_RUN_NUM_MODES][PS_RUN_HISTORY_LEN];   // Best first
+} run_history_t;
+
+typedef struct {
+	float traction_kwh;                          // Trip energy accounting totals
+	float regen_kwh;
+	float aux_kwh;
+	float dist_km;
+} trip_totals_t;
+
+typedef struct {
+	bool valid;
+	char id[PS_ELM327_ID_LEN+1];                 // Interface and ATI/AT@1/STI identification
+	uint8_t flags;                               // PS_ELM327_FLAG_*
+	uint8_t max_line_len;                        // Longest pipelined write accepted (0 = no pipelining)
+	uint16_t cmd_rate;                           // Sustained AT commands per second
+	uint32_t cmd_lat_usec;                       // Mean and worst AT command latency
+	uint32_t cmd_lat_max_usec;
+	uint32_t use_seq;                            // elm327_profiles_t seq when last used
+} elm327_profile_t;
+
+typedef struct {
+	uint32_t seq;
+	elm327_profile_t profile[PS_ELM327_NUM_PROFILES];
+} elm327_profiles_t;
+
+typedef struct {
+	bool valid;
+	uint32_t pid_map[PS_OBD2_NUM_PID_MAPS];     // PIDs 0x20*n+1 - 0x20*n+0x20, MSB first
+} obd2_pid_cache_t;
+
+typedef struct {
+	bool valid;
+	char vin[PS_VIN_LEN+1];                      // VIN read from the vehicle
+	char vehicle_name[PS_VEHICLE_NAME_MAX_LEN+1]; // Vehicle it identified
+} vin_cache_t;
+
+typedef struct {
+	bool valid;
+	uint32_t bitrate;                            // Bitrate frames were received at
+	uint32_t id_flags;                           // PS_CAN_FLAG_*
+} can_bus_cache_t;
+
+typedef struct {
+	uint32_t set_mask;                           // Parameters saved (others use their default)
+	int32_t val[PS_TUNE_MAX_PARAMS];
+} tune_config_t;
+
+typedef struct {
+	char vehicle_name[PS_VEHICLE_NAME_MAX_LEN+1]; // Vehicle the values were read from
+	uint8_t item[PS_SNAP_MAX_ITEMS];             // Data broker item IDs (0 = unused entry)
+	float val[PS_SNAP_MAX_ITEMS];
+} item_snapshot_t;
+
 
 
 //
@@ -97,6 +219,7 @@ typedef struct {
 bool ps_init();
 bool ps_get_config(int index, void** cfg);
 bool ps_save_config(int index);
+bool ps_flush();
 bool ps_reinit_all();
 bool ps_reinit_config(int index);
 bool ps_has_new_ap_name(const char* name);
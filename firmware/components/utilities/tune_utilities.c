@@ -0,0 +1,215 @@
+/*
+ * Tune Utilities
+ *
+ * Parameter values are aligned 32-bit words so a single read is always a whole value.
+ * A set of changes is validated completely before any is applied and then written under
+ * a spinlock so readers never see part of a set (e.g. a new backoff minimum with the old
+ * maximum it was checked against) and a rejected set changes nothing.  Only parameters
+ * that differ from their defaults are saved so a later default change still applies to
+ * units that never tuned it.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "tune_utilities.h"
+#include "ps_utilities.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include <string.h>
+
+
+
+//
+// Tune Utilities variables
+//
+static const char* TAG = "tune";
+
+// Defaults are the values the firmware was tuned with before the parameters were
+// adjustable
+static const tune_param_info_t param_info[TUNE_NUM_PARAMS] = {
+	{"can_eval_msec",         10,    1,   100},
+	{"can_sleep_eval_msec",   500,   50,  5000},
+	{"gui_max_wait_msec",     50,    5,   500},
+	{"req_period_pct",        100,   25,  1000},
+	{"req_min_period_msec",   0,     0,   10000},
+	{"backoff_min_msec",      1000,  100, 60000},
+	{"backoff_max_msec",      30000, 100, 600000},
+	{"lat_min_timeout_msec",  50,    10,  2000},
+	{"lat_dev_mult",          4,     1,   16},
+	{"n_cr_msec",             150,   20,  1000},
+	{"ema_alpha_pct",         0,     0,   100},
+	{"elm327_st",             0,     0,   255},
+	{"cadence_pct",           0,     0,   90}
+};
+_Static_assert(TUNE_NUM_PARAMS <= PS_TUNE_MAX_PARAMS, "tune_config_t must hold every parameter");
+
+static int32_t param_val[TUNE_NUM_PARAMS];
+static uint32_t generation = 0;
+
+static portMUX_TYPE tune_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static bool _tune_validate(const int32_t* vals);
+
+
+
+//
+// Tune Utilities API
+//
+
+// Load the saved values (after ps_init and before the tasks using the parameters start)
+void tune_init()
+{
+	tune_config_t* tcP;
+	int32_t vals[TUNE_NUM_PARAMS];
+	
+	for (int i=0; i<TUNE_NUM_PARAMS; i++) {
+		vals[i] = param_info[i].def_val;
+	}
+	
+	if (ps_get_config(PS_CONFIG_TYPE_TUNE, (void**) &tcP)) {
+		for (int i=0; i<TUNE_NUM_PARAMS; i++) {
+			if ((tcP->set_mask & (1 << i)) != 0) {
+				vals[i] = tcP->val[i];
+				ESP_LOGI(TAG, "%s = %ld", param_info[i].name, vals[i]);
+			}
+		}
+	}
+	
+	// Saved by a build with different ranges
+	if (!_tune_validate(vals)) {
+		ESP_LOGW(TAG, "Saved parameters out of range - using defaults");
+		for (int i=0; i<TUNE_NUM_PARAMS; i++) {
+			vals[i] = param_info[i].def_val;
+		}
+	}
+	
+	portENTER_CRITICAL(&tune_mux);
+	memcpy(param_val, vals, sizeof(param_val));
+	generation += 1;
+	portEXIT_CRITICAL(&tune_mux);
+}
+
+
+// Placed in IRAM with the CAN receive path
+int32_t tune_get(int id)
+{
+	if ((id < 0) || (id >= TUNE_NUM_PARAMS)) return 0;
+	
+	return __atomic_load_n(&param_val[id], __ATOMIC_RELAXED);
+}
+
+
+const tune_param_info_t* tune_get_info(int id)
+{
+	if ((id < 0) || (id >= TUNE_NUM_PARAMS)) return NULL;
+	
+	return &param_info[id];
+}
+
+
+// Returns -1 for an unknown name
+int tune_find(const char* name)
+{
+	for (int i=0; i<TUNE_NUM_PARAMS; i++) {
+		if (strcmp(name, param_info[i].name) == 0) {
+			return i;
+		}
+	}
+	
+	return -1;
+}
+
+
+// Change num parameters together.  Nothing is changed if any id is unknown or the
+// resulting set of values isn't legal.
+bool tune_set(int num, const int* ids, const int32_t* vals)
+{
+	int32_t new_vals[TUNE_NUM_PARAMS];
+	
+	portENTER_CRITICAL(&tune_mux);
+	memcpy(new_vals, param_val, sizeof(new_vals));
+	portEXIT_CRITICAL(&tune_mux);
+	
+	for (int i=0; i<num; i++) {
+		if ((ids[i] < 0) || (ids[i] >= TUNE_NUM_PARAMS)) return false;
+		new_vals[ids[i]] = vals[i];
+	}
+	if (!_tune_validate(new_vals)) return false;
+	
+	// Only the diagnostics server sets values so the copy can't have been changed since
+	// it was taken
+	portENTER_CRITICAL(&tune_mux);
+	memcpy(param_val, new_vals, sizeof(param_val));
+	generation += 1;
+	portEXIT_CRITICAL(&tune_mux);
+	
+	for (int i=0; i<num; i++) {
+		ESP_LOGI(TAG, "%s = %ld", param_info[ids[i]].name, vals[i]);
+	}
+	
+	return true;
+}
+
+
+// Save the parameters that differ from their defaults
+bool tune_save()
+{
+	tune_config_t* tcP;
+	int32_t val;
+	
+	if (!ps_get_config(PS_CONFIG_TYPE_TUNE, (void**) &tcP)) return false;
+	
+	tcP->set_mask = 0;
+	for (int i=0; i<TUNE_NUM_PARAMS; i++) {
+		val = tune_get(i);
+		if (val != param_info[i].def_val) {
+			tcP->set_mask |= (1 << i);
+			tcP->val[i] = val;
+		} else {
+			tcP->val[i] = 0;
+		}
+	}
+	
+	return ps_save_config(PS_CONFIG_TYPE_TUNE);
+}
+
+
+// Incremented by each change so users that cache a value can tell it changed
+uint32_t tune_get_generation()
+{
+	return __atomic_load_n(&generation, __ATOMIC_RELAXED);
+}
+
+
+
+//
+// Internal functions
+//
+static bool _tune_validate(const int32_t* vals)
+{
+	for (int i=0; i<TUNE_NUM_PARAMS; i++) {
+		if ((vals[i] < param_info[i].min_val) || (vals[i] > param_info[i].max_val)) {
+			return false;
+		}
+	}
+	
+	return (vals[TUNE_BACKOFF_MIN_MSEC] <= vals[TUNE_BACKOFF_MAX_MSEC]);
+}
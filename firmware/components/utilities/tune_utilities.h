@@ -0,0 +1,82 @@
+/*
+ * Tune Utilities
+ *
+ * Table of scheduling and timing parameters that may be changed while running (from the
+ * diagnostics server) to tune the firmware against a real vehicle without rebuilding.
+ * Each parameter has a compiled-in default and a legal range.  Users read a parameter
+ * with tune_get() each time they need it so a change takes effect at its next use.
+ * Changed values may be saved to persistent storage and are then loaded at startup.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef TUNE_UTILITIES_H
+#define TUNE_UTILITIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Tune Utilities Constants
+//
+
+// Parameters (new parameters are added at the end, saved values are kept by index)
+#define TUNE_CAN_EVAL_MSEC         0     // can_task maximum period between evaluations
+#define TUNE_CAN_SLEEP_EVAL_MSEC   1     // can_task evaluation period while the vehicle is asleep
+#define TUNE_GUI_MAX_WAIT_MSEC     2     // Longest gui_task sleeps waiting for data or LVGL
+#define TUNE_REQ_PERIOD_PCT        3     // Scale applied to every request's period
+#define TUNE_REQ_MIN_PERIOD_MSEC   4     // Shortest request period after scaling
+#define TUNE_BACKOFF_MIN_MSEC      5     // First backoff delay of a failing request
+#define TUNE_BACKOFF_MAX_MSEC      6     // Longest backoff delay
+#define TUNE_LAT_MIN_TIMEOUT_MSEC  7     // Shortest adaptive request timeout
+#define TUNE_LAT_DEV_MULT          8     // Adaptive timeout = mean + mult * mean deviation
+#define TUNE_N_CR_MSEC             9     // ISO-TP consecutive frame timeout (N_Cr)
+#define TUNE_EMA_ALPHA_PCT         10    // GUI EMA filter weight of a new sample (0 = catalog)
+#define TUNE_ELM327_ST             11    // Fixed ELM327 ATST value (0 = per request timeout)
+#define TUNE_CADENCE_PCT           12    // Bus share for constant cadence high priority requests (0 = off)
+#define TUNE_NUM_PARAMS            13
+
+// Longest parameter name
+#define TUNE_NAME_MAX_LEN          24
+
+
+
+//
+// Tune Utilities typedefs
+//
+typedef struct {
+	const char* name;
+	int32_t def_val;
+	int32_t min_val;
+	int32_t max_val;
+} tune_param_info_t;
+
+
+
+//
+// Tune Utilities API
+//
+void tune_init();
+int32_t tune_get(int id);
+const tune_param_info_t* tune_get_info(int id);
+int tune_find(const char* name);
+bool tune_set(int num, const int* ids, const int32_t* vals);
+bool tune_save();
+uint32_t tune_get_generation();
+
+#endif /* TUNE_UTILITIES_H */
@@ -29,6 +29,7 @@
 #include "esp_event.h"
 #include "esp_mac.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "nvs_flash.h"
@@ -43,6 +44,9 @@
 #define WIFI_INFO_FLAG_ENABLED        0x02
 #define WIFI_INFO_FLAG_CONNECTED      0x04
 
+// Power save used when not in latency mode
+#define WIFI_DEF_PS_MODE              WIFI_PS_MIN_MODEM
+
 
 
 //
@@ -70,6 +74,16 @@ static bool sta_connected = false; // Set when we connect to an AP so we can dis
 static int sta_retry_num = 0;
 static uint8_t wifi_flags = 0;
 
+// Station fast connect to the AP (BSSID and channel) last connected to
+static bool sta_directed = false;  // Connecting without a scan
+static int64_t sta_start_usec;
+static bool latency_mode = false;
+
+// HTTP server shared by the modules that serve data over WiFi
+static httpd_handle_t http_server = NULL;
+static bool http_starting = false;
+static portMUX_TYPE http_mux = portMUX_INITIALIZER_UNLOCKED;
+
 
 
 //
@@ -78,6 +92,8 @@ static uint8_t wifi_flags = 0;
 static bool init_esp_wifi();
 static bool enable_esp_wifi_ap();
 static bool enable_esp_wifi_client();
+static void wifi_sta_forget_ap();
+static void wifi_sta_note_ap(wifi_event_sta_connected_t* event);
 static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 
@@ -255,6 +271,91 @@ void wifi_get_ipv4_gw_string(char* s)
 }
 
 
+/**
+ * Disable power save while a latency sensitive session (e.g. to a WiFi OBD dongle) is
+ * active so the AP doesn't have to buffer frames for us until our next wake.  Power save
+ * can't be disabled while BLE is also running.
+ */
+void wifi_set_latency_mode(bool en)
+{
+	esp_err_t ret;
+	
+	if (en == latency_mode) return;
+	
+	ret = esp_wifi_set_ps(en ? WIFI_PS_NONE : WIFI_DEF_PS_MODE);
+	if (ret == ESP_OK) {
+		latency_mode = en;
+		ESP_LOGI(TAG, "Latency mode %s", en ? "on" : "off");
+	} else {
+		ESP_LOGW(TAG, "Could not set power save mode (%d)", ret);
+	}
+}
+
+
+/**
+ * Return the HTTP server shared by the modules that serve data over WiFi, starting it
+ * the first time.  Returns NULL if it could not be started (or another task is starting
+ * it right now) so the caller can try again later.  Does not start WiFi.
+ */
+httpd_handle_t wifi_get_http_server()
+{
+	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+	httpd_handle_t server;
+	bool start;
+	
+	portENTER_CRITICAL(&http_mux);
+	start = (http_server == NULL) && !http_starting;
+	if (start) {
+		http_starting = true;
+	}
+	server = http_server;
+	portEXIT_CRITICAL(&http_mux);
+	
+	if (start) {
+		// Handlers stream from PSRAM and flash off the protocol core
+		config.core_id = 1;
+		config.max_uri_handlers = WIFI_HTTP_MAX_URIS;
+		if (httpd_start(&server, &config) != ESP_OK) {
+			ESP_LOGE(TAG, "Could not start HTTP server");
+			server = NULL;
+		}
+		portENTER_CRITICAL(&http_mux);
+		http_server = server;
+		http_starting = false;
+		portEXIT_CRITICAL(&http_mux);
+	}
+	
+	return server;
+}
+
+
+/**
+ * Return true if the request carries WIFI_HTTP_TOKEN in its WIFI_HTTP_TOKEN_HDR header.
+ * Handlers that change the device check this before acting on the request.  Always false
+ * while the token is empty.
+ */
+bool wifi_http_authorized(httpd_req_t* req)
+{
+	const char* expP = WIFI_HTTP_TOKEN;
+	char token[WIFI_HTTP_TOKEN_MAX_LEN + 1];
+	size_t len = strlen(WIFI_HTTP_TOKEN);
+	uint8_t diff = 0;
+	
+	if ((len == 0) || (len > WIFI_HTTP_TOKEN_MAX_LEN)) return false;
+	if (httpd_req_get_hdr_value_len(req, WIFI_HTTP_TOKEN_HDR) != len) return false;
+	if (httpd_req_get_hdr_value_str(req, WIFI_HTTP_TOKEN_HDR, token, sizeof(token)) != ESP_OK) {
+		return false;
+	}
+	
+	// Compare every byte so the time taken doesn't tell how much of a guess matched
+	for (size_t i=0; i<len; i++) {
+		diff |= (uint8_t) (token[i] ^ expP[i]);
+	}
+	
+	return (diff == 0);
+}
+
+
 //
 // WiFi Utilities internal functions
 //
@@ -398,6 +499,14 @@ static bool enable_esp_wifi_client()
 			.sort_method = WIFI_CONNECT_AP_BY_SIGNAL			
 		}
 	};	
+	
+	// Connect directly to the AP we last connected to (only its channel is scanned)
+	sta_directed = (configP->sta_channel != 0);
+	if (sta_directed) {
+		wifi_driver_config.sta.bssid_set = 1;
+		memcpy(wifi_driver_config.sta.bssid, configP->sta_bssid, PS_BSSID_LEN);
+		wifi_driver_config.sta.channel = configP->sta_channel;
+	}
     strcpy((char*) wifi_driver_config.sta.ssid, configP->sta_ssid);
     if (strlen(configP->sta_pw) == 0) {
         strcpy((char*) wifi_driver_config.sta.password, "");
@@ -423,10 +532,44 @@ static bool enable_esp_wifi_client()
     	return false;
     }
     
+    // Modem power save until a latency sensitive session starts
+    latency_mode = false;
+    (void) esp_wifi_set_ps(WIFI_DEF_PS_MODE);
+    
     return true;
 }
 
 
+/**
+ * Go back to scanning for the SSID after a directed connect failed (the AP may have been
+ * replaced or moved to another channel)
+ */
+static void wifi_sta_forget_ap()
+{
+	wifi_config_t wifi_driver_config;
+	
+	sta_directed = false;
+	if (esp_wifi_get_config(WIFI_IF_STA, &wifi_driver_config) == ESP_OK) {
+		wifi_driver_config.sta.bssid_set = 0;
+		wifi_driver_config.sta.channel = 0;
+		(void) esp_wifi_set_config(WIFI_IF_STA, &wifi_driver_config);
+	}
+}
+
+
+/**
+ * Remember the AP we connected to for the next directed connect
+ */
+static void wifi_sta_note_ap(wifi_event_sta_connected_t* event)
+{
+	if ((configP->sta_channel != event->channel) || (memcmp(configP->sta_bssid, event->bssid, PS_BSSID_LEN) != 0)) {
+		memcpy(configP->sta_bssid, event->bssid, PS_BSSID_LEN);
+		configP->sta_channel = event->channel;
+		(void) ps_save_config(PS_CONFIG_TYPE_NET);
+	}
+}
+
+
 /*
  * Handle events from the WiFi stack
  */
@@ -450,7 +593,8 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t e
 			break;
 			
 		case WIFI_EVENT_STA_START:
-			ESP_LOGI(TAG, "Station started, trying to connect to %s", configP->sta_ssid);
+			ESP_LOGI(TAG, "Station started, trying to connect to %s%s", configP->sta_ssid, sta_directed ? " (cached AP)" : "");
+			sta_start_usec = esp_timer_get_time();
 			esp_wifi_connect();
 			sta_retry_num = 0;
         	break;
@@ -460,12 +604,18 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t e
         	break;
         	
         case WIFI_EVENT_STA_CONNECTED:
-        	ESP_LOGI(TAG, "Station connected");
+        	ESP_LOGI(TAG, "Station connected in %d mSec", (int) ((esp_timer_get_time() - sta_start_usec) / 1000));
+        	wifi_sta_note_ap((wifi_event_sta_connected_t*) event_data);
         	wifi_flags |= WIFI_INFO_FLAG_CONNECTED;
         	break;
         	
         case WIFI_EVENT_STA_DISCONNECTED:
         	wifi_flags &= ~WIFI_INFO_FLAG_CONNECTED;
+        	if (sta_directed) {
+        		// Cached AP not found, scan for it
+        		ESP_LOGI(TAG, "Cached AP not found");
+        		wifi_sta_forget_ap();
+        	}
         	if (sta_retry_num > WIFI_FAST_RECONNECT_ATTEMPTS) {
         		vTaskDelay(pdMS_TO_TICKS(1000));
         	} else {
@@ -22,6 +22,7 @@
 #ifndef WIFI_UTILITIES_H
 #define WIFI_UTILITIES_H
 
+#include "esp_http_server.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -34,6 +35,18 @@
 // Maximum attempts to reconnect to an AP in client mode before starting to wait
 #define WIFI_FAST_RECONNECT_ATTEMPTS  10
 
+// URI handlers the shared HTTP server can hold (diagnostics, parameters, OTA, captures,
+// run traces, profiler)
+#define WIFI_HTTP_MAX_URIS            16
+
+// Shared token a client sends in the WIFI_HTTP_TOKEN_HDR header to use the URIs that change
+// the device (OTA firmware updates, parameter changes).  Set it for each installation before
+// enabling those features; while it is empty they refuse every request.
+#define WIFI_HTTP_TOKEN_HDR           "X-Auth-Token"
+#define WIFI_HTTP_TOKEN               ""
+
+// Longest token accepted
+#define WIFI_HTTP_TOKEN_MAX_LEN       64
 
 
 //
@@ -45,5 +58,8 @@ bool wifi_is_enabled();
 bool wifi_is_connected();
 void wifi_get_ipv4_addr_string(char* s);   // s must be large enough for "XXX.XXX.XXX.XXX" + null
 void wifi_get_ipv4_gw_string(char* s);
+void wifi_set_latency_mode(bool en);
+httpd_handle_t wifi_get_http_server();
+bool wifi_http_authorized(httpd_req_t* req);
 
 #endif /* WIFI_UTILITIES_H */
@@ -0,0 +1,348 @@
+/*
+ * Vehicle auto-identification
+ *
+ * A pseudo-vehicle that reads the VIN from whichever ECU answers (the OBD-II powertrain
+ * ECU on 11- or 29-bit IDs or a VW MEB ECU by UDS) and maps its manufacturer (WMI) and
+ * model code to a vehicle implementation.  Drivetrain variants the VIN doesn't encode are
+ * told apart by a probe.  The identified vehicle is cached and the system restarted so
+ * the GUI is built for it.  Later boots select the cached vehicle without any probing.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "vehicle_auto.h"
+#include "can_manager.h"
+#include "dlog_utilities.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ps_utilities.h"
+#include <string.h>
+
+
+//
+// Local constants
+//
+
+// Identification states
+#define ID_VIN             0
+#define ID_DRIVE_PROBE     1
+#define ID_DONE            2
+
+#define VIN_REQ_MSEC       500
+
+// Both the Mode 09 (49 02 01) and UDS (62 F1 90) responses carry the VIN after 3 bytes
+#define VIN_RSP_OFFSET     3
+
+// Failed front motor requests before a MEB vehicle is taken to be RWD
+#define DRIVE_PROBE_TRIES  3
+
+// Vehicle an unknown VIN selects
+#define DEFAULT_VEHICLE    "Generic OBD-II"
+
+// CAN request list indicies
+#define AUTO_VIN_OBD       0
+#define AUTO_VIN_OBD_EXT   1
+#define AUTO_VIN_UDS       2
+#define AUTO_FRONT_PROBE   3
+
+#define NUM_AUTO_REQ_ITEMS 4
+
+#define NUM_VIN_REQ        3
+
+
+//
+//  Forward declarations
+//
+
+// Functions for vehicle manager
+static void _auto_init();
+static void _auto_eval();
+static void _auto_set_req_mask(db_mask_t mask);
+static void _auto_rx_data(uint32_t id, int req_index, int len, uint8_t* data);
+static void _auto_error(int errno);
+
+// Internal functions
+static bool _auto_get_vin(int len, uint8_t* data, char* vin);
+static void _auto_identify(const char* vin);
+static void _auto_select(const char* vehicle_name);
+
+
+
+//
+// Vehicle definition.  It has no items of its own.
+//
+const vehicle_config_t vehicle_auto =
+{
+	"Auto Detect",
+	0,
+	{0, NULL},
+	true,               // 500k CAN (all supported vehicles)
+	300,                // Request timeout (mSec)
+	VM_FC(0, 0),        // ISO-TP flow control: no block size limit, no separation time
+	_auto_init,
+	_auto_eval,
+	_auto_set_req_mask,
+	_auto_rx_data,
+	_auto_error
+};
+
+
+
+//
+// Identification CAN request packets (must match list of indicies)
+//
+//                                                 Req ID      Rsp ID      Period        Priority          Flow Ctrl          PCI   SID
+static const can_request_t req_vin_obd         = {0x7E0,      0x7E8,      VIN_REQ_MSEC, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x02, 0x09, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_vin_obd_ext     = {0x18DA01F1, 0x18DAF101, VIN_REQ_MSEC, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x02, 0x09, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_vin_uds         = {0x17fc0076, 0x17fe0076, VIN_REQ_MSEC, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x03, 0x22, 0xF1, 0x90, 0x00, 0x00, 0x00, 0x00}};
+
+// VW MEB front motor torque - only AWD vehicles have a front motor
+static const can_request_t req_front_probe     = {0x17fc0076, 0x17fe0076, VIN_REQ_MSEC, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x03, 0x22, 0x03, 0x35, 0x00, 0x00, 0x00, 0x00}};
+
+static const can_request_t* req_full_listP[NUM_AUTO_REQ_ITEMS] = {
+	&req_vin_obd,
+	&req_vin_obd_ext,
+	&req_vin_uds,
+	&req_front_probe
+};
+
+
+
+//
+// VIN to vehicle map.  A VIN matches a row when it starts with the WMI and has the model
+// code at code_offset.  Rows with probe_drive set select the RWD variant unless the front
+// motor probe is answered.
+//
+typedef struct {
+	const char* wmi;
+	int code_offset;
+	const char* code;
+	const char* vehicle_name;
+	bool probe_drive;
+} vin_map_t;
+
+static const vin_map_t vin_map[] = {
+	{"WVW", 6, "E1",  "VW MEB RWD", true},      // VW ID.3
+	{"WVG", 6, "E2",  "VW MEB RWD", true},      // VW ID.4, ID.5
+	{"WV1", 6, "EB",  "VW MEB RWD", true},      // VW ID.Buzz (commercial)
+	{"WV2", 6, "EB",  "VW MEB RWD", true},      // VW ID.Buzz
+	{"WAU", 6, "FZ",  "VW MEB RWD", true},      // Audi Q4 e-tron
+	{"VSS", 6, "K1",  "VW MEB RWD", true},      // Cupra Born
+	{"TMB", 6, "NY",  "VW MEB RWD", true},      // Skoda Enyaq
+	{"1N4", 3, "AZ1", "Leaf ZE1",   false},     // Nissan Leaf (US)
+	{"1N4", 3, "BZ1", "Leaf ZE1",   false},     // Nissan Leaf e+ (US)
+	{"SJN", 6, "ZE1", "Leaf ZE1",   false},     // Nissan Leaf (EU)
+	{"JN1", 6, "ZE1", "Leaf ZE1",   false}      // Nissan Leaf (JP)
+};
+
+#define NUM_VIN_MAP (sizeof(vin_map)/sizeof(vin_map[0]))
+
+
+
+//
+// Global variables
+//
+static const char* TAG = "vehicle_auto";
+
+static vin_cache_t vin_cache_default;
+static vin_cache_t* vin_cacheP = &vin_cache_default;
+static int id_state;
+
+
+
+//
+// API
+//
+
+// Returns the vehicle identified on an earlier boot or NULL if there is none
+const char* vehicle_auto_get_cached_name()
+{
+	if (!ps_get_config(PS_CONFIG_TYPE_VIN, (void**) &vin_cacheP)) {
+		vin_cacheP = &vin_cache_default;
+		return NULL;
+	}
+	
+	if (!vin_cacheP->valid || (strlen(vin_cacheP->vehicle_name) == 0)) {
+		return NULL;
+	}
+	
+	return vin_cacheP->vehicle_name;
+}
+
+
+// Discard the cached identification so the vehicle is identified again
+void vehicle_auto_forget()
+{
+	if (ps_get_config(PS_CONFIG_TYPE_VIN, (void**) &vin_cacheP) && vin_cacheP->valid) {
+		vin_cacheP->valid = false;
+		(void) ps_save_config(PS_CONFIG_TYPE_VIN);
+	}
+}
+
+
+
+//
+// Vehicle manager functions
+//
+static void _auto_init()
+{
+	// Responses come from several ECUs
+	can_en_rsp_filter(false);
+	
+	if (!ps_get_config(PS_CONFIG_TYPE_VIN, (void**) &vin_cacheP)) {
+		ESP_LOGE(TAG, "Get VIN cache failed");
+		vin_cacheP = &vin_cache_default;
+	}
+	
+	id_state = ID_VIN;
+}
+
+
+static void _auto_eval()
+{
+	vm_req_stats_t stats;
+	
+	if ((id_state == ID_DRIVE_PROBE) && vm_get_request_stats(AUTO_FRONT_PROBE, &stats)) {
+		// No front motor ECU answers (a negative response other than busy or repeated
+		// timeouts)
+		if (((stats.num_neg_rsp > 0) && (stats.last_nrc != CAN_NRC_BUSY_REPEAT_REQUEST)) ||
+		    ((stats.num_timeout + stats.num_no_data) >= DRIVE_PROBE_TRIES)) {
+			_auto_select("VW MEB RWD");
+		}
+	}
+}
+
+
+static void _auto_set_req_mask(db_mask_t mask)
+{
+	uint32_t enable_mask = 0;
+	
+	// Ask for the VIN every way we know until it is read, then probe the drivetrain
+	if (id_state == ID_VIN) {
+		enable_mask = (1UL << NUM_VIN_REQ) - 1;
+	} else if (id_state == ID_DRIVE_PROBE) {
+		enable_mask = 1UL << AUTO_FRONT_PROBE;
+	}
+	
+	vm_sched_set_request_list(NUM_AUTO_REQ_ITEMS, req_full_listP, NULL, enable_mask);
+}
+
+
+static void _auto_rx_data(uint32_t id, int req_index, int len, uint8_t* data)
+{
+	char vin[PS_VIN_LEN+1];
+	
+	if (id_state == ID_VIN) {
+		if ((req_index < NUM_VIN_REQ) && _auto_get_vin(len, data, vin)) {
+			_auto_identify(vin);
+		}
+	} else if ((id_state == ID_DRIVE_PROBE) && (req_index == AUTO_FRONT_PROBE)) {
+		_auto_select("VW MEB AWD");
+	}
+}
+
+
+static void _auto_error(int errno)
+{
+	// The vehicle manager backs off requests that repeatedly fail so we just log errors
+	if (errno == CAN_ERRNO_TIMEOUT) {
+		DLOGI(TAG, "Request timeout");
+	} else if (errno == CAN_ERRNO_FRAME_TIMEOUT) {
+		DLOGI(TAG, "Multi-frame response timeout");
+	} else if (errno == CAN_ERRNO_NO_DATA) {
+		DLOGI(TAG, "No data for request");
+	}
+}
+
+
+
+//
+// Internal functions
+//
+
+// Extract the VIN from a response.  Returns false if it doesn't look like a VIN.
+static bool _auto_get_vin(int len, uint8_t* data, char* vin)
+{
+	char c;
+	
+	if (len < (VIN_RSP_OFFSET + PS_VIN_LEN)) {
+		return false;
+	}
+	
+	// VINs are upper case letters (except I, O and Q) and digits
+	for (int i=0; i<PS_VIN_LEN; i++) {
+		c = (char) data[VIN_RSP_OFFSET + i];
+		if (!(((c >= '0') && (c <= '9')) || ((c >= 'A') && (c <= 'Z')))) {
+			ESP_LOGW(TAG, "Invalid VIN character 0x%02x", data[VIN_RSP_OFFSET + i]);
+			return false;
+		}
+		vin[i] = c;
+	}
+	vin[PS_VIN_LEN] = 0;
+	
+	return true;
+}
+
+
+static void _auto_identify(const char* vin)
+{
+	const vin_map_t* mP;
+	
+	ESP_LOGI(TAG, "VIN %s", vin);
+	strncpy(vin_cacheP->vin, vin, PS_VIN_LEN);
+	vin_cacheP->vin[PS_VIN_LEN] = 0;
+	
+	for (int i=0; i<NUM_VIN_MAP; i++) {
+		mP = &vin_map[i];
+		if ((strncmp(vin, mP->wmi, 3) == 0) && (strncmp(&vin[mP->code_offset], mP->code, strlen(mP->code)) == 0)) {
+			if (mP->probe_drive) {
+				// Find out if there is a front motor before selecting the variant
+				ESP_LOGI(TAG, "Probing drivetrain");
+				id_state = ID_DRIVE_PROBE;
+				vm_sched_rebuild_profiles();
+			} else {
+				_auto_select(mP->vehicle_name);
+			}
+			return;
+		}
+	}
+	
+	ESP_LOGI(TAG, "Unknown vehicle");
+	_auto_select(DEFAULT_VEHICLE);
+}
+
+
+// Cache the identified vehicle and restart so everything is setup for it
+static void _auto_select(const char* vehicle_name)
+{
+	id_state = ID_DONE;
+	
+	strncpy(vin_cacheP->vehicle_name, vehicle_name, PS_VEHICLE_NAME_MAX_LEN);
+	vin_cacheP->vehicle_name[PS_VEHICLE_NAME_MAX_LEN] = 0;
+	vin_cacheP->valid = true;
+	ESP_LOGI(TAG, "Identified %s - restarting", vehicle_name);
+	
+	if (!ps_save_config(PS_CONFIG_TYPE_VIN) || !ps_flush()) {
+		// Don't restart into identification again
+		ESP_LOGE(TAG, "Could not update persistent storage");
+		vm_sched_rebuild_profiles();
+		return;
+	}
+	vTaskDelay(pdMS_TO_TICKS(50));
+	esp_restart();
+}
@@ -0,0 +1,42 @@
+/*
+ * Vehicle auto-identification
+ *
+ * Reads the vehicle identification number (OBD-II Mode 09 PID 02 or UDS DID 0xF190),
+ * maps it to one of the vehicle implementations and caches the result so later boots
+ * select the vehicle directly.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef VEHICLE_AUTO_H
+#define VEHICLE_AUTO_H
+
+#include "vehicle_manager.h"
+
+
+//
+// Externs for vehicles defined in this module
+//
+extern const vehicle_config_t vehicle_auto;
+
+
+//
+// API
+//
+const char* vehicle_auto_get_cached_name();
+void vehicle_auto_forget();
+
+#endif /* VEHICLE_AUTO_H */
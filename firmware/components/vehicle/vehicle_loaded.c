@@ -0,0 +1,294 @@
+/*
+ * Vehicles loaded from the "vehicles" flash data partition
+ *
+ * The partition is memory-mapped once at boot and validated.  Request and decoder tables
+ * are used where they lie in flash; only the small per-vehicle configuration and the
+ * pointer lists the vehicle manager takes are kept in RAM.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "vehicle_loaded.h"
+#include "can_manager.h"
+#include "data_broker.h"
+#include "esp_partition.h"
+#include "dlog_utilities.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include <string.h>
+
+
+
+//
+// Local constants
+//
+
+// Signal catalog ranges set from an image record's five ranges
+#define VL_NUM_RANGES 8
+
+
+
+//
+// Forward declarations
+//
+
+// Functions for vehicle manager
+static void _vehicle_loaded_init();
+static void _vehicle_loaded_set_req_mask(db_mask_t mask);
+static void _vehicle_loaded_rx_data(uint32_t id, int req_index, int len, uint8_t* data);
+static void _vehicle_loaded_error(int errno);
+
+// Internal functions
+static bool _vehicle_loaded_validate(const vl_vehicle_t* vP, uint32_t image_len);
+static void _vehicle_loaded_set_ranges(vm_item_range_t* rangeP, const vl_vehicle_t* vP);
+
+
+
+//
+// Global variables
+//
+static const char* TAG = "vehicle_loaded";
+
+// Mapped image
+static esp_partition_mmap_handle_t map_handle;
+static const uint8_t* imageP = NULL;
+static int num_vehicles = 0;
+
+// Vehicle manager configurations for the loaded vehicles
+static const vl_vehicle_t* vehicle_recP[VL_MAX_VEHICLES];
+static vehicle_config_t vehicle_config[VL_MAX_VEHICLES];
+static vm_item_range_t vehicle_ranges[VL_MAX_VEHICLES][VL_NUM_RANGES];
+
+// Selected vehicle
+static const vl_vehicle_t* cur_vehicleP = NULL;
+static const vl_request_t* cur_reqP;
+static const can_request_t* cur_req_listP[VM_MAX_SCHED_REQ];
+static vm_decoder_list_t cur_decoder_list[VM_MAX_SCHED_REQ];
+
+
+
+//
+// API
+//
+
+// Map the vehicles partition.  Returns false if there is no partition or no valid image
+// (in which case there are no loaded vehicles).
+bool vehicle_loaded_init()
+{
+	const esp_partition_t* partP;
+	const vl_header_t* hP;
+	const void* mapP;
+	const vl_vehicle_t* vP;
+	esp_err_t ret;
+
+	partP = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, VL_PARTITION_SUBTYPE, VL_PARTITION_NAME);
+	if (partP == NULL) {
+		ESP_LOGI(TAG, "No vehicles partition");
+		return false;
+	}
+
+	ret = esp_partition_mmap(partP, 0, partP->size, ESP_PARTITION_MMAP_DATA, &mapP, &map_handle);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Map vehicles partition failed - %d", ret);
+		return false;
+	}
+
+	// An erased partition has no image
+	hP = (const vl_header_t*) mapP;
+	if ((hP->magic != VL_MAGIC) || (hP->format_version != VL_FORMAT_VERSION) || (hP->image_len > partP->size) ||
+	    (hP->num_vehicles > VL_MAX_VEHICLES) || ((sizeof(vl_header_t) + hP->num_vehicles * sizeof(vl_vehicle_t)) > hP->image_len)) {
+		if (hP->magic == VL_MAGIC) {
+			ESP_LOGE(TAG, "Unsupported vehicles image (format %d)", hP->format_version);
+		}
+		esp_partition_munmap(map_handle);
+		return false;
+	}
+	imageP = (const uint8_t*) mapP;
+
+	// Setup a vehicle manager configuration for each valid vehicle
+	vP = (const vl_vehicle_t*) (imageP + sizeof(vl_header_t));
+	for (int i=0; i<hP->num_vehicles; i++, vP++) {
+		if (!_vehicle_loaded_validate(vP, hP->image_len)) {
+			ESP_LOGE(TAG, "Skipping invalid vehicle %d", i);
+			continue;
+		}
+
+		vehicle_recP[num_vehicles] = vP;
+		_vehicle_loaded_set_ranges(vehicle_ranges[num_vehicles], vP);
+		vehicle_config[num_vehicles] = (vehicle_config_t) {
+			(char*) vP->name,
+			vP->supported_item_mask,
+			VM_RANGE_LIST(vehicle_ranges[num_vehicles]),
+			vP->can_is_500k != 0,
+			vP->req_timeout_msec,
+			vP->flow_control,
+			_vehicle_loaded_init,
+			NULL,
+			_vehicle_loaded_set_req_mask,
+			_vehicle_loaded_rx_data,
+			_vehicle_loaded_error
+		};
+		num_vehicles += 1;
+		ESP_LOGI(TAG, "Loaded %s (%lu requests)", vP->name, vP->num_req);
+	}
+
+	return true;
+}
+
+
+int vehicle_loaded_get_num()
+{
+	return num_vehicles;
+}
+
+
+const char* vehicle_loaded_get_name(int n)
+{
+	if ((n >= 0) && (n < num_vehicles)) {
+		return vehicle_recP[n]->name;
+	}
+
+	return NULL;
+}
+
+
+// Returns the configuration of the named vehicle (which becomes the one our vehicle manager
+// functions work with), NULL if there is no such loaded vehicle
+const vehicle_config_t* vehicle_loaded_select(const char* name)
+{
+	for (int i=0; i<num_vehicles; i++) {
+		if (strncmp(vehicle_recP[i]->name, name, VL_NAME_LEN) == 0) {
+			cur_vehicleP = vehicle_recP[i];
+			return &vehicle_config[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+
+//
+// Vehicle manager functions
+//
+static void _vehicle_loaded_init()
+{
+	const vm_decoder_t* rowP;
+
+	if ((cur_vehicleP->flags & VL_FLAG_NO_RSP_FILTER) != 0) {
+		can_en_rsp_filter(false);
+	}
+
+	// The vehicle manager takes lists of pointers into the tables
+	cur_reqP = (const vl_request_t*) (imageP + cur_vehicleP->req_offset);
+	rowP = (const vm_decoder_t*) (imageP + cur_vehicleP->row_offset);
+	for (int i=0; i<cur_vehicleP->num_req; i++) {
+		cur_req_listP[i] = VL_REQ(&cur_reqP[i]);
+		cur_decoder_list[i].num_rows = cur_reqP[i].num_rows;
+		cur_decoder_list[i].rowP = (cur_reqP[i].num_rows != 0) ? &rowP[cur_reqP[i].first_row] : NULL;
+	}
+}
+
+
+static void _vehicle_loaded_set_req_mask(db_mask_t mask)
+{
+	uint32_t enable_mask = 0;
+
+	for (int i=0; i<cur_vehicleP->num_req; i++) {
+		if (vm_mask_check(mask, cur_reqP[i].item_mask)) {
+			enable_mask |= (1UL << i);
+		}
+	}
+	vm_sched_set_request_list(cur_vehicleP->num_req, cur_req_listP, cur_decoder_list, enable_mask);
+
+	for (int i=0; i<cur_vehicleP->num_req; i++) {
+		if (cur_reqP[i].pair_index > i) {
+			vm_sched_pair_requests(i, cur_reqP[i].pair_index);
+		}
+		if (cur_reqP[i].streaming != 0) {
+			vm_sched_enable_streaming(i);
+		}
+	}
+}
+
+
+static void _vehicle_loaded_rx_data(uint32_t id, int req_index, int len, uint8_t* data)
+{
+	float vals[VM_MAX_DECODE_VALS];
+
+	// All values are published through their decoder rows
+	(void) vm_decode_response(&cur_decoder_list[req_index], len, data, vals);
+}
+
+
+static void _vehicle_loaded_error(int errno)
+{
+	// The vehicle manager backs off requests that repeatedly fail so we just log errors
+	if (errno == CAN_ERRNO_TIMEOUT) {
+		DLOGI(TAG, "Request timeout");
+	} else if (errno == CAN_ERRNO_FRAME_TIMEOUT) {
+		DLOGI(TAG, "Multi-frame response timeout");
+	} else if (errno == CAN_ERRNO_NO_DATA) {
+		DLOGI(TAG, "No data for request");
+	}
+}
+
+
+
+//
+// Internal functions
+//
+
+// Check that a vehicle's tables lie within the image and fit the vehicle manager's limits
+static bool _vehicle_loaded_validate(const vl_vehicle_t* vP, uint32_t image_len)
+{
+	const vl_request_t* rP;
+	const vm_decoder_t* dP;
+
+	if (strnlen(vP->name, VL_NAME_LEN) == VL_NAME_LEN) return false;
+	if ((vP->num_req == 0) || (vP->num_req > VM_MAX_SCHED_REQ)) return false;
+	if (((vP->req_offset & 0x3) != 0) || ((vP->row_offset & 0x3) != 0)) return false;
+	if ((vP->req_offset + vP->num_req * sizeof(vl_request_t)) > image_len) return false;
+	if ((vP->row_offset + vP->num_rows * sizeof(vm_decoder_t)) > image_len) return false;
+
+	rP = (const vl_request_t*) (imageP + vP->req_offset);
+	for (int i=0; i<vP->num_req; i++, rP++) {
+		if ((VL_REQ(rP)->req_len < 1) || (VL_REQ(rP)->req_len > VL_REQ_DATA_LEN)) return false;
+		if ((rP->num_rows > VM_MAX_DECODE_VALS) || ((rP->first_row + rP->num_rows) > vP->num_rows)) return false;
+		if (rP->pair_index >= (int) vP->num_req) return false;
+	}
+
+	dP = (const vm_decoder_t*) (imageP + vP->row_offset);
+	for (int i=0; i<vP->num_rows; i++, dP++) {
+		if (((dP->width < 1) && ((dP->width != 0) || (dP->rsp_len == 0))) || (dP->width > 4) || (dP->db_item < DB_ITEM_NONE) || (dP->db_item >= DB_NUM_ITEMS)) return false;
+	}
+
+	return true;
+}
+
+
+// The image format keeps its five fixed ranges; each covers the items drawn on the same scale
+static void _vehicle_loaded_set_ranges(vm_item_range_t* rangeP, const vl_vehicle_t* vP)
+{
+	rangeP[0] = (vm_item_range_t) {DB_ITEM_HV_POWER_KW, vP->power_kw_range.min, vP->power_kw_range.max};
+	rangeP[1] = (vm_item_range_t) {DB_ITEM_FRONT_MECH_KW, vP->power_kw_range.min, vP->power_kw_range.max};
+	rangeP[2] = (vm_item_range_t) {DB_ITEM_REAR_MECH_KW, vP->power_kw_range.min, vP->power_kw_range.max};
+	rangeP[3] = (vm_item_range_t) {DB_ITEM_AUX_KW, vP->aux_kw_range.min, vP->aux_kw_range.max};
+	rangeP[4] = (vm_item_range_t) {DB_ITEM_FRONT_TORQUE, vP->torque_nm_range.min, vP->torque_nm_range.max};
+	rangeP[5] = (vm_item_range_t) {DB_ITEM_REAR_TORQUE, vP->torque_nm_range.min, vP->torque_nm_range.max};
+	rangeP[6] = (vm_item_range_t) {DB_ITEM_HV_BATT_I, vP->hv_batt_i_range.min, vP->hv_batt_i_range.max};
+	rangeP[7] = (vm_item_range_t) {DB_ITEM_LV_BATT_V, vP->lv_batt_v_range.min, vP->lv_batt_v_range.max};
+}
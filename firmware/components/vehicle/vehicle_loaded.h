@@ -0,0 +1,115 @@
+/*
+ * Vehicles loaded from the "vehicles" flash data partition
+ *
+ * Vehicle descriptions (requests, decoders, ranges and bus parameters) are read in place
+ * from the memory-mapped partition so additional vehicles can be added by writing the
+ * partition (e.g. "parttool.py write_partition --partition-name vehicles") without
+ * rebuilding the firmware.  Loaded vehicles use the vehicle manager's table-driven
+ * decoding only (every value must map directly to a data item through a decoder row).
+ *
+ * Partition image layout (little-endian, records use the firmware's in-memory structure
+ * layouts so they are referenced directly):
+ *
+ *   vl_header_t                           at offset 0
+ *   vl_vehicle_t[num_vehicles]            immediately following the header
+ *   vl_request_t[] and vm_decoder_t[]     at the offsets given in each vl_vehicle_t
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef VEHICLE_LOADED_H
+#define VEHICLE_LOADED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "vehicle_manager.h"
+
+
+
+//
+// Constants
+//
+
+// Partition
+#define VL_PARTITION_NAME    "vehicles"
+#define VL_PARTITION_SUBTYPE 0x40
+
+// Image identification - the format version changes whenever vl_*_t, can_request_t or
+// vm_decoder_t change layout
+#define VL_MAGIC             0x44565645     /* "EVVD" */
+#define VL_FORMAT_VERSION    1
+
+// Limits
+#define VL_MAX_VEHICLES      8
+#define VL_NAME_LEN          32
+#define VL_REQ_DATA_LEN      8
+
+// vl_vehicle_t flags
+#define VL_FLAG_NO_RSP_FILTER 0x01          // Gateway filters the OBD bus (no interface filtering)
+
+
+
+//
+// Image records
+//
+typedef struct {
+	uint32_t magic;
+	uint16_t format_version;
+	uint16_t num_vehicles;
+	uint32_t image_len;                     // Total length of the image
+} vl_header_t;
+
+typedef struct {
+	char name[VL_NAME_LEN];                 // Null terminated
+	db_mask_t supported_item_mask;
+	item_range_t power_kw_range;
+	item_range_t aux_kw_range;
+	item_range_t torque_nm_range;
+	item_range_t hv_batt_i_range;
+	item_range_t lv_batt_v_range;
+	uint8_t can_is_500k;
+	uint8_t flags;                          // VL_FLAG_*
+	uint16_t flow_control;                  // VM_FC()
+	uint32_t req_timeout_msec;
+	uint32_t num_req;
+	uint32_t req_offset;                    // Image offset of the vehicle's vl_request_t list
+	uint32_t num_rows;
+	uint32_t row_offset;                    // Image offset of the vehicle's vm_decoder_t rows
+} vl_vehicle_t;
+
+typedef struct {
+	db_mask_t item_mask;                    // Requested items that need this request
+	uint16_t first_row;                     // Decoder rows (index into the vehicle's rows)
+	uint16_t num_rows;
+	int16_t pair_index;                     // Request issued back-to-back with this one (-1 = none)
+	uint8_t streaming;                      // Decode as the response's frames arrive
+	uint8_t reserved;
+	uint8_t req_buf[sizeof(can_request_t) + VL_REQ_DATA_LEN] __attribute__((aligned(4)));   // can_request_t with VL_REQ_DATA_LEN bytes of data
+} vl_request_t;
+
+#define VL_REQ(rP) ((const can_request_t*) (rP)->req_buf)
+
+
+
+//
+// API
+//
+bool vehicle_loaded_init();
+int vehicle_loaded_get_num();
+const char* vehicle_loaded_get_name(int n);
+const vehicle_config_t* vehicle_loaded_select(const char* name);
+
+#endif /* VEHICLE_LOADED_H */
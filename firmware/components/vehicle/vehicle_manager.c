@@ -26,13 +26,24 @@
  */
 #include "can_manager.h"
 #include "data_broker.h"
+#include "deadline_utilities.h"
+#include "dlog_utilities.h"
+#include "esp_heap_caps.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "event_utilities.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "tune_utilities.h"
 #include "vehicle_manager.h"
+#include "vehicle_auto.h"
 #include "vehicle_leaf_ze1.h"
+#include "vehicle_loaded.h"
+#include "vehicle_obd2.h"
 #include "vehicle_vw_meb.h"
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -40,9 +51,11 @@
 //
 // List of all implemented vehicle types
 //
-#define NUM_VEHICLES 3
+#define NUM_VEHICLES 5
 static const vehicle_config_t* vehicle_listP[NUM_VEHICLES] =
 {
+	&vehicle_auto,
+	&vehicle_obd2_generic,
 	&vehicle_leaf_ze1,
 	&vehicle_vw_meb_awd,
 	&vehicle_vw_meb_rwd
@@ -50,6 +63,267 @@ static const vehicle_config_t* vehicle_listP[NUM_VEHICLES] =
 
 
 
+//
+// Response queue constants
+//
+
+// Number of queued responses (must be a power of 2)
+#define RSP_QUEUE_LEN  16
+#define RSP_QUEUE_MASK (RSP_QUEUE_LEN - 1)
+
+// Per-entry buffer sized for typical responses (our vehicles see 5-53 bytes).  Larger
+// responses use a single shared buffer from the buffer plan.
+#define RSP_SLOT_LEN   64
+
+// Buffer plan.  Response buffers are sized for the longest response of the vehicle's
+// request list (worst case when a length is unknown) and carved from one internal RAM
+// allocation in multiples of PLAN_ALIGN bytes.
+#define PLAN_ALIGN     4
+
+// Extra time the scheduler allows past a vehicle's request timeout before abandoning
+// an outstanding request itself (normally the interface driver reports the timeout)
+#define SCHED_TIMEOUT_MARGIN_MSEC 100
+
+// The interface is put into broadcast monitor mode when no request is due for at least
+// this long (on ELM327 leaving monitor mode costs a round trip)
+#define SCHED_MONITOR_IDLE_MSEC   250
+
+// Request health tracking.  A request that fails (timeout, no data or negative response)
+// SCHED_FAIL_THRESHOLD times in a row is backed off - its period is extended by a delay
+// that doubles with each subsequent failure from TUNE_BACKOFF_MIN_MSEC up to
+// TUNE_BACKOFF_MAX_MSEC.  Each issue after the delay is a probe and the first good response
+// restores the normal period.
+#define SCHED_FAIL_THRESHOLD      3
+
+// Negative responses.  An ECU that is busy (busyRepeatRequest, or responsePending on an
+// interface that can't wait for the real response) is asked again after a short delay
+// without counting as a failure.  A request the ECU doesn't support is disabled until the
+// vehicle's request list changes.  Other negative responses count as failures.
+#define SCHED_BUSY_RETRY_MSEC     100
+
+// Dynamically defined DIDs.  A request reading a dynamic DID is preceded by its define
+// request (UDS 0x2C) the first time it is due and again whenever the ECU reports the DID
+// out of range (e.g. the ECU restarted and lost it).  If the ECU refuses the definition
+// the requests given as its fallback are scheduled instead.
+#define SCHED_DDID_UNDEFINED      0
+#define SCHED_DDID_DEFINED        1
+#define SCHED_DDID_REFUSED        2
+
+// Periodic data identifiers.  A periodic start request (UDS 0x2A) is sent when it becomes
+// enabled and then not again while the ECU transmits the periodic frames (received through
+// a broadcast subscription).  The stop request is sent when a profile without the start
+// request is applied.  Transmissions that stop arriving for their stale time (e.g. the
+// ECU's session ended) are started again and a refused start schedules the fallback
+// requests instead.
+#define SCHED_PDID_STOPPED        0
+#define SCHED_PDID_STARTED        1
+#define SCHED_PDID_REFUSED        2
+
+// Items become stale in the data broker when their request has not been answered for this
+// many periods (or the broker default, whichever is longer)
+#define SCHED_STALE_PERIODS       3
+
+// Period of a VM_PERIOD_CATALOG request whose response updates no items
+#define SCHED_CATALOG_PERIOD_MSEC 1000
+
+// Bus load throttle for interfaces that report bus statistics.  Every SCHED_LOAD_EVAL_MSEC
+// the bus load is estimated from the bits counted since the last evaluation.  While the load
+// is above SCHED_LOAD_HIGH_PCT or there were new bus errors the minimum gap between requests
+// doubles (starting at SCHED_GAP_MIN_MSEC, up to SCHED_GAP_MAX_MSEC).  While the load is
+// below SCHED_LOAD_LOW_PCT without errors it shrinks by a quarter until it reaches zero (no
+// gap).
+#define SCHED_LOAD_EVAL_MSEC      500
+#define SCHED_LOAD_HIGH_PCT       40
+#define SCHED_LOAD_LOW_PCT        25
+#define SCHED_GAP_MIN_MSEC        2
+#define SCHED_GAP_MAX_MSEC        100
+
+// Vehicle sleep detection.  When no response or broadcast arrived for SCHED_SLEEP_IDLE_MSEC
+// and at least SCHED_SLEEP_MIN_FAILS requests in a row failed the vehicle is considered off
+// (its ECUs asleep).  Polling then stops except for a single probe every
+// SCHED_SLEEP_PROBE_MSEC (or when asked for by vm_wake_probe()) and the first good response
+// or broadcast ends the sleep.
+#define SCHED_SLEEP_IDLE_MSEC     60000
+#define SCHED_SLEEP_MIN_FAILS     10
+#define SCHED_SLEEP_PROBE_MSEC    30000
+
+// Streamed (incremental) multi-frame responses.  Consecutive frames of responses to
+// requests with streaming enabled are passed on as they arrive so decoder rows are published
+// as soon as their bytes are present.  Only the start of a response up to the window length
+// is streamed (the rest is decoded when the response completes) and chunks are only queued
+// while at least STREAM_QUEUE_RESERVE entries remain free for complete responses.
+#define STREAM_WIN_LEN            RSP_SLOT_LEN
+#define STREAM_QUEUE_RESERVE      (RSP_QUEUE_LEN / 2)
+
+// Request profiles.  The schedule the vehicle builds for a request item mask (enabled
+// requests, groups and streamed responses) is kept so switching back to a mask already seen
+// (e.g. a GUI tile, or a tile plus the neighbour being prefetched) is a lookup.  Profiles for
+// the vehicle's full item set, the performance run items and no items are built when the
+// vehicle is selected.
+#define SCHED_MAX_PROFILES        16
+
+// Constant cadence mode (on when TUNE_CADENCE_PCT is not 0).  The enabled high priority
+// requests polled as fast as possible are issued in turn on a fixed grid so their items
+// are sampled at a constant period instead of whenever the round-robin gets to them.  Each
+// gets a slot sized from the slowest one's smoothed latency (plus CADENCE_MARGIN_PCT and
+// the ID switch time) and the slots fill TUNE_CADENCE_PCT percent of the period.  Other
+// requests are only started when they are expected to finish before the next slot, so
+// the interface may idle.  The period is re-evaluated every CADENCE_EVAL_MSEC and only
+// changed by more than CADENCE_HYST_PCT so animations keep a steady period.
+#define CADENCE_EVAL_MSEC         5000
+#define CADENCE_MARGIN_PCT        25
+#define CADENCE_HYST_PCT          20
+#define CADENCE_ROUND_MSEC        10
+#define CADENCE_LAT_SHIFT         3         // Latency smoothing weight of a new sample (1/8)
+
+// Freshness goals (vm_set_request_goals()).  The age each goal item's value reached before
+// it was replaced is measured from its data broker timestamps every time the scheduler runs
+// and every GOAL_EVAL_MSEC the worst age seen is compared with the goal.  Requests producing
+// an item with a goal are polled at a controlled period instead of their configured one:
+// shortened by the amount a goal was missed or, when the worst age is below GOAL_SLACK_PCT of
+// every goal, lengthened by half the slack to give bus time back (never beyond the goal).  A
+// goal missed while its requests are polled as fast as possible is limited by the interface
+// so requests without goals are stretched by GOAL_RELAX_STEP_PCT each evaluation up to
+// GOAL_RELAX_MAX_PCT (under SCHED_STALE_PERIODS so their items don't go stale) and let go
+// again by the same step once every goal is met.  Requests with poll conditions or periodic
+// transmissions and those on the cadence grid keep their own timing.
+#define GOAL_EVAL_MSEC            1000
+#define GOAL_SLACK_PCT            70
+#define GOAL_RELAX_STEP_PCT       25
+#define GOAL_RELAX_MAX_PCT        250
+
+// Uncomment to periodically log request statistics
+//#define LOG_REQ_STATS
+#define LOG_REQ_STATS_MSEC        30000
+
+
+
+//
+// Module data structures
+//
+typedef struct {
+	uint32_t id;
+	bool is_bcast;              // Unsolicited broadcast frame instead of a response
+	bool is_partial;            // Chunk of a streamed multi-frame response
+	int offset;                 // Partial: offset of the chunk in the response
+	int total_len;              // Partial: length of the complete response
+	int len;
+	int64_t rx_usec;            // Time the response was received
+	uint8_t* dataP;             // Points to the entry's slot buffer or the large buffer
+} rsp_desc_t;
+
+typedef struct {
+	uint32_t id;
+	const vm_decoder_list_t* decoderP;
+	const vm_signal_list_t* signalP;
+	vehicle_rx_data fcn;
+} bcast_sub_t;
+
+typedef struct {
+	bool enabled;
+	const can_request_t* reqP;
+	int period_msec;            // Request period (the catalog's for VM_PERIOD_CATALOG)
+	int64_t last_tx_msec;
+	int rsp_frames;             // Expected number of CAN frames in response (0 = unknown)
+	int fail_count;             // Consecutive failures
+	int backoff_msec;           // Additional delay while backed off (0 = healthy)
+	int group_next;             // Next request of its group, issued right after this one (-1 = none)
+	bool group_ts;              // Group's values share the time of its first response
+	uint32_t group_seq;         // Group run the last transmission belonged to (0 = none)
+	bool streaming;             // Multi-frame response is decoded as frames arrive
+	bool unsupported;           // ECU refused the request as not supported (kept disabled)
+	int ddid_define_index;      // Request defining the dynamic DID this request reads (-1 = none)
+	int ddid_read_index;        // Request reading the dynamic DID this request defines (-1 = none)
+	int ddid_state;             // Dynamic DID read: SCHED_DDID_*
+	int periodic_stop_index;    // Periodic start request: its stop request (-1 = not a periodic start)
+	int periodic_state;         // Periodic start request: SCHED_PDID_*
+	bool periodic_stop_due;     // Periodic start request: transmission running but no longer needed
+	int64_t periodic_rx_msec;   // Periodic start request: last periodic frame received
+	int cond_index;             // Poll condition in the current profile (-1 = none)
+	bool cond_held;             // Poll condition not met (polled at its alternate period)
+	db_mask_t item_mask;        // Data broker items carried by the response
+	int lat_avg_usec;           // Smoothed response latency (0 = no response yet)
+	bool cadence;               // Issued on the constant cadence grid
+	int64_t cadence_due_msec;   // Cadence: start of its next slot
+	int goal_msec;              // Shortest freshness goal of the items it produces (0 = none)
+	int goal_period_msec;       // Goal: controlled period
+	vm_req_stats_t stats;
+} sched_entry_t;
+
+typedef struct {
+	int read_index;
+	int define_index;
+	const vm_did_group_t* groupP;   // Source DID requests in definition order
+	uint32_t fallback_mask;     // Requests enabled instead if the ECU refuses the definition
+} sched_ddid_t;
+
+typedef struct {
+	int start_index;
+	int stop_index;
+	uint32_t periodic_id;       // CAN ID of the periodic frames
+	uint32_t fallback_mask;     // Requests enabled instead if the ECU refuses to start
+} sched_periodic_t;
+
+typedef struct {
+	int req_index;
+	int item;                   // Data broker item the condition tests
+	float min;
+	float max;
+	int alt_period_msec;        // Period while the item is outside [min, max] (0 = not polled)
+} sched_cond_t;
+
+typedef struct {
+	db_mask_t src_mask;         // Goal item and the items it is derived from
+	bool primed;                // A new value arrived since the goal was set
+	int64_t ts_usec;            // Broker timestamp of the value last seen
+	int worst_msec;             // Worst age since the last evaluation (-1 = none measured)
+	bool replaced;              // A value was replaced since the last evaluation
+	vm_goal_stats_t stats;
+} sched_goal_t;
+
+typedef struct {
+	bool valid;
+	db_mask_t item_mask;        // Requested items the profile was built for
+	uint32_t last_use;          // Profile use sequence number for replacement
+	int num_req;
+	const can_request_t** req_list;
+	const vm_decoder_list_t* decoder_list;
+	uint32_t enable_mask;
+	uint32_t stream_mask;
+	int8_t group_next[VM_MAX_SCHED_REQ];
+	uint32_t group_ts_mask;
+	int num_ddid;
+	sched_ddid_t ddid[VM_MAX_DDID];
+	int num_periodic;
+	sched_periodic_t periodic[VM_MAX_PERIODIC];
+	int num_cond;
+	sched_cond_t cond[VM_MAX_SCHED_COND];
+	int num_order;
+	uint8_t order[VM_MAX_SCHED_REQ];   // Enabled requests grouped by request ID
+} sched_profile_t;
+
+typedef struct {
+	bool in_use;
+	uint32_t rsp_id;
+	int req_index;              // Index of request in vehicle's full request list
+	bool rsp_pending;           // ECU sent responsePending (P2* applies from tx_msec)
+	int num_rsp;                // Functional request: ECUs that have answered
+	int64_t tx_msec;
+	int64_t tx_usec;
+} sched_outstanding_t;
+
+typedef struct {
+	bool in_use;
+	uint32_t id;
+	int req_index;              // Matched request (-1 = not decoding this response)
+	int total_len;
+	int avail;                  // Contiguous bytes received
+	uint8_t done_rows;          // Decoder rows already published (bit per row)
+	uint8_t win[STREAM_WIN_LEN];
+} stream_state_t;
+
+
+
 //
 // Module variables
 //
@@ -57,15 +331,190 @@ static const char* TAG = "vehicle_manager";
 
 static vehicle_config_t* cur_vehicleP = NULL;
 
-// Asynchronous update of request mask from GUI
+// Task to wake when there is something for vm_eval() to do
+static TaskHandle_t notify_task = NULL;
+
+// Asynchronous update of request mask from GUI (the 64-bit masks are handed over under
+// req_mask_mux so vm_eval never sees a partially written mask)
 static bool update_req_mask_flag = false;
-static uint32_t new_req_mask;
+static db_mask_t new_req_mask;
+static portMUX_TYPE req_mask_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Items of a GUI tile about to be displayed, requested along with new_req_mask
+static db_mask_t prefetch_req_mask = 0;
+
+// Items the GUI watches independent of the displayed tile (e.g. to detect charging)
+static db_mask_t background_req_mask = 0;
+
+// Freshness goals of the displayed tile, handed over with the masks
+static bool update_goals_flag = false;
+static int new_num_goals = 0;
+static vm_goal_t new_goals[VM_MAX_GOALS];
+
+// Request profile.  The GUI's mask is kept while a performance run or charging session
+// overrides it so it is restored when the profile ends.
+static volatile int req_profile = VM_PROFILE_NORMAL;
+
+// Response queue - multi-producer (CAN interfaces, possibly ISR) single-consumer (vm_eval).
+// With CAN_MANAGER_EN_DUAL_IF the TWAI receive task pushes broadcasts while the ELM327
+// receive path pushes responses, and CAN_MANAGER_EN_ELM327_PAIR has both adapters' receive
+// tasks pushing responses, so entries are claimed, filled and published under rsp_mux.
+// Head is only written under it, tail only by the consumer.
+static portMUX_TYPE rsp_mux = portMUX_INITIALIZER_UNLOCKED;
+static rsp_desc_t rsp_queue[RSP_QUEUE_LEN];
+static uint8_t rsp_slot_buf[RSP_QUEUE_LEN][RSP_SLOT_LEN];
+static uint8_t* rsp_large_bufP = NULL;
+static int rsp_large_len = 0;
+static volatile bool rsp_large_in_use = false;
+static volatile uint32_t rsp_head = 0;        // Only written by producers (under rsp_mux)
+static volatile uint32_t rsp_tail = 0;        // Only written by consumer
+static volatile uint32_t rsp_drop_count = 0;
+static uint32_t rsp_prev_drop_count = 0;
+
+// Buffer plan arena (NULL when only the minimum length buffers are used)
+static uint8_t* plan_arenaP = NULL;
+static int plan_rsp_len = 0;
+
+// Broadcast frame subscriptions
+static bcast_sub_t bcast_sub[VM_MAX_BCAST_SUBS];
+static int num_bcast_sub = 0;
+
+// Request scheduler
+static sched_entry_t sched_list[VM_MAX_SCHED_REQ];
+static int sched_num_req = 0;
+static sched_outstanding_t sched_outstanding[CAN_MANAGER_MAX_SESSIONS];
+static int sched_num_outstanding = 0;
+static int sched_if_errno = CAN_ERRNO_NONE;     // Last interface error (atomic, set from driver context)
+static uint32_t sched_rsp_err_id[CAN_MANAGER_MAX_SESSIONS];  // Single requests that failed (set from driver context)
+static int sched_rsp_err[CAN_MANAGER_MAX_SESSIONS];
+static int sched_num_rsp_err = 0;
+static portMUX_TYPE sched_err_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool sched_func_done = false;   // Functional request window closed (set from driver context)
+static int sched_follow_i = -1;               // Group member to issue next (-1 = none)
+static int sched_group_lead_i = -1;           // Member that started the current group run
+static uint32_t sched_group_seq = 0;          // Group run number (0 = not in a group run)
+static uint32_t sched_group_rx_seq = 0;       // Run whose first response set the group time
+static int64_t sched_group_rx_usec = 0;
+static const vm_decoder_list_t* sched_decoder_list = NULL;
+static const can_request_t** sched_req_list = NULL;
+static int sched_num_order = 0;
+static uint8_t sched_order[VM_MAX_SCHED_REQ];
+static can_tx_desc_t sched_tx_desc[VM_MAX_SCHED_REQ];  // Passed to can_prepare_requests
+
+// Request profiles - vehicle schedule calls are recorded into sched_build_profileP while a
+// profile is being built, otherwise into sched_direct_profile and applied immediately
+static sched_profile_t sched_profile[SCHED_MAX_PROFILES];
+static sched_profile_t sched_direct_profile;
+static sched_profile_t* sched_build_profileP = NULL;
+static sched_profile_t* sched_cur_profileP = NULL;
+static const sched_cond_t* sched_cond = NULL;     // Current profile's poll conditions
+static int sched_num_cond = 0;
+static uint32_t sched_profile_seq = 0;
+
+// Streamed responses - the response IDs are checked by the producer
+static uint32_t stream_rsp_id[CAN_MANAGER_MAX_SESSIONS];
+static int num_stream_rsp_id = 0;
+static stream_state_t stream_state[CAN_MANAGER_MAX_SESSIONS];
 
-// Response
-static bool rx_data_valid = false;
-static int rx_data_len;
-static uint8_t rx_data_buf[4096];
-static uint32_t rx_id;
+// Decoder rows of the response being processed that were already published while it streamed
+static const vm_decoder_list_t* cur_stream_listP = NULL;
+static uint8_t cur_stream_rows = 0;
+
+// Receive time of the response currently being processed (0 outside of response processing)
+// and the item values decoded from it, published together once it has been processed
+static int64_t cur_rx_usec = 0;
+static db_batch_t cur_rx_batch;
+static uint32_t sched_last_req_id = 0;
+static uint32_t sched_last_rsp_id = 0;
+
+// Bus load throttle
+static bool sched_load_valid = false;
+static int64_t sched_load_msec = 0;
+static can_bus_stats_t sched_load_stats;
+static int sched_load_pct = 0;
+static int sched_gap_msec = 0;
+static int64_t sched_last_issue_msec = 0;
+
+// Constant cadence mode.  The period and item masks are read by the GUI under req_mask_mux.
+static bool sched_cadence_valid = false;
+static int64_t sched_cadence_eval_msec = 0;
+static int sched_cadence_slot_msec = 0;
+static int sched_cadence_msec = 0;            // Period (0 = mode off or not established)
+static db_mask_t sched_cadence_item_mask = 0; // Items carried by the cadence requests
+static db_mask_t sched_polled_item_mask = 0;  // Items carried by every enabled request
+
+// Freshness goal controller
+static sched_goal_t sched_goal[VM_MAX_GOALS];
+static int sched_num_goals = 0;
+static int64_t sched_goal_eval_msec = 0;
+static int sched_relax_pct = 100;             // Period scale of requests without goals
+
+// Vehicle sleep detection
+static volatile bool sched_asleep = false;
+static volatile bool sched_probe_req = false;
+static int sched_fail_run = 0;
+static int64_t sched_activity_msec = 0;
+static int64_t sched_probe_msec = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _vm_notify_task();
+static void _vm_queue_push(rsp_desc_t* templateP, uint8_t* data);
+static bool _vm_add_broadcast(uint32_t id, const vm_decoder_list_t* decoderP, const vm_signal_list_t* signalP, vehicle_rx_data fcn);
+static void _vm_process_broadcast(uint32_t id, int len, uint8_t* data);
+static void _vm_process_partial(rsp_desc_t* dP);
+static void _vm_stream_complete(uint32_t id, int req_index, int len);
+static void _vm_update_rx_id_list();
+static void _vm_sched_eval();
+static sched_profile_t* _vm_sched_get_profile(db_mask_t mask);
+static void _vm_sched_apply_profile(sched_profile_t* pP);
+static void _vm_sched_load_list(int num_req, const can_request_t** req_list, const vm_decoder_list_t decoder_list[]);
+static sched_profile_t* _vm_sched_record_profile();
+static void _vm_sched_order_add(sched_profile_t* pP, int n);
+static void _vm_sched_setup_ddid(const sched_ddid_t* dP);
+static int _vm_sched_rsp_frames(int len);
+static int _vm_sched_stale_msec(int period_msec);
+static void _vm_sched_eval_cond();
+static int _vm_sched_period(int n);
+static int _vm_sched_catalog_period(db_mask_t item_mask);
+static bool _vm_sched_ecu_busy(uint32_t rsp_id);
+static int _vm_sched_group_next(int i);
+static bool _vm_sched_issue(int n, int64_t cur_msec);
+static void _vm_sched_eval_load(int64_t cur_msec);
+static void _vm_sched_eval_cadence(int64_t cur_msec);
+static bool _vm_sched_cadence_blocks(int n, int64_t cur_msec);
+static void _vm_sched_cadence_advance(int n, int64_t cur_msec);
+static void _vm_sched_set_goals(int num, const vm_goal_t* goals);
+static void _vm_sched_map_goals();
+static void _vm_sched_eval_goals(int64_t cur_msec);
+static int _vm_sched_fresh_msec(int n);
+static bool _vm_sched_throttled(int64_t cur_msec);
+static bool _vm_sched_eval_sleep(int64_t cur_msec);
+static void _vm_sched_note_activity();
+static void _vm_sched_note_periodic_rx(uint32_t id);
+static int _vm_sched_note_response(uint32_t rsp_id, int len, uint8_t* data, int64_t rx_usec);
+static void _vm_sched_clear_outstanding(int errno);
+static void _vm_sched_abandon(int i, int errno);
+static void _vm_sched_note_latency(int n, int64_t lat_usec);
+#ifdef LOG_REQ_STATS
+static void _vm_log_req_stats();
+#endif
+static void _vm_sched_note_health(int req_index, bool success);
+static int _vm_sched_switch_cost(const can_request_t* reqP, int switch_msec);
+static int _vm_sched_expected_len(int n, int num_req, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[]);
+static int _vm_sched_num_parts(const can_request_t* reqP);
+static int _vm_sched_part_index(const can_request_t* reqP, int part, int num_req, const can_request_t* req_list[]);
+static db_mask_t _vm_sched_item_mask(int n, int num_req, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[]);
+static void _vm_sched_note_item_error(int req_index);
+static bool _vm_sched_note_nrc(int req_index, uint8_t nrc);
+static bool _vm_resp_matches(const can_request_t* reqP, uint32_t resp_can_id, int resp_data_len, uint8_t* resp_data);
+static bool _vm_rsp_id_matches(const can_request_t* reqP, uint32_t resp_can_id);
+static void _vm_plan_buffers();
+static void _vm_free_buffers();
+static int _vm_plan_rsp_len(int n, int num_req, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[]);
 
 
 
@@ -74,44 +523,227 @@ static uint32_t rx_id;
 //
 bool vm_init(const char* vehicle_name, int if_type)
 {
-	// Try to find the vehicle
+	const vehicle_config_t* configP = NULL;
+	const char* id_nameP = NULL;
+	
+	// Use the vehicle identified on an earlier boot
+	if (strcmp(vehicle_name, vehicle_auto.name) == 0) {
+		if ((id_nameP = vehicle_auto_get_cached_name()) != NULL) {
+			ESP_LOGI(TAG, "Using identified vehicle %s", id_nameP);
+			vehicle_name = id_nameP;
+		}
+	}
+	
+	// Try to find the vehicle, first in the compiled-in list then in the vehicles partition
 	for (int i=0; i<NUM_VEHICLES; i++) {
 		if (strcmp(vehicle_listP[i]->name, vehicle_name) == 0) {
-			cur_vehicleP = (vehicle_config_t*) vehicle_listP[i];
-			
-			// First, initialize the interface
-			if (can_init(if_type, cur_vehicleP->req_timeout_msec, cur_vehicleP->can_is_500k)) {
-				// Then initialize the vehicle
-				cur_vehicleP->fcn_init();
-				
-				return true;
+			configP = vehicle_listP[i];
+			break;
+		}
+	}
+	if (configP == NULL) {
+		configP = vehicle_loaded_select(vehicle_name);
+		if (configP == NULL) {
+			if (vehicle_name == id_nameP) {
+				// Identified vehicle is no longer available so identify it again
+				vehicle_auto_forget();
+				configP = &vehicle_auto;
 			} else {
 				return false;
 			}
 		}
 	}
 	
+	cur_vehicleP = (vehicle_config_t*) configP;
+	
+	// Item display ranges for this vehicle
+	db_catalog_reset_ranges();
+	for (int i=0; i<cur_vehicleP->range_list.num_ranges; i++) {
+		db_catalog_set_range(cur_vehicleP->range_list.rangeP[i].item, cur_vehicleP->range_list.rangeP[i].min, cur_vehicleP->range_list.rangeP[i].max);
+	}
+	
+	num_bcast_sub = 0;
+	can_clear_broadcasts();
+	for (int j=0; j<SCHED_MAX_PROFILES; j++) {
+		sched_profile[j].valid = false;
+	}
+	sched_cur_profileP = NULL;
+	sched_load_valid = false;
+	sched_gap_msec = 0;
+	sched_cadence_valid = false;
+	sched_cadence_msec = 0;
+	sched_relax_pct = 100;
+	sched_asleep = false;
+	sched_fail_run = 0;
+	sched_activity_msec = esp_timer_get_time() / 1000;
+	
+	// First, initialize the interface
+	if (can_init(if_type, cur_vehicleP->req_timeout_msec, cur_vehicleP->can_is_500k)) {
+		// Then initialize the vehicle
+		cur_vehicleP->fcn_init();
+		
+		// and build the profiles that don't depend on which GUI tile is shown
+		(void) _vm_sched_get_profile(0);
+		(void) _vm_sched_get_profile(VM_PERF_RUN_ITEMS & cur_vehicleP->supported_item_mask);
+		(void) _vm_sched_get_profile(db_get_derived_inputs(vm_get_supported_item_mask()));
+		
+		// Size the response buffers for the request list
+		_vm_plan_buffers();
+		
+		// Apply the request masks the GUI set before a re-init
+		portENTER_CRITICAL(&req_mask_mux);
+		update_req_mask_flag = true;
+		portEXIT_CRITICAL(&req_mask_mux);
+		
+		return true;
+	}
+	
 	return false;
 }
 
 
+// Stop the vehicle and its interface so vm_init may be called again with a different
+// vehicle or interface.  Must be called from the task running vm_eval.  Returns false if
+// the interface can only be stopped by a restart.
+bool vm_deinit()
+{
+	if (cur_vehicleP == NULL) {
+		return true;
+	}
+	
+	// cur_vehicleP is left for other tasks reading the vehicle until vm_init replaces it
+	if (!can_deinit()) {
+		return false;
+	}
+	
+	// Abandon outstanding requests and anything received for them
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		sched_outstanding[i].in_use = false;
+		stream_state[i].in_use = false;
+	}
+	sched_num_outstanding = 0;
+	__atomic_store_n(&num_stream_rsp_id, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&sched_if_errno, CAN_ERRNO_NONE, __ATOMIC_RELEASE);
+	sched_func_done = false;
+	portENTER_CRITICAL_SAFE(&rsp_mux);
+	__atomic_store_n(&rsp_tail, rsp_head, __ATOMIC_RELEASE);
+	rsp_large_in_use = false;
+	portEXIT_CRITICAL_SAFE(&rsp_mux);
+	_vm_free_buffers();
+	
+	// The vehicle's request list is loaded again by its init
+	sched_num_req = 0;
+	sched_req_list = NULL;
+	sched_decoder_list = NULL;
+	sched_follow_i = -1;
+	sched_group_lead_i = -1;
+	sched_group_seq = 0;
+	sched_direct_profile.valid = false;
+	
+	return true;
+}
+
+
 void vm_eval()
 {
+	rsp_desc_t* dP;
+	sched_profile_t* pP;
+	bool mask_updated;
+	bool goals_updated;
+	db_mask_t mask;
+	int num_goals = 0;
+	vm_goal_t goals[VM_MAX_GOALS];
+	int n;
+	uint32_t t;
+	
 	if (cur_vehicleP != NULL) {
-		// Process any received data
-		if (rx_data_valid) {
-			cur_vehicleP->fcn_rx_data(rx_id, rx_data_len, rx_data_buf);
-			rx_data_valid = false;
+		// Process all received data
+		t = rsp_tail;
+		while (t != __atomic_load_n(&rsp_head, __ATOMIC_ACQUIRE)) {
+			dP = &rsp_queue[t & RSP_QUEUE_MASK];
+			cur_rx_usec = dP->rx_usec;
+			db_batch_begin(&cur_rx_batch);
+#ifdef DB_LATENCY_TRACE
+			if (!dP->is_bcast && !dP->is_partial) {
+				db_lat_note(DB_LAT_STAGE_VM, dP->rx_usec);
+			}
+#endif
+			if (dP->is_bcast) {
+				_vm_process_broadcast(dP->id, dP->len, dP->dataP);
+			} else if (dP->is_partial) {
+				_vm_process_partial(dP);
+			} else {
+				n = _vm_sched_note_response(dP->id, dP->len, dP->dataP, dP->rx_usec);
+				_vm_stream_complete(dP->id, n, dP->len);
+				if ((n >= 0) && sched_list[n].group_ts && (sched_list[n].group_seq != 0)) {
+					// Later responses of a group run take the time of its first
+					if (sched_list[n].group_seq == sched_group_rx_seq) {
+						cur_rx_usec = sched_group_rx_usec;
+					} else {
+						sched_group_rx_seq = sched_list[n].group_seq;
+						sched_group_rx_usec = cur_rx_usec;
+					}
+				}
+				if (n >= 0) {
+					cur_vehicleP->fcn_rx_data(dP->id, n, dP->len, dP->dataP);
+				}
+				cur_stream_listP = NULL;
+			}
+			db_batch_commit(&cur_rx_batch);
+			if (dP->dataP == rsp_large_bufP) {
+				rsp_large_in_use = false;
+			}
+			t += 1;
+			__atomic_store_n(&rsp_tail, t, __ATOMIC_RELEASE);
+		}
+		cur_rx_usec = 0;
+		deadline_phase(DEADLINE_LOOP_CAN, DEADLINE_PHASE_SCHED);
+		
+		if (rsp_drop_count != rsp_prev_drop_count) {
+			rsp_prev_drop_count = rsp_drop_count;
+			ESP_LOGW(TAG, "Dropped responses: %lu", rsp_prev_drop_count);
 		}
 		
 		// Look for updated request mask
-		if (update_req_mask_flag) {
-			update_req_mask_flag = false;
-			cur_vehicleP->fcn_set_req_mask(new_req_mask);
+		portENTER_CRITICAL(&req_mask_mux);
+		mask_updated = update_req_mask_flag;
+		update_req_mask_flag = false;
+		mask = new_req_mask | prefetch_req_mask | background_req_mask;
+		goals_updated = update_goals_flag;
+		update_goals_flag = false;
+		if (goals_updated) {
+			num_goals = new_num_goals;
+			memcpy(goals, new_goals, num_goals * sizeof(vm_goal_t));
+		}
+		portEXIT_CRITICAL(&req_mask_mux);
+		if (mask_updated) {
+			if (req_profile == VM_PROFILE_PERF_RUN) {
+				pP = _vm_sched_get_profile(VM_PERF_RUN_ITEMS & cur_vehicleP->supported_item_mask);
+			} else if (req_profile == VM_PROFILE_CHARGING) {
+				pP = _vm_sched_get_profile(VM_CHARGE_ITEMS & cur_vehicleP->supported_item_mask);
+			} else {
+				pP = _vm_sched_get_profile(mask);
+			}
+			if (pP != NULL) {
+				_vm_sched_apply_profile(pP);
+			}
+		}
+		if (goals_updated) {
+			_vm_sched_set_goals(num_goals, goals);
+		}
+		
+		// Then allow the vehicle to evaluate (requests are issued by the scheduler so most
+		// vehicles have nothing to do)
+		if (cur_vehicleP->fcn_eval != NULL) {
+			cur_vehicleP->fcn_eval();
 		}
 		
-		// Then allow the vehicle to evaluate
-		cur_vehicleP->fcn_eval();
+		// And send any requests that are due
+		_vm_sched_eval();
+		
+#ifdef LOG_REQ_STATS
+		_vm_log_req_stats();
+#endif
 	}
 }
 
@@ -119,148 +751,2741 @@ void vm_eval()
 // Returns -1 for no match
 int vm_get_resp_index(uint32_t resp_can_id, int resp_data_len, uint8_t* resp_data, int req_list_len, const can_request_t* req_list[])
 {
-	bool match;
-	int i, j;
-	int n;
+	// Look for a match in the list of requests
+	for (int i=0; i<req_list_len; i++) {
+		if (_vm_resp_matches(req_list[i], resp_can_id, resp_data_len, resp_data)) {
+			return i;
+		}
+	}
 	
-	// Must at least have a UDS packet length (byte 0) and service ID (byte 1)
-	if (resp_data_len < 2) {
-		return -1;
+	return -1;
+}
+
+
+// Runs the decoder rows for a response, updating any associated data items and storing
+// each decoded value in vals (which must hold VM_MAX_DECODE_VALS entries).  Values for rows
+// that could not be decoded are left unchanged.  Returns the number of rows decoded (length
+// only rows are skipped).  Items already published while the response streamed in are not
+// updated again.
+int vm_decode_response(const vm_decoder_list_t* listP, int len, uint8_t* data, float* vals)
+{
+	const vm_decoder_t* rP;
+	int n = 0;
+	int shift;
+	uint32_t u32;
+	float f;
+	
+	for (int i=0; i<listP->num_rows && i<VM_MAX_DECODE_VALS; i++) {
+		rP = &listP->rowP[i];
+		
+		if (rP->width == 0) continue;
+		if ((rP->rsp_len != 0) && (len != rP->rsp_len)) continue;
+		if ((rP->byte_offset + rP->width) > len) continue;
+		
+		u32 = 0;
+		for (int j=0; j<rP->width; j++) {
+			u32 = (u32 << 8) | data[rP->byte_offset + j];
+		}
+		
+		if (rP->is_signed) {
+			shift = 32 - 8*rP->width;
+			f = (float) (((int32_t) (u32 << shift)) >> shift);
+		} else {
+			f = (float) u32;
+		}
+		f = f * rP->scale + rP->offset;
+		
+		vals[i] = f;
+		if ((rP->db_item != DB_ITEM_NONE) && ((listP != cur_stream_listP) || ((cur_stream_rows & (1 << i)) == 0))) {
+			vm_update_data_item(rP->db_item, f);
+		}
+		n += 1;
 	}
 	
-	// Must not be a negative response
-	if (resp_data[0] == 0x7F) {
-		return -1;
+	return n;
+}
+
+
+// Decode the signals of a broadcast frame in one pass: the frame is loaded into its Intel
+// (little-endian) and Motorola (big-endian) 64-bit words once and each signal is then a
+// shift and mask.  Signals beyond the end of a short frame are skipped.  Returns the number
+// of values decoded.
+int vm_decode_signals(const vm_signal_list_t* listP, int len, const uint8_t* data, float* vals)
+{
+	const vm_signal_t* sP;
+	int n = 0;
+	uint32_t raw;
+	uint64_t le = 0;
+	uint64_t be = 0;
+	float f;
+	
+	if (len > 8) len = 8;
+	for (int j=0; j<8; j++) {
+		raw = (j < len) ? data[j] : 0;
+		le |= (uint64_t) raw << (8*j);
+		be = (be << 8) | raw;
 	}
 	
-	// Look for a match in the list of requests
-	for (i=0; i<req_list_len; i++) {
-		// Check CAN ID and SID
-		match = (resp_can_id == req_list[i]->rsp_id) && (resp_data[0] == (req_list[i]->data[1] + 0x40));
-		
-		// Check remaining request bytes
-		if (match) {
-			if (resp_data_len <= req_list[i]->data[0]) {
-				// Not enough incoming data to even check against original request
-				match = false;
-			} else {
-				n = req_list[i]->data[0] - 1;  // Count of additional subfunction/DID bytes in request (beyond SID)
-				j = 2;
-				while (n--) {
-					match &= (resp_data[j-1] == req_list[i]->data[j]);
-					j += 1;
-				}
+	for (int i=0; i<listP->num_signals && i<VM_MAX_SIGNALS; i++) {
+		sP = &listP->sigP[i];
+		
+		if (sP->min_len > len) continue;
+		
+		raw = (uint32_t) ((((sP->flags & VM_SIG_MOTOROLA) != 0) ? be : le) >> sP->shift) & sP->mask;
+		if ((sP->flags & VM_SIG_SIGNED) != 0) {
+			if ((raw & ~(sP->mask >> 1)) != 0) {
+				// Sign extend
+				raw |= ~sP->mask;
 			}
+			f = (float) ((int32_t) raw);
+		} else {
+			f = (float) raw;
 		}
+		f = f * sP->scale + sP->offset;
 		
-		if (match) {
-			return i;
+		vals[i] = f;
+		if (sP->db_item != DB_ITEM_NONE) {
+			vm_update_data_item(sP->db_item, f);
 		}
+		n += 1;
 	}
 	
+	return n;
+}
+
+
+// Splits the response to a multi-DID 0x22 request into individual single-DID responses
+// and passes each to fcn with the index of the corresponding single-DID request.  The
+// length of each DID's data is taken from the expected length of its decoder.
+void vm_split_multi_did_response(uint32_t id, int len, uint8_t* data, const vm_did_group_t* groupP, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[], vehicle_rx_data fcn)
+{
+	const can_request_t* reqP;
+	int n;
+	int part_len;
+	int pos = 1;                // Skip response SID
+	uint8_t buf[RSP_SLOT_LEN];
+	
+	for (int i=0; i<groupP->num_parts; i++) {
+		n = groupP->part_indexP[i];
+		reqP = req_list[n];
+		
+		if ((decoder_list[n].num_rows == 0) || (decoder_list[n].rowP[0].rsp_len == 0)) {
+			ESP_LOGE(TAG, "Multi-DID part %d has unknown length", n);
+			return;
+		}
+		part_len = decoder_list[n].rowP[0].rsp_len;   // Includes SID and DID
+		if ((part_len > RSP_SLOT_LEN) || ((pos + part_len - 1) > len)) {
+			return;
+		}
+		
+		// Each part starts with the DID
+		if ((data[pos] != reqP->data[2]) || (data[pos+1] != reqP->data[3])) {
+			return;
+		}
+		
+		buf[0] = data[0];
+		memcpy(&buf[1], &data[pos], part_len - 1);
+		fcn(id, n, part_len, buf);
+		
+		pos += part_len - 1;
+	}
+}
+
+
+// Splits the response to a multi-PID OBD-II Mode 01 request (the SID followed by each PID
+// and its data) into single-PID responses and passes each to fcn with the index of the
+// corresponding single-PID request.  ECUs may answer the PIDs in any order so each is
+// found by its PID.  The length of each PID's data is taken from the expected length of
+// its decoder.
+void vm_split_multi_pid_response(uint32_t id, int len, uint8_t* data, const vm_did_group_t* groupP, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[], vehicle_rx_data fcn)
+{
+	int n;
+	int part_len;
+	int pos = 1;                // Skip response SID
+	uint8_t buf[RSP_SLOT_LEN];
 	
-	return -1;
+	while (pos < len) {
+		n = -1;
+		for (int i=0; i<groupP->num_parts; i++) {
+			if (req_list[groupP->part_indexP[i]]->data[2] == data[pos]) {
+				n = groupP->part_indexP[i];
+				break;
+			}
+		}
+		if (n < 0) {
+			// Not one of ours (or padding) so the rest can't be located
+			return;
+		}
+		
+		if ((decoder_list[n].num_rows == 0) || (decoder_list[n].rowP[0].rsp_len == 0)) {
+			ESP_LOGE(TAG, "Multi-PID part %d has unknown length", n);
+			return;
+		}
+		part_len = decoder_list[n].rowP[0].rsp_len;   // Includes SID and PID
+		if ((part_len > RSP_SLOT_LEN) || ((pos + part_len - 1) > len)) {
+			return;
+		}
+		
+		buf[0] = data[0];
+		memcpy(&buf[1], &data[pos], part_len - 1);
+		fcn(id, n, part_len, buf);
+		
+		pos += part_len - 1;
+	}
+}
+
+
+// Splits the response to a dynamically defined DID read into single-DID responses for
+// each source DID and passes each to fcn with the index of the corresponding single-DID
+// request.  The response holds only the source DIDs' data records, each the length its
+// decoder expects less the SID and DID.
+void vm_split_ddid_response(uint32_t id, int len, uint8_t* data, const vm_did_group_t* groupP, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[], vehicle_rx_data fcn)
+{
+	const can_request_t* reqP;
+	int n;
+	int part_len;
+	int pos = 3;                // Skip response SID and dynamic DID
+	uint8_t buf[RSP_SLOT_LEN];
+	
+	for (int i=0; i<groupP->num_parts; i++) {
+		n = groupP->part_indexP[i];
+		reqP = req_list[n];
+		
+		if ((decoder_list[n].num_rows == 0) || (decoder_list[n].rowP[0].rsp_len < 3)) {
+			ESP_LOGE(TAG, "Dynamic DID part %d has unknown length", n);
+			return;
+		}
+		part_len = decoder_list[n].rowP[0].rsp_len;   // Includes SID and DID
+		if ((part_len > RSP_SLOT_LEN) || ((pos + part_len - 3) > len)) {
+			return;
+		}
+		
+		buf[0] = data[0];
+		buf[1] = reqP->data[2];
+		buf[2] = reqP->data[3];
+		memcpy(&buf[3], &data[pos], part_len - 3);
+		fcn(id, n, part_len, buf);
+		
+		pos += part_len - 3;
+	}
+}
+
+
+// Items set while processing a response are timestamped with the time it was received and
+// published together when the vehicle has finished with the response
+void vm_update_data_item(int item, float val)
+{
+	if (cur_rx_usec != 0) {
+		db_batch_add(&cur_rx_batch, item, val, cur_rx_usec);
+	} else {
+		db_set_data_item_value(item, val);
+	}
 }
 
 
-void vm_update_data_item(uint32_t mask, float val)
+// Cell arrays are stamped with the time of the response that completed them
+void vm_update_cell_array(int array, int num, const int16_t* vals)
 {
-	db_set_data_item_value(mask, val);
+	db_set_cell_array(array, num, vals, (cur_rx_usec != 0) ? cur_rx_usec : esp_timer_get_time());
 }
 
 
-bool vm_mask_check(uint32_t req_mask, uint32_t mask_list)
+bool vm_mask_check(db_mask_t req_mask, db_mask_t mask_list)
 {
 	return (req_mask & mask_list) != 0;
 }
 
 
-// May be called from within an ISR context so we copy data to a local buffer
-// for processing by a task later
-void vm_rx_data(uint32_t id, int len, uint8_t* data)
+// Called by a vehicle (from its fcn_set_req_mask) to specify its full set of requests and
+// which of them the scheduler should issue (bit n of enable_mask enables req_list[n]).
+// Responses are passed back to the vehicle with the index of the matching request.  The
+// expected response lengths of the decoders in decoder_list (one per request, may be NULL)
+// tell the interface how many frames to wait for.  The schedule is recorded as the profile
+// for the item mask being built and a request that stays enabled across a profile change
+// keeps its timing.
+void vm_sched_set_request_list(int num_req, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[], uint32_t enable_mask)
+{
+	sched_profile_t* pP = _vm_sched_record_profile();
+	
+	if (num_req > VM_MAX_SCHED_REQ) {
+		ESP_LOGE(TAG, "Too many requests %d - truncating", num_req);
+		num_req = VM_MAX_SCHED_REQ;
+	}
+	
+	pP->num_req = num_req;
+	pP->req_list = req_list;
+	pP->decoder_list = decoder_list;
+	pP->enable_mask = enable_mask;
+	pP->stream_mask = 0;
+	pP->group_ts_mask = 0;
+	pP->num_ddid = 0;
+	pP->num_periodic = 0;
+	pP->num_cond = 0;
+	for (int i=0; i<VM_MAX_SCHED_REQ; i++) {
+		pP->group_next[i] = -1;
+	}
+	
+	pP->num_order = 0;
+	for (int i=0; i<num_req; i++) {
+		if ((enable_mask & (1UL << i)) != 0) {
+			_vm_sched_order_add(pP, i);
+		}
+	}
+	
+	if (pP == &sched_direct_profile) {
+		_vm_sched_apply_profile(pP);
+	}
+}
+
+
+// Hint that two requests carry data that is combined (e.g. HV voltage and current for power)
+// so whichever is issued is followed immediately by the other, keeping their samples close
+// together in time.  Must be called after vm_sched_set_request_list().
+void vm_sched_pair_requests(int req_a, int req_b)
+{
+	const int req_pair[2] = {req_a, req_b};
+	
+	vm_sched_group_requests(2, req_pair, false);
+}
+
+
+// Sample a group of requests back-to-back: whichever member is issued is followed by the
+// rest in turn as their ECUs become free (members still each have their own period).  With
+// shared_ts the values of all the group's responses are given the receive time of the first
+// so items acquired by different requests (e.g. front and rear motor torque) are seen as
+// one sample.  A request may only belong to one group.  Must be called after
+// vm_sched_set_request_list().
+void vm_sched_group_requests(int num, const int* req_list, bool shared_ts)
 {
-	if ((cur_vehicleP != NULL) && (!rx_data_valid)) {
-		rx_id = id;
-		rx_data_len = len;
-		memcpy(rx_data_buf, data, (size_t) len);
-		rx_data_valid = true;
+	sched_profile_t* pP = _vm_sched_record_profile();
+	int n;
+	
+	if (num < 2) return;
+	for (int i=0; i<num; i++) {
+		n = req_list[i];
+		if ((n < 0) || (n >= pP->num_req) || (pP->group_next[n] >= 0)) {
+			ESP_LOGE(TAG, "Cannot group request %d", n);
+			return;
+		}
+		for (int j=0; j<i; j++) {
+			if (req_list[j] == n) return;
+		}
+	}
+	
+	// Members form a ring so any of them can lead
+	for (int i=0; i<num; i++) {
+		n = req_list[i];
+		pP->group_next[n] = req_list[(i + 1) % num];
+		if (shared_ts) {
+			pP->group_ts_mask |= 1UL << n;
+		}
+	}
+	
+	if (pP == &sched_direct_profile) {
+		_vm_sched_apply_profile(pP);
 	}
 }
 
 
-void vm_note_error(int errno)
+// Publish the decoder rows of a long multi-frame response as soon as their bytes arrive
+// instead of when the complete response has been received.  Rows with a DB_ITEM_NONE item
+// are still only seen by the vehicle when the response completes.  Must be called after
+// vm_sched_set_request_list().
+void vm_sched_enable_streaming(int req_index)
 {
-	if (cur_vehicleP != NULL) {
-		cur_vehicleP->fcn_note_can_error(errno);
+	sched_profile_t* pP = _vm_sched_record_profile();
+	
+	if ((req_index < 0) || (req_index >= pP->num_req) || (pP->decoder_list == NULL)) {
+		return;
+	}
+	
+	pP->stream_mask |= (1UL << req_index);
+	
+	if (pP == &sched_direct_profile) {
+		_vm_sched_apply_profile(pP);
 	}
 }
 
 
-int vm_get_num_vehicles()
+// Read a group of DIDs from one ECU as a single dynamically defined DID.  read_index is the
+// 0x22 request for the dynamic DID and define_index its 0x2C defineByIdentifier request
+// (each source DID's complete data record, in groupP order), which is not enabled itself -
+// the scheduler issues it before the first read.  If the ECU refuses the definition the
+// requests in fallback_mask (bit n for request n) are scheduled instead.  Must be called
+// after vm_sched_set_request_list().
+void vm_sched_define_ddid(int read_index, int define_index, const vm_did_group_t* groupP, uint32_t fallback_mask)
 {
-	return NUM_VEHICLES;
+	sched_profile_t* pP = _vm_sched_record_profile();
+	sched_ddid_t* dP;
+	
+	if ((read_index < 0) || (read_index >= pP->num_req) || (define_index < 0) || (define_index >= pP->num_req) ||
+	    (read_index == define_index) || (pP->num_ddid >= VM_MAX_DDID)) {
+		return;
+	}
+	
+	dP = &pP->ddid[pP->num_ddid++];
+	dP->read_index = read_index;
+	dP->define_index = define_index;
+	dP->groupP = groupP;
+	dP->fallback_mask = fallback_mask;
+	
+	// The fallback requests must be visited by the scheduler should they be enabled
+	for (int i=0; i<pP->num_req; i++) {
+		if ((fallback_mask & (1UL << i)) != 0) {
+			_vm_sched_order_add(pP, i);
+		}
+	}
+	
+	if (pP == &sched_direct_profile) {
+		_vm_sched_apply_profile(pP);
+	}
 }
 
 
-const char* vm_get_vehicle_name(int n)
+// Have an ECU transmit data periodically (UDS 0x2A ReadDataByPeriodicIdentifier) instead
+// of polling it.  start_index is the (enabled) request starting transmission at the rate
+// given by its transmission mode.  Its period is the expected interval between periodic
+// frames and its decoder list the decoder for them.  stop_index is the (not enabled) stop
+// request, sent when the schedule no longer needs the data.  The periodic frames arrive on
+// periodic_id (which must not be a response ID), subscribed to by the vehicle with
+// vm_subscribe_broadcast() in its fcn_init.
+// If the ECU refuses to start, the requests in fallback_mask (bit n for request n) are
+// scheduled instead.  Must be called after vm_sched_set_request_list().
+void vm_sched_enable_periodic(int start_index, int stop_index, uint32_t periodic_id, uint32_t fallback_mask)
 {
-	if ((n >= 0) && (n < NUM_VEHICLES)) {
-		return vehicle_listP[n]->name;
+	sched_profile_t* pP = _vm_sched_record_profile();
+	sched_periodic_t* tP;
+	
+	if ((start_index < 0) || (start_index >= pP->num_req) || (stop_index < 0) || (stop_index >= pP->num_req) ||
+	    (start_index == stop_index) || (pP->num_periodic >= VM_MAX_PERIODIC)) {
+		return;
+	}
+	
+	tP = &pP->periodic[pP->num_periodic++];
+	tP->start_index = start_index;
+	tP->stop_index = stop_index;
+	tP->periodic_id = periodic_id;
+	tP->fallback_mask = fallback_mask;
+	
+	for (int i=0; i<pP->num_req; i++) {
+		if ((fallback_mask & (1UL << i)) != 0) {
+			_vm_sched_order_add(pP, i);
+		}
 	}
 	
-	return NULL;
+	if (pP == &sched_direct_profile) {
+		_vm_sched_apply_profile(pP);
+	}
 }
 
 
-uint32_t vm_get_supported_item_mask()
+// Only poll a request at its own period while a data broker item is within [min, max]
+// (e.g. gear position only while nearly stopped).  Otherwise it is polled every
+// alt_period_msec, or not at all if that is 0.  The request is polled normally while the
+// item has no fresh value.  Must be called after vm_sched_set_request_list().
+void vm_sched_set_condition(int req_index, int item, float min, float max, int alt_period_msec)
 {
-	if (cur_vehicleP != NULL) {
-		return cur_vehicleP->supported_item_mask;
+	sched_profile_t* pP = _vm_sched_record_profile();
+	sched_cond_t* cP;
+	
+	if ((req_index < 0) || (req_index >= pP->num_req) || (item <= DB_ITEM_NONE) || (item >= DB_NUM_ITEMS) ||
+	    (pP->num_cond >= VM_MAX_SCHED_COND)) {
+		return;
 	}
 	
-	return 0;
+	cP = &pP->cond[pP->num_cond++];
+	cP->req_index = req_index;
+	cP->item = item;
+	cP->min = min;
+	cP->max = max;
+	cP->alt_period_msec = alt_period_msec;
+	
+	if (pP == &sched_direct_profile) {
+		_vm_sched_apply_profile(pP);
+	}
 }
 
 
-void vm_set_request_item_mask(uint32_t mask)
+// Called by a vehicle (while processing a response, from vm_eval) when the requests its
+// fcn_set_req_mask would choose or the contents of its request list have changed (e.g. it
+// found out what the ECU supports).  The recorded profiles are discarded and the current
+// item mask's profile is built again, reloading the request list.
+void vm_sched_rebuild_profiles()
 {
-	new_req_mask = mask;
+	for (int i=0; i<SCHED_MAX_PROFILES; i++) {
+		sched_profile[i].valid = false;
+	}
+	sched_req_list = NULL;
+	
+	portENTER_CRITICAL(&req_mask_mux);
 	update_req_mask_flag = true;
+	portEXIT_CRITICAL(&req_mask_mux);
 }
 
 
-bool vm_get_range(int index, float* min, float* max)
+// May be called from within an ISR context so we copy data into the response queue
+// for processing by a task later
+void vm_rx_data(uint32_t id, int len, uint8_t* data, int64_t rx_usec)
 {
-	bool success = true;
+	rsp_desc_t desc = {.id = id, .is_bcast = false, .is_partial = false, .len = len, .rx_usec = rx_usec};
 	
-	if (cur_vehicleP != NULL) {
-		switch (index) {
-			case VM_RANGE_POWER:
-				*min = cur_vehicleP->power_kw_range.min;
-				*max = cur_vehicleP->power_kw_range.max;
-				break;
-			case VM_RANGE_AUX:
-				*min = cur_vehicleP->aux_kw_range.min;
-				*max = cur_vehicleP->aux_kw_range.max;
-				break;
-			case VM_RANGE_TORQUE:
-				*min = cur_vehicleP->torque_nm_range.min;
-				*max = cur_vehicleP->torque_nm_range.max;
-				break;
-			case VM_RANGE_HV_BATTI:
-				*min = cur_vehicleP->hv_batt_i_range.min;
-				*max = cur_vehicleP->hv_batt_i_range.max;
-				break;
-			case VM_RANGE_LV_BATTV:
-				*min = cur_vehicleP->lv_batt_v_range.min;
-				*max = cur_vehicleP->lv_batt_v_range.max;
-				break;
-			default:
-				success = false;
+	_vm_queue_push(&desc, data);
+}
+
+
+// May be called from within an ISR context
+void vm_rx_broadcast(uint32_t id, int len, uint8_t* data, int64_t rx_usec)
+{
+	rsp_desc_t desc = {.id = id, .is_bcast = true, .is_partial = false, .len = len, .rx_usec = rx_usec};
+	
+	_vm_queue_push(&desc, data);
+}
+
+
+// Chunk of an incomplete multi-frame response (data holds len bytes starting at offset).
+// Only queued for responses that may be streamed.  May be called from within an ISR context.
+void vm_rx_partial(uint32_t id, int offset, int total_len, int len, uint8_t* data, int64_t rx_usec)
+{
+	int n;
+	bool found = false;
+	rsp_desc_t desc = {.id = id, .is_bcast = false, .is_partial = true, .offset = offset, .total_len = total_len, .len = len, .rx_usec = rx_usec};
+	
+	if ((offset + len) > STREAM_WIN_LEN) return;
+	
+	n = __atomic_load_n(&num_stream_rsp_id, __ATOMIC_ACQUIRE);
+	for (int i=0; i<n; i++) {
+		if (stream_rsp_id[i] == id) {
+			found = true;
+			break;
+		}
+	}
+	if (!found) return;
+	
+	// Best effort - keep room for complete responses
+	if ((rsp_head - __atomic_load_n(&rsp_tail, __ATOMIC_ACQUIRE)) >= (RSP_QUEUE_LEN - STREAM_QUEUE_RESERVE)) {
+		return;
+	}
+	
+	_vm_queue_push(&desc, data);
+}
+
+
+// Subscribe to a periodic broadcast frame.  Received frames are run through the (optional)
+// decoder list and then passed to the (optional) fcn with a req_index of -1.  Decoder
+// offsets are relative to the start of the CAN frame data.  Should be called from the
+// vehicle's fcn_init.
+bool vm_subscribe_broadcast(uint32_t id, const vm_decoder_list_t* decoderP, vehicle_rx_data fcn)
+{
+	return _vm_add_broadcast(id, decoderP, NULL, fcn);
+}
+
+
+// Subscribe to a periodic broadcast frame carrying bit-level signals.  Received frames are
+// run through vm_decode_signals() and then passed to the (optional) fcn with a req_index
+// of -1.  Should be called from the vehicle's fcn_init.
+bool vm_subscribe_signals(uint32_t id, const vm_signal_list_t* signalP, vehicle_rx_data fcn)
+{
+	return _vm_add_broadcast(id, NULL, signalP, fcn);
+}
+
+
+// May be called from within an ISR context (e.g. timer callback).  The error is handled,
+// and passed to the vehicle, by vm_eval.
+void vm_note_error(int errno)
+{
+	if ((cur_vehicleP != NULL) && (errno != CAN_ERRNO_NONE)) {
+		// The CAN manager abandons all outstanding requests on an interface error
+		__atomic_store_n(&sched_if_errno, errno, __ATOMIC_RELEASE);
+		_vm_notify_task();
+	}
+}
+
+
+// The request to rsp_id failed and was abandoned by an interface that has other requests
+// outstanding (the ELM327 pair).  May be called from within an ISR context.
+void vm_note_rsp_error(uint32_t rsp_id, int errno)
+{
+	if ((cur_vehicleP != NULL) && (errno != CAN_ERRNO_NONE)) {
+		portENTER_CRITICAL_SAFE(&sched_err_mux);
+		if (sched_num_rsp_err < CAN_MANAGER_MAX_SESSIONS) {
+			sched_rsp_err_id[sched_num_rsp_err] = rsp_id;
+			sched_rsp_err[sched_num_rsp_err] = errno;
+			sched_num_rsp_err += 1;
+		} else {
+			// Can't happen with one entry per session but abandoning everything is safe
+			__atomic_store_n(&sched_if_errno, errno, __ATOMIC_RELEASE);
+		}
+		portEXIT_CRITICAL_SAFE(&sched_err_mux);
+		_vm_notify_task();
+	}
+}
+
+
+// The response window of a functional request closed after at least one ECU answered.
+// May be called from within an ISR context (e.g. timer callback).
+void vm_rx_functional_done()
+{
+	if (cur_vehicleP != NULL) {
+		sched_func_done = true;
+		_vm_notify_task();
+	}
+}
+
+
+void vm_set_notify_task(TaskHandle_t task)
+{
+	notify_task = task;
+}
+
+
+int vm_get_num_vehicles()
+{
+	return NUM_VEHICLES + vehicle_loaded_get_num();
+}
+
+
+const char* vm_get_vehicle_name(int n)
+{
+	if ((n >= 0) && (n < NUM_VEHICLES)) {
+		return vehicle_listP[n]->name;
+	}
+	
+	// Loaded vehicles follow the compiled-in list
+	return vehicle_loaded_get_name(n - NUM_VEHICLES);
+}
+
+
+// Discard the vehicle identified by the auto-detect vehicle so it is identified again
+void vm_forget_identified_vehicle()
+{
+	vehicle_auto_forget();
+}
+
+
+db_mask_t vm_get_supported_item_mask()
+{
+	if (cur_vehicleP != NULL) {
+		// Include items the data broker can derive from the vehicle's items and those
+		// from on-board sensors
+		return cur_vehicleP->supported_item_mask | db_get_local_items() |
+		       db_get_derived_outputs(cur_vehicleP->supported_item_mask | db_get_local_items());
+	}
+	
+	return db_get_local_items();
+}
+
+
+// True while the vehicle appears to be off (only probed occasionally)
+bool vm_is_asleep()
+{
+	return sched_asleep;
+}
+
+
+// Probe a sleeping vehicle on the next evaluation (e.g. the user touched the display)
+void vm_wake_probe()
+{
+	if (sched_asleep) {
+		sched_probe_req = true;
+		_vm_notify_task();
+	}
+}
+
+
+// Number of scheduled requests and how many of those are backed off because they are
+// not being answered (e.g. ECU asleep)
+void vm_get_request_health(int* num_req, int* num_backoff)
+{
+	int n = 0;
+	
+	for (int i=0; i<sched_num_req; i++) {
+		if (sched_list[i].backoff_msec != 0) n++;
+	}
+	
+	*num_req = sched_num_req;
+	*num_backoff = n;
+}
+
+
+// Copy the statistics for scheduled request n.  Returns false if n is not a scheduled request.
+bool vm_get_request_stats(int n, vm_req_stats_t* statsP)
+{
+	if ((n < 0) || (n >= sched_num_req)) {
+		return false;
+	}
+	
+	*statsP = sched_list[n].stats;
+	return true;
+}
+
+
+// Returns the upper edge of the histogram bin (mSec) containing the specified percentile
+// of response latencies, 0 if there are no responses
+uint32_t vm_get_latency_percentile(const vm_req_stats_t* statsP, int percent)
+{
+	uint32_t sum = 0;
+	uint32_t target;
+	
+	if (statsP->num_rsp == 0) {
+		return 0;
+	}
+	
+	target = (statsP->num_rsp * percent + 99) / 100;
+	for (int i=0; i<VM_LAT_HIST_BINS; i++) {
+		sum += statsP->lat_hist[i];
+		if (sum >= target) {
+			return (i < (VM_LAT_HIST_BINS-1)) ? (1UL << i) : (statsP->lat_max_usec / 1000);
+		}
+	}
+	
+	return statsP->lat_max_usec / 1000;
+}
+
+
+void vm_set_request_item_mask(db_mask_t mask)
+{
+	// The vehicle only knows how to request its own items so request the inputs of derived items
+	mask = db_get_derived_inputs(mask);
+	portENTER_CRITICAL(&req_mask_mux);
+	new_req_mask = mask;
+	update_req_mask_flag = true;
+	new_num_goals = 0;
+	update_goals_flag = true;
+	portEXIT_CRITICAL(&req_mask_mux);
+	_vm_notify_task();
+}
+
+
+// Also request the items of a GUI tile that is about to be displayed (e.g. while the user
+// swipes toward it) so it has current data when it is activated.  A mask of 0 ends the prefetch.
+void vm_set_request_prefetch_mask(db_mask_t mask)
+{
+	mask = (mask != 0) ? db_get_derived_inputs(mask) : 0;
+	portENTER_CRITICAL(&req_mask_mux);
+	prefetch_req_mask = mask;
+	update_req_mask_flag = true;
+	portEXIT_CRITICAL(&req_mask_mux);
+	_vm_notify_task();
+}
+
+
+// Items requested independent of the tiles' masks so the GUI can watch the vehicle's state.
+// Only used in the normal profile.
+void vm_set_request_background_mask(db_mask_t mask)
+{
+	mask = (mask != 0) ? db_get_derived_inputs(mask) : 0;
+	portENTER_CRITICAL(&req_mask_mux);
+	background_req_mask = mask;
+	update_req_mask_flag = true;
+	portEXIT_CRITICAL(&req_mask_mux);
+	_vm_notify_task();
+}
+
+
+// Freshness goals for the items of the displayed tile (NULL for none).  Goals are cleared by
+// vm_set_request_item_mask() so a tile sets its goals after its mask.  Goals for items no
+// request produces (e.g. the IMU's) are measured and reported but can't be controlled.
+void vm_set_request_goals(const vm_goal_list_t* listP)
+{
+	int n = 0;
+	
+	portENTER_CRITICAL(&req_mask_mux);
+	if (listP != NULL) {
+		n = (listP->num_goals < VM_MAX_GOALS) ? listP->num_goals : VM_MAX_GOALS;
+		memcpy(new_goals, listP->goalP, n * sizeof(vm_goal_t));
+	}
+	new_num_goals = n;
+	update_goals_flag = true;
+	portEXIT_CRITICAL(&req_mask_mux);
+	_vm_notify_task();
+}
+
+
+// Goals missed in the last evaluation (goals without data yet are not counted) and the
+// period scale applied to requests without goals
+void vm_get_goal_health(int* num_goals, int* num_unmet, int* relax_pct)
+{
+	int n = 0;
+	
+	for (int i=0; i<sched_num_goals; i++) {
+		if ((sched_goal[i].stats.age_msec >= 0) && !sched_goal[i].stats.met) n++;
+	}
+	
+	*num_goals = sched_num_goals;
+	*num_unmet = n;
+	*relax_pct = sched_relax_pct;
+}
+
+
+// Copy the state of freshness goal n.  Returns false if n is not a current goal.
+bool vm_get_goal_stats(int n, vm_goal_stats_t* statsP)
+{
+	if ((n < 0) || (n >= sched_num_goals)) {
+		return false;
+	}
+	
+	*statsP = sched_goal[n].stats;
+	return true;
+}
+
+
+// Period the items in mask are sampled at in constant cadence mode, 0 if they aren't all
+// carried by cadence requests (items no request carries are ignored).  For GUI animations.
+int vm_get_cadence_msec(db_mask_t mask)
+{
+	db_mask_t cadence_mask;
+	db_mask_t polled_mask;
+	int msec;
+	
+	mask = db_get_derived_inputs(mask);
+	
+	portENTER_CRITICAL(&req_mask_mux);
+	cadence_mask = sched_cadence_item_mask;
+	polled_mask = sched_polled_item_mask;
+	msec = sched_cadence_msec;
+	portEXIT_CRITICAL(&req_mask_mux);
+	
+	mask &= polled_mask;
+	if ((mask == 0) || ((mask & ~cadence_mask) != 0)) {
+		return 0;
+	}
+	
+	return msec;
+}
+
+
+// Switch the request profile.  Returning to VM_PROFILE_NORMAL restores the last mask set
+// by vm_set_request_item_mask().
+void vm_set_request_profile(int profile)
+{
+	if (profile != req_profile) {
+		req_profile = profile;
+		portENTER_CRITICAL(&req_mask_mux);
+		update_req_mask_flag = true;
+		portEXIT_CRITICAL(&req_mask_mux);
+		_vm_notify_task();
+	}
+}
+
+
+
+//
+// Internal functions
+//
+static void _vm_notify_task()
+{
+	BaseType_t higher_priority_task_woken = pdFALSE;
+	
+	if (notify_task != NULL) {
+		if (xPortInIsrContext()) {
+			vTaskNotifyGiveFromISR(notify_task, &higher_priority_task_woken);
+			portYIELD_FROM_ISR(higher_priority_task_woken);
+		} else {
+			xTaskNotifyGive(notify_task);
+		}
+	}
+}
+
+
+// Returns the request profile for an item mask, building it with the vehicle's
+// fcn_set_req_mask if necessary (replacing the least recently used profile).  Returns NULL
+// if the vehicle did not specify a request list.
+static sched_profile_t* _vm_sched_get_profile(db_mask_t mask)
+{
+	sched_profile_t* pP = NULL;
+	
+	for (int i=0; i<SCHED_MAX_PROFILES; i++) {
+		if (sched_profile[i].valid && (sched_profile[i].item_mask == mask)) {
+			sched_profile[i].last_use = ++sched_profile_seq;
+			return &sched_profile[i];
+		}
+	}
+	
+	for (int i=0; i<SCHED_MAX_PROFILES; i++) {
+		if (&sched_profile[i] == sched_cur_profileP) continue;
+		if (!sched_profile[i].valid) {
+			pP = &sched_profile[i];
+			break;
+		}
+		if ((pP == NULL) || (sched_profile[i].last_use < pP->last_use)) {
+			pP = &sched_profile[i];
+		}
+	}
+	
+	memset(pP, 0, sizeof(sched_profile_t));
+	sched_build_profileP = pP;
+	cur_vehicleP->fcn_set_req_mask(mask);
+	sched_build_profileP = NULL;
+	
+	if (pP->req_list == NULL) {
+		return NULL;
+	}
+	pP->valid = true;
+	pP->item_mask = mask;
+	pP->last_use = ++sched_profile_seq;
+	
+	return pP;
+}
+
+
+// Make a profile the active schedule.  Per-request state is only rebuilt when the profile
+// uses a different request list.  Requests that become enabled are due immediately and
+// those that remain enabled keep their timing.
+static void _vm_sched_apply_profile(sched_profile_t* pP)
+{
+	bool en;
+	bool rx_changed = false;
+	int n = 0;
+	uint32_t enable_mask;
+	
+	if ((pP->req_list != sched_req_list) || (pP->num_req != sched_num_req) || (pP->decoder_list != sched_decoder_list)) {
+		_vm_sched_load_list(pP->num_req, pP->req_list, pP->decoder_list);
+		rx_changed = true;
+	}
+	
+	// Link dynamic DID reads with their define requests, or replace them with their
+	// fallback requests once the ECU has refused the definition
+	enable_mask = pP->enable_mask;
+	for (int i=0; i<sched_num_req; i++) {
+		sched_list[i].ddid_define_index = -1;
+		sched_list[i].ddid_read_index = -1;
+	}
+	for (int i=0; i<pP->num_ddid; i++) {
+		if (sched_list[pP->ddid[i].read_index].ddid_state == SCHED_DDID_REFUSED) {
+			enable_mask = (enable_mask & ~(1UL << pP->ddid[i].read_index)) | pP->ddid[i].fallback_mask;
+		} else {
+			_vm_sched_setup_ddid(&pP->ddid[i]);
+		}
+	}
+	
+	// Poll instead of periodic transmissions the ECU refused to start.  A start request stays
+	// linked to its stop request so a transmission is stopped by profiles that don't use it.
+	for (int i=0; i<pP->num_periodic; i++) {
+		sched_list[pP->periodic[i].start_index].periodic_stop_index = pP->periodic[i].stop_index;
+		if (sched_list[pP->periodic[i].start_index].periodic_state == SCHED_PDID_REFUSED) {
+			enable_mask = (enable_mask & ~(1UL << pP->periodic[i].start_index)) | pP->periodic[i].fallback_mask;
+		}
+	}
+	
+	// Poll conditions are evaluated again by the scheduler
+	for (int i=0; i<sched_num_req; i++) {
+		sched_list[i].cond_index = -1;
+		sched_list[i].cond_held = false;
+	}
+	for (int i=0; i<pP->num_cond; i++) {
+		sched_list[pP->cond[i].req_index].cond_index = i;
+	}
+	sched_cond = pP->cond;
+	sched_num_cond = pP->num_cond;
+	
+	for (int i=0; i<sched_num_req; i++) {
+		en = ((enable_mask & (1UL << i)) != 0) && !sched_list[i].unsupported;
+		if (sched_list[i].reqP->rsp_id == CAN_MANAGER_RSP_FUNCTIONAL) {
+			// Interfaces doing ISO-TP themselves only follow one ECU
+			en &= can_functional_supported();
+		}
+		if (en && !sched_list[i].enabled) {
+			sched_list[i].last_tx_msec = 0;
+			
+			// Let the data broker know how long the request's items remain fresh
+			for (int j=1; j<DB_NUM_ITEMS; j++) {
+				if ((sched_list[i].item_mask & DB_MASK(j)) != 0) {
+					db_set_item_stale_msec(j, _vm_sched_stale_msec(_vm_sched_fresh_msec(i)));
+				}
+			}
+		}
+		if (en != sched_list[i].enabled) {
+			rx_changed = true;
+		}
+		if (sched_list[i].periodic_stop_index >= 0) {
+			sched_list[i].periodic_stop_due = !en && (sched_list[i].periodic_state == SCHED_PDID_STARTED);
+		}
+		sched_list[i].enabled = en;
+		sched_list[i].group_next = pP->group_next[i];
+		sched_list[i].group_ts = ((pP->group_ts_mask & (1UL << i)) != 0);
+		sched_list[i].streaming = ((pP->stream_mask & (1UL << i)) != 0);
+		
+		if (sched_list[i].streaming && (n < CAN_MANAGER_MAX_SESSIONS)) {
+			stream_rsp_id[n++] = sched_list[i].reqP->rsp_id;
+		}
+	}
+	__atomic_store_n(&num_stream_rsp_id, n, __ATOMIC_RELEASE);
+	
+	memcpy(sched_order, pP->order, pP->num_order);
+	sched_num_order = pP->num_order;
+	if ((sched_follow_i >= 0) && !sched_list[sched_follow_i].enabled) {
+		sched_follow_i = -1;
+	}
+	sched_cur_profileP = pP;
+	sched_cadence_valid = false;
+	_vm_sched_map_goals();
+	
+	if (rx_changed) {
+		_vm_update_rx_id_list();
+	}
+}
+
+
+// Setup the per-request scheduler state for a vehicle's request list.  Health and
+// statistics are kept for requests that remain the same.
+static void _vm_sched_load_list(int num_req, const can_request_t** req_list, const vm_decoder_list_t decoder_list[])
+{
+	int len;
+	
+	for (int i=0; i<num_req; i++) {
+		sched_list[i].enabled = false;
+		if (sched_list[i].reqP != req_list[i]) {
+			sched_list[i].reqP = req_list[i];
+			sched_list[i].fail_count = 0;
+			sched_list[i].backoff_msec = 0;
+			sched_list[i].unsupported = false;
+			sched_list[i].ddid_state = SCHED_DDID_UNDEFINED;
+			sched_list[i].periodic_stop_index = -1;
+			sched_list[i].periodic_state = SCHED_PDID_STOPPED;
+			sched_list[i].periodic_stop_due = false;
+			sched_list[i].lat_avg_usec = 0;
+			sched_list[i].goal_msec = 0;
+			memset(&sched_list[i].stats, 0, sizeof(vm_req_stats_t));
+			sched_list[i].stats.req_id = req_list[i]->req_id;
+			sched_list[i].stats.rsp_id = req_list[i]->rsp_id;
+		}
+		sched_list[i].last_tx_msec = 0;
+		sched_list[i].cadence = false;
+		sched_list[i].item_mask = (decoder_list != NULL) ? _vm_sched_item_mask(i, num_req, req_list, decoder_list) : 0;
+		if (req_list[i]->period_msec == VM_PERIOD_CATALOG) {
+			sched_list[i].period_msec = _vm_sched_catalog_period(sched_list[i].item_mask);
+		} else {
+			sched_list[i].period_msec = req_list[i]->period_msec;
+		}
+		
+		len = (decoder_list != NULL) ? _vm_sched_expected_len(i, num_req, req_list, decoder_list) : 0;
+		sched_list[i].rsp_frames = _vm_sched_rsp_frames(len);
+		
+		// A list first loaded after vm_init planned the buffers may not fit them
+		if ((plan_rsp_len != 0) && (plan_rsp_len < CAN_MANAGER_MAX_RSP_LEN)) {
+			len = _vm_plan_rsp_len(i, num_req, req_list, decoder_list);
+			if ((len == 0) || (len > plan_rsp_len)) {
+				ESP_LOGW(TAG, "Response to 0x%lx may not fit %d byte buffers", req_list[i]->rsp_id, plan_rsp_len);
+			}
+		}
+		
+		sched_tx_desc[i].req_id = req_list[i]->req_id;
+		sched_tx_desc[i].rsp_id = req_list[i]->rsp_id;
+		sched_tx_desc[i].len = req_list[i]->req_len;
+		sched_tx_desc[i].data = req_list[i]->data;
+	}
+	for (int i=num_req; i<VM_MAX_SCHED_REQ; i++) {
+		sched_list[i].enabled = false;
+		sched_list[i].streaming = false;
+	}
+	sched_num_req = num_req;
+	sched_req_list = req_list;
+	sched_decoder_list = decoder_list;
+	sched_follow_i = -1;
+	
+	// Let the interface format the requests once
+	can_prepare_requests(num_req, sched_tx_desc);
+}
+
+
+// Profile the vehicle's schedule calls are recorded into
+static sched_profile_t* _vm_sched_record_profile()
+{
+	if (sched_build_profileP != NULL) {
+		return sched_build_profileP;
+	}
+	
+	// Calls outside of a profile build start from the active schedule
+	if ((sched_cur_profileP != NULL) && (sched_cur_profileP != &sched_direct_profile)) {
+		sched_direct_profile = *sched_cur_profileP;
+		sched_direct_profile.valid = false;
+	}
+	return &sched_direct_profile;
+}
+
+
+// Add a request to a profile's order.  Requests are ordered by request ID so the scheduler
+// visits requests for the same ECU together (ties in overdue time go to the first visited).
+static void _vm_sched_order_add(sched_profile_t* pP, int n)
+{
+	int j;
+	
+	for (j=0; j<pP->num_order; j++) {
+		if (pP->order[j] == n) return;
+	}
+	
+	j = pP->num_order++;
+	while ((j > 0) && (pP->req_list[pP->order[j-1]]->req_id > pP->req_list[n]->req_id)) {
+		pP->order[j] = pP->order[j-1];
+		j--;
+	}
+	pP->order[j] = n;
+}
+
+
+// Link a dynamic DID's read and define requests.  The read carries the items of its source
+// DID requests and its response is their data records.
+static void _vm_sched_setup_ddid(const sched_ddid_t* dP)
+{
+	sched_entry_t* rP = &sched_list[dP->read_index];
+	int n;
+	int len = 3;                // SID and dynamic DID
+	
+	rP->ddid_define_index = dP->define_index;
+	sched_list[dP->define_index].ddid_read_index = dP->read_index;
+	
+	rP->item_mask = 0;
+	for (int i=0; i<dP->groupP->num_parts; i++) {
+		n = dP->groupP->part_indexP[i];
+		rP->item_mask |= sched_list[n].item_mask;
+		if ((len != 0) && (sched_decoder_list != NULL) && (sched_decoder_list[n].num_rows != 0) && (sched_decoder_list[n].rowP[0].rsp_len >= 3)) {
+			len += sched_decoder_list[n].rowP[0].rsp_len - 3;
+		} else {
+			len = 0;
+		}
+	}
+	rP->rsp_frames = _vm_sched_rsp_frames(len);
+}
+
+
+// Single frame responses hold up to 7 bytes, multi-frame responses 6 bytes in the first
+// frame and 7 in each consecutive frame.  Returns 0 for an unknown length.
+static int _vm_sched_rsp_frames(int len)
+{
+	if (len == 0) {
+		return 0;
+	} else if (len <= 7) {
+		return 1;
+	}
+	
+	return 1 + (len - 6 + 7 - 1) / 7;
+}
+
+
+// Issue the most overdue request(s).  A request is eligible when its period has expired
+// and there is no request already outstanding to its ECU.  Multiple requests may be
+// outstanding at once (one per ECU) if the interface supports it.
+static void _vm_sched_eval()
+{
+	const can_request_t* reqP;
+	int best_i;
+	int64_t best_overdue;
+	int64_t cur_msec;
+	int64_t overdue;
+	int period_msec;
+	int switch_msec;
+	bool is_follow;
+	bool cadence_on;
+	bool best_cadence;
+	int tx_i;
+	int errno;
+	int num_rsp_err;
+	uint32_t rsp_err_id[CAN_MANAGER_MAX_SESSIONS];
+	int rsp_err[CAN_MANAGER_MAX_SESSIONS];
+	
+	cur_msec = esp_timer_get_time() / 1000;
+	switch_msec = can_get_id_switch_msec();
+	
+	// Requests the interface abandoned because of an error
+	errno = __atomic_exchange_n(&sched_if_errno, CAN_ERRNO_NONE, __ATOMIC_ACQ_REL);
+	if (errno != CAN_ERRNO_NONE) {
+		_vm_sched_clear_outstanding(errno);
+		cur_vehicleP->fcn_note_can_error(errno);
+	}
+	
+	portENTER_CRITICAL(&sched_err_mux);
+	num_rsp_err = sched_num_rsp_err;
+	memcpy(rsp_err_id, sched_rsp_err_id, num_rsp_err * sizeof(uint32_t));
+	memcpy(rsp_err, sched_rsp_err, num_rsp_err * sizeof(int));
+	sched_num_rsp_err = 0;
+	portEXIT_CRITICAL(&sched_err_mux);
+	for (int k=0; k<num_rsp_err; k++) {
+		for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+			if (sched_outstanding[i].in_use && (sched_outstanding[i].rsp_id == rsp_err_id[k])) {
+				_vm_sched_abandon(i, rsp_err[k]);
+				break;
+			}
+		}
+		cur_vehicleP->fcn_note_can_error(rsp_err[k]);
+	}
+	
+	// A functional request is complete once its window closes
+	if (sched_func_done) {
+		sched_func_done = false;
+		for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+			if (sched_outstanding[i].in_use && (sched_outstanding[i].rsp_id == CAN_MANAGER_RSP_FUNCTIONAL)) {
+				sched_outstanding[i].in_use = false;
+				sched_num_outstanding -= 1;
+			}
+		}
+	}
+	
+	_vm_sched_eval_load(cur_msec);
+	_vm_sched_eval_cadence(cur_msec);
+	_vm_sched_eval_goals(cur_msec);
+	cadence_on = (sched_cadence_msec != 0) && (req_profile == VM_PROFILE_NORMAL);
+	
+	// Abandon any request the CAN interface didn't time out itself
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (sched_outstanding[i].in_use && ((cur_msec - sched_outstanding[i].tx_msec) >
+		    ((sched_outstanding[i].rsp_pending ? CAN_MANAGER_P2X_MSEC : cur_vehicleP->req_timeout_msec) + SCHED_TIMEOUT_MARGIN_MSEC))) {
+			DLOGI(TAG, "Request timeout - 0x%lx", sched_outstanding[i].rsp_id);
+			can_end_session(sched_outstanding[i].rsp_id);
+			sched_list[sched_outstanding[i].req_index].stats.num_timeout += 1;
+			_vm_sched_note_health(sched_outstanding[i].req_index, false);
+			sched_outstanding[i].in_use = false;
+			sched_num_outstanding -= 1;
+		}
+	}
+	
+	// Only probe a vehicle that is off
+	if (_vm_sched_eval_sleep(cur_msec)) {
+		return;
+	}
+	
+	// Stop periodic transmissions the schedule no longer needs and restart those that
+	// stopped arriving
+	for (int i=0; i<sched_num_req; i++) {
+		if (sched_list[i].periodic_stop_index < 0) continue;
+		
+		if (sched_list[i].periodic_stop_due) {
+			if ((sched_num_outstanding < can_get_max_sessions()) && !_vm_sched_ecu_busy(sched_list[i].reqP->rsp_id) &&
+			    !_vm_sched_throttled(cur_msec) && _vm_sched_issue(sched_list[i].periodic_stop_index, cur_msec)) {
+				sched_list[i].periodic_stop_due = false;
+				sched_list[i].periodic_state = SCHED_PDID_STOPPED;
+			}
+		} else if (sched_list[i].enabled && (sched_list[i].periodic_state == SCHED_PDID_STARTED) &&
+		           ((cur_msec - sched_list[i].periodic_rx_msec) > _vm_sched_stale_msec(sched_list[i].period_msec))) {
+			ESP_LOGI(TAG, "Periodic data from 0x%lx stopped - restarting", sched_list[i].reqP->rsp_id);
+			sched_list[i].periodic_state = SCHED_PDID_STOPPED;
+			sched_list[i].last_tx_msec = 0;
+		}
+	}
+	
+	_vm_sched_eval_cond();
+	
+	while ((sched_num_outstanding < can_get_max_sessions()) && !_vm_sched_throttled(cur_msec)) {
+		// The next member of a group goes next once its ECU is free
+		best_i = -1;
+		best_overdue = 0;
+		best_cadence = false;
+		is_follow = false;
+		if (sched_follow_i >= 0) {
+			if (!sched_list[sched_follow_i].enabled) {
+				sched_follow_i = -1;
+			} else if (!_vm_sched_ecu_busy(sched_list[sched_follow_i].reqP->rsp_id) &&
+			           can_session_available(sched_list[sched_follow_i].reqP->rsp_id)) {
+				best_i = sched_follow_i;
+				is_follow = true;
+			}
+		}
+		
+		// Otherwise find the most overdue eligible request
+		for (int k=0; (k<sched_num_order) && !is_follow; k++) {
+			int i = sched_order[k];
+			if (!sched_list[i].enabled) continue;
+			
+			// The ECU is already transmitting a started periodic request's data
+			if ((sched_list[i].periodic_stop_index >= 0) && (sched_list[i].periodic_state == SCHED_PDID_STARTED)) continue;
+			
+			// Held by its poll condition
+			period_msec = _vm_sched_period(i);
+			if (period_msec < 0) continue;
+			
+			reqP = sched_list[i].reqP;
+			if (cadence_on && sched_list[i].cadence) {
+				// Due at its slot
+				overdue = cur_msec - (sched_list[i].cadence_due_msec + sched_list[i].backoff_msec);
+			} else {
+				if (req_profile == VM_PROFILE_PERF_RUN) {
+					period_msec = 0;
+				} else if ((req_profile == VM_PROFILE_CHARGING) && (period_msec < VM_CHARGE_PERIOD_MSEC)) {
+					period_msec = VM_CHARGE_PERIOD_MSEC;
+				}
+				overdue = cur_msec - (sched_list[i].last_tx_msec + period_msec + sched_list[i].backoff_msec);
+			}
+			if (overdue < 0) continue;
+			
+			if (_vm_sched_ecu_busy(reqP->rsp_id)) continue;
+			
+			// The interface can't take it now (e.g. the adapter of an ELM327 pair that
+			// carries this ECU's requests is busy)
+			if (!can_session_available(reqP->rsp_id)) continue;
+			
+			// Keep the next cadence slot free
+			if (cadence_on && !sched_list[i].cadence && _vm_sched_cadence_blocks(i, cur_msec)) continue;
+			
+			// Account for the cost of reconfiguring the interface for this request
+			overdue -= _vm_sched_switch_cost(reqP, switch_msec);
+			
+			// A cadence request due at its slot goes first
+			if ((best_i == -1) || (sched_list[i].cadence && cadence_on && !best_cadence) ||
+			    (((sched_list[i].cadence && cadence_on) == best_cadence) &&
+			     ((overdue > best_overdue) ||
+			      ((overdue == best_overdue) && (reqP->priority > sched_list[best_i].reqP->priority))))) {
+				best_i = i;
+				best_overdue = overdue;
+				best_cadence = sched_list[i].cadence && cadence_on;
+			}
+		}
+		
+		if (best_i == -1) {
+			// Nothing due
+			break;
+		}
+		
+		// Pull the rest of a group in behind it
+		if (!is_follow) {
+			sched_group_lead_i = best_i;
+			if (sched_list[best_i].group_next >= 0) {
+				if (++sched_group_seq == 0) sched_group_seq = 1;
+			}
+		}
+		sched_list[best_i].group_seq = (sched_list[best_i].group_next >= 0) ? sched_group_seq : 0;
+		sched_follow_i = _vm_sched_group_next(best_i);
+		
+		// A dynamic DID is defined before it is read (the read is due again once it is)
+		tx_i = best_i;
+		if ((sched_list[best_i].ddid_define_index >= 0) && (sched_list[best_i].ddid_state != SCHED_DDID_DEFINED)) {
+			tx_i = sched_list[best_i].ddid_define_index;
+		}
+		
+		sched_list[best_i].last_tx_msec = cur_msec;
+		if (cadence_on && sched_list[best_i].cadence) {
+			_vm_sched_cadence_advance(best_i, cur_msec);
+		}
+		if (!_vm_sched_issue(tx_i, cur_msec)) {
+			break;
+		}
+	}
+	
+	// Let the interface receive broadcasts while it would otherwise be idle
+	if ((sched_num_outstanding == 0) && (num_bcast_sub != 0)) {
+		best_overdue = -SCHED_MONITOR_IDLE_MSEC;
+		for (int i=0; i<sched_num_req; i++) {
+			if (!sched_list[i].enabled) continue;
+			period_msec = _vm_sched_period(i);
+			if (period_msec < 0) continue;
+			overdue = cur_msec - (sched_list[i].last_tx_msec + period_msec + sched_list[i].backoff_msec);
+			if (overdue > best_overdue) {
+				best_overdue = overdue;
+			}
+		}
+		if (best_overdue <= -SCHED_MONITOR_IDLE_MSEC) {
+			can_start_monitor();
+		}
+	}
+}
+
+
+// Send request n and note it outstanding.  Returns false if it couldn't be sent.
+static bool _vm_sched_issue(int n, int64_t cur_msec)
+{
+	const can_request_t* reqP = sched_list[n].reqP;
+	uint16_t fc;
+	
+	sched_last_req_id = reqP->req_id;
+	sched_last_rsp_id = reqP->rsp_id;
+	fc = (reqP->flow_control == VM_FC_DEFAULT) ? cur_vehicleP->flow_control : reqP->flow_control;
+	can_set_flow_control(VM_FC_BS(fc), VM_FC_STMIN(fc));
+	can_set_expected_frames(sched_list[n].rsp_frames);
+	if (!can_tx_packet(reqP->req_id, reqP->rsp_id, reqP->req_len, (uint8_t*) reqP->data)) {
+		DLOGE(TAG, "CAN TX fail - ID = %lx", reqP->req_id);
+		return false;
+	}
+	sched_list[n].stats.num_tx += 1;
+	sched_last_issue_msec = cur_msec;
+	
+	for (int j=0; j<CAN_MANAGER_MAX_SESSIONS; j++) {
+		if (!sched_outstanding[j].in_use) {
+			sched_outstanding[j].in_use = true;
+			sched_outstanding[j].rsp_id = reqP->rsp_id;
+			sched_outstanding[j].req_index = n;
+			sched_outstanding[j].rsp_pending = false;
+			sched_outstanding[j].num_rsp = 0;
+			sched_outstanding[j].tx_msec = cur_msec;
+			sched_outstanding[j].tx_usec = esp_timer_get_time();
+			sched_num_outstanding += 1;
+			break;
+		}
+	}
+	
+	return true;
+}
+
+
+// Adapt the minimum gap between requests to the bus load and errors the interface reports
+static void _vm_sched_eval_load(int64_t cur_msec)
+{
+	can_bus_stats_t stats;
+	uint32_t dt_msec;
+	bool errors;
+	int prev_gap_msec;
+	
+	if (sched_load_valid && ((cur_msec - sched_load_msec) < SCHED_LOAD_EVAL_MSEC)) {
+		return;
+	}
+	
+	if (!can_get_bus_stats(&stats) || (stats.bitrate == 0)) {
+		sched_load_valid = false;
+		sched_gap_msec = 0;
+		return;
+	}
+	
+	if (sched_load_valid) {
+		// Counters wrap so only their differences are used
+		dt_msec = (uint32_t) (cur_msec - sched_load_msec);
+		sched_load_pct = (int) (((uint64_t) (stats.num_bits - sched_load_stats.num_bits) * 100000ULL) /
+		                        ((uint64_t) stats.bitrate * dt_msec));
+		errors = (stats.num_bus_errors != sched_load_stats.num_bus_errors) ||
+		         (stats.num_err_passive != sched_load_stats.num_err_passive) ||
+		         (stats.num_bus_off != sched_load_stats.num_bus_off);
+		
+		prev_gap_msec = sched_gap_msec;
+		if (errors || (sched_load_pct > SCHED_LOAD_HIGH_PCT)) {
+			sched_gap_msec = (sched_gap_msec == 0) ? SCHED_GAP_MIN_MSEC : (2 * sched_gap_msec);
+			if (sched_gap_msec > SCHED_GAP_MAX_MSEC) {
+				sched_gap_msec = SCHED_GAP_MAX_MSEC;
+			}
+		} else if (sched_load_pct < SCHED_LOAD_LOW_PCT) {
+			sched_gap_msec -= (sched_gap_msec + 3) / 4;
+			if (sched_gap_msec < SCHED_GAP_MIN_MSEC) {
+				sched_gap_msec = 0;
+			}
+		}
+		
+		if ((prev_gap_msec == 0) != (sched_gap_msec == 0)) {
+			ESP_LOGI(TAG, "Bus load %d%%%s - request throttle %s", sched_load_pct, errors ? " with errors" : "",
+			         (sched_gap_msec == 0) ? "off" : "on");
+		}
+	}
+	
+	sched_load_stats = stats;
+	sched_load_msec = cur_msec;
+	sched_load_valid = true;
+}
+
+
+// Detect the vehicle turning off and probe it while it is.  Returns true while asleep.
+static bool _vm_sched_eval_sleep(int64_t cur_msec)
+{
+	int n = -1;
+	
+	if (!sched_asleep) {
+		if ((sched_fail_run < SCHED_SLEEP_MIN_FAILS) || ((cur_msec - sched_activity_msec) < SCHED_SLEEP_IDLE_MSEC)) {
+			return false;
+		}
+		ESP_LOGI(TAG, "Vehicle asleep - probing every %d sec", SCHED_SLEEP_PROBE_MSEC / 1000);
+		sched_asleep = true;
+		sched_probe_msec = cur_msec;
+		sched_follow_i = -1;
+	}
+	
+	if (sched_num_outstanding != 0) {
+		return true;
+	}
+	if (!sched_probe_req && ((cur_msec - sched_probe_msec) < SCHED_SLEEP_PROBE_MSEC)) {
+		// Listen for broadcasts between probes
+		if (num_bcast_sub != 0) {
+			can_start_monitor();
+		}
+		return true;
+	}
+	sched_probe_req = false;
+	sched_probe_msec = cur_msec;
+	
+	// Probe with the first plain request (no dynamic DID definition or periodic transmission)
+	for (int k=0; k<sched_num_order; k++) {
+		int i = sched_order[k];
+		if (!sched_list[i].enabled) continue;
+		if (n < 0) n = i;
+		if ((sched_list[i].ddid_define_index < 0) && (sched_list[i].periodic_stop_index < 0)) {
+			n = i;
+			break;
+		}
+	}
+	if (n >= 0) {
+		sched_list[n].last_tx_msec = cur_msec;
+		(void) _vm_sched_issue(n, cur_msec);
+	}
+	
+	return true;
+}
+
+
+// A response or broadcast shows the vehicle is on
+static void _vm_sched_note_activity()
+{
+	sched_fail_run = 0;
+	sched_activity_msec = esp_timer_get_time() / 1000;
+	if (sched_asleep) {
+		ESP_LOGI(TAG, "Vehicle awake");
+		sched_asleep = false;
+	}
+}
+
+
+// Choose the constant cadence requests and size their slots and period
+static void _vm_sched_eval_cadence(int64_t cur_msec)
+{
+	bool member;
+	bool changed = false;
+	db_mask_t cadence_mask = 0;
+	db_mask_t polled_mask = 0;
+	int lat_usec = 0;
+	int n = 0;
+	int k = 0;
+	int pct;
+	int period_msec = 0;
+	
+	if (sched_cadence_valid && ((cur_msec - sched_cadence_eval_msec) < CADENCE_EVAL_MSEC)) {
+		return;
+	}
+	sched_cadence_valid = true;
+	sched_cadence_eval_msec = cur_msec;
+	
+	// Members need a latency measured by ordinary polling before they can be given a slot
+	pct = tune_get(TUNE_CADENCE_PCT);
+	for (int i=0; i<sched_num_req; i++) {
+		if (!sched_list[i].enabled) continue;
+		polled_mask |= sched_list[i].item_mask;
+		
+		member = (pct != 0) && (req_profile == VM_PROFILE_NORMAL) &&
+		         (sched_list[i].reqP->priority == VM_PRIORITY_HIGH) && (sched_list[i].period_msec == 0) &&
+		         (sched_list[i].cond_index < 0) && (sched_list[i].periodic_stop_index < 0) &&
+		         (sched_list[i].reqP->rsp_id != CAN_MANAGER_RSP_FUNCTIONAL);
+		if (member) {
+			if (sched_list[i].lat_avg_usec == 0) {
+				pct = 0;
+			} else if (sched_list[i].lat_avg_usec > lat_usec) {
+				lat_usec = sched_list[i].lat_avg_usec;
+			}
+			n += 1;
+		}
+	}
+	
+	if ((pct != 0) && (n != 0)) {
+		sched_cadence_slot_msec = (lat_usec * (100 + CADENCE_MARGIN_PCT) / 100 + 999) / 1000 + can_get_id_switch_msec();
+		period_msec = n * sched_cadence_slot_msec * 100 / pct;
+		period_msec = (period_msec + CADENCE_ROUND_MSEC - 1) / CADENCE_ROUND_MSEC * CADENCE_ROUND_MSEC;
+	}
+	
+	for (int i=0; i<sched_num_req; i++) {
+		member = (period_msec != 0) && sched_list[i].enabled &&
+		         (sched_list[i].reqP->priority == VM_PRIORITY_HIGH) && (sched_list[i].period_msec == 0) &&
+		         (sched_list[i].cond_index < 0) && (sched_list[i].periodic_stop_index < 0) &&
+		         (sched_list[i].reqP->rsp_id != CAN_MANAGER_RSP_FUNCTIONAL);
+		if (member != sched_list[i].cadence) {
+			sched_list[i].cadence = member;
+			changed = true;
+		}
+		if (member) {
+			cadence_mask |= sched_list[i].item_mask;
+		}
+	}
+	
+	// Keep the period unless the members changed or it is well off
+	if (!changed && (period_msec != 0) && (sched_cadence_msec != 0) &&
+	    ((abs(period_msec - sched_cadence_msec) * 100) <= (sched_cadence_msec * CADENCE_HYST_PCT))) {
+		period_msec = sched_cadence_msec;
+	} else if (period_msec != sched_cadence_msec) {
+		changed = true;
+	}
+	
+	if (changed && (period_msec != 0)) {
+		// Lay the members' slots out from now
+		for (int i=0; i<sched_num_req; i++) {
+			if (sched_list[i].cadence) {
+				sched_list[i].cadence_due_msec = cur_msec + (k++ * sched_cadence_slot_msec);
+			}
+		}
+		ESP_LOGI(TAG, "Cadence %d mSec for %d requests (%d mSec slots)", period_msec, n, sched_cadence_slot_msec);
+	}
+	
+	portENTER_CRITICAL(&req_mask_mux);
+	sched_cadence_msec = period_msec;
+	sched_cadence_item_mask = cadence_mask;
+	sched_polled_item_mask = polled_mask;
+	portEXIT_CRITICAL(&req_mask_mux);
+}
+
+
+// True when starting request n now could delay a cadence slot: it is expected to still be
+// running at the slot and would take the last free session or is to the slot's ECU
+static bool _vm_sched_cadence_blocks(int n, int64_t cur_msec)
+{
+	int64_t end_msec;
+	
+	end_msec = cur_msec + _vm_sched_switch_cost(sched_list[n].reqP, can_get_id_switch_msec());
+	if (sched_list[n].lat_avg_usec != 0) {
+		end_msec += (sched_list[n].lat_avg_usec + 999) / 1000;
+	} else {
+		end_msec += sched_cadence_slot_msec;
+	}
+	
+	for (int i=0; i<sched_num_req; i++) {
+		if (!sched_list[i].cadence || !sched_list[i].enabled || (sched_list[i].cadence_due_msec >= end_msec)) continue;
+		
+		if (((can_get_max_sessions() - sched_num_outstanding) <= 1) || (sched_list[i].reqP->rsp_id == sched_list[n].reqP->rsp_id)) {
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+
+// Cadence request n was issued so its next slot is a period on.  One that fell a whole
+// period behind (e.g. its ECU was busy) starts again from now.
+static void _vm_sched_cadence_advance(int n, int64_t cur_msec)
+{
+	sched_list[n].cadence_due_msec += sched_cadence_msec;
+	if (sched_list[n].cadence_due_msec <= cur_msec) {
+		sched_list[n].cadence_due_msec = cur_msec + sched_cadence_msec;
+	}
+}
+
+
+// Start measuring a new set of freshness goals
+static void _vm_sched_set_goals(int num, const vm_goal_t* goals)
+{
+	sched_goal_t* gP;
+	
+	for (int i=0; i<num; i++) {
+		gP = &sched_goal[i];
+		memset(gP, 0, sizeof(sched_goal_t));
+		gP->src_mask = db_get_derived_inputs(DB_MASK(goals[i].item));
+		gP->worst_msec = -1;
+		gP->stats.item = goals[i].item;
+		gP->stats.goal_msec = goals[i].max_age_msec;
+		gP->stats.age_msec = -1;
+		
+		// The value left from before the goal doesn't count
+		(void) db_get_data_item(goals[i].item, NULL, &gP->ts_usec);
+	}
+	sched_num_goals = num;
+	sched_goal_eval_msec = esp_timer_get_time() / 1000;
+	if (sched_relax_pct != 100) {
+		sched_relax_pct = 100;
+		ESP_LOGI(TAG, "Requests without goals back to normal periods");
+	}
+	
+	_vm_sched_map_goals();
+}
+
+
+// Give each request the shortest goal of the items it produces.  A request that gets a new
+// goal starts from its configured period if that is well within the goal.
+static void _vm_sched_map_goals()
+{
+	int goal_msec;
+	
+	for (int i=0; i<sched_num_req; i++) {
+		goal_msec = 0;
+		if ((sched_list[i].period_msec >= 0) && (sched_list[i].cond_index < 0) && (sched_list[i].periodic_stop_index < 0)) {
+			for (int k=0; k<sched_num_goals; k++) {
+				if (((sched_goal[k].src_mask & sched_list[i].item_mask) != 0) &&
+				    ((goal_msec == 0) || (sched_goal[k].stats.goal_msec < goal_msec))) {
+					goal_msec = sched_goal[k].stats.goal_msec;
+				}
+			}
+		}
+		
+		if (goal_msec != sched_list[i].goal_msec) {
+			sched_list[i].goal_msec = goal_msec;
+			sched_list[i].goal_period_msec = (sched_list[i].period_msec < (goal_msec / 2)) ? sched_list[i].period_msec : (goal_msec / 2);
+			
+			// Let the data broker know how long its items now remain fresh
+			if (sched_list[i].enabled) {
+				for (int j=1; j<DB_NUM_ITEMS; j++) {
+					if ((sched_list[i].item_mask & DB_MASK(j)) != 0) {
+						db_set_item_stale_msec(j, _vm_sched_stale_msec(_vm_sched_fresh_msec(i)));
+					}
+				}
+			}
+		}
+	}
+}
+
+
+// Measure how old the goal items' values get and every GOAL_EVAL_MSEC adjust the periods of
+// the requests producing them
+static void _vm_sched_eval_goals(int64_t cur_msec)
+{
+	sched_goal_t* gP;
+	int64_t ts_usec;
+	int age_msec;
+	int margin_msec;
+	bool have_margin;
+	bool slack;
+	bool limited = false;
+	bool all_met = true;
+	
+	if (sched_num_goals == 0) return;
+	
+	for (int k=0; k<sched_num_goals; k++) {
+		gP = &sched_goal[k];
+		if (!db_get_data_item(gP->stats.item, NULL, &ts_usec)) continue;
+		
+		if (ts_usec != gP->ts_usec) {
+			// Age the previous value reached before it was replaced
+			age_msec = gP->primed ? (int) (cur_msec - (gP->ts_usec / 1000)) : -1;
+			gP->replaced = gP->primed;
+			gP->primed = true;
+			gP->ts_usec = ts_usec;
+		} else {
+			// A value not replaced counts as it gets older
+			age_msec = gP->primed ? (int) (cur_msec - (ts_usec / 1000)) : -1;
+		}
+		if (age_msec > gP->worst_msec) {
+			gP->worst_msec = age_msec;
+		}
+	}
+	
+	if ((cur_msec - sched_goal_eval_msec) < GOAL_EVAL_MSEC) return;
+	sched_goal_eval_msec = cur_msec;
+	
+	for (int k=0; k<sched_num_goals; k++) {
+		gP = &sched_goal[k];
+		gP->stats.age_msec = gP->worst_msec;
+		gP->stats.met = (gP->worst_msec >= 0) && (gP->worst_msec <= gP->stats.goal_msec);
+		gP->stats.controlled = false;
+		gP->stats.limited = false;
+		if (gP->worst_msec >= 0) {
+			gP->stats.num_eval += 1;
+			if (!gP->stats.met) {
+				gP->stats.num_unmet += 1;
+				all_met = false;
+			}
+		}
+		gP->worst_msec = -1;
+	}
+	
+	if (req_profile != VM_PROFILE_NORMAL) {
+		for (int k=0; k<sched_num_goals; k++) {
+			sched_goal[k].replaced = false;
+		}
+		return;
+	}
+	
+	for (int i=0; i<sched_num_req; i++) {
+		if (!sched_list[i].enabled || (sched_list[i].goal_msec == 0)) continue;
+		
+		// The tightest of its goals decides
+		have_margin = false;
+		slack = true;
+		margin_msec = 0;
+		for (int k=0; k<sched_num_goals; k++) {
+			gP = &sched_goal[k];
+			if (((gP->src_mask & sched_list[i].item_mask) == 0) || (gP->stats.age_msec < 0)) continue;
+			
+			gP->stats.controlled = true;
+			if (!have_margin || ((gP->stats.goal_msec - gP->stats.age_msec) < margin_msec)) {
+				margin_msec = gP->stats.goal_msec - gP->stats.age_msec;
+				have_margin = true;
+			}
+			// Slow goals may not see a whole interval in one evaluation
+			if (!gP->replaced || ((gP->stats.age_msec * 100) >= (gP->stats.goal_msec * GOAL_SLACK_PCT))) {
+				slack = false;
+			}
+		}
+		if (!have_margin || sched_list[i].cadence || (sched_list[i].backoff_msec != 0)) continue;
+		
+		if (margin_msec < 0) {
+			if (sched_list[i].goal_period_msec == 0) {
+				// Nothing left to take from this request
+				for (int k=0; k<sched_num_goals; k++) {
+					gP = &sched_goal[k];
+					if (((gP->src_mask & sched_list[i].item_mask) != 0) && (gP->stats.age_msec >= 0) && !gP->stats.met) {
+						gP->stats.limited = true;
+						limited = true;
+					}
+				}
+			}
+			sched_list[i].goal_period_msec += margin_msec;
+			if (sched_list[i].goal_period_msec < 0) {
+				sched_list[i].goal_period_msec = 0;
+			}
+		} else if (slack) {
+			sched_list[i].goal_period_msec += margin_msec / 2;
+			if (sched_list[i].goal_period_msec > sched_list[i].goal_msec) {
+				sched_list[i].goal_period_msec = sched_list[i].goal_msec;
+			}
+		}
+	}
+	
+	for (int k=0; k<sched_num_goals; k++) {
+		sched_goal[k].replaced = false;
+	}
+	
+	// Requests without goals give way while the interface is the limit
+	if (limited && (sched_relax_pct < GOAL_RELAX_MAX_PCT)) {
+		if (sched_relax_pct == 100) {
+			ESP_LOGI(TAG, "Freshness goals limited by the interface - slowing requests without goals");
+		}
+		sched_relax_pct += GOAL_RELAX_STEP_PCT;
+		if (sched_relax_pct > GOAL_RELAX_MAX_PCT) {
+			sched_relax_pct = GOAL_RELAX_MAX_PCT;
+		}
+	} else if (!limited && all_met && (sched_relax_pct > 100)) {
+		sched_relax_pct -= GOAL_RELAX_STEP_PCT;
+		if (sched_relax_pct <= 100) {
+			sched_relax_pct = 100;
+			ESP_LOGI(TAG, "Requests without goals back to normal periods");
+		}
+	}
+}
+
+
+// Is the next request held back by the bus load throttle
+static bool _vm_sched_throttled(int64_t cur_msec)
+{
+	return (sched_gap_msec != 0) && ((cur_msec - sched_last_issue_msec) < sched_gap_msec);
+}
+
+
+// True when a request to the ECU is outstanding
+static bool _vm_sched_ecu_busy(uint32_t rsp_id)
+{
+	// A functional request addresses every ECU so goes out alone
+	if ((rsp_id == CAN_MANAGER_RSP_FUNCTIONAL) && (sched_num_outstanding != 0)) {
+		return true;
+	}
+	
+	for (int j=0; j<CAN_MANAGER_MAX_SESSIONS; j++) {
+		if (sched_outstanding[j].in_use && ((sched_outstanding[j].rsp_id == rsp_id) ||
+		    (sched_outstanding[j].rsp_id == CAN_MANAGER_RSP_FUNCTIONAL))) {
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+
+// Member of the current group run to issue after request i (-1 when the run is complete).
+// Members that are disabled or backed off are skipped.
+static int _vm_sched_group_next(int i)
+{
+	int n = sched_list[i].group_next;
+	
+	while ((n >= 0) && (n != sched_group_lead_i) && (n != i)) {
+		if (sched_list[n].enabled && (sched_list[n].backoff_msec == 0)) {
+			return n;
+		}
+		n = sched_list[n].group_next;
+	}
+	
+	return -1;
+}
+
+
+// Items of a request remain fresh for SCHED_STALE_PERIODS periods (or the broker default,
+// whichever is longer)
+static int _vm_sched_stale_msec(int period_msec)
+{
+	return (period_msec * SCHED_STALE_PERIODS > DB_STALE_DEFAULT_MSEC) ? period_msec * SCHED_STALE_PERIODS : DB_STALE_DEFAULT_MSEC;
+}
+
+
+// Longest period request n is polled at outside of its poll condition
+static int _vm_sched_fresh_msec(int n)
+{
+	return (sched_list[n].goal_msec > sched_list[n].period_msec) ? sched_list[n].goal_msec : sched_list[n].period_msec;
+}
+
+
+// Check the poll conditions of enabled requests, letting the data broker know how long
+// their items now remain fresh when a condition changes
+static void _vm_sched_eval_cond()
+{
+	const sched_cond_t* cP;
+	bool held;
+	float val;
+	
+	for (int i=0; i<sched_num_req; i++) {
+		if (!sched_list[i].enabled || (sched_list[i].cond_index < 0)) continue;
+		
+		cP = &sched_cond[sched_list[i].cond_index];
+		held = false;
+		if ((db_get_item_quality(cP->item) == DB_QUALITY_FRESH) && db_get_data_item(cP->item, &val, NULL)) {
+			held = (val < cP->min) || (val > cP->max);
+		}
+		
+		if (held != sched_list[i].cond_held) {
+			sched_list[i].cond_held = held;
+			if (_vm_sched_period(i) > 0) {
+				for (int j=1; j<DB_NUM_ITEMS; j++) {
+					if ((sched_list[i].item_mask & DB_MASK(j)) != 0) {
+						db_set_item_stale_msec(j, _vm_sched_stale_msec(_vm_sched_period(i)));
+					}
+				}
+			}
+		}
+	}
+}
+
+
+// Period of request n, taking its poll condition, freshness goal and the tuned period scale
+// into account (-1 = not polled)
+static int _vm_sched_period(int n)
+{
+	int period_msec;
+	
+	if (!sched_list[n].cond_held) {
+		period_msec = sched_list[n].period_msec;
+	} else {
+		period_msec = sched_cond[sched_list[n].cond_index].alt_period_msec;
+		if (period_msec <= 0) return -1;
+	}
+	if (period_msec < 0) return -1;
+	
+	if ((sched_list[n].goal_msec != 0) && (req_profile == VM_PROFILE_NORMAL)) {
+		period_msec = sched_list[n].goal_period_msec;
+	} else {
+		period_msec = period_msec * tune_get(TUNE_REQ_PERIOD_PCT) / 100;
+		if (req_profile == VM_PROFILE_NORMAL) {
+			period_msec = period_msec * sched_relax_pct / 100;
+		}
+	}
+	if (period_msec < tune_get(TUNE_REQ_MIN_PERIOD_MSEC)) {
+		period_msec = tune_get(TUNE_REQ_MIN_PERIOD_MSEC);
+	}
+	
+	return period_msec;
+}
+
+
+// Shortest catalog request period of a request's items
+static int _vm_sched_catalog_period(db_mask_t item_mask)
+{
+	int period_msec = -1;
+	
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		if ((item_mask & DB_MASK(i)) != 0) {
+			if ((period_msec < 0) || (db_catalog_get(i)->period_msec < period_msec)) {
+				period_msec = db_catalog_get(i)->period_msec;
+			}
+		}
+	}
+	
+	return (period_msec < 0) ? SCHED_CATALOG_PERIOD_MSEC : period_msec;
+}
+
+
+// Note the arrival of a frame from a periodic transmission of the active schedule
+static void _vm_sched_note_periodic_rx(uint32_t id)
+{
+	if (sched_cur_profileP == NULL) return;
+	
+	for (int i=0; i<sched_cur_profileP->num_periodic; i++) {
+		if (sched_cur_profileP->periodic[i].periodic_id == id) {
+			sched_list[sched_cur_profileP->periodic[i].start_index].periodic_rx_msec = cur_rx_usec / 1000;
+		}
+	}
+}
+
+
+// Returns the index of the request matching a response, -1 if none.  There is at most one
+// outstanding request per ECU so a response is normally matched against that request only.
+// The full list is searched only for unexpected (e.g. late) responses.
+static int _vm_sched_note_response(uint32_t rsp_id, int len, uint8_t* data, int64_t rx_usec)
+{
+	int n;
+	
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (sched_outstanding[i].in_use && (sched_outstanding[i].rsp_id == CAN_MANAGER_RSP_FUNCTIONAL)) {
+			// Every ECU answering a functional request is passed on until its window closes.
+			// ECUs that don't support the request may refuse it (or stay silent).
+			n = sched_outstanding[i].req_index;
+			if (!_vm_resp_matches(sched_list[n].reqP, rsp_id, len, data)) {
+				return -1;
+			}
+			if (sched_outstanding[i].num_rsp++ == 0) {
+				_vm_sched_note_health(n, true);
+				_vm_sched_note_latency(n, rx_usec - sched_outstanding[i].tx_usec);
+			} else {
+				sched_list[n].stats.num_rsp += 1;
+			}
+			return n;
+		}
+		
+		if (sched_outstanding[i].in_use && (sched_outstanding[i].rsp_id == rsp_id)) {
+			n = sched_outstanding[i].req_index;
+			if (_vm_resp_matches(sched_list[n].reqP, rsp_id, len, data)) {
+				sched_outstanding[i].in_use = false;
+				sched_num_outstanding -= 1;
+				_vm_sched_note_health(n, true);
+				_vm_sched_note_latency(n, rx_usec - sched_outstanding[i].tx_usec);
+				if (sched_list[n].ddid_read_index >= 0) {
+					// Dynamic DID defined so read it right away
+					sched_list[sched_list[n].ddid_read_index].ddid_state = SCHED_DDID_DEFINED;
+					sched_list[sched_list[n].ddid_read_index].last_tx_msec = 0;
+				}
+				if (sched_list[n].periodic_stop_index >= 0) {
+					// ECU is transmitting the data
+					sched_list[n].periodic_state = SCHED_PDID_STARTED;
+					sched_list[n].periodic_rx_msec = rx_usec / 1000;
+				}
+				return n;
+			}
+			
+			if ((len >= 3) && (data[0] == CAN_UDS_NEG_RSP) && (data[1] == sched_list[n].reqP->data[1])) {
+				// ECU answered the outstanding request with a negative response
+				if (_vm_sched_note_nrc(n, data[2])) {
+					// The interface is waiting for the real response
+					sched_outstanding[i].rsp_pending = true;
+					sched_outstanding[i].tx_msec = rx_usec / 1000;
+					return -1;
+				}
+			} else {
+				// or a mismatched response
+				sched_list[n].stats.num_neg_rsp += 1;
+				_vm_sched_note_health(n, false);
+				_vm_sched_note_item_error(n);
+			}
+			sched_outstanding[i].in_use = false;
+			sched_num_outstanding -= 1;
+			break;
+		}
+	}
+	
+	for (n=0; n<sched_num_req; n++) {
+		if (_vm_resp_matches(sched_list[n].reqP, rsp_id, len, data)) {
+			return n;
+		}
+	}
+	
+	return -1;
+}
+
+
+// Called after an interface error (e.g. timeout or no data).  All outstanding requests
+// were abandoned without a response.
+static void _vm_sched_clear_outstanding(int errno)
+{
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (sched_outstanding[i].in_use) {
+			_vm_sched_abandon(i, errno);
+		}
+		stream_state[i].in_use = false;
+	}
+	sched_num_outstanding = 0;
+}
+
+
+// Outstanding request i was abandoned without a response because of errno
+static void _vm_sched_abandon(int i, int errno)
+{
+	vm_req_stats_t* statsP;
+	
+	statsP = &sched_list[sched_outstanding[i].req_index].stats;
+	switch (errno) {
+		case CAN_ERRNO_TIMEOUT:
+			statsP->num_timeout += 1;
+			break;
+		case CAN_ERRNO_FRAME_TIMEOUT:
+			statsP->num_frame_timeout += 1;
+			break;
+		case CAN_ERRNO_NO_DATA:
+			statsP->num_no_data += 1;
+			_vm_sched_note_item_error(sched_outstanding[i].req_index);
+			break;
+	}
+	_vm_sched_note_health(sched_outstanding[i].req_index, false);
+	
+	// Drop any partly decoded response from the ECU
+	for (int j=0; j<CAN_MANAGER_MAX_SESSIONS; j++) {
+		if (stream_state[j].in_use && (stream_state[j].id == sched_outstanding[i].rsp_id)) {
+			stream_state[j].in_use = false;
+		}
+	}
+	
+	sched_outstanding[i].in_use = false;
+	sched_num_outstanding -= 1;
+}
+
+
+// Returns the expected ISO-TP response length for request n from the length its decoder
+// checks, or 0 if unknown.  A multi-DID 0x22 or multi-PID Mode 01 request without its own
+// decoder is the sum of the single-DID/PID responses found elsewhere in the list.
+static int _vm_sched_expected_len(int n, int num_req, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[])
+{
+	const can_request_t* reqP = req_list[n];
+	int num_parts;
+	int len;
+	int j;
+	
+	if (decoder_list[n].num_rows != 0) {
+		return decoder_list[n].rowP[0].rsp_len;
+	}
+	
+	num_parts = _vm_sched_num_parts(reqP);
+	if (num_parts == 0) {
+		return 0;
+	}
+	
+	len = 1;
+	for (int i=0; i<num_parts; i++) {
+		j = _vm_sched_part_index(reqP, i, num_req, req_list);
+		if ((j < 0) || (decoder_list[j].num_rows == 0) || (decoder_list[j].rowP[0].rsp_len == 0)) return 0;
+		len += decoder_list[j].rowP[0].rsp_len - 1;
+	}
+	
+	return len;
+}
+
+
+// Returns the number of single-DID/PID parts of a multi-DID 0x22 or multi-PID Mode 01
+// request (0 for other requests)
+static int _vm_sched_num_parts(const can_request_t* reqP)
+{
+	if ((reqP->data[1] == 0x22) && (reqP->data[0] >= 5)) {
+		return (reqP->data[0] - 1) / 2;
+	} else if ((reqP->data[1] == 0x01) && (reqP->data[0] >= 3)) {
+		return reqP->data[0] - 1;
+	}
+	
+	return 0;
+}
+
+
+// Returns the index of the single-DID/PID request in the list for part of a multi-DID or
+// multi-PID request (-1 if there isn't one)
+static int _vm_sched_part_index(const can_request_t* reqP, int part, int num_req, const can_request_t* req_list[])
+{
+	const can_request_t* pP;
+	int id_len = (reqP->data[1] == 0x22) ? 2 : 1;
+	int pos = 2 + id_len*part;
+	
+	if ((pos + id_len) > reqP->req_len) {
+		return -1;
+	}
+	
+	for (int j=0; j<num_req; j++) {
+		pP = req_list[j];
+		if ((pP != reqP) && (pP->data[0] == (1 + id_len)) && (pP->data[1] == reqP->data[1]) &&
+		    (memcmp(&pP->data[2], &reqP->data[pos], id_len) == 0)) {
+			return j;
+		}
+	}
+	
+	return -1;
+}
+
+
+// Requests to the same ECU (and protocol) as the previous request are preferred on
+// interfaces where changing IDs is expensive (ELM327).  Each ID or protocol change a
+// request would cause counts against it as the interface's switch cost, so due requests
+// are grouped by header but one that is overdue by more than the cost still wins.
+static int _vm_sched_switch_cost(const can_request_t* reqP, int switch_msec)
+{
+	int n = 0;
+	
+	if (switch_msec == 0) return 0;
+	
+	if (reqP->req_id != sched_last_req_id) n++;
+	if (reqP->rsp_id != sched_last_rsp_id) n++;
+	if ((reqP->req_id > 0x7FF) != (sched_last_req_id > 0x7FF)) n++;
+	
+	return n * switch_msec;
+}
+
+
+// Returns the data broker items decoded from request n's response.  Multi-DID and
+// multi-PID requests carry the items of their single-DID/PID parts.
+static db_mask_t _vm_sched_item_mask(int n, int num_req, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[])
+{
+	const can_request_t* reqP = req_list[n];
+	db_mask_t mask = 0;
+	int j;
+	
+	for (int i=0; i<decoder_list[n].num_rows; i++) {
+		if (decoder_list[n].rowP[i].db_item != DB_ITEM_NONE) {
+			mask |= DB_MASK(decoder_list[n].rowP[i].db_item);
+		}
+	}
+	
+	if (decoder_list[n].num_rows == 0) {
+		for (int i=0; i<_vm_sched_num_parts(reqP); i++) {
+			j = _vm_sched_part_index(reqP, i, num_req, req_list);
+			if (j >= 0) {
+				mask |= _vm_sched_item_mask(j, num_req, req_list, decoder_list);
+			}
+		}
+	}
+	
+	return mask;
+}
+
+
+// Handle a negative response to an outstanding request.  Returns true if the ECU will send
+// the real response later (responsePending on an interface that waits for it).
+static bool _vm_sched_note_nrc(int req_index, uint8_t nrc)
+{
+	sched_entry_t* sP = &sched_list[req_index];
+	
+	sP->stats.last_nrc = nrc;
+	
+	if ((sP->ddid_read_index >= 0) && (nrc != CAN_NRC_RESPONSE_PENDING) && (nrc != CAN_NRC_BUSY_REPEAT_REQUEST)) {
+		// ECU won't define the dynamic DID so its source DIDs are read by the fallback requests
+		ESP_LOGI(TAG, "Dynamic DID refused by 0x%lx (NRC 0x%02x) - using fallback requests", sP->reqP->rsp_id, nrc);
+		sP->stats.num_neg_rsp += 1;
+		sched_list[sP->ddid_read_index].ddid_state = SCHED_DDID_REFUSED;
+		if (sched_cur_profileP != NULL) {
+			_vm_sched_apply_profile(sched_cur_profileP);
+		}
+		return false;
+	}
+	if ((sP->periodic_stop_index >= 0) && (nrc != CAN_NRC_RESPONSE_PENDING) && (nrc != CAN_NRC_BUSY_REPEAT_REQUEST)) {
+		// ECU won't transmit the data periodically so it is polled by the fallback requests
+		ESP_LOGI(TAG, "Periodic data refused by 0x%lx (NRC 0x%02x) - polling instead", sP->reqP->rsp_id, nrc);
+		sP->stats.num_neg_rsp += 1;
+		sP->periodic_state = SCHED_PDID_REFUSED;
+		if (sched_cur_profileP != NULL) {
+			_vm_sched_apply_profile(sched_cur_profileP);
+		}
+		return false;
+	}
+	if ((sP->ddid_define_index >= 0) && (nrc == CAN_NRC_REQUEST_OUT_OF_RANGE)) {
+		// ECU lost the dynamic DID (e.g. it restarted) so define it again
+		sP->stats.num_neg_rsp += 1;
+		sP->ddid_state = SCHED_DDID_UNDEFINED;
+		_vm_sched_note_health(req_index, false);
+		return false;
+	}
+	
+	// A define request is issued in place of its read so the read is asked again
+	if (sP->ddid_read_index >= 0) {
+		sP = &sched_list[sP->ddid_read_index];
+	}
+	switch (nrc) {
+		case CAN_NRC_RESPONSE_PENDING:
+			sP->stats.num_rsp_pending += 1;
+			if (can_rsp_pending_supported()) {
+				return true;
+			}
+			// The interface ended the request so ask again shortly
+			sP->last_tx_msec = (esp_timer_get_time() / 1000) + SCHED_BUSY_RETRY_MSEC - sP->period_msec;
+			break;
+		
+		case CAN_NRC_BUSY_REPEAT_REQUEST:
+			sP->stats.num_neg_rsp += 1;
+			sP->last_tx_msec = (esp_timer_get_time() / 1000) + SCHED_BUSY_RETRY_MSEC - sP->period_msec;
+			break;
+		
+		case CAN_NRC_SERVICE_NOT_SUPPORTED:
+		case CAN_NRC_SUBFUNC_NOT_SUPPORTED:
+		case CAN_NRC_REQUEST_OUT_OF_RANGE:
+		case CAN_NRC_NOT_SUPP_IN_SESSION:
+			ESP_LOGI(TAG, "Request to 0x%lx not supported (NRC 0x%02x) - disabling", sP->reqP->rsp_id, nrc);
+			sP->stats.num_neg_rsp += 1;
+			sP->unsupported = true;
+			sP->enabled = false;
+			if (sched_follow_i == req_index) {
+				sched_follow_i = -1;
+			}
+			_vm_sched_note_item_error(req_index);
+			_vm_update_rx_id_list();
+			break;
+		
+		default:
+			sP->stats.num_neg_rsp += 1;
+			_vm_sched_note_health(req_index, false);
+			_vm_sched_note_item_error(req_index);
+	}
+	
+	return false;
+}
+
+
+// Flag the items of a request that the ECU refused to provide
+static void _vm_sched_note_item_error(int req_index)
+{
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		if ((sched_list[req_index].item_mask & DB_MASK(i)) != 0) {
+			db_set_item_error(i);
+		}
+	}
+}
+
+
+static void _vm_sched_note_health(int req_index, bool success)
+{
+	sched_entry_t* sP;
+	
+	// A dynamic DID's define request is issued in place of its read so counts as the read
+	if (sched_list[req_index].ddid_read_index >= 0) {
+		req_index = sched_list[req_index].ddid_read_index;
+	}
+	sP = &sched_list[req_index];
+	
+	if (success) {
+		if (sP->backoff_msec != 0) {
+			ESP_LOGI(TAG, "Request to 0x%lx responding", sP->reqP->rsp_id);
+			event_publish(EVENT_REQ_HEALTH);
+		}
+		sP->fail_count = 0;
+		sP->backoff_msec = 0;
+		_vm_sched_note_activity();
+	} else {
+		sched_fail_run += 1;
+		sP->fail_count += 1;
+		if (sP->fail_count >= SCHED_FAIL_THRESHOLD) {
+			if (sP->backoff_msec == 0) {
+				ESP_LOGI(TAG, "Request to 0x%lx not responding - backing off", sP->reqP->rsp_id);
+				sP->backoff_msec = tune_get(TUNE_BACKOFF_MIN_MSEC);
+				event_publish(EVENT_REQ_HEALTH);
+			} else if (sP->backoff_msec < tune_get(TUNE_BACKOFF_MAX_MSEC)) {
+				sP->backoff_msec *= 2;
+				if (sP->backoff_msec > tune_get(TUNE_BACKOFF_MAX_MSEC)) {
+					sP->backoff_msec = tune_get(TUNE_BACKOFF_MAX_MSEC);
+				}
+			}
+		}
+	}
+}
+
+
+static void _vm_sched_note_latency(int req_index, int64_t lat_usec)
+{
+	vm_req_stats_t* statsP = &sched_list[req_index].stats;
+	int n = 0;
+	uint32_t lat_msec;
+	
+	if (lat_usec < 0) lat_usec = 0;
+	if (lat_usec > INT32_MAX) lat_usec = INT32_MAX;
+	
+	// Smoothed latency for cadence slot sizing
+	if (sched_list[req_index].lat_avg_usec == 0) {
+		sched_list[req_index].lat_avg_usec = (lat_usec == 0) ? 1 : (int) lat_usec;
+	} else {
+		sched_list[req_index].lat_avg_usec += ((int) lat_usec - sched_list[req_index].lat_avg_usec) >> CADENCE_LAT_SHIFT;
+	}
+	
+	statsP->num_rsp += 1;
+	if (lat_usec > statsP->lat_max_usec) {
+		statsP->lat_max_usec = (uint32_t) lat_usec;
+	}
+	
+	// Find the power-of-2 mSec bin
+	lat_msec = (uint32_t) (lat_usec / 1000);
+	while ((n < (VM_LAT_HIST_BINS-1)) && (lat_msec >= (1UL << n))) {
+		n++;
+	}
+	statsP->lat_hist[n] += 1;
+}
+
+
+#ifdef LOG_REQ_STATS
+static void _vm_log_req_stats()
+{
+	static int64_t prev_log_msec = 0;
+	int64_t cur_msec = esp_timer_get_time() / 1000;
+	vm_req_stats_t* sP;
+	
+	if ((cur_msec - prev_log_msec) < LOG_REQ_STATS_MSEC) {
+		return;
+	}
+	prev_log_msec = cur_msec;
+	
+	for (int i=0; i<sched_num_req; i++) {
+		sP = &sched_list[i].stats;
+		if (sP->num_tx == 0) continue;
+		ESP_LOGI(TAG, "0x%lx->0x%lx: tx %lu rsp %lu p50 %lu p90 %lu max %lu mS, TO %lu ND %lu CF %lu NR %lu",
+		         sP->req_id, sP->rsp_id, sP->num_tx, sP->num_rsp,
+		         vm_get_latency_percentile(sP, 50), vm_get_latency_percentile(sP, 90), sP->lat_max_usec / 1000,
+		         sP->num_timeout, sP->num_no_data, sP->num_frame_timeout, sP->num_neg_rsp);
+	}
+}
+#endif
+
+
+static bool _vm_resp_matches(const can_request_t* reqP, uint32_t resp_can_id, int resp_data_len, uint8_t* resp_data)
+{
+	int j, n;
+	
+	// ReadDataByPeriodicIdentifier's positive response is just the SID (the data arrives
+	// in periodic frames)
+	if ((reqP->data[1] == 0x2A) && (resp_data_len >= 1)) {
+		return _vm_rsp_id_matches(reqP, resp_can_id) && (resp_data[0] == 0x6A);
+	}
+	
+	// Must at least have a UDS packet length (byte 0) and service ID (byte 1)
+	if (resp_data_len < 2) {
+		return false;
+	}
+	
+	// Must not be a negative response
+	if (resp_data[0] == CAN_UDS_NEG_RSP) {
+		return false;
+	}
+	
+	// Check CAN ID and SID
+	if (!_vm_rsp_id_matches(reqP, resp_can_id) || (resp_data[0] != (reqP->data[1] + 0x40))) {
+		return false;
+	}
+	
+	// Check remaining request bytes
+	if ((reqP->data[1] == 0x01) && (reqP->data[0] > 2)) {
+		// Multi-PID Mode 01 request: the ECU may answer with any of the PIDs first
+		for (j=2; (j<=reqP->data[0]) && (j<reqP->req_len); j++) {
+			if (resp_data[1] == reqP->data[j]) {
+				return true;
+			}
 		}
+		return false;
+	} else if (reqP->data[1] == 0x2C) {
+		// DynamicallyDefineDataIdentifier: the response only echoes the subfunction and DID
+		if (resp_data_len < 4) {
+			return false;
+		}
+		n = 3;
+	} else {
+		if (resp_data_len <= reqP->data[0]) {
+			// Not enough incoming data to even check against original request
+			return false;
+		}
+		n = reqP->data[0] - 1;  // Count of additional subfunction/DID bytes in request (beyond SID)
+		if ((reqP->data[1] == 0x22) && (n > 2)) {
+			// Multi-DID request: only the first DID immediately follows the SID
+			n = 2;
+		}
+	}
+	j = 2;
+	while (n--) {
+		if (resp_data[j-1] != reqP->data[j]) {
+			return false;
+		}
+		j += 1;
+	}
+	
+	return true;
+}
+
+
+static bool _vm_rsp_id_matches(const can_request_t* reqP, uint32_t resp_can_id)
+{
+	if (reqP->rsp_id == CAN_MANAGER_RSP_FUNCTIONAL) {
+		return can_is_functional_rsp(reqP->req_id, resp_can_id);
+	}
+	
+	return (resp_can_id == reqP->rsp_id);
+}
+
+
+// May be called from within an ISR context and by more than one receive context at once.
+// The template holds all fields but the data pointer.  The entry is filled while rsp_mux
+// is held so entries are published in the order they were claimed (even the large buffer
+// copy is short next to a frame time).
+static void _vm_queue_push(rsp_desc_t* templateP, uint8_t* data)
+{
+	rsp_desc_t* dP;
+	uint32_t h;
+	int len = templateP->len;
+	
+	if ((cur_vehicleP == NULL) || (len < 0)) {
+		return;
+	}
+	
+	portENTER_CRITICAL_SAFE(&rsp_mux);
+	h = rsp_head;
+	if ((h - __atomic_load_n(&rsp_tail, __ATOMIC_ACQUIRE)) >= RSP_QUEUE_LEN) {
+		// Queue full
+		rsp_drop_count += 1;
+		portEXIT_CRITICAL_SAFE(&rsp_mux);
+		return;
+	}
+	
+	dP = &rsp_queue[h & RSP_QUEUE_MASK];
+	if (len <= RSP_SLOT_LEN) {
+		dP->dataP = rsp_slot_buf[h & RSP_QUEUE_MASK];
+	} else if ((len <= rsp_large_len) && !rsp_large_in_use) {
+		rsp_large_in_use = true;
+		dP->dataP = rsp_large_bufP;
 	} else {
-		success = false;
+		rsp_drop_count += 1;
+		portEXIT_CRITICAL_SAFE(&rsp_mux);
+		return;
+	}
+	
+	dP->id = templateP->id;
+	dP->is_bcast = templateP->is_bcast;
+	dP->is_partial = templateP->is_partial;
+	dP->offset = templateP->offset;
+	dP->total_len = templateP->total_len;
+	dP->len = len;
+	dP->rx_usec = templateP->rx_usec;
+	memcpy(dP->dataP, data, (size_t) len);
+	
+	// Publish the entry
+	__atomic_store_n(&rsp_head, h + 1, __ATOMIC_RELEASE);
+	portEXIT_CRITICAL_SAFE(&rsp_mux);
+	
+	// Get the task running to process it and send the next request
+	_vm_notify_task();
+}
+
+
+// Append a chunk of a streamed response to its window and publish the decoder rows whose
+// bytes are now all present
+static void _vm_process_partial(rsp_desc_t* dP)
+{
+	const vm_decoder_t* rP;
+	const vm_decoder_list_t* listP;
+	vm_decoder_list_t row_list;
+	stream_state_t* sP = NULL;
+	float vals[VM_MAX_DECODE_VALS];
+	
+	// Find the stream for this response ID, starting a new one with its first frame
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (stream_state[i].in_use && (stream_state[i].id == dP->id)) {
+			sP = &stream_state[i];
+			break;
+		}
+	}
+	if (dP->offset == 0) {
+		for (int i=0; (sP == NULL) && (i<CAN_MANAGER_MAX_SESSIONS); i++) {
+			if (!stream_state[i].in_use) {
+				sP = &stream_state[i];
+			}
+		}
+		if (sP == NULL) return;
+		
+		sP->in_use = true;
+		sP->id = dP->id;
+		sP->total_len = dP->total_len;
+		sP->avail = 0;
+		sP->done_rows = 0;
+		sP->req_index = -1;
+		for (int n=0; n<sched_num_req; n++) {
+			if (sched_list[n].enabled && sched_list[n].streaming && _vm_resp_matches(sched_list[n].reqP, dP->id, dP->len, dP->dataP)) {
+				sP->req_index = n;
+				break;
+			}
+		}
+	}
+	if ((sP == NULL) || (sP->req_index < 0)) return;
+	
+	if ((dP->offset != sP->avail) || (dP->total_len != sP->total_len)) {
+		// Lost a chunk - the rest is decoded when the response completes
+		sP->req_index = -1;
+		return;
+	}
+	memcpy(&sP->win[sP->avail], dP->dataP, dP->len);
+	sP->avail += dP->len;
+	
+	// Publish the rows that can now be decoded
+	listP = &sched_decoder_list[sP->req_index];
+	for (int i=0; i<listP->num_rows && i<VM_MAX_DECODE_VALS; i++) {
+		rP = &listP->rowP[i];
+		if (((sP->done_rows & (1 << i)) != 0) || (rP->db_item == DB_ITEM_NONE)) continue;
+		if ((rP->rsp_len != 0) && (sP->total_len != rP->rsp_len)) continue;
+		if ((rP->byte_offset + rP->width) > sP->avail) continue;
+		
+		row_list.num_rows = 1;
+		row_list.rowP = rP;
+		if (vm_decode_response(&row_list, sP->total_len, sP->win, vals) != 0) {
+			sP->done_rows |= (1 << i);
+		}
+	}
+}
+
+
+// Complete response: note the rows published while it streamed and release the stream
+static void _vm_stream_complete(uint32_t id, int req_index, int len)
+{
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (stream_state[i].in_use && (stream_state[i].id == id)) {
+			stream_state[i].in_use = false;
+			if ((req_index >= 0) && (stream_state[i].req_index == req_index) && (stream_state[i].total_len == len)) {
+				cur_stream_listP = &sched_decoder_list[req_index];
+				cur_stream_rows = stream_state[i].done_rows;
+			}
+			break;
+		}
+	}
+}
+
+
+static bool _vm_add_broadcast(uint32_t id, const vm_decoder_list_t* decoderP, const vm_signal_list_t* signalP, vehicle_rx_data fcn)
+{
+	if (num_bcast_sub >= VM_MAX_BCAST_SUBS) {
+		ESP_LOGE(TAG, "Too many broadcast subscriptions");
+		return false;
+	}
+	
+	bcast_sub[num_bcast_sub].id = id;
+	bcast_sub[num_bcast_sub].decoderP = decoderP;
+	bcast_sub[num_bcast_sub].signalP = signalP;
+	bcast_sub[num_bcast_sub].fcn = fcn;
+	if (!can_subscribe_broadcast(id)) {
+		return false;
+	}
+	num_bcast_sub += 1;
+	
+	_vm_update_rx_id_list();
+	
+	return true;
+}
+
+
+static void _vm_process_broadcast(uint32_t id, int len, uint8_t* data)
+{
+	float vals[VM_MAX_SIGNALS];
+	
+	for (int i=0; i<num_bcast_sub; i++) {
+		if (bcast_sub[i].id == id) {
+			if (bcast_sub[i].decoderP != NULL) {
+				(void) vm_decode_response(bcast_sub[i].decoderP, len, data, vals);
+			}
+			if (bcast_sub[i].signalP != NULL) {
+				(void) vm_decode_signals(bcast_sub[i].signalP, len, data, vals);
+			}
+			if (bcast_sub[i].fcn != NULL) {
+				bcast_sub[i].fcn(id, -1, len, data);
+			}
+			_vm_sched_note_periodic_rx(id);
+			_vm_sched_note_activity();
+			break;
+		}
+	}
+}
+
+
+// Let the CAN manager know the unique set of IDs we expect to receive so interfaces
+// that filter can be configured once instead of for each request
+static void _vm_update_rx_id_list()
+{
+	bool found;
+	int n = 0;
+	int num_ids;
+	uint32_t id;
+	static uint32_t id_list[CAN_MANAGER_MAX_RX_IDS];
+	
+	for (int i=0; i<(sched_num_req + num_bcast_sub); i++) {
+		num_ids = 1;
+		if (i < sched_num_req) {
+			if (!sched_list[i].enabled) continue;
+			id = sched_list[i].reqP->rsp_id;
+			if (id == CAN_MANAGER_RSP_FUNCTIONAL) {
+				// Any 11-bit responder.  29-bit responders (256 IDs) are only received with the
+				// response filter off.
+				if (sched_list[i].reqP->req_id != CAN_MANAGER_FUNC_REQ_ID) continue;
+				id = 0x7E8;
+				num_ids = 8;
+			}
+		} else {
+			id = bcast_sub[i - sched_num_req].id;
+		}
+		
+		for (int k=0; k<num_ids; k++, id++) {
+			found = false;
+			for (int j=0; j<n; j++) {
+				if (id_list[j] == id) {
+					found = true;
+					break;
+				}
+			}
+			if (!found && (n < CAN_MANAGER_MAX_RX_IDS)) {
+				id_list[n++] = id;
+			}
+		}
+	}
+	
+	can_set_rx_id_list(n, id_list);
+}
+
+
+// Size the response buffers of the CAN manager, its interfaces and the response queue for
+// the longest response of the vehicle's request lists and carve them from one internal
+// RAM allocation.  Vehicles issuing their own requests or with a response of unknown
+// length get the worst case.  Called by vm_init before any request is issued.
+static void _vm_plan_buffers()
+{
+	int can_len;
+	int len;
+	int max_len = RSP_SLOT_LEN;
+	sched_profile_t* pP;
+	
+	_vm_free_buffers();
+	
+	if (cur_vehicleP->fcn_eval != NULL) {
+		max_len = CAN_MANAGER_MAX_RSP_LEN;
+	}
+	for (int j=0; (j<SCHED_MAX_PROFILES) && (max_len < CAN_MANAGER_MAX_RSP_LEN); j++) {
+		pP = &sched_profile[j];
+		if (!pP->valid) continue;
+		
+		for (int i=0; i<pP->num_req; i++) {
+			len = _vm_plan_rsp_len(i, pP->num_req, pP->req_list, pP->decoder_list);
+			if (len == 0) {
+				max_len = CAN_MANAGER_MAX_RSP_LEN;
+				break;
+			} else if (len > max_len) {
+				max_len = len;
+			}
+		}
+	}
+	max_len = (max_len + PLAN_ALIGN - 1) & ~(PLAN_ALIGN - 1);
+	if (max_len > CAN_MANAGER_MAX_RSP_LEN) {
+		max_len = CAN_MANAGER_MAX_RSP_LEN;
+	}
+	
+	can_len = can_get_rsp_buf_size(max_len);
+	len = can_len + ((max_len > RSP_SLOT_LEN) ? max_len : 0);
+	if (len != 0) {
+		plan_arenaP = heap_caps_malloc(len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+		if (plan_arenaP == NULL) {
+			ESP_LOGE(TAG, "Response buffer allocation (%d bytes) failed - responses over %d bytes dropped", len, RSP_SLOT_LEN);
+			return;
+		}
+		if (can_len != 0) {
+			can_set_rsp_bufs(plan_arenaP, max_len);
+		}
+		if (max_len > RSP_SLOT_LEN) {
+			rsp_large_bufP = &plan_arenaP[can_len];
+			rsp_large_len = max_len;
+		}
+	}
+	plan_rsp_len = max_len;
+	
+	ESP_LOGI(TAG, "Response buffers: %d bytes for responses up to %d bytes", len, max_len);
+}
+
+
+// Return to the minimum length buffers.  Called while no requests are outstanding.
+static void _vm_free_buffers()
+{
+	can_set_rsp_bufs(NULL, 0);
+	rsp_large_bufP = NULL;
+	rsp_large_len = 0;
+	plan_rsp_len = 0;
+	
+	if (plan_arenaP != NULL) {
+		heap_caps_free(plan_arenaP);
+		plan_arenaP = NULL;
+	}
+}
+
+
+// Longest response to request n or 0 if unknown (a decoder row accepting any length)
+static int _vm_plan_rsp_len(int n, int num_req, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[])
+{
+	int len;
+	
+	if (decoder_list == NULL) {
+		return 0;
+	}
+	
+	len = _vm_sched_expected_len(n, num_req, req_list, decoder_list);
+	for (int r=1; (len != 0) && (r<decoder_list[n].num_rows); r++) {
+		if (decoder_list[n].rowP[r].rsp_len == 0) {
+			return 0;
+		} else if (decoder_list[n].rowP[r].rsp_len > len) {
+			len = decoder_list[n].rowP[r].rsp_len;
+		}
 	}
 	
-	return success;
+	return len;
 }
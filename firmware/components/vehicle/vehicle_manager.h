@@ -29,6 +29,9 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "data_broker.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 
 
@@ -36,17 +39,67 @@
 // Global constants
 //
 
-// Indicies for accessing vehicle ranges
-// Notes about ranges for best display gauge layout
-//   1. Ranges should be even, whole numbers
-//   2. POWER specific: should be multiples of 10
-//   3. AUX specific: min delta should be 8 kW
-//   4. ???
-#define VM_RANGE_POWER    0
-#define VM_RANGE_AUX      1
-#define VM_RANGE_TORQUE   2
-#define VM_RANGE_HV_BATTI 3
-#define VM_RANGE_LV_BATTV 4
+// Maximum number of requests the scheduler can manage
+#define VM_MAX_SCHED_REQ  32
+
+// Maximum number of values a single response decoder list may produce
+#define VM_MAX_DECODE_VALS 8
+
+// Maximum number of dynamically defined DIDs (UDS 0x2C) a schedule may read
+#define VM_MAX_DDID        4
+
+// Maximum number of periodic data identifier (UDS 0x2A) transmissions a schedule may use
+#define VM_MAX_PERIODIC    4
+
+// Maximum number of poll conditions a schedule may use
+#define VM_MAX_SCHED_COND  4
+
+// Maximum number of broadcast frame subscriptions (must not exceed CAN_MANAGER_MAX_BCAST)
+#define VM_MAX_BCAST_SUBS  8
+
+// Maximum number of signals decoded from one broadcast frame (at least VM_MAX_DECODE_VALS)
+#define VM_MAX_SIGNALS     16
+
+// Maximum number of freshness goals the GUI may set at once
+#define VM_MAX_GOALS       12
+
+// ISO-TP flow control block size (0 = no limit) and separation time (STmin encoding)
+#define VM_FC(bs, stmin)  ((uint16_t) (((bs) << 8) | (stmin)))
+#define VM_FC_DEFAULT     0xFFFF
+#define VM_FC_BS(fc)      ((uint8_t) ((fc) >> 8))
+#define VM_FC_STMIN(fc)   ((uint8_t) ((fc) & 0xFF))
+
+// Request period taken from the signal catalog (the shortest period of the items the
+// request's decoders update)
+#define VM_PERIOD_CATALOG -1
+
+// Request priorities
+#define VM_PRIORITY_LOW   0
+#define VM_PRIORITY_MED   1
+#define VM_PRIORITY_HIGH  2
+
+// Request profiles
+//  - NORMAL: requests implied by the GUI's item mask at their configured periods
+//  - PERF_RUN: only VM_PERF_RUN_ITEMS, each requested as fast as the interface allows
+//  - CHARGING: only VM_CHARGE_ITEMS, each requested at most every VM_CHARGE_PERIOD_MSEC
+#define VM_PROFILE_NORMAL   0
+#define VM_PROFILE_PERF_RUN 1
+#define VM_PROFILE_CHARGING 2
+
+// Items polled during a performance run (e.g. a timed 0-60 run).  There is no gear item
+// yet so launch is detected from speed alone.
+#define VM_PERF_RUN_ITEMS (DB_MASK(DB_ITEM_SPEED))
+
+// Items polled during a charging session.  HV power is derived from the battery voltage
+// and current.  Speed is kept so driving away ends the session.
+#define VM_CHARGE_ITEMS   (DB_MASK(DB_ITEM_HV_BATT_V) | DB_MASK(DB_ITEM_HV_BATT_I) | \
+                           DB_MASK(DB_ITEM_HV_BATT_MIN_T) | DB_MASK(DB_ITEM_HV_BATT_MAX_T) | \
+                           DB_MASK(DB_ITEM_HV_SOC) | DB_MASK(DB_ITEM_SPEED))
+#define VM_CHARGE_PERIOD_MSEC 5000
+
+// Request latency histogram bins.  Bin n counts responses with a TX->complete latency
+// less than 2^n mSec (the last bin counts everything longer).
+#define VM_LAT_HIST_BINS  10
 
 
 
@@ -55,8 +108,8 @@
 //
 typedef void (*vehicle_init)();
 typedef void (*vehicle_eval)();
-typedef void (*vehicle_set_req_mask)(uint32_t mask);
-typedef void (*vehicle_rx_data)(uint32_t id, int len, uint8_t* data);
+typedef void (*vehicle_set_req_mask)(db_mask_t mask);
+typedef void (*vehicle_rx_data)(uint32_t id, int req_index, int len, uint8_t* data);
 typedef void (*vehicle_note_can_error)(int errno);
 
 
@@ -68,29 +121,161 @@ typedef void (*vehicle_note_can_error)(int errno);
 // Vehicle UDS service CAN request packets for each mask
 typedef struct {
 	uint32_t req_id;            // Request CAN ID
-	uint32_t rsp_id;            // Response CAN ID
+	uint32_t rsp_id;            // Response CAN ID (CAN_MANAGER_RSP_FUNCTIONAL for every ECU answering a
+	                            //   functional request, each passed to fcn_rx_data with its own ID)
+	int period_msec;            // Target request period (0 = as fast as possible, VM_PERIOD_CATALOG)
+	int priority;               // Higher priority wins when requests are equally overdue
+	uint16_t flow_control;      // ISO-TP flow control (VM_FC() or VM_FC_DEFAULT for vehicle's)
 	int req_len;                // Number of valid bytes in the request
-	uint8_t data[];             // CAN Data
+	uint8_t data[];             // CAN Data: payload length followed by the payload (requests longer
+	                            //   than 8 bytes are sent segmented, see can_get_max_req_len())
 } can_request_t;
 
+// Response decoder table row.  Each row extracts one big-endian value from a response
+// (data[0] is the positive response SID), scales it and optionally updates a data item.
+// A zero width row only gives the expected length of a response the vehicle unpacks itself.
+typedef struct {
+	int rsp_len;                // Expected response length (0 = any long enough)
+	int byte_offset;            // Offset of the most significant byte in the response
+	int width;                  // Width in bytes (1 - 4, 0 for VM_DECODER_LEN rows)
+	bool is_signed;             // Value is two's complement
+	float scale;                // Value = raw * scale + offset
+	float offset;
+	int db_item;                // DB_ITEM_* to update, DB_ITEM_NONE (0) for values the vehicle post-processes
+} vm_decoder_t;
+
+// List of decoder rows for one request
+typedef struct {
+	int num_rows;
+	const vm_decoder_t* rowP;
+} vm_decoder_list_t;
+
+#define VM_DECODER_LIST(rows) {sizeof(rows)/sizeof(rows[0]), rows}
+#define VM_DECODER_NONE       {0, NULL}
+#define VM_DECODER_LEN(len)   {len, 0, 0, false, 1.0, 0.0, DB_ITEM_NONE}
+
+// Broadcast frame signal (DBC style: any bit position, 1 - 32 bits, Intel or Motorola
+// byte order).  Rows are built with VM_SIGNAL_INTEL() and VM_SIGNAL_MOTOROLA() from the
+// DBC start bit (the LSB for Intel, the MSB for Motorola) and length so the mask, shift and
+// frame length needed are constants.  The frame is treated as a 64-bit little-endian word
+// for Intel signals and a 64-bit big-endian word for Motorola signals.
+typedef struct {
+	uint32_t mask;              // (1 << length) - 1
+	uint8_t shift;              // Position of the LSB in the frame word
+	uint8_t min_len;            // Frame bytes needed
+	uint8_t flags;              // VM_SIG_*
+	float scale;                // Value = raw * scale + offset
+	float offset;
+	int db_item;                // DB_ITEM_* to update, DB_ITEM_NONE (0) for values the vehicle post-processes
+} vm_signal_t;
+
+// List of signals carried by one frame
+typedef struct {
+	int num_signals;
+	const vm_signal_t* sigP;
+} vm_signal_list_t;
+
+#define VM_SIG_SIGNED   0x01        // Value is two's complement
+#define VM_SIG_MOTOROLA 0x02        // Set by VM_SIGNAL_MOTOROLA()
+
+#define VM_SIG_MASK(len)            ((uint32_t) (0xFFFFFFFFUL >> (32 - (len))))
+#define VM_SIG_MOTO_LSB(start, len) (((7 - ((start) / 8)) * 8) + ((start) % 8) - ((len) - 1))
+
+#define VM_SIGNAL_INTEL(start, len, flags, scale, offset, item) \
+	{VM_SIG_MASK(len), (start), (((start) + (len) + 7) / 8), (flags), (scale), (offset), (item)}
+#define VM_SIGNAL_MOTOROLA(start, len, flags, scale, offset, item) \
+	{VM_SIG_MASK(len), VM_SIG_MOTO_LSB(start, len), (8 - (VM_SIG_MOTO_LSB(start, len) / 8)), \
+	 ((flags) | VM_SIG_MOTOROLA), (scale), (offset), (item)}
+
+#define VM_SIGNAL_LIST(sigs)  {sizeof(sigs)/sizeof(sigs[0]), sigs}
+
+// Multi-DID ReadDataByIdentifier (0x22) request group.  Lists the single-DID request
+// index for each DID, in order, carried by the grouped request.  The response is
+// split back into a single-DID response for each.  Also lists the source DIDs, in
+// definition order, of a dynamically defined DID and the single-PID requests of a
+// multi-PID OBD-II Mode 01 request.
+typedef struct {
+	int num_parts;
+	const int* part_indexP;
+} vm_did_group_t;
+
+#define VM_DID_GROUP(parts) {sizeof(parts)/sizeof(parts[0]), parts}
+
+// Per-request statistics (counts since the request was added to the schedule)
+typedef struct {
+	uint32_t req_id;
+	uint32_t rsp_id;
+	uint32_t num_tx;
+	uint32_t num_rsp;                            // Good responses
+	uint32_t num_timeout;                        // No response
+	uint32_t num_no_data;                        // ELM327 "NO DATA"
+	uint32_t num_frame_timeout;                  // Multi-frame response lost a consecutive frame
+	uint32_t num_neg_rsp;                        // Negative or mismatched response
+	uint32_t num_rsp_pending;                    // Negative response "response pending"
+	uint8_t last_nrc;                            // Most recent negative response code (0 = none)
+	uint32_t lat_max_usec;
+	uint32_t lat_hist[VM_LAT_HIST_BINS];
+} vm_req_stats_t;
+
+// Freshness goal of a displayed item: the oldest its value may get before it is replaced
+typedef struct {
+	int item;
+	int max_age_msec;
+} vm_goal_t;
+
+typedef struct {
+	int num_goals;
+	const vm_goal_t* goalP;
+} vm_goal_list_t;
+
+#define VM_GOAL_LIST(goals) {sizeof(goals)/sizeof(goals[0]), goals}
+#define VM_GOAL_NONE        {0, NULL}
+
+// Freshness goal state (counts since the goal was set)
+typedef struct {
+	int item;
+	int goal_msec;
+	int age_msec;                                // Worst age over the last evaluation (-1 = no data)
+	bool met;
+	bool controlled;                             // Produced by requests the scheduler can speed up
+	bool limited;                                // Missed with its requests polled as fast as possible
+	uint32_t num_eval;
+	uint32_t num_unmet;
+} vm_goal_stats_t;
+
 // Vehicle configuration
 typedef struct {
 	float min;
 	float max;
 } item_range_t;
 
+// Display range of an item, overriding the signal catalog's default for the vehicle
+// Notes about ranges for best display gauge layout
+//   1. Ranges should be even, whole numbers
+//   2. Power specific: should be multiples of 10
+//   3. Aux power specific: min delta should be 8 kW
+typedef struct {
+	int item;
+	float min;
+	float max;
+} vm_item_range_t;
+
+typedef struct {
+	int num_ranges;
+	const vm_item_range_t* rangeP;
+} vm_range_list_t;
+
+#define VM_RANGE_LIST(ranges) {sizeof(ranges)/sizeof(ranges[0]), ranges}
+
 typedef struct {
 	char* name;
-	uint32_t supported_item_mask;
-	item_range_t power_kw_range;
-	item_range_t aux_kw_range;
-	item_range_t torque_nm_range;
-	item_range_t hv_batt_i_range;
-	item_range_t lv_batt_v_range;
+	db_mask_t supported_item_mask;
+	vm_range_list_t range_list;                    // Signal catalog range overrides
 	bool can_is_500k;
 	int req_timeout_msec;                          // CAN Bus Request->Response timeout
+	uint16_t flow_control;                         // Default ISO-TP flow control - VM_FC()
 	vehicle_init fcn_init;
-	vehicle_eval fcn_eval;
+	vehicle_eval fcn_eval;                         // Optional (NULL) - requests are issued by the scheduler
 	vehicle_set_req_mask fcn_set_req_mask;
 	vehicle_rx_data fcn_rx_data;
 	vehicle_note_can_error fcn_note_can_error;
@@ -104,24 +289,58 @@ typedef struct {
 
 // For vehicle_task
 bool vm_init(const char* vehicle_name, int if_type);
+bool vm_deinit();
 void vm_eval();
+void vm_set_notify_task(TaskHandle_t task);
+bool vm_is_asleep();
 
 // For vehicle implementations
 int vm_get_resp_index(uint32_t resp_can_id, int resp_data_len, uint8_t* resp_data, int req_list_len, const can_request_t* req_list[]);
-void vm_update_data_item(uint32_t mask, float val);
-bool vm_mask_check(uint32_t req_mask, uint32_t mask_list);
+void vm_update_data_item(int item, float val);
+void vm_update_cell_array(int array, int num, const int16_t* vals);
+bool vm_mask_check(db_mask_t req_mask, db_mask_t mask_list);
+void vm_sched_set_request_list(int num_req, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[], uint32_t enable_mask);
+void vm_sched_pair_requests(int req_a, int req_b);
+void vm_sched_group_requests(int num, const int* req_list, bool shared_ts);
+void vm_sched_enable_streaming(int req_index);
+void vm_sched_define_ddid(int read_index, int define_index, const vm_did_group_t* groupP, uint32_t fallback_mask);
+void vm_sched_enable_periodic(int start_index, int stop_index, uint32_t periodic_id, uint32_t fallback_mask);
+void vm_sched_set_condition(int req_index, int item, float min, float max, int alt_period_msec);
+void vm_sched_rebuild_profiles();
+int vm_decode_response(const vm_decoder_list_t* listP, int len, uint8_t* data, float* vals);
+bool vm_subscribe_broadcast(uint32_t id, const vm_decoder_list_t* decoderP, vehicle_rx_data fcn);
+bool vm_subscribe_signals(uint32_t id, const vm_signal_list_t* signalP, vehicle_rx_data fcn);
+int vm_decode_signals(const vm_signal_list_t* listP, int len, const uint8_t* data, float* vals);
+void vm_split_multi_did_response(uint32_t id, int len, uint8_t* data, const vm_did_group_t* groupP, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[], vehicle_rx_data fcn);
+void vm_split_multi_pid_response(uint32_t id, int len, uint8_t* data, const vm_did_group_t* groupP, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[], vehicle_rx_data fcn);
+void vm_split_ddid_response(uint32_t id, int len, uint8_t* data, const vm_did_group_t* groupP, const can_request_t* req_list[], const vm_decoder_list_t decoder_list[], vehicle_rx_data fcn);
 
 // For CAN manager
-void vm_rx_data(uint32_t id, int len, uint8_t* data);
+void vm_rx_data(uint32_t id, int len, uint8_t* data, int64_t rx_usec);
+void vm_rx_broadcast(uint32_t id, int len, uint8_t* data, int64_t rx_usec);
+void vm_rx_partial(uint32_t id, int offset, int total_len, int len, uint8_t* data, int64_t rx_usec);
 void vm_note_error(int errno);
+void vm_note_rsp_error(uint32_t rsp_id, int errno);
+void vm_rx_functional_done();
 
 // For vehicle_task and GUI use
 int vm_get_num_vehicles();
 const char* vm_get_vehicle_name(int n);
+void vm_forget_identified_vehicle();
 
 // For GUI use
-uint32_t vm_get_supported_item_mask();
-void vm_set_request_item_mask(uint32_t mask);
-bool vm_get_range(int index, float* min, float* max);
+db_mask_t vm_get_supported_item_mask();
+void vm_get_request_health(int* num_req, int* num_backoff);
+void vm_wake_probe();
+bool vm_get_request_stats(int n, vm_req_stats_t* statsP);
+uint32_t vm_get_latency_percentile(const vm_req_stats_t* statsP, int percent);
+void vm_set_request_item_mask(db_mask_t mask);
+void vm_set_request_prefetch_mask(db_mask_t mask);
+void vm_set_request_background_mask(db_mask_t mask);
+void vm_set_request_goals(const vm_goal_list_t* listP);
+void vm_get_goal_health(int* num_goals, int* num_unmet, int* relax_pct);
+bool vm_get_goal_stats(int n, vm_goal_stats_t* statsP);
+int vm_get_cadence_msec(db_mask_t mask);
+void vm_set_request_profile(int profile);
 
 #endif /* VEHICLE_MANAGER_H */
\ No newline at end of file
@@ -0,0 +1,412 @@
+/*
+ * Generic OBD-II (SAE J1979 Mode 01) vehicle implementation
+ *
+ * Works with any vehicle whose powertrain ECU answers standard Mode 01 PIDs.  The PIDs the
+ * ECU supports are found from its supported PID bitmaps and cached so later connections
+ * start polling immediately.  PIDs are requested together, up to six in one request.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "vehicle_obd2.h"
+#include "can_manager.h"
+#include "data_broker.h"
+#include "dlog_utilities.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "ps_utilities.h"
+#include <string.h>
+
+
+//
+// Local constants
+//
+
+// Uncomment to debug
+//#define DEBUG_DATA
+
+// Requests are sent to the powertrain ECU's physical address.  Functional (0x7DF) requests
+// may be answered by several ECUs and their multi-frame responses need flow control sent
+// to a physical address anyway.
+#define OBD_REQ_ID        0x7E0
+#define OBD_RSP_ID        0x7E8
+
+// Supported PID discovery.  The bitmap for PID 0x20*n lists PIDs 0x20*n+1 - 0x20*n+0x20
+// (MSB first) and its last bit says whether the ECU has the next bitmap.  The bitmaps are
+// read one after the other with a single request.  A cached map is used right away and
+// only checked against the first bitmap.
+#define DISC_WALK         0
+#define DISC_VERIFY       1
+#define DISC_DONE         2
+
+#define PID_MAP_REQ_MSEC  200
+
+// Most PIDs a Mode 01 request may carry (SAE J1979)
+#define MAX_BATCH_PIDS    6
+
+// CAN request list indicies
+#define OBD_PID_MAP       0
+#define OBD_SPEED         1
+#define OBD_MODULE_V      2
+#define OBD_HV_BATT       3
+#define OBD_BATCH_FAST    4
+#define OBD_BATCH_SLOW    5
+
+#define NUM_OBD_REQ_ITEMS 6
+
+// Single-PID requests
+#define FIRST_PID_REQ     OBD_SPEED
+#define NUM_PID_REQ       3
+
+// Multi-PID requests.  The fast batch carries the supported PIDs polled as fast as
+// possible, the slow batch the others.
+#define BATCH_FAST        0
+#define BATCH_SLOW        1
+#define NUM_BATCHES       2
+
+
+//
+//  Forward declarations
+//
+
+// Functions for vehicle manager
+static void _obd2_init();
+static void _obd2_set_req_mask(db_mask_t mask);
+static void _obd2_rx_data(uint32_t id, int req_index, int len, uint8_t* data);
+static void _obd2_error(int errno);
+
+// Internal functions
+static void _obd2_process_rsp(uint32_t id, int req_index, int len, uint8_t* data);
+static void _obd2_process_pid_map(int len, uint8_t* data);
+static bool _obd2_pid_supported(uint8_t pid);
+static void _obd2_apply_pid_map();
+
+
+
+//
+// Vehicle definition.  The supported items are narrowed to those of the supported PIDs
+// once they are known.
+//
+static const vm_item_range_t obd2_ranges[] = {
+	{DB_ITEM_HV_BATT_I,    -200.0, 400.0},
+	{DB_ITEM_LV_BATT_V,    10.0,   16.0}
+};
+
+vehicle_config_t vehicle_obd2_generic =
+{
+	"Generic OBD-II",
+	DB_MASK(DB_ITEM_HV_BATT_V) | DB_MASK(DB_ITEM_HV_BATT_I) | DB_MASK(DB_ITEM_LV_BATT_V) | DB_MASK(DB_ITEM_SPEED),
+	VM_RANGE_LIST(obd2_ranges),
+	true,               // 500k CAN
+	200,                // Request timeout (mSec) - J1979 ECUs answer within 50 mSec
+	VM_FC(0, 0),        // ISO-TP flow control: no block size limit, no separation time
+	_obd2_init,
+	NULL,
+	_obd2_set_req_mask,
+	_obd2_rx_data,
+	_obd2_error
+};
+
+
+
+//
+// Vehicle OBD-II CAN request packets (must match list of indicies)
+//
+//                                                 Req ID      Rsp ID  Period    Priority          Flow Ctrl          PCI   SID
+static const can_request_t req_speed           = {OBD_REQ_ID, OBD_RSP_ID,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x02, 0x01, 0x0D, 0x00, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_module_v        = {OBD_REQ_ID, OBD_RSP_ID,  1000, VM_PRIORITY_LOW,  VM_FC_DEFAULT, 8, {0x02, 0x01, 0x42, 0x00, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_hv_batt         = {OBD_REQ_ID, OBD_RSP_ID,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x02, 0x01, 0x9A, 0x00, 0x00, 0x00, 0x00, 0x00}};
+
+// Supported PID bitmap (PID rewritten as discovery advances)
+static can_request_t req_pid_map               = {OBD_REQ_ID, OBD_RSP_ID, PID_MAP_REQ_MSEC, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x02, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
+
+// Multi-PID requests (PIDs filled in from the supported PIDs)
+static can_request_t req_batch_fast            = {OBD_REQ_ID, OBD_RSP_ID,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
+static can_request_t req_batch_slow            = {OBD_REQ_ID, OBD_RSP_ID,  1000, VM_PRIORITY_LOW,  VM_FC_DEFAULT, 8, {0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
+
+static const can_request_t* req_full_listP[NUM_OBD_REQ_ITEMS] = {
+	&req_pid_map,
+	&req_speed,
+	&req_module_v,
+	&req_hv_batt,
+	&req_batch_fast,
+	&req_batch_slow
+};
+
+static can_request_t* const batch_reqP[NUM_BATCHES] = {&req_batch_fast, &req_batch_slow};
+
+// Items carried by each single-PID request
+static const db_mask_t pid_item_mask[NUM_PID_REQ] = {
+	DB_MASK(DB_ITEM_SPEED),
+	DB_MASK(DB_ITEM_LV_BATT_V),
+	DB_MASK(DB_ITEM_HV_BATT_V) | DB_MASK(DB_ITEM_HV_BATT_I)
+};
+
+// Single-PID requests carried by each multi-PID request
+static int batch_parts[NUM_BATCHES][MAX_BATCH_PIDS];
+static vm_did_group_t batch_group[NUM_BATCHES] = {
+	{0, batch_parts[BATCH_FAST]},
+	{0, batch_parts[BATCH_SLOW]}
+};
+
+
+
+//
+// Response decoders (must match list of indicies)
+//
+//                                              Len  Offset  Width  Signed  Scale        Offset  Item
+static const vm_decoder_t dec_pid_map[]       = {{  6,   2,      2,     false,  1.0,           0.0,  0}};    // Bitmap read from the raw bytes
+static const vm_decoder_t dec_speed[]         = {{  3,   2,      1,     false,  1.0,           0.0,  DB_ITEM_SPEED}};
+static const vm_decoder_t dec_module_v[]      = {{  4,   2,      2,     false,  0.001,         0.0,  DB_ITEM_LV_BATT_V}};
+static const vm_decoder_t dec_hv_batt[]       = {{  8,   4,      2,     false,  1.0/64.0,      0.0,  DB_ITEM_HV_BATT_V},
+                                                 {  8,   6,      2,     true,   0.1,           0.0,  DB_ITEM_HV_BATT_I}};
+
+static const vm_decoder_list_t decoder_full_list[] = {
+	VM_DECODER_LIST(dec_pid_map),
+	VM_DECODER_LIST(dec_speed),
+	VM_DECODER_LIST(dec_module_v),
+	VM_DECODER_LIST(dec_hv_batt),
+	VM_DECODER_NONE,                   // Multi-PID requests are split into their parts
+	VM_DECODER_NONE
+};
+
+_Static_assert(sizeof(decoder_full_list)/sizeof(decoder_full_list[0]) == NUM_OBD_REQ_ITEMS, "decoder_full_list must match requests");
+
+
+
+//
+// Global variables
+//
+static const char* TAG = "vehicle_obd2";
+
+// Supported PIDs (cached in persistent storage)
+static obd2_pid_cache_t pid_cache_default;
+static obd2_pid_cache_t* pid_cacheP = &pid_cache_default;
+static int disc_state;
+static int disc_map_index;
+
+
+
+//
+// Vehicle manager functions
+//
+static void _obd2_init()
+{
+	// Only pass on the responses from the ECU we address
+	can_en_rsp_filter(true);
+	
+	if (!ps_get_config(PS_CONFIG_TYPE_OBD2, (void**) &pid_cacheP)) {
+		ESP_LOGE(TAG, "Get PID cache failed");
+		pid_cacheP = &pid_cache_default;
+	}
+	
+	if (pid_cacheP->valid) {
+		ESP_LOGI(TAG, "Using cached PIDs");
+		_obd2_apply_pid_map();
+		disc_state = DISC_VERIFY;
+	} else {
+		disc_state = DISC_WALK;
+	}
+	disc_map_index = 0;
+	req_pid_map.data[2] = 0x00;
+}
+
+
+static void _obd2_set_req_mask(db_mask_t mask)
+{
+	bool required_req[NUM_OBD_REQ_ITEMS];
+	uint32_t enable_mask = 0;
+	int n;
+	
+	// Discover the supported PIDs before requesting any of them
+	required_req[OBD_PID_MAP] = (disc_state != DISC_DONE);
+	for (int i=0; i<NUM_PID_REQ; i++) {
+		required_req[FIRST_PID_REQ + i] = (disc_state != DISC_WALK) &&
+		                                  _obd2_pid_supported(req_full_listP[FIRST_PID_REQ + i]->data[2]) &&
+		                                  vm_mask_check(mask, pid_item_mask[i]);
+	}
+	
+	// Replace two or more PIDs with the multi-PID request carrying them (it carries all
+	// the supported PIDs of its class)
+	for (int b=0; b<NUM_BATCHES; b++) {
+		n = 0;
+		for (int i=0; i<batch_group[b].num_parts; i++) {
+			if (required_req[batch_parts[b][i]]) n++;
+		}
+		required_req[OBD_BATCH_FAST + b] = (n > 1);
+		if (n > 1) {
+			for (int i=0; i<batch_group[b].num_parts; i++) {
+				required_req[batch_parts[b][i]] = false;
+			}
+		}
+	}
+	
+	// Let the scheduler know what requests to make
+	for (int i=0; i<NUM_OBD_REQ_ITEMS; i++) {
+		if (required_req[i]) {
+			enable_mask |= (1UL << i);
+		}
+	}
+	vm_sched_set_request_list(NUM_OBD_REQ_ITEMS, req_full_listP, decoder_full_list, enable_mask);
+	
+	// Sample HV voltage and current together with speed
+	vm_sched_pair_requests(OBD_SPEED, OBD_HV_BATT);
+}
+
+
+static void _obd2_rx_data(uint32_t id, int req_index, int len, uint8_t* data)
+{
+#ifdef DEBUG_DATA
+	ESP_LOGI(TAG, "RX: id = %lx, req = %d, len = %d", id, req_index, len);
+#endif
+	
+	// The vehicle manager has matched the response to our request
+	switch (req_index) {
+		case OBD_PID_MAP:
+			_obd2_process_pid_map(len, data);
+			break;
+		case OBD_BATCH_FAST:
+			vm_split_multi_pid_response(id, len, data, &batch_group[BATCH_FAST], req_full_listP, decoder_full_list, _obd2_process_rsp);
+			break;
+		case OBD_BATCH_SLOW:
+			vm_split_multi_pid_response(id, len, data, &batch_group[BATCH_SLOW], req_full_listP, decoder_full_list, _obd2_process_rsp);
+			break;
+		default:
+			_obd2_process_rsp(id, req_index, len, data);
+	}
+}
+
+
+static void _obd2_error(int errno)
+{
+	// The vehicle manager backs off requests that repeatedly fail so we just log errors
+	if (errno == CAN_ERRNO_TIMEOUT) {
+		DLOGI(TAG, "Request timeout");
+	} else if (errno == CAN_ERRNO_FRAME_TIMEOUT) {
+		DLOGI(TAG, "Multi-frame response timeout");
+	} else if (errno == CAN_ERRNO_NO_DATA) {
+		DLOGI(TAG, "No data for request");
+	}
+}
+
+
+
+//
+// Internal functions
+//
+static void _obd2_process_rsp(uint32_t id, int req_index, int len, uint8_t* data)
+{
+	float vals[VM_MAX_DECODE_VALS];
+	
+	// All values map directly to data items
+	(void) vm_decode_response(&decoder_full_list[req_index], len, data, vals);
+}
+
+
+// Record a supported PID bitmap (read from the raw bytes since a float can't hold all 32
+// bits) then read the next one or finish discovery
+static void _obd2_process_pid_map(int len, uint8_t* data)
+{
+	uint32_t bits;
+	
+	if (len < 6) return;
+	bits = ((uint32_t) data[2] << 24) | ((uint32_t) data[3] << 16) | ((uint32_t) data[4] << 8) | data[5];
+	
+	if (disc_state == DISC_VERIFY) {
+		if (bits == pid_cacheP->pid_map[0]) {
+			ESP_LOGI(TAG, "Cached PIDs confirmed");
+			disc_state = DISC_DONE;
+			vm_sched_rebuild_profiles();
+			return;
+		}
+	
+		// Different ECU - start over with this bitmap
+		ESP_LOGI(TAG, "Supported PIDs changed");
+		pid_cacheP->valid = false;
+		disc_state = DISC_WALK;
+		disc_map_index = 0;
+		_obd2_apply_pid_map();
+	}
+	
+	pid_cacheP->pid_map[disc_map_index] = bits;
+	if (((bits & 0x1) != 0) && ((disc_map_index + 1) < PS_OBD2_NUM_PID_MAPS)) {
+		// Request the next bitmap
+		disc_map_index += 1;
+		req_pid_map.data[2] = (uint8_t) (0x20 * disc_map_index);
+		return;
+	}
+	
+	for (int i=disc_map_index+1; i<PS_OBD2_NUM_PID_MAPS; i++) {
+		pid_cacheP->pid_map[i] = 0;
+	}
+	pid_cacheP->valid = true;
+	(void) ps_save_config(PS_CONFIG_TYPE_OBD2);
+	ESP_LOGI(TAG, "Discovered PIDs: %08lx %08lx %08lx %08lx %08lx", pid_cacheP->pid_map[0], pid_cacheP->pid_map[1],
+	         pid_cacheP->pid_map[2], pid_cacheP->pid_map[3], pid_cacheP->pid_map[4]);
+	
+	disc_state = DISC_DONE;
+	_obd2_apply_pid_map();
+	vm_sched_rebuild_profiles();
+}
+
+
+static bool _obd2_pid_supported(uint8_t pid)
+{
+	int n = (int) pid - 1;
+	
+	if (!pid_cacheP->valid || (n < 0) || ((n / 32) >= PS_OBD2_NUM_PID_MAPS)) {
+		return false;
+	}
+	
+	return ((pid_cacheP->pid_map[n / 32] >> (31 - (n % 32))) & 0x1) != 0;
+}
+
+
+// Fill the multi-PID requests with the supported PIDs (at most MAX_BATCH_PIDS each) and
+// narrow the vehicle's items to those the ECU can provide
+static void _obd2_apply_pid_map()
+{
+	const can_request_t* reqP;
+	can_request_t* bP;
+	db_mask_t mask = 0;
+	int b;
+	int n;
+	
+	for (b=0; b<NUM_BATCHES; b++) {
+		bP = batch_reqP[b];
+		memset(&bP->data[2], 0, bP->req_len - 2);
+		n = 0;
+		for (int i=FIRST_PID_REQ; (i<(FIRST_PID_REQ + NUM_PID_REQ)) && (n<MAX_BATCH_PIDS); i++) {
+			reqP = req_full_listP[i];
+			if (((reqP->period_msec == 0) == (b == BATCH_FAST)) && _obd2_pid_supported(reqP->data[2])) {
+				batch_parts[b][n] = i;
+				bP->data[2 + n] = reqP->data[2];
+				n += 1;
+			}
+		}
+		bP->data[0] = 1 + n;
+		batch_group[b].num_parts = n;
+	}
+	
+	for (int i=0; i<NUM_PID_REQ; i++) {
+		if (_obd2_pid_supported(req_full_listP[FIRST_PID_REQ + i]->data[2])) {
+			mask |= pid_item_mask[i];
+		}
+	}
+	if (mask != 0) {
+		vehicle_obd2_generic.supported_item_mask = mask;
+	}
+}
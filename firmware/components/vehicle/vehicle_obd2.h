@@ -0,0 +1,31 @@
+/*
+ * Generic OBD-II (SAE J1979 Mode 01) vehicle implementation
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef VEHICLE_OBD2_H
+#define VEHICLE_OBD2_H
+
+#include "vehicle_manager.h"
+
+
+//
+// Externs for vehicles defined in this module
+//
+extern vehicle_config_t vehicle_obd2_generic;
+
+#endif /* VEHICLE_OBD2_H */
@@ -0,0 +1,349 @@
+#!/usr/bin/env python3
+#
+# Convert a vehicle spec (JSON) into the const request and decoder tables of a vehicle
+# implementation.
+#
+# Usage: vehicle_spec.py <spec.json> <output.h>
+#
+# The output header is included by the vehicle's C file and defines
+#   UDS_<NAME>                 request list index of each request
+#   NUM_UDS_REQ_ITEMS          number of requests
+#   SPEC_SUPPORTED_ITEMS       mask of all items the requests' decoders and item lists cover
+#   SPEC_STREAMING_MASK        requests decoded as their frames arrive
+#   req_full_listP[]           can_request_t list for vm_sched_set_request_list()
+#   decoder_full_list[]        vm_decoder_list_t list (VM_DECODER_NONE for undecoded requests)
+#   req_item_mask[]            items that need each request
+#   req_pair_index[]           request issued back-to-back with each request (-1 = none)
+#   NUM_SPEC_BCAST             number of broadcast frames with signals, and when non-zero
+#   spec_bcast_id[]            their CAN IDs
+#   spec_bcast_signals[]       vm_signal_list_t list for vm_subscribe_signals()
+#
+# Broadcast signals are given DBC style (start_bit, length, byte_order "intel" or
+# "motorola") and checked to fit in the frame here.  Their rows use VM_SIGNAL_INTEL() and
+# VM_SIGNAL_MOTOROLA() so the masks and shifts are compile-time constants.
+#
+# Requests are sorted by request/response header so requests to the same ECU are
+# adjacent in the scheduler's list, and scale factors given as expressions ("1/1024")
+# are evaluated here.  Only the Python standard library is used so this runs as part of
+# the IDF build.
+#
+# Copyright 2025 Dan Julio
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# It is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software.  If not, see <https://www.gnu.org/licenses/>.
+#
+import json
+import os
+import re
+import sys
+from fractions import Fraction
+
+MAX_REQ = 32            # VM_MAX_SCHED_REQ
+MAX_DECODE_VALS = 8     # VM_MAX_DECODE_VALS
+MAX_SIGNALS = 16        # VM_MAX_SIGNALS
+MAX_BCAST = 8           # VM_MAX_BCAST_SUBS
+MAX_REQ_DATA = 256       # CAN_MANAGER_MAX_REQ_LEN (over 8 bytes needs a segmenting interface)
+PRIORITIES = {'low': 'VM_PRIORITY_LOW', 'med': 'VM_PRIORITY_MED', 'high': 'VM_PRIORITY_HIGH'}
+NAME_RE = re.compile(r'^[A-Z0-9][A-Z0-9_]*$')
+
+
+class SpecError(Exception):
+    pass
+
+
+def to_int(v, what):
+    """Spec integers may be JSON numbers or strings (for hex: "0x7BB")"""
+    try:
+        return int(v, 0) if isinstance(v, str) else int(v)
+    except (TypeError, ValueError):
+        raise SpecError('%s: bad integer %r' % (what, v))
+
+
+def to_number(v, what):
+    """Scale factors and offsets may be numbers or simple quotients ("1/1024")"""
+    if isinstance(v, (int, float)):
+        return float(v)
+    try:
+        parts = [Fraction(p.strip()) for p in str(v).split('/')]
+    except ValueError:
+        raise SpecError('%s: bad number %r' % (what, v))
+    val = parts[0]
+    for p in parts[1:]:
+        val /= p
+    return float(val)
+
+
+def item_name(v, what):
+    if v is None:
+        return 'DB_ITEM_NONE'
+    if not NAME_RE.match(v):
+        raise SpecError('%s: bad item name %r' % (what, v))
+    return 'DB_ITEM_' + v
+
+
+def flow_control(v, what):
+    if v is None or v == 'default':
+        return 'VM_FC_DEFAULT'
+    if not isinstance(v, list) or len(v) != 2:
+        raise SpecError('%s: flow_control must be "default" or [bs, stmin]' % what)
+    return 'VM_FC(%d, %d)' % (to_int(v[0], what), to_int(v[1], what))
+
+
+def period(v, what):
+    """Request period in mSec, or "catalog" for the signal catalog's period of its items"""
+    if v == 'catalog':
+        return 'VM_PERIOD_CATALOG'
+    p = to_int(v, what)
+    if p < 0:
+        raise SpecError('%s: period_msec must be >= 0 or "catalog"' % what)
+    return str(p)
+
+
+def parse_spec(spec):
+    reqs = []
+    names = set()
+    for r in spec.get('requests', []):
+        name = r.get('name', '')
+        if not NAME_RE.match(name) or name in names:
+            raise SpecError('bad or duplicate request name %r' % name)
+        names.add(name)
+
+        data = [to_int(b, name) for b in r['data']]
+        if len(data) < 1 or len(data) > MAX_REQ_DATA:
+            raise SpecError('%s: request data must be 1 - %d bytes' % (name, MAX_REQ_DATA))
+        priority = r.get('priority', 'low').lower()
+        if priority not in PRIORITIES:
+            raise SpecError('%s: bad priority %r' % (name, priority))
+
+        rows = []
+        for n, d in enumerate(r.get('decoders', [])):
+            what = '%s decoder %d' % (name, n)
+            width = to_int(d['width'], what)
+            if width < 1 or width > 4:
+                raise SpecError('%s: width must be 1 - 4' % what)
+            rows.append({
+                'rsp_len': to_int(d.get('rsp_len', 0), what),
+                'byte_offset': to_int(d['byte_offset'], what),
+                'width': width,
+                'is_signed': bool(d.get('signed', False)),
+                'scale': to_number(d.get('scale', 1), what),
+                'offset': to_number(d.get('offset', 0), what),
+                'item': item_name(d.get('item'), what),
+            })
+        if len(rows) > MAX_DECODE_VALS:
+            raise SpecError('%s: more than %d decoder rows' % (name, MAX_DECODE_VALS))
+        if 'rsp_len' in r:
+            # Responses the vehicle unpacks itself still give their length for buffer sizing
+            if rows:
+                raise SpecError('%s: rsp_len is for requests without decoders' % name)
+            rsp_len = to_int(r['rsp_len'], name)
+            if rsp_len < 1:
+                raise SpecError('%s: rsp_len must be > 0' % name)
+            rows.append({'rsp_len': rsp_len, 'item': 'DB_ITEM_NONE', 'length_only': True})
+
+        reqs.append({
+            'name': name,
+            'req_id': to_int(r['req_id'], name),
+            'rsp_id': to_int(r['rsp_id'], name),
+            'period_msec': period(r.get('period_msec', 0), name),
+            'priority': PRIORITIES[priority],
+            'flow_control': flow_control(r.get('flow_control'), name),
+            'data': data,
+            'items': [item_name(i, name) for i in r.get('items', [])],
+            'pair': r.get('pair'),
+            'streaming': bool(r.get('streaming', False)),
+            'comment': r.get('comment'),
+            'rows': rows,
+        })
+
+    if len(reqs) < 1 or len(reqs) > MAX_REQ:
+        raise SpecError('a vehicle must have 1 - %d requests' % MAX_REQ)
+
+    # The list is ordered by header (stable so the spec order is kept for each ECU)
+    reqs.sort(key=lambda r: (r['req_id'], r['rsp_id']))
+    index = {r['name']: i for i, r in enumerate(reqs)}
+    for r in reqs:
+        if r['pair'] is not None:
+            if r['pair'] not in index or r['pair'] == r['name']:
+                raise SpecError('%s: bad pair %r' % (r['name'], r['pair']))
+            r['pair_index'] = index[r['pair']]
+        else:
+            r['pair_index'] = -1
+    return reqs
+
+
+def signal_lsb(start, length, motorola):
+    """Position of a signal's LSB in the 64-bit frame word (VM_SIG_MOTO_LSB for Motorola)"""
+    if motorola:
+        return (7 - start // 8) * 8 + start % 8 - (length - 1)
+    return start
+
+
+def parse_broadcasts(spec):
+    bcasts = []
+    names = set()
+    for b in spec.get('broadcasts', []):
+        name = b.get('name', '')
+        if not NAME_RE.match(name) or name in names:
+            raise SpecError('bad or duplicate broadcast name %r' % name)
+        names.add(name)
+
+        sigs = []
+        for n, s in enumerate(b.get('signals', [])):
+            what = '%s signal %d' % (name, n)
+            start = to_int(s['start_bit'], what)
+            length = to_int(s['length'], what)
+            order = s.get('byte_order', 'intel').lower()
+            if order not in ('intel', 'motorola'):
+                raise SpecError('%s: byte_order must be "intel" or "motorola"' % what)
+            if start < 0 or start > 63 or length < 1 or length > 32:
+                raise SpecError('%s: start_bit must be 0 - 63 and length 1 - 32' % what)
+            lsb = signal_lsb(start, length, order == 'motorola')
+            if lsb < 0 or lsb + length > 64:
+                raise SpecError('%s: does not fit in the frame' % what)
+            sigs.append({
+                'start': start,
+                'length': length,
+                'motorola': order == 'motorola',
+                'is_signed': bool(s.get('signed', False)),
+                'scale': to_number(s.get('scale', 1), what),
+                'offset': to_number(s.get('offset', 0), what),
+                'item': item_name(s.get('item'), what),
+            })
+        if len(sigs) < 1 or len(sigs) > MAX_SIGNALS:
+            raise SpecError('%s: must have 1 - %d signals' % (name, MAX_SIGNALS))
+
+        bcasts.append({'name': name, 'id': to_int(b['id'], name), 'comment': b.get('comment'), 'signals': sigs})
+
+    if len(bcasts) > MAX_BCAST:
+        raise SpecError('more than %d broadcasts' % MAX_BCAST)
+    return bcasts
+
+
+def c_float(v):
+    s = repr(float(v))
+    return s + 'f'
+
+
+def write_header(f, src, reqs, bcasts):
+    w = max(len(r['name']) for r in reqs)
+
+    f.write('// Generated by vehicle_spec.py from %s - do not edit\n' % src)
+    f.write('#include "vehicle_manager.h"\n\n\n')
+
+    f.write('// Request list indicies\n')
+    for i, r in enumerate(reqs):
+        f.write('#define UDS_%-*s %d\n' % (w, r['name'], i))
+    f.write('\n#define NUM_UDS_REQ_ITEMS %d\n\n' % len(reqs))
+
+    items = []
+    for r in reqs:
+        for i in r['items'] + [d['item'] for d in r['rows']]:
+            if i != 'DB_ITEM_NONE' and i not in items:
+                items.append(i)
+    for b in bcasts:
+        for i in [s['item'] for s in b['signals']]:
+            if i != 'DB_ITEM_NONE' and i not in items:
+                items.append(i)
+    f.write('#define SPEC_SUPPORTED_ITEMS (%s)\n' % (' | '.join('DB_MASK(%s)' % i for i in items) if items else '0'))
+    stream = ['(1UL << UDS_%s)' % r['name'] for r in reqs if r['streaming']]
+    f.write('#define SPEC_STREAMING_MASK  (%s)\n\n\n' % (' | '.join(stream) if stream else '0'))
+
+    f.write('// Requests\n')
+    for r in reqs:
+        if r['comment']:
+            f.write('// %s\n' % r['comment'])
+        f.write('static const can_request_t req_%s = {0x%x, 0x%x, %s, %s, %s, %d, {%s}};\n' % (
+            r['name'].lower(), r['req_id'], r['rsp_id'], r['period_msec'], r['priority'], r['flow_control'],
+            len(r['data']), ', '.join('0x%02X' % b for b in r['data'])))
+    f.write('\nstatic const can_request_t* req_full_listP[NUM_UDS_REQ_ITEMS] = {\n')
+    for r in reqs:
+        f.write('\t&req_%s,\n' % r['name'].lower())
+    f.write('};\n\n\n')
+
+    f.write('// Response decoders\n')
+    for r in reqs:
+        if not r['rows']:
+            continue
+        f.write('static const vm_decoder_t dec_%s[] = {\n' % r['name'].lower())
+        for d in r['rows']:
+            if d.get('length_only'):
+                f.write('\tVM_DECODER_LEN(%d),\n' % d['rsp_len'])
+                continue
+            f.write('\t{%d, %d, %d, %s, %s, %s, %s},\n' % (
+                d['rsp_len'], d['byte_offset'], d['width'], 'true' if d['is_signed'] else 'false',
+                c_float(d['scale']), c_float(d['offset']), d['item']))
+        f.write('};\n')
+    f.write('\nstatic const vm_decoder_list_t decoder_full_list[NUM_UDS_REQ_ITEMS] = {\n')
+    for r in reqs:
+        if r['rows']:
+            f.write('\tVM_DECODER_LIST(dec_%s),\n' % r['name'].lower())
+        else:
+            f.write('\tVM_DECODER_NONE,\n')
+    f.write('};\n\n\n')
+
+    f.write('// Request selection and scheduling\n')
+    f.write('static const db_mask_t req_item_mask[NUM_UDS_REQ_ITEMS] = {\n')
+    for r in reqs:
+        f.write('\t%s,\n' % (' | '.join('DB_MASK(%s)' % i for i in r['items']) if r['items'] else '0'))
+    f.write('};\n\n')
+    f.write('static const int8_t req_pair_index[NUM_UDS_REQ_ITEMS] = {\n')
+    for r in reqs:
+        f.write('\t%d,\n' % r['pair_index'])
+    f.write('};\n\n\n')
+
+    f.write('// Broadcast signals\n')
+    f.write('#define NUM_SPEC_BCAST %d\n' % len(bcasts))
+    if not bcasts:
+        return
+    f.write('\n')
+    for b in bcasts:
+        if b['comment']:
+            f.write('// %s\n' % b['comment'])
+        f.write('static const vm_signal_t sig_%s[] = {\n' % b['name'].lower())
+        for s in b['signals']:
+            f.write('\tVM_SIGNAL_%s(%d, %d, %s, %s, %s, %s),\n' % (
+                'MOTOROLA' if s['motorola'] else 'INTEL', s['start'], s['length'],
+                'VM_SIG_SIGNED' if s['is_signed'] else '0', c_float(s['scale']), c_float(s['offset']), s['item']))
+        f.write('};\n')
+    f.write('\nstatic const uint32_t spec_bcast_id[NUM_SPEC_BCAST] = {\n')
+    for b in bcasts:
+        f.write('\t0x%x,\n' % b['id'])
+    f.write('};\n\n')
+    f.write('static const vm_signal_list_t spec_bcast_signals[NUM_SPEC_BCAST] = {\n')
+    for b in bcasts:
+        f.write('\tVM_SIGNAL_LIST(sig_%s),\n' % b['name'].lower())
+    f.write('};\n')
+
+
+def main():
+    if len(sys.argv) != 3:
+        print('usage: vehicle_spec.py <spec.json> <output.h>')
+        return 1
+
+    try:
+        with open(sys.argv[1]) as f:
+            spec = json.load(f)
+        reqs = parse_spec(spec)
+        bcasts = parse_broadcasts(spec)
+    except (SpecError, KeyError, ValueError) as e:
+        print('%s: %s' % (sys.argv[1], e), file=sys.stderr)
+        return 1
+
+    with open(sys.argv[2], 'w') as f:
+        write_header(f, os.path.basename(sys.argv[1]), reqs, bcasts)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -20,6 +20,7 @@
 #include "vehicle_vw_meb.h"
 #include "can_manager.h"
 #include "data_broker.h"
+#include "dlog_utilities.h"
 #include "esp_system.h"
 #include "esp_log.h"
 
@@ -31,6 +32,24 @@
 // Uncomment to debug
 //#define DEBUG_DATA
 
+// Comment out to request each DID individually (for gateways/ECUs that don't support
+// multiple DIDs in one ReadDataByIdentifier request)
+#define USE_MULTI_DID_REQ
+
+// Uncomment to read the fast BMS values and the drive values (gear and both motor torques)
+// each through one dynamically defined DID (UDS 0x2C) on ECUs that support them.  The define
+// requests are multi-frame so this needs an interface that sends segmented requests (TWAI).
+// The requests they replace are used if the ECU refuses a definition.
+//#define USE_DYNAMIC_DID
+
+// Motor torque (N-m) * speed (km/h) to mechanical kW: gear ratio / (3.6 * tire radius (m) * 1000)
+// using ~0.36 m tire radius, 13.0:1 rear reduction and 10.5:1 front (AWD) reduction
+#define REAR_MECH_KW_GAIN  0.0100
+#define FRONT_MECH_KW_GAIN 0.0081
+
+// Usable HV battery capacity (kWh) of the 82 kWh (gross) pack for the range estimate
+#define USABLE_KWH         77.0
+
 // CAN UDS request list indicies
 #define UDS_12V_BATT_INFO 0
 #define UDS_GPS_INFO      1
@@ -43,8 +62,30 @@
 #define UDS_REAR_TORQUE   8
 #define UDS_GEAR_POSITION 9
 #define UDS_SPEED         10
-
-#define NUM_UDS_REQ_ITEMS 11
+#define UDS_GRP_BMS_FAST  11
+#define UDS_GRP_BMS_TEMP  12
+#define UDS_GRP_TORQUE    13
+#define UDS_HV_CELL_V     14
+#define UDS_DDID_BMS_DEF  15
+#define UDS_DDID_BMS      16
+#define UDS_DDID_DRV_DEF  17
+#define UDS_DDID_DRV      18
+
+#define NUM_UDS_REQ_ITEMS 19
+
+// HV battery cell voltages.  The BMS has one DID per cell (raw mV above 1 V).  A single
+// request sweeps through the cells, a few DIDs at a time, and the array is published when
+// the sweep wraps.  Cells are only polled while their items are requested.
+#define NUM_CELLS         96
+#define CELL_V_DID_BASE   0x1E40
+#define CELL_V_MV_OFFSET  1000
+#ifdef USE_MULTI_DID_REQ
+#define CELL_DIDS_PER_REQ 3
+#else
+#define CELL_DIDS_PER_REQ 1
+#endif
+#define CELL_REQ_MSEC     200
+#define CELL_STALE_MSEC   (3 * CELL_REQ_MSEC * (NUM_CELLS / CELL_DIDS_PER_REQ))
 
 // Gear position constants
 #define GEAR_PARK         0x08
@@ -53,6 +94,10 @@
 #define GEAR_DRIVE_D      0x05
 #define GEAR_DRIVE_B      0x0C
 
+// The gear can only change while (nearly) stopped so it is polled slowly while moving
+#define GEAR_CHANGE_KPH   5
+#define GEAR_SLOW_MSEC    2000
+
 
 //
 //  Forward declarations
@@ -60,32 +105,54 @@
 
 // Functions for vehicle manager
 static void _vw_meb_init();
-static void _vw_meb_eval();
-static void _vw_meb_set_req_mask(uint32_t mask);
-static void _vw_meb_rx_data(uint32_t id, int len, uint8_t* data);
+static void _vw_meb_set_req_mask(db_mask_t mask);
+static void _vw_meb_rx_data(uint32_t id, int req_index, int len, uint8_t* data);
 static void _vw_meb_error(int errno);
 
+// Internal functions
+static void _vw_meb_process_rsp(uint32_t id, int req_index, int len, uint8_t* data);
+static void _vw_meb_process_cell_rsp(int len, uint8_t* data);
+static void _vw_meb_set_cell_req(int index);
+
 
 
 //
 // Vehicle definitions
 //
+static const vm_item_range_t vw_meb_rwd_ranges[] = {
+	{DB_ITEM_HV_POWER_KW,  -200.0, 300.0},
+	{DB_ITEM_REAR_MECH_KW, -200.0, 300.0},
+	{DB_ITEM_AUX_KW,       0.0,    16.0},
+	{DB_ITEM_REAR_TORQUE,  -150.0, 350.0},
+	{DB_ITEM_HV_BATT_I,    -400.0, 600.0},
+	{DB_ITEM_LV_BATT_V,    10.0,   16.0}
+};
+
+static const vm_item_range_t vw_meb_awd_ranges[] = {
+	{DB_ITEM_HV_POWER_KW,   -200.0, 300.0},
+	{DB_ITEM_FRONT_MECH_KW, -200.0, 300.0},
+	{DB_ITEM_REAR_MECH_KW,  -200.0, 300.0},
+	{DB_ITEM_AUX_KW,        0.0,    16.0},
+	{DB_ITEM_FRONT_TORQUE,  -150.0, 350.0},
+	{DB_ITEM_REAR_TORQUE,   -150.0, 350.0},
+	{DB_ITEM_HV_BATT_I,     -400.0, 800.0},
+	{DB_ITEM_LV_BATT_V,     10.0,   16.0}
+};
+
 const vehicle_config_t vehicle_vw_meb_rwd =
 {
 	"VW MEB RWD",
-	DB_ITEM_HV_BATT_V | DB_ITEM_HV_BATT_I | DB_ITEM_HV_BATT_MIN_T | DB_ITEM_HV_BATT_MAX_T | \
-	DB_ITEM_LV_BATT_V | DB_ITEM_LV_BATT_I | \
-	DB_ITEM_AUX_KW | DB_ITEM_REAR_TORQUE | \
-	DB_ITEM_SPEED | DB_ITEM_GPS_ELEVATION,
-	{-200.0, 300.0},    // power_kw_range
-	{0.0, 16.0},        // aux_kw_range
-	{-150.0, 350.0},    // torque_nm_range
-	{-400.0, 600.0},    // hv_batt_i_range
-	{10.0, 16.0},       // lv_batt_v_range
+	DB_MASK(DB_ITEM_HV_BATT_V) | DB_MASK(DB_ITEM_HV_BATT_I) | DB_MASK(DB_ITEM_HV_BATT_MIN_T) | DB_MASK(DB_ITEM_HV_BATT_MAX_T) | \
+	DB_MASK(DB_ITEM_LV_BATT_V) | DB_MASK(DB_ITEM_LV_BATT_I) | DB_MASK(DB_ITEM_LV_BATT_T) | \
+	DB_MASK(DB_ITEM_AUX_KW) | DB_MASK(DB_ITEM_REAR_TORQUE) | \
+	DB_MASK(DB_ITEM_SPEED) | DB_MASK(DB_ITEM_GPS_ELEVATION) | DB_MASK(DB_ITEM_GPS_LAT) | DB_MASK(DB_ITEM_GPS_LON) | DB_MASK(DB_ITEM_GPS_HEADING) | \
+	DB_MASK(DB_ITEM_CELL_MIN_V) | DB_MASK(DB_ITEM_CELL_MAX_V),
+	VM_RANGE_LIST(vw_meb_rwd_ranges),
 	true,               // 500k CAN
 	500,                // Request timeout (mSec)
+	VM_FC(0, 0),        // ISO-TP flow control: no block size limit, no separation time
 	_vw_meb_init,
-	_vw_meb_eval,
+	NULL,
 	_vw_meb_set_req_mask,
 	_vw_meb_rx_data,
 	_vw_meb_error
@@ -94,19 +161,17 @@ const vehicle_config_t vehicle_vw_meb_rwd =
 const vehicle_config_t vehicle_vw_meb_awd =
 {
 	"VW MEB AWD",
-	DB_ITEM_HV_BATT_V | DB_ITEM_HV_BATT_I | DB_ITEM_HV_BATT_MIN_T | DB_ITEM_HV_BATT_MAX_T | \
-	DB_ITEM_LV_BATT_V | DB_ITEM_LV_BATT_I | \
-	DB_ITEM_AUX_KW | DB_ITEM_FRONT_TORQUE | DB_ITEM_REAR_TORQUE | \
-	DB_ITEM_SPEED | DB_ITEM_GPS_ELEVATION,
-	{-200.0, 300.0},    // power_kw_range
-	{0.0, 16.0},        // aux_kw_range
-	{-150.0, 350.0},    // torque_nm_range
-	{-400.0, 800.0},    // hv_batt_i_range
-	{10.0, 16.0},       // lv_batt_v_range
+	DB_MASK(DB_ITEM_HV_BATT_V) | DB_MASK(DB_ITEM_HV_BATT_I) | DB_MASK(DB_ITEM_HV_BATT_MIN_T) | DB_MASK(DB_ITEM_HV_BATT_MAX_T) | \
+	DB_MASK(DB_ITEM_LV_BATT_V) | DB_MASK(DB_ITEM_LV_BATT_I) | DB_MASK(DB_ITEM_LV_BATT_T) | \
+	DB_MASK(DB_ITEM_AUX_KW) | DB_MASK(DB_ITEM_FRONT_TORQUE) | DB_MASK(DB_ITEM_REAR_TORQUE) | \
+	DB_MASK(DB_ITEM_SPEED) | DB_MASK(DB_ITEM_GPS_ELEVATION) | DB_MASK(DB_ITEM_GPS_LAT) | DB_MASK(DB_ITEM_GPS_LON) | DB_MASK(DB_ITEM_GPS_HEADING) | \
+	DB_MASK(DB_ITEM_CELL_MIN_V) | DB_MASK(DB_ITEM_CELL_MAX_V),
+	VM_RANGE_LIST(vw_meb_awd_ranges),
 	true,               // 500k CAN
 	500,                // Request timeout (mSec)
+	VM_FC(0, 0),        // ISO-TP flow control: no block size limit, no separation time
 	_vw_meb_init,
-	_vw_meb_eval,
+	NULL,
 	_vw_meb_set_req_mask,
 	_vw_meb_rx_data,
 	_vw_meb_error
@@ -117,19 +182,34 @@ const vehicle_config_t vehicle_vw_meb_awd =
 //
 // Vehicle UDS service CAN request packets (must match list of indicies)
 //
-//                                                 Req ID      Rsp ID         PCI   SID
-static const can_request_t req_12v_batt_info   = {     0x710,      0x77A, 8, {0x03, 0x22, 0x2A, 0xF7, 0x00, 0x00, 0x00, 0x00}};
-//static const can_request_t req_hv_ptc_current  = {0x17fc007b, 0x17fe007b, 8, {0x03, 0x22, 0x16, 0x20, 0x00, 0x00, 0x00, 0x00}}; // Not necessary (in Aux)
-static const can_request_t req_gps_info        = {     0x767,      0x7D1, 8, {0x03, 0x22, 0x24, 0x30, 0x00, 0x00, 0x00, 0x00}};
-static const can_request_t req_aux_power       = {0x17fc0076, 0x17fe0076, 8, {0x03, 0x22, 0x03, 0x64, 0x00, 0x00, 0x00, 0x00}};
-static const can_request_t req_hv_batt_current = {0x17fc007b, 0x17fe007b, 8, {0x03, 0x22, 0x1E, 0x3D, 0x00, 0x00, 0x00, 0x00}};
-static const can_request_t req_hv_batt_min_t   = {0x17fc007b, 0x17fe007b, 8, {0x03, 0x22, 0x1E, 0x0F, 0x00, 0x00, 0x00, 0x00}};
-static const can_request_t req_hv_batt_max_t   = {0x17fc007b, 0x17fe007b, 8, {0x03, 0x22, 0x1E, 0x0E, 0x00, 0x00, 0x00, 0x00}};
-static const can_request_t req_hv_batt_volt    = {0x17fc007b, 0x17fe007b, 8, {0x03, 0x22, 0x1E, 0x3B, 0x00, 0x00, 0x00, 0x00}};
-static const can_request_t req_front_torque    = {0x17fc0076, 0x17fe0076, 8, {0x03, 0x22, 0x03, 0x35, 0x00, 0x00, 0x00, 0x00}};
-static const can_request_t req_rear_torque     = {0x17fc0076, 0x17fe0076, 8, {0x03, 0x22, 0x03, 0x3B, 0x00, 0x00, 0x00, 0x00}};
-static const can_request_t req_gear_pos        = {0x17fc0076, 0x17fe0076, 8, {0x03, 0x22, 0x21, 0x0E, 0x00, 0x00, 0x00, 0x00}};
-static const can_request_t req_speed           = {0x18DB33F1, 0x18DAF101, 8, {0x02, 0x01, 0x0D, 0x00, 0x00, 0x00, 0x00, 0x00}};
+//                                                 Req ID      Rsp ID  Period    Priority          Flow Ctrl          PCI   SID
+static const can_request_t req_12v_batt_info   = {     0x710,      0x77A,  1000, VM_PRIORITY_LOW,  VM_FC_DEFAULT, 8, {0x03, 0x22, 0x2A, 0xF7, 0x00, 0x00, 0x00, 0x00}};
+//static const can_request_t req_hv_ptc_current  = {0x17fc007b, 0x17fe007b,  1000, VM_PRIORITY_LOW,  VM_FC_DEFAULT, 8, {0x03, 0x22, 0x16, 0x20, 0x00, 0x00, 0x00, 0x00}}; // Not necessary (in Aux)
+static const can_request_t req_gps_info        = {     0x767,      0x7D1,  1000, VM_PRIORITY_LOW,  VM_FC_DEFAULT, 8, {0x03, 0x22, 0x24, 0x30, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_aux_power       = {0x17fc0076, 0x17fe0076,   250, VM_PRIORITY_MED,  VM_FC_DEFAULT, 8, {0x03, 0x22, 0x03, 0x64, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_hv_batt_current = {0x17fc007b, 0x17fe007b,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x03, 0x22, 0x1E, 0x3D, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_hv_batt_min_t   = {0x17fc007b, 0x17fe007b,  2000, VM_PRIORITY_LOW,  VM_FC_DEFAULT, 8, {0x03, 0x22, 0x1E, 0x0F, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_hv_batt_max_t   = {0x17fc007b, 0x17fe007b,  2000, VM_PRIORITY_LOW,  VM_FC_DEFAULT, 8, {0x03, 0x22, 0x1E, 0x0E, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_hv_batt_volt    = {0x17fc007b, 0x17fe007b,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x03, 0x22, 0x1E, 0x3B, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_front_torque    = {0x17fc0076, 0x17fe0076,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x03, 0x22, 0x03, 0x35, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_rear_torque     = {0x17fc0076, 0x17fe0076,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x03, 0x22, 0x03, 0x3B, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_gear_pos        = {0x17fc0076, 0x17fe0076,   500, VM_PRIORITY_MED,  VM_FC_DEFAULT, 8, {0x03, 0x22, 0x21, 0x0E, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_speed           = {0x18DB33F1, 0x18DAF101,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x02, 0x01, 0x0D, 0x00, 0x00, 0x00, 0x00, 0x00}};
+
+// Multi-DID requests (up to 3 DIDs fit in a single frame)
+static const can_request_t req_grp_bms_fast    = {0x17fc007b, 0x17fe007b,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x05, 0x22, 0x1E, 0x3D, 0x1E, 0x3B, 0x00, 0x00}};
+static const can_request_t req_grp_bms_temp    = {0x17fc007b, 0x17fe007b,  2000, VM_PRIORITY_LOW,  VM_FC_DEFAULT, 8, {0x05, 0x22, 0x1E, 0x0F, 0x1E, 0x0E, 0x00, 0x00}};
+static const can_request_t req_grp_torque      = {0x17fc0076, 0x17fe0076,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x05, 0x22, 0x03, 0x35, 0x03, 0x3B, 0x00, 0x00}};
+
+// Dynamically defined DIDs (define by identifier: source DID, data record position 1 and
+// the record length from the source DID's decoder, in the order of the group lists below)
+static const can_request_t req_ddid_bms_def    = {0x17fc007b, 0x17fe007b,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 13, {0x0C, 0x2C, 0x01, 0xF2, 0x00, 0x1E, 0x3D, 0x01, 0x05, 0x1E, 0x3B, 0x01, 0x02}};
+static const can_request_t req_ddid_bms        = {0x17fc007b, 0x17fe007b,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x03, 0x22, 0xF2, 0x00, 0x00, 0x00, 0x00, 0x00}};
+static const can_request_t req_ddid_drv_def    = {0x17fc0076, 0x17fe0076,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 17, {0x10, 0x2C, 0x01, 0xF2, 0x01, 0x21, 0x0E, 0x01, 0x02, 0x03, 0x35, 0x01, 0x02, 0x03, 0x3B, 0x01, 0x02}};
+static const can_request_t req_ddid_drv        = {0x17fc0076, 0x17fe0076,     0, VM_PRIORITY_HIGH, VM_FC_DEFAULT, 8, {0x03, 0x22, 0xF2, 0x01, 0x00, 0x00, 0x00, 0x00}};
+
+// Cell voltage sweep (DIDs rewritten as the sweep advances)
+static can_request_t req_hv_cell_v             = {0x17fc007b, 0x17fe007b, CELL_REQ_MSEC, VM_PRIORITY_LOW, VM_FC_DEFAULT, 8, {0x01 + 2*CELL_DIDS_PER_REQ, 0x22, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
 
 static const can_request_t* req_full_listP[NUM_UDS_REQ_ITEMS] = {
 	&req_12v_batt_info,
@@ -142,9 +222,91 @@ static const can_request_t* req_full_listP[NUM_UDS_REQ_ITEMS] = {
 	&req_front_torque,
 	&req_rear_torque,
 	&req_gear_pos,
-	&req_speed
+	&req_speed,
+	&req_grp_bms_fast,
+	&req_grp_bms_temp,
+	&req_grp_torque,
+	&req_hv_cell_v,
+	&req_ddid_bms_def,
+	&req_ddid_bms,
+	&req_ddid_drv_def,
+	&req_ddid_drv
+};
+
+// Single-DID requests carried by each multi-DID request (in request order)
+static const int grp_bms_fast_parts[] = {UDS_HV_BATT_CUR, UDS_HV_BATT_VOLT};
+static const int grp_bms_temp_parts[] = {UDS_HV_BATT_MIN_T, UDS_HV_BATT_MAX_T};
+static const int grp_torque_parts[]   = {UDS_FRONT_TORQUE, UDS_REAR_TORQUE};
+
+// Separate requests sampled together when the torques can't be read with one request
+static const int torque_group[] = {UDS_SPEED, UDS_FRONT_TORQUE, UDS_REAR_TORQUE};
+
+static const vm_did_group_t grp_bms_fast = VM_DID_GROUP(grp_bms_fast_parts);
+static const vm_did_group_t grp_bms_temp = VM_DID_GROUP(grp_bms_temp_parts);
+static const vm_did_group_t grp_torque   = VM_DID_GROUP(grp_torque_parts);
+
+// Source DID requests of each dynamic DID (in definition order - gear position is
+// processed before the torques that depend on it)
+static const int ddid_bms_parts[] = {UDS_HV_BATT_CUR, UDS_HV_BATT_VOLT};
+static const int ddid_drv_parts[] = {UDS_GEAR_POSITION, UDS_FRONT_TORQUE, UDS_REAR_TORQUE};
+
+static const vm_did_group_t ddid_bms = VM_DID_GROUP(ddid_bms_parts);
+static const vm_did_group_t ddid_drv = VM_DID_GROUP(ddid_drv_parts);
+
+
+
+//
+// Response decoders (must match list of indicies)
+//
+//                                              Len  Offset  Width  Signed  Scale        Offset  Item
+static const vm_decoder_t dec_12v_batt_info[] = {{ 26,   3,      2,     false,  1.0/1024.0,    4.26, DB_ITEM_LV_BATT_V},
+                                                 { 26,   5,      4,     true,   1.0/1024.0,    0.0,  DB_ITEM_LV_BATT_I},
+                                                 { 26,   9,      1,     false,  0.5,         -40.0,  DB_ITEM_LV_BATT_T}};
+static const vm_decoder_t dec_gps_info[]      = {{ 33,  21,      4,     true,   1.0e-6,        0.0,  DB_ITEM_GPS_LAT},
+                                                 { 33,  25,      4,     true,   1.0e-6,        0.0,  DB_ITEM_GPS_LON},
+                                                 { 33,  29,      2,     false,  0.1,           0.0,  DB_ITEM_GPS_HEADING},
+                                                 { 33,  31,      2,     true,   1.0,        -501.0,  DB_ITEM_GPS_ELEVATION}};
+static const vm_decoder_t dec_aux_power[]     = {{  5,   3,      2,     true,   0.1,           0.0,  DB_ITEM_AUX_KW}};
+static const vm_decoder_t dec_hv_batt_cur[]   = {{  8,   3,      4,     true,   0.01,      -1500.0,  DB_ITEM_HV_BATT_I}};
+static const vm_decoder_t dec_hv_batt_min_t[] = {{  7,   3,      2,     true,   1.0/64.0,      0.0,  DB_ITEM_HV_BATT_MIN_T}};
+static const vm_decoder_t dec_hv_batt_max_t[] = {{  7,   3,      2,     true,   1.0/64.0,      0.0,  DB_ITEM_HV_BATT_MAX_T}};
+static const vm_decoder_t dec_hv_batt_volt[]  = {{  5,   3,      2,     true,   0.25,          0.0,  DB_ITEM_HV_BATT_V}};
+static const vm_decoder_t dec_torque[]        = {{  5,   3,      2,     true,   1.0,           0.0,  0}};
+static const vm_decoder_t dec_gear_pos[]      = {{  5,   4,      1,     false,  1.0,           0.0,  0}};
+static const vm_decoder_t dec_speed[]         = {{  3,   2,      1,     false,  1.0,           0.0,  DB_ITEM_SPEED}};
+
+// Lengths of the responses unpacked here (so the response buffers are sized for them): the
+// sweep's DID/value pairs, the define response's subfunction and dynamic DID, and each
+// dynamic DID's source data records
+static const vm_decoder_t dec_hv_cell_v[]     = {VM_DECODER_LEN(1 + 4*CELL_DIDS_PER_REQ)};
+static const vm_decoder_t dec_ddid_def[]      = {VM_DECODER_LEN(4)};
+static const vm_decoder_t dec_ddid_bms[]      = {VM_DECODER_LEN(3 + 5 + 2)};
+static const vm_decoder_t dec_ddid_drv[]      = {VM_DECODER_LEN(3 + 2 + 2 + 2)};
+
+static const vm_decoder_list_t decoder_full_list[] = {
+	VM_DECODER_LIST(dec_12v_batt_info),
+	VM_DECODER_LIST(dec_gps_info),
+	VM_DECODER_LIST(dec_aux_power),
+	VM_DECODER_LIST(dec_hv_batt_cur),
+	VM_DECODER_LIST(dec_hv_batt_min_t),
+	VM_DECODER_LIST(dec_hv_batt_max_t),
+	VM_DECODER_LIST(dec_hv_batt_volt),
+	VM_DECODER_LIST(dec_torque),
+	VM_DECODER_LIST(dec_torque),
+	VM_DECODER_LIST(dec_gear_pos),
+	VM_DECODER_LIST(dec_speed),
+	VM_DECODER_NONE,                   // Multi-DID requests are split into their parts
+	VM_DECODER_NONE,
+	VM_DECODER_NONE,
+	VM_DECODER_LIST(dec_hv_cell_v),    // Cell voltages are unpacked into the broker's cell array
+	VM_DECODER_LIST(dec_ddid_def),     // Dynamic DIDs are split into their source DIDs
+	VM_DECODER_LIST(dec_ddid_bms),
+	VM_DECODER_LIST(dec_ddid_def),
+	VM_DECODER_LIST(dec_ddid_drv)
 };
 
+_Static_assert(sizeof(decoder_full_list)/sizeof(decoder_full_list[0]) == NUM_UDS_REQ_ITEMS, "decoder_full_list must match requests");
+
 
 
 //
@@ -152,18 +314,13 @@ static const can_request_t* req_full_listP[NUM_UDS_REQ_ITEMS] = {
 //
 static const char* TAG = "vehicle_vw_meb";
 
-// OBD2 Request management
-static can_request_t* req_listP[NUM_UDS_REQ_ITEMS];
-static bool req_in_process = false;
-static bool req_timeout = false;
-static bool saw_error = false;
-static bool saw_response = false;
-static int req_index = 0;
-static int num_req_entries = 0;
-
 // Partial data values
 static bool in_reverse = false;
 
+// Cell voltage sweep
+static int cell_sweep_index;
+static int16_t cell_vals[NUM_CELLS];
+
 
 
 //
@@ -173,204 +330,233 @@ static void _vw_meb_init()
 {
 	// We don't need to filter the OBD CAN bus because the car's gateway does that for us
 	can_en_rsp_filter(false);
+	
+	db_set_derived_gain(DB_ITEM_REAR_MECH_KW, REAR_MECH_KW_GAIN);
+	db_set_derived_gain(DB_ITEM_FRONT_MECH_KW, FRONT_MECH_KW_GAIN);
+	db_set_derived_gain(DB_ITEM_RANGE_KM, USABLE_KWH);
+	
+	_vw_meb_set_cell_req(0);
 }
 
 
-static void _vw_meb_eval()
+static void _vw_meb_set_req_mask(db_mask_t mask)
 {
-	// Handle any responses or timeout
-	if (req_in_process) {
-		if (saw_error || saw_response || req_timeout) {
-			req_in_process = false;
-			
-			if (req_timeout) {
-				req_timeout = false;
-				ESP_LOGI(TAG, "Request timeout");
-			}
-		}
-	}
+	bool required_req[NUM_UDS_REQ_ITEMS];
+	uint32_t enable_mask = 0;
+	uint32_t ddid_bms_fallback = 0;
+	uint32_t ddid_drv_fallback = 0;
 	
-	// Look to see if we can make a request
-	if (!req_in_process && (num_req_entries > 0)) {
-		req_in_process = true;
-		saw_response = false;
-		req_timeout = false;
-		
-#ifdef DEBUG_DATA
-			ESP_LOGI(TAG, "TX: id = %lx, rsp = %lx, len = %d", req_listP[req_index]->req_id, req_listP[req_index]->rsp_id, req_listP[req_index]->req_len);
+	// Determine what requests are necessary
+	required_req[UDS_12V_BATT_INFO] = vm_mask_check(mask, DB_MASK(DB_ITEM_LV_BATT_V) | DB_MASK(DB_ITEM_LV_BATT_I) | DB_MASK(DB_ITEM_LV_BATT_T));
+	required_req[UDS_GPS_INFO]      = vm_mask_check(mask, DB_MASK(DB_ITEM_GPS_ELEVATION) | DB_MASK(DB_ITEM_GPS_LAT) |
+	                                                      DB_MASK(DB_ITEM_GPS_LON) | DB_MASK(DB_ITEM_GPS_HEADING));
+	required_req[UDS_HV_AUX_PWR]    = vm_mask_check(mask, DB_MASK(DB_ITEM_AUX_KW));
+	required_req[UDS_HV_BATT_CUR]   = vm_mask_check(mask, DB_MASK(DB_ITEM_HV_BATT_I));
+	required_req[UDS_HV_BATT_MIN_T] = vm_mask_check(mask, DB_MASK(DB_ITEM_HV_BATT_MIN_T));
+	required_req[UDS_HV_BATT_MAX_T] = vm_mask_check(mask, DB_MASK(DB_ITEM_HV_BATT_MAX_T));
+	required_req[UDS_HV_BATT_VOLT]  = vm_mask_check(mask, DB_MASK(DB_ITEM_HV_BATT_V) | DB_MASK(DB_ITEM_AUX_KW));
+	required_req[UDS_FRONT_TORQUE]  = vm_mask_check(mask, DB_MASK(DB_ITEM_FRONT_TORQUE));
+	required_req[UDS_REAR_TORQUE]   = vm_mask_check(mask, DB_MASK(DB_ITEM_REAR_TORQUE));
+	required_req[UDS_GEAR_POSITION] = vm_mask_check(mask, DB_MASK(DB_ITEM_FRONT_TORQUE) | DB_MASK(DB_ITEM_REAR_TORQUE));
+	required_req[UDS_SPEED]         = vm_mask_check(mask, DB_MASK(DB_ITEM_SPEED));
+	required_req[UDS_GRP_BMS_FAST]  = false;
+	required_req[UDS_GRP_BMS_TEMP]  = false;
+	required_req[UDS_GRP_TORQUE]    = false;
+	required_req[UDS_HV_CELL_V]     = vm_mask_check(mask, DB_MASK(DB_ITEM_CELL_MIN_V) | DB_MASK(DB_ITEM_CELL_MAX_V));
+	required_req[UDS_DDID_BMS_DEF]  = false;       // Issued by the scheduler before the read
+	required_req[UDS_DDID_BMS]      = false;
+	required_req[UDS_DDID_DRV_DEF]  = false;
+	required_req[UDS_DDID_DRV]      = false;
+	
+#ifdef USE_MULTI_DID_REQ
+	// Replace pairs of requests to the same ECU with one multi-DID request
+	if (required_req[UDS_HV_BATT_CUR] && required_req[UDS_HV_BATT_VOLT]) {
+		required_req[UDS_HV_BATT_CUR] = false;
+		required_req[UDS_HV_BATT_VOLT] = false;
+		required_req[UDS_GRP_BMS_FAST] = true;
+	}
+	if (required_req[UDS_HV_BATT_MIN_T] && required_req[UDS_HV_BATT_MAX_T]) {
+		required_req[UDS_HV_BATT_MIN_T] = false;
+		required_req[UDS_HV_BATT_MAX_T] = false;
+		required_req[UDS_GRP_BMS_TEMP] = true;
+	}
+	if (required_req[UDS_FRONT_TORQUE] && required_req[UDS_REAR_TORQUE]) {
+		required_req[UDS_FRONT_TORQUE] = false;
+		required_req[UDS_REAR_TORQUE] = false;
+		required_req[UDS_GRP_TORQUE] = true;
+	}
 #endif
-
-		if (can_tx_packet(req_listP[req_index]->req_id, req_listP[req_index]->rsp_id, req_listP[req_index]->req_len, req_listP[req_index]->data)) {
-			saw_error = false;
-		} else {
-			saw_error = true;
-			ESP_LOGE(TAG, "CAN TX fail - ID = %lx", req_listP[req_index]->req_id);
+	
+#ifdef USE_DYNAMIC_DID
+	// Replace the requests for all the values of a dynamic DID with its read (keeping them
+	// as the fallback)
+	if (can_get_max_req_len() >= req_ddid_drv_def.req_len) {
+		if (required_req[UDS_HV_BATT_CUR] && required_req[UDS_HV_BATT_VOLT]) {
+			ddid_bms_fallback = (1UL << UDS_HV_BATT_CUR) | (1UL << UDS_HV_BATT_VOLT);
+		} else if (required_req[UDS_GRP_BMS_FAST]) {
+			ddid_bms_fallback = (1UL << UDS_GRP_BMS_FAST);
+		}
+		if (required_req[UDS_GEAR_POSITION] && required_req[UDS_FRONT_TORQUE] && required_req[UDS_REAR_TORQUE]) {
+			ddid_drv_fallback = (1UL << UDS_GEAR_POSITION) | (1UL << UDS_FRONT_TORQUE) | (1UL << UDS_REAR_TORQUE);
+		} else if (required_req[UDS_GEAR_POSITION] && required_req[UDS_GRP_TORQUE]) {
+			ddid_drv_fallback = (1UL << UDS_GEAR_POSITION) | (1UL << UDS_GRP_TORQUE);
 		}
-		
-		// Setup for next request
-		req_index += 1;
-		if (req_index >= num_req_entries) {
-			req_index = 0;
+		for (int i=0; i<NUM_UDS_REQ_ITEMS; i++) {
+			if (((ddid_bms_fallback | ddid_drv_fallback) & (1UL << i)) != 0) {
+				required_req[i] = false;
+			}
 		}
+		required_req[UDS_DDID_BMS] = (ddid_bms_fallback != 0);
+		required_req[UDS_DDID_DRV] = (ddid_drv_fallback != 0);
 	}
-}
-
-
-static void _vw_meb_set_req_mask(uint32_t mask)
-{
-	bool required_req[NUM_UDS_REQ_ITEMS];
-	int n = 0;
-	
-	// Determine what requests are necessary
-	required_req[UDS_12V_BATT_INFO] = vm_mask_check(mask, DB_ITEM_LV_BATT_V | DB_ITEM_LV_BATT_I);
-	required_req[UDS_GPS_INFO]      = vm_mask_check(mask, DB_ITEM_GPS_ELEVATION);
-	required_req[UDS_HV_AUX_PWR]    = vm_mask_check(mask, DB_ITEM_AUX_KW);
-	required_req[UDS_HV_BATT_CUR]   = vm_mask_check(mask, DB_ITEM_HV_BATT_I);
-	required_req[UDS_HV_BATT_MIN_T] = vm_mask_check(mask, DB_ITEM_HV_BATT_MIN_T);
-	required_req[UDS_HV_BATT_MAX_T] = vm_mask_check(mask, DB_ITEM_HV_BATT_MAX_T);
-	required_req[UDS_HV_BATT_VOLT]  = vm_mask_check(mask, DB_ITEM_HV_BATT_V | DB_ITEM_AUX_KW);
-	required_req[UDS_FRONT_TORQUE]  = vm_mask_check(mask, DB_ITEM_FRONT_TORQUE);
-	required_req[UDS_REAR_TORQUE]   = vm_mask_check(mask, DB_ITEM_REAR_TORQUE);
-	required_req[UDS_GEAR_POSITION] = vm_mask_check(mask, DB_ITEM_FRONT_TORQUE | DB_ITEM_REAR_TORQUE);
-	required_req[UDS_SPEED]         = vm_mask_check(mask, DB_ITEM_SPEED);
+#endif
 	
-	// Build up our list of requests and reset starting point
-	num_req_entries = 0;
-	req_index = 0;
+	// Let the scheduler know what requests to make
 	for (int i=0; i<NUM_UDS_REQ_ITEMS; i++) {
 		if (required_req[i]) {
-			num_req_entries += 1;
-			req_listP[n++] = (can_request_t*) req_full_listP[i];
+			enable_mask |= (1UL << i);
 		}
 	}
+	vm_sched_set_request_list(NUM_UDS_REQ_ITEMS, req_full_listP, decoder_full_list, enable_mask);
+	
+	// The scheduler can't see the cell items in the undecoded cell responses
+	db_set_item_stale_msec(DB_ITEM_CELL_MIN_V, CELL_STALE_MSEC);
+	db_set_item_stale_msec(DB_ITEM_CELL_MAX_V, CELL_STALE_MSEC);
+	
+	// Poll the inputs of derived power items back-to-back (multi-DID requests already
+	// sample voltage and current together).  Separate front and rear torque requests (AWD
+	// without multi-DID) are grouped with speed and stamped as one sample so the split and
+	// the motor powers compare the same instant.
+	vm_sched_pair_requests(UDS_HV_BATT_CUR, UDS_HV_BATT_VOLT);
+	if (required_req[UDS_DDID_DRV]) {
+		vm_sched_pair_requests(UDS_SPEED, UDS_DDID_DRV);
+	} else if (required_req[UDS_FRONT_TORQUE] && required_req[UDS_REAR_TORQUE]) {
+		vm_sched_group_requests(sizeof(torque_group) / sizeof(torque_group[0]), torque_group, true);
+	} else {
+		vm_sched_pair_requests(UDS_SPEED, required_req[UDS_GRP_TORQUE] ? UDS_GRP_TORQUE : UDS_REAR_TORQUE);
+	}
+	vm_sched_set_condition(UDS_GEAR_POSITION, DB_ITEM_SPEED, -GEAR_CHANGE_KPH, GEAR_CHANGE_KPH, GEAR_SLOW_MSEC);
+	
+	if (ddid_bms_fallback != 0) {
+		vm_sched_define_ddid(UDS_DDID_BMS, UDS_DDID_BMS_DEF, &ddid_bms, ddid_bms_fallback);
+	}
+	if (ddid_drv_fallback != 0) {
+		vm_sched_define_ddid(UDS_DDID_DRV, UDS_DDID_DRV_DEF, &ddid_drv, ddid_drv_fallback);
+	}
 }
 
 
-static void _vw_meb_rx_data(uint32_t id, int len, uint8_t* data)
+static void _vw_meb_rx_data(uint32_t id, int req_index, int len, uint8_t* data)
 {
-	float f;
-	int n;
-	int16_t i16;
-	int32_t i32;
-	uint16_t u16;
-	
-	saw_response = true;
-	
 #ifdef DEBUG_DATA
-	ESP_LOGI(TAG, "RX: id = %lx, len = %d", id, len);
+	ESP_LOGI(TAG, "RX: id = %lx, req = %d, len = %d", id, req_index, len);
 #endif
-
-	// Try to find the request this response matches
-	n = vm_get_resp_index(id, len, data, NUM_UDS_REQ_ITEMS, req_full_listP);
 	
-	switch (n) {
-		case UDS_12V_BATT_INFO:
-			if (len == 26) {
-				u16 = (data[3] << 8) | data[4];
-				f = (float) u16 / 1024.0 + 4.26;
-				vm_update_data_item(DB_ITEM_LV_BATT_V, f);
-				i32 = (data[5] << 24) | (data[6] << 16) | (data[7] << 8) | data[8];
-				f = (float) i32 / 1024.0;
-				vm_update_data_item(DB_ITEM_LV_BATT_I, f);
-			}
-			break;
-			
-		case UDS_GPS_INFO:
-			if (len == 33) {
-				i16 = (data[31] << 8) + data[32];
-				f = (float) i16 - 501.0;
-				vm_update_data_item(DB_ITEM_GPS_ELEVATION, f);
-			}
+	// The vehicle manager has matched the response to our request
+	switch (req_index) {
+		case UDS_GRP_BMS_FAST:
+			vm_split_multi_did_response(id, len, data, &grp_bms_fast, req_full_listP, decoder_full_list, _vw_meb_process_rsp);
 			break;
-			
-		case UDS_HV_AUX_PWR:
-			if (len == 5) {
-				i16 = (data[3] << 8) | data[4];
-				f = (float) i16 / 10.0;
-				vm_update_data_item(DB_ITEM_AUX_KW, f);
-			}
+		case UDS_GRP_BMS_TEMP:
+			vm_split_multi_did_response(id, len, data, &grp_bms_temp, req_full_listP, decoder_full_list, _vw_meb_process_rsp);
 			break;
-			
-		case UDS_HV_BATT_CUR:
-			if (len == 8) {
-				i32 = (data[3] << 24) | (data[4] << 16) | (data[5] << 8) | data[6];
-				f = (i32 - 150000) / 100.0;
-				vm_update_data_item(DB_ITEM_HV_BATT_I, f);
-			}
+		case UDS_GRP_TORQUE:
+			vm_split_multi_did_response(id, len, data, &grp_torque, req_full_listP, decoder_full_list, _vw_meb_process_rsp);
 			break;
-			
-		case UDS_HV_BATT_MIN_T:
-			if (len == 7) {
-				i16 = ((int16_t) ((data[3] << 8) | data[4])) / 64;
-				f = (float) i16;
-				vm_update_data_item(DB_ITEM_HV_BATT_MIN_T, f);
-			}
+		case UDS_HV_CELL_V:
+			_vw_meb_process_cell_rsp(len, data);
 			break;
-			
-		case UDS_HV_BATT_MAX_T:
-			if (len == 7) {
-				i16 = ((int16_t) ((data[3] << 8) | data[4])) / 64;
-				f = (float) i16;
-				vm_update_data_item(DB_ITEM_HV_BATT_MAX_T, f);
-			}
+		case UDS_DDID_BMS:
+			vm_split_ddid_response(id, len, data, &ddid_bms, req_full_listP, decoder_full_list, _vw_meb_process_rsp);
 			break;
-			
-		case UDS_HV_BATT_VOLT:
-			if (len == 5) {
-				i16 = (data[3] << 8) | data[4];
-				f = (float) i16 / 4.0;
-				vm_update_data_item(DB_ITEM_HV_BATT_V, f);
-			}
+		case UDS_DDID_DRV:
+			vm_split_ddid_response(id, len, data, &ddid_drv, req_full_listP, decoder_full_list, _vw_meb_process_rsp);
 			break;
-			
+		default:
+			_vw_meb_process_rsp(id, req_index, len, data);
+	}
+}
+
+
+static void _vw_meb_error(int errno)
+{
+	// The vehicle manager backs off requests that repeatedly fail so we just log errors
+	if (errno == CAN_ERRNO_TIMEOUT) {
+		DLOGI(TAG, "Request timeout");
+	} else if (errno == CAN_ERRNO_FRAME_TIMEOUT) {
+		DLOGI(TAG, "Multi-frame response timeout");
+	} else if (errno == CAN_ERRNO_NO_DATA) {
+		DLOGI(TAG, "No data for request");
+	}
+}
+
+
+
+//
+// Internal functions
+//
+static void _vw_meb_process_rsp(uint32_t id, int req_index, int len, uint8_t* data)
+{
+	float vals[VM_MAX_DECODE_VALS];
+	
+	// Decode the response
+	if (vm_decode_response(&decoder_full_list[req_index], len, data, vals) == 0) {
+		return;
+	}
+	
+	// Handle values that require further processing
+	switch (req_index) {
 		case UDS_FRONT_TORQUE:
-			if (len == 5) {
-				i16 = (data[3] << 8) | data[4];
-				f = (float) i16;
-				
-				// For MEB the torque value is the actual torque going to the motor
-				// which means going in reverse is the same as applying regen while going forward
-				// so we use knowledge of the shift position to negate the torque for reverse
-				// so it still shows up as a positive number (a request to move the car as opposed
-				// to regenerate energy back into the battery)
-				if (in_reverse) {
-					f = -f;
-				}
-				vm_update_data_item(DB_ITEM_FRONT_TORQUE, f);
-			}
-			break;
-			
 		case UDS_REAR_TORQUE:
-			if (len == 5) {
-				i16 = (data[3] << 8) | data[4];
-				f = (float) i16;
-				if (in_reverse) {
-					f = -f;
-				}
-				vm_update_data_item(DB_ITEM_REAR_TORQUE, f);
+			// For MEB the torque value is the actual torque going to the motor
+			// which means going in reverse is the same as applying regen while going forward
+			// so we use knowledge of the shift position to negate the torque for reverse
+			// so it still shows up as a positive number (a request to move the car as opposed
+			// to regenerate energy back into the battery)
+			if (in_reverse) {
+				vals[0] = -vals[0];
 			}
+			vm_update_data_item((req_index == UDS_FRONT_TORQUE) ? DB_ITEM_FRONT_TORQUE : DB_ITEM_REAR_TORQUE, vals[0]);
 			break;
 			
 		case UDS_GEAR_POSITION:
-			if (len == 5) {
-				in_reverse = (data[4] == GEAR_REVERSE);
-			}
-			break;
-			
-		case UDS_SPEED:
-			if (len == 3) {
-				f = (float) data[2];
-				vm_update_data_item(DB_ITEM_SPEED, f);
-			}
+			in_reverse = ((int) vals[0] == GEAR_REVERSE);
 			break;
 	}
 }
 
 
-static void _vw_meb_error(int errno)
+// Unpack a cell sweep response (SID followed by DID/value pairs) then advance the sweep
+static void _vw_meb_process_cell_rsp(int len, uint8_t* data)
 {
-	// We only handle (and expect) timeouts
-	if (errno == CAN_ERRNO_TIMEOUT) {
-		req_timeout = true;
+	int cell;
+	
+	for (int i=1; (i+4)<=len; i+=4) {
+		cell = ((data[i] << 8) | data[i+1]) - CELL_V_DID_BASE;
+		if ((cell >= 0) && (cell < NUM_CELLS)) {
+			cell_vals[cell] = (int16_t) (((data[i+2] << 8) | data[i+3]) + CELL_V_MV_OFFSET);
+		}
+	}
+	
+	if ((cell_sweep_index + CELL_DIDS_PER_REQ) >= NUM_CELLS) {
+		vm_update_cell_array(DB_CELL_ARRAY_V, NUM_CELLS, cell_vals);
+		_vw_meb_set_cell_req(0);
+	} else {
+		_vw_meb_set_cell_req(cell_sweep_index + CELL_DIDS_PER_REQ);
+	}
+}
+
+
+// Point the sweep request at the DIDs starting with cell index (the response is matched
+// against the first DID so this is only done after a response)
+static void _vw_meb_set_cell_req(int index)
+{
+	uint16_t did;
+	
+	cell_sweep_index = index;
+	for (int i=0; i<CELL_DIDS_PER_REQ; i++) {
+		did = CELL_V_DID_BASE + ((index + i) % NUM_CELLS);
+		req_hv_cell_v.data[2 + 2*i] = did >> 8;
+		req_hv_cell_v.data[3 + 2*i] = did & 0xFF;
 	}
 }
@@ -0,0 +1,382 @@
+/*
+ * BLE Stream Task
+ *
+ * Stream data broker items to a phone app over a BLE GATT notify characteristic (the
+ * peripheral role in ble_utilities, running alongside the central connection to a BLE
+ * ELM327 adapter) so the app can log high-rate data.  The task is a broker subscriber for
+ * the items the phone asked for through the control characteristic.  The items updated
+ * each batch period (the broker coalesces repeated updates to the latest value) are
+ * packed into notifications of up to the negotiated MTU.  Values are sent as the change
+ * from the previous value sent, at the item's display precision, so most records take
+ * three bytes.  A byte budget, the per-item minimum interval and the phone connection's
+ * longer interval keep the stream from taking airtime the adapter link needs: when the
+ * budget runs out updates simply wait (and coalesce) in the broker.  If the host runs out
+ * of buffers the rest of the batch is dropped and every item is next sent as an absolute
+ * value.  Only included when ENABLE_BLE_STREAM is defined.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "ble_stream_task.h"
+
+#ifdef ENABLE_BLE_STREAM
+
+#include "ble_utilities.h"
+#include "can_manager.h"
+#include "data_broker.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ps_utilities.h"
+#include "vehicle_manager.h"
+#include <math.h>
+#include <string.h>
+
+#ifndef BLE_EN_PERIPHERAL
+#error "ENABLE_BLE_STREAM needs BLE_EN_PERIPHERAL (ble_utilities.h)"
+#endif
+
+
+//
+// BLE Stream Task constants
+//
+
+// Largest notification (CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU - 3)
+#define BLE_STREAM_MAX_NOTIFY_LEN    253
+
+// Longest record (type/item, age, float)
+#define BLE_STREAM_MAX_REC_LEN       6
+
+// Period the set of streamed items is re-evaluated (on-board items appear after startup)
+#define BLE_STREAM_ITEM_CHECK_MSEC   1000
+
+// The stack is started after the vehicle interface is up (so the GUI has its internal RAM
+// draw buffers) or this long after boot
+#define BLE_STREAM_START_WAIT_MSEC   10000
+#define BLE_STREAM_START_POLL_MSEC   100
+
+
+
+//
+// BLE Stream Task variables
+//
+static const char* TAG = "ble_stream_task";
+
+// Task handle
+TaskHandle_t task_handle_ble_stream;
+
+static int stream_sub = -1;
+static db_mask_t stream_cur_mask = 0;
+
+// Set by the host task
+static volatile bool restart_req = false;
+static db_mask_t req_mask = 0;
+static portMUX_TYPE req_mask_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Notification being built
+static uint8_t notify_buf[BLE_STREAM_MAX_NOTIFY_LEN];
+static int notify_max_len;
+static int cur_len;
+static uint32_t cur_ts_msec;
+static bool tx_failed;
+
+// Delta state: the scaled value last sent for each item
+static int32_t last_q[DB_NUM_ITEMS];
+static db_mask_t have_q = 0;
+static float scale[DB_NUM_ITEMS];
+
+static uint8_t seq = 0;
+static int32_t budget_bytes = BLE_STREAM_MAX_BYTES_PER_SEC;
+static uint32_t drop_count = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _ble_stream_update_items();
+static void _ble_stream_send_batch();
+static void _ble_stream_item_handler(int item, float val, int64_t ts_usec);
+static bool _ble_stream_send_notify();
+static void _ble_stream_state_cb(bool subscribed);
+static void _ble_stream_write_cb(int len, const uint8_t* data);
+static int _ble_stream_read_cb(int max_len, uint8_t* data);
+
+
+
+//
+// API
+//
+void ble_stream_task()
+{
+	net_config_t* net_configP;
+	int check_count = 0;
+	int keyframe_count = 0;
+	int wait_count = BLE_STREAM_START_WAIT_MSEC / BLE_STREAM_START_POLL_MSEC;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	while ((can_get_active_interface() < 0) && (wait_count-- > 0)) {
+		vTaskDelay(pdMS_TO_TICKS(BLE_STREAM_START_POLL_MSEC));
+	}
+	
+	// Advertise with the unit's (unique) AP SSID
+	if (!ps_get_config(PS_CONFIG_TYPE_NET, (void**) &net_configP)) {
+		ESP_LOGE(TAG, "Get configuration failed");
+		vTaskDelete(NULL);
+	}
+	
+	for (int i=0; i<DB_NUM_ITEMS; i++) {
+		scale[i] = powf(10, db_catalog_get(i)->precision);
+	}
+	
+	stream_sub = db_add_subscriber(0, _ble_stream_item_handler);
+	if (stream_sub < 0) {
+		ESP_LOGE(TAG, "No broker subscriber available");
+		vTaskDelete(NULL);
+	}
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		db_set_subscriber_filter(stream_sub, i, 0, BLE_STREAM_MIN_INTERVAL_MSEC);
+	}
+	
+	if (!ble_periph_init(net_configP->ap_ssid, _ble_stream_state_cb, _ble_stream_write_cb, _ble_stream_read_cb)) {
+		ESP_LOGE(TAG, "Could not start BLE peripheral");
+		vTaskDelete(NULL);
+	}
+	
+	while (1) {
+		vTaskDelay(pdMS_TO_TICKS(BLE_STREAM_BATCH_MSEC));
+		
+		if (restart_req || (keyframe_count-- == 0)) {
+			restart_req = false;
+			keyframe_count = BLE_STREAM_KEYFRAME_MSEC / BLE_STREAM_BATCH_MSEC;
+			have_q = 0;
+			check_count = 0;
+		}
+		
+		if (check_count-- == 0) {
+			check_count = BLE_STREAM_ITEM_CHECK_MSEC / BLE_STREAM_BATCH_MSEC;
+			_ble_stream_update_items();
+		}
+		
+		// Refill the budget
+		budget_bytes += (BLE_STREAM_MAX_BYTES_PER_SEC * BLE_STREAM_BATCH_MSEC) / 1000;
+		if (budget_bytes > BLE_STREAM_MAX_BYTES_PER_SEC) {
+			budget_bytes = BLE_STREAM_MAX_BYTES_PER_SEC;
+		}
+		
+		if ((stream_cur_mask != 0) && ble_periph_is_subscribed() && db_subscriber_has_updates(stream_sub)) {
+			_ble_stream_send_batch();
+		}
+	}
+}
+
+
+
+//
+// Internal functions
+//
+
+// Stream the items the phone wants that are available
+static void _ble_stream_update_items()
+{
+	db_mask_t mask;
+	
+	portENTER_CRITICAL(&req_mask_mux);
+	mask = req_mask;
+	portEXIT_CRITICAL(&req_mask_mux);
+	
+	if (!ble_periph_is_subscribed()) {
+		mask = 0;
+	}
+	mask &= vm_get_supported_item_mask();
+	if (mask != stream_cur_mask) {
+		stream_cur_mask = mask;
+		db_set_subscriber_items(stream_sub, mask);
+	}
+}
+
+
+static void _ble_stream_send_batch()
+{
+	notify_max_len = ble_periph_get_max_notify_len();
+	if (notify_max_len > BLE_STREAM_MAX_NOTIFY_LEN) {
+		notify_max_len = BLE_STREAM_MAX_NOTIFY_LEN;
+	}
+	if ((notify_max_len < (int) (sizeof(ble_stream_hdr_t) + BLE_STREAM_MAX_REC_LEN)) ||
+	    (budget_bytes < notify_max_len)) {
+		return;
+	}
+	
+	cur_ts_msec = (uint32_t) (esp_timer_get_time() / 1000);
+	cur_len = sizeof(ble_stream_hdr_t);
+	tx_failed = false;
+	
+	// Records are encoded by the handler which sends each notification that fills (a batch
+	// may overdraw the budget, the next ones wait until it is refilled)
+	db_subscriber_eval(stream_sub);
+	if (!tx_failed && (cur_len > sizeof(ble_stream_hdr_t))) {
+		(void) _ble_stream_send_notify();
+	}
+	
+	// Values were lost so phone and deltas no longer agree
+	if (tx_failed) {
+		have_q = 0;
+		if ((drop_count++ % 100) == 0) {
+			ESP_LOGW(TAG, "Notify failed (%lu)", drop_count);
+		}
+	}
+}
+
+
+// Broker subscriber handler - add one record to the notification
+static void _ble_stream_item_handler(int item, float val, int64_t ts_usec)
+{
+	uint8_t* p;
+	int32_t age;
+	int32_t q = 0;
+	int32_t d = 0;
+	float f;
+	int type;
+	
+	if ((item >= DB_NUM_ITEMS) || tx_failed) {
+		return;
+	}
+	
+	if ((cur_len + BLE_STREAM_MAX_REC_LEN) > notify_max_len) {
+		if (!_ble_stream_send_notify()) {
+			// Out of buffers for the rest of this batch
+			return;
+		}
+		cur_len = sizeof(ble_stream_hdr_t);
+	}
+	
+	age = (int32_t) (cur_ts_msec - (uint32_t) (ts_usec / 1000)) / BLE_STREAM_AGE_UNIT_MSEC;
+	if (age < 0) age = 0;
+	if (age > 255) age = 255;
+	
+	f = roundf(val * scale[item]);
+	if (!(fabsf(f) < 2147483520.0f)) {
+		type = BLE_STREAM_REC_FLOAT;
+		have_q &= ~DB_MASK(item);
+	} else {
+		q = (int32_t) f;
+		d = q - last_q[item];
+		if ((have_q & DB_MASK(item)) == 0) {
+			type = BLE_STREAM_REC_ABS;
+		} else if ((d >= INT8_MIN) && (d <= INT8_MAX)) {
+			type = BLE_STREAM_REC_DELTA8;
+		} else if ((d >= INT16_MIN) && (d <= INT16_MAX)) {
+			type = BLE_STREAM_REC_DELTA16;
+		} else {
+			type = BLE_STREAM_REC_ABS;
+		}
+		last_q[item] = q;
+		have_q |= DB_MASK(item);
+	}
+	
+	p = &notify_buf[cur_len];
+	*p++ = (uint8_t) ((type << 6) | item);
+	*p++ = (uint8_t) age;
+	switch (type) {
+		case BLE_STREAM_REC_DELTA8:
+			*p++ = (uint8_t) (int8_t) d;
+			break;
+		case BLE_STREAM_REC_DELTA16:
+			memcpy(p, &d, 2);
+			p += 2;
+			break;
+		case BLE_STREAM_REC_ABS:
+			memcpy(p, &q, 4);
+			p += 4;
+			break;
+		default:
+			memcpy(p, &val, 4);
+			p += 4;
+	}
+	cur_len = p - notify_buf;
+}
+
+
+static bool _ble_stream_send_notify()
+{
+	ble_stream_hdr_t hdr;
+	
+	hdr.version = BLE_STREAM_VERSION;
+	hdr.seq = seq;
+	hdr.ts_msec = cur_ts_msec;
+	memcpy(notify_buf, &hdr, sizeof(hdr));
+	
+	if (!ble_periph_notify(cur_len, notify_buf)) {
+		tx_failed = true;
+		return false;
+	}
+	seq++;
+	budget_bytes -= cur_len;
+	
+	return true;
+}
+
+
+// Called from the host task when the phone enables or disables notifications
+static void _ble_stream_state_cb(bool subscribed)
+{
+	// Deltas restart and the items are re-evaluated
+	restart_req = true;
+}
+
+
+// Called from the host task when the phone writes the control characteristic
+static void _ble_stream_write_cb(int len, const uint8_t* data)
+{
+	db_mask_t mask;
+	
+	if (len != BLE_STREAM_CTRL_LEN) {
+		return;
+	}
+	
+	memcpy(&mask, data, sizeof(mask));
+	portENTER_CRITICAL(&req_mask_mux);
+	req_mask = mask;
+	portEXIT_CRITICAL(&req_mask_mux);
+	restart_req = true;
+}
+
+
+// Called from the host task when the phone reads the control characteristic
+static int _ble_stream_read_cb(int max_len, uint8_t* data)
+{
+	ble_stream_info_t* iP = (ble_stream_info_t*) data;
+	int len = sizeof(ble_stream_info_t) + DB_NUM_ITEMS;
+	
+	if (len > max_len) {
+		return 0;
+	}
+	
+	iP->version = BLE_STREAM_VERSION;
+	iP->num_items = DB_NUM_ITEMS;
+	iP->available = vm_get_supported_item_mask();
+	iP->streaming = stream_cur_mask;
+	for (int i=0; i<DB_NUM_ITEMS; i++) {
+		iP->precision[i] = db_catalog_get(i)->precision;
+	}
+	
+	return len;
+}
+
+#endif /* ENABLE_BLE_STREAM */
@@ -0,0 +1,113 @@
+/*
+ * BLE Stream Task
+ *
+ * Stream data broker items to a phone app over a BLE GATT notify characteristic
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BLE_STREAM_TASK_H
+#define BLE_STREAM_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+
+
+//
+// BLE Stream Task Constants
+//
+
+// Uncomment to stream broker items to phones (also needs BLE_EN_PERIPHERAL in
+// ble_utilities.h)
+//#define ENABLE_BLE_STREAM
+
+// Updated items are batched into notifications once per period
+#define BLE_STREAM_BATCH_MSEC        20
+
+// Each item is sent no more often than this
+#define BLE_STREAM_MIN_INTERVAL_MSEC 20
+
+// Bandwidth budget (bytes/sec) so the phone never takes airtime the adapter link needs
+#define BLE_STREAM_MAX_BYTES_PER_SEC 6144
+
+// Every item is sent as an absolute value at least this often so a phone that missed
+// values resynchronizes
+#define BLE_STREAM_KEYFRAME_MSEC     5000
+
+// Record age units
+#define BLE_STREAM_AGE_UNIT_MSEC     4
+
+// Notification format (little endian, up to the negotiated MTU - 3 bytes)
+//   Header: ble_stream_hdr_t
+//   Records until the end of the notification, each:
+//     uint8_t  type << 6 | item
+//     uint8_t  age (BLE_STREAM_AGE_UNIT_MSEC units before the header ts_msec, 255 = older)
+//     value    by type:
+//              BLE_STREAM_REC_DELTA8  - int8_t  q - previous q of the item
+//              BLE_STREAM_REC_DELTA16 - int16_t q - previous q of the item
+//              BLE_STREAM_REC_ABS     - int32_t q
+//              BLE_STREAM_REC_FLOAT   - float value (q out of range, next is absolute)
+//   where q is the value scaled by 10^precision (the item's signal catalog precision) and
+//   rounded.  An item's first record, and any after the stream restarted, is absolute.
+#define BLE_STREAM_VERSION           1
+#define BLE_STREAM_REC_DELTA8        0
+#define BLE_STREAM_REC_DELTA16       1
+#define BLE_STREAM_REC_ABS           2
+#define BLE_STREAM_REC_FLOAT         3
+
+// Control characteristic
+//   Write: db_mask_t (uint64_t) of the items wanted (0 = stop), items not available are
+//          ignored
+//   Read:  ble_stream_info_t
+#define BLE_STREAM_CTRL_LEN          8
+
+
+
+//
+// BLE Stream Task typedefs
+//
+typedef struct {
+	uint8_t version;
+	uint8_t seq;                         // Increments each notification
+	uint32_t ts_msec;                    // esp_timer mSec (low 32 bits) when sent
+} __attribute__((packed)) ble_stream_hdr_t;
+
+typedef struct {
+	uint8_t version;
+	uint8_t num_items;                   // DB_NUM_ITEMS
+	uint64_t available;                  // Items the vehicle (and on-board sensors) provide
+	uint64_t streaming;                  // Items being sent
+	uint8_t precision[];                 // Catalog precision of each item (num_items entries)
+} __attribute__((packed)) ble_stream_info_t;
+
+
+
+//
+// BLE Stream Task externally accessible variables
+//
+extern TaskHandle_t task_handle_ble_stream;
+
+
+
+//
+// API
+//
+void ble_stream_task();
+
+#endif /* BLE_STREAM_TASK_H */
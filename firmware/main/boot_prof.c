@@ -0,0 +1,84 @@
+/*
+ * Boot Profiler
+ *
+ * Record esp_timer timestamps (uSec since the application started) as the startup phases
+ * complete in the various tasks.  The table, with the time spent since the previous
+ * phase, is logged once after the first live vehicle data is displayed so changes to the
+ * startup sequence can be measured.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "boot_prof.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+
+//
+// Boot Profiler variables
+//
+static const char* TAG = "boot_prof";
+
+static portMUX_TYPE boot_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static int num_marks = 0;
+static const char* mark_name[BOOT_PROF_MAX_MARKS];
+static const char* mark_task[BOOT_PROF_MAX_MARKS];
+static int64_t mark_usec[BOOT_PROF_MAX_MARKS];
+
+
+
+//
+// API
+//
+
+// May be called from any task
+void boot_prof_mark(const char* phase)
+{
+	int64_t t = esp_timer_get_time();
+	const char* task_name = pcTaskGetName(NULL);
+	
+	portENTER_CRITICAL(&boot_mux);
+	if (num_marks < BOOT_PROF_MAX_MARKS) {
+		mark_name[num_marks] = phase;
+		mark_task[num_marks] = task_name;
+		mark_usec[num_marks] = t;
+		num_marks++;
+	}
+	portEXIT_CRITICAL(&boot_mux);
+}
+
+
+void boot_prof_log()
+{
+	int n;
+	int64_t prev_usec = 0;
+	
+	portENTER_CRITICAL(&boot_mux);
+	n = num_marks;
+	portEXIT_CRITICAL(&boot_mux);
+	
+	// Marks are recorded in time order and never change once written
+	ESP_LOGI(TAG, "Boot phases (mSec from start, delta)");
+	for (int i=0; i<n; i++) {
+		ESP_LOGI(TAG, "  %-14s %-10s %5lu.%01lu %+6ld", mark_name[i], mark_task[i],
+		         (uint32_t) (mark_usec[i] / 1000), (uint32_t) ((mark_usec[i] / 100) % 10),
+		         (int32_t) ((mark_usec[i] - prev_usec) / 1000));
+		prev_usec = mark_usec[i];
+	}
+}
@@ -0,0 +1,46 @@
+/*
+ * Boot Profiler
+ *
+ * Record timestamps as the startup phases complete and log them once the first live
+ * vehicle data is displayed.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BOOT_PROF_H
+#define BOOT_PROF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Boot Profiler Constants
+//
+
+// Maximum number of phases recorded (later marks are dropped)
+#define BOOT_PROF_MAX_MARKS     16
+
+
+
+//
+// API
+//
+void boot_prof_mark(const char* phase);     // phase must be a static string
+void boot_prof_log();
+
+#endif /* BOOT_PROF_H */
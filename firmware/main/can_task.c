@@ -21,13 +21,21 @@
  */
 #include "can_manager.h"
 #include "can_task.h"
+#include "boot_prof.h"
 #include "esp_system.h"
+#include "data_broker.h"
+#include "deadline_utilities.h"
 #include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "event_utilities.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "gui_task.h"
 #include "ps_utilities.h"
+#include "tune_utilities.h"
 #include "vehicle_manager.h"
+#include <math.h>
 #include <string.h>
 
 
@@ -41,6 +49,38 @@ TaskHandle_t task_handle_can;
 
 // Configuration
 static main_config_t* configP;
+static trip_totals_t* tripP;
+
+// Trip persistence
+static int64_t trip_save_usec;
+static volatile bool trip_reset_req = false;
+
+// Set while the GUI benchmark feeds the data broker synthetic values
+static volatile bool bench_mode = false;
+
+// Set to switch to the configured interface without a restart
+static volatile bool reconfig_req = false;
+
+// Last-known item persistence
+static item_snapshot_t* snapP;
+static int64_t snap_save_usec;
+
+// Response processing and the next request run at the maximum CPU frequency
+static esp_pm_lock_handle_t can_pm_lock = NULL;
+
+// Items with a signal catalog persist deadband, in snapshot slot order
+static int snap_item_list[PS_SNAP_MAX_ITEMS];
+static int num_snap_items = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _can_task_reconfigure();
+static void _can_task_trip_eval(bool force);
+static void _can_task_snap_restore();
+static void _can_task_snap_eval();
 
 
 
@@ -49,10 +89,11 @@ static main_config_t* configP;
 //
 void can_task()
 {
-	ESP_LOGI(TAG, "Start task");
+	db_trip_totals_t trip;
+	bool asleep = false;
+	bool connected = false;
 	
-	// Delay to let GUI task start first
-	vTaskDelay(pdMS_TO_TICKS(250));
+	ESP_LOGI(TAG, "Start task");
 	
 	// Get the system configuration
 	if (!ps_get_config(PS_CONFIG_TYPE_MAIN, (void**) &configP)) {
@@ -69,19 +110,249 @@ void can_task()
 		ps_save_config(PS_CONFIG_TYPE_MAIN);
 	}
 	
+	// Continue the trip saved at the last power down
+	if (ps_get_config(PS_CONFIG_TYPE_TRIP, (void**) &tripP)) {
+		trip.traction_kwh = tripP->traction_kwh;
+		trip.regen_kwh = tripP->regen_kwh;
+		trip.aux_kwh = tripP->aux_kwh;
+		trip.dist_km = tripP->dist_km;
+		db_set_trip_totals(&trip);
+	} else {
+		tripP = NULL;
+		ESP_LOGE(TAG, "Get trip totals failed");
+	}
+	trip_save_usec = esp_timer_get_time();
+	
+	// Start with the item values from the last power cycle (marked stale)
+	_can_task_snap_restore();
+	
+	// Wait for the GUI to get its internal RAM draw buffers before the BLE/WiFi stacks
+	// allocate theirs.  The rest of the GUI initialization and the intro screen overlap
+	// the interface bring-up.
+	if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CAN_TASK_GUI_WAIT_MSEC)) == 0) {
+		ESP_LOGW(TAG, "Timed out waiting for GUI");
+	}
+	
+	// Have the vehicle manager wake us when a response or error arrives so the next
+	// request can be sent immediately
+	vm_set_notify_task(task_handle_can);
+	
+	if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "can_task", &can_pm_lock) != ESP_OK) {
+		can_pm_lock = NULL;
+	}
+	
 	// Attempt to open the selected interface
 	if (!vm_init(configP->vehicle_name, configP->connection_index)) {
 		ESP_LOGE(TAG, "Vehicle manager init failed - %s, %d", configP->vehicle_name, configP->connection_index);
 	}
+	boot_prof_mark("vm_init");
 	
 	// Let the GUI know we're up and running
-	xTaskNotify(task_handle_gui, GUI_NOTIFY_VEHICLE_INIT, eSetBits);
+	event_publish(EVENT_VEHICLE_IDENTIFIED);
+	
+	deadline_init(DEADLINE_LOOP_CAN, CAN_TASK_BUDGET_USEC);
 	
 	while (1) {
-		vTaskDelay(pdMS_TO_TICKS(CAN_TASK_EVAL_MSEC));
+		// Wait for an event from the vehicle manager or our periodic scheduling tick
+		(void) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(tune_get(asleep ? TUNE_CAN_SLEEP_EVAL_MSEC : TUNE_CAN_EVAL_MSEC)));
+		
+		if (reconfig_req) {
+			reconfig_req = false;
+			_can_task_reconfigure();
+		}
 		
-		if (can_connected()) {
+		// The vehicle manager moves on to scheduling after decoding responses
+		deadline_begin(DEADLINE_LOOP_CAN, DEADLINE_PHASE_DECODE);
+		if (can_connected() != connected) {
+			connected = !connected;
+			event_publish(connected ? EVENT_ADAPTER_READY : EVENT_LINK_DOWN);
+		}
+		if (connected && !bench_mode) {
+			if (can_pm_lock != NULL) {
+				(void) esp_pm_lock_acquire(can_pm_lock);
+			}
 			vm_eval();
+			if (can_pm_lock != NULL) {
+				(void) esp_pm_lock_release(can_pm_lock);
+			}
+		}
+		
+		// Let the GUI turn the display off while the vehicle is off
+		if (vm_is_asleep() != asleep) {
+			asleep = !asleep;
+			event_publish(asleep ? EVENT_ECU_ASLEEP : EVENT_ECU_AWAKE);
+		}
+		
+		// Synthetic benchmark values are not saved
+		if (bench_mode) {
+			deadline_end(DEADLINE_LOOP_CAN);
+			continue;
+		}
+		
+		deadline_phase(DEADLINE_LOOP_CAN, DEADLINE_PHASE_SAVE);
+		if (trip_reset_req) {
+			trip_reset_req = false;
+			db_set_trip_totals(NULL);
+			_can_task_trip_eval(true);
+		} else {
+			_can_task_trip_eval(false);
+		}
+		_can_task_snap_eval();
+		deadline_end(DEADLINE_LOOP_CAN);
+	}
+}
+
+
+// Start a new trip (may be called from any task)
+void can_task_reset_trip()
+{
+	trip_reset_req = true;
+	xTaskNotifyGive(task_handle_can);
+}
+
+
+// Stop the current interface and start the one in the saved configuration (may be called
+// from any task).  The caller checks can_interface_hot_swappable() first.
+void can_task_reconfigure()
+{
+	reconfig_req = true;
+	xTaskNotifyGive(task_handle_can);
+}
+
+
+// Called by the GUI task once its display buffers are allocated
+void can_task_gui_ready()
+{
+	xTaskNotifyGive(task_handle_can);
+}
+
+
+// Stop (true) or resume (false) evaluating the vehicle manager and saving trip totals and
+// item snapshots while the GUI benchmark owns the data broker (may be called from any task)
+void can_task_set_bench_mode(bool en)
+{
+	bench_mode = en;
+	xTaskNotifyGive(task_handle_can);
+}
+
+
+
+//
+// Internal functions
+//
+
+// Tear down the vehicle manager and its interface and bring them up again with the current
+// configuration.  The item snapshot and trip carry on.
+static void _can_task_reconfigure()
+{
+	int64_t start_usec = esp_timer_get_time();
+	
+	if (!vm_deinit()) {
+		ESP_LOGE(TAG, "Interface could not be stopped - restarting");
+		esp_restart();
+	}
+	
+	if (!vm_init(configP->vehicle_name, configP->connection_index)) {
+		ESP_LOGE(TAG, "Vehicle manager init failed - %s, %d", configP->vehicle_name, configP->connection_index);
+	} else {
+		ESP_LOGI(TAG, "Switched to %s in %d mSec", can_get_interface_name(configP->connection_index),
+		         (int) ((esp_timer_get_time() - start_usec) / 1000));
+	}
+}
+
+
+// Periodically save the trip totals if they changed meaningfully since the last save
+static void _can_task_trip_eval(bool force)
+{
+	db_trip_totals_t cur;
+	int64_t cur_usec;
+	
+	if (tripP == NULL) return;
+	
+	cur_usec = esp_timer_get_time();
+	if (!force && ((cur_usec - trip_save_usec) < ((int64_t) CAN_TASK_TRIP_SAVE_MSEC * 1000))) return;
+	trip_save_usec = cur_usec;
+	
+	db_get_trip_totals(&cur);
+	if (force ||
+	    (fabsf(cur.traction_kwh - tripP->traction_kwh) >= CAN_TASK_TRIP_SAVE_MIN_KWH) ||
+	    (fabsf(cur.regen_kwh - tripP->regen_kwh) >= CAN_TASK_TRIP_SAVE_MIN_KWH) ||
+	    (fabsf(cur.aux_kwh - tripP->aux_kwh) >= CAN_TASK_TRIP_SAVE_MIN_KWH) ||
+	    (fabsf(cur.dist_km - tripP->dist_km) >= CAN_TASK_TRIP_SAVE_MIN_KM)) {
+		
+		tripP->traction_kwh = cur.traction_kwh;
+		tripP->regen_kwh = cur.regen_kwh;
+		tripP->aux_kwh = cur.aux_kwh;
+		tripP->dist_km = cur.dist_km;
+		if (!ps_save_config(PS_CONFIG_TYPE_TRIP)) {
+			ESP_LOGE(TAG, "Save trip totals failed");
+		}
+	}
+}
+
+
+// Restore the saved item values if they were read from the configured vehicle
+static void _can_task_snap_restore()
+{
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		if (db_catalog_get(i)->persist_deadband > 0) {
+			if (num_snap_items < PS_SNAP_MAX_ITEMS) {
+				snap_item_list[num_snap_items++] = i;
+			} else {
+				ESP_LOGW(TAG, "Too many snapshot items");
+				break;
+			}
+		}
+	}
+	
+	if (!ps_get_config(PS_CONFIG_TYPE_SNAP, (void**) &snapP)) {
+		snapP = NULL;
+		ESP_LOGE(TAG, "Get item snapshot failed");
+		return;
+	}
+	snap_save_usec = esp_timer_get_time();
+	
+	if (strncmp(snapP->vehicle_name, configP->vehicle_name, PS_VEHICLE_NAME_MAX_LEN) != 0) {
+		// Different vehicle: start a new snapshot
+		memset(snapP, 0, sizeof(item_snapshot_t));
+		strncpy(snapP->vehicle_name, configP->vehicle_name, PS_VEHICLE_NAME_MAX_LEN);
+		return;
+	}
+	
+	for (int i=0; i<PS_SNAP_MAX_ITEMS; i++) {
+		if (snapP->item[i] != DB_ITEM_NONE) {
+			db_restore_data_item(snapP->item[i], snapP->val[i]);
 		}
 	}
 }
+
+
+// Periodically save the snapshot items that have been freshly acquired if any of them
+// changed by more than its deadband since the last save (one NVS write covers them all)
+static void _can_task_snap_eval()
+{
+	bool changed = false;
+	float val;
+	int64_t cur_usec;
+	
+	if (snapP == NULL) return;
+	
+	cur_usec = esp_timer_get_time();
+	if ((cur_usec - snap_save_usec) < ((int64_t) CAN_TASK_SNAP_SAVE_MSEC * 1000)) return;
+	snap_save_usec = cur_usec;
+	
+	for (int i=0; i<num_snap_items; i++) {
+		if (db_get_item_quality(snap_item_list[i]) != DB_QUALITY_FRESH) continue;
+		(void) db_get_data_item(snap_item_list[i], &val, NULL);
+		
+		if ((snapP->item[i] != snap_item_list[i]) || (fabsf(val - snapP->val[i]) > db_catalog_get(snap_item_list[i])->persist_deadband)) {
+			snapP->item[i] = snap_item_list[i];
+			snapP->val[i] = val;
+			changed = true;
+		}
+	}
+	
+	if (changed && !ps_save_config(PS_CONFIG_TYPE_SNAP)) {
+		ESP_LOGE(TAG, "Save item snapshot failed");
+	}
+}
@@ -32,7 +32,27 @@
 //
 // CAN Task Constants
 //
-#define CAN_TASK_EVAL_MSEC  10
+// The maximum period between evaluations (the task is also woken by vehicle manager
+// events) is TUNE_CAN_EVAL_MSEC and TUNE_CAN_SLEEP_EVAL_MSEC while the vehicle is asleep
+
+// Loop iterations taking longer than this are counted as deadline overruns (the default
+// evaluation period)
+#define CAN_TASK_BUDGET_USEC       10000
+
+// Longest time the vehicle manager (and radio stacks) start is held waiting for the GUI
+// to allocate its internal RAM draw buffers
+#define CAN_TASK_GUI_WAIT_MSEC     1000
+
+// Trip totals are saved to flash at most this often, and only after they changed by at
+// least the given amount, to limit NVS wear (a power loss costs at most this much of the trip)
+#define CAN_TASK_TRIP_SAVE_MSEC    (5 * 60 * 1000)
+#define CAN_TASK_TRIP_SAVE_MIN_KWH 0.05
+#define CAN_TASK_TRIP_SAVE_MIN_KM  0.5
+
+// Slowly changing items (battery voltages and temperatures) are saved to flash so the
+// GUI can show their last-known (stale) values at boot.  They are saved at most this often
+// and only after one of them changed by more than its deadband.
+#define CAN_TASK_SNAP_SAVE_MSEC    (2 * 60 * 1000)
 
 
 
@@ -47,5 +67,9 @@ extern TaskHandle_t task_handle_can;
 // API
 //
 void can_task();
+void can_task_reset_trip();
+void can_task_reconfigure();
+void can_task_gui_ready();
+void can_task_set_bench_mode(bool en);
 
 #endif /* CAN_TASK_H */
\ No newline at end of file
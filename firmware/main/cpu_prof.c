@@ -0,0 +1,428 @@
+/*
+ * CPU Profiler
+ *
+ * Each core has a general purpose timer whose alarm interrupt (allocated on that core by
+ * a setup task pinned to it) reads the program counter the interrupted task was at from
+ * the frame the interrupt entry saved on its stack.  Samples are counted in an open
+ * addressed hash table of (PC, count) bins in PSRAM, one per core so the interrupts never
+ * share data.  Time in the idle task is counted but not binned.
+ *
+ * Only task code is sampled: the timer interrupt is level 1 so it never interrupts
+ * another ISR, and a sample that comes due while a task has interrupts masked (a critical
+ * section) is taken when they are unmasked so it is charged to the code just after it.
+ * The handler touches PSRAM so it isn't IRAM safe and no samples are taken while the
+ * flash cache is disabled.  The timers run from the crystal so they hold no power
+ * management lock.
+ *
+ * The histogram is served as text at CPU_PROF_URI once WiFi is running (it isn't started
+ * for the profiler) and may also be printed to the console:
+ *   # cpu_prof hz <sample rate> uptime_ms <time since boot>
+ *   # core <n> samples <total> idle <in idle task> dropped <didn't fit>
+ *   P <core> <pc hex> <count>
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "cpu_prof.h"
+
+#ifdef ENABLE_CPU_PROF
+
+#include "driver/gptimer.h"
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "wifi_utilities.h"
+#include "xtensa_context.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+//
+// CPU Profiler constants
+//
+#define CPU_PROF_NUM_CORES      2
+
+// Sample timer count rate
+#define TIMER_RES_HZ            1000000
+
+// Setup task run on each core
+#define SETUP_TASK_STACK        3072
+#define SETUP_WAIT_MSEC         500
+
+// Text output
+#define LINE_MAX_LEN            80
+#define DUMP_BUF_LEN            1024
+
+
+
+//
+// CPU Profiler typedefs
+//
+typedef struct {
+	uint32_t pc;                       // 0 = empty
+	uint32_t count;
+} cpu_prof_bin_t;
+
+typedef struct {
+	gptimer_handle_t timer;
+	cpu_prof_bin_t* binP;              // CPU_PROF_BINS in PSRAM
+	TaskHandle_t idle_task;
+	volatile uint32_t num_samples;     // Includes idle and dropped samples
+	volatile uint32_t num_idle;
+	volatile uint32_t num_dropped;
+	volatile bool setup_done;
+} cpu_prof_core_t;
+
+
+
+//
+// CPU Profiler variables
+//
+static const char* TAG = "cpu_prof";
+
+static cpu_prof_core_t prof_core[CPU_PROF_NUM_CORES];
+static bool prof_init = false;
+static volatile bool sampling = false;
+
+static bool uri_registered = false;
+
+// Download buffer (the server runs one handler at a time)
+static char dump_buf[DUMP_BUF_LEN];
+static int dump_len;
+
+#if CPU_PROF_PRINT_MSEC != 0
+static int64_t prev_print_usec = 0;
+#endif
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _cpu_prof_setup_task(void* arg);
+static bool _cpu_prof_alarm_cb(gptimer_handle_t timer, const gptimer_alarm_event_data_t* edata, void* user_ctx);
+static esp_err_t _cpu_prof_handler(httpd_req_t* req);
+static esp_err_t _cpu_prof_dump(httpd_req_t* req);
+static esp_err_t _cpu_prof_append(httpd_req_t* req, const char* s, int len);
+
+
+
+//
+// API
+//
+
+// Start (or restart) sampling both cores.  The histograms and timers are set up on the
+// first call.
+bool cpu_prof_start()
+{
+	int n = 0;
+	bool success = true;
+	
+	if (!prof_init) {
+		for (int i=0; i<CPU_PROF_NUM_CORES; i++) {
+			prof_core[i].idle_task = xTaskGetIdleTaskHandleForCore(i);
+			if (prof_core[i].binP == NULL) {
+				prof_core[i].binP = heap_caps_calloc(CPU_PROF_BINS, sizeof(cpu_prof_bin_t), MALLOC_CAP_SPIRAM);
+				if (prof_core[i].binP == NULL) {
+					ESP_LOGE(TAG, "Could not allocate histogram");
+					return false;
+				}
+			}
+		}
+	
+		// The timer interrupts are allocated on the core their timer is started from
+		sampling = true;
+		for (int i=0; i<CPU_PROF_NUM_CORES; i++) {
+			prof_core[i].setup_done = false;
+			if (xTaskCreatePinnedToCore(&_cpu_prof_setup_task, "cpu_prof_setup", SETUP_TASK_STACK, &prof_core[i],
+			                            configMAX_PRIORITIES - 1, NULL, i) != pdPASS) {
+				prof_core[i].setup_done = true;
+			}
+		}
+		while ((!prof_core[0].setup_done || !prof_core[1].setup_done) && (n++ < (SETUP_WAIT_MSEC / 10))) {
+			vTaskDelay(pdMS_TO_TICKS(10));
+		}
+		for (int i=0; i<CPU_PROF_NUM_CORES; i++) {
+			if (!prof_core[i].setup_done || (prof_core[i].timer == NULL)) {
+				ESP_LOGE(TAG, "Could not start sample timer on core %d", i);
+				success = false;
+			}
+		}
+		prof_init = true;
+	} else if (!sampling) {
+		sampling = true;
+		for (int i=0; i<CPU_PROF_NUM_CORES; i++) {
+			if (prof_core[i].timer != NULL) {
+				(void) gptimer_start(prof_core[i].timer);
+			}
+		}
+	}
+	
+	ESP_LOGI(TAG, "Sampling at %d Hz", CPU_PROF_SAMPLE_HZ);
+	return success;
+}
+
+
+void cpu_prof_stop()
+{
+	if (!sampling) return;
+	
+	sampling = false;
+	for (int i=0; i<CPU_PROF_NUM_CORES; i++) {
+		if (prof_core[i].timer != NULL) {
+			(void) gptimer_stop(prof_core[i].timer);
+		}
+	}
+}
+
+
+void cpu_prof_clear()
+{
+	bool was_sampling = sampling;
+	
+	// Let any sample being taken on the other core finish first
+	cpu_prof_stop();
+	vTaskDelay(pdMS_TO_TICKS(2));
+	
+	for (int i=0; i<CPU_PROF_NUM_CORES; i++) {
+		if (prof_core[i].binP != NULL) {
+			memset(prof_core[i].binP, 0, CPU_PROF_BINS * sizeof(cpu_prof_bin_t));
+		}
+		prof_core[i].num_samples = 0;
+		prof_core[i].num_idle = 0;
+		prof_core[i].num_dropped = 0;
+	}
+	
+	if (was_sampling) {
+		(void) cpu_prof_start();
+	}
+}
+
+
+// Called periodically by mon_task to make the histogram available once WiFi is in use
+void cpu_prof_eval()
+{
+	const httpd_uri_t prof_uri = {
+		.uri = CPU_PROF_URI,
+		.method = HTTP_GET,
+		.handler = _cpu_prof_handler,
+		.user_ctx = NULL
+	};
+	httpd_handle_t server;
+	
+	if (!prof_init) return;
+	
+	if (!uri_registered && wifi_is_enabled() && ((server = wifi_get_http_server()) != NULL)) {
+		if (httpd_register_uri_handler(server, &prof_uri) == ESP_OK) {
+			ESP_LOGI(TAG, "Serving %s", CPU_PROF_URI);
+		}
+		uri_registered = true;
+	}
+	
+#if CPU_PROF_PRINT_MSEC != 0
+	if ((esp_timer_get_time() - prev_print_usec) >= ((int64_t) CPU_PROF_PRINT_MSEC * 1000)) {
+		prev_print_usec = esp_timer_get_time();
+		cpu_prof_print();
+	}
+#endif
+}
+
+
+// Print the histogram to the console
+void cpu_prof_print()
+{
+	if (prof_init) {
+		(void) _cpu_prof_dump(NULL);
+	}
+}
+
+
+
+//
+// Internal functions
+//
+static void _cpu_prof_setup_task(void* arg)
+{
+	cpu_prof_core_t* cP = (cpu_prof_core_t*) arg;
+	gptimer_handle_t timer = NULL;
+	const gptimer_config_t timer_config = {
+		.clk_src = GPTIMER_CLK_SRC_XTAL,
+		.direction = GPTIMER_COUNT_UP,
+		.resolution_hz = TIMER_RES_HZ
+	};
+	const gptimer_alarm_config_t alarm_config = {
+		.alarm_count = TIMER_RES_HZ / CPU_PROF_SAMPLE_HZ,
+		.reload_count = 0,
+		.flags.auto_reload_on_alarm = true
+	};
+	const gptimer_event_callbacks_t cbs = {
+		.on_alarm = _cpu_prof_alarm_cb
+	};
+	
+	if (gptimer_new_timer(&timer_config, &timer) == ESP_OK) {
+		if ((gptimer_register_event_callbacks(timer, &cbs, cP) != ESP_OK) ||
+		    (gptimer_enable(timer) != ESP_OK) ||
+		    (gptimer_set_alarm_action(timer, &alarm_config) != ESP_OK) ||
+		    (gptimer_start(timer) != ESP_OK)) {
+			(void) gptimer_del_timer(timer);
+			timer = NULL;
+		}
+	} else {
+		timer = NULL;
+	}
+	
+	cP->timer = timer;
+	cP->setup_done = true;
+	vTaskDelete(NULL);
+}
+
+
+// Sample timer interrupt
+static bool _cpu_prof_alarm_cb(gptimer_handle_t timer, const gptimer_alarm_event_data_t* edata, void* user_ctx)
+{
+	cpu_prof_core_t* cP = (cpu_prof_core_t*) user_ctx;
+	cpu_prof_bin_t* bP;
+	TaskHandle_t task;
+	XtExcFrame* fP;
+	uint32_t pc;
+	uint32_t h;
+	
+	if (!sampling) return false;
+	cP->num_samples += 1;
+	
+	task = xTaskGetCurrentTaskHandle();
+	if (task == cP->idle_task) {
+		cP->num_idle += 1;
+		return false;
+	}
+	
+	// The interrupt entry saved the interrupted task's registers on its stack and left
+	// the stack pointer in pxTopOfStack, the first member of its TCB
+	fP = *((XtExcFrame**) task);
+	pc = fP->pc;
+	
+	// Fibonacci hash of the PC (instructions are at least 2 bytes) with linear probing
+	h = ((pc >> 1) * 2654435761UL) >> (32 - CPU_PROF_BIN_BITS);
+	for (int i=0; i<CPU_PROF_MAX_PROBE; i++) {
+		bP = &cP->binP[(h + i) & (CPU_PROF_BINS - 1)];
+		if (bP->pc == pc) {
+			bP->count += 1;
+			return false;
+		}
+		if (bP->pc == 0) {
+			bP->pc = pc;
+			bP->count = 1;
+			return false;
+		}
+	}
+	cP->num_dropped += 1;
+	
+	return false;
+}
+
+
+static esp_err_t _cpu_prof_handler(httpd_req_t* req)
+{
+	char query[16];
+	bool clear = false;
+	esp_err_t ret;
+	
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+		clear = (strstr(query, "clear=1") != NULL);
+		if (strstr(query, "run=0") != NULL) {
+			cpu_prof_stop();
+		} else if (strstr(query, "run=1") != NULL) {
+			(void) cpu_prof_start();
+		}
+	}
+	
+	httpd_resp_set_type(req, "text/plain");
+	httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"prof.txt\"");
+	httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+	
+	ret = _cpu_prof_dump(req);
+	if (ret == ESP_OK) {
+		ret = httpd_resp_send_chunk(req, NULL, 0);
+	}
+	if ((ret == ESP_OK) && clear) {
+		cpu_prof_clear();
+	}
+	
+	return ret;
+}
+
+
+// Write the histogram to the HTTP response (or stdout if req is NULL).  Bins are read
+// while sampling continues so counts may be a sample apart from the totals.
+static esp_err_t _cpu_prof_dump(httpd_req_t* req)
+{
+	cpu_prof_core_t* cP;
+	cpu_prof_bin_t* bP;
+	char line[LINE_MAX_LEN];
+	int n;
+	esp_err_t ret;
+	
+	dump_len = 0;
+	n = snprintf(line, sizeof(line), "# cpu_prof hz %d uptime_ms %lld\n", CPU_PROF_SAMPLE_HZ, esp_timer_get_time() / 1000);
+	ret = _cpu_prof_append(req, line, n);
+	
+	for (int i=0; (i<CPU_PROF_NUM_CORES) && (ret == ESP_OK); i++) {
+		cP = &prof_core[i];
+		n = snprintf(line, sizeof(line), "# core %d samples %lu idle %lu dropped %lu\n", i, cP->num_samples,
+		             cP->num_idle, cP->num_dropped);
+		ret = _cpu_prof_append(req, line, n);
+	
+		for (int j=0; (j<CPU_PROF_BINS) && (ret == ESP_OK); j++) {
+			bP = &cP->binP[j];
+			if (bP->pc != 0) {
+				n = snprintf(line, sizeof(line), "P %d %08lx %lu\n", i, bP->pc, bP->count);
+				ret = _cpu_prof_append(req, line, n);
+			}
+		}
+	}
+	
+	if ((ret == ESP_OK) && (req != NULL) && (dump_len != 0)) {
+		ret = httpd_resp_send_chunk(req, dump_buf, dump_len);
+	}
+	
+	return ret;
+}
+
+
+static esp_err_t _cpu_prof_append(httpd_req_t* req, const char* s, int len)
+{
+	esp_err_t ret = ESP_OK;
+	
+	if (req == NULL) {
+		fwrite(s, 1, len, stdout);
+		return ESP_OK;
+	}
+	
+	if ((dump_len + len) > DUMP_BUF_LEN) {
+		ret = httpd_resp_send_chunk(req, dump_buf, dump_len);
+		dump_len = 0;
+	}
+	memcpy(&dump_buf[dump_len], s, len);
+	dump_len += len;
+	
+	return ret;
+}
+
+#endif /* ENABLE_CPU_PROF */
@@ -0,0 +1,72 @@
+/*
+ * CPU Profiler
+ *
+ * Statistical profiler for both cores.  A timer interrupt on each core samples the
+ * program counter of the task it interrupted into a histogram in PSRAM.  The histogram
+ * is downloaded over WiFi (or printed to the USB console) and symbolized against the ELF
+ * on the host by cpu_prof_report.py to show where CPU time goes during a drive.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef CPU_PROF_H
+#define CPU_PROF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// CPU Profiler Constants
+//
+
+// Uncomment to sample both cores from startup
+//#define ENABLE_CPU_PROF
+
+// Sample rate on each core (not a divisor of the FreeRTOS tick or the LVGL refresh so the
+// samples don't lock to periodic work)
+#define CPU_PROF_SAMPLE_HZ      997
+
+// Histogram bins on each core (power of 2, 8 bytes each).  Samples of a PC that doesn't
+// fit are counted as dropped.
+#define CPU_PROF_BIN_BITS       13
+#define CPU_PROF_BINS           (1 << CPU_PROF_BIN_BITS)
+
+// Bins tried for a PC before its sample is dropped
+#define CPU_PROF_MAX_PROBE      16
+
+// Download URI.  "?clear=1" empties the histogram after the download, "?run=0" and
+// "?run=1" stop and restart sampling.
+//   curl -o prof.txt http://<ip>/prof.txt
+#define CPU_PROF_URI            "/prof.txt"
+
+// Print the histogram to the console every CPU_PROF_PRINT_MSEC (for units without WiFi,
+// capture the console to a file).  0 to disable.
+#define CPU_PROF_PRINT_MSEC     0
+
+
+
+//
+// CPU Profiler API
+//
+bool cpu_prof_start();
+void cpu_prof_stop();
+void cpu_prof_clear();
+void cpu_prof_eval();
+void cpu_prof_print();
+
+#endif /* CPU_PROF_H */
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+#
+# Symbolize a CPU profile (cpu_prof.h) against the firmware ELF and report where each
+# core's time went.
+#
+# Usage: cpu_prof_report.py <ev_info_display.elf> <prof.txt> [--top N] [--addr2line PATH]
+#
+# prof.txt is the download from /prof.txt or a console capture (other lines are
+# ignored).  Sampled PCs are resolved to functions and source files by addr2line from
+# the ESP-IDF toolchain, grouped into areas (LVGL, ELM327 parsing, NimBLE, lwIP, our
+# decoders ...) by source path or symbol name, and summarized per core as a share of
+# the samples taken outside the idle task.  The busiest functions follow.  Only the
+# Python standard library is used.
+#
+# Copyright 2025 Dan Julio
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# It is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software.  If not, see <https://www.gnu.org/licenses/>.
+#
+import subprocess
+import sys
+
+ADDR2LINE = 'xtensa-esp32s3-elf-addr2line'
+
+# Areas in the order they are tried: (name, source path fragments, symbol prefixes).
+# Libraries shipped without line information (WiFi, BT controller) only match by symbol.
+AREAS = [
+    ('LVGL draw', ['/lvgl/src/draw/'], ['lv_draw_', '_lv_blend', 'lv_img_decoder']),
+    ('LVGL', ['/lvgl/'], ['lv_', '_lv_']),
+    ('Display/touch', ['/lvgl_drivers/', '/esp_lcd/'], []),
+    ('ELM327 parsing', ['can_driver_elm327.c', '/elm327_interface'], ['_can_driver_elm327']),
+    ('CAN', ['/components/can/', '/esp_driver_twai/'], ['twai_']),
+    ('Decoders', ['/components/vehicle/'], ['vm_', '_vm_']),
+    ('Broker', ['/components/data_broker/'], ['db_', '_db_']),
+    ('GUI', ['/components/gui/', '/components/gui_assets/'], ['gui_']),
+    ('NimBLE', ['/nimble/', '/bt/host/'], ['ble_', 'npl_', 'r_ble']),
+    ('BT controller', ['/bt/controller/'], ['r_', 'btdm_', 'bt_']),
+    ('lwIP', ['/lwip/'], ['lwip_', 'tcp_', 'udp_', 'ip4_', 'pbuf_', 'netconn_', 'etharp_']),
+    ('WiFi', ['/esp_wifi/', '/wpa_supplicant/'], ['ieee80211', 'esp_wifi', 'wifi_', 'ppTask', 'pp_', 'lmac', 'hal_mac']),
+    ('FreeRTOS', ['/freertos/'], ['xQueue', 'xTask', 'vTask', 'vPort', 'xPort', 'prv', 'ulTask', 'xEventGroup']),
+    ('libc', ['/newlib/', '/libc/'], ['memcpy', 'memset', 'memmove', 'memcmp', 'str', '_vfprintf', '_svfprintf', '__']),
+    ('Firmware', ['/main/', '/components/'], []),
+]
+
+
+def read_profile(path):
+    """Returns {core: {pc: count}} and {core: (samples, idle, dropped)}"""
+    bins = {}
+    totals = {}
+    with open(path, errors='replace') as f:
+        for line in f:
+            words = line.split()
+            if (len(words) == 4) and (words[0] == 'P'):
+                core, pc, count = int(words[1]), int(words[2], 16), int(words[3])
+                core_bins = bins.setdefault(core, {})
+                core_bins[pc] = core_bins.get(pc, 0) + count
+            elif (len(words) == 9) and (words[:2] == ['#', 'core']):
+                totals[int(words[2])] = (int(words[4]), int(words[6]), int(words[8]))
+    return bins, totals
+
+
+def symbolize(elf, pcs, addr2line):
+    """Returns {pc: (function, file)}"""
+    pcs = sorted(pcs)
+    proc = subprocess.run([addr2line, '-f', '-C', '-e', elf], input=''.join('0x%08x\n' % pc for pc in pcs),
+                          capture_output=True, text=True, check=True)
+    lines = proc.stdout.splitlines()
+    result = {}
+    for i, pc in enumerate(pcs):
+        fcn = lines[2 * i] if (2 * i) < len(lines) else '??'
+        loc = lines[2 * i + 1] if (2 * i + 1) < len(lines) else '??:0'
+        result[pc] = (fcn, loc.split(':')[0])
+    return result
+
+
+def area(fcn, path):
+    path = path.replace('\\', '/')
+    for name, paths, prefixes in AREAS:
+        if any(p in path for p in paths):
+            return name
+    for name, paths, prefixes in AREAS:
+        if any(fcn.startswith(p) for p in prefixes):
+            return name
+    return 'Other'
+
+
+def main():
+    args = sys.argv[1:]
+    top = 20
+    addr2line = ADDR2LINE
+    if '--top' in args:
+        i = args.index('--top')
+        top = int(args[i + 1])
+        del args[i:i + 2]
+    if '--addr2line' in args:
+        i = args.index('--addr2line')
+        addr2line = args[i + 1]
+        del args[i:i + 2]
+    if len(args) != 2:
+        print('Usage: %s <elf> <prof.txt> [--top N] [--addr2line PATH]' % sys.argv[0])
+        sys.exit(1)
+
+    bins, totals = read_profile(args[1])
+    if not bins:
+        print('No samples in %s' % args[1])
+        sys.exit(1)
+    syms = symbolize(args[0], set(pc for core_bins in bins.values() for pc in core_bins), addr2line)
+
+    for core in sorted(set(bins) | set(totals)):
+        samples, idle, dropped = totals.get(core, (0, 0, 0))
+        core_bins = bins.get(core, {})
+        busy = sum(core_bins.values()) + dropped
+        print('Core %d: %d samples, %.1f%% idle, %d dropped' %
+              (core, samples, (100.0 * idle / samples) if samples else 0, dropped))
+        if busy == 0:
+            print()
+            continue
+
+        by_area = {}
+        by_fcn = {}
+        for pc, count in core_bins.items():
+            fcn, path = syms[pc]
+            a = area(fcn, path)
+            by_area[a] = by_area.get(a, 0) + count
+            by_fcn[(fcn, a)] = by_fcn.get((fcn, a), 0) + count
+        if dropped:
+            by_area['(dropped)'] = dropped
+
+        print('  %-20s %8s %7s' % ('Area', 'Samples', 'Busy'))
+        for a, count in sorted(by_area.items(), key=lambda x: -x[1]):
+            print('  %-20s %8d %6.1f%%' % (a, count, 100.0 * count / busy))
+        print('  %-40s %-16s %8s %7s' % ('Function', 'Area', 'Samples', 'Busy'))
+        for (fcn, a), count in sorted(by_fcn.items(), key=lambda x: -x[1])[:top]:
+            print('  %-40s %-16s %8d %6.1f%%' % (fcn[:40], a, count, 100.0 * count / busy))
+        print()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,453 @@
+/*
+ * Data broker benchmark
+ *
+ * The producer is woken by a periodic timer and publishes its share of the rate each tick,
+ * each item's values being its own sequence number so the consumer counts the updates it
+ * never saw.  Values carry the time they were published so the consumer measures the
+ * delivery latency from the timestamp it is given, as the GUI would.  The model stores
+ * keep the same value, timestamp and pending bit layout as the broker so only the locking
+ * differs between them.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "db_bench.h"
+
+#ifdef ENABLE_DB_BENCH
+
+#include "data_broker.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <string.h>
+
+
+
+//
+// Local typedefs
+//
+typedef struct {
+	uint32_t bins[DB_BENCH_HIST_BINS];
+	uint32_t num;
+	uint32_t max;
+} db_bench_hist_t;
+
+typedef struct {
+	// Producer (core 0)
+	db_bench_hist_t pub;                   // Publish call cycles
+	uint64_t write_wait_cycles;            // Cycles taken acquiring a model store's lock
+	uint32_t write_wait_max;
+
+	// Consumer (core 1)
+	db_bench_hist_t dlv;                   // Publish to delivery uSec
+	uint32_t delivered;
+	uint32_t dropped;                      // Updates overwritten before being delivered
+	uint64_t read_wait_cycles;             // Cycles taken acquiring a model store's lock
+	uint32_t read_retries;                 // Sequence lock reads repeated or spun
+} db_bench_result_t;
+
+
+
+//
+// Local variables
+//
+static const char* TAG = "db_bench";
+
+static const char* mode_names[DB_BENCH_NUM_MODES] = {"broker", "mutex", "spin", "seq"};
+static const uint32_t rate_list[DB_BENCH_NUM_RATES] = DB_BENCH_RATES;
+static const int item_list[DB_BENCH_NUM_ITEMS] = {
+	DB_ITEM_LV_BATT_I, DB_ITEM_LV_BATT_T, DB_ITEM_GPS_ELEVATION, DB_ITEM_LAT_ACCEL,
+	DB_ITEM_CELL_MIN_V, DB_ITEM_CELL_MAX_V, DB_ITEM_HV_SOH, DB_ITEM_GPS_HEADING
+};
+
+static TaskHandle_t producer_task;
+static TaskHandle_t consumer_task;
+static esp_timer_handle_t tick_timer;
+static int subscriber;
+
+// Current run (set by db_bench_run while the producer is stopped)
+static volatile bool running = false;
+static int cur_mode;
+static uint32_t cur_rate;
+static db_bench_result_t result;
+
+// Producer state
+static uint32_t rate_acc;
+static int next_item;
+static uint32_t item_seq[DB_BENCH_NUM_ITEMS];
+static uint32_t num_published;
+
+// Consumer state
+static uint32_t last_seq[DB_BENCH_NUM_ITEMS];
+
+// Model store
+static float model_val[DB_BENCH_NUM_ITEMS];
+static int64_t model_ts[DB_BENCH_NUM_ITEMS];
+static uint32_t model_seq[DB_BENCH_NUM_ITEMS];
+static uint32_t model_pending;
+static SemaphoreHandle_t model_mutex;
+static portMUX_TYPE model_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _db_bench_producer(void* arg);
+static void _db_bench_consumer(void* arg);
+static void _db_bench_tick_cb(void* arg);
+static void _db_bench_publish(int i, float val, int64_t ts_usec);
+static void _db_bench_model_eval();
+static void _db_bench_broker_cb(int item, float val, int64_t ts_usec);
+static void _db_bench_deliver(int i, float val, int64_t ts_usec);
+static void _db_bench_hist_add(db_bench_hist_t* hP, uint32_t v);
+static uint32_t _db_bench_hist_percentile(const db_bench_hist_t* hP, int pct);
+static void _db_bench_report();
+static uint32_t _db_bench_nsec(uint64_t cycles);
+
+
+
+//
+// API
+//
+
+// Run every mode at every rate (blocks for about
+// DB_BENCH_NUM_MODES * DB_BENCH_NUM_RATES * DB_BENCH_RUN_MSEC)
+void db_bench_run()
+{
+	const esp_timer_create_args_t tick_timer_args = {
+		.callback = &_db_bench_tick_cb,
+		.arg = NULL,
+		.name = "db bench tick",
+		.skip_unhandled_events = true
+	};
+	esp_pm_lock_handle_t pm_lock = NULL;
+	db_mask_t item_mask = 0;
+#ifdef DB_LOCK_STATS
+	db_lock_stats_t lock_stats;
+#endif
+	
+	ESP_LOGI(TAG, "Starting: %d items, %d mSec per run", DB_BENCH_NUM_ITEMS, DB_BENCH_RUN_MSEC);
+	
+	// Hold the clock steady so cycle counts convert to time
+	if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "db_bench", &pm_lock) == ESP_OK) {
+		esp_pm_lock_acquire(pm_lock);
+	} else {
+		pm_lock = NULL;
+	}
+	
+	for (int i=0; i<DB_BENCH_NUM_ITEMS; i++) {
+		item_mask |= DB_MASK(item_list[i]);
+	}
+	subscriber = db_add_subscriber(0, _db_bench_broker_cb);
+	model_mutex = xSemaphoreCreateMutex();
+	if ((subscriber < 0) || (model_mutex == NULL) || (esp_timer_create(&tick_timer_args, &tick_timer) != ESP_OK)) {
+		ESP_LOGE(TAG, "Could not allocate resources");
+		return;
+	}
+	
+	// Producer on the core the vehicle interfaces run on, consumer on the GUI's core
+	xTaskCreatePinnedToCore(&_db_bench_producer, "db_bench_prod", 3072, NULL, DB_BENCH_PRODUCER_PRIO, &producer_task, 0);
+	xTaskCreatePinnedToCore(&_db_bench_consumer, "db_bench_cons", 3072, NULL, DB_BENCH_CONSUMER_PRIO, &consumer_task, 1);
+	
+	for (int m=0; m<DB_BENCH_NUM_MODES; m++) {
+		for (int r=0; r<DB_BENCH_NUM_RATES; r++) {
+			cur_mode = m;
+			cur_rate = rate_list[r];
+			memset(&result, 0, sizeof(result));
+			memset(item_seq, 0, sizeof(item_seq));
+			memset(last_seq, 0, sizeof(last_seq));
+			memset(model_seq, 0, sizeof(model_seq));
+			rate_acc = 0;
+			next_item = 0;
+			num_published = 0;
+			__atomic_store_n(&model_pending, 0, __ATOMIC_RELAXED);
+			db_set_subscriber_items(subscriber, (m == DB_BENCH_MODE_BROKER) ? item_mask : 0);
+#ifdef DB_LOCK_STATS
+			db_get_lock_stats(&lock_stats, true);
+#endif
+	
+			running = true;
+			esp_timer_start_periodic(tick_timer, DB_BENCH_TICK_USEC);
+			vTaskDelay(pdMS_TO_TICKS(DB_BENCH_RUN_MSEC));
+			esp_timer_stop(tick_timer);
+			vTaskDelay(pdMS_TO_TICKS(DB_BENCH_DRAIN_MSEC));
+			running = false;
+	
+			_db_bench_report();
+#ifdef DB_LOCK_STATS
+			if (m == DB_BENCH_MODE_BROKER) {
+				db_get_lock_stats(&lock_stats, false);
+				ESP_LOGI(TAG, "  broker lock: %lu writes avg %lu max %lu nSec, %lu reads %lu spins %lu retries",
+				         lock_stats.writes,
+				         (lock_stats.writes == 0) ? 0 : _db_bench_nsec(lock_stats.write_wait_cycles / lock_stats.writes),
+				         _db_bench_nsec(lock_stats.write_wait_max), lock_stats.reads, lock_stats.read_spins,
+				         lock_stats.read_retries);
+			}
+#endif
+		}
+	}
+	
+	db_set_subscriber_items(subscriber, 0);
+	esp_timer_delete(tick_timer);
+	vTaskDelete(producer_task);
+	vTaskDelete(consumer_task);
+	if (pm_lock != NULL) esp_pm_lock_release(pm_lock);
+	ESP_LOGI(TAG, "Done");
+}
+
+
+
+//
+// Internal functions
+//
+static void _db_bench_producer(void* arg)
+{
+	uint32_t t0, dt;
+	int n;
+	
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		if (!running) continue;
+	
+		// This tick's share of the rate
+		rate_acc += cur_rate;
+		n = rate_acc / (1000000 / DB_BENCH_TICK_USEC);
+		rate_acc %= (1000000 / DB_BENCH_TICK_USEC);
+	
+		for (int j=0; j<n; j++) {
+			item_seq[next_item] += 1;
+			t0 = esp_cpu_get_cycle_count();
+			_db_bench_publish(next_item, (float) item_seq[next_item], esp_timer_get_time());
+			dt = esp_cpu_get_cycle_count() - t0;
+			_db_bench_hist_add(&result.pub, dt);
+			num_published += 1;
+	
+			if (++next_item >= DB_BENCH_NUM_ITEMS) next_item = 0;
+		}
+	
+		if ((n != 0) && (DB_BENCH_FRAME_MSEC == 0)) {
+			xTaskNotifyGive(consumer_task);
+		}
+	}
+}
+
+
+static void _db_bench_consumer(void* arg)
+{
+	while (1) {
+		if (DB_BENCH_FRAME_MSEC == 0) {
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DB_BENCH_DRAIN_MSEC));
+		} else {
+			vTaskDelay(pdMS_TO_TICKS(DB_BENCH_FRAME_MSEC));
+		}
+		if (!running) continue;
+	
+		if (cur_mode == DB_BENCH_MODE_BROKER) {
+			db_subscriber_eval(subscriber);
+		} else {
+			_db_bench_model_eval();
+		}
+	}
+}
+
+
+static void _db_bench_tick_cb(void* arg)
+{
+	xTaskNotifyGive(producer_task);
+}
+
+
+static void _db_bench_publish(int i, float val, int64_t ts_usec)
+{
+	uint32_t t0, dt;
+	uint32_t s;
+	
+	if (cur_mode == DB_BENCH_MODE_BROKER) {
+		db_set_data_item_value_ts(item_list[i], val, ts_usec);
+		return;
+	}
+	
+	t0 = esp_cpu_get_cycle_count();
+	switch (cur_mode) {
+		case DB_BENCH_MODE_MUTEX:
+			xSemaphoreTake(model_mutex, portMAX_DELAY);
+			dt = esp_cpu_get_cycle_count() - t0;
+			model_val[i] = val;
+			model_ts[i] = ts_usec;
+			xSemaphoreGive(model_mutex);
+			break;
+	
+		case DB_BENCH_MODE_SPIN:
+			taskENTER_CRITICAL(&model_mux);
+			dt = esp_cpu_get_cycle_count() - t0;
+			model_val[i] = val;
+			model_ts[i] = ts_usec;
+			taskEXIT_CRITICAL(&model_mux);
+			break;
+	
+		default:
+			// Sole writer of the item so no lock, just an odd sequence while storing
+			dt = 0;
+			s = model_seq[i];
+			__atomic_store_n(&model_seq[i], s + 1, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			model_val[i] = val;
+			model_ts[i] = ts_usec;
+			__atomic_store_n(&model_seq[i], s + 2, __ATOMIC_RELEASE);
+	}
+	
+	result.write_wait_cycles += dt;
+	if (dt > result.write_wait_max) result.write_wait_max = dt;
+	
+	__atomic_fetch_or(&model_pending, 1UL << i, __ATOMIC_RELEASE);
+}
+
+
+// Claim and copy the pending model store updates the way the broker delivers to a subscriber
+static void _db_bench_model_eval()
+{
+	uint32_t bits;
+	uint32_t t0;
+	uint32_t s;
+	float val;
+	int64_t ts_usec;
+	int i;
+	
+	bits = __atomic_exchange_n(&model_pending, 0, __ATOMIC_ACQUIRE);
+	while (bits != 0) {
+		i = __builtin_ctz(bits);
+		bits &= bits - 1;
+	
+		t0 = esp_cpu_get_cycle_count();
+		switch (cur_mode) {
+			case DB_BENCH_MODE_MUTEX:
+				xSemaphoreTake(model_mutex, portMAX_DELAY);
+				result.read_wait_cycles += esp_cpu_get_cycle_count() - t0;
+				val = model_val[i];
+				ts_usec = model_ts[i];
+				xSemaphoreGive(model_mutex);
+				break;
+	
+			case DB_BENCH_MODE_SPIN:
+				taskENTER_CRITICAL(&model_mux);
+				result.read_wait_cycles += esp_cpu_get_cycle_count() - t0;
+				val = model_val[i];
+				ts_usec = model_ts[i];
+				taskEXIT_CRITICAL(&model_mux);
+				break;
+	
+			default:
+				while (1) {
+					s = __atomic_load_n(&model_seq[i], __ATOMIC_ACQUIRE);
+					if ((s & 0x1) == 0) {
+						val = model_val[i];
+						ts_usec = model_ts[i];
+						__atomic_thread_fence(__ATOMIC_ACQUIRE);
+						if (__atomic_load_n(&model_seq[i], __ATOMIC_RELAXED) == s) break;
+					}
+					result.read_retries += 1;
+				}
+				result.read_wait_cycles += esp_cpu_get_cycle_count() - t0;
+		}
+	
+		_db_bench_deliver(i, val, ts_usec);
+	}
+}
+
+
+static void _db_bench_broker_cb(int item, float val, int64_t ts_usec)
+{
+	for (int i=0; i<DB_BENCH_NUM_ITEMS; i++) {
+		if (item_list[i] == item) {
+			_db_bench_deliver(i, val, ts_usec);
+			return;
+		}
+	}
+}
+
+
+static void _db_bench_deliver(int i, float val, int64_t ts_usec)
+{
+	uint32_t seq = (uint32_t) val;
+	
+	_db_bench_hist_add(&result.dlv, (uint32_t) (esp_timer_get_time() - ts_usec));
+	result.delivered += 1;
+	if (seq > (last_seq[i] + 1)) {
+		result.dropped += seq - last_seq[i] - 1;
+	}
+	last_seq[i] = seq;
+}
+
+
+static void _db_bench_hist_add(db_bench_hist_t* hP, uint32_t v)
+{
+	hP->bins[31 - __builtin_clz(v | 1)] += 1;
+	hP->num += 1;
+	if (v > hP->max) hP->max = v;
+}
+
+
+// Upper bound of the bin holding the percentile
+static uint32_t _db_bench_hist_percentile(const db_bench_hist_t* hP, int pct)
+{
+	uint32_t target;
+	uint32_t sum = 0;
+	
+	if (hP->num == 0) return 0;
+	
+	target = (uint32_t) (((uint64_t) hP->num * pct + 99) / 100);
+	for (int b=0; b<DB_BENCH_HIST_BINS; b++) {
+		sum += hP->bins[b];
+		if (sum >= target) {
+			return (b >= 31) ? UINT32_MAX : ((2UL << b) - 1);
+		}
+	}
+	
+	return hP->max;
+}
+
+
+static void _db_bench_report()
+{
+	uint32_t write_waits = (cur_mode == DB_BENCH_MODE_BROKER) ? 0 : result.pub.num;
+	
+	ESP_LOGI(TAG, "%-6s %5lu/s: pub %lu  p50 %lu p99 %lu max %lu nSec | dlv %lu  p50 %lu p99 %lu max %lu uSec | dropped %lu",
+	         mode_names[cur_mode], cur_rate, num_published,
+	         _db_bench_nsec(_db_bench_hist_percentile(&result.pub, 50)),
+	         _db_bench_nsec(_db_bench_hist_percentile(&result.pub, 99)), _db_bench_nsec(result.pub.max),
+	         result.delivered, _db_bench_hist_percentile(&result.dlv, 50), _db_bench_hist_percentile(&result.dlv, 99),
+	         result.dlv.max, result.dropped);
+	if (cur_mode != DB_BENCH_MODE_BROKER) {
+		ESP_LOGI(TAG, "  lock: write avg %lu max %lu nSec, read avg %lu nSec, %lu retries",
+		         (write_waits == 0) ? 0 : _db_bench_nsec(result.write_wait_cycles / write_waits),
+		         _db_bench_nsec(result.write_wait_max),
+		         (result.delivered == 0) ? 0 : _db_bench_nsec(result.read_wait_cycles / result.delivered),
+		         result.read_retries);
+	}
+}
+
+
+static uint32_t _db_bench_nsec(uint64_t cycles)
+{
+	return (uint32_t) ((cycles * 1000) / DB_BENCH_CPU_MHZ);
+}
+
+#endif /* ENABLE_DB_BENCH */
@@ -0,0 +1,89 @@
+/*
+ * Data broker benchmark - a producer on core 0 publishes sequence-numbered items at a
+ * series of rates while a consumer on core 1 drains them the way the GUI does, measuring
+ * the time each publish takes, the latency from publish to delivery, updates coalesced
+ * before delivery and the time spent waiting on the value lock.  The broker itself is
+ * measured along with model stores using the alternative locking schemes so they can be
+ * compared on the hardware.  Runs in place of the application when ENABLE_DB_BENCH is
+ * defined and logs a line per mode and rate.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef DB_BENCH_H
+#define DB_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Uncomment to run the broker benchmark instead of the application (define DB_LOCK_STATS
+// in data_broker.h as well to see the broker's own lock waits)
+//#define ENABLE_DB_BENCH
+
+// Stores measured
+//  - BROKER: the data broker (writers serialized by a spinlock, readers use a sequence lock)
+//  - MUTEX: model store with writers and readers serialized by a FreeRTOS mutex
+//  - SPIN: model store with writers and readers serialized by a spinlock
+//  - SEQ: model store with a sequence lock per item and no writer lock (one producer per item)
+#define DB_BENCH_MODE_BROKER    0
+#define DB_BENCH_MODE_MUTEX     1
+#define DB_BENCH_MODE_SPIN      2
+#define DB_BENCH_MODE_SEQ       3
+#define DB_BENCH_NUM_MODES      4
+
+// Total publish rates (updates/sec spread round-robin over the items) run for each mode
+#define DB_BENCH_RATES          {200, 1000, 5000, 20000}
+#define DB_BENCH_NUM_RATES      4
+
+// Length of each run and the time allowed afterwards for the consumer to drain
+#define DB_BENCH_RUN_MSEC       5000
+#define DB_BENCH_DRAIN_MSEC     50
+
+// Producer tick (publishes are made in a burst each tick)
+#define DB_BENCH_TICK_USEC      1000
+
+// Consumer delivery interval (0 = as soon as the producer signals a burst, otherwise paced
+// like the GUI's frames so updates coalesce)
+#define DB_BENCH_FRAME_MSEC     0
+
+// Number of items published (ones without derived items or alerts so only the storage and
+// delivery paths are measured)
+#define DB_BENCH_NUM_ITEMS      8
+
+// Histograms have log2 bins (bin n holds values below 2^(n+1))
+#define DB_BENCH_HIST_BINS      32
+
+// CPU clock held during the benchmark (converts cycles to nSec)
+#define DB_BENCH_CPU_MHZ        240
+
+// Task priorities (those of can_task and gui_task)
+#define DB_BENCH_PRODUCER_PRIO  2
+#define DB_BENCH_CONSUMER_PRIO  2
+
+
+
+//
+// API
+//
+void db_bench_run();
+
+#endif /* DB_BENCH_H */
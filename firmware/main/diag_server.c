@@ -0,0 +1,438 @@
+/*
+ * Diagnostics Server
+ *
+ * The snapshot is formatted field by field into one small chunk buffer that is sent
+ * each time it fills, straight from each module's statistics accessors.  Counters are
+ * cumulative so a scraper computes rates from successive snapshots.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "diag_server.h"
+#include "can_manager.h"
+#include "data_broker.h"
+#include "deadline_utilities.h"
+#include "esp_app_desc.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lvgl.h"
+#include "lvgl_mem.h"
+#include "mon_task.h"
+#include "tune_utilities.h"
+#include "vehicle_manager.h"
+#include "wifi_utilities.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+//
+// Diagnostics Server variables
+//
+static const char* TAG = "diag_server";
+
+static bool uri_registered = false;
+
+// Response state (the server runs one handler at a time)
+static char chunk_buf[DIAG_SERVER_CHUNK_LEN];
+static int chunk_len;
+static esp_err_t chunk_err;
+static mon_task_info_t task_info[MON_MAX_TASKS];
+static char params_body[DIAG_SERVER_PARAMS_BODY_LEN + 1];
+
+static const char* loop_names[DEADLINE_NUM_LOOPS] = {"can", "gui"};
+
+
+
+//
+// Forward declarations for internal functions
+//
+static esp_err_t _diag_server_handler(httpd_req_t* req);
+static esp_err_t _diag_server_params_get_handler(httpd_req_t* req);
+static esp_err_t _diag_server_params_post_handler(httpd_req_t* req);
+static esp_err_t _diag_server_params(httpd_req_t* req);
+static bool _diag_server_parse_params(char* body, int* num, int* ids, int32_t* vals);
+static void _diag_server_system(httpd_req_t* req);
+static void _diag_server_tasks(httpd_req_t* req);
+static void _diag_server_loops(httpd_req_t* req);
+static void _diag_server_can(httpd_req_t* req);
+static void _diag_server_goals(httpd_req_t* req);
+static void _diag_server_items(httpd_req_t* req);
+static void _diag_server_printf(httpd_req_t* req, const char* fmt, ...);
+static void _diag_server_flush(httpd_req_t* req);
+
+
+
+//
+// API
+//
+
+// Called periodically by mon_task to make the snapshot available once WiFi is in use
+void diag_server_eval()
+{
+	const httpd_uri_t diag_uri = {
+		.uri = DIAG_SERVER_URI,
+		.method = HTTP_GET,
+		.handler = _diag_server_handler,
+		.user_ctx = NULL
+	};
+	const httpd_uri_t params_get_uri = {
+		.uri = DIAG_SERVER_PARAMS_URI,
+		.method = HTTP_GET,
+		.handler = _diag_server_params_get_handler,
+		.user_ctx = NULL
+	};
+	const httpd_uri_t params_post_uri = {
+		.uri = DIAG_SERVER_PARAMS_URI,
+		.method = HTTP_POST,
+		.handler = _diag_server_params_post_handler,
+		.user_ctx = NULL
+	};
+	httpd_handle_t server;
+	
+	if (!uri_registered && wifi_is_enabled() && ((server = wifi_get_http_server()) != NULL)) {
+		if (httpd_register_uri_handler(server, &diag_uri) == ESP_OK) {
+			ESP_LOGI(TAG, "Serving %s", DIAG_SERVER_URI);
+		}
+		if ((httpd_register_uri_handler(server, &params_get_uri) == ESP_OK) &&
+		    (httpd_register_uri_handler(server, &params_post_uri) == ESP_OK)) {
+			ESP_LOGI(TAG, "Serving %s", DIAG_SERVER_PARAMS_URI);
+		}
+		uri_registered = true;
+	}
+}
+
+
+
+//
+// Internal functions
+//
+static esp_err_t _diag_server_handler(httpd_req_t* req)
+{
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+	chunk_len = 0;
+	chunk_err = ESP_OK;
+	
+	_diag_server_printf(req, "{\"uptime_ms\":%lld,\"version\":\"%s\",", esp_timer_get_time() / 1000,
+	                    esp_app_get_description()->version);
+	_diag_server_system(req);
+	_diag_server_tasks(req);
+	_diag_server_loops(req);
+	_diag_server_can(req);
+	_diag_server_goals(req);
+	_diag_server_items(req);
+	_diag_server_printf(req, "}\n");
+	
+	_diag_server_flush(req);
+	if (chunk_err == ESP_OK) {
+		chunk_err = httpd_resp_send_chunk(req, NULL, 0);
+	}
+	
+	return chunk_err;
+}
+
+
+static esp_err_t _diag_server_params_get_handler(httpd_req_t* req)
+{
+	return _diag_server_params(req);
+}
+
+
+static esp_err_t _diag_server_params_post_handler(httpd_req_t* req)
+{
+	char query[24];
+	bool save = false;
+	int len = 0;
+	int n;
+	int num = 0;
+	int ids[2 * TUNE_NUM_PARAMS];
+	int32_t vals[2 * TUNE_NUM_PARAMS];
+	
+	// Reading is open but changes need the shared token (like OTA updates)
+	if (!wifi_http_authorized(req)) {
+		ESP_LOGW(TAG, "Rejected unauthorized parameter change");
+		httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, "Not authorized");
+		return ESP_FAIL;
+	}
+	
+	if (req->content_len > DIAG_SERVER_PARAMS_BODY_LEN) {
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Body too long");
+		return ESP_FAIL;
+	}
+	while (len < req->content_len) {
+		n = httpd_req_recv(req, &params_body[len], req->content_len - len);
+		if (n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+		if (n <= 0) {
+			httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Receive failed");
+			return ESP_FAIL;
+		}
+		len += n;
+	}
+	params_body[len] = 0;
+	
+	// A reset is applied as part of the same set as the body so a bad body changes nothing
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+		save = (strstr(query, "save=1") != NULL);
+		if (strstr(query, "reset=1") != NULL) {
+			for (num=0; num<TUNE_NUM_PARAMS; num++) {
+				ids[num] = num;
+				vals[num] = tune_get_info(num)->def_val;
+			}
+		}
+	}
+	
+	if (!_diag_server_parse_params(params_body, &num, ids, vals)) {
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown parameter or bad value");
+		return ESP_FAIL;
+	}
+	
+	if (!tune_set(num, ids, vals)) {
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Value out of range");
+		return ESP_FAIL;
+	}
+	if (save && !tune_save()) {
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Save failed");
+		return ESP_FAIL;
+	}
+	
+	return _diag_server_params(req);
+}
+
+
+// Current values with their defaults and ranges
+static esp_err_t _diag_server_params(httpd_req_t* req)
+{
+	const tune_param_info_t* infoP;
+	
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+	chunk_len = 0;
+	chunk_err = ESP_OK;
+	
+	_diag_server_printf(req, "{\"generation\":%lu,\"params\":{", tune_get_generation());
+	for (int i=0; i<TUNE_NUM_PARAMS; i++) {
+		infoP = tune_get_info(i);
+		_diag_server_printf(req, "%s\"%s\":{\"value\":%ld,\"default\":%ld,\"min\":%ld,\"max\":%ld}",
+		                    (i == 0) ? "" : ",", infoP->name, tune_get(i), infoP->def_val, infoP->min_val,
+		                    infoP->max_val);
+	}
+	_diag_server_printf(req, "}}\n");
+	
+	_diag_server_flush(req);
+	if (chunk_err == ESP_OK) {
+		chunk_err = httpd_resp_send_chunk(req, NULL, 0);
+	}
+	
+	return chunk_err;
+}
+
+
+// Append the parameter IDs and values of a "name=value&name=value" body to the *num
+// already in ids and vals (room for 2 * TUNE_NUM_PARAMS)
+static bool _diag_server_parse_params(char* body, int* num, int* ids, int32_t* vals)
+{
+	char* pairP;
+	char* valP;
+	char* endP;
+	char* saveP;
+	
+	for (pairP = strtok_r(body, "&\r\n", &saveP); pairP != NULL; pairP = strtok_r(NULL, "&\r\n", &saveP)) {
+		if (*num == (2 * TUNE_NUM_PARAMS)) return false;
+		if ((valP = strchr(pairP, '=')) == NULL) return false;
+		*valP++ = 0;
+		
+		if ((ids[*num] = tune_find(pairP)) < 0) return false;
+		vals[*num] = strtol(valP, &endP, 0);
+		if ((endP == valP) || (*endP != 0)) return false;
+		*num += 1;
+	}
+	
+	return true;
+}
+
+
+// Core loads, clock residency and heaps
+static void _diag_server_system(httpd_req_t* req)
+{
+	mon_heap_info_t heap;
+#if LV_MEM_CUSTOM != 0
+	lvgl_mem_stats_t lv_stats;
+#endif
+	
+	_diag_server_printf(req, "\"cpu_load\":[%d,%d],\"freq_pct\":{\"240\":%d,\"160\":%d,\"80\":%d},",
+	                    mon_get_core_load(0), mon_get_core_load(1), mon_get_freq_residency(240),
+	                    mon_get_freq_residency(160), mon_get_freq_residency(80));
+	
+	if (mon_get_heap_info(&heap)) {
+		_diag_server_printf(req, "\"heap\":{\"int_free\":%lu,\"int_min_free\":%lu,\"int_largest\":%lu,"
+		                    "\"psram_free\":%lu,\"psram_min_free\":%lu},",
+		                    heap.int_free, heap.int_min_free, heap.int_largest, heap.psram_free, heap.psram_min_free);
+	}
+	
+#if LV_MEM_CUSTOM != 0
+	lvgl_mem_get_stats(&lv_stats);
+	_diag_server_printf(req, "\"lvgl_mem\":{\"int_used\":%lu,\"int_max_used\":%lu,\"psram_used\":%lu,"
+	                    "\"psram_max_used\":%lu,\"allocs\":%lu,\"fails\":%lu},",
+	                    lv_stats.int_used, lv_stats.int_max_used, lv_stats.ext_used, lv_stats.ext_max_used,
+	                    lv_stats.alloc_cnt, lv_stats.fail_cnt);
+#endif
+}
+
+
+// Per-task load and stack high-water marks from the last monitor sample
+static void _diag_server_tasks(httpd_req_t* req)
+{
+	int n;
+	
+	n = mon_get_task_info(task_info, MON_MAX_TASKS);
+	_diag_server_printf(req, "\"tasks\":[");
+	for (int i=0; i<n; i++) {
+		_diag_server_printf(req, "%s{\"name\":\"%s\",\"core\":%d,\"prio\":%u,\"load_pct\":%u.%u,\"stack_hwm\":%lu}",
+		                    (i == 0) ? "" : ",", task_info[i].name, task_info[i].core, task_info[i].priority,
+		                    task_info[i].load_pct10 / 10, task_info[i].load_pct10 % 10, task_info[i].stack_hwm);
+	}
+	_diag_server_printf(req, "],");
+}
+
+
+static void _diag_server_loops(httpd_req_t* req)
+{
+	deadline_stats_t stats;
+	bool first = true;
+	
+	_diag_server_printf(req, "\"loops\":{");
+	for (int i=0; i<DEADLINE_NUM_LOOPS; i++) {
+		if (deadline_get_stats(i, &stats)) {
+			_diag_server_printf(req, "%s\"%s\":{\"budget_us\":%lu,\"iterations\":%lu,\"overruns\":%lu,\"last_us\":%lu,"
+			                    "\"max_us\":%lu,\"max_phase\":\"%s\",\"overrun_phase\":\"%s\"}",
+			                    first ? "" : ",", loop_names[i], stats.budget_usec, stats.iterations, stats.overruns,
+			                    stats.last_usec, stats.max_usec, deadline_get_phase_name(stats.max_phase),
+			                    deadline_get_phase_name(stats.overrun_phase));
+			first = false;
+		}
+	}
+	_diag_server_printf(req, "},");
+}
+
+
+// Bus counters and the statistics of each scheduled request
+static void _diag_server_can(httpd_req_t* req)
+{
+	can_bus_stats_t bus;
+	vm_req_stats_t stats;
+	int num_req, num_backoff;
+	
+	if (can_get_bus_stats(&bus)) {
+		_diag_server_printf(req, "\"can_bus\":{\"bitrate\":%lu,\"rx_frames\":%lu,\"tx_frames\":%lu,\"bits\":%lu,"
+		                    "\"bus_errors\":%lu,\"err_passive\":%lu,\"bus_off\":%lu},",
+		                    bus.bitrate, bus.num_rx_frames, bus.num_tx_frames, bus.num_bits, bus.num_bus_errors,
+		                    bus.num_err_passive, bus.num_bus_off);
+	}
+	
+	vm_get_request_health(&num_req, &num_backoff);
+	_diag_server_printf(req, "\"num_requests\":%d,\"num_backoff\":%d,\"requests\":[", num_req, num_backoff);
+	for (int i=0; vm_get_request_stats(i, &stats); i++) {
+		_diag_server_printf(req, "%s{\"req_id\":%lu,\"rsp_id\":%lu,\"tx\":%lu,\"rsp\":%lu,\"timeout\":%lu,\"no_data\":%lu,"
+		                    "\"frame_timeout\":%lu,\"neg_rsp\":%lu,\"rsp_pending\":%lu,\"last_nrc\":%u,",
+		                    (i == 0) ? "" : ",", stats.req_id, stats.rsp_id, stats.num_tx, stats.num_rsp,
+		                    stats.num_timeout, stats.num_no_data, stats.num_frame_timeout, stats.num_neg_rsp,
+		                    stats.num_rsp_pending, stats.last_nrc);
+		_diag_server_printf(req, "\"lat_max_us\":%lu,\"lat_p50_ms\":%lu,\"lat_p90_ms\":%lu,\"lat_hist\":[",
+		                    stats.lat_max_usec, vm_get_latency_percentile(&stats, 50), vm_get_latency_percentile(&stats, 90));
+		for (int b=0; b<VM_LAT_HIST_BINS; b++) {
+			_diag_server_printf(req, "%s%lu", (b == 0) ? "" : ",", stats.lat_hist[b]);
+		}
+		_diag_server_printf(req, "]}");
+	}
+	_diag_server_printf(req, "],");
+}
+
+
+// Freshness goals of the displayed tile
+static void _diag_server_goals(httpd_req_t* req)
+{
+	vm_goal_stats_t stats;
+	const char* name;
+	int num_goals, num_unmet, relax_pct;
+	
+	vm_get_goal_health(&num_goals, &num_unmet, &relax_pct);
+	_diag_server_printf(req, "\"goals_unmet\":%d,\"goal_relax_pct\":%d,\"goals\":[", num_unmet, relax_pct);
+	for (int i=0; vm_get_goal_stats(i, &stats); i++) {
+		name = db_catalog_get(stats.item)->name;
+		_diag_server_printf(req, "%s{\"item\":\"%s\",\"goal_ms\":%d,\"age_ms\":%d,\"met\":%s,\"controlled\":%s,"
+		                    "\"limited\":%s,\"eval\":%lu,\"unmet\":%lu}",
+		                    (i == 0) ? "" : ",", (name != NULL) ? name : "", stats.goal_msec, stats.age_msec,
+		                    stats.met ? "true" : "false", stats.controlled ? "true" : "false",
+		                    stats.limited ? "true" : "false", stats.num_eval, stats.num_unmet);
+	}
+	_diag_server_printf(req, "],");
+}
+
+
+// Update counts of the items the vehicle supports
+static void _diag_server_items(httpd_req_t* req)
+{
+	db_mask_t item_mask = vm_get_supported_item_mask();
+	bool first = true;
+	
+	_diag_server_printf(req, "\"item_updates\":{");
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		if (((item_mask & DB_MASK(i)) != 0) && (db_catalog_get(i)->name != NULL)) {
+			_diag_server_printf(req, "%s\"%s\":%lu", first ? "" : ",", db_catalog_get(i)->name, db_get_item_update_count(i));
+			first = false;
+		}
+	}
+	_diag_server_printf(req, "}");
+}
+
+
+// Append to the response, sending the chunk buffer first if there isn't room
+static void _diag_server_printf(httpd_req_t* req, const char* fmt, ...)
+{
+	va_list ap;
+	int n;
+	
+	if (chunk_err != ESP_OK) return;
+	
+	for (int tries=0; tries<2; tries++) {
+		va_start(ap, fmt);
+		n = vsnprintf(&chunk_buf[chunk_len], DIAG_SERVER_CHUNK_LEN - chunk_len, fmt, ap);
+		va_end(ap);
+	
+		if ((chunk_len + n) < DIAG_SERVER_CHUNK_LEN) {
+			chunk_len += n;
+			return;
+		}
+		_diag_server_flush(req);
+	}
+	
+	// Longer than a chunk (never expected)
+	ESP_LOGE(TAG, "Field too long");
+	chunk_err = ESP_FAIL;
+}
+
+
+static void _diag_server_flush(httpd_req_t* req)
+{
+	if ((chunk_err == ESP_OK) && (chunk_len != 0)) {
+		chunk_err = httpd_resp_send_chunk(req, chunk_buf, chunk_len);
+	}
+	chunk_len = 0;
+}
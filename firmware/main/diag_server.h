@@ -0,0 +1,63 @@
+/*
+ * Diagnostics Server
+ *
+ * Serve a JSON snapshot of the performance counters kept around the system (core loads,
+ * heaps, task stacks, loop deadlines, CAN bus load, per-request latency histograms and
+ * item update counts) over WiFi so units on the depot network can be scraped without a
+ * USB cable.  The URI is only registered once WiFi has been started for something else.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef DIAG_SERVER_H
+#define DIAG_SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Diagnostics Server Constants
+//
+
+// Snapshot URI
+//   GET DIAG_SERVER_URI  (application/json, sent with chunked encoding)
+#define DIAG_SERVER_URI         "/diag.json"
+
+// Runtime parameter URI (tune_utilities.h).  GET returns each parameter's value, default
+// and range.  POST changes the parameters in a form encoded body together (all or none)
+// and returns the new values.  "?save=1" also saves the values, "?reset=1" returns the
+// parameters missing from the body to their defaults.  POST is refused with 401 unless it
+// carries WIFI_HTTP_TOKEN (wifi_utilities.h) in the WIFI_HTTP_TOKEN_HDR header.
+//   curl http://<ip>/params.json
+//   curl -H "X-Auth-Token: <token>" -d "backoff_min_msec=500&lat_dev_mult=3" "http://<ip>/params.json?save=1"
+#define DIAG_SERVER_PARAMS_URI  "/params.json"
+
+// Longest parameter POST body
+#define DIAG_SERVER_PARAMS_BODY_LEN 256
+
+// Response chunk length (the snapshot is formatted directly into this buffer)
+#define DIAG_SERVER_CHUNK_LEN   512
+
+
+
+//
+// Diagnostics Server API
+//
+void diag_server_eval();
+
+#endif /* DIAG_SERVER_H */
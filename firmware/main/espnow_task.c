@@ -0,0 +1,245 @@
+/*
+ * ESP-NOW Publisher Task
+ *
+ * Broadcast data broker updates over ESP-NOW so secondary displays (running the ESP-NOW
+ * remote interface) share this unit's vehicle connection without their own adapter or a
+ * WiFi association.  The task is a broker subscriber that collects the items updated each
+ * GUI refresh period (the broker coalesces repeated updates to the latest value) and
+ * encodes them as compact records into as few broadcast frames as fit.  Items the remote
+ * displays produce themselves (on-board sensors and items derived from the others) are
+ * not sent.  Frames go out on the channel the radio is on (the AP's when WiFi is in use)
+ * and the receivers search for it.  Only included when ENABLE_ESPNOW_PUB is defined.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "espnow_task.h"
+
+#ifdef ENABLE_ESPNOW_PUB
+
+#include "can_driver_remote.h"
+#include "can_manager.h"
+#include "data_broker.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ps_utilities.h"
+#include "vehicle_manager.h"
+#include "wifi_utilities.h"
+#include <string.h>
+
+
+//
+// ESP-NOW Publisher Task variables
+//
+static const char* TAG = "espnow_task";
+
+// Task handle
+TaskHandle_t task_handle_espnow;
+
+static int pub_sub = -1;
+static db_mask_t pub_cur_mask = 0;
+
+static const uint8_t bcast_mac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static wifi_interface_t peer_ifidx;
+
+// Frame being built
+static uint8_t frame_buf[CAN_REMOTE_MAX_FRAME_LEN];
+static uint32_t cur_ts_msec;
+static int cur_count;
+
+static uint16_t seq = 0;
+static uint32_t drop_count = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static bool _espnow_update_peer();
+static void _espnow_update_items();
+static void _espnow_item_handler(int item, float val, int64_t ts_usec);
+static void _espnow_send_frame();
+
+
+
+//
+// API
+//
+void espnow_task()
+{
+#ifdef CAN_MANAGER_EN_REMOTE
+	main_config_t* main_configP;
+#endif
+	int check_count = 0;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+#ifdef CAN_MANAGER_EN_REMOTE
+	// A remote display doesn't republish what it receives
+	if (ps_get_config(PS_CONFIG_TYPE_MAIN, (void**) &main_configP) &&
+	    (main_configP->connection_index == CAN_MANAGER_IF_REMOTE)) {
+		ESP_LOGI(TAG, "Remote display - not publishing");
+		vTaskDelete(NULL);
+	}
+#endif
+	
+	if (!wifi_is_enabled() && !wifi_init()) {
+		ESP_LOGE(TAG, "Could not start WiFi");
+		vTaskDelete(NULL);
+	}
+	
+	if ((esp_now_init() != ESP_OK) || !_espnow_update_peer()) {
+		ESP_LOGE(TAG, "Could not start ESP-NOW");
+		vTaskDelete(NULL);
+	}
+	
+	pub_sub = db_add_subscriber(0, _espnow_item_handler);
+	if (pub_sub < 0) {
+		ESP_LOGE(TAG, "No broker subscriber available");
+		vTaskDelete(NULL);
+	}
+	
+	while (1) {
+		vTaskDelay(pdMS_TO_TICKS(ESPNOW_PUB_BATCH_MSEC));
+		
+		if (check_count-- == 0) {
+			check_count = ESPNOW_PUB_ITEM_CHECK_MSEC / ESPNOW_PUB_BATCH_MSEC;
+			_espnow_update_items();
+			(void) _espnow_update_peer();
+		}
+		
+		if (db_subscriber_has_updates(pub_sub)) {
+			// Records are encoded by the handler which sends each frame that fills
+			cur_ts_msec = (uint32_t) (esp_timer_get_time() / 1000);
+			cur_count = 0;
+			db_subscriber_eval(pub_sub);
+			if (cur_count != 0) {
+				_espnow_send_frame();
+			}
+		}
+	}
+}
+
+
+
+//
+// Internal functions
+//
+
+// (Re)add the broadcast peer on the interface WiFi is running (it may be reconfigured)
+static bool _espnow_update_peer()
+{
+	esp_now_peer_info_t peer;
+	wifi_mode_t mode;
+	wifi_interface_t ifidx;
+	
+	if (esp_wifi_get_mode(&mode) != ESP_OK) {
+		return false;
+	}
+	ifidx = (mode == WIFI_MODE_AP) ? WIFI_IF_AP : WIFI_IF_STA;
+	if (esp_now_is_peer_exist(bcast_mac)) {
+		if (ifidx == peer_ifidx) {
+			return true;
+		}
+		(void) esp_now_del_peer(bcast_mac);
+	}
+	
+	// Channel 0 is the current channel
+	memset(&peer, 0, sizeof(peer));
+	memcpy(peer.peer_addr, bcast_mac, 6);
+	peer.channel = 0;
+	peer.ifidx = ifidx;
+	peer.encrypt = false;
+	if (esp_now_add_peer(&peer) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not add broadcast peer");
+		return false;
+	}
+	peer_ifidx = ifidx;
+	
+	return true;
+}
+
+
+// Publish the vehicle's items (remote displays have their own on-board sensors and derive
+// the same items from the ones sent)
+static void _espnow_update_items()
+{
+	db_mask_t mask;
+	
+	mask = vm_get_supported_item_mask();
+	mask &= ~(db_get_local_items() | db_get_derived_outputs(mask));
+	if (mask != pub_cur_mask) {
+		pub_cur_mask = mask;
+		db_set_subscriber_items(pub_sub, mask);
+	}
+}
+
+
+// Broker subscriber handler - add one record to the frame
+static void _espnow_item_handler(int item, float val, int64_t ts_usec)
+{
+	can_remote_record_t rec;
+	int32_t dt;
+	
+	if (item >= DB_NUM_ITEMS) {
+		return;
+	}
+	
+	if (cur_count >= CAN_REMOTE_MAX_RECORDS) {
+		_espnow_send_frame();
+		cur_count = 0;
+	}
+	
+	dt = (int32_t) ((uint32_t) (ts_usec / 1000) - cur_ts_msec);
+	if (dt < INT16_MIN) dt = INT16_MIN;
+	if (dt > INT16_MAX) dt = INT16_MAX;
+	
+	rec.item = (uint8_t) item;
+	rec.dt_msec = (int16_t) dt;
+	rec.val = val;
+	memcpy(&frame_buf[sizeof(can_remote_hdr_t) + cur_count * sizeof(can_remote_record_t)], &rec, sizeof(rec));
+	cur_count++;
+}
+
+
+static void _espnow_send_frame()
+{
+	can_remote_hdr_t hdr;
+	esp_err_t ret;
+	int len;
+	
+	hdr.magic = CAN_REMOTE_MAGIC;
+	hdr.version = CAN_REMOTE_VERSION;
+	hdr.count = (uint8_t) cur_count;
+	hdr.seq = seq++;
+	hdr.items = pub_cur_mask;
+	memcpy(frame_buf, &hdr, sizeof(hdr));
+	len = sizeof(can_remote_hdr_t) + cur_count * sizeof(can_remote_record_t);
+	
+	// Copied by ESP-NOW so the buffer may be reused immediately
+	if ((ret = esp_now_send(bcast_mac, frame_buf, len)) != ESP_OK) {
+		if ((drop_count++ % 100) == 0) {
+			ESP_LOGW(TAG, "Send failed - %d (%lu)", ret, drop_count);
+		}
+	}
+}
+
+#endif /* ENABLE_ESPNOW_PUB */
@@ -0,0 +1,62 @@
+/*
+ * ESP-NOW Publisher Task
+ *
+ * Broadcast data broker updates over ESP-NOW to secondary displays
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef ESPNOW_TASK_H
+#define ESPNOW_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+
+
+//
+// ESP-NOW Publisher Task Constants
+//
+
+// Uncomment to broadcast broker updates to secondary displays using the ESP-NOW remote
+// interface (CAN_MANAGER_EN_REMOTE, frame format in can_driver_remote.h)
+//#define ENABLE_ESPNOW_PUB
+
+// Updated items are batched into frames once per GUI refresh period so remote displays
+// draw them in the frame after ours
+#define ESPNOW_PUB_BATCH_MSEC      CONFIG_LV_DISP_DEF_REFR_PERIOD
+
+// Period the set of published items is re-evaluated (on-board items appear after startup)
+#define ESPNOW_PUB_ITEM_CHECK_MSEC 1000
+
+
+
+//
+// ESP-NOW Publisher Task externally accessible variables
+//
+extern TaskHandle_t task_handle_espnow;
+
+
+
+//
+// API
+//
+void espnow_task();
+
+#endif /* ESPNOW_TASK_H */
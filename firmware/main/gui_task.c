@@ -21,21 +21,35 @@
  * along with this software.  If not, see <https://www.gnu.org/licenses/>.
  *
  */
+#include "boot_prof.h"
 #include "can_manager.h"
+#include "can_task.h"
 #include "data_broker.h"
+#include "deadline_utilities.h"
+#include "disp_blend.h"
 #include "disp_driver.h"
 #include "driver/gpio.h"
+#include "driver/usb_serial_jtag_vfs.h"
 #include "esp_log.h"
+#include "esp_pm.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "event_utilities.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_freertos_hooks.h"
 #include "gt911.h"
 #include "gui_task.h"
+#include "gui_alert.h"
+#include "gui_bench.h"
+#include "gui_charge.h"
+#include "gui_perf.h"
+#include "gui_utilities.h"
 #include "gui_screen_ble.h"
 #include "gui_screen_intro.h"
 #include "gui_screen_main.h"
 #include "gui_screen_wifi.h"
+#include "gui_touch_rec.h"
 #include "lvgl.h"
 #include "mem_fb.h"
 #include "ST7701S.h"
@@ -43,6 +57,8 @@
 #include "I2C_Driver.h"
 #include "TCA9554PWR.h"
 #include "ps_utilities.h"
+#include "tune_utilities.h"
+#include "vehicle_manager.h"
 
 
 
@@ -54,6 +70,53 @@
 // Period between new tile display and persistent memory update
 #define TILE_PS_UPDATE_MSEC (15 * 1000)
 
+// Backlight idle dimming
+//   Note: after GUI_BL_IDLE_MSEC without a touch while the vehicle isn't moving the
+//   backlight fades to GUI_BL_IDLE_PERCENT of its level and back on the next touch.  The
+//   fades are run by the LEDC hardware.
+#define GUI_BL_IDLE_MSEC    (5 * 60 * 1000)
+#define GUI_BL_IDLE_PERCENT 30
+#define GUI_BL_FADE_MSEC    1000
+
+// Display off while the vehicle is off
+//   Note: once the vehicle manager decides the vehicle is off (asleep) the backlight is
+//   turned off after GUI_BL_OFF_MSEC without a touch.  A touch turns it back on and has
+//   the vehicle manager probe the vehicle immediately.
+#define GUI_BL_OFF_MSEC     (30 * 1000)
+
+// Backlight states
+#define GUI_BL_ON           0
+#define GUI_BL_DIM          1
+#define GUI_BL_OFF          2
+
+// Comment out to keep updating the gauges while the tileview scrolls
+//   Note: gauge updates and animations are held from the start of a swipe until the
+//   tileview settles so the whole frame time goes to the scroll.  The data broker keeps
+//   the latest value of each item and delivers it on the first pass after the scroll ends.
+#define ENABLE_SCROLL_PRIORITY
+
+// Speed above which the vehicle is considered moving (km/h or mph)
+#define GUI_BL_MOVING_SPEED 2
+
+// Comment out to poll and display normally while the vehicle is charging
+//   Note: once gui_charge detects a charging session the vehicle manager polls only the
+//   charging items at a low rate (tiles showing other items stop updating), a charge curve
+//   is logged and the backlight dims after GUI_BL_CHG_IDLE_MSEC without a touch.
+#define ENABLE_CHARGE_MODE
+
+#define GUI_BL_CHG_IDLE_MSEC (30 * 1000)
+
+// Comment out to always refresh the display at CONFIG_LV_DISP_DEF_REFR_PERIOD
+//   Note: the refresh period drops to GUI_REFR_IDLE_MSEC once nothing has been invalidated,
+//   animated, scrolled or touched for GUI_REFR_IDLE_DELAY_MSEC (or the backlight is off)
+//   and returns to the default as soon as any of those happen again.  Data that changes
+//   while idle is displayed up to GUI_REFR_IDLE_MSEC later.
+#define ENABLE_REFR_GOVERNOR
+
+// Idle refresh period (8 Hz) and how long the screen must be static before it is used
+#define GUI_REFR_IDLE_MSEC       125
+#define GUI_REFR_IDLE_DELAY_MSEC 2000
+
 // Uncomment to enable screen dumps
 //   Note: this dumps the screen raw hex data to the USB debug log output when
 //   the button attached to IO0 is pressed.  The GUI is frozen while the dump is
@@ -61,6 +124,61 @@
 //   that will display the screen image for capture the attached computer.
 //#define ENABLE_SCREENDUMP
 
+// Comment out to dump the screen as hex log lines instead of binary
+//   Note: the binary dump writes a "FB: BEGIN <w> <h> <bpp> <len>" line followed by
+//   exactly <len> bytes of little-endian frame buffer data and a "FB: END" line.  Logging
+//   and line ending translation are off while the data streams.  It takes about a second
+//   instead of many minutes for the hex dump.
+#define SCREENDUMP_BINARY
+
+// Binary screen dump write size
+#define SCREENDUMP_CHUNK_LEN 4096
+
+// Uncomment to benchmark full-screen redraws
+//   Note: this logs the min/average/max time to render and flush the entire screen
+//   when the main screen is first displayed so the draw buffer configurations
+//   (PSRAM, direct mode, internal RAM partial buffers) can be compared.
+//#define ENABLE_RENDER_BENCH
+
+// Number of full-screen redraws timed by the benchmark
+#define RENDER_BENCH_FRAMES 20
+
+// Uncomment to log the time LVGL's blend routines and the display driver's take for
+// fills, masked fills and image copies at startup
+//#define ENABLE_BLEND_BENCH
+
+// Uncomment to display a frame rate/render time overlay and periodically log per-tile
+// frame time histograms
+//#define ENABLE_PERF_OVERLAY
+
+// Uncomment to run the GUI benchmark when the main screen is first displayed
+//   Note: this replaces vehicle data with synthetic values, steps through every tile and
+//   logs the frame rate, frame time percentiles and core loads for each, then resumes
+//   normal operation.  It times frames itself so it can't be used with the perf overlay.
+//#define ENABLE_GUI_BENCH
+
+#if defined(ENABLE_GUI_BENCH) && defined(ENABLE_PERF_OVERLAY)
+#error "ENABLE_GUI_BENCH and ENABLE_PERF_OVERLAY both wrap the display refresh timer"
+#endif
+
+// Uncomment to record touches for TOUCH_RECORD_MSEC after the main screen is first displayed
+//   Note: the recording is saved to GUI_TOUCH_REC_FILE where the GUI benchmark replays it
+//   in place of its generated swipes.
+//#define ENABLE_TOUCH_RECORD
+
+// Touch recording length
+#define TOUCH_RECORD_MSEC   (60 * 1000)
+
+#if defined(ENABLE_GUI_BENCH) && defined(ENABLE_TOUCH_RECORD)
+#error "ENABLE_GUI_BENCH replays the recording ENABLE_TOUCH_RECORD makes"
+#endif
+
+// Uncomment to periodically log LVGL heap usage, high-water marks and fragmentation
+//#define ENABLE_MEM_MONITOR
+
+// Interval between memory statistics logs
+#define MEM_MONITOR_MSEC    (60 * 1000)
+
 
 
 //
@@ -96,19 +214,42 @@ static main_config_t* configP;
 // Notifications
 static bool saw_end_of_intro = false;
 static bool saw_vehicle_init = false;
+static bool saw_first_data = false;
+
+// Rendering runs at the maximum CPU frequency
+static esp_pm_lock_handle_t gui_pm_lock = NULL;
+
+// Gauge updates held while the tileview scrolls
+static bool scroll_hold = false;
+
+// Backlight idle dimming
+static int bl_state = GUI_BL_ON;
+static uint8_t bl_on_level;
+static bool vehicle_asleep = false;
+
+// Refresh governor
+#ifdef ENABLE_REFR_GOVERNOR
+static bool refr_idle = false;
+static int64_t refr_active_usec = 0;
+#endif
 
 
 
 //
 // GUI Task internal function forward declarations
 //
-static void _gui_notification_handler();
+static void _gui_notification_handler(uint32_t notification_value);
+static void _gui_event_cb(uint32_t events);
 static void _gui_lvgl_init();
 static void _gui_init_screens();
 static void _lv_tick_callback();
 static void _gui_ps_update_timer_cb(lv_timer_t* timer);
+static void _gui_eval_backlight();
+static void _gui_eval_refr_period();
 static bool _gui_screendump_button_eval();
 static void _gui_do_screendump();
+static void _gui_render_bench();
+static void _gui_mem_monitor_timer_cb(lv_timer_t* timer);
 
 
 //
@@ -117,6 +258,11 @@ static void _gui_do_screendump();
 
 void gui_task()
 {
+	uint32_t notification_value;
+	uint32_t wait_msec;
+	uint32_t max_wait_msec;
+	TickType_t wait_ticks;
+	
 	ESP_LOGI(TAG, "Start task");
 	
 	// Get a pointer to the system configuration
@@ -127,6 +273,10 @@ void gui_task()
 	
 	// Initialize LVGL
 	_gui_lvgl_init();
+	boot_prof_mark("lvgl_init");
+	
+	// Let can_task start the interfaces now that our draw buffers are allocated
+	can_task_gui_ready();
 	
 	// Set the initial screen brightness
 	if (configP->bl_percent < 10) {
@@ -139,20 +289,61 @@ void gui_task()
 	
 	// Initialize the main display objects
 	_gui_init_screens();
+	gui_alert_init();
 	
 	// Set the initial display
 	gui_set_screen_page(GUI_SCREEN_INTRO);
+	boot_prof_mark("gui_screens");
+	
+	// Have the data broker wake us when new data arrives
+	db_set_gui_notify(xTaskGetCurrentTaskHandle(), GUI_NOTIFY_DB_UPDATE);
+	
+	// Interface and vehicle state changes are handled here (events published before
+	// this are delivered on the first pass)
+	(void) event_subscribe(EVENT_VEHICLE_IDENTIFIED | EVENT_ECU_ASLEEP | EVENT_ECU_AWAKE, _gui_event_cb);
+	event_set_notify(xTaskGetCurrentTaskHandle(), GUI_NOTIFY_EVENT);
+	
+	if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "gui_task", &gui_pm_lock) != ESP_OK) {
+		gui_pm_lock = NULL;
+	}
+	
+	deadline_init(DEADLINE_LOOP_GUI, GUI_TASK_BUDGET_USEC);
 	
 	// GUI Task
 	while (1) {
+		if (gui_pm_lock != NULL) {
+			(void) esp_pm_lock_acquire(gui_pm_lock);
+		}
+		
+		deadline_begin(DEADLINE_LOOP_GUI, DEADLINE_PHASE_RENDER);
 		lv_task_handler();
-		lv_timer_handler();
+		wait_msec = lv_timer_handler();
+#ifdef DB_LATENCY_TRACE
+		db_lat_note_frame();
+#endif
 		
 		// Evaluate data broker to get updated values
+		deadline_phase(DEADLINE_LOOP_GUI, DEADLINE_PHASE_BROKER);
+#ifdef ENABLE_SCROLL_PRIORITY
+		if (gui_screen_main_is_scrolling() != scroll_hold) {
+			scroll_hold = !scroll_hold;
+			gui_utility_hold_gauge_anims(scroll_hold);
+		}
+		if (!scroll_hold) {
+			db_gui_eval();
+		}
+#else
 		db_gui_eval();
+#endif
 		
-		// Handle incoming notifications
-		_gui_notification_handler();
+		deadline_phase(DEADLINE_LOOP_GUI, DEADLINE_PHASE_OTHER);
+#ifdef ENABLE_CHARGE_MODE
+		gui_charge_eval();
+#endif
+		_gui_eval_backlight();
+#ifdef ENABLE_REFR_GOVERNOR
+		_gui_eval_refr_period();
+#endif
 		
 #ifdef ENABLE_SCREENDUMP
 		if (_gui_screendump_button_eval()) {
@@ -160,7 +351,23 @@ void gui_task()
 		}
 #endif
 		
-		vTaskDelay(pdMS_TO_TICKS(GUI_TASK_EVAL_MSEC));
+		deadline_end(DEADLINE_LOOP_GUI);
+		if (gui_pm_lock != NULL) {
+			(void) esp_pm_lock_release(gui_pm_lock);
+		}
+		
+		// Sleep until new data, a notification or the next LVGL timer is due
+		max_wait_msec = (bl_state == GUI_BL_OFF) ? GUI_TASK_OFF_WAIT_MSEC : tune_get(TUNE_GUI_MAX_WAIT_MSEC);
+		if (wait_msec > max_wait_msec) {
+			wait_msec = max_wait_msec;
+		}
+		wait_ticks = pdMS_TO_TICKS(wait_msec);
+		if (wait_ticks == 0) {
+			wait_ticks = 1;
+		}
+		if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, wait_ticks)) {
+			_gui_notification_handler(notification_value);
+		}
 	}
 }
 
@@ -190,6 +397,9 @@ void gui_get_screen_size(uint16_t* w, uint16_t* h)
 int32_t gui_get_init_tile_index()
 {
 	cur_tile_index = configP->start_tile_index;
+#ifdef ENABLE_PERF_OVERLAY
+	gui_perf_set_tile(cur_tile_index);
+#endif
 	return cur_tile_index;
 }
 
@@ -198,6 +408,9 @@ void gui_set_init_tile_index(int32_t n)
 {
 	ESP_LOGI(TAG, "Set tile index = %d", n);
 	cur_tile_index = n;
+#ifdef ENABLE_PERF_OVERLAY
+	gui_perf_set_tile(n);
+#endif
 	
 	// Start the changed tile timer.  We update persistent storage after it expires.
 	// This allows us to not excessively write persistent storage if the user is flipping
@@ -221,7 +434,14 @@ bool gui_is_metric()
 
 bool gui_has_fast_interface()
 {
-	return (configP->connection_index == CAN_MANAGER_IF_TWAI);
+	int rate = can_get_link_rate();
+	
+	// Use the measured rate when the interface was picked automatically
+	if (rate > 0) {
+		return (rate >= GUI_FAST_LINK_RATE);
+	}
+	
+	return (can_get_active_interface() == CAN_MANAGER_IF_TWAI);
 }
 
 
@@ -229,26 +449,85 @@ bool gui_has_fast_interface()
 //
 // GUI Task Internal functions
 //
-static void _gui_notification_handler()
+// Handle notifications received (and cleared) while the task waited.  GUI_NOTIFY_DB_UPDATE
+// only needs the wakeup; the data broker is evaluated every pass.
+static void _gui_notification_handler(uint32_t notification_value)
 {
-	uint32_t notification_value;
+#if defined(ENABLE_RENDER_BENCH) || defined(ENABLE_GUI_BENCH)
+	bool prev_ready = saw_vehicle_init && saw_end_of_intro;
+#endif
 	
-	// Look for incoming notifications (clear them upon reading)
-	if (xTaskNotifyWait(0x00, 0xFFFFFFFF, &notification_value, 0)) {
-		if (Notification(notification_value, GUI_NOTIFY_VEHICLE_INIT)) {
-			saw_vehicle_init = true;
-			if (saw_end_of_intro) {
-				gui_set_screen_page(GUI_SCREEN_MAIN);
-			}
+	if (Notification(notification_value, GUI_NOTIFY_EVENT)) {
+		event_dispatch();
+	}
+	
+	if (Notification(notification_value, GUI_NOTIFY_INTRO_DONE)) {
+		saw_end_of_intro = true;
+		if (saw_vehicle_init) {
+			gui_set_screen_page(GUI_SCREEN_MAIN);
+			boot_prof_mark("main_screen");
 		}
+	}
+	
+	if (Notification(notification_value, GUI_NOTIFY_ALERT)) {
+		gui_alert_update();
+	}
+	
+	// Time to the first vehicle (not on-board sensor) data shown on the main screen
+	if (!saw_first_data && saw_vehicle_init && saw_end_of_intro && Notification(notification_value, GUI_NOTIFY_DB_UPDATE)) {
+		db_mask_t mask = vm_get_supported_item_mask() & ~db_get_local_items();
 		
-		if (Notification(notification_value, GUI_NOTIFY_INTRO_DONE)) {
-			saw_end_of_intro = true;
-			if (saw_vehicle_init) {
-				gui_set_screen_page(GUI_SCREEN_MAIN);
+		for (int i=1; i<DB_NUM_ITEMS; i++) {
+			if (((mask & DB_MASK(i)) != 0) && (db_get_item_update_count(i) != 0)) {
+				saw_first_data = true;
+				boot_prof_mark("first_data");
+				boot_prof_log();
+				break;
 			}
 		}
 	}
+	
+#ifdef ENABLE_RENDER_BENCH
+	if (!prev_ready && saw_vehicle_init && saw_end_of_intro) {
+		_gui_render_bench();
+	}
+#endif
+#ifdef ENABLE_GUI_BENCH
+	if (!prev_ready && saw_vehicle_init && saw_end_of_intro) {
+		gui_bench_start(lv_disp_get_default());
+	}
+#endif
+#ifdef ENABLE_TOUCH_RECORD
+	if (!prev_ready && saw_vehicle_init && saw_end_of_intro) {
+		(void) gui_touch_rec_start(TOUCH_RECORD_MSEC);
+	}
+#endif
+}
+
+
+// Vehicle state changes published by the CAN task
+static void _gui_event_cb(uint32_t events)
+{
+	if ((events & EVENT_VEHICLE_IDENTIFIED) != 0) {
+		saw_vehicle_init = true;
+#ifdef ENABLE_CHARGE_MODE
+		gui_charge_init();
+#endif
+		if (saw_end_of_intro) {
+			gui_set_screen_page(GUI_SCREEN_MAIN);
+			boot_prof_mark("main_screen");
+		}
+	}
+	
+	// Both may be pending if the vehicle changed state twice between dispatches so the
+	// current state is read back
+	if ((events & (EVENT_ECU_ASLEEP | EVENT_ECU_AWAKE)) != 0) {
+		vehicle_asleep = vm_is_asleep();
+		if (!vehicle_asleep) {
+			// Turn the display back on right away
+			lv_disp_trig_activity(NULL);
+		}
+	}
 }
 
 
@@ -262,20 +541,24 @@ static void _gui_lvgl_init()
 	touch_driver_init();
 	
 	// Get the display buffers
-#if CONFIG_USE_PSRAM_BUFFER
+#if CONFIG_USE_DIRECT_MODE
+    ESP_LOGI(TAG, "Render directly into the panel frame buffers");
+    LCD_Get_Frame_Buffers(&lvgl_disp_buf1, &lvgl_disp_buf2);
+    lv_disp_draw_buf_init(&lvgl_draw_buf, lvgl_disp_buf1, lvgl_disp_buf2, LCD_H_RES * LCD_V_RES);
+#elif CONFIG_USE_PSRAM_BUFFER
     ESP_LOGI(TAG, "Allocate full LVGL draw buffers from PSRAM");
-    lvgl_disp_buf1 = heap_caps_malloc(LCD_H_RES * LCD_V_RES, MALLOC_CAP_SPIRAM);
+    lvgl_disp_buf1 = heap_caps_malloc(LCD_H_RES * LCD_V_RES * sizeof(lv_color_t), MALLOC_CAP_SPIRAM);
     assert(lvgl_disp_buf1);
-    lvgl_disp_buf2 = heap_caps_malloc(LCD_H_RES * LCD_V_RES, MALLOC_CAP_SPIRAM);
+    lvgl_disp_buf2 = heap_caps_malloc(LCD_H_RES * LCD_V_RES * sizeof(lv_color_t), MALLOC_CAP_SPIRAM);
     assert(lvgl_disp_buf2);
     lv_disp_draw_buf_init(&lvgl_draw_buf, lvgl_disp_buf1, lvgl_disp_buf2, LCD_H_RES * LCD_V_RES);
 #else
     ESP_LOGI(TAG, "Allocate partial LVGL draw buffers from DRAM");
-    lvgl_disp_buf1 = heap_caps_aligned_alloc(32, LCD_H_RES * LCD_V_RES * 2 / 10, MALLOC_CAP_DMA);
+    lvgl_disp_buf1 = heap_caps_aligned_alloc(32, LCD_H_RES * LCD_PARTIAL_BUF_LINES * sizeof(lv_color_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
     assert(lvgl_disp_buf1);
-    lvgl_disp_buf2 = heap_caps_aligned_alloc(32, LCD_H_RES * LCD_V_RES * 2 / 10, MALLOC_CAP_DMA);
+    lvgl_disp_buf2 = heap_caps_aligned_alloc(32, LCD_H_RES * LCD_PARTIAL_BUF_LINES * sizeof(lv_color_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
     assert(lvgl_disp_buf2);
-    lv_disp_draw_buf_init(&lvgl_draw_buf, lvgl_disp_buf1, lvgl_disp_buf2, LCD_H_RES * LCD_V_RES / 10);
+    lv_disp_draw_buf_init(&lvgl_draw_buf, lvgl_disp_buf1, lvgl_disp_buf2, LCD_H_RES * LCD_PARTIAL_BUF_LINES);
 #endif
 	
 	// Install the display driver
@@ -285,13 +568,33 @@ static void _gui_lvgl_init()
     lvgl_disp_drv.flush_cb = disp_driver_flush;
     lvgl_disp_drv.draw_buf = &lvgl_draw_buf;
     lvgl_disp_drv.user_data = panel_handle;
+#if CONFIG_USE_DIRECT_MODE
+    lvgl_disp_drv.direct_mode = 1;
+#endif
+#if CONFIG_USE_DMA_FLUSH
+    lvgl_disp_drv.rounder_cb = lvgl_rounder_cb;
+#endif
+    disp_blend_init(&lvgl_disp_drv);
     lv_disp_t *disp = lv_disp_drv_register(&lvgl_disp_drv);
+#ifdef ENABLE_BLEND_BENCH
+    disp_blend_bench();
+#endif
+#ifdef ENABLE_PERF_OVERLAY
+    gui_perf_init(disp);
+#endif
+#ifdef ENABLE_MEM_MONITOR
+    lv_timer_create(_gui_mem_monitor_timer_cb, MEM_MONITOR_MSEC, NULL);
+#endif
     
     // Install the touchscreen driver
     lv_indev_drv_init (&lvgl_indev_drv);
     lvgl_indev_drv.type = LV_INDEV_TYPE_POINTER;
     lvgl_indev_drv.disp = disp;
+#if defined(ENABLE_GUI_BENCH) || defined(ENABLE_TOUCH_RECORD)
+    lvgl_indev_drv.read_cb = gui_touch_rec_read_cb;
+#else
     lvgl_indev_drv.read_cb = touch_driver_read;
+#endif
     lv_indev_drv_register(&lvgl_indev_drv);
 
     // Hook LVGL's timebase to the CPU system tick so it can keep track of time
@@ -328,6 +631,144 @@ static void _gui_ps_update_timer_cb(lv_timer_t* timer)
 }
 
 
+// Dim the backlight while nobody is using the display in a parked vehicle and turn it off
+// while the vehicle is off
+static void _gui_eval_backlight()
+{
+	float speed;
+	int64_t age_usec;
+	int level;
+	int state;
+	uint32_t inactive_msec;
+	
+	inactive_msec = lv_disp_get_inactive_time(NULL);
+	if (vehicle_asleep && (inactive_msec > GUI_BL_OFF_MSEC)) {
+		state = GUI_BL_OFF;
+#ifdef ENABLE_CHARGE_MODE
+	} else if ((inactive_msec > GUI_BL_IDLE_MSEC) || (gui_charge_active() && (inactive_msec > GUI_BL_CHG_IDLE_MSEC))) {
+#else
+	} else if (inactive_msec > GUI_BL_IDLE_MSEC) {
+#endif
+		state = GUI_BL_DIM;
+		if (db_get_data_item(DB_ITEM_SPEED, &speed, NULL)) {
+			// A speed that stopped updating (vehicle off) doesn't keep the display bright
+			age_usec = db_get_data_item_age(DB_ITEM_SPEED);
+			if ((age_usec >= 0) && (age_usec < (5 * 1000 * 1000)) && (speed > GUI_BL_MOVING_SPEED)) {
+				state = GUI_BL_ON;
+			}
+		}
+	} else {
+		state = GUI_BL_ON;
+	}
+	
+	if (state == bl_state) return;
+	
+	if (bl_state == GUI_BL_ON) {
+		bl_on_level = disp_driver_get_bl();
+	}
+	switch (state) {
+		case GUI_BL_ON:
+			disp_driver_fade_bl(bl_on_level, GUI_BL_FADE_MSEC / 4);
+			if (bl_state == GUI_BL_OFF) {
+				vm_wake_probe();
+			}
+			break;
+		case GUI_BL_DIM:
+			level = ((int) bl_on_level * GUI_BL_IDLE_PERCENT) / 100;
+			if (level < 1) level = 1;
+			disp_driver_fade_bl((uint8_t) level, GUI_BL_FADE_MSEC);
+			break;
+		case GUI_BL_OFF:
+			disp_driver_fade_bl(0, GUI_BL_FADE_MSEC);
+			break;
+	}
+	bl_state = state;
+}
+
+
+#ifdef ENABLE_REFR_GOVERNOR
+// Slow the display refresh timer once the screen has been static for a while and restore
+// it on the first invalidation, animation, scroll or touch.  Called after the data broker
+// has been evaluated so invalidations from new data are still pending.
+static void _gui_eval_refr_period()
+{
+	lv_disp_t* disp = lv_disp_get_default();
+	int64_t cur_usec = esp_timer_get_time();
+	bool active;
+	
+	if (disp == NULL) return;
+	
+	active = (disp->inv_p != 0) ||
+	         (lv_anim_count_running() > 0) ||
+	         gui_screen_main_is_scrolling() ||
+	         (lv_disp_get_inactive_time(disp) < GUI_REFR_IDLE_DELAY_MSEC);
+	if (bl_state == GUI_BL_OFF) {
+		active = false;
+	}
+#ifdef ENABLE_GUI_BENCH
+	if (gui_bench_running()) {
+		active = true;
+	}
+#endif
+	
+	if (active) {
+		refr_active_usec = cur_usec;
+		if (refr_idle) {
+			// Runs immediately if the default period has already elapsed since the last refresh
+			lv_timer_set_period(disp->refr_timer, CONFIG_LV_DISP_DEF_REFR_PERIOD);
+			refr_idle = false;
+		}
+	} else if (!refr_idle && ((cur_usec - refr_active_usec) > (GUI_REFR_IDLE_DELAY_MSEC * 1000))) {
+		lv_timer_set_period(disp->refr_timer, GUI_REFR_IDLE_MSEC);
+		refr_idle = true;
+	}
+}
+#endif
+
+
+#ifdef ENABLE_MEM_MONITOR
+static void _gui_mem_monitor_timer_cb(lv_timer_t* timer)
+{
+	gui_dump_mem_info();
+}
+#endif
+
+
+#ifdef ENABLE_RENDER_BENCH
+// This blocks gui_task for RENDER_BENCH_FRAMES full-screen redraws of the current screen
+static void _gui_render_bench()
+{
+	int64_t t, t_min = INT64_MAX, t_max = 0, t_tot = 0;
+	lv_disp_t* disp = lv_disp_get_default();
+	
+	for (int i=0; i<RENDER_BENCH_FRAMES; i++) {
+		lv_obj_invalidate(lv_scr_act());
+		t = esp_timer_get_time();
+		lv_refr_now(disp);
+		
+		// Include the copy of the last stripe if it is still in flight
+		while (lv_disp_get_draw_buf(disp)->flushing) {}
+		t = esp_timer_get_time() - t;
+		
+		t_tot += t;
+		if (t < t_min) t_min = t;
+		if (t > t_max) t_max = t;
+	}
+	
+#if CONFIG_USE_DIRECT_MODE
+	ESP_LOGI(TAG, "Render bench (direct mode):");
+#elif CONFIG_USE_PSRAM_BUFFER
+	ESP_LOGI(TAG, "Render bench (PSRAM full buffers):");
+#else
+	ESP_LOGI(TAG, "Render bench (internal RAM %d line buffers):", LCD_PARTIAL_BUF_LINES);
+#endif
+	ESP_LOGI(TAG, "  min %d.%03d  avg %d.%03d  max %d.%03d mSec", (int) (t_min / 1000), (int) (t_min % 1000),
+		(int) (t_tot / RENDER_BENCH_FRAMES / 1000), (int) ((t_tot / RENDER_BENCH_FRAMES) % 1000),
+		(int) (t_max / 1000), (int) (t_max % 1000));
+}
+#endif
+
+
 #ifdef ENABLE_SCREENDUMP
 static bool _gui_screendump_button_eval()
 {
@@ -356,13 +797,22 @@ static bool _gui_screendump_button_eval()
 // This task blocks gui_task
 static void _gui_do_screendump()
 {
+#ifdef SCREENDUMP_BINARY
+	int i, n;
+	int len = MEM_FB_W * MEM_FB_H * (MEM_FB_BPP / 8);
+	uint8_t* fb;
+#else
 	char line_buf[161];   // Large enough for 32 16-bit hex values with a space between them
 	int i, j, n;
 	int len = MEM_FB_W * MEM_FB_H;
 	uint16_t* fb;
+#endif
 	
 	// Configure the display driver to render to the screendump frame buffer
-	disp_driver_en_dump(true);
+	if (!disp_driver_en_dump(true)) {
+		ESP_LOGE(TAG, "No screendump frame buffer");
+		return;
+	}
 	
 	// Force LVGL to redraw the entire screen (to the screendump frame buffer)
 	lv_obj_invalidate(lv_scr_act());
@@ -371,6 +821,22 @@ static void _gui_do_screendump()
 	// Reconfigure the driver back to the LCD
 	disp_driver_en_dump(false);
 	
+#ifdef SCREENDUMP_BINARY
+	// Stream the fb with nothing else written to the console while it goes out
+	fb = mem_fb_get_buffer();
+	printf("%s: FB: BEGIN %d %d %d %d\n", TAG, MEM_FB_W, MEM_FB_H, MEM_FB_BPP, len);
+	fflush(stdout);
+	esp_log_level_set("*", ESP_LOG_NONE);
+	usb_serial_jtag_vfs_set_tx_line_endings(ESP_LINE_ENDINGS_LF);
+	for (i=0; i<len; i+=n) {
+		n = ((len - i) < SCREENDUMP_CHUNK_LEN) ? (len - i) : SCREENDUMP_CHUNK_LEN;
+		(void) fwrite(fb + i, 1, n, stdout);
+	}
+	fflush(stdout);
+	usb_serial_jtag_vfs_set_tx_line_endings(ESP_LINE_ENDINGS_CRLF);
+	esp_log_level_set("*", CONFIG_LOG_DEFAULT_LEVEL);
+	printf("\n%s: FB: END\n", TAG);
+#else
 	// Dump the fb
 	fb = (uint16_t*) mem_fb_get_buffer();
 	i = 0;
@@ -384,5 +850,6 @@ static void _gui_do_screendump()
 		printf("%s: FB: %s\n", TAG, line_buf);
 		vTaskDelay(pdMS_TO_TICKS(20));
 	}
+#endif
 }
 #endif
\ No newline at end of file
@@ -38,6 +38,18 @@
 #define GUI_LVGL_TICK_MSEC         1
 #define GUI_TASK_EVAL_MSEC         10
 
+// Longest the GUI task sleeps waiting for data or an LVGL timer is TUNE_GUI_MAX_WAIT_MSEC
+
+// Longest the GUI task sleeps while the display is off (still reads the touchscreen)
+#define GUI_TASK_OFF_WAIT_MSEC     100
+
+// Frames taking longer than the display refresh period are counted as deadline overruns
+#define GUI_TASK_BUDGET_USEC       (CONFIG_LV_DISP_DEF_REFR_PERIOD * 1000)
+
+// Automatically selected interfaces measured at this many requests/sec or more are treated
+// as fast enough for the faster updating displays
+#define GUI_FAST_LINK_RATE         50
+
 // Screen page indicies
 #define GUI_SCREEN_INTRO           0
 #define GUI_SCREEN_MAIN            1
@@ -49,8 +61,10 @@
 
 // Notifications
 //
-#define GUI_NOTIFY_VEHICLE_INIT    0x00000001
 #define GUI_NOTIFY_INTRO_DONE      0x00000010
+#define GUI_NOTIFY_DB_UPDATE       0x00000100
+#define GUI_NOTIFY_EVENT           0x00001000
+#define GUI_NOTIFY_ALERT           0x00004000
 
 
 //
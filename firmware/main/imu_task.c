@@ -0,0 +1,288 @@
+/*
+ * IMU Task
+ *
+ * Acquire acceleration from the on-board QMI8658 through its FIFO and publish
+ * longitudinal and lateral g to the data broker.  The accelerometer runs alone at
+ * IMU_ODR_HZ in stream mode and the FIFO is drained in one burst each time it reaches
+ * its watermark.  Samples are filtered in fixed-point (Q8 raw counts), decimated and
+ * published with the time each was acquired.
+ *
+ * While the vehicle manager considers the vehicle off the same samples are watched for
+ * motion (a door opening, someone getting in) so a sleeping vehicle is probed right
+ * away instead of at the next periodic probe.  The interface reconnects on its own so
+ * the probe that follows finds the vehicle as soon as it answers.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "data_broker.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "imu_task.h"
+#include "QMI8658.h"
+#include "vehicle_manager.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// IMU Task constants
+//
+
+// Accelerometer counts per g at ACC_RANGE_4G
+#define IMU_COUNTS_PER_G        8192
+
+// Bytes per FIFO sample (accelerometer X, Y, Z)
+#define IMU_SAMPLE_BYTES        6
+
+// Drain buffer holds the whole FIFO
+#define IMU_FIFO_SAMPLES        64
+#define IMU_FIFO_BUF_LEN        (IMU_FIFO_SAMPLES * IMU_SAMPLE_BYTES)
+
+// Sample period
+#define IMU_SAMPLE_USEC         (1000000 / IMU_ODR_HZ)
+
+// Polling period for the watermark
+#define IMU_POLL_MSEC           ((1000 * IMU_FIFO_WTM_SAMPLES) / IMU_ODR_HZ)
+
+// Fixed-point fraction bits for the filter state
+#define IMU_Q                   8
+
+// Wake-on-motion threshold (raw counts << IMU_Q)
+#define IMU_WAKE_THRESH_Q       ((IMU_WAKE_THRESH_MG * IMU_COUNTS_PER_G / 1000) << IMU_Q)
+
+
+//
+// IMU Task variables
+//
+static const char* TAG = "imu_task";
+
+// Task handle
+TaskHandle_t task_handle_imu;
+
+static uint8_t fifo_buf[IMU_FIFO_BUF_LEN];
+
+// Filter state per device axis (raw counts << IMU_Q)
+static int32_t filt_q[3];
+static bool filt_init = false;
+
+// Mounting offset per device axis (raw counts << IMU_Q)
+static int32_t offset_q[3];
+static int64_t cal_sum[3];
+static int cal_count = 0;
+static bool cal_done = false;
+
+// Decimation
+static int32_t dec_sum[3];
+static int dec_count = 0;
+
+static uint32_t overflow_count = 0;
+
+// Wake-on-motion - rest value per device axis (raw counts << IMU_Q)
+static int32_t rest_q[3];
+static bool rest_init = false;
+static int motion_count = 0;
+static int64_t wake_usec = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static bool _imu_init_device();
+static void _imu_drain();
+static void _imu_process_sample(const uint8_t* sP, int64_t ts_usec);
+static void _imu_eval_motion(int64_t ts_usec);
+static void _imu_publish(const int32_t* val_q, int64_t ts_usec);
+
+
+
+//
+// API
+//
+void imu_task()
+{
+	ESP_LOGI(TAG, "Start task");
+	
+	if (!_imu_init_device()) {
+		ESP_LOGE(TAG, "QMI8658 not found");
+		vTaskDelete(NULL);
+	}
+	
+	while (1) {
+		vTaskDelay(pdMS_TO_TICKS(IMU_POLL_MSEC));
+		_imu_drain();
+	}
+}
+
+
+
+//
+// Internal functions
+//
+static bool _imu_init_device()
+{
+	if (!QMI8658_Present()) {
+		return false;
+	}
+	
+	QMI8658_Init();
+	
+	// Accelerometer only so it runs at its own ODR, FIFO in stream mode
+	QMI8658_EnableSensors(QMI8658_CTRL7_ACC_EN);
+	setAccScale(ACC_RANGE_4G);
+	setAccODR(acc_odr_norm_120);
+	setAccLPF(LPF_MODE_0);
+	QMI8658_ConfigFifo(QMI8658_FIFO_SIZE_64, IMU_FIFO_WTM_SAMPLES);
+	
+	return true;
+}
+
+
+static void _imu_drain()
+{
+	int len;
+	int n;
+	int64_t t_now;
+	uint8_t status;
+	
+	len = QMI8658_GetFifoBytes(&status);
+	if (len < (IMU_FIFO_WTM_SAMPLES * IMU_SAMPLE_BYTES)) {
+		// Not yet at the watermark (or a bus error)
+		return;
+	}
+	t_now = esp_timer_get_time();
+	
+	if ((status & QMI8658_FIFO_STATUS_OVFLOW) != 0) {
+		if ((overflow_count++ % 100) == 0) {
+			ESP_LOGW(TAG, "FIFO overflow (%lu)", overflow_count);
+		}
+	}
+	
+	// Whole samples only
+	if (len > IMU_FIFO_BUF_LEN) len = IMU_FIFO_BUF_LEN;
+	len -= len % IMU_SAMPLE_BYTES;
+	if (QMI8658_ReadFifo(fifo_buf, len) != len) {
+		return;
+	}
+	
+	// The newest sample was acquired just before we looked
+	n = len / IMU_SAMPLE_BYTES;
+	for (int i=0; i<n; i++) {
+		_imu_process_sample(&fifo_buf[i * IMU_SAMPLE_BYTES], t_now - (int64_t) (n - 1 - i) * IMU_SAMPLE_USEC);
+	}
+}
+
+
+static void _imu_process_sample(const uint8_t* sP, int64_t ts_usec)
+{
+	int32_t x_q;
+	
+	for (int a=0; a<3; a++) {
+		x_q = (int32_t) ((int16_t) ((sP[2*a+1] << 8) | sP[2*a])) << IMU_Q;
+		if (!filt_init) {
+			filt_q[a] = x_q;
+		} else {
+			filt_q[a] += (x_q - filt_q[a]) >> IMU_FILTER_SHIFT;
+		}
+	}
+	filt_init = true;
+	
+	_imu_eval_motion(ts_usec);
+	
+	// Measure the mounting offset (gravity plus tilt) while the vehicle is at rest
+	if (!cal_done) {
+		for (int a=0; a<3; a++) {
+			cal_sum[a] += filt_q[a];
+		}
+		if (++cal_count >= ((IMU_CAL_MSEC * IMU_ODR_HZ) / 1000)) {
+			for (int a=0; a<3; a++) {
+				offset_q[a] = (int32_t) (cal_sum[a] / cal_count);
+			}
+			cal_done = true;
+			db_set_local_items(DB_MASK(DB_ITEM_LONG_ACCEL) | DB_MASK(DB_ITEM_LAT_ACCEL));
+			ESP_LOGI(TAG, "Offset %ld %ld %ld", offset_q[0] >> IMU_Q, offset_q[1] >> IMU_Q, offset_q[2] >> IMU_Q);
+		}
+		return;
+	}
+	
+	for (int a=0; a<3; a++) {
+		dec_sum[a] += filt_q[a] - offset_q[a];
+	}
+	if (++dec_count == IMU_DECIMATION) {
+		for (int a=0; a<3; a++) {
+			dec_sum[a] /= IMU_DECIMATION;
+		}
+		_imu_publish(dec_sum, ts_usec);
+		memset(dec_sum, 0, sizeof(dec_sum));
+		dec_count = 0;
+	}
+}
+
+
+// Ask the vehicle manager to probe a sleeping vehicle when the filtered acceleration
+// moves away from its rest value
+static void _imu_eval_motion(int64_t ts_usec)
+{
+	bool moved = false;
+	
+	if (!vm_is_asleep()) {
+		// Track from the current value once the vehicle sleeps again
+		rest_init = false;
+		return;
+	}
+	
+	if (!rest_init) {
+		memcpy(rest_q, filt_q, sizeof(rest_q));
+		rest_init = true;
+		motion_count = 0;
+		return;
+	}
+	
+	for (int a=0; a<3; a++) {
+		if (abs(filt_q[a] - rest_q[a]) > IMU_WAKE_THRESH_Q) {
+			moved = true;
+		}
+		// Follow slow changes (temperature drift, the vehicle settling) but not motion
+		rest_q[a] += (filt_q[a] - rest_q[a]) >> IMU_WAKE_REST_SHIFT;
+	}
+	
+	if (!moved) {
+		motion_count = 0;
+		return;
+	}
+	
+	if ((++motion_count >= IMU_WAKE_SAMPLES) && ((ts_usec - wake_usec) >= (IMU_WAKE_HOLDOFF_MSEC * 1000))) {
+		ESP_LOGI(TAG, "Motion while asleep - probing vehicle");
+		vm_wake_probe();
+		wake_usec = ts_usec;
+	}
+}
+
+
+static void _imu_publish(const int32_t* val_q, int64_t ts_usec)
+{
+	float long_g, lat_g;
+	
+	long_g = (float) (IMU_LONG_SIGN * val_q[IMU_LONG_AXIS]) / (IMU_COUNTS_PER_G << IMU_Q);
+	lat_g  = (float) (IMU_LAT_SIGN * val_q[IMU_LAT_AXIS]) / (IMU_COUNTS_PER_G << IMU_Q);
+	
+	db_set_data_item_value_ts(DB_ITEM_LONG_ACCEL, long_g, ts_usec);
+	db_set_data_item_value_ts(DB_ITEM_LAT_ACCEL, lat_g, ts_usec);
+}
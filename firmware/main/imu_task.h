@@ -0,0 +1,82 @@
+/*
+ * IMU Task
+ *
+ * Acquire acceleration from the on-board QMI8658 through its FIFO and publish
+ * longitudinal and lateral g to the data broker
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef IMU_TASK_H
+#define IMU_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+
+
+//
+// IMU Task Constants
+//
+
+// Accelerometer output data rate (must match the ODR selected in imu_task.c)
+#define IMU_ODR_HZ              125
+
+// Samples accumulated in the FIFO before it is drained (drain period = WTM / ODR)
+#define IMU_FIFO_WTM_SAMPLES    8
+
+// Samples averaged into each published value (published rate = ODR / DECIMATION)
+#define IMU_DECIMATION          2
+
+// Single-pole low-pass filter: y += (x - y) >> IMU_FILTER_SHIFT
+#define IMU_FILTER_SHIFT        2
+
+// Time at startup used to measure the mounting offset (vehicle assumed at rest)
+#define IMU_CAL_MSEC            1000
+
+// Mounting - device axis (0=X, 1=Y, 2=Z) and sign for each vehicle direction
+#define IMU_LONG_AXIS           0
+#define IMU_LONG_SIGN           1
+#define IMU_LAT_AXIS            1
+#define IMU_LAT_SIGN            1
+
+// Wake-on-motion while the vehicle is asleep: acceleration more than IMU_WAKE_THRESH_MG
+// away from its rest value on any axis for IMU_WAKE_SAMPLES samples in a row asks for an
+// immediate probe, at most once per IMU_WAKE_HOLDOFF_MSEC while the motion continues
+#define IMU_WAKE_THRESH_MG      40
+#define IMU_WAKE_SAMPLES        3
+#define IMU_WAKE_HOLDOFF_MSEC   5000
+
+// Rest value tracking: rest += (filtered - rest) >> IMU_WAKE_REST_SHIFT (~2 sec time constant)
+#define IMU_WAKE_REST_SHIFT     8
+
+
+
+//
+// IMU Task externally accessible variables
+//
+extern TaskHandle_t task_handle_imu;
+
+
+
+//
+// API
+//
+void imu_task();
+
+#endif /* IMU_TASK_H */
\ No newline at end of file
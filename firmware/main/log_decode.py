@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+#
+# Decode a trip log (T####.BIN) written by log_task into CSV.
+#
+# Usage: log_decode.py <trip.bin> [<output.csv>]
+#
+# Each output line is "ts_msec,item,value" where item is the data broker item
+# number (see data_broker.h) and ts_msec is esp_timer time since boot.  The
+# compressed (versions 2 and 3) and original (version 1) formats are handled
+# so this may also be used by a depot server to unpack uploaded trips.  Only
+# the Python standard library is used.
+#
+# Copyright 2025 Dan Julio
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# It is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software.  If not, see <https://www.gnu.org/licenses/>.
+#
+import struct
+import sys
+
+FILE_MAGIC = 0x314C5645
+BLOCK_MAGIC = 0xB10C
+
+# LZ stream format (lz_utilities.h)
+LZ_DIST_MASK = 0x03FF
+LZ_LEN_SHIFT = 10
+LZ_MIN_MATCH = 3
+
+
+def lz_decode(data):
+    """Expand an lz_utilities stream"""
+    out = bytearray()
+    ip = 0
+    while ip < len(data):
+        flags = data[ip]
+        ip += 1
+        for n in range(8):
+            if ip >= len(data):
+                break
+            if flags & (1 << n):
+                if ip + 2 > len(data):
+                    raise ValueError('truncated match')
+                w = data[ip] | (data[ip + 1] << 8)
+                ip += 2
+                dist = (w & LZ_DIST_MASK) + 1
+                length = (w >> LZ_LEN_SHIFT) + LZ_MIN_MATCH
+                if dist > len(out):
+                    raise ValueError('match before start of block')
+                for _ in range(length):
+                    out.append(out[-dist])
+            else:
+                out.append(data[ip])
+                ip += 1
+    return bytes(out)
+
+
+def get_varint(data, pos):
+    """Return (value, new position) for an unsigned varint at pos"""
+    v = 0
+    shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        v |= (b & 0x7F) << shift
+        if b < 0x80:
+            return v, pos
+        shift += 7
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def decode_records(records, ts_msec, quantum, samples):
+    """Append (ts_msec, item, value) for each record in one block"""
+    last_q = [0] * len(quantum)
+    pos = 0
+    while pos < len(records):
+        item = records[pos]
+        dt, pos = get_varint(records, pos + 1)
+        dq, pos = get_varint(records, pos)
+        if item >= len(quantum):
+            raise ValueError('bad item %d' % item)
+        ts_msec = (ts_msec + unzigzag(dt)) & 0xFFFFFFFF
+        last_q[item] += unzigzag(dq)
+        samples.append((ts_msec, item, last_q[item] * quantum[item]))
+
+
+def decode_file(data):
+    magic, version, num_items, block_len = struct.unpack_from('<IBBH', data, 0)
+    if magic != FILE_MAGIC or version not in (1, 2, 3):
+        raise ValueError('not a trip log')
+    quantum = struct.unpack_from('<%df' % num_items, data, 8)
+    hdr_fmt = {1: '<HHI', 2: '<HHIH', 3: '<HHIHHQ'}[version]
+    hdr_len = struct.calcsize(hdr_fmt)
+
+    samples = []
+    pos = 8 + 4 * num_items
+    while pos + hdr_len <= len(data):
+        hdr = struct.unpack_from(hdr_fmt, data, pos)
+        if hdr[0] != BLOCK_MAGIC:
+            # End of the blocks (or the start of the trip's index)
+            break
+        body = data[pos + hdr_len:pos + hdr_len + hdr[1]]
+        if version >= 2:
+            body = lz_decode(body)
+            if len(body) != hdr[3]:
+                raise ValueError('block at %d decoded to %d bytes, expected %d' % (pos, len(body), hdr[3]))
+        decode_records(body, hdr[2], quantum, samples)
+
+        # Blocks start on block_len boundaries
+        pos = (pos // block_len + 1) * block_len
+
+    return samples
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        print('Usage: log_decode.py <trip.bin> [<output.csv>]')
+        sys.exit(1)
+
+    with open(sys.argv[1], 'rb') as f:
+        samples = decode_file(f.read())
+
+    out = open(sys.argv[2], 'w') if len(sys.argv) == 3 else sys.stdout
+    out.write('ts_msec,item,value\n')
+    for ts, item, value in samples:
+        out.write('%d,%d,%g\n' % (ts, item, value))
+    if out is not sys.stdout:
+        out.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,288 @@
+/*
+ * Trip log reader
+ *
+ * Random access to the trip logs written by log_task.  An open trip may be read (up to
+ * the data flushed when it is opened) since it has no index until it is closed.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "log_reader.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "lz_utilities.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+
+//
+// Log Reader variables
+//
+static const char* TAG = "log_reader";
+
+
+
+//
+// Forward declarations for internal functions
+//
+static long _log_reader_block_offset(int blk);
+static bool _log_reader_get_block_ts(log_reader_t* rP, int blk, uint32_t* ts_msec);
+static bool _log_reader_load_index(log_reader_t* rP);
+static bool _log_reader_get_varint(const uint8_t* p, int len, int* pos, uint32_t* v);
+static int32_t _log_reader_unzigzag(uint32_t v);
+
+
+
+//
+// API
+//
+bool log_reader_open(log_reader_t* rP, int trip)
+{
+	char name[24];
+	long size;
+	
+	memset(rP, 0, sizeof(log_reader_t));
+	
+	sprintf(name, LOG_TRIP_FMT, trip);
+	rP->fp = fopen(name, "rb");
+	if (rP->fp == NULL) {
+		ESP_LOGE(TAG, "Could not open %s", name);
+		return false;
+	}
+	
+	if ((fread(&rP->hdr, 1, sizeof(log_file_hdr_t), rP->fp) != sizeof(log_file_hdr_t)) ||
+	    (rP->hdr.magic != LOG_FILE_MAGIC) ||
+	    (rP->hdr.version != LOG_VERSION) ||
+	    (rP->hdr.num_items != DB_NUM_ITEMS) ||
+	    (rP->hdr.block_len != LOG_BLOCK_LEN)) {
+		ESP_LOGE(TAG, "%s is not a version %d trip log", name, LOG_VERSION);
+		log_reader_close(rP);
+		return false;
+	}
+	
+	if ((fseek(rP->fp, 0, SEEK_END) != 0) || ((size = ftell(rP->fp)) < 0)) {
+		log_reader_close(rP);
+		return false;
+	}
+	rP->num_blocks = (size + LOG_BLOCK_LEN - 1) / LOG_BLOCK_LEN;
+	
+	rP->comp_bufP = heap_caps_malloc(LOG_BLOCK_LEN, MALLOC_CAP_SPIRAM);
+	rP->raw_bufP = heap_caps_malloc(LOG_MAX_RAW_LEN, MALLOC_CAP_SPIRAM);
+	if ((rP->comp_bufP == NULL) || (rP->raw_bufP == NULL)) {
+		ESP_LOGE(TAG, "malloc buffers failed");
+		log_reader_close(rP);
+		return false;
+	}
+	
+	rP->has_index = _log_reader_load_index(rP);
+	
+	return true;
+}
+
+
+void log_reader_close(log_reader_t* rP)
+{
+	if (rP->fp != NULL) {
+		fclose(rP->fp);
+		rP->fp = NULL;
+	}
+	free(rP->index_ts);
+	free(rP->comp_bufP);
+	free(rP->raw_bufP);
+	rP->index_ts = NULL;
+	rP->comp_bufP = NULL;
+	rP->raw_bufP = NULL;
+	rP->num_blocks = 0;
+	rP->has_index = false;
+}
+
+
+// Returns the last block starting at or before ts_msec (the first block if ts_msec is
+// before the trip) or -1 for an error.  Broker timestamps aren't strictly ordered between
+// items so the preceding block may hold a few samples a little later than ts_msec.
+int log_reader_seek(log_reader_t* rP, uint32_t ts_msec)
+{
+	int lo, hi, mid;
+	uint32_t t;
+	
+	if (rP->num_blocks == 0) {
+		return -1;
+	}
+	
+	lo = 0;
+	hi = rP->num_blocks - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (!_log_reader_get_block_ts(rP, mid, &t)) {
+			return -1;
+		}
+	
+		// Compare as a difference since the mSec timestamp wraps
+		if ((int32_t) (t - ts_msec) <= 0) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	
+	return lo;
+}
+
+
+bool log_reader_get_block_hdr(log_reader_t* rP, int blk, log_block_hdr_t* hP)
+{
+	if ((blk < 0) || (blk >= rP->num_blocks)) {
+		return false;
+	}
+	
+	if ((fseek(rP->fp, _log_reader_block_offset(blk), SEEK_SET) != 0) ||
+	    (fread(hP, 1, sizeof(log_block_hdr_t), rP->fp) != sizeof(log_block_hdr_t)) ||
+	    (hP->magic != LOG_BLOCK_MAGIC)) {
+		return false;
+	}
+	
+	return true;
+}
+
+
+// Decode a block, calling cb for each sample in the order they were logged
+bool log_reader_read_block(log_reader_t* rP, int blk, log_sample_cb_t cb, void* arg)
+{
+	log_block_hdr_t hdr;
+	int32_t last_q[DB_NUM_ITEMS];
+	uint32_t ts_msec, dt, dq;
+	int item, len, pos;
+	
+	if (!log_reader_get_block_hdr(rP, blk, &hdr) ||
+	    (hdr.len > (LOG_BLOCK_LEN - sizeof(log_block_hdr_t))) ||
+	    (fread(rP->comp_bufP, 1, hdr.len, rP->fp) != hdr.len)) {
+		ESP_LOGE(TAG, "Read block %d failed", blk);
+		return false;
+	}
+	
+	len = lz_decode(rP->comp_bufP, hdr.len, rP->raw_bufP, LOG_MAX_RAW_LEN);
+	if (len != hdr.raw_len) {
+		ESP_LOGE(TAG, "Block %d corrupt", blk);
+		return false;
+	}
+	
+	memset(last_q, 0, sizeof(last_q));
+	ts_msec = hdr.ts_msec;
+	pos = 0;
+	while (pos < len) {
+		item = rP->raw_bufP[pos++];
+		if ((item >= DB_NUM_ITEMS) ||
+		    !_log_reader_get_varint(rP->raw_bufP, len, &pos, &dt) ||
+		    !_log_reader_get_varint(rP->raw_bufP, len, &pos, &dq)) {
+			ESP_LOGE(TAG, "Block %d bad record at %d", blk, pos);
+			return false;
+		}
+		ts_msec += _log_reader_unzigzag(dt);
+		last_q[item] += _log_reader_unzigzag(dq);
+		cb(item, last_q[item] * rP->hdr.quantum[item], ts_msec, arg);
+	}
+	
+	return true;
+}
+
+
+
+//
+// Internal functions
+//
+static long _log_reader_block_offset(int blk)
+{
+	return (blk == 0) ? sizeof(log_file_hdr_t) : ((long) blk * LOG_BLOCK_LEN);
+}
+
+
+static bool _log_reader_get_block_ts(log_reader_t* rP, int blk, uint32_t* ts_msec)
+{
+	log_block_hdr_t hdr;
+	
+	if (rP->has_index) {
+		*ts_msec = rP->index_ts[blk];
+		return true;
+	}
+	
+	if (!log_reader_get_block_hdr(rP, blk, &hdr)) {
+		return false;
+	}
+	*ts_msec = hdr.ts_msec;
+	return true;
+}
+
+
+// Load the index from the last sector if it has one
+static bool _log_reader_load_index(log_reader_t* rP)
+{
+	log_index_hdr_t hdr;
+	int len;
+	
+	if (rP->num_blocks < 2) {
+		return false;
+	}
+	
+	if ((fseek(rP->fp, (long) (rP->num_blocks - 1) * LOG_BLOCK_LEN, SEEK_SET) != 0) ||
+	    (fread(&hdr, 1, sizeof(log_index_hdr_t), rP->fp) != sizeof(log_index_hdr_t)) ||
+	    (hdr.magic != LOG_INDEX_MAGIC) ||
+	    (hdr.num_blocks != (rP->num_blocks - 1))) {
+		return false;
+	}
+	
+	len = hdr.num_blocks * sizeof(uint32_t);
+	rP->index_ts = heap_caps_malloc(len, MALLOC_CAP_SPIRAM);
+	if (rP->index_ts == NULL) {
+		return false;
+	}
+	if (fread(rP->index_ts, 1, len, rP->fp) != len) {
+		free(rP->index_ts);
+		rP->index_ts = NULL;
+		return false;
+	}
+	
+	// The index sector isn't a block
+	rP->num_blocks = hdr.num_blocks;
+	rP->end_ts_msec = hdr.end_ts_msec;
+	return true;
+}
+
+
+static bool _log_reader_get_varint(const uint8_t* p, int len, int* pos, uint32_t* v)
+{
+	int shift = 0;
+	
+	*v = 0;
+	while (*pos < len) {
+		*v |= (uint32_t) (p[*pos] & 0x7F) << shift;
+		if (p[(*pos)++] < 0x80) {
+			return true;
+		}
+		shift += 7;
+		if (shift > 28) {
+			return false;
+		}
+	}
+	
+	return false;
+}
+
+
+static int32_t _log_reader_unzigzag(uint32_t v)
+{
+	return (int32_t) (v >> 1) ^ -((int32_t) (v & 1));
+}
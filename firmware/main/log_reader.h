@@ -0,0 +1,65 @@
+/*
+ * Trip log reader
+ *
+ * Random access to the trip logs written by log_task for on-device review and the
+ * uploader.  A trip closed normally is located through its index (one read) and any other
+ * by a binary search of its block headers, so seeking to a time costs O(log n) block
+ * reads at worst.  Blocks are decompressed into PSRAM and their samples passed to a
+ * callback.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOG_READER_H
+#define LOG_READER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "log_task.h"
+
+
+
+//
+// Log Reader typedefs
+//
+
+// Sample callback (value already scaled by the item's quantum)
+typedef void (*log_sample_cb_t)(int item, float val, uint32_t ts_msec, void* arg);
+
+typedef struct {
+	FILE* fp;
+	log_file_hdr_t hdr;
+	int num_blocks;
+	bool has_index;
+	uint32_t end_ts_msec;                // Last record time (only if has_index)
+	uint32_t* index_ts;                  // Block start times (only if has_index)
+	uint8_t* comp_bufP;
+	uint8_t* raw_bufP;
+} log_reader_t;
+
+
+
+//
+// Log Reader API
+//
+bool log_reader_open(log_reader_t* rP, int trip);
+void log_reader_close(log_reader_t* rP);
+int log_reader_seek(log_reader_t* rP, uint32_t ts_msec);
+bool log_reader_get_block_hdr(log_reader_t* rP, int blk, log_block_hdr_t* hP);
+bool log_reader_read_block(log_reader_t* rP, int blk, log_sample_cb_t cb, void* arg);
+
+#endif /* LOG_READER_H */
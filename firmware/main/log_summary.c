@@ -0,0 +1,320 @@
+/*
+ * Trip summary pyramids
+ *
+ * Every level accumulates directly from the samples into an open bucket per series that
+ * is closed into the level's ring when a sample falls in a later bucket (buckets skipped
+ * while nothing was logged are stored empty).  Readers also see the open buckets so a
+ * live display includes the newest data.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "log_summary.h"
+#include "data_broker.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <math.h>
+#include <string.h>
+
+
+
+//
+// Log Summary constants
+//
+
+// Stored bucket value resolution
+#define SUM_QUANTUM         0.1f
+
+
+
+//
+// Log Summary typedefs
+//
+
+// Stored bucket (count = 0 for a bucket without samples)
+typedef struct {
+	int16_t min;
+	int16_t max;
+	int16_t mean;
+	uint16_t count;
+} sum_bucket_t;
+
+// Open bucket
+typedef struct {
+	float min;
+	float max;
+	float sum;
+	uint32_t count;
+} sum_acc_t;
+
+
+
+//
+// Log Summary variables
+//
+static const char* TAG = "log_summary";
+
+static const uint32_t level_sec[LOG_SUM_NUM_LEVELS] = {LOG_SUM_LEVEL_0_SEC, LOG_SUM_LEVEL_1_SEC, LOG_SUM_LEVEL_2_SEC};
+
+// Rings, each [LOG_SUM_NUM_SERIES][LOG_SUM_LEVEL_LEN] in PSRAM
+static sum_bucket_t* ringP[LOG_SUM_NUM_LEVELS];
+
+// Open buckets and the number of buckets closed (the index of the open bucket) per level
+static sum_acc_t acc[LOG_SUM_NUM_LEVELS][LOG_SUM_NUM_SERIES];
+static uint32_t closed_count[LOG_SUM_NUM_LEVELS];
+
+static SemaphoreHandle_t sum_mutex = NULL;
+static int sum_trip = -1;
+static bool sum_started;
+static int64_t start_usec;
+static uint32_t last_sec;
+static float hv_batt_v = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _log_summary_close_bucket(int level);
+static void _log_summary_merge(sum_acc_t* aP, const sum_acc_t* bP);
+static int16_t _log_summary_quantize(float v);
+
+
+
+//
+// API
+//
+bool log_summary_init()
+{
+	for (int i=0; i<LOG_SUM_NUM_LEVELS; i++) {
+		ringP[i] = heap_caps_malloc(LOG_SUM_NUM_SERIES * LOG_SUM_LEVEL_LEN * sizeof(sum_bucket_t), MALLOC_CAP_SPIRAM);
+		if (ringP[i] == NULL) {
+			ESP_LOGE(TAG, "malloc level %d failed", i);
+			return false;
+		}
+	}
+	
+	sum_mutex = xSemaphoreCreateMutex();
+	
+	return (sum_mutex != NULL);
+}
+
+
+// Discard the previous trip's summary
+void log_summary_start(int trip)
+{
+	if (sum_mutex == NULL) return;
+	
+	xSemaphoreTake(sum_mutex, portMAX_DELAY);
+	memset(acc, 0, sizeof(acc));
+	memset(closed_count, 0, sizeof(closed_count));
+	sum_trip = trip;
+	sum_started = false;
+	last_sec = 0;
+	xSemaphoreGive(sum_mutex);
+}
+
+
+// Called by log_task with each sample it logs
+void log_summary_add(int item, float val, int64_t ts_usec)
+{
+	int series;
+	uint32_t t_sec, b;
+	sum_acc_t* aP;
+	
+	switch (item) {
+		case DB_ITEM_HV_BATT_V:
+			// Only needed for power
+			hv_batt_v = val;
+			return;
+		case DB_ITEM_HV_BATT_I:
+			if (hv_batt_v == 0) return;
+			series = LOG_SUM_POWER;
+			val = val * hv_batt_v / 1000.0f;
+			break;
+		case DB_ITEM_SPEED:
+			series = LOG_SUM_SPEED;
+			break;
+		case DB_ITEM_HV_BATT_MAX_T:
+			series = LOG_SUM_TEMP;
+			break;
+		default:
+			return;
+	}
+	
+	if ((sum_mutex == NULL) || (sum_trip < 0)) return;
+	
+	xSemaphoreTake(sum_mutex, portMAX_DELAY);
+	
+	if (!sum_started) {
+		sum_started = true;
+		start_usec = ts_usec;
+	}
+	t_sec = (ts_usec > start_usec) ? (uint32_t) ((ts_usec - start_usec) / 1000000) : 0;
+	if (t_sec > last_sec) last_sec = t_sec;
+	
+	for (int l=0; l<LOG_SUM_NUM_LEVELS; l++) {
+		// Close the open bucket and any empty ones up to this sample's (a sample that is a
+		// little older than the open bucket is counted in it)
+		b = t_sec / level_sec[l];
+		if (b > closed_count[l]) {
+			_log_summary_close_bucket(l);
+			if ((b - closed_count[l]) > LOG_SUM_LEVEL_LEN) {
+				closed_count[l] = b - LOG_SUM_LEVEL_LEN;
+			}
+			while (closed_count[l] < b) {
+				_log_summary_close_bucket(l);
+			}
+		}
+	
+		aP = &acc[l][series];
+		if ((aP->count == 0) || (val < aP->min)) aP->min = val;
+		if ((aP->count == 0) || (val > aP->max)) aP->max = val;
+		aP->sum += val;
+		aP->count++;
+	}
+	
+	xSemaphoreGive(sum_mutex);
+}
+
+
+// Returns the trip being summarized or -1 if none
+int log_summary_get_trip()
+{
+	return sum_trip;
+}
+
+
+// Returns the seconds from the trip's first summarized sample to its latest
+uint32_t log_summary_get_duration()
+{
+	return last_sec;
+}
+
+
+// Fill num_points points covering span_sec seconds starting start_sec seconds into the
+// trip.  Each point is built from the coarsest level with buckets no wider than the point
+// that still holds the start of the span.
+bool log_summary_get(int series, uint32_t start_sec, uint32_t span_sec, int num_points, log_sum_point_t* points)
+{
+	int level;
+	uint32_t sec, oldest, t0, t1, b0, b1;
+	sum_bucket_t* bP;
+	sum_acc_t a, b;
+	
+	if ((series < 0) || (series >= LOG_SUM_NUM_SERIES) || (num_points <= 0) || (sum_mutex == NULL) || (sum_trip < 0)) {
+		return false;
+	}
+	
+	xSemaphoreTake(sum_mutex, portMAX_DELAY);
+	
+	level = 0;
+	for (int l=1; l<LOG_SUM_NUM_LEVELS; l++) {
+		if ((level_sec[l] * num_points) <= span_sec) level = l;
+	}
+	while (level < (LOG_SUM_NUM_LEVELS - 1)) {
+		oldest = (closed_count[level] > LOG_SUM_LEVEL_LEN) ? (closed_count[level] - LOG_SUM_LEVEL_LEN) : 0;
+		if ((start_sec / level_sec[level]) >= oldest) break;
+		level++;
+	}
+	sec = level_sec[level];
+	oldest = (closed_count[level] > LOG_SUM_LEVEL_LEN) ? (closed_count[level] - LOG_SUM_LEVEL_LEN) : 0;
+	
+	for (int p=0; p<num_points; p++) {
+		t0 = start_sec + (uint32_t) (((uint64_t) span_sec * p) / num_points);
+		t1 = start_sec + (uint32_t) (((uint64_t) span_sec * (p + 1)) / num_points);
+		b0 = t0 / sec;
+		b1 = (t1 > t0) ? ((t1 - 1) / sec) : b0;
+	
+		a.sum = 0;
+		a.count = 0;
+		for (uint32_t n=b0; n<=b1; n++) {
+			if (n < oldest) continue;
+			if (n < closed_count[level]) {
+				bP = &ringP[level][series * LOG_SUM_LEVEL_LEN + (n % LOG_SUM_LEVEL_LEN)];
+				if (bP->count == 0) continue;
+				b.min = bP->min * SUM_QUANTUM;
+				b.max = bP->max * SUM_QUANTUM;
+				b.sum = bP->mean * SUM_QUANTUM * bP->count;
+				b.count = bP->count;
+				_log_summary_merge(&a, &b);
+			} else if (n == closed_count[level]) {
+				_log_summary_merge(&a, &acc[level][series]);
+			}
+		}
+	
+		points[p].valid = (a.count != 0);
+		if (points[p].valid) {
+			points[p].min = a.min;
+			points[p].max = a.max;
+			points[p].mean = a.sum / (float) a.count;
+		}
+	}
+	
+	xSemaphoreGive(sum_mutex);
+	
+	return true;
+}
+
+
+
+//
+// Internal functions
+//
+
+// Store the open buckets of a level and start the next
+static void _log_summary_close_bucket(int level)
+{
+	sum_bucket_t* bP;
+	sum_acc_t* aP;
+	
+	for (int s=0; s<LOG_SUM_NUM_SERIES; s++) {
+		bP = &ringP[level][s * LOG_SUM_LEVEL_LEN + (closed_count[level] % LOG_SUM_LEVEL_LEN)];
+		aP = &acc[level][s];
+		bP->count = (aP->count > UINT16_MAX) ? UINT16_MAX : aP->count;
+		if (aP->count != 0) {
+			bP->min = _log_summary_quantize(aP->min);
+			bP->max = _log_summary_quantize(aP->max);
+			bP->mean = _log_summary_quantize(aP->sum / (float) aP->count);
+		}
+		memset(aP, 0, sizeof(sum_acc_t));
+	}
+	
+	closed_count[level]++;
+}
+
+
+static void _log_summary_merge(sum_acc_t* aP, const sum_acc_t* bP)
+{
+	if (bP->count == 0) return;
+	
+	if ((aP->count == 0) || (bP->min < aP->min)) aP->min = bP->min;
+	if ((aP->count == 0) || (bP->max > aP->max)) aP->max = bP->max;
+	aP->sum += bP->sum;
+	aP->count += bP->count;
+}
+
+
+static int16_t _log_summary_quantize(float v)
+{
+	long q = lroundf(v / SUM_QUANTUM);
+	
+	if (q > INT16_MAX) q = INT16_MAX;
+	if (q < INT16_MIN) q = INT16_MIN;
+	return (int16_t) q;
+}
@@ -0,0 +1,78 @@
+/*
+ * Trip summary pyramids
+ *
+ * Maintained by log_task from the samples it logs: min/max/mean buckets of a few key
+ * series at 1, 10 and 100 second resolution for the trip being logged (kept after it
+ * closes until the next trip starts).  A review display gets any time span at any
+ * width from the coarsest level that still resolves it without touching the flash
+ * log.  Buckets are held in PSRAM rings so each level covers the newest
+ * LOG_SUM_LEVEL_LEN buckets of a longer trip.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOG_SUMMARY_H
+#define LOG_SUMMARY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Log Summary Constants
+//
+
+// Series
+#define LOG_SUM_POWER       0            // HV battery power (kW, negative for discharge)
+#define LOG_SUM_SPEED       1            // kph
+#define LOG_SUM_TEMP        2            // Highest HV battery temperature (°C)
+#define LOG_SUM_NUM_SERIES  3
+
+// Levels and their bucket periods
+#define LOG_SUM_NUM_LEVELS  3
+#define LOG_SUM_LEVEL_0_SEC 1
+#define LOG_SUM_LEVEL_1_SEC 10
+#define LOG_SUM_LEVEL_2_SEC 100
+
+// Buckets kept per level (one hour at the finest level)
+#define LOG_SUM_LEVEL_LEN   3600
+
+
+
+//
+// Log Summary typedefs
+//
+typedef struct {
+	bool valid;                          // Set if any samples fell in the point's span
+	float min;
+	float max;
+	float mean;
+} log_sum_point_t;
+
+
+
+//
+// Log Summary API
+//
+bool log_summary_init();
+void log_summary_start(int trip);
+void log_summary_add(int item, float val, int64_t ts_usec);
+int log_summary_get_trip();
+uint32_t log_summary_get_duration();
+bool log_summary_get(int series, uint32_t start_sec, uint32_t span_sec, int num_points, log_sum_point_t* points);
+
+#endif /* LOG_SUMMARY_H */
@@ -0,0 +1,547 @@
+/*
+ * Log Task
+ *
+ * Record data broker items to the flash FAT partition in a compact binary trip log.
+ * The task is a broker subscriber with a per-item quantization (also used as the
+ * subscriber deadband) and minimum interval so slowly changing items cost almost
+ * nothing.  Samples are encoded as varint deltas and compressed by a streaming LZ encoder
+ * into a RAM block the size of a flash sector that is written out when the block fills, so
+ * flash writes happen only from this low priority task and only once per sector.  The
+ * samples also feed the trip summary pyramids (log_summary) for review displays.  A new trip file is started each time
+ * data starts flowing after boot or after the vehicle wakes and is closed when the vehicle
+ * goes to sleep.  The oldest trips are deleted to make room.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "data_broker.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "log_summary.h"
+#include "log_task.h"
+#include "lz_utilities.h"
+#include "vehicle_manager.h"
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+//
+// Log Task constants
+//
+
+// Maximum files on the partition
+#define LOG_MAX_FILES       16
+
+
+
+//
+// Log Task typedefs
+//
+
+// Logged items: value quantization (also the deadband) and minimum logging interval
+typedef struct {
+	int item;
+	float quantum;
+	uint32_t min_interval_msec;
+} log_item_cfg_t;
+
+
+
+//
+// Log Task variables
+//
+static const char* TAG = "log_task";
+
+// Task handle
+TaskHandle_t task_handle_log;
+
+// Derived items are not logged since they can be recomputed from their inputs
+static const log_item_cfg_t log_item_cfg[] = {
+	{DB_ITEM_HV_BATT_V,      0.1,   1000},
+	{DB_ITEM_HV_BATT_I,      0.1,    250},
+	{DB_ITEM_HV_BATT_MIN_T,  0.5,   5000},
+	{DB_ITEM_HV_BATT_MAX_T,  0.5,   5000},
+	{DB_ITEM_LV_BATT_V,      0.01,  1000},
+	{DB_ITEM_LV_BATT_I,      0.1,   1000},
+	{DB_ITEM_LV_BATT_T,      0.5,   5000},
+	{DB_ITEM_AUX_KW,         0.01,  1000},
+	{DB_ITEM_FRONT_TORQUE,   1.0,    250},
+	{DB_ITEM_REAR_TORQUE,    1.0,    250},
+	{DB_ITEM_SPEED,          0.1,    250},
+	{DB_ITEM_GPS_ELEVATION,  1.0,   2000},
+	{DB_ITEM_GPS_LAT,        1.0e-5, 1000},
+	{DB_ITEM_GPS_LON,        1.0e-5, 1000},
+	{DB_ITEM_GPS_HEADING,    1.0,   1000},
+	{DB_ITEM_HV_SOC,         0.1,   5000},
+	{DB_ITEM_LONG_ACCEL,     0.01,   200},
+	{DB_ITEM_LAT_ACCEL,      0.01,   200}
+};
+#define LOG_NUM_ITEM_CFG (sizeof(log_item_cfg) / sizeof(log_item_cfg_t))
+
+static int log_sub = -1;
+static db_mask_t log_cfg_mask = 0;
+static db_mask_t log_cur_mask = 0;
+static float item_quantum[DB_NUM_ITEMS];
+
+// File state
+static wl_handle_t wl_handle = WL_INVALID_HANDLE;
+static FILE* log_fp = NULL;
+static bool log_failed = false;      // Stop trying after an unrecoverable file error
+static int trip_num;
+
+// Block state.  The first block in a file is preceded by the file header so every block
+// starts on a LOG_BLOCK_LEN boundary in the file.
+static uint8_t blk_buf[LOG_BLOCK_LEN];
+static uint32_t blk_offset;          // File offset of blk_buf[0]
+static int blk_hdr_index;            // blk_buf index of the current block header
+static int blk_len;                  // Bytes used in blk_buf (0 = no block started)
+static int blk_data_index;           // blk_buf index of the current block's LZ stream
+static lz_enc_t blk_lz;
+static uint32_t blk_last_ts_msec;
+static int32_t blk_last_q[DB_NUM_ITEMS];
+static int64_t last_flush_usec;
+
+// Block start times for the trip's index
+static uint32_t blk_index_ts[LOG_INDEX_MAX_BLOCKS];
+static int blk_index_len;            // Blocks started (may exceed LOG_INDEX_MAX_BLOCKS)
+
+static uint32_t log_block_count = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static bool _log_mount();
+static void _log_init_items();
+static void _log_update_items();
+static bool _log_open_trip();
+static void _log_close_trip();
+static int _log_find_trips(int* oldest, int* newest);
+static bool _log_ensure_space();
+static void _log_item_handler(int item, float val, int64_t ts_usec);
+static void _log_start_block(uint32_t ts_msec);
+static bool _log_write_block(bool complete);
+static bool _log_write_index();
+static int _log_put_varint(uint8_t* p, uint32_t v);
+static uint32_t _log_zigzag(int32_t v);
+
+
+
+//
+// API
+//
+void log_task()
+{
+	int check_count = 0;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	if (!_log_mount()) {
+		vTaskDelete(NULL);
+	}
+	
+	if (!log_summary_init()) {
+		ESP_LOGE(TAG, "Trip summaries disabled");
+	}
+	
+	_log_init_items();
+	log_sub = db_add_subscriber(0, _log_item_handler);
+	if (log_sub < 0) {
+		ESP_LOGE(TAG, "No broker subscriber available");
+		vTaskDelete(NULL);
+	}
+	for (int i=0; i<LOG_NUM_ITEM_CFG; i++) {
+		db_set_subscriber_filter(log_sub, log_item_cfg[i].item, log_item_cfg[i].quantum, log_item_cfg[i].min_interval_msec);
+	}
+	
+	while (1) {
+		vTaskDelay(pdMS_TO_TICKS(LOG_TASK_EVAL_MSEC));
+		
+		if (check_count-- == 0) {
+			check_count = LOG_ITEM_CHECK_MSEC / LOG_TASK_EVAL_MSEC;
+			_log_update_items();
+		}
+		
+		// The trip ends when the vehicle goes to sleep (on-board items still update while it
+		// sleeps but are dropped until it wakes and starts the next trip).  The last block is
+		// written in full so the index starts on the following sector.
+		if ((log_fp != NULL) && vm_is_asleep()) {
+			if (blk_len != 0) {
+				(void) _log_write_block(true);
+			}
+			if (log_fp != NULL) {
+				(void) _log_write_index();
+				ESP_LOGI(TAG, "Trip %d complete", trip_num);
+				_log_close_trip();
+			}
+		}
+		
+		if (db_subscriber_has_updates(log_sub)) {
+			if ((log_fp == NULL) && !log_failed && !vm_is_asleep()) {
+				(void) _log_open_trip();
+			}
+			db_subscriber_eval(log_sub);
+		}
+		
+		// Bound what is lost if power goes away mid-block
+		if ((log_fp != NULL) && (blk_len != 0) && ((esp_timer_get_time() - last_flush_usec) >= ((int64_t) LOG_FLUSH_MSEC * 1000))) {
+			(void) _log_write_block(false);
+		}
+	}
+}
+
+
+
+// Returns the number of the trip being written or -1 if none (all trip files are complete)
+int log_get_open_trip()
+{
+	return (log_fp != NULL) ? trip_num : -1;
+}
+
+
+
+//
+// Internal functions
+//
+static bool _log_mount()
+{
+	esp_err_t ret;
+	const esp_vfs_fat_mount_config_t mount_config = {
+		.max_files = 3,                  // Trip being written, a reader and the uploader
+		.format_if_mount_failed = true,
+		.allocation_unit_size = LOG_BLOCK_LEN
+	};
+	uint64_t total_bytes, free_bytes;
+	
+	ret = esp_vfs_fat_spiflash_mount_rw_wl(LOG_BASE_PATH, LOG_PARTITION_LABEL, &mount_config, &wl_handle);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Mount %s failed - %d", LOG_PARTITION_LABEL, ret);
+		return false;
+	}
+	
+	if (esp_vfs_fat_info(LOG_BASE_PATH, &total_bytes, &free_bytes) == ESP_OK) {
+		ESP_LOGI(TAG, "%llu of %llu bytes free", free_bytes, total_bytes);
+	}
+	
+	return true;
+}
+
+
+static void _log_init_items()
+{
+	memset(item_quantum, 0, sizeof(item_quantum));
+	for (int i=0; i<LOG_NUM_ITEM_CFG; i++) {
+		item_quantum[log_item_cfg[i].item] = log_item_cfg[i].quantum;
+		log_cfg_mask |= DB_MASK(log_item_cfg[i].item);
+	}
+}
+
+
+// Log the configured items currently available
+static void _log_update_items()
+{
+	db_mask_t mask;
+	
+	mask = vm_get_supported_item_mask() & log_cfg_mask;
+	if (mask != log_cur_mask) {
+		log_cur_mask = mask;
+		db_set_subscriber_items(log_sub, mask);
+		ESP_LOGI(TAG, "Logging items 0x%llx", mask);
+	}
+}
+
+
+static bool _log_open_trip()
+{
+	char name[24];
+	int oldest, newest;
+	log_file_hdr_t* hP = (log_file_hdr_t*) blk_buf;
+	
+	if (!_log_ensure_space()) {
+		log_failed = true;
+		return false;
+	}
+	
+	trip_num = 1;
+	if ((_log_find_trips(&oldest, &newest) > 0) && (newest < LOG_TRIP_MAX)) {
+		trip_num = newest + 1;
+	}
+	sprintf(name, LOG_TRIP_FMT, trip_num);
+	
+	log_fp = fopen(name, "wb");
+	if (log_fp == NULL) {
+		ESP_LOGE(TAG, "Could not create %s", name);
+		log_failed = true;
+		return false;
+	}
+	
+	// Blocks are written directly to the FAT layer
+	setvbuf(log_fp, NULL, _IONBF, 0);
+	
+	memset(blk_buf, 0, LOG_BLOCK_LEN);
+	hP->magic = LOG_FILE_MAGIC;
+	hP->version = LOG_VERSION;
+	hP->num_items = DB_NUM_ITEMS;
+	hP->block_len = LOG_BLOCK_LEN;
+	memcpy(hP->quantum, item_quantum, sizeof(item_quantum));
+	blk_offset = 0;
+	blk_hdr_index = sizeof(log_file_hdr_t);
+	blk_len = 0;
+	blk_index_len = 0;
+	last_flush_usec = esp_timer_get_time();
+	
+	log_summary_start(trip_num);
+	
+	ESP_LOGI(TAG, "Logging to %s", name);
+	return true;
+}
+
+
+static void _log_close_trip()
+{
+	if (log_fp != NULL) {
+		fclose(log_fp);
+		log_fp = NULL;
+	}
+}
+
+
+// Find the lowest and highest numbered trip files.  Returns the number of trip files.
+static int _log_find_trips(int* oldest, int* newest)
+{
+	DIR* dirP;
+	struct dirent* entP;
+	int n;
+	int count = 0;
+	
+	dirP = opendir(LOG_BASE_PATH);
+	if (dirP == NULL) {
+		return 0;
+	}
+	
+	while ((entP = readdir(dirP)) != NULL) {
+		if ((entP->d_name[0] == 'T') && (sscanf(&entP->d_name[1], "%d", &n) == 1)) {
+			if ((count == 0) || (n < *oldest)) *oldest = n;
+			if ((count == 0) || (n > *newest)) *newest = n;
+			count++;
+		}
+	}
+	closedir(dirP);
+	
+	return count;
+}
+
+
+// Delete the oldest trips (never the one being written) until there is room for more
+// blocks.  Returns false if there is no room and nothing left to delete.
+static bool _log_ensure_space()
+{
+	char name[24];
+	int oldest, newest;
+	uint64_t total_bytes, free_bytes;
+	int files;
+	int max_files;
+	
+	// Leave room for a new trip file if we're about to create one
+	max_files = (log_fp == NULL) ? (LOG_MAX_FILES - 1) : LOG_MAX_FILES;
+	
+	while (esp_vfs_fat_info(LOG_BASE_PATH, &total_bytes, &free_bytes) == ESP_OK) {
+		files = _log_find_trips(&oldest, &newest);
+		if ((free_bytes >= LOG_MIN_FREE_BYTES) && (files <= max_files)) {
+			return true;
+		}
+		if ((files == 0) || ((log_fp != NULL) && (oldest == trip_num))) {
+			ESP_LOGE(TAG, "Log partition full");
+			return false;
+		}
+		
+		sprintf(name, LOG_TRIP_FMT, oldest);
+		if (unlink(name) != 0) {
+			ESP_LOGE(TAG, "Could not delete %s", name);
+			return false;
+		}
+		ESP_LOGI(TAG, "Deleted %s", name);
+	}
+	
+	return false;
+}
+
+
+// Broker subscriber handler - encode one sample
+static void _log_item_handler(int item, float val, int64_t ts_usec)
+{
+	uint32_t ts_msec;
+	int32_t q;
+	uint8_t rec[LOG_MAX_RECORD_LEN];
+	uint8_t* p;
+	log_block_hdr_t* hP;
+	
+	if ((log_fp == NULL) || (item >= DB_NUM_ITEMS) || (item_quantum[item] == 0)) {
+		return;
+	}
+	ts_msec = (uint32_t) (ts_usec / 1000);
+	
+	log_summary_add(item, val, ts_usec);
+	
+	if (blk_len == 0) {
+		_log_start_block(ts_msec);
+	} else if (!lz_enc_fits(&blk_lz, LOG_MAX_RECORD_LEN) || ((lz_enc_raw_len(&blk_lz) + LOG_MAX_RECORD_LEN) > LOG_MAX_RAW_LEN)) {
+		if (!_log_write_block(true)) {
+			return;
+		}
+		_log_start_block(ts_msec);
+	}
+	
+	// Broker timestamps are not strictly ordered between items so the time delta is signed
+	q = (int32_t) lroundf(val / item_quantum[item]);
+	p = rec;
+	*p++ = (uint8_t) item;
+	p += _log_put_varint(p, _log_zigzag((int32_t) (ts_msec - blk_last_ts_msec)));
+	p += _log_put_varint(p, _log_zigzag(q - blk_last_q[item]));
+	lz_enc_write(&blk_lz, rec, p - rec);
+	
+	hP = (log_block_hdr_t*) &blk_buf[blk_hdr_index];
+	hP->samples++;
+	hP->items |= DB_MASK(item);
+	
+	blk_last_ts_msec = ts_msec;
+	blk_last_q[item] = q;
+}
+
+
+static void _log_start_block(uint32_t ts_msec)
+{
+	log_block_hdr_t* hP = (log_block_hdr_t*) &blk_buf[blk_hdr_index];
+	int n;
+	
+	hP->magic = LOG_BLOCK_MAGIC;
+	hP->len = 0;
+	hP->ts_msec = ts_msec;
+	hP->raw_len = 0;
+	hP->samples = 0;
+	hP->items = 0;
+	blk_data_index = blk_hdr_index + sizeof(log_block_hdr_t);
+	blk_len = blk_data_index;
+	lz_enc_begin(&blk_lz, &blk_buf[blk_data_index], LOG_BLOCK_LEN - blk_data_index);
+	
+	n = blk_offset / LOG_BLOCK_LEN;
+	if (n < LOG_INDEX_MAX_BLOCKS) {
+		blk_index_ts[n] = ts_msec;
+	}
+	blk_index_len = n + 1;
+	
+	blk_last_ts_msec = ts_msec;
+	memset(blk_last_q, 0, sizeof(blk_last_q));
+}
+
+
+// Write the current block to its place in the file.  A complete block is written in full
+// (keeping the next block sector-aligned) and the buffer moves on to the next.  A partial
+// block is rewritten in place when it completes.  The LZ lookahead is flushed first so
+// the block on flash decodes completely (the stream carries on from there).
+static bool _log_write_block(bool complete)
+{
+	log_block_hdr_t* hP = (log_block_hdr_t*) &blk_buf[blk_hdr_index];
+	int len;
+	
+	blk_len = blk_data_index + lz_enc_flush(&blk_lz);
+	hP->len = blk_len - blk_data_index;
+	hP->raw_len = lz_enc_raw_len(&blk_lz);
+	len = (complete) ? LOG_BLOCK_LEN : blk_len;
+	
+	if ((fseek(log_fp, blk_offset, SEEK_SET) != 0) ||
+	    (fwrite(blk_buf, 1, len, log_fp) != len) ||
+	    (fsync(fileno(log_fp)) != 0)) {
+		ESP_LOGE(TAG, "Write block %lu failed", log_block_count);
+		_log_close_trip();
+		log_failed = true;
+		return false;
+	}
+	last_flush_usec = esp_timer_get_time();
+	
+	if (complete) {
+		log_block_count++;
+		blk_offset += LOG_BLOCK_LEN;
+		blk_hdr_index = 0;
+		blk_len = 0;
+		memset(blk_buf, 0, LOG_BLOCK_LEN);
+		
+		// Make room for the next block
+		if (!_log_ensure_space()) {
+			_log_close_trip();
+			log_failed = true;
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+
+// Write the trip's index to the sector following its last (complete) block
+static bool _log_write_index()
+{
+	log_index_hdr_t* hP = (log_index_hdr_t*) blk_buf;
+	int len;
+	
+	if ((blk_index_len == 0) || (blk_index_len > LOG_INDEX_MAX_BLOCKS)) {
+		return false;
+	}
+	
+	hP->magic = LOG_INDEX_MAGIC;
+	hP->num_blocks = blk_index_len;
+	hP->end_ts_msec = blk_last_ts_msec;
+	memcpy(&blk_buf[sizeof(log_index_hdr_t)], blk_index_ts, blk_index_len * sizeof(uint32_t));
+	len = sizeof(log_index_hdr_t) + blk_index_len * sizeof(uint32_t);
+	
+	if ((fseek(log_fp, blk_offset, SEEK_SET) != 0) ||
+	    (fwrite(blk_buf, 1, len, log_fp) != len) ||
+	    (fsync(fileno(log_fp)) != 0)) {
+		ESP_LOGE(TAG, "Write index failed");
+		return false;
+	}
+	
+	return true;
+}
+
+
+static int _log_put_varint(uint8_t* p, uint32_t v)
+{
+	int n = 0;
+	
+	while (v >= 0x80) {
+		p[n++] = (uint8_t) (v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (uint8_t) v;
+	
+	return n;
+}
+
+
+static uint32_t _log_zigzag(int32_t v)
+{
+	return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
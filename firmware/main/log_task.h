@@ -0,0 +1,131 @@
+/*
+ * Log Task
+ *
+ * Record data broker items to the flash FAT partition in a compact binary trip log
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOG_TASK_H
+#define LOG_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "data_broker.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+
+
+//
+// Log Task Constants
+//
+
+// Mount point and partition
+#define LOG_BASE_PATH       "/log"
+#define LOG_PARTITION_LABEL "flash_test"
+
+// Trip file names (8.3 since long file names are not enabled)
+#define LOG_TRIP_FMT        LOG_BASE_PATH "/T%04d.BIN"
+#define LOG_TRIP_MAX        9999
+
+// Block size (matches the FAT/wear-levelling sector so each block is one sector write)
+#define LOG_BLOCK_LEN       4096
+
+// Evaluation period
+#define LOG_TASK_EVAL_MSEC  100
+
+// Maximum period before a partially filled block is written (bounds data lost at power-off)
+#define LOG_FLUSH_MSEC      (2 * 60 * 1000)
+
+// Period the set of logged items is re-evaluated (on-board items appear after startup)
+#define LOG_ITEM_CHECK_MSEC 1000
+
+// Free space kept on the partition (oldest trips are deleted to maintain this)
+#define LOG_MIN_FREE_BYTES  (4 * LOG_BLOCK_LEN)
+
+// File format
+//   File header: log_file_hdr_t
+//   Blocks, each: log_block_hdr_t followed by len bytes of an LZ stream (lz_utilities.h)
+//   that expands to raw_len bytes of records.  Block n starts at file offset
+//   n * LOG_BLOCK_LEN (block 0 after the file header).  Each block decodes independently:
+//   the LZ stream starts with the block, record timestamps start from the block's ts_msec
+//   and every item's previous value starts at 0.
+//   Record: item (1 byte), zigzag varint delta mSec, zigzag varint delta value in quanta
+//   Index (trips closed normally): log_index_hdr_t followed by num_blocks uint32_t block
+//   start times in the sector after the last block.  A trip without one (e.g. power lost
+//   while it was open) is searched through the block headers instead.
+// Version 1 files have only the first three block header fields and the records are not
+// compressed.  Version 2 files lack the samples and items block header fields and the
+// index.
+#define LOG_FILE_MAGIC      0x314C5645   /* "EVL1" */
+#define LOG_BLOCK_MAGIC     0xB10C
+#define LOG_INDEX_MAGIC     0x1DE7
+#define LOG_VERSION         3
+
+// Maximum encoded record length
+#define LOG_MAX_RECORD_LEN  (1 + 5 + 5)
+
+// Maximum records per block (bounds the buffer a decoder needs)
+#define LOG_MAX_RAW_LEN     (4 * LOG_BLOCK_LEN)
+
+// Maximum blocks covered by a trip's index (more than fit in the log partition)
+#define LOG_INDEX_MAX_BLOCKS 256
+
+
+
+//
+// Log Task typedefs
+//
+typedef struct {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t num_items;
+	uint16_t block_len;
+	float quantum[DB_NUM_ITEMS];         // Item value = count * quantum[item] (0 = not logged)
+} __attribute__((packed)) log_file_hdr_t;
+
+typedef struct {
+	uint16_t magic;
+	uint16_t len;                        // Compressed bytes following this header
+	uint32_t ts_msec;                    // First record's esp_timer mSec (low 32 bits)
+	uint16_t raw_len;                    // Record bytes once decompressed
+	uint16_t samples;                    // Records in the block
+	db_mask_t items;                     // Items with records in the block
+} __attribute__((packed)) log_block_hdr_t;
+
+typedef struct {
+	uint16_t magic;
+	uint16_t num_blocks;
+	uint32_t end_ts_msec;                // Time of the trip's last record
+} __attribute__((packed)) log_index_hdr_t;
+
+
+
+//
+// Log Task externally accessible variables
+//
+extern TaskHandle_t task_handle_log;
+
+
+
+//
+// API
+//
+void log_task();
+int log_get_open_trip();
+
+#endif /* LOG_TASK_H */
\ No newline at end of file
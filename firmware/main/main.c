@@ -17,24 +17,94 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include "boot_prof.h"
+#include "ble_stream_task.h"
 #include "Buzzer.h"
+#include "cpu_prof.h"
 #include "data_broker.h"
+#include "db_bench.h"
+#include "espnow_task.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_pm.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "can_task.h"
 #include "gui_task.h"
 #include "I2C_Driver.h"
+#include "imu_task.h"
+#include "log_task.h"
+#include "mon_task.h"
+#include "telem_task.h"
 #include "TCA9554PWR.h"
+#include "upload_task.h"
 #include "ps_utilities.h"
+#include "tune_utilities.h"
+#include "vehicle_loaded.h"
  
 
+//
+// Constants
+//
+
+// Dynamic frequency scaling range.  The CPU runs at the maximum while a task holds a
+// CPU_FREQ_MAX lock (CAN receive processing, vehicle evaluation, LVGL rendering) and
+// drops to the minimum otherwise.
+#define MAIN_PM_MAX_FREQ_MHZ 240
+#define MAIN_PM_MIN_FREQ_MHZ 80
+
+
+
+//
+// Typedefs
+//
+typedef struct {
+	TaskFunction_t fcn;
+	const char* name;
+	uint32_t stack;
+	UBaseType_t priority;
+	BaseType_t core;
+	TaskHandle_t* handleP;
+} task_layout_t;
+
+
+
 //
 // Variables
 //
 static const char* TAG = "main";
 
+// Application task layout
+//   Core 0 : PRO - also runs the NimBLE host and BT controller, WiFi task, esp_timer
+//                  task and the ELM327 interface and driver tasks (see their headers)
+//   Core 1 : APP - GUI rendering (lcd_flush runs on core 0)
+//   lwIP tcpip (priority 18) floats between cores
+// The ELM327 driver (CAN_ELM327_PARSE_ON_APP_CORE) and the radio stacks (menuconfig, the
+// interface tasks follow them) may be moved to core 1 - see "Core layout" in the README.
+// Adjust using the per-task loads logged by mon_task.  can_task must be created before
+// gui_task since the GUI notifies it when its draw buffers are allocated.
+static const task_layout_t task_layout[] = {
+	{&can_task,   "can_task",   3072, 2, 0, &task_handle_can},
+	{&gui_task,   "gui_task",   3072, 2, 1, &task_handle_gui},
+	{&imu_task,   "imu_task",   2560, 3, 0, &task_handle_imu},
+	{&log_task,   "log_task",   3584, 1, 1, &task_handle_log},
+#ifdef ENABLE_TELEMETRY
+	{&telem_task, "telem_task", 3072, 1, 1, &task_handle_telem},
+#endif
+#ifdef ENABLE_ESPNOW_PUB
+	{&espnow_task, "espnow_task", 3072, 1, 1, &task_handle_espnow},
+#endif
+#ifdef ENABLE_BLE_STREAM
+	{&ble_stream_task, "ble_stream_task", 3072, 1, 1, &task_handle_ble_stream},
+#endif
+#ifdef ENABLE_UPLOAD
+	{&upload_task, "upload_task", 4096, 1, 1, &task_handle_upload},
+#endif
+	{&mon_task,   "mon_task",   2560, 1, 1, &task_handle_mon}
+};
+
+#define NUM_LAYOUT_TASKS (sizeof(task_layout) / sizeof(task_layout_t))
+
 
 //
 // API
@@ -42,26 +112,51 @@ static const char* TAG = "main";
 void app_main(void)
 {
 	ESP_LOGI(TAG, "ev_info_display starting");
+	boot_prof_mark("app_main");
+	
+	// Let the CPU clock down between frames and polls (the radios need it to stay awake so
+	// no light sleep)
+	esp_pm_config_t pm_config = {
+		.max_freq_mhz = MAIN_PM_MAX_FREQ_MHZ,
+		.min_freq_mhz = MAIN_PM_MIN_FREQ_MHZ,
+		.light_sleep_enable = false
+	};
+	if (esp_pm_configure(&pm_config) != ESP_OK) {
+		ESP_LOGW(TAG, "Dynamic frequency scaling not enabled");
+	}
 	
 	// Initialize persistent storage so everyone can get their configuration
 	if (!ps_init()) {
 		ESP_LOGE(TAG, "Persistent Storage initialization failed");
 		while (1) {vTaskDelay(pdMS_TO_TICKS(100));}
 	}
+	tune_init();
 	
 	// Initialize shared resources
 	ESP_ERROR_CHECK(I2C_Init());
 	ESP_ERROR_CHECK(EXIO_Init());
+	ESP_ERROR_CHECK(Buzzer_Init());
 	ESP_ERROR_CHECK(db_init());
-	
-	// Let them know we're alive
-	Buzzer_On();
-	vTaskDelay(pdMS_TO_TICKS(100));
-	Buzzer_Off();
+#ifdef ENABLE_DB_BENCH
+	// Measure the broker with nothing else running
+	db_bench_run();
+	while (1) {vTaskDelay(pdMS_TO_TICKS(1000));}
+#endif
+	(void) vehicle_loaded_init();
+	boot_prof_mark("shared_init");
+#ifdef ENABLE_CPU_PROF
+	(void) cpu_prof_start();
+#endif
 	
 	// Start tasks
-    //  Core 0 : PRO
-    //  Core 1 : APP
-    xTaskCreatePinnedToCore(&can_task,   "can_task",   3072, NULL, 2, &task_handle_can,   0);
-    xTaskCreatePinnedToCore(&gui_task,   "gui_task",   3072, NULL, 2, &task_handle_gui,   1);
+	for (int i=0; i<NUM_LAYOUT_TASKS; i++) {
+		if (xTaskCreatePinnedToCore(task_layout[i].fcn, task_layout[i].name, task_layout[i].stack, NULL,
+		                            task_layout[i].priority, task_layout[i].handleP, task_layout[i].core) != pdPASS) {
+			ESP_LOGE(TAG, "Could not start %s", task_layout[i].name);
+		}
+	}
+	boot_prof_mark("tasks_started");
+	
+	// Let them know we're alive (while the tasks initialize)
+	Buzzer_Play(BUZZER_SEQ_CHIRP);
 }
\ No newline at end of file
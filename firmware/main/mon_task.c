@@ -0,0 +1,357 @@
+/*
+ * System Monitor Task
+ *
+ * Periodically sample the FreeRTOS run-time statistics (esp_timer based, enabled by
+ * CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS) to compute the CPU usage of each task over
+ * the sample period and the load on each core (from its idle task).  Each task's stack
+ * high-water mark and the internal RAM and PSRAM heap minimum-ever-free levels are
+ * collected with them.  The results are made available to the GUI and written to the
+ * log as a table so task placement, priorities and stack sizes can be set from
+ * measurements.  Tasks close to overflowing their stack are warned about each sample.
+ * A tick hook on CPU 0 counts the ticks spent at each CPU frequency so the residency
+ * under dynamic frequency scaling can be seen.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "mon_task.h"
+#include "cpu_prof.h"
+#include "diag_server.h"
+#include "dlog_utilities.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_freertos_hooks.h"
+#include "esp_private/esp_clk.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+
+//
+// System Monitor Task constants
+//
+
+#define MON_NUM_CORES           2
+
+// CPU frequencies counted by the tick hook (others are counted with the nearest lower one)
+#define MON_NUM_FREQS           3
+
+
+
+//
+// System Monitor Task variables
+//
+static const char* TAG = "mon_task";
+
+// Task handle
+TaskHandle_t task_handle_mon;
+
+// Run-time statistics snapshots (static so they don't take stack)
+static TaskStatus_t task_status[MON_MAX_TASKS];
+
+static TaskHandle_t prev_handle[MON_MAX_TASKS];
+static uint32_t prev_run_time[MON_MAX_TASKS];
+static int prev_num_tasks = 0;
+static uint32_t prev_total_time;
+static bool prev_valid = false;
+
+// Results - protected by mon_mux
+static portMUX_TYPE mon_mux = portMUX_INITIALIZER_UNLOCKED;
+static mon_task_info_t task_info[MON_MAX_TASKS];
+static int task_info_num = 0;
+static int core_load[MON_NUM_CORES] = {-1, -1};
+static mon_heap_info_t heap_info;
+static bool heap_info_valid = false;
+static int freq_residency[MON_NUM_FREQS] = {-1, -1, -1};
+
+// Ticks at each frequency - written by the tick hook, protected by mon_mux
+static const int freq_mhz[MON_NUM_FREQS] = {240, 160, 80};
+static uint32_t freq_ticks[MON_NUM_FREQS];
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _mon_sample();
+static uint32_t _mon_prev_run_time(TaskHandle_t h, bool* found);
+static void _mon_log();
+static void _mon_tick_hook();
+
+
+
+//
+// API
+//
+void mon_task()
+{
+	int log_count = 0;
+	int sample_count = 0;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	if (esp_register_freertos_tick_hook_for_cpu(_mon_tick_hook, 0) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not register tick hook");
+	}
+	
+	while (1) {
+		vTaskDelay(pdMS_TO_TICKS(MON_DLOG_MSEC));
+		(void) dlog_flush();
+		
+		if (++sample_count < (MON_SAMPLE_MSEC / MON_DLOG_MSEC)) continue;
+		sample_count = 0;
+		_mon_sample();
+		diag_server_eval();
+#ifdef ENABLE_CPU_PROF
+		cpu_prof_eval();
+#endif
+		
+		if ((MON_LOG_MSEC != 0) && (++log_count >= (MON_LOG_MSEC / MON_SAMPLE_MSEC))) {
+			log_count = 0;
+			_mon_log();
+		}
+	}
+}
+
+
+int mon_get_core_load(int core)
+{
+	int load;
+	
+	if ((core < 0) || (core >= MON_NUM_CORES)) return -1;
+	
+	portENTER_CRITICAL(&mon_mux);
+	load = core_load[core];
+	portEXIT_CRITICAL(&mon_mux);
+	
+	return load;
+}
+
+
+int mon_get_task_info(mon_task_info_t* list, int max)
+{
+	int n;
+	
+	portENTER_CRITICAL(&mon_mux);
+	n = (task_info_num < max) ? task_info_num : max;
+	memcpy(list, task_info, n * sizeof(mon_task_info_t));
+	portEXIT_CRITICAL(&mon_mux);
+	
+	return n;
+}
+
+
+bool mon_get_heap_info(mon_heap_info_t* info)
+{
+	bool valid;
+	
+	portENTER_CRITICAL(&mon_mux);
+	valid = heap_info_valid;
+	*info = heap_info;
+	portEXIT_CRITICAL(&mon_mux);
+	
+	return valid;
+}
+
+
+int mon_get_freq_residency(int mhz)
+{
+	int pct = -1;
+	
+	portENTER_CRITICAL(&mon_mux);
+	for (int i=0; i<MON_NUM_FREQS; i++) {
+		if (freq_mhz[i] == mhz) pct = freq_residency[i];
+	}
+	portEXIT_CRITICAL(&mon_mux);
+	
+	return pct;
+}
+
+
+bool mon_get_min_stack(char* name, uint32_t* hwm)
+{
+	int min_i = -1;
+	
+	portENTER_CRITICAL(&mon_mux);
+	for (int i=0; i<task_info_num; i++) {
+		if ((min_i < 0) || (task_info[i].stack_hwm < task_info[min_i].stack_hwm)) {
+			min_i = i;
+		}
+	}
+	if (min_i >= 0) {
+		strcpy(name, task_info[min_i].name);
+		*hwm = task_info[min_i].stack_hwm;
+	}
+	portEXIT_CRITICAL(&mon_mux);
+	
+	return (min_i >= 0);
+}
+
+
+
+//
+// Internal functions
+//
+static void _mon_sample()
+{
+	bool found;
+	int n;
+	int idle_load[MON_NUM_CORES];
+	uint32_t ticks[MON_NUM_FREQS];
+	uint32_t total_ticks = 0;
+	uint32_t dt;
+	uint32_t delta;
+	uint32_t total_time;
+	TaskHandle_t idle_handle[MON_NUM_CORES];
+	BaseType_t core;
+	mon_heap_info_t heap;
+	
+	n = uxTaskGetSystemState(task_status, MON_MAX_TASKS, &total_time);
+	if (n == 0) {
+		ESP_LOGE(TAG, "More than %d tasks", MON_MAX_TASKS);
+		return;
+	}
+	
+	for (int c=0; c<MON_NUM_CORES; c++) {
+		idle_handle[c] = xTaskGetIdleTaskHandleForCore(c);
+		idle_load[c] = -1;
+	}
+	
+	heap.int_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+	heap.int_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+	heap.int_largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+	heap.psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+	heap.psram_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
+	
+	// Stack sizes are in bytes on this port
+	for (int i=0; i<n; i++) {
+		if (task_status[i].usStackHighWaterMark < MON_STACK_WARN_BYTES) {
+			ESP_LOGW(TAG, "%s stack high-water %lu bytes", task_status[i].pcTaskName,
+			         (uint32_t) task_status[i].usStackHighWaterMark);
+		}
+	}
+	
+	// Counters are 32-bit uSec so unsigned differences survive the wrap
+	dt = total_time - prev_total_time;
+	
+	portENTER_CRITICAL(&mon_mux);
+	heap_info = heap;
+	heap_info_valid = true;
+	for (int i=0; i<MON_NUM_FREQS; i++) {
+		ticks[i] = freq_ticks[i];
+		freq_ticks[i] = 0;
+		total_ticks += ticks[i];
+	}
+	if (total_ticks != 0) {
+		for (int i=0; i<MON_NUM_FREQS; i++) {
+			freq_residency[i] = (int) (((uint64_t) ticks[i] * 100) / total_ticks);
+		}
+	}
+	portEXIT_CRITICAL(&mon_mux);
+	
+	if (prev_valid && (dt != 0)) {
+		portENTER_CRITICAL(&mon_mux);
+		for (int i=0; i<n; i++) {
+			delta = task_status[i].ulRunTimeCounter - _mon_prev_run_time(task_status[i].xHandle, &found);
+			if (!found) delta = 0;
+			
+			strncpy(task_info[i].name, task_status[i].pcTaskName, MON_TASK_NAME_LEN - 1);
+			task_info[i].name[MON_TASK_NAME_LEN - 1] = 0;
+			core = xTaskGetCoreID(task_status[i].xHandle);
+			task_info[i].core = (core == tskNO_AFFINITY) ? MON_CORE_ANY : (int8_t) core;
+			task_info[i].priority = (uint8_t) task_status[i].uxCurrentPriority;
+			task_info[i].load_pct10 = (uint16_t) (((uint64_t) delta * 1000) / dt);
+			task_info[i].stack_hwm = (uint32_t) task_status[i].usStackHighWaterMark;
+			
+			for (int c=0; c<MON_NUM_CORES; c++) {
+				if (task_status[i].xHandle == idle_handle[c]) {
+					idle_load[c] = 100 - (int) (((uint64_t) delta * 100) / dt);
+				}
+			}
+		}
+		task_info_num = n;
+		for (int c=0; c<MON_NUM_CORES; c++) {
+			core_load[c] = (idle_load[c] < 0) ? 0 : idle_load[c];
+		}
+		portEXIT_CRITICAL(&mon_mux);
+	}
+	
+	// Save this sample as the reference for the next one
+	for (int i=0; i<n; i++) {
+		prev_handle[i] = task_status[i].xHandle;
+		prev_run_time[i] = task_status[i].ulRunTimeCounter;
+	}
+	prev_num_tasks = n;
+	prev_total_time = total_time;
+	prev_valid = true;
+}
+
+
+static uint32_t _mon_prev_run_time(TaskHandle_t h, bool* found)
+{
+	for (int i=0; i<prev_num_tasks; i++) {
+		if (prev_handle[i] == h) {
+			*found = true;
+			return prev_run_time[i];
+		}
+	}
+	
+	*found = false;
+	return 0;
+}
+
+
+static void _mon_log()
+{
+	int n;
+	mon_heap_info_t heap;
+	static mon_task_info_t info[MON_MAX_TASKS];
+	
+	n = mon_get_task_info(info, MON_MAX_TASKS);
+	if (n == 0) return;
+	
+	ESP_LOGI(TAG, "CPU0 %d%%  CPU1 %d%%", mon_get_core_load(0), mon_get_core_load(1));
+	ESP_LOGI(TAG, "240 MHz %d%%  160 MHz %d%%  80 MHz %d%%", mon_get_freq_residency(240),
+	         mon_get_freq_residency(160), mon_get_freq_residency(80));
+	for (int i=0; i<n; i++) {
+		ESP_LOGI(TAG, "  %-16s %c  P%-2u %3u.%u%%  stack free %lu", info[i].name,
+		         (info[i].core == MON_CORE_ANY) ? '-' : '0' + info[i].core,
+		         info[i].priority, info[i].load_pct10 / 10, info[i].load_pct10 % 10,
+		         info[i].stack_hwm);
+	}
+	
+	if (mon_get_heap_info(&heap)) {
+		ESP_LOGI(TAG, "Internal heap free %lu (min %lu, largest %lu)  PSRAM free %lu (min %lu)",
+		         heap.int_free, heap.int_min_free, heap.int_largest, heap.psram_free, heap.psram_min_free);
+	}
+}
+
+
+// Runs in the tick interrupt on CPU 0 (both cores always run at the same frequency)
+static void _mon_tick_hook()
+{
+	int i;
+	int mhz = esp_clk_cpu_freq() / 1000000;
+	
+	for (i=0; i<(MON_NUM_FREQS-1); i++) {
+		if (mhz >= freq_mhz[i]) break;
+	}
+	
+	portENTER_CRITICAL_ISR(&mon_mux);
+	freq_ticks[i]++;
+	portEXIT_CRITICAL_ISR(&mon_mux);
+}
@@ -0,0 +1,100 @@
+/*
+ * System Monitor Task
+ *
+ * Periodically sample the FreeRTOS run-time statistics to compute per-task and per-core
+ * CPU usage, task stack high-water marks and heap minimum-ever-free levels.  Also writes
+ * the deferred log records from hot paths (dlog_utilities) to the console at low priority
+ * and makes the diagnostics snapshot (diag_server) available when WiFi is running.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef MON_TASK_H
+#define MON_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+
+
+//
+// System Monitor Task Constants
+//
+
+// Run-time statistics sample period
+#define MON_SAMPLE_MSEC         5000
+
+// Deferred log flush period (a divisor of MON_SAMPLE_MSEC)
+#define MON_DLOG_MSEC           250
+
+// Period the per-task table is written to the log (0 to disable)
+#define MON_LOG_MSEC            30000
+
+// Maximum number of tasks tracked
+#define MON_MAX_TASKS           32
+
+// Length of the task names kept
+#define MON_TASK_NAME_LEN       16
+
+// Core value for tasks without affinity
+#define MON_CORE_ANY            -1
+
+// A warning is logged when a task's unused stack falls below this many bytes
+#define MON_STACK_WARN_BYTES    512
+
+
+
+//
+// System Monitor Task typedefs
+//
+typedef struct {
+	char name[MON_TASK_NAME_LEN];
+	int8_t core;                          // 0, 1 or MON_CORE_ANY
+	uint8_t priority;
+	uint16_t load_pct10;                  // Percent of one core * 10 over the last sample period
+	uint32_t stack_hwm;                   // Minimum unused stack (bytes) since the task started
+} mon_task_info_t;
+
+typedef struct {
+	uint32_t int_free;                    // Internal RAM
+	uint32_t int_min_free;                // Minimum ever free
+	uint32_t int_largest;                 // Largest free block
+	uint32_t psram_free;
+	uint32_t psram_min_free;
+} mon_heap_info_t;
+
+
+
+//
+// System Monitor Task externally accessible variables
+//
+extern TaskHandle_t task_handle_mon;
+
+
+
+//
+// API
+//
+void mon_task();
+int mon_get_core_load(int core);                      // Percent, -1 until two samples taken
+int mon_get_task_info(mon_task_info_t* list, int max); // Returns number of entries copied
+bool mon_get_heap_info(mon_heap_info_t* info);         // Returns false until the first sample
+bool mon_get_min_stack(char* name, uint32_t* hwm);     // Task with the least unused stack
+int mon_get_freq_residency(int mhz);                   // Percent of time at 240, 160 or 80 MHz, -1 until sampled
+
+#endif /* MON_TASK_H */
@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+#
+# Compress a firmware image for an over-the-air update and optionally send it.
+#
+# Usage: ota_pack.py [-t <token>] <ev_info_display.bin> <output.evz> [<device ip> ...]
+#
+# The image is compressed in the LZ stream format of lz_utilities.h behind a
+# small header (see ota_update.h) so the device decodes it straight into its
+# inactive OTA slot as it arrives.  The encoder searches much harder for
+# matches than the one the logger runs so it takes a little while on a full
+# image.  Each device given is sent the packed image with a POST to its
+# /ota URI (the device must be parked with updates enabled) carrying the
+# device's WIFI_HTTP_TOKEN (wifi_utilities.h).  The same may be done with e.g.
+# "curl -H 'X-Auth-Token: <token>' --data-binary @<output.evz> http://<device ip>/ota".
+# Only the Python standard library is used.
+#
+# Copyright 2025 Dan Julio
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# It is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software.  If not, see <https://www.gnu.org/licenses/>.
+#
+import struct
+import sys
+import urllib.request
+
+OTA_MAGIC = 0x5A4F5645          # "EVOZ"
+HDR_FMT = '<II'
+
+# LZ stream format (lz_utilities.h)
+LZ_WINDOW_LEN = 1024
+LZ_MIN_MATCH = 3
+LZ_MAX_MATCH = 66
+LZ_LEN_SHIFT = 10
+
+# Candidates examined for each position
+MAX_CHAIN = 48
+
+# Device response wait (it is flashing while the image arrives)
+SEND_TIMEOUT_SEC = 120
+
+# Header carrying the shared token (WIFI_HTTP_TOKEN_HDR)
+TOKEN_HDR = 'X-Auth-Token'
+
+
+def find_match(data, pos, chains):
+    """Returns (length, distance) of the longest match for pos in the window."""
+    best_len = 0
+    best_dist = 0
+    limit = min(LZ_MAX_MATCH, len(data) - pos)
+    if limit < LZ_MIN_MATCH:
+        return 0, 0
+    for cand in reversed(chains.get(data[pos:pos + LZ_MIN_MATCH], [])[-MAX_CHAIN:]):
+        dist = pos - cand
+        if dist > LZ_WINDOW_LEN:
+            break
+        n = LZ_MIN_MATCH
+        while n < limit and data[cand + n] == data[pos + n]:
+            n += 1
+        if n > best_len:
+            best_len = n
+            best_dist = dist
+            if n == limit:
+                break
+    return best_len, best_dist
+
+
+def lz_encode(data):
+    out = bytearray()
+    items = []
+    chains = {}
+
+    def insert(p):
+        key = data[p:p + LZ_MIN_MATCH]
+        if len(key) == LZ_MIN_MATCH:
+            lst = chains.setdefault(key, [])
+            lst.append(p)
+            if len(lst) > 2 * MAX_CHAIN:
+                del lst[:MAX_CHAIN]
+
+    pos = 0
+    while pos < len(data):
+        length, dist = find_match(data, pos, chains)
+
+        # One step lazy evaluation: emit a literal if the next position matches longer
+        if length >= LZ_MIN_MATCH and length < LZ_MAX_MATCH:
+            insert(pos)
+            next_len, _ = find_match(data, pos + 1, chains)
+            if next_len > length:
+                items.append((False, data[pos]))
+                pos += 1
+                continue
+            for p in range(pos + 1, pos + length):
+                insert(p)
+        elif length >= LZ_MIN_MATCH:
+            for p in range(pos, pos + length):
+                insert(p)
+        else:
+            insert(pos)
+
+        if length >= LZ_MIN_MATCH:
+            items.append((True, ((length - LZ_MIN_MATCH) << LZ_LEN_SHIFT) | (dist - 1)))
+            pos += length
+        else:
+            items.append((False, data[pos]))
+            pos += 1
+
+    for i in range(0, len(items), 8):
+        group = items[i:i + 8]
+        flags = 0
+        body = bytearray()
+        for n, (match, v) in enumerate(group):
+            if match:
+                flags |= 1 << n
+                body += struct.pack('<H', v)
+            else:
+                body.append(v)
+        out.append(flags)
+        out += body
+
+    return bytes(out)
+
+
+def lz_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        flags = data[i]
+        i += 1
+        for n in range(8):
+            if i >= len(data):
+                break
+            if flags & (1 << n):
+                w = data[i] | (data[i + 1] << 8)
+                i += 2
+                dist = (w & (LZ_WINDOW_LEN - 1)) + 1
+                for _ in range((w >> LZ_LEN_SHIFT) + LZ_MIN_MATCH):
+                    out.append(out[-dist])
+            else:
+                out.append(data[i])
+                i += 1
+    return bytes(out)
+
+
+def send(packed, addr, token):
+    req = urllib.request.Request('http://%s/ota' % addr, data=packed, method='POST',
+                                 headers={'Content-Type': 'application/octet-stream',
+                                          TOKEN_HDR: token})
+    try:
+        with urllib.request.urlopen(req, timeout=SEND_TIMEOUT_SEC) as rsp:
+            print('%s: %s' % (addr, rsp.read().decode(errors='replace').strip()))
+            return True
+    except Exception as e:
+        print('%s: failed - %s' % (addr, e))
+        return False
+
+
+def main():
+    args = sys.argv[1:]
+    token = ''
+    if len(args) >= 2 and args[0] == '-t':
+        token = args[1]
+        args = args[2:]
+    if len(args) < 2 or (len(args) > 2 and token == ''):
+        print('usage: ota_pack.py [-t <token>] <ev_info_display.bin> <output.evz> [<device ip> ...]')
+        print('       (the token is required to send)')
+        return 1
+
+    with open(args[0], 'rb') as f:
+        image = f.read()
+    if len(image) == 0 or image[0] != 0xE9:
+        print('%s is not an application image' % args[0])
+        return 1
+
+    stream = lz_encode(image)
+    if lz_decode(stream) != image:
+        print('internal error: compressed image does not decode')
+        return 1
+
+    packed = struct.pack(HDR_FMT, OTA_MAGIC, len(image)) + stream
+    with open(args[1], 'wb') as f:
+        f.write(packed)
+    print('%d -> %d bytes (%.0f%%)' % (len(image), len(packed), 100.0 * len(packed) / len(image)))
+
+    ok = True
+    for addr in args[2:]:
+        ok = send(packed, addr, token) and ok
+
+    return 0 if ok else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,305 @@
+/*
+ * Over-the-air firmware update
+ *
+ * The update handler streams the request body through the LZ decoder into a fixed size
+ * buffer that is written to the inactive OTA slot each time it fills so the image is
+ * never held in memory.  The slot is erased sector by sector as it is written.  The
+ * bootloader is only switched to the new slot after the complete image has been written
+ * and verified by esp_ota_end(), so a failed or interrupted update leaves the running
+ * firmware in place.  Nothing is written unless the request carries the shared HTTP token
+ * (wifi_utilities.h).
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "ota_update.h"
+
+#ifdef ENABLE_OTA
+
+#include "esp_app_format.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "lz_utilities.h"
+#include "vehicle_manager.h"
+#include "wifi_utilities.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+//
+// OTA Update variables
+//
+static const char* TAG = "ota_update";
+
+// Buffers (the server runs one handler at a time so one set serves all requests)
+static uint8_t* rx_bufP = NULL;
+static uint8_t* write_bufP;
+static lz_dec_t* decP;
+static int write_len;
+static uint32_t image_len;
+
+static esp_timer_handle_t restart_timer;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static esp_err_t _ota_update_handler(httpd_req_t* req);
+static const char* _ota_update_write(esp_ota_handle_t handle, bool compressed, const uint8_t* data, int len);
+static int _ota_update_recv(httpd_req_t* req, uint8_t* buf, int len, int* remainingP);
+static void _ota_update_restart_cb(void* arg);
+
+
+
+//
+// API
+//
+
+// Register the update URI.  Returns false if the HTTP server isn't available yet so the
+// caller can try again later.
+bool ota_update_init()
+{
+	const httpd_uri_t ota_uri = {
+		.uri = OTA_URI,
+		.method = HTTP_POST,
+		.handler = _ota_update_handler,
+		.user_ctx = NULL
+	};
+	const esp_timer_create_args_t restart_timer_args = {
+		.callback = &_ota_update_restart_cb,
+		.arg = NULL,
+		.name = "ota_restart"
+	};
+	httpd_handle_t server;
+	
+	if (rx_bufP == NULL) {
+		rx_bufP = heap_caps_malloc(OTA_RX_BUF_LEN + OTA_WRITE_LEN + sizeof(lz_dec_t), MALLOC_CAP_SPIRAM);
+		if (rx_bufP == NULL) {
+			ESP_LOGE(TAG, "Could not allocate buffers");
+			return false;
+		}
+		write_bufP = rx_bufP + OTA_RX_BUF_LEN;
+		decP = (lz_dec_t*) (write_bufP + OTA_WRITE_LEN);
+	
+		if (esp_timer_create(&restart_timer_args, &restart_timer) != ESP_OK) {
+			ESP_LOGE(TAG, "Could not create restart timer");
+			free(rx_bufP);
+			rx_bufP = NULL;
+			return false;
+		}
+	}
+	
+	if (!wifi_is_enabled() || ((server = wifi_get_http_server()) == NULL)) {
+		return false;
+	}
+	if (httpd_register_uri_handler(server, &ota_uri) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not register %s", OTA_URI);
+		return false;
+	}
+	
+	ESP_LOGI(TAG, "Running from %s", esp_ota_get_running_partition()->label);
+	return true;
+}
+
+
+
+//
+// Internal functions
+//
+static esp_err_t _ota_update_handler(httpd_req_t* req)
+{
+	const esp_partition_t* partP;
+	esp_ota_handle_t handle;
+	esp_app_desc_t desc;
+	ota_hdr_t hdr;
+	bool compressed;
+	const char* err = NULL;
+	int remaining = req->content_len;
+	int len, n;
+	int64_t start_usec = esp_timer_get_time();
+	esp_err_t ret;
+	char rsp[48];
+	
+	// Only accept firmware from the holder of the shared token
+	if (!wifi_http_authorized(req)) {
+		ESP_LOGW(TAG, "Rejected unauthorized update");
+		httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, "Not authorized");
+		return ESP_FAIL;
+	}
+	
+	// Never restart under a driver
+	if (!vm_is_asleep()) {
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Vehicle not parked");
+		return ESP_FAIL;
+	}
+	
+	partP = esp_ota_get_next_update_partition(NULL);
+	if (partP == NULL) {
+		// Built with the single application partitions.csv instead of partitions_ota.csv
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No OTA partition");
+		return ESP_FAIL;
+	}
+	
+	// The start of the body identifies a compressed or uncompressed image
+	len = 0;
+	while ((len < (int) sizeof(ota_hdr_t)) && (remaining > 0)) {
+		n = _ota_update_recv(req, &rx_bufP[len], sizeof(ota_hdr_t) - len, &remaining);
+		if (n < 0) {
+			httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Receive failed");
+			return ESP_FAIL;
+		}
+		len += n;
+	}
+	memcpy(&hdr, rx_bufP, sizeof(ota_hdr_t));
+	compressed = (len == sizeof(ota_hdr_t)) && (hdr.magic == OTA_MAGIC);
+	if (!compressed && ((len == 0) || (rx_bufP[0] != ESP_IMAGE_HEADER_MAGIC))) {
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Not a firmware image");
+		return ESP_FAIL;
+	}
+	if (compressed) {
+		if (hdr.raw_len > partP->size) {
+			httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Image too large");
+			return ESP_FAIL;
+		}
+		image_len = hdr.raw_len;
+		len = 0;
+		lz_dec_begin(decP);
+	}
+	
+	ret = esp_ota_begin(partP, OTA_WITH_SEQUENTIAL_WRITES, &handle);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "esp_ota_begin failed - %d", ret);
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Could not start update");
+		return ESP_FAIL;
+	}
+	ESP_LOGI(TAG, "Writing %s image to %s", compressed ? "compressed" : "uncompressed", partP->label);
+	
+	// Flash the body as it arrives
+	write_len = 0;
+	while ((err == NULL) && ((len > 0) || (remaining > 0))) {
+		if (len == 0) {
+			len = _ota_update_recv(req, rx_bufP, (remaining < OTA_RX_BUF_LEN) ? remaining : OTA_RX_BUF_LEN, &remaining);
+			if (len < 0) {
+				err = "Receive failed";
+				break;
+			}
+		}
+		err = _ota_update_write(handle, compressed, rx_bufP, len);
+		len = 0;
+	}
+	
+	// Write the partial last buffer and check the complete image arrived
+	if ((err == NULL) && (write_len != 0) && (esp_ota_write(handle, write_bufP, write_len) != ESP_OK)) {
+		err = "Flash write failed";
+	}
+	if ((err == NULL) && compressed && (!lz_dec_idle(decP) || (lz_dec_raw_len(decP) != hdr.raw_len))) {
+		err = "Truncated image";
+	}
+	if (err != NULL) {
+		ESP_LOGE(TAG, "Update failed - %s", err);
+		esp_ota_abort(handle);
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, err);
+		return ESP_FAIL;
+	}
+	
+	ret = esp_ota_end(handle);
+	if (ret == ESP_OK) {
+		ret = esp_ota_set_boot_partition(partP);
+	}
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Image not accepted - %d", ret);
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+		                    (ret == ESP_ERR_OTA_VALIDATE_FAILED) ? "Invalid image" : "Could not set boot partition");
+		return ESP_FAIL;
+	}
+	
+	if (esp_ota_get_partition_description(partP, &desc) != ESP_OK) {
+		strcpy(desc.version, "?");
+	}
+	ESP_LOGI(TAG, "Updated to %s from %d bytes in %d mSec", desc.version, (int) req->content_len,
+	         (int) ((esp_timer_get_time() - start_usec) / 1000));
+	snprintf(rsp, sizeof(rsp), "OK %s\n", desc.version);
+	httpd_resp_sendstr(req, rsp);
+	
+	// Let the response go out before restarting
+	esp_timer_start_once(restart_timer, OTA_RESTART_DELAY_MSEC * 1000);
+	
+	return ESP_OK;
+}
+
+
+// Decode (if necessary) and flash received data.  Returns NULL or an error description.
+static const char* _ota_update_write(esp_ota_handle_t handle, bool compressed, const uint8_t* data, int len)
+{
+	int used, n;
+	
+	if (!compressed) {
+		return (esp_ota_write(handle, data, len) == ESP_OK) ? NULL : "Flash write failed";
+	}
+	
+	// Continue until the data is used up and a match it ends with is completely output
+	do {
+		n = lz_dec_run(decP, data, len, &used, &write_bufP[write_len], OTA_WRITE_LEN - write_len);
+		if ((n < 0) || (lz_dec_raw_len(decP) > image_len)) {
+			return "Corrupt image";
+		}
+		data += used;
+		len -= used;
+		write_len += n;
+	
+		if (write_len == OTA_WRITE_LEN) {
+			if (esp_ota_write(handle, write_bufP, OTA_WRITE_LEN) != ESP_OK) {
+				return "Flash write failed";
+			}
+			write_len = 0;
+		}
+	} while ((len > 0) || (n > 0));
+	
+	return NULL;
+}
+
+
+// Receive up to len bytes of the body, retrying timeouts.  Returns the length received or
+// -1 if the connection failed.
+static int _ota_update_recv(httpd_req_t* req, uint8_t* buf, int len, int* remainingP)
+{
+	int n;
+	
+	do {
+		n = httpd_req_recv(req, (char*) buf, len);
+	} while (n == HTTPD_SOCK_ERR_TIMEOUT);
+	
+	if (n <= 0) {
+		return -1;
+	}
+	*remainingP -= n;
+	return n;
+}
+
+
+static void _ota_update_restart_cb(void* arg)
+{
+	ESP_LOGI(TAG, "Restarting");
+	esp_restart();
+}
+
+#endif /* ENABLE_OTA */
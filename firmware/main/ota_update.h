@@ -0,0 +1,77 @@
+/*
+ * Over-the-air firmware update
+ *
+ * Receive a new application image over WiFi and write it into the inactive OTA slot as it
+ * arrives, then boot it.  Images are normally sent compressed by main/ota_pack.py.  Only
+ * accepted while the vehicle is asleep.  Included when ENABLE_OTA is defined.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// OTA Update Constants
+//
+
+// Uncomment to accept firmware updates over the depot network
+//   Note: the update URI is registered by upload_task so ENABLE_UPLOAD must also be defined.
+//   Requires the partitions_ota.csv partition table (CONFIG_PARTITION_TABLE_CUSTOM_FILENAME)
+//   and WIFI_HTTP_TOKEN (wifi_utilities.h) set, sent by clients in WIFI_HTTP_TOKEN_HDR.
+//#define ENABLE_OTA
+
+// Update URI (refused with 401 without the WIFI_HTTP_TOKEN_HDR header)
+//   POST OTA_URI  (octet-stream body: an ota_hdr_t followed by the image compressed in the
+//                  lz_utilities stream format, or the uncompressed image)
+//     200 response body: "OK <new version>" and the device restarts into the new image
+#define OTA_URI                 "/ota"
+
+// Compressed image header magic ("EVOZ")
+#define OTA_MAGIC               0x5A4F5645
+
+// Received data and decoded image buffer lengths (the image is flashed OTA_WRITE_LEN at a time)
+#define OTA_RX_BUF_LEN          4096
+#define OTA_WRITE_LEN           4096
+
+// Delay after responding before restarting into the new image
+#define OTA_RESTART_DELAY_MSEC  1000
+
+
+
+//
+// OTA Update typedefs
+//
+
+// Compressed image header (little endian)
+typedef struct {
+	uint32_t magic;
+	uint32_t raw_len;                    // Length of the decoded image
+} ota_hdr_t;
+
+
+
+//
+// OTA Update API
+//
+bool ota_update_init();
+
+#endif /* OTA_UPDATE_H */
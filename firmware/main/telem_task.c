@@ -0,0 +1,241 @@
+/*
+ * Telemetry Task
+ *
+ * Stream data broker items over WiFi as compact UDP datagrams to a laptop or phone during
+ * test drives.  The task is a broker subscriber that collects the items updated each batch
+ * period (the broker coalesces repeated updates to the latest value) and encodes them
+ * directly into an lwIP pbuf which is handed to the TCP/IP thread to send, so the data is
+ * never copied through a socket buffer.  A byte budget limits the stream: when it runs
+ * out updates simply wait (and coalesce) in the broker.  Only included when
+ * ENABLE_TELEMETRY is defined.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "telem_task.h"
+
+#ifdef ENABLE_TELEMETRY
+
+#include "data_broker.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcpip.h"
+#include "lwip/udp.h"
+#include "vehicle_manager.h"
+#include "wifi_utilities.h"
+#include <string.h>
+
+
+//
+// Telemetry Task constants
+//
+
+// Largest datagram (every item updated in one batch)
+#define TELEM_MAX_DGRAM_LEN     (sizeof(telem_pkt_hdr_t) + DB_NUM_ITEMS * sizeof(telem_record_t))
+
+// Period the set of streamed items is re-evaluated (on-board items appear after startup)
+#define TELEM_ITEM_CHECK_MSEC   1000
+
+
+
+//
+// Telemetry Task variables
+//
+static const char* TAG = "telem_task";
+
+// Task handle
+TaskHandle_t task_handle_telem;
+
+static int telem_sub = -1;
+static db_mask_t telem_cur_mask = 0;
+
+// Only accessed from the TCP/IP thread
+static struct udp_pcb* telem_pcb = NULL;
+
+// Datagram being built
+static struct pbuf* cur_pbuf;
+static uint32_t cur_ts_msec;
+static int cur_count;
+
+static uint16_t seq = 0;
+static int32_t budget_bytes = TELEM_MAX_BYTES_PER_SEC;
+static uint32_t drop_count = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _telem_update_items();
+static void _telem_send_batch();
+static void _telem_item_handler(int item, float val, int64_t ts_usec);
+static void _telem_send_cb(void* ctx);
+
+
+
+//
+// API
+//
+void telem_task()
+{
+	int check_count = 0;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	if (!wifi_is_enabled() && !wifi_init()) {
+		ESP_LOGE(TAG, "Could not start WiFi");
+		vTaskDelete(NULL);
+	}
+	
+	telem_sub = db_add_subscriber(0, _telem_item_handler);
+	if (telem_sub < 0) {
+		ESP_LOGE(TAG, "No broker subscriber available");
+		vTaskDelete(NULL);
+	}
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		db_set_subscriber_filter(telem_sub, i, 0, TELEM_MIN_INTERVAL_MSEC);
+	}
+	
+	while (1) {
+		vTaskDelay(pdMS_TO_TICKS(TELEM_BATCH_MSEC));
+		
+		if (check_count-- == 0) {
+			check_count = TELEM_ITEM_CHECK_MSEC / TELEM_BATCH_MSEC;
+			_telem_update_items();
+		}
+		
+		// Refill the budget
+		budget_bytes += (TELEM_MAX_BYTES_PER_SEC * TELEM_BATCH_MSEC) / 1000;
+		if (budget_bytes > TELEM_MAX_BYTES_PER_SEC) {
+			budget_bytes = TELEM_MAX_BYTES_PER_SEC;
+		}
+		
+		if ((budget_bytes >= (int32_t) TELEM_MAX_DGRAM_LEN) && db_subscriber_has_updates(telem_sub)) {
+			_telem_send_batch();
+		}
+	}
+}
+
+
+
+//
+// Internal functions
+//
+
+// Stream all items available (including derived and on-board items)
+static void _telem_update_items()
+{
+	db_mask_t mask;
+	
+	mask = vm_get_supported_item_mask();
+	if (mask != telem_cur_mask) {
+		telem_cur_mask = mask;
+		db_set_subscriber_items(telem_sub, mask);
+	}
+}
+
+
+static void _telem_send_batch()
+{
+	telem_pkt_hdr_t* hP;
+	int len;
+	
+	if (!wifi_is_enabled()) {
+		return;
+	}
+	
+	cur_pbuf = pbuf_alloc(PBUF_TRANSPORT, TELEM_MAX_DGRAM_LEN, PBUF_RAM);
+	if (cur_pbuf == NULL) {
+		drop_count++;
+		return;
+	}
+	cur_ts_msec = (uint32_t) (esp_timer_get_time() / 1000);
+	cur_count = 0;
+	
+	// Records are encoded in place by the handler
+	db_subscriber_eval(telem_sub);
+	if (cur_count == 0) {
+		pbuf_free(cur_pbuf);
+		return;
+	}
+	
+	hP = (telem_pkt_hdr_t*) cur_pbuf->payload;
+	hP->magic = TELEM_MAGIC;
+	hP->version = TELEM_VERSION;
+	hP->count = (uint8_t) cur_count;
+	hP->seq = seq++;
+	hP->ts_msec = cur_ts_msec;
+	len = sizeof(telem_pkt_hdr_t) + cur_count * sizeof(telem_record_t);
+	pbuf_realloc(cur_pbuf, len);
+	
+	// The TCP/IP thread sends and frees the pbuf
+	if (tcpip_callback(_telem_send_cb, cur_pbuf) != ERR_OK) {
+		pbuf_free(cur_pbuf);
+		if ((drop_count++ % 100) == 0) {
+			ESP_LOGW(TAG, "Send queue full (%lu)", drop_count);
+		}
+		return;
+	}
+	budget_bytes -= len;
+}
+
+
+// Broker subscriber handler - add one record to the datagram
+static void _telem_item_handler(int item, float val, int64_t ts_usec)
+{
+	telem_record_t* rP;
+	int32_t dt;
+	
+	if ((item >= DB_NUM_ITEMS) || (cur_count >= DB_NUM_ITEMS)) {
+		return;
+	}
+	
+	dt = (int32_t) ((uint32_t) (ts_usec / 1000) - cur_ts_msec);
+	if (dt < INT16_MIN) dt = INT16_MIN;
+	if (dt > INT16_MAX) dt = INT16_MAX;
+	
+	rP = (telem_record_t*) ((uint8_t*) cur_pbuf->payload + sizeof(telem_pkt_hdr_t) + cur_count * sizeof(telem_record_t));
+	rP->item = (uint8_t) item;
+	rP->quality = (uint8_t) db_get_item_quality(item);
+	rP->dt_msec = (int16_t) dt;
+	rP->val = val;
+	cur_count++;
+}
+
+
+// Runs in the TCP/IP thread
+static void _telem_send_cb(void* ctx)
+{
+	struct pbuf* p = (struct pbuf*) ctx;
+	
+	if (telem_pcb == NULL) {
+		telem_pcb = udp_new();
+		if (telem_pcb != NULL) {
+			ip_set_option(telem_pcb, SOF_BROADCAST);
+		}
+	}
+	
+	if (telem_pcb != NULL) {
+		(void) udp_sendto(telem_pcb, p, IP_ADDR_BROADCAST, TELEM_UDP_PORT);
+	}
+	pbuf_free(p);
+}
+
+#endif /* ENABLE_TELEMETRY */
@@ -0,0 +1,91 @@
+/*
+ * Telemetry Task
+ *
+ * Stream data broker items over WiFi as compact UDP datagrams
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef TELEM_TASK_H
+#define TELEM_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+
+
+//
+// Telemetry Task Constants
+//
+
+// Uncomment to stream broker items over WiFi
+//#define ENABLE_TELEMETRY
+
+// Destination (broadcast on the WiFi network so any listener receives it)
+#define TELEM_UDP_PORT          5555
+
+// Updated items are batched into one datagram per period (matches the GUI's longest wait)
+#define TELEM_BATCH_MSEC        50
+
+// Each item is sent no more often than this
+#define TELEM_MIN_INTERVAL_MSEC 100
+
+// Bandwidth budget (bytes/sec) so streaming never competes with the ELM327 socket
+#define TELEM_MAX_BYTES_PER_SEC 4096
+
+// Datagram format (little endian)
+//   Header: telem_pkt_hdr_t
+//   count records: telem_record_t (item time relative to the header ts_msec)
+#define TELEM_MAGIC             0x7E1E
+#define TELEM_VERSION           1
+
+
+
+//
+// Telemetry Task typedefs
+//
+typedef struct {
+	uint16_t magic;
+	uint8_t version;
+	uint8_t count;
+	uint16_t seq;
+	uint32_t ts_msec;                    // esp_timer mSec (low 32 bits) when sent
+} __attribute__((packed)) telem_pkt_hdr_t;
+
+typedef struct {
+	uint8_t item;
+	uint8_t quality;
+	int16_t dt_msec;                     // Acquisition time - header ts_msec (<= 0)
+	float val;
+} __attribute__((packed)) telem_record_t;
+
+
+
+//
+// Telemetry Task externally accessible variables
+//
+extern TaskHandle_t task_handle_telem;
+
+
+
+//
+// API
+//
+void telem_task();
+
+#endif /* TELEM_TASK_H */
\ No newline at end of file
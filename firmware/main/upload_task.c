@@ -0,0 +1,369 @@
+/*
+ * Upload Task
+ *
+ * Forward completed trip logs from the flash log partition to a depot server over HTTP
+ * while the vehicle is parked on the depot's WiFi.  The task wakes periodically and only
+ * does anything while the vehicle manager considers the vehicle asleep and the station
+ * interface is connected, so it never competes with vehicle polling.  Trips are sent
+ * oldest first in UPLOAD_CHUNK_LEN POSTs.  The server reports how much of each file it
+ * holds so an upload interrupted by the vehicle waking, a lost connection or a reboot
+ * resumes where it stopped.  The server may unpack the trips with main/log_decode.py.
+ * The task also makes the firmware update URI available on the depot network when
+ * ENABLE_OTA is defined.  Only included when ENABLE_UPLOAD is defined.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "upload_task.h"
+
+#ifdef ENABLE_UPLOAD
+
+#include "can_manager.h"
+#include "esp_heap_caps.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "ota_update.h"
+#include "ps_utilities.h"
+#include "vehicle_manager.h"
+#include "wifi_utilities.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+
+//
+// Upload Task constants
+//
+
+// Result of trying to upload a trip
+#define UPLOAD_RES_NONE     0         // Nothing to upload
+#define UPLOAD_RES_DONE     1         // A trip was completely uploaded
+#define UPLOAD_RES_STOPPED  2         // No longer parked on the depot network
+#define UPLOAD_RES_ERROR    3
+
+// Longest request URL
+#define UPLOAD_URL_MAX_LEN  (sizeof(UPLOAD_URL) + 64)
+
+
+
+//
+// Upload Task variables
+//
+static const char* TAG = "upload_task";
+
+// Task handle
+TaskHandle_t task_handle_upload;
+
+static char dev_id[13];
+static uint8_t* chunk_bufP;
+static char url_buf[UPLOAD_URL_MAX_LEN];
+static char rsp_buf[UPLOAD_RSP_MAX_LEN+1];
+
+// Connection kept open between requests
+static esp_http_client_handle_t client = NULL;
+
+// Trips the server already holds completely (number and length) so they aren't asked about again
+static int done_trip[UPLOAD_MAX_TRIPS];
+static long done_len[UPLOAD_MAX_TRIPS];
+static int num_done = 0;
+
+#ifdef ENABLE_OTA
+static bool ota_registered = false;
+#endif
+
+
+
+//
+// Forward declarations for internal functions
+//
+static bool _upload_ready();
+static int _upload_next_trip();
+static int _upload_trip(int trip, long len);
+static long _upload_request(const char* file, long offset, const uint8_t* data, int len);
+static bool _upload_is_done(int trip, long len);
+static void _upload_note_done(int trip, long len);
+
+
+
+//
+// API
+//
+void upload_task()
+{
+	main_config_t* main_configP;
+	net_config_t* net_configP;
+	uint8_t mac[6];
+	uint32_t wait_msec = UPLOAD_EVAL_MSEC;
+	int res;
+	
+	ESP_LOGI(TAG, "Start task");
+	
+	if (!ps_get_config(PS_CONFIG_TYPE_MAIN, (void**) &main_configP) ||
+	    !ps_get_config(PS_CONFIG_TYPE_NET, (void**) &net_configP)) {
+		ESP_LOGE(TAG, "Get configuration failed");
+		vTaskDelete(NULL);
+	}
+	
+	// The depot network is the configured station network (auto selection may pick the
+	// WiFi adapter)
+	if (!net_configP->sta_mode || (main_configP->connection_index == CAN_MANAGER_IF_WIFI) ||
+#ifdef CAN_MANAGER_EN_ELM327_PAIR
+	    (main_configP->connection_index == CAN_MANAGER_IF_ELM327_PAIR) ||
+#endif
+	    (main_configP->connection_index == CAN_MANAGER_IF_AUTO)) {
+		ESP_LOGW(TAG, "Station WiFi not available for uploads");
+		vTaskDelete(NULL);
+	}
+	
+	chunk_bufP = heap_caps_malloc(UPLOAD_CHUNK_LEN, MALLOC_CAP_SPIRAM);
+	if (chunk_bufP == NULL) {
+		ESP_LOGE(TAG, "Could not allocate chunk buffer");
+		vTaskDelete(NULL);
+	}
+	
+	if (!wifi_is_enabled() && !wifi_init()) {
+		ESP_LOGE(TAG, "Could not start WiFi");
+		vTaskDelete(NULL);
+	}
+	
+	(void) esp_efuse_mac_get_default(mac);
+	sprintf(dev_id, "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+	
+	while (1) {
+		vTaskDelay(pdMS_TO_TICKS(wait_msec));
+		wait_msec = UPLOAD_EVAL_MSEC;
+		
+#ifdef ENABLE_OTA
+		// The HTTP server may not be up the first time
+		if (!ota_registered) {
+			ota_registered = ota_update_init();
+		}
+#endif
+		
+		// Send everything waiting while we're parked at the depot
+		res = UPLOAD_RES_DONE;
+		while (_upload_ready() && (res == UPLOAD_RES_DONE)) {
+			res = _upload_next_trip();
+		}
+		
+		// Don't hold a connection between checks (and retry a server error after a while)
+		if (client != NULL) {
+			esp_http_client_cleanup(client);
+			client = NULL;
+		}
+		if (res == UPLOAD_RES_ERROR) {
+			wait_msec = UPLOAD_RETRY_MSEC;
+		}
+	}
+}
+
+
+
+//
+// Internal functions
+//
+
+// Parked (the vehicle manager has seen the vehicle go to sleep) and on the depot network
+static bool _upload_ready()
+{
+	return vm_is_asleep() && wifi_is_connected();
+}
+
+
+// Upload the oldest complete trip the server doesn't already hold
+static int _upload_next_trip()
+{
+	DIR* dirP;
+	struct dirent* entP;
+	struct stat st;
+	char name[24];
+	int open_trip;
+	int trip = -1;
+	long len = 0;
+	int n;
+	
+	dirP = opendir(LOG_BASE_PATH);
+	if (dirP == NULL) {
+		return UPLOAD_RES_NONE;
+	}
+	
+	open_trip = log_get_open_trip();
+	while ((entP = readdir(dirP)) != NULL) {
+		if ((entP->d_name[0] == 'T') && (sscanf(&entP->d_name[1], "%d", &n) == 1) && (n != open_trip)) {
+			sprintf(name, LOG_TRIP_FMT, n);
+			if ((stat(name, &st) == 0) && !_upload_is_done(n, (long) st.st_size) && ((trip == -1) || (n < trip))) {
+				trip = n;
+				len = (long) st.st_size;
+			}
+		}
+	}
+	closedir(dirP);
+	
+	if (trip == -1) {
+		return UPLOAD_RES_NONE;
+	}
+	
+	return _upload_trip(trip, len);
+}
+
+
+static int _upload_trip(int trip, long len)
+{
+	char name[24];
+	const char* file;
+	FILE* fp;
+	long offset;
+	long next;
+	int n;
+	int res = UPLOAD_RES_DONE;
+	
+	sprintf(name, LOG_TRIP_FMT, trip);
+	file = &name[sizeof(LOG_BASE_PATH)];
+	
+	// Where the server is
+	offset = _upload_request(file, -1, NULL, 0);
+	if (offset < 0) {
+		return UPLOAD_RES_ERROR;
+	}
+	if (offset > len) {
+		// Not the same file (e.g. trip numbers restarted after the partition was cleared)
+		ESP_LOGW(TAG, "Server holds %ld bytes of %ld byte %s - skipping", offset, len, file);
+		_upload_note_done(trip, len);
+		return UPLOAD_RES_DONE;
+	}
+	
+	fp = fopen(name, "rb");
+	if (fp == NULL) {
+		// Deleted to make room since it was found
+		return UPLOAD_RES_DONE;
+	}
+	
+	if (offset < len) {
+		ESP_LOGI(TAG, "Uploading %s from %ld of %ld", file, offset, len);
+	}
+	while ((offset < len) && (res == UPLOAD_RES_DONE)) {
+		if (!_upload_ready()) {
+			res = UPLOAD_RES_STOPPED;
+			break;
+		}
+		
+		n = ((len - offset) > UPLOAD_CHUNK_LEN) ? UPLOAD_CHUNK_LEN : (int) (len - offset);
+		if ((fseek(fp, offset, SEEK_SET) != 0) || (fread(chunk_bufP, 1, n, fp) != n)) {
+			ESP_LOGE(TAG, "Read %s failed", file);
+			res = UPLOAD_RES_ERROR;
+			break;
+		}
+		
+		next = _upload_request(file, offset, chunk_bufP, n);
+		if (next <= offset) {
+			res = UPLOAD_RES_ERROR;
+		} else {
+			offset = next;
+		}
+	}
+	fclose(fp);
+	
+	if (res == UPLOAD_RES_DONE) {
+		ESP_LOGI(TAG, "Uploaded %s", file);
+		_upload_note_done(trip, len);
+	}
+	
+	return res;
+}
+
+
+// GET the length the server holds of file (offset < 0) or POST len bytes of it at offset.
+// Returns the server's length or -1 for an error.
+static long _upload_request(const char* file, long offset, const uint8_t* data, int len)
+{
+	esp_http_client_config_t config = {
+		.url = UPLOAD_URL,
+		.timeout_ms = UPLOAD_TIMEOUT_MSEC,
+		.keep_alive_enable = true
+	};
+	int status;
+	int n;
+	
+	if (client == NULL) {
+		client = esp_http_client_init(&config);
+		if (client == NULL) {
+			return -1;
+		}
+	}
+	
+	if (offset < 0) {
+		snprintf(url_buf, sizeof(url_buf), "%s?dev=%s&file=%s", UPLOAD_URL, dev_id, file);
+		esp_http_client_set_method(client, HTTP_METHOD_GET);
+		len = 0;
+	} else {
+		snprintf(url_buf, sizeof(url_buf), "%s?dev=%s&file=%s&offset=%ld", UPLOAD_URL, dev_id, file, offset);
+		esp_http_client_set_method(client, HTTP_METHOD_POST);
+		esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
+	}
+	esp_http_client_set_url(client, url_buf);
+	
+	if (esp_http_client_open(client, len) != ESP_OK) {
+		ESP_LOGW(TAG, "Could not connect to server");
+		return -1;
+	}
+	if ((len != 0) && (esp_http_client_write(client, (const char*) data, len) != len)) {
+		esp_http_client_close(client);
+		return -1;
+	}
+	(void) esp_http_client_fetch_headers(client);
+	status = esp_http_client_get_status_code(client);
+	n = esp_http_client_read_response(client, rsp_buf, UPLOAD_RSP_MAX_LEN);
+	esp_http_client_close(client);
+	
+	if ((status != 200) || (n <= 0)) {
+		ESP_LOGW(TAG, "Server error for %s (%d)", file, status);
+		return -1;
+	}
+	rsp_buf[n] = 0;
+	
+	return strtol(rsp_buf, NULL, 10);
+}
+
+
+static bool _upload_is_done(int trip, long len)
+{
+	for (int i=0; i<num_done; i++) {
+		if ((done_trip[i] == trip) && (done_len[i] == len)) {
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+
+// Remember a complete trip (forgetting the oldest once the list is full)
+static void _upload_note_done(int trip, long len)
+{
+	if (num_done == UPLOAD_MAX_TRIPS) {
+		memmove(&done_trip[0], &done_trip[1], (UPLOAD_MAX_TRIPS - 1) * sizeof(int));
+		memmove(&done_len[0], &done_len[1], (UPLOAD_MAX_TRIPS - 1) * sizeof(long));
+		num_done--;
+	}
+	done_trip[num_done] = trip;
+	done_len[num_done] = len;
+	num_done++;
+}
+
+#endif /* ENABLE_UPLOAD */
@@ -0,0 +1,80 @@
+/*
+ * Upload Task
+ *
+ * Forward completed trip logs from the flash log partition to a depot server over HTTP
+ * while the vehicle is parked on the depot's WiFi.  Only included when ENABLE_UPLOAD is
+ * defined.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef UPLOAD_TASK_H
+#define UPLOAD_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "log_task.h"
+
+
+
+//
+// Upload Task Constants
+//
+
+// Uncomment to upload trip logs to the depot server
+//   Note: uses the WiFi station network in the network configuration so it can't be
+//   used with the WiFi ELM327 interface (whose network is the adapter's)
+//#define ENABLE_UPLOAD
+
+// Depot server
+#define UPLOAD_URL              "http://192.168.1.10:8080/upload"
+
+// Protocol (dev is the ESP32 MAC address as 12 hex digits, file is the trip file name)
+//   GET  UPLOAD_URL?dev=<dev>&file=<file>
+//     200 response body: decimal number of bytes of the file the server holds (0 if none)
+//   POST UPLOAD_URL?dev=<dev>&file=<file>&offset=<offset>  (octet-stream body)
+//     Server appends the body if offset matches what it holds.  200 response body: the
+//     number of bytes it now holds (so an upload always resumes where the server is).
+#define UPLOAD_RSP_MAX_LEN      16
+
+// Bytes sent per POST (a few log blocks) and the HTTP timeout
+#define UPLOAD_CHUNK_LEN        (4 * LOG_BLOCK_LEN)
+#define UPLOAD_TIMEOUT_MSEC     10000
+
+// Period between checks for something to upload and the wait after a server error
+#define UPLOAD_EVAL_MSEC        (10 * 1000)
+#define UPLOAD_RETRY_MSEC       (2 * 60 * 1000)
+
+// Trip files tracked as uploaded (matches the most the log partition holds)
+#define UPLOAD_MAX_TRIPS        16
+
+
+
+//
+// Upload Task externally accessible variables
+//
+extern TaskHandle_t task_handle_upload;
+
+
+
+//
+// API
+//
+void upload_task();
+
+#endif /* UPLOAD_TASK_H */
@@ -0,0 +1,522 @@
+/*
+ * Desktop GUI simulator
+ *
+ * Runs the firmware's GUI on the host with the display rendered into a memory frame
+ * buffer so layouts can be checked and tile render costs compared without a board.  The
+ * main loop is gui_task's.  gui_bench drives every tile with synthetic data (and then
+ * replays scripted swipes) exactly as an ENABLE_GUI_BENCH firmware build does, and the
+ * simulator exits when it finishes.
+ *
+ *   gui_sim [--shots DIR] [--report FILE] [--baseline FILE [--tolerance PCT]] [-v]
+ *
+ *   --shots DIR      Write a PPM image of each tile at the end of its measurement
+ *   --report FILE    Write the results as CSV
+ *   --baseline FILE  Compare each tile's average render time with an earlier report and
+ *                    exit with status 2 if one is more than PCT percent (default 10) slower
+ *   -v               Debug logging
+ *
+ * Host times are only comparable with other host runs on the same machine.  They rank
+ * tiles and catch regressions; the board's own numbers come from gui_bench on the board.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "sim_port.h"
+#include "data_broker.h"
+#include "disp_driver.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "event_utilities.h"
+#include "gui_alert.h"
+#include "gui_bench.h"
+#include "gui_screen_ble.h"
+#include "gui_screen_intro.h"
+#include "gui_screen_main.h"
+#include "gui_screen_wifi.h"
+#include "gui_task.h"
+#include "gui_touch_rec.h"
+#include "gui_utilities.h"
+#include "lvgl.h"
+#include "ps_utilities.h"
+#include "touch_driver.h"
+#include "tune_utilities.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+//
+// Simulator constants
+//
+
+// Panel (ST7701S)
+#define SIM_H_RES             480
+#define SIM_V_RES             480
+
+// Results kept for the report and baseline comparison
+#define SIM_MAX_RESULTS       32
+#define SIM_NAME_LEN          16
+
+// Default allowed render time increase over the baseline
+#define SIM_DEF_TOLERANCE_PCT 10
+
+// Give up if the intro screen hasn't finished and started the benchmark by now
+#define SIM_START_TIMEOUT_MSEC 30000
+
+// Longest path for a shot
+#define SIM_PATH_LEN          256
+
+
+
+//
+// Simulator typedefs
+//
+typedef struct {
+	char name[SIM_NAME_LEN];
+	gui_bench_result_t r;
+} sim_result_t;
+
+
+
+//
+// Simulator variables
+//
+static const char* TAG = "gui_sim";
+
+static lv_disp_draw_buf_t draw_buf;
+static lv_disp_drv_t disp_drv;
+static lv_indev_drv_t indev_drv;
+static lv_color_t* draw_bufP;
+static lv_color_t* panel_fbP;
+
+static lv_obj_t* screen_pages[GUI_NUM_MAIN_SCREEN_PAGES];
+static main_config_t* configP;
+static int32_t cur_tile_index;
+
+static uint32_t flush_usec;
+static uint8_t bl_percent;
+
+static bool saw_end_of_intro = false;
+static bool bench_started = false;
+
+static const char* shot_dir = NULL;
+
+static sim_result_t results[SIM_MAX_RESULTS];
+static int num_results = 0;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _sim_lvgl_init();
+static void _sim_flush_cb(lv_disp_drv_t* drv, const lv_area_t* area, lv_color_t* color_map);
+static void _sim_notification_handler(uint32_t notification_value);
+static void _sim_result_handler(const char* name, const gui_bench_result_t* resultP);
+static bool _sim_write_shot(const char* name);
+static bool _sim_write_report(const char* path);
+static int _sim_check_baseline(const char* path, int tolerance_pct);
+static void _sim_usage(const char* prog);
+
+
+
+//
+// Simulator main
+//
+int main(int argc, char** argv)
+{
+	const char* report_file = NULL;
+	const char* baseline_file = NULL;
+	int tolerance_pct = SIM_DEF_TOLERANCE_PCT;
+	int log_level = SIM_LOG_INFO;
+	bool scroll_hold = false;
+	int64_t last_tick_usec;
+	int64_t cur_usec;
+	int64_t next_usec;
+	uint32_t wait_msec;
+	uint32_t notification_value;
+	
+	for (int i=1; i<argc; i++) {
+		if ((strcmp(argv[i], "--shots") == 0) && ((i + 1) < argc)) {
+			shot_dir = argv[++i];
+		} else if ((strcmp(argv[i], "--report") == 0) && ((i + 1) < argc)) {
+			report_file = argv[++i];
+		} else if ((strcmp(argv[i], "--baseline") == 0) && ((i + 1) < argc)) {
+			baseline_file = argv[++i];
+		} else if ((strcmp(argv[i], "--tolerance") == 0) && ((i + 1) < argc)) {
+			tolerance_pct = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-v") == 0) {
+			log_level = SIM_LOG_DEBUG;
+		} else {
+			_sim_usage(argv[0]);
+			return 1;
+		}
+	}
+	
+	sim_port_init(log_level);
+	task_handle_gui = xTaskGetCurrentTaskHandle();
+	tune_init();
+	ESP_ERROR_CHECK(db_init());
+	
+	// What vm_init does for the broker
+	db_catalog_reset_ranges();
+	
+	// gui_task's startup
+	(void) ps_get_config(PS_CONFIG_TYPE_MAIN, (void**) &configP);
+	_sim_lvgl_init();
+	screen_pages[GUI_SCREEN_INTRO] = gui_screen_intro_init();
+	screen_pages[GUI_SCREEN_MAIN] = gui_screen_main_init();
+	screen_pages[GUI_SCREEN_WIFI] = gui_screen_wifi_init();
+	screen_pages[GUI_SCREEN_BLE] = gui_screen_ble_init();
+	gui_alert_init();
+	gui_set_screen_page(GUI_SCREEN_INTRO);
+	db_set_gui_notify(xTaskGetCurrentTaskHandle(), GUI_NOTIFY_DB_UPDATE);
+	gui_bench_set_result_handler(_sim_result_handler);
+	
+	// The vehicle is identified as soon as the intro screen finishes
+	event_set_notify(xTaskGetCurrentTaskHandle(), GUI_NOTIFY_EVENT);
+	event_publish(EVENT_VEHICLE_IDENTIFIED);
+	
+	// gui_task's loop, stepping the clock over the waits
+	last_tick_usec = esp_timer_get_time();
+	while (!bench_started || gui_bench_running()) {
+		cur_usec = esp_timer_get_time();
+		lv_tick_inc((uint32_t) ((cur_usec - last_tick_usec) / 1000));
+		last_tick_usec += ((cur_usec - last_tick_usec) / 1000) * 1000;
+	
+		sim_run_timers();
+		wait_msec = lv_timer_handler();
+	
+		if (gui_screen_main_is_scrolling() != scroll_hold) {
+			scroll_hold = !scroll_hold;
+			gui_utility_hold_gauge_anims(scroll_hold);
+		}
+		if (!scroll_hold) {
+			db_gui_eval();
+		}
+	
+		notification_value = sim_take_notifications();
+		if (notification_value != 0) {
+			_sim_notification_handler(notification_value);
+			continue;
+		}
+	
+		if (!bench_started && (esp_timer_get_time() > (SIM_START_TIMEOUT_MSEC * 1000))) {
+			ESP_LOGE(TAG, "Benchmark didn't start");
+			return 1;
+		}
+	
+		// Sleep until LVGL or a timer has work
+		if (wait_msec > tune_get(TUNE_GUI_MAX_WAIT_MSEC)) {
+			wait_msec = tune_get(TUNE_GUI_MAX_WAIT_MSEC);
+		}
+		next_usec = esp_timer_get_time() + wait_msec * 1000;
+		if (sim_next_timer_usec() < next_usec) {
+			next_usec = sim_next_timer_usec();
+		}
+		sim_skip_usec(next_usec - esp_timer_get_time());
+	}
+	
+	if ((report_file != NULL) && !_sim_write_report(report_file)) {
+		return 1;
+	}
+	if (baseline_file != NULL) {
+		return _sim_check_baseline(baseline_file, tolerance_pct);
+	}
+	
+	return 0;
+}
+
+
+
+//
+// GUI task API
+//
+void gui_set_screen_page(uint32_t page)
+{
+	if (page >= GUI_NUM_MAIN_SCREEN_PAGES) return;
+	
+	gui_screen_intro_set_active(page == GUI_SCREEN_INTRO);
+	gui_screen_main_set_active(page == GUI_SCREEN_MAIN);
+	gui_screen_wifi_set_active(page == GUI_SCREEN_WIFI);
+	gui_screen_ble_set_active(page == GUI_SCREEN_BLE);
+	
+	lv_scr_load(screen_pages[page]);
+}
+
+
+void gui_get_screen_size(uint16_t* w, uint16_t* h)
+{
+	*w = SIM_H_RES;
+	*h = SIM_V_RES;
+}
+
+
+int32_t gui_get_init_tile_index()
+{
+	cur_tile_index = configP->start_tile_index;
+	return cur_tile_index;
+}
+
+
+void gui_set_init_tile_index(int32_t n)
+{
+	cur_tile_index = n;
+}
+
+
+bool gui_is_metric()
+{
+	return (configP->config_flags & PS_MAIN_FLAG_METRIC) == PS_MAIN_FLAG_METRIC;
+}
+
+
+bool gui_has_fast_interface()
+{
+	return false;
+}
+
+
+
+//
+// Display and touch drivers
+//
+uint32_t disp_driver_get_flush_usec()
+{
+	uint32_t t = flush_usec;
+	
+	flush_usec = 0;
+	return t;
+}
+
+
+void disp_driver_set_bl(uint8_t brightness)
+{
+	bl_percent = brightness;
+}
+
+
+uint8_t disp_driver_get_bl()
+{
+	return bl_percent;
+}
+
+
+// Nobody touches the simulator (gui_bench replays gestures through gui_touch_rec)
+void touch_driver_read(lv_indev_drv_t* drv, lv_indev_data_t* data)
+{
+	data->state = LV_INDEV_STATE_RELEASED;
+}
+
+
+
+//
+// Internal functions
+//
+static void _sim_lvgl_init()
+{
+	lv_init();
+	
+	// Render full frames and copy the changed areas to the "panel" in the flush like the
+	// PSRAM buffer configuration
+	draw_bufP = malloc(SIM_H_RES * SIM_V_RES * sizeof(lv_color_t));
+	panel_fbP = calloc(SIM_H_RES * SIM_V_RES, sizeof(lv_color_t));
+	if ((draw_bufP == NULL) || (panel_fbP == NULL)) {
+		ESP_LOGE(TAG, "Allocate frame buffers failed");
+		exit(1);
+	}
+	lv_disp_draw_buf_init(&draw_buf, draw_bufP, NULL, SIM_H_RES * SIM_V_RES);
+	
+	lv_disp_drv_init(&disp_drv);
+	disp_drv.hor_res = SIM_H_RES;
+	disp_drv.ver_res = SIM_V_RES;
+	disp_drv.flush_cb = _sim_flush_cb;
+	disp_drv.draw_buf = &draw_buf;
+	(void) lv_disp_drv_register(&disp_drv);
+	
+	lv_indev_drv_init(&indev_drv);
+	indev_drv.type = LV_INDEV_TYPE_POINTER;
+	indev_drv.read_cb = gui_touch_rec_read_cb;
+	lv_indev_drv_register(&indev_drv);
+}
+
+
+static void _sim_flush_cb(lv_disp_drv_t* drv, const lv_area_t* area, lv_color_t* color_map)
+{
+	int64_t t = esp_timer_get_time();
+	int w = lv_area_get_width(area);
+	
+	for (int y=area->y1; y<=area->y2; y++) {
+		memcpy(&panel_fbP[y * SIM_H_RES + area->x1], color_map, w * sizeof(lv_color_t));
+		color_map += w;
+	}
+	
+	flush_usec += (uint32_t) (esp_timer_get_time() - t);
+	lv_disp_flush_ready(drv);
+}
+
+
+static void _sim_notification_handler(uint32_t notification_value)
+{
+	if ((notification_value & GUI_NOTIFY_INTRO_DONE) != 0) {
+		saw_end_of_intro = true;
+	}
+	
+	if ((notification_value & GUI_NOTIFY_ALERT) != 0) {
+		gui_alert_update();
+	}
+	
+	if ((notification_value & GUI_NOTIFY_EVENT) != 0) {
+		event_dispatch();
+	}
+	
+	if (saw_end_of_intro && !bench_started) {
+		gui_set_screen_page(GUI_SCREEN_MAIN);
+		gui_bench_start(lv_disp_get_default());
+		bench_started = true;
+		if (!gui_bench_running()) {
+			ESP_LOGE(TAG, "Benchmark didn't start");
+			exit(1);
+		}
+	}
+}
+
+
+static void _sim_result_handler(const char* name, const gui_bench_result_t* resultP)
+{
+	if (num_results < SIM_MAX_RESULTS) {
+		strncpy(results[num_results].name, name, SIM_NAME_LEN - 1);
+		results[num_results].r = *resultP;
+		num_results += 1;
+	}
+	
+	// The tile is still displayed with the data it was measured with
+	if (shot_dir != NULL) {
+		(void) _sim_write_shot(name);
+	}
+}
+
+
+// Binary PPM named after the result ("Tile 3" -> tile_3.ppm)
+static bool _sim_write_shot(const char* name)
+{
+	char path[SIM_PATH_LEN];
+	char* cP;
+	FILE* fp;
+	lv_color_t c;
+	uint8_t rgb[3];
+	
+	snprintf(path, sizeof(path), "%s/%s.ppm", shot_dir, name);
+	for (cP = path + strlen(shot_dir) + 1; *cP != '\0'; cP++) {
+		if (*cP == ' ') {
+			*cP = '_';
+		} else if ((*cP >= 'A') && (*cP <= 'Z')) {
+			*cP += 'a' - 'A';
+		}
+	}
+	
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Open %s failed", path);
+		return false;
+	}
+	
+	fprintf(fp, "P6\n%d %d\n255\n", SIM_H_RES, SIM_V_RES);
+	for (int i=0; i<(SIM_H_RES * SIM_V_RES); i++) {
+		c = panel_fbP[i];
+		rgb[0] = (c.ch.red << 3) | (c.ch.red >> 2);
+		rgb[1] = (c.ch.green << 2) | (c.ch.green >> 4);
+		rgb[2] = (c.ch.blue << 3) | (c.ch.blue >> 2);
+		fwrite(rgb, 1, 3, fp);
+	}
+	fclose(fp);
+	
+	ESP_LOGI(TAG, "Wrote %s", path);
+	return true;
+}
+
+
+static bool _sim_write_report(const char* path)
+{
+	FILE* fp;
+	const gui_bench_result_t* rP;
+	
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Open %s failed", path);
+		return false;
+	}
+	
+	fprintf(fp, "name,frames,msec,p50_usec,p90_usec,p99_usec,max_usec,render_avg_usec,flush_avg_usec\n");
+	for (int i=0; i<num_results; i++) {
+		rP = &results[i].r;
+		fprintf(fp, "%s,%u,%u,%u,%u,%u,%u,%u,%u\n", results[i].name, rP->frames, rP->msec,
+			rP->p50_usec, rP->p90_usec, rP->p99_usec, rP->max_usec, rP->render_avg_usec, rP->flush_avg_usec);
+	}
+	fclose(fp);
+	
+	ESP_LOGI(TAG, "Wrote %s", path);
+	return true;
+}
+
+
+// Returns the exit status: 0 when no result regressed, 1 if the baseline can't be read
+// and 2 for a regression.  Results missing from the baseline (new tiles) are skipped.
+static int _sim_check_baseline(const char* path, int tolerance_pct)
+{
+	FILE* fp;
+	char line[160];
+	char name[SIM_NAME_LEN];
+	unsigned int base_render;
+	uint32_t cur_render;
+	int num_checked = 0;
+	int num_regressed = 0;
+	
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Open %s failed", path);
+		return 1;
+	}
+	
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%15[^,],%*u,%*u,%*u,%*u,%*u,%*u,%u", name, &base_render) != 2) {
+			continue;
+		}
+	
+		for (int i=0; i<num_results; i++) {
+			if (strcmp(name, results[i].name) == 0) {
+				cur_render = results[i].r.render_avg_usec;
+				num_checked += 1;
+				if (((uint64_t) cur_render * 100) > ((uint64_t) base_render * (100 + tolerance_pct))) {
+					ESP_LOGE(TAG, "%s: render %u uSec, baseline %u uSec", name, cur_render, base_render);
+					num_regressed += 1;
+				}
+				break;
+			}
+		}
+	}
+	fclose(fp);
+	
+	ESP_LOGI(TAG, "Baseline: %d of %d results more than %d%% slower", num_regressed, num_checked, tolerance_pct);
+	return (num_regressed == 0) ? 0 : 2;
+}
+
+
+static void _sim_usage(const char* prog)
+{
+	printf("Usage: %s [--shots DIR] [--report FILE] [--baseline FILE [--tolerance PCT]] [-v]\n", prog);
+}
@@ -0,0 +1,14 @@
+/*
+ * Desktop shim: placement attributes have no meaning on the host
+ */
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define EXT_RAM_BSS_ATTR
+#define EXT_RAM_NOINIT_ATTR
+#define WORD_ALIGNED_ATTR __attribute__((aligned(4)))
+
+#endif /* ESP_ATTR_H */
@@ -0,0 +1,11 @@
+/*
+ * Desktop shim: "cycles" are host nanoseconds
+ */
+#ifndef ESP_CPU_H
+#define ESP_CPU_H
+
+#include <stdint.h>
+
+uint32_t esp_cpu_get_cycle_count(void);
+
+#endif /* ESP_CPU_H */
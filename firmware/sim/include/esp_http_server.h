@@ -0,0 +1,48 @@
+/*
+ * Desktop shim: the simulator has no network so no server is ever available
+ */
+#ifndef ESP_HTTP_SERVER_H
+#define ESP_HTTP_SERVER_H
+
+#include <stddef.h>
+#include "esp_system.h"
+
+typedef void* httpd_handle_t;
+
+typedef enum {
+	HTTP_GET = 1,
+	HTTP_POST = 3
+} httpd_method_t;
+
+typedef enum {
+	HTTPD_400_BAD_REQUEST,
+	HTTPD_404_NOT_FOUND,
+	HTTPD_500_INTERNAL_SERVER_ERROR
+} httpd_err_code_t;
+
+typedef struct httpd_req {
+	httpd_handle_t handle;
+	int method;
+	const char uri[128];
+	size_t content_len;
+	void* user_ctx;
+} httpd_req_t;
+
+typedef struct httpd_uri {
+	const char* uri;
+	httpd_method_t method;
+	esp_err_t (*handler)(httpd_req_t* r);
+	void* user_ctx;
+} httpd_uri_t;
+
+#define HTTPD_SOCK_ERR_TIMEOUT  -3
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t* uri_handler);
+esp_err_t httpd_resp_set_type(httpd_req_t* r, const char* type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t* r, const char* field, const char* value);
+esp_err_t httpd_resp_send_chunk(httpd_req_t* r, const char* buf, ssize_t buf_len);
+esp_err_t httpd_resp_send_err(httpd_req_t* req, httpd_err_code_t error, const char* msg);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* r, char* buf, size_t buf_len);
+int httpd_req_recv(httpd_req_t* r, char* buf, size_t buf_len);
+
+#endif /* ESP_HTTP_SERVER_H */
@@ -0,0 +1,34 @@
+/*
+ * Desktop shim: log lines go to stdout through sim_log() (info and above, debug with -v)
+ */
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdio.h>
+
+typedef enum {
+	ESP_LOG_NONE,
+	ESP_LOG_ERROR,
+	ESP_LOG_WARN,
+	ESP_LOG_INFO,
+	ESP_LOG_DEBUG,
+	ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#define SIM_LOG_NONE   ESP_LOG_NONE
+#define SIM_LOG_ERROR  ESP_LOG_ERROR
+#define SIM_LOG_WARN   ESP_LOG_WARN
+#define SIM_LOG_INFO   ESP_LOG_INFO
+#define SIM_LOG_DEBUG  ESP_LOG_DEBUG
+
+void sim_log(int level, const char* tag, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+esp_log_level_t esp_log_level_get(const char* tag);
+
+#define ESP_LOGE(tag, fmt, ...) sim_log(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) sim_log(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) sim_log(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) sim_log(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) sim_log(ESP_LOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOG_LEVEL(level, tag, fmt, ...) sim_log(level, tag, fmt, ##__VA_ARGS__)
+
+#endif /* ESP_LOG_H */
@@ -0,0 +1,12 @@
+/*
+ * Desktop shim: there is no PSRAM on the host
+ */
+#ifndef ESP_MEMORY_UTILS_H
+#define ESP_MEMORY_UTILS_H
+
+#include <stdbool.h>
+
+static inline bool esp_ptr_external_ram(const void* p) { return false; }
+static inline bool esp_ptr_internal(const void* p) { return true; }
+
+#endif /* ESP_MEMORY_UTILS_H */
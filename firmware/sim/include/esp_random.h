@@ -0,0 +1,11 @@
+/*
+ * Desktop shim: repeatable pseudo-random numbers so runs can be compared
+ */
+#ifndef ESP_RANDOM_H
+#define ESP_RANDOM_H
+
+#include <stdint.h>
+
+uint32_t esp_random(void);
+
+#endif /* ESP_RANDOM_H */
@@ -0,0 +1,52 @@
+/*
+ * Desktop shim: the simulator runs the GUI on a single thread so critical sections are
+ * empty and every wait succeeds (or fails) immediately
+ */
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sim_kconfig.h"
+#include "esp_system.h"
+
+#define CONFIG_FREERTOS_HZ          100
+#define configTICK_RATE_HZ          CONFIG_FREERTOS_HZ
+#define configMAX_PRIORITIES        25
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint32_t StackType_t;
+
+#define pdFALSE                     0
+#define pdTRUE                      1
+#define pdFAIL                      0
+#define pdPASS                      1
+#define portMAX_DELAY               ((TickType_t) 0xFFFFFFFF)
+#define portTICK_PERIOD_MS          (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)           ((TickType_t) (((uint64_t) (ms) * configTICK_RATE_HZ) / 1000))
+#define tskNO_AFFINITY              0x7FFFFFFF
+
+typedef struct {
+	int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(m)       (void) (m)
+#define portEXIT_CRITICAL(m)        (void) (m)
+#define portENTER_CRITICAL_ISR(m)   (void) (m)
+#define portEXIT_CRITICAL_ISR(m)    (void) (m)
+#define portENTER_CRITICAL_SAFE(m)  (void) (m)
+#define portEXIT_CRITICAL_SAFE(m)   (void) (m)
+#define taskENTER_CRITICAL(m)       (void) (m)
+#define taskEXIT_CRITICAL(m)        (void) (m)
+#define portYIELD_FROM_ISR(...)
+
+static inline BaseType_t xPortGetCoreID(void) { return 1; }
+
+// Timer callbacks run from the main loop, not an ISR
+static inline BaseType_t xPortInIsrContext(void) { return pdFALSE; }
+
+#endif /* FREERTOS_H */
@@ -0,0 +1,10 @@
+/*
+ * Desktop shim: the firmware's sdkconfig options the host builds use (generated into
+ * sim_kconfig.h by CMakeLists.txt)
+ */
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+#include "sim_kconfig.h"
+
+#endif /* SDKCONFIG_H */
@@ -0,0 +1,949 @@
+/*
+ * ELM327 response parser benchmark
+ *
+ * Feeds adapter transcripts from the corpus through the ELM327 driver's receive parsers
+ * and the CAN manager's ISO-TP reassembly on the host, checks every transcript still
+ * produces the responses it is expected to and measures how fast the text is parsed.
+ * Each corpus file holds the output of one adapter type (see corpus/README.txt for the
+ * format).  The drivers are compiled unchanged (parse_bench_elm327.c, parse_bench_can.c)
+ * and everything below them is stubbed here.
+ *
+ *   parse_bench [--corpus DIR] [--passes N] [--mutate N [--seed S]] [--report FILE]
+ *               [--baseline FILE [--tolerance PCT]] [-v]
+ *
+ *   --corpus DIR     Transcript directory (default the source corpus)
+ *   --passes N       Timed passes over each file (default 20000)
+ *   --mutate N       Also run each transcript N times with random damage (flipped, lost
+ *                    and repeated characters, extra CRs and prompts) fed in random sized
+ *                    pieces and report how many responses survived intact, were altered
+ *                    or were lost.  The parse state is checked after every run.
+ *   --seed S         Mutation random seed (default 1)
+ *   --report FILE    Write the results as CSV
+ *   --baseline FILE  Compare each file's parse rate with an earlier report and exit with
+ *                    status 2 if one is more than PCT percent (default 10) slower
+ *   -v               Debug logging
+ *
+ * The exit status is 1 if a transcript doesn't produce its expected responses or a
+ * mutated one leaves the parsers in an impossible state.  As with gui_sim host rates are
+ * only comparable with other runs on the same machine.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "sim_port.h"
+#include "parse_bench.h"
+#include "can_capture.h"
+#include "can_driver_elm327.h"
+#include "can_driver_twai.h"
+#include "can_manager.h"
+#include "elm327_interface_ble.h"
+#include "elm327_interface_usb.h"
+#include "elm327_interface_wifi.h"
+#include "esp_log.h"
+#include "ps_utilities.h"
+#include "tune_utilities.h"
+#include "vehicle_manager.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+//
+// Parser benchmark constants
+//
+
+// Corpus limits (per file)
+#define PB_MAX_FILES          16
+#define PB_MAX_EXCHANGES      128
+#define PB_MAX_RAW_LEN        1024     // Adapter output of one exchange
+#define PB_MAX_EXPECTED       32       // Responses from one exchange
+#define PB_MAX_BCAST_IDS      8
+#define PB_MAX_VER_LEN        8
+#define PB_LINE_LEN           512
+#define PB_NAME_LEN           24
+#define PB_PATH_LEN           256
+
+// Longest response reassembled (the response buffers are sized for it as the vehicle
+// manager does for its request list)
+#define PB_MAX_MSG_LEN        256
+
+// Received responses recorded from one exchange (mutations can create extra ones)
+#define PB_MAX_RECEIVED       48
+
+// Timing.  The passes are split into rounds and the fastest round is reported so other
+// load on the host doesn't show up as a regression.
+#define PB_DEF_PASSES         20000
+#define PB_NUM_ROUNDS         5
+
+// Default allowed parse rate decrease from the baseline
+#define PB_DEF_TOLERANCE_PCT  10
+
+// Mutation
+#define PB_MAX_MUTATIONS      3        // Per run (at least 1)
+#define PB_MAX_CHUNK_LEN      24       // Longest piece handed to the parser at once
+#define PB_MUTATE_CHARS       "0123456789ABCDEF :>?\rNO DATA"
+
+// Exchange end state checks
+#define PB_CHECK_STATE        0x01
+#define PB_CHECK_NO_DATA      0x02
+#define PB_CHECK_UNKNOWN      0x04
+#define PB_CHECK_VERSION      0x08
+
+
+
+//
+// Parser benchmark typedefs
+//
+typedef struct {
+	uint32_t id;
+	int len;
+	uint8_t data[PB_MAX_MSG_LEN];
+} pb_msg_t;
+
+// One request (or AT command or monitor session) and what the adapter sent back
+typedef struct {
+	int line_num;                      // Of the "@" line
+	int type;
+	uint32_t req_id;
+	uint32_t rsp_id;
+	int num_bcast;
+	uint32_t bcast_id[PB_MAX_BCAST_IDS];
+	int raw_len;
+	char raw[PB_MAX_RAW_LEN];
+	int num_expected;
+	pb_msg_t expected[PB_MAX_EXPECTED];
+	uint8_t check_mask;
+	int check_state;
+	char check_version[PB_MAX_VER_LEN];
+} pb_exchange_t;
+
+typedef struct {
+	char name[PB_NAME_LEN];
+	uint64_t bytes_per_sec;
+	int bytes;                         // Per pass
+	int frames;                        // CAN frames recovered per pass
+	int messages;                      // Responses and broadcast frames delivered per pass
+	int intact;                        // Mutated runs
+	int altered;
+	int lost;
+} pb_result_t;
+
+
+
+//
+// Parser benchmark variables
+//
+static const char* TAG = "parse_bench";
+
+static pb_exchange_t exchange[PB_MAX_EXCHANGES];
+static int num_exchanges;
+
+static pb_result_t results[PB_MAX_FILES];
+static int num_results = 0;
+
+// What the CAN manager delivered during an exchange
+static bool record_en = false;
+static int num_frames;
+static int num_messages;
+static int num_received;
+static bool received_too_long;
+static pb_msg_t received[PB_MAX_RECEIVED];
+
+static int num_passes = PB_DEF_PASSES;
+static int log_level = SIM_LOG_INFO;
+
+static uint32_t rand_state;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static int _pb_cmp_names(const void* a, const void* b);
+static bool _pb_load_file(const char* path);
+static bool _pb_parse_line(const char* path, int line_num, char* line, pb_exchange_t** eP);
+static bool _pb_parse_hex(const char* s, pb_msg_t* mP);
+static int _pb_unescape(const char* s, char* out, int max_len);
+static void _pb_run(const pb_exchange_t* eP, const char* raw, int raw_len, bool chunked);
+static bool _pb_verify(const char* path, const pb_exchange_t* eP);
+static void _pb_time(pb_result_t* rP);
+static bool _pb_mutate_all(const char* path, int num_runs, pb_result_t* rP);
+static int _pb_mutate(const char* raw, int raw_len, char* out, int max_len);
+static bool _pb_same_msg(const pb_msg_t* aP, const pb_msg_t* bP);
+static uint32_t _pb_rand();
+static int64_t _pb_host_usec();
+static bool _pb_write_report(const char* path);
+static int _pb_check_baseline(const char* path, int tolerance_pct);
+static void _pb_usage(const char* prog);
+
+
+
+//
+// Parser benchmark main
+//
+int main(int argc, char** argv)
+{
+	const char* corpus_dir = PARSE_BENCH_CORPUS_DIR;
+	const char* report_file = NULL;
+	const char* baseline_file = NULL;
+	char names[PB_MAX_FILES][PB_NAME_LEN];
+	char path[PB_PATH_LEN];
+	int num_files = 0;
+	int mutate_runs = 0;
+	int tolerance_pct = PB_DEF_TOLERANCE_PCT;
+	bool failed = false;
+	bool passed;
+	DIR* dirP;
+	struct dirent* entP;
+	uint8_t* rsp_bufP;
+	int len;
+	
+	rand_state = 1;
+	for (int i=1; i<argc; i++) {
+		if ((strcmp(argv[i], "--corpus") == 0) && ((i + 1) < argc)) {
+			corpus_dir = argv[++i];
+		} else if ((strcmp(argv[i], "--passes") == 0) && ((i + 1) < argc)) {
+			num_passes = atoi(argv[++i]);
+		} else if ((strcmp(argv[i], "--mutate") == 0) && ((i + 1) < argc)) {
+			mutate_runs = atoi(argv[++i]);
+		} else if ((strcmp(argv[i], "--seed") == 0) && ((i + 1) < argc)) {
+			rand_state = (uint32_t) strtoul(argv[++i], NULL, 0);
+		} else if ((strcmp(argv[i], "--report") == 0) && ((i + 1) < argc)) {
+			report_file = argv[++i];
+		} else if ((strcmp(argv[i], "--baseline") == 0) && ((i + 1) < argc)) {
+			baseline_file = argv[++i];
+		} else if ((strcmp(argv[i], "--tolerance") == 0) && ((i + 1) < argc)) {
+			tolerance_pct = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-v") == 0) {
+			log_level = SIM_LOG_DEBUG;
+		} else {
+			_pb_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (num_passes < PB_NUM_ROUNDS) {
+		num_passes = PB_NUM_ROUNDS;
+	}
+	if (rand_state == 0) {
+		// xorshift never leaves 0
+		rand_state = 1;
+	}
+	
+	sim_port_init(log_level);
+	tune_init();
+	parse_bench_can_init();
+	rsp_bufP = malloc(can_get_rsp_buf_size(PB_MAX_MSG_LEN));
+	if (rsp_bufP == NULL) {
+		ESP_LOGE(TAG, "Response buffer allocation failed");
+		return 1;
+	}
+	can_set_rsp_bufs(rsp_bufP, PB_MAX_MSG_LEN);
+	
+	// Corpus files in name order so reports line up
+	dirP = opendir(corpus_dir);
+	if (dirP == NULL) {
+		ESP_LOGE(TAG, "Open %s failed", corpus_dir);
+		return 1;
+	}
+	while (((entP = readdir(dirP)) != NULL) && (num_files < PB_MAX_FILES)) {
+		len = strlen(entP->d_name);
+		if ((len > 4) && (len < (PB_NAME_LEN + 4)) && (strcmp(&entP->d_name[len-4], ".txt") == 0) &&
+		    (strcmp(entP->d_name, "README.txt") != 0)) {
+			memcpy(names[num_files], entP->d_name, len - 4);
+			names[num_files][len - 4] = 0;
+			num_files += 1;
+		}
+	}
+	closedir(dirP);
+	qsort(names, num_files, PB_NAME_LEN, _pb_cmp_names);
+	
+	if (num_files == 0) {
+		ESP_LOGE(TAG, "No transcripts in %s", corpus_dir);
+		return 1;
+	}
+	
+	for (int i=0; i<num_files; i++) {
+		snprintf(path, sizeof(path), "%s/%s.txt", corpus_dir, names[i]);
+		if (!_pb_load_file(path)) {
+			return 1;
+		}
+	
+		memset(&results[num_results], 0, sizeof(pb_result_t));
+		strcpy(results[num_results].name, names[i]);
+	
+		// Expected responses first, a file that fails isn't timed
+		passed = true;
+		for (int j=0; j<num_exchanges; j++) {
+			if (!_pb_verify(path, &exchange[j])) {
+				passed = false;
+			}
+			results[num_results].bytes += exchange[j].raw_len;
+			results[num_results].frames += num_frames;
+			results[num_results].messages += num_messages;
+		}
+		if (!passed) {
+			failed = true;
+			continue;
+		}
+	
+		_pb_time(&results[num_results]);
+		ESP_LOGI(TAG, "%s: %d exchanges, %d bytes, %d frames, %d messages: %llu bytes/sec", names[i],
+			num_exchanges, results[num_results].bytes, results[num_results].frames, results[num_results].messages,
+			(unsigned long long) results[num_results].bytes_per_sec);
+	
+		if (mutate_runs > 0) {
+			if (!_pb_mutate_all(path, mutate_runs, &results[num_results])) {
+				failed = true;
+			}
+			ESP_LOGI(TAG, "%s: %d mutated runs: %d intact, %d altered, %d lost", names[i],
+				num_exchanges * mutate_runs, results[num_results].intact, results[num_results].altered,
+				results[num_results].lost);
+		}
+	
+		num_results += 1;
+	}
+	
+	if ((report_file != NULL) && !_pb_write_report(report_file)) {
+		return 1;
+	}
+	if (failed) {
+		return 1;
+	}
+	if (baseline_file != NULL) {
+		return _pb_check_baseline(baseline_file, tolerance_pct);
+	}
+	
+	return 0;
+}
+
+
+
+//
+// Stubs
+//
+
+// Capture is the benchmark's view of what the CAN manager recovered
+volatile bool can_capture_active = true;
+
+void can_capture_record(int type, uint32_t id, int len, const uint8_t* data)
+{
+	if (type == CAN_CAPTURE_RX) {
+		num_frames += 1;
+	}
+}
+
+// Drivers that are never selected
+const can_if_driver_t can_driver_twai;
+const elm327_if_driver_t elm327_interface_driver_wifi = {"WiFi"};
+const elm327_if_driver_t elm327_interface_driver_ble = {"BLE"};
+const elm327_if_driver_t elm327_interface_driver_usb = {"USB"};
+
+
+bool ps_get_config(int index, void** cfg)
+{
+	return false;
+}
+
+
+bool ps_save_config(int index)
+{
+	return false;
+}
+
+
+void vm_rx_data(uint32_t id, int len, uint8_t* data, int64_t rx_usec)
+{
+	num_messages += 1;
+	
+	if (record_en && (num_received < PB_MAX_RECEIVED)) {
+		if (len > PB_MAX_MSG_LEN) {
+			received_too_long = true;
+			len = PB_MAX_MSG_LEN;
+		}
+		received[num_received].id = id;
+		received[num_received].len = len;
+		memcpy(received[num_received].data, data, len);
+		num_received += 1;
+	}
+}
+
+
+void vm_rx_broadcast(uint32_t id, int len, uint8_t* data, int64_t rx_usec)
+{
+	vm_rx_data(id, len, data, rx_usec);
+}
+
+
+void vm_rx_partial(uint32_t id, int offset, int total_len, int len, uint8_t* data, int64_t rx_usec)
+{
+}
+
+
+void vm_note_error(int errno)
+{
+}
+
+
+void vm_note_rsp_error(uint32_t rsp_id, int errno)
+{
+}
+
+
+void vm_rx_functional_done()
+{
+}
+
+
+
+//
+// Internal functions
+//
+static int _pb_cmp_names(const void* a, const void* b)
+{
+	return strcmp((const char*) a, (const char*) b);
+}
+
+
+static bool _pb_load_file(const char* path)
+{
+	FILE* fp;
+	char line[PB_LINE_LEN];
+	char* cP;
+	int line_num = 0;
+	pb_exchange_t* eP = NULL;
+	
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Open %s failed", path);
+		return false;
+	}
+	
+	num_exchanges = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line_num += 1;
+		if ((cP = strpbrk(line, "\r\n")) != NULL) {
+			*cP = 0;
+		}
+		if (!_pb_parse_line(path, line_num, line, &eP)) {
+			fclose(fp);
+			return false;
+		}
+	}
+	fclose(fp);
+	
+	if (num_exchanges == 0) {
+		ESP_LOGE(TAG, "%s: No exchanges", path);
+		return false;
+	}
+	
+	return true;
+}
+
+
+// One corpus line (see corpus/README.txt).  eP is the exchange being read.
+static bool _pb_parse_line(const char* path, int line_num, char* line, pb_exchange_t** eP)
+{
+	char* argP[2 + PB_MAX_BCAST_IDS];
+	char* saveP;
+	int num_args = 0;
+	int len;
+	
+	if ((line[0] == 0) || (line[0] == '#')) {
+		return true;
+	}
+	
+	if ((line[0] != '@') && (*eP == NULL)) {
+		ESP_LOGE(TAG, "%s:%d: Not in an exchange", path, line_num);
+		return false;
+	}
+	
+	switch (line[0]) {
+		case '@':
+			if (num_exchanges == PB_MAX_EXCHANGES) {
+				ESP_LOGE(TAG, "%s:%d: Too many exchanges", path, line_num);
+				return false;
+			}
+			*eP = &exchange[num_exchanges++];
+			memset(*eP, 0, sizeof(pb_exchange_t));
+			(*eP)->line_num = line_num;
+	
+			for (char* cP = strtok_r(&line[1], " ", &saveP); (cP != NULL) && (num_args < (2 + PB_MAX_BCAST_IDS));
+			     cP = strtok_r(NULL, " ", &saveP)) {
+				argP[num_args++] = cP;
+			}
+	
+			if ((num_args == 1) && (strcmp(argP[0], "at") == 0)) {
+				(*eP)->type = PARSE_BENCH_AT;
+			} else if ((num_args == 1) && (strcmp(argP[0], "stop") == 0)) {
+				(*eP)->type = PARSE_BENCH_MON_STOP;
+			} else if ((num_args == 3) && (strcmp(argP[0], "req") == 0)) {
+				(*eP)->type = PARSE_BENCH_REQ;
+				(*eP)->req_id = strtoul(argP[1], NULL, 16);
+				(*eP)->rsp_id = strtoul(argP[2], NULL, 16);
+			} else if ((num_args >= 2) && ((strcmp(argP[0], "mon11") == 0) || (strcmp(argP[0], "mon29") == 0))) {
+				(*eP)->type = (argP[0][3] == '1') ? PARSE_BENCH_MON_11 : PARSE_BENCH_MON_29;
+				(*eP)->num_bcast = num_args - 1;
+				for (int i=1; i<num_args; i++) {
+					(*eP)->bcast_id[i-1] = strtoul(argP[i], NULL, 16);
+				}
+			} else {
+				ESP_LOGE(TAG, "%s:%d: Bad exchange", path, line_num);
+				return false;
+			}
+			break;
+	
+		case '<':
+			len = _pb_unescape(&line[1 + (line[1] == ' ')], &(*eP)->raw[(*eP)->raw_len], PB_MAX_RAW_LEN - (*eP)->raw_len);
+			if (len < 0) {
+				ESP_LOGE(TAG, "%s:%d: Exchange too long", path, line_num);
+				return false;
+			}
+			(*eP)->raw_len += len;
+			break;
+	
+		case '=':
+			if (((*eP)->num_expected == PB_MAX_EXPECTED) ||
+			    !_pb_parse_hex(&line[1], &(*eP)->expected[(*eP)->num_expected])) {
+				ESP_LOGE(TAG, "%s:%d: Bad response", path, line_num);
+				return false;
+			}
+			(*eP)->num_expected += 1;
+			break;
+	
+		case '!':
+			for (char* cP = strtok_r(&line[1], " ", &saveP); (cP != NULL) && (num_args < 2);
+			     cP = strtok_r(NULL, " ", &saveP)) {
+				argP[num_args++] = cP;
+			}
+	
+			if ((num_args == 1) && (strcmp(argP[0], "ok") == 0)) {
+				(*eP)->check_mask |= PB_CHECK_STATE;
+				(*eP)->check_state = PARSE_BENCH_ST_OK;
+			} else if ((num_args == 1) && (strcmp(argP[0], "error") == 0)) {
+				(*eP)->check_mask |= PB_CHECK_STATE;
+				(*eP)->check_state = PARSE_BENCH_ST_ERROR;
+			} else if ((num_args == 1) && (strcmp(argP[0], "pending") == 0)) {
+				(*eP)->check_mask |= PB_CHECK_STATE;
+				(*eP)->check_state = PARSE_BENCH_ST_PENDING;
+			} else if ((num_args == 1) && (strcmp(argP[0], "nodata") == 0)) {
+				(*eP)->check_mask |= PB_CHECK_NO_DATA;
+			} else if ((num_args == 1) && (strcmp(argP[0], "unknown") == 0)) {
+				(*eP)->check_mask |= PB_CHECK_UNKNOWN;
+			} else if ((num_args == 2) && (strcmp(argP[0], "version") == 0) && (strlen(argP[1]) < PB_MAX_VER_LEN)) {
+				(*eP)->check_mask |= PB_CHECK_VERSION;
+				strcpy((*eP)->check_version, argP[1]);
+			} else {
+				ESP_LOGE(TAG, "%s:%d: Bad check", path, line_num);
+				return false;
+			}
+			break;
+	
+		default:
+			ESP_LOGE(TAG, "%s:%d: Unknown line", path, line_num);
+			return false;
+	}
+	
+	return true;
+}
+
+
+// "<id> <hex bytes>" with optional spaces between the bytes
+static bool _pb_parse_hex(const char* s, pb_msg_t* mP)
+{
+	char* endP;
+	int nibbles = 0;
+	int val;
+	
+	mP->id = strtoul(s, &endP, 16);
+	if ((endP == s) || (*endP != ' ')) {
+		return false;
+	}
+	
+	mP->len = 0;
+	for (s = endP; *s != 0; s++) {
+		if (*s == ' ') continue;
+	
+		if ((*s >= '0') && (*s <= '9')) {
+			val = *s - '0';
+		} else if ((*s >= 'A') && (*s <= 'F')) {
+			val = *s - 'A' + 10;
+		} else if ((*s >= 'a') && (*s <= 'f')) {
+			val = *s - 'a' + 10;
+		} else {
+			return false;
+		}
+	
+		if ((nibbles & 1) == 0) {
+			if (mP->len == PB_MAX_MSG_LEN) return false;
+			mP->data[mP->len] = val;
+		} else {
+			mP->data[mP->len] = (mP->data[mP->len] << 4) | val;
+			mP->len += 1;
+		}
+		nibbles += 1;
+	}
+	
+	return (nibbles != 0) && ((nibbles & 1) == 0);
+}
+
+
+// Adapter text with \r, \n and \\ escapes.  Returns the length or -1 if it doesn't fit.
+static int _pb_unescape(const char* s, char* out, int max_len)
+{
+	int len = 0;
+	char c;
+	
+	while (*s != 0) {
+		c = *s++;
+		if ((c == '\\') && (*s != 0)) {
+			c = *s++;
+			if (c == 'r') {
+				c = '\r';
+			} else if (c == 'n') {
+				c = '\n';
+			}
+		}
+	
+		if (len == max_len) return -1;
+		out[len++] = c;
+	}
+	
+	return len;
+}
+
+
+// Start the exchange and hand the adapter output to the driver in one piece (as one
+// interface read) or in random sized pieces
+static void _pb_run(const pb_exchange_t* eP, const char* raw, int raw_len, bool chunked)
+{
+	int len;
+	
+	num_frames = 0;
+	num_messages = 0;
+	num_received = 0;
+	received_too_long = false;
+	
+	parse_bench_can_start(eP->req_id, eP->rsp_id, eP->num_bcast, eP->bcast_id);
+	parse_bench_elm327_start(eP->type, eP->rsp_id);
+	
+	if (!chunked) {
+		can_driver_elm327_rx_data(CAN_DRIVER_ELM327_WIFI, raw, raw_len);
+		return;
+	}
+	
+	while (raw_len > 0) {
+		len = 1 + (_pb_rand() % PB_MAX_CHUNK_LEN);
+		if (len > raw_len) {
+			len = raw_len;
+		}
+		can_driver_elm327_rx_data(CAN_DRIVER_ELM327_WIFI, raw, len);
+		raw += len;
+		raw_len -= len;
+	}
+}
+
+
+static bool _pb_verify(const char* path, const pb_exchange_t* eP)
+{
+	static const char* state_name[] = {"ok", "error", "pending"};
+	parse_bench_elm327_state_t state;
+	bool passed = true;
+	int n;
+	
+	record_en = true;
+	_pb_run(eP, eP->raw, eP->raw_len, false);
+	record_en = false;
+	parse_bench_elm327_get_state(&state);
+	
+	if (num_received != eP->num_expected) {
+		ESP_LOGE(TAG, "%s:%d: %d responses, expected %d", path, eP->line_num, num_received, eP->num_expected);
+		passed = false;
+	}
+	for (int i=0; (i<num_received) && (i<eP->num_expected); i++) {
+		if ((received[i].id != eP->expected[i].id) || (received[i].len != eP->expected[i].len)) {
+			ESP_LOGE(TAG, "%s:%d: Response %d is %d bytes from 0x%lx, expected %d bytes from 0x%lx", path, eP->line_num,
+				i + 1, received[i].len, (unsigned long) received[i].id, eP->expected[i].len, (unsigned long) eP->expected[i].id);
+			passed = false;
+		} else if (!_pb_same_msg(&received[i], &eP->expected[i])) {
+			n = 0;
+			while (received[i].data[n] == eP->expected[i].data[n]) {
+				n += 1;
+			}
+			ESP_LOGE(TAG, "%s:%d: Response %d byte %d is 0x%02x, expected 0x%02x", path, eP->line_num,
+				i + 1, n, received[i].data[n], eP->expected[i].data[n]);
+			passed = false;
+		}
+	}
+	
+	if (((eP->check_mask & PB_CHECK_STATE) != 0) && (state.state != eP->check_state)) {
+		ESP_LOGE(TAG, "%s:%d: Ended %s, expected %s", path, eP->line_num, state_name[state.state], state_name[eP->check_state]);
+		passed = false;
+	}
+	if (((eP->check_mask & PB_CHECK_NO_DATA) != 0) != state.no_data) {
+		ESP_LOGE(TAG, "%s:%d: NO DATA %s", path, eP->line_num, state.no_data ? "seen" : "not seen");
+		passed = false;
+	}
+	if (((eP->check_mask & PB_CHECK_UNKNOWN) != 0) != state.unknown_cmd) {
+		ESP_LOGE(TAG, "%s:%d: ? %s", path, eP->line_num, state.unknown_cmd ? "seen" : "not seen");
+		passed = false;
+	}
+	if (((eP->check_mask & PB_CHECK_VERSION) != 0) && (strcmp(state.version, eP->check_version) != 0)) {
+		ESP_LOGE(TAG, "%s:%d: Version \"%s\", expected \"%s\"", path, eP->line_num, state.version, eP->check_version);
+		passed = false;
+	}
+	if (!state.parser_sane || !parse_bench_can_sane()) {
+		ESP_LOGE(TAG, "%s:%d: Bad parse state", path, eP->line_num);
+		passed = false;
+	}
+	
+	return passed;
+}
+
+
+// Parse rate of the fastest round (the parsers' own logging is off while timing)
+static void _pb_time(pb_result_t* rP)
+{
+	int passes_per_round = num_passes / PB_NUM_ROUNDS;
+	int64_t best_usec = INT64_MAX;
+	int64_t start_usec;
+	int64_t usec;
+	
+	sim_set_log_level(SIM_LOG_NONE);
+	for (int r=0; r<PB_NUM_ROUNDS; r++) {
+		start_usec = _pb_host_usec();
+		for (int p=0; p<passes_per_round; p++) {
+			for (int i=0; i<num_exchanges; i++) {
+				_pb_run(&exchange[i], exchange[i].raw, exchange[i].raw_len, false);
+			}
+		}
+		usec = _pb_host_usec() - start_usec;
+		if (usec < best_usec) {
+			best_usec = usec;
+		}
+	}
+	sim_set_log_level(log_level);
+	
+	if (best_usec < 1) {
+		best_usec = 1;
+	}
+	rP->bytes_per_sec = ((uint64_t) rP->bytes * passes_per_round * 1000000) / best_usec;
+}
+
+
+// Each exchange num_runs times with random damage.  Returns false if the parse state is
+// ever impossible.
+static bool _pb_mutate_all(const char* path, int num_runs, pb_result_t* rP)
+{
+	static char buf[2 * PB_MAX_RAW_LEN];
+	parse_bench_elm327_state_t state;
+	const pb_exchange_t* eP;
+	bool altered;
+	bool found;
+	bool sane = true;
+	int len;
+	
+	sim_set_log_level(SIM_LOG_NONE);
+	record_en = true;
+	
+	for (int i=0; i<num_exchanges; i++) {
+		eP = &exchange[i];
+		for (int n=0; n<num_runs; n++) {
+			len = _pb_mutate(eP->raw, eP->raw_len, buf, sizeof(buf));
+			_pb_run(eP, buf, len, true);
+	
+			parse_bench_elm327_get_state(&state);
+			if (!state.parser_sane || !parse_bench_can_sane() || received_too_long) {
+				sim_set_log_level(SIM_LOG_ERROR);
+				ESP_LOGE(TAG, "%s:%d: Bad parse state after mutated run %d", path, eP->line_num, n + 1);
+				sim_set_log_level(SIM_LOG_NONE);
+				sane = false;
+			}
+	
+			// Altered if anything was delivered that the adapter didn't send (or twice),
+			// otherwise lost if something is missing
+			altered = (num_received > eP->num_expected);
+			for (int j=0; (j<num_received) && !altered; j++) {
+				found = false;
+				for (int k=0; k<eP->num_expected; k++) {
+					if (_pb_same_msg(&received[j], &eP->expected[k])) {
+						found = true;
+						break;
+					}
+				}
+				if (!found) {
+					altered = true;
+				}
+			}
+	
+			if (altered) {
+				rP->altered += 1;
+			} else if (num_received < eP->num_expected) {
+				rP->lost += 1;
+			} else {
+				rP->intact += 1;
+			}
+		}
+	}
+	
+	record_en = false;
+	sim_set_log_level(log_level);
+	
+	return sane;
+}
+
+
+// Copy raw to out with 1 to PB_MAX_MUTATIONS random changes.  Returns the new length.
+static int _pb_mutate(const char* raw, int raw_len, char* out, int max_len)
+{
+	int len = raw_len;
+	int num = 1 + (_pb_rand() % PB_MAX_MUTATIONS);
+	int pos;
+	char c;
+	
+	memcpy(out, raw, raw_len);
+	
+	for (int i=0; (i<num) && (len > 0) && (len < max_len); i++) {
+		pos = _pb_rand() % len;
+		switch (_pb_rand() % 6) {
+			case 0:
+				// Flipped to a character adapters send
+				out[pos] = PB_MUTATE_CHARS[_pb_rand() % (sizeof(PB_MUTATE_CHARS) - 1)];
+				break;
+			case 1:
+				// Flipped to anything (link noise)
+				out[pos] = (char) (_pb_rand() & 0xFF);
+				break;
+			case 2:
+				// Lost
+				memmove(&out[pos], &out[pos+1], len - pos - 1);
+				len -= 1;
+				break;
+			default:
+				// Repeated, or an extra CR or prompt
+				c = out[pos];
+				if ((i & 1) != 0) {
+					c = ((_pb_rand() & 1) == 0) ? '\r' : '>';
+				}
+				memmove(&out[pos+1], &out[pos], len - pos);
+				out[pos] = c;
+				len += 1;
+		}
+	}
+	
+	return len;
+}
+
+
+static bool _pb_same_msg(const pb_msg_t* aP, const pb_msg_t* bP)
+{
+	return (aP->id == bP->id) && (aP->len == bP->len) && (memcmp(aP->data, bP->data, aP->len) == 0);
+}
+
+
+// xorshift32 so a seed reproduces a run on any host
+static uint32_t _pb_rand()
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	
+	return rand_state;
+}
+
+
+// Timing uses the host clock (the simulator's virtual clock is for its waits)
+static int64_t _pb_host_usec()
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+static bool _pb_write_report(const char* path)
+{
+	FILE* fp;
+	const pb_result_t* rP;
+	
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Open %s failed", path);
+		return false;
+	}
+	
+	fprintf(fp, "name,bytes_per_sec,bytes,frames,messages,intact,altered,lost\n");
+	for (int i=0; i<num_results; i++) {
+		rP = &results[i];
+		fprintf(fp, "%s,%llu,%d,%d,%d,%d,%d,%d\n", rP->name, (unsigned long long) rP->bytes_per_sec,
+			rP->bytes, rP->frames, rP->messages, rP->intact, rP->altered, rP->lost);
+	}
+	fclose(fp);
+	
+	ESP_LOGI(TAG, "Wrote %s", path);
+	return true;
+}
+
+
+// Returns the exit status: 0 when no file's rate regressed, 1 if the baseline can't be
+// read and 2 for a regression.  Files missing from the baseline (new adapters) are skipped.
+static int _pb_check_baseline(const char* path, int tolerance_pct)
+{
+	FILE* fp;
+	char line[160];
+	char name[PB_NAME_LEN];
+	unsigned long long base_rate;
+	uint64_t cur_rate;
+	int num_checked = 0;
+	int num_regressed = 0;
+	
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Open %s failed", path);
+		return 1;
+	}
+	
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%23[^,],%llu", name, &base_rate) != 2) {
+			continue;
+		}
+	
+		for (int i=0; i<num_results; i++) {
+			if (strcmp(name, results[i].name) == 0) {
+				cur_rate = results[i].bytes_per_sec;
+				num_checked += 1;
+				if ((cur_rate * 100) < ((uint64_t) base_rate * (100 - tolerance_pct))) {
+					ESP_LOGE(TAG, "%s: %llu bytes/sec, baseline %llu bytes/sec", name, (unsigned long long) cur_rate, base_rate);
+					num_regressed += 1;
+				}
+				break;
+			}
+		}
+	}
+	fclose(fp);
+	
+	ESP_LOGI(TAG, "Baseline: %d of %d files more than %d%% slower", num_regressed, num_checked, tolerance_pct);
+	return (num_regressed == 0) ? 0 : 2;
+}
+
+
+static void _pb_usage(const char* prog)
+{
+	printf("Usage: %s [--corpus DIR] [--passes N] [--mutate N [--seed S]] [--report FILE] [--baseline FILE [--tolerance PCT]] [-v]\n", prog);
+}
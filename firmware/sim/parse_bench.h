@@ -0,0 +1,73 @@
+/*
+ * Parser benchmark access to the ELM327 driver and CAN manager internals
+ *
+ * parse_bench_elm327.c and parse_bench_can.c compile the firmware sources unchanged with
+ * these functions appended so the benchmark can put the parsers in the state a request
+ * (or monitor mode) leaves them in without an adapter connection.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PARSE_BENCH_H
+#define PARSE_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Constants
+//
+
+// Exchange types (what was sent to the adapter)
+#define PARSE_BENCH_AT       0    // AT command
+#define PARSE_BENCH_REQ      1    // Request packet (CAF0, headers and spaces off)
+#define PARSE_BENCH_MON_11   2    // ATMA with 11-bit headers
+#define PARSE_BENCH_MON_29   3    // ATMA with 29-bit headers
+#define PARSE_BENCH_MON_STOP 4    // Character ending monitor mode
+
+// Driver state after an exchange
+#define PARSE_BENCH_ST_OK      0  // Finished (or still monitoring)
+#define PARSE_BENCH_ST_ERROR   1  // Failed at the prompt
+#define PARSE_BENCH_ST_PENDING 2  // Waiting for more of the response or its prompt
+
+
+
+//
+// Typedefs
+//
+typedef struct {
+	int state;
+	bool no_data;                // Saw "NO DATA"
+	bool unknown_cmd;            // Saw "?"
+	bool parser_sane;            // Parse state within its buffers
+	const char* version;         // Version from an ATZ or ATI response
+} parse_bench_elm327_state_t;
+
+
+
+//
+// API
+//
+void parse_bench_elm327_start(int type, uint32_t rsp_id);
+void parse_bench_elm327_get_state(parse_bench_elm327_state_t* stateP);
+
+void parse_bench_can_init();
+void parse_bench_can_start(uint32_t req_id, uint32_t rsp_id, int num_bcast_ids, const uint32_t* bcast_ids);
+bool parse_bench_can_sane();
+
+#endif /* PARSE_BENCH_H */
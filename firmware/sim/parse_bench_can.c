@@ -0,0 +1,79 @@
+/*
+ * Parser benchmark build of the CAN manager
+ *
+ * The CAN manager compiled unchanged with functions to open the session a request to
+ * one ECU (or the broadcast subscriptions of monitor mode) would and check the ISO-TP
+ * reassembly state afterwards.  The ELM327 driver is the active interface.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "can_manager.c"
+#include "parse_bench.h"
+
+
+
+//
+// Parser benchmark hooks
+//
+
+// Session deadlines are set up as can_init does.  They are never run so a response that
+// stops short stays open until the next exchange starts.
+void parse_bench_can_init()
+{
+	if (!session_timers_init && can_timer_wheel_init()) {
+		for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+			can_timer_setup(&session[i].cf_timer, &_can_session_timer_cb, &session[i]);
+		}
+		session_timers_init = true;
+	}
+	
+	driverP = (can_if_driver_t*) &can_driver_elm327;
+	max_sessions = driverP->max_sessions;
+}
+
+
+// A request opens a session for its ECU (rsp_id != 0), monitor mode subscribes the
+// broadcast IDs
+void parse_bench_can_start(uint32_t req_id, uint32_t rsp_id, int num_bcast_ids, const uint32_t* bcast_ids)
+{
+	_can_free_all_sessions();
+	
+	if (rsp_id != 0) {
+		(void) _can_alloc_session(req_id, rsp_id);
+	}
+	
+	if (num_bcast_ids > CAN_MANAGER_MAX_BCAST) {
+		num_bcast_ids = CAN_MANAGER_MAX_BCAST;
+	}
+	for (int i=0; i<num_bcast_ids; i++) {
+		bcast_id[i] = bcast_ids[i];
+	}
+	num_bcast = num_bcast_ids;
+}
+
+
+bool parse_bench_can_sane()
+{
+	for (int i=0; i<CAN_MANAGER_MAX_SESSIONS; i++) {
+		if (session[i].in_use &&
+		    ((session[i].num_rx_bytes > rsp_buf_len) || (session[i].data_index > session[i].num_rx_bytes))) {
+			return false;
+		}
+	}
+	
+	return (num_sessions >= 0) && (num_sessions <= max_sessions);
+}
@@ -0,0 +1,99 @@
+/*
+ * Parser benchmark build of the ELM327 driver
+ *
+ * The driver compiled unchanged with functions to start an exchange on the WiFi interface
+ * instance and read back what its parsers made of it.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "can_driver_elm327.c"
+#include "parse_bench.h"
+
+
+
+//
+// Parser benchmark hooks
+//
+
+// The state a request written by tx_packet (or the ATMA of start_monitor) leaves the
+// adapter instance in.  Requests are synchronous so nothing reports to the CAN manager
+// at the prompt and no request timer runs.
+void parse_bench_elm327_start(int type, uint32_t rsp_id)
+{
+	elm327_dev_t* d = &elm327_dev[0];
+	
+	if_devP[CAN_DRIVER_ELM327_WIFI] = d;
+	d->op_state = OP_ST_CONNECTED;
+	d->req_async = false;
+	d->tx_wait_task = NULL;
+	d->pipe_pending_cmds = 0;
+	d->rsp_text_en = false;
+	d->rsp_text_len = 0;
+	d->no_data = false;
+	d->unknown_cmd = false;
+	d->prev_rsp_id = rsp_id;
+	d->elm327_version_string[0] = 0;
+	
+	switch (type) {
+		case PARSE_BENCH_AT:
+			d->tx_state = TX_ST_AT_CMD;
+			break;
+		case PARSE_BENCH_MON_11:
+			d->tx_state = TX_ST_MONITOR;
+			d->mon_header_size = HEADER_SIZE_11;
+			break;
+		case PARSE_BENCH_MON_29:
+			d->tx_state = TX_ST_MONITOR;
+			d->mon_header_size = HEADER_SIZE_29;
+			break;
+		case PARSE_BENCH_MON_STOP:
+			d->tx_state = TX_ST_MON_STOP;
+			break;
+		default:
+			d->tx_state = TX_ST_REQ_PKT;
+	}
+	
+	_can_driver_elm327_reset_parser(d);
+}
+
+
+void parse_bench_elm327_get_state(parse_bench_elm327_state_t* stateP)
+{
+	elm327_dev_t* d = &elm327_dev[0];
+	
+	switch (d->tx_state) {
+		case TX_ST_IDLE:
+		case TX_ST_MONITOR:
+			stateP->state = PARSE_BENCH_ST_OK;
+			break;
+		case TX_ST_AT_CMD:
+		case TX_ST_REQ_PKT:
+			stateP->state = PARSE_BENCH_ST_PENDING;
+			break;
+		default:
+			stateP->state = PARSE_BENCH_ST_ERROR;
+	}
+	
+	stateP->no_data = d->no_data;
+	stateP->unknown_cmd = d->unknown_cmd;
+	stateP->version = d->elm327_version_string;
+	stateP->parser_sane = (d->rsp_p.n >= 0) && (d->rsp_p.n <= 8) &&
+	                      (d->mon_p.n >= 0) && (d->mon_p.n <= 16) &&
+	                      (d->mon_p.id_chars >= 0) && (d->mon_p.id_chars <= 8) &&
+	                      (d->ver_index >= 0) && (d->ver_index < MAX_ELM327_VER_LEN) &&
+	                      (d->rsp_text_len <= MAX_RSP_TEXT_LEN);
+}
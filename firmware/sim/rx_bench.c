@@ -0,0 +1,741 @@
+/*
+ * Receive path benchmark
+ *
+ * Runs a vehicle's polling closed loop on the host through the CAN manager, Vehicle
+ * Manager, vehicle decoders and data broker compiled unchanged, with the frames coming
+ * from the ECU emulator or a captured candump log played back by the replay driver, and
+ * measures what each stage of the receive path costs.  The esp_timer callbacks the
+ * interface drivers deliver frames from are run from the main loop, which evaluates the
+ * Vehicle Manager when it is notified as can_task does.  Virtual time skips ahead to the
+ * next frame or evaluation so a run takes only as long as its processing.
+ *
+ *   rx_bench [--vehicle NAME] [--log FILE [--speed N]] [--capture FILE] [--seconds N]
+ *            [--passes N] [--report FILE] [-v]
+ *
+ *   --vehicle NAME   Vehicle to poll (default "VW MEB AWD")
+ *   --log FILE       Play back a candump log (e.g. downloaded from can_capture or written
+ *                    by --capture) in place of the ECU emulator
+ *   --speed N        Playback speed multiplier (default the replay driver's, 0 for as fast
+ *                    as possible)
+ *   --capture FILE   Write every frame sent and received as a candump log (holding the
+ *                    frames adds a little to the can_rx_packet time)
+ *   --seconds N      Virtual time polled after a short warm up (default 30)
+ *   --passes N       Passes over the recorded responses for the per stage timing
+ *                    (default 2000)
+ *   --report FILE    Write the results as CSV
+ *   -v               Debug logging
+ *
+ * Reported are the host time can_rx_packet takes per frame (ISO-TP reassembly, flow
+ * control and the response queue push), the time vm_eval takes per response (matching,
+ * decoding, storing and scheduling the next requests), the heap allocations made and the
+ * responses the Vehicle Manager dropped during the polled time and how many requests
+ * timed out.  Polling then continues briefly to collect the first response to each request,
+ * which are run through vm_get_resp_index and the vehicle's decoders on their own, and
+ * every item the vehicle supports is run through db_set_data_item_value.  The exit status is 1 if no responses were decoded or any were
+ * dropped.  As with gui_sim host rates are only comparable with other runs on the same
+ * machine.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "sim_port.h"
+#include "rx_bench.h"
+#include "can_capture.h"
+#include "can_driver_elm327.h"
+#include "can_driver_replay.h"
+#include "can_driver_twai.h"
+#include "can_manager.h"
+#include "can_task.h"
+#include "data_broker.h"
+#include "deadline_utilities.h"
+#include "elm327_interface_ble.h"
+#include "elm327_interface_usb.h"
+#include "elm327_interface_wifi.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ps_utilities.h"
+#include "tune_utilities.h"
+#include "vehicle_manager.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+//
+// Receive benchmark constants
+//
+
+#define RB_DEF_VEHICLE        "VW MEB AWD"
+
+// Polled virtual time.  The warm up (not measured) covers the response buffer planning,
+// the first requests of each profile and the per-ECU latency estimates settling.
+#define RB_DEF_SECONDS        30
+#define RB_WARMUP_MSEC        2000
+
+// Responses collected after the polled time for the per stage timing.  The first with
+// each ID, length, SID and DID is kept and then only the first matching each request.
+#define RB_RECORD_MSEC        2000
+#define RB_MAX_RSPS           256
+#define RB_MAX_RSP_LEN        512
+#define RB_KEY_LEN            3
+
+// Frames held for --capture (written at the end so the file isn't written while timing)
+#define RB_CAPTURE_FRAMES     (1024 * 1024)
+
+// Per stage timing.  The passes are split into rounds and the fastest round is reported
+// so other load on the host doesn't show up as a regression.
+#define RB_DEF_PASSES         2000
+#define RB_NUM_ROUNDS         5
+
+// Host clock reads averaged to find what timing one can_rx_packet call adds
+#define RB_CAL_READS          10000
+
+
+
+//
+// Receive benchmark typedefs
+//
+typedef struct {
+	uint32_t id;
+	int len;
+	int req_index;
+	uint8_t data[RB_MAX_RSP_LEN];
+} rb_rsp_t;
+
+typedef struct {
+	int64_t ts_usec;
+	uint32_t id;
+	uint8_t len;
+	uint8_t data[8];
+} rb_frame_t;
+
+typedef struct {
+	uint32_t frames;
+	uint32_t responses;
+	uint32_t dropped;
+	uint32_t timeouts;
+	uint32_t allocs;
+	uint64_t alloc_bytes;
+	int64_t rx_nsec;                   // Per frame
+	int64_t eval_nsec;                 // Per response
+	int num_match;
+	int64_t match_nsec;                // Per vm_get_resp_index call
+	int num_decode;
+	int64_t decode_nsec;               // Per decoded response
+	int num_items;
+	int64_t db_set_nsec;               // Per db_set_data_item_value call
+} rb_result_t;
+
+
+
+//
+// Receive benchmark variables
+//
+static const char* TAG = "rx_bench";
+
+// Responses seen
+static bool record_en = false;
+static uint32_t num_responses;
+static rb_rsp_t rsp_list[RB_MAX_RSPS];
+static int num_rsps = 0;
+
+// Frames for --capture
+static rb_frame_t* capture_bufP = NULL;
+static int num_capture = 0;
+
+// Heap use (counted by the malloc wrappers the link sets up)
+static bool count_allocs = false;
+static uint32_t num_allocs;
+static uint64_t num_alloc_bytes;
+
+static int num_passes = RB_DEF_PASSES;
+static int log_level = SIM_LOG_INFO;
+
+static rb_result_t result;
+
+
+
+//
+// Forward declarations for internal functions
+//
+static void _rb_poll(int64_t usec, int64_t* eval_nsecP);
+static uint32_t _rb_count_timeouts();
+static void _rb_time_match();
+static void _rb_time_decode();
+static void _rb_time_db_set();
+static int64_t _rb_clock_nsec();
+static void _rb_record_rsp(uint32_t id, int len, const uint8_t* data);
+static bool _rb_write_capture(const char* path);
+static bool _rb_write_report(const char* path, const char* vehicle, const char* source);
+static void _rb_usage(const char* prog);
+
+
+
+//
+// Receive benchmark main
+//
+int main(int argc, char** argv)
+{
+	const char* vehicle = RB_DEF_VEHICLE;
+	const char* log_file = NULL;
+	const char* capture_file = NULL;
+	const char* report_file = NULL;
+	const char* source;
+	rx_bench_can_stats_t rx_stats;
+	int seconds = RB_DEF_SECONDS;
+	int speed = -1;
+	int if_type;
+	int64_t eval_nsec = 0;
+	int64_t clock_nsec;
+	uint32_t start_dropped;
+	uint32_t start_timeouts;
+	
+	for (int i=1; i<argc; i++) {
+		if ((strcmp(argv[i], "--vehicle") == 0) && ((i + 1) < argc)) {
+			vehicle = argv[++i];
+		} else if ((strcmp(argv[i], "--log") == 0) && ((i + 1) < argc)) {
+			log_file = argv[++i];
+		} else if ((strcmp(argv[i], "--speed") == 0) && ((i + 1) < argc)) {
+			speed = atoi(argv[++i]);
+		} else if ((strcmp(argv[i], "--capture") == 0) && ((i + 1) < argc)) {
+			capture_file = argv[++i];
+		} else if ((strcmp(argv[i], "--seconds") == 0) && ((i + 1) < argc)) {
+			seconds = atoi(argv[++i]);
+		} else if ((strcmp(argv[i], "--passes") == 0) && ((i + 1) < argc)) {
+			num_passes = atoi(argv[++i]);
+		} else if ((strcmp(argv[i], "--report") == 0) && ((i + 1) < argc)) {
+			report_file = argv[++i];
+		} else if (strcmp(argv[i], "-v") == 0) {
+			log_level = SIM_LOG_DEBUG;
+		} else {
+			_rb_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (seconds < 1) {
+		seconds = 1;
+	}
+	if (num_passes < RB_NUM_ROUNDS) {
+		num_passes = RB_NUM_ROUNDS;
+	}
+	
+	sim_port_init(log_level);
+	tune_init();
+	if (db_init() != ESP_OK) {
+		ESP_LOGE(TAG, "Data broker init failed");
+		return 1;
+	}
+	deadline_init(DEADLINE_LOOP_CAN, CAN_TASK_BUDGET_USEC);
+	
+	if (capture_file != NULL) {
+		capture_bufP = malloc(RB_CAPTURE_FRAMES * sizeof(rb_frame_t));
+		if (capture_bufP == NULL) {
+			ESP_LOGE(TAG, "Capture buffer allocation failed");
+			return 1;
+		}
+		
+		// Touched now so its page faults aren't timed
+		memset(capture_bufP, 0, RB_CAPTURE_FRAMES * sizeof(rb_frame_t));
+	}
+	
+	if (log_file != NULL) {
+		rx_bench_replay_set_file(log_file);
+		if (speed >= 0) {
+			can_driver_replay_set_speed(speed);
+		}
+		if_type = CAN_MANAGER_IF_REPLAY;
+		source = "replay";
+	} else {
+		if_type = CAN_MANAGER_IF_EMU;
+		source = "emulator";
+	}
+	
+	// Started as can_task starts it, polling every item the vehicle supports
+	vm_set_notify_task(xTaskGetCurrentTaskHandle());
+	if (!vm_init(vehicle, if_type)) {
+		ESP_LOGE(TAG, "Could not start %s on the %s", vehicle, source);
+		for (int i=0; i<vm_get_num_vehicles(); i++) {
+			ESP_LOGI(TAG, "  %s", vm_get_vehicle_name(i));
+		}
+		return 1;
+	}
+	vm_set_request_item_mask(vm_get_supported_item_mask());
+	
+	_rb_poll((int64_t) RB_WARMUP_MSEC * 1000, NULL);
+	
+	// Polled time, with the code under test only logging errors
+	if (log_level < SIM_LOG_DEBUG) {
+		sim_set_log_level(SIM_LOG_ERROR);
+	}
+	start_dropped = rx_bench_vm_get_drop_count();
+	start_timeouts = _rb_count_timeouts();
+	num_responses = 0;
+	num_allocs = 0;
+	num_alloc_bytes = 0;
+	count_allocs = true;
+	rx_bench_can_enable_timing(true);
+	_rb_poll((int64_t) seconds * 1000000, &eval_nsec);
+	rx_bench_can_enable_timing(false);
+	count_allocs = false;
+	
+	rx_bench_can_get_stats(&rx_stats);
+	clock_nsec = _rb_clock_nsec();
+	result.frames = rx_stats.num_frames;
+	result.responses = num_responses;
+	result.dropped = rx_bench_vm_get_drop_count() - start_dropped;
+	result.timeouts = _rb_count_timeouts() - start_timeouts;
+	result.allocs = num_allocs;
+	result.alloc_bytes = num_alloc_bytes;
+	if (rx_stats.num_frames > 0) {
+		result.rx_nsec = (rx_stats.nsec / rx_stats.num_frames) - clock_nsec;
+		if (result.rx_nsec < 0) {
+			result.rx_nsec = 0;
+		}
+	}
+	if (num_responses > 0) {
+		result.eval_nsec = eval_nsec / num_responses;
+	}
+	
+	// Collect responses for the per stage timing
+	record_en = true;
+	_rb_poll((int64_t) RB_RECORD_MSEC * 1000, NULL);
+	record_en = false;
+	sim_set_log_level(log_level);
+	
+	ESP_LOGI(TAG, "%s (%s): %d sec, %lu frames, %lu responses, %lu dropped, %lu timeouts, %lu allocations (%llu bytes)",
+		vehicle, source, seconds, (unsigned long) result.frames, (unsigned long) result.responses,
+		(unsigned long) result.dropped, (unsigned long) result.timeouts, (unsigned long) result.allocs,
+		(unsigned long long) result.alloc_bytes);
+	ESP_LOGI(TAG, "  can_rx_packet: %lld ns/frame, vm_eval: %lld ns/response", (long long) result.rx_nsec,
+		(long long) result.eval_nsec);
+	
+	// Then each stage on its own
+	sim_set_log_level(SIM_LOG_NONE);
+	_rb_time_match();
+	_rb_time_decode();
+	_rb_time_db_set();
+	sim_set_log_level(log_level);
+	
+	ESP_LOGI(TAG, "  vm_get_resp_index: %lld ns (%d responses), decode: %lld ns/response (%d), db_set_data_item_value: %lld ns (%d items)",
+		(long long) result.match_nsec, result.num_match, (long long) result.decode_nsec, result.num_decode,
+		(long long) result.db_set_nsec, result.num_items);
+	
+	if ((capture_file != NULL) && !_rb_write_capture(capture_file)) {
+		return 1;
+	}
+	if ((report_file != NULL) && !_rb_write_report(report_file, vehicle, source)) {
+		return 1;
+	}
+	if ((result.responses == 0) || (result.dropped != 0)) {
+		ESP_LOGE(TAG, "%s", (result.responses == 0) ? "No responses" : "Responses dropped");
+		return 1;
+	}
+	
+	return 0;
+}
+
+
+
+//
+// Stubs
+//
+
+// Capture is the benchmark's view of what the CAN manager passed on
+volatile bool can_capture_active = true;
+
+void can_capture_record(int type, uint32_t id, int len, const uint8_t* data)
+{
+	rb_frame_t* fP;
+	
+	if (type == CAN_CAPTURE_RSP) {
+		num_responses += 1;
+		if (record_en) {
+			_rb_record_rsp(id, len, data);
+		}
+	} else if ((capture_bufP != NULL) && (num_capture < RB_CAPTURE_FRAMES)) {
+		fP = &capture_bufP[num_capture++];
+		fP->ts_usec = esp_timer_get_time();
+		fP->id = id;
+		fP->len = (len > 8) ? 8 : len;
+		memcpy(fP->data, data, fP->len);
+	}
+}
+
+// Interfaces that are never selected (the ELM327 driver is built for the CAN manager to link)
+const can_if_driver_t can_driver_twai;
+const elm327_if_driver_t elm327_interface_driver_wifi = {"WiFi"};
+const elm327_if_driver_t elm327_interface_driver_ble = {"BLE"};
+const elm327_if_driver_t elm327_interface_driver_usb = {"USB"};
+
+
+bool ps_get_config(int index, void** cfg)
+{
+	return false;
+}
+
+
+bool ps_save_config(int index)
+{
+	return false;
+}
+
+
+bool ps_flush()
+{
+	return false;
+}
+
+
+// The heap functions the code under test calls are wrapped (-Wl,--wrap) to count its
+// allocations
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+int __real_posix_memalign(void** pP, size_t alignment, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+	if (count_allocs) {
+		num_allocs += 1;
+		num_alloc_bytes += size;
+	}
+	return __real_malloc(size);
+}
+
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+	if (count_allocs) {
+		num_allocs += 1;
+		num_alloc_bytes += n * size;
+	}
+	return __real_calloc(n, size);
+}
+
+
+void* __wrap_realloc(void* p, size_t size)
+{
+	if (count_allocs) {
+		num_allocs += 1;
+		num_alloc_bytes += size;
+	}
+	return __real_realloc(p, size);
+}
+
+
+int __wrap_posix_memalign(void** pP, size_t alignment, size_t size)
+{
+	if (count_allocs) {
+		num_allocs += 1;
+		num_alloc_bytes += size;
+	}
+	return __real_posix_memalign(pP, alignment, size);
+}
+
+
+
+//
+// API
+//
+
+// Timing uses the host clock (the simulator's virtual clock is for its waits)
+int64_t rx_bench_host_nsec()
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+
+
+//
+// Internal functions
+//
+
+// Run the drivers' timers and evaluate the Vehicle Manager when it has something for us
+// or its period is up, skipping virtual time to whichever is next.  The host time spent
+// in vm_eval is added to eval_nsecP if it isn't NULL.
+static void _rb_poll(int64_t usec, int64_t* eval_nsecP)
+{
+	int64_t cur_usec = esp_timer_get_time();
+	int64_t end_usec = cur_usec + usec;
+	int64_t eval_usec = cur_usec;
+	int64_t next_usec;
+	int64_t start_nsec;
+	
+	while ((cur_usec = esp_timer_get_time()) < end_usec) {
+		sim_run_timers();
+	
+		if ((sim_take_notifications() != 0) || (cur_usec >= eval_usec)) {
+			start_nsec = rx_bench_host_nsec();
+			vm_eval();
+			if (eval_nsecP != NULL) {
+				*eval_nsecP += rx_bench_host_nsec() - start_nsec;
+			}
+			eval_usec = cur_usec + (int64_t) tune_get(TUNE_CAN_EVAL_MSEC) * 1000;
+		}
+	
+		next_usec = sim_next_timer_usec();
+		if (next_usec > eval_usec) next_usec = eval_usec;
+		if (next_usec > end_usec) next_usec = end_usec;
+		sim_skip_usec(next_usec - esp_timer_get_time());
+	}
+}
+
+
+static uint32_t _rb_count_timeouts()
+{
+	vm_req_stats_t stats;
+	uint32_t n = 0;
+	
+	for (int i=0; i<rx_bench_vm_get_num_req(); i++) {
+		if (vm_get_request_stats(i, &stats)) {
+			n += stats.num_timeout + stats.num_frame_timeout;
+		}
+	}
+	
+	return n;
+}
+
+
+// vm_get_resp_index over the recorded responses (after keeping only the first matching
+// each request)
+static void _rb_time_match()
+{
+	int passes_per_round = num_passes / RB_NUM_ROUNDS;
+	int64_t best_nsec = INT64_MAX;
+	int64_t start_nsec;
+	int64_t nsec;
+	int num_kept = 0;
+	bool keep;
+	volatile int n;
+	
+	for (int i=0; i<num_rsps; i++) {
+		rsp_list[i].req_index = rx_bench_vm_resp_index(rsp_list[i].id, rsp_list[i].len, rsp_list[i].data);
+		keep = true;
+		for (int j=0; (j<num_kept) && (rsp_list[i].req_index >= 0); j++) {
+			if (rsp_list[j].req_index == rsp_list[i].req_index) {
+				keep = false;
+				break;
+			}
+		}
+		if (keep) {
+			if (i != num_kept) {
+				rsp_list[num_kept] = rsp_list[i];
+			}
+			num_kept += 1;
+		}
+	}
+	num_rsps = num_kept;
+	
+	result.num_match = num_rsps;
+	if (num_rsps == 0) {
+		return;
+	}
+	
+	for (int r=0; r<RB_NUM_ROUNDS; r++) {
+		start_nsec = rx_bench_host_nsec();
+		for (int p=0; p<passes_per_round; p++) {
+			for (int i=0; i<num_rsps; i++) {
+				n = rx_bench_vm_resp_index(rsp_list[i].id, rsp_list[i].len, rsp_list[i].data);
+			}
+		}
+		nsec = rx_bench_host_nsec() - start_nsec;
+		if (nsec < best_nsec) {
+			best_nsec = nsec;
+		}
+	}
+	(void) n;
+	
+	result.match_nsec = best_nsec / ((int64_t) passes_per_round * num_rsps);
+}
+
+
+// The vehicle's decoders (and the data broker updates they make) for each recorded
+// response that matches a request
+static void _rb_time_decode()
+{
+	int passes_per_round = num_passes / RB_NUM_ROUNDS;
+	int64_t best_nsec = INT64_MAX;
+	int64_t start_nsec;
+	int64_t nsec;
+	
+	result.num_decode = 0;
+	for (int i=0; i<num_rsps; i++) {
+		if (rsp_list[i].req_index >= 0) {
+			result.num_decode += 1;
+		}
+	}
+	if (result.num_decode == 0) {
+		return;
+	}
+	
+	for (int r=0; r<RB_NUM_ROUNDS; r++) {
+		start_nsec = rx_bench_host_nsec();
+		for (int p=0; p<passes_per_round; p++) {
+			for (int i=0; i<num_rsps; i++) {
+				if (rsp_list[i].req_index >= 0) {
+					rx_bench_vm_decode(rsp_list[i].id, rsp_list[i].req_index, rsp_list[i].len, rsp_list[i].data);
+				}
+			}
+		}
+		nsec = rx_bench_host_nsec() - start_nsec;
+		if (nsec < best_nsec) {
+			best_nsec = nsec;
+		}
+	}
+	
+	result.decode_nsec = best_nsec / ((int64_t) passes_per_round * result.num_decode);
+}
+
+
+// Every item the vehicle supports with a changing value
+static void _rb_time_db_set()
+{
+	int passes_per_round = num_passes / RB_NUM_ROUNDS;
+	db_mask_t mask = vm_get_supported_item_mask();
+	int64_t best_nsec = INT64_MAX;
+	int64_t start_nsec;
+	int64_t nsec;
+	
+	result.num_items = 0;
+	for (int item=0; item<DB_MAX_ITEMS; item++) {
+		if ((mask & DB_MASK(item)) != 0) {
+			result.num_items += 1;
+		}
+	}
+	if (result.num_items == 0) {
+		return;
+	}
+	
+	for (int r=0; r<RB_NUM_ROUNDS; r++) {
+		start_nsec = rx_bench_host_nsec();
+		for (int p=0; p<passes_per_round; p++) {
+			for (int item=0; item<DB_MAX_ITEMS; item++) {
+				if ((mask & DB_MASK(item)) != 0) {
+					db_set_data_item_value(item, (float) (p % 100));
+				}
+			}
+		}
+		nsec = rx_bench_host_nsec() - start_nsec;
+		if (nsec < best_nsec) {
+			best_nsec = nsec;
+		}
+	}
+	
+	result.db_set_nsec = best_nsec / ((int64_t) passes_per_round * result.num_items);
+}
+
+
+// Host time one timed can_rx_packet call adds (the clock reads)
+static int64_t _rb_clock_nsec()
+{
+	int64_t start_nsec = rx_bench_host_nsec();
+	volatile int64_t t;
+	
+	for (int i=0; i<RB_CAL_READS; i++) {
+		t = rx_bench_host_nsec();
+	}
+	(void) t;
+	
+	return (rx_bench_host_nsec() - start_nsec) / RB_CAL_READS;
+}
+
+
+// Keep the first of each response (by ID, length, SID and DID)
+static void _rb_record_rsp(uint32_t id, int len, const uint8_t* data)
+{
+	int key_len = (len < RB_KEY_LEN) ? len : RB_KEY_LEN;
+	
+	if ((num_rsps >= RB_MAX_RSPS) || (len > RB_MAX_RSP_LEN)) {
+		return;
+	}
+	
+	for (int i=0; i<num_rsps; i++) {
+		if ((rsp_list[i].id == id) && (rsp_list[i].len == len) && (memcmp(rsp_list[i].data, data, key_len) == 0)) {
+			return;
+		}
+	}
+	
+	rsp_list[num_rsps].id = id;
+	rsp_list[num_rsps].len = len;
+	memcpy(rsp_list[num_rsps].data, data, len);
+	num_rsps += 1;
+}
+
+
+// The candump format can_capture downloads (and the replay driver plays back)
+static bool _rb_write_capture(const char* path)
+{
+	FILE* fp;
+	const rb_frame_t* fP;
+	
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Open %s failed", path);
+		return false;
+	}
+	
+	for (int i=0; i<num_capture; i++) {
+		fP = &capture_bufP[i];
+		fprintf(fp, "(%lld.%06lld) can0 %0*lX#", (long long) (fP->ts_usec / 1000000), (long long) (fP->ts_usec % 1000000),
+		        (fP->id > 0x7FF) ? 8 : 3, (unsigned long) fP->id);
+		for (int j=0; j<fP->len; j++) {
+			fprintf(fp, "%02X", fP->data[j]);
+		}
+		fprintf(fp, "\n");
+	}
+	fclose(fp);
+	
+	if (num_capture == RB_CAPTURE_FRAMES) {
+		ESP_LOGW(TAG, "Capture stopped after %d frames", num_capture);
+	}
+	ESP_LOGI(TAG, "Wrote %s (%d frames)", path, num_capture);
+	return true;
+}
+
+
+static bool _rb_write_report(const char* path, const char* vehicle, const char* source)
+{
+	FILE* fp;
+	
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		ESP_LOGE(TAG, "Open %s failed", path);
+		return false;
+	}
+	
+	fprintf(fp, "vehicle,source,frames,responses,dropped,timeouts,allocs,alloc_bytes,rx_ns_per_frame,eval_ns_per_rsp,match_ns,decode_ns,db_set_ns\n");
+	fprintf(fp, "%s,%s,%lu,%lu,%lu,%lu,%lu,%llu,%lld,%lld,%lld,%lld,%lld\n", vehicle, source,
+		(unsigned long) result.frames, (unsigned long) result.responses, (unsigned long) result.dropped,
+		(unsigned long) result.timeouts, (unsigned long) result.allocs, (unsigned long long) result.alloc_bytes, (long long) result.rx_nsec, (long long) result.eval_nsec,
+		(long long) result.match_nsec, (long long) result.decode_nsec, (long long) result.db_set_nsec);
+	fclose(fp);
+	
+	ESP_LOGI(TAG, "Wrote %s", path);
+	return true;
+}
+
+
+static void _rb_usage(const char* prog)
+{
+	printf("Usage: %s [--vehicle NAME] [--log FILE [--speed N]] [--capture FILE] [--seconds N] [--passes N] [--report FILE] [-v]\n", prog);
+}
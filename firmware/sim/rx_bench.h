@@ -0,0 +1,65 @@
+/*
+ * Receive path benchmark access to the CAN manager and Vehicle Manager internals
+ *
+ * rx_bench_can.c, rx_bench_vm.c and rx_bench_replay.c compile the firmware sources
+ * unchanged with these functions appended so the benchmark can time the receive path
+ * frame by frame and run the response matching and vehicle decoders on their own.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef RX_BENCH_H
+#define RX_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// Typedefs
+//
+
+// Frames handed to can_rx_packet by the interface driver and the host time spent in it
+// (ISO-TP reassembly, flow control and the Vehicle Manager response queue push)
+typedef struct {
+	uint32_t num_frames;
+	int64_t nsec;
+} rx_bench_can_stats_t;
+
+
+
+//
+// API
+//
+
+// rx_bench.c
+int64_t rx_bench_host_nsec();
+
+// rx_bench_can.c
+void rx_bench_can_enable_timing(bool en);
+void rx_bench_can_get_stats(rx_bench_can_stats_t* statsP);
+
+// rx_bench_replay.c
+void rx_bench_replay_set_file(const char* path);
+
+// rx_bench_vm.c
+uint32_t rx_bench_vm_get_drop_count();
+int rx_bench_vm_get_num_req();
+int rx_bench_vm_resp_index(uint32_t id, int len, uint8_t* data);
+void rx_bench_vm_decode(uint32_t id, int req_index, int len, uint8_t* data);
+
+#endif /* RX_BENCH_H */
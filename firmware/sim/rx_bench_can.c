@@ -0,0 +1,70 @@
+/*
+ * Receive path benchmark build of the CAN manager
+ *
+ * The CAN manager compiled unchanged with its can_rx_packet renamed so the interface
+ * drivers' frames pass through a version here that times each call.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#define can_rx_packet _rx_bench_can_rx_packet
+#include "can_manager.c"
+#undef can_rx_packet
+#include "rx_bench.h"
+
+
+
+//
+// Receive path benchmark variables
+//
+static bool timing_en = false;
+static rx_bench_can_stats_t rx_stats;
+
+
+
+//
+// Receive path benchmark hooks
+//
+void can_rx_packet(uint32_t rsp_id, int len, uint8_t* data, int64_t rx_usec)
+{
+	int64_t start_nsec;
+	
+	if (!timing_en) {
+		_rx_bench_can_rx_packet(rsp_id, len, data, rx_usec);
+		return;
+	}
+	
+	start_nsec = rx_bench_host_nsec();
+	_rx_bench_can_rx_packet(rsp_id, len, data, rx_usec);
+	rx_stats.nsec += rx_bench_host_nsec() - start_nsec;
+	rx_stats.num_frames += 1;
+}
+
+
+// Enabling starts the counts over
+void rx_bench_can_enable_timing(bool en)
+{
+	if (en) {
+		memset(&rx_stats, 0, sizeof(rx_stats));
+	}
+	timing_en = en;
+}
+
+
+void rx_bench_can_get_stats(rx_bench_can_stats_t* statsP)
+{
+	*statsP = rx_stats;
+}
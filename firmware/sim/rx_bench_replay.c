@@ -0,0 +1,43 @@
+/*
+ * Receive path benchmark build of the log replay driver
+ *
+ * The replay driver compiled unchanged with its log read from a host file instead of the
+ * flash file system.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "can_capture.h"
+
+// CAN_REPLAY_FILE is CAN_CAPTURE_UPLOAD_FILE
+static const char* replay_pathP = CAN_CAPTURE_UPLOAD_FILE;
+#undef CAN_CAPTURE_UPLOAD_FILE
+#define CAN_CAPTURE_UPLOAD_FILE replay_pathP
+
+#include "can_driver_replay.c"
+#include "rx_bench.h"
+
+
+
+//
+// Receive path benchmark hooks
+//
+
+// Must be set before the interface is started
+void rx_bench_replay_set_file(const char* path)
+{
+	replay_pathP = path;
+}
@@ -0,0 +1,63 @@
+/*
+ * Receive path benchmark build of the Vehicle Manager
+ *
+ * The Vehicle Manager compiled unchanged with functions to read its dropped response
+ * count and to run the response matching and the current vehicle's decoders on a
+ * response outside of vm_eval.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "vehicle_manager.c"
+#include "rx_bench.h"
+
+
+
+//
+// Receive path benchmark hooks
+//
+
+// Responses the queue had no room for
+uint32_t rx_bench_vm_get_drop_count()
+{
+	return rsp_drop_count;
+}
+
+
+int rx_bench_vm_get_num_req()
+{
+	return sched_num_req;
+}
+
+
+// A response matched against the vehicle's request list the way vehicles do
+int rx_bench_vm_resp_index(uint32_t id, int len, uint8_t* data)
+{
+	return vm_get_resp_index(id, len, data, sched_num_req, sched_req_list);
+}
+
+
+// A response through the vehicle's decoders and into the data broker as vm_eval passes
+// it on (without the scheduler's bookkeeping)
+void rx_bench_vm_decode(uint32_t id, int req_index, int len, uint8_t* data)
+{
+	cur_rx_usec = esp_timer_get_time();
+	db_batch_begin(&cur_rx_batch);
+	cur_vehicleP->fcn_rx_data(id, req_index, len, data);
+	cur_stream_listP = NULL;
+	db_batch_commit(&cur_rx_batch);
+	cur_rx_usec = 0;
+}
@@ -0,0 +1,728 @@
+/*
+ * Simulator port
+ *
+ * The virtual clock is the host's monotonic clock plus an offset that sim_skip_usec()
+ * advances, so time spent rendering is real (and measured by gui_bench) while idle waits
+ * cost nothing.  esp_random() is a fixed-seed generator so runs show the same synthetic
+ * data.  The assets "partition" is the bundle the build packs from the firmware sources.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "sim_port.h"
+#include "esp_app_desc.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_random.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "gui_assets.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+
+//
+// Simulator port constants
+//
+
+// Reported heap (the ESP32-S3 with 8 MB PSRAM after startup)
+#define SIM_INT_HEAP_BYTES   (200 * 1024)
+#define SIM_PSRAM_HEAP_BYTES (7 * 1024 * 1024)
+
+// CPU clock for esp_cpu_get_cycle_count()
+#define SIM_CPU_MHZ          240
+
+// esp_random() seed
+#define SIM_RANDOM_SEED      0x2545F491
+
+
+
+//
+// Simulator port typedefs
+//
+struct esp_timer {
+	esp_timer_cb_t callback;
+	void* arg;
+	bool active;
+	uint64_t period;                   // 0 for a one-shot timer
+	int64_t due_usec;
+	struct esp_timer* nextP;
+};
+
+struct sim_task {
+	uint32_t notify_val;
+};
+
+struct sim_sem {
+	int count;
+};
+
+struct sim_queue {
+	UBaseType_t len;
+	UBaseType_t item_size;
+	UBaseType_t head;
+	UBaseType_t num;
+	uint8_t* bufP;
+};
+
+
+
+//
+// Simulator port variables
+//
+static const char* TAG = "sim_port";
+
+static int64_t host_start_usec;
+static int64_t virt_offset_usec = 0;
+
+static struct esp_timer* timer_listP = NULL;
+
+static struct sim_task gui_task_obj;
+
+static uint32_t random_state = SIM_RANDOM_SEED;
+
+static int log_max_level = SIM_LOG_INFO;
+
+static esp_partition_t assets_part;
+static uint8_t* assets_bufP = NULL;
+
+static const esp_app_desc_t app_desc = {
+	.magic_word = 0xABCD5432,
+	.version = "sim",
+	.project_name = "ev_info_display",
+	.time = __TIME__,
+	.date = __DATE__,
+	.idf_ver = "host"
+};
+
+
+
+//
+// Forward declarations for internal functions
+//
+static int64_t _sim_host_usec();
+static void _sim_load_assets();
+
+
+
+//
+// API
+//
+void sim_port_init(int log_level)
+{
+	host_start_usec = _sim_host_usec();
+	log_max_level = log_level;
+	_sim_load_assets();
+}
+
+
+// Changed around timed sections so the logging of the code under test isn't measured
+void sim_set_log_level(int log_level)
+{
+	log_max_level = log_level;
+}
+
+
+void sim_skip_usec(int64_t usec)
+{
+	if (usec > 0) {
+		virt_offset_usec += usec;
+	}
+}
+
+
+// Returns INT64_MAX when no timer is running
+int64_t sim_next_timer_usec()
+{
+	struct esp_timer* tP = timer_listP;
+	int64_t next_usec = INT64_MAX;
+	
+	while (tP != NULL) {
+		if (tP->active && (tP->due_usec < next_usec)) {
+			next_usec = tP->due_usec;
+		}
+		tP = tP->nextP;
+	}
+	
+	return next_usec;
+}
+
+
+void sim_run_timers()
+{
+	struct esp_timer* tP;
+	bool fired;
+	
+	// Start over after each callback since it may have started, stopped or deleted timers
+	do {
+		fired = false;
+		tP = timer_listP;
+		while (tP != NULL) {
+			if (tP->active && (tP->due_usec <= esp_timer_get_time())) {
+				if (tP->period != 0) {
+					tP->due_usec += tP->period;
+				} else {
+					tP->active = false;
+				}
+				tP->callback(tP->arg);
+				fired = true;
+				break;
+			}
+			tP = tP->nextP;
+		}
+	} while (fired);
+}
+
+
+uint32_t sim_take_notifications()
+{
+	uint32_t val = gui_task_obj.notify_val;
+	
+	gui_task_obj.notify_val = 0;
+	return val;
+}
+
+
+
+//
+// ESP-IDF
+//
+void sim_log(int level, const char* tag, const char* fmt, ...)
+{
+	static const char level_char[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+	va_list args;
+	
+	if ((level > log_max_level) || (level > ESP_LOG_VERBOSE)) return;
+	
+	printf("%c (%lld) %s: ", level_char[level], (long long) (esp_timer_get_time() / 1000), tag);
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	printf("\n");
+}
+
+
+esp_log_level_t esp_log_level_get(const char* tag)
+{
+	return (esp_log_level_t) log_max_level;
+}
+
+
+const char* esp_err_to_name(esp_err_t err)
+{
+	switch (err) {
+		case ESP_OK: return "ESP_OK";
+		case ESP_FAIL: return "ESP_FAIL";
+		case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+		case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+		case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+		case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+		case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+		case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+		default: return "UNKNOWN ERROR";
+	}
+}
+
+
+void esp_restart(void)
+{
+	ESP_LOGW(TAG, "Restart requested - exiting");
+	exit(1);
+}
+
+
+// xorshift32
+uint32_t esp_random(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+	return (uint32_t) (esp_timer_get_time() * SIM_CPU_MHZ);
+}
+
+
+const esp_app_desc_t* esp_app_get_description(void)
+{
+	return &app_desc;
+}
+
+
+int64_t esp_timer_get_time(void)
+{
+	return _sim_host_usec() - host_start_usec + virt_offset_usec;
+}
+
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handleP)
+{
+	struct esp_timer* tP;
+	
+	tP = calloc(1, sizeof(struct esp_timer));
+	if (tP == NULL) return ESP_ERR_NO_MEM;
+	
+	tP->callback = args->callback;
+	tP->arg = args->arg;
+	tP->nextP = timer_listP;
+	timer_listP = tP;
+	*handleP = tP;
+	
+	return ESP_OK;
+}
+
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+	if (timer->active) return ESP_ERR_INVALID_STATE;
+	
+	timer->period = 0;
+	timer->due_usec = esp_timer_get_time() + timeout_us;
+	timer->active = true;
+	return ESP_OK;
+}
+
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+	if (timer->active) return ESP_ERR_INVALID_STATE;
+	
+	timer->period = period;
+	timer->due_usec = esp_timer_get_time() + period;
+	timer->active = true;
+	return ESP_OK;
+}
+
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+	if (!timer->active) return ESP_ERR_INVALID_STATE;
+	
+	timer->active = false;
+	return ESP_OK;
+}
+
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+	struct esp_timer** tPP = &timer_listP;
+	
+	while (*tPP != NULL) {
+		if (*tPP == timer) {
+			*tPP = timer->nextP;
+			free(timer);
+			return ESP_OK;
+		}
+		tPP = &(*tPP)->nextP;
+	}
+	
+	return ESP_ERR_INVALID_ARG;
+}
+
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+	return timer->active;
+}
+
+
+// Capabilities are ignored
+void* heap_caps_malloc(size_t size, uint32_t caps)
+{
+	return malloc(size);
+}
+
+
+void* heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+	return calloc(n, size);
+}
+
+
+void* heap_caps_realloc(void* p, size_t size, uint32_t caps)
+{
+	return realloc(p, size);
+}
+
+
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+	void* p;
+	
+	if (posix_memalign(&p, alignment, size) != 0) return NULL;
+	return p;
+}
+
+
+void heap_caps_free(void* p)
+{
+	free(p);
+}
+
+
+size_t heap_caps_get_allocated_size(void* p)
+{
+	return malloc_usable_size(p);
+}
+
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+	return ((caps & MALLOC_CAP_SPIRAM) != 0) ? SIM_PSRAM_HEAP_BYTES : SIM_INT_HEAP_BYTES;
+}
+
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+	return heap_caps_get_free_size(caps);
+}
+
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+	return heap_caps_get_free_size(caps);
+}
+
+
+void heap_caps_get_info(multi_heap_info_t* info, uint32_t caps)
+{
+	memset(info, 0, sizeof(multi_heap_info_t));
+	info->total_free_bytes = heap_caps_get_free_size(caps);
+	info->largest_free_block = info->total_free_bytes;
+	info->minimum_free_bytes = info->total_free_bytes;
+}
+
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+	if ((assets_bufP == NULL) || (type != ESP_PARTITION_TYPE_DATA)) return NULL;
+	if ((label != NULL) && (strcmp(label, assets_part.label) != 0)) return NULL;
+	
+	return &assets_part;
+}
+
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void** out_ptr, esp_partition_mmap_handle_t* out_handle)
+{
+	if ((partition != &assets_part) || ((offset + size) > assets_part.size)) return ESP_ERR_INVALID_ARG;
+	
+	*out_ptr = assets_bufP + offset;
+	*out_handle = 1;
+	return ESP_OK;
+}
+
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle)
+{
+}
+
+
+// There is no network in the simulator (wifi_get_http_server() returns NULL)
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t* uri_handler)
+{
+	return ESP_FAIL;
+}
+
+
+esp_err_t httpd_resp_set_type(httpd_req_t* r, const char* type)
+{
+	return ESP_FAIL;
+}
+
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t* r, const char* field, const char* value)
+{
+	return ESP_FAIL;
+}
+
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t* r, const char* buf, ssize_t buf_len)
+{
+	return ESP_FAIL;
+}
+
+
+esp_err_t httpd_resp_send_err(httpd_req_t* req, httpd_err_code_t error, const char* msg)
+{
+	return ESP_FAIL;
+}
+
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* r, char* buf, size_t buf_len)
+{
+	return ESP_ERR_NOT_FOUND;
+}
+
+
+int httpd_req_recv(httpd_req_t* r, char* buf, size_t buf_len)
+{
+	return -1;
+}
+
+
+
+//
+// FreeRTOS
+//
+
+// The GUI's background save tasks can't run without threads.  They fail as they do on
+// the device when memory is short.
+BaseType_t xTaskCreate(TaskFunction_t fcn, const char* name, uint32_t stack, void* arg, UBaseType_t priority, TaskHandle_t* handleP)
+{
+	ESP_LOGW(TAG, "No tasks in the simulator - %s not started", name);
+	return pdFAIL;
+}
+
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fcn, const char* name, uint32_t stack, void* arg, UBaseType_t priority, TaskHandle_t* handleP, BaseType_t core)
+{
+	return xTaskCreate(fcn, name, stack, arg, priority, handleP);
+}
+
+
+void vTaskDelete(TaskHandle_t task)
+{
+	ESP_LOGE(TAG, "Task deleted - exiting");
+	exit(1);
+}
+
+
+void vTaskDelay(TickType_t ticks)
+{
+	sim_skip_usec((int64_t) ticks * portTICK_PERIOD_MS * 1000);
+}
+
+
+// Everything runs as gui_task
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return &gui_task_obj;
+}
+
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t) (esp_timer_get_time() / (portTICK_PERIOD_MS * 1000));
+}
+
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+	if (task == NULL) return pdFAIL;
+	
+	switch (action) {
+		case eSetBits:
+			task->notify_val |= value;
+			break;
+		case eIncrement:
+			task->notify_val += 1;
+			break;
+		case eSetValueWithOverwrite:
+		case eSetValueWithoutOverwrite:
+			task->notify_val = value;
+			break;
+		default:
+			break;
+	}
+	
+	return pdPASS;
+}
+
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t* woken)
+{
+	return xTaskNotify(task, value, action);
+}
+
+
+// Never waits: the main loop owns the notifications
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t* valueP, TickType_t ticks)
+{
+	uint32_t val = sim_take_notifications();
+	
+	if (valueP != NULL) *valueP = val;
+	return (val != 0) ? pdTRUE : pdFALSE;
+}
+
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+	return sim_take_notifications();
+}
+
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	return xTaskNotify(task, 0, eIncrement);
+}
+
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken)
+{
+	(void) xTaskNotify(task, 0, eIncrement);
+}
+
+
+// With one thread a mutex is never held by someone else
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	struct sim_sem* sP = calloc(1, sizeof(struct sim_sem));
+	
+	if (sP != NULL) sP->count = 1;
+	return sP;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return calloc(1, sizeof(struct sim_sem));
+}
+
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+	if (sem->count == 0) return pdFALSE;
+	
+	sem->count -= 1;
+	return pdTRUE;
+}
+
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+	if (sem->count != 0) return pdFALSE;
+	
+	sem->count = 1;
+	return pdTRUE;
+}
+
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size)
+{
+	struct sim_queue* qP = calloc(1, sizeof(struct sim_queue));
+	
+	if (qP == NULL) return NULL;
+	qP->bufP = malloc(len * item_size);
+	if (qP->bufP == NULL) {
+		free(qP);
+		return NULL;
+	}
+	qP->len = len;
+	qP->item_size = item_size;
+	
+	return qP;
+}
+
+
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t ticks)
+{
+	if (q->num == q->len) return pdFALSE;
+	
+	memcpy(q->bufP + ((q->head + q->num) % q->len) * q->item_size, item, q->item_size);
+	q->num += 1;
+	return pdTRUE;
+}
+
+
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void* item, BaseType_t* woken)
+{
+	return xQueueSend(q, item, 0);
+}
+
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks)
+{
+	if (q->num == 0) return pdFALSE;
+	
+	memcpy(item, q->bufP + q->head * q->item_size, q->item_size);
+	q->head = (q->head + 1) % q->len;
+	q->num -= 1;
+	return pdTRUE;
+}
+
+
+BaseType_t xQueueReset(QueueHandle_t q)
+{
+	q->head = 0;
+	q->num = 0;
+	return pdPASS;
+}
+
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+	return q->num;
+}
+
+
+
+//
+// Internal functions
+//
+static int64_t _sim_host_usec()
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// Without a bundle gui_assets falls back as it does on a unit with an erased partition
+static void _sim_load_assets()
+{
+	FILE* fp;
+	long len;
+	
+	fp = fopen(GUI_SIM_ASSETS_FILE, "rb");
+	if (fp == NULL) {
+		ESP_LOGW(TAG, "No asset bundle %s", GUI_SIM_ASSETS_FILE);
+		return;
+	}
+	
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	
+	assets_bufP = malloc(len);
+	if ((assets_bufP == NULL) || (fread(assets_bufP, 1, len, fp) != (size_t) len)) {
+		ESP_LOGE(TAG, "Read %s failed", GUI_SIM_ASSETS_FILE);
+		free(assets_bufP);
+		assets_bufP = NULL;
+	} else {
+		assets_part.type = ESP_PARTITION_TYPE_DATA;
+		assets_part.subtype = GUI_ASSETS_PARTITION_SUBTYPE;
+		assets_part.size = (uint32_t) len;
+		strcpy(assets_part.label, GUI_ASSETS_PARTITION_NAME);
+	}
+	fclose(fp);
+}
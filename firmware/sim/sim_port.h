@@ -0,0 +1,44 @@
+/*
+ * Simulator port
+ *
+ * Host implementations of the ESP-IDF and FreeRTOS services the GUI uses (see the shims
+ * in include/).  Time is a virtual clock that runs with the host clock while the GUI
+ * works and is stepped forward over the waits the GUI task would sleep through so a run
+ * takes only as long as the rendering it measures.  There is a single thread: timers run
+ * from the main loop and task notifications are collected for it.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SIM_PORT_H
+#define SIM_PORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+//
+// API
+//
+void sim_port_init(int log_level);
+void sim_set_log_level(int log_level);
+void sim_skip_usec(int64_t usec);
+int64_t sim_next_timer_usec();
+void sim_run_timers();
+uint32_t sim_take_notifications();
+
+#endif /* SIM_PORT_H */
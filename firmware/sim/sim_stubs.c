@@ -0,0 +1,305 @@
+/*
+ * Simulator stubs
+ *
+ * The parts of the firmware the GUI calls that aren't built for the simulator.  The
+ * vehicle supports every data broker item so every tile is shown (gui_bench supplies the
+ * values), the interface is an idle ELM327 and the radios are off.  Configuration comes
+ * from defaults and is never saved.
+ *
+ * Copyright 2025 Dan Julio
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "Buzzer.h"
+#include "can_manager.h"
+#include "can_task.h"
+#include "data_broker.h"
+#include "gui_task.h"
+#include "log_summary.h"
+#include "mon_task.h"
+#include "ps_utilities.h"
+#include "vehicle_manager.h"
+#include "wifi_utilities.h"
+#include <string.h>
+
+
+
+//
+// Simulator stubs variables
+//
+TaskHandle_t task_handle_gui;
+
+static main_config_t main_config = {
+	.bl_percent = 100,
+	.config_flags = 0,
+	.connection_index = 0,
+	.start_tile_index = -1,
+	.vehicle_name = "Simulator"
+};
+static net_config_t net_config;
+static ble_config_t ble_config;
+static run_history_t run_history;
+static tune_config_t tune_config;
+
+
+
+//
+// Vehicle manager
+//
+int vm_get_num_vehicles()
+{
+	return 1;
+}
+
+
+const char* vm_get_vehicle_name(int n)
+{
+	return (n == 0) ? main_config.vehicle_name : NULL;
+}
+
+
+void vm_forget_identified_vehicle()
+{
+}
+
+
+db_mask_t vm_get_supported_item_mask()
+{
+	db_mask_t mask = 0;
+	
+	for (int i=1; i<DB_NUM_ITEMS; i++) {
+		mask |= DB_MASK(i);
+	}
+	
+	return mask;
+}
+
+
+void vm_get_request_health(int* num_req, int* num_backoff)
+{
+	*num_req = 0;
+	*num_backoff = 0;
+}
+
+
+bool vm_get_request_stats(int n, vm_req_stats_t* statsP)
+{
+	return false;
+}
+
+
+uint32_t vm_get_latency_percentile(const vm_req_stats_t* statsP, int percent)
+{
+	return 0;
+}
+
+
+void vm_set_request_item_mask(db_mask_t mask)
+{
+}
+
+
+void vm_set_request_prefetch_mask(db_mask_t mask)
+{
+}
+
+
+void vm_set_request_background_mask(db_mask_t mask)
+{
+}
+
+
+void vm_set_request_goals(const vm_goal_list_t* listP)
+{
+}
+
+
+int vm_get_cadence_msec(db_mask_t mask)
+{
+	return 0;
+}
+
+
+void vm_set_request_profile(int profile)
+{
+}
+
+
+bool vm_is_asleep()
+{
+	return false;
+}
+
+
+
+//
+// CAN manager and task
+//
+int can_get_num_interfaces()
+{
+	return 1;
+}
+
+
+const char* can_get_interface_name(int n)
+{
+	return (n == 0) ? "Simulator" : NULL;
+}
+
+
+bool can_characterize_interface()
+{
+	return false;
+}
+
+
+bool can_interface_characterizing()
+{
+	return false;
+}
+
+
+bool can_interface_hot_swappable(int if_type)
+{
+	return false;
+}
+
+
+bool can_connected()
+{
+	return true;
+}
+
+
+void can_task_set_bench_mode(bool en)
+{
+}
+
+
+void can_task_reconfigure()
+{
+}
+
+
+
+//
+// Persistent storage
+//
+bool ps_get_config(int index, void** cfg)
+{
+	switch (index) {
+		case PS_CONFIG_TYPE_MAIN:
+			*cfg = &main_config;
+			return true;
+		case PS_CONFIG_TYPE_NET:
+			*cfg = &net_config;
+			return true;
+		case PS_CONFIG_TYPE_BLE:
+			*cfg = &ble_config;
+			return true;
+		case PS_CONFIG_TYPE_RUNS:
+			*cfg = &run_history;
+			return true;
+		case PS_CONFIG_TYPE_TUNE:
+			*cfg = &tune_config;
+			return true;
+		default:
+			return false;
+	}
+}
+
+
+bool ps_save_config(int index)
+{
+	return true;
+}
+
+
+bool ps_flush()
+{
+	return true;
+}
+
+
+
+//
+// System monitor
+//
+int mon_get_core_load(int core)
+{
+	return -1;
+}
+
+
+int mon_get_freq_residency(int mhz)
+{
+	return -1;
+}
+
+
+bool mon_get_min_stack(char* name, uint32_t* hwm)
+{
+	return false;
+}
+
+
+bool mon_get_heap_info(mon_heap_info_t* info)
+{
+	return false;
+}
+
+
+
+//
+// Data log summary
+//
+int log_summary_get_trip()
+{
+	return -1;
+}
+
+
+uint32_t log_summary_get_duration()
+{
+	return 0;
+}
+
+
+bool log_summary_get(int series, uint32_t start_sec, uint32_t span_sec, int num_points, log_sum_point_t* points)
+{
+	memset(points, 0, num_points * sizeof(log_sum_point_t));
+	return false;
+}
+
+
+
+//
+// Radios and board peripherals
+//
+bool wifi_is_enabled()
+{
+	return false;
+}
+
+
+httpd_handle_t wifi_get_http_server()
+{
+	return NULL;
+}
+
+
+void Buzzer_Play(buzzer_seq_t seq)
+{
+}